@@ -0,0 +1,180 @@
+#
+# Supermodel
+# A Sega Model 3 Arcade Emulator.
+# Copyright 2003-2022 The Supermodel Team
+#
+# This file is part of Supermodel.
+#
+# Supermodel is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# Supermodel is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# frame_hash_regression.py
+#
+# Checks that a change does not alter emulation. Each game with a recording
+# in the golden directory (<game>.inp, made with -record-inputs) is replayed
+# headless with -capture-every and -capture-memory, and the CRC-32s of the
+# frames and of RAM, Real3D memory and VRAM logged to <game>_frames.txt are
+# compared with the golden <game>_frames.txt. The first frame that differs is
+# reported for each game.
+#
+# The games are run in parallel, each in its own directory with a copy of the
+# Config directory (found next to the executable or in the current directory),
+# so that their NVRAM and logs are kept apart.
+#
+# Usage:
+#   python frame_hash_regression.py [options] <supermodel> <romdir> <golden>
+#
+# Options:
+#   --frames=<n>        Frames to run each game for [Default: 3600]
+#   --every=<n>         Capture every nth frame [Default: 60]
+#   --jobs=<n>          Games run at once [Default: number of CPUs]
+#   --games=<a,b,...>   Only these games
+#   --no-framebuffer    Compare the memory CRC-32s only, not the frames, which
+#                       depend on the GPU and driver
+#   --update            Write the golden hashes instead of comparing them
+#
+# Options after '--' are passed to Supermodel.
+#
+
+import argparse
+import concurrent.futures
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import xml.etree.ElementTree
+
+class RegressionError(Exception):
+  pass
+
+def find_config_dir(supermodel):
+  # Next to the executable, as distributed, or in the current directory, as
+  # built
+  for dir in [ os.path.dirname(os.path.abspath(supermodel)), os.getcwd() ]:
+    if os.path.exists(os.path.join(dir, "Config", "Games.xml")):
+      return os.path.join(dir, "Config")
+  raise RegressionError("No Config directory found next to %s or in the current directory" % supermodel)
+
+def get_games(config_dir):
+  tree = xml.etree.ElementTree.parse(os.path.join(config_dir, "Games.xml"))
+  return [ game.get("name") for game in tree.getroot().iter("game") ]
+
+def parse_hashes(file):
+  # Each line: frame number, frame CRC-32, then name=CRC-32 fields
+  frames = []
+  with open(file) as fp:
+    for line in fp:
+      fields = line.split()
+      if len(fields) < 2:
+        continue
+      hashes = { "frame": fields[1] }
+      for field in fields[2:]:
+        name, _, value = field.partition("=")
+        hashes[name] = value
+      frames.append((int(fields[0]), hashes))
+  return frames
+
+def compare(golden, result, framebuffer):
+  # Returns a description of the first difference, or None
+  for i in range(min(len(golden), len(result))):
+    golden_frame, golden_hashes = golden[i]
+    frame, hashes = result[i]
+    if frame != golden_frame:
+      return "frame %d captured where frame %d was expected" % (frame, golden_frame)
+    for name in golden_hashes:
+      if name == "frame" and not framebuffer:
+        continue
+      if hashes.get(name) != golden_hashes[name]:
+        return "frame %d: %s is %s, expected %s" % (frame, name, hashes.get(name, "missing"), golden_hashes[name])
+  if len(result) != len(golden):
+    return "%d frames captured, expected %d" % (len(result), len(golden))
+  return None
+
+def run_game(supermodel, config_dir, romdir, golden_dir, game, frames, every, update, framebuffer, options):
+  work_dir = tempfile.mkdtemp(prefix="supermodel_%s_" % game)
+  try:
+    # Supermodel writes its logs to the current directory when there is a
+    # Config directory in it
+    shutil.copytree(config_dir, os.path.join(work_dir, "Config"))
+    log_file = os.path.join(work_dir, "Supermodel.log")
+    command = [ os.path.abspath(supermodel), os.path.abspath(os.path.join(romdir, game + ".zip")), "-headless",
+      "-replay-inputs=" + os.path.abspath(os.path.join(golden_dir, game + ".inp")), "-capture-every=%d" % every,
+      "-capture-memory", "-benchmark=%d" % frames, "-benchmark-report=" + os.path.join(work_dir, "benchmark.txt"),
+      "-log-output=" + log_file ] + options
+    result = subprocess.run(command, cwd=work_dir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    if result.returncode != 0:
+      raise RegressionError("Supermodel failed (exit code %d):\n%s" % (result.returncode, result.stdout.decode(errors="replace")))
+    hash_file = os.path.join(work_dir, game + "_frames.txt")
+    if not os.path.exists(hash_file):
+      raise RegressionError("No frame hashes written (see %s)" % log_file)
+    golden_file = os.path.join(golden_dir, game + "_frames.txt")
+    if update:
+      shutil.copyfile(hash_file, golden_file)
+      return None
+    if not os.path.exists(golden_file):
+      raise RegressionError("No golden hashes in %s (run with --update)" % golden_file)
+    return compare(parse_hashes(golden_file), parse_hashes(hash_file), framebuffer)
+  finally:
+    shutil.rmtree(work_dir, ignore_errors=True)
+
+def regression(supermodel, romdir, golden_dir, games, frames, every, jobs, update, framebuffer, options):
+  config_dir = find_config_dir(supermodel)
+  if games is None:
+    games = get_games(config_dir)
+  games = [ game for game in games if os.path.exists(os.path.join(romdir, game + ".zip")) and os.path.exists(os.path.join(golden_dir, game + ".inp")) ]
+  if len(games) == 0:
+    raise RegressionError("No games with both a ROM set in %s and a recording in %s" % (romdir, golden_dir))
+
+  failed = 0
+  with concurrent.futures.ThreadPoolExecutor(max_workers=jobs) as executor:
+    futures = { executor.submit(run_game, supermodel, config_dir, romdir, golden_dir, game, frames, every, update, framebuffer, options): game for game in games }
+    for future in concurrent.futures.as_completed(futures):
+      game = futures[future]
+      try:
+        difference = future.result()
+      except RegressionError as e:
+        difference = str(e)
+      if difference is None:
+        print("%-12s %s" % (game, "updated" if update else "ok"))
+      else:
+        print("%-12s FAILED: %s" % (game, difference))
+        failed += 1
+  print("")
+  print("%d of %d games %s" % (len(games) - failed, len(games), "updated" if update else "passed"))
+  return failed == 0
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("supermodel", metavar="supermodel", type=str, help="Supermodel executable")
+  parser.add_argument("romdir", metavar="romdir", type=str, help="Directory of ROM sets")
+  parser.add_argument("golden", metavar="golden", type=str, help="Directory of recordings and golden hashes")
+  parser.add_argument("options", metavar="options", type=str, nargs="*", help="Options passed to Supermodel (after '--')")
+  parser.add_argument("--frames", metavar="n", type=int, default=3600, action="store", help="Frames to run each game for")
+  parser.add_argument("--every", metavar="n", type=int, default=60, action="store", help="Capture every nth frame")
+  parser.add_argument("--jobs", metavar="n", type=int, default=os.cpu_count(), action="store", help="Games run at once")
+  parser.add_argument("--games", metavar="list", type=str, action="store", help="Comma-separated list of games to run")
+  parser.add_argument("--no-framebuffer", action="store_true", help="Compare the memory CRC-32s only, not the frames")
+  parser.add_argument("--update", action="store_true", help="Write the golden hashes instead of comparing them")
+  options = parser.parse_args()
+
+  try:
+    games = options.games.split(",") if options.games else None
+    passed = regression(supermodel=options.supermodel, romdir=options.romdir, golden_dir=options.golden, games=games, frames=options.frames,
+      every=options.every, jobs=options.jobs, update=options.update, framebuffer=not options.no_framebuffer, options=options.options)
+  except RegressionError as e:
+    print("Error: %s" % str(e))
+    sys.exit(1)
+  sys.exit(0 if passed else 1)
@@ -0,0 +1,201 @@
+#
+# Supermodel
+# A Sega Model 3 Arcade Emulator.
+# Copyright 2003-2022 The Supermodel Team
+#
+# This file is part of Supermodel.
+#
+# Supermodel is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# Supermodel is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# pgo_training.py
+#
+# Training workload for profile-guided optimization, used by the 'pgo' make
+# target and VS2008/Build.PGO.bat.
+#
+#   train     Runs an instrumented build on each game of the training set,
+#             headless and unthrottled, for a fixed number of frames, so that
+#             it writes its profile on exit. Games with a recording in the
+#             recordings directory (<game>.inp, made with -record-inputs)
+#             replay it, so that gameplay is profiled rather than attract mode.
+#   compare   Runs a baseline and an optimized build the same way and prints
+#             the frame rates and per-subsystem frame times of each, from their
+#             -benchmark reports, and the speedup as JSON.
+#
+# The training set covers each Model 3 step and the PowerPC, 68K, SCSP and
+# DSB paths; games whose ROM sets are missing are skipped.
+#
+# Usage:
+#   python pgo_training.py train [options] <supermodel> <romdir> [-- <options>]
+#   python pgo_training.py compare [options] <baseline> <supermodel> <romdir> [-- <options>]
+#
+# Options:
+#   --frames=<n>        Frames to run each game for [Default: 3600]
+#   --profile-dir=<dir> With train: directory the profile is written to, which
+#                       is emptied first
+#   --llvm-profdata=<tool>
+#                       With train: merge Clang's raw profiles in the profile
+#                       directory into supermodel.profdata with this tool
+#   --recordings=<dir>  Directory of recordings to replay
+#   --games=<a,b,...>   Games to run instead of the training set
+#   --runs=<n>          With compare: runs of each build, of which the median
+#                       frame rate is reported [Default: 3]
+#   --output=<file>     With compare: write the JSON report to file
+#
+# Options after '--' are passed to Supermodel.
+#
+
+import argparse
+import json
+import math
+import glob
+import os
+import shlex
+import shutil
+import subprocess
+import sys
+import tempfile
+
+TRAINING_SET = [
+  "vf3",        # Step 1.0
+  "bassdx",
+  "scud",       # Step 1.5, DSB
+  "lostwsga",
+  "srally2",    # Step 2.0
+  "harley",
+  "von2",
+  "daytona2",   # Step 2.1
+  "spikeout",
+  "lemans24",
+  "oceanhun",
+  "swtrilgy"
+]
+
+SUBSYSTEMS = [ "ppc", "render", "sound", "drive", "total" ]
+
+class TrainingError(Exception):
+  pass
+
+def run_game(supermodel, romdir, recordings, game, frames, work_dir, options):
+  # Returns the -benchmark report
+  report_file = os.path.join(work_dir, game + "_benchmark.json")
+  command = [ os.path.abspath(supermodel), os.path.abspath(os.path.join(romdir, game + ".zip")), "-headless", "-benchmark=%d" % frames,
+    "-benchmark-no-present", "-benchmark-report=" + report_file, "-log-output=" + os.path.join(work_dir, game + ".log") ]
+  if recordings is not None and os.path.exists(os.path.join(recordings, game + ".inp")):
+    command.append("-replay-inputs=" + os.path.abspath(os.path.join(recordings, game + ".inp")))
+  result = subprocess.run(command + options, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+  if result.returncode != 0:
+    raise TrainingError("Supermodel failed on %s (exit code %d):\n%s" % (game, result.returncode, result.stdout.decode(errors="replace")))
+  with open(report_file) as fp:
+    return json.load(fp)
+
+def get_games(romdir, games):
+  games = [ game for game in (games or TRAINING_SET) if os.path.exists(os.path.join(romdir, game + ".zip")) ]
+  if len(games) == 0:
+    raise TrainingError("None of the games are in %s" % romdir)
+  return games
+
+def train(supermodel, romdir, recordings, games, frames, profile_dir, llvm_profdata, options):
+  games = get_games(romdir, games)
+  if profile_dir is not None:
+    # Profiles accumulate over runs, so those of an earlier build must go
+    shutil.rmtree(profile_dir, ignore_errors=True)
+    os.makedirs(profile_dir)
+  work_dir = tempfile.mkdtemp(prefix="supermodel_pgo_")
+  try:
+    for game in games:
+      report = run_game(supermodel, romdir, recordings, game, frames, work_dir, options)
+      print("Trained on %-10s %d frames at %1.1f fps" % (game, report["frames"], report["fps"]))
+  finally:
+    shutil.rmtree(work_dir, ignore_errors=True)
+  if llvm_profdata is not None:
+    raw_profiles = glob.glob(os.path.join(profile_dir or ".", "*.profraw"))
+    if len(raw_profiles) == 0:
+      raise TrainingError("No raw profiles written to %s" % (profile_dir or "."))
+    command = shlex.split(llvm_profdata) + [ "merge", "-o", os.path.join(profile_dir or ".", "supermodel.profdata") ] + raw_profiles
+    if subprocess.run(command).returncode != 0:
+      raise TrainingError("Unable to merge the raw profiles")
+
+def summarize(reports):
+  # Median run by frame rate
+  report = sorted(reports, key=lambda report: report["fps"])[len(reports) // 2]
+  summary = { "fps": report["fps"], "pgo": report.get("pgo", "none") }
+  for name in SUBSYSTEMS:
+    summary[name] = report["timings"][name]["mean"]
+  return summary
+
+def compare(baseline, supermodel, romdir, recordings, games, frames, runs, output, options):
+  work_dir = tempfile.mkdtemp(prefix="supermodel_pgo_")
+  results = []
+  for game in get_games(romdir, games):
+    # Alternate the builds, so that both see the same thermal conditions
+    baseline_reports = []
+    reports = []
+    try:
+      for i in range(runs):
+        baseline_reports.append(run_game(baseline, romdir, recordings, game, frames, work_dir, options))
+        reports.append(run_game(supermodel, romdir, recordings, game, frames, work_dir, options))
+    finally:
+      shutil.rmtree(work_dir, ignore_errors=True)
+      os.makedirs(work_dir, exist_ok=True)
+    result = { "game": game, "baseline": summarize(baseline_reports), "optimized": summarize(reports) }
+    result["speedup"] = result["optimized"]["fps"] / result["baseline"]["fps"] if result["baseline"]["fps"] > 0 else 0.0
+    results.append(result)
+    print("%-10s %7.1f fps -> %7.1f fps (%+1.1f%%)" % (game, result["baseline"]["fps"], result["optimized"]["fps"], (result["speedup"] - 1) * 100), file=sys.stderr)
+
+  speedups = [ result["speedup"] for result in results if result["speedup"] > 0 ]
+  report = {
+    "frames": frames,
+    "runs": runs,
+    "games": results,
+    "geomeanSpeedup": math.exp(sum(math.log(speedup) for speedup in speedups) / len(speedups)) if speedups else 0.0
+  }
+  shutil.rmtree(work_dir, ignore_errors=True)
+  text = json.dumps(report, indent=2)
+  if output:
+    with open(output, "w") as fp:
+      fp.write(text + "\n")
+  print(text)
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  subparsers = parser.add_subparsers(dest="command", required=True)
+  train_parser = subparsers.add_parser("train", help="Run an instrumented build on the training set")
+  compare_parser = subparsers.add_parser("compare", help="Compare the frame rates of two builds")
+  compare_parser.add_argument("baseline", metavar="baseline", type=str, help="Supermodel executable built without profile")
+  for subparser in [ train_parser, compare_parser ]:
+    subparser.add_argument("supermodel", metavar="supermodel", type=str, help="Supermodel executable")
+    subparser.add_argument("romdir", metavar="romdir", type=str, help="Directory of ROM sets")
+    subparser.add_argument("options", metavar="options", type=str, nargs="*", help="Options passed to Supermodel (after '--')")
+    subparser.add_argument("--frames", metavar="n", type=int, default=3600, action="store", help="Frames to run each game for")
+    subparser.add_argument("--recordings", metavar="dir", type=str, action="store", help="Directory of recordings to replay")
+    subparser.add_argument("--games", metavar="list", type=str, action="store", help="Comma-separated list of games instead of the training set")
+  train_parser.add_argument("--profile-dir", metavar="dir", type=str, action="store", help="Directory the profile is written to, emptied first")
+  train_parser.add_argument("--llvm-profdata", metavar="tool", type=str, action="store", help="Merge Clang's raw profiles with this tool")
+  compare_parser.add_argument("--runs", metavar="n", type=int, default=3, action="store", help="Runs of each build")
+  compare_parser.add_argument("--output", metavar="file", type=str, action="store", help="Write the JSON report to file")
+  options = parser.parse_args()
+
+  try:
+    games = options.games.split(",") if options.games else None
+    if options.command == "train":
+      train(supermodel=options.supermodel, romdir=options.romdir, recordings=options.recordings, games=games, frames=options.frames,
+        profile_dir=options.profile_dir, llvm_profdata=options.llvm_profdata, options=options.options)
+    else:
+      compare(baseline=options.baseline, supermodel=options.supermodel, romdir=options.romdir, recordings=options.recordings, games=games,
+        frames=options.frames, runs=options.runs, output=options.output, options=options.options)
+  except TrainingError as e:
+    print("Error: %s" % str(e))
+    sys.exit(1)
@@ -0,0 +1,133 @@
+#
+# Supermodel
+# A Sega Model 3 Arcade Emulator.
+# Copyright 2003-2022 The Supermodel Team
+#
+# This file is part of Supermodel.
+#
+# Supermodel is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# Supermodel is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+# more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# startup_benchmark.py
+#
+# Measures startup time. Runs Supermodel on a ROM set several times with
+# -startup-profile, quitting after the first frame, and prints the median time
+# taken by each phase of startup, for cold and warm starts:
+#
+#   - Cold: an empty ROM cache directory (so the ROM set is decoded and the
+#     game definitions parsed) and, with --drop-caches, the operating system's
+#     file cache dropped first (Linux only, needs root).
+#   - Warm: the ROM cache directory filled by the previous run and the files
+#     still in the operating system's file cache.
+#
+# Usage:
+#   python startup_benchmark.py [--runs=5] [--drop-caches] <supermodel> <romset> [-- <options>]
+#
+# Options after '--' are passed to Supermodel (e.g., -no-threads).
+#
+
+import argparse
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+
+class BenchmarkError(Exception):
+  pass
+
+def drop_caches():
+  subprocess.run("sync", shell=True)
+  with open("/proc/sys/vm/drop_caches", "w") as fp:
+    fp.write("3\n")
+
+def run_once(supermodel, romset, rom_cache_dir, log_file, options):
+  if os.path.exists(log_file):
+    os.remove(log_file)
+  command = [ supermodel, romset, "-startup-profile", "-benchmark=1", "-benchmark-no-present", "-rom-cache=" + rom_cache_dir, "-log-output=" + log_file ] + options
+  result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+  if result.returncode != 0:
+    raise BenchmarkError("Supermodel failed (exit code %d):\n%s" % (result.returncode, result.stdout.decode(errors="replace")))
+  return parse_profile(log_file)
+
+def parse_profile(log_file):
+  # Phase lines follow the heading: time since start, time taken, phase name
+  phases = []
+  in_profile = False
+  with open(log_file) as fp:
+    for line in fp:
+      if "Startup profile" in line:
+        in_profile = True
+        phases = []
+        continue
+      if in_profile:
+        match = re.match(r"\[Info\]\s+([0-9.]+)\s+([0-9.]+)\s+(.+)$", line)
+        if not match:
+          in_profile = False
+          continue
+        phases.append((match.group(3).strip(), float(match.group(1)), float(match.group(2))))
+  if len(phases) == 0:
+    raise BenchmarkError("No startup profile found in %s" % log_file)
+  return phases
+
+def print_summary(title, runs):
+  print("%s (median of %d runs, ms):" % (title, len(runs)))
+  print("  %10s %10s  %s" % ("End", "Taken", "Phase"))
+  for i in range(len(runs[0])):
+    name = runs[0][i][0]
+    end = statistics.median([ run[i][1] for run in runs ])
+    taken = statistics.median([ run[i][2] for run in runs ])
+    print("  %10.1f %10.1f  %s" % (end, taken, name))
+  print("")
+
+def benchmark(supermodel, romset, runs, cold_drop_caches, options):
+  work_dir = tempfile.mkdtemp(prefix="supermodel_startup_")
+  try:
+    log_file = os.path.join(work_dir, "Supermodel.log")
+    rom_cache_dir = os.path.join(work_dir, "ROMCache")
+    cold = []
+    warm = []
+    for i in range(runs):
+      # Cold start from an empty ROM cache, which the run fills for the warm
+      # start after it
+      shutil.rmtree(rom_cache_dir, ignore_errors=True)
+      os.makedirs(rom_cache_dir)
+      if cold_drop_caches:
+        drop_caches()
+      cold.append(run_once(supermodel, romset, rom_cache_dir, log_file, options))
+      warm.append(run_once(supermodel, romset, rom_cache_dir, log_file, options))
+      print("Run %d/%d: cold %1.1f ms, warm %1.1f ms" % (i + 1, runs, cold[-1][-1][1], warm[-1][-1][1]))
+    print("")
+    print_summary("Cold start", cold)
+    print_summary("Warm start", warm)
+  finally:
+    shutil.rmtree(work_dir, ignore_errors=True)
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("supermodel", metavar="supermodel", type=str, help="Supermodel executable")
+  parser.add_argument("romset", metavar="romset", type=str, help="ROM set to start")
+  parser.add_argument("options", metavar="options", type=str, nargs="*", help="Options passed to Supermodel (after '--')")
+  parser.add_argument("--runs", metavar="n", type=int, default=5, action="store", help="Number of cold and warm starts")
+  parser.add_argument("--drop-caches", action="store_true", help="Drop the operating system's file cache before each cold start (Linux only, needs root)")
+  options = parser.parse_args()
+
+  try:
+    benchmark(supermodel=options.supermodel, romset=options.romset, runs=options.runs, cold_drop_caches=options.drop_caches, options=options.options)
+  except BenchmarkError as e:
+    print("Error: %s" % str(e))
+    sys.exit(1)
@@ -0,0 +1,411 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Bench_Kernels.cpp
+ *
+ * Micro-benchmarks of emulator kernels in isolation, on synthetic data, for
+ * before and after numbers on optimizations of them. Each benchmark is run
+ * repeatedly for at least the given time and the fastest of several runs is
+ * reported, as JSON on stdout:
+ *
+ *    Bench_Kernels [-filter=<substring>] [-time=<seconds>] [-runs=<n>]
+ *
+ * Only kernels that build without the OS layer, OpenGL or a ROM set are
+ * covered: byte swapping, block files, config lookups, the security board
+ * decryption, the SCSP DSP and the PowerPC core (see also Test_Lockstep for the latter). The
+ * tile generator, Real3D and sound slot renderers need a running emulator and
+ * are measured by the whole-game benchmark instead.
+ */
+
+#include "CPU/PowerPC/ppc.h"
+#include "CPU/Bus.h"
+#include "Model3/Crypto.h"
+#include "Sound/SCSPDSP.h"
+#include "Util/ByteSwap.h"
+#include "Util/Format.h"
+#include "Util/NewConfig.h"
+#include "BlockFile.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+void DebugLog(const char *fmt, ...)
+{
+}
+
+void InfoLog(const char *fmt, ...)
+{
+}
+
+bool ErrorLog(const char *fmt, ...)
+{
+  va_list vl;
+  va_start(vl, fmt);
+  vfprintf(stderr, fmt, vl);
+  va_end(vl);
+  fputc('\n', stderr);
+  return FAIL;
+}
+
+struct Options
+{
+  std::string filter;
+  double      seconds = 0.25;
+  int         runs = 5;
+};
+
+// A benchmark does one unit of work per call and returns the number of items
+// (bytes, samples, instructions) it processed
+struct Benchmark
+{
+  const char  *name;
+  const char  *unit;
+  std::function<UINT64()> run;
+};
+
+struct Result
+{
+  UINT64  calls;
+  UINT64  items;
+  double  seconds;
+};
+
+static void Fill(std::vector<UINT8> *data, UINT32 seed)
+{
+  // Half random, half runs of repeated bytes, so compression has something to do
+  for (size_t i = 0; i < data->size(); i++)
+  {
+    seed = seed * 1664525 + 1013904223;
+    (*data)[i] = (i & 0x10000) ? UINT8(seed >> 24) : UINT8(i >> 9);
+  }
+}
+
+static Result Measure(const Benchmark &bench, const Options &opts)
+{
+  Result best = { 0, 0, 0 };
+  for (int run = 0; run < opts.runs; run++)
+  {
+    Result r = { 0, 0, 0 };
+    auto start = std::chrono::steady_clock::now();
+    do
+    {
+      r.items += bench.run();
+      r.calls++;
+      r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (r.seconds < opts.seconds);
+    if (run == 0 || r.items / r.seconds > best.items / best.seconds)
+      best = r;
+  }
+  return best;
+}
+
+
+/******************************************************************************
+ Kernels
+******************************************************************************/
+
+static std::vector<UINT8> s_src(8 * 1024 * 1024), s_dest(8 * 1024 * 1024);
+
+static void AddByteSwapBenchmarks(std::vector<Benchmark> *benches)
+{
+  Fill(&s_src, 1);
+  benches->push_back({ "FlipEndian16", "bytes", [] { Util::FlipEndian16(s_dest.data(), s_dest.size()); return UINT64(s_dest.size()); } });
+  benches->push_back({ "FlipEndian32", "bytes", [] { Util::FlipEndian32(s_dest.data(), s_dest.size()); return UINT64(s_dest.size()); } });
+  benches->push_back({ "CopyFlipEndian16", "bytes", [] { Util::CopyFlipEndian16(s_dest.data(), s_src.data(), s_src.size()); return UINT64(s_src.size()); } });
+  benches->push_back({ "CopyFlipEndian32", "bytes", [] { Util::CopyFlipEndian32(s_dest.data(), s_src.data(), s_src.size()); return UINT64(s_src.size()); } });
+}
+
+static void AddBlockFileBenchmarks(std::vector<Benchmark> *benches)
+{
+  static std::vector<uint8_t> buffer;
+
+  // Laid out like a save state: a few large memory blocks and small ones
+  auto write = []
+  {
+    CBlockFile file;
+    file.Create(&buffer, "Benchmark", "Bench_Kernels");
+    UINT64 bytes = 0;
+    for (int i = 0; i < 64; i++)
+    {
+      UINT32 size = (i % 16 == 0) ? 1024 * 1024 : 256;
+      file.NewBlock("Block " + std::to_string(i), "");
+      file.Write(&s_src[i * 4096], size);
+      bytes += size;
+    }
+    file.Close();
+    return bytes;
+  };
+  write();
+
+  benches->push_back({ "CBlockFile write", "bytes", write });
+  benches->push_back({ "CBlockFile read", "bytes", []
+  {
+    CBlockFile file;
+    file.Load(&buffer);
+    UINT64 bytes = 0;
+    for (int i = 0; i < 64; i++)
+    {
+      UINT32 size = (i % 16 == 0) ? 1024 * 1024 : 256;
+      if (OKAY == file.FindBlock("Block " + std::to_string(i)))
+        bytes += file.Read(s_dest.data(), size);
+    }
+    file.Close();
+    return bytes;
+  } });
+  benches->push_back({ "CBlockFile save (level 1)", "bytes", []
+  {
+    const std::string path = "Bench_Kernels.tmp";
+    CBlockFile::Save(path, buffer, 1);
+    remove(path.c_str());
+    return UINT64(buffer.size());
+  } });
+}
+
+// A setting read every frame, looked up by name in a node with 100 others
+// and through a cached value
+static void AddConfigBenchmarks(std::vector<Benchmark> *benches)
+{
+  static Util::Config::Node config("global");
+  for (int i = 0; i < 100; i++)
+    config.Set(Util::Format() << "Setting" << i, i);
+  config.Set("PowerPCFrequency", "50");
+  static Util::Config::CachedValue<unsigned> frequency(config, "PowerPCFrequency");
+
+  benches->push_back({ "Config lookup", "lookups", []
+  {
+    unsigned sum = 0;
+    for (int i = 0; i < 1024; i++)
+      sum += config["PowerPCFrequency"].ValueAs<unsigned>();
+    s_dest[0] = UINT8(sum);
+    return UINT64(1024);
+  } });
+  benches->push_back({ "CachedValue::Get", "lookups", []
+  {
+    unsigned sum = 0;
+    for (int i = 0; i < 1024; i++)
+      sum += frequency.Get();
+    s_dest[0] = UINT8(sum);
+    return UINT64(1024);
+  } });
+}
+
+static void AddCryptoBenchmarks(std::vector<Benchmark> *benches)
+{
+  static CCrypto crypto;
+  static std::vector<UINT16> ram(0x100000);
+  for (size_t i = 0; i < ram.size(); i++)
+    ram[i] = UINT16(i * 0x9E37);
+  crypto.Init(0x29290f17, [](uint32_t addr) { return ram[addr & 0xFFFFF]; });
+  crypto.Reset();
+
+  benches->push_back({ "CCrypto::Decrypt", "words", []
+  {
+    crypto.SetAddressLow(0);
+    crypto.SetAddressHigh(0);
+    crypto.SetSubKey(0x1234);
+    UINT8 *base;
+    UINT32 sum = 0;
+    for (int i = 0; i < 4096; i++)
+      sum += crypto.Decrypt(&base);
+    s_dest[0] = UINT8(sum);
+    return UINT64(4096);
+  } });
+}
+
+static void AddSCSPDSPBenchmarks(std::vector<Benchmark> *benches)
+{
+  static _SCSPDSP dsp;
+  static std::vector<UINT16> ram(256 * 1024);
+  SCSPDSP_Init(&dsp);
+  dsp.SCSPRAM = ram.data();
+  dsp.SCSPRAM_LENGTH = UINT32(ram.size());
+  dsp.RBL = 32 * 1024;
+
+  // A full length program of pseudo-random steps, kept to valid inputs
+  UINT32 seed = 7;
+  for (int i = 0; i < 128 * 4; i++)
+  {
+    seed = seed * 1664525 + 1013904223;
+    dsp.MPRO[i] = UINT16(seed >> 16);
+  }
+  for (int i = 0; i < 128; i++)
+    dsp.MPRO[i * 4 + 1] &= ~(0x20 << 6);  // IRA within MEMS
+  for (int i = 0; i < 64; i++)
+    dsp.COEF[i] = INT16(i * 517);
+  for (int i = 0; i < 32; i++)
+    dsp.MADRS[i] = UINT16(i * 301);
+  SCSPDSP_Start(&dsp);
+
+  benches->push_back({ "SCSPDSP_Step", "samples", []
+  {
+    for (int i = 0; i < 1024; i++)
+    {
+      SCSPDSP_SetSample(&dsp, (i * 37) & 0xFFFF, i & 15, 0);
+      SCSPDSP_Step(&dsp);
+    }
+    return UINT64(1024);
+  } });
+}
+
+class CPPCBenchBus: public IBus
+{
+public:
+  std::vector<UINT8> ram;   // 32-bit words in host order, as CModel3 has them
+  std::vector<UINT8> crom;  // at 0xFF800000
+
+  UINT8 *Ptr(UINT32 addr)
+  {
+    if (addr < 0x800000)
+      return &ram[addr];
+    if (addr >= 0xFF800000)
+      return &crom[addr & 0x7FFFFF];
+    return NULL;
+  }
+
+  UINT8 Read8(UINT32 addr)    { return Ptr(addr) ? Ptr(addr ^ 3)[0] : 0xFF; }
+  UINT16 Read16(UINT32 addr)  { return Ptr(addr) ? *(UINT16 *) Ptr(addr ^ 2) : 0xFFFF; }
+  UINT32 Read32(UINT32 addr)  { return Ptr(addr) ? *(UINT32 *) Ptr(addr) : 0xFFFFFFFF; }
+  UINT64 Read64(UINT32 addr)  { return ((UINT64) Read32(addr) << 32) | Read32(addr + 4); }
+  void Write8(UINT32 addr, UINT8 data)    { if (addr < 0x800000) ram[addr ^ 3] = data; }
+  void Write16(UINT32 addr, UINT16 data)  { if (addr < 0x800000) *(UINT16 *) &ram[addr ^ 2] = data; }
+  void Write32(UINT32 addr, UINT32 data)  { if (addr < 0x800000) *(UINT32 *) &ram[addr] = data; }
+  void Write64(UINT32 addr, UINT64 data)  { Write32(addr, UINT32(data >> 32)); Write32(addr + 4, UINT32(data)); }
+
+  CPPCBenchBus(void)
+    : ram(0x800000, 0),
+      crom(0x800000, 0)
+  {
+  }
+};
+
+static void AddPPCBenchmark(std::vector<Benchmark> *benches, const char *name, PPC_EXEC_MODE mode, bool chaining = true)
+{
+  static CPPCBenchBus bus;
+  static PPC_FETCH_REGION fetch[3];
+
+  // The reset vector branches to a loop in RAM: load, add, store, increment
+  // and branch back
+  static const UINT32 reset[] = { 0x48000102 };
+  static const UINT32 loop[] = { 0x38801000, 0x80A40000, 0x7C632A14, 0x90640004, 0x38C60001, 0x4BFFFFF0 };
+  memcpy(&bus.crom[0x700100], reset, sizeof(reset));
+  memcpy(&bus.ram[0x100], loop, sizeof(loop));
+
+  PPC_CONTEXT *context = ppc_create_context();
+  ppc_set_context(context);
+  PPC_CONFIG config;
+  config.pvr = PPC_MODEL_603R;
+  config.bus_frequency = BUS_FREQUENCY_66MHZ;
+  config.bus_frequency_multiplier = 0x25;
+  ppc_init(&config);
+  ppc_attach_bus(&bus);
+  fetch[0] = { 0x00000000, 0x007FFFFF, (UINT32 *) bus.ram.data() };
+  fetch[1] = { 0xFF800000, 0xFFFFFFFF, (UINT32 *) bus.crom.data() };
+  fetch[2] = { 0, 0, NULL };
+  ppc_set_fetch(fetch);
+  ppc_map_memory(0x00000000, 0x007FFFFF, bus.ram.data(), true);
+  ppc_map_memory(0xFF800000, 0xFFFFFFFF, bus.crom.data(), false);
+  ppc_set_exec_mode(mode);
+  ppc_set_block_chaining(chaining);
+  ppc_set_idle_skip(false);
+  ppc_reset();
+  if (ppc_get_exec_mode() != mode)
+    fprintf(stderr, "%s is not supported on this host and runs as mode %d.\n", name, int(ppc_get_exec_mode()));
+
+  benches->push_back({ name, "instructions", [context]
+  {
+    ppc_set_context(context);
+    ppc_execute(100000);
+    return UINT64(100000);
+  } });
+}
+
+
+/******************************************************************************
+ Main
+******************************************************************************/
+
+static void Help(void)
+{
+  puts("Usage: Bench_Kernels [options]");
+  puts("Options:");
+  puts("  -filter=<text>     Only run benchmarks whose name contains text");
+  puts("  -time=<seconds>    Minimum time of each run [Default: 0.25]");
+  puts("  -runs=<n>          Runs of each benchmark, the fastest is reported [Default: 5]");
+}
+
+int main(int argc, char **argv)
+{
+  Options opts;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string name = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (name == "-filter")
+      opts.filter = value;
+    else if (name == "-time")
+      opts.seconds = std::max(0.001, atof(value.c_str()));
+    else if (name == "-runs")
+      opts.runs = std::max(1, atoi(value.c_str()));
+    else
+    {
+      ErrorLog("Unknown option: %s", arg.c_str());
+      Help();
+      return 1;
+    }
+  }
+
+  std::vector<Benchmark> benches;
+  AddByteSwapBenchmarks(&benches);
+  AddBlockFileBenchmarks(&benches);
+  AddConfigBenchmarks(&benches);
+  AddCryptoBenchmarks(&benches);
+  AddSCSPDSPBenchmarks(&benches);
+  AddPPCBenchmark(&benches, "PowerPC interpreter", PPC_EXEC_INTERPRETER);
+  AddPPCBenchmark(&benches, "PowerPC block cache", PPC_EXEC_BLOCK_CACHE);
+  AddPPCBenchmark(&benches, "PowerPC block cache (unchained)", PPC_EXEC_BLOCK_CACHE, false);
+  AddPPCBenchmark(&benches, "PowerPC recompiler", PPC_EXEC_RECOMPILER);
+  AddPPCBenchmark(&benches, "PowerPC recompiler (unchained)", PPC_EXEC_RECOMPILER, false);
+
+  printf("{\n  \"benchmarks\": [");
+  bool first = true;
+  for (const Benchmark &bench: benches)
+  {
+    if (!opts.filter.empty() && std::string(bench.name).find(opts.filter) == std::string::npos)
+      continue;
+    Result r = Measure(bench, opts);
+    printf("%s\n    { \"name\": \"%s\", \"unit\": \"%s\", \"calls\": %llu, \"items\": %llu, \"seconds\": %.6f, \"ns_per_call\": %.1f, \"items_per_second\": %.1f }",
+      first ? "" : ",", bench.name, bench.unit, (unsigned long long) r.calls, (unsigned long long) r.items, r.seconds,
+      r.seconds * 1e9 / r.calls, r.items / r.seconds);
+    fflush(stdout);
+    first = false;
+  }
+  printf("\n  ]\n}\n");
+  return 0;
+}
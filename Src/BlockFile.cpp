@@ -28,100 +28,146 @@
 
 #include "BlockFile.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <cstdint>
+#include <zlib.h>
+#ifdef _WIN32
+#include <io.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 #include "Supermodel.h"
 
+// Compression method of a block, in the top 8 bits of its name length
+static const uint32_t NAME_LENGTH_MASK    = 0x00FFFFFF;
+static const int      METHOD_SHIFT        = 24;
+static const uint32_t METHOD_NONE         = 0;
+static const uint32_t METHOD_ZLIB         = 1;
+
+// Block header fields and total header size (including strings) of the block
+// at the given position, or false if it runs past the end of the data
+static bool GetBlockHeader(const std::vector<uint8_t> &data, size_t pos, uint32_t header[3], size_t *headerSize)
+{
+  if (data.size() - pos < 12)
+    return false;
+  memcpy(header, &data[pos], 12);
+  *headerSize = 12 + size_t(header[1] & NAME_LENGTH_MASK) + header[2];
+  return header[0] >= *headerSize && header[0] <= data.size() - pos;
+}
+
 
 /******************************************************************************
  Output Functions
 ******************************************************************************/
 
+bool CBlockFile::IsOpen(void) const
+{
+  return buffer != NULL;
+}
+
+long int CBlockFile::Tell(void)
+{
+  return long(bufferPos);
+}
+
+void CBlockFile::Seek(long int pos)
+{
+  bufferPos = size_t(pos);
+}
+
+size_t CBlockFile::ReadRaw(void *data, size_t numBytes)
+{
+  if (bufferPos >= buffer->size())
+    return 0;
+  numBytes = std::min(numBytes, buffer->size() - bufferPos);
+  memcpy(data, buffer->data() + bufferPos, numBytes);
+  bufferPos += numBytes;
+  return numBytes;
+}
+
+void CBlockFile::WriteRaw(const void *data, size_t numBytes)
+{
+  // Writing is always at the end. Appending avoids zero-filling the buffer
+  // before the copy.
+  const uint8_t *bytes = (const uint8_t *) data;
+  buffer->insert(buffer->end(), bytes, bytes + numBytes);
+  bufferPos = buffer->size();
+}
+
 void CBlockFile::ReadString(std::string *str, uint32_t length)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  str->clear();
-  //TODO: use fstream to get rid of this ugly hack
-  bool keep_loading = true;
-  for (uint32_t i = 0; i < length; i++)
-  {
-    char c;
-    fread(&c, sizeof(char), 1, fp);
-    if (keep_loading)
-    {
-      if (!c)
-        keep_loading = false;
-      else
-        *str += c;
-    }
-  }
+  // Up to the null terminator, if within the field
+  size_t available = std::min(size_t(length), buffer->size() - std::min(bufferPos, buffer->size()));
+  const char *chars = (const char *) buffer->data() + bufferPos;
+  str->assign(chars, std::find(chars, chars + available, '\0'));
+  bufferPos += available;
 }
 
 unsigned CBlockFile::ReadBytes(void *data, uint32_t numBytes)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return 0;
-  return fread(data, sizeof(uint8_t), numBytes, fp);
+  return ReadRaw(data, numBytes);
 }
 
 unsigned CBlockFile::ReadDWord(uint32_t *data)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return 0;
-  fread(data, sizeof(uint32_t), 1, fp);
+  ReadRaw(data, sizeof(uint32_t));
   return 4;
 }
   
+// Fills in the length of the block being written, once it is complete
 void CBlockFile::UpdateBlockSize(void)
 {
-  long int  curPos;
-  unsigned  newBlockSize;
-  
-  if (NULL == fp)
+  if (!IsOpen() || blockStartPos < 0)
     return;
-  curPos = ftell(fp);       // save current file position
-  fseek(fp, blockStartPos, SEEK_SET);
-  newBlockSize = curPos - blockStartPos;
-  fwrite(&newBlockSize, sizeof(uint32_t), 1, fp);
-  fseek(fp, curPos, SEEK_SET);  // go back
+  uint32_t newBlockSize = uint32_t(buffer->size() - size_t(blockStartPos));
+  memcpy(buffer->data() + blockStartPos, &newBlockSize, sizeof(uint32_t));
 }
 
 void CBlockFile::WriteByte(uint8_t data)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  fwrite(&data, sizeof(uint8_t), 1, fp);
-  UpdateBlockSize();
+  WriteRaw(&data, sizeof(uint8_t));
 }
 
 void CBlockFile::WriteDWord(uint32_t data)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  fwrite(&data, sizeof(uint32_t), 1, fp);
-  UpdateBlockSize();
+  WriteRaw(&data, sizeof(uint32_t));
 }
 
 void CBlockFile::WriteBytes(const void *data, uint32_t numBytes)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
-  fwrite(data, sizeof(uint8_t), numBytes, fp);
-  UpdateBlockSize();
+  WriteRaw(data, numBytes);
 }
 
 void CBlockFile::WriteBlockHeader(const std::string &name, const std::string &comment)
 {
-  if (NULL == fp)
+  if (!IsOpen())
     return;
   
+  // Previous block is complete
+  UpdateBlockSize();
+
   // Record current block starting position
-  blockStartPos = ftell(fp);
+  blockStartPos = Tell();
 
   // Write the total block length field
-  WriteDWord(0);  // will be automatically updated as we write the file
+  WriteDWord(0);  // filled in when the block is complete
   
   // Write name and comment lengths
   WriteDWord(name.size() + 1);
@@ -130,7 +176,7 @@ void CBlockFile::WriteBlockHeader(const std::string &name, const std::string &co
   Write(comment);
   
   // Record the start of the current data section
-  dataStartPos = ftell(fp);
+  dataStartPos = Tell();
 } 
 
 
@@ -148,6 +194,11 @@ void CBlockFile::WriteBlockHeader(const std::string &name, const std::string &co
  name     ...     Name string (null-terminated, up to 1025 bytes).
  comment    ...     Comment string (same as above).
  data     ...     Raw data (blockLength - total header size).
+ 
+ Blocks are compressed in files written by Save(). The top 8 bits of the name
+ length then give the compression method. With zlib (1), the data is the size
+ of the uncompressed data (uint32_t) followed by a zlib stream. Load()
+ decompresses them, so that only uncompressed blocks are ever read.
 ******************************************************************************/
 
 unsigned CBlockFile::Read(void *data, uint32_t numBytes)
@@ -184,97 +235,354 @@ void CBlockFile::Write(const std::string &str)
     WriteBytes(str.c_str(), str.length() + 1);
 }
 
+uint32_t CBlockFile::GetPosition(void) const
+{
+  return uint32_t(bufferPos);
+}
+
 void CBlockFile::NewBlock(const std::string &name, const std::string &comment)
 {
   if (mode == 'w')
     WriteBlockHeader(name, comment);
 }
 
-bool CBlockFile::FindBlock(const std::string &name)
+void CBlockFile::BuildDirectory(void)
 {
-  if (mode != 'r')
-    return FAIL;
-    
-  fseek(fp, 0, SEEK_SET);
+  directory.clear();
   
   long int  curPos = 0;
   while (curPos < fileSize)
   {
-    blockStartPos = curPos;
+    Seek(curPos);
     
     // Read header
-    uint32_t block_length;
-    uint32_t name_length;
-    uint32_t comment_length;
-    curPos += ReadDWord(&block_length);
-    curPos += ReadDWord(&name_length);
-    curPos += ReadDWord(&comment_length);
+    uint32_t block_length = 0;
+    uint32_t name_length = 0;
+    uint32_t comment_length = 0;
+    ReadDWord(&block_length);
+    ReadDWord(&name_length);
+    ReadDWord(&comment_length);
     std::string block_name;
     ReadString(&block_name, name_length);
     
-    // Is this the block we want?
-    if (block_name == name)
-    {
-      fseek(fp, blockStartPos + 12 + name_length + comment_length, SEEK_SET); // move to beginning of data
-      dataStartPos = ftell(fp);
-      return OKAY;
-    }
+    // The first block of a given name is the one found
+    long int dataPos = curPos + 12 + name_length + comment_length;
+    directory.emplace(block_name, std::make_pair(curPos, dataPos));
     
     // Move to next block
-    fseek(fp, blockStartPos + block_length, SEEK_SET);
-    curPos = blockStartPos + block_length;
     if (block_length == 0)  // this would never advance
       break;
+    curPos += block_length;
   }
   
-  return FAIL;
+  directoryBuilt = true;
+}
+
+bool CBlockFile::FindBlock(const std::string &name)
+{
+  if (mode != 'r')
+    return FAIL;
+  
+  if (!directoryBuilt)
+    BuildDirectory();
+  
+  auto it = directory.find(name);
+  if (it == directory.end())
+    return FAIL;
+  
+  blockStartPos = it->second.first;
+  dataStartPos = it->second.second;
+  Seek(dataStartPos); // move to beginning of data
+  return OKAY;
 }
 
 bool CBlockFile::Create(const std::string &file, const std::string &headerName, const std::string &comment)
 {
+  // Opened now so that errors are reported straight away, written on Close()
   fp = fopen(file.c_str(), "wb");
   if (NULL == fp)
     return FAIL;
+  return Create(&fileBuffer, headerName, comment);
+}
+
+bool CBlockFile::Create(std::vector<uint8_t> *buf, const std::string &headerName, const std::string &comment)
+{
+  buffer = buf;
+  buffer->clear();
+  bufferPos = 0;
+  blockStartPos = -1;
   mode = 'w';
   WriteBlockHeader(headerName, comment);
   return OKAY;
 }
   
-bool CBlockFile::Load(const std::string &file)
+// Blocks are compressed in pieces of this size, which can be done in parallel
+static const size_t COMPRESS_CHUNK_SIZE = 256 * 1024;
+static const size_t DEFLATE_WINDOW_SIZE = 32 * 1024;
+
+// A piece of a block compressed as raw deflate data, ending on a byte
+// boundary so that the pieces of a block can be joined into one stream
+struct CompressedChunk
+{
+  size_t    block;    // index in blocks
+  size_t    start;    // offset in the block's data
+  size_t    size;
+  uLong     adler;    // of the uncompressed data
+  std::vector<uint8_t> data;
+  bool      ok;
+};
+
+static void CompressChunk(CompressedChunk *chunk, const uint8_t *blockData, size_t blockSize, int level)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  chunk->ok = false;
+  if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return;
+
+  // Primed with the data just before it, as if compressed in one go
+  size_t dictionary = std::min(chunk->start, DEFLATE_WINDOW_SIZE);
+  if (dictionary > 0)
+    deflateSetDictionary(&stream, blockData + chunk->start - dictionary, uInt(dictionary));
+
+  bool last = chunk->start + chunk->size == blockSize;
+  chunk->data.resize(deflateBound(&stream, uLong(chunk->size)) + 16);
+  stream.next_in = const_cast<Bytef *>(blockData + chunk->start);
+  stream.avail_in = uInt(chunk->size);
+  stream.next_out = chunk->data.data();
+  stream.avail_out = uInt(chunk->data.size());
+  int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+  chunk->ok = (last ? result == Z_STREAM_END : result == Z_OK) && stream.avail_in == 0;
+  chunk->data.resize(stream.total_out);
+  chunk->adler = adler32(adler32(0, Z_NULL, 0), blockData + chunk->start, uInt(chunk->size));
+  deflateEnd(&stream);
+}
+
+bool CBlockFile::Save(const std::string &file, const std::vector<uint8_t> &data, int level, const JobRunner &runJobs)
 {
-  fp = fopen(file.c_str(), "rb");
+  // Find the blocks, and split the ones to compress (all but the header) into
+  // chunks that are compressed separately, in parallel if a job runner is
+  // given. Their output is joined into one zlib stream per block.
+  struct Block
+  {
+    size_t    pos;
+    uint32_t  header[3];
+    size_t    headerSize;
+    size_t    firstChunk;
+    size_t    numChunks;
+  };
+  std::vector<Block> blocks;
+  std::vector<CompressedChunk> chunks;
+  size_t pos = 0;
+  Block b;
+  while (pos < data.size() && GetBlockHeader(data, pos, b.header, &b.headerSize))
+  {
+    size_t rawSize = b.header[0] - b.headerSize;
+    b.pos = pos;
+    b.firstChunk = chunks.size();
+    b.numChunks = 0;
+    if (level > 0 && pos > 0 && rawSize > 0 && (b.header[1] >> METHOD_SHIFT) == METHOD_NONE)
+    {
+      for (size_t start = 0; start < rawSize; start += COMPRESS_CHUNK_SIZE)
+      {
+        CompressedChunk chunk{};
+        chunk.block = blocks.size();
+        chunk.start = start;
+        chunk.size = std::min(COMPRESS_CHUNK_SIZE, rawSize - start);
+        chunks.push_back(std::move(chunk));
+        b.numChunks++;
+      }
+    }
+    blocks.push_back(b);
+    pos += b.header[0];
+  }
+  size_t end = pos;
+
+  auto compressChunk = [&](unsigned i)
+  {
+    const Block &block = blocks[chunks[i].block];
+    CompressChunk(&chunks[i], &data[block.pos + block.headerSize], block.header[0] - block.headerSize, std::min(level, 9));
+  };
+  if (runJobs)
+    runJobs(unsigned(chunks.size()), compressChunk);
+  else
+  {
+    for (unsigned i = 0; i < chunks.size(); i++)
+      compressChunk(i);
+  }
+
+  // Keep each block as is if it does not get any smaller
+  std::vector<uint8_t> out;
+  out.reserve(data.size());
+  for (const Block &block: blocks)
+  {
+    const uint8_t *blockData = &data[block.pos];
+    uint32_t rawSize = uint32_t(block.header[0] - block.headerSize);
+    size_t packedSize = 6;  // zlib header and Adler-32
+    bool ok = block.numChunks > 0;
+    for (size_t i = block.firstChunk; i < block.firstChunk + block.numChunks; i++)
+    {
+      packedSize += chunks[i].data.size();
+      ok &= chunks[i].ok;
+    }
+    if (!ok || packedSize + 4 >= rawSize)
+    {
+      out.insert(out.end(), blockData, blockData + block.header[0]);
+      continue;
+    }
+
+    uint32_t packedHeader[2] = { uint32_t(block.headerSize + 4 + packedSize), block.header[1] | (METHOD_ZLIB << METHOD_SHIFT) };
+    size_t start = out.size();
+    out.insert(out.end(), blockData, blockData + block.headerSize);
+    memcpy(&out[start], packedHeader, sizeof(packedHeader));
+    out.insert(out.end(), (const uint8_t *) &rawSize, (const uint8_t *) &rawSize + sizeof(rawSize));
+    out.push_back(0x78);  // deflate, 32 KB window, default level, no dictionary
+    out.push_back(0x9C);
+    uLong adler = adler32(0, Z_NULL, 0);
+    for (size_t i = block.firstChunk; i < block.firstChunk + block.numChunks; i++)
+    {
+      out.insert(out.end(), chunks[i].data.begin(), chunks[i].data.end());
+      adler = adler32_combine(adler, chunks[i].adler, z_off_t(chunks[i].size));
+    }
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out.push_back(uint8_t(adler >> shift));
+  }
+  out.insert(out.end(), data.begin() + end, data.end());  // anything unparsed
+
+  // Written to a temporary file, flushed to disk and renamed, so that losing
+  // power part way leaves the previous file intact
+  std::string temp_file = file + ".tmp";
+  FILE *fp = fopen(temp_file.c_str(), "wb");
   if (NULL == fp)
     return FAIL;
-  mode = 'r';
+  bool written = fwrite(out.data(), sizeof(uint8_t), out.size(), fp) == out.size();
+  written &= fflush(fp) == 0;
+#ifdef _WIN32
+  written &= _commit(_fileno(fp)) == 0;
+#else
+  written &= fsync(fileno(fp)) == 0;
+#endif
+  written &= fclose(fp) == 0;
+  if (written)
+  {
+#ifdef _WIN32
+    // rename() won't replace an existing file on Windows, and removing it
+    // first would leave no file at all if power were lost in between
+    written = MoveFileExA(temp_file.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    written = rename(temp_file.c_str(), file.c_str()) == 0;
+#endif
+  }
+  if (!written)
+    remove(temp_file.c_str());
+  return written ? OKAY : FAIL;
+}
+
+bool CBlockFile::Decompress(std::vector<uint8_t> *data)
+{
+  // Nothing to do unless there is a compressed block
+  size_t pos = 0;
+  uint32_t header[3];
+  size_t headerSize;
+  bool compressed = false;
+  while (!compressed && pos < data->size() && GetBlockHeader(*data, pos, header, &headerSize))
+  {
+    compressed = (header[1] >> METHOD_SHIFT) != METHOD_NONE;
+    pos += header[0];
+  }
+  if (!compressed)
+    return OKAY;
+
+  std::vector<uint8_t> out;
+  pos = 0;
+  while (pos < data->size() && GetBlockHeader(*data, pos, header, &headerSize))
+  {
+    const uint8_t *block = &(*data)[pos];
+    uint32_t method = header[1] >> METHOD_SHIFT;
+    if (method == METHOD_NONE)
+      out.insert(out.end(), block, block + header[0]);
+    else if (method == METHOD_ZLIB && header[0] >= headerSize + 4)
+    {
+      uint32_t size;
+      memcpy(&size, block + headerSize, sizeof(size));
+      uint32_t rawHeader[2] = { uint32_t(headerSize + size), header[1] & NAME_LENGTH_MASK };
+      size_t start = out.size();
+      out.resize(start + headerSize + size);
+      memcpy(&out[start], block, headerSize);
+      memcpy(&out[start], rawHeader, sizeof(rawHeader));
+      uLongf rawSize = size;
+      if (uncompress(&out[start + headerSize], &rawSize, block + headerSize + 4, uLong(header[0] - headerSize - 4)) != Z_OK || rawSize != size)
+        return FAIL;
+    }
+    else
+      return FAIL;  // unknown method
+    pos += header[0];
+  }
+  out.insert(out.end(), data->begin() + pos, data->end());
+  data->swap(out);
+  return OKAY;
+}
+
+bool CBlockFile::Load(const std::string &file)
+{
+  FILE *in = fopen(file.c_str(), "rb");
+  if (NULL == in)
+    return FAIL;
   
   // TODO: is this a valid block file?
   
-  // Get the file size
-  fseek(fp, 0, SEEK_END);
-  fileSize = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
+  // Read the whole file in one go
+  fseek(in, 0, SEEK_END);
+  long int size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  fileBuffer.resize(size_t(std::max(size, 0L)));
+  fileBuffer.resize(fread(fileBuffer.data(), sizeof(uint8_t), fileBuffer.size(), in));
+  fclose(in);
   
+  if (OKAY != Decompress(&fileBuffer))
+  {
+    std::vector<uint8_t>().swap(fileBuffer);
+    return FAIL;
+  }
+  return Load(&fileBuffer);
+}
+
+bool CBlockFile::Load(const std::vector<uint8_t> *buf)
+{
+  buffer = const_cast<std::vector<uint8_t> *>(buf);  // never written to in read mode
+  bufferPos = 0;
+  mode = 'r';
+  fileSize = long(buffer->size());
+  directoryBuilt = false;
   return OKAY;
 }
   
 void CBlockFile::Close(void)
 {
+  if (mode == 'w')
+    UpdateBlockSize();
   if (fp != NULL)
+  {
+    fwrite(fileBuffer.data(), sizeof(uint8_t), fileBuffer.size(), fp);
     fclose(fp);
+  }
   fp = NULL;
+  buffer = NULL;
+  std::vector<uint8_t>().swap(fileBuffer);
   mode = 0;
 }
 
 CBlockFile::CBlockFile(void)
 {
   fp = NULL;
+  buffer = NULL;
+  bufferPos = 0;
+  blockStartPos = -1;
+  directoryBuilt = false;
   mode = 0;   // neither reading nor writing (do nothing)
 }
 
 CBlockFile::~CBlockFile(void)
 {
-  if (fp != NULL) // in case user forgot
-    fclose(fp);
-  fp = NULL;
-  mode = 0;
+  Close();  // in case user forgot
 }
@@ -29,7 +29,12 @@
 #define INCLUDED_BLOCKFILE_H
 
 #include <cstdint>
+#include <cstdio>
+#include <functional>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 /*
  * CBlockFile:
@@ -40,6 +45,13 @@
  * All strings (comments and names) will be truncated to 1024 bytes, not
  * including the null terminator.
  *
+ * All reading and writing is done in memory. Instead of a file, a block file
+ * can be kept in a memory buffer, for states that are saved and restored many
+ * times a second. Files are read whole when loaded and written in one go when
+ * closed, and block lengths are filled in when each block is complete, so
+ * saving and loading never seeks. A buffer can also be written to a file with
+ * its blocks compressed, by Save().
+ *
  * Members do not generate any output messages.
  */
 class CBlockFile
@@ -76,8 +88,10 @@ public:
   /*
    * FindBlock(name):
    *
-   * Scans the file for a block with the given name string. When it is found,
-   * the file pointer is set to the beginning of the data region.
+   * Looks up a block with the given name string. When it is found, the file
+   * pointer is set to the beginning of the data region. The first call after
+   * loading scans the file once to index its blocks by name, after which each
+   * call is a hash lookup.
    *
    * Parameters:
    *    name  Name of block to locate.
@@ -121,6 +135,16 @@ public:
    */
   void Write(const std::string &str);
 
+  /*
+   * GetPosition(void):
+   *
+   * Returns:
+   *    Offset of the current file pointer position from the start of the
+   *    file, where the next byte will be read or written. For a file created
+   *    in memory, this is the offset in the buffer.
+   */
+  uint32_t GetPosition(void) const;
+
   /*
    * NewBlock(name, comment):
    *
@@ -139,7 +163,8 @@ public:
    * Opens a block file for writing and creates the header block. This  
    * function must be called before attempting to write data. Otherwise, all
    * write commands will be silently ignored. Read commands will be ignored
-   * and will always return 0's.
+   * and will always return 0's. Data is kept in memory and written to the
+   * file by Close().
    * 
    * Parameters:
    *    file        File path.
@@ -151,26 +176,91 @@ public:
    */
   bool Create(const std::string &file, const std::string &headerName, const std::string &comment);
 
+  /*
+   * Create(buffer, headerName, comment):
+   *
+   * As above but writes to a memory buffer, which is emptied first. Its
+   * capacity is kept, so reusing a buffer avoids reallocating it. The buffer
+   * holds a complete block file once Close() is called.
+   *
+   * Parameters:
+   *    buffer      Buffer to write to. Must remain valid until Close().
+   *    headerName  Block name for header. Must be unique and not NULL.
+   *    comment     Comment string that will be embedded into file header.
+   *
+   * Returns:
+   *    Always OKAY.
+   */
+  bool Create(std::vector<uint8_t> *buffer, const std::string &headerName, const std::string &comment);
+
+  /*
+   * JobRunner:
+   *
+   * Runs job(0) to job(count - 1), in any order and possibly in parallel,
+   * and returns once all of them are done.
+   */
+  typedef std::function<void(unsigned count, const std::function<void(unsigned)> &job)> JobRunner;
+
+  /*
+   * Save(file, buffer, level, runJobs):
+   *
+   * Writes a block file kept in a memory buffer to a file, compressing each
+   * block but the header block. Does not use any CBlockFile object, so may
+   * be called from any thread while the buffer is not being written to.
+   * Blocks are compressed in pieces of 256 KB, joined into one zlib stream
+   * per block, which can be spread over threads by runJobs.
+   *
+   * Parameters:
+   *    file    File path.
+   *    buffer  Complete block file, written by
+   *            Create(buffer, headerName, comment) and closed.
+   *    level   zlib compression level, from 1 (fastest) to 9 (smallest), or
+   *            0 to write the blocks uncompressed.
+   *    runJobs Runs the compression jobs. If empty, they are run in turn on
+   *            the calling thread.
+   *
+   * Returns:
+   *    OKAY if the file was written, otherwise FAIL.
+   */
+  static bool Save(const std::string &file, const std::vector<uint8_t> &buffer, int level, const JobRunner &runJobs = JobRunner());
+
   /*
    * Load(file):
    *
-   * Open a block file file for reading.
+   * Open a block file file for reading. Blocks compressed by Save() are
+   * decompressed.
    *
    * Parameters:
    *    file  File path.
    *
    * Returns:
    *    OKAY if successfully opened and confirmed to be a valid Supermodel
-   *    block file, otherwise FAIL. If the file could not be opened, all 
+   *    block file, otherwise FAIL (also if a compressed block is corrupt or
+   *    uses an unknown method). If the file could not be opened, all 
    *    subsequent operations will be silently ignored (reads will return
    *    0's). Write commands will be ignored.
    */
   bool Load(const std::string &file);
 
+  /*
+   * Load(buffer):
+   *
+   * As above but reads from a memory buffer written by
+   * Create(buffer, headerName, comment), which is never compressed.
+   *
+   * Parameters:
+   *    buffer  Buffer to read from. Must remain valid until Close().
+   *
+   * Returns:
+   *    Always OKAY.
+   */
+  bool Load(const std::vector<uint8_t> *buffer);
+
   /*
    * Close(void):
    *
-   * Closes the file.
+   * Completes the last block written and closes the file, writing it out if
+   * it was created.
    */
   void Close(void);
 
@@ -185,6 +275,11 @@ public:
 
 private:
   // Helper functions
+  bool      IsOpen(void) const;
+  long int  Tell(void);
+  void      Seek(long int pos);
+  size_t    ReadRaw(void *data, size_t numBytes);
+  void      WriteRaw(const void *data, size_t numBytes);
   void      ReadString(std::string *str, uint32_t length);
   unsigned  ReadBytes(void *data, uint32_t numBytes);
   unsigned  ReadDWord(uint32_t *data);
@@ -193,13 +288,22 @@ private:
   void      WriteDWord(uint32_t data);
   void      WriteBytes(const void *data, uint32_t numBytes);
   void      WriteBlockHeader(const std::string &name, const std::string &comment);
+  void      BuildDirectory(void);
+  static bool Decompress(std::vector<uint8_t> *data);
 
   // File state data
-  FILE      *fp;
+  FILE      *fp;            // file to write on Close() (if not NULL)
+  std::vector<uint8_t> fileBuffer;  // contents of file being read or written
+  std::vector<uint8_t> *buffer; // memory buffer being read or written (if not NULL)
+  size_t    bufferPos;
   int       mode;           // 'r' for read, 'w' for write
   long int  fileSize;       // size of file in bytes
   long int  blockStartPos;  // points to beginning of current block (or file) header
   long int  dataStartPos;   // points to beginning of current block's data section 
+
+  // Block directory: start of each block and of its data, by name
+  std::unordered_map<std::string, std::pair<long int, long int>> directory;
+  bool      directoryBuilt;
 };
 
 
@@ -23,7 +23,8 @@
  * 68K.cpp
  *
  * 68K CPU interface. This is presently just a wrapper for the Musashi 68K core
- * and therefore, only a single CPU is supported. In the future, we may want to
+ * and therefore, only a single CPU can be active at a time. Switching between
+ * CPUs only swaps the active context pointer. In the future, we may want to
  * add in another 68K core (eg., Turbo68K, A68K, or a recompiler).
  *
  * To-Do List
@@ -36,6 +37,7 @@
 #include "68K.h"
 
 #include "Supermodel.h"
+#include "CPU/ExecTrace.h"
 #include "Musashi/m68k.h"	// Musashi 68K core
 #include "Debugger/CPU/Musashi68KDebug.h"
 
@@ -43,23 +45,36 @@
  Internal Context
 
  An active context must be mapped before calling M68K interface functions. Only
- the bus and IRQ handlers are copied here; the CPU context is passed directly
- to Musashi.
+ the bus and IRQ handlers are copied here; Musashi runs directly on the CPU
+ context inside the active M68KCtx, so switching contexts copies no CPU state.
+ The active context is per thread, so that CPUs can be run concurrently from
+ different threads.
 ******************************************************************************/
 
+// Active context
+static thread_local M68KCtx	*s_Ctx = NULL;
+
 // Bus
-static IBus	*s_Bus = NULL;
+static thread_local IBus	*s_Bus = NULL;
+
+// Instruction fetch map of the active context, none until one is set
+static const UINT8 *const s_noFetchMap[M68K_NUM_FETCH_PAGES] = {};
+static thread_local const UINT8 *const *s_fetchMap = s_noFetchMap;
 
 #ifdef SUPERMODEL_DEBUGGER
 // Debugger
-static Debugger::CMusashi68KDebug *s_Debug = NULL;
+static thread_local Debugger::CMusashi68KDebug *s_Debug = NULL;
 #endif
 
 // IRQ callback
-static int	(*IRQAck)(int nIRQ) = NULL;
+static thread_local int	(*IRQAck)(void *data, int nIRQ) = NULL;
+static thread_local void *s_IRQAckData = NULL;
 
 // Cycles remaining in timeslice
-static int s_lastCycles;
+static thread_local int s_lastCycles;
+
+// Number of bus writes so far, for idle loop detection
+static thread_local UINT32 s_numWrites = 0;
 
 
 /******************************************************************************
@@ -113,6 +128,11 @@ UINT32 M68KGetPC(void)
 	return m68k_get_reg(NULL, M68K_REG_PC);
 }
 
+UINT32 M68KGetSR(void)
+{
+	return m68k_get_reg(NULL, M68K_REG_SR);
+}
+
 void M68KSaveState(CBlockFile *StateFile, const char *name)
 {
 	StateFile->NewBlock(name, __FILE__);
@@ -232,23 +252,101 @@ void M68KSetIRQ(int irqLevel)
 int M68KRun(int numCycles)
 {
 #ifdef SUPERMODEL_DEBUGGER
-	if (s_Debug != NULL)
+	// Leave an attached debugger out of the timeslice, with direct fetches and bus accesses, unless it needs to watch execution
+	Debugger::CMusashi68KDebug *debug = s_Debug;
+	IBus *bus = s_Bus;
+	if (debug != NULL)
 	{
-		s_Debug->CPUActive();
-		s_lastCycles += numCycles;
+		debug->CPUActive();
+		if (debug->NeedsHooks())
+			s_lastCycles += numCycles;
+		else
+		{
+			s_Debug = NULL;
+			s_Bus = debug->GetUnwatchedBus();
+		}
 	}
 #endif // SUPERMODEL_DEBUGGER
 	int doneCycles = m68k_execute(numCycles);
+	if (s_Ctx != NULL && s_Ctx->Trace != NULL)
+		s_Ctx->traceCycles += doneCycles;
 #ifdef SUPERMODEL_DEBUGGER
-	if (s_Debug != NULL)
+	if (debug != NULL)
 	{
-		s_Debug->CPUInactive();
-		s_lastCycles -= m68k_cycles_remaining();
+		if (s_Debug != NULL)
+			s_lastCycles -= m68k_cycles_remaining();
+		s_Debug = debug;
+		s_Bus = bus;
+		debug->CPUInactive();
 	}
 #endif // SUPERMODEL_DEBUGGER
 	return doneCycles;
 }
 
+/*
+ * Idle loop detection: the 68K runs in short probes. A loop is recognized when,
+ * over several consecutive probes, no bus writes occur, the registers
+ * (including SR) are unchanged, and the PC stays within a small window.
+ */
+#define IDLE_PROBE_CYCLES	256	// cycles per probe
+#define IDLE_LOOP_BYTES		32	// maximum extent of an idle loop
+#define IDLE_CONFIRMATIONS	2	// matching probes needed before skipping
+
+struct IdleProbe
+{
+	UINT32	pc;
+	UINT32	regs[17];	// D0-D7, A0-A7, SR
+};
+
+static void GetIdleProbe(IdleProbe *probe)
+{
+	probe->pc = M68KGetPC();
+	for (int i = 0; i < 8; i++)
+	{
+		probe->regs[i] = M68KGetDRegister(i);
+		probe->regs[8+i] = M68KGetARegister(i);
+	}
+	probe->regs[16] = M68KGetSR();
+}
+
+int M68KRunIdleSkip(int numCycles, UINT64 *idleCycles)
+{
+	if (numCycles <= (IDLE_CONFIRMATIONS+1)*IDLE_PROBE_CYCLES)
+		return M68KRun(numCycles);
+
+	IdleProbe	ref, cur;
+	bool		haveRef = false;
+	int			matches = 0;
+	int			done = 0;
+	while (done < numCycles)
+	{
+		UINT32 writes = s_numWrites;
+		done += M68KRun(std::min(IDLE_PROBE_CYCLES, numCycles - done));
+		if (writes != s_numWrites)
+		{
+			haveRef = false;
+			continue;
+		}
+
+		GetIdleProbe(&cur);
+		if (haveRef && !memcmp(cur.regs, ref.regs, sizeof(ref.regs)) && (cur.pc - ref.pc + IDLE_LOOP_BYTES) < 2*IDLE_LOOP_BYTES)
+		{
+			if (++matches >= IDLE_CONFIRMATIONS && done < numCycles)
+			{
+				*idleCycles += numCycles - done;
+				return numCycles;
+			}
+		}
+		else
+		{
+			ref = cur;
+			haveRef = true;
+			matches = 0;
+		}
+	}
+	return done;
+}
+
 void M68KReset(void)
 {
 	m68k_pulse_reset();
@@ -260,37 +358,89 @@ void M68KReset(void)
 
 // Callback setup
 
-void M68KSetIRQCallback(int (*F)(int nIRQ))
+void M68KSetIRQCallback(int (*F)(void *data, int nIRQ), void *data)
 {
 	IRQAck = F;
+	s_IRQAckData = data;
+	if (s_Ctx != NULL)
+	{
+		s_Ctx->IRQAck = F;
+		s_Ctx->IRQAckData = data;
+	}
 }
 
 void M68KAttachBus(IBus *BusPtr)
 {
 	s_Bus = BusPtr;
+	if (s_Ctx != NULL)
+		s_Ctx->Bus = BusPtr;
 	DebugLog("Attached bus to 68K\n");
 }
 
+void M68KMapFetch(UINT32 start, UINT32 end, const UINT8 *ptr)
+{
+	if (s_Ctx == NULL)
+	{
+		ErrorLog("68K fetch map set up with no active context.");
+		return;
+	}
+	for (UINT32 page = start >> M68K_FETCH_PAGE_SHIFT; page <= ((end >> M68K_FETCH_PAGE_SHIFT) & (M68K_NUM_FETCH_PAGES - 1)); page++)
+		s_Ctx->fetchMap[page] = ptr + ((page << M68K_FETCH_PAGE_SHIFT) - start);
+}
+
 // Context switching
 
 void M68KGetContext(M68KCtx *Dest)
 {
 	Dest->IRQAck = IRQAck;
+	Dest->IRQAckData = s_IRQAckData;
 	Dest->Bus = s_Bus;
 #ifdef SUPERMODEL_DEBUGGER
 	Dest->Debug = s_Debug;
 #endif // SUPERMODEL_DEBUGGER
-	m68k_get_context(&(Dest->musashiCtx));
+	m68k_get_context(&(Dest->musashiCtx));	// no-op if Dest is the active context
 }
 
 void M68KSetContext(M68KCtx *Src)
 {
+	s_Ctx = Src;
 	IRQAck = Src->IRQAck;
+	s_IRQAckData = Src->IRQAckData;
 	s_Bus = Src->Bus;
 #ifdef SUPERMODEL_DEBUGGER
 	s_Debug = Src->Debug;
 #endif // SUPERMODEL_DEBUGGER
-	m68k_set_context(&(Src->musashiCtx));
+	s_fetchMap = Src->fetchMap;
+	m68k_set_context_ptr(&(Src->musashiCtx));
+}
+
+// Execution trace
+
+void M68KSetExecTrace(M68KCtx *ctx, CExecTrace *trace)
+{
+	ctx->Trace = trace;
+	ctx->traceLastPC = 0;
+	ctx->traceAfterJump = true;
+	ctx->musashiCtx.exec_trace_callback = trace != NULL ? M68KExecTraceCallback : NULL;
+}
+
+static void M68KDisassembleTrace(UINT32 pc, UINT32 opcode, char *str, size_t size)
+{
+	char buf[256];
+	m68k_disassemble(buf, pc, M68K_CPU_TYPE_68000);
+	snprintf(str, size, "%s", buf);
+}
+
+bool M68KDumpExecTrace(M68KCtx *ctx, const std::string &file)
+{
+	if (ctx->Trace == NULL)
+		return OKAY;
+	M68KCtx *prev = s_Ctx;
+	M68KSetContext(ctx);
+	bool result = ctx->Trace->Dump(file, M68KDisassembleTrace);
+	if (prev != NULL)
+		M68KSetContext(prev);
+	return result;
 }
 
 // One-time initialization
@@ -386,6 +536,25 @@ void M68KDebugCallback()
 }
 #endif // SUPERMODEL_DEBUGGER
 
+// Whether an instruction may change the flow of control: Bcc, BRA, BSR, DBcc,
+// JSR, JMP, the RTE/RTS/RTR group and TRAP
+static inline bool M68KMayJump(unsigned int ir)
+{
+	return (ir & 0xF000) == 0x6000 || (ir & 0xF0F8) == 0x50C8 || (ir & 0xFF80) == 0x4E80 || (ir & 0xFFF8) == 0x4E70 || (ir & 0xFFF0) == 0x4E40;
+}
+
+#define M68K_MAX_INSN_BYTES	10	// longest 68000 instruction
+
+void M68KExecTraceCallback(unsigned int pc, unsigned int ir)
+{
+	M68KCtx *ctx = s_Ctx;
+	CExecTrace *trace = ctx->Trace;
+	if (!trace->BranchesOnly() || ctx->traceAfterJump || pc - ctx->traceLastPC > M68K_MAX_INSN_BYTES)
+		trace->Record(pc, ir, ctx->traceCycles + m68k_cycles_run());
+	ctx->traceLastPC = pc;
+	ctx->traceAfterJump = M68KMayJump(ir);
+}
+
 int M68KIRQCallback(int nIRQ)
 {
 #ifdef SUPERMODEL_DEBUGGER
@@ -401,21 +570,40 @@ int M68KIRQCallback(int nIRQ)
 		return M68K_IRQ_AUTOVECTOR;
 	}
 	else
-		return IRQAck(nIRQ);
+		return IRQAck(s_IRQAckData, nIRQ);
+}
+
+// Fetches from mapped pages bypass the bus, except when the debugger is watching it
+static inline const UINT8 *M68KFetchPage(unsigned int a)
+{
+#ifdef SUPERMODEL_DEBUGGER
+	if (s_Debug != NULL)
+		return NULL;
+#endif // SUPERMODEL_DEBUGGER
+	return s_fetchMap[(a >> M68K_FETCH_PAGE_SHIFT) & (M68K_NUM_FETCH_PAGES - 1)];
 }
 
 unsigned int FASTCALL M68KFetch8(unsigned int a)
 {
+	const UINT8 *page = M68KFetchPage(a);
+	if (page != NULL)
+		return page[(a & 0xFFFF) ^ 1];
 	return s_Bus->Read8(a);
 }
 
 unsigned int FASTCALL M68KFetch16(unsigned int a)
 {
+	const UINT8 *page = M68KFetchPage(a);
+	if (page != NULL)
+		return *(const UINT16 *) &page[a & 0xFFFF];
 	return s_Bus->Read16(a);
 }
 
 unsigned int FASTCALL M68KFetch32(unsigned int a)
 {
+	const UINT8 *page = M68KFetchPage(a);
+	if (page != NULL && (a & 0xFFFF) <= 0xFFFC)
+		return (*(const UINT16 *) &page[a & 0xFFFF] << 16) | *(const UINT16 *) &page[(a + 2) & 0xFFFF];
 	return s_Bus->Read32(a);
 }
 
@@ -436,16 +624,19 @@ unsigned int FASTCALL M68KRead32(unsigned int a)
 
 void FASTCALL M68KWrite8(unsigned int a, unsigned int d)
 {
+	++s_numWrites;
 	s_Bus->Write8(a, d);
 }
 
 void FASTCALL M68KWrite16(unsigned int a, unsigned int d)
 {
+	++s_numWrites;
 	s_Bus->Write16(a, d);
 }
 
 void FASTCALL M68KWrite32(unsigned int a, unsigned int d)
 {
+	++s_numWrites;
 	s_Bus->Write32(a, d);
 }
 
@@ -38,6 +38,9 @@
 #include "Musashi/m68kctx.h"
 #include "CPU/Bus.h"
 #include "BlockFile.h"
+#include <string>
+
+class CExecTrace;
 
 // This doesn't work for now (needs to be added to the prototypes in m68k.h for m68k_read_memory*)
 //#ifndef FASTCALL
@@ -59,6 +62,10 @@ namespace Debugger {
 #define M68K_IRQ_AUTOVECTOR	M68K_INT_ACK_AUTOVECTOR	// signals an autovectored interrupt
 #define M68K_IRQ_SPURIOUS	M68K_INT_ACK_SPURIOUS	// signals a spurious interrupt
 
+// Instruction fetch map: 64KB pages covering the 24-bit address space
+#define M68K_FETCH_PAGE_SHIFT	16
+#define M68K_NUM_FETCH_PAGES	(1 << (24 - M68K_FETCH_PAGE_SHIFT))
+
 
 /******************************************************************************
  CPU Context
@@ -76,7 +83,13 @@ typedef struct SM68KCtx
 public:
 	m68ki_cpu_core	musashiCtx;		// CPU context
 	IBus			*Bus;			// memory handlers
-	int				(*IRQAck)(int);	// IRQ acknowledge callback
+	int				(*IRQAck)(void *, int);	// IRQ acknowledge callback
+	void			*IRQAckData;	// passed to IRQ acknowledge callback
+	const UINT8		*fetchMap[M68K_NUM_FETCH_PAGES];	// directly fetchable memory (NULL: use bus)
+	CExecTrace		*Trace;			// execution trace (if any)
+	UINT64			traceCycles;	// cycles run before the current timeslice while tracing
+	UINT32			traceLastPC;	// address of the last instruction executed while tracing
+	bool			traceAfterJump;	// whether the last instruction executed may have jumped
 #ifdef SUPERMODEL_DEBUGGER
 	Debugger::CMusashi68KDebug *Debug;        // holds debugger (if attached)
 #endif // SUPERMODEL_DEBUGGER
@@ -85,6 +98,12 @@ public:
 	{
 		Bus = NULL;
 		IRQAck = NULL;
+		IRQAckData = NULL;
+		memset(fetchMap, 0, sizeof(fetchMap));
+		Trace = NULL;
+		traceCycles = 0;
+		traceLastPC = 0;
+		traceAfterJump = false;
 		memset(&musashiCtx, 0, sizeof(musashiCtx));	// very important! garbage in context at reset can cause very strange bugs
 #ifdef SUPERMODEL_DEBUGGER
 		Debug = NULL;
@@ -153,6 +172,14 @@ extern void M68KSetDRegister(int n, UINT32 v);
  */
 extern UINT32 M68KGetPC(void);
 
+/*
+ * M68KGetSR():
+ *
+ * Returns:
+ *		Status register.
+ */
+extern UINT32 M68KGetSR(void);
+
 /*
  * M68KSaveState(StateFile, name):
  *
@@ -199,6 +226,25 @@ extern void M68KSetIRQ(int irqLevel);
  */
 extern int M68KRun(int numCycles);
 
+/*
+ * M68KRunIdleSkip(numCycles, idleCycles):
+ *
+ * Runs the 68K like M68KRun() but stops early once it has settled into an idle
+ * loop: several successive short probes in which it wrote nothing to the bus,
+ * left all registers and SR unchanged, and stayed within a few bytes of code.
+ * The remaining cycles are then treated as executed. This is only safe if
+ * nothing outside the 68K can break the loop before numCycles elapse (e.g.,
+ * the caller raises interrupts only between calls).
+ *
+ * Parameters:
+ *		numCycles	Number of cycles to run.
+ *		idleCycles	Incremented by the number of cycles skipped.
+ *
+ * Returns:
+ *		Number of cycles executed, including any skipped.
+ */
+extern int M68KRunIdleSkip(int numCycles, UINT64 *idleCycles);
+
 /*
  * M68KReset():
  *
@@ -207,15 +253,16 @@ extern int M68KRun(int numCycles);
 extern void M68KReset(void);
 
 /*
- * M68KSetIRQCallback(F):
+ * M68KSetIRQCallback(F, data):
  *
  * Installs an interrupt acknowledge callback for the currently active CPU. The
  * default behavior is to always assume autovectored interrupts.
  *
  * Parameters:
- *		F	Callback function.
+ *		F		Callback function, passed data and the interrupt level.
+ *		data	Passed to the callback (the object owning the CPU).
  */
-extern void M68KSetIRQCallback(int (*F)(int));
+extern void M68KSetIRQCallback(int (*F)(void *data, int nIRQ), void *data = NULL);
 
 /*
  * M68KAttachBus(IBus *BusPtr):
@@ -230,6 +277,25 @@ extern void M68KSetIRQCallback(int (*F)(int));
  */
 extern void M68KAttachBus(IBus *BusPtr);
 
+/*
+ * M68KMapFetch(start, end, ptr):
+ *
+ * Maps a region of ROM or RAM for direct instruction, immediate, and
+ * PC-relative fetches by the currently active CPU, bypassing the bus. All
+ * other accesses still go through the bus. The memory must be laid out as
+ * the bus handlers do it: 16-bit words in host byte order. Regions are
+ * handled in 64KB pages; start must be page aligned and end must be the last
+ * byte of a page. Only map memory that has no side effects when read. The
+ * map belongs to the context set with M68KSetContext(), which must have been
+ * called first.
+ *
+ * Parameters:
+ *		start	First 68K address of the region.
+ *		end		Last 68K address of the region (inclusive).
+ *		ptr		Pointer to the memory corresponding to start.
+ */
+extern void M68KMapFetch(UINT32 start, UINT32 end, const UINT8 *ptr);
+
 /*
  * M68KInit():
  *
@@ -245,7 +311,9 @@ extern bool M68KInit(void);
 /*
  * M68KGetContext(M68KCtx *Dest):
  *
- * Copies the internal (active) 68K context back to the destination.
+ * Copies the internal (active) 68K context back to the destination. If Dest
+ * is the active context, only its bus and IRQ callback pointers are updated,
+ * because the CPU state is already used in place.
  *
  * Parameters:
  *		Dest	Location to which to copy 68K context.
@@ -255,13 +323,46 @@ extern void M68KGetContext(M68KCtx *Dest);
 /*
  * M68KSetContext(M68KCtx *Src):
  *
- * Sets the specified 68K context by copying it to the internal context.
+ * Makes the specified 68K context the active context. The CPU state is not
+ * copied; the 68K core operates directly on Src until another context is set,
+ * so Src must remain valid for as long as it is active.
  *
  * Parameters:
- *		Src		Location from which to copy 68K context.
+ *		Src		Context to activate.
  */
 extern void M68KSetContext(M68KCtx *Src);
 
+/*
+ * M68KSetExecTrace(ctx, trace):
+ *
+ * Records the instructions executed by a 68K in an execution trace (see
+ * CPU/ExecTrace.h). In branches only mode, the instructions following flow
+ * control instructions (branches, jumps, returns and traps) and any that do
+ * not closely follow the previous one (exceptions and interrupts) are
+ * recorded.
+ *
+ * Parameters:
+ *		ctx		Context of the 68K to trace (need not be active).
+ *		trace	Trace to record to or NULL to stop tracing.
+ */
+extern void M68KSetExecTrace(M68KCtx *ctx, CExecTrace *trace);
+
+/*
+ * M68KDumpExecTrace(ctx, file):
+ *
+ * Writes the execution trace of a 68K to a file, disassembling from its
+ * memory as it is now. The context is made active while doing so, so no other
+ * 68K may be running.
+ *
+ * Parameters:
+ *		ctx		Context of the traced 68K.
+ *		file	File path.
+ *
+ * Returns:
+ *		OKAY if successful (or not tracing), otherwise FAIL. Prints errors.
+ */
+extern bool M68KDumpExecTrace(M68KCtx *ctx, const std::string &file);
+
 #ifdef SUPERMODEL_DEBUGGER
 #define DBG68K_REG_PC 0
 #define DBG68K_REG_SR 1
@@ -321,6 +422,18 @@ extern "C" {
 #ifdef SUPERMODEL_DEBUGGER
 extern void M68KDebugCallback();
 #endif // SUPERMODEL_DEBUGGER
+
+/*
+ * M68KExecTraceCallback(pc, ir):
+ *
+ * Records an instruction about to be executed in the active context's
+ * execution trace. Only installed while tracing.
+ *
+ * Parameters:
+ *		pc		Address of the instruction.
+ *		ir		First word of the instruction.
+ */
+extern void M68KExecTraceCallback(unsigned int pc, unsigned int ir);
 	
 /*
  * M68KIRQCallback(nIRQ):
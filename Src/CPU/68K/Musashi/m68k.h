@@ -354,6 +354,15 @@ unsigned int m68k_get_context(void* dst);
 /* set the current cpu context */
 void m68k_set_context(void* dst);
 
+/* Make ctx the current cpu context in place, without copying it. The CPU
+ * then runs directly on ctx until another context is selected. NULL selects
+ * the built-in context.
+ */
+void m68k_set_context_ptr(void* ctx);
+
+/* Get the current cpu context (in place) */
+void* m68k_get_context_ptr(void);
+
 /* Register the CPU state information */
 void m68k_state_register(const char *type);
 
@@ -58,6 +58,15 @@
 #include "m68k.h"
 #include <limits.h>
 
+/* Thread-local storage, for the state of the active CPU */
+#if defined(__cplusplus)
+#define M68K_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define M68K_THREAD_LOCAL __declspec(thread)
+#else
+#define M68K_THREAD_LOCAL _Thread_local
+#endif
+
 #if M68K_EMULATE_ADDRESS_ERROR
 #include <setjmp.h>
 #endif /* M68K_EMULATE_ADDRESS_ERROR */
@@ -556,7 +565,7 @@
 /* Address error */
 #if M68K_EMULATE_ADDRESS_ERROR
 	#include <setjmp.h>
-	extern jmp_buf m68ki_aerr_trap;
+	extern M68K_THREAD_LOCAL jmp_buf m68ki_aerr_trap;
 
 	#define m68ki_set_address_error_trap() \
 		if(setjmp(m68ki_aerr_trap) != 0) \
@@ -839,19 +848,21 @@
 #include "m68kctx.h"
 
 
-extern m68ki_cpu_core m68ki_cpu;
-extern sint           m68ki_remaining_cycles;
-extern uint           m68ki_tracing;
+/* The active CPU context, per thread. Switching CPUs only changes the pointer. */
+extern M68K_THREAD_LOCAL m68ki_cpu_core *m68ki_cpu_ptr;
+#define m68ki_cpu (*m68ki_cpu_ptr)
+extern M68K_THREAD_LOCAL sint m68ki_remaining_cycles;
+extern M68K_THREAD_LOCAL uint m68ki_tracing;
 extern const uint8    m68ki_shift_8_table[];
 extern const uint16   m68ki_shift_16_table[];
 extern const uint     m68ki_shift_32_table[];
 extern const uint8    m68ki_exception_cycle_table[][256];
-extern uint           m68ki_address_space;
+extern M68K_THREAD_LOCAL uint m68ki_address_space;
 extern const uint8    m68ki_ea_idx_cycle_table[];
 
-extern uint           m68ki_aerr_address;
-extern uint           m68ki_aerr_write_mode;
-extern uint           m68ki_aerr_fc;
+extern M68K_THREAD_LOCAL uint m68ki_aerr_address;
+extern M68K_THREAD_LOCAL uint m68ki_aerr_write_mode;
+extern M68K_THREAD_LOCAL uint m68ki_aerr_fc;
 
 /* Read data immediately after the program counter */
 INLINE uint m68ki_read_imm_16(void);
@@ -83,5 +83,6 @@ typedef struct
 	void (*pc_changed_callback)(unsigned int new_pc); /* Called when the PC changes by a large amount */
 	void (*set_fc_callback)(unsigned int new_fc);     /* Called when the CPU function code changes */
 	void (*instr_hook_callback)(void);                /* Called every instruction cycle prior to execution */
+	void (*exec_trace_callback)(unsigned int pc, unsigned int ir); /* Supermodel: called before each instruction is executed while tracing, or NULL */
 
 } m68ki_cpu_core;
\ No newline at end of file
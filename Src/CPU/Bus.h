@@ -80,6 +80,25 @@ public:
 	virtual void	Write32(UINT32 addr, UINT32 data)	{}
 	virtual void	Write64(UINT32 addr, UINT64 data)	{}
 	
+	/*
+	 * CopyBlock32(dest, src, numWords):
+	 *
+	 * Optional fast path for devices that move blocks of memory over the bus.
+	 * Must have the same effect as calling Write32(dest, Read32(src)) for
+	 * each word in ascending order, but may copy directly between memory
+	 * regions the bus recognizes.
+	 *
+	 * Parameters:
+	 *		dest		Destination address (32-bit aligned).
+	 *		src			Source address (32-bit aligned).
+	 *		numWords	Number of 32-bit words to copy.
+	 *
+	 * Returns:
+	 *		True if the block was copied, false if nothing was done and the
+	 *		caller must copy it word by word.
+	 */
+	virtual bool	CopyBlock32(UINT32 dest, UINT32 src, unsigned numWords)	{ return false; }
+	
 	/*
 	 * IORead8(addr):
 	 *
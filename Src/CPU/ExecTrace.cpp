@@ -0,0 +1,77 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ExecTrace.cpp
+ *
+ * Implementation of the CExecTrace class.
+ */
+
+#include "ExecTrace.h"
+
+#include "Supermodel.h"
+#include <cstdio>
+
+void CExecTrace::Clear(void)
+{
+	m_count = 0;
+}
+
+bool CExecTrace::Dump(const std::string &file, Disassembler disassemble) const
+{
+	FILE *fp = fopen(file.c_str(), "w");
+	if (NULL == fp)
+		return ErrorLog("Unable to write %s execution trace to '%s'.", m_name.c_str(), file.c_str());
+
+	UINT64 size = m_mask + 1;
+	UINT64 oldest = m_count > size ? m_count - size : 0;
+	fprintf(fp, "%s execution trace: last %llu of %llu %s, oldest first\n\n", m_name.c_str(), (unsigned long long) (m_count - oldest), (unsigned long long) m_count,
+		m_branchesOnly ? "jump targets" : "instructions");
+	fprintf(fp, "  %-16s %-8s %-8s %s\n", "cycle", "pc", "opcode", "instruction");
+	char str[256];
+	for (UINT64 i = oldest; i < m_count; i++)
+	{
+		const Entry &e = m_entries[i & m_mask];
+		disassemble(e.pc, e.opcode, str, sizeof(str));
+		fprintf(fp, "  %16llu %08X %08X %s\n", (unsigned long long) e.cycle, e.pc, e.opcode, str);
+	}
+
+	fclose(fp);
+	printf("Wrote %s execution trace to '%s'.\n", m_name.c_str(), file.c_str());
+	return OKAY;
+}
+
+static size_t RoundUpToPowerOfTwo(size_t size)
+{
+	size_t rounded = 1;
+	while (rounded < size)
+		rounded <<= 1;
+	return rounded;
+}
+
+CExecTrace::CExecTrace(const std::string &name, size_t size, bool branchesOnly)
+	: m_name(name),
+	  m_entries(RoundUpToPowerOfTwo(size)),
+	  m_mask(m_entries.size() - 1),
+	  m_count(0),
+	  m_branchesOnly(branchesOnly)
+{
+}
@@ -0,0 +1,137 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ExecTrace.h
+ *
+ * Header file for the CExecTrace class, a ring of the most recently executed
+ * instructions of one CPU for finding out how it got somewhere.
+ */
+
+#ifndef INCLUDED_EXECTRACE_H
+#define INCLUDED_EXECTRACE_H
+
+#include "Types.h"
+#include <string>
+#include <vector>
+
+/*
+ * CExecTrace:
+ *
+ * Each traced CPU records the PC, opcode and cycle count of the instructions
+ * it executes into a ring buffer of its own, overwriting the oldest entries.
+ * Recording is a single store to memory and takes no locks, so it must be
+ * done only by the thread running the CPU and the ring should be dumped
+ * while that thread is paused (or the CPU has halted).
+ *
+ * In branches only mode, the CPU records only the first instruction executed
+ * after each jump (taken branch, exception or interrupt). The instructions
+ * in between are those following each entry in sequence.
+ */
+class CExecTrace
+{
+public:
+	struct Entry
+	{
+		UINT64	cycle;		// CPU cycle count when the instruction began
+		UINT32	pc;
+		UINT32	opcode;		// first word of the instruction
+	};
+
+	/*
+	 * Disassembler:
+	 *
+	 * Disassembles an instruction recorded in the trace into a string.
+	 */
+	typedef void (*Disassembler)(UINT32 pc, UINT32 opcode, char *str, size_t size);
+
+	/*
+	 * Record(pc, opcode, cycle):
+	 *
+	 * Records an executed instruction.
+	 */
+	inline void Record(UINT32 pc, UINT32 opcode, UINT64 cycle)
+	{
+		Entry &e = m_entries[m_count & m_mask];
+		e.cycle = cycle;
+		e.pc = pc;
+		e.opcode = opcode;
+		++m_count;
+	}
+
+	/*
+	 * BranchesOnly():
+	 *
+	 * Returns:
+	 *		True if only the targets of jumps should be recorded.
+	 */
+	inline bool BranchesOnly(void) const
+	{
+		return m_branchesOnly;
+	}
+
+	const std::string &GetName(void) const
+	{
+		return m_name;
+	}
+
+	/*
+	 * Clear():
+	 *
+	 * Discards all entries (e.g., on reset).
+	 */
+	void Clear(void);
+
+	/*
+	 * Dump(file, disassemble):
+	 *
+	 * Writes the entries in the ring, oldest first, to a text file with their
+	 * raw values and disassembly.
+	 *
+	 * Parameters:
+	 *		file		File path.
+	 *		disassemble	Disassembler for the CPU's instructions.
+	 *
+	 * Returns:
+	 *		OKAY if successful, otherwise FAIL. Prints errors.
+	 */
+	bool Dump(const std::string &file, Disassembler disassemble) const;
+
+	/*
+	 * CExecTrace(name, size, branchesOnly):
+	 *
+	 * Parameters:
+	 *		name			Name of the CPU for the dump.
+	 *		size			Number of entries to hold, rounded up to the next
+	 *						power of two.
+	 *		branchesOnly	Whether only the targets of jumps are recorded.
+	 */
+	CExecTrace(const std::string &name, size_t size, bool branchesOnly);
+
+private:
+	std::string			m_name;
+	std::vector<Entry>	m_entries;
+	size_t				m_mask;
+	UINT64				m_count;		// entries recorded so far
+	bool				m_branchesOnly;
+};
+
+#endif	// INCLUDED_EXECTRACE_H
@@ -30,21 +30,26 @@
 
 #include "ppc.h"
 
+#include <cstdio>	// snprintf()
 #include <cstring>	// memset()
 #include "Supermodel.h"
 #include "CPU/Bus.h"
+#include "CPU/ExecTrace.h"
+#include "CPU/PowerPC/PPCDisasm.h"
+#ifdef PPC_PROFILE
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifdef SUPERMODEL_DEBUGGER
+#include "Debugger/Label.h"
+#endif // SUPERMODEL_DEBUGGER
+#endif // PPC_PROFILE
 
 // Typedefs that Supermodel no longer provides
 typedef unsigned int	UINT;
 
-// Model 3 context provides read/write handlers
-static class IBus	*Bus = NULL;	// pointer to Model 3 bus object (for access handlers)
-
-#ifdef SUPERMODEL_DEBUGGER
-// Pointer to current PPC debugger (if any)
-static class Debugger::CPPCDebug *PPCDebug = NULL;
-#endif
-
 void ppc603_exception(int exception);
 static void ppc603_check_interrupts(void);
 
@@ -243,21 +248,22 @@ typedef struct {
 	int (*irq_callback)(int irqline);
 
 	PPC_FETCH_REGION	cur_fetch;
+	PPC_FETCH_REGION	prev_fetch;		// region left last, tried before the others (calls between CROM and RAM)
 	PPC_FETCH_REGION	* fetch;
 
 	// STUFF added for the 6xx series
 	UINT32 dec;
 	UINT32 fpscr;
+	FPR fprf_result;	// FP result whose class has not been stored in FPSCR[FPRF] yet
+	bool fprf_pending;
 
 	FPR	fpr[32];
 	UINT32 sr[16];
 
 	// Timing related
 	int timer_ratio;
-	UINT32 timer_frac;
-	int tb_base_icount;
-	int dec_base_icount;
-	int dec_trigger_cycle;
+	UINT64 timer_base_cycle;	// cycle at which tb and dec hold their stored values
+	UINT64 dec_trigger;			// cycle at which the decrementer next passes through zero
 	
 	// Cycle related
 	UINT64 total_cycles;
@@ -284,7 +290,149 @@ typedef struct {
 
 
 
-static PPC_REGS ppc;
+/*
+ * Memory access. Pages of plain memory (stored as little endian 32-bit words,
+ * like Model 3 RAM and CROM) can be mapped directly with ppc_map_memory(),
+ * bypassing the bus. Unmapped pages and unaligned accesses go to the bus.
+ * Pages of little endian device memory, which the bus writes byte reversed
+ * words to, can be mapped for aligned 32- and 64-bit writes with
+ * ppc_map_swapped_memory(). They are only looked up for pages not mapped
+ * as plain memory, so RAM accesses cost no more.
+ */
+
+#define PPC_MEM_PAGE_SHIFT	16
+#define PPC_MEM_PAGE_MASK	((1 << PPC_MEM_PAGE_SHIFT) - 1)
+#define PPC_MEM_NUM_PAGES	(1 << (32 - PPC_MEM_PAGE_SHIFT))
+
+#define DRC_CHUNK_SHIFT		16		// block lookup table granularity (see ppc_drc.c)
+
+// A block expected to run at pc, valid while the cache is in the same generation
+typedef struct
+{
+	UINT32			pc;
+	UINT32			generation;
+	void			*block;
+} PPC_DRC_LINK;
+
+// Recompiler and block cache state (see ppc_drc.c)
+typedef struct
+{
+	PPC_EXEC_MODE	mode;
+	UINT8			*cache;			// block storage (executable in recompiler mode)
+	UINT8			*cache_ptr;		// next free byte
+	void			**lookup[1 << (32 - DRC_CHUNK_SHIFT)];	// blocks per 64 KB chunk, indexed by word
+	UINT32			generation;		// changed whenever blocks are invalidated or freed, making links to them stale
+	void			*exit_link;		// link a recompiled block was last left through, if not yet followed
+	bool			no_chaining;	// links are never followed (see ppc_set_block_chaining())
+	UINT32			blocks_compiled;
+	UINT32			flushes;
+} PPC_DRC_STATE;
+
+// Idle loop detection state (see ppc_idle.c)
+typedef struct
+{
+	bool	enabled;
+	UINT64	skipped_cycles;
+	UINT32	watch_pc;		// branch target watched for (0 for none)
+	bool	watch_hit;
+} PPC_IDLE_STATE;
+
+// High-level emulation state (see ppc_hle.c)
+#define PPC_HLE_MAX_ROUTINES		16
+#define PPC_HLE_MAX_WORDS			16
+#define PPC_HLE_CACHE_SIZE			256		// call targets looked up
+#define PPC_HLE_MAX_VALIDATE_BYTES	0x10000	// larger calls are not validated
+
+typedef struct
+{
+	char			name[32];
+	PPC_HLE_TYPE	type;
+	UINT32			words[PPC_HLE_MAX_WORDS];	// signature, already masked
+	UINT32			masks[PPC_HLE_MAX_WORDS];
+	UINT32			num_words;
+	UINT32			cycles_per_word;
+	UINT32			result;			// returned by PPC_HLE_SELFTEST
+	bool			disabled;		// failed validation
+	bool			validated;		// matched the game's routine at least once
+} PPC_HLE_ROUTINE;
+
+typedef struct
+{
+	UINT32	tag;		// call target | 1, or 0 if empty
+	INT32	routine;	// index of the routine there, or -1 for none
+} PPC_HLE_CACHE_ENTRY;
+
+typedef struct
+{
+	bool				enabled;
+	bool				validate;
+	bool				boot;			// self-test routines are skipped
+	PPC_HLE_ROUTINE		routines[PPC_HLE_MAX_ROUTINES];
+	UINT32				num_routines;
+	PPC_HLE_CACHE_ENTRY	cache[PPC_HLE_CACHE_SIZE];
+	struct
+	{
+		bool	active;
+		INT32	routine;
+		UINT32	return_addr;
+		UINT32	sp;
+		UINT32	dst;
+		UINT32	bytes;
+		UINT64	start_cycle;
+	} pending;			// call being validated
+	UINT8				expected[PPC_HLE_MAX_VALIDATE_BYTES];	// destination as it should be left
+} PPC_HLE_STATE;
+
+/*
+ * Everything belonging to one emulated PowerPC. The opcode and rotate mask
+ * tables are shared by all contexts and never change once built, so several
+ * contexts may be run concurrently from different threads. Each thread
+ * executes whichever context it last selected with ppc_set_context().
+ */
+struct PPC_CONTEXT
+{
+	PPC_REGS		regs;
+	class IBus		*bus;			// Model 3 bus object (for access handlers)
+#ifdef SUPERMODEL_DEBUGGER
+	class Debugger::CPPCDebug *debug;	// PPC debugger while it is watching execution (otherwise NULL)
+	class Debugger::CPPCDebug *attached_debug;	// attached PPC debugger (if any)
+	class IBus		*debug_bus;		// debugger's bus, used while it is watching
+	class IBus		*unwatched_bus;	// Model 3 bus, used while it is not
+#endif
+	UINT8			**read_map;		// either read_pages or ppc_no_pages
+	UINT8			**write_map;
+	UINT8			**swap_write_map;	// either swap_write_pages or ppc_no_pages
+	UINT8			*read_pages[PPC_MEM_NUM_PAGES];
+	UINT8			*write_pages[PPC_MEM_NUM_PAGES];
+	UINT8			*swap_write_pages[PPC_MEM_NUM_PAGES];
+	UINT8			code_pages[1 << (32 - 12)];	// 4 KB pages holding cached code that must be invalidated on write (see ppc_drc.c)
+	PPC_DRC_STATE	drc;
+	PPC_IDLE_STATE	idle;
+	PPC_HLE_STATE	hle;
+	CExecTrace		*trace;			// execution trace (if any)
+	UINT32			trace_next_pc;	// address following the last instruction executed while tracing
+};
+
+#ifdef SUPERMODEL_DEBUGGER
+static UINT8 *ppc_no_pages[PPC_MEM_NUM_PAGES];	// used while the debugger is watching the bus
+#endif // SUPERMODEL_DEBUGGER
+
+static PPC_CONTEXT ppc_default_context = { {}, NULL,
+#ifdef SUPERMODEL_DEBUGGER
+	NULL, NULL, NULL, NULL,
+#endif
+	ppc_default_context.read_pages, ppc_default_context.write_pages, ppc_default_context.swap_write_pages };
+static thread_local PPC_CONTEXT *ppc_context = &ppc_default_context;
+
+#define ppc				(ppc_context->regs)
+#define Bus				(ppc_context->bus)
+#define PPCDebug		(ppc_context->debug)
+#define PPCDebugAttached	(ppc_context->attached_debug)
+#define ppc_read_map	(ppc_context->read_map)
+#define ppc_write_map	(ppc_context->write_map)
+#define ppc_swap_write_map	(ppc_context->swap_write_map)
+#define ppc_code_pages	(ppc_context->code_pages)
+
 static UINT32 ppc_rotate_mask[32][32];
 
 static void ppc_change_pc(UINT32 newpc)
@@ -296,10 +444,20 @@ static void ppc_change_pc(UINT32 newpc)
 		return;
 	}
 
+	if (ppc.prev_fetch.ptr != NULL && ppc.prev_fetch.start <= newpc && newpc <= ppc.prev_fetch.end)
+	{
+		PPC_FETCH_REGION region = ppc.prev_fetch;
+		ppc.prev_fetch = ppc.cur_fetch;
+		ppc.cur_fetch = region;
+		ppc.op = &ppc.cur_fetch.ptr[(newpc-ppc.cur_fetch.start)/4];
+		return;
+	}
+
 	for(UINT i = 0; ppc.fetch[i].ptr != NULL; i++)
 	{
 		if (ppc.fetch[i].start <= newpc && newpc <= ppc.fetch[i].end)
 		{
+			ppc.prev_fetch = ppc.cur_fetch;
 			ppc.cur_fetch.start = ppc.fetch[i].start;
 			ppc.cur_fetch.end = ppc.fetch[i].end;
 			ppc.cur_fetch.ptr = ppc.fetch[i].ptr;
@@ -317,41 +475,103 @@ static void ppc_change_pc(UINT32 newpc)
 
 static inline UINT8 READ8(UINT32 address)
 {
+	const UINT8 *page = ppc_read_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL)
+		return page[(address & PPC_MEM_PAGE_MASK) ^ BYTE_LANE_XOR8];
 	return Bus->Read8(address);
 }
 
 static inline UINT16 READ16(UINT32 address)
 {
+	const UINT8 *page = ppc_read_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL && !(address & 1))
+		return *(const UINT16 *) &page[(address & PPC_MEM_PAGE_MASK) ^ BYTE_LANE_XOR16];
 	return Bus->Read16(address);
 }
 
 static inline UINT32 READ32(UINT32 address)
 {
+	const UINT8 *page = ppc_read_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL && !(address & 3))
+		return *(const UINT32 *) &page[address & PPC_MEM_PAGE_MASK];
 	return Bus->Read32(address);
 }
 
 static inline UINT64 READ64(UINT32 address)
 {
+	const UINT8 *page = ppc_read_map[address >> PPC_MEM_PAGE_SHIFT];
+	UINT32 offset = address & PPC_MEM_PAGE_MASK;
+	if (page != NULL && !(address & 3) && offset <= PPC_MEM_PAGE_MASK - 7)
+		return ((UINT64) *(const UINT32 *) &page[offset] << 32) | *(const UINT32 *) &page[offset + 4];
 	return Bus->Read64(address);
 }
 
 static inline void WRITE8(UINT32 address, UINT8 data)
 {
+	UINT8 *page = ppc_write_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL)
+	{
+		page[(address & PPC_MEM_PAGE_MASK) ^ BYTE_LANE_XOR8] = data;
+		if (ppc_code_pages[address >> 12])
+			ppc_invalidate_code(address);
+		return;
+	}
 	Bus->Write8(address,data);
 }
 
 static inline void WRITE16(UINT32 address, UINT16 data)
 {
+	UINT8 *page = ppc_write_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL && !(address & 1))
+	{
+		*(UINT16 *) &page[(address & PPC_MEM_PAGE_MASK) ^ BYTE_LANE_XOR16] = data;
+		if (ppc_code_pages[address >> 12])
+			ppc_invalidate_code(address);
+		return;
+	}
 	Bus->Write16(address,data);
 }
 
 static inline void WRITE32(UINT32 address, UINT32 data)
 {
+	UINT8 *page = ppc_write_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL && !(address & 3))
+	{
+		*(UINT32 *) &page[address & PPC_MEM_PAGE_MASK] = data;
+		if (ppc_code_pages[address >> 12])
+			ppc_invalidate_code(address);
+		return;
+	}
+	page = ppc_swap_write_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL && !(address & 3))
+	{
+		*(UINT32 *) &page[address & PPC_MEM_PAGE_MASK] = FLIPENDIAN32(data);
+		return;
+	}
 	Bus->Write32(address,data);
 }
 
 static inline void WRITE64(UINT32 address, UINT64 data)
 {
+	UINT8 *page = ppc_write_map[address >> PPC_MEM_PAGE_SHIFT];
+	UINT32 offset = address & PPC_MEM_PAGE_MASK;
+	if (page != NULL && !(address & 3) && offset <= PPC_MEM_PAGE_MASK - 7)
+	{
+		*(UINT32 *) &page[offset] = (UINT32) (data >> 32);
+		*(UINT32 *) &page[offset + 4] = (UINT32) data;
+		if (ppc_code_pages[address >> 12])
+			ppc_invalidate_code(address);
+		if (ppc_code_pages[(address + 4) >> 12])
+			ppc_invalidate_code(address + 4);
+		return;
+	}
+	page = ppc_swap_write_map[address >> PPC_MEM_PAGE_SHIFT];
+	if (page != NULL && !(address & 3) && offset <= PPC_MEM_PAGE_MASK - 7)
+	{
+		*(UINT32 *) &page[offset] = FLIPENDIAN32((UINT32) (data >> 32));
+		*(UINT32 *) &page[offset + 4] = FLIPENDIAN32((UINT32) data);
+		return;
+	}
 	Bus->Write64(address,data);
 }
 
@@ -426,38 +646,78 @@ static inline UINT32 check_condition_code(UINT32 bo, UINT32 bi)
 	return ctr_ok & condition_ok;
 }
 
-static inline UINT64 ppc_read_timebase(void)
+/*
+ * The timebase and decrementer are not stepped while executing. Instead, tb
+ * and dec hold their values as of timer_base_cycle and are brought up to date
+ * only when read or written. The only thing the execution loop needs to know
+ * is the cycle at which the decrementer passes through zero (dec_trigger),
+ * which ppc_execute() treats as the end of a segment.
+ */
+
+static inline UINT64 ppc_current_cycle(void)
+{
+	return ppc.total_cycles + (UINT64)(ppc.cur_cycles - ppc.icount);
+}
+
+/*
+ * Records an instruction about to be executed at ppc.pc in the execution
+ * trace. In branches only mode, it is recorded only if it does not follow the
+ * last instruction executed.
+ */
+static inline void ppc_trace_insn(CExecTrace *trace, UINT32 opcode)
 {
-	int cycles = ppc.tb_base_icount - ppc.icount;
+	if (!trace->BranchesOnly() || ppc.pc != ppc_context->trace_next_pc)
+		trace->Record(ppc.pc, opcode, ppc_current_cycle());
+	ppc_context->trace_next_pc = ppc.pc + 4;
+}
 
+// Number of timer ticks elapsed since timer_base_cycle
+static inline UINT64 ppc_timer_ticks(void)
+{
+	return (ppc_current_cycle() - ppc.timer_base_cycle) / ppc.timer_ratio;
+}
+
+static inline void ppc_update_dec_trigger(void)
+{
+	// Exception occurs after decrementer has passed through zero
+	UINT64 ticks = ppc_timer_ticks();
+	UINT32 dec = DEC - (UINT32)ticks;
+	ppc.dec_trigger = ppc.timer_base_cycle + (ticks + (UINT64)dec + 1) * ppc.timer_ratio;
+
+	// If this falls within the current segment, end the segment there
+	UINT64 now = ppc_current_cycle();
+	if (ppc.dec_trigger - now < (UINT64)ppc.icount)
+	{
+		int remaining = (int)(ppc.dec_trigger - now);
+		ppc.cur_cycles -= ppc.icount - remaining;
+		ppc.icount = remaining;
+	}
+}
+
+static inline UINT64 ppc_read_timebase(void)
+{
 	// Timebase is incremented according to timer ratio, so adjust value accordingly
-	return ppc.tb + (cycles / ppc.timer_ratio);
+	return ppc.tb + ppc_timer_ticks();
 }
 
 static inline void ppc_write_timebase_l(UINT32 tbl)
 {
 	UINT64 tb = ppc_read_timebase();
 
-	ppc.tb_base_icount = ppc.icount + ((ppc.tb_base_icount - ppc.icount) % ppc.timer_ratio);
-
-	ppc.tb = (tb&~0xffffffff)|tbl;
+	ppc.tb = ((tb&~0xffffffff)|tbl) - ppc_timer_ticks();
 }
 
 static inline void ppc_write_timebase_h(UINT32 tbh)
 {
 	UINT64 tb = ppc_read_timebase();
 
-	ppc.tb_base_icount = ppc.icount + ((ppc.tb_base_icount - ppc.icount) % ppc.timer_ratio);
-	
-	ppc.tb = (tb&0xffffffff)|((UINT64)(tbh) << 32);
+	ppc.tb = ((tb&0xffffffff)|((UINT64)(tbh) << 32)) - ppc_timer_ticks();
 }
 
 static inline UINT32 read_decrementer(void)
 {
-	int cycles = ppc.dec_base_icount - ppc.icount;
-
 	// Decrementer is decremented at same rate as timebase, so adjust value accordingly
-	return DEC - (cycles / ppc.timer_ratio);
+	return DEC - (UINT32)ppc_timer_ticks();
 }
 
 static inline void write_decrementer(UINT32 value)
@@ -469,16 +729,8 @@ static inline void write_decrementer(UINT32 value)
 		ppc603_check_interrupts();
 	}
 
-	ppc.dec_base_icount = ppc.icount + ((ppc.dec_base_icount - ppc.icount) % ppc.timer_ratio);
-	
-	DEC = value;
-
-	// Check if decrementer exception occurs during execution (exception occurs after decrementer
-	// has passed through zero)
-	if ((UINT32)(ppc.dec_base_icount / ppc.timer_ratio) > DEC)
-		ppc.dec_trigger_cycle = ppc.dec_base_icount - ((1 + DEC) * ppc.timer_ratio);
-	else
-		ppc.dec_trigger_cycle = 0x7fffffff;
+	DEC = value + (UINT32)ppc_timer_ticks();
+	ppc_update_dec_trigger();
 }
 
 /*********************************************************************/
@@ -663,21 +915,39 @@ static void (* optable59[1024])(UINT32);
 static void (* optable63[1024])(UINT32);
 static void (* optable[64])(UINT32);
 
+// Threaded interpreter dispatch requires the GCC labels-as-values extension.
+// The profiler hooks only exist in the plain interpreter loop.
+#if defined(__GNUC__) && !defined(PPC_NO_THREADED_DISPATCH) && !defined(PPC_PROFILE)
+#define PPC_THREADED_DISPATCH
+static void ppc_execute_threaded(void);
+#endif
+
+#ifdef SUPERMODEL_DEBUGGER
+static void ppc_update_debug_hooks(void);
+#endif // SUPERMODEL_DEBUGGER
+
+#include "ppc_drc.c"
+#include "ppc_idle.c"
+#include "ppc_hle.c"
+#include "ppc_profile.c"
 #include "ppc603.c"
 
 /********************************************************************/
 
 #include "ppc_ops.c"
 #include "ppc_ops.h"
+#include "ppc_threaded.c"
 
 /* Initialization and shutdown */
 
-void ppc_base_init(void)
+/*
+ * Builds the opcode and rotate mask tables. These are shared by all contexts
+ * and are only built once.
+ */
+static bool ppc_build_tables(void)
 {
 	int i,j;
 
-	memset(&ppc, 0, sizeof(ppc));
-
 	for( i=0; i < 64; i++ ) {
 		optable[i] = ppc_invalid;
 	}
@@ -724,15 +994,6 @@ void ppc_base_init(void)
 			ppc_rotate_mask[i][j] = mask;
 		}
 	}
-}
-
-void ppc_init(const PPC_CONFIG *config)
-{
-	int pll_config = 0;
-	float multiplier;
-	int i ;
-
-	ppc_base_init() ;
 
 	optable[48] = ppc_lfs;
 	optable[49] = ppc_lfsu;
@@ -819,6 +1080,27 @@ void ppc_init(const PPC_CONFIG *config)
 			((i & 0x01) ? 0x0000000F : 0);
 	}
 
+	return true;
+}
+
+void ppc_base_init(void)
+{
+	static const bool tables_built = ppc_build_tables();
+	(void) tables_built;
+
+	memset(&ppc, 0, sizeof(ppc));
+	memset(ppc_context->read_pages, 0, sizeof(ppc_context->read_pages));
+	memset(ppc_context->write_pages, 0, sizeof(ppc_context->write_pages));
+	memset(ppc_context->swap_write_pages, 0, sizeof(ppc_context->swap_write_pages));
+}
+
+void ppc_init(const PPC_CONFIG *config)
+{
+	int pll_config = 0;
+	float multiplier;
+
+	ppc_base_init() ;
+
 	ppc.pvr = config->pvr;
 
 	multiplier = (float)((config->bus_frequency_multiplier >> 4) & 0xf) +
@@ -859,7 +1141,7 @@ void ppc_init(const PPC_CONFIG *config)
 
 void ppc_shutdown(void)
 {
-
+	ppc_set_exec_mode(PPC_EXEC_INTERPRETER);
 }
 
 void ppc_set_irq_line(int irqline)
@@ -883,6 +1165,7 @@ UINT32 ppc_get_pc(void)
 void ppc_set_fetch(PPC_FETCH_REGION * fetch)
 {
 	ppc.fetch = fetch;
+	ppc.prev_fetch.ptr = NULL;
 }
 
 UINT64 ppc_total_cycles(void)
@@ -902,7 +1185,16 @@ int ppc_get_bus_freq_multipler()
 
 void ppc_set_timer_ratio(int ratio)
 {
+	// Fold the ticks counted at the old rate into tb and dec, keeping the
+	// partial tick, before switching to the new rate
+	UINT64 elapsed = ppc_current_cycle() - ppc.timer_base_cycle;
+	UINT64 ticks = elapsed / ppc.timer_ratio;
+	ppc.tb += ticks;
+	DEC -= (UINT32)ticks;
+	ppc.timer_base_cycle = ppc_current_cycle() - elapsed % ppc.timer_ratio;
+
 	ppc.timer_ratio = ratio;
+	ppc_update_dec_trigger();
 }
 
 int ppc_get_timer_ratio()
@@ -914,11 +1206,60 @@ int ppc_get_timer_ratio()
  Supermodel Interface
 ******************************************************************************/
 
+void ppc_map_memory(UINT32 start, UINT32 end, UINT8 *ptr, bool writable)
+{
+	for (UINT64 addr = start & ~PPC_MEM_PAGE_MASK; addr <= end; addr += (1 << PPC_MEM_PAGE_SHIFT))
+	{
+		UINT32 page = (UINT32) (addr >> PPC_MEM_PAGE_SHIFT);
+		UINT8 *host = (ptr == NULL) ? NULL : ptr + (addr - start);
+		ppc_context->read_pages[page] = host;
+		ppc_context->write_pages[page] = writable ? host : NULL;
+	}
+}
+
+void ppc_map_swapped_memory(UINT32 start, UINT32 end, UINT8 *ptr)
+{
+	for (UINT64 addr = start & ~PPC_MEM_PAGE_MASK; addr <= end; addr += (1 << PPC_MEM_PAGE_SHIFT))
+		ppc_context->swap_write_pages[addr >> PPC_MEM_PAGE_SHIFT] = (ptr == NULL) ? NULL : ptr + (addr - start);
+}
+
 void ppc_attach_bus(IBus *BusPtr)
 {
 	Bus = BusPtr;
 }
 
+PPC_CONTEXT *ppc_create_context(void)
+{
+	PPC_CONTEXT *ctx = (PPC_CONTEXT *) calloc(1, sizeof(PPC_CONTEXT));
+	if (ctx == NULL)
+		return NULL;
+	ctx->read_map = ctx->read_pages;
+	ctx->write_map = ctx->write_pages;
+	ctx->swap_write_map = ctx->swap_write_pages;
+	return ctx;
+}
+
+void ppc_destroy_context(PPC_CONTEXT *ctx)
+{
+	if (ctx == NULL)
+		return;
+	PPC_CONTEXT *prev = ppc_context;
+	ppc_context = ctx;
+	ppc_shutdown();		// releases the code cache
+	ppc_context = (prev == ctx) ? &ppc_default_context : prev;
+	free(ctx);
+}
+
+void ppc_set_context(PPC_CONTEXT *ctx)
+{
+	ppc_context = (ctx == NULL) ? &ppc_default_context : ctx;
+}
+
+PPC_CONTEXT *ppc_get_context(void)
+{
+	return ppc_context;
+}
+
 void ppc_save_state(CBlockFile *SaveState)
 {
 	SaveState->NewBlock("PowerPC", __FILE__);
@@ -984,10 +1325,14 @@ void ppc_save_state(CBlockFile *SaveState)
 	SaveState->Write(&ppc.reserved_address, sizeof(ppc.reserved_address));
 	SaveState->Write(&ppc.external_int, sizeof(ppc.external_int));
 	
-	SaveState->Write(&ppc.tb, sizeof(ppc.tb));
+	UINT64 tb = ppc_read_timebase();
+	UINT32 dec = read_decrementer();
+	UINT32 timerFrac = (UINT32)((ppc_current_cycle() - ppc.timer_base_cycle) % ppc.timer_ratio);
+	SaveState->Write(&tb, sizeof(tb));
 	
-	SaveState->Write(&ppc.dec, sizeof(ppc.dec));
-	SaveState->Write(&ppc.timer_frac, sizeof(ppc.timer_frac));
+	SaveState->Write(&dec, sizeof(dec));
+	SaveState->Write(&timerFrac, sizeof(timerFrac));
+	flush_fprf();
 	SaveState->Write(&ppc.fpscr, sizeof(ppc.fpscr));
 	
 	SaveState->Write(ppc.fpr, sizeof(ppc.fpr));
@@ -1012,6 +1357,8 @@ void ppc_load_state(CBlockFile *SaveState)
 	SaveState->Read(&ppc.pc, sizeof(ppc.pc));
 	SaveState->Read(&ppc.npc, sizeof(ppc.npc));
 	ppc_change_pc(ppc.npc);
+	ppc_flush_code();	// memory contents have been replaced
+	hle_flush_cache();
 	SaveState->Read(&ppc.lr, sizeof(ppc.lr));
 	SaveState->Read(&ppc.ctr, sizeof(ppc.ctr));
 	SaveState->Read(&ppc.xer, sizeof(ppc.xer));
@@ -1066,8 +1413,12 @@ void ppc_load_state(CBlockFile *SaveState)
 	SaveState->Read(&ppc.tb, sizeof(ppc.tb));
 	
 	SaveState->Read(&ppc.dec, sizeof(ppc.dec));
-	SaveState->Read(&ppc.timer_frac, sizeof(ppc.timer_frac));
+	UINT32 timerFrac;
+	SaveState->Read(&timerFrac, sizeof(timerFrac));
+	ppc.timer_base_cycle = ppc_current_cycle() - timerFrac;
+	ppc_update_dec_trigger();
 	SaveState->Read(&ppc.fpscr, sizeof(ppc.fpscr));
+	ppc.fprf_pending = false;
 	
 	SaveState->Read(ppc.fpr, sizeof(ppc.fpr));
 	SaveState->Read(ppc.sr, sizeof(ppc.sr));
@@ -1098,31 +1449,100 @@ UINT32 ppc_read_sr(unsigned num)
 	return ppc.sr[num&15];
 }
 
+/******************************************************************************
+ Execution Trace
+******************************************************************************/
+
+void ppc_attach_trace(CExecTrace *trace)
+{
+	ppc_context->trace = trace;
+	ppc_context->trace_next_pc = 0;
+}
+
+static void ppc_disassemble_trace(UINT32 pc, UINT32 opcode, char *str, size_t size)
+{
+	char mnem[32], oprs[256];
+	DisassemblePowerPC(opcode, pc, mnem, oprs, true);
+	if (mnem[0] == '\0')
+		snprintf(str, size, "?");
+	else
+		snprintf(str, size, "%s %s", mnem, oprs);
+}
+
+bool ppc_dump_trace(const char *file)
+{
+	if (ppc_context->trace == NULL)
+		return OKAY;
+	return ppc_context->trace->Dump(file, ppc_disassemble_trace);
+}
+
+bool ppc_halted(void)
+{
+	return ppc.fatalError;
+}
+
 /******************************************************************************
  Debugger Interface
 ******************************************************************************/
 
 #ifdef SUPERMODEL_DEBUGGER
+/*
+ * An attached debugger only sees execution while it needs to (see
+ * CCPUDebug::NeedsHooks()). Otherwise the CPU runs as though there were no
+ * debugger, with direct memory pages and the fast execution paths, until the
+ * debugger next needs it at the start of an execution segment.
+ */
+static void ppc_update_debug_hooks(void)
+{
+	bool watch = PPCDebugAttached != NULL && PPCDebugAttached->NeedsHooks();
+	if (watch == (PPCDebug != NULL))
+		return;
+	if (watch)
+	{
+		PPCDebug = PPCDebugAttached;
+		Bus = ppc_context->debug_bus;
+		ppc_read_map = ppc_no_pages;	// all accesses must be seen by the debugger
+		ppc_write_map = ppc_no_pages;
+		ppc_swap_write_map = ppc_no_pages;
+	}
+	else
+	{
+		PPCDebug = NULL;
+		Bus = ppc_context->unwatched_bus;
+		ppc_read_map = ppc_context->read_pages;
+		ppc_write_map = ppc_context->write_pages;
+		ppc_swap_write_map = ppc_context->swap_write_pages;
+	}
+}
+
 void ppc_attach_debugger(Debugger::CPPCDebug *PPCDebugPtr)
 {
-	if (PPCDebug != NULL)
+	if (PPCDebugAttached != NULL)
 		ppc_detach_debugger();
-	PPCDebug = PPCDebugPtr;
-	Bus = PPCDebug->AttachBus(Bus);
+	PPCDebugAttached = PPCDebugPtr;
+	ppc_context->unwatched_bus = Bus;
+	ppc_context->debug_bus = PPCDebugAttached->AttachBus(Bus);
+	ppc_update_debug_hooks();
 }
 
 void ppc_detach_debugger()
 {
-	if (PPCDebug == NULL)
+	if (PPCDebugAttached == NULL)
 		return;
-	Bus = PPCDebug->DetachBus(); 
+	Bus = PPCDebugAttached->DetachBus(); 
 	PPCDebug = NULL;
+	PPCDebugAttached = NULL;
+	ppc_context->debug_bus = NULL;
+	ppc_context->unwatched_bus = NULL;
+	ppc_read_map = ppc_context->read_pages;
+	ppc_write_map = ppc_context->write_pages;
+	ppc_swap_write_map = ppc_context->swap_write_pages;
 }
 
 void ppc_break()
 {
-	if (PPCDebug != NULL)
-		PPCDebug->ForceBreak(true);
+	if (PPCDebugAttached != NULL)
+		PPCDebugAttached->ForceBreak(true);
 }
 #else  // SUPERMODEL_DEBUGGER
 void ppc_break()
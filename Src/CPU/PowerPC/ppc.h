@@ -343,6 +343,12 @@ typedef struct
 
 } PPC_FETCH_REGION;
 
+typedef enum {
+	PPC_EXEC_INTERPRETER = 0,	// fetch and decode every instruction
+	PPC_EXEC_BLOCK_CACHE,		// execute cached blocks of pre-decoded instructions
+	PPC_EXEC_RECOMPILER			// execute blocks translated to host code
+} PPC_EXEC_MODE;
+
 
 /******************************************************************************
  Functions
@@ -363,6 +369,16 @@ extern void ppc_set_timer_ratio(int ratio);
 
 // These have been added to support the new Supermodel
 extern void ppc_attach_bus(class IBus *BusPtr);		// must be called first!
+
+// Contexts. All other functions operate on the calling thread's current
+// context, which is a built-in default context until one is selected.
+typedef struct PPC_CONTEXT PPC_CONTEXT;
+extern PPC_CONTEXT *ppc_create_context(void);	// returns NULL if out of memory
+extern void ppc_destroy_context(PPC_CONTEXT *ctx);
+extern void ppc_set_context(PPC_CONTEXT *ctx);	// NULL selects the default context
+extern PPC_CONTEXT *ppc_get_context(void);
+extern void ppc_map_memory(UINT32 start, UINT32 end, UINT8 *ptr, bool writable);	// 64 KB aligned, ptr = NULL to go through bus
+extern void ppc_map_swapped_memory(UINT32 start, UINT32 end, UINT8 *ptr);	// word writes stored byte reversed, as above
 extern void ppc_save_state(class CBlockFile *SaveState);
 extern void ppc_load_state(class CBlockFile *SaveState);
 extern UINT32 ppc_get_gpr(unsigned num);
@@ -371,6 +387,50 @@ extern UINT32 ppc_get_lr(void);
 extern UINT32 ppc_read_spr(unsigned spr);
 extern UINT32 ppc_read_sr(unsigned num);
 
+// Block cache and dynamic recompiler
+extern void ppc_set_exec_mode(PPC_EXEC_MODE mode);	// falls back to a slower mode if unsupported
+extern PPC_EXEC_MODE ppc_get_exec_mode(void);
+extern void ppc_flush_code(void);
+extern void ppc_invalidate_code(UINT32 addr);		// must be called for writes to pages flagged in the code page map
+extern void ppc_set_block_chaining(bool enable);	// on by default; turning it off only serves to measure it
+extern const UINT8 *ppc_get_code_page_map(void);	// one byte per 4 KB page, non-zero if page holds translated code
+
+// Idle loop skipping
+extern void ppc_set_idle_skip(bool enable);
+extern UINT64 ppc_idle_cycles(void);	// total cycles skipped
+
+// Watch for a taken branch (b or bc) to an address, such as the one a game
+// reaches once it has booted
+extern void ppc_set_watch_pc(UINT32 addr);	// 0 for none, clears the hit
+extern bool ppc_watch_pc_hit(void);
+
+// High-level emulation of the games' block copy and clear routines, which are
+// recognised by the instruction words at their entry (see ppc_hle.c)
+typedef enum {
+	PPC_HLE_MEMCPY = 0,		// r3 = destination, r4 = source, r5 = bytes
+	PPC_HLE_MEMSET,			// r3 = destination, r4 = fill byte, r5 = bytes
+	PPC_HLE_MEMCPY32,		// as PPC_HLE_MEMCPY, r5 = words
+	PPC_HLE_MEMSET32,		// r3 = destination, r4 = fill word, r5 = words
+	PPC_HLE_SELFTEST		// returns result in r3 at once, only while booting
+} PPC_HLE_TYPE;
+
+extern bool ppc_add_hle_routine(const char *name, PPC_HLE_TYPE type, const UINT32 *words, const UINT32 *masks, UINT32 num_words, UINT32 cycles_per_word, UINT32 result = 0);	// returns FAIL if too many or too long
+extern void ppc_clear_hle_routines(void);
+extern void ppc_set_hle(bool enable, bool validate);	// validating runs the game's routines, checking them against the host's
+extern void ppc_set_hle_boot(bool booting);	// self-test routines are only skipped while booting
+
+// Execution trace (see CPU/ExecTrace.h). Tracing runs the interpreter, or the
+// block cache if selected and only branches are traced.
+extern void ppc_attach_trace(class CExecTrace *trace);	// NULL stops tracing
+extern bool ppc_dump_trace(const char *file);			// returns FAIL on error
+extern bool ppc_halted(void);							// true after a fatal error until reset
+
+#ifdef PPC_PROFILE
+// Hotspot profiler (only present when built with PPC_PROFILE)
+extern void ppc_profile_reset(void);
+extern bool ppc_profile_dump(const char *file);	// writes sorted report, returns FAIL on error
+#endif // PPC_PROFILE
+
 #ifdef SUPERMODEL_DEBUGGER
 // These have been added to support the Supermodel debugger
 extern void ppc_attach_debugger(class Debugger::CPPCDebug *PPCDebugPtr);
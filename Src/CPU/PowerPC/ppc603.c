@@ -243,34 +243,30 @@ void ppc_reset(void)
 
 	ppc_set_msr(0x40);
 	ppc_change_pc(ppc.pc);
+	ppc_flush_code();	// memory is about to be reinitialized
+	hle_flush_cache();
 
 	ppc.hid0 = 1;
 
 	ppc.interrupt_pending = 0;
 
 	ppc.tb = 0;
-	ppc.timer_frac = 0;
 	DEC = 0xffffffff;
 	ppc.total_cycles = 0;
 	ppc.cur_cycles = 0;
 	ppc.icount = 0;
+	ppc.timer_base_cycle = 0;
+	ppc_update_dec_trigger();
 }
 
-int ppc_execute(int cycles)
+// Runs until the segment's cycles are used up or emulation is halted
+static void ppc_execute_segment(void)
 {
 	UINT32 opcode;
 
-	ppc.cur_cycles = cycles;
-	ppc.icount = cycles;
-	ppc.tb_base_icount = cycles + ppc.timer_frac;
-	ppc.dec_base_icount = cycles + ppc.timer_frac;
-
-	// Check if decrementer exception occurs during execution (exception occurs after decrementer
-	// has passed through zero)
-	if ((UINT32)(ppc.dec_base_icount / ppc.timer_ratio) > DEC)
-		ppc.dec_trigger_cycle = ppc.dec_base_icount - ((1 + DEC) * ppc.timer_ratio);
-	else
-		ppc.dec_trigger_cycle = 0x7fffffff;
+#ifdef SUPERMODEL_DEBUGGER
+	ppc_update_debug_hooks();
+#endif // SUPERMODEL_DEBUGGER
 
 	ppc_change_pc(ppc.npc);
 
@@ -289,6 +285,34 @@ int ppc_execute(int cycles)
 		PPCDebug->CPUActive();
 #endif // SUPERMODEL_DEBUGGER
 
+	PPC_EXEC_MODE mode = drc.mode;
+	CExecTrace *trace = ppc_context->trace;
+	if (trace != NULL && !(mode == PPC_EXEC_BLOCK_CACHE && trace->BranchesOnly()))
+		mode = PPC_EXEC_INTERPRETER;	// trace needs every instruction, or the blocks to be entered in C
+#ifdef SUPERMODEL_DEBUGGER
+	if (PPCDebug != NULL)
+		mode = PPC_EXEC_INTERPRETER;	// debugger needs to see every instruction
+#endif // SUPERMODEL_DEBUGGER
+#ifdef PPC_PROFILE
+	mode = PPC_EXEC_INTERPRETER;	// so does the profiler
+#endif // PPC_PROFILE
+#ifdef PPC_DRC_X64
+	if (mode == PPC_EXEC_RECOMPILER)
+		drc_execute();
+	else
+#endif // PPC_DRC_X64
+	if (mode == PPC_EXEC_BLOCK_CACHE)
+		drc_execute_decoded();
+	else
+#ifdef PPC_THREADED_DISPATCH
+	if (mode == PPC_EXEC_INTERPRETER && trace == NULL
+#ifdef SUPERMODEL_DEBUGGER
+		&& PPCDebug == NULL
+#endif // SUPERMODEL_DEBUGGER
+		)
+		ppc_execute_threaded();
+	else
+#endif // PPC_THREADED_DISPATCH
 	while( ppc.icount > 0 && !ppc.fatalError)
 	{
 		ppc.pc = ppc.npc;
@@ -313,6 +337,9 @@ int ppc_execute(int cycles)
 		}
 #endif // SUPERMODEL_DEBUGGER
 
+		if (trace != NULL)
+			ppc_trace_insn(trace, opcode);
+
 		switch(opcode >> 26)
 		{
 			case 19:	optable19[(opcode >> 1) & 0x3ff](opcode); break;
@@ -323,12 +350,7 @@ int ppc_execute(int cycles)
 		}
 
 		ppc.icount--;
-		
-		if (ppc.icount == ppc.dec_trigger_cycle)
-		{
-			ppc.interrupt_pending |= 0x2;
-			ppc603_check_interrupts();
-		}
+		PPC_PROFILE_INSN(opcode);
 
 		//ppc603_check_interrupts();
 	}
@@ -337,11 +359,6 @@ int ppc_execute(int cycles)
 	if (PPCDebug != NULL)
 		PPCDebug->CPUInactive();
 #endif // SUPERMODEL_DEBUGGER
-
-	// Update timebase and decrementer.  Both are updated at same rate as specified by timer_ratio.
-	ppc.timer_frac = ((ppc.tb_base_icount - ppc.icount) % ppc.timer_ratio);
-	ppc.tb += ((ppc.tb_base_icount - ppc.icount) / ppc.timer_ratio);
-	DEC -= ((ppc.dec_base_icount - ppc.icount) / ppc.timer_ratio);
 	
 	/*
 	{
@@ -352,12 +369,43 @@ int ppc_execute(int cycles)
 		printf("%08X: %s %s\n", ppc.npc, string1, string2);
 	}
 	*/
+}
 
-	int executed = cycles - ppc.icount;
-	ppc.total_cycles += executed;
-	ppc.cur_cycles = 0;
-	ppc.icount = 0;
-	ppc.tb_base_icount = 0;
-    ppc.dec_base_icount = 0;
-	return executed;
+/*
+ * The time slice is split into segments that end where the decrementer passes
+ * through zero, so the execution loops only have to watch icount. A halted
+ * CPU still consumes its cycles so that callers waiting on ppc_total_cycles()
+ * make progress.
+ */
+int ppc_execute(int cycles)
+{
+	UINT64 start = ppc.total_cycles;
+	UINT64 end = start + cycles;
+
+	while (ppc.total_cycles < end && !ppc.fatalError)
+	{
+		UINT64 segment = end - ppc.total_cycles;
+		if (ppc.dec_trigger - ppc.total_cycles < segment)
+			segment = ppc.dec_trigger - ppc.total_cycles;
+		ppc.cur_cycles = (int)segment;
+		ppc.icount = (int)segment;
+
+		ppc_execute_segment();
+
+		ppc.total_cycles += ppc.cur_cycles - ppc.icount;
+		ppc.cur_cycles = 0;
+		ppc.icount = 0;
+
+		// Decrementer exception
+		if (ppc.total_cycles >= ppc.dec_trigger && !ppc.fatalError)
+		{
+			ppc.interrupt_pending |= 0x2;
+			ppc603_check_interrupts();
+			ppc_update_dec_trigger();
+		}
+	}
+
+	if (ppc.total_cycles < end)	// halted
+		ppc.total_cycles = end;
+	return (int)(ppc.total_cycles - start);
 }
@@ -0,0 +1,1478 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_drc.c
+ *
+ * PowerPC dynamic recompiler and pre-decoded block cache. Included from
+ * ppc.cpp; do not compile separately.
+ *
+ * Both execution modes work on blocks of guest code from the fetch regions,
+ * looked up by PC. A block ends at an unconditional branch, at the end of a
+ * 4 KB page, or after DRC_MAX_BLOCK_INSNS instructions. It is exited early
+ * whenever an instruction redirects control flow (taken branch, exception,
+ * interrupt), the cycle budget of the current segment runs out (ppc_execute()
+ * ends segments where the decrementer fires), or a fatal error is raised, so
+ * exceptions are always taken at the exact same instruction boundary and cycle
+ * count as in the interpreter loop.
+ *
+ * Block cache: each instruction is stored with its handler already looked up
+ * from the opcode tables, so execution is a tight loop of indirect calls with
+ * no fetch or decode. This is portable to any host.
+ *
+ * Recompiler: the x86-64 backend emits the common integer, load, store and
+ * branch instructions inline and calls the interpreter handlers for the rest
+ * (see below).
+ *
+ * Blocks are chained: an exit to a fixed address (the end of a block, or a
+ * b or bc without LK) is linked to the block there the first time it is
+ * taken, and from then on runs straight into it without going back to the
+ * lookup table, provided the segment has cycles left for the whole block.
+ * The block cache keeps one link for the end of each block and one for its
+ * conditional branches; the recompiler patches a jump into its code. All
+ * other exits (blr, bcctr, exceptions, anything else done by a handler) are
+ * looked up.
+ *
+ * Code in RAM may be overwritten by the game. Each 4 KB page that contains
+ * cached code is flagged in a page map, which the bus must consult on writes
+ * (see ppc_get_code_page_map()) and call ppc_invalidate_code() for. That also
+ * moves the cache to a new generation, leaving all links stale, since they
+ * aren't tracked per page. Only RAM and the fixed CROM are fetch regions; the
+ * banked CROM (see CModel3::SetCROMBank()) is read as data, so bank switches
+ * never change cached code.
+ */
+
+#include <cstddef>	// offsetof()
+#include <cstdlib>	// malloc(), calloc(), free()
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PPC_DRC_X64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#define DRC_PAGE_SHIFT			12		// invalidation granularity (4 KB)
+#define DRC_CHUNK_ENTRIES		(1 << (DRC_CHUNK_SHIFT - 2))
+#define DRC_PAGE_ENTRIES		(1 << (DRC_PAGE_SHIFT - 2))
+#define DRC_CACHE_SIZE			(32*1024*1024)
+#define DRC_MAX_BLOCK_INSNS		64
+#define DRC_MAX_INSN_BYTES		256		// generous upper bound on host code emitted per instruction
+#define DRC_MAX_BLOCK_BYTES		(DRC_MAX_BLOCK_INSNS * DRC_MAX_INSN_BYTES + 64)
+
+#define drc						(ppc_context->drc)	// PPC_DRC_STATE (see ppc.cpp)
+
+// How the block cache runs a pre-decoded instruction
+enum
+{
+	DRC_INSN_CALL,			// handler, with ppc.pc, ppc.npc and icount up to date
+	DRC_INSN_REGISTERS,		// handler only (see drc_registers_only())
+	DRC_INSN_BRANCH			// drc_take_branch()
+};
+
+// A pre-decoded instruction
+typedef struct
+{
+	void	(*handler)(UINT32);
+	UINT32	opcode;
+	UINT8	kind;			// DRC_INSN_*
+	UINT8	dispatch;		// label in ppc_execute_block_threaded()
+} PPC_DECODED_INSN;
+
+// Links of a block cache block
+enum
+{
+	DRC_LINK_END,			// where the block ends (falling through or at b)
+	DRC_LINK_BRANCH,		// target of a taken bc
+	DRC_NUM_LINKS
+};
+
+// A block, as stored in the lookup table. In the block cache, it's followed by
+// num_insns PPC_DECODED_INSN. In the recompiler, its code follows at
+// DRC_CODE_OFFSET, and its links are in the code.
+typedef struct
+{
+	PPC_DRC_LINK	links[DRC_NUM_LINKS];
+	UINT32			num_insns;
+} PPC_DECODED_BLOCK;
+
+#ifdef PPC_THREADED_DISPATCH
+static PPC_DRC_LINK *ppc_execute_block_threaded(PPC_DECODED_BLOCK *block, UINT32 generation, bool follow_links);
+#endif
+
+#define DRC_CODE_OFFSET			((sizeof(PPC_DECODED_BLOCK) + 15) & ~(size_t)15)
+
+typedef void (*DRC_BLOCK)(void);
+
+// Handlers looked for by the block cache and the recompiler (ppc_ops.c and
+// ppc_idle.c are included later)
+static void ppc_addi(UINT32), ppc_addis(UINT32), ppc_addic(UINT32), ppc_addic_rc(UINT32),
+	ppc_mulli(UINT32), ppc_ori(UINT32), ppc_oris(UINT32), ppc_xori(UINT32), ppc_xoris(UINT32),
+	ppc_andi_rc(UINT32), ppc_andis_rc(UINT32), ppc_rlwinmx(UINT32), ppc_rlwimix(UINT32);
+static void ppc_cmp(UINT32), ppc_cmpi(UINT32), ppc_cmpl(UINT32), ppc_cmpli(UINT32),
+	ppc_addx(UINT32), ppc_subfx(UINT32), ppc_mullwx(UINT32), ppc_negx(UINT32), ppc_andx(UINT32),
+	ppc_andcx(UINT32), ppc_orx(UINT32), ppc_norx(UINT32), ppc_xorx(UINT32), ppc_extsbx(UINT32),
+	ppc_extshx(UINT32), ppc_slwx(UINT32), ppc_srwx(UINT32), ppc_mfspr(UINT32), ppc_mtspr(UINT32);
+static void ppc_subfic(UINT32), ppc_rlwnmx(UINT32), ppc_addcx(UINT32), ppc_addex(UINT32),
+	ppc_addzex(UINT32), ppc_subfcx(UINT32), ppc_subfex(UINT32), ppc_mulhwx(UINT32),
+	ppc_mulhwux(UINT32), ppc_divwx(UINT32), ppc_divwux(UINT32), ppc_nandx(UINT32), ppc_eqvx(UINT32),
+	ppc_orcx(UINT32), ppc_srawx(UINT32), ppc_srawix(UINT32), ppc_cntlzw(UINT32), ppc_mfcr(UINT32);
+static void ppc_lwz(UINT32), ppc_lwzu(UINT32), ppc_lwzx(UINT32), ppc_lhz(UINT32),
+	ppc_lhzu(UINT32), ppc_lhzx(UINT32), ppc_lbz(UINT32), ppc_lbzu(UINT32), ppc_lbzx(UINT32),
+	ppc_stw(UINT32), ppc_stwu(UINT32), ppc_stwx(UINT32), ppc_sth(UINT32), ppc_sthu(UINT32),
+	ppc_sthx(UINT32), ppc_stb(UINT32), ppc_stbu(UINT32), ppc_stbx(UINT32), ppc_bcx(UINT32), ppc_bx(UINT32);
+static inline bool idle_loop_branch(UINT32, UINT32);
+static inline void ppc_check_idle_loop(void);
+
+
+/*
+ * Common block management
+ */
+
+static void drc_flush(void)
+{
+	for (UINT i = 0; i < (1 << (32 - DRC_CHUNK_SHIFT)); i++)
+	{
+		if (drc.lookup[i] != NULL)
+			memset(drc.lookup[i], 0, DRC_CHUNK_ENTRIES * sizeof(void *));
+	}
+	memset(ppc_code_pages, 0, sizeof(ppc_code_pages));
+	drc.cache_ptr = drc.cache;
+	++drc.generation;
+	++drc.flushes;
+}
+
+static inline void *drc_lookup_block(UINT32 pc)
+{
+	void **chunk = drc.lookup[pc >> DRC_CHUNK_SHIFT];
+	return (chunk != NULL) ? chunk[(pc & ((1 << DRC_CHUNK_SHIFT) - 1)) >> 2] : NULL;
+}
+
+static inline void (*drc_lookup_handler(UINT32 opcode))(UINT32)
+{
+	switch (opcode >> 26)
+	{
+		case 19:	return optable19[(opcode >> 1) & 0x3ff];
+		case 31:	return optable31[(opcode >> 1) & 0x3ff];
+		case 59:	return optable59[(opcode >> 1) & 0x3ff];
+		case 63:	return optable63[(opcode >> 1) & 0x3ff];
+		default:	return optable[opcode >> 26];
+	}
+}
+
+// Instructions after which the following word is unlikely to be executed
+static inline bool drc_ends_block(UINT32 opcode)
+{
+	switch (opcode >> 26)
+	{
+		case 17:	// sc
+		case 18:	// b
+			return true;
+		case 19:
+			switch ((opcode >> 1) & 0x3ff)
+			{
+				case 16:	// bclr
+				case 50:	// rfi
+				case 528:	// bcctr
+					return true;
+				default:
+					return false;
+			}
+		default:
+			return false;
+	}
+}
+
+/*
+ * Instructions whose handlers only read and write registers: they can't see
+ * ppc.pc, ppc.npc or icount, branch, raise an exception or touch memory, so
+ * the block cache runs them without updating any of those.
+ */
+static bool drc_registers_only(void (*handler)(UINT32), UINT32 op)
+{
+	static void (*const handlers[])(UINT32) =
+	{
+		ppc_addi, ppc_addis, ppc_addic, ppc_addic_rc, ppc_mulli, ppc_subfic, ppc_ori, ppc_oris,
+		ppc_xori, ppc_xoris, ppc_andi_rc, ppc_andis_rc, ppc_rlwinmx, ppc_rlwimix, ppc_rlwnmx,
+		ppc_cmp, ppc_cmpi, ppc_cmpl, ppc_cmpli, ppc_addx, ppc_addcx, ppc_addex, ppc_addzex,
+		ppc_subfx, ppc_subfcx, ppc_subfex, ppc_mullwx, ppc_mulhwx, ppc_mulhwux, ppc_divwx,
+		ppc_divwux, ppc_negx, ppc_andx, ppc_andcx, ppc_orx, ppc_norx, ppc_xorx, ppc_nandx,
+		ppc_eqvx, ppc_orcx, ppc_extsbx, ppc_extshx, ppc_slwx, ppc_srwx, ppc_srawx, ppc_srawix,
+		ppc_cntlzw, ppc_mfcr
+	};
+	if (handler == ppc_mfspr || handler == ppc_mtspr)
+		return SPR == SPR_LR || SPR == SPR_CTR;
+	for (auto h : handlers)
+	{
+		if (h == handler)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Takes b or bc without LK, if its condition holds, as the handler would. Only
+ * the interpreter loop fetches through ppc.op, so the fetch region isn't
+ * switched unless the idle loop check, which needs it, can act on the branch.
+ * On entry, icount is pending instructions ahead of the branch; they are
+ * subtracted along with the branch unless that check sees icount. A branch
+ * not taken only changes CTR and leaves icount alone.
+ */
+static inline bool drc_take_branch(UINT32 op, UINT32 addr, UINT32 pending)
+{
+	UINT32 target;
+	if ((op >> 26) == 18)
+	{
+		INT32 li = op & 0x3fffffc;
+		if (li & 0x2000000)
+			li |= 0xfc000000;
+		target = AABIT ? li : addr + li;
+	}
+	else if (check_condition_code(BO, BI))
+		target = AABIT ? (SIMM16 & ~0x3) : addr + (SIMM16 & ~0x3);
+	else
+		return false;
+
+	ppc.pc = addr;
+	ppc.npc = target;
+	if (target == ppc_context->idle.watch_pc || (ppc_context->idle.enabled && idle_loop_branch(addr, target)))
+	{
+		ppc.icount -= pending;
+		ppc_change_pc(target);
+		ppc_check_idle_loop();
+		ppc.icount--;
+	}
+	else
+		ppc.icount -= pending + 1;
+	return true;
+}
+
+/*
+ * Locates the host copy of the guest code at pc and prepares a lookup table
+ * slot for a new block. Returns NULL if the code is not in a fetch region or
+ * memory could not be allocated. Otherwise, returns the code and the maximum
+ * number of instructions the block may contain, and makes sure there is room
+ * for a block of block_bytes in the cache.
+ */
+static const UINT32 *drc_begin_block(void ***slot, UINT32 *max_insns, UINT32 pc, size_t block_bytes)
+{
+	const UINT32 *src = NULL;
+	UINT32 region_end = 0;
+	for (UINT i = 0; ppc.fetch[i].ptr != NULL; i++)
+	{
+		if (ppc.fetch[i].start <= pc && pc <= ppc.fetch[i].end)
+		{
+			src = &ppc.fetch[i].ptr[(pc - ppc.fetch[i].start) / 4];
+			region_end = ppc.fetch[i].end;
+			break;
+		}
+	}
+	if (src == NULL || drc.cache == NULL)
+		return NULL;
+
+	void **&chunk = drc.lookup[pc >> DRC_CHUNK_SHIFT];
+	if (chunk == NULL)
+	{
+		chunk = (void **) calloc(DRC_CHUNK_ENTRIES, sizeof(void *));
+		if (chunk == NULL)
+			return NULL;
+	}
+
+	if (drc.cache_ptr + block_bytes > drc.cache + DRC_CACHE_SIZE)
+	{
+		DebugLog("PowerPC block cache full after %u blocks; flushing.\n", drc.blocks_compiled);
+		drc_flush();
+	}
+
+	// Blocks never cross a page or fetch region boundary
+	UINT32 page_end = pc | ((1 << DRC_PAGE_SHIFT) - 1);
+	UINT32 last = page_end < region_end ? page_end : region_end;
+	*max_insns = (last - pc) / 4 + 1;
+	if (*max_insns > DRC_MAX_BLOCK_INSNS)
+		*max_insns = DRC_MAX_BLOCK_INSNS;
+
+	*slot = &chunk[(pc & ((1 << DRC_CHUNK_SHIFT) - 1)) >> 2];
+	return src;
+}
+
+// Links start out stale, as if made in the generation before this one
+static inline void drc_init_links(PPC_DECODED_BLOCK *block)
+{
+	for (UINT i = 0; i < DRC_NUM_LINKS; i++)
+	{
+		block->links[i].pc = 0;
+		block->links[i].generation = drc.generation - 1;
+		block->links[i].block = NULL;
+	}
+}
+
+static inline void drc_end_block(void **slot, UINT32 pc, void *block)
+{
+	ppc_code_pages[pc >> DRC_PAGE_SHIFT] = 1;
+	*slot = block;
+	++drc.blocks_compiled;
+}
+
+// Interprets a single instruction exactly as the main loop in ppc_execute() does
+static void drc_interpret_one(void)
+{
+	ppc.pc = ppc.npc;
+	ppc_change_pc(ppc.pc);
+	if (ppc.fatalError)
+		return;
+	UINT32 opcode = *ppc.op++;
+	ppc.npc = ppc.pc + 4;
+	drc_lookup_handler(opcode)(opcode);
+	ppc.icount--;
+}
+
+// Finishes a segment too short for the next block
+static void drc_interpret_rest(void)
+{
+	while (ppc.icount > 0 && !ppc.fatalError)
+		drc_interpret_one();
+}
+
+
+/*
+ * Block chaining
+ */
+
+// Returns the block at ppc.npc, translating it if not found, or NULL if there can't be one
+static inline PPC_DECODED_BLOCK *drc_get_block(PPC_DECODED_BLOCK *(*translate)(UINT32))
+{
+	PPC_DECODED_BLOCK *block = (PPC_DECODED_BLOCK *) drc_lookup_block(ppc.npc);
+	return (block != NULL) ? block : translate(ppc.npc);
+}
+
+/*
+ * Whether a block cache block left through link, having been entered in the
+ * given cache generation, can go on straight into the block at ppc.npc: the
+ * link must have been made to there since the cache last changed, and the
+ * segment have enough cycles left for the whole block, as drc_execute_decoded()
+ * would require.
+ */
+static inline bool drc_can_follow(const PPC_DRC_LINK *link, UINT32 generation)
+{
+	return link->pc == ppc.npc && link->generation == generation && ppc.icount >= (INT32) ((const PPC_DECODED_BLOCK *) link->block)->num_insns;
+}
+
+// Link a taken b or bc leaves a block cache block through (b always ends it)
+static inline UINT drc_branch_link(UINT32 op)
+{
+	return ((op >> 26) == 18) ? DRC_LINK_END : DRC_LINK_BRANCH;
+}
+
+
+/*
+ * Block cache
+ */
+
+static PPC_DECODED_BLOCK *drc_decode(UINT32 pc)
+{
+	void **slot;
+	UINT32 max_insns;
+	const UINT32 *src = drc_begin_block(&slot, &max_insns, pc, sizeof(PPC_DECODED_BLOCK) + DRC_MAX_BLOCK_INSNS * sizeof(PPC_DECODED_INSN) + 8);
+	if (src == NULL)
+		return NULL;
+
+	PPC_DECODED_BLOCK *block = (PPC_DECODED_BLOCK *) drc.cache_ptr;
+	PPC_DECODED_INSN *insn = (PPC_DECODED_INSN *) (block + 1);
+	drc_init_links(block);
+	UINT32 n = 0;
+	while (n < max_insns)
+	{
+		UINT32 opcode = src[n];
+		insn[n].handler = drc_lookup_handler(opcode);
+		insn[n].opcode = opcode;
+		if (drc_registers_only(insn[n].handler, opcode))
+			insn[n].kind = DRC_INSN_REGISTERS;
+		else if ((insn[n].handler == ppc_bx || insn[n].handler == ppc_bcx) && !(opcode & 1))	// no LK
+			insn[n].kind = DRC_INSN_BRANCH;
+		else
+			insn[n].kind = DRC_INSN_CALL;
+		insn[n].dispatch = (insn[n].kind == DRC_INSN_BRANCH) ? 128 : (opcode >> 26) | (insn[n].kind << 6);
+		++n;
+		if (drc_ends_block(opcode))
+			break;
+	}
+	block->num_insns = n;
+
+	// Keep blocks pointer-aligned
+	size_t size = sizeof(PPC_DECODED_BLOCK) + n * sizeof(PPC_DECODED_INSN);
+	drc.cache_ptr += (size + 7) & ~(size_t)7;
+
+	drc_end_block(slot, pc, block);
+	return block;
+}
+
+#ifndef PPC_THREADED_DISPATCH
+/*
+ * Runs a block and the blocks it is linked to, as ppc_execute_block_threaded()
+ * does with threaded dispatch. Register only instructions are run without any
+ * bookkeeping: icount is brought up to date (from done) before the other
+ * handlers, and the block is left after one only if it redirects control flow,
+ * stops emulation, overwrites cached code or cuts the segment short. Returns
+ * the link the last block was left through, or NULL if it was left by a
+ * handler.
+ */
+static PPC_DRC_LINK *drc_run_decoded(PPC_DECODED_BLOCK *block, UINT32 generation, bool follow_links)
+{
+	while (true)
+	{
+		const PPC_DECODED_INSN *insn = (const PPC_DECODED_INSN *) (block + 1);
+		UINT32 num_insns = block->num_insns;
+		UINT32 addr = ppc.npc;
+		PPC_DRC_LINK *link = &block->links[DRC_LINK_END];
+		UINT32 i, done = 0;
+		for (i = 0; i < num_insns; i++, addr += 4)
+		{
+			if (insn[i].kind == DRC_INSN_REGISTERS)
+			{
+				insn[i].handler(insn[i].opcode);
+				continue;
+			}
+			if (insn[i].kind == DRC_INSN_BRANCH)
+			{
+				if (!drc_take_branch(insn[i].opcode, addr, i - done))
+					continue;
+				link = &block->links[drc_branch_link(insn[i].opcode)];
+				break;
+			}
+			ppc.pc = addr;
+			ppc.npc = addr + 4;
+			ppc.icount -= i - done;
+			insn[i].handler(insn[i].opcode);
+			ppc.icount--;
+			done = i + 1;
+			if (ppc.npc != addr + 4 || ppc.fatalError || drc.generation != generation || ppc.icount < (INT32) (num_insns - done))
+				return NULL;
+		}
+		if (i == num_insns)
+		{
+			ppc.pc = addr - 4;
+			ppc.npc = addr;
+			ppc.icount -= num_insns - done;
+		}
+		if (!follow_links || !drc_can_follow(link, generation))
+			return link;
+		block = (PPC_DECODED_BLOCK *) link->block;
+	}
+}
+#endif	// PPC_THREADED_DISPATCH
+
+static void drc_execute_decoded(void)
+{
+	CExecTrace *trace = ppc_context->trace;	// only ever in branches only mode
+	bool follow_links = trace == NULL && !drc.no_chaining;	// blocks jumped to must be traced here
+	PPC_DRC_LINK *link = NULL;	// the last block was left through
+	UINT32 generation = 0;
+	while (ppc.icount > 0 && !ppc.fatalError)
+	{
+		PPC_DECODED_BLOCK *block = drc_get_block(drc_decode);
+
+		// The link is only valid if the cache hasn't changed since the block
+		// it belongs to was entered
+		if (block != NULL && link != NULL && generation == drc.generation)
+		{
+			link->pc = ppc.npc;
+			link->generation = generation;
+			link->block = block;
+		}
+		link = NULL;
+		if (block == NULL)
+		{
+			drc_interpret_one();
+			continue;
+		}
+		generation = drc.generation;
+		if (ppc.icount < (INT32) block->num_insns)
+		{
+			drc_interpret_rest();
+			break;
+		}
+
+		const PPC_DECODED_INSN *insn = (const PPC_DECODED_INSN *) (block + 1);
+		if (trace != NULL && ppc.npc != ppc_context->trace_next_pc)
+			trace->Record(ppc.npc, insn[0].opcode, ppc_current_cycle());	// block was jumped to
+#ifdef PPC_THREADED_DISPATCH
+		link = ppc_execute_block_threaded(block, generation, follow_links);
+#else
+		link = drc_run_decoded(block, generation, follow_links);
+#endif
+		if (trace != NULL)
+			ppc_context->trace_next_pc = ppc.pc + 4;
+	}
+}
+
+
+/*
+ * x86-64 recompiler. RBX holds &ppc for the entire block so that all register
+ * accesses can use a 32-bit displacement, and R12D the cache generation the
+ * block was entered in. The rest of the context follows the registers, so the
+ * memory maps and the code page map are reached through RBX as well.
+ *
+ * Integer arithmetic, logical, rotate and compare instructions, moves to and
+ * from LR and CTR, and byte, half-word and word loads and stores are emitted
+ * inline. There is no register allocation: each instruction loads its
+ * operands from ppc and stores its result back, which still costs a fraction
+ * of a handler call. Loads and stores access directly mapped pages inline and
+ * leave anything else, including writes to pages holding cached code, to a
+ * call to their handler out of line. Conditional branches and b without LK
+ * are taken inline, except where the idle loop check made on branches could
+ * act on them (see drc_emit_idle_checks()), which calls out to the handler.
+ * Branches that set LR are left to the handler for the HLE checks, and
+ * everything else is a handler call.
+ *
+ * Inline code doesn't update ppc.pc, ppc.npc or icount. They are brought up
+ * to date before each handler call, the only code that can observe them, and
+ * when the block is left. Only a handler can redirect control flow, cut the
+ * segment short, halt emulation or overwrite cached code, so these exits are
+ * checked after calls rather than after every instruction. drc_execute() only
+ * enters a block if the segment has at least as many cycles left as the block
+ * has instructions.
+ *
+ * The end of a block reached inline and taken bc without LK leave through a
+ * link stub (see drc_emit_link()), which drc_link() points at the block for
+ * the target. A linked stub makes the same checks drc_execute() would before
+ * jumping to the code after the prologue of that block, and only returns to
+ * drc_execute() when they fail.
+ */
+
+#ifdef PPC_DRC_X64
+
+#define DRC_OFFSET(field)		((UINT32) offsetof(PPC_REGS, field))
+#define DRC_GPR(n)				(DRC_OFFSET(r) + 4 * (n))
+#define DRC_CRF(n)				(DRC_OFFSET(cr) + (n))
+
+// Host registers, as encoded in ModR/M
+#define DRC_EAX					0
+#define DRC_ECX					1
+#define DRC_EDX					2
+
+// Opcodes of <op> r32, r/m32
+#define DRC_ADD					0x03
+#define DRC_OR					0x0B
+#define DRC_AND					0x23
+#define DRC_SUB					0x2B
+#define DRC_XOR					0x33
+#define DRC_CMP					0x3B
+
+// ModR/M reg field of <op> r/m32, imm32 (opcode 81)
+#define DRC_ADD_IMM				0
+#define DRC_OR_IMM				1
+#define DRC_AND_IMM				4
+#define DRC_SUB_IMM				5
+#define DRC_XOR_IMM				6
+#define DRC_CMP_IMM				7
+
+// Condition codes, as the second byte of jcc rel32 (cmovcc is 0x40 | (cc & 0xF))
+#define DRC_JE					0x84
+#define DRC_JNE					0x85
+#define DRC_JL					0x8C
+
+// Displacement of a field of the context from &ppc, which is where it starts
+static inline UINT32 drc_context_offset(const void *field)
+{
+	return (UINT32) ((const UINT8 *) field - (const UINT8 *) &ppc);
+}
+
+static inline void drc_emit8(UINT8 v)
+{
+	*drc.cache_ptr++ = v;
+}
+
+static inline void drc_emit32(UINT32 v)
+{
+	memcpy(drc.cache_ptr, &v, sizeof(v));
+	drc.cache_ptr += sizeof(v);
+}
+
+static inline void drc_emit64(UINT64 v)
+{
+	memcpy(drc.cache_ptr, &v, sizeof(v));
+	drc.cache_ptr += sizeof(v);
+}
+
+// ModR/M and displacement of [rbx+offset]
+static inline void drc_emit_rbx(UINT32 reg, UINT32 offset)
+{
+	drc_emit8(0x83 | (reg << 3)); drc_emit32(offset);
+}
+
+// mov reg, dword [rbx+offset]
+static inline void drc_emit_load(UINT32 reg, UINT32 offset)
+{
+	drc_emit8(0x8B); drc_emit_rbx(reg, offset);
+}
+
+// mov dword [rbx+offset], reg
+static inline void drc_emit_store(UINT32 offset, UINT32 reg)
+{
+	drc_emit8(0x89); drc_emit_rbx(reg, offset);
+}
+
+// <op> reg, dword [rbx+offset]
+static inline void drc_emit_op_mem(UINT8 op, UINT32 reg, UINT32 offset)
+{
+	drc_emit8(op); drc_emit_rbx(reg, offset);
+}
+
+// <op> reg, imm32
+static inline void drc_emit_op_imm(UINT32 op, UINT32 reg, UINT32 imm)
+{
+	drc_emit8(0x81); drc_emit8(0xC0 | (op << 3) | reg); drc_emit32(imm);
+}
+
+// <op> dword [rbx+offset], imm32
+static inline void drc_emit_op_mem_imm(UINT32 op, UINT32 offset, UINT32 imm)
+{
+	drc_emit8(0x81); drc_emit_rbx(op, offset); drc_emit32(imm);
+}
+
+// mov dword [rbx+offset], imm32
+static inline void drc_emit_store_imm32(UINT32 offset, UINT32 imm)
+{
+	drc_emit8(0xC7); drc_emit_rbx(0, offset); drc_emit32(imm);
+}
+
+// mov reg, imm32
+static inline void drc_emit_mov_imm(UINT32 reg, UINT32 imm)
+{
+	drc_emit8(0xB8 + reg); drc_emit32(imm);
+}
+
+// Loads rA, or 0 for r0, as used in effective addresses and addi
+static inline void drc_emit_load_gpr0(UINT32 reg, UINT32 n)
+{
+	if (n == 0)
+	{
+		drc_emit8(0x31); drc_emit8(0xC0 | (reg << 3) | reg);	// xor reg, reg
+	}
+	else
+		drc_emit_load(reg, DRC_GPR(n));
+}
+
+// jcc rel32 (returns location of the displacement, to be patched later)
+static inline UINT8 *drc_emit_jcc(UINT8 cc)
+{
+	drc_emit8(0x0F); drc_emit8(cc);
+	UINT8 *fixup = drc.cache_ptr;
+	drc_emit32(0);
+	return fixup;
+}
+
+// jmp rel32 (likewise)
+static inline UINT8 *drc_emit_jmp(void)
+{
+	drc_emit8(0xE9);
+	UINT8 *fixup = drc.cache_ptr;
+	drc_emit32(0);
+	return fixup;
+}
+
+static inline void drc_patch(UINT8 *fixup, const UINT8 *target)
+{
+	INT32 rel = (INT32) (target - (fixup + 4));
+	memcpy(fixup, &rel, sizeof(rel));
+}
+
+// handler(opcode)
+static inline void drc_emit_call_handler(void (*handler)(UINT32), UINT32 opcode)
+{
+#ifdef _WIN32
+	drc_emit8(0xB9); drc_emit32(opcode);	// mov ecx, opcode
+#else
+	drc_emit8(0xBF); drc_emit32(opcode);	// mov edi, opcode
+#endif
+	drc_emit8(0x48); drc_emit8(0xB8); drc_emit64((UINT64) (uintptr_t) handler);	// mov rax, handler
+	drc_emit8(0xFF); drc_emit8(0xD0);		// call rax
+}
+
+#define DRC_PROLOGUE_BYTES		24		// what drc_emit_prologue() emits
+
+static inline void drc_emit_prologue(void)
+{
+	drc_emit8(0x53);											// push rbx
+	drc_emit8(0x41); drc_emit8(0x54);							// push r12
+	drc_emit8(0x48); drc_emit8(0x83); drc_emit8(0xEC); drc_emit8(0x28);	// sub rsp, 40 (Win64 shadow space, keeps stack aligned)
+	drc_emit8(0x48); drc_emit8(0xBB); drc_emit64((UINT64) (uintptr_t) &ppc);	// mov rbx, &ppc
+	drc_emit8(0x44); drc_emit8(0x8B); drc_emit_rbx(4, drc_context_offset(&drc.generation));	// mov r12d, generation
+}
+
+static inline void drc_emit_epilogue(void)
+{
+	drc_emit8(0x48); drc_emit8(0x83); drc_emit8(0xC4); drc_emit8(0x28);	// add rsp, 40
+	drc_emit8(0x41); drc_emit8(0x5C);							// pop r12
+	drc_emit8(0x5B);											// pop rbx
+	drc_emit8(0xC3);											// ret
+}
+
+/*
+ * Sets a CR field from the flags of a compare: LT, GT or EQ, and SO copied
+ * from XER.
+ */
+static void drc_emit_set_crf(UINT32 field, bool is_signed)
+{
+	drc_emit_mov_imm(DRC_ECX, 0x4);
+	drc_emit_mov_imm(DRC_EDX, 0x8);
+	drc_emit8(0x0F); drc_emit8(is_signed ? 0x4C : 0x42); drc_emit8(0xCA);	// cmovl/cmovb ecx, edx
+	drc_emit_mov_imm(DRC_EDX, 0x2);
+	drc_emit8(0x0F); drc_emit8(0x44); drc_emit8(0xCA);	// cmove ecx, edx
+	drc_emit_load(DRC_EDX, DRC_OFFSET(xer));
+	drc_emit8(0xC1); drc_emit8(0xEA); drc_emit8(31);	// shr edx, 31
+	drc_emit8(0x09); drc_emit8(0xD1);					// or ecx, edx
+	drc_emit8(0x88); drc_emit_rbx(DRC_ECX, DRC_CRF(field));	// mov byte [cr+field], cl
+}
+
+// Stores eax to a GPR, setting CR0 from it if rc
+static void drc_emit_result(UINT32 n, bool rc)
+{
+	drc_emit_store(DRC_GPR(n), DRC_EAX);
+	if (rc)
+	{
+		drc_emit8(0x85); drc_emit8(0xC0);	// test eax, eax
+		drc_emit_set_crf(0, true);
+	}
+}
+
+// XER[CA] = carry flag
+static void drc_emit_set_ca(void)
+{
+	drc_emit8(0x0F); drc_emit8(0x92); drc_emit8(0xC1);	// setc cl
+	drc_emit8(0x0F); drc_emit8(0xB6); drc_emit8(0xC9);	// movzx ecx, cl
+	drc_emit8(0xC1); drc_emit8(0xE1); drc_emit8(29);	// shl ecx, 29
+	drc_emit_load(DRC_EDX, DRC_OFFSET(xer));
+	drc_emit_op_imm(DRC_AND_IMM, DRC_EDX, ~XER_CA);
+	drc_emit8(0x09); drc_emit8(0xCA);					// or edx, ecx
+	drc_emit_store(DRC_OFFSET(xer), DRC_EDX);
+}
+
+/*
+ * Emits an integer instruction inline, exactly as its handler would execute
+ * it (which is matched by address, so a table that maps the opcode elsewhere
+ * is respected). Returns false if it isn't one that is done inline.
+ * Instructions setting XER[OV] are left to their handlers.
+ */
+static bool drc_emit_integer(void (*handler)(UINT32), UINT32 op)
+{
+	if (handler == ppc_addi || handler == ppc_addis)
+	{
+		drc_emit_load_gpr0(DRC_EAX, RA);
+		UINT32 i = handler == ppc_addi ? SIMM16 : UIMM16 << 16;
+		if (i != 0)
+			drc_emit_op_imm(DRC_ADD_IMM, DRC_EAX, i);
+		drc_emit_result(RT, false);
+	}
+	else if (handler == ppc_addic || handler == ppc_addic_rc)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RA));
+		drc_emit_op_imm(DRC_ADD_IMM, DRC_EAX, SIMM16);
+		drc_emit_set_ca();
+		drc_emit_result(RT, handler == ppc_addic_rc);
+	}
+	else if (handler == ppc_mulli)
+	{
+		drc_emit8(0x69); drc_emit_rbx(DRC_EAX, DRC_GPR(RA)); drc_emit32(SIMM16);	// imul eax, rA, imm32
+		drc_emit_result(RT, false);
+	}
+	else if (handler == ppc_ori || handler == ppc_oris || handler == ppc_xori || handler == ppc_xoris || handler == ppc_andi_rc || handler == ppc_andis_rc)
+	{
+		bool shifted = handler == ppc_oris || handler == ppc_xoris || handler == ppc_andis_rc;
+		UINT32 op_imm = (handler == ppc_ori || handler == ppc_oris) ? DRC_OR_IMM : (handler == ppc_xori || handler == ppc_xoris) ? DRC_XOR_IMM : DRC_AND_IMM;
+		drc_emit_load(DRC_EAX, DRC_GPR(RS));
+		drc_emit_op_imm(op_imm, DRC_EAX, shifted ? UIMM16 << 16 : UIMM16);
+		drc_emit_result(RA, op_imm == DRC_AND_IMM);
+	}
+	else if (handler == ppc_rlwinmx || handler == ppc_rlwimix)
+	{
+		UINT32 mask = GET_ROTATE_MASK(MB, ME);
+		drc_emit_load(DRC_EAX, DRC_GPR(RS));
+		if (SH != 0)
+		{
+			drc_emit8(0xC1); drc_emit8(0xC0); drc_emit8(SH);	// rol eax, sh
+		}
+		drc_emit_op_imm(DRC_AND_IMM, DRC_EAX, mask);
+		if (handler == ppc_rlwimix)
+		{
+			drc_emit_load(DRC_ECX, DRC_GPR(RA));
+			drc_emit_op_imm(DRC_AND_IMM, DRC_ECX, ~mask);
+			drc_emit8(0x09); drc_emit8(0xC8);	// or eax, ecx
+		}
+		drc_emit_result(RA, RCBIT);
+	}
+	else if (handler == ppc_cmpi || handler == ppc_cmpli)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RA));
+		drc_emit_op_imm(DRC_CMP_IMM, DRC_EAX, handler == ppc_cmpi ? SIMM16 : UIMM16);
+		drc_emit_set_crf(CRFD, handler == ppc_cmpi);
+	}
+	else if (handler == ppc_cmp || handler == ppc_cmpl)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RA));
+		drc_emit_op_mem(DRC_CMP, DRC_EAX, DRC_GPR(RB));
+		drc_emit_set_crf(CRFD, handler == ppc_cmp);
+	}
+	else if ((handler == ppc_addx || handler == ppc_subfx || handler == ppc_mullwx || handler == ppc_negx) && !OEBIT)
+	{
+		if (handler == ppc_subfx)
+		{
+			drc_emit_load(DRC_EAX, DRC_GPR(RB));
+			drc_emit_op_mem(DRC_SUB, DRC_EAX, DRC_GPR(RA));
+		}
+		else
+		{
+			drc_emit_load(DRC_EAX, DRC_GPR(RA));
+			if (handler == ppc_addx)
+				drc_emit_op_mem(DRC_ADD, DRC_EAX, DRC_GPR(RB));
+			else if (handler == ppc_mullwx)
+			{
+				drc_emit8(0x0F); drc_emit8(0xAF); drc_emit_rbx(DRC_EAX, DRC_GPR(RB));	// imul eax, rB
+			}
+			else
+			{
+				drc_emit8(0xF7); drc_emit8(0xD8);	// neg eax
+			}
+		}
+		drc_emit_result(RT, RCBIT);
+	}
+	else if (handler == ppc_andx || handler == ppc_orx || handler == ppc_xorx || handler == ppc_norx)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RS));
+		drc_emit_op_mem(handler == ppc_andx ? DRC_AND : handler == ppc_xorx ? DRC_XOR : DRC_OR, DRC_EAX, DRC_GPR(RB));
+		if (handler == ppc_norx)
+		{
+			drc_emit8(0xF7); drc_emit8(0xD0);	// not eax
+		}
+		drc_emit_result(RA, RCBIT);
+	}
+	else if (handler == ppc_andcx)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RB));
+		drc_emit8(0xF7); drc_emit8(0xD0);		// not eax
+		drc_emit_op_mem(DRC_AND, DRC_EAX, DRC_GPR(RS));
+		drc_emit_result(RA, RCBIT);
+	}
+	else if (handler == ppc_extsbx || handler == ppc_extshx)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RS));
+		drc_emit8(0x0F); drc_emit8(handler == ppc_extsbx ? 0xBE : 0xBF); drc_emit8(0xC0);	// movsx eax, al/ax
+		drc_emit_result(RA, RCBIT);
+	}
+	else if (handler == ppc_slwx || handler == ppc_srwx)
+	{
+		// A 64-bit shift by rB & 0x3F leaves 0 in the low word for shifts
+		// of 32 or more, as the PowerPC does
+		drc_emit_load(DRC_EAX, DRC_GPR(RS));
+		drc_emit_load(DRC_ECX, DRC_GPR(RB));
+		drc_emit8(0x48); drc_emit8(0xD3); drc_emit8(handler == ppc_slwx ? 0xE0 : 0xE8);	// shl/shr rax, cl
+		drc_emit_result(RA, RCBIT);
+	}
+	else if ((handler == ppc_mfspr || handler == ppc_mtspr) && (SPR == SPR_LR || SPR == SPR_CTR))
+	{
+		UINT32 spr = SPR == SPR_LR ? DRC_OFFSET(lr) : DRC_OFFSET(ctr);
+		if (handler == ppc_mfspr)
+		{
+			drc_emit_load(DRC_EAX, spr);
+			drc_emit_store(DRC_GPR(RT), DRC_EAX);
+		}
+		else
+		{
+			drc_emit_load(DRC_EAX, DRC_GPR(RS));
+			drc_emit_store(spr, DRC_EAX);
+		}
+	}
+	else
+		return false;
+	return true;
+}
+
+// A load or store that can be done inline
+typedef struct
+{
+	void	(*handler)(UINT32);
+	UINT32	size;		// 1, 2 or 4 bytes
+	bool	store;
+	bool	indexed;	// ea = (rA|0) + rB rather than (rA|0) + d
+	bool	update;		// rA = ea
+} DRC_MEM_OP;
+
+static const DRC_MEM_OP drc_mem_ops[] =
+{
+	{ ppc_lwz,	4, false, false, false },	{ ppc_lwzu,	4, false, false, true },	{ ppc_lwzx,	4, false, true, false },
+	{ ppc_lhz,	2, false, false, false },	{ ppc_lhzu,	2, false, false, true },	{ ppc_lhzx,	2, false, true, false },
+	{ ppc_lbz,	1, false, false, false },	{ ppc_lbzu,	1, false, false, true },	{ ppc_lbzx,	1, false, true, false },
+	{ ppc_stw,	4, true, false, false },	{ ppc_stwu,	4, true, false, true },		{ ppc_stwx,	4, true, true, false },
+	{ ppc_sth,	2, true, false, false },	{ ppc_sthu,	2, true, false, true },		{ ppc_sthx,	2, true, true, false },
+	{ ppc_stb,	1, true, false, false },	{ ppc_stbu,	1, true, false, true },		{ ppc_stbx,	1, true, true, false }
+};
+
+static const DRC_MEM_OP *drc_find_mem_op(void (*handler)(UINT32), UINT32 op)
+{
+	for (UINT i = 0; i < sizeof(drc_mem_ops) / sizeof(drc_mem_ops[0]); i++)
+	{
+		const DRC_MEM_OP *m = &drc_mem_ops[i];
+		if (m->handler != handler)
+			continue;
+		// Update forms with rA = 0, or loads with rA = rT, are invalid and
+		// left to the handler
+		if (m->update && (RA == 0 || (!m->store && RA == RT)))
+			return NULL;
+		return m;
+	}
+	return NULL;
+}
+
+/*
+ * Emits the inline part of a load or store, which accesses directly mapped
+ * memory like READ32() and friends. Anything they would pass to the bus, and
+ * writes to pages holding cached code, jump to the slow path instead before
+ * any state has been changed. Returns the number of those jumps.
+ */
+static UINT drc_emit_mem_op(const DRC_MEM_OP *m, UINT32 op, UINT8 **slow)
+{
+	UINT num_slow = 0;
+
+	// eax = ea
+	if (m->indexed)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RB));
+		if (RA != 0)
+			drc_emit_op_mem(DRC_ADD, DRC_EAX, DRC_GPR(RA));
+	}
+	else
+	{
+		drc_emit_load_gpr0(DRC_EAX, RA);
+		if (SIMM16 != 0)
+			drc_emit_op_imm(DRC_ADD_IMM, DRC_EAX, SIMM16);
+	}
+	if (m->update)
+	{
+		drc_emit8(0x41); drc_emit8(0x89); drc_emit8(0xC0);	// mov r8d, eax
+	}
+
+	// rcx = page, or to the slow path if unmapped or misaligned
+	drc_emit8(0x89); drc_emit8(0xC2);										// mov edx, eax
+	drc_emit8(0xC1); drc_emit8(0xEA); drc_emit8(PPC_MEM_PAGE_SHIFT);		// shr edx, PPC_MEM_PAGE_SHIFT
+	drc_emit8(0x48); drc_emit8(0x8B); drc_emit_rbx(DRC_ECX, drc_context_offset(m->store ? &ppc_write_map : &ppc_read_map));	// mov rcx, map
+	drc_emit8(0x48); drc_emit8(0x8B); drc_emit8(0x0C); drc_emit8(0xD1);	// mov rcx, [rcx+rdx*8]
+	drc_emit8(0x48); drc_emit8(0x85); drc_emit8(0xC9);						// test rcx, rcx
+	slow[num_slow++] = drc_emit_jcc(DRC_JE);
+	if (m->size > 1)
+	{
+		drc_emit8(0xA8); drc_emit8(m->size - 1);							// test al, size - 1
+		slow[num_slow++] = drc_emit_jcc(DRC_JNE);
+	}
+	if (m->store)
+	{
+		drc_emit8(0x89); drc_emit8(0xC2);									// mov edx, eax
+		drc_emit8(0xC1); drc_emit8(0xEA); drc_emit8(DRC_PAGE_SHIFT);		// shr edx, DRC_PAGE_SHIFT
+		drc_emit8(0x80); drc_emit8(0xBC); drc_emit8(0x13); drc_emit32(drc_context_offset(ppc_code_pages)); drc_emit8(0x00);	// cmp byte [rbx+rdx+code_pages], 0
+		slow[num_slow++] = drc_emit_jcc(DRC_JNE);
+	}
+
+	// rdx = offset within the page
+	drc_emit8(0x0F); drc_emit8(0xB7); drc_emit8(0xD0);						// movzx edx, ax
+	UINT32 lane = m->size == 1 ? BYTE_LANE_XOR8 : m->size == 2 ? BYTE_LANE_XOR16 : 0;
+	if (lane != 0)
+	{
+		drc_emit8(0x83); drc_emit8(0xF2); drc_emit8(lane);					// xor edx, lane
+	}
+
+	if (m->store)
+	{
+		drc_emit_load(DRC_EAX, DRC_GPR(RS));
+		if (m->size == 2)
+			drc_emit8(0x66);
+		drc_emit8(m->size == 1 ? 0x88 : 0x89); drc_emit8(0x04); drc_emit8(0x11);	// mov [rcx+rdx], al/ax/eax
+	}
+	else
+	{
+		if (m->size == 4)
+		{
+			drc_emit8(0x8B); drc_emit8(0x04); drc_emit8(0x11);				// mov eax, [rcx+rdx]
+		}
+		else
+		{
+			drc_emit8(0x0F); drc_emit8(m->size == 1 ? 0xB6 : 0xB7); drc_emit8(0x04); drc_emit8(0x11);	// movzx eax, byte/word [rcx+rdx]
+		}
+		drc_emit_store(DRC_GPR(RT), DRC_EAX);
+	}
+	if (m->update)
+	{
+		drc_emit8(0x44); drc_emit8(0x89); drc_emit_rbx(DRC_EAX, DRC_GPR(RA));	// mov rA, r8d
+	}
+	return num_slow;
+}
+
+// Code placed after the block
+typedef enum
+{
+	DRC_STUB_SLOW_PATH,		// load or store through the handler, then back to the block
+	DRC_STUB_CALL,			// branch through the handler, leaving the block
+	DRC_STUB_TAKEN			// conditional branch taken inline, leaving the block
+} DRC_STUB_TYPE;
+
+typedef struct
+{
+	DRC_STUB_TYPE	type;
+	UINT8			*jumps[4];	// to be patched to the code
+	UINT			num_jumps;
+	UINT32			index;		// of the instruction in the block
+	UINT32			pending;	// instructions before it not yet subtracted from icount
+	UINT8			*resume;	// where a slow path continues
+	UINT32			target;		// of a taken branch
+	bool			ctr;		// taken branch stores the decremented CTR in eax
+} DRC_STUB;
+
+typedef struct
+{
+	UINT32		pc;
+	UINT32		num_insns;
+	const UINT32	*src;
+	UINT8		*exits[DRC_MAX_BLOCK_INSNS * 4 + 2];	// jumps to the epilogue
+	UINT		num_exits;
+	DRC_STUB	stubs[DRC_MAX_BLOCK_INSNS * 2];
+	UINT		num_stubs;
+} DRC_COMPILER;
+
+static DRC_STUB *drc_add_stub(DRC_COMPILER *c, DRC_STUB_TYPE type, UINT32 index, UINT32 pending)
+{
+	DRC_STUB *stub = &c->stubs[c->num_stubs++];
+	stub->type = type;
+	stub->num_jumps = 0;
+	stub->index = index;
+	stub->pending = pending;
+	return stub;
+}
+
+static inline UINT32 drc_branch_target(UINT32 op, UINT32 addr, UINT32 offset)
+{
+	return AABIT ? offset : addr + offset;
+}
+
+/*
+ * The idle loop check made on taken branches (see ppc_check_idle_loop()) can
+ * only act on short backward branches while idle skipping is enabled, and on
+ * a branch to the watched address. Those are left to the handler, called by
+ * the given stub.
+ */
+static void drc_emit_idle_checks(UINT32 addr, UINT32 target, DRC_STUB *call)
+{
+	if (idle_loop_branch(addr, target))
+	{
+		drc_emit8(0x80); drc_emit_rbx(7, drc_context_offset(&ppc_context->idle.enabled)); drc_emit8(0x00);	// cmp byte [idle.enabled], 0
+		call->jumps[call->num_jumps++] = drc_emit_jcc(DRC_JNE);
+	}
+	drc_emit_op_mem_imm(DRC_CMP_IMM, drc_context_offset(&ppc_context->idle.watch_pc), target);
+	call->jumps[call->num_jumps++] = drc_emit_jcc(DRC_JE);
+}
+
+/*
+ * Emits a conditional branch that doesn't set LR. The condition is evaluated
+ * without side effects; the taken stub stores CTR and leaves the block, and
+ * the call stub behind it runs the handler when the idle loop check needs to
+ * see the branch. Returns false for branches that are always taken, which
+ * are left to the handler.
+ */
+static bool drc_emit_bc(DRC_COMPILER *c, UINT32 op, UINT32 index, UINT32 pending)
+{
+	bool use_ctr = !(BO & 0x04);
+	bool use_cr = !(BO & 0x10);
+	if (LKBIT || !(use_ctr || use_cr))
+		return false;
+
+	DRC_STUB *taken = drc_add_stub(c, DRC_STUB_TAKEN, index, pending);
+	taken->target = drc_branch_target(op, c->pc + index * 4, SIMM16 & ~0x3);
+	taken->ctr = use_ctr;
+	drc_add_stub(c, DRC_STUB_CALL, index, pending);
+
+	UINT8 *not_taken = NULL;
+	if (use_ctr)
+	{
+		// OK if CTR - 1 is non-zero, or zero with BO[3]
+		drc_emit_load(DRC_EAX, DRC_OFFSET(ctr));
+		drc_emit8(0x83); drc_emit8(0xE8); drc_emit8(0x01);	// sub eax, 1
+		UINT8 ok = (BO & 0x02) ? DRC_JE : DRC_JNE;
+		if (use_cr)
+			not_taken = drc_emit_jcc(ok ^ 1);
+		else
+			taken->jumps[taken->num_jumps++] = drc_emit_jcc(ok);
+	}
+	if (use_cr)
+	{
+		// OK if the CR bit equals BO[1]
+		drc_emit8(0xF6); drc_emit_rbx(0, DRC_CRF(BI / 4)); drc_emit8(1 << (3 - BI % 4));	// test byte [cr+field], bit
+		taken->jumps[taken->num_jumps++] = drc_emit_jcc((BO & 0x08) ? DRC_JNE : DRC_JE);
+	}
+	if (not_taken != NULL)
+		drc_patch(not_taken, drc.cache_ptr);
+	if (use_ctr)
+		drc_emit_store(DRC_OFFSET(ctr), DRC_EAX);
+	return true;
+}
+
+// ppc.pc and ppc.npc for the instruction, icount -= pending, handler(opcode), icount--
+static void drc_emit_call(DRC_COMPILER *c, UINT32 index, UINT32 pending)
+{
+	UINT32 addr = c->pc + index * 4;
+	UINT32 opcode = c->src[index];
+	drc_emit_store_imm32(DRC_OFFSET(pc), addr);
+	drc_emit_store_imm32(DRC_OFFSET(npc), addr + 4);
+	if (pending > 0)
+		drc_emit_op_mem_imm(DRC_SUB_IMM, DRC_OFFSET(icount), pending);
+	drc_emit_call_handler(drc_lookup_handler(opcode), opcode);
+	drc_emit_op_mem_imm(DRC_SUB_IMM, DRC_OFFSET(icount), 1);
+}
+
+// Leaves the block after a call if control flow was redirected, emulation
+// halted, cached code overwritten, or the rest of the block would overrun
+// the segment
+static void drc_emit_exit_checks(DRC_COMPILER *c, UINT32 index)
+{
+	drc_emit_op_mem_imm(DRC_CMP_IMM, DRC_OFFSET(npc), c->pc + index * 4 + 4);
+	c->exits[c->num_exits++] = drc_emit_jcc(DRC_JNE);
+	drc_emit8(0x80); drc_emit_rbx(7, DRC_OFFSET(fatalError)); drc_emit8(0x00);	// cmp byte [fatalError], 0
+	c->exits[c->num_exits++] = drc_emit_jcc(DRC_JNE);
+	drc_emit8(0x44); drc_emit8(0x3B); drc_emit_rbx(4, drc_context_offset(&drc.generation));	// cmp r12d, generation
+	c->exits[c->num_exits++] = drc_emit_jcc(DRC_JNE);
+	drc_emit_op_mem_imm(DRC_CMP_IMM, DRC_OFFSET(icount), c->num_insns - index - 1);
+	c->exits[c->num_exits++] = drc_emit_jcc(DRC_JL);
+}
+
+// ppc.pc and ppc.npc as left by an instruction executed inline, icount -= pending
+static void drc_emit_sync(UINT32 addr, UINT32 npc, UINT32 pending)
+{
+	drc_emit_store_imm32(DRC_OFFSET(pc), addr);
+	drc_emit_store_imm32(DRC_OFFSET(npc), npc);
+	drc_emit_op_mem_imm(DRC_SUB_IMM, DRC_OFFSET(icount), pending);
+}
+
+static inline DRC_BLOCK drc_block_code(PPC_DECODED_BLOCK *block)
+{
+	return (DRC_BLOCK) (void *) ((UINT8 *) block + DRC_CODE_OFFSET);
+}
+
+// Offsets in a link stub of the generation it was linked in, the number of
+// instructions in the block it is linked to, and the jump there
+#define DRC_LINK_GENERATION		3
+#define DRC_LINK_NUM_INSNS		19
+#define DRC_LINK_JUMP			30
+
+/*
+ * Leaves the block for a fixed target, with ppc.pc, ppc.npc and icount up to
+ * date. Until drc_link() has pointed the stub at the block there, and
+ * whenever the cache has changed since, it stores its address in
+ * drc.exit_link for drc_execute() to link. It also leaves if the target block
+ * would overrun the segment.
+ */
+static void drc_emit_link(DRC_COMPILER *c)
+{
+	UINT8 *link = drc.cache_ptr;
+	drc_emit8(0x41); drc_emit8(0x81); drc_emit8(0xFC); drc_emit32(drc.generation - 1);	// cmp r12d, generation (stale)
+	UINT8 *stale = drc_emit_jcc(DRC_JNE);
+	drc_emit_op_mem_imm(DRC_CMP_IMM, DRC_OFFSET(icount), 0);	// cmp icount, num_insns
+	c->exits[c->num_exits++] = drc_emit_jcc(DRC_JL);
+	UINT8 *jump = drc_emit_jmp();
+	drc_patch(stale, drc.cache_ptr);
+	drc_patch(jump, drc.cache_ptr);
+	drc_emit8(0x48); drc_emit8(0xB8); drc_emit64((UINT64) (uintptr_t) link);	// mov rax, link
+	drc_emit8(0x48); drc_emit8(0x89); drc_emit_rbx(DRC_EAX, drc_context_offset(&drc.exit_link));	// mov [exit_link], rax
+	c->exits[c->num_exits++] = drc_emit_jmp();
+}
+
+// Points a link stub at a block, in the current generation
+static void drc_link(UINT8 *link, PPC_DECODED_BLOCK *block)
+{
+	memcpy(link + DRC_LINK_GENERATION, &drc.generation, sizeof(UINT32));
+	memcpy(link + DRC_LINK_NUM_INSNS, &block->num_insns, sizeof(UINT32));
+	drc_patch(link + DRC_LINK_JUMP, (UINT8 *) drc_block_code(block) + DRC_PROLOGUE_BYTES);
+}
+
+static PPC_DECODED_BLOCK *drc_compile(UINT32 pc)
+{
+	void **slot;
+	UINT32 max_insns;
+	const UINT32 *src = drc_begin_block(&slot, &max_insns, pc, DRC_MAX_BLOCK_BYTES + DRC_CODE_OFFSET + 15);
+	if (src == NULL)
+		return NULL;
+
+	// The header is followed by the code, both 16-byte aligned
+	drc.cache_ptr = (UINT8 *) (((size_t) drc.cache_ptr + 15) & ~(size_t)15);
+	PPC_DECODED_BLOCK *block = (PPC_DECODED_BLOCK *) drc.cache_ptr;
+	drc_init_links(block);
+	drc.cache_ptr += DRC_CODE_OFFSET;
+
+	DRC_COMPILER c;
+	c.pc = pc;
+	c.src = src;
+	c.num_insns = 0;
+	while (c.num_insns < max_insns && !drc_ends_block(src[c.num_insns++]))
+		;
+	c.num_exits = 0;
+	c.num_stubs = 0;
+	block->num_insns = c.num_insns;
+
+	drc_emit_prologue();
+	UINT32 pending = 0;	// instructions executed inline since icount was last updated
+	UINT32 last = pc + (c.num_insns - 1) * 4;
+	UINT32 end_npc = last + 4;
+	for (UINT32 i = 0; i < c.num_insns; i++)
+	{
+		UINT32 op = src[i];
+		void (*handler)(UINT32) = drc_lookup_handler(op);
+		const DRC_MEM_OP *m;
+		if (drc_emit_integer(handler, op))
+			++pending;
+		else if ((m = drc_find_mem_op(handler, op)) != NULL)
+		{
+			DRC_STUB *slow = drc_add_stub(&c, DRC_STUB_SLOW_PATH, i, pending);
+			slow->num_jumps = drc_emit_mem_op(m, op, slow->jumps);
+			slow->resume = drc.cache_ptr;
+			++pending;
+		}
+		else if (handler == ppc_bcx && drc_emit_bc(&c, op, i, pending))
+			++pending;
+		else if (handler == ppc_bx && !LKBIT)
+		{
+			// Always last in the block
+			INT32 li = op & 0x3FFFFFC;
+			if (li & 0x2000000)
+				li |= 0xFC000000;
+			end_npc = drc_branch_target(op, last, li);
+			drc_emit_idle_checks(last, end_npc, drc_add_stub(&c, DRC_STUB_CALL, i, pending));
+			++pending;
+		}
+		else
+		{
+			drc_emit_call(&c, i, pending);
+			pending = 0;
+			if (i != c.num_insns - 1)
+				drc_emit_exit_checks(&c, i);
+		}
+	}
+
+	// Reaching the end of the block inline
+	if (pending > 0)
+	{
+		drc_emit_sync(last, end_npc, pending);
+		drc_emit_link(&c);
+	}
+	UINT8 *exit = drc.cache_ptr;
+	drc_emit_epilogue();
+
+	for (UINT i = 0; i < c.num_stubs; i++)
+	{
+		DRC_STUB *stub = &c.stubs[i];
+		UINT32 addr = pc + stub->index * 4;
+		for (UINT j = 0; j < stub->num_jumps; j++)
+			drc_patch(stub->jumps[j], drc.cache_ptr);
+		switch (stub->type)
+		{
+			case DRC_STUB_SLOW_PATH:
+				// Checks for exits like any call, then puts back the cycles
+				// the main path accounts for itself
+				drc_emit_call(&c, stub->index, stub->pending);
+				drc_emit_exit_checks(&c, stub->index);
+				drc_emit_op_mem_imm(DRC_ADD_IMM, DRC_OFFSET(icount), stub->pending + 1);
+				drc_patch(drc_emit_jmp(), stub->resume);
+				break;
+			case DRC_STUB_CALL:
+				drc_emit_call(&c, stub->index, stub->pending);
+				drc_patch(drc_emit_jmp(), exit);
+				break;
+			case DRC_STUB_TAKEN:
+				drc_emit_idle_checks(addr, stub->target, &c.stubs[i + 1]);
+				if (stub->ctr)
+					drc_emit_store(DRC_OFFSET(ctr), DRC_EAX);
+				drc_emit_sync(addr, stub->target, stub->pending + 1);
+				drc_emit_link(&c);
+				break;
+		}
+	}
+
+	for (UINT i = 0; i < c.num_exits; i++)
+		drc_patch(c.exits[i], exit);
+
+	drc_end_block(slot, pc, block);
+	return block;
+}
+
+static void drc_execute(void)
+{
+	UINT8 *link = NULL;		// the last block was left through
+	UINT32 generation = 0;
+	while (ppc.icount > 0 && !ppc.fatalError)
+	{
+		PPC_DECODED_BLOCK *block = drc_get_block(drc_compile);
+
+		// The stub is gone if the cache was flushed since its block was entered
+		if (block != NULL && link != NULL && generation == drc.generation && !drc.no_chaining)
+			drc_link(link, block);
+		if (block == NULL)
+		{
+			drc_interpret_one();
+			link = NULL;
+			continue;
+		}
+		if (ppc.icount < (int) block->num_insns)
+		{
+			drc_interpret_rest();
+			break;
+		}
+
+		generation = drc.generation;
+		drc.exit_link = NULL;
+		drc_block_code(block)();
+		link = (UINT8 *) drc.exit_link;
+	}
+}
+
+#endif	// PPC_DRC_X64
+
+
+/*
+ * Cache memory
+ */
+
+static bool drc_alloc_cache(bool executable)
+{
+	if (executable)
+	{
+#if defined(PPC_DRC_X64) && defined(_WIN32)
+		drc.cache = (UINT8 *) VirtualAlloc(NULL, DRC_CACHE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#elif defined(PPC_DRC_X64)
+		void *mem = mmap(NULL, DRC_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		drc.cache = (mem == MAP_FAILED) ? NULL : (UINT8 *) mem;
+#else
+		drc.cache = NULL;
+#endif
+	}
+	else
+		drc.cache = (UINT8 *) malloc(DRC_CACHE_SIZE);
+	drc.cache_ptr = drc.cache;
+	return drc.cache != NULL;
+}
+
+static void drc_free_cache(void)
+{
+	if (drc.cache != NULL)
+	{
+		if (drc.mode == PPC_EXEC_RECOMPILER)
+		{
+#if defined(PPC_DRC_X64) && defined(_WIN32)
+			VirtualFree(drc.cache, 0, MEM_RELEASE);
+#elif defined(PPC_DRC_X64)
+			munmap(drc.cache, DRC_CACHE_SIZE);
+#endif
+		}
+		else
+			free(drc.cache);
+	}
+	drc.cache = NULL;
+	drc.cache_ptr = NULL;
+	for (UINT i = 0; i < (1 << (32 - DRC_CHUNK_SHIFT)); i++)
+	{
+		free(drc.lookup[i]);
+		drc.lookup[i] = NULL;
+	}
+	memset(ppc_code_pages, 0, sizeof(ppc_code_pages));
+	drc.mode = PPC_EXEC_INTERPRETER;
+}
+
+
+/*
+ * Public interface
+ */
+
+void ppc_set_exec_mode(PPC_EXEC_MODE mode)
+{
+	if (mode == drc.mode)
+	{
+		ppc_flush_code();
+		return;
+	}
+	drc_free_cache();
+
+	if (mode == PPC_EXEC_RECOMPILER)
+	{
+#ifdef PPC_DRC_X64
+		if (drc_alloc_cache(true))
+		{
+			drc.mode = PPC_EXEC_RECOMPILER;
+			drc_flush();
+			InfoLog("PowerPC recompiler enabled.");
+			return;
+		}
+		ErrorLog("Unable to allocate memory for PowerPC recompiler. Using block cache instead.");
+#else
+		ErrorLog("PowerPC recompiler is not supported on this platform. Using block cache instead.");
+#endif
+		mode = PPC_EXEC_BLOCK_CACHE;
+	}
+
+	if (mode == PPC_EXEC_BLOCK_CACHE)
+	{
+		if (drc_alloc_cache(false))
+		{
+			drc.mode = PPC_EXEC_BLOCK_CACHE;
+			drc_flush();
+			InfoLog("PowerPC block cache enabled.");
+			return;
+		}
+		ErrorLog("Unable to allocate memory for PowerPC block cache. Using interpreter instead.");
+	}
+}
+
+PPC_EXEC_MODE ppc_get_exec_mode(void)
+{
+	return drc.mode;
+}
+
+void ppc_invalidate_code(UINT32 addr)
+{
+	UINT32 page = addr >> DRC_PAGE_SHIFT;
+	if (!ppc_code_pages[page])
+		return;
+	ppc_code_pages[page] = 0;
+	++drc.generation;
+	void **chunk = drc.lookup[addr >> DRC_CHUNK_SHIFT];
+	if (chunk != NULL)
+		memset(&chunk[((addr & ((1 << DRC_CHUNK_SHIFT) - 1)) >> DRC_PAGE_SHIFT) * DRC_PAGE_ENTRIES], 0, DRC_PAGE_ENTRIES * sizeof(void *));
+}
+
+void ppc_set_block_chaining(bool enable)
+{
+	drc.no_chaining = !enable;
+}
+
+void ppc_flush_code(void)
+{
+	if (drc.mode != PPC_EXEC_INTERPRETER)
+		drc_flush();
+}
+
+const UINT8 *ppc_get_code_page_map(void)
+{
+	return ppc_code_pages;
+}
@@ -0,0 +1,341 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_hle.c
+ *
+ * High-level emulation of the games' own block copy and clear routines.
+ * Included from ppc.cpp; do not compile separately.
+ *
+ * Each routine is described by a signature, the instruction words at its
+ * entry point (with a mask of the bits that must match), so that it is
+ * recognised wherever the game has it. When a call (bl, bcl or bctrl) lands
+ * on code matching a signature, the copy or clear is done by the host
+ * instead, a page at a time through the memory map where both sides are
+ * directly mapped and a word at a time through the bus otherwise, and the
+ * routine returns at once. Its cost is charged as an estimated number of
+ * cycles per word.
+ *
+ * The routines must follow the calling convention: destination in r3,
+ * source or fill value in r4 and length in r5, in bytes or words depending
+ * on the type. Only r3, which is returned unchanged, is set as the routine
+ * would leave it.
+ *
+ * Self-test routines, which the boot sequence calls to check RAM and ROM,
+ * are only recognised while CModel3 is turbo booting. They return at once,
+ * passing, with their result in r3.
+ *
+ * In validation mode, the routines run as normal. The expected result is
+ * computed when the routine is called and compared with the destination when
+ * it returns, and a routine that doesn't match is disabled.
+ */
+
+#define hle		(ppc_context->hle)	// PPC_HLE_STATE
+
+#define HLE_CALL_CYCLES		8			// charged for the call and return on top of the words
+#define HLE_VALIDATE_CYCLES	1000000		// longest a call being validated may take to return
+
+static inline UINT32 hle_cache_index(UINT32 addr)
+{
+	return (addr >> 2) & (PPC_HLE_CACHE_SIZE - 1);
+}
+
+static inline UINT32 hle_bytes(const PPC_HLE_ROUTINE *r, UINT32 count)
+{
+	return (r->type == PPC_HLE_MEMCPY32 || r->type == PPC_HLE_MEMSET32) ? count * 4 : count;
+}
+
+// Code at ppc.op (the call's target, at addr) matches the routine's signature
+static bool hle_matches(const PPC_HLE_ROUTINE *r, UINT32 addr)
+{
+	if (r->disabled || (r->type == PPC_HLE_SELFTEST && !hle.boot) || addr + r->num_words * 4 - 1 > ppc.cur_fetch.end)
+		return false;
+	for (UINT32 i = 0; i < r->num_words; i++)
+	{
+		if ((ppc.op[i] & r->masks[i]) != r->words[i])
+			return false;
+	}
+	return true;
+}
+
+// Routine called at addr, or -1. Matches are looked up once per target and
+// kept in a small cache, checked again on each call in case the code was
+// replaced.
+static int hle_lookup(UINT32 addr)
+{
+	PPC_HLE_CACHE_ENTRY *entry = &hle.cache[hle_cache_index(addr)];
+	if (entry->tag == (addr | 1))
+	{
+		if (entry->routine < 0 || hle_matches(&hle.routines[entry->routine], addr))
+			return entry->routine;
+	}
+	entry->tag = addr | 1;
+	entry->routine = -1;
+	for (UINT32 i = 0; i < hle.num_routines; i++)
+	{
+		if (hle_matches(&hle.routines[i], addr))
+		{
+			entry->routine = (INT32) i;
+			break;
+		}
+	}
+	return entry->routine;
+}
+
+static void hle_flush_cache(void)
+{
+	memset(hle.cache, 0, sizeof(hle.cache));
+	hle.pending.active = false;
+}
+
+static inline void hle_invalidate_written(UINT32 start, UINT32 bytes)
+{
+	for (UINT32 page = start >> 12; page <= (start + bytes - 1) >> 12; page++)
+	{
+		if (ppc_code_pages[page])
+			ppc_invalidate_code(page << 12);
+	}
+}
+
+/*
+ * Copies as the guest would, front to back. Words are moved a page at a time
+ * when source and destination are aligned and directly mapped, unless the
+ * destination overlaps the source ahead of it, where copying front to back
+ * repeats the data.
+ */
+static void hle_copy(UINT32 dst, UINT32 src, UINT32 bytes)
+{
+	bool overlapped = dst > src && dst - src < bytes;
+	if (((dst | src | bytes) & 3) != 0 || overlapped)
+	{
+		if (((dst | src | bytes) & 3) == 0)
+		{
+			for (UINT32 i = 0; i < bytes; i += 4)
+				WRITE32(dst + i, READ32(src + i));
+		}
+		else
+		{
+			for (UINT32 i = 0; i < bytes; i++)
+				WRITE8(dst + i, READ8(src + i));
+		}
+		return;
+	}
+
+	while (bytes > 0)
+	{
+		UINT32 chunk = (std::min)(PPC_MEM_PAGE_MASK + 1 - (dst & PPC_MEM_PAGE_MASK), PPC_MEM_PAGE_MASK + 1 - (src & PPC_MEM_PAGE_MASK));
+		chunk = (std::min)(chunk, bytes);
+		const UINT8 *from = ppc_read_map[src >> PPC_MEM_PAGE_SHIFT];
+		UINT8 *to = ppc_write_map[dst >> PPC_MEM_PAGE_SHIFT];
+		if (from != NULL && to != NULL)
+		{
+			memmove(&to[dst & PPC_MEM_PAGE_MASK], &from[src & PPC_MEM_PAGE_MASK], chunk);	// words are in host order on both sides
+			hle_invalidate_written(dst, chunk);
+		}
+		else
+		{
+			for (UINT32 i = 0; i < chunk; i += 4)
+				WRITE32(dst + i, READ32(src + i));
+		}
+		dst += chunk;
+		src += chunk;
+		bytes -= chunk;
+	}
+}
+
+static void hle_fill(UINT32 dst, UINT32 word, UINT32 bytes)
+{
+	if (((dst | bytes) & 3) != 0)
+	{
+		for (UINT32 i = 0; i < bytes; i++)
+			WRITE8(dst + i, (UINT8) (word >> (24 - ((dst + i) & 3) * 8)));
+		return;
+	}
+
+	while (bytes > 0)
+	{
+		UINT32 chunk = (std::min)(PPC_MEM_PAGE_MASK + 1 - (dst & PPC_MEM_PAGE_MASK), bytes);
+		UINT8 *to = ppc_write_map[dst >> PPC_MEM_PAGE_SHIFT];
+		if (to != NULL)
+		{
+			UINT32 *words = (UINT32 *) &to[dst & PPC_MEM_PAGE_MASK];
+			for (UINT32 i = 0; i < chunk / 4; i++)
+				words[i] = word;
+			hle_invalidate_written(dst, chunk);
+		}
+		else
+		{
+			for (UINT32 i = 0; i < chunk; i += 4)
+				WRITE32(dst + i, word);
+		}
+		dst += chunk;
+		bytes -= chunk;
+	}
+}
+
+static inline UINT32 hle_fill_word(const PPC_HLE_ROUTINE *r, UINT32 value)
+{
+	return (r->type == PPC_HLE_MEMSET) ? (value & 0xFF) * 0x01010101 : value;
+}
+
+// Saves what the routine should leave at the destination, to compare on return
+static void hle_begin_validation(INT32 index, UINT32 dst, UINT32 src, UINT32 bytes)
+{
+	const PPC_HLE_ROUTINE *r = &hle.routines[index];
+	if (bytes > PPC_HLE_MAX_VALIDATE_BYTES || bytes == 0)
+		return;
+	for (UINT32 i = 0; i < bytes; i++)
+	{
+		if (r->type == PPC_HLE_MEMCPY || r->type == PPC_HLE_MEMCPY32)
+			hle.expected[i] = (dst > src && dst - src <= i) ? hle.expected[i - (dst - src)] : READ8(src + i);
+		else
+		{
+			UINT32 word = hle_fill_word(r, src);
+			hle.expected[i] = (UINT8) (word >> (24 - ((dst + i) & 3) * 8));
+		}
+	}
+	hle.pending.active = true;
+	hle.pending.routine = index;
+	hle.pending.return_addr = LR;
+	hle.pending.sp = REG(1);
+	hle.pending.dst = dst;
+	hle.pending.bytes = bytes;
+	hle.pending.start_cycle = ppc_current_cycle();
+}
+
+/*
+ * Called by bclr when taken. On entry, ppc.npc is the return address.
+ */
+static inline void ppc_check_hle_return(void)
+{
+	if (!hle.pending.active || ppc.npc != hle.pending.return_addr || REG(1) != hle.pending.sp)
+		return;
+
+	PPC_HLE_ROUTINE *r = &hle.routines[hle.pending.routine];
+	hle.pending.active = false;
+	for (UINT32 i = 0; i < hle.pending.bytes; i++)
+	{
+		if (READ8(hle.pending.dst + i) != hle.expected[i])
+		{
+			ErrorLog("PowerPC HLE routine '%s' does not match the game's at %08X (byte %u of %u). Disabling it.", r->name, hle.pending.dst, i, hle.pending.bytes);
+			r->disabled = true;
+			return;
+		}
+	}
+	if (!r->validated)
+	{
+		UINT64 cycles = ppc_current_cycle() - hle.pending.start_cycle;
+		InfoLog("PowerPC HLE routine '%s' matches the game's: %u bytes in %llu cycles, estimated %u.", r->name, hle.pending.bytes,
+			(unsigned long long) cycles, HLE_CALL_CYCLES + (hle.pending.bytes / 4) * r->cycles_per_word);
+		r->validated = true;
+	}
+}
+
+/*
+ * Called by branch handlers after a call has been taken. On entry, ppc.npc and
+ * ppc.op point to its target and LR has been set.
+ */
+static inline void ppc_check_hle_call(void)
+{
+	if (!hle.enabled || ppc.fatalError)
+		return;
+	int index = hle_lookup(ppc.npc);
+	if (index < 0)
+		return;
+
+	const PPC_HLE_ROUTINE *r = &hle.routines[index];
+	if (r->type == PPC_HLE_SELFTEST)
+	{
+		// Passes at once, with nothing to validate
+		REG(3) = r->result;
+		ppc.icount -= HLE_CALL_CYCLES;
+		ppc.npc = LR & ~0x3;
+		ppc_change_pc(ppc.npc);
+		return;
+	}
+	UINT32 dst = REG(3);
+	UINT32 src = REG(4);
+	UINT32 bytes = hle_bytes(r, REG(5));
+	if (hle.validate)
+	{
+		// Let the game's routine run, checking the result once it returns. A
+		// call that hasn't returned the usual way after a frame's worth of
+		// cycles is given up on.
+		if (hle.pending.active && ppc_current_cycle() - hle.pending.start_cycle > HLE_VALIDATE_CYCLES)
+			hle.pending.active = false;
+		if (!hle.pending.active)
+			hle_begin_validation(index, dst, src, bytes);
+		return;
+	}
+
+	if (bytes > 0)
+	{
+		if (r->type == PPC_HLE_MEMCPY || r->type == PPC_HLE_MEMCPY32)
+			hle_copy(dst, src, bytes);
+		else
+			hle_fill(dst, hle_fill_word(r, src), bytes);
+	}
+
+	// Return straight away. Long copies may run past the end of the segment,
+	// as a slow instruction would.
+	ppc.icount -= HLE_CALL_CYCLES + (bytes / 4) * r->cycles_per_word;
+	ppc.npc = LR & ~0x3;
+	ppc_change_pc(ppc.npc);
+}
+
+bool ppc_add_hle_routine(const char *name, PPC_HLE_TYPE type, const UINT32 *words, const UINT32 *masks, UINT32 num_words, UINT32 cycles_per_word, UINT32 result)
+{
+	if (hle.num_routines >= PPC_HLE_MAX_ROUTINES || num_words == 0 || num_words > PPC_HLE_MAX_WORDS)
+		return FAIL;
+	PPC_HLE_ROUTINE *r = &hle.routines[hle.num_routines++];
+	memset(r, 0, sizeof(*r));
+	strncpy(r->name, name, sizeof(r->name) - 1);
+	r->type = type;
+	for (UINT32 i = 0; i < num_words; i++)
+	{
+		r->masks[i] = masks[i];
+		r->words[i] = words[i] & masks[i];
+	}
+	r->num_words = num_words;
+	r->cycles_per_word = cycles_per_word;
+	r->result = result;
+	hle_flush_cache();
+	return OKAY;
+}
+
+void ppc_clear_hle_routines(void)
+{
+	hle.num_routines = 0;
+	hle_flush_cache();
+}
+
+void ppc_set_hle(bool enable, bool validate)
+{
+	hle.enabled = (enable || validate) && hle.num_routines > 0;
+	hle.validate = validate;
+	hle_flush_cache();
+}
+
+void ppc_set_hle_boot(bool booting)
+{
+	hle.boot = booting;
+	hle_flush_cache();
+}
@@ -0,0 +1,224 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_idle.c
+ *
+ * PowerPC idle loop detection. Included from ppc.cpp; do not compile
+ * separately.
+ *
+ * Games frequently spin in short loops waiting for an interrupt handler to
+ * change a variable in RAM, e.g.:
+ *
+ *		loop:	lwz		r3,0x1234(r13)
+ *				cmpwi	r3,0
+ *				beq		loop
+ *
+ * Each time a short backward branch is taken, the loop body is examined. If
+ * it consists only of loads from directly mapped memory (which nothing but
+ * the PowerPC itself can modify during a time slice), compares, and simple
+ * register operations, and no register value is carried from one iteration to
+ * the next, every further iteration would leave the CPU in exactly the same
+ * state. The remaining cycles up to the next event that could break the loop
+ * -- a decrementer exception, or the end of the time slice, after which
+ * CModel3 may assert an IRQ -- are then consumed at once.
+ *
+ * Loops that poll MMIO (e.g., the Real3D status bit, which changes based on
+ * the cycle count) are never skipped.
+ *
+ * The same branches are checked against a watched address, which is how
+ * CModel3 tells a game has finished booting.
+ */
+
+#define IDLE_MAX_INSNS	8
+
+#define idle	(ppc_context->idle)	// PPC_IDLE_STATE
+
+/*
+ * Tracks register usage within one loop iteration. A register that is read
+ * before being written and also written somewhere in the loop carries state
+ * between iterations (e.g., a counter), which makes the loop non-idle.
+ */
+typedef struct
+{
+	UINT32	written;
+	UINT32	carried;
+} IDLE_REG_USAGE;
+
+static inline void idle_read(IDLE_REG_USAGE *usage, UINT32 reg)
+{
+	if (!(usage->written & (1 << reg)))
+		usage->carried |= (1 << reg);
+}
+
+static inline void idle_write(IDLE_REG_USAGE *usage, UINT32 reg)
+{
+	usage->written |= (1 << reg);
+}
+
+// Effective address must be loop invariant and in memory that only the PowerPC can write
+static inline bool idle_load(IDLE_REG_USAGE *usage, UINT32 op, bool indexed)
+{
+	UINT32 ea = indexed ? REG(RB) : (UINT32) SIMM16;
+	if (RA != 0)
+	{
+		if (usage->written & (1 << RA))
+			return false;
+		idle_read(usage, RA);
+		ea += REG(RA);
+	}
+	if (indexed)
+	{
+		if (usage->written & (1 << RB))
+			return false;
+		idle_read(usage, RB);
+	}
+	if (ppc_read_map[ea >> PPC_MEM_PAGE_SHIFT] == NULL)
+		return false;
+	idle_write(usage, RD);
+	return true;
+}
+
+static bool idle_analyze(const UINT32 *code, UINT32 num_insns)
+{
+	IDLE_REG_USAGE usage = { 0, 0 };
+
+	// Loop body (excluding the final branch)
+	for (UINT32 i = 0; i < num_insns - 1; i++)
+	{
+		UINT32 op = code[i];
+		switch (op >> 26)
+		{
+			case 32:	// lwz
+			case 34:	// lbz
+			case 40:	// lhz
+			case 42:	// lha
+				if (!idle_load(&usage, op, false))
+					return false;
+				break;
+			case 10:	// cmpli
+			case 11:	// cmpi
+				idle_read(&usage, RA);
+				break;
+			case 21:	// rlwinm
+			case 24:	// ori
+			case 28:	// andi.
+			case 29:	// andis.
+				idle_read(&usage, RS);
+				idle_write(&usage, RA);
+				break;
+			case 31:
+				switch ((op >> 1) & 0x3ff)
+				{
+					case 23:	// lwzx
+					case 87:	// lbzx
+					case 279:	// lhzx
+						if (!idle_load(&usage, op, true))
+							return false;
+						break;
+					case 0:		// cmp
+					case 32:	// cmpl
+						idle_read(&usage, RA);
+						idle_read(&usage, RB);
+						break;
+					case 28:	// and
+					case 444:	// or
+						idle_read(&usage, RS);
+						idle_read(&usage, RB);
+						idle_write(&usage, RA);
+						break;
+					default:
+						return false;
+				}
+				break;
+			default:
+				return false;
+		}
+	}
+
+	// Closing branch must not modify CTR or LR
+	UINT32 op = code[num_insns - 1];
+	switch (op >> 26)
+	{
+		case 16:	// bc
+			if (!(BO & 0x4) || LKBIT)
+				return false;
+			break;
+		case 18:	// b
+			if (LKBIT)
+				return false;
+			break;
+		default:
+			return false;
+	}
+
+	return (usage.carried & usage.written) == 0;
+}
+
+// Whether a branch from pc to target is short and backward enough to close
+// an idle loop
+static inline bool idle_loop_branch(UINT32 pc, UINT32 target)
+{
+	return target <= pc && pc - target < IDLE_MAX_INSNS * 4;
+}
+
+/*
+ * Called by branch handlers after a branch has been taken. On entry, ppc.pc is
+ * the branch and ppc.npc and ppc.op point to its target.
+ */
+static inline void ppc_check_idle_loop(void)
+{
+	if (ppc.npc == idle.watch_pc)
+		idle.watch_hit = true;
+	if (!idle.enabled || !idle_loop_branch(ppc.pc, ppc.npc) || ppc.fatalError)
+		return;
+	if (ppc.pc > ppc.cur_fetch.end || !idle_analyze(ppc.op, (ppc.pc - ppc.npc) / 4 + 1))
+		return;
+
+	// Skip ahead to the end of the segment, which is where the decrementer
+	// fires or the slice ends. The caller accounts for the branch itself.
+	if (ppc.icount > 1)
+	{
+		idle.skipped_cycles += ppc.icount - 1;
+		ppc.icount = 1;
+	}
+}
+
+void ppc_set_idle_skip(bool enable)
+{
+	idle.enabled = enable;
+}
+
+UINT64 ppc_idle_cycles(void)
+{
+	return idle.skipped_cycles;
+}
+
+void ppc_set_watch_pc(UINT32 addr)
+{
+	idle.watch_pc = addr != 0 ? addr : 0xFFFFFFFF;	// never a branch target
+	idle.watch_hit = false;
+}
+
+bool ppc_watch_pc_hit(void)
+{
+	return idle.watch_hit;
+}
@@ -241,6 +241,10 @@ static void ppc_bx(UINT32 op)
 	}
 
 	ppc_change_pc(ppc.npc);
+	if( LKBIT )
+		ppc_check_hle_call();
+	else
+		ppc_check_idle_loop();
 }
 
 static void ppc_bcx(UINT32 op)
@@ -253,10 +257,13 @@ static void ppc_bcx(UINT32 op)
 			ppc.npc += ppc.pc;
 
 		ppc_change_pc(ppc.npc);
+		ppc_check_idle_loop();
 	}
 
 	if( LKBIT ) {
 		LR = ppc.pc + 4;
+		if( condition )
+			ppc_check_hle_call();
 	}
 }
 
@@ -271,6 +278,8 @@ static void ppc_bcctrx(UINT32 op)
 
 	if( LKBIT ) {
 		LR = ppc.pc + 4;
+		if( condition )
+			ppc_check_hle_call();
 	}
 }
 
@@ -281,6 +290,7 @@ static void ppc_bclrx(UINT32 op)
 	if( condition ) {
 		ppc.npc = LR & ~0x3;
 		ppc_change_pc(ppc.npc);
+		ppc_check_hle_return();
 	}
 
 	if( LKBIT ) {
@@ -1693,7 +1703,13 @@ inline INT64 round_toward_negative_infinity(FPR f)
 #define SET_VXSNAN(a, b)    if (is_snan_double(a) || is_snan_double(b)) ppc.fpscr |= 0x80000000
 #define SET_VXSNAN_1(c)     if (is_snan_double(c)) ppc.fpscr |= 0x80000000
 
-inline void set_fprf(FPR f)
+/*
+ * FPSCR[FPRF] is updated by nearly every arithmetic instruction but rarely
+ * read. Rather than classifying each result, the most recent one is kept and
+ * only classified by flush_fprf() when FPSCR is accessed (mffs, mcrfs, the
+ * mtfs* instructions, saving state). The outcome is identical.
+ */
+static inline UINT32 fprf_class(FPR f)
 {
 	UINT32 fprf;
 
@@ -1732,8 +1748,23 @@ inline void set_fprf(FPR f)
 			fprf = 0x02;
 	}
 
-	ppc.fpscr &= ~0x0001f000;
-	ppc.fpscr |= (fprf << 12);
+	return fprf;
+}
+
+static inline void set_fprf(FPR f)
+{
+	ppc.fprf_result = f;
+	ppc.fprf_pending = true;
+}
+
+static inline void flush_fprf(void)
+{
+	if (ppc.fprf_pending)
+	{
+		ppc.fpscr &= ~0x0001f000;
+		ppc.fpscr |= (fprf_class(ppc.fprf_result) << 12);
+		ppc.fprf_pending = false;
+	}
 }
 
 
@@ -2121,6 +2152,7 @@ static void ppc_fcmpo(UINT32 op)
 
 	// TODO
 	// Enabled by Bart
+	ppc.fprf_pending = false;
 	ppc.fpscr &= ~0x0001F000;
 	ppc.fpscr |= (c << 12);
 }
@@ -2156,6 +2188,7 @@ static void ppc_fcmpu(UINT32 op)
 	CR(t) = c;
 
 	// TODO
+	ppc.fprf_pending = false;
 	ppc.fpscr &= ~0x0001F000;
 	ppc.fpscr |= (c << 12);
 }
@@ -2382,6 +2415,7 @@ static void ppc_fsubx(UINT32 op)
 
 static void ppc_mffsx(UINT32 op)
 {
+	flush_fprf();
 	FPR(RT).id = (UINT32)ppc.fpscr;
 
 	if( RCBIT ) {
@@ -2395,6 +2429,7 @@ static void ppc_mtfsb0x(UINT32 op)
 
 	crbD = (op >> 21) & 0x1F;
 
+	flush_fprf();
 	if (crbD != 1 && crbD != 2) // these bits cannot be explicitly cleared
 		ppc.fpscr &= ~(1 << (31 - crbD));
 
@@ -2409,6 +2444,7 @@ static void ppc_mtfsb1x(UINT32 op)
 
 	crbD = (op >> 21) & 0x1F;
 
+	flush_fprf();
 	if (crbD != 1 && crbD != 2) // these bits cannot be explicitly cleared
 		ppc.fpscr |= (1 << (31 - crbD));
 
@@ -2422,6 +2458,7 @@ static void ppc_mtfsfx(UINT32 op)
 	UINT32 b = RB;
 	UINT32 f = ppc_field_xlat[FM];
 
+	flush_fprf();
 	ppc.fpscr &= (~f) | ~(FPSCR_FEX | FPSCR_VX);
 	ppc.fpscr |= (UINT32)(FPR(b).id) & ~(FPSCR_FEX | FPSCR_VX);
 
@@ -2450,6 +2487,8 @@ static void ppc_mtfsfix(UINT32 op)
 
     crfd = (7 - crfd) * 4;  // calculate LSB position of field
 
+	flush_fprf();
+
     if (crfd == 28)         // field containing FEX and VX is special...
     {                       // bits 1 and 2 of FPSCR must not be altered
         ppc.fpscr &= 0x9fffffff;
@@ -2469,6 +2508,7 @@ static void ppc_mcrfs(UINT32 op)
 	UINT32 crfs, f;
 	crfs = CRFA;
 
+	flush_fprf();
 	f = ppc.fpscr >> ((7 - crfs) * 4);	// get crfS field from FPSCR
 	f &= 0xf;
 
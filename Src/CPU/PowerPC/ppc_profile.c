@@ -0,0 +1,221 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_profile.c
+ *
+ * PowerPC hotspot profiler. Included from ppc.cpp; do not compile separately.
+ *
+ * Only built when PPC_PROFILE is defined. Otherwise, PPC_PROFILE_INSN()
+ * expands to nothing and no profiling code exists at all. When built, the
+ * PowerPC always runs in the plain interpreter loop, which calls
+ * PPC_PROFILE_INSN() after every instruction to:
+ *
+ *		- Count executions per opcode table entry. Entries sharing a handler
+ *		  (e.g., the A-form floating point ops) are merged in the report.
+ *		- Sample the PC once every PPC_PROFILE_SAMPLE_CYCLES cycles. Cycles
+ *		  consumed by idle loop skipping are credited to the loop's branch.
+ *
+ * Profile data is global rather than per-context: it is a development tool
+ * and normally only one PowerPC is running.
+ */
+
+#ifdef PPC_PROFILE
+
+#ifndef PPC_PROFILE_SAMPLE_CYCLES
+#define PPC_PROFILE_SAMPLE_CYCLES	1000
+#endif
+
+#define PPC_PROFILE_MAX_PCS			256		// number of hotspots reported
+
+#define PPC_PROFILE_NUM_OPS			(64 + 4 * 1024)	// optable, then optable19/31/59/63
+
+typedef struct
+{
+	UINT64	count;
+	UINT32	opcode;		// most recently executed opcode, for disassembly
+} PPC_PROFILE_OP;
+
+static struct
+{
+	PPC_PROFILE_OP	ops[PPC_PROFILE_NUM_OPS];
+	std::unordered_map<UINT32, UINT64>	pcSamples;
+	UINT64	nextSample;
+} s_profile;
+
+static inline unsigned ppc_profile_op_index(UINT32 opcode)
+{
+	switch (opcode >> 26)
+	{
+		case 19:	return 64 + 0 * 1024 + ((opcode >> 1) & 0x3ff);
+		case 31:	return 64 + 1 * 1024 + ((opcode >> 1) & 0x3ff);
+		case 59:	return 64 + 2 * 1024 + ((opcode >> 1) & 0x3ff);
+		case 63:	return 64 + 3 * 1024 + ((opcode >> 1) & 0x3ff);
+		default:	return opcode >> 26;
+	}
+}
+
+static void (*ppc_profile_handler(unsigned index))(UINT32)
+{
+	if (index < 64)
+		return optable[index];
+	index -= 64;
+	switch (index / 1024)
+	{
+		case 0:		return optable19[index % 1024];
+		case 1:		return optable31[index % 1024];
+		case 2:		return optable59[index % 1024];
+		default:	return optable63[index % 1024];
+	}
+}
+
+static inline void ppc_profile_insn(UINT32 opcode)
+{
+	PPC_PROFILE_OP *op = &s_profile.ops[ppc_profile_op_index(opcode)];
+	++op->count;
+	op->opcode = opcode;
+
+	UINT64 now = ppc_current_cycle();
+	if (now >= s_profile.nextSample)
+	{
+		UINT64 samples = (now - s_profile.nextSample) / PPC_PROFILE_SAMPLE_CYCLES + 1;
+		s_profile.pcSamples[ppc.pc] += samples;
+		s_profile.nextSample += samples * PPC_PROFILE_SAMPLE_CYCLES;
+	}
+	else if (now + PPC_PROFILE_SAMPLE_CYCLES < s_profile.nextSample)
+		s_profile.nextSample = now;		// cycle count went backwards (reset)
+}
+
+#define PPC_PROFILE_INSN(opcode)	ppc_profile_insn(opcode)
+
+void ppc_profile_reset(void)
+{
+	memset(s_profile.ops, 0, sizeof(s_profile.ops));
+	s_profile.pcSamples.clear();
+	s_profile.nextSample = 0;
+}
+
+#ifdef SUPERMODEL_DEBUGGER
+// Name of the nearest label at or before addr, from the attached debugger
+static bool ppc_profile_label(const std::vector<std::pair<UINT32, std::string>> &labels, UINT32 addr, char *str, size_t size)
+{
+	auto it = std::upper_bound(labels.begin(), labels.end(), addr, [](UINT32 a, const std::pair<UINT32, std::string> &l) { return a < l.first; });
+	if (it == labels.begin())
+		return false;
+	--it;
+	if (addr == it->first)
+		snprintf(str, size, "%s", it->second.c_str());
+	else
+		snprintf(str, size, "%s+%X", it->second.c_str(), addr - it->first);
+	return true;
+}
+
+static void ppc_profile_gather_labels(std::vector<std::pair<UINT32, std::string>> &labels)
+{
+	if (PPCDebugAttached == NULL)
+		return;
+	for (Debugger::CLabel *label : PPCDebugAttached->labels)
+		labels.push_back(std::make_pair(label->addr, std::string(label->name)));
+	Debugger::CCodeAnalyser *analyser = PPCDebugAttached->GetCodeAnalyser();
+	if (analyser != NULL)
+	{
+		char name[256];
+		for (Debugger::CAutoLabel *label : analyser->analysis->GetAutoLabels(Debugger::LFSubroutine))
+		{
+			if (label->GetLabel(name, Debugger::LFSubroutine))
+				labels.push_back(std::make_pair(label->addr, std::string(name)));
+		}
+	}
+	std::sort(labels.begin(), labels.end());
+}
+#endif // SUPERMODEL_DEBUGGER
+
+bool ppc_profile_dump(const char *file)
+{
+	FILE *fp = fopen(file, "w");
+	if (NULL == fp)
+		return ErrorLog("Unable to write PowerPC profile to '%s'.", file);
+
+	char mnem[32], oprs[256], label[256];
+
+	// Opcode handlers, merging table entries that share a handler
+	std::map<void (*)(UINT32), PPC_PROFILE_OP> handlers;
+	UINT64 totalInsns = 0;
+	for (unsigned i = 0; i < PPC_PROFILE_NUM_OPS; i++)
+	{
+		if (s_profile.ops[i].count == 0)
+			continue;
+		PPC_PROFILE_OP &op = handlers[ppc_profile_handler(i)];
+		op.count += s_profile.ops[i].count;
+		op.opcode = s_profile.ops[i].opcode;
+		totalInsns += s_profile.ops[i].count;
+	}
+	std::vector<PPC_PROFILE_OP> ops;
+	for (auto &h : handlers)
+		ops.push_back(h.second);
+	std::sort(ops.begin(), ops.end(), [](const PPC_PROFILE_OP &a, const PPC_PROFILE_OP &b) { return a.count > b.count; });
+
+	fprintf(fp, "PowerPC opcode handlers (%llu instructions):\n\n", (unsigned long long) totalInsns);
+	fprintf(fp, "  %-16s %14s %7s\n", "handler", "count", "%");
+	for (const PPC_PROFILE_OP &op : ops)
+	{
+		DisassemblePowerPC(op.opcode, 0, mnem, oprs, false);
+		if (mnem[0] == '\0')
+			strcpy(mnem, "?");
+		fprintf(fp, "  %-16s %14llu %6.2f%%\n", mnem, (unsigned long long) op.count, 100.0 * op.count / totalInsns);
+	}
+
+	// PC samples
+	std::vector<std::pair<UINT32, UINT64>> pcs(s_profile.pcSamples.begin(), s_profile.pcSamples.end());
+	std::sort(pcs.begin(), pcs.end(), [](const std::pair<UINT32, UINT64> &a, const std::pair<UINT32, UINT64> &b) { return a.second > b.second; });
+	UINT64 totalSamples = 0;
+	for (auto &pc : pcs)
+		totalSamples += pc.second;
+
+#ifdef SUPERMODEL_DEBUGGER
+	std::vector<std::pair<UINT32, std::string>> labels;
+	ppc_profile_gather_labels(labels);
+#endif // SUPERMODEL_DEBUGGER
+
+	fprintf(fp, "\nPowerPC hotspots (%llu samples, one per %d cycles):\n\n", (unsigned long long) totalSamples, PPC_PROFILE_SAMPLE_CYCLES);
+	fprintf(fp, "  %-8s %10s %7s  %-32s %s\n", "pc", "samples", "%", "label", "instruction");
+	for (size_t i = 0; i < pcs.size() && i < PPC_PROFILE_MAX_PCS; i++)
+	{
+		UINT32 pc = pcs[i].first;
+		label[0] = '\0';
+#ifdef SUPERMODEL_DEBUGGER
+		ppc_profile_label(labels, pc, label, sizeof(label));
+#endif // SUPERMODEL_DEBUGGER
+		DisassemblePowerPC(READ32(pc), pc, mnem, oprs, true);
+		if (mnem[0] == '\0')
+			strcpy(mnem, "?");
+		fprintf(fp, "  %08X %10llu %6.2f%%  %-32s %s %s\n", pc, (unsigned long long) pcs[i].second, 100.0 * pcs[i].second / totalSamples, label, mnem, oprs);
+	}
+
+	fclose(fp);
+	return OKAY;
+}
+
+#else
+
+#define PPC_PROFILE_INSN(opcode)
+
+#endif // PPC_PROFILE
@@ -0,0 +1,217 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ppc_threaded.c
+ *
+ * Threaded (computed goto) PowerPC interpreter loop for GCC and Clang.
+ * Included from ppc.cpp after the opcode handlers; do not compile separately.
+ *
+ * Semantically identical to the portable loop in ppc_execute(). Each primary
+ * opcode has its own label that calls its handler directly (allowing small
+ * handlers to be inlined) and ends with its own copy of the dispatch jump, so
+ * the host branch predictor sees one indirect branch per opcode rather than a
+ * single shared one. Opcodes without a fixed primary handler go through the
+ * regular opcode tables.
+ *
+ * The block cache (see ppc_drc.c) runs its blocks with the same dispatch. Each
+ * opcode has a second label there for instructions that only access
+ * registers, which skips all bookkeeping, and branches without LK have one
+ * of their own. Linked blocks are gone on to without leaving the loop.
+ */
+
+#ifdef PPC_THREADED_DISPATCH
+
+// Primary opcodes with a label of their own and the call made there. The
+// others take the table entry.
+#define PPC_THREADED_OPS(OP)									\
+	OP(table,	optable[opcode >> 26](opcode))					\
+	OP(3,		ppc_twi(opcode))								\
+	OP(7,		ppc_mulli(opcode))								\
+	OP(8,		ppc_subfic(opcode))								\
+	OP(10,		ppc_cmpli(opcode))								\
+	OP(11,		ppc_cmpi(opcode))								\
+	OP(12,		ppc_addic(opcode))								\
+	OP(13,		ppc_addic_rc(opcode))							\
+	OP(14,		ppc_addi(opcode))								\
+	OP(15,		ppc_addis(opcode))								\
+	OP(16,		ppc_bcx(opcode))								\
+	OP(17,		ppc_sc(opcode))									\
+	OP(18,		ppc_bx(opcode))									\
+	OP(19,		optable19[(opcode >> 1) & 0x3ff](opcode))		\
+	OP(20,		ppc_rlwimix(opcode))							\
+	OP(21,		ppc_rlwinmx(opcode))							\
+	OP(23,		ppc_rlwnmx(opcode))								\
+	OP(24,		ppc_ori(opcode))								\
+	OP(25,		ppc_oris(opcode))								\
+	OP(26,		ppc_xori(opcode))								\
+	OP(27,		ppc_xoris(opcode))								\
+	OP(28,		ppc_andi_rc(opcode))							\
+	OP(29,		ppc_andis_rc(opcode))							\
+	OP(31,		optable31[(opcode >> 1) & 0x3ff](opcode))		\
+	OP(32,		ppc_lwz(opcode))								\
+	OP(33,		ppc_lwzu(opcode))								\
+	OP(34,		ppc_lbz(opcode))								\
+	OP(35,		ppc_lbzu(opcode))								\
+	OP(36,		ppc_stw(opcode))								\
+	OP(37,		ppc_stwu(opcode))								\
+	OP(38,		ppc_stb(opcode))								\
+	OP(39,		ppc_stbu(opcode))								\
+	OP(40,		ppc_lhz(opcode))								\
+	OP(41,		ppc_lhzu(opcode))								\
+	OP(42,		ppc_lha(opcode))								\
+	OP(43,		ppc_lhau(opcode))								\
+	OP(44,		ppc_sth(opcode))								\
+	OP(45,		ppc_sthu(opcode))								\
+	OP(46,		ppc_lmw(opcode))								\
+	OP(47,		ppc_stmw(opcode))								\
+	OP(48,		ppc_lfs(opcode))								\
+	OP(49,		ppc_lfsu(opcode))								\
+	OP(50,		ppc_lfd(opcode))								\
+	OP(51,		ppc_lfdu(opcode))								\
+	OP(52,		ppc_stfs(opcode))								\
+	OP(53,		ppc_stfsu(opcode))								\
+	OP(54,		ppc_stfd(opcode))								\
+	OP(55,		ppc_stfdu(opcode))								\
+	OP(59,		optable59[(opcode >> 1) & 0x3ff](opcode))		\
+	OP(63,		optable63[(opcode >> 1) & 0x3ff](opcode))
+
+// Dispatch table for label prefix p, indexed by primary opcode
+#define PPC_THREADED_LABELS(p)																	\
+	&&p##table, &&p##table, &&p##table, &&p##3, &&p##table, &&p##table, &&p##table, &&p##7,		\
+	&&p##8, &&p##table, &&p##10, &&p##11, &&p##12, &&p##13, &&p##14, &&p##15,					\
+	&&p##16, &&p##17, &&p##18, &&p##19, &&p##20, &&p##21, &&p##table, &&p##23,					\
+	&&p##24, &&p##25, &&p##26, &&p##27, &&p##28, &&p##29, &&p##table, &&p##31,					\
+	&&p##32, &&p##33, &&p##34, &&p##35, &&p##36, &&p##37, &&p##38, &&p##39,						\
+	&&p##40, &&p##41, &&p##42, &&p##43, &&p##44, &&p##45, &&p##46, &&p##47,						\
+	&&p##48, &&p##49, &&p##50, &&p##51, &&p##52, &&p##53, &&p##54, &&p##55,						\
+	&&p##table, &&p##table, &&p##table, &&p##59, &&p##table, &&p##table, &&p##table, &&p##63
+
+static void ppc_execute_threaded(void)
+{
+	static const void *const dispatch[64] = { PPC_THREADED_LABELS(op_) };
+	UINT32 opcode;
+
+#define DISPATCH()													\
+	do {															\
+		if (ppc.icount <= 0 || ppc.fatalError)						\
+			return;													\
+		ppc.pc = ppc.npc;											\
+		opcode = *ppc.op++;											\
+		ppc.npc = ppc.pc + 4;										\
+		goto *dispatch[opcode >> 26];								\
+	} while (0)
+
+#define OP(n, call)													\
+	op_##n:															\
+		call;														\
+		ppc.icount--;												\
+		DISPATCH();
+
+	DISPATCH();
+	PPC_THREADED_OPS(OP)
+
+#undef OP
+#undef DISPATCH
+}
+
+/*
+ * Runs the instructions of a block cache block until one redirects control
+ * flow, halts emulation, overwrites cached code or leaves too few cycles for
+ * the rest of the block, and then the blocks it is linked to, as
+ * drc_run_decoded() does without threaded dispatch. ppc.icount is only
+ * brought up to date (from done) before handlers that aren't registers only,
+ * and at the end. Each of those handlers is only subtracted along with the
+ * instructions after it, which saves a dependent update of icount in memory.
+ * Returns the link the last block was left through, or NULL if it was left
+ * by a handler.
+ */
+static PPC_DRC_LINK *ppc_execute_block_threaded(PPC_DECODED_BLOCK *block, UINT32 generation, bool follow_links)
+{
+	static const void *const dispatch[129] = { PPC_THREADED_LABELS(op_), PPC_THREADED_LABELS(reg_), &&branch };
+	const PPC_DECODED_INSN *insn = (const PPC_DECODED_INSN *) (block + 1);
+	UINT32 num_insns = block->num_insns;
+	UINT32 addr = ppc.npc, opcode, i = 0, done = 0;
+	PPC_DRC_LINK *link;
+
+#define DISPATCH()													\
+	do {															\
+		opcode = insn[i].opcode;									\
+		goto *dispatch[insn[i].dispatch];							\
+	} while (0)
+
+#define NEXT()														\
+	do {															\
+		if (++i == num_insns)										\
+			goto end;												\
+		addr += 4;													\
+		DISPATCH();													\
+	} while (0)
+
+#define OP(n, call)													\
+	reg_##n:														\
+		call;														\
+		NEXT();														\
+	op_##n:															\
+		ppc.pc = addr;												\
+		ppc.npc = addr + 4;											\
+		ppc.icount -= i - done;										\
+		call;														\
+		done = i;	/* the instruction itself is subtracted later */	\
+		if (ppc.npc != addr + 4 || ppc.fatalError || drc.generation != generation || ppc.icount <= (INT32) (num_insns - done - 1))	\
+		{															\
+			ppc.icount--;											\
+			return NULL;											\
+		}															\
+		NEXT();
+
+	DISPATCH();
+	PPC_THREADED_OPS(OP)
+
+branch:
+	if (!drc_take_branch(opcode, addr, i - done))
+		NEXT();
+	link = &block->links[drc_branch_link(opcode)];
+	goto next_block;
+
+end:
+	ppc.pc = addr;
+	ppc.npc = addr + 4;
+	ppc.icount -= num_insns - done;
+	link = &block->links[DRC_LINK_END];
+
+next_block:
+	if (!follow_links || !drc_can_follow(link, generation))
+		return link;
+	block = (PPC_DECODED_BLOCK *) link->block;
+	insn = (const PPC_DECODED_INSN *) (block + 1);
+	num_insns = block->num_insns;
+	addr = ppc.npc;
+	i = 0;
+	done = 0;
+	DISPATCH();
+
+#undef OP
+#undef NEXT
+#undef DISPATCH
+}
+
+#endif	// PPC_THREADED_DISPATCH
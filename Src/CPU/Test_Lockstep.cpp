@@ -0,0 +1,3240 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Test_Lockstep.cpp
+ *
+ * Differential test harness for CPU execution paths. Runs a reference and a
+ * fast path side by side on identical copies of memory and compares their
+ * registers and the stream of bus writes after every interval. Stops at the
+ * first divergence and disassembles the code around both PCs. Also reports
+ * the throughput of each path, which makes it a repeatable CPU benchmark.
+ * The same is done for emulation kernels that have a fast path, on random
+ * inputs.
+ *
+ *    Test_Lockstep ppc [-mode=cache|recompiler] [-state=<file>] [-crom=<file>]
+ *                      [-program=random] [-seed=<n>] [-cycles=<n>]
+ *                      [-interval=<n>] [-trace=all|branches]
+ *    Test_Lockstep 68k [-image=<file>] [-cycles=<n>] [-interval=<n>]
+ *                      [-trace=all|branches]
+ *    Test_Lockstep new3d|render2d|scspdsp|scsp|mpeg|mix|ratecontrol
+ *                  |barrier|blockfile|midi|netdelta|crypto
+ *                  [-count=<n>] [-seed=<n>]
+ *    Test_Lockstep romsets [-xml=<file>]
+ *
+ * PowerPC: the interpreter is compared against the block cache or the
+ * recompiler. With -state, RAM and PowerPC registers are taken from a
+ * Supermodel save state; -crom supplies the 8 MB fixed CROM as it appears at
+ * 0xFF800000 (32-bit words in host order). Without -state, a built-in program
+ * exercising loads, stores, branches and the decrementer is run.
+ * -program=random runs a random program for -seed instead, made of the kinds
+ * of instructions the recompiler emits inline, with RAM writable directly so
+ * that stores take the fast paths; the data area it uses is compared too.
+ *
+ * 68K: Musashi fetching through the bus is compared against Musashi with
+ * directly mapped instruction fetches. -image loads a big-endian binary
+ * (starting with the reset vectors) at address 0.
+ *
+ * With -trace, the fast path also records an execution trace (see
+ * CPU/ExecTrace.h), which must not change what it does. A PowerPC recording
+ * every instruction runs the interpreter loop rather than the fast path.
+ * The fast path's throughput then includes tracing, so it is not comparable.
+ *
+ * Reads of unmapped addresses return all ones on both sides, so code that
+ * polls hardware runs identically but not necessarily meaningfully.
+ *
+ * Kernels: each check runs -count random cases (by default, a number that
+ * takes a moment) through the fast path and a reference and compares the
+ * results bit for bit, reporting the first case that differs. The inputs are
+ * reproducible for a given -seed.
+ *
+ * New3D: the SIMD.h matrix, vector and frustum plane kernels are compared
+ * against the scalar code they replaced.
+ *
+ * Render2D: DrawTileLineSIMD() is compared against the unclipped scalar
+ * DrawTileLine() for 4- and 8-bit tiles, with and without alpha testing.
+ *
+ * SCSP DSP: SCSPDSP_Step() running the pre-decoded program is compared
+ * against the interpreter that decoded every step of every sample, on random
+ * programs, one case per sample.
+ *
+ * SCSP: random register writes are made between 68K batches, and each frame
+ * of output is one case. With the state saved and loaded back every few
+ * frames, which rebuilds the set of active slots and the fields decoded from
+ * the slot registers, the output must be the same as without, for one and two
+ * SCSPs. Rendering slots in blocks, also on the job pool with two SCSPs, must
+ * give the same output as mixing them sample by sample.
+ *
+ * MPEG audio: MpegDec, which decodes ahead on a worker thread, is compared
+ * against decoding each frame when needed, on random Layer III frames, with
+ * random track, loop and position changes. Each operation is one case.
+ *
+ * Audio mix: the 16-bit host output of OutputAudio(), taken from the audio
+ * sink with audio headless, is compared against the mix as it was before it
+ * was vectorized, for every audio type, channel count, balance and flip.
+ *
+ * Audio rate control: the resampler must pass samples through unchanged at a
+ * ratio of 1, and with the fill level controller, keep a simulated host
+ * buffer from under- or over-running with the host clock off by up to 0.4%.
+ *
+ * Frame barrier: 4 threads go through a start and an end CFrameBarrier each
+ * frame, arriving in random order and sometimes late enough for the others
+ * to block. All must see each other's writes of the frame once released.
+ *
+ * Block files: files of random blocks, one per case, written to memory and
+ * to a file must match the block format byte for byte, and read back the
+ * same both ways. FindBlock() must find the same blocks as a scan from the
+ * start of the file, with repeated and missing names. Files saved with
+ * compression must load back the same, and fail to load when corrupted. A
+ * temporary file, Test_Lockstep.tmp, is written to the current directory.
+ *
+ * MIDI recordings: random MIDI port writes recorded by the sound board must
+ * load back the same, and damaged recordings must be rejected or cut short.
+ * The recording is written to Test_Lockstep.tmp as well.
+ *
+ * Net deltas: comm RAM slices encoded as keyframes and deltas for the net
+ * board must decode to the slices sent, corrupt deltas must be rejected, and
+ * the size of the deltas is printed.
+ *
+ * ROM sets: the games identified through GameLoader's file index must be the
+ * same as those found by checking every file of every game, on ROM sets made
+ * up from the game definitions in -xml (Config/Games.xml by default).
+ *
+ * Security board: words decrypted through the precomputed tables are
+ * compared against the reference block_decrypt(), with a new random game key
+ * every 20000 words and a new sequence key every 100.
+ */
+
+#include "CPU/PowerPC/ppc.h"
+#include "CPU/PowerPC/PPCDisasm.h"
+#include "CPU/68K/68K.h"
+#include "CPU/Bus.h"
+#include "CPU/ExecTrace.h"
+#include "BlockFile.h"
+#include "GameLoader.h"
+#include "Graphics/New3D/SIMD.h"
+#include "Graphics/TileLine.h"
+#include "Model3/Crypto.h"
+#include "Model3/SoundBoard.h"
+#include "Network/NetDelta.h"
+#include "OSD/Audio.h"
+#include "OSD/SDL/AudioResampler.h"
+#include "OSD/Thread.h"
+#include "Pkgs/minimp3.h"
+#include "Sound/MPEG/MpegAudio.h"
+#include "Sound/SCSP.h"
+#include "Sound/SCSPDSP.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+void DebugLog(const char *fmt, ...)
+{
+}
+
+void InfoLog(const char *fmt, ...)
+{
+}
+
+// Set by checks that expect errors, to keep them out of the output
+static bool s_muteErrors = false;
+
+bool ErrorLog(const char *fmt, ...)
+{
+  if (s_muteErrors)
+    return FAIL;
+  va_list vl;
+  va_start(vl, fmt);
+  vfprintf(stderr, fmt, vl);
+  va_end(vl);
+  fputc('\n', stderr);
+  return FAIL;
+}
+
+struct Options
+{
+  std::string mode = "recompiler";
+  std::string state;
+  std::string crom;
+  std::string image;
+  std::string trace;
+  std::string program;
+  UINT64      cycles = 100000000;
+  int         interval = 10000;
+  UINT64      count = 0;  // kernel check's default
+  UINT32      seed = 1;
+  std::string xml = "Config/Games.xml";
+};
+
+struct BusWrite
+{
+  UINT32  addr;
+  UINT64  data;
+  int     size;
+
+  bool operator==(const BusWrite &other) const
+  {
+    return addr == other.addr && data == other.data && size == other.size;
+  }
+};
+
+static bool LoadFile(const std::string &file, UINT8 *dest, size_t size)
+{
+  FILE *fp = fopen(file.c_str(), "rb");
+  if (NULL == fp)
+    return ErrorLog("Unable to open '%s'.", file.c_str());
+  size_t n = fread(dest, 1, size, fp);
+  fclose(fp);
+  if (n == 0)
+    return ErrorLog("Unable to read '%s'.", file.c_str());
+  return OKAY;
+}
+
+static void PrintWrites(const char *name, const std::vector<BusWrite> &writes, size_t first)
+{
+  printf("  %s writes from #%u:\n", name, unsigned(first));
+  for (size_t i = first; i < writes.size() && i < first + 4; i++)
+    printf("    [%08X] <- %0*llX (%d bytes)\n", writes[i].addr, writes[i].size * 2, (unsigned long long) writes[i].data, writes[i].size);
+}
+
+// Compares write streams of one interval, returns false and reports on divergence
+static bool CompareWrites(const std::vector<BusWrite> &a, const std::vector<BusWrite> &b)
+{
+  size_t n = std::min(a.size(), b.size());
+  size_t i = 0;
+  while (i < n && a[i] == b[i])
+    i++;
+  if (i == n && a.size() == b.size())
+    return true;
+  printf("Bus writes diverge at write #%u of interval (%u vs. %u writes)\n", unsigned(i), unsigned(a.size()), unsigned(b.size()));
+  PrintWrites("reference", a, i);
+  PrintWrites("fast path", b, i);
+  return false;
+}
+
+static void PrintThroughput(const char *name, UINT64 count, double seconds, const char *unit)
+{
+  printf("  %-24s %12.2f %s\n", name, seconds > 0 ? count / seconds / 1e6 : 0.0, unit);
+}
+
+
+/******************************************************************************
+ PowerPC
+******************************************************************************/
+
+class CPPCTestBus: public IBus
+{
+public:
+  std::vector<UINT8>    ram;
+  std::vector<UINT8>    crom;
+  std::vector<BusWrite> writes;
+
+  // Memory is laid out like CModel3 does it: 32-bit words in host order
+  UINT8 *Ptr(UINT32 addr)
+  {
+    if (addr < 0x800000)
+      return &ram[addr];
+    if (addr >= 0xFF800000)
+      return &crom[addr & 0x7FFFFF];
+    return NULL;
+  }
+
+  UINT8 Read8(UINT32 addr)
+  {
+    UINT8 *p = Ptr(addr);
+    return p ? Ptr(addr ^ 3)[0] : 0xFF;
+  }
+
+  UINT16 Read16(UINT32 addr)
+  {
+    UINT8 *p = Ptr(addr);
+    return p ? *(UINT16 *) Ptr(addr ^ 2) : 0xFFFF;
+  }
+
+  UINT32 Read32(UINT32 addr)
+  {
+    UINT8 *p = Ptr(addr);
+    return p ? *(UINT32 *) p : 0xFFFFFFFF;
+  }
+
+  UINT64 Read64(UINT32 addr)
+  {
+    return ((UINT64) Read32(addr) << 32) | Read32(addr + 4);
+  }
+
+  void Write(UINT32 addr, UINT64 data, int size)
+  {
+    writes.push_back({ addr, data, size });
+    if (addr < 0x800000 && ppc_get_code_page_map()[addr >> 12])
+      ppc_invalidate_code(addr);
+  }
+
+  void Write8(UINT32 addr, UINT8 data)
+  {
+    Write(addr, data, 1);
+    if (addr < 0x800000)
+      ram[addr ^ 3] = data;
+  }
+
+  void Write16(UINT32 addr, UINT16 data)
+  {
+    Write(addr, data, 2);
+    if (addr < 0x800000)
+      *(UINT16 *) &ram[addr ^ 2] = data;
+  }
+
+  void Write32(UINT32 addr, UINT32 data)
+  {
+    Write(addr, data, 4);
+    if (addr < 0x800000)
+      *(UINT32 *) &ram[addr] = data;
+  }
+
+  void Write64(UINT32 addr, UINT64 data)
+  {
+    Write(addr, data, 8);
+    if (addr < 0x800000)
+    {
+      *(UINT32 *) &ram[addr] = UINT32(data >> 32);
+      *(UINT32 *) &ram[addr + 4] = UINT32(data);
+    }
+  }
+
+  CPPCTestBus(void)
+    : ram(0x800000, 0),
+      crom(0x800000, 0)
+  {
+  }
+};
+
+struct PPCState
+{
+  UINT32  gpr[32];
+  UINT64  fpr[32];
+  UINT32  pc, lr, ctr, xer, msr, srr0, srr1, dec;
+  UINT8   cr[8];
+};
+
+static const char *s_ppcStateNames[] = { "pc", "lr", "ctr", "xer", "msr", "srr0", "srr1", "dec" };
+
+static void GetPPCState(PPCState *s)
+{
+  for (int i = 0; i < 32; i++)
+  {
+    s->gpr[i] = ppc_get_gpr(i);
+    double f = ppc_get_fpr(i);
+    memcpy(&s->fpr[i], &f, sizeof(f));
+  }
+  s->pc = ppc_get_pc();
+  s->lr = ppc_get_lr();
+  s->ctr = ppc_read_spr(SPR_CTR);
+  s->xer = ppc_read_spr(SPR_XER);
+  s->msr = ppc_read_msr();
+  s->srr0 = ppc_read_spr(SPR_SRR0);
+  s->srr1 = ppc_read_spr(SPR_SRR1);
+  s->dec = ppc_read_spr(SPR603E_DEC);
+  for (int i = 0; i < 8; i++)
+    s->cr[i] = ppc_get_cr(i);
+}
+
+static bool ComparePPCState(const PPCState &a, const PPCState &b)
+{
+  bool same = true;
+  for (int i = 0; i < 32; i++)
+  {
+    if (a.gpr[i] != b.gpr[i])
+      printf("  r%-4d %08X vs. %08X\n", i, a.gpr[i], b.gpr[i]), same = false;
+    if (a.fpr[i] != b.fpr[i])
+      printf("  f%-4d %016llX vs. %016llX\n", i, (unsigned long long) a.fpr[i], (unsigned long long) b.fpr[i]), same = false;
+  }
+  const UINT32 *sa = &a.pc, *sb = &b.pc;
+  for (int i = 0; i < 8; i++)
+  {
+    if (sa[i] != sb[i])
+      printf("  %-5s %08X vs. %08X\n", s_ppcStateNames[i], sa[i], sb[i]), same = false;
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    if (a.cr[i] != b.cr[i])
+      printf("  cr%-3d %X vs. %X\n", i, a.cr[i], b.cr[i]), same = false;
+  }
+  return same;
+}
+
+static void DisassemblePPC(const char *name, CPPCTestBus &bus, UINT32 pc)
+{
+  printf("  %s code around %08X:\n", name, pc);
+  char mnem[32], oprs[256];
+  for (UINT32 addr = pc - 8 * 4; addr != pc + 4 * 4; addr += 4)
+  {
+    UINT32 op = bus.Read32(addr);
+    if (DisassemblePowerPC(op, addr, mnem, oprs, true) != OKAY)
+      strcpy(mnem, "?"), oprs[0] = '\0';
+    printf("  %s %08X: %08X  %-8s %s\n", addr == pc ? ">" : " ", addr, op, mnem, oprs);
+  }
+}
+
+// Built-in program: decrementer exceptions, a subroutine, loads and stores.
+// The subroutine is called through a branch in CROM, which is linked to it
+// before it is overwritten.
+static void LoadPPCTestProgram(CPPCTestBus &bus)
+{
+  static const UINT32 reset[] =
+  {
+    0x38600000, 0x388003E8, 0x7C8903A6, 0x38E00032, 0x7CF603A6, 0x7D0000A6, 0x61088000, 0x7D000124,
+    0x7C632214, 0x90600100, 0x80A00100, 0x4BF00203, 0x3884FFFF, 0x4200FFEC,
+    0x3D403929, 0x614A0064, 0x91401000, 0x4BF00203, 0x48000000
+  };
+  static const UINT32 trampoline[] = { 0x48001002 };
+  static const UINT32 decrementer[] = { 0x38C60001, 0x7CF603A6, 0x4C000064 };
+  static const UINT32 subroutine[] = { 0x39290001, 0x4E800020 };
+  memcpy(&bus.crom[0x700100], reset, sizeof(reset));
+  memcpy(&bus.crom[0x700200], trampoline, sizeof(trampoline));
+  memcpy(&bus.crom[0x700900], decrementer, sizeof(decrementer));
+  memcpy(&bus.ram[0x1000], subroutine, sizeof(subroutine));
+}
+
+/*
+ * Random program: loops of random integer, load, store and branch
+ * instructions, mostly of the kinds the recompiler emits inline, with the
+ * decrementer firing in the middle of them. Only r8-r25 are written; r31 and
+ * r30 hold the base and an index into the 64 KB data area at s_ppcDataBase,
+ * r29 is the base for the update forms and r26 the loop count.
+ */
+static const UINT32 s_ppcRandomCode = 0x2000;
+static const UINT32 s_ppcDataBase = 0x100000;
+static const UINT32 s_ppcDataSize = 0x10000;
+
+static inline UINT32 PPCDForm(UINT32 opcd, UINT32 rt, UINT32 ra, UINT32 imm)
+{
+  return (opcd << 26) | (rt << 21) | (ra << 16) | (imm & 0xFFFF);
+}
+
+static inline UINT32 PPCXForm(UINT32 rt, UINT32 ra, UINT32 rb, UINT32 xo, UINT32 rc)
+{
+  return (31 << 26) | (rt << 21) | (ra << 16) | (rb << 11) | (xo << 1) | rc;
+}
+
+static UINT32 RandomPPCInsn(std::mt19937 &random, std::vector<UINT32> *code)
+{
+  auto r = [&](UINT32 n) { return UINT32(random() % n); };
+  UINT32 d = 8 + r(18), a = r(32), b = r(32), rc = r(2);
+  switch (r(12))
+  {
+  case 0:   // addi, addis, addic, addic., mulli
+  {
+    static const UINT32 opcds[] = { 14, 15, 12, 13, 7 };
+    return PPCDForm(opcds[r(5)], d, a, random());
+  }
+  case 1:   // ori, oris, xori, xoris, andi., andis.
+    return PPCDForm(24 + r(6), a, d, random());
+  case 2:   // rlwinm, rlwimi
+    return ((21 - r(2)) << 26) | (a << 21) | (d << 16) | (r(32) << 11) | (r(32) << 6) | (r(32) << 1) | rc;
+  case 3:   // cmpi, cmpli, cmp, cmpl
+    switch (r(4))
+    {
+    case 0:   return PPCDForm(11, r(8) << 2, a, random());
+    case 1:   return PPCDForm(10, r(8) << 2, a, random());
+    case 2:   return PPCXForm(r(8) << 2, a, b, 0, 0);
+    default:  return PPCXForm(r(8) << 2, a, b, 32, 0);
+    }
+  case 4:   // add, subf, mullw, neg, sometimes with OE
+  {
+    static const UINT32 xos[] = { 266, 40, 235, 104 };
+    UINT32 xo = xos[r(4)];
+    return PPCXForm(d, a, xo == 104 ? 0 : b, xo | (r(8) == 0 ? 0x200 : 0), rc);
+  }
+  case 5:   // and, or, xor, nor, andc, slw, srw, extsb, extsh, srawi
+  {
+    static const UINT32 xos[] = { 28, 444, 316, 124, 60, 24, 536, 954, 922, 824 };
+    UINT32 xo = xos[r(10)];
+    return PPCXForm(a, d, xo == 954 || xo == 922 ? 0 : b, xo, rc);
+  }
+  case 6:   // mflr, mfctr, mfcr
+    switch (r(3))
+    {
+    case 0:   return PPCXForm(d, 8, 0, 339, 0);
+    case 1:   return PPCXForm(d, 9, 0, 339, 0);
+    default:  return PPCXForm(d, 0, 0, 19, 0);
+    }
+  case 7:   // D-form loads and stores off r31, sometimes misaligned
+  {
+    static const UINT32 opcds[] = { 32, 34, 40, 36, 38, 44 };
+    UINT32 opcd = opcds[r(6)];
+    UINT32 size = opcd == 32 || opcd == 36 ? 4 : opcd == 34 || opcd == 38 ? 1 : 2;
+    UINT32 disp = r(0x8000) & ~(size - 1);
+    if (r(16) == 0)
+      disp |= 1;
+    return PPCDForm(opcd, d, 31, disp);
+  }
+  case 8:   // indexed loads and stores off r31 + r30
+  {
+    static const UINT32 xos[] = { 23, 87, 279, 151, 215, 407 };
+    return PPCXForm(d, 31, 30, xos[r(6)], 0);
+  }
+  case 9:   // update forms, after setting r29 within the data area
+  {
+    static const UINT32 opcds[] = { 33, 35, 41, 37, 39, 45 };
+    code->push_back(PPCDForm(14, 29, 31, r(0x8000) & ~3));
+    return PPCDForm(opcds[r(6)], d, 29, r(0x8000) & ~3);
+  }
+  default:  // loads with the most variety
+    return PPCDForm(32, d, 31, r(0x8000) & ~3);
+  }
+}
+
+static void LoadPPCRandomProgram(CPPCTestBus &bus, UINT32 seed)
+{
+  std::mt19937 random(seed);
+  std::vector<UINT32> code;
+  for (UINT32 n = 8; n <= 25; n++)
+  {
+    UINT32 value = random();
+    code.push_back(PPCDForm(15, n, 0, value >> 16));   // lis
+    code.push_back(PPCDForm(24, n, n, value));         // ori
+  }
+  code.push_back(PPCDForm(15, 31, 0, s_ppcDataBase >> 16));
+  code.push_back(PPCDForm(14, 30, 0, random() & 0xFFC));
+
+  // Subroutine, then the loops
+  UINT32 subroutine = s_ppcRandomCode + UINT32(code.size()) * 4 + 4;
+  code.push_back(0x48000000 | 12);                    // b over it
+  code.push_back(PPCDForm(14, 8, 8, 1));              // addi r8,r8,1
+  code.push_back(0x4E800020);                         // blr
+  size_t start = code.size();
+  for (int block = 0; block < 64; block++)
+  {
+    code.push_back(PPCDForm(14, 26, 0, 1 + random() % 8));   // li r26,n
+    code.push_back(PPCXForm(26, 9, 0, 467, 0));              // mtctr r26
+    size_t top = code.size();
+    size_t len = 4 + random() % 24;
+    std::vector<size_t> branches;
+    while (code.size() - top < len)
+    {
+      switch (random() % 16)
+      {
+      case 0:   // forward branch over up to three instructions; patched below
+      {
+        static const UINT32 bos[] = { 4, 12, 20, 5, 13 };
+        UINT32 bo = bos[random() % 5];
+        branches.push_back(code.size());
+        code.push_back(random() % 4 == 0 ? 0x48000000 : (16 << 26) | (bo << 21) | ((random() % 32) << 16));
+        break;
+      }
+      case 1:
+        code.push_back(0x48000001 | ((subroutine - (s_ppcRandomCode + UINT32(code.size()) * 4)) & 0x3FFFFFC));   // bl
+        break;
+      default:
+        code.push_back(RandomPPCInsn(random, &code));
+        break;
+      }
+    }
+    for (size_t i : branches)
+    {
+      UINT32 skip = std::min<UINT32>(1 + random() % 3, UINT32(code.size() - i));
+      code[i] |= (skip + 1) * 4;
+    }
+
+    // Loop on CTR, combined with a condition for most of the BO values
+    static const UINT32 bos[] = { 16, 0, 2, 8, 10, 18, 17 };
+    UINT32 bo = bos[random() % 7];
+    code.push_back((16 << 26) | (bo << 21) | ((random() % 32) << 16) | (UINT32(top - code.size()) * 4 & 0xFFFC));
+  }
+  code.push_back(0x48000000 | (UINT32(start - code.size()) * 4 & 0x3FFFFFC));
+  memcpy(&bus.ram[s_ppcRandomCode], code.data(), code.size() * 4);
+
+  // Reset enables the decrementer and jumps to the program
+  static const UINT32 reset[] = { 0x38E00032, 0x7CF603A6, 0x7D0000A6, 0x61088000, 0x7D000124, 0x48000002 | s_ppcRandomCode };
+  static const UINT32 decrementer[] = { 0x38C60001, 0x7CF603A6, 0x4C000064 };
+  memcpy(&bus.crom[0x700100], reset, sizeof(reset));
+  memcpy(&bus.crom[0x700900], decrementer, sizeof(decrementer));
+}
+
+// Save state layout must match CModel3::SaveState()
+static bool LoadPPCSaveState(CBlockFile *file, CPPCTestBus &bus)
+{
+  if (OKAY != file->FindBlock("Model 3"))
+    return ErrorLog("Save state has no Model 3 block.");
+  UINT8 bytes[4];
+  int adcChannel;
+  unsigned cromBankReg, securityPtr;
+  file->Read(bytes, sizeof(bytes));  // inputBank, serialFIFO1, serialFIFO2, gunReg
+  file->Read(&adcChannel, sizeof(adcChannel));
+  file->Read(&cromBankReg, sizeof(cromBankReg));
+  file->Read(&securityPtr, sizeof(securityPtr));
+  file->Read(bus.ram.data(), 0x800000);
+  return OKAY;
+}
+
+struct PPCCore
+{
+  PPC_CONTEXT       *context;
+  CPPCTestBus       bus;
+  PPC_FETCH_REGION  fetch[3];
+  double            seconds = 0;
+};
+
+static bool InitPPCCore(PPCCore *core, PPC_EXEC_MODE mode, const Options &opts)
+{
+  core->context = ppc_create_context();
+  if (NULL == core->context)
+    return ErrorLog("Out of memory.");
+  ppc_set_context(core->context);
+
+  PPC_CONFIG config;
+  config.pvr = PPC_MODEL_603R;
+  config.bus_frequency = BUS_FREQUENCY_66MHZ;
+  config.bus_frequency_multiplier = 0x25;
+  ppc_init(&config);
+  ppc_attach_bus(&core->bus);
+
+  if (!opts.crom.empty() && OKAY != LoadFile(opts.crom, core->bus.crom.data(), core->bus.crom.size()))
+    return FAIL;
+  bool random = opts.state.empty() && opts.program == "random";
+  if (random)
+    LoadPPCRandomProgram(core->bus, opts.seed);
+  else if (opts.state.empty())
+    LoadPPCTestProgram(core->bus);
+
+  // RAM is mapped for reads only so that all writes are seen by the bus,
+  // except for random programs, whose data area is compared instead
+  core->fetch[0] = { 0x00000000, 0x007FFFFF, (UINT32 *) core->bus.ram.data() };
+  core->fetch[1] = { 0xFF800000, 0xFFFFFFFF, (UINT32 *) core->bus.crom.data() };
+  core->fetch[2] = { 0, 0, NULL };
+  ppc_set_fetch(core->fetch);
+  ppc_map_memory(0x00000000, 0x007FFFFF, core->bus.ram.data(), random);
+  ppc_map_memory(0xFF800000, 0xFFFFFFFF, core->bus.crom.data(), false);
+  ppc_set_exec_mode(mode);
+  ppc_set_idle_skip(false);
+  ppc_reset();
+
+  if (!opts.state.empty())
+  {
+    CBlockFile file;
+    if (OKAY != file.Load(opts.state))
+      return ErrorLog("Unable to load save state '%s'.", opts.state.c_str());
+    if (OKAY != LoadPPCSaveState(&file, core->bus))
+      return FAIL;
+    ppc_load_state(&file);
+  }
+  return OKAY;
+}
+
+static int RunPPC(const Options &opts)
+{
+  PPC_EXEC_MODE mode = opts.mode == "cache" ? PPC_EXEC_BLOCK_CACHE : PPC_EXEC_RECOMPILER;
+  PPCCore *ref = new PPCCore, *fast = new PPCCore;
+  if (OKAY != InitPPCCore(ref, PPC_EXEC_INTERPRETER, opts) || OKAY != InitPPCCore(fast, mode, opts))
+    return 1;
+  ppc_set_context(fast->context);
+  if (ppc_get_exec_mode() != mode)
+    printf("Requested execution mode is not supported on this host; comparing interpreter against mode %d.\n", int(ppc_get_exec_mode()));
+  CExecTrace trace("fast path", 1 << 20, opts.trace == "branches");
+  if (!opts.trace.empty())
+    ppc_attach_trace(&trace);
+
+  UINT64 done = 0;
+  UINT32 lastPC = 0;
+  bool ok = true;
+  while (ok && done < opts.cycles)
+  {
+    PPCState a, b;
+    PPCCore *cores[] = { ref, fast };
+    PPCState *states[] = { &a, &b };
+    for (int i = 0; i < 2; i++)
+    {
+      ppc_set_context(cores[i]->context);
+      cores[i]->bus.writes.clear();
+      auto start = std::chrono::steady_clock::now();
+      ppc_execute(opts.interval);
+      cores[i]->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      GetPPCState(states[i]);
+    }
+    done += opts.interval;
+
+    bool sameState = ComparePPCState(a, b);
+    bool sameWrites = CompareWrites(ref->bus.writes, fast->bus.writes);
+    if (opts.program == "random" && memcmp(&ref->bus.ram[s_ppcDataBase], &fast->bus.ram[s_ppcDataBase], s_ppcDataSize) != 0)
+      printf("  Data area differs\n"), sameWrites = false;
+    if (!sameState || !sameWrites)
+    {
+      printf("Divergence within cycles %llu-%llu (interval started at PC=%08X)\n",
+        (unsigned long long) (done - opts.interval), (unsigned long long) done, lastPC);
+      DisassemblePPC("reference", ref->bus, a.pc);
+      DisassemblePPC("fast path", fast->bus, b.pc);
+      ok = false;
+    }
+    lastPC = a.pc;
+  }
+
+  printf("%s after %llu cycles\n", ok ? "No divergence" : "FAILED", (unsigned long long) done);
+  printf("Throughput (one cycle per instruction):\n");
+  PrintThroughput("interpreter", done, ref->seconds, "MIPS");
+  PrintThroughput((opts.mode + (opts.trace.empty() ? "" : " (traced)")).c_str(), done, fast->seconds, "MIPS");
+
+  ppc_set_context(NULL);
+  ppc_destroy_context(ref->context);
+  ppc_destroy_context(fast->context);
+  delete ref;
+  delete fast;
+  return ok ? 0 : 1;
+}
+
+
+/******************************************************************************
+ 68K
+******************************************************************************/
+
+class C68KTestBus: public IBus
+{
+public:
+  std::vector<UINT8>    ram;    // 1 MB, mirrored; 16-bit words in host order
+  std::vector<BusWrite> writes;
+
+  UINT8 Read8(UINT32 addr)
+  {
+    return ram[(addr & 0xFFFFF) ^ 1];
+  }
+
+  UINT16 Read16(UINT32 addr)
+  {
+    return *(UINT16 *) &ram[addr & 0xFFFFE];
+  }
+
+  UINT32 Read32(UINT32 addr)
+  {
+    return (Read16(addr) << 16) | Read16(addr + 2);
+  }
+
+  void Write8(UINT32 addr, UINT8 data)
+  {
+    writes.push_back({ addr, data, 1 });
+    ram[(addr & 0xFFFFF) ^ 1] = data;
+  }
+
+  void Write16(UINT32 addr, UINT16 data)
+  {
+    writes.push_back({ addr, data, 2 });
+    *(UINT16 *) &ram[addr & 0xFFFFE] = data;
+  }
+
+  void Write32(UINT32 addr, UINT32 data)
+  {
+    writes.push_back({ addr, data, 4 });
+    *(UINT16 *) &ram[addr & 0xFFFFE] = UINT16(data >> 16);
+    *(UINT16 *) &ram[(addr + 2) & 0xFFFFE] = UINT16(data);
+  }
+
+  C68KTestBus(void)
+    : ram(0x100000, 0)
+  {
+  }
+};
+
+struct M68KState
+{
+  UINT32  regs[18];   // D0-D7, A0-A7, SR, PC
+};
+
+static void GetM68KState(M68KState *s)
+{
+  for (int i = 0; i < 8; i++)
+  {
+    s->regs[i] = M68KGetDRegister(i);
+    s->regs[8 + i] = M68KGetARegister(i);
+  }
+  s->regs[16] = M68KGetSR();
+  s->regs[17] = M68KGetPC();
+}
+
+static bool CompareM68KState(const M68KState &a, const M68KState &b)
+{
+  static const char *names[] = { "d0", "d1", "d2", "d3", "d4", "d5", "d6", "d7", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "sr", "pc" };
+  bool same = true;
+  for (int i = 0; i < 18; i++)
+  {
+    if (a.regs[i] != b.regs[i])
+      printf("  %-4s %08X vs. %08X\n", names[i], a.regs[i], b.regs[i]), same = false;
+  }
+  return same;
+}
+
+// Must be called with the context active, since Musashi reads through the bus
+static void DisassembleM68K(const char *name, UINT32 pc)
+{
+  printf("  %s code at %06X:\n", name, pc);
+  char buf[128];
+  UINT32 addr = pc;
+  for (int i = 0; i < 8; i++)
+  {
+    unsigned len = m68k_disassemble(buf, addr, M68K_CPU_TYPE_68000);
+    printf("  %s %06X: %s\n", addr == pc ? ">" : " ", addr, buf);
+    addr += len;
+  }
+}
+
+// Built-in program: arithmetic, stores, and PC-relative and immediate operands
+static void Load68KTestProgram(C68KTestBus &bus)
+{
+  static const UINT16 program[] =
+  {
+    0x0000, 0x8000, 0x0000, 0x0100,         // reset vectors: SP=0x8000, PC=0x100
+  };
+  static const UINT16 code[] =
+  {
+    0x7000,                                 // moveq   #0,d0
+    0x223C, 0x0001, 0x2345,                 // move.l  #$12345,d1
+    0xD081,                                 // add.l   d1,d0
+    0x23C0, 0x0000, 0x2000,                 // move.l  d0,$2000
+    0x41FA, 0xFFF2,                         // lea     ($104,pc),a0
+    0xD050,                                 // add.w   (a0),d0
+    0xE388,                                 // lsl.l   #1,d0
+    0x3F00,                                 // move.w  d0,-(a7)
+    0x321F,                                 // move.w  (a7)+,d1
+    0x60EA                                  // bra     $108
+  };
+  for (size_t i = 0; i < sizeof(program) / 2; i++)
+    bus.Write16(UINT32(i * 2), program[i]);
+  for (size_t i = 0; i < sizeof(code) / 2; i++)
+    bus.Write16(UINT32(0x100 + i * 2), code[i]);
+  bus.writes.clear();
+}
+
+static bool Load68KImage(const std::string &file, C68KTestBus &bus)
+{
+  std::vector<UINT8> image(bus.ram.size());
+  if (OKAY != LoadFile(file, image.data(), image.size()))
+    return FAIL;
+  for (size_t i = 0; i < image.size(); i += 2)
+    *(UINT16 *) &bus.ram[i] = UINT16((image[i] << 8) | image[i + 1]);
+  return OKAY;
+}
+
+struct M68KCore
+{
+  M68KCtx     ctx;
+  C68KTestBus bus;
+  double      seconds = 0;
+};
+
+static bool Init68KCore(M68KCore *core, bool mapFetch, const Options &opts)
+{
+  if (opts.image.empty())
+    Load68KTestProgram(core->bus);
+  else if (OKAY != Load68KImage(opts.image, core->bus))
+    return FAIL;
+  M68KSetContext(&core->ctx);
+  M68KInit();
+  M68KAttachBus(&core->bus);
+  if (mapFetch)
+  {
+    for (UINT32 base = 0; base < 0x1000000; base += 0x100000)
+      M68KMapFetch(base, base + 0xFFFFF, core->bus.ram.data());
+  }
+  M68KReset();
+  M68KGetContext(&core->ctx);
+  return OKAY;
+}
+
+static int Run68K(const Options &opts)
+{
+  M68KCore *ref = new M68KCore, *fast = new M68KCore;
+  if (OKAY != Init68KCore(ref, false, opts) || OKAY != Init68KCore(fast, true, opts))
+    return 1;
+  CExecTrace trace("fast path", 1 << 20, opts.trace == "branches");
+  if (!opts.trace.empty())
+    M68KSetExecTrace(&fast->ctx, &trace);
+
+  UINT64 done = 0;
+  UINT32 lastPC = 0;
+  bool ok = true;
+  while (ok && done < opts.cycles)
+  {
+    M68KState a, b;
+    M68KCore *cores[] = { ref, fast };
+    M68KState *states[] = { &a, &b };
+    for (int i = 0; i < 2; i++)
+    {
+      M68KSetContext(&cores[i]->ctx);
+      cores[i]->bus.writes.clear();
+      auto start = std::chrono::steady_clock::now();
+      M68KRun(opts.interval);
+      cores[i]->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      GetM68KState(states[i]);
+      M68KGetContext(&cores[i]->ctx);
+    }
+    done += opts.interval;
+
+    bool sameState = CompareM68KState(a, b);
+    bool sameWrites = CompareWrites(ref->bus.writes, fast->bus.writes);
+    if (!sameState || !sameWrites)
+    {
+      printf("Divergence within cycles %llu-%llu (interval started at PC=%06X)\n",
+        (unsigned long long) (done - opts.interval), (unsigned long long) done, lastPC);
+      M68KSetContext(&ref->ctx);
+      DisassembleM68K("reference", a.regs[17]);
+      M68KSetContext(&fast->ctx);
+      DisassembleM68K("fast path", b.regs[17]);
+      ok = false;
+    }
+    lastPC = a.regs[17];
+  }
+
+  printf("%s after %llu cycles\n", ok ? "No divergence" : "FAILED", (unsigned long long) done);
+  printf("Throughput:\n");
+  PrintThroughput("bus fetch", done, ref->seconds, "Mcycles/s");
+  PrintThroughput(opts.trace.empty() ? "mapped fetch" : "mapped fetch (traced)", done, fast->seconds, "Mcycles/s");
+
+  delete ref;
+  delete fast;
+  return ok ? 0 : 1;
+}
+
+
+/******************************************************************************
+ Kernels
+******************************************************************************/
+
+class CKernelCheck
+{
+public:
+  std::mt19937  random;
+  UINT64        count;  // cases to run
+
+  UINT32 Bits(void)
+  {
+    return UINT32(random());
+  }
+
+  // Mostly small integers, so that sums cancel out exactly and signed zeros
+  // come up, with some wide-ranging values
+  float Float(void)
+  {
+    switch (Bits() % 8)
+    {
+    case 0:   return 0.0f;
+    case 1:   return -0.0f;
+    case 2:
+    case 3:   return std::uniform_real_distribution<float>(-1e4f, 1e4f)(random);
+    case 4:   return std::uniform_real_distribution<float>(-1.0f, 1.0f)(random);
+    default:  return float(int(Bits() % 9) - 4);
+    }
+  }
+
+  // Records a case, returns false and reports the first one that failed
+  bool Case(bool same, const char *fmt, ...)
+  {
+    m_cases++;
+    if (same)
+      return true;
+    if (m_failures++ == 0)
+    {
+      printf("  %s: case %llu differs: ", m_name.c_str(), (unsigned long long) (m_cases - 1));
+      va_list vl;
+      va_start(vl, fmt);
+      vprintf(fmt, vl);
+      va_end(vl);
+      printf("\n");
+    }
+    return false;
+  }
+
+  void Begin(const std::string &name)
+  {
+    m_name = name;
+    m_cases = 0;
+    m_failures = 0;
+  }
+
+  // Prints the result of the check begun last
+  void End(void)
+  {
+    printf("  %-32s %s (%llu cases", m_name.c_str(), m_failures ? "FAILED" : "passed", (unsigned long long) m_cases);
+    if (m_failures)
+      printf(", %llu failed", (unsigned long long) m_failures);
+    printf(")\n");
+    m_total += m_failures;
+  }
+
+  int Result(void) const
+  {
+    printf("%s\n", m_total ? "FAILED" : "All checks passed");
+    return m_total ? 1 : 0;
+  }
+
+  CKernelCheck(const Options &opts, UINT64 defaultCount)
+    : random(opts.seed),
+      count(opts.count ? opts.count : defaultCount)
+  {
+  }
+
+private:
+  std::string m_name;
+  UINT64      m_cases = 0;
+  UINT64      m_failures = 0;
+  UINT64      m_total = 0;
+};
+
+static bool SameFloats(const float *a, const float *b, size_t n)
+{
+  return 0 == memcmp(a, b, n * sizeof(float));
+}
+
+static void FormatFloats(char *buf, const float *f, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    buf += sprintf(buf, "%s%.9g", i ? " " : "", f[i]);
+}
+
+
+/******************************************************************************
+ New3D
+******************************************************************************/
+
+// Reference code: Mat4::MultiMatrices() and CNew3D::MultVec(), TransformBox()
+// and ClipBox() as they were before SIMD.h
+
+static void RefMultMatrices(const float a[16], const float b[16], float r[16])
+{
+#define A(row,col)  a[(col<<2)+row]
+#define B(row,col)  b[(col<<2)+row]
+#define P(row,col)  r[(col<<2)+row]
+
+  for (int i = 0; i < 4; i++)
+  {
+    const float ai0 = A(i, 0), ai1 = A(i, 1), ai2 = A(i, 2), ai3 = A(i, 3);
+    P(i, 0) = ai0 * B(0, 0) + ai1 * B(1, 0) + ai2 * B(2, 0) + ai3 * B(3, 0);
+    P(i, 1) = ai0 * B(0, 1) + ai1 * B(1, 1) + ai2 * B(2, 1) + ai3 * B(3, 1);
+    P(i, 2) = ai0 * B(0, 2) + ai1 * B(1, 2) + ai2 * B(2, 2) + ai3 * B(3, 2);
+    P(i, 3) = ai0 * B(0, 3) + ai1 * B(1, 3) + ai2 * B(2, 3) + ai3 * B(3, 3);
+  }
+
+#undef A
+#undef B
+#undef P
+}
+
+static void RefMultVec(const float matrix[16], const float in[4], float out[4])
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out[i] =
+      in[0] * matrix[0 * 4 + i] +
+      in[1] * matrix[1 * 4 + i] +
+      in[2] * matrix[2 * 4 + i] +
+      in[3] * matrix[3 * 4 + i];
+  }
+}
+
+static unsigned RefPlaneMask(Plane &plane, const float (*points)[4])
+{
+  unsigned mask = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    if (plane.DistanceToPoint(points[i]) >= 0.f)
+      mask |= 1u << i;
+  }
+  return mask;
+}
+
+static int RunNew3D(const Options &opts)
+{
+  CKernelCheck check(opts, 100000);
+  char refText[512] = "", fastText[512] = "";
+
+  check.Begin("MultMatrices");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    float a[16], b[16], ref[16], fast[16];
+    for (int j = 0; j < 16; j++)
+    {
+      a[j] = check.Float();
+      b[j] = check.Float();
+    }
+    RefMultMatrices(a, b, ref);
+    New3D::SIMD::MultMatrices(a, b, fast);
+    bool same = SameFloats(ref, fast, 16);
+    if (!same)
+    {
+      FormatFloats(refText, ref, 16);
+      FormatFloats(fastText, fast, 16);
+    }
+    check.Case(same, "%s vs. %s", refText, fastText);
+  }
+  check.End();
+
+  // The result may be either operand
+  check.Begin("MultMatrices in place");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    float a[16], b[16], ref[16], left[16], right[16];
+    for (int j = 0; j < 16; j++)
+    {
+      a[j] = check.Float();
+      b[j] = check.Float();
+    }
+    RefMultMatrices(a, b, ref);
+    memcpy(left, a, sizeof(left));
+    memcpy(right, b, sizeof(right));
+    New3D::SIMD::MultMatrices(left, b, left);
+    New3D::SIMD::MultMatrices(a, right, right);
+    check.Case(SameFloats(ref, left, 16) && SameFloats(ref, right, 16), "%s operand overwritten early", SameFloats(ref, left, 16) ? "right" : "left");
+  }
+  check.End();
+
+  check.Begin("MultVec");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    float m[16], in[4], ref[4], fast[4];
+    for (int j = 0; j < 16; j++)
+      m[j] = check.Float();
+    for (int j = 0; j < 4; j++)
+      in[j] = check.Float();
+    RefMultVec(m, in, ref);
+    New3D::SIMD::MultVec(m, in, fast);
+    bool same = SameFloats(ref, fast, 4);
+    if (!same)
+    {
+      FormatFloats(refText, ref, 4);
+      FormatFloats(fastText, fast, 4);
+    }
+    check.Case(same, "%s vs. %s", refText, fastText);
+  }
+  check.End();
+
+  // TransformBox() followed by ClipBox()'s per-plane tests
+  check.Begin("TransformPoints and PlaneMasks");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    float m[16], ref[8][4], fast[8][4];
+    Plane planes[5];
+    for (int j = 0; j < 16; j++)
+      m[j] = check.Float();
+    for (int j = 0; j < 8; j++)
+    {
+      for (int k = 0; k < 3; k++)
+        ref[j][k] = check.Float();
+      ref[j][3] = 1.0f;
+    }
+    for (int j = 0; j < 5; j++)
+      planes[j] = { check.Float(), check.Float(), check.Float(), check.Float() };
+    memcpy(fast, ref, sizeof(fast));
+    for (int j = 0; j < 8; j++)
+    {
+      float v[4];
+      RefMultVec(m, ref[j], v);
+      ref[j][0] = v[0];
+      ref[j][1] = v[1];
+      ref[j][2] = v[2];
+    }
+    New3D::SIMD::TransformPoints(m, fast, 8);
+    if (!SameFloats(&ref[0][0], &fast[0][0], 8 * 4))
+    {
+      check.Case(false, "transformed points differ");
+      continue;
+    }
+    unsigned masks[5];
+    New3D::SIMD::PlaneMasks(planes, 5, fast, masks);
+    int j = 0;
+    while (j < 5 && masks[j] == RefPlaneMask(planes[j], ref))
+      j++;
+    check.Case(j == 5, "plane %d mask %02X vs. %02X", j, j < 5 ? RefPlaneMask(planes[j], ref) : 0, j < 5 ? masks[j] : 0);
+  }
+  check.End();
+
+  return check.Result();
+}
+
+
+/******************************************************************************
+ Render2D
+******************************************************************************/
+
+#if defined(RENDER2D_SIMD_SSE2) || defined(RENDER2D_SIMD_NEON)
+
+// Draws random tile lines over a line of random contents both ways
+template <int bits, bool alphaTest>
+static void CheckTileLine(CKernelCheck &check, const std::vector<uint32_t> &vram, const std::vector<uint32_t> &palette)
+{
+  check.Begin(std::to_string(bits) + "-bit tiles" + (alphaTest ? ", alpha test" : ""));
+  uint32_t ref[496], fast[496];
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    for (int x = 0; x < 496; x++)
+      ref[x] = check.Bits();
+    memcpy(fast, ref, sizeof(fast));
+    int pixelOffset = check.Bits() % (496 - 8 + 1);
+    uint16_t tile = uint16_t(check.Bits());
+    int patternLine = check.Bits() % 8;
+    uint16_t mask = uint16_t(check.Bits());
+    DrawTileLine<bits, alphaTest, false>(ref, pixelOffset, tile, patternLine, vram.data(), palette.data(), mask);
+    DrawTileLineSIMD<bits, alphaTest>(fast, pixelOffset, tile, patternLine, vram.data(), palette.data(), mask);
+    int x = 0;
+    while (x < 496 && ref[x] == fast[x])
+      x++;
+    check.Case(x == 496, "tile %04X line %d at %d, mask %04X: pixel %d is %08X vs. %08X", tile, patternLine, pixelOffset, mask, x,
+      x < 496 ? ref[x] : 0, x < 496 ? fast[x] : 0);
+  }
+  check.End();
+}
+
+static int RunRender2D(const Options &opts)
+{
+  CKernelCheck check(opts, 100000);
+
+  // VRAM covers every pattern a tile can address. A quarter of the palette
+  // entries are transparent.
+  std::vector<uint32_t> vram(0x100000 / 4), palette(0x8000);
+  for (auto &word: vram)
+    word = check.Bits();
+  for (auto &color: palette)
+  {
+    color = check.Bits();
+    if (color >> 30 == 0)
+      color &= 0x00FFFFFF;
+  }
+
+  CheckTileLine<4, false>(check, vram, palette);
+  CheckTileLine<4, true>(check, vram, palette);
+  CheckTileLine<8, false>(check, vram, palette);
+  CheckTileLine<8, true>(check, vram, palette);
+  return check.Result();
+}
+
+#else
+
+static int RunRender2D(const Options &opts)
+{
+  puts("No SIMD tile line drawing on this target");
+  return 0;
+}
+
+#endif
+
+
+/******************************************************************************
+ SCSP DSP
+******************************************************************************/
+
+// Reference code: SCSPDSP_Step() before programs were pre-decoded
+
+static UINT16 RefPACK(INT32 val)
+{
+  int sign = (val >> 23) & 0x1;
+  UINT32 temp = (val ^ (val << 1)) & 0xFFFFFF;
+  int exponent = 0;
+  for (int k = 0; k < 12; k++)
+  {
+    if (temp & 0x800000)
+      break;
+    temp <<= 1;
+    exponent += 1;
+  }
+  if (exponent < 12)
+    val = (val << exponent) & 0x3FFFFF;
+  else
+    val <<= 11;
+  val >>= 11;
+  val &= 0x7FF;
+  val |= sign << 15;
+  val |= exponent << 11;
+  return (UINT16)val;
+}
+
+static INT32 RefUNPACK(UINT16 val)
+{
+  int sign = (val >> 15) & 0x1;
+  int exponent = (val >> 11) & 0xF;
+  int mantissa = val & 0x7FF;
+  INT32 uval = mantissa << 11;
+  if (exponent > 11)
+  {
+    exponent = 11;
+    uval |= sign << 22;
+  }
+  else
+    uval |= (sign ^ 1) << 22;
+  uval |= sign << 23;
+  uval <<= 8;
+  uval >>= 8;
+  uval >>= exponent;
+  return uval;
+}
+
+static void RefSCSPDSPStep(_SCSPDSP *DSP)
+{
+  INT32 ACC = 0;        // 26 bit
+  INT32 SHIFTED = 0;    // 24 bit
+  INT32 X = 0;          // 24 bit
+  INT32 Y = 0;          // 13 bit
+  INT32 B = 0;          // 26 bit
+  INT32 INPUTS = 0;     // 24 bit
+  INT32 MEMVAL = 0;
+  INT32 FRC_REG = 0;    // 13 bit
+  INT32 Y_REG = 0;      // 24 bit
+  UINT32 ADDR = 0;
+  UINT32 ADRS_REG = 0;  // 13 bit
+
+  if (DSP->Stopped)
+    return;
+
+  memset(DSP->EFREG, 0, 2 * 16);
+  for (int step = 0; step < DSP->LastStep; ++step)
+  {
+    UINT16 *IPtr = DSP->MPRO + step * 4;
+
+    UINT32 TRA = (IPtr[0] >> 8) & 0x7F;
+    UINT32 TWT = (IPtr[0] >> 7) & 0x01;
+    UINT32 TWA = (IPtr[0] >> 0) & 0x7F;
+
+    UINT32 XSEL = (IPtr[1] >> 15) & 0x01;
+    UINT32 YSEL = (IPtr[1] >> 13) & 0x03;
+    UINT32 IRA = (IPtr[1] >> 6) & 0x3F;
+    UINT32 IWT = (IPtr[1] >> 5) & 0x01;
+    UINT32 IWA = (IPtr[1] >> 0) & 0x1F;
+
+    UINT32 TABLE = (IPtr[2] >> 15) & 0x01;
+    UINT32 MWT = (IPtr[2] >> 14) & 0x01;
+    UINT32 MRD = (IPtr[2] >> 13) & 0x01;
+    UINT32 EWT = (IPtr[2] >> 12) & 0x01;
+    UINT32 EWA = (IPtr[2] >> 8) & 0x0F;
+    UINT32 ADRL = (IPtr[2] >> 7) & 0x01;
+    UINT32 FRCL = (IPtr[2] >> 6) & 0x01;
+    UINT32 SHIFT = (IPtr[2] >> 4) & 0x03;
+    UINT32 YRL = (IPtr[2] >> 3) & 0x01;
+    UINT32 NEGB = (IPtr[2] >> 2) & 0x01;
+    UINT32 ZERO = (IPtr[2] >> 1) & 0x01;
+    UINT32 BSEL = (IPtr[2] >> 0) & 0x01;
+
+    UINT32 NOFL = (IPtr[3] >> 15) & 0x01;
+    UINT32 COEF = (IPtr[3] >> 9) & 0x3f;
+
+    UINT32 MASA = (IPtr[3] >> 2) & 0x1f;
+    UINT32 ADREB = (IPtr[3] >> 1) & 0x01;
+    UINT32 NXADR = (IPtr[3] >> 0) & 0x01;
+
+    INT64 v;
+
+    if (IRA <= 0x1f)
+      INPUTS = DSP->MEMS[IRA];
+    else if (IRA <= 0x2F)
+      INPUTS = DSP->MIXS[IRA - 0x20] << 4;
+    else if (IRA <= 0x31)
+      INPUTS = DSP->EXTS[IRA - 0x30] << 8;
+    else
+      return;
+
+    INPUTS <<= 8;
+    INPUTS >>= 8;
+
+    if (IWT)
+    {
+      DSP->MEMS[IWA] = MEMVAL;
+      if (IRA == IWA)
+        INPUTS = MEMVAL;
+    }
+
+    if (!ZERO)
+    {
+      if (BSEL)
+        B = ACC;
+      else
+      {
+        B = DSP->TEMP[(TRA + DSP->DEC) & 0x7F];
+        B <<= 8;
+        B >>= 8;
+      }
+      if (NEGB)
+        B = 0 - B;
+    }
+    else
+      B = 0;
+
+    if (XSEL)
+      X = INPUTS;
+    else
+    {
+      X = DSP->TEMP[(TRA + DSP->DEC) & 0x7F];
+      X <<= 8;
+      X >>= 8;
+    }
+
+    if (YSEL == 0)
+      Y = FRC_REG;
+    else if (YSEL == 1)
+      Y = DSP->COEF[COEF] >> 3;
+    else if (YSEL == 2)
+      Y = (Y_REG >> 11) & 0x1FFF;
+    else if (YSEL == 3)
+      Y = (Y_REG >> 4) & 0x0FFF;
+
+    if (YRL)
+      Y_REG = INPUTS;
+
+    if (SHIFT == 0)
+    {
+      SHIFTED = ACC;
+      if (SHIFTED > 0x007FFFFF)
+        SHIFTED = 0x007FFFFF;
+      if (SHIFTED < (-0x00800000))
+        SHIFTED = -0x00800000;
+    }
+    else if (SHIFT == 1)
+    {
+      SHIFTED = ACC * 2;
+      if (SHIFTED > 0x007FFFFF)
+        SHIFTED = 0x007FFFFF;
+      if (SHIFTED < (-0x00800000))
+        SHIFTED = -0x00800000;
+    }
+    else if (SHIFT == 2)
+    {
+      SHIFTED = ACC * 2;
+      SHIFTED <<= 8;
+      SHIFTED >>= 8;
+    }
+    else if (SHIFT == 3)
+    {
+      SHIFTED = ACC;
+      SHIFTED <<= 8;
+      SHIFTED >>= 8;
+    }
+
+    Y <<= 19;
+    Y >>= 19;
+
+    v = (((INT64)X*(INT64)Y) >> 12);
+    ACC = (int)v + B;
+
+    if (TWT)
+      DSP->TEMP[(TWA + DSP->DEC) & 0x7F] = SHIFTED;
+
+    if (FRCL)
+    {
+      if (SHIFT == 3)
+        FRC_REG = SHIFTED & 0x0FFF;
+      else
+        FRC_REG = (SHIFTED >> 11) & 0x1FFF;
+    }
+
+    if (MRD || MWT)
+    {
+      ADDR = DSP->MADRS[MASA];
+      if (!TABLE)
+        ADDR += DSP->DEC;
+      if (ADREB)
+        ADDR += ADRS_REG & 0x0FFF;
+      if (NXADR)
+        ADDR++;
+      if (!TABLE)
+        ADDR &= DSP->RBL - 1;
+      else
+        ADDR &= 0xFFFF;
+      ADDR += DSP->RBP << 12;
+      if (ADDR > 0x7ffff) ADDR = 0;
+      if (MRD && (step & 1))
+      {
+        if (NOFL)
+          MEMVAL = DSP->SCSPRAM[ADDR] << 8;
+        else
+          MEMVAL = RefUNPACK(DSP->SCSPRAM[ADDR]);
+      }
+      if (MWT && (step & 1))
+      {
+        if (NOFL)
+          DSP->SCSPRAM[ADDR] = SHIFTED >> 8;
+        else
+          DSP->SCSPRAM[ADDR] = RefPACK(SHIFTED);
+      }
+    }
+
+    if (ADRL)
+    {
+      if (SHIFT == 3)
+        ADRS_REG = (SHIFTED >> 12) & 0xFFF;
+      else
+        ADRS_REG = (INPUTS >> 16);
+    }
+
+    if (EWT)
+      DSP->EFREG[EWA] += SHIFTED >> 8;
+  }
+  --DSP->DEC;
+  memset(DSP->MIXS, 0, 4 * 16);
+}
+
+// Loads a random program of random length into both DSPs, as SCSP.cpp
+// does: registers are written, then the DSP is started. Inputs are mostly
+// valid, so that programs rarely stop early.
+static void LoadRandomDSPProgram(CKernelCheck &check, _SCSPDSP *ref, _SCSPDSP *fast)
+{
+  int length = 1 + check.Bits() % 128;
+  memset(ref->MPRO, 0, sizeof(ref->MPRO));
+  for (int i = 0; i < length * 4; i++)
+    ref->MPRO[i] = UINT16(check.Bits());
+  for (int i = 0; i < length; i++)
+  {
+    UINT32 ira = (check.Bits() % 1024) ? check.Bits() % 0x32 : 0x32 + check.Bits() % 14;
+    ref->MPRO[i * 4 + 1] = UINT16((ref->MPRO[i * 4 + 1] & ~(0x3F << 6)) | (ira << 6));
+  }
+  for (auto &coef: ref->COEF)
+    coef = INT16(check.Bits());
+  for (auto &madrs: ref->MADRS)
+    madrs = UINT16(check.Bits());
+  ref->RBL = (8 * 1024) << (check.Bits() % 4);
+  ref->RBP = check.Bits() % 128;
+  memcpy(fast->MPRO, ref->MPRO, sizeof(fast->MPRO));
+  memcpy(fast->COEF, ref->COEF, sizeof(fast->COEF));
+  memcpy(fast->MADRS, ref->MADRS, sizeof(fast->MADRS));
+  fast->RBL = ref->RBL;
+  fast->RBP = ref->RBP;
+  fast->Decoded = false;
+  SCSPDSP_Start(ref);
+  SCSPDSP_Start(fast);
+}
+
+static int RunSCSPDSP(const Options &opts)
+{
+  CKernelCheck check(opts, 100000);
+  _SCSPDSP *ref = new _SCSPDSP, *fast = new _SCSPDSP;
+  std::vector<UINT16> refRAM(0x80000), fastRAM(0x80000);
+  SCSPDSP_Init(ref);
+  SCSPDSP_Init(fast);
+  ref->SCSPRAM = refRAM.data();
+  fast->SCSPRAM = fastRAM.data();
+  ref->SCSPRAM_LENGTH = fast->SCSPRAM_LENGTH = UINT32(refRAM.size());
+  for (auto &word: refRAM)
+    word = UINT16(check.Bits());
+  fastRAM = refRAM;
+  for (int i = 0; i < 128; i++)
+    ref->TEMP[i] = fast->TEMP[i] = INT32(check.Bits()) >> 8;
+  for (int i = 0; i < 32; i++)
+    ref->MEMS[i] = fast->MEMS[i] = INT32(check.Bits()) >> 8;
+
+  // A new program every 256 samples, with the state carried over
+  check.Begin("SCSPDSP_Step");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    if ((i & 255) == 0)
+    {
+      if (i != 0 && !check.Case(refRAM == fastRAM, "sound RAM differs after program %llu", (unsigned long long) (i / 256 - 1)))
+        break;
+      LoadRandomDSPProgram(check, ref, fast);
+    }
+    for (int j = 0; j < 16; j++)
+    {
+      INT32 sample = INT32(check.Bits()) >> 12;
+      SCSPDSP_SetSample(ref, sample, j, 0);
+      SCSPDSP_SetSample(fast, sample, j, 0);
+    }
+    for (int j = 0; j < 2; j++)
+      ref->EXTS[j] = fast->EXTS[j] = INT16(check.Bits());
+    RefSCSPDSPStep(ref);
+    SCSPDSP_Step(fast);
+    const char *what = NULL;
+    if (memcmp(ref->EFREG, fast->EFREG, sizeof(ref->EFREG)))
+      what = "EFREG";
+    else if (memcmp(ref->TEMP, fast->TEMP, sizeof(ref->TEMP)))
+      what = "TEMP";
+    else if (memcmp(ref->MEMS, fast->MEMS, sizeof(ref->MEMS)))
+      what = "MEMS";
+    else if (memcmp(ref->MIXS, fast->MIXS, sizeof(ref->MIXS)))
+      what = "MIXS";
+    else if (ref->DEC != fast->DEC)
+      what = "DEC";
+    if (!check.Case(what == NULL, "%s differs at sample %llu of a %d-step program", what, (unsigned long long) (i & 255), ref->LastStep))
+      break;
+  }
+  check.Case(refRAM == fastRAM, "sound RAM differs at the end");
+  check.End();
+
+  delete ref;
+  delete fast;
+  return check.Result();
+}
+
+
+/******************************************************************************
+ SCSP
+******************************************************************************/
+
+// Stands in for the sound 68K: between batches, writes random registers of
+// random slots and now and then the master volume. FM is mostly left off, so
+// that most batches can be rendered as blocks. Each SCSP context under test
+// has its own copy, so all of them see the same writes at the same samples.
+struct SCSPTestDriver
+{
+  std::mt19937  random;
+  int           numSCSPs = 1;
+
+  static int Run68K(void *data, int cycles)
+  {
+    SCSPTestDriver *driver = (SCSPTestDriver *) data;
+    for (unsigned n = driver->random() % 4; n > 0; n--)
+    {
+      bool slave = driver->numSCSPs == 2 && (driver->random() & 1);
+      UINT32 addr = 0x400;
+      UINT16 value;
+      if (driver->random() % 64 == 0)
+        value = UINT16(driver->random() & 0x30F);  // MEM4MB, DAC18B, MVOL
+      else
+      {
+        UINT32 slot = driver->random() % 32;
+        UINT32 reg = driver->random() % 12;
+        addr = slot * 0x20 + reg * 2;
+        value = UINT16(driver->random());
+        if (reg == 0x0E / 2 && driver->random() % 32)
+          value = 0;  // MDL, MDXSL, MDYSL
+        if (reg == 0x12 / 2)
+          value &= ~0x100;  // PLFOS is decoded from bits 6-8, and past 7 is beyond the scale tables
+      }
+      if (slave)
+        SCSP_Slave_w16(addr, value);
+      else
+        SCSP_Master_w16(addr, value);
+    }
+    return 0;
+  }
+
+  static void Int68K(void *data, int irqLevel)
+  {
+  }
+};
+
+// One sound board's SCSPs, with their own sound RAM and output buffers
+class CSCSPTestBoard
+{
+public:
+  static const int    length = 44100 / 60;  // samples per frame
+  SCSPTestDriver      driver;
+  std::vector<UINT8>  ram[2];
+  std::vector<float>  out[4];
+
+  bool Init(const Util::Config::Node &config, int numSCSPs, const std::vector<UINT8> &initialRAM, UINT32 seed)
+  {
+    driver.random.seed(seed);
+    driver.numSCSPs = numSCSPs;
+    for (auto &r: ram)
+      r = initialRAM;
+    for (auto &o: out)
+      o.assign(length, 0.0f);
+    m_context = SCSP_CreateContext();
+    if (NULL == m_context)
+      return ErrorLog("Out of memory.");
+    SCSP_SetContext(m_context);
+    SCSP_SetBuffers(out[0].data(), out[1].data(), out[2].data(), out[3].data(), length);
+    SCSP_SetCB(SCSPTestDriver::Run68K, SCSPTestDriver::Int68K, &driver);
+    if (OKAY != SCSP_Init(config, numSCSPs))
+      return FAIL;
+    SCSP_SetRAM(0, ram[0].data());
+    SCSP_SetRAM(1, ram[1].data());
+    return OKAY;
+  }
+
+  void RunFrame(void)
+  {
+    SCSP_SetContext(m_context);
+    SCSP_Update();
+  }
+
+  // Saves the state and loads it back, which rebuilds what the SCSPs keep
+  // decoded from their registers and the set of active slots
+  void ReloadState(void)
+  {
+    SCSP_SetContext(m_context);
+    CBlockFile file;
+    file.Create(&m_state, "Test Header", "Test_Lockstep");
+    SCSP_SaveState(&file);
+    file.Close();
+    file.Load(&m_state);
+    SCSP_LoadState(&file);
+    file.Close();
+  }
+
+  ~CSCSPTestBoard(void)
+  {
+    if (m_context != NULL)
+    {
+      SCSP_SetContext(m_context);
+      SCSP_Deinit();
+      SCSP_DestroyContext(m_context);
+    }
+  }
+
+private:
+  SCSP_CONTEXT          *m_context = NULL;
+  std::vector<uint8_t>  m_state;
+};
+
+/*
+ * Runs a board with the per-sample mixer against one with block rendering
+ * enabled, or with its state reloaded every few frames, on the same register
+ * writes, and compares their output frame by frame.
+ */
+static void CheckSCSP(CKernelCheck &check, const std::string &name, int numSCSPs, bool blockRendering, bool parallel, bool reloadState)
+{
+  Util::Config::Node config("Global");
+  config.Set("Balance", 0.0f);
+  config.Set("MultiThreaded", false);
+  config.Set("LegacySoundDSP", false);
+  config.Set("StrictSCSPTiming", false);
+  config.Set("BlockSCSPRendering", false);
+  config.Set("ParallelSound", false);
+  Util::Config::Node testConfig(config);
+  testConfig.Set("BlockSCSPRendering", blockRendering);
+  testConfig.Set("ParallelSound", parallel);
+
+  // Sound RAM of random samples, with room past the highest start address
+  // for the largest offset a slot can read at
+  std::vector<UINT8> initialRAM(0x200000);
+  for (auto &byte: initialRAM)
+    byte = UINT8(check.Bits());
+  UINT32 seed = check.Bits();
+
+  check.Begin(name);
+  CSCSPTestBoard ref, test;
+  if (OKAY != ref.Init(config, numSCSPs, initialRAM, seed) || OKAY != test.Init(testConfig, numSCSPs, initialRAM, seed))
+  {
+    check.Case(false, "unable to initialize SCSP");
+    check.End();
+    return;
+  }
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    if (reloadState && i % 8 == 7)
+      test.ReloadState();
+    ref.RunFrame();
+    test.RunFrame();
+    int channel = 0;
+    while (channel < 4 && SameFloats(ref.out[channel].data(), test.out[channel].data(), CSCSPTestBoard::length))
+      channel++;
+    int s = 0;
+    if (channel < 4)
+    {
+      while (ref.out[channel][s] == test.out[channel][s])
+        s++;
+    }
+    static const char *channelNames[] = { "front left", "front right", "rear left", "rear right" };
+    if (!check.Case(channel == 4, "frame %llu, %s sample %d: %.9g vs. %.9g", (unsigned long long) i, channelNames[channel & 3], s, ref.out[channel & 3][s], test.out[channel & 3][s]))
+      break;
+  }
+  check.End();
+}
+
+static int RunSCSP(const Options &opts)
+{
+  CKernelCheck check(opts, 1000);
+  CheckSCSP(check, "Active slots, 1 SCSP", 1, false, false, true);
+  CheckSCSP(check, "Active slots, 2 SCSPs", 2, false, false, true);
+  CheckSCSP(check, "Block rendering, 1 SCSP", 1, true, false, false);
+  CheckSCSP(check, "Block rendering, 2 SCSPs", 2, true, false, false);
+  CheckSCSP(check, "Parallel block rendering", 2, true, true, false);
+  return check.Result();
+}
+
+
+/******************************************************************************
+ MPEG Audio
+******************************************************************************/
+
+static const int s_mpegFrameBytes = 576;  // 128 kbps at 32 kHz, no padding
+static const int s_mpegHeaderBytes = 4;   // HDR_SIZE in minimp3
+
+// Reference: MpegDec as it was before frames were decoded ahead, decoding
+// each frame when it is needed
+class CRefMpegDecoder
+{
+public:
+  void SetMemory(const uint8_t *data, int length, bool loop)
+  {
+    mp3dec_init(&m_mp3d);
+    m_buffer = data;
+    m_size = length;
+    m_pos = 0;
+    m_numSamples = 0;
+    m_pcmPos = 0;
+    m_loop = loop;
+    m_stopped = false;
+  }
+
+  void UpdateMemory(const uint8_t *data, int length, bool loop)
+  {
+    int diff;
+    if (data > m_buffer)
+      diff = (int) (data - m_buffer);
+    else
+      diff = -(int) (m_buffer - data);
+    m_buffer = data;
+    m_size = length;
+    m_pos = m_pos - diff;
+    m_loop = loop;
+  }
+
+  int GetPosition(void) const
+  {
+    return m_pos;
+  }
+
+  void SetPosition(int pos)
+  {
+    m_pos = pos;
+  }
+
+  void Stop(void)
+  {
+    m_stopped = true;
+  }
+
+  bool IsLoaded(void) const
+  {
+    return m_buffer != nullptr;
+  }
+
+  void DecodeAudio(int16_t *left, int16_t *right, int numStereoSamples)
+  {
+    if (m_stopped || !m_buffer)
+      EndWithSilence(left, right, numStereoSamples);
+    FlushBuffer(left, right, numStereoSamples);
+    while (numStereoSamples)
+    {
+      m_numSamples = mp3dec_decode_frame(&m_mp3d, m_buffer + m_pos, m_size - m_pos, m_pcm, &m_info);
+      m_pos += m_info.frame_bytes;
+      m_pcmPos = 0;
+      FlushBuffer(left, right, numStereoSamples);
+      if (m_pos >= m_size - s_mpegHeaderBytes)
+      {
+        if (m_loop)
+          m_pos = 0;
+        else
+          EndWithSilence(left, right, numStereoSamples);
+      }
+    }
+  }
+
+private:
+  void FlushBuffer(int16_t *&left, int16_t *&right, int &numStereoSamples)
+  {
+    int numChans = m_info.channels;
+    for (; m_pcmPos < m_numSamples * numChans && numStereoSamples; m_pcmPos += numChans)
+    {
+      *left++ = m_pcm[m_pcmPos];
+      *right++ = m_pcm[m_pcmPos + numChans - 1];
+      numStereoSamples--;
+    }
+  }
+
+  static void EndWithSilence(int16_t *&left, int16_t *&right, int &numStereoSamples)
+  {
+    for (; numStereoSamples; numStereoSamples--)
+      *left++ = 0, *right++ = 0;
+  }
+
+  mp3dec_t            m_mp3d = {};
+  mp3dec_frame_info_t m_info = {};
+  const uint8_t       *m_buffer = nullptr;
+  int                 m_size = 0;
+  int                 m_pos = 0;
+  bool                m_loop = false;
+  bool                m_stopped = false;
+  int                 m_numSamples = 0;
+  int                 m_pcmPos = 0;
+  short               m_pcm[MINIMP3_MAX_SAMPLES_PER_FRAME];
+};
+
+/*
+ * Random stereo MPEG-1 Layer III frames with plausible side information. The
+ * Huffman data of a granule can run past its length, so the granules are kept
+ * short enough that the decoder never reads past the main data of a frame,
+ * where minimp3 would read uninitialized memory that differs between the two
+ * decoders.
+ */
+static std::vector<uint8_t> RandomMpegStream(CKernelCheck &check, int numFrames)
+{
+  std::vector<uint8_t> stream(size_t(numFrames) * s_mpegFrameBytes);
+  for (int f = 0; f < numFrames; f++)
+  {
+    uint8_t *frame = &stream[size_t(f) * s_mpegFrameBytes];
+    for (int i = 0; i < s_mpegFrameBytes; i++)
+      frame[i] = uint8_t(check.Bits());
+    frame[0] = 0xFF;  // sync, MPEG-1 Layer III without CRC
+    frame[1] = 0xFB;
+    frame[2] = 0x98;  // 128 kbps, 32 kHz
+    frame[3] = 0x00;  // stereo
+    int bit = s_mpegHeaderBytes * 8;
+    auto put = [&](UINT32 value, int bits)
+    {
+      for (int k = bits - 1; k >= 0; k--, bit++)
+      {
+        uint8_t mask = uint8_t(0x80 >> (bit & 7));
+        frame[bit >> 3] = ((value >> k) & 1) ? (frame[bit >> 3] | mask) : (frame[bit >> 3] & ~mask);
+      }
+    };
+    put(f ? check.Bits() % 30 : 0, 9);  // main_data_begin
+    put(0, 3);                          // private bits
+    put(check.Bits() % 256, 8);         // scfsi
+    for (int gr = 0; gr < 4; gr++)
+    {
+      put(300 + check.Bits() % 100, 12);  // part2_3_length
+      put(check.Bits() % 48, 9);          // big_values
+      put(100 + check.Bits() % 100, 8);   // global_gain
+      put(check.Bits() % 16, 4);          // scalefac_compress
+      put(0, 1);                          // long blocks
+      for (int i = 0; i < 3; i++)
+        put(check.Bits() % 32, 5);        // table_select
+      put(check.Bits() % 16, 4);          // region0_count
+      put(check.Bits() % 8, 3);           // region1_count
+      put(check.Bits() % 8, 3);           // preflag, scalefac_scale, count1table_select
+    }
+  }
+  return stream;
+}
+
+/*
+ * Drives MpegDec and the reference through the same random tracks, loops,
+ * position changes and stops, like the DSB does, one case per operation. The
+ * calling thread sometimes stalls, so that the worker is found both ahead
+ * and behind.
+ */
+static int RunMpeg(const Options &opts)
+{
+  CKernelCheck check(opts, 10000);
+  const int numFrames = 400;
+  std::vector<uint8_t> stream = RandomMpegStream(check, numFrames);
+  MpegDec::Decoder *decoder = MpegDec::CreateDecoder();
+  if (nullptr == decoder)
+    return ErrorLog("Out of memory.");
+  MpegDec::SetDecoder(decoder);
+  CRefMpegDecoder ref;
+  int start = 0, end = 0, base = -1;
+  int16_t refLeft[600], refRight[600], left[600], right[600];
+
+  check.Begin("Decoding ahead");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    unsigned op = check.Bits() % 100;
+    int numSamples = 0;
+    if (op < 3)
+    {
+      // New track
+      start = int(check.Bits() % (numFrames - 100)) * s_mpegFrameBytes;
+      end = start + int(5 + check.Bits() % 90) * s_mpegFrameBytes;
+      base = start;
+      bool loop = check.Bits() % 4 == 0;
+      ref.SetMemory(&stream[start], end - start, loop);
+      MpegDec::SetMemory(&stream[start], end - start, loop);
+    }
+    else if (op < 5 && base >= 0)
+    {
+      // Loop back to a frame between the start of the track and the position,
+      // leaving at least one frame to loop
+      int pos = std::min(base + ref.GetPosition(), end - s_mpegFrameBytes);
+      int loopStart = start + int(check.Bits() % ((pos - start) / s_mpegFrameBytes + 1)) * s_mpegFrameBytes;
+      base = loopStart;
+      ref.UpdateMemory(&stream[loopStart], end - loopStart, true);
+      MpegDec::UpdateMemory(&stream[loopStart], end - loopStart, true);
+    }
+    else if (op < 6 && base >= 0)
+    {
+      int pos = int(check.Bits() % ((end - base) / s_mpegFrameBytes)) * s_mpegFrameBytes;
+      ref.SetPosition(pos);
+      MpegDec::SetPosition(pos);
+    }
+    else if (op < 7)
+    {
+      ref.Stop();
+      MpegDec::Stop();
+    }
+    else
+    {
+      numSamples = 400 + int(check.Bits() % 200);
+      if (check.Bits() % 4 == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(check.Bits() % 200));
+      ref.DecodeAudio(refLeft, refRight, numSamples);
+      MpegDec::DecodeAudio(left, right, numSamples);
+    }
+
+    int s = 0;
+    while (s < numSamples && refLeft[s] == left[s] && refRight[s] == right[s])
+      s++;
+    bool same = s == numSamples && ref.GetPosition() == MpegDec::GetPosition() && ref.IsLoaded() == MpegDec::IsLoaded();
+    if (!check.Case(same, "operation %u: position %d vs. %d, sample %d of %d: %d,%d vs. %d,%d", op, ref.GetPosition(), MpegDec::GetPosition(), s, numSamples,
+                    s < numSamples ? refLeft[s] : 0, s < numSamples ? refRight[s] : 0, s < numSamples ? left[s] : 0, s < numSamples ? right[s] : 0))
+      break;
+  }
+  check.End();
+
+  MpegDec::DestroyDecoder(decoder);
+  return check.Result();
+}
+
+
+/******************************************************************************
+ Host Audio Mix
+******************************************************************************/
+
+static INT16 RefClampINT16(float x)
+{
+  INT32 xi = (INT32)x;
+  if (xi > INT16_MAX)
+    xi = INT16_MAX;
+  if (xi < INT16_MIN)
+    xi = INT16_MIN;
+  return (INT16)xi;
+}
+
+static INT16 RefMixINT16(float x, float y)
+{
+  return RefClampINT16((x + y)*0.5f);
+}
+
+static float RefMixFloat(float x, float y)
+{
+  return (x + y)*0.5f;
+}
+
+// Reference: MixChannels() in OSD/SDL/Audio.cpp before it was vectorized,
+// with the host channels, audio type and balance factors passed in
+static void RefMixChannels(unsigned numSamples, const float *const in[4], INT16 *p, bool flipStereo, int channels, Game::AudioTypes type, const float balance[4])
+{
+  for (unsigned i = 0; i < numSamples; i++)
+  {
+    float fl = in[0][i]*balance[0];
+    float fr = in[1][i]*balance[1];
+    float rl = in[2][i]*balance[2];
+    float rr = in[3][i]*balance[3];
+    if (channels == 1)
+    {
+      *p++ = RefClampINT16(RefMixFloat(RefMixFloat(fl, fr), RefMixFloat(rl, rr)));
+      continue;
+    }
+
+    bool flip = flipStereo;
+    if (type == Game::STEREO_RL || type == Game::QUAD_1_FRL_2_RRL || type == Game::QUAD_1_RRL_2_FRL)
+      flip = !flip;
+
+    INT16 out[4];
+    if (channels == 2)
+    {
+      out[0] = RefMixINT16(fl, rl);
+      out[1] = RefMixINT16(fr, rr);
+    }
+    else
+    {
+      switch (type)
+      {
+      case Game::MONO:
+        out[0] = out[1] = out[2] = out[3] = RefMixINT16(RefMixFloat(fl, fr), RefMixFloat(rl, rr));
+        break;
+      case Game::STEREO_LR:
+      case Game::STEREO_RL:
+        out[0] = out[2] = RefMixINT16(fl, fr);
+        out[1] = out[3] = RefMixINT16(rl, rr);
+        break;
+      case Game::QUAD_1_FLR_2_RLR:
+      case Game::QUAD_1_FRL_2_RRL:
+        out[0] = RefClampINT16(fl);
+        out[1] = RefClampINT16(fr);
+        out[2] = RefClampINT16(rl);
+        out[3] = RefClampINT16(rr);
+        break;
+      case Game::QUAD_1_RLR_2_FLR:
+      case Game::QUAD_1_RRL_2_FRL:
+        out[0] = RefClampINT16(rl);
+        out[1] = RefClampINT16(rr);
+        out[2] = RefClampINT16(fl);
+        out[3] = RefClampINT16(fr);
+        break;
+      default:
+        out[0] = RefMixINT16(fl, rl);
+        out[1] = RefMixINT16(fl, rr);
+        out[2] = RefMixINT16(fr, rl);
+        out[3] = RefMixINT16(fr, rr);
+        break;
+      }
+    }
+
+    // Swapping left and right swaps each pair of host channels
+    for (int ch = 0; ch < channels; ch++)
+      *p++ = out[flip ? ch ^ 1 : ch];
+  }
+}
+
+// Balance factors as OpenAudio() works them out
+static void RefBalanceFactors(float balanceLR, float balanceFR, float balance[4])
+{
+  balanceLR = std::max(-100.f, std::min(100.f, balanceLR)) * 0.01f;
+  balanceFR = std::max(-100.f, std::min(100.f, balanceFR)) * 0.01f;
+  balance[0] = (balanceLR < 0.f ? 1.f + balanceLR : 1.f) * (balanceFR < 0 ? 1.f + balanceFR : 1.f);
+  balance[1] = (balanceLR > 0.f ? 1.f - balanceLR : 1.f) * (balanceFR < 0 ? 1.f + balanceFR : 1.f);
+  balance[2] = (balanceLR < 0.f ? 1.f + balanceLR : 1.f) * (balanceFR > 0 ? 1.f - balanceFR : 1.f);
+  balance[3] = (balanceLR > 0.f ? 1.f - balanceLR : 1.f) * (balanceFR > 0 ? 1.f - balanceFR : 1.f);
+}
+
+struct MixCapture
+{
+  std::vector<INT16> samples;
+  unsigned numChannels = 0;
+};
+
+static void CaptureMix(void *data, const INT16 *samples, unsigned numSamples, unsigned numChannels)
+{
+  MixCapture *capture = (MixCapture *) data;
+  capture->samples.assign(samples, samples + numSamples * numChannels);
+  capture->numChannels = numChannels;
+}
+
+/*
+ * Each case opens headless audio with a random audio type, channel count and
+ * balance, and passes one chunk of random samples, some out of the 16-bit
+ * range, through OutputAudio(). The mixed chunk handed to the audio sink is
+ * compared against the reference. Chunk lengths vary, so that the scalar
+ * code finishes off the SIMD runs at every offset.
+ */
+static int RunMix(const Options &opts)
+{
+  CKernelCheck check(opts, 20000);
+  static const int s_channels[] = { 1, 2, 4 };
+  const unsigned maxSamples = 44100 / 45;  // a chunk at the lowest SoundFreq
+  std::vector<float> buffers[4];
+  for (auto &buffer: buffers)
+    buffer.resize(maxSamples);
+  std::vector<INT16> ref(maxSamples * 4);
+  MixCapture capture;
+  SetAudioHeadless(true);
+  SetAudioSink(CaptureMix, &capture);
+
+  check.Begin("Vectorized mix");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    Game::AudioTypes type = Game::AudioTypes(check.Bits() % 8);
+    int channels = s_channels[check.Bits() % 3];
+    float balanceLR = check.Bits() % 2 ? 0.0f : float(int(check.Bits() % 241) - 120);
+    float balanceFR = check.Bits() % 2 ? 0.0f : float(int(check.Bits() % 241) - 120);
+    bool flipStereo = check.Bits() % 2 != 0;
+    unsigned numSamples = check.Bits() % 4 ? check.Bits() % 64 : check.Bits() % (maxSamples + 1);
+    for (auto &buffer: buffers)
+    {
+      for (unsigned s = 0; s < numSamples; s++)
+        buffer[s] = check.Bits() % 4 ? check.Float() : std::uniform_real_distribution<float>(-70000.0f, 70000.0f)(check.random);
+    }
+
+    Util::Config::Node config("Global");
+    config.Set("NbSoundChannels", channels);
+    config.Set("BalanceLeftRight", balanceLR);
+    config.Set("BalanceFrontRear", balanceFR);
+    config.Set("SoundFreq", 45.0f);
+    config.Set("DynamicRateControl", false);
+    config.Set("AudioLatency", 100);
+    SetAudioType(type);
+    capture.samples.clear();
+    bool opened = OpenAudio(config) == OKAY;
+    if (opened)
+      OutputAudio(numSamples, buffers[0].data(), buffers[1].data(), buffers[2].data(), buffers[3].data(), flipStereo);
+    CloseAudio();
+
+    // OpenAudio() limits mono and stereo games to as many host channels
+    if (type == Game::MONO)
+      channels = std::min(channels, 1);
+    else if (type == Game::STEREO_LR || type == Game::STEREO_RL)
+      channels = std::min(channels, 2);
+    float balance[4];
+    RefBalanceFactors(balanceLR, balanceFR, balance);
+    const float *in[4] = { buffers[0].data(), buffers[1].data(), buffers[2].data(), buffers[3].data() };
+    RefMixChannels(numSamples, in, ref.data(), flipStereo, channels, type, balance);
+
+    size_t n = numSamples * channels;
+    size_t s = 0;
+    bool same = opened && capture.numChannels == unsigned(channels) && capture.samples.size() == n;
+    while (same && s < n && capture.samples[s] == ref[s])
+      s++;
+    same = same && s == n;
+    if (!check.Case(same, "type %d, %d channels, balance %g/%g, flip %d, %u samples: sample %u channel %u is %d vs. %d", int(type), channels, balanceLR, balanceFR, int(flipStereo), numSamples,
+                    unsigned(s / channels), unsigned(s % channels), s < n ? ref[s] : 0, s < capture.samples.size() ? capture.samples[s] : 0))
+      break;
+  }
+  check.End();
+
+  SetAudioSink(nullptr, nullptr);
+  return check.Result();
+}
+
+
+/******************************************************************************
+ Audio Rate Control
+******************************************************************************/
+
+static const unsigned s_rateMaxInput = 44100 / 45;
+typedef CAudioResampler<s_rateMaxInput, s_rateMaxInput + s_rateMaxInput / 100 + 2> RateTestResampler;
+
+// At a ratio of 1, every output sample is an input sample, 2 samples late
+static void CheckResamplerIdentity(CKernelCheck &check)
+{
+  static RateTestResampler resampler;
+  resampler.Reset();
+  std::vector<float> input[4], output[4], expected[4];
+  for (int ch = 0; ch < 4; ch++)
+  {
+    output[ch].resize(s_rateMaxInput + 16);
+    expected[ch].assign(2, 0.0f);
+  }
+
+  check.Begin("Resampling at a ratio of 1");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    unsigned numSamples = 1 + check.Bits() % s_rateMaxInput;
+    for (int ch = 0; ch < 4; ch++)
+    {
+      input[ch].resize(numSamples);
+      for (auto &sample: input[ch])
+        sample = check.Float();
+      expected[ch].insert(expected[ch].end(), input[ch].begin(), input[ch].end());
+    }
+    const float *in[4] = { input[0].data(), input[1].data(), input[2].data(), input[3].data() };
+    float *out[4] = { output[0].data(), output[1].data(), output[2].data(), output[3].data() };
+    unsigned count = resampler.Resample(numSamples, in, out, 1.0);
+
+    unsigned s = 0;
+    int ch = 4;
+    while (count == numSamples && s < count && ch == 4)
+    {
+      for (ch = 0; ch < 4 && expected[ch][s] == output[ch][s]; ch++)
+        ;
+      s += ch == 4;
+    }
+    if (!check.Case(count == numSamples && s == count, "%u samples in, %u out, sample %u channel %d differs", numSamples, count, s, ch))
+      break;
+    for (ch = 0; ch < 4; ch++)
+      expected[ch].erase(expected[ch].begin(), expected[ch].begin() + count);
+  }
+  check.End();
+}
+
+struct RateRun
+{
+  UINT64 underRuns = 0;
+  UINT64 overRuns = 0;
+  UINT64 produced = 0;    // resampled samples, before over-runs are dropped
+  UINT64 consumed = 0;    // input samples
+};
+
+/*
+ * Simulates OutputAudio() and the host's playback callback over the given
+ * time: frames of 765 samples, as at the default SoundFreq of 57.6 Hz, and
+ * a default 200 ms buffer, played in 512-sample callbacks by a host whose
+ * clock is off by drift. Under- and over-runs are counted after the first
+ * few seconds, while the buffer settles.
+ */
+static RateRun SimulateRateControl(double drift, bool rateControl, double seconds)
+{
+  static RateTestResampler resampler;
+  const unsigned frameSamples = 765;
+  const double frameRate = 44100.0 / frameSamples;
+  const unsigned bufferSamples = 44100 * 200 / 1000;
+  const unsigned playSamples = 512;
+  const double settleSeconds = 5.0;
+  resampler.Reset();
+
+  // What is played does not matter here, only how much
+  std::vector<float> input[4], output[4];
+  for (int ch = 0; ch < 4; ch++)
+  {
+    for (unsigned s = 0; s < frameSamples; s++)
+      input[ch].push_back(float(8000.0 * std::sin(s * 0.0311 + ch)));
+    output[ch].resize(s_rateMaxInput + 16);
+  }
+  const float *in[4] = { input[0].data(), input[1].data(), input[2].data(), input[3].data() };
+  float *out[4] = { output[0].data(), output[1].data(), output[2].data(), output[3].data() };
+
+  RateRun run;
+  UINT64 buffered = std::min(bufferSamples - frameSamples, (bufferSamples + frameSamples) / 2);
+  UINT64 frame = 0, callback = 0;
+  while (true)
+  {
+    double frameTime = frame / frameRate;
+    double callbackTime = callback * playSamples / (44100.0 * (1.0 + drift));
+    double now = std::min(frameTime, callbackTime);
+    if (now >= seconds)
+      break;
+    bool settled = now >= settleSeconds;
+
+    if (frameTime <= callbackTime)
+    {
+      unsigned count = frameSamples;
+      if (rateControl)
+        count = resampler.Resample(frameSamples, in, out, RateControlRatio(unsigned(buffered), bufferSamples));
+      run.consumed += frameSamples;
+      run.produced += count;
+      if (buffered + count > bufferSamples)
+        run.overRuns += settled;
+      else
+        buffered += count;
+      frame++;
+    }
+    else
+    {
+      if (buffered < playSamples)
+        run.underRuns += settled;
+      buffered -= std::min<UINT64>(buffered, playSamples);
+      callback++;
+    }
+  }
+  return run;
+}
+
+/*
+ * With the host clock off by up to 0.4% either way, rate control must keep
+ * the buffer from under- or over-running for 5 minutes, and produce as many
+ * samples as its ratios ask for. Without it, the same drift must run the
+ * buffer dry or full, or the simulation would prove nothing. One case per
+ * random drift, for every 100 cases asked for.
+ */
+static void CheckRateControl(CKernelCheck &check)
+{
+  check.Begin("Dynamic rate control");
+  for (UINT64 i = 0; i < std::max<UINT64>(1, check.count / 100); i++)
+  {
+    double drift = (int(check.Bits() % 81) - 40) * 0.0001;
+    RateRun with = SimulateRateControl(drift, true, 300);
+    RateRun without = SimulateRateControl(drift, false, 300);
+    bool runsWithout = std::fabs(drift) < 0.0005 || without.underRuns + without.overRuns > 0;
+    double ratio = double(with.produced) / double(with.consumed);
+    bool same = with.underRuns == 0 && with.overRuns == 0 && runsWithout && std::fabs(ratio - (1.0 + drift)) < 0.001;
+    if (!check.Case(same, "drift %+.2f%%: %llu under-runs, %llu over-runs, ratio %.5f (without rate control: %llu, %llu)", drift * 100,
+                    (unsigned long long) with.underRuns, (unsigned long long) with.overRuns, ratio,
+                    (unsigned long long) without.underRuns, (unsigned long long) without.overRuns))
+      break;
+  }
+  check.End();
+}
+
+static int RunRateControl(const Options &opts)
+{
+  CKernelCheck check(opts, 2000);
+  CheckResamplerIdentity(check);
+  CheckRateControl(check);
+  return check.Result();
+}
+
+
+/******************************************************************************
+ Frame Barrier
+******************************************************************************/
+
+static const int s_barrierThreads = 4;
+
+// Shared by the threads of the barrier check. Each frame, every thread writes
+// its slot before the start barrier and reads all the others after it, and
+// records whether they were all of that frame before the end barrier.
+struct BarrierTest
+{
+  CFrameBarrier *start;
+  CFrameBarrier *end;
+  UINT64 frames;
+  UINT32 seed;
+  UINT64 slot[s_barrierThreads];
+  bool bad[s_barrierThreads];
+  bool error[s_barrierThreads];
+};
+
+// Threads are sometimes late to a barrier, mostly for less than the others
+// spin, now and then for long enough that the others block
+static void BarrierStall(std::mt19937 &random)
+{
+  unsigned r = random() % 64;
+  if (r == 0)
+    std::this_thread::sleep_for(std::chrono::microseconds(300 + random() % 300));
+  else if (r < 8)
+    std::this_thread::sleep_for(std::chrono::microseconds(random() % 30));
+}
+
+static bool BarrierFrame(BarrierTest &test, int t, UINT64 frame, std::mt19937 &random)
+{
+  BarrierStall(random);
+  test.slot[t] = frame;
+  if (!test.start->Wait())
+    return false;
+  bool bad = false;
+  for (int u = 0; u < s_barrierThreads; u++)
+    bad |= test.slot[u] != frame;
+  test.bad[t] = bad;
+  BarrierStall(random);
+  return test.end->Wait();
+}
+
+static void BarrierThread(BarrierTest *test, int t)
+{
+  std::mt19937 random(test->seed + t);
+  for (UINT64 frame = 0; frame < test->frames && !test->error[t]; frame++)
+    test->error[t] = !BarrierFrame(*test, t, frame, random);
+}
+
+/*
+ * Runs a frame's start and end barriers, as RunFrame() and the board threads
+ * do, on 4 threads arriving in random order. Each frame is one case: after
+ * the start barrier, every thread must see the writes all of them made
+ * before it, and none may be released early or kept waiting.
+ */
+static int RunBarrier(const Options &opts)
+{
+  CKernelCheck check(opts, 20000);
+  BarrierTest test = {};
+  test.start = CThread::CreateFrameBarrier(s_barrierThreads);
+  test.end = CThread::CreateFrameBarrier(s_barrierThreads);
+  if (nullptr == test.start || nullptr == test.end)
+    return ErrorLog("Unable to create frame barriers.");
+  test.frames = check.count;
+  test.seed = check.Bits();
+
+  std::vector<std::thread> threads;
+  for (int t = 1; t < s_barrierThreads; t++)
+    threads.emplace_back(BarrierThread, &test, t);
+
+  check.Begin("Frame barrier");
+  auto start = std::chrono::steady_clock::now();
+  std::mt19937 random(test.seed);
+  UINT64 frame;
+  for (frame = 0; frame < test.frames; frame++)
+  {
+    bool ok = BarrierFrame(test, 0, frame, random);
+    int t = 0;
+    while (t < s_barrierThreads && !test.bad[t])
+      t++;
+    if (!check.Case(ok && t == s_barrierThreads, "frame %llu: %s %d", (unsigned long long) frame, ok ? "a stale slot was seen by thread" : "Wait() failed on thread", t))
+      break;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  check.End();
+
+  // On failure, the other threads cannot finish, so they are left behind
+  if (frame < test.frames)
+  {
+    for (auto &thread: threads)
+      thread.detach();
+    return check.Result();
+  }
+  for (auto &thread: threads)
+    thread.join();
+  delete test.start;
+  delete test.end;
+  printf("  %-32s %8.2f us per frame\n", "Both barriers, with stalls", seconds * 1e6 / test.frames);
+  return check.Result();
+}
+
+
+/******************************************************************************
+ Block Files
+******************************************************************************/
+
+static const char s_blockTestFile[] = "Test_Lockstep.tmp";
+
+struct TestBlock
+{
+  std::string         name;
+  std::string         comment;
+  std::vector<UINT8>  data;
+};
+
+// Up to 15 blocks, mostly small, some up to 1 MB, either compressible or not,
+// after the header block. Names are unique unless duplicates are asked for.
+static std::vector<TestBlock> RandomBlocks(CKernelCheck &check, bool duplicates)
+{
+  std::vector<TestBlock> blocks(check.Bits() % 16);
+  for (size_t i = 0; i < blocks.size(); i++)
+  {
+    TestBlock &block = blocks[i];
+    if (duplicates && i > 0 && (check.Bits() % 4) == 0)
+      block.name = blocks[check.Bits() % i].name;
+    else
+      block.name = "Block " + std::to_string(i) + std::string(check.Bits() % 32, 'x');
+    block.comment = std::string(check.Bits() % 64, 'c');
+    block.data.resize((check.Bits() % 4) ? check.Bits() % 4096 : check.Bits() % (1 << 20));
+    bool runs = (check.Bits() & 1) != 0;
+    for (size_t j = 0; j < block.data.size(); j++)
+      block.data[j] = runs ? UINT8(j >> 7) : UINT8(check.Bits());
+  }
+  return blocks;
+}
+
+// Reference: appends a block in the format described in BlockFile.cpp
+static void AppendBlock(std::vector<UINT8> *file, const std::string &name, const std::string &comment, const std::vector<UINT8> &data)
+{
+  UINT32 header[3] = { UINT32(12 + name.size() + 1 + comment.size() + 1 + data.size()), UINT32(name.size() + 1), UINT32(comment.size() + 1) };
+  const UINT8 *bytes = (const UINT8 *) header;
+  file->insert(file->end(), bytes, bytes + sizeof(header));
+  file->insert(file->end(), name.c_str(), name.c_str() + name.size() + 1);
+  file->insert(file->end(), comment.c_str(), comment.c_str() + comment.size() + 1);
+  file->insert(file->end(), data.begin(), data.end());
+}
+
+static std::vector<UINT8> FormatBlocks(const std::vector<TestBlock> &blocks)
+{
+  std::vector<UINT8> file;
+  AppendBlock(&file, "Test Header", "Test_Lockstep", std::vector<UINT8>());
+  for (auto &block: blocks)
+    AppendBlock(&file, block.name, block.comment, block.data);
+  return file;
+}
+
+// Writes each block's data in pieces of random size
+static void WriteBlocks(CKernelCheck &check, CBlockFile *file, const std::vector<TestBlock> &blocks)
+{
+  for (auto &block: blocks)
+  {
+    file->NewBlock(block.name, block.comment);
+    size_t pos = 0;
+    while (pos < block.data.size())
+    {
+      size_t size = std::min(block.data.size() - pos, size_t(1 + check.Bits() % 8192));
+      file->Write(&block.data[pos], UINT32(size));
+      pos += size;
+    }
+  }
+}
+
+// Checks that every block is found and reads back whole, and no further
+static bool ReadBlocks(CBlockFile *file, const std::vector<TestBlock> &blocks)
+{
+  std::vector<UINT8> data;
+  for (auto &block: blocks)
+  {
+    data.assign(block.data.size() + 1, 0);
+    if (OKAY != file->FindBlock(block.name) || file->Read(data.data(), UINT32(data.size())) < block.data.size())
+      return false;
+    data.pop_back();
+    if (data != block.data)
+      return false;
+  }
+  return true;
+}
+
+static std::vector<UINT8> ReadWholeFile(const std::string &path)
+{
+  std::vector<UINT8> data;
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (NULL == fp)
+    return data;
+  UINT8 buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(fp);
+  return data;
+}
+
+static void CheckBlockFileFormat(CKernelCheck &check)
+{
+  check.Begin("Create, Close and Load");
+  std::vector<UINT8> buffer;
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    std::vector<TestBlock> blocks = RandomBlocks(check, false);
+    std::vector<UINT8> expected = FormatBlocks(blocks);
+    const char *failure = NULL;
+    CBlockFile file;
+    file.Create(&buffer, "Test Header", "Test_Lockstep");
+    WriteBlocks(check, &file, blocks);
+    file.Close();
+    if (buffer != expected)
+      failure = "written to memory do not match the format";
+    else if (OKAY != file.Create(s_blockTestFile, "Test Header", "Test_Lockstep"))
+      failure = "could not be written to a file";
+    else
+    {
+      WriteBlocks(check, &file, blocks);
+      file.Close();
+      if (ReadWholeFile(s_blockTestFile) != expected)
+        failure = "written to a file do not match the format";
+    }
+    if (!failure)
+    {
+      file.Load(&buffer);
+      if (!ReadBlocks(&file, blocks))
+        failure = "do not read back from memory";
+      file.Close();
+    }
+    if (!failure)
+    {
+      if (OKAY != file.Load(s_blockTestFile) || !ReadBlocks(&file, blocks))
+        failure = "do not read back from the file";
+      file.Close();
+    }
+    check.Case(failure == NULL, "%u blocks %s", unsigned(blocks.size()), failure);
+  }
+  check.End();
+}
+
+// Reference: FindBlock() before blocks were indexed, a scan from the start of
+// the file returning the data offset of the first block of that name or -1
+static long FindBlockByScan(const std::vector<UINT8> &file, const std::string &name)
+{
+  size_t pos = 0;
+  while (pos + 12 <= file.size())
+  {
+    UINT32 header[3];
+    memcpy(header, &file[pos], sizeof(header));
+    std::string blockName((const char *) &file[pos + 12], strnlen((const char *) &file[pos + 12], header[1]));
+    if (blockName == name)
+      return long(pos + 12 + header[1] + header[2]);
+    if (header[0] == 0)
+      break;
+    pos += header[0];
+  }
+  return -1;
+}
+
+static void CheckFindBlock(CKernelCheck &check)
+{
+  check.Begin("FindBlock");
+  std::vector<UINT8> buffer;
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    std::vector<TestBlock> blocks = RandomBlocks(check, true);
+    CBlockFile file;
+    file.Create(&buffer, "Test Header", "Test_Lockstep");
+    WriteBlocks(check, &file, blocks);
+    file.Close();
+
+    // Names of blocks, the header block and missing ones, in random order
+    std::vector<std::string> names = { "Test Header", "Missing", "", "Block" };
+    for (auto &block: blocks)
+      names.push_back(block.name);
+    std::shuffle(names.begin(), names.end(), check.random);
+
+    file.Load(&buffer);
+    std::string failure;
+    for (auto &name: names)
+    {
+      long expected = FindBlockByScan(buffer, name);
+      bool found = OKAY == file.FindBlock(name);
+      if (found != (expected >= 0) || (found && long(file.GetPosition()) != expected))
+      {
+        failure = "'" + name + "' found at " + (found ? std::to_string(file.GetPosition()) : "none") + " vs. " + (expected >= 0 ? std::to_string(expected) : "none");
+        break;
+      }
+    }
+    file.Close();
+    check.Case(failure.empty(), "%u blocks: %s", unsigned(blocks.size()), failure.c_str());
+  }
+  check.End();
+}
+
+// Corrupts the zlib stream of the first compressed block of a file, anywhere
+// or in its checksum, returns false if there is none
+static bool CorruptCompressedBlock(CKernelCheck &check, std::vector<UINT8> *file, bool checksum)
+{
+  size_t pos = 0;
+  while (pos + 12 <= file->size())
+  {
+    UINT32 header[3];
+    memcpy(header, &(*file)[pos], sizeof(header));
+    size_t headerSize = 12 + (header[1] & 0xFFFFFF) + header[2];
+    if ((header[1] >> 24) != 0 && header[0] > headerSize + 4)
+    {
+      // Past the uncompressed size, in the zlib stream, which ends with an
+      // Adler-32 checksum
+      size_t streamSize = header[0] - headerSize - 4;
+      size_t offset = checksum ? streamSize - 1 - check.Bits() % 4 : check.Bits() % streamSize;
+      (*file)[pos + headerSize + 4 + offset] ^= UINT8(1 + check.Bits() % 255);
+      return true;
+    }
+    pos += header[0];
+  }
+  return false;
+}
+
+static bool WriteWholeFile(const std::string &path, const std::vector<UINT8> &data)
+{
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (NULL == fp)
+    return false;
+  bool written = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  fclose(fp);
+  return written;
+}
+
+static void CheckCompression(CKernelCheck &check)
+{
+  // Compression jobs are run in reverse, as a thread pool may finish them in
+  // any order
+  CBlockFile::JobRunner runJobs = [](unsigned count, const std::function<void(unsigned)> &job)
+  {
+    for (unsigned i = count; i-- > 0; )
+      job(i);
+  };
+
+  std::vector<UINT8> buffer;
+  for (int level: { 0, 1, 9 })
+  {
+    check.Begin("Save and Load, level " + std::to_string(level));
+    for (UINT64 i = 0; i < check.count; i++)
+    {
+      std::vector<TestBlock> blocks = RandomBlocks(check, false);
+      CBlockFile file;
+      file.Create(&buffer, "Test Header", "Test_Lockstep");
+      WriteBlocks(check, &file, blocks);
+      file.Close();
+
+      std::string failure;
+      if (OKAY != CBlockFile::Save(s_blockTestFile, buffer, level, (i & 1) ? runJobs : CBlockFile::JobRunner()))
+        failure = "could not be saved";
+      else
+      {
+        // Stored blocks are never larger than they were, and uncompressed
+        // files are in the original format
+        std::vector<UINT8> saved = ReadWholeFile(s_blockTestFile);
+        if (saved.size() > buffer.size() || (level == 0 && saved != buffer))
+          failure = "saved as " + std::to_string(saved.size()) + " bytes from " + std::to_string(buffer.size());
+        else if (OKAY != file.Load(s_blockTestFile) || !ReadBlocks(&file, blocks))
+          failure = "do not load back";
+        file.Close();
+
+        // A stream with a bad checksum must not load. Other corruption may
+        // only flip unused bits, but must never load different data.
+        bool checksum = (check.Bits() & 1) != 0;
+        if (failure.empty() && CorruptCompressedBlock(check, &saved, checksum))
+        {
+          if (!WriteWholeFile(s_blockTestFile, saved))
+            failure = "could not be rewritten";
+          else if (OKAY == file.Load(s_blockTestFile) && (checksum || !ReadBlocks(&file, blocks)))
+            failure = checksum ? "load with a bad checksum" : "load different data from a corrupt stream";
+          file.Close();
+        }
+      }
+      check.Case(failure.empty(), "%u blocks %s", unsigned(blocks.size()), failure.c_str());
+    }
+    check.End();
+  }
+
+  // An unknown compression method must not load
+  check.Begin("Load, unknown method");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    std::vector<TestBlock> blocks = RandomBlocks(check, false);
+    std::vector<UINT8> data = FormatBlocks(blocks);
+    size_t pos = 0;
+    UINT32 header[3];
+    memcpy(header, &data[pos], sizeof(header));
+    for (size_t skip = check.Bits() % (blocks.size() + 1); skip > 0; skip--)
+    {
+      pos += header[0];
+      memcpy(header, &data[pos], sizeof(header));
+    }
+    header[1] |= UINT32(2 + check.Bits() % 254) << 24;
+    memcpy(&data[pos], header, sizeof(header));
+    CBlockFile file;
+    bool loaded = WriteWholeFile(s_blockTestFile, data) && OKAY == file.Load(s_blockTestFile);
+    file.Close();
+    check.Case(!loaded, "a file with method %u in block %u loads", header[1] >> 24, unsigned(pos));
+  }
+  check.End();
+}
+
+static int RunBlockFile(const Options &opts)
+{
+  CKernelCheck check(opts, 100);
+  CheckBlockFileFormat(check);
+  CheckFindBlock(check);
+  CheckCompression(check);
+  remove(s_blockTestFile);
+  return check.Result();
+}
+
+
+/******************************************************************************
+ MIDI Recordings
+******************************************************************************/
+
+static const char s_midiTestFile[] = "Test_Lockstep.tmp";
+
+// Records random MIDI port writes over a random number of frames, starting a
+// few frames after the board was created, and returns what was recorded,
+// frames counted from the start of the recording
+static CSoundBoard::MIDIRecording RecordRandomMIDI(CKernelCheck &check, const Util::Config::Node &config)
+{
+  CSoundBoard::MIDIRecording recording;
+  recording.game = std::string(check.Bits() % 40, char('a' + check.Bits() % 26));
+  recording.numFrames = check.Bits() % 4 ? check.Bits() % 200 : 0;
+
+  // The MIDI queue keeps the bytes from the SCSP, which is not initialized.
+  // It fills up and drops bytes, but only after they are recorded.
+  CSoundBoard board(config);
+  board.SetMIDIQueue(true);
+  for (unsigned i = check.Bits() % 4; i > 0; i--)
+  {
+    board.WriteMIDIPort(UINT8(check.Bits()));
+    board.EndMIDIFrame();
+  }
+  if (OKAY != board.StartMIDIRecording(s_midiTestFile, recording.game))
+    return CSoundBoard::MIDIRecording();
+  for (UINT32 frame = 0; frame < recording.numFrames; frame++)
+  {
+    for (unsigned i = check.Bits() % 2 ? check.Bits() % 24 : 0; i > 0; i--)
+    {
+      UINT8 data = UINT8(check.Bits());
+      board.WriteMIDIPort(data);
+      recording.entries.push_back({ frame, data });
+    }
+    board.EndMIDIFrame();
+  }
+  if (check.Bits() % 2)
+    board.StopMIDIRecording();
+  recording.game.resize(std::min<size_t>(recording.game.size(), 31));
+  return recording;
+}
+
+static bool SameMIDIRecording(const CSoundBoard::MIDIRecording &a, const CSoundBoard::MIDIRecording &b)
+{
+  if (a.game != b.game || a.numFrames != b.numFrames || a.entries.size() != b.entries.size())
+    return false;
+  for (size_t i = 0; i < a.entries.size(); i++)
+  {
+    if (a.entries[i].frame != b.entries[i].frame || a.entries[i].data != b.entries[i].data)
+      return false;
+  }
+  return true;
+}
+
+/*
+ * Recordings of random writes, stopped explicitly or by destroying the board,
+ * must load back the same, game names being cut to 31 characters. A file cut
+ * short in its entries loads the whole entries before the cut, one with a
+ * lower frame count loads the entries before that frame, and one cut short in
+ * its header, or with a different ID or version, must fail to load.
+ * One case per recording.
+ */
+static int RunMIDI(const Options &opts)
+{
+  CKernelCheck check(opts, 1000);
+  Util::Config::Node config("Global");
+  config.Set("EmulateSound", true);
+  config.Set("SoundIdleSkip", true);
+  config.Set("SoundVolume", 100);
+  config.Set("FlipStereo", false);
+
+  check.Begin("Record and load");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    CSoundBoard::MIDIRecording recorded = RecordRandomMIDI(check, config);
+    CSoundBoard::MIDIRecording loaded;
+    bool ok = OKAY == CSoundBoard::LoadMIDIRecording(&loaded, s_midiTestFile);
+    if (!check.Case(ok && SameMIDIRecording(recorded, loaded), "%u frames, %u entries recorded, %u frames, %u entries loaded%s", recorded.numFrames,
+                    unsigned(recorded.entries.size()), loaded.numFrames, unsigned(loaded.entries.size()), ok ? "" : " (failed)"))
+      break;
+  }
+  check.End();
+
+  check.Begin("Damaged recordings");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    CSoundBoard::MIDIRecording recorded = RecordRandomMIDI(check, config);
+    std::vector<UINT8> file = ReadWholeFile(s_midiTestFile);
+    const size_t header = 56;
+    unsigned damage = check.Bits() % 5;
+    bool loads = false;
+    if (damage == 0 || (damage == 3 && file.size() == header))
+      file.resize(check.Bits() % header);
+    else if (damage == 1)
+      file[check.Bits() % 16] ^= UINT8(1 + check.Bits() % 255);
+    else if (damage == 2)
+      file[16 + check.Bits() % 4] ^= UINT8(1 + check.Bits() % 255);
+    else if (damage == 4)
+    {
+      // Entries from frames after the frame count are dropped
+      UINT32 numFrames = check.Bits() % (recorded.numFrames + 1);
+      memcpy(&file[20], &numFrames, sizeof(numFrames));
+      while (!recorded.entries.empty() && recorded.entries.back().frame >= numFrames)
+        recorded.entries.pop_back();
+      recorded.numFrames = numFrames;
+      loads = true;
+    }
+    else
+    {
+      size_t entries = (file.size() - header) / 5;
+      size_t cut = header + check.Bits() % (file.size() - header);
+      file.resize(cut);
+      recorded.entries.resize(std::min(entries, (cut - header) / 5));
+      loads = true;
+    }
+    WriteWholeFile(s_midiTestFile, file);
+    CSoundBoard::MIDIRecording loaded;
+    s_muteErrors = true;
+    bool ok = OKAY == CSoundBoard::LoadMIDIRecording(&loaded, s_midiTestFile);
+    s_muteErrors = false;
+    if (!check.Case(ok == loads && (!loads || SameMIDIRecording(recorded, loaded)), "damage %u to a file of %u bytes: %s", damage, unsigned(file.size()), ok ? "loaded" : "failed to load"))
+      break;
+  }
+  check.End();
+
+  remove(s_midiTestFile);
+  return check.Result();
+}
+
+/******************************************************************************
+ Net Deltas
+******************************************************************************/
+
+// Changes a few short runs of a slice, as games do from frame to frame
+static void ChangeSlice(CKernelCheck &check, std::vector<uint8_t> *slice)
+{
+  for (unsigned i = 1 + check.Bits() % 4; i > 0; i--)
+  {
+    size_t at = check.Bits() % slice->size();
+    size_t end = std::min(slice->size(), at + 1 + check.Bits() % 8);
+    for (; at < end; at++)
+      (*slice)[at] = uint8_t(check.Bits());
+  }
+}
+
+// Mostly comm RAM sized slices, with some of a few bytes
+static size_t RandomSliceSize(CKernelCheck &check)
+{
+  return check.Bits() % 8 ? 0x1000 + check.Bits() % 0x3001 : 1 + check.Bits() % 64;
+}
+
+static void PutTestVarint(std::vector<uint8_t> *out, size_t value)
+{
+  for (; value >= 0x80; value >>= 7)
+    out->push_back(uint8_t(value | 0x80));
+  out->push_back(uint8_t(value));
+}
+
+/*
+ * Streams of slices, each a keyframe followed by deltas with a few short runs
+ * changed, as the net board sends them, must decode to the slices sent. All
+ * zero and fully changed slices must decode the same, and a delta of a slice
+ * that did not change must be the header alone. Deltas and keyframes damaged
+ * in ways the format can tell must be rejected: cut short in the header or in
+ * the last run of changed bytes, with another slice size or a run past the end
+ * of the slice, compressed and cut short, or applied to a slice of another
+ * size. The deltas of comm RAM sized slices, 4 KB to 16 KB, must average under
+ * 2% of the slice size. One case per slice.
+ */
+static int RunNetDelta(const Options &opts)
+{
+  CKernelCheck check(opts, 5000);
+  std::vector<uint8_t> encoded;
+  const size_t header = 5;
+  const int levels[] = { 0, 1, 9 };
+
+  check.Begin("Random slices");
+  double deltaBytes = 0;
+  double sliceBytes = 0;
+  for (UINT64 i = 0; i < check.count; )
+  {
+    std::vector<uint8_t> sent(RandomSliceSize(check));
+    std::vector<uint8_t> received;
+    std::vector<uint8_t> prev;
+    for (uint8_t &b: sent)
+      b = uint8_t(check.Bits());
+    int level = levels[check.Bits() % 3];
+    for (unsigned frame = 0; frame < 60 && i < check.count; frame++, i++)
+    {
+      if (frame > 0)
+      {
+        prev = sent;
+        ChangeSlice(check, &sent);
+      }
+      NetDelta::Encode(&encoded, sent.data(), sent.size(), frame > 0 ? prev.data() : nullptr, level);
+      bool ok = NetDelta::Decode(&received, encoded.data(), encoded.size());
+      if (!check.Case(ok && received == sent, "frame %u of %u byte slices at level %d: %s", frame, unsigned(sent.size()), level, ok ? "decoded differently" : "failed to decode"))
+        break;
+      if (frame > 0 && sent.size() >= 0x1000)
+      {
+        deltaBytes += encoded.size();
+        sliceBytes += sent.size();
+      }
+    }
+  }
+  check.End();
+
+  check.Begin("Delta size");
+  double deltaSize = sliceBytes > 0 ? deltaBytes * 100 / sliceBytes : 0;
+  check.Case(deltaSize < 2, "deltas average %.2f%% of the slice size", deltaSize);
+  check.End();
+  printf("  %-32s %8.2f%% of the slice size\n", "Deltas of 4 KB to 16 KB slices", deltaSize);
+
+  check.Begin("All zero and fully changed");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    size_t size = RandomSliceSize(check);
+    int level = levels[check.Bits() % 3];
+    std::vector<uint8_t> zeros(size, 0);
+    std::vector<uint8_t> received;
+
+    // Keyframe of zeros, then a delta with nothing changed
+    NetDelta::Encode(&encoded, zeros.data(), size, nullptr, level);
+    bool ok = NetDelta::Decode(&received, encoded.data(), encoded.size()) && received == zeros;
+    NetDelta::Encode(&encoded, zeros.data(), size, zeros.data(), level);
+    ok = ok && encoded.size() == header && NetDelta::Decode(&received, encoded.data(), encoded.size()) && received == zeros;
+    if (!check.Case(ok, "%u zero bytes at level %d", unsigned(size), level))
+      break;
+
+    // Every byte changed, to a slice of zeros and back
+    std::vector<uint8_t> changed(size);
+    for (uint8_t &b: changed)
+      b = uint8_t(1 + check.Bits() % 255);
+    NetDelta::Encode(&encoded, changed.data(), size, zeros.data(), level);
+    ok = NetDelta::Decode(&received, encoded.data(), encoded.size()) && received == changed;
+    NetDelta::Encode(&encoded, zeros.data(), size, changed.data(), level);
+    ok = ok && NetDelta::Decode(&received, encoded.data(), encoded.size()) && received == zeros;
+    if (!check.Case(ok, "%u bytes fully changed at level %d", unsigned(size), level))
+      break;
+  }
+  check.End();
+
+  check.Begin("Corrupt deltas");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    size_t size = RandomSliceSize(check);
+    std::vector<uint8_t> prev(size);
+    for (uint8_t &b: prev)
+      b = uint8_t(check.Bits());
+    std::vector<uint8_t> data = prev;
+    ChangeSlice(check, &data);
+    size_t at = check.Bits() % size;
+    data[at] = prev[at] ^ uint8_t(1 + check.Bits() % 255);  // at least one byte changed
+    std::vector<uint8_t> received = prev;
+
+    unsigned damage = check.Bits() % 7;
+    switch (damage)
+    {
+    case 0:   // header cut short
+      NetDelta::Encode(&encoded, data.data(), size, prev.data(), 0);
+      encoded.resize(check.Bits() % header);
+      break;
+    case 1:   // another slice size
+      NetDelta::Encode(&encoded, data.data(), size, check.Bits() % 2 ? prev.data() : nullptr, levels[check.Bits() % 3]);
+      encoded[1 + check.Bits() % 4] ^= uint8_t(1 + check.Bits() % 255);
+      break;
+    case 2:   // last run of changed bytes cut short, or a keyframe
+      NetDelta::Encode(&encoded, data.data(), size, check.Bits() % 2 ? prev.data() : nullptr, 0);
+      encoded.pop_back();
+      break;
+    case 3:   // run of unchanged or of changed bytes past the end of the slice
+      NetDelta::Encode(&encoded, data.data(), size, prev.data(), 0);
+      if (check.Bits() % 2)
+      {
+        PutTestVarint(&encoded, size + 1);
+        PutTestVarint(&encoded, 0);
+      }
+      else
+      {
+        PutTestVarint(&encoded, 0);
+        PutTestVarint(&encoded, size + 1);
+        encoded.insert(encoded.end(), size + 1, uint8_t(1));
+      }
+      break;
+    case 4:   // run length cut short
+      NetDelta::Encode(&encoded, data.data(), size, prev.data(), 0);
+      for (unsigned j = 1 + check.Bits() % 5; j > 0; j--)
+        encoded.push_back(uint8_t(0x80 | check.Bits()));
+      break;
+    case 5:   // compressed and cut short
+      std::fill(data.begin(), data.end(), 0);
+      NetDelta::Encode(&encoded, data.data(), size, nullptr, 9);
+      if (encoded[0] & 2)
+        encoded.resize(encoded.size() - 1 - check.Bits() % std::min<size_t>(4, encoded.size() - header));
+      else
+        encoded.resize(0);  // too small to compress
+      break;
+    default:  // applied to a slice of another size
+      NetDelta::Encode(&encoded, data.data(), size, prev.data(), levels[check.Bits() % 3]);
+      received.resize(check.Bits() % 2 || size == 1 ? size + 1 : size - 1);
+      break;
+    }
+    bool ok = NetDelta::Decode(&received, encoded.data(), encoded.size());
+    if (!check.Case(!ok, "damage %u to a delta of %u byte slices was not detected", damage, unsigned(size)))
+      break;
+  }
+  check.End();
+  return check.Result();
+}
+
+
+
+/******************************************************************************
+ ROM Set Identification
+******************************************************************************/
+
+/*
+ * The games found in ROM sets made up from the game definitions (see
+ * GameLoader::CheckFileIndex()) must be the same through the file index as by
+ * checking every file of every game. One case per ROM set.
+ */
+static int RunROMSets(const Options &opts)
+{
+  CKernelCheck check(opts, 0);
+  GameLoader loader(opts.xml);
+  if (loader.GetGames().empty())
+    return ErrorLog("No games defined in '%s'.", opts.xml.c_str());
+
+  check.Begin("File index vs. scan");
+  for (auto &result: loader.CheckFileIndex())
+    check.Case(result.same, "%s: games identified differently", result.rom_set.c_str());
+  check.End();
+  return check.Result();
+}
+
+
+/******************************************************************************
+ Security Board
+******************************************************************************/
+
+static int RunCrypto(const Options &opts)
+{
+  CKernelCheck check(opts, 1000000);
+  CCrypto crypto;
+  UINT32 key = 0;
+  UINT16 subkey = 0;
+
+  check.Begin("Decryption tables");
+  for (UINT64 i = 0; i < check.count; i++)
+  {
+    if (i % 20000 == 0)
+    {
+      key = check.Bits();
+      crypto.Init(key, [](UINT32) { return UINT16(0); });
+      crypto.Reset();
+    }
+    if (i % 100 == 0)
+    {
+      subkey = UINT16(check.Bits());
+      crypto.SetSubKey(subkey);
+    }
+    UINT16 counter = UINT16(check.Bits());
+    UINT16 data = UINT16(check.Bits());
+    UINT16 ref = crypto.DecryptWord(counter, data, true);
+    UINT16 fast = crypto.DecryptWord(counter, data, false);
+    check.Case(ref == fast, "key %08X, subkey %04X, counter %04X, data %04X: %04X vs. %04X", key, subkey, counter, data, ref, fast);
+  }
+  check.End();
+  return check.Result();
+}
+
+
+/******************************************************************************
+ Main
+******************************************************************************/
+
+static void Help(void)
+{
+  puts("Usage: Test_Lockstep ppc|68k|new3d|render2d|scspdsp|scsp|mpeg|mix|ratecontrol|barrier|blockfile|midi|netdelta|romsets|crypto [options]");
+  puts("Options:");
+  puts("  -cycles=<n>        Total cycles to run [Default: 100000000]");
+  puts("  -interval=<n>      Cycles between comparisons [Default: 10000]");
+  puts("  -mode=<mode>       PowerPC path to test: cache or recompiler [Default]");
+  puts("  -state=<file>      Load RAM and PowerPC registers from a save state");
+  puts("  -crom=<file>       Load fixed CROM image (8 MB at 0xFF800000)");
+  puts("  -program=random    Run a random PowerPC program generated from -seed");
+  puts("  -image=<file>      Load 68K program image at address 0");
+  puts("  -trace=<what>      Trace fast path execution: all or branches");
+  puts("  -count=<n>         Random cases per kernel check [Default: per check]");
+  puts("  -seed=<n>          Seed for kernel check inputs and random programs [Default: 1]");
+  puts("  -xml=<file>        Game definitions for romsets [Default: Config/Games.xml]");
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    Help();
+    return 1;
+  }
+
+  Options opts;
+  for (int i = 2; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string name = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (name == "-cycles")
+      opts.cycles = strtoull(value.c_str(), NULL, 0);
+    else if (name == "-interval")
+      opts.interval = std::max(1, atoi(value.c_str()));
+    else if (name == "-mode")
+      opts.mode = value;
+    else if (name == "-state")
+      opts.state = value;
+    else if (name == "-crom")
+      opts.crom = value;
+    else if (name == "-image")
+      opts.image = value;
+    else if (name == "-trace")
+      opts.trace = value;
+    else if (name == "-program")
+      opts.program = value;
+    else if (name == "-count")
+      opts.count = strtoull(value.c_str(), NULL, 0);
+    else if (name == "-seed")
+      opts.seed = UINT32(strtoul(value.c_str(), NULL, 0));
+    else if (name == "-xml")
+      opts.xml = value;
+    else
+    {
+      ErrorLog("Unknown option: %s", arg.c_str());
+      Help();
+      return 1;
+    }
+  }
+
+  std::string what = argv[1];
+  if (what == "ppc")
+    return RunPPC(opts);
+  if (what == "68k")
+    return Run68K(opts);
+  if (what == "new3d")
+    return RunNew3D(opts);
+  if (what == "render2d")
+    return RunRender2D(opts);
+  if (what == "scspdsp")
+    return RunSCSPDSP(opts);
+  if (what == "scsp")
+    return RunSCSP(opts);
+  if (what == "mpeg")
+    return RunMpeg(opts);
+  if (what == "mix")
+    return RunMix(opts);
+  if (what == "ratecontrol")
+    return RunRateControl(opts);
+  if (what == "barrier")
+    return RunBarrier(opts);
+  if (what == "blockfile")
+    return RunBlockFile(opts);
+  if (what == "midi")
+    return RunMIDI(opts);
+  if (what == "netdelta")
+    return RunNetDelta(opts);
+  if (what == "romsets")
+    return RunROMSets(opts);
+  if (what == "crypto")
+    return RunCrypto(opts);
+  Help();
+  return 1;
+}
@@ -41,17 +41,17 @@
 ******************************************************************************/
 
 // Address space access
-#define GetBYTE(a)    ( Bus->Read8(a&0xFFFF) )
-#define GetBYTE_pp(a) ( Bus->Read8(((a)++)&0xFFFF) )
-#define GetBYTE_mm(a) ( Bus->Read8(((a)--)&0xFFFF) )
-#define mm_GetBYTE(a) ( Bus->Read8((--(a))&0xFFFF) )
+#define GetBYTE(a)    ( ReadMem(a&0xFFFF) )
+#define GetBYTE_pp(a) ( ReadMem(((a)++)&0xFFFF) )
+#define GetBYTE_mm(a) ( ReadMem(((a)--)&0xFFFF) )
+#define mm_GetBYTE(a) ( ReadMem((--(a))&0xFFFF) )
 
-#define PutBYTE(a,v)  Bus->Write8((a)&0xFFFF,v)
-#define PutBYTE_pp(a,v) Bus->Write8(((a)++)&0xFFFF,v)
-#define PutBYTE_mm(a,v) Bus->Write8(((a)--)&0xFFFF,v)
-#define mm_PutBYTE(a,v) Bus->Write8((--(a))&0xFFFF,v)
+#define PutBYTE(a,v)  WriteMem((a)&0xFFFF,v)
+#define PutBYTE_pp(a,v) WriteMem(((a)++)&0xFFFF,v)
+#define PutBYTE_mm(a,v) WriteMem(((a)--)&0xFFFF,v)
+#define mm_PutBYTE(a,v) WriteMem((--(a))&0xFFFF,v)
 
-#define GetWORD(a)    (Bus->Read8((a)&0xFFFF) | (Bus->Read8(((a)+1)&0xFFFF)<<8))
+#define GetWORD(a)    (ReadMem((a)&0xFFFF) | (ReadMem(((a)+1)&0xFFFF)<<8))
 
 #define PutWORD(a, v)         \
   do                          \
@@ -60,7 +60,7 @@
     PutBYTE((a)+1,((v)>>8));  \
   } while (0)
 
-#define OUTPUT(a,v)   Bus->IOWrite8((a)&0xFF,v)
+#define OUTPUT(a,v)   ( ++numWrites, Bus->IOWrite8((a)&0xFF,v) )
 #define INPUT(a)    ( Bus->IORead8((a)&0xFF) )
 
 // Flags
@@ -235,6 +235,33 @@ static const unsigned char cycleTables[5][256] = {
  Functions
 *******************************************************************************/
 
+// Mapped pages bypass the bus, except when the debugger is watching it
+inline UINT8 CZ80::ReadMem(unsigned addr)
+{
+  const UINT8 *page = readMap[addr>>8];
+#ifdef SUPERMODEL_DEBUGGER
+  if (page != NULL && Debug == NULL)
+#else
+  if (page != NULL)
+#endif // SUPERMODEL_DEBUGGER
+    return page[addr&0xFF];
+  return Bus->Read8(addr);
+}
+
+inline void CZ80::WriteMem(unsigned addr, UINT8 data)
+{
+  ++numWrites;
+  UINT8 *page = writeMap[addr>>8];
+#ifdef SUPERMODEL_DEBUGGER
+  if (page != NULL && Debug == NULL)
+#else
+  if (page != NULL)
+#endif // SUPERMODEL_DEBUGGER
+    page[addr&0xFF] = data;
+  else
+    Bus->Write8(addr, data);
+}
+
 int CZ80::Run(int numCycles)
 {
 #ifdef SUPERMODEL_DEBUGGER
@@ -265,10 +292,19 @@ int CZ80::Run(int numCycles)
 
   int cycles = numCycles;
 #ifdef SUPERMODEL_DEBUGGER
+  // Leave an attached debugger out of the timeslice, with direct memory accesses, unless it needs to watch execution
+  Debugger::CZ80Debug *attachedDebug = Debug;
+  IBus *watchedBus = Bus;
   if (Debug != NULL)
   {
     Debug->CPUActive();
-    lastCycles += numCycles;
+    if (Debug->NeedsHooks())
+      lastCycles += numCycles;
+    else
+    {
+      Debug = NULL;
+      Bus = unwatchedBus;
+    }
   }
 #endif // SUPERMODEL_DEBUGGER
 
@@ -3773,10 +3809,13 @@ int CZ80::Run(int numCycles)
   // write registers back to context
 HALTExit: 
 #ifdef SUPERMODEL_DEBUGGER
-  if (Debug != NULL)
+  if (attachedDebug != NULL)
   {
+    if (Debug != NULL)
+      lastCycles -= cycles;
+    Debug = attachedDebug;
+    Bus = watchedBus;
     Debug->CPUInactive();
-    lastCycles -= cycles;
   }
 #else
   // Save local copies of Z80 registers back to context
@@ -3793,6 +3832,63 @@ HALTExit:
     return numCycles - cycles;
 }
 
+/*
+ * Wait loop detection: one probe per IDLE_PROBE_CYCLES, and a loop is assumed
+ * once IDLE_CONFIRMATIONS successive probes find the same register state with
+ * no writes in between and the PC within IDLE_LOOP_BYTES of where it was.
+ */
+#define IDLE_PROBE_CYCLES   256
+#define IDLE_LOOP_BYTES     16
+#define IDLE_CONFIRMATIONS  2
+
+int CZ80::RunIdleSkip(int numCycles, UINT64 *idleCycles)
+{
+  if (numCycles <= (IDLE_CONFIRMATIONS+1)*IDLE_PROBE_CYCLES)
+    return Run(numCycles);
+
+  UINT16  ref[13], cur[13];
+  UINT16  refPC = 0;
+  bool    haveRef = false;
+  int     matches = 0;
+  int     done = 0;
+  while (done < numCycles)
+  {
+    UINT32 writes = numWrites;
+    int ran = Run(std::min(IDLE_PROBE_CYCLES, numCycles - done));
+    done += ran;
+    if (writes != numWrites || ran == 0)  // ran == 0 on HALT
+    {
+      haveRef = false;
+      if (ran == 0)
+        break;
+      continue;
+    }
+
+    cur[0] = af[0];         cur[1] = af[1];
+    cur[2] = regs[0].bc;    cur[3] = regs[0].de;    cur[4] = regs[0].hl;
+    cur[5] = regs[1].bc;    cur[6] = regs[1].de;    cur[7] = regs[1].hl;
+    cur[8] = ix;            cur[9] = iy;            cur[10] = sp;
+    cur[11] = (UINT16) ((regs_sel << 9) | (af_sel << 8) | iff);
+    cur[12] = im;
+    if (haveRef && !memcmp(cur, ref, sizeof(ref)) && (UINT16) (pc - refPC + IDLE_LOOP_BYTES) < 2*IDLE_LOOP_BYTES)
+    {
+      if (++matches >= IDLE_CONFIRMATIONS && done < numCycles)
+      {
+        *idleCycles += numCycles - done;
+        return numCycles;
+      }
+    }
+    else
+    {
+      memcpy(ref, cur, sizeof(ref));
+      refPC = pc;
+      haveRef = true;
+      matches = 0;
+    }
+  }
+  return done;
+}
+
 void CZ80::TriggerNMI(void)
 {
   nmiTrigger = true;
@@ -3978,6 +4074,28 @@ void CZ80::Init(IBus *BusPtr, int (*INTF)(CZ80 *Z80))
 {
   Bus = BusPtr;
   INTCallback = INTF;
+  UnmapMemory();
+}
+
+void CZ80::MapReadMemory(UINT32 start, UINT32 end, const UINT8 *ptr)
+{
+  for (UINT32 page = start >> 8; page <= ((end >> 8) & 0xFF); page++)
+    readMap[page] = ptr + ((page << 8) - start);
+}
+
+void CZ80::MapWriteMemory(UINT32 start, UINT32 end, UINT8 *ptr)
+{
+  for (UINT32 page = start >> 8; page <= ((end >> 8) & 0xFF); page++)
+    writeMap[page] = ptr + ((page << 8) - start);
+}
+
+void CZ80::UnmapMemory(void)
+{
+  for (int page = 0; page < 256; page++)
+  {
+    readMap[page] = NULL;
+    writeMap[page] = NULL;
+  }
 }
 
 #ifdef SUPERMODEL_DEBUGGER
@@ -3986,6 +4104,7 @@ void CZ80::AttachDebugger(Debugger::CZ80Debug *DebugPtr)
   if (Debug != NULL)
     DetachDebugger();
   Debug = DebugPtr;
+  unwatchedBus = Bus;
   Bus = Debug->AttachBus(Bus);
 }
 
@@ -3995,6 +4114,7 @@ void CZ80::DetachDebugger()
     return;
   Bus = Debug->DetachBus();
   Debug = NULL;
+  unwatchedBus = NULL;
 }
 #endif //SUPERMODEL_DEBUGGER
 
@@ -4002,8 +4122,11 @@ CZ80::CZ80(void)
 {
   INTCallback = NULL; // so we can later check to see if one has been installed
   Bus = NULL;
+  UnmapMemory();
+  numWrites = 0;
 #ifdef SUPERMODEL_DEBUGGER
   Debug = NULL;
+  unwatchedBus = NULL;
 #endif //SUPERMODEL_DEBUGGER
 }
 
@@ -123,7 +123,26 @@ public:
    * Returns:
    *    Number of instruction cycles actually executed.
    */
-  int Run(int numCycles);
+int Run(int numCycles);
+
+  /*
+   * RunIdleSkip(numCycles, idleCycles):
+   *
+   * Runs the Z80 like Run() but stops early once it has settled into a wait
+   * loop: several successive short probes in which it wrote nothing to memory
+   * or IO ports, left all registers unchanged, and stayed within a few bytes
+   * of code. The remaining cycles are then treated as executed. Interrupts
+   * should only be raised between calls.
+   *
+   * Parameters:
+   *    numCycles   Number of instruction cycles to execute.
+   *    idleCycles  Incremented by the number of cycles skipped.
+   *
+   * Returns:
+   *    Number of instruction cycles executed, including any skipped.
+   */
+  int RunIdleSkip(int numCycles, UINT64 *idleCycles);
+  
   
   /*
    * TriggerNMI(void):
@@ -279,6 +298,31 @@ public:
    */
   void Init(IBus *BusPtr, int (*INTF)(CZ80 *Z80));
 
+  /*
+   * MapReadMemory(start, end, ptr):
+   * MapWriteMemory(start, end, ptr):
+   *
+   * Maps a region of plain ROM or RAM so that the Z80 accesses it directly
+   * instead of through the bus, avoiding a virtual call per byte. Regions
+   * are handled in 256-byte pages: start must be page aligned and end must
+   * be the last byte of a page. Accesses to unmapped pages go to the bus.
+   * Only map memory that has no side effects when accessed.
+   *
+   * Parameters:
+   *    start First Z80 address of the region.
+   *    end   Last Z80 address of the region (inclusive).
+   *    ptr   Pointer to the memory corresponding to start.
+   */
+  void MapReadMemory(UINT32 start, UINT32 end, const UINT8 *ptr);
+  void MapWriteMemory(UINT32 start, UINT32 end, UINT8 *ptr);
+
+  /*
+   * UnmapMemory(void):
+   *
+   * Removes all direct memory mappings. All accesses then go to the bus.
+   */
+  void UnmapMemory(void);
+
 #ifdef SUPERMODEL_DEBUGGER
   /*
    * AttachDebugger(DebugPtr):
@@ -324,6 +368,16 @@ private:
   
   // Memory and IO bus
   IBus  *Bus;
+
+  // Direct memory map, one entry per 256-byte page (NULL: use bus)
+  const UINT8 *readMap[256];
+  UINT8       *writeMap[256];
+
+  inline UINT8 ReadMem(unsigned addr);
+  inline void  WriteMem(unsigned addr, UINT8 data);
+
+  // Memory and IO writes performed so far (for wait loop detection)
+  UINT32  numWrites;
   
   // Interrupts
   bool  nmiTrigger;
@@ -332,7 +386,8 @@ private:
 
 #ifdef SUPERMODEL_DEBUGGER
   int   lastCycles;
-  Debugger::CZ80Debug *Debug;
+  Debugger::CZ80Debug *Debug;   // attached debugger, or NULL while it is not watching execution
+  IBus  *unwatchedBus;          // bus the debugger watches, used directly while it is not
 #endif // SUPERMODEL_DEBUGGER
 };
 
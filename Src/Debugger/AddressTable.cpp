@@ -19,8 +19,8 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-/*
- * AddressTable.cpp
+/*
+ * AddressTable.cpp
  */
 
 #ifdef SUPERMODEL_DEBUGGER
@@ -143,6 +143,43 @@ namespace Debugger
 		CheckAndReleaseTable(tableIndex);
 		return removed;
 	}
+
+	CPageBitmap::CPageBitmap()
+	{
+		memset(m_tableBits, 0, sizeof(m_tableBits));
+		memset(m_pageBits, 0, sizeof(m_pageBits));
+	}
+
+	void CPageBitmap::Clear()
+	{
+		// Only the tables with pages set need clearing
+		for (unsigned i = 0; i < NUM_TABLES / 64; i++)
+		{
+			for (UINT64 bits = m_tableBits[i]; bits != 0; bits &= bits - 1)
+			{
+				unsigned bit = 0;
+				while (!((bits >> bit) & 1))
+					bit++;
+				m_pageBits[i * 64 + bit] = 0;
+			}
+			m_tableBits[i] = 0;
+		}
+	}
+
+	void CPageBitmap::Add(UINT32 addr, UINT32 size)
+	{
+		if (size == 0)
+			return;
+		UINT64 lastPage = (UINT64(addr) + size - 1) >> PAGE_WIDTH;
+		if (lastPage >= (0x100000000ULL >> PAGE_WIDTH))
+			lastPage = (0x100000000ULL >> PAGE_WIDTH) - 1;
+		for (UINT64 page = addr >> PAGE_WIDTH; page <= lastPage; page++)
+		{
+			UINT32 tableIndex = UINT32(page >> (TABLE_WIDTH - PAGE_WIDTH));
+			m_tableBits[tableIndex >> 6] |= UINT64(1) << (tableIndex & 63);
+			m_pageBits[tableIndex] |= UINT16(1 << (page & (PAGES_PER_TABLE - 1)));
+		}
+	}
 }
 
 #endif  // SUPERMODEL_DEBUGGER
@@ -19,8 +19,8 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-/*
- * AddressTable.h
+/*
+ * AddressTable.h
  */
 
 #ifdef SUPERMODEL_DEBUGGER
@@ -37,6 +37,8 @@
 #define TABLE_MASK (TABLE_SIZE - 1)
 #define INDEX_SHIFT TABLE_WIDTH
 #define NUM_TABLES (0x100000000ULL / TABLE_SIZE)
+#define PAGE_WIDTH 12
+#define PAGES_PER_TABLE (1 << (TABLE_WIDTH - PAGE_WIDTH))
 
 namespace Debugger
 {
@@ -95,6 +97,30 @@ namespace Debugger
 		bool Remove(CAddressRef *value);
 	};
 
+	/*
+	 * Two-level bitmap of the 4 KB pages of the address space that hold anything of interest, such as watches or breakpoints, so
+	 * that the common case of an address with nothing there is ruled out by a bit test before any table is looked at.  The first
+	 * level has a bit per 64 KB table and is small enough to stay in the cache.  It is rebuilt whenever what it covers changes.
+	 */
+	class CPageBitmap
+	{
+	private:
+		UINT64 m_tableBits[NUM_TABLES / 64];
+		UINT16 m_pageBits[NUM_TABLES];
+
+	public:
+		CPageBitmap();
+
+		void Clear();
+
+		void Add(UINT32 addr, UINT32 size = 1);
+
+		bool Test(UINT32 addr);
+
+		// True if any of the pages of an access of up to 4 KB may hold something
+		bool Test(UINT32 addr, UINT32 size);
+	};
+
 	//
 	// Inlined methods
 	//
@@ -113,6 +139,17 @@ namespace Debugger
 		return m_tables[tableIndex];
 	}
 
+	inline bool CPageBitmap::Test(UINT32 addr)
+	{
+		UINT32 tableIndex = addr >> INDEX_SHIFT;
+		return ((m_tableBits[tableIndex >> 6] >> (tableIndex & 63)) & 1) && ((m_pageBits[tableIndex] >> ((addr >> PAGE_WIDTH) & (PAGES_PER_TABLE - 1))) & 1);
+	}
+
+	inline bool CPageBitmap::Test(UINT32 addr, UINT32 size)
+	{
+		return Test(addr) || Test(addr + size - 1);
+	}
+
 	inline CAddressRef *CAddressTable::Get(UINT32 addr)
 	{
 		int tableIndex;
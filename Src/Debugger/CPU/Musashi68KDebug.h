@@ -86,6 +86,14 @@ namespace Debugger
 
 		void DetachFromCPU();
 
+		/*
+		 * Returns the bus the debugger watches, which the CPU uses directly while the debugger does not need to see its accesses.
+		 */
+		::IBus *GetUnwatchedBus()
+		{
+			return m_bus;
+		}
+
 		UINT32 GetResetAddr();
 
 		bool UpdatePC(UINT32 pc);
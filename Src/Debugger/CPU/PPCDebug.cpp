@@ -19,8 +19,8 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-/*
- * PPCDebug.cpp
+/*
+ * PPCDebug.cpp
  */
 
 #ifdef SUPERMODEL_DEBUGGER
@@ -119,7 +119,7 @@ namespace Debugger
 		AddAddrRegister("lr", srGroup, PPCSPECIAL_LR, GetSpecialReg, SetSpecialReg);
 
 		// SPR registers
-		AddInt32Register   ("ctr",  srGroup, SPR_LR,         GetSPR, SetSPR);
+		AddInt32Register   ("ctr",  srGroup, SPR_CTR,        GetSPR, SetSPR);
 		AddInt32Register   ("xer",  srGroup, SPR_XER,        GetSPR, SetSPR);
 		//AddStatus32Register("xer",  srGroup, SPR_XER,  "SOC", GetSPR, SetSPR);  //TODO: bit mapping is wrong
 		AddInt32Register   ("srr0", srGroup, SPR_SRR0,       GetSPR, SetSPR);
@@ -322,6 +322,14 @@ namespace Debugger
 			return -4;
 	}
 
+	int CPPCDebug::GetOpLength(UINT32 addr)
+	{
+		// Decode instruction without formatting its operands, which involves looking up labels
+		char mnemonic[255];
+		char operands[255];
+		return ::DisassemblePowerPC(m_bus->Read32(addr), addr, mnemonic, operands, true) ? -4 : 4;
+	}
+
 	EOpFlags CPPCDebug::GetOpFlags(UINT32 addr, UINT32 opcode)
 	{
 		EOpFlags opFlags;
@@ -496,6 +504,12 @@ namespace Debugger
 		return true;
 	}
 
+	bool CPPCDebug::CanAnalyseConcurrently()
+	{
+		// Decoding only reads memory, which is RAM or CROM in code regions
+		return true;
+	}
+
 	// IBus methods
 
 	UINT8 CPPCDebug::Read8(UINT32 addr)
@@ -19,8 +19,8 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-/*
- * PPCDebug.h
+/*
+ * PPCDebug.h
  */
 
 #ifdef SUPERMODEL_DEBUGGER
@@ -81,6 +81,8 @@ namespace Debugger
 		bool WriteMem(UINT32 addr, unsigned dataSize, UINT64 data);
 
 		int Disassemble(UINT32 addr, char *mnemonic, char *operands);
+
+		int GetOpLength(UINT32 addr);
 		
 		EOpFlags GetOpFlags(UINT32 addr, UINT32 opcode);
 
@@ -94,6 +96,8 @@ namespace Debugger
 
 		bool GetHandlerAddr(CInterrupt *in, UINT32 &handlerAddr);
 
+		bool CanAnalyseConcurrently();
+
 		// IBus methods
 		
 		UINT8 Read8(UINT32 addr);
@@ -19,8 +19,8 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-/*
- * CPUDebug.cpp
+/*
+ * CPUDebug.cpp
  */
 
 #ifdef SUPERMODEL_DEBUGGER
@@ -44,7 +44,8 @@ namespace Debugger
 		addrFmt(HexDollar), portFmt(Decimal), dataFmt(HexDollar), debugger(NULL), 
 		numExCodes(0), numIntCodes(0), numPorts(0), memSize(0), active(false), instrCount(0), totalCycles(0), cyclesPerPoll(0), pc(0), opcode(0),
 		m_enabled(true), m_break(false), m_breakUser(false), m_halted(false), m_step(false), m_steppingOver(false), m_steppingOut(false), 
-		m_count(0), m_until(false), m_untilAddr(0),
+		m_count(0), m_until(false), m_untilAddr(0), m_execPagesOnly(false),
+		m_profileInterval(0), m_profileNextCycles(~(UINT64)0), m_profileCount(0),
 		m_mappedIOTable(NULL), m_memWatchTable(NULL), m_bpTable(NULL), m_numRegMons(0), m_regMonArray(NULL),
 		m_analyser(NULL), m_stateUpdated(false), m_exRaised(NULL), m_exTrapped(NULL), m_intRaised(NULL), m_intTrapped(NULL), m_bpReached(NULL), 
 		m_memWatchTriggered(NULL), m_ioWatchTriggered(NULL), m_regMonTriggered(NULL), m_prevTotalCycles(0)
@@ -902,6 +903,7 @@ namespace Debugger
 
 	void CCPUDebug::UpdateExecMasks()
 	{
+		m_execPagesOnly = false;
 		if (!m_enabled)
 		{
 			m_execAndMask = 0xFFFFFFFF;
@@ -914,21 +916,26 @@ namespace Debugger
 		}
 		else if (bps.size() > 0 || m_until)
 		{
+			// Only the pages with breakpoints or the address to run until need checking
 			UINT32 andMask = 0xFFFFFFFF;
 			UINT32 orMask = 0;
+			m_execPages.Clear();
 			for (vector<CBreakpoint*>::iterator it = bps.begin(), end = bps.end(); it != end; it++)
 			{
 				UINT32 addr = (*it)->addr;
 				andMask &= addr;
 				orMask |= addr;
+				m_execPages.Add(addr);
 			}
 			if (m_until)
 			{
 				andMask &= m_untilAddr;
 				orMask |= m_untilAddr;
+				m_execPages.Add(m_untilAddr);
 			}
 			m_execAndMask = andMask;
 			m_execOrMask = ~orMask;
+			m_execPagesOnly = true;
 		}
 		else
 		{
@@ -947,12 +954,14 @@ namespace Debugger
 		UINT32 or16Mask = 0;
 		UINT32 or32Mask = 0;
 		UINT32 or64Mask = 0;
+		m_memPages.Clear();
 		for (vector<CIO*>::iterator it = ios.begin(), end = ios.end(); it != end; it++)
 		{
 			CMappedIO *mapped = dynamic_cast<CMappedIO*>(*it);
 			if (!mapped)
 				continue;
 			UINT32 addr = mapped->addr;
+			m_memPages.Add(addr, mapped->size);
 			CRegion *region = GetRegion(addr);
 			int intSize = (int)mapped->size;
 			for (int offset = -7; offset < intSize; offset++)
@@ -993,6 +1002,7 @@ namespace Debugger
 		for (vector<CWatch*>::iterator it = memWatches.begin(), end = memWatches.end(); it != end; it++)
 		{
 			UINT32 addr = (*it)->addr;
+			m_memPages.Add(addr, (*it)->size);
 			CRegion *region = GetRegion(addr);
 			int intSize = (int)(*it)->size;
 			for (int offset = -7; offset < intSize; offset++)
@@ -1207,6 +1217,41 @@ namespace Debugger
 		return m_analyser;
 	}
 
+	void CCPUDebug::StartProfile(UINT64 cyclesPerSample)
+	{
+		m_profileSamples.clear();
+		m_profileCount = 0;
+		m_profileInterval = max<UINT64>(1, cyclesPerSample);
+		m_profileNextCycles = totalCycles + m_profileInterval;
+	}
+
+	void CCPUDebug::StopProfile()
+	{
+		m_profileNextCycles = ~(UINT64)0;
+	}
+
+	bool CCPUDebug::IsProfiling()
+	{
+		return m_profileNextCycles != ~(UINT64)0;
+	}
+
+	UINT64 CCPUDebug::GetProfileSampleCount()
+	{
+		return m_profileCount;
+	}
+
+	const map<UINT32,UINT64> &CCPUDebug::GetProfileSamples()
+	{
+		return m_profileSamples;
+	}
+
+	void CCPUDebug::SampleProfile()
+	{
+		m_profileSamples[pc]++;
+		m_profileCount++;
+		m_profileNextCycles = totalCycles + m_profileInterval;
+	}
+
 	bool CCPUDebug::FindInMem(UINT32 start, UINT32 end, const char *str, bool matchCase, UINT32 &findAddr)
 	{
 		size_t len = strlen(str);
@@ -1483,6 +1528,27 @@ namespace Debugger
 #endif // DEBUGGER_HASTHREAD
 	}
 
+	bool CCPUDebug::NeedsHooks()
+	{
+		if (!m_enabled)
+			return false;
+		if (m_break || m_stateUpdated || m_step || m_count > 0 || m_until || m_numRegMons > 0 || IsProfiling())
+			return true;
+		if (bps.size() > 0 || memWatches.size() > 0 || ioWatches.size() > 0)
+			return true;
+		for (vector<CException*>::iterator it = exceps.begin(); it != exceps.end(); it++)
+		{
+			if ((*it)->trap)
+				return true;
+		}
+		for (vector<CInterrupt*>::iterator it = inters.begin(); it != inters.end(); it++)
+		{
+			if ((*it)->trap)
+				return true;
+		}
+		return false;
+	}
+
 	void CCPUDebug::WaitCommand(EHaltReason reason)
 	{
 #ifdef DEBUGGER_HASTHREAD
@@ -1645,6 +1711,12 @@ namespace Debugger
 	{
 		return (UINT32)ReadMem(addr, min<int>(4, minInstrLen));
 	}
+
+	bool CCPUDebug::CanAnalyseConcurrently()
+	{
+		// Default is to assume disassembly uses shared state
+		return false;
+	}
 }
 
 #endif  // SUPERMODEL_DEBUGGER
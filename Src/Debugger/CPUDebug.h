@@ -29,19 +29,20 @@
 
 #include <stdio.h>
 #include <vector>
+#include <map>
 #include <algorithm>
 
 #include "Types.h"
 #include "CodeAnalyser.h"
 #include "AddressTable.h"
 #include "Breakpoint.h"
-#include "Debugger.h"
-#include "Exception.h"
-#include "Interrupt.h"
-#include "DebuggerIO.h"
-#include "Register.h"
-#include "Watch.h"
-
+#include "Debugger.h"
+#include "Exception.h"
+#include "Interrupt.h"
+#include "DebuggerIO.h"
+#include "Register.h"
+#include "Watch.h"
+
 #ifdef DEBUGGER_HASBLOCKFILE
 #include "BlockFile.h"
 #endif // DEBUGGER_HASBLOCKFILE
@@ -119,6 +120,14 @@ namespace Debugger
 		UINT32 m_mem32OrMask;
 		UINT32 m_mem64AndMask;
 		UINT32 m_mem64OrMask;
+		bool m_execPagesOnly;				// whether only breakpoints and running until an address need checking
+		CPageBitmap m_execPages;			// pages with breakpoints or the address to run until
+		CPageBitmap m_memPages;				// pages with mapped I/O or memory watches
+
+		UINT64 m_profileInterval;			// cycles between profiler samples
+		UINT64 m_profileNextCycles;			// total cycles at which to take next sample (all ones when not profiling)
+		UINT64 m_profileCount;
+		std::map<UINT32,UINT64> m_profileSamples;	// number of samples taken at each pc
 
 #ifdef DEBUGGER_HASTHREAD
 		CMutex *m_mutex;
@@ -161,6 +170,8 @@ namespace Debugger
 		void UpdateMemMasks();
 
 		bool CheckExecute(UINT32 newPC, UINT32 newOpcode, UINT32 lastCycles);
+
+		void SampleProfile();
 		
 	protected:
 		CCodeAnalyser *m_analyser;
@@ -375,6 +386,13 @@ namespace Debugger
 		 */
 		virtual void CPUInterrupt(UINT16 intCode);
 
+		/*
+		 * Should be called by CPU before it runs a timeslice.  Returns true if the CPU must report every instruction, memory access and
+		 * exception to the debugger, ie when execution is to break, is being stepped, counted or profiled, or there are breakpoints,
+		 * watches, register monitors or traps.  Otherwise, the CPU may run that timeslice without the debugger, at full speed.
+		 */
+		bool NeedsHooks();
+
 		void WaitCommand(EHaltReason reason);
 
 #ifdef DEBUGGER_HASTHREAD
@@ -549,6 +567,23 @@ namespace Debugger
 
 		CCodeAnalyser *GetCodeAnalyser();
 
+		//
+		// Sampling profiler
+		//
+
+		/*
+		 * Starts sampling the pc every given number of emulated cycles, discarding any previous samples.
+		 */
+		void StartProfile(UINT64 cyclesPerSample);
+
+		void StopProfile();
+
+		bool IsProfiling();
+
+		UINT64 GetProfileSampleCount();
+
+		const std::map<UINT32,UINT64> &GetProfileSamples();
+
 		//
 		// Memory searching
 		//
@@ -607,6 +642,10 @@ namespace Debugger
 		virtual bool GetHandlerAddr(CException *ex, UINT32 &handlerAddr) = 0;
 
 		virtual bool GetHandlerAddr(CInterrupt *in, UINT32 &handlerAddr) = 0;
+
+		// Returns true if GetOpLength, GetOpcode, GetOpFlags and GetJumpAddr may be called from several threads at once while the
+		// CPU is halted, so that code analysis can be split between them
+		virtual bool CanAnalyseConcurrently();
 	};
 
 	//
@@ -756,7 +795,7 @@ namespace Debugger
 
 	inline void CCPUDebug::CheckRead8(UINT32 addr, UINT8 data)
 	{
-		if ((addr&m_mem8AndMask) != m_mem8AndMask || (addr&m_mem8OrMask) != 0)
+		if ((addr&m_mem8AndMask) != m_mem8AndMask || (addr&m_mem8OrMask) != 0 || !m_memPages.Test(addr))
 			return;
 
 		// Check if reading from mapped I/O address
@@ -781,25 +820,25 @@ namespace Debugger
 
 	inline void CCPUDebug::CheckRead16(UINT32 addr, UINT16 data)
 	{
-		if ((addr&m_mem16AndMask) == m_mem16AndMask && (addr&m_mem16OrMask) == 0)
+		if ((addr&m_mem16AndMask) == m_mem16AndMask && (addr&m_mem16OrMask) == 0 && m_memPages.Test(addr, 2))
 			CheckRead(addr, 2, data);
 	}
 
 	inline void CCPUDebug::CheckRead32(UINT32 addr, UINT32 data)
 	{
-		if ((addr&m_mem32AndMask) == m_mem32AndMask && (addr&m_mem32OrMask) == 0)
+		if ((addr&m_mem32AndMask) == m_mem32AndMask && (addr&m_mem32OrMask) == 0 && m_memPages.Test(addr, 4))
 			CheckRead(addr, 4, data);
 	}
 
 	inline void CCPUDebug::CheckRead64(UINT32 addr, UINT64 data)
 	{
-		if ((addr&m_mem64AndMask) == m_mem64AndMask && (addr&m_mem64OrMask) == 0)
+		if ((addr&m_mem64AndMask) == m_mem64AndMask && (addr&m_mem64OrMask) == 0 && m_memPages.Test(addr, 8))
 			CheckRead(addr, 8, data);
 	}
 
 	inline void CCPUDebug::CheckWrite8(UINT32 addr, UINT8 data)
 	{
-		if ((addr&m_mem8AndMask) != m_mem8AndMask || (addr&m_mem8OrMask) != 0)
+		if ((addr&m_mem8AndMask) != m_mem8AndMask || (addr&m_mem8OrMask) != 0 || !m_memPages.Test(addr))
 			return;
 
 		// Check if writing to mapped I/O address
@@ -824,19 +863,19 @@ namespace Debugger
 
 	inline void CCPUDebug::CheckWrite16(UINT32 addr, UINT16 data)
 	{
-		if ((addr&m_mem16AndMask) == m_mem16AndMask && (addr&m_mem16OrMask) == 0)
+		if ((addr&m_mem16AndMask) == m_mem16AndMask && (addr&m_mem16OrMask) == 0 && m_memPages.Test(addr, 2))
 			CheckWrite(addr, 2, data);
 	}
 
 	inline void CCPUDebug::CheckWrite32(UINT32 addr, UINT32 data)
 	{
-		if ((addr&m_mem32AndMask) == m_mem32AndMask && (addr&m_mem32OrMask) == 0)
+		if ((addr&m_mem32AndMask) == m_mem32AndMask && (addr&m_mem32OrMask) == 0 && m_memPages.Test(addr, 4))
 			CheckWrite(addr, 4, data);
 	}
 
 	inline void CCPUDebug::CheckWrite64(UINT32 addr, UINT64 data)
 	{
-		if ((addr&m_mem64AndMask) == m_mem64AndMask && (addr&m_mem64OrMask) == 0)
+		if ((addr&m_mem64AndMask) == m_mem64AndMask && (addr&m_mem64OrMask) == 0 && m_memPages.Test(addr, 8))
 			CheckWrite(addr, 8, data);
 	}
 
@@ -861,7 +900,7 @@ namespace Debugger
 	inline bool CCPUDebug::CPUExecute(UINT32 newPC, UINT32 newOpcode, UINT32 lastCycles)
 	{
 		// Check if should check execution flow
-		if ((newPC&m_execAndMask) == m_execAndMask && (newPC&m_execOrMask) == 0)
+		if ((newPC&m_execAndMask) == m_execAndMask && (newPC&m_execOrMask) == 0 && (!m_execPagesOnly || m_execPages.Test(newPC)))
 			return CheckExecute(newPC, newOpcode, lastCycles);
 		else
 		{
@@ -870,6 +909,8 @@ namespace Debugger
 			totalCycles += lastCycles;
 			pc = newPC;
 			opcode = newOpcode;		
+			if (totalCycles >= m_profileNextCycles)
+				SampleProfile();
 			return false;
 		}
 	}
@@ -901,6 +942,8 @@ namespace Debugger
 			totalCycles += lastCycles;
 			pc = newPC;
 			opcode = newOpcode;		
+			if (totalCycles >= m_profileNextCycles)
+				SampleProfile();
 
 			// Next check for breakpoints at new pc and opcode
 			if (m_bpTable != NULL)
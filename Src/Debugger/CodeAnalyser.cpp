@@ -19,8 +19,8 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-/*
- * CodeAnalyser.cpp
+/*
+ * CodeAnalyser.cpp
  */
 
 #ifdef SUPERMODEL_DEBUGGER
@@ -31,9 +31,18 @@
 
 #include <cctype>
 #include <string>
+#include <zlib.h>
 
 using namespace std;
 
+// Address indices are split into pages of 2^CODEANALYSER_PAGE_BITS indices, which are hashed to find code that has changed
+#define CODEANALYSER_PAGE_BITS 10
+
+// Number of code blocks an analysis job walks before handing the rest of its work back to be shared out again
+#define CODEANALYSER_BLOCKS_PER_JOB 256
+
+#define CODEANALYSER_CACHE_VERSION 1
+
 namespace Debugger
 {
 	CEntryPoint::CEntryPoint(const CEntryPoint &other) : addr(other.addr), autoFlag(other.autoFlag)
@@ -162,6 +171,11 @@ namespace Debugger
 		if (index == -1)
 			return;
 		flags = (ELabelFlags)((unsigned)flags | (unsigned)flag);
+		// Keep existing sub-label rather than creating default one again for every jump to same address
+		if (subLabel == NULL && m_subLabels[index] != NULL)
+			return;
+		if (m_subLabels[index] != NULL)
+			delete[] m_subLabels[index];
 		if (subLabel != NULL)
 		{
 			size_t len = strlen(subLabel);
@@ -228,20 +242,22 @@ namespace Debugger
 		//
 	}
 
-	CCodeAnalysis::CCodeAnalysis(CCodeAnalyser *aAnalyser, unsigned aTotalIndices, vector<CEntryPoint> &entryPoints, vector<UINT32> &unseenEntryAddrs) : 
+	CCodeAnalysis::CCodeAnalysis(CCodeAnalyser *aAnalyser, unsigned aTotalIndices, unsigned aTotalPages, vector<CEntryPoint> &entryPoints, 
+		vector<UINT32> &unseenEntryAddrs) : 
 		analyser(aAnalyser), m_entryPoints(entryPoints), m_unseenEntryAddrs(unseenEntryAddrs), 
-		m_seenIndices(aTotalIndices), m_validIndices(aTotalIndices), m_acquired(0)
+		m_indexFlags(aTotalIndices), m_pageHashes(aTotalPages), m_hashedPages(aTotalPages), m_acquired(0)
 	{
 		//
 	}
 
 	CCodeAnalysis::CCodeAnalysis(CCodeAnalysis *oldAnalysis, vector<CEntryPoint> &entryPoints, vector<UINT32> &unseenEntryAddrs) :
 		analyser(oldAnalysis->analyser), m_entryPoints(entryPoints), m_unseenEntryAddrs(unseenEntryAddrs), 
-		m_seenIndices(oldAnalysis->m_seenIndices), m_validIndices(oldAnalysis->m_validIndices), 
-		m_autoLabelsMap(oldAnalysis->m_autoLabelsMap), m_acquired(0), validIndexSet(oldAnalysis->validIndexSet)
+		m_indexFlags(oldAnalysis->m_indexFlags.size()), m_flows(oldAnalysis->m_flows), 
+		m_pageHashes(oldAnalysis->m_pageHashes), m_hashedPages(oldAnalysis->m_hashedPages), m_acquired(0)
 	{
-		for (map<unsigned,CAutoLabel*>::iterator it = m_autoLabelsMap.begin(); it != m_autoLabelsMap.end(); it++)
-			it->second->Acquire();
+		// Auto-labels are created again from entry points and flows once analysis is finished
+		for (size_t index = 0; index < m_indexFlags.size(); index++)
+			m_indexFlags[index].store(oldAnalysis->m_indexFlags[index].load(memory_order_relaxed), memory_order_relaxed);
 	}
 
 	CCodeAnalysis::~CCodeAnalysis()
@@ -284,26 +300,27 @@ namespace Debugger
 			return false;
 		if (IsIndexValid(index))
 			return true;
-		set<unsigned>::iterator it = validIndexSet.lower_bound(index);
-		if (it == validIndexSet.end())
+		if (!GetNextValidIndex(index))
 			return false;
-		return analyser->GetAddrOfIndex(*it, addr);
+		return analyser->GetAddrOfIndex(index, addr);
 	}
 
 	bool CCodeAnalysis::IsIndexValid(unsigned index)
 	{
-		return index < m_validIndices.size() && m_validIndices[index];
+		return index < m_indexFlags.size() && (m_indexFlags[index].load(memory_order_relaxed) & IFValid);
 	}
 
 	bool CCodeAnalysis::GetNextValidIndex(unsigned &index)
 	{
-		if (IsIndexValid(index))
-			return true;
-		set<unsigned>::iterator it = validIndexSet.lower_bound(index);
-		if (it == validIndexSet.end())
-			return false;
-		index = *it;
-		return true;
+		for (unsigned i = index; i < m_indexFlags.size(); i++)
+		{
+			if (m_indexFlags[i].load(memory_order_relaxed) & IFValid)
+			{
+				index = i;
+				return true;
+			}
+		}
+		return false;
 	}
 
 	bool CCodeAnalysis::HasSeenAddr(UINT32 addr)
@@ -316,7 +333,7 @@ namespace Debugger
 
 	bool CCodeAnalysis::HaveSeenIndex(unsigned index)
 	{
-		return index < m_seenIndices.size() && m_seenIndices[index];
+		return index < m_indexFlags.size() && (m_indexFlags[index].load(memory_order_relaxed) & IFSeen);
 	}
 
 	CAutoLabel *CCodeAnalysis::GetAutoLabel(UINT32 addr)
@@ -350,6 +367,8 @@ namespace Debugger
 
 	CCodeAnalyser::CCodeAnalyser(CCPUDebug *aCPU) : cpu(aCPU), emptyAnalysis(this), analysis(&emptyAnalysis)
 	{
+		m_abortAnalysis = false;
+
 		instrAlign = cpu->minInstrLen;
 
 		totalIndices = 0;
@@ -361,6 +380,7 @@ namespace Debugger
 			totalIndices += (*it)->size / instrAlign;
 			m_indexBounds.push_back(totalIndices);
 		}
+		totalPages = (totalIndices + (1 << CODEANALYSER_PAGE_BITS) - 1) >> CODEANALYSER_PAGE_BITS;
 	}
 
 	CCodeAnalyser::~CCodeAnalyser()
@@ -411,17 +431,13 @@ namespace Debugger
 	}
 
 	void CCodeAnalyser::CheckEntryPoints(vector<CEntryPoint> &entryPoints, vector<UINT32> &unseenEntryAddrs, vector<CEntryPoint> &prevPoints,
-		bool &needsAnalysis, bool &reanalyse)
+		bool &needsAnalysis, bool &reanalyse, bool &invalidAtPC)
 	{
-		needsAnalysis = false;
+		reanalyse = false;
 
 		// Gather entry points
-		GatherEntryPoints(entryPoints, unseenEntryAddrs, reanalyse);
-		if (reanalyse)
-		{
-			needsAnalysis = true;
-			return;
-		}
+		GatherEntryPoints(entryPoints, unseenEntryAddrs, invalidAtPC);
+		needsAnalysis = invalidAtPC;
 
 		// Compare new entry points with previous ones
 		for (size_t i = 0; i < entryPoints.size(); i++)
@@ -454,14 +470,14 @@ namespace Debugger
 		}		
 	}
 
-	void CCodeAnalyser::GatherEntryPoints(vector<CEntryPoint> &entryPoints, vector<UINT32> &unseenEntryAddrs, bool &reanalyse)
+	void CCodeAnalyser::GatherEntryPoints(vector<CEntryPoint> &entryPoints, vector<UINT32> &unseenEntryAddrs, bool &invalidAtPC)
 	{
 		char labelStr[255];
 		UINT32 addr;
 		unsigned index;
 
 		entryPoints.clear();
-		reanalyse = false;
+		invalidAtPC = false;
 
 		// Add reset address as main entry point
 		AddEntryPoint(entryPoints, cpu->GetResetAddr(), LFEntryPoint, "MainEntry");
@@ -495,9 +511,10 @@ namespace Debugger
 		// If current PC address is at an unseen location or at location that was previously invalid, then add address as unseen entry point
 		if (cpu->instrCount > 0 && GetIndexOfAddr(cpu->pc, index) && (!analysis->HaveSeenIndex(index) || !analysis->IsIndexValid(index)))
 		{
-			// If at location that was previously seen and was invalid, then force reanalysis (ie because code may have been modified)
+			// If at location that was previously seen and was invalid, then flag it so that its page is reanalysed (ie because code
+			// may have been modified)
 			if (analysis->HaveSeenIndex(index) && !analysis->IsIndexValid(index))
-				reanalyse = true;
+				invalidAtPC = true;
 
 			// Check that address not already included in previous entry points
 			bool unseen = true;
@@ -531,87 +548,177 @@ namespace Debugger
 		vector<UINT32> unseenEntryAddrs(analysis->m_unseenEntryAddrs);
 		bool needsAnalysis;
 		bool reanalyse;
-		CheckEntryPoints(entryPoints, unseenEntryAddrs, analysis->m_entryPoints, needsAnalysis, reanalyse);
-		return needsAnalysis;
+		bool invalidAtPC;
+		CheckEntryPoints(entryPoints, unseenEntryAddrs, analysis->m_entryPoints, needsAnalysis, reanalyse, invalidAtPC);
+		if (needsAnalysis)
+			return true;
+
+		// Check if code analysed previously has changed
+		vector<unsigned> changedPages;
+		FindChangedPages(analysis, changedPages);
+		return !changedPages.empty();
 	}
 
 	bool CCodeAnalyser::AnalyseCode()
 	{
 		m_abortAnalysis = false;
 
+		// If nothing analysed yet, start from cached analysis if there is one
+#ifdef DEBUGGER_HASBLOCKFILE
+		bool loaded = analysis == &emptyAnalysis && LoadCache();
+#else
+		bool loaded = false;
+#endif // DEBUGGER_HASBLOCKFILE
+
 		CCodeAnalysis *oldAnalysis = analysis;
 		
 		vector<CEntryPoint> entryPoints;
 		vector<UINT32> unseenEntryAddrs(oldAnalysis->m_unseenEntryAddrs);
 		bool needsAnalysis;
 		bool reanalyse;
-		CheckEntryPoints(entryPoints, unseenEntryAddrs, oldAnalysis->m_entryPoints, needsAnalysis, reanalyse);
-		if (!needsAnalysis)
-			return false;
+		bool invalidAtPC;
+		CheckEntryPoints(entryPoints, unseenEntryAddrs, oldAnalysis->m_entryPoints, needsAnalysis, reanalyse, invalidAtPC);
+
+		// Find pages whose code has changed since they were analysed, including the page of the current PC if it is at a location 
+		// that was invalid
+		vector<unsigned> changedPages;
+		if (!reanalyse)
+		{
+			FindChangedPages(oldAnalysis, changedPages);
+			unsigned index;
+			if (invalidAtPC && GetIndexOfAddr(cpu->pc, index) && 
+				find(changedPages.begin(), changedPages.end(), index >> CODEANALYSER_PAGE_BITS) == changedPages.end())
+				changedPages.push_back(index >> CODEANALYSER_PAGE_BITS);
+		}
+		if (!needsAnalysis && changedPages.empty())
+		{
+			if (loaded)
+				cpu->debugger->AnalysisUpdated(this);
+			return loaded;
+		}
 
+		// Either start again or carry on from previous analysis, analysing changed pages again from the flows into them
 		CCodeAnalysis *newAnalysis;
+		vector<UINT32> addrs;
 		if (reanalyse || oldAnalysis == &emptyAnalysis)
-			newAnalysis = new CCodeAnalysis(this, totalIndices, entryPoints, unseenEntryAddrs);
+			newAnalysis = new CCodeAnalysis(this, totalIndices, totalPages, entryPoints, unseenEntryAddrs);
 		else
+		{
 			newAnalysis = new CCodeAnalysis(oldAnalysis, entryPoints, unseenEntryAddrs);
+			InvalidatePages(newAnalysis, changedPages, addrs);
+		}
 		newAnalysis->Acquire();
 
+		// Walk code from all entry points (those already seen are skipped straight away)
 		for (vector<CEntryPoint>::iterator it = newAnalysis->m_entryPoints.begin(); it != newAnalysis->m_entryPoints.end(); it++)
-		{
-			AddFlagToAddr(newAnalysis->m_autoLabelsMap, it->addr, it->autoFlag, it->autoLabel);
-			AnalyseCode(newAnalysis->m_seenIndices, newAnalysis->m_validIndices, newAnalysis->validIndexSet, newAnalysis->m_autoLabelsMap, it->addr);
-		}
-		newAnalysis->FinishAnalysis();
+			addrs.push_back(it->addr);
+		WalkCode(newAnalysis, addrs);
 
 		if (m_abortAnalysis)
 		{
 			newAnalysis->Release();
-			return false;
+			if (loaded)
+				cpu->debugger->AnalysisUpdated(this);
+			return loaded;
 		}
 
+		HashPages(newAnalysis);
+		AddAutoLabels(newAnalysis);
+		newAnalysis->FinishAnalysis();
+
 		analysis = newAnalysis;
 		if (oldAnalysis != &emptyAnalysis)
 			oldAnalysis->Release();
 
+#ifdef DEBUGGER_HASBLOCKFILE
+		SaveCache();
+#endif // DEBUGGER_HASBLOCKFILE
+
 		cpu->debugger->AnalysisUpdated(this);
 		return true;
 	}
 
-	void CCodeAnalyser::AnalyseCode(vector<bool> &seenIndices, vector<bool> &validIndices, set<unsigned> &validIndexSet,
-		map<UINT32,CAutoLabel*> &autoLabelsMap, UINT32 addr)
+	void CCodeAnalyser::WalkCode(CCodeAnalysis *newAnalysis, vector<UINT32> &addrs)
 	{
-		if (m_abortAnalysis)
+#ifdef DEBUGGER_HASTHREAD
+		// If CPU allows it, share walking between job pool's threads.  Each round, the addresses still to walk are split between
+		// jobs, which claim address indices as they go so that no code is walked twice, and those left when jobs reach their limit 
+		// are shared out again the next round.
+		CJobPool *pool = (cpu->CanAnalyseConcurrently() ? CThread::GetJobPool() : NULL);
+		if (pool != NULL && pool->GetNumWorkers() > 0)
+		{
+			unsigned maxJobs = 4 * (pool->GetNumWorkers() + 1);
+			vector< vector<UINT32> > jobAddrs(maxJobs);
+			vector< vector<UINT32> > unwalkedAddrs(maxJobs);
+			vector< vector<CCodeFlow> > flows(maxJobs);
+			while (!addrs.empty() && !m_abortAnalysis)
+			{
+				unsigned numJobs = (unsigned)min<size_t>(maxJobs, addrs.size());
+				pool->Run("CodeAnalyser", numJobs, [&](unsigned job)
+				{
+					jobAddrs[job].assign(addrs.begin() + addrs.size() * job / numJobs, addrs.begin() + addrs.size() * (job + 1) / numJobs);
+					unwalkedAddrs[job].clear();
+					WalkCode(newAnalysis, jobAddrs[job], unwalkedAddrs[job], flows[job], CODEANALYSER_BLOCKS_PER_JOB);
+				});
+				addrs.clear();
+				for (unsigned job = 0; job < numJobs; job++)
+					addrs.insert(addrs.end(), unwalkedAddrs[job].begin(), unwalkedAddrs[job].end());
+			}
+			for (unsigned job = 0; job < maxJobs; job++)
+				newAnalysis->m_flows.insert(newAnalysis->m_flows.end(), flows[job].begin(), flows[job].end());
 			return;
+		}
+#endif // DEBUGGER_HASTHREAD
+
+		vector<UINT32> unwalkedAddrs;
+		WalkCode(newAnalysis, addrs, unwalkedAddrs, newAnalysis->m_flows, (size_t)-1);
+	}
+
+	void CCodeAnalyser::WalkCode(CCodeAnalysis *newAnalysis, vector<UINT32> &addrs, vector<UINT32> &unwalkedAddrs, vector<CCodeFlow> &flows,
+		size_t maxBlocks)
+	{
+		// Walk code blocks depth first, adding jump destinations to list as they are found
+		for (size_t blocks = 0; !addrs.empty(); blocks++)
+		{
+			if (m_abortAnalysis)
+				return;
+			if (blocks == maxBlocks)
+			{
+				unwalkedAddrs.insert(unwalkedAddrs.end(), addrs.begin(), addrs.end());
+				addrs.clear();
+				return;
+			}
+			UINT32 addr = addrs.back();
+			addrs.pop_back();
+			WalkBlock(newAnalysis, addr, addrs, flows);
+		}
+	}
 
+	void CCodeAnalyser::WalkBlock(CCodeAnalysis *newAnalysis, UINT32 addr, vector<UINT32> &addrs, vector<CCodeFlow> &flows)
+	{
 		unsigned index;
-		if (!GetIndexOfAddr(addr, index) || seenIndices[index])
+		if (!GetIndexOfAddr(addr, index))
 			return;
 		
 		CRegion *region = cpu->GetRegion(addr);
 		if (region == NULL || !region->isCode)
 			return;
 
-		set<unsigned>::iterator setIt = validIndexSet.end();
-
-		unsigned startIndex = index;
-		do
+		for (;;)
 		{
 			if (m_abortAnalysis)
 				return;
 
-			// Flag that have seen this address index
-			seenIndices[index] = true;
+			// Flag that have seen this address index, finishing if it had already been seen
+			if (newAnalysis->m_indexFlags[index].fetch_or(CCodeAnalysis::IFSeen, memory_order_relaxed) & CCodeAnalysis::IFSeen)
+				return;
 
 			// If unit is not valid (ie doesn't disassemble) then code block must be invalid (TODO - invalidate whole code block?)
 			int codesLen = cpu->GetOpLength(addr);
 			if (codesLen <= 0)
 				return;
 
-			validIndices[index] = true;
-			if (setIt != validIndexSet.end())
-				setIt = validIndexSet.insert(setIt, index);
-			else
-				setIt = validIndexSet.insert(index).first;
+			newAnalysis->m_indexFlags[index].store(CCodeAnalysis::IFSeen | CCodeAnalysis::IFValid, memory_order_relaxed);
 			
 			UINT32 opcode = cpu->GetOpcode(addr);
 			EOpFlags opFlags = cpu->GetOpFlags(addr, opcode);
@@ -623,11 +730,15 @@ namespace Debugger
 				UINT32 jumpAddr;
 				if (cpu->GetJumpAddr(addr, opcode, jumpAddr))
 				{
-					// If so, add flags to jump address and analyse destination code block too
-					if      (opFlags & JumpSub)  AddFlagToAddr(autoLabelsMap, jumpAddr, LFSubroutine, NULL);
-					else if (opFlags & JumpLoop) AddFlagToAddr(autoLabelsMap, jumpAddr, LFLoopPoint, NULL);
-					else                         AddFlagToAddr(autoLabelsMap, jumpAddr, LFJumpTarget, NULL);
-					AnalyseCode(seenIndices, validIndices, validIndexSet, autoLabelsMap, jumpAddr);
+					// If so, record flow to jump address and analyse destination code block too
+					CCodeFlow flow;
+					flow.fromIndex = index;
+					flow.toAddr = jumpAddr;
+					if      (opFlags & JumpSub)  flow.flag = LFSubroutine;
+					else if (opFlags & JumpLoop) flow.flag = LFLoopPoint;
+					else                         flow.flag = LFJumpTarget;
+					flows.push_back(flow);
+					addrs.push_back(jumpAddr);
 				}
 			}
 
@@ -637,10 +748,10 @@ namespace Debugger
 				return;
 
 			// Move to next index
-			index += (unsigned)codesLen / instrAlign;
+			unsigned nextIndex = index + (unsigned)codesLen / instrAlign;
 
 			// If reach end of address indices, code block must be invalid (TODO - invalidate whole code block?)
-			if (index >= totalIndices)
+			if (nextIndex >= totalIndices)
 				return;
 
 			// Move to next address
@@ -653,8 +764,96 @@ namespace Debugger
 				if (region == NULL || !region->isCode) // (TODO - invalidate whole code block?)
 					return;
 			}
+
+			// If move between pages, record flow into next one
+			if ((nextIndex >> CODEANALYSER_PAGE_BITS) != (index >> CODEANALYSER_PAGE_BITS))
+			{
+				CCodeFlow flow;
+				flow.fromIndex = index;
+				flow.toAddr = addr;
+				flow.flag = LFNone;
+				flows.push_back(flow);
+			}
+			index = nextIndex;
+		}
+	}
+
+	void CCodeAnalyser::InvalidatePages(CCodeAnalysis *newAnalysis, vector<unsigned> &pages, vector<UINT32> &addrs)
+	{
+		// Forget what was found in changed pages
+		vector<bool> changed(totalPages);
+		for (vector<unsigned>::iterator it = pages.begin(); it != pages.end(); it++)
+		{
+			changed[*it] = true;
+			newAnalysis->m_hashedPages[*it] = false;
+			unsigned endIndex = min<unsigned>((*it + 1) << CODEANALYSER_PAGE_BITS, totalIndices);
+			for (unsigned index = *it << CODEANALYSER_PAGE_BITS; index < endIndex; index++)
+				newAnalysis->m_indexFlags[index].store(0, memory_order_relaxed);
+		}
+
+		// Drop flows out of changed pages and walk code again from flows into them
+		vector<CCodeFlow> flows;
+		for (vector<CCodeFlow>::iterator it = newAnalysis->m_flows.begin(); it != newAnalysis->m_flows.end(); it++)
+		{
+			if (changed[it->fromIndex >> CODEANALYSER_PAGE_BITS])
+				continue;
+			flows.push_back(*it);
+			unsigned index;
+			if (GetIndexOfAddr(it->toAddr, index) && changed[index >> CODEANALYSER_PAGE_BITS])
+				addrs.push_back(it->toAddr);
+		}
+		newAnalysis->m_flows.swap(flows);
+	}
+
+	UINT32 CCodeAnalyser::HashPage(unsigned page)
+	{
+		// FNV-1a hash of page's memory, one address index at a time
+		UINT32 hash = 2166136261U;
+		unsigned endIndex = min<unsigned>((page + 1) << CODEANALYSER_PAGE_BITS, totalIndices);
+		for (unsigned index = page << CODEANALYSER_PAGE_BITS; index < endIndex; index++)
+		{
+			UINT32 addr;
+			GetAddrOfIndex(index, addr);
+			hash = (hash ^ (UINT32)cpu->ReadMem(addr, instrAlign)) * 16777619U;
+		}
+		return hash;
+	}
+
+	void CCodeAnalyser::HashPages(CCodeAnalysis *newAnalysis)
+	{
+		// Hash pages that have been seen in code for first time (or again after changing)
+		for (unsigned page = 0; page < totalPages; page++)
+		{
+			if (newAnalysis->m_hashedPages[page])
+				continue;
+			unsigned endIndex = min<unsigned>((page + 1) << CODEANALYSER_PAGE_BITS, totalIndices);
+			for (unsigned index = page << CODEANALYSER_PAGE_BITS; index < endIndex; index++)
+			{
+				if (newAnalysis->HaveSeenIndex(index))
+				{
+					newAnalysis->m_pageHashes[page] = HashPage(page);
+					newAnalysis->m_hashedPages[page] = true;
+					break;
+				}
+			}
+		}
+	}
+
+	void CCodeAnalyser::FindChangedPages(CCodeAnalysis *oldAnalysis, vector<unsigned> &pages)
+	{
+		for (unsigned page = 0; page < oldAnalysis->m_hashedPages.size(); page++)
+		{
+			if (oldAnalysis->m_hashedPages[page] && HashPage(page) != oldAnalysis->m_pageHashes[page])
+				pages.push_back(page);
 		}
-		while (!seenIndices[index]);
+	}
+
+	void CCodeAnalyser::AddAutoLabels(CCodeAnalysis *newAnalysis)
+	{
+		for (vector<CEntryPoint>::iterator it = newAnalysis->m_entryPoints.begin(); it != newAnalysis->m_entryPoints.end(); it++)
+			AddFlagToAddr(newAnalysis->m_autoLabelsMap, it->addr, it->autoFlag, it->autoLabel);
+		for (vector<CCodeFlow>::iterator it = newAnalysis->m_flows.begin(); it != newAnalysis->m_flows.end(); it++)
+			AddFlagToAddr(newAnalysis->m_autoLabelsMap, it->toAddr, it->flag, NULL);
 	}
 
 	void CCodeAnalyser::AddFlagToAddr(map<UINT32,CAutoLabel*> &autoLabelsMap, UINT32 addr, ELabelFlags flag, const char *subLabel)
@@ -699,6 +898,12 @@ namespace Debugger
 		return true;
 	}
 
+	void CCodeAnalyser::SetCacheDir(const char *cacheDir)
+	{
+		m_cacheDir = cacheDir;
+		m_cacheFile.clear();
+	}
+
 #ifdef DEBUGGER_HASBLOCKFILE
 	bool CCodeAnalyser::LoadState(CBlockFile *state)
 	{
@@ -735,6 +940,187 @@ namespace Debugger
 		}
 		return true;
 	}
+
+	bool CCodeAnalyser::GetCacheFile(string &file)
+	{
+		if (m_cacheDir.empty())
+			return false;
+
+		// Name cache file after CRC of read-only code, which is worked out once as the code may be banked in and out later
+		if (m_cacheFile.empty())
+		{
+			UINT32 crc = crc32(0L, Z_NULL, 0);
+			UINT8 buffer[4096];
+			for (vector<CRegion*>::iterator it = m_codeRegions.begin(); it != m_codeRegions.end(); it++)
+			{
+				if (!(*it)->isReadOnly)
+					continue;
+				unsigned len = 0;
+				for (UINT32 offset = 0; offset + instrAlign <= (*it)->size; offset += instrAlign)
+				{
+					UINT64 data = cpu->ReadMem((*it)->addr + offset, instrAlign);
+					memcpy(&buffer[len], &data, instrAlign);
+					len += instrAlign;
+					if (len + instrAlign > sizeof(buffer))
+					{
+						crc = crc32(crc, buffer, len);
+						len = 0;
+					}
+				}
+				crc = crc32(crc, buffer, len);
+			}
+			char fileName[255];
+			sprintf(fileName, "/%s.%08X.ca", cpu->name, crc);
+			m_cacheFile = m_cacheDir + fileName;
+		}
+		file = m_cacheFile;
+		return true;
+	}
+
+	bool CCodeAnalyser::LoadCache()
+	{
+		string file;
+		if (!GetCacheFile(file))
+			return false;
+
+		// Open file and check version in header matches
+		CBlockFile cache;
+		if (cache.Load(file) != OKAY)
+			return false;
+		if (cache.FindBlock("Code Analysis Cache") != OKAY)
+		{
+			cache.Close();
+			return false;
+		}
+		unsigned version;
+		cache.Read(&version, sizeof(version));
+		if (version != CODEANALYSER_CACHE_VERSION || cache.FindBlock("Code Analysis") != OKAY)
+		{
+			cache.Close();
+			return false;
+		}
+
+		// Check it was made with same code regions
+		UINT32 numIndices;
+		UINT32 numPages;
+		cache.Read(&numIndices, sizeof(numIndices));
+		cache.Read(&numPages, sizeof(numPages));
+		if (numIndices != totalIndices || numPages != totalPages)
+		{
+			cache.Close();
+			return false;
+		}
+
+		// Load entry points
+		vector<CEntryPoint> entryPoints;
+		UINT32 numEntryPoints;
+		cache.Read(&numEntryPoints, sizeof(numEntryPoints));
+		for (UINT32 i = 0; i < numEntryPoints; i++)
+		{
+			UINT32 addr;
+			UINT32 autoFlag;
+			UINT32 labelLen;
+			char autoLabel[255];
+			cache.Read(&addr, sizeof(addr));
+			cache.Read(&autoFlag, sizeof(autoFlag));
+			cache.Read(&labelLen, sizeof(labelLen));
+			if (labelLen >= sizeof(autoLabel))
+			{
+				cache.Close();
+				return false;
+			}
+			cache.Read(autoLabel, labelLen);
+			autoLabel[labelLen] = '\0';
+			entryPoints.push_back(CEntryPoint(addr, (ELabelFlags)autoFlag, labelLen > 0 ? autoLabel : NULL));
+		}
+		UINT32 numUnseenAddrs;
+		cache.Read(&numUnseenAddrs, sizeof(numUnseenAddrs));
+		vector<UINT32> unseenEntryAddrs(numUnseenAddrs);
+		if (numUnseenAddrs > 0)
+			cache.Read(&unseenEntryAddrs[0], numUnseenAddrs * sizeof(UINT32));
+
+		// Load address indices, page hashes and flows
+		CCodeAnalysis *newAnalysis = new CCodeAnalysis(this, totalIndices, totalPages, entryPoints, unseenEntryAddrs);
+		vector<UINT8> data(max(totalIndices, totalPages));
+		cache.Read(&data[0], totalIndices);
+		for (unsigned index = 0; index < totalIndices; index++)
+			newAnalysis->m_indexFlags[index].store(data[index], memory_order_relaxed);
+		cache.Read(&newAnalysis->m_pageHashes[0], totalPages * sizeof(UINT32));
+		cache.Read(&data[0], totalPages);
+		for (unsigned page = 0; page < totalPages; page++)
+			newAnalysis->m_hashedPages[page] = data[page] != 0;
+		UINT32 numFlows;
+		cache.Read(&numFlows, sizeof(numFlows));
+		newAnalysis->m_flows.resize(numFlows);
+		if (numFlows > 0 && cache.Read(&newAnalysis->m_flows[0], numFlows * sizeof(CCodeFlow)) != numFlows * sizeof(CCodeFlow))
+		{
+			delete newAnalysis;
+			cache.Close();
+			return false;
+		}
+		cache.Close();
+
+		AddAutoLabels(newAnalysis);
+		newAnalysis->FinishAnalysis();
+		newAnalysis->Acquire();
+
+		CCodeAnalysis *oldAnalysis = analysis;
+		analysis = newAnalysis;
+		if (oldAnalysis != &emptyAnalysis)
+			oldAnalysis->Release();
+		return true;
+	}
+
+	void CCodeAnalyser::SaveCache()
+	{
+		string file;
+		if (!GetCacheFile(file))
+			return;
+
+		// Create file with header and version
+		vector<UINT8> buffer;
+		CBlockFile cache;
+		cache.Create(&buffer, "Code Analysis Cache", __FILE__);
+		unsigned version = CODEANALYSER_CACHE_VERSION;
+		cache.Write(&version, sizeof(version));
+
+		// Save code regions' sizes, entry points, address indices, page hashes and flows
+		cache.NewBlock("Code Analysis", __FILE__);
+		UINT32 numIndices = totalIndices;
+		UINT32 numPages = totalPages;
+		cache.Write(&numIndices, sizeof(numIndices));
+		cache.Write(&numPages, sizeof(numPages));
+		UINT32 numEntryPoints = (UINT32)analysis->m_entryPoints.size();
+		cache.Write(&numEntryPoints, sizeof(numEntryPoints));
+		for (vector<CEntryPoint>::iterator it = analysis->m_entryPoints.begin(); it != analysis->m_entryPoints.end(); it++)
+		{
+			UINT32 autoFlag = it->autoFlag;
+			UINT32 labelLen = (it->autoLabel != NULL ? (UINT32)strlen(it->autoLabel) : 0);
+			cache.Write(&it->addr, sizeof(it->addr));
+			cache.Write(&autoFlag, sizeof(autoFlag));
+			cache.Write(&labelLen, sizeof(labelLen));
+			cache.Write(it->autoLabel, labelLen);
+		}
+		UINT32 numUnseenAddrs = (UINT32)analysis->m_unseenEntryAddrs.size();
+		cache.Write(&numUnseenAddrs, sizeof(numUnseenAddrs));
+		if (numUnseenAddrs > 0)
+			cache.Write(&analysis->m_unseenEntryAddrs[0], numUnseenAddrs * sizeof(UINT32));
+		vector<UINT8> data(max(totalIndices, totalPages));
+		for (unsigned index = 0; index < totalIndices; index++)
+			data[index] = analysis->m_indexFlags[index].load(memory_order_relaxed);
+		cache.Write(&data[0], totalIndices);
+		cache.Write(&analysis->m_pageHashes[0], totalPages * sizeof(UINT32));
+		for (unsigned page = 0; page < totalPages; page++)
+			data[page] = analysis->m_hashedPages[page];
+		cache.Write(&data[0], totalPages);
+		UINT32 numFlows = (UINT32)analysis->m_flows.size();
+		cache.Write(&numFlows, sizeof(numFlows));
+		if (numFlows > 0)
+			cache.Write(&analysis->m_flows[0], numFlows * sizeof(CCodeFlow));
+		cache.Close();
+
+		CBlockFile::Save(file, buffer, 1);
+	}
 #endif // DEBUGGER_HASBLOCKFILE
 }
 #endif  // SUPERMODEL_DEBUGGER
\ No newline at end of file
@@ -31,6 +31,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <string>
+#include <atomic>
 #include <algorithm>
 
 #include "Types.h"
@@ -126,6 +128,18 @@ namespace Debugger
 
 	class CCodeAnalyser;
 
+	/*
+	 * Flow of control found during analysis, either a jump (with the flag to give its destination) or code running on from one
+	 * page of address indices into the next (with no flag).  Kept so that re-analysing a page that has changed can start from
+	 * everywhere that leads into it and drop what led out of it.
+	 */
+	struct CCodeFlow
+	{
+		unsigned fromIndex;
+		UINT32 toAddr;
+		ELabelFlags flag;
+	};
+
 	/*
      * Class that holds the results of having analysed the program code.
 	 */
@@ -134,17 +148,25 @@ namespace Debugger
 	friend class CCodeAnalyser;
 
 	private:
+		enum EIndexFlags
+		{
+			IFSeen  = 1,
+			IFValid = 2
+		};
+
 		std::vector<CEntryPoint> m_entryPoints;
 		std::vector<UINT32> m_unseenEntryAddrs;
-		std::vector<bool> m_seenIndices;
-		std::vector<bool> m_validIndices;
+		std::vector<std::atomic<UINT8>> m_indexFlags;	// atomic so that analysis threads can claim indices
+		std::vector<CCodeFlow> m_flows;
+		std::vector<UINT32> m_pageHashes;
+		std::vector<bool> m_hashedPages;				// pages with seen indices, whose contents are checked for changes
 		std::map<UINT32,CAutoLabel*> m_autoLabelsMap;
 
 		unsigned m_acquired;
 
 		CCodeAnalysis(CCodeAnalyser *aAnalyser);
 
-		CCodeAnalysis(CCodeAnalyser *aAnalyser, unsigned aTotalIndices, std::vector<CEntryPoint> &entryPoints, std::vector<UINT32> &m_unseenEntryAddrs);
+		CCodeAnalysis(CCodeAnalyser *aAnalyser, unsigned aTotalIndices, unsigned aTotalPages, std::vector<CEntryPoint> &entryPoints, std::vector<UINT32> &m_unseenEntryAddrs);
 
 		CCodeAnalysis(CCodeAnalysis *oldAnalysis, std::vector<CEntryPoint> &entryPoints, std::vector<UINT32> &m_unseenEntryAddrs);
 
@@ -152,7 +174,6 @@ namespace Debugger
 
 	public:
 		CCodeAnalyser *analyser;
-		std::set<unsigned> validIndexSet;
 		std::vector<CAutoLabel*> autoLabels;
 		
 		~CCodeAnalysis();
@@ -188,6 +209,9 @@ namespace Debugger
 	 * This sort of analysis works well for static addressing modes but not so well for dynamic address referencing or self-modifying code.
 	 * To allow for the latter cases the analyser updates its analysis whenever it encounters an unseen memory location or it sees 
 	 * that code has changed from a previous inspection.
+	 * Updates are incremental: the address indices are split into pages whose contents are hashed, and only the pages that have
+	 * changed are analysed again, from the entry points and flows that lead into them.  For CPUs that allow it, the code is walked
+	 * by several threads at once.  Analyses can be cached in a directory, keyed by a CRC of the CPU's read-only code regions.
 	 */
 	class CCodeAnalyser
 	{	
@@ -197,19 +221,44 @@ namespace Debugger
 
 		std::vector<UINT32> m_customEntryAddrs;
 
-		bool m_abortAnalysis;
+		std::string m_cacheDir;
+		std::string m_cacheFile;
+
+		std::atomic<bool> m_abortAnalysis;
 
 		void CheckEntryPoints(std::vector<CEntryPoint> &entryPoints, std::vector<UINT32> &unseenEntryAddrs, std::vector<CEntryPoint> &prevPoints,
-			bool &needsAnalysis, bool &reanalyse);
+			bool &needsAnalysis, bool &reanalyse, bool &invalidAtPC);
 		
-		void GatherEntryPoints(std::vector<CEntryPoint> &entryPoints, std::vector<UINT32> &unseenEntryAddrs, bool &reanalyse);
+		void GatherEntryPoints(std::vector<CEntryPoint> &entryPoints, std::vector<UINT32> &unseenEntryAddrs, bool &invalidAtPC);
 
 		void AddEntryPoint(std::vector<CEntryPoint> &entryPoints, UINT32 addr, ELabelFlags autoFlag, const char *autoLabel);
 
-		void AnalyseCode(std::vector<bool> &seenIndices, std::vector<bool> &validIndices, std::set<unsigned> &validIndexSet, std::map<UINT32, CAutoLabel*> &autoLabelsMap, UINT32 addr);
+		void WalkCode(CCodeAnalysis *newAnalysis, std::vector<UINT32> &addrs);
+
+		void WalkCode(CCodeAnalysis *newAnalysis, std::vector<UINT32> &addrs, std::vector<UINT32> &unwalkedAddrs, std::vector<CCodeFlow> &flows, size_t maxBlocks);
+
+		void WalkBlock(CCodeAnalysis *newAnalysis, UINT32 addr, std::vector<UINT32> &addrs, std::vector<CCodeFlow> &flows);
+
+		void InvalidatePages(CCodeAnalysis *newAnalysis, std::vector<unsigned> &pages, std::vector<UINT32> &addrs);
+
+		UINT32 HashPage(unsigned page);
+
+		void HashPages(CCodeAnalysis *newAnalysis);
+
+		void FindChangedPages(CCodeAnalysis *oldAnalysis, std::vector<unsigned> &pages);
+
+		void AddAutoLabels(CCodeAnalysis *newAnalysis);
 
 		void AddFlagToAddr(std::map<UINT32, CAutoLabel*> &autoLabelsMap, UINT32 addr, ELabelFlags autoFlag, const char *autoLabel);
 
+#ifdef DEBUGGER_HASBLOCKFILE
+		bool GetCacheFile(std::string &file);
+
+		bool LoadCache();
+
+		void SaveCache();
+#endif // DEBUGGER_HASBLOCKFILE
+
 	public:
 		CCPUDebug *cpu;
 
@@ -219,6 +268,7 @@ namespace Debugger
 		
 		unsigned instrAlign;
 		unsigned totalIndices;
+		unsigned totalPages;
 
 		CCodeAnalyser(CCPUDebug *aCPU);
 
@@ -250,6 +300,12 @@ namespace Debugger
 
 		bool RemoveCustomEntryAddr(UINT32 entryAddr);
 
+		//
+		// Method to set directory that analyses are cached in between sessions (empty string to not cache them)
+		//
+
+		void SetCacheDir(const char *cacheDir);
+
 #ifdef DEBUGGER_HASBLOCKFILE
 		bool LoadState(CBlockFile *state);
 
@@ -32,6 +32,9 @@
 
 #include <cctype>
 #include <string>
+#include <map>
+#include <algorithm>
+#include <functional>
 
 using namespace std;
 
@@ -1368,6 +1371,44 @@ namespace Debugger
 			Print("All port watches removed.\n");
 		}
 		//
+		// Profiling
+		//
+		else if (CheckToken(token, "pfs", "profilestart"))			// profilestart [<cycles>=1000]
+		{
+			// Parse arguments
+			number = 1000;
+			token = strtok(NULL, " ");
+			if (token != NULL && (!ParseInt(token, &number) || number <= 0))
+			{
+				Error("Enter a valid number of cycles.\n");
+				return false;
+			}
+
+			// Start sampling every CPU
+			for (vector<CCPUDebug*>::iterator it = cpus.begin(); it != cpus.end(); it++)
+				(*it)->StartProfile(number);
+			Print("Profiling all CPUs, sampling every %d cycles.\n", number);
+		}
+		else if (CheckToken(token, "pfe", "profileend"))			// profileend
+		{
+			for (vector<CCPUDebug*>::iterator it = cpus.begin(); it != cpus.end(); it++)
+				(*it)->StopProfile();
+			Print("Profiling stopped.\n");
+		}
+		else if (CheckToken(token, "lpf", "listprofile"))			// listprofile [<count>=20]
+		{
+			// Parse arguments
+			number = 20;
+			token = strtok(NULL, " ");
+			if (token != NULL && (!ParseInt(token, &number) || number <= 0))
+			{
+				Error("Enter a valid count.\n");
+				return false;
+			}
+
+			ListProfile(number);
+		}
+		//
 		// General
 		//		
 		else if (CheckToken(token, "p", "print", mod, 9, ""))		// print[.<size>=v] <expr> [(h)ex|hexdo(l)lar|hex(p)osth|(d)ecimal|(b)inary]
@@ -1603,6 +1644,11 @@ namespace Debugger
 			Print(fmt, "pw/apw", "addportwatch",           "<port> [((n)one|(i)nput|(o)utput|(io)nputoutput) [(s)imple|(c)ount <count>|(m)atch <sequence>|captu(r)e <maxlen>|(p)rint]]");
 			Print(fmt, "rpw",    "removeportwatch",        "(#<num>|<port>)");
 			Print(fmt, "rapw",   "removeallportwatches",   "");
+
+			Print(" Profiling:\n");
+			Print(fmt, "pfs",    "profilestart",           "[<cycles>=1000]");
+			Print(fmt, "pfe",    "profileend",             "");
+			Print(fmt, "lpf",    "listprofile",            "[<count>=20]");
 			
 			Print("General:\n");
 			Print(fmt, "p",      "print[.<size>=v]",       "<expr> [(h)ex|hexdo(l)lar|hex(p)osth|(d)ecimal|(b)inary]");
@@ -2191,6 +2237,85 @@ namespace Debugger
 		}
 	}
 
+	void CConsoleDebugger::ListProfile(unsigned count)
+	{
+		char addrStr[20];
+		char labelStr[255];
+		bool found = false;
+		for (vector<CCPUDebug*>::iterator cpuIt = cpus.begin(); cpuIt != cpus.end(); cpuIt++)
+		{
+			CCPUDebug *cpu = *cpuIt;
+			UINT64 total = cpu->GetProfileSampleCount();
+			if (total == 0)
+				continue;
+			found = true;
+
+			// Collect start of each routine, from custom labels and, if code is being analysed, the entry points and subroutines found
+			map<UINT32,string> routines;
+			if (m_analyseCode)
+			{
+				CCodeAnalyser *analyser = cpu->GetCodeAnalyser();
+				if (analyser->NeedsAnalysis())
+				{
+					Print("Analysing %s...\n", cpu->name);
+					analyser->AnalyseCode();
+				}
+				ELabelFlags routineFlags = (ELabelFlags)(LFEntryPoint | LFExcepHandler | LFInterHandler | LFSubroutine);
+				for (vector<CAutoLabel*>::iterator it = analyser->analysis->autoLabels.begin(); it != analyser->analysis->autoLabels.end(); it++)
+				{
+					if (((*it)->flags & routineFlags) && (*it)->GetLabel(labelStr, routineFlags))
+						routines[(*it)->addr] = labelStr;
+				}
+			}
+			for (vector<CLabel*>::iterator it = cpu->labels.begin(); it != cpu->labels.end(); it++)
+				routines[(*it)->addr] = (*it)->name;
+
+			// Attribute each sample to the routine preceding it in the same region, or failing that to the region itself
+			map<UINT32,UINT64> routineSamples;
+			map<UINT32,string> routineNames;
+			const map<UINT32,UINT64> &samples = cpu->GetProfileSamples();
+			for (map<UINT32,UINT64>::const_iterator it = samples.begin(); it != samples.end(); it++)
+			{
+				CRegion *region = cpu->GetRegion(it->first);
+				map<UINT32,string>::iterator routine = routines.upper_bound(it->first);
+				UINT32 key;
+				if (routine != routines.begin() && (--routine, region == NULL || routine->first >= region->addr))
+				{
+					key = routine->first;
+					routineNames[key] = routine->second;
+				}
+				else if (region != NULL)
+				{
+					key = region->addr;
+					routineNames[key] = string("(") + region->name + ")";
+				}
+				else
+				{
+					key = it->first;
+					routineNames[key] = "(unknown)";
+				}
+				routineSamples[key] += it->second;
+			}
+
+			// Sort routines by samples and print top ones
+			vector<pair<UINT64,UINT32> > sorted;
+			for (map<UINT32,UINT64>::iterator it = routineSamples.begin(); it != routineSamples.end(); it++)
+				sorted.push_back(pair<UINT64,UINT32>(it->second, it->first));
+			sort(sorted.begin(), sorted.end(), greater<pair<UINT64,UINT32> >());
+
+			Print("%s Profile (%llu samples%s):\n", cpu->name, (unsigned long long)total, (cpu->IsProfiling() ? ", still profiling" : ""));
+			for (size_t i = 0; i < sorted.size() && i < count; i++)
+			{
+				cpu->FormatAddress(addrStr, sorted[i].second);
+				Print(" %6.2f%% %10llu %s %s\n", 100.0 * (double)sorted[i].first / (double)total, (unsigned long long)sorted[i].first, addrStr,
+					routineNames[sorted[i].second].c_str());
+			}
+		}
+
+		if (!found)
+			Print("No profile samples taken (start profiling with 'profilestart').\n");
+	}
+
 	void CConsoleDebugger::ListLabels(bool customLabels, ELabelFlags autoLabelFlags)
 	{
 		Print("%s Labels:\n", m_cpu->name);
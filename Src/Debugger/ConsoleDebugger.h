@@ -142,6 +142,8 @@ namespace Debugger
 
 		void ListPortWatches();
 
+		void ListProfile(unsigned count);
+
 		void ListBreakpoints();
 
 		void ListMonitors();
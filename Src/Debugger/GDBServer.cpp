@@ -0,0 +1,740 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * GDBServer.cpp
+ */
+
+#ifdef SUPERMODEL_DEBUGGER
+
+#include "GDBServer.h"
+#include "CPUDebug.h"
+#include "Register.h"
+#include "Breakpoint.h"
+#include "Watch.h"
+#include "Label.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+// Largest packet accepted, which limits memory transfers to half as many bytes
+#define GDB_PACKET_SIZE 0x4000
+
+#define GDB_SIGINT  2
+#define GDB_SIGTRAP 5
+
+namespace Debugger
+{
+	static int HexDigit(char c)
+	{
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		if (c >= 'a' && c <= 'f')
+			return 10 + c - 'a';
+		if (c >= 'A' && c <= 'F')
+			return 10 + c - 'A';
+		return -1;
+	}
+
+	static bool ParseHexNumber(const char *&str, UINT32 &num)
+	{
+		const char *start = str;
+		num = 0;
+		for (int digit; (digit = HexDigit(*str)) >= 0; str++)
+			num = (num << 4) | (UINT32)digit;
+		return str > start;
+	}
+
+	static bool HasPrefix(const string &str, const char *prefix)
+	{
+		return str.compare(0, strlen(prefix), prefix) == 0;
+	}
+
+	CGDBServer::CGDBServer(CCPUDebug *cpu, unsigned port) : m_cpu(cpu), m_listenSocket(NULL), m_clientSocket(NULL), m_socketSet(NULL),
+		m_noAckMode(false), m_resumed(false), m_interrupted(false)
+	{
+		// Registers in gdb's layout for PowerPC (org.gnu.gdb.power.core and .fpu), otherwise as the CPU's debugger lists them
+		if (strcmp(m_cpu->type, "PPC") == 0)
+		{
+			char name[10];
+			for (unsigned i = 0; i < 32; i++)
+			{
+				sprintf(name, "r%u", i);
+				AddRegister(name, 32, RKInt);
+			}
+			AddRegister("pc", 32, RKInt);
+			AddRegister("msr", 32, RKInt);
+			AddRegister("cr", 32, RKCondition);
+			AddRegister("lr", 32, RKInt);
+			AddRegister("ctr", 32, RKInt);
+			AddRegister("xer", 32, RKInt);
+			for (unsigned i = 0; i < 32; i++)
+			{
+				sprintf(name, "f%u", i);
+				AddRegister(name, 64, RKFPoint);
+			}
+			AddRegister("fpscr", 32, RKZero);
+		}
+		else
+		{
+			for (vector<CRegister*>::iterator it = m_cpu->regs.begin(); it != m_cpu->regs.end(); it++)
+				AddRegister((*it)->name, ((*it)->dataWidth + 7) & ~7, (dynamic_cast<CFPointRegister*>(*it) != NULL ? RKFPoint : RKInt));
+		}
+		CreateTargetXML();
+
+		SDLNet_Init();
+		m_socketSet = SDLNet_AllocSocketSet(1);
+		IPaddress ip;
+		if (SDLNet_ResolveHost(&ip, NULL, (Uint16)port) == 0)
+			m_listenSocket = SDLNet_TCP_Open(&ip);
+	}
+
+	CGDBServer::~CGDBServer()
+	{
+		Disconnect();
+		if (m_listenSocket != NULL)
+			SDLNet_TCP_Close(m_listenSocket);
+		if (m_socketSet != NULL)
+			SDLNet_FreeSocketSet(m_socketSet);
+		SDLNet_Quit();
+	}
+
+	void CGDBServer::AddRegister(const char *name, unsigned bits, ERegKind kind)
+	{
+		CGDBRegister reg;
+		reg.name = name;
+		reg.bits = bits;
+		reg.kind = kind;
+		reg.reg = (kind == RKInt || kind == RKFPoint ? m_cpu->GetRegister(name) : NULL);
+		if ((kind == RKInt || kind == RKFPoint) && reg.reg == NULL)
+			reg.kind = RKZero;
+		m_regs.push_back(reg);
+	}
+
+	void CGDBServer::CreateTargetXML()
+	{
+		bool isPPC = strcmp(m_cpu->type, "PPC") == 0;
+		m_targetXML = "<?xml version=\"1.0\"?>\n<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n<target version=\"1.0\">\n";
+		if (isPPC)
+			m_targetXML += "<architecture>powerpc:common</architecture>\n<feature name=\"org.gnu.gdb.power.core\">\n";
+		else
+			m_targetXML += string("<feature name=\"org.supermodel.") + m_cpu->type + "\">\n";
+		char line[100];
+		for (vector<CGDBRegister>::iterator it = m_regs.begin(); it != m_regs.end(); it++)
+		{
+			if (isPPC && it->name == "f0")
+				m_targetXML += "</feature>\n<feature name=\"org.gnu.gdb.power.fpu\">\n";
+			const char *type = (it->kind == RKFPoint ? "ieee_double" : (it->name == "pc" ? "code_ptr" : "int"));
+			sprintf(line, "<reg name=\"%s\" bitsize=\"%u\" type=\"%s\"/>\n", it->name.c_str(), it->bits, type);
+			m_targetXML += line;
+		}
+		m_targetXML += "</feature>\n</target>\n";
+	}
+
+	CCPUDebug *CGDBServer::GetCPU()
+	{
+		return m_cpu;
+	}
+
+	bool CGDBServer::IsListening()
+	{
+		return m_listenSocket != NULL;
+	}
+
+	bool CGDBServer::IsConnected()
+	{
+		return m_clientSocket != NULL;
+	}
+
+	bool CGDBServer::Receive(int timeoutMS)
+	{
+		// Wait for data and append whatever has arrived to buffer, disconnecting if connection has closed
+		if (m_clientSocket == NULL || SDLNet_CheckSockets(m_socketSet, (Uint32)timeoutMS) <= 0 || !SDLNet_SocketReady(m_clientSocket))
+			return false;
+		char buffer[4096];
+		int len = SDLNet_TCP_Recv(m_clientSocket, buffer, sizeof(buffer));
+		if (len <= 0)
+		{
+			Disconnect();
+			return false;
+		}
+		m_received.insert(m_received.end(), buffer, buffer + len);
+		return true;
+	}
+
+	void CGDBServer::Disconnect()
+	{
+		if (m_clientSocket == NULL)
+			return;
+		SDLNet_DelSocket(m_socketSet, (SDLNet_GenericSocket)m_clientSocket);
+		SDLNet_TCP_Close(m_clientSocket);
+		m_clientSocket = NULL;
+		m_received.clear();
+		m_cpu->debugger->PrintEvent(m_cpu, "GDB client disconnected.\n");
+	}
+
+	bool CGDBServer::GetPacket(string &packet)
+	{
+		for (;;)
+		{
+			// Skip acknowledgements and anything else before start of packet, noting interrupts
+			size_t start = 0;
+			while (start < m_received.size() && m_received[start] != '$')
+			{
+				if (m_received[start] == '\x03')
+					m_interrupted = true;
+				start++;
+			}
+			m_received.erase(m_received.begin(), m_received.begin() + start);
+
+			// Look for end of packet and its checksum
+			vector<char>::iterator end = find(m_received.begin(), m_received.end(), '#');
+			if (end != m_received.end() && m_received.end() - end >= 3)
+			{
+				packet.assign(m_received.begin() + 1, end);
+				int checksum = (HexDigit(end[1]) << 4) | HexDigit(end[2]);
+				m_received.erase(m_received.begin(), end + 3);
+				UINT8 sum = 0;
+				for (size_t i = 0; i < packet.size(); i++)
+					sum += (UINT8)packet[i];
+				if (m_noAckMode)
+					return true;
+				bool valid = (sum == checksum);
+				SDLNet_TCP_Send(m_clientSocket, valid ? "+" : "-", 1);
+				if (valid)
+					return true;
+				continue;
+			}
+
+			// Wait for more to arrive
+			while (!Receive(100))
+			{
+				if (m_clientSocket == NULL)
+					return false;
+			}
+		}
+	}
+
+	void CGDBServer::SendPacket(const string &data)
+	{
+		if (m_clientSocket == NULL)
+			return;
+		string packet;
+		packet.reserve(data.size() + 4);
+		packet += '$';
+		UINT8 sum = 0;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			// Escape characters that have special meaning
+			char c = data[i];
+			if (c == '$' || c == '#' || c == '}' || c == '*')
+			{
+				packet += '}';
+				sum += (UINT8)'}';
+				c ^= 0x20;
+			}
+			packet += c;
+			sum += (UINT8)c;
+		}
+		char checksum[4];
+		sprintf(checksum, "#%02x", sum);
+		packet += checksum;
+
+		// Send, resending until acknowledged unless acknowledgments have been turned off
+		for (int attempt = 0; attempt < 3; attempt++)
+		{
+			if (SDLNet_TCP_Send(m_clientSocket, packet.data(), (int)packet.size()) < (int)packet.size())
+			{
+				Disconnect();
+				return;
+			}
+			if (m_noAckMode)
+				return;
+			while (m_received.empty() || (m_received[0] != '+' && m_received[0] != '-'))
+			{
+				if (!m_received.empty() && m_received[0] != '$')
+					m_received.erase(m_received.begin());
+				else if (!m_received.empty())
+					return;	// client has moved on to another packet
+				else if (!Receive(1000))
+					return;
+			}
+			bool acked = m_received[0] == '+';
+			m_received.erase(m_received.begin());
+			if (acked)
+				return;
+		}
+	}
+
+	void CGDBServer::SendStopReply()
+	{
+		char reply[10];
+		sprintf(reply, "S%02X", m_interrupted ? GDB_SIGINT : GDB_SIGTRAP);
+		SendPacket(reply);
+	}
+
+	void CGDBServer::Poll()
+	{
+		if (m_listenSocket == NULL)
+			return;
+
+		// Accept a connection if not serving one already and halt CPU so that client finds it stopped
+		if (m_clientSocket == NULL)
+		{
+			m_clientSocket = SDLNet_TCP_Accept(m_listenSocket);
+			if (m_clientSocket == NULL)
+				return;
+			SDLNet_AddSocket(m_socketSet, (SDLNet_GenericSocket)m_clientSocket);
+			m_noAckMode = false;
+			m_resumed = false;
+			m_interrupted = true;
+			m_cpu->debugger->PrintEvent(m_cpu, "GDB client connected.\n");
+			m_cpu->ForceBreak(true);
+			return;
+		}
+
+		// Check for interrupt (Ctrl-C) sent while running
+		if (Receive(0) && find(m_received.begin(), m_received.end(), '\x03') != m_received.end())
+		{
+			m_received.erase(remove(m_received.begin(), m_received.end(), '\x03'), m_received.end());
+			m_interrupted = true;
+			m_cpu->ForceBreak(true);
+		}
+	}
+
+	bool CGDBServer::WaitCommand(EHaltReason reason)
+	{
+		if (m_clientSocket == NULL)
+			return false;
+
+		// Tell client CPU has stopped if it had resumed execution (otherwise client will ask)
+		if (reason & HaltUser)
+			m_interrupted = true;
+		if (m_resumed)
+		{
+			SendStopReply();
+			m_resumed = false;
+		}
+
+		string packet;
+		while (GetPacket(packet))
+		{
+			if (HandlePacket(packet))
+			{
+				m_resumed = m_clientSocket != NULL;
+				m_interrupted = false;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool CGDBServer::HandlePacket(const string &packet)
+	{
+		const char *p = packet.c_str() + 1;
+		UINT32 addr;
+		UINT32 len;
+		switch (packet.empty() ? '\0' : packet[0])
+		{
+			case '?':
+				SendStopReply();
+				return false;
+
+			case 'q':
+				if (HasPrefix(packet, "qSupported"))
+				{
+					char reply[100];
+					sprintf(reply, "PacketSize=%X;qXfer:features:read+;QStartNoAckMode+", GDB_PACKET_SIZE);
+					SendPacket(reply);
+				}
+				else if (packet == "qAttached")
+					SendPacket("1");
+				else if (packet == "qC")
+					SendPacket("QC1");
+				else if (packet == "qfThreadInfo")
+					SendPacket("m1");
+				else if (packet == "qsThreadInfo")
+					SendPacket("l");
+				else if (HasPrefix(packet, "qSymbol"))
+					SendPacket("OK");
+				else if (HasPrefix(packet, "qXfer:features:read:target.xml:"))
+				{
+					p = packet.c_str() + strlen("qXfer:features:read:target.xml:");
+					if (!ParseHexNumber(p, addr) || *p++ != ',' || !ParseHexNumber(p, len))
+						SendPacket("E01");
+					else if (addr >= m_targetXML.size())
+						SendPacket("l");
+					else
+					{
+						len = min<UINT32>(len, GDB_PACKET_SIZE / 2);
+						bool last = addr + len >= m_targetXML.size();
+						SendPacket((last ? "l" : "m") + m_targetXML.substr(addr, len));
+					}
+				}
+				else
+					SendPacket("");
+				return false;
+
+			case 'Q':
+				if (packet == "QStartNoAckMode")
+				{
+					SendPacket("OK");
+					m_noAckMode = true;
+				}
+				else
+					SendPacket("");
+				return false;
+
+			case 'H':
+			case 'T':
+				SendPacket("OK");
+				return false;
+
+			case 'g':
+			{
+				// All registers in one go
+				string hex;
+				for (vector<CGDBRegister>::iterator it = m_regs.begin(); it != m_regs.end(); it++)
+					AppendHex(hex, GetRegister(*it), it->bits / 8);
+				SendPacket(hex);
+				return false;
+			}
+
+			case 'G':
+			{
+				for (vector<CGDBRegister>::iterator it = m_regs.begin(); it != m_regs.end() && *p != '\0'; it++)
+				{
+					UINT64 data;
+					if (!ParseHex(p, data, it->bits / 8))
+						break;
+					SetRegister(*it, data);
+				}
+				SendPacket("OK");
+				return false;
+			}
+
+			case 'p':
+			{
+				string hex;
+				if (!ParseHexNumber(p, addr) || addr >= m_regs.size())
+					SendPacket("E01");
+				else
+				{
+					AppendHex(hex, GetRegister(m_regs[addr]), m_regs[addr].bits / 8);
+					SendPacket(hex);
+				}
+				return false;
+			}
+
+			case 'P':
+			{
+				UINT64 data;
+				if (!ParseHexNumber(p, addr) || addr >= m_regs.size() || *p++ != '=' || !ParseHex(p, data, m_regs[addr].bits / 8))
+					SendPacket("E01");
+				else
+					SendPacket(SetRegister(m_regs[addr], data) ? "OK" : "E02");
+				return false;
+			}
+
+			case 'm':
+			{
+				string hex;
+				if (!ParseHexNumber(p, addr) || *p++ != ',' || !ParseHexNumber(p, len))
+					SendPacket("E01");
+				else if (!ReadMemory(addr, min<UINT32>(len, GDB_PACKET_SIZE / 2), hex))
+					SendPacket("E14");
+				else
+					SendPacket(hex);
+				return false;
+			}
+
+			case 'M':
+			case 'X':
+			{
+				// Memory write as hex digits (M) or binary (X) with escaped characters
+				vector<UINT8> data;
+				if (!ParseHexNumber(p, addr) || *p++ != ',' || !ParseHexNumber(p, len) || *p++ != ':')
+				{
+					SendPacket("E01");
+					return false;
+				}
+				const char *end = packet.c_str() + packet.size();
+				while (p < end && data.size() < len)
+				{
+					if (packet[0] == 'M')
+					{
+						UINT64 byte;
+						if (!ParseHex(p, byte, 1))
+							break;
+						data.push_back((UINT8)byte);
+					}
+					else if (*p == '}' && p + 1 < end)
+					{
+						data.push_back((UINT8)(p[1] ^ 0x20));
+						p += 2;
+					}
+					else
+						data.push_back((UINT8)*p++);
+				}
+				if (data.size() != len)
+					SendPacket("E01");
+				else
+					SendPacket(WriteMemory(addr, data) ? "OK" : "E14");
+				return false;
+			}
+
+			case 'c':
+			case 's':
+				// Continue or step, optionally from new address
+				if (ParseHexNumber(p, addr))
+					m_cpu->SetPC(addr);
+				if (packet[0] == 'c')
+					m_cpu->SetContinue();
+				else
+					m_cpu->SetStepMode(StepInto);
+				return true;
+
+			case 'v':
+				if (packet == "vCont?")
+					SendPacket("vCont;c;s");
+				else if (HasPrefix(packet, "vCont;c"))
+				{
+					m_cpu->SetContinue();
+					return true;
+				}
+				else if (HasPrefix(packet, "vCont;s"))
+				{
+					m_cpu->SetStepMode(StepInto);
+					return true;
+				}
+				else
+					SendPacket("");
+				return false;
+
+			case 'Z':
+			case 'z':
+				if (!HandleBreakpoint(packet, packet[0] == 'Z'))
+					SendPacket("");
+				return false;
+
+			case 'D':
+			case 'k':
+				// Detach (or kill, which leaves emulator running too) and carry on
+				if (packet[0] == 'D')
+					SendPacket("OK");
+				Disconnect();
+				m_cpu->SetContinue();
+				return true;
+
+			default:
+				SendPacket("");
+				return false;
+		}
+	}
+
+	bool CGDBServer::HandleBreakpoint(const string &packet, bool insert)
+	{
+		// Z<type>,<addr>,<kind>: 0 and 1 are breakpoints, 2-4 are write, read and access watchpoints
+		const char *p = packet.c_str() + 1;
+		UINT32 type;
+		UINT32 addr;
+		UINT32 kind;
+		if (!ParseHexNumber(p, type) || type > 4 || *p++ != ',' || !ParseHexNumber(p, addr) || *p++ != ',' || !ParseHexNumber(p, kind))
+			return false;
+		bool done;
+		if (type <= 1)
+		{
+			if (insert)
+				done = m_cpu->GetBreakpoint(addr) != NULL || m_cpu->AddSimpleBreakpoint(addr) != NULL;
+			else
+				done = m_cpu->RemoveBreakpoint(addr);
+		}
+		else
+		{
+			if (kind == 0)
+				kind = 1;
+			if (insert)
+				done = m_cpu->AddSimpleMemWatch(addr, kind, type != 2, type != 3) != NULL;
+			else
+				done = m_cpu->RemoveMemWatch(addr, kind);
+		}
+		SendPacket(done ? "OK" : "E01");
+		return true;
+	}
+
+	UINT64 CGDBServer::GetRegister(const CGDBRegister &reg)
+	{
+		switch (reg.kind)
+		{
+			case RKInt:
+				return reg.reg->GetValueAsInt();
+
+			case RKFPoint:
+			{
+				double value = reg.reg->GetValueAsFPoint();
+				UINT64 data;
+				memcpy(&data, &value, sizeof(data));
+				return data;
+			}
+
+			case RKCondition:
+			{
+				// Fields cr0 to cr7 from most significant nibble down
+				UINT64 data = 0;
+				char name[5];
+				for (unsigned i = 0; i < 8; i++)
+				{
+					sprintf(name, "cr%u", i);
+					CRegister *field = m_cpu->GetRegister(name);
+					if (field != NULL)
+						data |= (field->GetValueAsInt() & 0xF) << (28 - 4 * i);
+				}
+				return data;
+			}
+
+			default:
+				return 0;
+		}
+	}
+
+	bool CGDBServer::SetRegister(const CGDBRegister &reg, UINT64 data)
+	{
+		if (reg.reg == NULL && reg.kind != RKCondition)
+			return false;
+		if (reg.reg == m_cpu->GetRegister("pc"))
+			return m_cpu->SetPC((UINT32)data);
+		switch (reg.kind)
+		{
+			case RKFPoint:
+			{
+				CFPointRegister *fpReg = dynamic_cast<CFPointRegister*>(reg.reg);
+				double value;
+				memcpy(&value, &data, sizeof(value));
+				return fpReg != NULL && fpReg->Set(value);
+			}
+
+			case RKCondition:
+			{
+				bool set = true;
+				char name[5];
+				for (unsigned i = 0; i < 8; i++)
+				{
+					sprintf(name, "cr%u", i);
+					CIntRegister *field = dynamic_cast<CIntRegister*>(m_cpu->GetRegister(name));
+					set &= field != NULL && field->Set((data >> (28 - 4 * i)) & 0xF);
+				}
+				return set;
+			}
+
+			default:
+			{
+				// Go through register's own parsing for registers that are not plain integers
+				CIntRegister *intReg = dynamic_cast<CIntRegister*>(reg.reg);
+				if (intReg != NULL)
+					return intReg->Set(data);
+				char str[50];
+				m_cpu->FormatData(str, reg.bits / 8, data);
+				return reg.reg->SetValue(str);
+			}
+		}
+	}
+
+	void CGDBServer::AppendHex(string &str, UINT64 data, unsigned bytes)
+	{
+		// Values are transferred in CPU's byte order
+		static const char digits[] = "0123456789abcdef";
+		for (unsigned i = 0; i < bytes; i++)
+		{
+			unsigned shift = 8 * (m_cpu->bigEndian ? bytes - 1 - i : i);
+			UINT8 byte = (UINT8)(data >> shift);
+			str += digits[byte >> 4];
+			str += digits[byte & 0xF];
+		}
+	}
+
+	bool CGDBServer::ParseHex(const char *&str, UINT64 &data, unsigned bytes)
+	{
+		data = 0;
+		for (unsigned i = 0; i < bytes; i++)
+		{
+			int hi = HexDigit(str[0]);
+			int lo = (hi >= 0 ? HexDigit(str[1]) : -1);
+			if (lo < 0)
+				return false;
+			str += 2;
+			unsigned shift = 8 * (m_cpu->bigEndian ? bytes - 1 - i : i);
+			data |= (UINT64)((hi << 4) | lo) << shift;
+		}
+		return true;
+	}
+
+	bool CGDBServer::ReadMemory(UINT32 addr, UINT32 len, string &hex)
+	{
+		// Read a word at a time where aligned, stopping at first address outside CPU's memory regions
+		unsigned maxSize = min<unsigned>(4, max<unsigned>(1, m_cpu->memBusWidth / 8));
+		CRegion *region = NULL;
+		hex.reserve(2 * len);
+		while (len > 0)
+		{
+			if (region == NULL || addr < region->addr || addr > region->addrEnd)
+			{
+				region = m_cpu->GetRegion(addr);
+				if (region == NULL)
+					return !hex.empty();
+			}
+			unsigned size = maxSize;
+			while (size > 1 && (addr % size != 0 || len < size || addr + size - 1 > region->addrEnd))
+				size /= 2;
+			AppendHex(hex, m_cpu->ReadMem(addr, size), size);
+			addr += size;
+			len -= size;
+		}
+		return true;
+	}
+
+	bool CGDBServer::WriteMemory(UINT32 addr, const vector<UINT8> &data)
+	{
+		unsigned maxSize = min<unsigned>(4, max<unsigned>(1, m_cpu->memBusWidth / 8));
+		for (size_t offset = 0; offset < data.size(); )
+		{
+			CRegion *region = m_cpu->GetRegion(addr);
+			if (region == NULL || region->isReadOnly)
+				return false;
+			unsigned size = maxSize;
+			while (size > 1 && (addr % size != 0 || data.size() - offset < size || addr + size - 1 > region->addrEnd))
+				size /= 2;
+			UINT64 value = 0;
+			for (unsigned i = 0; i < size; i++)
+				value |= (UINT64)data[offset + i] << (8 * (m_cpu->bigEndian ? size - 1 - i : i));
+			if (!m_cpu->WriteMem(addr, size, value))
+				return false;
+			addr += size;
+			offset += size;
+		}
+		return true;
+	}
+}
+
+#endif  // SUPERMODEL_DEBUGGER
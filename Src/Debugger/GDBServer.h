@@ -0,0 +1,139 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * GDBServer.h
+ */
+
+#ifdef SUPERMODEL_DEBUGGER
+#ifndef INCLUDED_GDBSERVER_H
+#define INCLUDED_GDBSERVER_H
+
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "Debugger.h"
+#include "SDLIncludes.h"
+
+namespace Debugger
+{
+	class CCPUDebug;
+	class CRegister;
+
+	/*
+	 * Server for the GDB remote serial protocol, through which gdb (eg gdb-multiarch with 'target remote :<port>'), IDA, Ghidra or
+	 * scripts can examine and control one CPU over TCP.  It serves one client at a time, on the emulator's thread: while the CPU runs,
+	 * Poll() accepts connections and interrupts (which halt the CPU), and while it is halted, WaitCommand() serves requests until the
+	 * client resumes execution or detaches.
+	 * Registers are described to the client with a target description, in gdb's standard layout for the PowerPC and as listed by the
+	 * CPU's debugger for other CPUs.  Memory is read and written in transfers of up to a packet's size, through the CPU's own memory
+	 * reads and writes, a word at a time where aligned.
+	 */
+	class CGDBServer
+	{
+	private:
+		enum ERegKind
+		{
+			RKInt,
+			RKFPoint,
+			RKCondition,	// PowerPC CR, made up of cr0-cr7
+			RKZero			// register gdb expects but debugger does not have
+		};
+
+		struct CGDBRegister
+		{
+			std::string name;
+			unsigned bits;
+			ERegKind kind;
+			CRegister *reg;
+		};
+
+		CCPUDebug *m_cpu;
+		std::vector<CGDBRegister> m_regs;
+		std::string m_targetXML;
+
+		TCPsocket m_listenSocket;
+		TCPsocket m_clientSocket;
+		SDLNet_SocketSet m_socketSet;
+
+		std::vector<char> m_received;
+		bool m_noAckMode;
+		bool m_resumed;
+		bool m_interrupted;
+
+		void AddRegister(const char *name, unsigned bits, ERegKind kind);
+
+		void CreateTargetXML();
+
+		bool Receive(int timeoutMS);
+
+		void Disconnect();
+
+		bool GetPacket(std::string &packet);
+
+		void SendPacket(const std::string &data);
+
+		void SendStopReply();
+
+		bool HandlePacket(const std::string &packet);
+
+		UINT64 GetRegister(const CGDBRegister &reg);
+
+		bool SetRegister(const CGDBRegister &reg, UINT64 data);
+
+		void AppendHex(std::string &str, UINT64 data, unsigned bytes);
+
+		bool ParseHex(const char *&str, UINT64 &data, unsigned bytes);
+
+		bool ReadMemory(UINT32 addr, UINT32 len, std::string &hex);
+
+		bool WriteMemory(UINT32 addr, const std::vector<UINT8> &data);
+
+		bool HandleBreakpoint(const std::string &packet, bool insert);
+
+	public:
+		CGDBServer(CCPUDebug *cpu, unsigned port);
+
+		~CGDBServer();
+
+		CCPUDebug *GetCPU();
+
+		bool IsListening();
+
+		bool IsConnected();
+
+		/*
+		 * Accepts new connections and checks for interrupts from the client, forcing the CPU to break into the debugger.  To be called
+		 * regularly while emulation runs.
+		 */
+		void Poll();
+
+		/*
+		 * Serves requests from the client while the CPU is halted, until the client resumes execution or detaches.  Returns false,
+		 * without waiting, if no client is connected, or if the client disconnected without resuming execution.
+		 */
+		bool WaitCommand(EHaltReason reason);
+	};
+}
+
+#endif	// INCLUDED_GDBSERVER_H
+#endif  // SUPERMODEL_DEBUGGER
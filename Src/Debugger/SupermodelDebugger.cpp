@@ -339,7 +339,7 @@ namespace Debugger
 
 	CSupermodelDebugger::CSupermodelDebugger(::CModel3 *model3, ::CInputs *inputs, std::shared_ptr<CLogger> logger) :
 		CConsoleDebugger(), m_model3(model3), m_inputs(inputs), m_logger(logger),
-		m_loadEmuState(false), m_saveEmuState(false), m_resetEmu(false)
+		m_loadEmuState(false), m_saveEmuState(false), m_resetEmu(false), m_gdbPort(0), m_gdbServer(NULL), m_haltReason(HaltNone)
 	{
 		//
 	}
@@ -372,13 +372,21 @@ namespace Debugger
 
 	}
 
+	void CSupermodelDebugger::ExecutionHalted(CCPUDebug *cpu, EHaltReason reason)
+	{
+		m_haltReason = reason;
+		CConsoleDebugger::ExecutionHalted(cpu, reason);
+	}
+
 	void CSupermodelDebugger::WaitCommand(CCPUDebug *cpu)
 	{
 		// Ungrab mouse and disable audio
 		m_inputs->GetInputSystem()->UngrabMouse();
 		SetAudioEnabled(false);
 
-		CConsoleDebugger::WaitCommand(cpu);
+		// Let GDB client, if one is connected, control its CPU and otherwise fall back to console
+		if (m_gdbServer == NULL || m_gdbServer->GetCPU() != cpu || !m_gdbServer->WaitCommand(m_haltReason))
+			CConsoleDebugger::WaitCommand(cpu);
 
 		m_inputs->GetInputSystem()->GrabMouse();
 		SetAudioEnabled(true);
@@ -424,6 +432,11 @@ namespace Debugger
 			m_resetEmu = true;
 			return true;
 		}
+		else if (CheckToken(token, "det", "dumpexectraces"))		// dumpexectraces
+		{
+			m_model3->DumpExecTraces();
+			return false;
+		}
 		//
 		// Inputs
 		//
@@ -580,6 +593,7 @@ namespace Debugger
 			Print(fmt, "les",    "loademustate",           "<filename>");
 			Print(fmt, "ses",    "saveemustate",           "<filename>");
 			Print(fmt, "res",    "resetemu",               "");
+			Print(fmt, "det",    "dumpexectraces",         "");
 			Print(" Inputs:\n");
 			Print(fmt, "lip",    "listinputs",             "");
 			Print(fmt, "pip",    "printinput",             "(<id>|<label>)");
@@ -649,13 +663,35 @@ namespace Debugger
 	{
 		CConsoleDebugger::Attached();
 
+		// Cache code analyses alongside debugger state so that they are not repeated every session
+		for (std::vector<CCPUDebug*>::iterator it = cpus.begin(); it != cpus.end(); it++)
+			(*it)->GetCodeAnalyser()->SetCacheDir("Debug");
+
 		char fileName[25];
 		sprintf(fileName, "Debug/%s.ds", m_model3->GetGame().name.c_str());
 		LoadState(fileName);
+
+		// Start GDB server for main board CPU if requested
+		CCPUDebug *mainCPU = GetCPU("MainPPC");
+		if (m_gdbPort != 0 && mainCPU != NULL)
+		{
+			m_gdbServer = new CGDBServer(mainCPU, m_gdbPort);
+			if (m_gdbServer->IsListening())
+				Print("Listening for GDB connections on port %u.\n", m_gdbPort);
+			else
+			{
+				Error("Unable to listen for GDB connections on port %u.\n", m_gdbPort);
+				delete m_gdbServer;
+				m_gdbServer = NULL;
+			}
+		}
 	}
 
 	void CSupermodelDebugger::Detaching()
 	{
+		delete m_gdbServer;
+		m_gdbServer = NULL;
+
 		char fileName[25];
 		sprintf(fileName, "Debug/%s.ds", m_model3->GetGame().name.c_str());
 		SaveState(fileName);
@@ -746,10 +782,18 @@ namespace Debugger
 			CConsoleDebugger::ErrorLog(fmt, vl);
 	}
 
+	void CSupermodelDebugger::SetGDBPort(unsigned port)
+	{
+		m_gdbPort = port;
+	}
+
 	void CSupermodelDebugger::Poll()
 	{
 		CConsoleDebugger::Poll();
 
+		if (m_gdbServer != NULL)
+			m_gdbServer->Poll();
+
 		// Load/saving of emulator state and resetting emulator must be done here
 		if (m_loadEmuState)
 		{
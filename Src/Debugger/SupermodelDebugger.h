@@ -28,6 +28,7 @@
 #define INCLUDED_SUPERMODELDEBUGGER_H
 
 #include "ConsoleDebugger.h"
+#include "GDBServer.h"
 #include "Model3/Model3.h"
 
 #include <stdarg.h>
@@ -56,6 +57,10 @@ namespace Debugger
 		bool m_resetEmu;
 		char m_stateFile[255];
 
+		unsigned m_gdbPort;
+		CGDBServer *m_gdbServer;
+		EHaltReason m_haltReason;
+
 		bool InputIsValid(CInput *input);
 
 		void ListInputs();
@@ -63,6 +68,8 @@ namespace Debugger
 	protected:
 		void AddCPUs();
 
+		void ExecutionHalted(CCPUDebug *cpu, EHaltReason reason);
+
 		void WaitCommand(CCPUDebug *cpu);
 
 		bool ProcessToken(const char *token, const char *cmd);
@@ -85,6 +92,11 @@ namespace Debugger
 
 		CSupermodelDebugger(::CModel3 *model3, ::CInputs *inputs, std::shared_ptr<CLogger> logger);
 
+		/*
+		 * Sets TCP port on which to serve GDB remote protocol clients for main board CPU, or 0 for none.  Must be set before attaching.
+		 */
+		void SetGDBPort(unsigned port);
+
 		void Poll();
 
 		bool LoadModel3State(const char *fileName);
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <memory>
+#include <map>
+#include <vector>
 
 struct Game
 {
@@ -31,6 +33,21 @@ struct Game
   float real3d_status_bit_set_percent_of_frame = 0; // overrides default status bit timing (0 for default)
   uint32_t encryption_key = 0;
   bool netboard_present;
+  bool idle_skip = true;                // allow PowerPC idle loops to be skipped
+  uint32_t boot_pc = 0;                 // branch target reached once booted, ending turbo boot (0 for none)
+  std::map<std::string, std::string> performance; // shipped defaults for settings, by name, overridden by the INI file
+
+  struct HLERoutine                     // guest routine done by the host (see CPU/PowerPC/ppc_hle.c)
+  {
+    std::string name;
+    std::string type;                   // memcpy, memset, memcpy32, memset32 or selftest
+    std::vector<uint32_t> words;        // instructions at its entry point
+    std::vector<uint32_t> masks;        // bits of each that must match
+    unsigned cycles_per_word = 3;       // estimated cost charged for it
+    uint32_t result = 0;                // returned in r3 by a selftest routine
+    bool enabled = true;
+  };
+  std::vector<HLERoutine> hle_routines;
 
   enum Inputs
   {
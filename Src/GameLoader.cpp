@@ -1,15 +1,87 @@
 #include "GameLoader.h"
+#include "ROMCache.h"
 #include "OSD/Logger.h"
+#include "OSD/Thread.h"
 #include "Util/NewConfig.h"
 #include "Util/ConfigBuilders.h"
 #include "Util/ByteSwap.h"
 #include "Util/Format.h"
 #include <algorithm>
+#include <cctype>
+#include <cstdio>
 #include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static bool IsDirectory(const std::string &path)
+{
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static bool GetFileSize(size_t *size, uint64_t *mtime, const std::string &path)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+    return false;
+  *size = size_t(st.st_size);
+  *mtime = uint64_t(st.st_mtime);
+  return true;
+}
+
+// Maps a file read-only, so that a region needing no swapping or interleaving
+// takes no copy and shares the OS page cache with other instances. Returns an
+// empty pointer if it cannot be mapped.
+static std::shared_ptr<uint8_t> MapFile(const std::string &path, size_t size)
+{
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return std::shared_ptr<uint8_t>();
+  void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED)
+    return std::shared_ptr<uint8_t>();
+  return std::shared_ptr<uint8_t>((uint8_t *) ptr, [size](uint8_t *p) { munmap(p, size); });
+#else
+  return std::shared_ptr<uint8_t>();
+#endif
+}
+
+// CRC-32 of zip files, with the ARMv8 CRC instructions where available. (The
+// SSE4.2 instruction computes CRC-32C, a different polynomial, so x86 relies
+// on zlib.)
+static uint32_t ComputeCRC32(uint32_t crc, const uint8_t *data, size_t size)
+{
+#if defined(__ARM_FEATURE_CRC32)
+  crc = ~crc;
+  for (; size >= 8; data += 8, size -= 8)
+  {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc = __crc32d(crc, word);
+  }
+  for (; size > 0; data++, size--)
+    crc = __crc32b(crc, *data);
+  return ~crc;
+#else
+  return uint32_t(crc32(crc, data, uInt(size)));
+#endif
+}
 
 bool GameLoader::LoadZipArchive(ZipArchive *zip, const std::string &zipfilename) const
 {
+  uint64_t start = CThread::GetMicroseconds();
   unzFile zf = unzOpen(zipfilename.c_str());
   if (NULL == zf)
   {
@@ -30,6 +102,8 @@ bool GameLoader::LoadZipArchive(ZipArchive *zip, const std::string &zipfilename)
     zip->files_by_crc[file_info.crc].zf = zf;
     zip->files_by_crc[file_info.crc].zipfilename = filename_buffer;
     zip->files_by_crc[file_info.crc].filename = filename_buffer;
+    zip->files_by_crc[file_info.crc].archive = zipfilename;
+    unzGetFilePos(zf, &zip->files_by_crc[file_info.crc].pos);
     zip->files_by_crc[file_info.crc].uncompressed_size = file_info.uncompressed_size;
     zip->files_by_crc[file_info.crc].crc32 = file_info.crc;
   }
@@ -39,7 +113,58 @@ bool GameLoader::LoadZipArchive(ZipArchive *zip, const std::string &zipfilename)
     ErrorLog("Unable to read the contents of '%s' (code 0x%x).", zipfilename.c_str(), err);
     return true;
   }
-  InfoLog("Opened %s.", zipfilename.c_str());
+  InfoLog("Opened %s (read directory in %1.1f ms).", zipfilename.c_str(), (CThread::GetMicroseconds() - start) / 1000.0);
+  return false;
+}
+
+// Finds the ROM files of a game in a directory by name, as their CRCs would
+// take reading them all. Every file the game (merged with its parent, for a
+// child set) is defined with is looked for, in lower and upper case.
+bool GameLoader::LoadDirectory(ZipArchive *zip, const std::string &dir, const std::string &game_name) const
+{
+  uint64_t start = CThread::GetMicroseconds();
+  auto merged = m_regions_by_merged_game.find(game_name);
+  auto unmerged = m_regions_by_game.find(game_name);
+  if (unmerged == m_regions_by_game.end())
+  {
+    ErrorLog("'%s' is a directory but '%s' is not a known game. Directories must be named after the game.", dir.c_str(), game_name.c_str());
+    return true;
+  }
+  auto &regions_by_name = merged != m_regions_by_merged_game.end() ? merged->second : unmerged->second;
+  zip->zipfilenames.push_back(dir);
+
+  unsigned num_found = 0;
+  for (auto &v: regions_by_name)
+  {
+    for (auto &file: v.second->files)
+    {
+      uint32_t key = file->has_crc32 ? file->crc32 : uint32_t(crc32(0, reinterpret_cast<const Bytef *>(file->filename.c_str()), uInt(file->filename.length())));
+      if (zip->files_by_crc.count(key))
+        continue;
+      std::string upper = file->filename;
+      std::transform(upper.begin(), upper.end(), upper.begin(), [](unsigned char c) { return char(toupper(c)); });
+      for (const std::string &name: { file->filename, upper })
+      {
+        std::string path = dir + "/" + name;
+        size_t size = 0;
+        uint64_t mtime = 0;
+        if (GetFileSize(&size, &mtime, path))
+        {
+          ZippedFile &found = zip->files_by_crc[key];
+          found.zipfilename = name;
+          found.filename = name;
+          found.archive = dir;
+          found.path = path;
+          found.uncompressed_size = size;
+          found.mtime = mtime;
+          found.crc32 = key;
+          num_found++;
+          break;
+        }
+      }
+    }
+  }
+  InfoLog("Opened %s (found %u ROM files in %1.1f ms).", dir.c_str(), num_found, (CThread::GetMicroseconds() - start) / 1000.0);
   return false;
 }
 
@@ -67,7 +192,7 @@ const GameLoader::ZippedFile *GameLoader::LookupFile(const File::ptr_t &file, co
     auto it = zip.files_by_crc.find(file->crc32);
     if (it == zip.files_by_crc.end())
     {
-      if (zip.zfs.size() == 1)
+      if (zip.zipfilenames.size() == 1)
         ErrorLog("'%s' with CRC32 0x%08x not found in '%s'.", file->filename.c_str(), file->crc32, zip.zipfilenames[0].c_str());
       else
         ErrorLog("'%s' with CRC32 0x%08x not found in '%s'.", file->filename.c_str(), file->crc32, Util::Format("', '").Join(zip.zipfilenames).str().c_str());
@@ -82,45 +207,145 @@ const GameLoader::ZippedFile *GameLoader::LookupFile(const File::ptr_t &file, co
     if (Util::ToLower(v.second.filename) == file->filename)
       return &v.second;
   }
-  if (zip.zfs.size() == 1)
+  if (zip.zipfilenames.size() == 1)
     ErrorLog("'%s' not found in '%s'.", file->filename.c_str(), zip.zipfilenames[0].c_str());
   else
     ErrorLog("'%s' not found in '%s'.", file->filename.c_str(), Util::Format("', '").Join(zip.zipfilenames).str().c_str());
   return nullptr;
 }
 
-bool GameLoader::LoadZippedFile(std::shared_ptr<uint8_t> *buffer, size_t *file_size, const GameLoader::File::ptr_t &file, const ZipArchive &zip) const
+// Opens the archive again, so that files can be read on several threads at
+// once as a minizip handle may only be used by one, and opens the file in it.
+// Returns NULL on error.
+unzFile GameLoader::OpenZippedFile(const ZippedFile &zipped_file)
 {
+  unzFile zf = unzOpen(zipped_file.archive.c_str());
+  if (NULL == zf)
+  {
+    ErrorLog("Could not open '%s'.", zipped_file.archive.c_str());
+    return NULL;
+  }
+
   // Locate file
-  const ZippedFile *zipped_file = LookupFile(file, zip);
-  if (!zipped_file)
-    return true;
-  if (UNZ_OK != unzLocateFile(zipped_file->zf, zipped_file->filename.c_str(), 2))
+  unz_file_pos pos = zipped_file.pos;
+  if (UNZ_OK != unzGoToFilePos(zf, &pos))
   {
-    ErrorLog("Unable to locate '%s' in '%s'. Is zip file corrupt?", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
-    return true;
+    ErrorLog("Unable to locate '%s' in '%s'. Is zip file corrupt?", zipped_file.filename.c_str(), zipped_file.archive.c_str());
+    unzClose(zf);
+    return NULL;
+  }
+  if (UNZ_OK != unzOpenCurrentFile(zf))
+  {
+    ErrorLog("Unable to read '%s' from '%s'. Is zip file corrupt?", zipped_file.filename.c_str(), zipped_file.archive.c_str());
+    unzClose(zf);
+    return NULL;
   }
+  return zf;
+}
 
-  // Read it in
-  if (UNZ_OK != unzOpenCurrentFile(zipped_file->zf))
+// Closes a file opened by OpenZippedFile(), checking its CRC if it was read to
+// the end. Returns true on error.
+bool GameLoader::CloseZippedFile(unzFile zf, const ZippedFile &zipped_file, bool read_all)
+{
+  if (!read_all)
   {
-    ErrorLog("Unable to read '%s' from '%s'. Is zip file corrupt?", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
+    ErrorLog("Unable to read '%s' from '%s'. Is zip file corrupt?", zipped_file.filename.c_str(), zipped_file.archive.c_str());
+    unzCloseCurrentFile(zf);
+    unzClose(zf);
     return true;
   }
-  *file_size = zipped_file->uncompressed_size;
-  buffer->reset(new uint8_t[*file_size], std::default_delete<uint8_t[]>());
-  size_t bytes_read = (size_t) unzReadCurrentFile(zipped_file->zf, buffer->get(), *file_size);
-  if (bytes_read != *file_size)
+  if (UNZ_CRCERROR == unzCloseCurrentFile(zf))
+    ErrorLog("CRC error reading '%s' from '%s'. File may be corrupt.", zipped_file.filename.c_str(), zipped_file.archive.c_str());
+  unzClose(zf);
+  return false;
+}
+
+// Inflates a file into dest, which must be large enough
+bool GameLoader::ReadZippedFile(uint8_t *dest, const ZippedFile &zipped_file)
+{
+  if (!zipped_file.path.empty())
   {
-    ErrorLog("Unable to read '%s' from '%s'. Is zip file corrupt?", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
-    unzCloseCurrentFile(zipped_file->zf);
+    FILE *fp = fopen(zipped_file.path.c_str(), "rb");
+    bool error = fp == NULL || fread(dest, 1, zipped_file.uncompressed_size, fp) != zipped_file.uncompressed_size;
+    if (fp != NULL)
+      fclose(fp);
+    if (error)
+      ErrorLog("Unable to read '%s'.", zipped_file.path.c_str());
+    return error;
+  }
+  if (zipped_file.packed)
+    return ReadPackedFile(dest, zipped_file);
+
+  unzFile zf = OpenZippedFile(zipped_file);
+  if (NULL == zf)
     return true;
+  size_t bytes_read = (size_t) unzReadCurrentFile(zf, dest, unsigned(zipped_file.uncompressed_size));
+  return CloseZippedFile(zf, zipped_file, bytes_read == zipped_file.uncompressed_size);
+}
+
+// Inflates a file a piece at a time through a small buffer, passing each
+// piece and its offset in the file to consume
+bool GameLoader::StreamZippedFile(const ZippedFile &zipped_file, const std::function<void(const uint8_t *data, size_t offset, size_t size)> &consume)
+{
+  static const size_t BufferSize = 0x10000;
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[BufferSize]);
+  size_t offset = 0;
+  if (!zipped_file.path.empty())
+  {
+    FILE *fp = fopen(zipped_file.path.c_str(), "rb");
+    while (fp != NULL && offset < zipped_file.uncompressed_size)
+    {
+      size_t bytes_read = fread(buffer.get(), 1, (std::min)(BufferSize, zipped_file.uncompressed_size - offset), fp);
+      if (bytes_read == 0)
+        break;
+      consume(buffer.get(), offset, bytes_read);
+      offset += bytes_read;
+    }
+    if (fp != NULL)
+      fclose(fp);
+    if (offset != zipped_file.uncompressed_size)
+    {
+      ErrorLog("Unable to read '%s'.", zipped_file.path.c_str());
+      return true;
+    }
+    return false;
+  }
+  if (zipped_file.packed)
+  {
+    // One frame at a time, in order
+    std::unique_ptr<uint8_t[]> frame_buffer(new uint8_t[zipped_file.frame_size]);
+    std::vector<uint8_t> compressed;
+    FILE *fp = fopen(zipped_file.archive.c_str(), "rb");
+    for (size_t i = 0; fp != NULL && i < zipped_file.frames.size(); i++)
+    {
+      size_t size = (std::min)(size_t(zipped_file.frame_size), zipped_file.uncompressed_size - offset);
+      if (ReadPackFrame(frame_buffer.get(), fp, zipped_file, i, &compressed))
+        break;
+      consume(frame_buffer.get(), offset, size);
+      offset += size;
+    }
+    if (fp != NULL)
+      fclose(fp);
+    if (offset != zipped_file.uncompressed_size)
+    {
+      ErrorLog("Unable to read '%s' from '%s'. Is the ROM pack corrupt?", zipped_file.filename.c_str(), zipped_file.archive.c_str());
+      return true;
+    }
+    return false;
   }
 
-  // And close it
-  if (UNZ_CRCERROR == unzCloseCurrentFile(zipped_file->zf))
-    ErrorLog("CRC error reading '%s' from '%s'. File may be corrupt.", zipped_file->filename.c_str(), zipped_file->zipfilename.c_str());
-  return false;
+  unzFile zf = OpenZippedFile(zipped_file);
+  if (NULL == zf)
+    return true;
+  while (offset < zipped_file.uncompressed_size)
+  {
+    int bytes_read = unzReadCurrentFile(zf, buffer.get(), unsigned((std::min)(BufferSize, zipped_file.uncompressed_size - offset)));
+    if (bytes_read <= 0)
+      break;
+    consume(buffer.get(), offset, size_t(bytes_read));
+    offset += size_t(bytes_read);
+  }
+  return CloseZippedFile(zf, zipped_file, offset == zipped_file.uncompressed_size);
 }
 
 bool GameLoader::MissingAttrib(const GameLoader &loader, const Util::Config::Node &node, const std::string &attribute)
@@ -217,6 +442,64 @@ static void PopulateGameInfo(Game *game, const Util::Config::Node &game_node)
   game->real3d_status_bit_set_percent_of_frame = game_node["hardware/real3d_status_bit_set_percent_of_frame"].ValueAsDefault<float>(0);
   game->encryption_key = game_node["hardware/encryption_key"].ValueAsDefault<uint32_t>(0);
   game->netboard_present = game_node["hardware/netboard"].ValueAsDefault<bool>(false);
+  game->idle_skip = game_node["hardware/idle_skip"].ValueAsDefault<bool>(true);
+  game->boot_pc = game_node["hardware/boot_pc"].ValueAsDefault<uint32_t>(0);
+
+  // Performance profile: settings named as in the INI file
+  game->performance.clear();
+  if (const Util::Config::Node *performance = game_node.TryGet("performance"))
+  {
+    for (auto it = performance->begin(); it != performance->end(); ++it)
+    {
+      if (it->IsLeaf() && it->Exists())
+        game->performance[it->Key()] = it->ValueAs<std::string>();
+    }
+  }
+
+  // Guest routines emulated by the host, recognised by their signature: the
+  // instruction words at their entry, '?' digits matching anything
+  game->hle_routines.clear();
+  if (const Util::Config::Node *hle = game_node.TryGet("hle"))
+  {
+    for (auto &node: *hle)
+    {
+      if (node.Key() != "routine" || !node["name"].Exists() || !node["type"].Exists() || !node["signature"].Exists())
+        continue;
+      Game::HLERoutine routine;
+      routine.name = node["name"].ValueAs<std::string>();
+      routine.type = node["type"].ValueAs<std::string>();
+      routine.cycles_per_word = node["cycles_per_word"].ValueAsDefault<unsigned>(3);
+      routine.enabled = node["enabled"].ValueAsDefault<bool>(true);
+      routine.result = node["result"].ValueAsDefault<uint32_t>(0);
+      bool valid = routine.type == "memcpy" || routine.type == "memset" || routine.type == "memcpy32" || routine.type == "memset32" || routine.type == "selftest";
+      std::string signature = node["signature"].ValueAs<std::string>();
+      for (size_t pos = signature.find_first_not_of(" \t\r\n"); valid && pos != std::string::npos; pos = signature.find_first_not_of(" \t\r\n", pos))
+      {
+        size_t end = std::min(signature.find_first_of(" \t\r\n", pos), signature.size());
+        valid = end - pos == 8;
+        uint32_t word = 0;
+        uint32_t mask = 0;
+        for (; valid && pos < end; pos++)
+        {
+          char c = (char) toupper(signature[pos]);
+          word <<= 4;
+          mask <<= 4;
+          if (c == '?')
+            continue;
+          valid = isxdigit(c) != 0;
+          word |= uint32_t(isdigit(c) ? c - '0' : c - 'A' + 10);
+          mask |= 0xF;
+        }
+        routine.words.push_back(word);
+        routine.masks.push_back(mask);
+        pos = end;
+      }
+      if (valid && !routine.words.empty())
+        game->hle_routines.push_back(routine);
+      else
+        ErrorLog("Ignoring HLE routine '%s' of '%s' with an invalid type or signature.", routine.name.c_str(), game->name.c_str());
+    }
+  }
 
   std::map<std::string, uint32_t> input_flags
   {
@@ -489,190 +772,970 @@ bool GameLoader::ParseXML(const Util::Config::Node &xml)
   return error;
 }
 
-bool GameLoader::LoadDefinitionXML(const std::string &filename)
-{
-  m_xml_filename = filename;
-  Util::Config::Node xml("xml");
-  if (Util::Config::FromXMLFile(&xml, filename))
-  {
-    ErrorLog("Game and ROM set definitions could not be loaded! ROMs will not be detected.");
-    return true;
-  }
-  return ParseXML(xml);
-}
+/*
+ * Definition cache: the tables built from the XML, so that later runs need
+ * not parse it. The file is a header followed by the files, then the regions
+ * (referring to files by index), then the games (referring to regions by
+ * index), so that files and regions shared between parent and child sets
+ * remain shared. Strings are a 32-bit length followed by characters.
+ */
+static const char s_definition_cache_magic[8] = { 'S', 'M', 'G', 'A', 'M', 'E', 'S', '\0' };
 
-void GameLoader::FindEquivalentFiles(std::set<File::ptr_t> *equivalent_files, const std::set<File::ptr_t> &a, const std::set<File::ptr_t> &b)
+// Must be incremented whenever the cached tables, or the Game structure,
+// change
+static const uint32_t DefinitionCacheVersion = 4;
+
+namespace
 {
-  // Copy files that are equivalent between a and b from a (doesn't matter
-  // which we actually use) to output
-  for (auto &file1: a)
+  class DefinitionWriter
   {
-    for (auto &file2: b)
+  public:
+    std::vector<uint8_t> data;
+
+    void Write(const void *ptr, size_t size)
     {
-      if (*file1 == *file2)
-        equivalent_files->insert(file1);
+      data.insert(data.end(), reinterpret_cast<const uint8_t *>(ptr), reinterpret_cast<const uint8_t *>(ptr) + size);
     }
-  }
-}
 
-void GameLoader::IdentifyGamesInZipArchive(
-  std::set<std::string> *complete_games,
-  std::map<std::string, std::set<File::ptr_t>> *files_missing_by_game,
-  const ZipArchive &zip,
-  const std::map<std::string, RegionsByName_t> &regions_by_game) const
-{
-  std::map<std::string, std::set<File::ptr_t>> files_required_by_game;
-  std::map<std::string, std::set<File::ptr_t>> files_found_by_game;
+    template <typename T>
+    void Write(T value)
+    {
+      Write(&value, sizeof(value));
+    }
 
-  // Determine which files each game requires and which files are present in
-  // the zip archive. Files belonging to optional regions cannot be used to
-  // identify games.
-  for (auto &v1: regions_by_game)
+    void Write(const std::string &str)
+    {
+      Write(uint32_t(str.length()));
+      Write(str.data(), str.length());
+    }
+  };
+
+  class DefinitionReader
   {
-    const std::string &game_name = v1.first;
-    auto &regions_by_name = v1.second;
-    for (auto &v2: regions_by_name)
+  public:
+    bool error = false;
+
+    void Read(void *ptr, size_t size)
     {
-      Region::ptr_t region = v2.second;
-      if (!region->required)
-        continue;
-      for (auto file: region->files)
+      if (size_t(m_end - m_ptr) < size)
       {
-        // Add each file to the set of required files per game
-        files_required_by_game[game_name].insert(file);
-        // Check file in ROM definition against all files in zip
-        if (FileExistsInZipArchive(file, zip))
-          files_found_by_game[game_name].insert(file);
+        error = true;
+        memset(ptr, 0, size);
+        return;
       }
+      memcpy(ptr, m_ptr, size);
+      m_ptr += size;
     }
-  }
 
-  /*
-   * Corner case: some child ROM sets legitimately share files, which can fool
-   * us into thinking two games are partially present. Need to remove the one
-   * that is not really there by detecting case when only overlapping files
-   * exist (the ROM set with more present files is the intended one).
-   */
-  std::vector<std::string> to_remove;
-  for (auto &v1: files_found_by_game)
-  {
-    auto &game1_name = v1.first;
-    auto &game1_files = v1.second;
-    for (auto &v2: files_found_by_game)
+    template <typename T>
+    T Read()
     {
-      auto &game2_name = v2.first;
-      auto &game2_files = v2.second;
-      if (game1_name == game2_name)
-        continue;
-      std::set<File::ptr_t> equivalent_files;
-      FindEquivalentFiles(&equivalent_files, game1_files, game2_files);
-      /*
-       * If the these two games have a different number of files in the zip
-       * archive, but one consists only of the overlapping files, we can safely
-       * conclude that these files represent only the game with the larger
-       * number of files present. Otherwise, if only the overlapping files are
-       * present for both, we have a genuine ambiguity and hence do nothing.
-       */
-      if (game1_files.size() != game2_files.size() && equivalent_files.size() == game2_files.size())
-        to_remove.push_back(game2_name);
+      T value;
+      Read(&value, sizeof(value));
+      return value;
     }
-  }
-  for (auto &game_name: to_remove)
-  {
-    files_found_by_game.erase(game_name);
-  }
 
-  // Find the missing files for each game we found in the zip archive, then use
-  // this to determine whether the complete game exists
-  auto compare = [](const File::ptr_t &a, const File::ptr_t &b) { return a->filename < b->filename; };
-  for (auto &v: files_found_by_game)
-  {
-    auto &files_found = v.second;
-    auto &files_required = files_required_by_game[v.first];
-    auto &files_missing = (*files_missing_by_game)[v.first];
-    // Need to sort by filename for set_difference to work
-    std::vector<File::ptr_t> files_found_v(files_found.begin(), files_found.end());
-    std::vector<File::ptr_t> files_required_v(files_required.begin(), files_required.end());
-    std::sort(files_found_v.begin(), files_found_v.end(), compare);
-    std::sort(files_required_v.begin(), files_required_v.end(), compare);
-    // Use set difference to find missing files
-    std::set_difference(
-      files_required_v.begin(), files_required_v.end(),
-      files_found_v.begin(), files_found_v.end(),
-      std::inserter(files_missing, files_missing.end()),
-      compare);
-    // Is the whole game present?
-    if (files_found == files_required)
-      complete_games->insert(v.first);
-    // Clean up: if no files missing, don't want empty entry in map
-    if (files_missing.empty())
-      files_missing_by_game->erase(v.first);
-  }
-}
+    std::string ReadString()
+    {
+      uint32_t length = Read<uint32_t>();
+      if (size_t(m_end - m_ptr) < length)
+      {
+        error = true;
+        return std::string();
+      }
+      std::string str(reinterpret_cast<const char *>(m_ptr), length);
+      m_ptr += length;
+      return str;
+    }
 
-void GameLoader::ChooseGameInZipArchive(std::string *chosen_game, bool *missing_parent_roms, const ZipArchive &zip, const std::string &zipfilename) const
-{
-  chosen_game->clear();
-  *missing_parent_roms = false;
+    DefinitionReader(const std::vector<uint8_t> &data)
+      : m_ptr(data.data()),
+        m_end(data.data() + data.size())
+    {}
 
-  // Find complete unmerged games (those that do not need to be merged with a
-  // parent). This will pick up child-only ROMs, too, which we prune out later.
-  std::set<std::string> complete_games;
-  std::map<std::string, std::set<File::ptr_t>> files_missing_by_game;
-  IdentifyGamesInZipArchive(&complete_games, &files_missing_by_game, zip, m_regions_by_game);
+  private:
+    const uint8_t *m_ptr;
+    const uint8_t *m_end;
+  };
+}
 
-  // Find complete, merged games
-  std::set<std::string> complete_merged_games;
-  std::map<std::string, std::set<File::ptr_t>> files_missing_by_merged_game;
-  IdentifyGamesInZipArchive(&complete_merged_games, &files_missing_by_merged_game, zip, m_regions_by_merged_game);
+std::string StripFilename(const std::string &filepath);
 
-  /*
-   * Find incomplete child games by sorting child games out from the unmerged
-   * games results and pruning out complete merged games. Don't care about
-   * missing files because they are not neccessarily an error for these games.
-   * If one ends up being chosen, we would try to load from a second, parent
-   * ROM set.
-   */
-  std::set<std::string> incomplete_child_games;
-  for (auto &v: m_game_info_by_game)
+static std::string GetDefinitionCachePath(const std::string &dir, const std::string &xml_file)
+{
+  std::string path = dir;
+  if (!path.empty() && path.back() != '/' && path.back() != '\\')
+    path += '/';
+  return path + xml_file.substr(StripFilename(xml_file).length()) + ".bin";
+}
+
+bool GameLoader::SaveDefinitionCache(const std::string &file, uint32_t key) const
+{
+  DefinitionWriter out;
+  out.Write(s_definition_cache_magic, sizeof(s_definition_cache_magic));
+  out.Write(DefinitionCacheVersion);
+  out.Write(key);
+
+  // Number every file and region once
+  std::map<const File *, uint32_t> file_index;
+  std::map<const Region *, uint32_t> region_index;
+  std::vector<const File *> files;
+  std::vector<const Region *> regions;
+  for (auto *games: { &m_regions_by_game, &m_regions_by_merged_game })
   {
-    auto &game_name = v.first;
-    if (IsChildSet(v.second))
+    for (auto &v1: *games)
     {
-      if (complete_games.count(game_name) || files_missing_by_game.find(game_name) != files_missing_by_game.end())
+      for (auto &v2: v1.second)
       {
-        incomplete_child_games.insert(game_name);
-        complete_games.erase(game_name);
-        files_missing_by_game.erase(game_name);
+        const Region *region = v2.second.get();
+        if (region_index.emplace(region, uint32_t(regions.size())).second)
+          regions.push_back(region);
+        for (auto &file: region->files)
+        {
+          if (file_index.emplace(file.get(), uint32_t(files.size())).second)
+            files.push_back(file.get());
+        }
       }
     }
   }
-  for (auto &game_name: complete_merged_games)
+
+  out.Write(uint32_t(files.size()));
+  for (const File *file: files)
   {
-    incomplete_child_games.erase(game_name);
+    out.Write(file->filename);
+    out.Write(file->offset);
+    out.Write(file->crc32);
+    out.Write(file->has_crc32);
   }
-
-  // Complete merged games take highest precedence
-  for (auto &game_name: complete_merged_games)
+  out.Write(uint32_t(regions.size()));
+  for (const Region *region: regions)
   {
-    const std::string &parent = m_game_info_by_game.find(game_name)->second.parent;
-    // Complete merged game will be used, so ignore the parent entirely
-    complete_games.erase(parent);
-    // Complete merged sets will often have some parent ROMs missing (those
-    // replaced by the child games). This is not an error, so remove parents of
-    // complete merged games from missing file list.
-    files_missing_by_game.erase(parent);
+    out.Write(region->region_name);
+    out.Write(uint64_t(region->stride));
+    out.Write(uint64_t(region->chunk_size));
+    out.Write(region->byte_swap);
+    out.Write(region->required);
+    out.Write(uint32_t(region->files.size()));
+    for (auto &file: region->files)
+      out.Write(file_index[file.get()]);
   }
 
-  // Any remaining incomplete games from the unmerged set are legitimate errors
-  for (auto &v: files_missing_by_game)
+  out.Write(uint32_t(m_game_info_by_game.size()));
+  for (auto &v: m_game_info_by_game)
   {
-    for (auto &file: v.second)
+    const Game &game = v.second;
+    out.Write(game.name);
+    out.Write(game.parent);
+    out.Write(game.title);
+    out.Write(game.version);
+    out.Write(game.manufacturer);
+    out.Write(game.year);
+    out.Write(game.stepping);
+    out.Write(game.mpeg_board);
+    out.Write(uint32_t(game.audio));
+    out.Write(game.pci_bridge);
+    out.Write(game.real3d_pci_id);
+    out.Write(game.real3d_status_bit_set_percent_of_frame);
+    out.Write(game.encryption_key);
+    out.Write(game.netboard_present);
+    out.Write(game.idle_skip);
+    out.Write(game.boot_pc);
+    out.Write(uint32_t(game.performance.size()));
+    for (auto &setting: game.performance)
     {
-      ErrorLog("'%s' (CRC32 0x%08x) not found in '%s' for game '%s'.", file->filename.c_str(), file->crc32, zipfilename.c_str(), v.first.c_str());
+      out.Write(setting.first);
+      out.Write(setting.second);
     }
-    ErrorLog("Ignoring game '%s' in '%s' because it is missing files.", v.first.c_str(), zipfilename.c_str());
-  }
+    out.Write(uint32_t(game.hle_routines.size()));
+    for (auto &routine: game.hle_routines)
+    {
+      out.Write(routine.name);
+      out.Write(routine.type);
+      out.Write(uint32_t(routine.words.size()));
+      for (size_t j = 0; j < routine.words.size(); j++)
+      {
+        out.Write(routine.words[j]);
+        out.Write(routine.masks[j]);
+      }
+      out.Write(uint32_t(routine.cycles_per_word));
+      out.Write(routine.result);
+      out.Write(routine.enabled);
+    }
+    out.Write(game.inputs);
+    out.Write(uint32_t(game.driveboard_type));
+
+    auto patches = m_patches_by_game.find(game.name);
+    out.Write(uint32_t(patches == m_patches_by_game.end() ? 0 : patches->second.size()));
+    if (patches != m_patches_by_game.end())
+    {
+      for (auto &p: patches->second)
+      {
+        out.Write(p.first);
+        out.Write(uint32_t(p.second.size()));
+        for (auto &patch: p.second)
+        {
+          out.Write(patch.offset);
+          out.Write(patch.value);
+          out.Write(patch.bits);
+        }
+      }
+    }
+
+    for (auto *games: { &m_regions_by_game, &m_regions_by_merged_game })
+    {
+      auto regions_by_name = games->find(game.name);
+      out.Write(regions_by_name != games->end());
+      if (regions_by_name == games->end())
+        continue;
+      out.Write(uint32_t(regions_by_name->second.size()));
+      for (auto &v2: regions_by_name->second)
+        out.Write(region_index[v2.second.get()]);
+    }
+  }
+
+  // Write to a temporary file first, so that instances starting at the same
+  // time never see a partial file
+  std::string temp_file = file + "." + std::to_string(CThread::GetMicroseconds());
+  FILE *fp = fopen(temp_file.c_str(), "wb");
+  if (!fp)
+    return ErrorLog("Unable to create game definition cache '%s'.", file.c_str());
+  bool error = fwrite(out.data.data(), out.data.size(), 1, fp) != 1;
+  error = fclose(fp) != 0 || error;
+  if (error || rename(temp_file.c_str(), file.c_str()) != 0)
+  {
+    remove(temp_file.c_str());
+    return ErrorLog("Unable to write game definition cache '%s'.", file.c_str());
+  }
+  return false;
+}
+
+// Returns true, leaving the tables empty, if the file is missing, corrupt, or
+// not a cache of the XML identified by key
+bool GameLoader::LoadDefinitionCache(const std::string &file, uint32_t key)
+{
+  std::vector<uint8_t> data;
+  FILE *fp = fopen(file.c_str(), "rb");
+  if (!fp)
+    return true;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  data.resize(size > 0 ? size_t(size) : 0);
+  bool error = data.empty() || fread(data.data(), data.size(), 1, fp) != 1;
+  fclose(fp);
+  if (error)
+    return true;
+
+  DefinitionReader in(data);
+  char magic[sizeof(s_definition_cache_magic)];
+  in.Read(magic, sizeof(magic));
+  if (memcmp(magic, s_definition_cache_magic, sizeof(magic)) || in.Read<uint32_t>() != DefinitionCacheVersion || in.Read<uint32_t>() != key || in.error)
+    return true;
+
+  std::vector<File::ptr_t> files(in.Read<uint32_t>());
+  for (size_t i = 0; i < files.size() && !in.error; i++)
+  {
+    files[i] = std::make_shared<File>();
+    files[i]->filename = in.ReadString();
+    files[i]->offset = in.Read<uint32_t>();
+    files[i]->crc32 = in.Read<uint32_t>();
+    files[i]->has_crc32 = in.Read<bool>();
+  }
+  std::vector<Region::ptr_t> regions(in.Read<uint32_t>());
+  for (size_t i = 0; i < regions.size() && !in.error; i++)
+  {
+    regions[i] = std::make_shared<Region>();
+    regions[i]->region_name = in.ReadString();
+    regions[i]->stride = size_t(in.Read<uint64_t>());
+    regions[i]->chunk_size = size_t(in.Read<uint64_t>());
+    regions[i]->byte_swap = in.Read<bool>();
+    regions[i]->required = in.Read<bool>();
+    uint32_t num_files = in.Read<uint32_t>();
+    for (uint32_t j = 0; j < num_files && !in.error; j++)
+    {
+      uint32_t idx = in.Read<uint32_t>();
+      in.error |= idx >= files.size();
+      if (!in.error)
+        regions[i]->files.push_back(files[idx]);
+    }
+  }
+
+  uint32_t num_games = in.Read<uint32_t>();
+  for (uint32_t i = 0; i < num_games && !in.error; i++)
+  {
+    Game game;
+    game.name = in.ReadString();
+    game.parent = in.ReadString();
+    game.title = in.ReadString();
+    game.version = in.ReadString();
+    game.manufacturer = in.ReadString();
+    game.year = in.Read<unsigned>();
+    game.stepping = in.ReadString();
+    game.mpeg_board = in.ReadString();
+    game.audio = Game::AudioTypes(in.Read<uint32_t>());
+    game.pci_bridge = in.ReadString();
+    game.real3d_pci_id = in.Read<uint32_t>();
+    game.real3d_status_bit_set_percent_of_frame = in.Read<float>();
+    game.encryption_key = in.Read<uint32_t>();
+    game.netboard_present = in.Read<bool>();
+    game.idle_skip = in.Read<bool>();
+    game.boot_pc = in.Read<uint32_t>();
+    uint32_t num_settings = in.Read<uint32_t>();
+    for (uint32_t j = 0; j < num_settings && !in.error; j++)
+    {
+      std::string key = in.ReadString();
+      game.performance[key] = in.ReadString();
+    }
+    uint32_t num_routines = in.Read<uint32_t>();
+    for (uint32_t j = 0; j < num_routines && !in.error; j++)
+    {
+      Game::HLERoutine routine;
+      routine.name = in.ReadString();
+      routine.type = in.ReadString();
+      uint32_t num_words = in.Read<uint32_t>();
+      for (uint32_t k = 0; k < num_words && !in.error; k++)
+      {
+        routine.words.push_back(in.Read<uint32_t>());
+        routine.masks.push_back(in.Read<uint32_t>());
+      }
+      routine.cycles_per_word = in.Read<uint32_t>();
+      routine.result = in.Read<uint32_t>();
+      routine.enabled = in.Read<bool>();
+      game.hle_routines.push_back(routine);
+    }
+    game.inputs = in.Read<uint32_t>();
+    game.driveboard_type = Game::DriveBoardType(in.Read<uint32_t>());
+
+    PatchesByRegion_t &patches_by_region = m_patches_by_game[game.name];
+    uint32_t num_patched_regions = in.Read<uint32_t>();
+    for (uint32_t j = 0; j < num_patched_regions && !in.error; j++)
+    {
+      auto &patches = patches_by_region[in.ReadString()];
+      uint32_t num_patches = in.Read<uint32_t>();
+      for (uint32_t k = 0; k < num_patches && !in.error; k++)
+      {
+        uint32_t offset = in.Read<uint32_t>();
+        uint64_t value = in.Read<uint64_t>();
+        unsigned bits = in.Read<unsigned>();
+        patches.push_back(ROM::BigEndianPatch(offset, value, bits));
+      }
+    }
+
+    for (auto *games: { &m_regions_by_game, &m_regions_by_merged_game })
+    {
+      if (!in.Read<bool>())
+        continue;
+      RegionsByName_t &regions_by_name = (*games)[game.name];
+      uint32_t num_regions = in.Read<uint32_t>();
+      for (uint32_t j = 0; j < num_regions && !in.error; j++)
+      {
+        uint32_t idx = in.Read<uint32_t>();
+        in.error |= idx >= regions.size();
+        if (!in.error)
+          regions_by_name[regions[idx]->region_name] = regions[idx];
+      }
+    }
+    m_game_info_by_game[game.name] = game;
+  }
+
+  if (in.error || m_regions_by_game.empty())
+  {
+    m_game_info_by_game.clear();
+    m_patches_by_game.clear();
+    m_regions_by_game.clear();
+    m_regions_by_merged_game.clear();
+    return true;
+  }
+  return false;
+}
+
+bool GameLoader::LoadDefinitionXML(const std::string &filename, const std::string &cache_dir)
+{
+  m_xml_filename = filename;
+  uint64_t start = CThread::GetMicroseconds();
+
+  // The cache is keyed by the contents of the XML file, which is much quicker
+  // to read than to parse
+  std::string text;
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp)
+  {
+    char buffer[0x10000];
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+      text.append(buffer, bytes_read);
+    fclose(fp);
+  }
+  uint32_t key = uint32_t(crc32(crc32(0, reinterpret_cast<const Bytef *>(text.data()), uInt(text.length())), reinterpret_cast<const Bytef *>(filename.c_str()), uInt(filename.length())));
+  std::string cache_file = cache_dir.empty() ? std::string() : GetDefinitionCachePath(cache_dir, filename);
+  if (!text.empty() && !cache_file.empty() && !LoadDefinitionCache(cache_file, key))
+  {
+    DebugLog("Loaded game definitions from '%s' in %1.2f ms.", cache_file.c_str(), (CThread::GetMicroseconds() - start) / 1000.0);
+    return false;
+  }
+
+  Util::Config::Node xml("xml");
+  if (!fp)
+    ErrorLog("Unable to open %s.", filename.c_str());
+  if (!fp || Util::Config::FromXML(&xml, text))
+  {
+    ErrorLog("Game and ROM set definitions could not be loaded! ROMs will not be detected.");
+    return true;
+  }
+  bool error = ParseXML(xml);
+  DebugLog("Parsed game definitions from '%s' in %1.2f ms.", filename.c_str(), (CThread::GetMicroseconds() - start) / 1000.0);
+  if (!error && !cache_file.empty())
+    SaveDefinitionCache(cache_file, key);
+  return error;
+}
+
+/*
+ * ROM packs: a header, then the frames of every file, then an index of the
+ * files. Each file is cut into frames of PackFrameSize bytes (the last one
+ * shorter), deflated independently with zlib so that they can be inflated in
+ * parallel, or stored as is when that does not make them smaller. The index
+ * holds, for each file, its name, CRC-32 as found in the zip archive, size,
+ * the offset of its first frame, and the compressed size of each frame, which
+ * follow each other.
+ */
+const char GameLoader::PackExtension[] = ".smrom";
+static const char s_pack_magic[8] = { 'S', 'M', 'R', 'O', 'M', 'S', '\0', '\0' };
+static const uint32_t PackVersion = 1;
+static const uint32_t PackFrameSize = 0x40000;
+static const size_t PackHeaderSize = sizeof(s_pack_magic) + 4 + 4 + 8 + 4;
+
+static bool IsPack(const std::string &path)
+{
+  size_t length = strlen(GameLoader::PackExtension);
+  return path.length() > length && Util::ToLower(path.substr(path.length() - length)) == GameLoader::PackExtension;
+}
+
+static bool SeekFile(FILE *fp, uint64_t offset)
+{
+#ifdef _WIN32
+  return _fseeki64(fp, int64_t(offset), SEEK_SET) == 0;
+#else
+  return fseeko(fp, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+bool GameLoader::LoadPack(ZipArchive *zip, const std::string &pack_filename) const
+{
+  uint64_t start = CThread::GetMicroseconds();
+  FILE *fp = fopen(pack_filename.c_str(), "rb");
+  if (!fp)
+  {
+    ErrorLog("Could not open '%s'.", pack_filename.c_str());
+    return true;
+  }
+  std::vector<uint8_t> header(PackHeaderSize);
+  bool error = fread(header.data(), header.size(), 1, fp) != 1;
+  DefinitionReader in_header(header);
+  char magic[sizeof(s_pack_magic)];
+  in_header.Read(magic, sizeof(magic));
+  uint32_t version = in_header.Read<uint32_t>();
+  uint32_t frame_size = in_header.Read<uint32_t>();
+  uint64_t index_offset = in_header.Read<uint64_t>();
+  std::vector<uint8_t> index(in_header.Read<uint32_t>());
+  error = error || memcmp(magic, s_pack_magic, sizeof(magic)) || version != PackVersion || frame_size == 0;
+  error = error || !SeekFile(fp, index_offset) || (!index.empty() && fread(index.data(), index.size(), 1, fp) != 1);
+  fclose(fp);
+  if (error)
+  {
+    ErrorLog("'%s' is not a ROM pack of this version of Supermodel, or is corrupt.", pack_filename.c_str());
+    return true;
+  }
+  zip->zipfilenames.push_back(pack_filename);
+
+  // Files are identified by CRC, as in zip archives
+  DefinitionReader in(index);
+  uint32_t num_files = in.Read<uint32_t>();
+  for (uint32_t i = 0; i < num_files && !in.error; i++)
+  {
+    ZippedFile file;
+    file.filename = in.ReadString();
+    file.zipfilename = file.filename;
+    file.archive = pack_filename;
+    file.crc32 = in.Read<uint32_t>();
+    file.uncompressed_size = size_t(in.Read<uint64_t>());
+    file.packed = true;
+    file.frame_size = frame_size;
+    uint64_t offset = in.Read<uint64_t>();
+    uint32_t num_frames = in.Read<uint32_t>();
+    if (num_frames != (file.uncompressed_size + frame_size - 1) / frame_size)
+    {
+      in.error = true;
+      break;
+    }
+    file.frames.resize(num_frames);
+    for (auto &frame: file.frames)
+    {
+      frame.offset = offset;
+      frame.compressed_size = in.Read<uint32_t>();
+      offset += frame.compressed_size;
+      in.error |= frame.compressed_size > frame_size;
+    }
+    zip->files_by_crc[file.crc32] = std::move(file);
+  }
+  if (in.error)
+  {
+    ErrorLog("Unable to read the index of '%s'. Is the ROM pack corrupt?", pack_filename.c_str());
+    return true;
+  }
+  InfoLog("Opened %s (read index of %u files in %1.1f ms).", pack_filename.c_str(), num_files, (CThread::GetMicroseconds() - start) / 1000.0);
+  return false;
+}
+
+// Reads one frame of a file in a ROM pack into dest, inflating it through
+// buffer unless it is stored as is
+bool GameLoader::ReadPackFrame(uint8_t *dest, FILE *fp, const ZippedFile &zipped_file, size_t frame, std::vector<uint8_t> *buffer)
+{
+  size_t size = (std::min)(size_t(zipped_file.frame_size), zipped_file.uncompressed_size - frame * zipped_file.frame_size);
+  const PackFrame &pack_frame = zipped_file.frames[frame];
+  if (!SeekFile(fp, pack_frame.offset))
+    return true;
+  if (pack_frame.compressed_size == size)
+    return fread(dest, 1, size, fp) != size;
+  buffer->resize(pack_frame.compressed_size);
+  if (fread(buffer->data(), 1, buffer->size(), fp) != buffer->size())
+    return true;
+  uLongf dest_size = uLongf(size);
+  return uncompress(dest, &dest_size, buffer->data(), uLong(buffer->size())) != Z_OK || dest_size != size;
+}
+
+// Inflates the frames of a file in a ROM pack into dest in parallel, each job
+// reading through its own handle. Loading runs one job per file, so the
+// frames of a large file are spread over the threads left idle once the small
+// files are done.
+bool GameLoader::ReadPackedFile(uint8_t *dest, const ZippedFile &zipped_file)
+{
+  std::atomic<bool> error{ false };
+  CThread::GetJobPool()->Run("ReadPackedFile", unsigned(zipped_file.frames.size()), [&](unsigned i)
+  {
+    std::vector<uint8_t> buffer;
+    FILE *fp = fopen(zipped_file.archive.c_str(), "rb");
+    if (fp == NULL || ReadPackFrame(dest + size_t(i) * zipped_file.frame_size, fp, zipped_file, i, &buffer))
+      error = true;
+    if (fp != NULL)
+      fclose(fp);
+  });
+  if (error)
+    ErrorLog("Unable to read '%s' from '%s'. Is the ROM pack corrupt?", zipped_file.filename.c_str(), zipped_file.archive.c_str());
+  return error;
+}
+
+static std::string GetPackFilename(const std::string &zipfilename)
+{
+  std::string name = zipfilename;
+  size_t dot = name.find_last_of('.');
+  if (dot != std::string::npos && dot > StripFilename(name).length())
+    name.resize(dot);
+  return name + GameLoader::PackExtension;
+}
+
+bool GameLoader::ConvertToPack(std::string *pack_filename, const std::string &zipfilename) const
+{
+  if (IsDirectory(zipfilename) || IsPack(zipfilename))
+  {
+    ErrorLog("Only zip archives can be converted to ROM packs, not '%s'.", zipfilename.c_str());
+    return true;
+  }
+  uint64_t start = CThread::GetMicroseconds();
+  ZipArchive zip;
+  if (LoadZipArchive(&zip, zipfilename))
+    return true;
+  *pack_filename = GetPackFilename(zipfilename);
+
+  // Inflate the files and deflate their frames on the job pool. The whole
+  // ROM set is held in memory until written.
+  struct PackedFile
+  {
+    const ZippedFile *zipped_file;
+    std::vector<std::vector<uint8_t>> frames;
+    bool error;
+  };
+  std::vector<PackedFile> files;
+  for (auto &v: zip.files_by_crc)
+    files.push_back({ &v.second, {}, false });
+  CJobPool *pool = CThread::GetJobPool();
+  pool->Run("ConvertToPack", unsigned(files.size()), [&files, pool](unsigned i)
+  {
+    PackedFile &file = files[i];
+    size_t size = file.zipped_file->uncompressed_size;
+    std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+    file.error = ReadZippedFile(data.get(), *file.zipped_file);
+    if (file.error)
+      return;
+    file.frames.resize((size + PackFrameSize - 1) / PackFrameSize);
+    pool->Run("DeflatePackFrames", unsigned(file.frames.size()), [&file, &data, size](unsigned j)
+    {
+      size_t offset = size_t(j) * PackFrameSize;
+      size_t frame_size = (std::min)(size_t(PackFrameSize), size - offset);
+      const uint8_t *src = data.get() + offset;
+      std::vector<uint8_t> &frame = file.frames[j];
+      uLongf compressed_size = compressBound(uLong(frame_size));
+      frame.resize(compressed_size);
+      if (compress2(frame.data(), &compressed_size, src, uLong(frame_size), Z_BEST_COMPRESSION) == Z_OK && compressed_size < frame_size)
+        frame.resize(compressed_size);
+      else
+        frame.assign(src, src + frame_size);
+    });
+  });
+
+  // Lay out the frames after the header, then the index
+  DefinitionWriter index;
+  index.Write(uint32_t(files.size()));
+  uint64_t offset = PackHeaderSize;
+  size_t total_size = 0;
+  for (auto &file: files)
+  {
+    if (file.error)
+      return true;
+    index.Write(file.zipped_file->filename);
+    index.Write(file.zipped_file->crc32);
+    index.Write(uint64_t(file.zipped_file->uncompressed_size));
+    index.Write(offset);
+    index.Write(uint32_t(file.frames.size()));
+    for (auto &frame: file.frames)
+    {
+      index.Write(uint32_t(frame.size()));
+      offset += frame.size();
+    }
+    total_size += file.zipped_file->uncompressed_size;
+  }
+  DefinitionWriter header;
+  header.Write(s_pack_magic, sizeof(s_pack_magic));
+  header.Write(PackVersion);
+  header.Write(PackFrameSize);
+  header.Write(offset);
+  header.Write(uint32_t(index.data.size()));
+
+  // Write to a temporary file first, as for the definition cache
+  std::string temp_file = *pack_filename + "." + std::to_string(CThread::GetMicroseconds());
+  FILE *fp = fopen(temp_file.c_str(), "wb");
+  if (!fp)
+    return ErrorLog("Unable to create ROM pack '%s'.", pack_filename->c_str());
+  bool error = fwrite(header.data.data(), header.data.size(), 1, fp) != 1;
+  for (auto &file: files)
+  {
+    for (auto &frame: file.frames)
+      error = error || fwrite(frame.data(), frame.size(), 1, fp) != 1;
+  }
+  error = error || fwrite(index.data.data(), index.data.size(), 1, fp) != 1;
+  error = fclose(fp) != 0 || error;
+  if (error || rename(temp_file.c_str(), pack_filename->c_str()) != 0)
+  {
+    remove(temp_file.c_str());
+    return ErrorLog("Unable to write ROM pack '%s'.", pack_filename->c_str());
+  }
+  InfoLog("Converted %s to %s (%u files, %1.1f MB to %1.1f MB) in %1.1f ms.", zipfilename.c_str(), pack_filename->c_str(), unsigned(files.size()),
+    total_size / double(0x100000), offset / double(0x100000), (CThread::GetMicroseconds() - start) / 1000.0);
+  return false;
+}
+
+// Files belonging to optional regions cannot be used to identify games, so
+// only those of required regions are indexed
+void GameLoader::BuildFileIndex(FileIndex *index, const std::map<std::string, RegionsByName_t> &regions_by_game)
+{
+  *index = FileIndex();
+  for (auto &v1: regions_by_game)
+  {
+    const std::string &game_name = v1.first;
+    auto &files_required = index->files_required_by_game[game_name];
+    for (auto &v2: v1.second)
+    {
+      const Region::ptr_t &region = v2.second;
+      if (!region->required)
+        continue;
+      for (auto &file: region->files)
+      {
+        if (!files_required.insert(file).second)
+          continue;
+        if (file->has_crc32)
+          index->by_crc[file->crc32].emplace_back(game_name, file);
+        else
+          index->by_name[file->filename].emplace_back(game_name, file);
+      }
+    }
+  }
+}
+
+void GameLoader::IdentifyGamesInZipArchive(
+  std::set<std::string> *complete_games,
+  std::map<std::string, std::set<File::ptr_t>> *files_missing_by_game,
+  const ZipArchive &zip,
+  const FileIndex &index) const
+{
+  std::map<std::string, std::set<File::ptr_t>> files_found_by_game;
+  std::map<std::string, std::set<uint32_t>> zipped_files_found_by_game;
+
+  // Look up each file in the zip archive in the index of files each game
+  // requires
+  for (auto &v: zip.files_by_crc)
+  {
+    auto add = [&](const FileIndex::GameFiles_t &game_files)
+    {
+      for (auto &game_file: game_files)
+      {
+        files_found_by_game[game_file.first].insert(game_file.second);
+        zipped_files_found_by_game[game_file.first].insert(v.first);
+      }
+    };
+    auto by_crc = index.by_crc.find(v.first);
+    if (by_crc != index.by_crc.end())
+      add(by_crc->second);
+    auto by_name = index.by_name.find(Util::ToLower(v.second.filename));
+    if (by_name != index.by_name.end())
+      add(by_name->second);
+  }
+
+  /*
+   * Corner case: some child ROM sets legitimately share files, which can fool
+   * us into thinking two games are partially present. Need to remove the one
+   * that is not really there by detecting case when only overlapping files
+   * exist (the ROM set with more present files is the intended one).
+   */
+  std::vector<std::string> to_remove;
+  for (auto &v1: zipped_files_found_by_game)
+  {
+    auto &game1_name = v1.first;
+    auto &game1_files = v1.second;
+    for (auto &v2: zipped_files_found_by_game)
+    {
+      auto &game2_name = v2.first;
+      auto &game2_files = v2.second;
+      if (game1_name == game2_name)
+        continue;
+      // Files in the zip archive are sorted by CRC, so finding those shared
+      // is linear
+      std::vector<uint32_t> equivalent_files;
+      std::set_intersection(game1_files.begin(), game1_files.end(), game2_files.begin(), game2_files.end(), std::back_inserter(equivalent_files));
+      /*
+       * If the these two games have a different number of files in the zip
+       * archive, but one consists only of the overlapping files, we can safely
+       * conclude that these files represent only the game with the larger
+       * number of files present. Otherwise, if only the overlapping files are
+       * present for both, we have a genuine ambiguity and hence do nothing.
+       */
+      if (game1_files.size() != game2_files.size() && equivalent_files.size() == game2_files.size())
+        to_remove.push_back(game2_name);
+    }
+  }
+  for (auto &game_name: to_remove)
+  {
+    files_found_by_game.erase(game_name);
+  }
+
+  // Find the missing files for each game we found in the zip archive, then use
+  // this to determine whether the complete game exists
+  auto compare = [](const File::ptr_t &a, const File::ptr_t &b) { return a->filename < b->filename; };
+  for (auto &v: files_found_by_game)
+  {
+    auto &files_found = v.second;
+    auto &files_required = index.files_required_by_game.find(v.first)->second;
+    auto &files_missing = (*files_missing_by_game)[v.first];
+    // Need to sort by filename for set_difference to work
+    std::vector<File::ptr_t> files_found_v(files_found.begin(), files_found.end());
+    std::vector<File::ptr_t> files_required_v(files_required.begin(), files_required.end());
+    std::sort(files_found_v.begin(), files_found_v.end(), compare);
+    std::sort(files_required_v.begin(), files_required_v.end(), compare);
+    // Use set difference to find missing files
+    std::set_difference(
+      files_required_v.begin(), files_required_v.end(),
+      files_found_v.begin(), files_found_v.end(),
+      std::inserter(files_missing, files_missing.end()),
+      compare);
+    // Is the whole game present?
+    if (files_found == files_required)
+      complete_games->insert(v.first);
+    // Clean up: if no files missing, don't want empty entry in map
+    if (files_missing.empty())
+      files_missing_by_game->erase(v.first);
+  }
+}
+
+void GameLoader::FindEquivalentFiles(std::set<File::ptr_t> *equivalent_files, const std::set<File::ptr_t> &a, const std::set<File::ptr_t> &b)
+{
+  // Copy files that are equivalent between a and b from a (doesn't matter
+  // which we actually use) to output
+  for (auto &file1: a)
+  {
+    for (auto &file2: b)
+    {
+      if (*file1 == *file2)
+        equivalent_files->insert(file1);
+    }
+  }
+}
+
+// Same as IdentifyGamesInZipArchive() but checks every file of every game
+// against the zip archive, as was done before the file index. Kept as the
+// reference for CheckFileIndex().
+void GameLoader::ScanGamesInZipArchive(
+  std::set<std::string> *complete_games,
+  std::map<std::string, std::set<File::ptr_t>> *files_missing_by_game,
+  const ZipArchive &zip,
+  const std::map<std::string, RegionsByName_t> &regions_by_game) const
+{
+  std::map<std::string, std::set<File::ptr_t>> files_required_by_game;
+  std::map<std::string, std::set<File::ptr_t>> files_found_by_game;
+
+  // Determine which files each game requires and which files are present in
+  // the zip archive. Files belonging to optional regions cannot be used to
+  // identify games.
+  for (auto &v1: regions_by_game)
+  {
+    const std::string &game_name = v1.first;
+    auto &regions_by_name = v1.second;
+    for (auto &v2: regions_by_name)
+    {
+      Region::ptr_t region = v2.second;
+      if (!region->required)
+        continue;
+      for (auto file: region->files)
+      {
+        // Add each file to the set of required files per game
+        files_required_by_game[game_name].insert(file);
+        // Check file in ROM definition against all files in zip
+        if (FileExistsInZipArchive(file, zip))
+          files_found_by_game[game_name].insert(file);
+      }
+    }
+  }
+
+  // Corner case of child ROM sets sharing files, as in
+  // IdentifyGamesInZipArchive()
+  std::vector<std::string> to_remove;
+  for (auto &v1: files_found_by_game)
+  {
+    auto &game1_name = v1.first;
+    auto &game1_files = v1.second;
+    for (auto &v2: files_found_by_game)
+    {
+      auto &game2_name = v2.first;
+      auto &game2_files = v2.second;
+      if (game1_name == game2_name)
+        continue;
+      std::set<File::ptr_t> equivalent_files;
+      FindEquivalentFiles(&equivalent_files, game1_files, game2_files);
+      if (game1_files.size() != game2_files.size() && equivalent_files.size() == game2_files.size())
+        to_remove.push_back(game2_name);
+    }
+  }
+  for (auto &game_name: to_remove)
+  {
+    files_found_by_game.erase(game_name);
+  }
+
+  // Find the missing files for each game we found in the zip archive, then use
+  // this to determine whether the complete game exists
+  auto compare = [](const File::ptr_t &a, const File::ptr_t &b) { return a->filename < b->filename; };
+  for (auto &v: files_found_by_game)
+  {
+    auto &files_found = v.second;
+    auto &files_required = files_required_by_game[v.first];
+    auto &files_missing = (*files_missing_by_game)[v.first];
+    // Need to sort by filename for set_difference to work
+    std::vector<File::ptr_t> files_found_v(files_found.begin(), files_found.end());
+    std::vector<File::ptr_t> files_required_v(files_required.begin(), files_required.end());
+    std::sort(files_found_v.begin(), files_found_v.end(), compare);
+    std::sort(files_required_v.begin(), files_required_v.end(), compare);
+    // Use set difference to find missing files
+    std::set_difference(
+      files_required_v.begin(), files_required_v.end(),
+      files_found_v.begin(), files_found_v.end(),
+      std::inserter(files_missing, files_missing.end()),
+      compare);
+    // Is the whole game present?
+    if (files_found == files_required)
+      complete_games->insert(v.first);
+    // Clean up: if no files missing, don't want empty entry in map
+    if (files_missing.empty())
+      files_missing_by_game->erase(v.first);
+  }
+}
+
+void GameLoader::ClassifyGamesInZipArchive(GamesInZipArchive *games, const ZipArchive &zip, bool scan) const
+{
+  auto &complete_games = games->complete_games;
+  auto &complete_merged_games = games->complete_merged_games;
+  auto &incomplete_child_games = games->incomplete_child_games;
+  auto &files_missing_by_game = games->files_missing_by_game;
+
+  // Find complete unmerged games (those that do not need to be merged with a
+  // parent). This will pick up child-only ROMs, too, which we prune out later.
+  // Find complete, merged games as well.
+  std::map<std::string, std::set<File::ptr_t>> files_missing_by_merged_game;
+  if (scan)
+  {
+    ScanGamesInZipArchive(&complete_games, &files_missing_by_game, zip, m_regions_by_game);
+    ScanGamesInZipArchive(&complete_merged_games, &files_missing_by_merged_game, zip, m_regions_by_merged_game);
+  }
+  else
+  {
+    IdentifyGamesInZipArchive(&complete_games, &files_missing_by_game, zip, m_file_index);
+    IdentifyGamesInZipArchive(&complete_merged_games, &files_missing_by_merged_game, zip, m_merged_file_index);
+  }
+
+  /*
+   * Find incomplete child games by sorting child games out from the unmerged
+   * games results and pruning out complete merged games. Don't care about
+   * missing files because they are not neccessarily an error for these games.
+   * If one ends up being chosen, we would try to load from a second, parent
+   * ROM set.
+   */
+  for (auto &v: m_game_info_by_game)
+  {
+    auto &game_name = v.first;
+    if (IsChildSet(v.second))
+    {
+      if (complete_games.count(game_name) || files_missing_by_game.find(game_name) != files_missing_by_game.end())
+      {
+        incomplete_child_games.insert(game_name);
+        complete_games.erase(game_name);
+        files_missing_by_game.erase(game_name);
+      }
+    }
+  }
+  for (auto &game_name: complete_merged_games)
+  {
+    incomplete_child_games.erase(game_name);
+  }
+
+  // Complete merged games take highest precedence
+  for (auto &game_name: complete_merged_games)
+  {
+    const std::string &parent = m_game_info_by_game.find(game_name)->second.parent;
+    // Complete merged game will be used, so ignore the parent entirely
+    complete_games.erase(parent);
+    // Complete merged sets will often have some parent ROMs missing (those
+    // replaced by the child games). This is not an error, so remove parents of
+    // complete merged games from missing file list.
+    files_missing_by_game.erase(parent);
+  }
+}
+
+void GameLoader::ChooseGameInZipArchive(std::string *chosen_game, bool *missing_parent_roms, const ZipArchive &zip, const std::string &zipfilename) const
+{
+  chosen_game->clear();
+  *missing_parent_roms = false;
+
+  GamesInZipArchive games;
+  ClassifyGamesInZipArchive(&games, zip);
+  auto &complete_games = games.complete_games;
+  auto &complete_merged_games = games.complete_merged_games;
+  auto &incomplete_child_games = games.incomplete_child_games;
+  auto &files_missing_by_game = games.files_missing_by_game;
+
+  // Any remaining incomplete games from the unmerged set are legitimate errors
+  for (auto &v: files_missing_by_game)
+  {
+    for (auto &file: v.second)
+    {
+      ErrorLog("'%s' (CRC32 0x%08x) not found in '%s' for game '%s'.", file->filename.c_str(), file->crc32, zipfilename.c_str(), v.first.c_str());
+    }
+    ErrorLog("Ignoring game '%s' in '%s' because it is missing files.", v.first.c_str(), zipfilename.c_str());
+  }
 
   // Choose game: complete merged game > incomplete child game > complete
   // unmerged game
@@ -731,51 +1794,97 @@ bool GameLoader::ComputeRegionSize(uint32_t *region_size, const GameLoader::Regi
 // properly when chunk size is 1
 static inline void CopyBytes(uint8_t *dest_base, uint32_t dest_offset, const uint8_t *src_base, uint32_t src_offset, uint32_t size, uint32_t byte_swap)
 {
-  for (uint32_t i = 0; i < size; i++)
+  if (byte_swap == 0)
+    memcpy(dest_base + dest_offset, src_base + src_offset, size);
+  else if ((dest_offset & 1) == 0 && (size & 1) == 0)
+    Util::CopyFlipEndian16(dest_base + dest_offset, src_base + src_offset, size);
+  else
   {
-    dest_base[(dest_offset + i) ^ byte_swap] = src_base[src_offset + i];
+    for (uint32_t i = 0; i < size; i++)
+    {
+      dest_base[(dest_offset + i) ^ byte_swap] = src_base[src_offset + i];
+    }
   }
 }
 
-bool GameLoader::LoadRegion(ROM *rom, const GameLoader::Region::ptr_t &region, const ZipArchive &zip) const
+// Copies a piece of a file to its chunks in the region, which start every
+// stride bytes from the file offset. The piece may begin and end part way
+// through chunks.
+static void ScatterChunks(uint8_t *dest, uint32_t file_offset, const uint8_t *src, size_t src_offset, size_t size, uint32_t chunk_size, uint32_t stride, uint32_t byte_swap)
 {
-  bool error = false;
-  for (auto &file: region->files)
+  uint32_t chunk = uint32_t(src_offset / chunk_size);
+  uint32_t within = uint32_t(src_offset % chunk_size);
+  uint32_t pos = 0;
+  if (chunk_size == 2 && byte_swap && within == 0 && (stride & 1) == 0 && (file_offset & 1) == 0)
   {
-    std::shared_ptr<uint8_t> tmp;
-    size_t file_size;
-    error |= LoadZippedFile(&tmp, &file_size, file, zip);
-    if (!error)
+    // Whole swapped words, as in most CROMs: one pass with no call per chunk
+    uint32_t words = uint32_t(size / 2);
+    Util::InterleaveFlipEndian16(dest + file_offset + chunk * stride, stride, src, words * 2);
+    pos = words * 2;
+    chunk += words;
+  }
+  while (pos < size)
+  {
+    uint32_t n = (std::min)(uint32_t(size) - pos, chunk_size - within);
+    CopyBytes(dest, file_offset + chunk * stride + within, src, pos, n, byte_swap);
+    pos += n;
+    chunk++;
+    within = 0;
+  }
+}
+
+// Reads a file into its region. Files of a region do not overlap, so any
+// number of them can be loaded at once.
+void GameLoader::LoadFile(LoadJob *job)
+{
+  const Region &region = *job->region;
+  const File &file = *job->file;
+  size_t file_size = job->zipped_file->uncompressed_size;
+  uint8_t *dest = job->dest;
+  uint64_t start = CThread::GetMicroseconds();
+  if (region.chunk_size == region.stride)
+  {
+    // Contiguous: inflate straight into the region and swap in place
+    job->error = ReadZippedFile(dest + file.offset, *job->zipped_file);
+    uint64_t inflated = CThread::GetMicroseconds();
+    job->inflate_micros = inflated - start;
+    if (!job->error && region.byte_swap)
+      Util::FlipEndian16(dest + file.offset, file_size);
+    job->assemble_micros = CThread::GetMicroseconds() - inflated;
+  }
+  else if (job->zipped_file->packed)
+  {
+    // Interleaved, from a ROM pack: inflate the frames in parallel into a
+    // copy of the file, then interleave it in one go
+    std::unique_ptr<uint8_t[]> data(new uint8_t[file_size]);
+    job->error = ReadZippedFile(data.get(), *job->zipped_file);
+    uint64_t inflated = CThread::GetMicroseconds();
+    job->inflate_micros = inflated - start;
+    if (!job->error)
+      ScatterChunks(dest, file.offset, data.get(), 0, file_size, uint32_t(region.chunk_size), uint32_t(region.stride), region.byte_swap);
+    job->assemble_micros = CThread::GetMicroseconds() - inflated;
+  }
+  else
+  {
+    // Interleaved: stream the inflated data into its chunks, so the file is
+    // never held whole and each byte is written once
+    uint32_t chunk_size = (uint32_t)region.chunk_size;		// cache these as pointer dereferencing cripples performance in a tight loop
+    uint32_t stride = (uint32_t)region.stride;
+    uint32_t byte_swap = region.byte_swap;
+    uint32_t file_offset = file.offset;
+    uint64_t assemble_micros = 0;
+    job->error = StreamZippedFile(*job->zipped_file, [&](const uint8_t *data, size_t offset, size_t size)
     {
-      uint8_t *dest = rom->data.get();
-      uint8_t *src = tmp.get();
-      if (region->chunk_size == region->stride)
-      {
-        memcpy(dest + file->offset, src, file_size);
-        if (region->byte_swap)
-          Util::FlipEndian16(dest + file->offset, file_size);
-      }
-      else
-      {
-        uint32_t num_chunks = (uint32_t)file_size / region->chunk_size;
-        uint32_t dest_offset = file->offset;
-        uint32_t src_offset = 0;
-        uint32_t chunk_size = (uint32_t)region->chunk_size;		// cache these as pointer dereferencing cripples performance in a tight loop
-        uint32_t stride = (uint32_t)region->stride;
-        uint32_t byte_swap = region->byte_swap;
-        for (uint32_t i = 0; i < num_chunks; i++)
-        {
-          CopyBytes(dest, dest_offset, src, src_offset, chunk_size, byte_swap);
-          dest_offset += stride;
-          src_offset += chunk_size;
-        }
-      }
-    }
+      uint64_t scatter_start = CThread::GetMicroseconds();
+      ScatterChunks(dest, file_offset, data, offset, size, chunk_size, stride, byte_swap);
+      assemble_micros += CThread::GetMicroseconds() - scatter_start;
+    });
+    job->assemble_micros = assemble_micros;
+    job->inflate_micros = CThread::GetMicroseconds() - start - assemble_micros;
   }
-  return error;
 }
 
-bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const ZipArchive &zip) const
+bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const ZipArchive &zip, bool load_data) const
 {
   auto it = m_game_info_by_game.find(game_name);
   if (it == m_game_info_by_game.end())
@@ -788,24 +1897,8 @@ bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const Z
   auto &regions_by_name = IsChildSet(it->second) ? m_regions_by_merged_game.find(game_name)->second : m_regions_by_game.find(game_name)->second;
   LogROMDefinition(game_name, regions_by_name);
   bool error = false;
-  for (auto &v: regions_by_name)
+  auto region_loaded = [&](const Region::ptr_t &region, bool error_loading_region)
   {
-    auto &region = v.second;
-    uint32_t region_size = 0;
-    bool error_loading_region = false;
-
-    // Attempt to load the region
-    if (ComputeRegionSize(&region_size, region, zip))
-      error_loading_region = true;
-    else
-    {
-      // Load up the ROM region
-      auto &rom = rom_set->rom_by_region[region->region_name];
-      rom.data.reset(new uint8_t[region_size], std::default_delete<uint8_t[]>());
-      rom.size = region_size;
-      error_loading_region = LoadRegion(&rom, region, zip);
-    }
-
     if (error_loading_region && !region->required)
     {
       // Failed to load the region but it wasn't required anyway, so remove it
@@ -818,6 +1911,85 @@ bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const Z
       // Proceed normally: accumulate errors
       error |= error_loading_region;
     }
+  };
+
+  // Size the regions and gather the files to read into them
+  uint64_t start = CThread::GetMicroseconds();
+  std::vector<LoadJob> jobs;
+  size_t total_size = 0;
+  unsigned num_mapped = 0;
+  for (auto &v: regions_by_name)
+  {
+    auto &region = v.second;
+    uint32_t region_size = 0;
+    if (ComputeRegionSize(&region_size, region, zip))
+    {
+      region_loaded(region, true);
+      continue;
+    }
+    auto &rom = rom_set->rom_by_region[region->region_name];
+    rom.size = region_size;
+    if (load_data)
+    {
+      // An uncompressed file that is the whole region as is can be mapped
+      const ZippedFile *whole = region->files.size() == 1 && region->files[0]->offset == 0 &&
+        region->chunk_size == region->stride && !region->byte_swap ? LookupFile(region->files[0], zip) : nullptr;
+      if (whole && !whole->path.empty() && whole->uncompressed_size == region_size)
+      {
+        rom.data = MapFile(whole->path, region_size);
+        if (rom.data)
+        {
+          num_mapped++;
+          region_loaded(region, false);
+          continue;
+        }
+      }
+      rom.data.reset(new uint8_t[region_size], std::default_delete<uint8_t[]>());
+      for (auto &file: region->files)
+      {
+        const ZippedFile *zipped_file = LookupFile(file, zip);
+        jobs.push_back({ region.get(), file.get(), zipped_file, rom.data.get(), false, 0, 0 });
+        total_size += zipped_file->uncompressed_size;
+      }
+    }
+    else
+      region_loaded(region, false);
+  }
+
+  if (num_mapped > 0)
+    InfoLog("Mapped %u ROM regions from uncompressed files.", num_mapped);
+  rom_set->verified = load_data && num_mapped == 0 && std::all_of(jobs.begin(), jobs.end(), [](const LoadJob &job) { return job.zipped_file->path.empty() && !job.zipped_file->packed; });
+  if (!jobs.empty())
+  {
+    // Inflate the files in parallel, largest first so that the last few jobs
+    // are short and keep all threads busy
+    std::sort(jobs.begin(), jobs.end(), [](const LoadJob &a, const LoadJob &b) { return a.zipped_file->uncompressed_size > b.zipped_file->uncompressed_size; });
+    uint64_t read_start = CThread::GetMicroseconds();
+    CJobPool *pool = CThread::GetJobPool();
+    pool->Run("LoadROMs", unsigned(jobs.size()), [&jobs](unsigned i) { LoadFile(&jobs[i]); });
+    uint64_t end = CThread::GetMicroseconds();
+    uint64_t inflate_micros = 0;
+    uint64_t assemble_micros = 0;
+    for (auto &job: jobs)
+    {
+      inflate_micros += job.inflate_micros;
+      assemble_micros += job.assemble_micros;
+    }
+    InfoLog("Loaded %u ROM files (%1.1f MB) in %1.1f ms on %u threads: sizing %1.1f ms, reading %1.1f ms (inflating %1.1f ms, swapping and interleaving %1.1f ms across threads).",
+      unsigned(jobs.size()), total_size / double(0x100000), (end - start) / 1000.0, pool->GetNumWorkers() + 1,
+      (read_start - start) / 1000.0, (end - read_start) / 1000.0, inflate_micros / 1000.0, assemble_micros / 1000.0);
+
+    // Regions with files that failed to load are dropped if optional
+    for (auto &v: regions_by_name)
+    {
+      auto &region = v.second;
+      if (rom_set->rom_by_region.find(region->region_name) == rom_set->rom_by_region.end())
+        continue;
+      bool error_loading_region = false;
+      for (auto &job: jobs)
+        error_loading_region |= job.region == region.get() && job.error;
+      region_loaded(region, error_loading_region);
+    }
   }
 
   // Attach the patches and do some more error checking here
@@ -834,6 +2006,41 @@ bool GameLoader::LoadROMs(ROMSet *rom_set, const std::string &game_name, const Z
   return error;
 }
 
+// Identifies the ROM set contents: the CRCs and placement of all files, and
+// the patches applied
+uint32_t GameLoader::ComputeROMSetKey(const std::string &game_name, const ZipArchive &zip) const
+{
+  auto &game = m_game_info_by_game.find(game_name)->second;
+  auto &regions_by_name = IsChildSet(game) ? m_regions_by_merged_game.find(game_name)->second : m_regions_by_game.find(game_name)->second;
+  uLong key = crc32(0, reinterpret_cast<const Bytef *>(game_name.c_str()), uInt(game_name.length()));
+  for (auto &v: regions_by_name)
+  {
+    auto &region = v.second;
+    uint32_t attribs[3] = { uint32_t(region->stride), uint32_t(region->chunk_size), uint32_t(region->byte_swap) };
+    key = crc32(key, reinterpret_cast<const Bytef *>(region->region_name.c_str()), uInt(region->region_name.length()));
+    key = crc32(key, reinterpret_cast<const Bytef *>(attribs), sizeof(attribs));
+    for (auto &file: region->files)
+    {
+      const ZippedFile *zipped_file = LookupFile(file, zip);
+      uint32_t placement[3] = { file->offset, zipped_file ? zipped_file->crc32 : 0, zipped_file ? uint32_t(zipped_file->uncompressed_size) : 0 };
+      key = crc32(key, reinterpret_cast<const Bytef *>(placement), sizeof(placement));
+      // Uncompressed files are matched by name, not CRC, so catch edits to them
+      if (zipped_file && !zipped_file->path.empty())
+        key = crc32(key, reinterpret_cast<const Bytef *>(&zipped_file->mtime), sizeof(zipped_file->mtime));
+    }
+  }
+  for (auto &v: m_patches_by_game.find(game_name)->second)
+  {
+    key = crc32(key, reinterpret_cast<const Bytef *>(v.first.c_str()), uInt(v.first.length()));
+    for (auto &patch: v.second)
+    {
+      uint64_t fields[3] = { patch.offset, patch.value, patch.bits };
+      key = crc32(key, reinterpret_cast<const Bytef *>(fields), sizeof(fields));
+    }
+  }
+  return uint32_t(key);
+}
+
 std::string StripFilename(const std::string &filepath)
 {
   // Search for last '/' or '\', if any
@@ -855,44 +2062,268 @@ std::string StripFilename(const std::string &filepath)
   return std::string(filepath, 0, last_slash + 1);
 }
 
-bool GameLoader::Load(Game *game, ROMSet *rom_set, const std::string &zipfilename) const
+// Reads the zip contents or ROM pack index, or finds the files in a directory
+// named after the game, and picks the game to load, along with its parent ROM set if needed
+bool GameLoader::OpenGame(ZipArchive *zip, std::string *game_name, const std::string &zipfilename) const
 {
-  *game = Game();
-
-  // Read the zip contents
-  ZipArchive zip;
-  if (LoadZipArchive(&zip, zipfilename))
+  if (IsDirectory(zipfilename))
+  {
+    std::string dir = zipfilename;
+    while (dir.length() > 1 && (dir.back() == '/' || dir.back() == '\\'))
+      dir.pop_back();
+    std::string dir_game_name = dir.substr(StripFilename(dir).length());
+    if (LoadDirectory(zip, dir, dir_game_name))
+      return true;
+  }
+  else if (IsPack(zipfilename))
+  {
+    if (LoadPack(zip, zipfilename))
+      return true;
+  }
+  else if (LoadZipArchive(zip, zipfilename))
     return true;
 
   // Pick the game to load (there could be multiple ROM sets in a zip file)
-  std::string chosen_game;
   bool missing_parent_roms = false;
-  ChooseGameInZipArchive(&chosen_game, &missing_parent_roms, zip, zipfilename);
-  if (chosen_game.empty())
+  ChooseGameInZipArchive(game_name, &missing_parent_roms, *zip, zipfilename);
+  if (game_name->empty())
     return true;
 
-  // Return game information to caller
-  *game = m_game_info_by_game.find(chosen_game)->second;
-
   // Bring in additional parent ROM set if needed
   if (missing_parent_roms)
   {
-    std::string parent_zipfilename = StripFilename(zipfilename) + game->parent + ".zip";
-    if (LoadZipArchive(&zip, parent_zipfilename))
+    const Game &game = m_game_info_by_game.find(*game_name)->second;
+    std::string parent_dir = StripFilename(zip->zipfilenames[0]) + game.parent;
+    std::string parent_zipfilename = parent_dir + ".zip";
+    std::string parent_pack_filename = parent_dir + PackExtension;
+    size_t size = 0;
+    uint64_t mtime = 0;
+    bool error;
+    if (IsDirectory(parent_dir))
+      error = LoadDirectory(zip, parent_dir, game.parent);
+    else if (GetFileSize(&size, &mtime, parent_pack_filename))
+      error = LoadPack(zip, parent_pack_filename);
+    else
+      error = LoadZipArchive(zip, parent_zipfilename);
+    if (error)
     {
-      ErrorLog("Expected to find parent ROM set of '%s' at '%s'.", game->name.c_str(), parent_zipfilename.c_str());
+      ErrorLog("Expected to find parent ROM set of '%s' at '%s'.", game.name.c_str(), parent_zipfilename.c_str());
       return true;
     }
   }
+  return false;
+}
+
+bool GameLoader::Load(Game *game, ROMSet *rom_set, const std::string &zipfilename, const std::string &cache_dir) const
+{
+  *game = Game();
+  ZipArchive zip;
+  std::string chosen_game;
+  if (OpenGame(&zip, &chosen_game, zipfilename))
+    return true;
+
+  // Return game information to caller
+  *game = m_game_info_by_game.find(chosen_game)->second;
+
+  // Decoded ROMs can be taken from the cache if present
+  if (!cache_dir.empty())
+  {
+    rom_set->cache_key = ComputeROMSetKey(game->name, zip);
+    rom_set->cache_file = ROMCache::GetFilePath(cache_dir, game->name, rom_set->cache_key);
+    rom_set->cached = ROMCache::IsValid(rom_set->cache_file, rom_set->cache_key);
+  }
 
   // Load
-  bool error = LoadROMs(rom_set, game->name, zip);
+  bool error = LoadROMs(rom_set, game->name, zip, !rom_set->cached);
   if (error)
     *game = Game();
   return error;
 }
 
-GameLoader::GameLoader(const std::string &xml_file)
+bool GameLoader::VerifyROMs(std::vector<std::string> *bad_files, const std::string &zipfilename, bool parallel) const
+{
+  ZipArchive zip;
+  std::string game_name;
+  if (OpenGame(&zip, &game_name, zipfilename))
+  {
+    bad_files->push_back(zipfilename + ": unable to open ROM set");
+    return true;
+  }
+
+  // Files defined without a CRC, and those of optional regions that are
+  // missing, can't be checked
+  struct VerifyJob
+  {
+    const File *file;
+    const ZippedFile *zipped_file;
+    uint32_t crc32;
+    bool error;
+  };
+  const Game &game = m_game_info_by_game.find(game_name)->second;
+  auto &regions_by_name = IsChildSet(game) ? m_regions_by_merged_game.find(game_name)->second : m_regions_by_game.find(game_name)->second;
+  std::vector<VerifyJob> jobs;
+  size_t total_size = 0;
+  for (auto &v: regions_by_name)
+  {
+    for (auto &file: v.second->files)
+    {
+      const ZippedFile *zipped_file = LookupFile(file, zip);
+      if (file->has_crc32 && zipped_file != nullptr)
+      {
+        jobs.push_back({ file.get(), zipped_file, 0, false });
+        total_size += zipped_file->uncompressed_size;
+      }
+    }
+  }
+
+  // Largest first, as for loading
+  uint64_t start = CThread::GetMicroseconds();
+  std::sort(jobs.begin(), jobs.end(), [](const VerifyJob &a, const VerifyJob &b) { return a.zipped_file->uncompressed_size > b.zipped_file->uncompressed_size; });
+  auto verify = [&jobs](unsigned i)
+  {
+    VerifyJob &job = jobs[i];
+    uint32_t crc = 0;
+    job.error = StreamZippedFile(*job.zipped_file, [&crc](const uint8_t *data, size_t offset, size_t size) { crc = ComputeCRC32(crc, data, size); });
+    job.crc32 = crc;
+  };
+  if (parallel)
+    CThread::GetJobPool()->Run("VerifyROMs", unsigned(jobs.size()), verify);
+  else
+  {
+    for (unsigned i = 0; i < jobs.size(); i++)
+      verify(i);
+  }
+
+  for (auto &job: jobs)
+  {
+    const std::string &name = job.zipped_file->path.empty() ? job.zipped_file->filename : job.zipped_file->path;
+    if (job.error)
+      bad_files->push_back(name + ": unable to read");
+    else if (job.crc32 != job.file->crc32)
+      bad_files->push_back(Util::Format() << name << ": CRC32 " << Util::Hex(job.crc32) << ", expected " << Util::Hex(job.file->crc32));
+  }
+  InfoLog("Verified %u ROM files (%1.1f MB) of '%s' in %1.1f ms: %u bad.", unsigned(jobs.size()), total_size / double(0x100000), game_name.c_str(),
+    (CThread::GetMicroseconds() - start) / 1000.0, unsigned(bad_files->size()));
+  return !bad_files->empty();
+}
+
+GameLoader::GameLoader(const std::string &xml_file, const std::string &cache_dir)
+{
+  LoadDefinitionXML(xml_file, cache_dir);
+  BuildFileIndex(&m_file_index, m_regions_by_game);
+  BuildFileIndex(&m_merged_file_index, m_regions_by_merged_game);
+}
+
+std::vector<GameLoader::ScanResult> GameLoader::ScanDirectory(const std::string &dir) const
+{
+  std::vector<ScanResult> results;
+  std::error_code ec;
+  for (auto &entry: std::filesystem::directory_iterator(dir, ec))
+  {
+    std::string path = entry.path().string();
+    std::string name = entry.path().filename().string();
+    bool is_zip = entry.path().extension() == ".zip" || entry.path().extension() == ".ZIP" || IsPack(path);
+    if ((is_zip && !entry.is_directory(ec)) || (entry.is_directory(ec) && m_regions_by_game.count(name)))
+    {
+      results.emplace_back();
+      results.back().path = path;
+    }
+  }
+  if (ec)
+    ErrorLog("Unable to read directory '%s'.", dir.c_str());
+  std::sort(results.begin(), results.end(), [](const ScanResult &a, const ScanResult &b) { return a.path < b.path; });
+
+  uint64_t start = CThread::GetMicroseconds();
+  CThread::GetJobPool()->Run("ScanDirectory", unsigned(results.size()), [this, &results](unsigned i)
+  {
+    ScanResult &result = results[i];
+    ZipArchive zip;
+    if (IsDirectory(result.path))
+      result.error = LoadDirectory(&zip, result.path, result.path.substr(StripFilename(result.path).length()));
+    else if (IsPack(result.path))
+      result.error = LoadPack(&zip, result.path);
+    else
+      result.error = LoadZipArchive(&zip, result.path);
+    if (result.error)
+      return;
+    GamesInZipArchive games;
+    ClassifyGamesInZipArchive(&games, zip);
+    result.complete_games = games.complete_merged_games;
+    result.complete_games.insert(games.complete_games.begin(), games.complete_games.end());
+    result.child_games = games.incomplete_child_games;
+    for (auto &v: games.files_missing_by_game)
+      result.incomplete_games[v.first] = v.second.size();
+  });
+  InfoLog("Scanned %u ROM sets in '%s' in %1.1f ms.", unsigned(results.size()), dir.c_str(), (CThread::GetMicroseconds() - start) / 1000.0);
+  return results;
+}
+
+std::vector<GameLoader::IndexCheck> GameLoader::CheckFileIndex() const
 {
-  LoadDefinitionXML(xml_file);
+  std::vector<IndexCheck> checks;
+  auto files_of = [](std::vector<File::ptr_t> *files, const RegionsByName_t &regions_by_name)
+  {
+    for (auto &v: regions_by_name)
+    {
+      files->insert(files->end(), v.second->files.begin(), v.second->files.end());
+    }
+  };
+  auto check = [this, &checks](const std::string &rom_set, const std::vector<File::ptr_t> &files)
+  {
+    // Zip archive directory of just the files, those defined without a CRC
+    // keyed by their name as when loading from a directory
+    ZipArchive zip;
+    for (auto &file: files)
+    {
+      uint32_t key = file->has_crc32 ? file->crc32 : uint32_t(crc32(0, reinterpret_cast<const Bytef *>(file->filename.c_str()), uInt(file->filename.length())));
+      ZippedFile &zipped_file = zip.files_by_crc[key];
+      zipped_file.zipfilename = rom_set;
+      zipped_file.filename = file->filename;
+      zipped_file.crc32 = key;
+    }
+    GamesInZipArchive indexed;
+    GamesInZipArchive scanned;
+    ClassifyGamesInZipArchive(&indexed, zip);
+    ClassifyGamesInZipArchive(&scanned, zip, true);
+    bool same = indexed.complete_games == scanned.complete_games &&
+                indexed.complete_merged_games == scanned.complete_merged_games &&
+                indexed.incomplete_child_games == scanned.incomplete_child_games &&
+                indexed.files_missing_by_game == scanned.files_missing_by_game;
+    checks.push_back({ rom_set, same });
+  };
+
+  // Every game as defined (child sets alone), and missing each file in turn
+  std::map<std::string, std::vector<File::ptr_t>> files_by_parent;
+  for (auto &v: m_regions_by_game)
+  {
+    std::vector<File::ptr_t> files;
+    files_of(&files, v.second);
+    check(v.first, files);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+      std::vector<File::ptr_t> missing(files);
+      missing.erase(missing.begin() + i);
+      check(v.first + " without " + files[i]->filename, missing);
+    }
+    auto game = m_game_info_by_game.find(v.first);
+    if (game != m_game_info_by_game.end() && IsChildSet(game->second))
+      files_of(&files_by_parent[game->second.parent], v.second);
+  }
+
+  // Child sets merged with their parents, and parents merged with all of
+  // their child sets
+  for (auto &v: m_regions_by_merged_game)
+  {
+    std::vector<File::ptr_t> files;
+    files_of(&files, v.second);
+    check(v.first + " merged with its parent", files);
+  }
+  for (auto &v: files_by_parent)
+  {
+    auto parent = m_regions_by_game.find(v.first);
+    if (parent != m_regions_by_game.end())
+      files_of(&v.second, parent->second);
+    check(v.first + " merged with its child sets", v.second);
+  }
+  return checks;
 }
@@ -5,8 +5,12 @@
 #include "Pkgs/unzip.h"
 #include "Game.h"
 #include "ROMSet.h"
+#include <cstdio>
+#include <functional>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 class GameLoader
 {
@@ -53,17 +57,56 @@ private:
   std::map<std::string, RegionsByName_t> m_regions_by_merged_game;  // only child sets merged w/ parents
   std::string m_xml_filename;
 
+  // Files of required regions, by CRC (or by name, for files defined without
+  // one), and the games they belong to, for identifying ROM sets in time
+  // linear in the number of files in them
+  struct FileIndex
+  {
+    typedef std::vector<std::pair<std::string, File::ptr_t>> GameFiles_t;
+    std::unordered_map<uint32_t, GameFiles_t> by_crc;
+    std::unordered_map<std::string, GameFiles_t> by_name;
+    std::map<std::string, std::set<File::ptr_t>> files_required_by_game;
+  };
+  FileIndex m_file_index;         // all games as defined in XML
+  FileIndex m_merged_file_index;  // only child sets merged w/ parents
+
+  // Independently deflated piece of a file in a ROM pack (see LoadPack())
+  struct PackFrame
+  {
+    uint64_t offset;          // in the pack
+    uint32_t compressed_size; // equal to the frame's own size if stored as is
+  };
+
   // Single compressed file inside of a zip archive
   struct ZippedFile
   {
     unzFile zf = nullptr;
     std::string zipfilename;  // zip archive
     std::string filename;     // file inside the zip archive
+    std::string archive;      // path of the zip archive, for opening it again
+    std::string path;         // uncompressed file, if loading from a directory
+    uint64_t mtime = 0;       // modification time of the uncompressed file
+    unz_file_pos pos = {};    // position in the archive's directory
     size_t uncompressed_size = 0;
     uint32_t crc32 = 0;
+    bool packed = false;      // in a ROM pack (the archive) rather than a zip
+    uint32_t frame_size = 0;  // uncompressed size of all but the last frame
+    std::vector<PackFrame> frames;
   };
 
-  // Multiple zip archives
+  // ROM file to be read into its region, one per job when loading in parallel
+  struct LoadJob
+  {
+    const Region *region;
+    const File *file;
+    const ZippedFile *zipped_file;
+    uint8_t *dest;            // region data
+    bool error;
+    uint64_t inflate_micros;
+    uint64_t assemble_micros; // byte swapping and interleaving
+  };
+
+  // Multiple zip archives, ROM packs, or directories of uncompressed files
   struct ZipArchive
   {
     std::vector<std::string> zipfilenames;
@@ -80,35 +123,112 @@ private:
   };
 
   bool LoadZipArchive(ZipArchive *zip, const std::string &zipfilename) const;
+  bool LoadDirectory(ZipArchive *zip, const std::string &dir, const std::string &game_name) const;
+  bool LoadPack(ZipArchive *zip, const std::string &pack_filename) const;
   const ZippedFile *LookupFile(const File::ptr_t &file, const ZipArchive &zip) const;
   bool FileExistsInZipArchive(const File::ptr_t &file, const ZipArchive &zip) const;
-  bool LoadZippedFile(std::shared_ptr<uint8_t> *buffer, size_t *file_size, const GameLoader::File::ptr_t &file, const ZipArchive &zip) const;
+  static unzFile OpenZippedFile(const ZippedFile &zipped_file);
+  static bool CloseZippedFile(unzFile zf, const ZippedFile &zipped_file, bool read_all);
+  static bool ReadZippedFile(uint8_t *dest, const ZippedFile &zipped_file);
+  static bool ReadPackFrame(uint8_t *dest, FILE *fp, const ZippedFile &zipped_file, size_t frame, std::vector<uint8_t> *buffer);
+  static bool ReadPackedFile(uint8_t *dest, const ZippedFile &zipped_file);
+  static bool StreamZippedFile(const ZippedFile &zipped_file, const std::function<void(const uint8_t *data, size_t offset, size_t size)> &consume);
   static bool MissingAttrib(const GameLoader &loader, const Util::Config::Node &node, const std::string &attribute);
   bool LoadGamesFromXML(const Util::Config::Node &xml);
   bool MergeChildrenWithParents();
   void LogROMDefinition(const std::string &game_name, const RegionsByName_t &regions_by_name) const;
   bool ParseXML(const Util::Config::Node &xml);
-  bool LoadDefinitionXML(const std::string &filename);
-  static void FindEquivalentFiles(std::set<File::ptr_t> *equivalent_files, const std::set<File::ptr_t> &a, const std::set<File::ptr_t> &b);
+  bool LoadDefinitionCache(const std::string &file, uint32_t key);
+  bool SaveDefinitionCache(const std::string &file, uint32_t key) const;
+  bool LoadDefinitionXML(const std::string &filename, const std::string &cache_dir);
+  static void BuildFileIndex(FileIndex *index, const std::map<std::string, RegionsByName_t> &regions_by_game);
   void IdentifyGamesInZipArchive(
+    std::set<std::string> *complete_games,
+    std::map<std::string, std::set<File::ptr_t>> *files_missing_by_game,
+    const ZipArchive &zip,
+    const FileIndex &index) const;
+  static void FindEquivalentFiles(std::set<File::ptr_t> *equivalent_files, const std::set<File::ptr_t> &a, const std::set<File::ptr_t> &b);
+  void ScanGamesInZipArchive(
     std::set<std::string> *complete_games,
     std::map<std::string, std::set<File::ptr_t>> *files_missing_by_game,
     const ZipArchive &zip,
     const std::map<std::string, RegionsByName_t> &regions_by_game) const;
+
+  // Games in a zip archive, sorted by how they could be loaded
+  struct GamesInZipArchive
+  {
+    std::set<std::string> complete_games;         // complete unmerged games
+    std::set<std::string> complete_merged_games;  // child sets complete with parent files
+    std::set<std::string> incomplete_child_games; // child sets needing the parent ROM set
+    std::map<std::string, std::set<File::ptr_t>> files_missing_by_game;
+  };
+  // Through the file index, or if scan, through ScanGamesInZipArchive()
+  void ClassifyGamesInZipArchive(GamesInZipArchive *games, const ZipArchive &zip, bool scan = false) const;
   bool ComputeRegionSize(uint32_t *region_size, const Region::ptr_t &region, const ZipArchive &zip) const;
   void ChooseGameInZipArchive(std::string *chosen_game, bool *missing_parent_roms, const ZipArchive &zip, const std::string &zipfilename) const;
-  bool LoadRegion(ROM *buffer, const GameLoader::Region::ptr_t &region, const ZipArchive &zip) const;
-  bool LoadROMs(ROMSet *rom_set, const std::string &game_name, const ZipArchive &zip) const;
+  static void LoadFile(LoadJob *job);
+  bool LoadROMs(ROMSet *rom_set, const std::string &game_name, const ZipArchive &zip, bool load_data) const;
+  uint32_t ComputeROMSetKey(const std::string &game_name, const ZipArchive &zip) const;
   std::string ChooseGame(const std::set<std::string> &games_found, const std::string &zipfilename) const;
+  bool OpenGame(ZipArchive *zip, std::string *game_name, const std::string &zipfilename) const;
   static bool CompareFilesByName(const File::ptr_t &a,const File::ptr_t &b);
 
 public:
-  GameLoader(const std::string &xml_file);
-  bool Load(Game *game, ROMSet *rom_set, const std::string &zipfilename) const;
+  // If cache_dir is given, the parsed definitions are cached there and read
+  // back on later runs, until the XML file changes.
+  GameLoader(const std::string &xml_file, const std::string &cache_dir = std::string());
+  // Loads from a zip file, a ROM pack, or a directory of uncompressed ROM
+  // files named after the game. If cache_dir is given, the decoded ROM cache file is
+  // recorded in rom_set. When it already exists, only ROM region sizes are
+  // loaded, not the data.
+  bool Load(Game *game, ROMSet *rom_set, const std::string &zipfilename, const std::string &cache_dir = std::string()) const;
+  // Checks the CRC-32 of every file of the game in a zip file or directory
+  // against its definition, which loading from the decoded ROM cache or from
+  // uncompressed files skips. Files are read on the job pool if parallel,
+  // otherwise on the calling thread alone, to keep out of emulation's way.
+  // Returns true if any file is bad, each described in bad_files.
+  bool VerifyROMs(std::vector<std::string> *bad_files, const std::string &zipfilename, bool parallel) const;
   const std::map<std::string, Game> &GetGames() const
   {
     return m_game_info_by_game;
   }
+
+  // Games found in a zip archive or game directory by ScanDirectory()
+  struct ScanResult
+  {
+    std::string path;
+    std::set<std::string> complete_games;           // can be loaded as is
+    std::set<std::string> child_games;              // need the parent ROM set
+    std::map<std::string, size_t> incomplete_games; // number of files missing
+    bool error = false;                             // could not be read
+  };
+
+  // Identifies the games in every zip archive and game directory in dir,
+  // reading the archives in parallel. No ROM data is read, only the CRCs in
+  // the zip directories. Results are sorted by path.
+  std::vector<ScanResult> ScanDirectory(const std::string &dir) const;
+
+  // ROM set made up from the game definitions by CheckFileIndex()
+  struct IndexCheck
+  {
+    std::string rom_set;  // description
+    bool same;            // identified the same with and without the index
+  };
+
+  // Identifies the games in ROM sets made up from the game definitions both
+  // through the file index and by checking every file of every game, as was
+  // done before the index, for Test_Lockstep. The sets are every game as
+  // defined, every game missing each of its files in turn, child sets merged
+  // with their parents, and parents merged with all of their child sets.
+  std::vector<IndexCheck> CheckFileIndex() const;
+
+  // Writes every file of a zip archive to a ROM pack next to it, named after
+  // it with the extension PackExtension. A ROM pack holds each file in small,
+  // independently deflated frames behind an index of file names and CRCs, so
+  // that one file is inflated on all threads at once when loading. Returns
+  // true on error.
+  static const char PackExtension[];
+  bool ConvertToPack(std::string *pack_filename, const std::string &zipfilename) const;
 };
 
 #endif  // INCLUDED_GAMELOADER_H
@@ -0,0 +1,222 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+ 
+/*
+ * GPUTimer.cpp
+ * 
+ * GPU timings of the render stages of a frame.
+ */
+
+#include "GPUTimer.h"
+#include "OSD/Logger.h"
+#include <GL/glew.h>
+#include <cstdio>
+
+namespace GPUTimer
+{
+	static const int	NumFrames	= 4;	// frames in flight before their times must be read
+	static const int	MaxEvents	= 64;	// stage runs per frame, later ones aren't timed
+
+	struct Frame
+	{
+		GLuint	queries[MaxEvents * 2];
+		int		stages[MaxEvents];
+		int		numEvents;
+	};
+
+	static bool		s_enabled = false;
+	static Frame	s_frames[NumFrames];
+	static int		s_frame = 0;
+	static int		s_open[NumStages];			// event index of each stage begun but not ended, or -1
+	static double	s_sums[NumStages];
+	static unsigned	s_sumFrames = 0;
+	static FILE		*s_csv = nullptr;
+
+	static const char *s_names[NumStages] =
+	{
+		"2D bottom",
+		"2D top",
+		"Scroll fog",
+		"P0 opaque", "P0 trans1", "P0 trans2",
+		"P1 opaque", "P1 trans1", "P1 trans2",
+		"P2 opaque", "P2 trans1", "P2 trans2",
+		"P3 opaque", "P3 trans1", "P3 trans2",
+		"Composite"
+	};
+
+	static bool IsReady(const Frame &frame)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[frame.numEvents * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		return available != 0;
+	}
+
+	static void Collect(Frame &frame)
+	{
+		if (IsReady(frame))
+		{
+			double ms[NumStages] = {};
+			for (int i = 0; i < frame.numEvents; i++)
+			{
+				GLuint64 start = 0, end = 0;
+				glGetQueryObjectui64v(frame.queries[i * 2 + 0], GL_QUERY_RESULT, &start);
+				glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+				ms[frame.stages[i]] += (end - start) / 1000000.0;
+			}
+
+			for (int i = 0; i < NumStages; i++)
+				s_sums[i] += ms[i];
+			s_sumFrames++;
+
+			if (s_csv)
+			{
+				for (int i = 0; i < NumStages; i++)
+					fprintf(s_csv, i ? ",%.3f" : "%.3f", ms[i]);
+				fputc('\n', s_csv);
+			}
+		}
+
+		// A frame the GPU still hasn't finished after NumFrames is dropped rather than waited for
+		frame.numEvents = 0;
+	}
+
+	void Enable(bool enable, const std::string &csvFile)
+	{
+		if (s_enabled == enable)
+			return;
+
+		if (enable)
+		{
+			for (auto &frame : s_frames)
+			{
+				glGenQueries(MaxEvents * 2, frame.queries);
+				frame.numEvents = 0;
+			}
+
+			if (!csvFile.empty())
+			{
+				s_csv = fopen(csvFile.c_str(), "w");
+				if (s_csv)
+				{
+					for (int i = 0; i < NumStages; i++)
+						fprintf(s_csv, i ? ",%s" : "%s", s_names[i]);
+					fputc('\n', s_csv);
+				}
+				else
+					ErrorLog("Unable to open GPU timings file '%s'.", csvFile.c_str());
+			}
+		}
+		else
+		{
+			for (auto &frame : s_frames)
+				glDeleteQueries(MaxEvents * 2, frame.queries);
+
+			if (s_csv)
+			{
+				fclose(s_csv);
+				s_csv = nullptr;
+			}
+		}
+
+		for (auto &open : s_open)
+			open = -1;
+		for (auto &sum : s_sums)
+			sum = 0;
+		s_sumFrames = 0;
+		s_frame = 0;
+		s_enabled = enable;
+	}
+
+	bool IsEnabled(void)
+	{
+		return s_enabled;
+	}
+
+	void Begin(int stage)
+	{
+		if (!s_enabled)
+			return;
+
+		Frame &frame = s_frames[s_frame];
+		if (frame.numEvents >= MaxEvents || s_open[stage] >= 0)
+			return;
+
+		s_open[stage] = frame.numEvents;
+		frame.stages[frame.numEvents] = stage;
+		glQueryCounter(frame.queries[frame.numEvents * 2], GL_TIMESTAMP);
+		frame.numEvents++;
+	}
+
+	void End(int stage)
+	{
+		if (!s_enabled || s_open[stage] < 0)
+			return;
+
+		Frame &frame = s_frames[s_frame];
+		glQueryCounter(frame.queries[s_open[stage] * 2 + 1], GL_TIMESTAMP);
+		s_open[stage] = -1;
+	}
+
+	void EndFrame(void)
+	{
+		if (!s_enabled)
+			return;
+
+		for (int stage = 0; stage < NumStages; stage++)
+			End(stage);
+
+		s_frame = (s_frame + 1) % NumFrames;
+
+		// Collect the frames that are ready, oldest first. The oldest is reused
+		// next, so it is collected or dropped either way.
+		for (int i = 0; i < NumFrames; i++)
+		{
+			Frame &frame = s_frames[(s_frame + i) % NumFrames];
+			if (!frame.numEvents)
+				continue;
+			if (i > 0 && !IsReady(frame))
+				break;
+			Collect(frame);
+		}
+	}
+
+	unsigned GetAverages(double ms[NumStages])
+	{
+		unsigned frames = s_sumFrames;
+		if (frames)
+		{
+			for (int i = 0; i < NumStages; i++)
+			{
+				ms[i] = s_sums[i] / frames;
+				s_sums[i] = 0;
+			}
+		}
+		s_sumFrames = 0;
+		return frames;
+	}
+
+	const char *StageName(int stage)
+	{
+		return s_names[stage];
+	}
+}
@@ -0,0 +1,100 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+ 
+/*
+ * GPUTimer.h
+ * 
+ * GPU timings of the render stages of a frame.
+ */
+
+#ifndef INCLUDED_GPUTIMER_H
+#define INCLUDED_GPUTIMER_H
+
+#include <string>
+
+/*
+ * Each stage is bracketed by a pair of GL timestamp queries, which unlike
+ * GL_TIME_ELAPSED queries may be issued inside other queries. Queries go into
+ * a ring a few frames deep and are read once the GPU has caught up with them,
+ * so timing never waits on the GPU. A stage may run several times a frame;
+ * its times are added up.
+ *
+ * Usage:
+ *
+ *		GPUTimer::Begin(GPUTimer::Render2DBottom);
+ *		// draw
+ *		GPUTimer::End(GPUTimer::Render2DBottom);
+ *		...
+ *		GPUTimer::EndFrame();	// after the buffers are swapped
+ */
+namespace GPUTimer
+{
+	enum Stage
+	{
+		Render2DBottom,
+		Render2DTop,
+		ScrollFog,
+		Scene,									// priority * 3 + layer (colour, trans1, trans2)
+		Composite = Scene + 12,					// New3D frame buffer passes
+		NumStages
+	};
+
+	/*
+	 * Enable(enable, csvFile):
+	 *
+	 * Turns timing on or off. Must be called with the GL context current.
+	 *
+	 * Parameters:
+	 *		enable		Whether to time stages.
+	 *		csvFile		If not empty, the times of each frame are written to
+	 *					this file, one row per frame and one column per stage.
+	 */
+	void Enable(bool enable, const std::string &csvFile);
+	bool IsEnabled(void);
+
+	void Begin(int stage);
+	void End(int stage);
+
+	/*
+	 * EndFrame():
+	 *
+	 * Starts the next frame and collects the times of frames the GPU has
+	 * finished.
+	 */
+	void EndFrame(void);
+
+	/*
+	 * GetAverages(ms):
+	 *
+	 * Average time of each stage over the frames collected since the last
+	 * call, in milliseconds.
+	 *
+	 * Returns:
+	 *		Number of frames averaged. ms is not written if this is 0.
+	 */
+	unsigned GetAverages(double ms[NumStages]);
+
+	const char *StageName(int stage);
+}
+
+#endif	// INCLUDED_GPUTIMER_H
@@ -3,6 +3,8 @@
 
 #include <cstdint>
 
+class CDirtyPages;
+
 /*
  * IRender3D:
  *
@@ -11,6 +13,7 @@
 class IRender3D
 {
 public:
+  virtual void BuildFrame(void) = 0;
   virtual void RenderFrame(void) = 0;
   virtual void BeginFrame(void) = 0;
   virtual void EndFrame(void) = 0;
@@ -21,6 +24,10 @@ public:
   virtual void SetSunClamp(bool enable) = 0;
   virtual void SetSignedShade(bool enable) = 0;
   virtual float GetLosValue(int layer) = 0;
+  virtual uint32_t GetFrameAllocations(void) = 0;
+  virtual uint32_t GetFrameModelsCached(void) = 0;
+  virtual void SetPolyRAMDirtyPages(const CDirtyPages *dirty) = 0;
+  virtual void SetCullingRAMDirtyPages(const CDirtyPages *lo, const CDirtyPages *hi) = 0;
 
   virtual ~IRender3D()
   {
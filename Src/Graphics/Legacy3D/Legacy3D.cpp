@@ -162,10 +162,12 @@
 #include "Shaders3D.h"  // fragment and vertex shaders
 #include "Graphics/Shader.h"
 #include "Util/BitCast.h"
+#include "OSD/Thread.h"
 
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 
 #ifndef M_PI
 #define M_PI 3.1415926535897932384626433832795
@@ -184,7 +186,7 @@ namespace Legacy3D {
 // Model cache settings
 #define NUM_STATIC_VERTS        700000  // suggested maximum number of static vertices
 #define NUM_DYNAMIC_VERTS       64000   // "" dynamic vertices
-#define NUM_LOCAL_VERTS         32768   // size of local vertex buffer
+#define NUM_LOCAL_VERTS         32768   // maximum number of vertices of each state in a model
 #define NUM_STATIC_MODELS       10000   // maximum number of unique static models to cache
 #define NUM_DYNAMIC_MODELS      1024    // maximum number of unique dynamic models to cache
 #define NUM_DISPLAY_LIST_ITEMS  10000   // maximum number of model instances displayed per frame
@@ -227,145 +229,95 @@ void CLegacy3D::DecodeTexture(int format, int x, int y, int width, int height)
   // Check to see if ALL texture tiles have been properly decoded on texture sheet
   if ((texSheet->texFormat[y/32][x/32] == format) && (texSheet->texWidth[y/32][x/32] >= width) && (texSheet->texHeight[y/32][x/32] >= height))
     return;
+  textureGeneration++;
 
   //printf("Decoding texture format %u: %u x %u @ (%u, %u) sheet %u\n", format, width, height, x, y, texNum);
 
-  // Copy and decode
-  int i = 0;
-  switch (format)
+  // Copy and decode to RGBA8. Channels are expanded to 8 bits the same way
+  // the driver would round them from float.
+  static const uint8_t expand5[32] =
   {
-  default:  // Unknown
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
-      {
-        textureBuffer[i++] = 0.0; // R
-        textureBuffer[i++] = 0.0; // G
-        textureBuffer[i++] = 1.0f;  // B
-        textureBuffer[i++] = 1.0f;  // A
-      }
-    }
-    break;    
-  case 0: // T1RGB5
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
-      {
-        textureBuffer[i++] = (GLfloat) ((textureRAM[yi*2048+xi]>>10)&0x1F) * (1.0f/31.0f);  // R
-        textureBuffer[i++] = (GLfloat) ((textureRAM[yi*2048+xi]>>5)&0x1F) * (1.0f/31.0f); // G
-        textureBuffer[i++] = (GLfloat) ((textureRAM[yi*2048+xi]>>0)&0x1F) * (1.0f/31.0f); // B
-        textureBuffer[i++] = ((textureRAM[yi*2048+xi]&0x8000)?0.0f:1.0f);         // T
-      }
-    }
-    break;
-  case 7: // RGBA4
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
-      {
-        textureBuffer[i++] = (GLfloat) ((textureRAM[yi*2048+xi]>>12)&0xF) * (1.0f/15.0f); // R
-        textureBuffer[i++] = (GLfloat) ((textureRAM[yi*2048+xi]>>8)&0xF) * (1.0f/15.0f);  // G
-        textureBuffer[i++] = (GLfloat) ((textureRAM[yi*2048+xi]>>4)&0xF) * (1.0f/15.0f);  // B
-        textureBuffer[i++] = (GLfloat) ((textureRAM[yi*2048+xi]>>0)&0xF) * (1.0f/15.0f);  // A
-      }
-    }
-    break;
-  case 5: // 8-bit grayscale
-    for (int yi = y; yi < (y+height); yi++)
+    0x00, 0x08, 0x10, 0x19, 0x21, 0x29, 0x31, 0x3A, 0x42, 0x4A, 0x52, 0x5A, 0x63, 0x6B, 0x73, 0x7B,
+    0x84, 0x8C, 0x94, 0x9C, 0xA5, 0xAD, 0xB5, 0xBD, 0xC5, 0xCE, 0xD6, 0xDE, 0xE6, 0xEF, 0xF7, 0xFF
+  };
+  uint8_t *dst = textureBuffer;
+  for (int yi = y; yi < (y+height); yi++)
+  {
+    const uint16_t *src = &textureRAM[yi*2048+x];
+    switch (format)
     {
-      for (int xi = x; xi < (x+width); xi++)
+    default:  // Unknown
+      for (int xi = 0; xi < width; xi++, dst += 4)
       {
-        // Interpret as 8-bit grayscale
-        uint16_t texel = textureRAM[yi*2048+xi] & 0xFF;
-        GLfloat c = texel * (1.0f/255.0f);
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = (texel == 0xFF) ? 0.f : 1.f;
+        dst[0] = 0;     // R
+        dst[1] = 0;     // G
+        dst[2] = 0xFF;  // B
+        dst[3] = 0xFF;  // A
       }
-    }
-    break;
-  case 4: // 8-bit L4A4 (high byte)
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
+      break;
+    case 0: // T1RGB5
+      for (int xi = 0; xi < width; xi++, dst += 4)
       {
-        uint16_t texel = textureRAM[yi*2048+xi] >> 8;
-        GLfloat c = (texel >> 4) * (1.0f/15.0f);
-        GLfloat a = (texel & 0xF) * (1.0f/15.0f);
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = a;
+        uint16_t texel = src[xi];
+        dst[0] = expand5[(texel>>10)&0x1F];   // R
+        dst[1] = expand5[(texel>>5)&0x1F];    // G
+        dst[2] = expand5[(texel>>0)&0x1F];    // B
+        dst[3] = (texel&0x8000) ? 0 : 0xFF;   // T
       }
-    }
-    break;
-  case 6: // 8-bit grayscale
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
+      break;
+    case 7: // RGBA4
+      for (int xi = 0; xi < width; xi++, dst += 4)
       {
-        uint16_t texel = textureRAM[yi*2048+xi] >> 8;
-        GLfloat c = texel * (1.0f/255.0f);
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = (texel == 0xFF) ? 0.f : 1.f;
+        uint16_t texel = src[xi];
+        dst[0] = ((texel>>12)&0xF) * 17;  // R
+        dst[1] = ((texel>>8)&0xF) * 17;   // G
+        dst[2] = ((texel>>4)&0xF) * 17;   // B
+        dst[3] = ((texel>>0)&0xF) * 17;   // A
       }
-    }
-    break;
-  case 2: // 8-bit L4A4 (low byte)
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
+      break;
+    case 5: // 8-bit grayscale (low byte)
+    case 6: // 8-bit grayscale (high byte)
+      for (int xi = 0; xi < width; xi++, dst += 4)
       {
-        uint16_t texel = textureRAM[yi*2048+xi] & 0xFF;
-        GLfloat c = (texel >> 4) * (1.0f/15.0f);
-        GLfloat a = (texel & 0xF) * (1.0f/15.0f);
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = a;
+        uint8_t texel = (format == 5) ? (src[xi] & 0xFF) : (src[xi] >> 8);
+        dst[0] = texel;
+        dst[1] = texel;
+        dst[2] = texel;
+        dst[3] = (texel == 0xFF) ? 0 : 0xFF;
       }
-    }
-    break;
-  case 3: // 8-bit A4L4 (high byte)
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
+      break;
+    case 2: // 8-bit L4A4 (low byte)
+    case 4: // 8-bit L4A4 (high byte)
+      for (int xi = 0; xi < width; xi++, dst += 4)
       {
-        uint16_t texel = textureRAM[yi*2048+xi] >> 8;
-        GLfloat c = (texel & 0xF) * (1.0f/15.0f);
-        GLfloat a = (texel >> 4) * (1.0f/15.0f);
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = a;
+        uint8_t texel = (format == 2) ? (src[xi] & 0xFF) : (src[xi] >> 8);
+        uint8_t c = (texel >> 4) * 17;
+        dst[0] = c;
+        dst[1] = c;
+        dst[2] = c;
+        dst[3] = (texel & 0xF) * 17;
       }
-    }
-    break;
-  case 1: // 8-bit A4L4 (low byte)
-    for (int yi = y; yi < (y+height); yi++)
-    {
-      for (int xi = x; xi < (x+width); xi++)
+      break;
+    case 1: // 8-bit A4L4 (low byte)
+    case 3: // 8-bit A4L4 (high byte)
+      for (int xi = 0; xi < width; xi++, dst += 4)
       {
-        uint16_t texel = textureRAM[yi*2048+xi] & 0xFF;
-        GLfloat c = (texel & 0xF) * (1.0f/15.0f);
-        GLfloat a = (texel >> 4) * (1.0f/15.0f);
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = c;
-        textureBuffer[i++] = a;
+        uint8_t texel = (format == 1) ? (src[xi] & 0xFF) : (src[xi] >> 8);
+        uint8_t c = (texel & 0xF) * 17;
+        dst[0] = c;
+        dst[1] = c;
+        dst[2] = c;
+        dst[3] = (texel >> 4) * 17;
       }
+      break;
     }
-    break;
   }
     
   // Upload texture to correct position within texture map
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   glActiveTexture(GL_TEXTURE0 + texSheet->mapNum);           // activate correct texture unit
   glBindTexture(GL_TEXTURE_2D, texMapIDs[texSheet->mapNum]); // bind correct texture map
-  glTexSubImage2D(GL_TEXTURE_2D, 0, texSheet->xOffset + x, texSheet->yOffset + y, width, height, GL_RGBA, GL_FLOAT, textureBuffer);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, texSheet->xOffset + x, texSheet->yOffset + y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, textureBuffer);
   
   // Mark texture as decoded
   texSheet->texFormat[y/32][x/32] = format;
@@ -378,16 +330,17 @@ void CLegacy3D::UploadTextures(unsigned level, unsigned x, unsigned y, unsigned
 {
 #ifdef DEBUG
   // Make everything red
-  for (int i = 0; i < 512*512; )
+  for (int i = 0; i < 512*512*4; )
   {
-    textureBuffer[i++] = 1.0f;
-    textureBuffer[i++] = 0.0f;
-    textureBuffer[i++] = 0.0f;
-    textureBuffer[i++] = 1.0f;
+    textureBuffer[i++] = 0xFF;
+    textureBuffer[i++] = 0;
+    textureBuffer[i++] = 0;
+    textureBuffer[i++] = 0xFF;
   }
 #endif
 
   // Update all texture sheets
+  textureGeneration++;
   for (size_t texSheet = 0; texSheet < numTexSheets; texSheet++)
   {
     for (size_t xi = x/32; xi < (x+width)/32; xi++)
@@ -409,7 +362,7 @@ void CLegacy3D::UploadTextures(unsigned level, unsigned x, unsigned y, unsigned
 ******************************************************************************/
 
 // Translates 24-bit culling RAM addresses
-const UINT32 *CLegacy3D::TranslateCullingAddress(UINT32 addr)
+const UINT32 *CLegacy3D::TranslateCullingAddress(UINT32 addr) const
 {
   addr &= 0x00FFFFFF; // caller should have done this already
   
@@ -425,7 +378,7 @@ const UINT32 *CLegacy3D::TranslateCullingAddress(UINT32 addr)
 }
 
 // Translates model references
-const UINT32 *CLegacy3D::TranslateModelAddress(UINT32 modelAddr)
+const UINT32 *CLegacy3D::TranslateModelAddress(UINT32 modelAddr) const
 {
   modelAddr &= 0x00FFFFFF;  // caller should have done this already
   
@@ -438,11 +391,47 @@ const UINT32 *CLegacy3D::TranslateModelAddress(UINT32 modelAddr)
 
 /******************************************************************************
  Matrix Stack
+
+ Each viewport is traversed with a matrix stack of its own, which lives on the
+ C++ stack as the scene graph is descended. Matrices are column-major and are
+ multiplied the same way glMultMatrixf() would.
 ******************************************************************************/
 
 // Macro to generate column-major (OpenGL) index from y,x subscripts
 #define CMINDEX(y,x)  (x*4+y)
 
+// Multiplies m by n, storing the result in m
+static void MultMatrices(GLfloat m[4*4], const GLfloat n[4*4])
+{
+  GLfloat r[4*4];
+  for (int x = 0; x < 4; x++)
+  {
+    for (int y = 0; y < 4; y++)
+      r[CMINDEX(y,x)] = m[CMINDEX(y,0)]*n[CMINDEX(0,x)] + m[CMINDEX(y,1)]*n[CMINDEX(1,x)] + m[CMINDEX(y,2)]*n[CMINDEX(2,x)] + m[CMINDEX(y,3)]*n[CMINDEX(3,x)];
+  }
+  memcpy(m, r, sizeof(r));
+}
+
+// Same as glTranslatef()
+static void TranslateMatrix(GLfloat m[4*4], GLfloat x, GLfloat y, GLfloat z)
+{
+  for (int i = 0; i < 4; i++)
+    m[CMINDEX(i,3)] += m[CMINDEX(i,0)]*x + m[CMINDEX(i,1)]*y + m[CMINDEX(i,2)]*z;
+}
+
+// Same as gluPerspective() applied to an identity matrix
+static void PerspectiveMatrix(GLfloat m[4*4], GLdouble fovYDegrees, GLdouble aspect, GLdouble zNear, GLdouble zFar)
+{
+  GLdouble f = 1.0/tan(fovYDegrees*M_PI/360.0);
+  for (int i = 0; i < 4*4; i++)
+    m[i] = 0.0f;
+  m[CMINDEX(0,0)] = (GLfloat) (f/aspect);
+  m[CMINDEX(1,1)] = (GLfloat) f;
+  m[CMINDEX(2,2)] = (GLfloat) ((zFar+zNear)/(zNear-zFar));
+  m[CMINDEX(2,3)] = (GLfloat) (2.0*zFar*zNear/(zNear-zFar));
+  m[CMINDEX(3,2)] = -1.0f;
+}
+
 /*
  * MultMatrix():
  *
@@ -450,12 +439,12 @@ const UINT32 *CLegacy3D::TranslateModelAddress(UINT32 modelAddr)
  * index is a 12-bit number specifying a matrix number relative to the base.
  * The base matrix MUST be set up before calling this function.
  */
-void CLegacy3D::MultMatrix(UINT32 matrixOffset)
+void CLegacy3D::MultMatrix(SceneTask &task, UINT32 matrixOffset) const
 {
   GLfloat   m[4*4];
-  const float *src = &matrixBasePtr[matrixOffset*12];
-  if (matrixBasePtr==NULL)  // LA Machineguns
+  if (task.matrixBasePtr==NULL)  // LA Machineguns
     return;
+  const float *src = &task.matrixBasePtr[matrixOffset*12];
   m[CMINDEX(0, 0)] = src[3];
   m[CMINDEX(0, 1)] = src[4];
   m[CMINDEX(0, 2)] = src[5];
@@ -472,7 +461,7 @@ void CLegacy3D::MultMatrix(UINT32 matrixOffset)
   m[CMINDEX(3, 1)] = 0.0;
   m[CMINDEX(3, 2)] = 0.0;
   m[CMINDEX(3, 3)] = 1.0; 
-  glMultMatrixf(m);
+  MultMatrices(task.matrix, m);
 }
 
 /*
@@ -500,11 +489,9 @@ void CLegacy3D::MultMatrix(UINT32 matrixOffset)
  * store everything as X,Y,Z and perform the translation at the end. The Real3D
  * also has Y and Z coordinates opposite of the OpenGL convention. This
  * function inserts a compensating matrix to undo these things.
- *
- * NOTE: This function assumes we are in GL_MODELVIEW matrix mode.
  */
 
-void CLegacy3D::InitMatrixStack(UINT32 matrixBaseAddr)
+void CLegacy3D::InitMatrixStack(SceneTask &task, UINT32 matrixBaseAddr) const
 {
   GLfloat m[4*4];
 
@@ -516,19 +503,23 @@ void CLegacy3D::InitMatrixStack(UINT32 matrixBaseAddr)
   m[CMINDEX(3,0)]=0.0;  m[CMINDEX(3,1)]=0.0;  m[CMINDEX(3,2)]=0.0;  m[CMINDEX(3,3)]=1.0;
   
   if (step > 0x10)
-    glLoadMatrixf(m);
+    memcpy(task.matrix, m, sizeof(m));
   else
   {
     // Scaling seems to help w/ Step 1.0's extremely large coordinates
     GLfloat s = 1.0f/2048.0f;
-    glLoadIdentity();
-    glScalef(s,s,s);
-    glMultMatrixf(m);
+    for (int i = 0; i < 4*4; i++)
+      task.matrix[i] = 0.0f;
+    task.matrix[CMINDEX(0,0)] = s;
+    task.matrix[CMINDEX(1,1)] = s;
+    task.matrix[CMINDEX(2,2)] = s;
+    task.matrix[CMINDEX(3,3)] = 1.0f;
+    MultMatrices(task.matrix, m);
   }
   
   // Set matrix base address and apply matrix #0 (coordinate system matrix)
-  matrixBasePtr = (float *) TranslateCullingAddress(matrixBaseAddr);
-  MultMatrix(0);
+  task.matrixBasePtr = (const float *) TranslateCullingAddress(matrixBaseAddr);
+  MultMatrix(task, 0);
 }
 
 
@@ -536,6 +527,13 @@ void CLegacy3D::InitMatrixStack(UINT32 matrixBaseAddr)
  Scene Database
  
  Complete scene database traversal and rendering.
+
+ Viewports are traversed in parallel on the job pool, each into a list of the
+ model instances it draws (see SceneTask). The models that miss both caches
+ are then decoded in parallel (see StagedModel), and finally the render thread
+ caches and draws the instances in the order they would have been traversed
+ in by one thread, so that the caches, textures, and display lists come out
+ the same whatever the number of threads.
 ******************************************************************************/
 
 static bool IsVROMModel(UINT32 modelAddr)
@@ -572,32 +570,30 @@ static bool IsDynamicModel(const UINT32 *data)
 /*
  * DrawModel():
  *
- * Draw the specified model (adds it to the display list). This is where vertex
- * buffer overflows and display list overflows will be detected. An attempt is
- * made to salvage the situation if this occurs, so if DrawModel() returns
- * FAIL, it is a serious matter and rendering should be aborted for the frame.
+ * Draw the specified model instance (adds it to the display list). This is
+ * where vertex buffer overflows and display list overflows will be detected.
+ * An attempt is made to salvage the situation if this occurs, so if
+ * DrawModel() returns FAIL, it is a serious matter and rendering should be
+ * aborted for the frame.
  *
  * Models are cached for each unique culling node texture offset state.
  */
-bool CLegacy3D::DrawModel(UINT32 modelAddr)
+bool CLegacy3D::DrawModel(const SceneTask &task, const SceneModel &Instance)
 {  
-  //if (modelAddr==0x7FFF00)  // Fighting Vipers (this is not polygon data!)
-  //  return;
-  if (modelAddr == 0x200000)  // Virtual On 2 (during boot-up, causes slow-down)
-    return OKAY;
-  const UINT32 *model = TranslateModelAddress(modelAddr);
+  const UINT32 *model = TranslateModelAddress(Instance.modelAddr);
   
   // Determine whether model is in polygon RAM or VROM
-  ModelCache *Cache = IsVROMModel(modelAddr) ? &VROMCache : &PolyCache;
+  ModelCache *Cache = IsVROMModel(Instance.modelAddr) ? &VROMCache : &PolyCache;
     
   // Look up the model in the LUT and cache it if necessary
-  int lutIdx = modelAddr&0xFFFFFF;
-  struct VBORef *ModelRef = LookUpModel(Cache, lutIdx, m_textureOffset.state);
+  int lutIdx = Instance.modelAddr&0xFFFFFF;
+  UINT16 textureOffsetState = Instance.state.textureOffset.state;
+  struct VBORef *ModelRef = LookUpModel(Cache, lutIdx, textureOffsetState);
   if (NULL == ModelRef && Cache == &VROMCache)
   {
     // If the model was a VROM model, it may be dynamic, so we need to try
     // another lookup in the dynamic cache
-    ModelRef = LookUpModel(&PolyCache, lutIdx, m_textureOffset.state);
+    ModelRef = LookUpModel(&PolyCache, lutIdx, textureOffsetState);
     if (ModelRef != NULL)
       Cache = &PolyCache;
   }
@@ -610,23 +606,33 @@ bool CLegacy3D::DrawModel(UINT32 modelAddr)
     // afterwards)
     if (Cache == &VROMCache && IsDynamicModel(model))
       Cache = &PolyCache;
-    ModelRef = CacheModel(Cache, lutIdx, m_textureOffset.state, model);
+    Cache->misses++;
+    ModelRef = CacheModel(Cache, Instance, model);
     if (NULL == ModelRef)
     {
       // Model could not be cached. Render what we have so far and try again.
+      // Once drawn, the static models in the display list may be evicted.
       DrawDisplayList(&VROMCache, POLY_STATE_NORMAL);
       DrawDisplayList(&PolyCache, POLY_STATE_NORMAL);
       DrawDisplayList(&VROMCache, POLY_STATE_ALPHA);
       DrawDisplayList(&PolyCache, POLY_STATE_ALPHA);
-      ClearModelCache(&VROMCache);
+      ClearDisplayList(&VROMCache);
       ClearModelCache(&PolyCache);
       
       // Try caching again...
-      ModelRef = CacheModel(Cache, lutIdx, m_textureOffset.state, model);
+      ModelRef = CacheModel(Cache, Instance, model);
+      if (NULL == ModelRef && Cache == &VROMCache)
+      {
+        ClearModelCache(&VROMCache);
+        ModelRef = CacheModel(Cache, Instance, model);
+      }
       if (NULL == ModelRef)
-        return ErrorUnableToCacheModel(modelAddr);  // nothing we can do :(
+        return ErrorUnableToCacheModel(Instance.modelAddr);  // nothing we can do :(
     }
   }
+  else
+    Cache->hits++;
+  ModelRef->lastUsed = Cache->useStamp;
 
   // If cache is static then decode all the texture references contained in the cached model
   // before rendering (models in dynamic cache will have been decoded already in CacheModel)
@@ -634,39 +640,57 @@ bool CLegacy3D::DrawModel(UINT32 modelAddr)
     ModelRef->texRefs.DecodeAllTextures(this);
 
   // Add to display list
-  return AppendDisplayList(Cache, false, ModelRef);
+  return AppendDisplayList(Cache, task, &Instance, ModelRef);
+}
+
+// Records an instance of a model with the current matrix and state, to be drawn once traversal is complete
+void CLegacy3D::RecordModel(SceneTask &task, UINT32 modelAddr) const
+{
+  //if (modelAddr==0x7FFF00)  // Fighting Vipers (this is not polygon data!)
+  //  return;
+  if (modelAddr == 0x200000)  // Virtual On 2 (during boot-up, causes slow-down)
+    return;
+
+  task.models.emplace_back();
+  SceneModel &Instance = task.models.back();
+  Instance.modelAddr = modelAddr;
+  Instance.state = task.state;
+  Instance.inheritsColorTable = !task.colorTableSet;  // resolved by StageModels()
+  Instance.staged = -1;
+  memcpy(Instance.modelViewMatrix, task.matrix, sizeof(task.matrix));
 }
 
 // Descends into a 10-word culling node
-void CLegacy3D::DescendCullingNode(UINT32 addr)
+void CLegacy3D::DescendCullingNode(SceneTask &task, UINT32 addr) const
 { 
-  ++stackDepth;
+  ++task.stackDepth;
   // Stack depth of 64 is too small for Star Wars Trilogy (Hoth)
-  if (stackDepth>=(512+64)) // safety (prevent overflows -- OpenGL matrix stack will still overflow by this point)
+  if (task.stackDepth>=(512+64)) // safety (prevent overflows)
   {
-    --stackDepth;
+    --task.stackDepth;
     return;
   }
 
   const UINT32 *node = TranslateCullingAddress(addr);
   if (NULL == node)
   {
-    --stackDepth;
+    --task.stackDepth;
     return;
   }
   
   // Set color table address, if one is specified
   if ((node[0x00] & 0x04))
   {
-    m_colorTableAddr = ((node[0x03-offset] >> 19) << 0) | ((node[0x07-offset] >> 28) << 13) | ((node[0x08-offset] >> 25) << 17);
-    m_colorTableAddr &= 0x000FFFFF; // clamp to 4MB (in words) range
+    task.state.colorTableAddr = ((node[0x03-offset] >> 19) << 0) | ((node[0x07-offset] >> 28) << 13) | ((node[0x08-offset] >> 25) << 17);
+    task.state.colorTableAddr &= 0x000FFFFF; // clamp to 4MB (in words) range
+    task.colorTableSet = true;
   }
 
 #ifdef DEBUG
-  bool oldDebugHighlightAll = m_debugHighlightAll;
-  m_debugHighlightAll = (m_debugHighlightCullingNodeIdx >= 0) && (node[m_debugHighlightCullingNodeIdx] & m_debugHighlightCullingNodeMask) != 0;
+  bool oldHighlight = task.state.highlight;
+  task.state.highlight = (m_debugHighlightCullingNodeIdx >= 0) && (node[m_debugHighlightCullingNodeIdx] & m_debugHighlightCullingNodeMask) != 0;
 #endif
-  //printf("%08x NODE %d\n", addr, stackDepth);
+  //printf("%08x NODE %d\n", addr, task.stackDepth);
   //for (int i = 0; i < 8; i++)
   //  printf("  %08x\n", node[i]);
 
@@ -683,19 +707,20 @@ void CLegacy3D::DescendCullingNode(UINT32 addr)
   const float z             = Util::Uint32AsFloat(node[0x06-offset]);
   
   // Texture offset?
-  TextureOffset oldTextureOffset = m_textureOffset; // save old offsets
+  TextureOffset oldTextureOffset = task.state.textureOffset; // save old offsets
   if (!offset)  // Step 1.5+
   {
     if ((node[0x02] & 0x8000))  // apply texture offset, else retain current ones
-      m_textureOffset = TextureOffset(node[0x02]);
+      task.state.textureOffset = TextureOffset(node[0x02]);
   }
   
   // Apply matrix and translation
-  glPushMatrix();
+  GLfloat oldMatrix[4*4];
+  memcpy(oldMatrix, task.matrix, sizeof(oldMatrix));
   if ((node[0x00]&0x10))  // apply translation vector
-    glTranslatef(x,y,z);
+    TranslateMatrix(task.matrix, x, y, z);
   else if (matrixOffset)  // multiply matrix, if specified
-    MultMatrix(matrixOffset);
+    MultMatrix(task, matrixOffset);
     
   // Descend down first link
   if ((node[0x00]&0x08))  // 4-element LOD table
@@ -704,38 +729,38 @@ void CLegacy3D::DescendCullingNode(UINT32 addr)
     if (NULL != lodTable)
     {
       if ((node[0x03-offset]&0x20000000))
-        DescendCullingNode(lodTable[0]&0xFFFFFF);
+        DescendCullingNode(task, lodTable[0]&0xFFFFFF);
       else
-        DrawModel(lodTable[0]&0xFFFFFF);
+        RecordModel(task, lodTable[0]&0xFFFFFF);
     }
   }
   else
-    DescendNodePtr(node1Ptr);
+    DescendNodePtr(task, node1Ptr);
 
   // Proceed to second link
-  glPopMatrix();
+  memcpy(task.matrix, oldMatrix, sizeof(oldMatrix));
 #ifdef DEBUG
-  m_debugHighlightAll = oldDebugHighlightAll;
+  task.state.highlight = oldHighlight;
 #endif
   if ((node[0x00] & 0x07) != 0x06)  // seems to indicate second link is invalid (fixes circular references)
-    DescendNodePtr(node2Ptr);
-  --stackDepth;
+    DescendNodePtr(task, node2Ptr);
+  --task.stackDepth;
   
   // Restore old texture offsets
-  m_textureOffset = oldTextureOffset;
+  task.state.textureOffset = oldTextureOffset;
 }
 
 // A list of pointers. MAME assumes that these may only point to culling nodes.
-void CLegacy3D::DescendPointerList(UINT32 addr)
+void CLegacy3D::DescendPointerList(SceneTask &task, UINT32 addr) const
 {
-  if (listDepth > 2)  // several Step 2.1 games require this safeguard
+  if (task.listDepth > 2)  // several Step 2.1 games require this safeguard
     return;
   
   const UINT32 *list = TranslateCullingAddress(addr);
   if (NULL == list)
     return;
     
-  ++listDepth;
+  ++task.listDepth;
   // Traverse the list forward and print it out
   int listEnd = 0;
   while (1)
@@ -759,7 +784,7 @@ void CLegacy3D::DescendPointerList(UINT32 addr)
     {
       if ((nodeAddr != 0) && (nodeAddr != 0x800800))
       {
-        DescendCullingNode(nodeAddr);
+        DescendCullingNode(task, nodeAddr);
       }
       //else
       //  printf("Strange pointers encountered\n");
@@ -767,7 +792,7 @@ void CLegacy3D::DescendPointerList(UINT32 addr)
     --listEnd;
   }
   
-  --listDepth;
+  --task.listDepth;
 }
 
 /*
@@ -775,7 +800,7 @@ void CLegacy3D::DescendPointerList(UINT32 addr)
  *
  * The old scene traversal engine. Recursively descends into a node pointer.
  */
-void CLegacy3D::DescendNodePtr(UINT32 nodeAddr)
+void CLegacy3D::DescendNodePtr(SceneTask &task, UINT32 nodeAddr) const
 {   
   // Ignore null links
   if ((nodeAddr&0x00FFFFFF) == 0)
@@ -784,14 +809,14 @@ void CLegacy3D::DescendNodePtr(UINT32 nodeAddr)
   switch ((nodeAddr>>24)&0xFF)  // pointer type encoded in upper 8 bits
   {
   case 0x00:  // culling node
-    DescendCullingNode(nodeAddr&0xFFFFFF);
+    DescendCullingNode(task, nodeAddr&0xFFFFFF);
     break;
   case 0x01:  // model (perhaps bit 1 is a flag in this case?)
   case 0x03:
-    DrawModel(nodeAddr&0xFFFFFF);
+    RecordModel(task, nodeAddr&0xFFFFFF);
     break;
   case 0x04:  // pointer list
-    DescendPointerList(nodeAddr&0xFFFFFF);
+    DescendPointerList(task, nodeAddr&0xFFFFFF);
     break;
   default:
     //printf("ATTENTION: Unknown pointer format: %08X\n\n", nodeAddr);
@@ -799,8 +824,8 @@ void CLegacy3D::DescendNodePtr(UINT32 nodeAddr)
   }
 }
 
-// Draws viewports of the given priority
-void CLegacy3D::RenderViewport(UINT32 addr, int pri, bool wideScreen)
+// Sets up the viewport of a task and traverses its scene graph. May run on any thread.
+void CLegacy3D::TraverseViewport(SceneTask &task, bool wideScreen) const
 {
   static constexpr GLfloat color[8][3] = {
     { 0.0, 0.0, 0.0 },    // off
@@ -813,27 +838,13 @@ void CLegacy3D::RenderViewport(UINT32 addr, int pri, bool wideScreen)
     { 1.0, 1.0, 1.0 }     // white
   };
 
-  // Translate address and obtain pointer
-  const UINT32 *vpnode = TranslateCullingAddress(addr);
-  if (nullptr == vpnode)
-    return;
-
-  // Recursively process next viewport
-  UINT32 nextAddr = vpnode[0x01]; // next viewport              
+  const UINT32 *vpnode = TranslateCullingAddress(task.addr);
   UINT32 nodeAddr = vpnode[0x02]; // scene database node pointer
-  if (nextAddr == 0)  // memory probably hasn't been set up yet, abort
-    return;
-  if (nextAddr != 0x01000000)
-    RenderViewport(nextAddr, pri, wideScreen);
+  DisplayList::ViewportInstance &Viewport = task.viewport;
 
   // Skip disabled viewports
   //if ((vpnode[0] & 0x20) != 0)
   //  return;
-
-  // If the priority doesn't match, do not process
-  int curPri = (vpnode[0x00] >> 3) & 3; // viewport priority
-  if (curPri != pri)
-    return;
   
   // Fetch viewport parameters (TO-DO: would rounding make a difference?)
   int vpX       = (vpnode[0x1A]&0xFFFF)>>4;   // viewport X (12.4 fixed point)
@@ -848,28 +859,26 @@ void CLegacy3D::RenderViewport(UINT32 addr, int pri, bool wideScreen)
   // TO-DO: investigate clipping planes
   
   // Set up viewport and projection (TO-DO: near and far clipping)
-  glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
   if (wideScreen && (vpX==0) && (vpWidth>=495) && (vpY==0) && (vpHeight >= 383))  // only expand viewports that occupy whole screen
   {
     // Wide screen hack only modifies X axis and not the Y FOV
-    viewportX      = 0;
-    viewportY      = yOffs + (GLint) ((float)(384-(vpY+vpHeight))*yRatio);
-    viewportWidth  = totalXRes;
-    viewportHeight = (GLint) ((float)vpHeight*yRatio);
-    gluPerspective(fovYDegrees,(GLfloat)viewportWidth/(GLfloat)viewportHeight,0.1f,1e5);  // use actual full screen ratio to get proper X FOV
-    //printf("viewportX=%d, viewportY=%d, viewportWidth=%d, viewportHeight=%d\tvpY=%d vpHeight=%d\n", viewportX, viewportY, viewportWidth, viewportHeight, vpY,vpHeight);
+    Viewport.x      = 0;
+    Viewport.y      = yOffs + (GLint) ((float)(384-(vpY+vpHeight))*yRatio);
+    Viewport.width  = totalXRes;
+    Viewport.height = (GLint) ((float)vpHeight*yRatio);
+    PerspectiveMatrix(Viewport.projectionMatrix, fovYDegrees, (GLfloat)Viewport.width/(GLfloat)Viewport.height, 0.1f, 1e5);  // use actual full screen ratio to get proper X FOV
   }
   else
   {
-    viewportX      = xOffs + (GLint) ((float)vpX*xRatio);
-    viewportY      = yOffs + (GLint) ((float)(384-(vpY+vpHeight))*yRatio);
-    viewportWidth  = (GLint) ((float)vpWidth*xRatio);
-    viewportHeight = (GLint) ((float)vpHeight*yRatio);
-    gluPerspective(fovYDegrees,(GLdouble)vpWidth/(GLdouble)vpHeight,0.1,1e5);        // use Model 3 viewport ratio
+    Viewport.x      = xOffs + (GLint) ((float)vpX*xRatio);
+    Viewport.y      = yOffs + (GLint) ((float)(384-(vpY+vpHeight))*yRatio);
+    Viewport.width  = (GLint) ((float)vpWidth*xRatio);
+    Viewport.height = (GLint) ((float)vpHeight*yRatio);
+    PerspectiveMatrix(Viewport.projectionMatrix, fovYDegrees, (GLdouble)vpWidth/(GLdouble)vpHeight, 0.1, 1e5);  // use Model 3 viewport ratio
   }
   
   // Lighting (note that sun vector points toward sun -- away from vertex)
+  GLfloat *lightingParams = Viewport.lightingParams;
   lightingParams[0] = Util::Uint32AsFloat(vpnode[0x05]);             // sun X
   lightingParams[1] = Util::Uint32AsFloat(vpnode[0x06]);             // sun Y
   lightingParams[2] = Util::Uint32AsFloat(vpnode[0x04]);             // sun Z
@@ -878,6 +887,9 @@ void CLegacy3D::RenderViewport(UINT32 addr, int pri, bool wideScreen)
   lightingParams[5] = 0.0;  // reserved
      
   // Spotlight
+  GLfloat *spotEllipse = Viewport.spotEllipse;
+  GLfloat *spotRange = Viewport.spotRange;
+  GLfloat *spotColor = Viewport.spotColor;
   int spotColorIdx  = (vpnode[0x20]>>11)&7;                 // spotlight color index
   spotEllipse[0]    = (float) ((vpnode[0x1E]>>3)&0x1FFF);   // spotlight X position (fractional component?)
   spotEllipse[1]    = (float) ((vpnode[0x1D]>>3)&0x1FFF);   // spotlight Y
@@ -903,6 +915,7 @@ void CLegacy3D::RenderViewport(UINT32 addr, int pri, bool wideScreen)
   spotEllipse[3] *= yRatio;
 
   // Fog
+  GLfloat *fogParams = Viewport.fogParams;
   fogParams[0] = (float) ((vpnode[0x22]>>16)&0xFF) * (float)(1.0/255.0); // fog color R
   fogParams[1] = (float) ((vpnode[0x22]>>8)&0xFF) * (float)(1.0/255.0);  // fog color G
   fogParams[2] = (float) ((vpnode[0x22]>>0)&0xFF) * (float)(1.0/255.0);  // fog color B
@@ -918,22 +931,25 @@ void CLegacy3D::RenderViewport(UINT32 addr, int pri, bool wideScreen)
   //printf("Fog: R=%02X G=%02X B=%02X density=%g (%X) %d start=%g\n", ((vpnode[0x22]>>16)&0xFF), ((vpnode[0x22]>>8)&0xFF), ((vpnode[0x22]>>0)&0xFF), fogParams[3], vpnode[0x23], (fogParams[3]==fogParams[3]), fogParams[4]);
 
   // Clear texture offsets before proceeding
-  m_textureOffset = TextureOffset();
+  task.state.textureOffset = TextureOffset();
+  task.state.colorTableAddr = 0;  // until set by a culling node, inherited from earlier viewports
+  task.state.highlight = false;
+  task.colorTableSet = false;
 
   // Set up coordinate system and base matrix
   UINT32 matrixBase = vpnode[0x16] & 0xFFFFFF;
-  glMatrixMode(GL_MODELVIEW);
-  InitMatrixStack(matrixBase);
+  InitMatrixStack(task, matrixBase);
+  task.state.normZFlip = (nullptr != task.matrixBasePtr) ? -1.0f*task.matrixBasePtr[0x5] : 1.0f; // coordinate system m13 component
 
   // Safeguard: weird coordinate system matrices usually indicate scenes that will choke the renderer
-  if (nullptr != matrixBasePtr)
+  if (nullptr != task.matrixBasePtr)
   {
     float m21, m32, m13;
 
     // Get the three elements that are usually set and see if their magnitudes are 1
-    m21 = matrixBasePtr[6];
-    m32 = matrixBasePtr[10];
-    m13 = matrixBasePtr[5];
+    m21 = task.matrixBasePtr[6];
+    m32 = task.matrixBasePtr[10];
+    m13 = task.matrixBasePtr[5];
 
     m21 *= m21;
     m32 *= m32;
@@ -948,18 +964,117 @@ void CLegacy3D::RenderViewport(UINT32 addr, int pri, bool wideScreen)
   }
 
   // Render
-  AppendDisplayList(&VROMCache, true, 0); // add a viewport display list node
-  AppendDisplayList(&PolyCache, true, 0);
-  stackDepth = 0;
-  listDepth = 0;
+  task.visible = true;
+  task.stackDepth = 0;
+  task.listDepth = 0;
 
   // Descend down the node link: Use recursive traversal
-  DescendNodePtr(nodeAddr);
+  DescendNodePtr(task, nodeAddr);
+}
+
+/*
+ * AddSceneTasks():
+ *
+ * Sets up a task for each viewport, in the order they are drawn in: by
+ * priority and, within a priority, from the last viewport in the chain to the
+ * first.
+ */
+void CLegacy3D::AddSceneTasks(void)
+{
+  m_viewportChain.clear();
+  UINT32 addr = 0x800000;
+  while (m_viewportChain.size() < 0x10000)  // guard against circular chains
+  {
+    const UINT32 *vpnode = TranslateCullingAddress(addr);
+    if (nullptr == vpnode)
+      break;
+    UINT32 nextAddr = vpnode[0x01]; // next viewport
+    if (nextAddr == 0)  // memory probably hasn't been set up yet, abort
+      break;
+    m_viewportChain.push_back(addr);
+    if (nextAddr == 0x01000000)
+      break;
+    addr = nextAddr;
+  }
+
+  m_numSceneTasks = 0;
+  for (int pri = 0; pri <= 3; pri++)
+  {
+    for (size_t i = m_viewportChain.size(); i-- > 0; )
+    {
+      // If the priority doesn't match, do not process
+      const UINT32 *vpnode = TranslateCullingAddress(m_viewportChain[i]);
+      if (((vpnode[0x00] >> 3) & 3) != UINT32(pri))
+        continue;
+      if (m_numSceneTasks == m_sceneTasks.size())
+        m_sceneTasks.emplace_back();
+      SceneTask &task = m_sceneTasks[m_numSceneTasks++];
+      task.addr = m_viewportChain[i];
+      task.priority = pri;
+      task.visible = false;
+      task.models.clear();
+    }
+  }
+}
+
+/*
+ * StageModels():
+ *
+ * Gives the model instances drawn before their viewport set a color table the
+ * one left by the viewports drawn earlier, then finds the models that are in
+ * neither cache and decodes each of them once, in parallel, with the state of
+ * its first instance. They are cached by DrawModel(), in drawing order.
+ */
+void CLegacy3D::StageModels(void)
+{
+  m_stagedIndex.clear();
+  m_numStagedModels = 0;
+  for (size_t t = 0; t < m_numSceneTasks; t++)
+  {
+    SceneTask &task = m_sceneTasks[t];
+    if (!task.visible)
+      continue;
+    for (SceneModel &Instance: task.models)
+    {
+      if (Instance.inheritsColorTable)
+        Instance.state.colorTableAddr = m_colorTableAddr;
+      int lutIdx = Instance.modelAddr&0xFFFFFF;
+      UINT16 textureOffsetState = Instance.state.textureOffset.state;
+      if ((LookUpModel(&VROMCache, lutIdx, textureOffsetState) != NULL) || (LookUpModel(&PolyCache, lutIdx, textureOffsetState) != NULL))
+        continue;
+      UINT64 key = (UINT64(lutIdx) << 16) | textureOffsetState;
+      auto it = m_stagedIndex.find(key);
+      if (it != m_stagedIndex.end())
+      {
+        Instance.staged = it->second;
+        continue;
+      }
+      if (m_numStagedModels == m_stagedModels.size())
+        m_stagedModels.emplace_back();
+      StagedModel &Staged = m_stagedModels[m_numStagedModels];
+      Staged.data = TranslateModelAddress(Instance.modelAddr);
+      Staged.lutIdx = lutIdx;
+      Staged.state = Instance.state;
+      Instance.staged = int(m_numStagedModels);
+      m_stagedIndex[key] = int(m_numStagedModels++);
+    }
+    if (task.colorTableSet)
+      m_colorTableAddr = task.state.colorTableAddr;
+  }
+
+  // Interleave the models over a few jobs per thread to even out their sizes
+  size_t numStaged = m_numStagedModels;
+  unsigned numJobs = unsigned(std::min<size_t>(numStaged, (CThread::GetJobPool()->GetNumWorkers() + 1) * 4));
+  CThread::GetJobPool()->Run("Legacy3D models", numJobs, [this, numStaged, numJobs](unsigned job)
+  {
+    for (size_t i = job; i < numStaged; i += numJobs)
+      DecodeModel(&m_stagedModels[i]);
+  });
 }
 
 void CLegacy3D::RenderFrame(void)
 {
-  bool wideScreen = m_config["WideScreen"].ValueAs<bool>();
+  bool wideScreen = m_wideScreen.Get();
 
   // Begin frame
   ClearErrors();  // must be cleared each frame
@@ -1010,13 +1125,33 @@ void CLegacy3D::RenderFrame(void)
     ClearModelCache(&VROMCache);
 #endif
   ClearModelCache(&PolyCache);
+
+  // Traverse all viewports and decode the models they miss in parallel
+  AddSceneTasks();
+  CThread::GetJobPool()->Run("Legacy3D traversal", unsigned(m_numSceneTasks), [this, wideScreen](unsigned i)
+  {
+    TraverseViewport(m_sceneTasks[i], wideScreen);
+  });
+  StageModels();
+
+  // Cache and draw them in traversal order
+  size_t t = 0;
   for (int pri = 0; pri <= 3; pri++)
   {
     glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
     //ClearModelCache(&PolyCache);
     ClearDisplayList(&PolyCache);
     ClearDisplayList(&VROMCache);
-    RenderViewport(0x800000,pri,wideScreen);
+    for (; (t < m_numSceneTasks) && (m_sceneTasks[t].priority == pri); t++)
+    {
+      const SceneTask &task = m_sceneTasks[t];
+      if (!task.visible)
+        continue;
+      AppendDisplayList(&VROMCache, task, NULL, NULL); // add a viewport display list node
+      AppendDisplayList(&PolyCache, task, NULL, NULL);
+      for (const SceneModel &Instance: task.models)
+        DrawModel(task, Instance);
+    }
     DrawDisplayList(&VROMCache, POLY_STATE_NORMAL);
     DrawDisplayList(&PolyCache, POLY_STATE_NORMAL);
     DrawDisplayList(&VROMCache, POLY_STATE_ALPHA);
@@ -1045,6 +1180,10 @@ void CLegacy3D::EndFrame(void)
 {
 }
 
+void CLegacy3D::BuildFrame(void)
+{
+}
+
 void CLegacy3D::BeginFrame(void)
 {
   //printf("--- BEGIN FRAME ---\n");
@@ -1062,7 +1201,6 @@ void CLegacy3D::AttachMemory(const UINT32 *cullingRAMLoPtr, const UINT32 *cullin
   polyRAM = polyRAMPtr;
   vrom = vromPtr;
   textureRAM = textureRAMPtr;
-  DebugLog("Legacy3D attached Real3D memory regions\n");
 }
 
 void CLegacy3D::SetStepping(int stepping)
@@ -1092,7 +1230,7 @@ void CLegacy3D::SetStepping(int stepping)
 bool CLegacy3D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yRes, unsigned totalXResParam, unsigned totalYResParam)
 {
   // Allocate memory for texture buffer
-  textureBuffer = new(std::nothrow) GLfloat[1024*1024*4];
+  textureBuffer = new(std::nothrow) uint8_t[1024*1024*4];
   if (NULL == textureBuffer)
     return ErrorLog("Insufficient memory for texture decode buffer.");
     
@@ -1104,14 +1242,6 @@ bool CLegacy3D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned
   if (CreateModelCache(&PolyCache, NUM_DYNAMIC_VERTS, NUM_LOCAL_VERTS, NUM_DYNAMIC_MODELS, 0x4000000/4, NUM_DISPLAY_LIST_ITEMS, true))
     return FAIL;
 
-  // Initialize lighting parameters (updated as viewports are traversed)
-  lightingParams[0] = 0.0;
-  lightingParams[1] = 0.0;
-  lightingParams[2] = 0.0;
-  lightingParams[3] = 0.0;
-  lightingParams[4] = 1.0;  // full ambient intensity in case we want to render a standalone model
-  lightingParams[5] = 0.0;
-
   // Resolution and offset within physical display area
   xRatio = (GLfloat) xRes / 496.0f;
   yRatio = (GLfloat) yRes / 384.0f;
@@ -1309,8 +1439,27 @@ float CLegacy3D::GetLosValue(int layer)
 	return 0.0f;
 }
 
+UINT32 CLegacy3D::GetFrameAllocations(void)
+{
+	return 0;
+}
+
+UINT32 CLegacy3D::GetFrameModelsCached(void)
+{
+	return 0;
+}
+
+void CLegacy3D::SetPolyRAMDirtyPages(const CDirtyPages *dirty)
+{
+}
+
+void CLegacy3D::SetCullingRAMDirtyPages(const CDirtyPages *lo, const CDirtyPages *hi)
+{
+}
+
 CLegacy3D::CLegacy3D(const Util::Config::Node &config)
-  : m_config(config)
+  : m_config(config),
+    m_wideScreen(config, "WideScreen")
 { 
   cullingRAMLo = NULL;
   cullingRAMHi = NULL;
@@ -1319,12 +1468,11 @@ CLegacy3D::CLegacy3D(const Util::Config::Node &config)
   textureRAM = NULL;
   textureBuffer = NULL;
   texSheets = NULL;
+  textureGeneration = 1;
   
   // Clear model cache pointers so we can safely destroy them if init fails
   for (int i = 0; i < 2; i++)
   {
-    VROMCache.verts[i] = NULL;
-    PolyCache.verts[i] = NULL;
     VROMCache.Models = NULL;
     PolyCache.Models = NULL;
     VROMCache.lut = NULL;
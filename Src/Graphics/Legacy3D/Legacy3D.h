@@ -34,6 +34,8 @@
 #include <GL/glew.h>
 #include "Util/NewConfig.h"
 #include "Types.h"
+#include <unordered_map>
+#include <vector>
 
 namespace Legacy3D {
 
@@ -82,9 +84,12 @@ struct Poly
 
 struct VBORef
 {
+	static const unsigned FreeSlot = 0xFFFFFFFF;  // lutIdx of model array entries not holding a model
+
 	unsigned index[2];		// index of model polygons in VBO
 	unsigned numVerts[2]; // number of vertices
-	unsigned lutIdx;      // LUT index associated with this model (for fast LUT clearing)
+	unsigned lutIdx;      // LUT index associated with this model (for fast LUT clearing), or FreeSlot
+	unsigned lastUsed;    // ModelCache::useStamp when last added to a display list
 	
 	VBORef *nextTextureOffsetState; // linked list of models with different texture offset states
 	uint16_t textureOffsetState;    // texture offset data for this model
@@ -102,6 +107,7 @@ struct VBORef
 	{
 		texRefs.Clear();
 		lutIdx = 0;
+		lastUsed = 0;
 		textureOffsetState = 0;
 		nextTextureOffsetState = NULL;
 		useStencil = false;
@@ -120,8 +126,8 @@ struct DisplayList
 	struct ViewportInstance
 	{
 		GLfloat	projectionMatrix[4*4];	// projection matrix
-		GLfloat	lightingParams[6];		  // lighting parameters (see RenderViewport() and vertex shader)
-		GLfloat	spotEllipse[4];			    // spotlight ellipse (see RenderViewport())
+		GLfloat	lightingParams[6];		  // lighting parameters (see TraverseViewport() and vertex shader)
+		GLfloat	spotEllipse[4];			    // spotlight ellipse (see TraverseViewport())
 		GLfloat	spotRange[2];			      // Z range
 		GLfloat	spotColor[3];			      // color
 		GLfloat fogParams[5];			      // fog parameters (...)
@@ -161,6 +167,12 @@ struct DisplayList
  * cleared, one cannot assume a model exists because there is a LUT entry
  * pointing to it. Always use NeedToCache() to determine whether caching is
  * necessary before reading the LUT!
+ *
+ * Static caches are never cleared when full. Instead, the least recently used
+ * models that are not in the current display list are evicted, in batches so
+ * that the next few misses find room straight away. VBO space is handed out
+ * from a free list of vertex ranges, sorted by index, with adjacent ranges
+ * merged when freed.
  */
 struct ModelCache
 {
@@ -172,15 +184,31 @@ struct ModelCache
 	unsigned	vboCurOffset;	// current offset in VBO (in bytes)
 	GLuint		vboID;			// OpenGL VBO handle
 	
-	// Local vertex buffers (enough for a single model)
-	unsigned	maxVertIdx;		// size of each local vertex buffer (in vertices)
-	unsigned	curVertIdx[2];	// current vertex index (in vertices)
-	GLfloat		*verts[2];
+	// Models are decoded into staging buffers (see StagedModel)
+	unsigned	maxVertIdx;		// maximum number of vertices of each state in a model
 	
 	// Array of cached models
 	unsigned	maxModels;	// maximum number of models
 	unsigned	numModels;	// current number stored
 	VBORef		*Models;
+
+	// Static cache allocation (all in vertices)
+	struct FreeRange
+	{
+		unsigned	index;
+		unsigned	numVerts;
+	};
+	unsigned	vboMaxVerts;	// size of VBO
+	unsigned	numFreeRanges;
+	FreeRange	*freeRanges;	// maxModels+1 entries
+	unsigned	numFreeModels;
+	unsigned	*freeModels;	// evicted entries of Models[] available for reuse
+	unsigned	useStamp;		// advanced each time the display list is cleared
+
+	// Statistics
+	UINT64		hits;
+	UINT64		misses;
+	UINT64		evictions;
 	
 	/*
 	 * Look-Up Table:
@@ -201,6 +229,106 @@ struct ModelCache
 	DisplayList	*ListTail[2];	// current tail node for each state
 };
 
+// Texture offset applied by culling nodes to the models below them
+struct TextureOffset
+{
+  int x;          // x offset
+  int y;          // y offset (wraps within 2048x1023 texel bank)
+  int switchBank; // 0: use bank from polygon header, 1024: swap banks
+  uint16_t state; // x, y, and bank states compromise a unique key
+  TextureOffset(uint32_t data)
+    : x(32 * ((data >> 7) & 0x7F)),
+      y(32 * (data & 0x7F)),
+      switchBank((data & 0x4000) >> 4),
+      state(data & 0x7FFF)
+  {}
+  TextureOffset()
+    : x(0),
+      y(0),
+      switchBank(false),
+      state(0)
+  {}
+};
+
+/*
+ * ModelState:
+ *
+ * Traversal state a model is decoded with. A cached model keeps the state of
+ * the instance it was first decoded for.
+ */
+struct ModelState
+{
+	TextureOffset	textureOffset;
+	UINT32			colorTableAddr;	// address of color table in polygon RAM
+	GLfloat			normZFlip;		// Z axis sign of the coordinate system (see InsertPolygon())
+	bool			highlight;		// debug highlighting of the culling node (DEBUG builds only)
+};
+
+/*
+ * StagedModel:
+ *
+ * A model decoded into vertex buffers of its own, sorted by state, with the
+ * textures it references. Decoding needs no GL calls or model caches, so
+ * models can be decoded in parallel and added to a cache afterwards.
+ */
+struct StagedModel
+{
+	struct TexRef
+	{
+		int	format, x, y, width, height;
+	};
+
+	const UINT32			*data;			// model in polygon RAM or VROM
+	int						lutIdx;
+	ModelState				state;
+	std::vector<GLfloat>	verts[2];		// VBO_VERTEX_SIZE floats per vertex
+	std::vector<TexRef>		texRefs;		// in polygon order
+	bool					useStencil;
+	bool					overflow;		// too many vertices for a model
+
+	unsigned NumVerts(int state) const;
+};
+
+/*
+ * SceneModel:
+ *
+ * A model instance found by the scene traversal.
+ */
+struct SceneModel
+{
+	UINT32		modelAddr;
+	ModelState	state;
+	bool		inheritsColorTable;		// drawn before its viewport set a color table
+	int			staged;					// index of the model decoded for it, or -1 if it was cached
+	GLfloat		modelViewMatrix[4*4];
+};
+
+/*
+ * SceneTask:
+ *
+ * Traversal of one viewport. Viewports are traversed in parallel, with a
+ * matrix stack of their own and without touching GL or the model caches. The
+ * model instances they find are recorded in drawing order and added to the
+ * display lists afterwards by the render thread, in the order of a traversal
+ * on one thread.
+ */
+struct SceneTask
+{
+	UINT32							addr;		// viewport node
+	int								priority;
+	bool							visible;	// passed the coordinate system safeguard
+	DisplayList::ViewportInstance	viewport;
+	std::vector<SceneModel>			models;
+
+	// Traversal state
+	const float		*matrixBasePtr;	// Real3D base matrix
+	GLfloat			matrix[4*4];	// model-view matrix
+	ModelState		state;
+	bool			colorTableSet;	// state.colorTableAddr was set by a culling node
+	int				listDepth;		// how many lists have we recursed into
+	int				stackDepth;		// for debugging and error handling purposes
+};
+
 struct TexSheet
 {
 	unsigned sheetNum;
@@ -236,6 +364,14 @@ class CLegacy3D: public IRender3D
 	friend class CTextureRefs;
 
 public:
+	/*
+	 * BuildFrame(void):
+	 *
+	 * Does nothing; the scene database is traversed while it is drawn, by
+	 * RenderFrame().
+	 */
+	void BuildFrame(void);
+
 	/*
 	 * RenderFrame(void):
 	 *
@@ -360,6 +496,38 @@ public:
 	*/
 	float GetLosValue(int layer);
 
+	/*
+	* GetFrameAllocations(void);
+	*
+	* Gets the number of heap allocations made building the last frame. Not
+	* tracked by this renderer.
+	*/
+	UINT32 GetFrameAllocations(void);
+
+	/*
+	* GetFrameModelsCached(void);
+	*
+	* Gets the number of models decoded building the last frame. Not tracked
+	* by this renderer.
+	*/
+	UINT32 GetFrameModelsCached(void);
+
+	/*
+	* SetPolyRAMDirtyPages(dirty);
+	*
+	* Sets the polygon RAM pages written since the last frame. Not used by
+	* this renderer.
+	*/
+	void SetPolyRAMDirtyPages(const CDirtyPages *dirty);
+
+	/*
+	* SetCullingRAMDirtyPages(lo, hi);
+	*
+	* Sets the culling RAM pages written since the last frame. Not used by
+	* this renderer.
+	*/
+	void SetCullingRAMDirtyPages(const CDirtyPages *lo, const CDirtyPages *hi);
+
 	/*
 	 * CLegacy3D(void):
 	 * ~CLegacy3D(void):
@@ -378,20 +546,27 @@ private:
 	 */
 
 	// Real3D address translation
-	const UINT32 *TranslateCullingAddress(UINT32 addr);
-	const UINT32 *TranslateModelAddress(UINT32 addr);
+	const UINT32 *TranslateCullingAddress(UINT32 addr) const;
+	const UINT32 *TranslateModelAddress(UINT32 addr) const;
 	
 	// Model caching and display list management
 	void 			DrawDisplayList(ModelCache *Cache, POLY_STATE state);
-	bool 			AppendDisplayList(ModelCache *Cache, bool isViewport, const struct VBORef *Model);
+	bool 			AppendDisplayList(ModelCache *Cache, const SceneTask &task, const SceneModel *Instance, const struct VBORef *Model);
 	void 			ClearDisplayList(ModelCache *Cache);
-	int       GetTextureBaseX(const Poly *P) const;
-	int       GetTextureBaseY(const Poly *P) const;
-	bool 			InsertPolygon(ModelCache *cache, const Poly *p);
-	void 			InsertVertex(ModelCache *cache, const Vertex *v, const Poly *p, float normFlip);
+	int       GetTextureBaseX(const Poly *P, const TextureOffset &textureOffset) const;
+	int       GetTextureBaseY(const Poly *P, const TextureOffset &textureOffset) const;
+	bool 			InsertPolygon(StagedModel *Staged, const Poly *p) const;
+	void 			InsertVertex(StagedModel *Staged, const Vertex *v, const Poly *p, float normFlip) const;
+	void			DecodeModel(StagedModel *Staged) const;
 	struct VBORef	*BeginModel(ModelCache *cache);
-	void			EndModel(ModelCache *cache, struct VBORef *Model, int lutIdx, UINT16 textureOffsetState, bool useStencil);
-	struct VBORef	*CacheModel(ModelCache *cache, int lutIdx, UINT16 textureOffsetState, const UINT32 *data);
+	bool			EndModel(ModelCache *cache, struct VBORef *Model, const StagedModel &Staged);
+	void			FlushDynamicVerts(ModelCache *cache);
+	bool			AllocVBO(ModelCache *cache, unsigned numVerts, unsigned *index);
+	unsigned		FreeVBO(ModelCache *cache, unsigned index, unsigned numVerts);
+	unsigned		EvictModel(ModelCache *cache, struct VBORef *Model);
+	bool			EvictModels(ModelCache *cache, unsigned numVerts);
+	struct VBORef	*CacheModel(ModelCache *cache, const SceneModel &Instance, const UINT32 *data);
+	struct VBORef	*CommitModel(ModelCache *cache, const StagedModel &Staged);
 	struct VBORef	*LookUpModel(ModelCache *cache, int lutIdx, UINT16 textureOffsetState);
 	void 			ClearModelCache(ModelCache *cache);
 	bool 			CreateModelCache(ModelCache *cache, unsigned vboMaxVerts, unsigned localMaxVerts, unsigned maxNumModels, unsigned numLUTEntries, unsigned displayListSize, bool isDynamic);
@@ -401,15 +576,18 @@ private:
 	void DecodeTexture(int format, int x, int y, int width, int height);
 	
 	// Matrix stack
-	void	MultMatrix(UINT32 matrixOffset);
-	void 	InitMatrixStack(UINT32 matrixBaseAddr);
+	void	MultMatrix(SceneTask &task, UINT32 matrixOffset) const;
+	void 	InitMatrixStack(SceneTask &task, UINT32 matrixBaseAddr) const;
 	
 	// Scene database traversal
-	bool DrawModel(UINT32 modelAddr);
-	void DescendCullingNode(UINT32 addr);
-	void DescendPointerList(UINT32 addr);
-	void DescendNodePtr(UINT32 nodeAddr);
-	void RenderViewport(UINT32 addr, int pri, bool wideScreen);
+	bool DrawModel(const SceneTask &task, const SceneModel &Instance);
+	void RecordModel(SceneTask &task, UINT32 modelAddr) const;
+	void DescendCullingNode(SceneTask &task, UINT32 addr) const;
+	void DescendPointerList(SceneTask &task, UINT32 addr) const;
+	void DescendNodePtr(SceneTask &task, UINT32 nodeAddr) const;
+	void TraverseViewport(SceneTask &task, bool wideScreen) const;
+	void AddSceneTasks(void);
+	void StageModels(void);
 	
 	// In-frame error reporting
 	bool ErrorLocalVertexOverflow(void);
@@ -421,6 +599,7 @@ private:
 	 */
   
   const Util::Config::Node &m_config;
+  Util::Config::CachedValue<bool> m_wideScreen;  // read each frame
 	
 #ifdef DEBUG
 	// Debug
@@ -428,7 +607,6 @@ private:
 	uint32_t m_debugHighlightPolyHeaderMask = 0;
 	int m_debugHighlightCullingNodeIdx = -1;
 	uint32_t m_debugHighlightCullingNodeMask = 0;
-	bool m_debugHighlightAll = false;
 #endif
 	
 	// Stepping
@@ -446,41 +624,17 @@ private:
 	// Error reporting
 	unsigned	errorMsgFlags;	// tracks which errors have been printed this frame
 	
-	// Real3D Base Matrix Pointer
-	const float	*matrixBasePtr;
-	
-	// Current viewport parameters (updated as viewports are traversed)
-	GLfloat	lightingParams[6];
-	GLfloat	fogParams[5];
-	GLfloat	spotEllipse[4];
-	GLfloat	spotRange[2];
-	GLfloat	spotColor[3];
-	GLint	viewportX, viewportY;
-	GLint	viewportWidth, viewportHeight;
-	
-	// Scene graph processing
-	int		listDepth;	        // how many lists have we recursed into
-	int		stackDepth;	        // for debugging and error handling purposes
-	struct TextureOffset
-	{
-	  int x;          // x offset
-	  int y;          // y offset (wraps within 2048x1023 texel bank)
-	  int switchBank; // 0: use bank from polygon header, 1024: swap banks
-	  uint16_t state; // x, y, and bank states compromise a unique key
-	  TextureOffset(uint32_t data)
-	    : x(32 * ((data >> 7) & 0x7F)),
-	      y(32 * (data & 0x7F)),
-	      switchBank((data & 0x4000) >> 4),
-	      state(data & 0x7FFF)
-	  {}
-	  TextureOffset()
-	    : x(0),
-	      y(0),
-	      switchBank(false),
-	      state(0)
-	  {}
-	} m_textureOffset;
-	UINT32  m_colorTableAddr = 0x400; // address of color table in polygon RAM
+	// Scene graph processing (tasks and staged models are reused each frame)
+	std::vector<UINT32>		m_viewportChain;		// viewport node addresses, first to last
+	std::vector<SceneTask>	m_sceneTasks;			// in drawing order
+	size_t					m_numSceneTasks = 0;
+	std::vector<StagedModel>	m_stagedModels;		// models decoded for this frame, first instance first
+	size_t					m_numStagedModels = 0;
+	std::unordered_map<UINT64, int>	m_stagedIndex;	// (lutIdx << 16) | texture offset state -> staged model
+	StagedModel				m_serialStage;			// for a model whose staged copy has a different state
+	std::vector<GLfloat>	m_pendingVerts;			// dynamic model vertices not yet uploaded, from m_pendingVertsIndex on
+	unsigned				m_pendingVertsIndex = 0;
+	UINT32  m_colorTableAddr = 0x400; // address of color table in polygon RAM (carried over from the last frame)
 	
 	// Resolution and scaling factors (to support resolutions higher than 496x384) and offsets
 	GLfloat		xRatio, yRatio;
@@ -494,6 +648,7 @@ private:
 	unsigned    numTexSheets;                // total number of texture sheets
 	TexSheet   *texSheets;                   // texture sheet objects
 	TexSheet   *fmtToTexSheet[8];            // final mapping from Model3 texture format to texture sheet
+	unsigned    textureGeneration;           // incremented whenever texture RAM is uploaded or a texture is decoded (see CTextureRefs)
 	
 	// Shader programs and input data locations
 	GLuint	shaderProgram;			// shader program object
@@ -526,9 +681,9 @@ private:
  	 * Texture Decode Buffer
  	 *
  	 * Textures are decoded and copied from texture RAM into this temporary buffer
- 	 * before being uploaded. Dimensions are 512x512.
+ 	 * before being uploaded. Dimensions are 1024x1024.
  	 */
-	GLfloat	*textureBuffer;	// RGBA8 format
+	uint8_t	*textureBuffer;	// RGBA8 format
 };
 
 } // Legacy3D
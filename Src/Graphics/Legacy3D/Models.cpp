@@ -103,8 +103,10 @@
  *   texture base coordinates are not re-decoded in two different places!
  */
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <vector>
 #include "Supermodel.h"
 #include "Legacy3D.h"
 
@@ -229,6 +231,10 @@ static void PrintMatrix(GLfloat m[4*4])
 // Draws the display list
 void CLegacy3D::DrawDisplayList(ModelCache *Cache, POLY_STATE state)
 {
+  // Upload the dynamic models cached since the last draw
+  if (Cache->dynamic)
+    FlushDynamicVerts(Cache);
+
   // Bind and activate VBO (pointers activate currently bound VBO)
   glBindBuffer(GL_ARRAY_BUFFER, Cache->vboID);
   glVertexPointer(3, GL_FLOAT, VBO_VERTEX_SIZE*sizeof(GLfloat), (GLvoid *) (VBO_VERTEX_OFFSET_X*sizeof(GLfloat))); 
@@ -314,9 +320,10 @@ void CLegacy3D::DrawDisplayList(ModelCache *Cache, POLY_STATE state)
   }
 }
 
-// Appends an instance of a model or viewport to the display list, copying over the required state information
-bool CLegacy3D::AppendDisplayList(ModelCache *Cache, bool isViewport, const struct VBORef *Model)
+// Appends an instance of a model or, if Instance is NULL, the viewport of a task to the display list, copying over the required state information
+bool CLegacy3D::AppendDisplayList(ModelCache *Cache, const SceneTask &task, const SceneModel *Instance, const struct VBORef *Model)
 {
+  bool isViewport = (Instance == NULL);
   if ((Cache->listSize+2) > Cache->maxListSize) // a model may have 2 states (viewports are added to both display lists)
     return FAIL;
     //return ErrorLog("Display list is full.");
@@ -330,21 +337,8 @@ bool CLegacy3D::AppendDisplayList(ModelCache *Cache, bool isViewport, const stru
       // Get index for new display list item and advance to next one
       lm = Cache->listSize++;
       
-      // Viewport parameters
-      Cache->List[lm].Data.Viewport.x = viewportX;
-      Cache->List[lm].Data.Viewport.y = viewportY;
-      Cache->List[lm].Data.Viewport.width = viewportWidth;
-      Cache->List[lm].Data.Viewport.height = viewportHeight;
-      
-      // Copy over lighting and fog state
-      memcpy(Cache->List[lm].Data.Viewport.lightingParams, lightingParams, sizeof(lightingParams));
-      memcpy(Cache->List[lm].Data.Viewport.fogParams, fogParams, sizeof(fogParams));
-      memcpy(Cache->List[lm].Data.Viewport.spotEllipse, spotEllipse, sizeof(spotEllipse));
-      memcpy(Cache->List[lm].Data.Viewport.spotRange, spotRange, sizeof(spotRange));
-      memcpy(Cache->List[lm].Data.Viewport.spotColor, spotColor, sizeof(spotColor));
-      
-      // Copy projection matrix
-      glGetFloatv(GL_PROJECTION_MATRIX, Cache->List[lm].Data.Viewport.projectionMatrix);
+      // Viewport parameters, lighting and fog state, and projection matrix
+      Cache->List[lm].Data.Viewport = task.viewport;
     }
     else if (Model->numVerts[i] > 0)  // vertices exist for this state
     { 
@@ -359,7 +353,7 @@ bool CLegacy3D::AppendDisplayList(ModelCache *Cache, bool isViewport, const stru
       Cache->List[lm].Data.Model.useStencil = Model->useStencil;
       
       // Copy modelview matrix
-      glGetFloatv(GL_MODELVIEW_MATRIX, Cache->List[lm].Data.Model.modelViewMatrix);
+      memcpy(Cache->List[lm].Data.Model.modelViewMatrix, Instance->modelViewMatrix, sizeof(Instance->modelViewMatrix));
       
       /*
        * Determining if winding was reversed (but not polygon normal):
@@ -392,7 +386,7 @@ bool CLegacy3D::AppendDisplayList(ModelCache *Cache, bool isViewport, const stru
        */
       static const GLfloat x[3] = { 1.0f, 0.0f, 0.0f };
       static const GLfloat y[3] = { 0.0f, 1.0f, 0.0f };
-      const GLfloat z[3] = { 0.0f, 0.0f, -1.0f*matrixBasePtr[0x5] };
+      const GLfloat z[3] = { 0.0f, 0.0f, Instance->state.normZFlip };
       GLfloat m[4*4];
       GLfloat xT[3], yT[3], zT[3], pT[3];
 
@@ -434,6 +428,7 @@ bool CLegacy3D::AppendDisplayList(ModelCache *Cache, bool isViewport, const stru
 // Clears the display list in preparation for a new frame
 void CLegacy3D::ClearDisplayList(ModelCache *Cache)
 {
+  Cache->useStamp++;  // models drawn so far may be evicted now
   Cache->listSize = 0;
   for (size_t i = 0; i < 2; i++)
   {
@@ -446,27 +441,32 @@ void CLegacy3D::ClearDisplayList(ModelCache *Cache)
 /******************************************************************************
  Model Caching
  
- Note that as vertices are inserted into the appropriate local vertex buffer
- (sorted by polygon state -- alpha and normal), the VBO index is advanced to 
- reserve space and does not correspond to the actual position of each vertex.
- Vertices are copied in batches sorted by state when the model is complete.
+ Models are first decoded into staging buffers of their own, sorted by
+ polygon state -- alpha and normal -- which can be done on any thread. Their
+ vertices are copied to the VBO in batches sorted by state when the render
+ thread enters them into a model cache.
 ******************************************************************************/
 
-int CLegacy3D::GetTextureBaseX(const Poly *P) const
+int CLegacy3D::GetTextureBaseX(const Poly *P, const TextureOffset &textureOffset) const
 {
   int x = 32 * (((P->header[4] & 0x7F) << 1) | ((P->header[5] >> 7) & 1));
-  return (x + m_textureOffset.x) & 2047;
+  return (x + textureOffset.x) & 2047;
 }
 
-int CLegacy3D::GetTextureBaseY(const Poly *P) const
+int CLegacy3D::GetTextureBaseY(const Poly *P, const TextureOffset &textureOffset) const
 {
   int y = 32 * (P->header[5] & 0x7F);
   int bank = (P->header[4] & 0x40) << 4;
-  return ((y + m_textureOffset.y) & 1023) + (bank ^ m_textureOffset.switchBank);
+  return ((y + textureOffset.y) & 1023) + (bank ^ textureOffset.switchBank);
 }
 
-// Inserts a vertex into the local vertex buffer, incrementing both the local and VBO pointers. The normal is scaled by normFlip.
-void CLegacy3D::InsertVertex(ModelCache *Cache, const Vertex *V, const Poly *P, float normFlip)
+unsigned StagedModel::NumVerts(int state) const
+{
+  return unsigned(verts[state].size() / VBO_VERTEX_SIZE);
+}
+
+// Appends a vertex to the staging buffer of its polygon state. The normal is scaled by normFlip.
+void CLegacy3D::InsertVertex(StagedModel *Staged, const Vertex *V, const Poly *P, float normFlip) const
 {
   // Texture selection
   unsigned  texEnable = P->header[6]&0x400;
@@ -474,8 +474,8 @@ void CLegacy3D::InsertVertex(ModelCache *Cache, const Vertex *V, const Poly *P,
   GLfloat   texWidth  = (GLfloat) (32<<((P->header[3]>>3)&7));
   GLfloat   texHeight = (GLfloat) (32<<((P->header[3]>>0)&7));
   TexSheet  *texSheet = fmtToTexSheet[texFormat]; // get X, Y offset of texture sheet within texture map
-  GLfloat   texBaseX = (GLfloat)(texSheet->xOffset + GetTextureBaseX(P));
-  GLfloat   texBaseY = (GLfloat)(texSheet->yOffset + GetTextureBaseY(P));
+  GLfloat   texBaseX = (GLfloat)(texSheet->xOffset + GetTextureBaseX(P, Staged->state.textureOffset));
+  GLfloat   texBaseY = (GLfloat)(texSheet->yOffset + GetTextureBaseY(P, Staged->state.textureOffset));
 
   /*
    * Lighting and Color Modulation:
@@ -526,9 +526,10 @@ void CLegacy3D::InsertVertex(ModelCache *Cache, const Vertex *V, const Poly *P,
   {
     //size_t sensorColorIdx = ((P->header[4]>>20)&0xFFF);
     size_t colorIdx = ((P->header[4]>>8)&0xFFF);
-    b = (GLfloat) (polyRAM[m_colorTableAddr+colorIdx]&0xFF) * (1.0f/255.0f);
-    g = (GLfloat) ((polyRAM[m_colorTableAddr+colorIdx]>>8)&0xFF) * (1.0f/255.0f);
-    r = (GLfloat) ((polyRAM[m_colorTableAddr+colorIdx]>>16)&0xFF) * (1.0f/255.0f);
+    UINT32 colorTableAddr = Staged->state.colorTableAddr;
+    b = (GLfloat) (polyRAM[colorTableAddr+colorIdx]&0xFF) * (1.0f/255.0f);
+    g = (GLfloat) ((polyRAM[colorTableAddr+colorIdx]>>8)&0xFF) * (1.0f/255.0f);
+    r = (GLfloat) ((polyRAM[colorTableAddr+colorIdx]>>16)&0xFF) * (1.0f/255.0f);
   }
   else
   {
@@ -755,9 +756,9 @@ void CLegacy3D::InsertVertex(ModelCache *Cache, const Vertex *V, const Poly *P,
     contourProcessing = 1.0f;
 
 #ifdef DEBUG
-  if (m_debugHighlightPolyHeaderIdx >= 0 || m_debugHighlightAll)
+  if (m_debugHighlightPolyHeaderIdx >= 0 || Staged->state.highlight)
   {
-    if ((P->header[m_debugHighlightPolyHeaderIdx] & m_debugHighlightPolyHeaderMask) || m_debugHighlightAll)
+    if ((P->header[m_debugHighlightPolyHeaderIdx] & m_debugHighlightPolyHeaderMask) || Staged->state.highlight)
     {
       r = 0.;
       g = 1.;
@@ -772,50 +773,49 @@ void CLegacy3D::InsertVertex(ModelCache *Cache, const Vertex *V, const Poly *P,
   }
 #endif
 
-  // Store to local vertex buffer
-  size_t s = P->state;
-  size_t baseIdx = Cache->curVertIdx[s]*VBO_VERTEX_SIZE;
-
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_X] = V->x;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_Y] = V->y;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_Z] = V->z;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_R] = r;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_G] = g;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_B] = b;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TRANSLUCENCE] = translucence;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_LIGHTENABLE] = lightEnable ? 1.0f : 0.0f;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_SPECULAR] = specularCoefficient;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_SHININESS] = (GLfloat) shininess;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_FOGINTENSITY] = fogIntensity;
+  // Store to staging buffer
+  std::vector<GLfloat> &verts = Staged->verts[P->state];
+  size_t baseIdx = verts.size();
+  verts.resize(baseIdx + VBO_VERTEX_SIZE);
+
+  verts[baseIdx + VBO_VERTEX_OFFSET_X] = V->x;
+  verts[baseIdx + VBO_VERTEX_OFFSET_Y] = V->y;
+  verts[baseIdx + VBO_VERTEX_OFFSET_Z] = V->z;
+  verts[baseIdx + VBO_VERTEX_OFFSET_R] = r;
+  verts[baseIdx + VBO_VERTEX_OFFSET_G] = g;
+  verts[baseIdx + VBO_VERTEX_OFFSET_B] = b;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TRANSLUCENCE] = translucence;
+  verts[baseIdx + VBO_VERTEX_OFFSET_LIGHTENABLE] = lightEnable ? 1.0f : 0.0f;
+  verts[baseIdx + VBO_VERTEX_OFFSET_SPECULAR] = specularCoefficient;
+  verts[baseIdx + VBO_VERTEX_OFFSET_SHININESS] = (GLfloat) shininess;
+  verts[baseIdx + VBO_VERTEX_OFFSET_FOGINTENSITY] = fogIntensity;
   
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_NX] = fixedShading ? 0.f : nx*normFlip;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_NY] = fixedShading ? 0.f : ny*normFlip;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_NZ] = fixedShading ? 0.f : nz*normFlip; 
+  verts[baseIdx + VBO_VERTEX_OFFSET_NX] = fixedShading ? 0.f : nx*normFlip;
+  verts[baseIdx + VBO_VERTEX_OFFSET_NY] = fixedShading ? 0.f : ny*normFlip;
+  verts[baseIdx + VBO_VERTEX_OFFSET_NZ] = fixedShading ? 0.f : nz*normFlip; 
   
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_U] = V->u;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_V] = V->v;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXTURE_X] = texBaseX;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXTURE_Y] = texBaseY;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXTURE_W] = texWidth;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXTURE_H] = texHeight;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_EN] = texEnable ? 1.0f : 0.0f;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_TRANS] = contourProcessing;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_UWRAP] = (P->header[2]&2) ? 1.0f : 0.0f;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_VWRAP] = (P->header[2]&1) ? 1.0f : 0.0f;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXFORMAT] = (float)texFormat;
-  Cache->verts[s][baseIdx + VBO_VERTEX_OFFSET_TEXMAP] = (float)texSheet->mapNum;
-
-  Cache->curVertIdx[s]++;
-  Cache->vboCurOffset += VBO_VERTEX_SIZE*sizeof(GLfloat);
+  verts[baseIdx + VBO_VERTEX_OFFSET_U] = V->u;
+  verts[baseIdx + VBO_VERTEX_OFFSET_V] = V->v;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXTURE_X] = texBaseX;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXTURE_Y] = texBaseY;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXTURE_W] = texWidth;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXTURE_H] = texHeight;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_EN] = texEnable ? 1.0f : 0.0f;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_TRANS] = contourProcessing;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_UWRAP] = (P->header[2]&2) ? 1.0f : 0.0f;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXPARAMS_VWRAP] = (P->header[2]&1) ? 1.0f : 0.0f;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXFORMAT] = (float)texFormat;
+  verts[baseIdx + VBO_VERTEX_OFFSET_TEXMAP] = (float)texSheet->mapNum;
 }
 
-bool CLegacy3D::InsertPolygon(ModelCache *Cache, const Poly *P)
+bool CLegacy3D::InsertPolygon(StagedModel *Staged, const Poly *P) const
 {
   // Bounds testing: up to 12 triangles will be inserted (worst case: double sided quad is 6 triangles)
-  if ((Cache->curVertIdx[P->state]+6*2) >= Cache->maxVertIdx)
-    return ErrorLocalVertexOverflow();  // local buffers are not expected to overflow
-  if ((Cache->vboCurOffset+6*2*VBO_VERTEX_SIZE*sizeof(GLfloat)) >= Cache->vboMaxOffset)
-    return FAIL;  // this just indicates we may need to re-cache
+  if ((Staged->NumVerts(P->state)+6*2) >= PolyCache.maxVertIdx)
+  {
+    Staged->overflow = true;  // reported when cached, models are not expected to be this large
+    return FAIL;
+  }
     
   // Is the polygon double sided?
   bool doubleSided = (P->header[1]&0x10) ? true : false;
@@ -848,36 +848,36 @@ bool CLegacy3D::InsertPolygon(ModelCache *Cache, const Poly *P)
   v2[2] = P->Vert[2].z-P->Vert[1].z;
   CrossProd(n,v1,v2);
   
-  GLfloat normZFlip = -1.0f*matrixBasePtr[0x5]; // coordinate system m13 component
+  GLfloat normZFlip = Staged->state.normZFlip; // coordinate system m13 component
   
   if (normZFlip*(n[0]*P->n[0]+n[1]*P->n[1]+n[2]*P->n[2]) >= 0.0)  // clockwise winding confirmed
   {
     // Store the first triangle
     for (int i = 0; i < 3; i++)
     {
-      InsertVertex(Cache, &(P->Vert[i]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[i]), P, 1.0f);
     }
     
     if (doubleSided)  // store backside as counter-clockwise
     {
       for (int i = 2; i >=0; i--)
       {
-        InsertVertex(Cache, &(P->Vert[i]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[i]), P, -1.0f);
       }
     }
   
     // If quad, second triangle will just be vertices 1, 3, 4
     if (P->numVerts == 4)
     {
-      InsertVertex(Cache, &(P->Vert[0]), P, 1.0f);
-      InsertVertex(Cache, &(P->Vert[2]), P, 1.0f);
-      InsertVertex(Cache, &(P->Vert[3]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[0]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[2]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[3]), P, 1.0f);
       
       if (doubleSided)
       {
-        InsertVertex(Cache, &(P->Vert[0]), P, -1.0f);
-        InsertVertex(Cache, &(P->Vert[3]), P, -1.0f);
-        InsertVertex(Cache, &(P->Vert[2]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[0]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[3]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[2]), P, -1.0f);
       }
     }
   }
@@ -885,28 +885,28 @@ bool CLegacy3D::InsertPolygon(ModelCache *Cache, const Poly *P)
   {
     for (int i = 2; i >=0; i--)
     {
-      InsertVertex(Cache, &(P->Vert[i]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[i]), P, 1.0f);
     }
     
     if (doubleSided)  // store backside as clockwise
     {
       for (int i = 0; i < 3; i++)
       {
-        InsertVertex(Cache, &(P->Vert[i]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[i]), P, -1.0f);
       }
     }
     
     if (P->numVerts == 4)
     {
-      InsertVertex(Cache, &(P->Vert[0]), P, 1.0f);
-      InsertVertex(Cache, &(P->Vert[3]), P, 1.0f);
-      InsertVertex(Cache, &(P->Vert[2]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[0]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[3]), P, 1.0f);
+      InsertVertex(Staged, &(P->Vert[2]), P, 1.0f);
       
       if (doubleSided)
       {
-        InsertVertex(Cache, &(P->Vert[0]), P, -1.0f);
-        InsertVertex(Cache, &(P->Vert[2]), P, -1.0f);
-        InsertVertex(Cache, &(P->Vert[3]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[0]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[2]), P, -1.0f);
+        InsertVertex(Staged, &(P->Vert[3]), P, -1.0f);
       }
     }
   }
@@ -914,13 +914,21 @@ bool CLegacy3D::InsertPolygon(ModelCache *Cache, const Poly *P)
   return OKAY;
 }
 
-// Begins caching a new model by resetting to the start of the local vertex buffer
+// Begins caching a new model
 struct VBORef *CLegacy3D::BeginModel(ModelCache *Cache)
 {
-  size_t  m = Cache->numModels;
+  size_t  m;
   
-  // Determine whether we've exceeded the model cache limits (caller will have to recache)
-  if (m >= Cache->maxModels)
+  // Reuse an evicted entry, else take the next one. A full static cache
+  // evicts models to make room and a full dynamic one must be recached by the
+  // caller.
+  if ((Cache->numFreeModels == 0) && (Cache->numModels >= Cache->maxModels) && !Cache->dynamic)
+    EvictModels(Cache, 0);
+  if (Cache->numFreeModels > 0)
+    m = Cache->freeModels[--Cache->numFreeModels];
+  else if (Cache->numModels < Cache->maxModels)
+    m = Cache->numModels;
+  else
   {
     //ErrorLog("Too many %s models.", Cache->dynamic?"dynamic":"static");
     return NULL;  
@@ -928,77 +936,121 @@ struct VBORef *CLegacy3D::BeginModel(ModelCache *Cache)
   
   struct VBORef *Model = &(Cache->Models[m]);
   
-  // Reset to the beginning of the local vertex buffer
-  for (size_t i = 0; i < 2; i++)
-    Cache->curVertIdx[i] = 0;
-  
   // Clear the VBO reference to 0 and clear texture references
   Model->Clear();
+  Model->lutIdx = VBORef::FreeSlot;   // until EndModel() succeeds
   
-  // Record starting index of first opaque polygon in VBO (alpha poly index will be re-set in EndModel())
+  // Record starting index of first opaque polygon in VBO (alpha poly index will be re-set in EndModel()).
+  // Static models are placed in EndModel() once their size is known, until
+  // then the VBO offset counts the size of the model.
+  if (!Cache->dynamic)
+    Cache->vboCurOffset = 0;
   Model->index[POLY_STATE_NORMAL] = Cache->vboCurOffset/(VBO_VERTEX_SIZE*sizeof(GLfloat));
   Model->index[POLY_STATE_ALPHA] = Model->index[POLY_STATE_NORMAL];
   
   return Model;
 }
 
-// Uploads all vertices from the local vertex buffer to the VBO, sets up the VBO reference, updates the LUT
-void CLegacy3D::EndModel(ModelCache *Cache, struct VBORef *Model, int lutIdx, UINT16 textureOffsetState, bool useStencil)
+// Copies the vertices of a staged model to the VBO, sets up the VBO reference, updates the LUT
+bool CLegacy3D::EndModel(ModelCache *Cache, struct VBORef *Model, const StagedModel &Staged)
 {
-  int m = Cache->numModels++;
+  int m = int(Model - Cache->Models);
+  int lutIdx = Staged.lutIdx;
 
   // Record the number of vertices, completing the VBORef
   for (size_t i = 0; i < 2; i++)
-    Model->numVerts[i] = Cache->curVertIdx[i];
+    Model->numVerts[i] = Staged.NumVerts(int(i));
+
+  // Find room for a static model, evicting others if needed
+  if (!Cache->dynamic)
+  {
+    unsigned numVerts = Model->numVerts[POLY_STATE_NORMAL] + Model->numVerts[POLY_STATE_ALPHA];
+    if ((numVerts > 0) && !AllocVBO(Cache, numVerts, &Model->index[POLY_STATE_NORMAL]))
+    {
+      if (!EvictModels(Cache, numVerts) || !AllocVBO(Cache, numVerts, &Model->index[POLY_STATE_NORMAL]))
+      {
+        if (m < int(Cache->numModels))
+          Cache->freeModels[Cache->numFreeModels++] = m;  // give the entry back
+        return FAIL;
+      }
+    }
+  }
+  if (m == int(Cache->numModels))
+    Cache->numModels++;
 
   // First alpha polygon immediately follows the normal polygons
   Model->index[POLY_STATE_ALPHA] = Model->index[POLY_STATE_NORMAL] + Model->numVerts[POLY_STATE_NORMAL];
 
-  // Upload from local vertex buffer to real VBO
-  glBindBuffer(GL_ARRAY_BUFFER, Cache->vboID);
-  if (Model->numVerts[POLY_STATE_NORMAL] > 0)
-    glBufferSubData(GL_ARRAY_BUFFER, Model->index[POLY_STATE_NORMAL]*VBO_VERTEX_SIZE*sizeof(GLfloat), Cache->curVertIdx[POLY_STATE_NORMAL]*VBO_VERTEX_SIZE*sizeof(GLfloat), Cache->verts[POLY_STATE_NORMAL]);
-  if (Model->numVerts[POLY_STATE_ALPHA] > 0)
-    glBufferSubData(GL_ARRAY_BUFFER, Model->index[POLY_STATE_ALPHA]*VBO_VERTEX_SIZE*sizeof(GLfloat), Cache->curVertIdx[POLY_STATE_ALPHA]*VBO_VERTEX_SIZE*sizeof(GLfloat), Cache->verts[POLY_STATE_ALPHA]);
+  // Upload to real VBO. Dynamic models follow each other in the VBO, so they
+  // are gathered and uploaded together when the display list is drawn.
+  if (Cache->dynamic)
+  {
+    unsigned pendingEnd = m_pendingVertsIndex + unsigned(m_pendingVerts.size()/VBO_VERTEX_SIZE);
+    if (m_pendingVerts.empty() || (pendingEnd != Model->index[POLY_STATE_NORMAL]))
+    {
+      FlushDynamicVerts(Cache);
+      m_pendingVertsIndex = Model->index[POLY_STATE_NORMAL];
+    }
+    for (size_t i = 0; i < 2; i++)
+      m_pendingVerts.insert(m_pendingVerts.end(), Staged.verts[i].begin(), Staged.verts[i].end());
+  }
+  else
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, Cache->vboID);
+    if (Model->numVerts[POLY_STATE_NORMAL] > 0)
+      glBufferSubData(GL_ARRAY_BUFFER, Model->index[POLY_STATE_NORMAL]*VBO_VERTEX_SIZE*sizeof(GLfloat), Staged.verts[POLY_STATE_NORMAL].size()*sizeof(GLfloat), Staged.verts[POLY_STATE_NORMAL].data());
+    if (Model->numVerts[POLY_STATE_ALPHA] > 0)
+      glBufferSubData(GL_ARRAY_BUFFER, Model->index[POLY_STATE_ALPHA]*VBO_VERTEX_SIZE*sizeof(GLfloat), Staged.verts[POLY_STATE_ALPHA].size()*sizeof(GLfloat), Staged.verts[POLY_STATE_ALPHA].data());
+  }
     
   // Record LUT index in the model VBORef
   Model->lutIdx = lutIdx;
   
   // Texture offset of this model state
-  Model->textureOffsetState = textureOffsetState;
+  Model->textureOffsetState = Staged.state.textureOffset.state;
   
   // Should we use stencil?
-  Model->useStencil = useStencil;
+  Model->useStencil = Staged.useStencil;
   
   // Update the LUT and link up to any existing model that already exists here
   if (Cache->lut[lutIdx] >= 0)  // another texture offset state already cached
     Model->nextTextureOffsetState = &(Cache->Models[Cache->lut[lutIdx]]);
   Cache->lut[lutIdx] = m;
+  return OKAY;
+}
+
+// Uploads the vertices of the dynamic models cached since the last upload in one go
+void CLegacy3D::FlushDynamicVerts(ModelCache *Cache)
+{
+  if (m_pendingVerts.empty())
+    return;
+  glBindBuffer(GL_ARRAY_BUFFER, Cache->vboID);
+  glBufferSubData(GL_ARRAY_BUFFER, m_pendingVertsIndex*VBO_VERTEX_SIZE*sizeof(GLfloat), m_pendingVerts.size()*sizeof(GLfloat), m_pendingVerts.data());
+  m_pendingVerts.clear();
 }
 
 /*
- * CacheModel():
+ * DecodeModel():
  *
- * Decodes and caches a complete model. Returns NULL if any sort of overflow in
- * the cache occurred. In this case, the model cache should be cleared before
- * being used again because an incomplete model will be stored, wasting vertex
- * buffer space.
- *
- * A pointer to the VBO reference for the cached model is returned when
- * successful.
+ * Decodes a complete model into the staging buffers, in the state it was
+ * staged with. Neither GL nor the model caches are touched, so models may be
+ * decoded on any thread. If a model has more vertices than a model may have,
+ * it is marked as overflowing.
  */
 
-struct VBORef *CLegacy3D::CacheModel(ModelCache *Cache, int lutIdx, UINT16 textureOffsetState, const UINT32 *data)
+void CLegacy3D::DecodeModel(StagedModel *Staged) const
 {
+  for (size_t i = 0; i < 2; i++)
+    Staged->verts[i].clear();
+  Staged->texRefs.clear();
+  Staged->overflow = false;
+  Staged->useStencil = true;
+
+  const UINT32 *data = Staged->data;
   if (data == NULL)
-    return NULL;
+    return;
     
-  // Start constructing a new model
-  struct VBORef *Model = BeginModel(Cache);
-  if (NULL == Model)
-    return NULL;  // too many models!
-  
-  // Cache all polygons
+  // Decode all polygons
   Vertex    Prev[4];  // previous vertices
   int       numPolys = 0;
   bool      useStencil = true;
@@ -1027,8 +1079,8 @@ struct VBORef *CLegacy3D::CacheModel(ModelCache *Cache, int lutIdx, UINT16 textu
     int texFormat = (P.header[6]>>7)&7;
     int texWidth  = (32<<((P.header[3]>>3)&7));
     int texHeight = (32<<((P.header[3]>>0)&7));
-    int texBaseX = GetTextureBaseX(&P);
-    int texBaseY = GetTextureBaseY(&P);    
+    int texBaseX = GetTextureBaseX(&P, Staged->state.textureOffset);
+    int texBaseY = GetTextureBaseY(&P, Staged->state.textureOffset);
     GLfloat uvScale   = (P.header[1]&0x40)?1.0f:(1.0f/8.0f);
     
     // Determine whether this is an alpha polygon (TODO: when testing textures, test if texturing enabled? Might not matter)
@@ -1066,15 +1118,9 @@ struct VBORef *CLegacy3D::CacheModel(ModelCache *Cache, int lutIdx, UINT16 textu
     bool isProbablyShadow = isLightDisabled && isTranslucent && !texEnable;
     useStencil &= (isLayered || isProbablyShadow);
     
-    // Decode the texture
+    // Record the texture, to be decoded when the model is cached
     if (texEnable)
-    {
-      // If model cache is static, record texture reference in model cache entry for later decoding.
-      // If cache is dynamic, or if it's not possible to record the texture reference (due to lack of
-      // memory) then decode the texture now.
-      if (Cache->dynamic || !Model->texRefs.AddRef(texFormat, texBaseX, texBaseY, texWidth, texHeight))
-        DecodeTexture(texFormat, texBaseX, texBaseY, texWidth, texHeight);
-    }
+      Staged->texRefs.push_back({ texFormat, texBaseX, texBaseY, texWidth, texHeight });
     
     // Polygon normal is in upper 24 bits: sign + 1.22 fixed point
     P.n[0] = (GLfloat) (((INT32)P.header[1])>>8) * (1.0f/4194304.0f);
@@ -1134,18 +1180,85 @@ struct VBORef *CLegacy3D::CacheModel(ModelCache *Cache, int lutIdx, UINT16 textu
         Prev[i] = P.Vert[i];
       
       // Copy this polygon into the model buffer
-      if (OKAY != InsertPolygon(Cache,&P))
-        return NULL;
+      if (OKAY != InsertPolygon(Staged,&P))
+        return;
       ++numPolys;
     }
   }
   
+  Staged->useStencil = useStencil;
+}
+
+static bool IsSameState(const ModelState &a, const ModelState &b)
+{
+  return (a.textureOffset.state == b.textureOffset.state) && (a.colorTableAddr == b.colorTableAddr) && (a.normZFlip == b.normZFlip) && (a.highlight == b.highlight);
+}
+
+/*
+ * CacheModel():
+ *
+ * Caches a complete model for the given instance, using the model staged for
+ * it if it was decoded in the same state, and otherwise decoding it now.
+ * Returns NULL if any sort of overflow in the cache occurred. In this case,
+ * the model cache should be cleared before being used again because an
+ * incomplete model will be stored, wasting vertex buffer space.
+ *
+ * A pointer to the VBO reference for the cached model is returned when
+ * successful.
+ */
+
+struct VBORef *CLegacy3D::CacheModel(ModelCache *Cache, const SceneModel &Instance, const UINT32 *data)
+{
+  if ((Instance.staged >= 0) && IsSameState(m_stagedModels[Instance.staged].state, Instance.state))
+    return CommitModel(Cache, m_stagedModels[Instance.staged]);
+
+  // Staged for an instance in another state, or evicted since it was looked up
+  m_serialStage.data = data;
+  m_serialStage.lutIdx = Instance.modelAddr&0xFFFFFF;
+  m_serialStage.state = Instance.state;
+  DecodeModel(&m_serialStage);
+  return CommitModel(Cache, m_serialStage);
+}
+
+// Enters a decoded model into a cache and decodes its textures. Returns NULL if it does not fit.
+struct VBORef *CLegacy3D::CommitModel(ModelCache *Cache, const StagedModel &Staged)
+{
+  if (Staged.data == NULL)
+    return NULL;
+  if (Staged.overflow)
+  {
+    ErrorLocalVertexOverflow();  // models are not expected to be this large
+    return NULL;
+  }
+
+  // Start constructing a new model
+  struct VBORef *Model = BeginModel(Cache);
+  if (NULL == Model)
+    return NULL;  // too many models!
+
+  // Bounds testing: leave room for the 12 vertices of one more polygon, as
+  // when vertices were inserted one polygon at a time
+  size_t numVerts = Staged.NumVerts(POLY_STATE_NORMAL) + Staged.NumVerts(POLY_STATE_ALPHA);
+  if ((Cache->vboCurOffset+(numVerts+6*2)*VBO_VERTEX_SIZE*sizeof(GLfloat)) >= Cache->vboMaxOffset)
+    return NULL;  // this just indicates we may need to re-cache
+  Cache->vboCurOffset += unsigned(numVerts*VBO_VERTEX_SIZE*sizeof(GLfloat));
+
+  // Decode the textures. If model cache is static, record texture reference
+  // in model cache entry for later decoding. If cache is dynamic, or if it's
+  // not possible to record the texture reference (due to lack of memory) then
+  // decode the texture now.
+  for (const StagedModel::TexRef &Tex: Staged.texRefs)
+  {
+    if (Cache->dynamic || !Model->texRefs.AddRef(Tex.format, Tex.x, Tex.y, Tex.width, Tex.height))
+      DecodeTexture(Tex.format, Tex.x, Tex.y, Tex.width, Tex.height);
+  }
+
   // Finish model and enter it into the LUT
-  EndModel(Cache, Model, lutIdx, textureOffsetState, useStencil);
+  if (OKAY != EndModel(Cache, Model, Staged))
+    return NULL;
   return Model;
 }
 
-
 /******************************************************************************
  Cache Management
 ******************************************************************************/
@@ -1172,16 +1285,152 @@ struct VBORef *CLegacy3D::LookUpModel(ModelCache *Cache, int lutIdx, UINT16 text
   return NULL;  // no match found, we must cache this new model state
 }
 
+/*
+ * Static cache allocation. The free list is searched first fit. Freed ranges
+ * are merged with their neighbors, so there is never more than one range per
+ * cached model plus one.
+ */
+bool CLegacy3D::AllocVBO(ModelCache *Cache, unsigned numVerts, unsigned *index)
+{
+  for (unsigned i = 0; i < Cache->numFreeRanges; i++)
+  {
+    ModelCache::FreeRange &range = Cache->freeRanges[i];
+    if (range.numVerts >= numVerts)
+    {
+      *index = range.index;
+      range.index += numVerts;
+      range.numVerts -= numVerts;
+      if (range.numVerts == 0)
+      {
+        memmove(&Cache->freeRanges[i], &Cache->freeRanges[i+1], (Cache->numFreeRanges-i-1)*sizeof(ModelCache::FreeRange));
+        Cache->numFreeRanges--;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the size of the free range the vertices end up in
+unsigned CLegacy3D::FreeVBO(ModelCache *Cache, unsigned index, unsigned numVerts)
+{
+  if (numVerts == 0)
+    return 0;
+
+  ModelCache::FreeRange *ranges = Cache->freeRanges;
+  unsigned i = 0;
+  while (i < Cache->numFreeRanges && ranges[i].index < index)
+    i++;
+
+  bool mergePrev = (i > 0) && (ranges[i-1].index + ranges[i-1].numVerts == index);
+  bool mergeNext = (i < Cache->numFreeRanges) && (index + numVerts == ranges[i].index);
+
+  if (mergePrev && mergeNext)
+  {
+    ranges[i-1].numVerts += numVerts + ranges[i].numVerts;
+    memmove(&ranges[i], &ranges[i+1], (Cache->numFreeRanges-i-1)*sizeof(ModelCache::FreeRange));
+    Cache->numFreeRanges--;
+    return ranges[i-1].numVerts;
+  }
+  if (mergePrev)
+  {
+    ranges[i-1].numVerts += numVerts;
+    return ranges[i-1].numVerts;
+  }
+  if (mergeNext)
+  {
+    ranges[i].index = index;
+    ranges[i].numVerts += numVerts;
+    return ranges[i].numVerts;
+  }
+
+  memmove(&ranges[i+1], &ranges[i], (Cache->numFreeRanges-i)*sizeof(ModelCache::FreeRange));
+  ranges[i].index = index;
+  ranges[i].numVerts = numVerts;
+  Cache->numFreeRanges++;
+  return numVerts;
+}
+
+// Removes a static model from the LUT and frees its VBO space and entry. Returns the size of the free range its vertices end up in.
+unsigned CLegacy3D::EvictModel(ModelCache *Cache, struct VBORef *Model)
+{
+  // Unlink from the list of texture offset states of this LUT entry
+  int head = Cache->lut[Model->lutIdx];
+  if (&Cache->Models[head] == Model)
+    Cache->lut[Model->lutIdx] = Model->nextTextureOffsetState ? INT16(Model->nextTextureOffsetState - Cache->Models) : -1;
+  else
+  {
+    for (VBORef *Linked = &Cache->Models[head]; Linked != NULL; Linked = Linked->nextTextureOffsetState)
+    {
+      if (Linked->nextTextureOffsetState == Model)
+      {
+        Linked->nextTextureOffsetState = Model->nextTextureOffsetState;
+        break;
+      }
+    }
+  }
+
+  Model->lutIdx = VBORef::FreeSlot;
+  Cache->freeModels[Cache->numFreeModels++] = unsigned(Model - Cache->Models);
+  Cache->evictions++;
+  return FreeVBO(Cache, Model->index[POLY_STATE_NORMAL], Model->numVerts[POLY_STATE_NORMAL] + Model->numVerts[POLY_STATE_ALPHA]);
+}
+
+/*
+ * EvictModels():
+ *
+ * Evicts the least recently used models of a static cache until a range of
+ * numVerts vertices is free, and at least 1/16th of the VBO and the model
+ * array are, so that the following misses don't each have to evict. Models in
+ * the current display list are kept. Returns false if no room could be made.
+ */
+bool CLegacy3D::EvictModels(ModelCache *Cache, unsigned numVerts)
+{
+  std::vector<unsigned> lru;
+  for (unsigned i = 0; i < Cache->numModels; i++)
+  {
+    const VBORef &Model = Cache->Models[i];
+    if ((Model.lutIdx != VBORef::FreeSlot) && (Model.lastUsed != Cache->useStamp))
+      lru.push_back(i);
+  }
+  std::sort(lru.begin(), lru.end(), [Cache](unsigned a, unsigned b) { return Cache->Models[a].lastUsed < Cache->Models[b].lastUsed; });
+
+  unsigned freeVerts = 0;
+  for (unsigned i = 0; i < Cache->numFreeRanges; i++)
+    freeVerts += Cache->freeRanges[i].numVerts;
+
+  bool fits = false;
+  size_t n = 0;
+  for (; n < lru.size(); n++)
+  {
+    if (fits && (freeVerts >= Cache->vboMaxVerts / 16) && (Cache->numFreeModels >= Cache->maxModels / 16))
+      break;
+    VBORef *Model = &Cache->Models[lru[n]];
+    freeVerts += Model->numVerts[POLY_STATE_NORMAL] + Model->numVerts[POLY_STATE_ALPHA];
+    fits = (EvictModel(Cache, Model) >= numVerts) || fits;
+  }
+
+  DebugLog("Evicted %u static models.", unsigned(n));
+  return fits;
+}
+
 // Discard all models in the cache and the display list
 void CLegacy3D::ClearModelCache(ModelCache *Cache)
 {
   Cache->vboCurOffset = 0;
-  for (size_t i = 0; i < 2; i++)
-    Cache->curVertIdx[i] = 0;
+  if (Cache->dynamic)
+    m_pendingVerts.clear();   // no longer drawn
   for (size_t i = 0; i < Cache->numModels; i++)
-    Cache->lut[Cache->Models[i].lutIdx] = -1;
+  {
+    if (Cache->Models[i].lutIdx != VBORef::FreeSlot)
+      Cache->lut[Cache->Models[i].lutIdx] = -1;
+  }
 
   Cache->numModels = 0;
+  Cache->numFreeModels = 0;
+  Cache->numFreeRanges = 1;
+  Cache->freeRanges[0].index = 0;
+  Cache->freeRanges[0].numVerts = Cache->vboMaxVerts;
   ClearDisplayList(Cache);
 }
 
@@ -1235,20 +1484,26 @@ bool CLegacy3D::CreateModelCache(ModelCache *Cache, unsigned vboMaxVerts,
   // Set the VBO to the size we obtained
   Cache->vboMaxOffset = vboBytes;
   Cache->vboCurOffset = 0;
+  Cache->vboMaxVerts = unsigned(vboBytes/(VBO_VERTEX_SIZE*sizeof(GLfloat)));
   
-  // Attempt to allocate space for local VBO
-  for (size_t i = 0; i < 2; i++)
-  {
-    Cache->verts[i] = new(std::nothrow) GLfloat[localMaxVerts*VBO_VERTEX_SIZE];
-    Cache->curVertIdx[i] = 0;
-  }
+  // Limit on the size of a model
   Cache->maxVertIdx = localMaxVerts;
   
-  // ... model array
+  // Attempt to allocate space for model array
   Cache->Models = new(std::nothrow) VBORef[maxNumModels];
   Cache->maxModels = maxNumModels;
   Cache->numModels = 0;
   
+  // ... static cache allocation
+  Cache->freeRanges = new(std::nothrow) ModelCache::FreeRange[maxNumModels+1];
+  Cache->freeModels = new(std::nothrow) unsigned[maxNumModels];
+  Cache->numFreeRanges = 0;
+  Cache->numFreeModels = 0;
+  Cache->useStamp = 0;
+  Cache->hits = 0;
+  Cache->misses = 0;
+  Cache->evictions = 0;
+  
   // ... LUT
   Cache->lut = new(std::nothrow) INT16[numLUTEntries];
   Cache->lutSize = numLUTEntries;
@@ -1259,7 +1514,7 @@ bool CLegacy3D::CreateModelCache(ModelCache *Cache, unsigned vboMaxVerts,
   Cache->maxListSize = displayListSize;
   
   // Check if memory allocation succeeded
-  if ((Cache->verts[0]==NULL) || (Cache->verts[1]==NULL) || (Cache->Models==NULL) || (Cache->lut==NULL) || (Cache->List==NULL))
+  if ((Cache->Models==NULL) || (Cache->freeRanges==NULL) || (Cache->freeModels==NULL) || (Cache->lut==NULL) || (Cache->List==NULL))
   {
     DestroyModelCache(Cache);
     return ErrorLog("Insufficient memory for model cache.");
@@ -1268,6 +1523,7 @@ bool CLegacy3D::CreateModelCache(ModelCache *Cache, unsigned vboMaxVerts,
   // Clear LUT (MUST be done here because ClearModelCache() won't do it for dynamic models)
   for (size_t i = 0; i < numLUTEntries; i++)
     Cache->lut[i] = -1;
+  ClearModelCache(Cache);
     
   // All good!
   return OKAY;
@@ -1275,15 +1531,17 @@ bool CLegacy3D::CreateModelCache(ModelCache *Cache, unsigned vboMaxVerts,
 
 void CLegacy3D::DestroyModelCache(ModelCache *Cache)
 {
+  if (Cache->hits + Cache->misses > 0)
+    InfoLog("%s model cache: %llu hits, %llu misses, %llu evictions.", Cache->dynamic?"Dynamic":"Static", Cache->hits, Cache->misses, Cache->evictions);
+
   glDeleteBuffers(1, &(Cache->vboID));
 
-  for (size_t i = 0; i < 2; i++)
-  {
-    if (Cache->verts[i] != NULL)
-      delete [] Cache->verts[i];
-  }
   if (Cache->Models != NULL)
     delete [] Cache->Models;
+  if (Cache->freeRanges != NULL)
+    delete [] Cache->freeRanges;
+  if (Cache->freeModels != NULL)
+    delete [] Cache->freeModels;
   if (Cache->lut != NULL)
     delete [] Cache->lut;
   if (Cache->List != NULL)
@@ -27,7 +27,9 @@
  * Texture references are stored internally as a 27-bit field (3 bits for format, 6 bits each for x, y, width & height) to save space.
  * 
  * A pre-allocated array is used for storing up to TEXREFS_ARRAY_SIZE texture references.  When that limit is exceeded, it switches
- * to using a hashset to store the texture references, but this requires extra memory allocation.
+ * to using an open-addressed hashset (a single power of two sized array of packed references, probed linearly) to store the texture
+ * references, but this requires extra memory allocation.  Since packed references only use 27 bits, all-ones values are free to mark
+ * empty and removed slots.
  */
 
 #include "TextureRefs.h"
@@ -35,16 +37,28 @@
 #include "Supermodel.h"
 #include "Legacy3D.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 namespace Legacy3D {
 
-CTextureRefs::CTextureRefs() : m_size(0), m_hashCapacity(0), m_hashEntries(NULL)
+static const unsigned EMPTY_SLOT = 0xFFFFFFFF;
+static const unsigned REMOVED_SLOT = 0xFFFFFFFE;
+
+static inline unsigned PackTexRef(unsigned fmt, unsigned x, unsigned y, unsigned width, unsigned height)
+{
+	return (fmt&7)<<24|(x&0x7E0)<<13|(y&0x7E0)<<7|(width&0x7E0)<<1|(height&0x7E0)>>5;
+}
+
+CTextureRefs::CTextureRefs() : m_size(0), m_decodedGeneration(0), m_hashCapacity(0), m_hashUsed(0), m_hashSlots(NULL)
 {
 	//
 }
 
 CTextureRefs::~CTextureRefs()
 {
-	DeleteAllHashEntries();
+	DeleteHash();
 }
 
 unsigned CTextureRefs::GetSize() const
@@ -54,20 +68,19 @@ unsigned CTextureRefs::GetSize() const
 
 void CTextureRefs::Clear()
 {
-	// Delete all hash entries
-	DeleteAllHashEntries();
+	// Delete hashset
+	DeleteHash();
 	m_size = 0;
-	m_hashCapacity = 0;
-	m_hashEntries = NULL;
+	m_decodedGeneration = 0;
 }
 
 bool CTextureRefs::ContainsRef(unsigned fmt, unsigned x, unsigned y, unsigned width, unsigned height)
 {
 	// Pack texture reference into bitfield
-	unsigned texRef = (fmt&7)<<24|(x&0x7E0)<<13|(y&0x7E0)<<7|(width&0x7E0)<<1|(height&0x7E0)>>5;
+	unsigned texRef = PackTexRef(fmt, x, y, width, height);
 	
 	// Check if using array or hashset
-	if (m_size <= TEXREFS_ARRAY_SIZE)
+	if (!m_hashSlots)
 	{
 		// See if texture reference held in array
 		for (unsigned i = 0; i < m_size; i++)
@@ -85,10 +98,10 @@ bool CTextureRefs::ContainsRef(unsigned fmt, unsigned x, unsigned y, unsigned wi
 bool CTextureRefs::AddRef(unsigned fmt, unsigned x, unsigned y, unsigned width, unsigned height)
 {
 	// Pack texture reference into bitfield
-	unsigned texRef = (fmt&7)<<24|(x&0x7E0)<<13|(y&0x7E0)<<7|(width&0x7E0)<<1|(height&0x7E0)>>5;
+	unsigned texRef = PackTexRef(fmt, x, y, width, height);
 
 	// Check if using array or hashset
-	if (m_size <= TEXREFS_ARRAY_SIZE)
+	if (!m_hashSlots)
 	{
 		// See if already held in array, if so nothing to do
 		for (unsigned i = 0; i < m_size; i++)
@@ -99,19 +112,22 @@ bool CTextureRefs::AddRef(unsigned fmt, unsigned x, unsigned y, unsigned width,
 		// If not, check if array is full
 		if (m_size == TEXREFS_ARRAY_SIZE)
 		{
-			// If so, set initial hashset capacity to 47 to initialize it
-			UpdateHashCapacity(47);
+			// If so, set initial hashset capacity to 32 (load factor below 1/2) to initialize it
+			if (!UpdateHashCapacity(32))
+				return false;
 			// Copy array into hashset
+			m_size = 0;
 			for (unsigned i = 0; i < TEXREFS_ARRAY_SIZE; i++)
 				AddToHash(m_array[i]);
 			// Add texture reference to hashset
-			AddToHash(texRef);
+			return AddToHash(texRef);
 		}
 		else
 		{
 			// Add texture reference to array
 			m_array[m_size] = texRef;
 			m_size++;
+			m_decodedGeneration = 0;
 		}
 		return true;
 	}
@@ -123,10 +139,10 @@ bool CTextureRefs::AddRef(unsigned fmt, unsigned x, unsigned y, unsigned width,
 bool CTextureRefs::RemoveRef(unsigned fmt, unsigned x, unsigned y, unsigned width, unsigned height)
 {
 	// Pack texture reference into bitfield
-	unsigned texRef = (fmt&7)<<24|(x&0x7E0)<<13|(y&0x7E0)<<7|(width&0x7E0)<<1|(height&0x7E0)>>5;
+	unsigned texRef = PackTexRef(fmt, x, y, width, height);
 
 	// Check if using array or hashset
-	if (m_size <= TEXREFS_ARRAY_SIZE)
+	if (!m_hashSlots)
 	{
 		for (unsigned i = 0; i < m_size; i++)
 		{
@@ -148,15 +164,15 @@ bool CTextureRefs::RemoveRef(unsigned fmt, unsigned x, unsigned y, unsigned widt
 		// See if should switch back to array
 		if (m_size == TEXREFS_ARRAY_SIZE)
 		{
-			// Loop through all hash entries and copy texture references into array
+			// Loop through all slots and copy texture references into array
 			unsigned j = 0;
 			for (unsigned i = 0; i < m_hashCapacity; i++)
 			{
-				for (HashEntry *entry = m_hashEntries[i]; entry; entry = entry->nextEntry)
-					m_array[j++] = entry->texRef;
+				if (m_hashSlots[i] < REMOVED_SLOT)
+					m_array[j++] = m_hashSlots[i];
 			}
-			// Delete all hash entries
-			DeleteAllHashEntries();
+			// Delete hashset
+			DeleteHash();
 		}
 		return removed;
 	}
@@ -164,173 +180,130 @@ bool CTextureRefs::RemoveRef(unsigned fmt, unsigned x, unsigned y, unsigned widt
 
 void CTextureRefs::DecodeAllTextures(CLegacy3D *Render3D)
 {
-	// Check if using array or hashset
-	if (m_size <= TEXREFS_ARRAY_SIZE)
+	// Nothing to do if no texture sheet has been uploaded to or decoded into since last time
+	if (m_decodedGeneration == Render3D->textureGeneration)
+		return;
+
+	// Gather texture references, keyed by texture map so that each texture sheet is decoded in one run
+	static std::vector<unsigned> keys;
+	keys.clear();
+	const unsigned *refs = m_hashSlots ? m_hashSlots : m_array;
+	unsigned numRefs = m_hashSlots ? m_hashCapacity : m_size;
+	for (unsigned i = 0; i < numRefs; i++)
 	{
-		// Loop through elements in array and call CLegacy3D::DecodeTexture
-		for (unsigned i = 0; i < m_size; i++)
-		{
-			// Unpack texture reference from bitfield 
-			unsigned texRef = m_array[i];
-			unsigned fmt = texRef>>24;
-			unsigned x = (texRef>>13)&0x7E0;
-			unsigned y = (texRef>>7)&0x7E0;
-			unsigned width = (texRef>>1)&0x7E0;
-			unsigned height = (texRef<<5)&0x7E0;
-			Render3D->DecodeTexture(fmt, x, y, width, height);
-		}
+		unsigned texRef = refs[i];
+		if (texRef >= REMOVED_SLOT)
+			continue;
+		unsigned mapNum = Render3D->fmtToTexSheet[texRef>>24]->mapNum;
+		keys.push_back(mapNum<<27|texRef);
 	}
-	else
+	std::sort(keys.begin(), keys.end());
+
+	// Call CLegacy3D::DecodeTexture for each texture reference
+	for (unsigned key : keys)
 	{
-		// Loop through all hash entriesa and call CLegacy3D::DecodeTexture
-		for (unsigned i = 0; i < m_hashCapacity; i++)
-		{
-			for (HashEntry *entry = m_hashEntries[i]; entry; entry = entry->nextEntry)
-			{
-				// Unpack texture reference from bitfield 
-				unsigned texRef = entry->texRef;
-				unsigned fmt = texRef>>24;
-				unsigned x = (texRef>>13)&0x7E0;
-				unsigned y = (texRef>>7)&0x7E0;
-				unsigned width = (texRef>>1)&0x7E0;
-				unsigned height = (texRef<<5)&0x7E0;
-				Render3D->DecodeTexture(fmt, x, y, width, height);
-			}
-		}
+		// Unpack texture reference from bitfield 
+		unsigned texRef = key&0x7FFFFFF;
+		unsigned fmt = texRef>>24;
+		unsigned x = (texRef>>13)&0x7E0;
+		unsigned y = (texRef>>7)&0x7E0;
+		unsigned width = (texRef>>1)&0x7E0;
+		unsigned height = (texRef<<5)&0x7E0;
+		Render3D->DecodeTexture(fmt, x, y, width, height);
 	}
+
+	// Decoding may itself have advanced the generation (by overwriting tiles decoded in another format), which is fine: all of
+	// these references are now decoded as of the current generation
+	m_decodedGeneration = Render3D->textureGeneration;
 }
 
 bool CTextureRefs::UpdateHashCapacity(unsigned capacity)
 {
 	unsigned oldCapacity = m_hashCapacity;
-	HashEntry **oldEntries = m_hashEntries;
-	// Update capacity and create new empty entries array
-	m_hashCapacity = capacity;
-	m_hashEntries = new(std::nothrow) HashEntry*[capacity];
-	if (!m_hashEntries)
+	unsigned *oldSlots = m_hashSlots;
+	// Create new empty slots array
+	unsigned *slots = new(std::nothrow) unsigned[capacity];
+	if (!slots)
 		return false;
-	memset(m_hashEntries, 0, capacity * sizeof(HashEntry*));
-	if (oldEntries)
+	memset(slots, 0xFF, capacity * sizeof(unsigned));
+	m_hashCapacity = capacity;
+	m_hashUsed = 0;
+	m_hashSlots = slots;
+	if (oldSlots)
 	{
-		// Redistribute entries into new entries array
+		// Reinsert references into new slots array, dropping removed slots
 		for (unsigned i = 0; i < oldCapacity; i++)
 		{
-			HashEntry *entry = oldEntries[i];
-			while (entry)
+			if (oldSlots[i] < REMOVED_SLOT)
 			{
-				HashEntry *nextEntry = entry->nextEntry;
-				unsigned hash = entry->texRef % capacity;
-				entry->nextEntry = m_hashEntries[hash];
-				m_hashEntries[hash] = entry;
-				entry = nextEntry;
+				m_hashSlots[FindSlot(oldSlots[i])] = oldSlots[i];
+				m_hashUsed++;
 			}
 		}
-		// Delete old entries array
-		delete[] oldEntries;
+		// Delete old slots array
+		delete[] oldSlots;
 	}
 	return true;
 }
 
-HashEntry *CTextureRefs::CreateHashEntry(unsigned texRef, bool &hashCapacityUpdated)
-{
-	// Update size and increase hash capacity if required
-	m_size++;
-	hashCapacityUpdated = m_size >= m_hashCapacity;
-	if (hashCapacityUpdated)
-	{
-		if (m_hashCapacity < 89)
-			UpdateHashCapacity(89); // Capacity of 89 gives good sequence of mostly prime capacities (89, 179, 359, 719, 1439, 2879 etc)
-		else
-			UpdateHashCapacity(2 * m_hashCapacity + 1);
-	}
-	return new(std::nothrow) HashEntry(texRef);
-}
-
-void CTextureRefs::DeleteHashEntry(HashEntry *entry)
+void CTextureRefs::DeleteHash()
 {
-	// Update size and delete hash entry
-	m_size--;
-	delete entry;
+	delete[] m_hashSlots;
+	m_hashSlots = NULL;
+	m_hashCapacity = 0;
+	m_hashUsed = 0;
 }
 
-void CTextureRefs::DeleteAllHashEntries()
+unsigned CTextureRefs::FindSlot(unsigned texRef) const
 {
-	if (!m_hashEntries)
-		return;
-	// Delete all hash entries and their storage
-	for (unsigned i = 0; i < m_hashCapacity; i++)
+	// Fibonacci hash, capacity is always a power of two
+	unsigned mask = m_hashCapacity - 1;
+	unsigned i = (texRef * 0x9E3779B1u) >> 7 & mask;
+	unsigned removed = EMPTY_SLOT;
+	while (m_hashSlots[i] != EMPTY_SLOT && m_hashSlots[i] != texRef)
 	{
-		HashEntry *entry = m_hashEntries[i];
-		if (entry)
-			delete entry;
+		// Remember first removed slot so that it can be reused by AddToHash
+		if (m_hashSlots[i] == REMOVED_SLOT && removed == EMPTY_SLOT)
+			removed = i;
+		i = (i + 1) & mask;
 	}
-	delete[] m_hashEntries;
+	if (m_hashSlots[i] == EMPTY_SLOT && removed != EMPTY_SLOT)
+		return removed;
+	return i;
 }
 
 bool CTextureRefs::AddToHash(unsigned texRef)
 {
-	// Convert texture reference to hash value
-	unsigned hash = texRef % m_hashCapacity;
-	// Loop through linked list for hash value and see if have texture reference already
-	HashEntry *headEntry = m_hashEntries[hash];
-	HashEntry *entry = headEntry;
-	while (entry && texRef != entry->texRef)
-		entry = entry->nextEntry;
+	unsigned i = FindSlot(texRef);
 	// If found, nothing to do
-	if (entry)
+	if (m_hashSlots[i] == texRef)
 		return true;
-	// Otherwise, create new hash entry for texture reference
-	bool hashCapacityUpdated;
-	entry = CreateHashEntry(texRef, hashCapacityUpdated);
-	// If couldn't create entry (ie out of memory), let caller know
-	if (!entry)
-		return false;
-	if (hashCapacityUpdated)
-	{
-		// If hash capacity was increased recalculate hash value
-		hash = texRef % m_hashCapacity;
-		headEntry = m_hashEntries[hash];
-	}
-	// Store hash entry in linked list for hash value
-	entry->nextEntry = headEntry;
-	m_hashEntries[hash] = entry;
+	// Otherwise, store texture reference in slot, growing hashset if more than 3/4 full (including removed slots)
+	if (m_hashSlots[i] == EMPTY_SLOT)
+		m_hashUsed++;
+	m_hashSlots[i] = texRef;
+	m_size++;
+	m_decodedGeneration = 0;
+	if (m_hashUsed * 4 > m_hashCapacity * 3)
+		return UpdateHashCapacity(m_size * 2 > m_hashCapacity ? 2 * m_hashCapacity : m_hashCapacity);
 	return true;
 }
 
 bool CTextureRefs::RemoveFromHash(unsigned texRef)
 {
-	// Convert texture reference to hash value
-	unsigned hash = texRef % m_hashCapacity;
-	// Loop through linked list for hash value and see if have texture reference
-	HashEntry *entry = m_hashEntries[hash];
-	HashEntry *prevEntry = NULL;
-	while (entry && texRef != entry->texRef)
-	{
-		prevEntry = entry;
-		entry = entry->nextEntry;
-    }
+	unsigned i = FindSlot(texRef);
 	// If not found, nothing to do
-	if (!entry)
+	if (m_hashSlots[i] != texRef)
 		return false;
-	// Otherwise, remove entry from linked list for hash value
-	if (prevEntry)	
-		prevEntry->nextEntry = entry->nextEntry;
-	else
-		m_hashEntries[hash] = entry->nextEntry;
-	// Delete hash entry storage
-	DeleteHashEntry(entry);
+	// Otherwise, mark slot as removed so that probing continues past it
+	m_hashSlots[i] = REMOVED_SLOT;
+	m_size--;
 	return true;
 }
 
 bool CTextureRefs::HashContains(unsigned texRef) const
 {
-	// Convert texture reference to hash value
-	unsigned hash = texRef % m_hashCapacity;
-	// Loop through linked list for hash value and see if have texture reference
-	HashEntry *entry = m_hashEntries[hash];
-	while (entry && texRef != entry->texRef)
-		entry = entry->nextEntry;
-	return !!entry;
+	return m_hashSlots[FindSlot(texRef)] == texRef;
 }
 
 } // Legacy3D
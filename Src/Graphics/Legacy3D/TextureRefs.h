@@ -34,15 +34,6 @@ namespace Legacy3D {
 
 #define TEXREFS_ARRAY_SIZE 12
 
-// Hash entry that holds a texture reference in the hashset
-struct HashEntry
-{
-	const unsigned texRef;	// Texture reference as a bitfield
-	HashEntry *nextEntry;   // Next entry with the same hash
-  
-	HashEntry(unsigned theTexRef) : texRef(theTexRef), nextEntry(nullptr) { }
-};
-
 class CLegacy3D;
 
 class CTextureRefs
@@ -98,9 +89,10 @@ public:
 	bool RemoveRef(unsigned fmt, unsigned x, unsigned y, unsigned width, unsigned height);
 
 	/*
-	 * RemoveRef(fmt, x, y, width, height):
+	 * DecodeAllTextures(Render3D):
 	 *
-	 * Decodes all texture references held, calling CLegacy3D::DecodeTexture for each one.
+	 * Decodes all texture references held, calling CLegacy3D::DecodeTexture for each one, sorted by texture sheet.
+	 * Does nothing if no texture sheet has changed since the last time, according to CLegacy3D's texture generation.
 	 */
 	void DecodeAllTextures(CLegacy3D *Render3D);
 
@@ -108,41 +100,39 @@ private:
 	// Number of texture references held.
 	unsigned m_size;
 
+	// Texture generation of CLegacy3D when all references were last decoded, 0 if never.
+	unsigned m_decodedGeneration;
+
 	// Pre-allocated array used to hold first TEXREFS_ARRAY_SIZE texture references.
 	unsigned m_array[TEXREFS_ARRAY_SIZE];
 
-	// Dynamically allocated hashset used to hold texture references when there are more than TEXREFS_ARRAY_SIZE.
+	// Dynamically allocated open-addressed hashset (linear probing, power of two capacity) used to hold texture
+	// references when there are more than TEXREFS_ARRAY_SIZE. Removed references leave a tombstone.
 	unsigned m_hashCapacity;
-	HashEntry **m_hashEntries;
+	unsigned m_hashUsed;	// slots that are not empty, including tombstones
+	unsigned *m_hashSlots;
     
 	/*
 	 * UpdateHashCapacity(hashCapacity)
 	 *
-	 * Increases capacity of the hashset to given size.
+	 * Rehashes the hashset into the given number of slots, dropping tombstones.
 	 */
 	bool UpdateHashCapacity(unsigned hashCapacity);
 
 	/*
-	 * CreateHashEntry(texRef, hashCapacityUpdated)
+	 * DeleteHash()
 	 *
-	 * Creates and returns a new hash entry, updating the capacity if required (hashCapacityUpdated is set to true).
+	 * Deletes the hashset storage.
 	 */
-	HashEntry *CreateHashEntry(unsigned texRef, bool &hashCapacityUpdated);
-
-	/*
-	 * DeleteHashEntry(entry)
-	 *
-	 * Deletes the given hash entry and its storage.
-	 */
-	void DeleteHashEntry(HashEntry *entry);
+    void DeleteHash();
 	
 	/*
-	 * DeleteAllHashEntries()
+	 * FindSlot(texRef)
 	 *
-	 * Deletes all hash entries and their storage.
+	 * Returns the slot holding the given texture reference, or the empty slot where it would go.
 	 */
-    void DeleteAllHashEntries();
-	
+	unsigned FindSlot(unsigned texRef) const;
+
 	/*
 	 * AddToHash(texRef)
 	 *
@@ -1,4 +1,5 @@
 #include "GLSLShader.h"
+#include "Graphics/ShaderCache.h"
 #include <cstdio>
 
 GLSLShader::GLSLShader() 
@@ -37,6 +38,11 @@ GLSLShader& GLSLShader::operator=(GLSLShader&& other) noexcept
 bool GLSLShader::LoadShaders(const char* vertexShader, const char* fragmentShader) 
 {
 	m_program = glCreateProgram();
+
+	if (ShaderCache::Load(m_program, { vertexShader, fragmentShader })) {
+		return true;
+	}
+
 	m_vShader = glCreateShader(GL_VERTEX_SHADER);
 	m_fShader = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -55,6 +61,8 @@ bool GLSLShader::LoadShaders(const char* vertexShader, const char* fragmentShade
 	PrintShaderInfoLog(m_fShader);
 	PrintProgramInfoLog(m_program);
 
+	ShaderCache::Save(m_program, { vertexShader, fragmentShader });
+
 	return true;
 }
 
@@ -5,6 +5,8 @@
 #include <unordered_map>
 #include <memory>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 #include "Types.h"
 #include "Mat4.h"
 
@@ -92,12 +94,50 @@ struct FVertex : Vertex			// full vertex including face attributes
 	}
 };
 
+struct PackedVertex				// full vertex as stored in the vbo, 36 bytes instead of 56
+{
+	float	pos[3];				// w is always 1, the vertex fetch fills it in
+	UINT32	normal;				// 10:10:10:2 signed normalised
+	float	texcoords[2];		// left as floats, textures repeat further than half floats can address to the texel
+	UINT32	faceNormal;			// 10:10:10:2 signed normalised
+	UINT8	faceColour[4];
+	INT16	fixedShade;			// signed normalised, unsigned shades only use the top half
+	INT16	pad;
+
+	PackedVertex() {}
+	PackedVertex(const FVertex& v)
+	{
+		for (int i = 0; i < 3; i++) { pos[i] = v.pos[i]; }
+		for (int i = 0; i < 2; i++) { texcoords[i] = v.texcoords[i]; }
+		for (int i = 0; i < 4; i++) { faceColour[i] = v.faceColour[i]; }
+
+		normal		= PackNormal(v.normal);
+		faceNormal	= PackNormal(v.faceNormal);
+		fixedShade	= (INT16)std::lround(std::min(std::max(v.fixedShade, -1.0f), 1.0f) * 32767.0f);
+		pad			= 0;
+	}
+
+	static UINT32 PackNormal(const float n[3])
+	{
+		UINT32 packed = 0;
+
+		for (int i = 0; i < 3; i++) {
+			INT32 c = (INT32)std::lround(std::min(std::max(n[i], -1.0f), 1.0f) * 511.0f);
+			packed |= ((UINT32)c & 0x3FF) << (i * 10);
+		}
+
+		return packed;
+	}
+};
+
+static_assert(sizeof(PackedVertex) == 36, "vertex attribute offsets assume a tightly packed vertex");
+
 enum class Layer { colour, trans1, trans2, trans12 /*both 1&2*/, all, none };
 
 struct Mesh
 {
 	//helper funcs
-	bool Render(Layer layer)
+	bool Render(Layer layer) const
 	{
 		switch (layer)
 		{
@@ -123,6 +163,17 @@ struct Mesh
 		return true;
 	}
 
+	bool SameState(const Mesh& other) const		// can be drawn with the same shader uniforms and render states
+	{
+		return format == other.format && x == other.x && y == other.y && width == other.width && height == other.height &&
+			wrapModeU == other.wrapModeU && wrapModeV == other.wrapModeV && inverted == other.inverted &&
+			microTexture == other.microTexture && microTextureID == other.microTextureID && microTextureScale == other.microTextureScale &&
+			textured == other.textured && textureAlpha == other.textureAlpha && alphaTest == other.alphaTest &&
+			layered == other.layered && translatorMap == other.translatorMap &&
+			fixedShading == other.fixedShading && lighting == other.lighting && specular == other.specular &&
+			shininess == other.shininess && specularValue == other.specularValue && fogIntensity == other.fogIntensity;
+	}
+
 	enum TexWrapMode : int { repeat = 0, repeatClamp, mirror, mirrorClamp };
 
 	// texture
@@ -161,11 +212,6 @@ struct Mesh
 	int vertexCount		= 0;			// /3 for triangles /4 for quads
 };
 
-struct SortingMesh : public Mesh		// This struct temporarily holds the model data, before it gets copied to the main buffer
-{
-	std::vector<FVertex> verts;
-};
-
 struct Model
 {
 	std::shared_ptr<std::vector<Mesh>> meshes;	// this reason why this is a shared ptr to an array, is that multiple models might use the same meshes
@@ -1,5 +1,6 @@
 #include "New3D.h"
 #include "Vec.h"
+#include "SIMD.h"
 #include <cmath>
 #include <algorithm>
 #include <limits>
@@ -7,20 +8,61 @@
 #include <unordered_map>
 #include "R3DFloat.h"
 #include "Util/BitCast.h"
+#include "OSD/Thread.h"
+#include "Model3/DirtyPages.h"
+#include "OSD/Logger.h"
+#include "OSD/Trace.h"
+#include "Graphics/GPUTimer.h"
+#include "ROMCache.h"
+#include <cstdio>
+#include <type_traits>
+#include <zlib.h>
 
 #define MAX_RAM_VERTS 300000
 #define MAX_ROM_VERTS 1500000
+#define ROM_MODEL_CACHE_VERSION 2		// increment whenever decoded vertices or mesh state change
 
 #define BYTE_TO_FLOAT(B)	((2.0f * (B) + 1.0f) * (float)(1.0/255.0))
 
 namespace New3D {
 
+// 64 bit hash of 32 bit words, two at a time
+static UINT64 HashWords(const UINT32 *data, size_t count, UINT64 hash)
+{
+	const UINT64 k1 = 0x9E3779B97F4A7C15ull;
+	const UINT64 k2 = 0xC2B2AE3D27D4EB4Full;
+
+	for (size_t i = 0; i < count; i += 2) {
+		UINT64 v = data[i] | ((i + 1 < count) ? (UINT64)data[i + 1] << 32 : 0);
+		hash ^= v * k1;
+		hash = ((hash << 31) | (hash >> 33)) * k2;
+	}
+
+	hash ^= hash >> 29;
+	hash *= k1;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+// Makes room to append count elements, counting the times this goes to the heap
+template <typename T>
+static void ReserveMore(std::vector<T>& v, size_t count, UINT32& allocations)
+{
+	if (v.size() + count > v.capacity()) {
+		v.reserve(std::max(v.size() + count, v.capacity() * 2));
+		allocations++;
+	}
+}
+
 CNew3D::CNew3D(const Util::Config::Node &config, const std::string& gameName) : 
 	m_r3dShader(config),
 	m_r3dScrollFog(config),
 	m_gameName(gameName),
 	m_textureBuffer(0),
-	m_vao(0)
+	m_romCacheDir(config["ROMCacheDirectory"].ValueAs<std::string>()),
+	m_vao(0),
+	m_instanceBuffer(0)
 {
 	m_cullingRAMLo	= nullptr;
 	m_cullingRAMHi	= nullptr;
@@ -31,6 +73,13 @@ CNew3D::CNew3D(const Util::Config::Node &config, const std::string& gameName) :
 	m_shadeIsSigned = true;
 	m_numPolyVerts	= 3;
 	m_primType		= GL_TRIANGLES;
+	m_gpuClipping	= config["GPUClipping"].ValueAs<bool>();
+	m_lodDistanceScale	= config["LODQuality"].ValueAs<float>() > 0 ? 100.0f / config["LODQuality"].ValueAs<float>() : 0.0f;
+	m_strictLos		= config["StrictLOS"].ValueAs<bool>();
+	m_useTextureCache	= config["TextureCache"].ValueAs<bool>();
+	m_dynamicResolution	= config["DynamicResolution"].ValueAs<bool>();
+	m_minRenderScale	= std::min(1.0f, std::max(0.25f, config["DynamicResolutionMin"].ValueAs<float>() / 100.0f));
+	m_gpuBudget			= std::max(1.0f, config["GPUFrameBudget"].ValueAs<float>());
 
 	if (config["QuadRendering"].ValueAs<bool>()) {
 		m_numPolyVerts	= 4;
@@ -40,6 +89,10 @@ CNew3D::CNew3D(const Util::Config::Node &config, const std::string& gameName) :
 	m_r3dShader.LoadShader();
 	glUseProgram(0);
 
+	if (m_r3dShader.VertexPulling()) {
+		m_primType		= GL_TRIANGLES;		// 2 a quad, from 6 vertex ids
+	}
+
 	// setup our texture memory
 
 	glGenTextures(1, &m_textureBuffer);
@@ -49,40 +102,80 @@ CNew3D::CNew3D(const Util::Config::Node &config, const std::string& gameName) :
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, 2048, 2048, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);	// allocate storage
+	m_textureUploadBuffer.Create();
 
 	// setup up our vertex buffer memory
 
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
-	m_vbo.Create(GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW, sizeof(FVertex) * (MAX_RAM_VERTS + MAX_ROM_VERTS));
+	if (!m_vbo.CreateRing(GL_ARRAY_BUFFER, sizeof(PackedVertex) * MAX_ROM_VERTS, sizeof(PackedVertex) * MAX_RAM_VERTS)) {
+		m_vbo.Create(GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW, sizeof(PackedVertex) * (MAX_RAM_VERTS + MAX_ROM_VERTS));
+	}
 	m_vbo.Bind(true);
 
-	glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inVertex"));
-	glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inNormal"));
-	glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inTexCoord"));
-	glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inColour"));
-	glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inFaceNormal"));
-	glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inFixedShade"));
-
-	// before draw, specify vertex and index arrays with their offsets, offsetof is maybe evil ..
-	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inVertex"), 4, GL_FLOAT, GL_FALSE, sizeof(FVertex), 0);
-	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inNormal"), 3, GL_FLOAT, GL_FALSE, sizeof(FVertex), (void*)offsetof(FVertex, normal));
-	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inTexCoord"), 2, GL_FLOAT, GL_FALSE, sizeof(FVertex), (void*)offsetof(FVertex, texcoords));
-	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inColour"), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(FVertex), (void*)offsetof(FVertex, faceColour));
-	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inFaceNormal"), 3, GL_FLOAT, GL_FALSE, sizeof(FVertex), (void*)offsetof(FVertex, faceNormal));
-	glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inFixedShade"), 1, GL_FLOAT, GL_FALSE, sizeof(FVertex), (void*)offsetof(FVertex, fixedShade));
+	if (!m_r3dShader.VertexPulling()) {		// otherwise the shader reads the vertices from the buffer itself
+		glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inVertex"));
+		glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inNormal"));
+		glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inTexCoord"));
+		glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inColour"));
+		glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inFaceNormal"));
+		glEnableVertexAttribArray(m_r3dShader.GetVertexAttribPos("inFixedShade"));
+
+		// before draw, specify vertex and index arrays with their offsets, offsetof is maybe evil ..
+		// positions have 3 components, w defaults to 1. the normals are packed 10:10:10:2, the shader only reads xyz
+		glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inVertex"), 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), 0);
+		glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inNormal"), 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+		glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inTexCoord"), 2, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texcoords));
+		glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inColour"), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, faceColour));
+		glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inFaceNormal"), 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, faceNormal));
+		glVertexAttribPointer(m_r3dShader.GetVertexAttribPos("inFixedShade"), 1, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, fixedShade));
+	}
+
+	// the instance matrix takes 4 attribute slots, its arrays are enabled once the buffer has something in it
+	GLint instanceMat = m_r3dShader.GetVertexAttribPos("inInstanceMat");
+	for (int i = 0; i < 4 && instanceMat >= 0; i++) {
+		glVertexAttribDivisor(instanceMat + i, 1);
+	}
 
 	glBindVertexArray(0);
 	m_vbo.Bind(false);
+
+	glGenBuffers(1, &m_instanceBuffer);
 }
 
 CNew3D::~CNew3D()
 {
+	SaveRomModelCache();
+
+	if (m_compositeFrames) {
+		InfoLog("New3D skipped %.1f MB of compositing and depth copies per frame.", m_compositeBytesSaved / (1024.0 * 1024.0) / m_compositeFrames);
+	}
+
 	m_vbo.Destroy();
 	if (m_vao) {
 		glDeleteVertexArrays(1, &m_vao);
 		m_vao = 0;
 	}
+	if (m_instanceBuffer) {
+		glDeleteBuffers(1, &m_instanceBuffer);
+		m_instanceBuffer = 0;
+	}
+
+	m_textureUploadBuffer.Destroy();
+	m_textureCache.Destroy();
+
+	if (m_timerQueries[0]) {
+		glDeleteQueries(NumTimerQueries, m_timerQueries);
+	}
+
+	for (auto& s : m_losSamples) {
+		if (s.fence) {
+			glDeleteSync(s.fence);
+		}
+		if (s.pbo) {
+			glDeleteBuffers(1, &s.pbo);
+		}
+	}
 
 	if (m_textureBuffer) {
 		glDeleteTextures(1, &m_textureBuffer);
@@ -99,6 +192,11 @@ void CNew3D::AttachMemory(const UINT32 *cullingRAMLoPtr, const UINT32 *cullingRA
 	m_polyRAM		= polyRAMPtr;
 	m_vrom			= vromPtr;
 	m_textureRAM	= textureRAMPtr;
+
+	if (m_useTextureCache && !m_textureCache.Enabled()) {
+		m_textureCache.Create(m_textureRAM);
+		m_r3dShader.SetTextureCache(&m_textureCache);
+	}
 }
 
 void CNew3D::SetStepping(int stepping)
@@ -133,21 +231,20 @@ bool CNew3D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yR
 
 	m_r3dFrameBuffers.DestroyFBO();		// remove any old ones if created
 	m_r3dFrameBuffers.CreateFBO(totalXResParam, totalYResParam);
+	m_r3dFrameBuffers.SetScale(m_renderScale);
 
 	return OKAY;
 }
 
 void CNew3D::UploadTextures(unsigned level, unsigned x, unsigned y, unsigned width, unsigned height)
 {
-	glBindTexture(GL_TEXTURE_2D, m_textureBuffer);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
-
-	for (unsigned i = 0; i < height; i++) {
-		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y + i, width, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_textureRAM + ((y + i) * 2048) + x);
-	}
+	Trace::Scope scope("UploadTextures");
+	m_textureUploadBuffer.Upload(m_textureBuffer, x, y, width, height, m_textureRAM);
+	m_textureCache.Invalidate(x, y, width, height);
 }
 
-void CNew3D::DrawScrollFog()
+// Finds the viewport scroll fog is drawn in and its colour, -1 if there is none
+int CNew3D::FindScrollFog(float rgba[4]) const
 {
 	// this is my best guess at the logic based upon what games are doing
 	//
@@ -158,8 +255,6 @@ void CNew3D::DrawScrollFog()
 	// sega bassfishing	- first viewport in priority 1 sets scroll value. The rest all contain the wrong value + a higher select value ..
 	// spikeout final	- 2nd viewport in the priority layer has scroll values set, none of the others do. It also uses the highest select value
 
-	float rgba[4];
-
 	for (int i = 0; i < 4; i++) {
 		for (auto &n : m_nodes) {
 			if (n.viewport.priority == i) {
@@ -174,12 +269,13 @@ void CNew3D::DrawScrollFog()
 		}
 	}
 
-	return;
+	return -1;
 
 CheckScroll:
 
 	for (int i = 0; i < 4; i++) {
-		for (auto &n : m_nodes) {
+		for (size_t j = 0; j < m_nodes.size(); j++) {
+			const auto &n = m_nodes[j];
 			if (n.viewport.priority == i) {
 
 				//if we have a fog density value
@@ -189,67 +285,255 @@ CheckScroll:
 						rgba[1] == n.viewport.fogParams[1] &&
 						rgba[2] == n.viewport.fogParams[2]) {
 
-						glViewport(n.viewport.x, n.viewport.y, n.viewport.width, n.viewport.height);
-						m_r3dScrollFog.DrawScrollFog(rgba, n.viewport.scrollAtt, n.viewport.fogParams[6], n.viewport.spotFogColor, n.viewport.spotEllipse);
-						return;
+						return (int)j;
 					}
 				}
 
 			}
 		}
 	}
+
+	return -1;
 }
 
-bool CNew3D::RenderScene(int priority, bool renderOverlay, Layer layer)
+// Finds the models of a node that share their meshes, scale and texture offsets, ie the same rom model placed more than
+// once, which only differ by their matrices. The first of each gets the matrices of all of them, the others none.
+void CNew3D::GroupInstances(const Node& n)
 {
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_textureBuffer);
+	const auto& models = n.models;
+
+	m_instanceGroups.clear();
+	m_instanceOrder.clear();
+	ReserveMore(m_instanceGroups, models.size(), m_frameAllocations);
+	ReserveMore(m_instanceOrder, models.size(), m_frameAllocations);
+	m_instanceGroups.assign(models.size(), { 0, 1 });
+
+	for (size_t i = 0; i < models.size(); i++) {
+		m_instanceOrder.push_back((int)i);
+	}
+
+	auto less = [&models](int a, int b) {
+		const Model& ma = models[a];
+		const Model& mb = models[b];
+		if (ma.meshes != mb.meshes)					return ma.meshes < mb.meshes;
+		if (ma.scale != mb.scale)					return ma.scale < mb.scale;
+		if (ma.textureOffsetX != mb.textureOffsetX)	return ma.textureOffsetX < mb.textureOffsetX;
+		if (ma.textureOffsetY != mb.textureOffsetY)	return ma.textureOffsetY < mb.textureOffsetY;
+		if (ma.page != mb.page)						return ma.page < mb.page;
+		return a < b;								// first in scene order leads
+	};
 
-	bool hasOverlay = false;		// (high priority polys)
+	std::sort(m_instanceOrder.begin(), m_instanceOrder.end(), less);
 
-	for (auto &n : m_nodes) {
+	for (size_t i = 0; i < m_instanceOrder.size(); ) {
 
-		if (n.viewport.priority != priority || n.models.empty()) {
-			continue;
+		const Model& lead = models[m_instanceOrder[i]];
+		size_t end = i + 1;
+
+		while (end < m_instanceOrder.size()) {
+			const Model& m = models[m_instanceOrder[end]];
+			if (m.meshes != lead.meshes || m.scale != lead.scale || m.textureOffsetX != lead.textureOffsetX || m.textureOffsetY != lead.textureOffsetY || m.page != lead.page) {
+				break;
+			}
+			end++;
 		}
 
-		CalcViewport(&n.viewport, std::abs(m_nfPairs[priority].zNear*0.96f), std::abs(m_nfPairs[priority].zFar*1.05f));	// make planes 5% bigger
-		glViewport(n.viewport.x, n.viewport.y, n.viewport.width, n.viewport.height);
+		if (end - i > 1) {
 
-		m_r3dShader.SetViewportUniforms(&n.viewport);
+			InstanceGroup& group = m_instanceGroups[m_instanceOrder[i]];
+			group.firstInstance	= m_instanceMats.size() / 16;
+			group.instances		= (GLsizei)(end - i);
+			ReserveMore(m_instanceMats, (end - i) * 16, m_frameAllocations);
 
-		for (auto &m : n.models) {
+			for (size_t j = i; j < end; j++) {
+				const float* mat = models[m_instanceOrder[j]].modelMat;
+				m_instanceMats.insert(m_instanceMats.end(), mat, mat + 16);
+				if (j > i) {
+					m_instanceGroups[m_instanceOrder[j]].instances = 0;
+				}
+			}
+		}
 
-			bool matrixLoaded = false;
+		i = end;
+	}
+}
 
-			if (m.meshes->empty()) {
-				continue;
+void CNew3D::BuildDrawLists()
+{
+	Trace::Scope scope("BuildDrawLists");
+	static const Layer layers[3] = { Layer::colour, Layer::trans1, Layer::trans2 };
+
+	for (auto &priority : m_drawLists) {
+		for (auto &overlay : priority) {
+			for (auto &list : overlay) {
+				list.batches.clear();
+				list.first.clear();
+				list.count.clear();
 			}
+		}
+	}
+
+	for (auto &overlay : m_hasOverlay) {
+		overlay = false;
+	}
+
+	m_instanceMats.clear();
+
+	// lists keep the scene order, only meshes that follow each other in a pass are batched. the exception is
+	// opaque meshes of models drawn more than once, which are drawn instanced where the first of them was
+	for (auto &n : m_nodes) {
+
+		int priority = n.viewport.priority;
+
+		if (priority < 0 || priority > 3) {
+			continue;
+		}
+
+		GroupInstances(n);
+
+		size_t firstBatch[2] = { m_drawLists[priority][0][0].batches.size(), m_drawLists[priority][1][0].batches.size() };
 
-			for (auto &mesh : *m.meshes) {
+		for (size_t j = 0; j < n.models.size(); j++) {
+
+			const Model& m = n.models[j];
+			const InstanceGroup& group = m_instanceGroups[j];
+
+			for (const auto &mesh : *m.meshes) {
 
 				if (mesh.highPriority) {
-					hasOverlay = true;
+					m_hasOverlay[priority] = true;
 				}
 
-				if (!mesh.Render(layer)) continue;
-				if (mesh.highPriority != renderOverlay) continue;
+				for (int i = 0; i < 3; i++) {
+
+					if (!mesh.Render(layers[i])) continue;
+
+					bool instanced = i == 0 && !mesh.layered;	// stencilled polys rely on draw order
+
+					if (instanced && group.instances == 0) {
+						continue;
+					}
+
+					GLsizei instances		= instanced ? group.instances : 1;
+					size_t	firstInstance	= instanced ? group.firstInstance : 0;
+
+					DrawList &list = m_drawLists[priority][mesh.highPriority][i];
 
-				if (!matrixLoaded) {
-					m_r3dShader.SetModelStates(&m);
-					matrixLoaded = true;		// do this here to stop loading matrices we don't need. Ie when rendering non transparent etc
+					if (!list.batches.empty() && list.batches.back().model == &m && list.batches.back().mesh->SameState(mesh) && list.batches.back().instances == instances) {
+						list.batches.back().count++;
+					}
+					else {
+						list.batches.push_back({ &n, &m, &mesh, list.first.size(), 1, instances, firstInstance });
+					}
+
+					if (m_r3dShader.VertexPulling()) {		// 6 vertex ids a quad
+						list.first.push_back(mesh.vboOffset / 4 * 6);
+						list.count.push_back(mesh.vertexCount / 4 * 6);
+					}
+					else {
+						list.first.push_back(mesh.vboOffset);
+						list.count.push_back(mesh.vertexCount);
+					}
 				}
-				
-				m_r3dShader.SetMeshUniforms(&mesh);
-				glDrawArrays(m_primType, mesh.vboOffset, mesh.vertexCount);
 			}
 		}
+
+		if (m_r3dShader.Permutations()) {
+			SortByPermutation(m_drawLists[priority][0][0], firstBatch[0]);
+			SortByPermutation(m_drawLists[priority][1][0], firstBatch[1]);
+		}
+	}
+}
+
+void CNew3D::SortByPermutation(DrawList& list, size_t first)
+{
+	// opaque meshes of a node are drawn grouped by shader permutation, to switch programs less. stencilled
+	// meshes depend on what's drawn before them, so they stay in place and meshes aren't moved across them
+	auto key = [](const DrawBatch& b) { return R3DShader::PermutationKey(b.mesh); };
+
+	auto begin = list.batches.begin() + first;
+
+	while (begin != list.batches.end()) {
+		auto end = std::find_if(begin, list.batches.end(), [](const DrawBatch& b) { return b.mesh->layered; });
+		std::stable_sort(begin, end, [&](const DrawBatch& a, const DrawBatch& b) { return key(a) < key(b); });
+		begin = (end == list.batches.end()) ? end : end + 1;
+	}
+}
+
+void CNew3D::RenderScene(int priority, bool renderOverlay, Layer layer)
+{
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_textureBuffer);
+
+	const DrawList &list = m_drawLists[priority][renderOverlay][layer == Layer::colour ? 0 : (layer == Layer::trans1 ? 1 : 2)];
+
+	const Node*		node	= nullptr;
+	const Model*	model	= nullptr;
+
+	int stage = GPUTimer::Scene + (priority * 3) + (int)layer;
+	GPUTimer::Begin(stage);
+
+	for (const auto &batch : list.batches) {
+
+		if (m_r3dShader.SelectProgram(batch.mesh)) {
+			node = nullptr;		// set the viewport and model uniforms in this program
+		}
+
+		if (batch.node != node) {
+			glViewport(batch.node->viewport.x, batch.node->viewport.y, batch.node->viewport.width, batch.node->viewport.height);
+
+			m_r3dShader.SetViewportUniforms(&batch.node->viewport);
+			node	= batch.node;
+			model	= nullptr;
+		}
+
+		if (batch.model != model) {
+			m_r3dShader.SetModelStates(batch.model);
+			model = batch.model;
+		}
+
+		m_r3dShader.SetMeshUniforms(batch.mesh);
+		m_r3dShader.SetInstanced(batch.instances > 1);
+
+		if (batch.instances > 1) {
+			SetInstanceMats(batch.firstInstance);
+			for (GLsizei i = 0; i < batch.count; i++) {
+				glDrawArraysInstanced(m_primType, list.first[batch.first + i], list.count[batch.first + i], batch.instances);
+			}
+		}
+		else if (batch.count == 1) {
+			glDrawArrays(m_primType, list.first[batch.first], list.count[batch.first]);
+		}
+		else {
+			glMultiDrawArrays(m_primType, &list.first[batch.first], &list.count[batch.first], batch.count);
+		}
+	}
+
+	m_r3dShader.SetInstanced(false);
+
+	GPUTimer::End(stage);
+}
+
+// Points the instance matrix attribute at the matrices of an instanced batch. GL 4.1 has no base instance for draws
+void CNew3D::SetInstanceMats(size_t firstInstance)
+{
+	GLint loc = m_r3dShader.GetVertexAttribPos("inInstanceMat");
+
+	if (loc < 0) {
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+
+	for (int i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(loc + i);
+		glVertexAttribPointer(loc + i, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(float), (void*)((firstInstance * 16 + i * 4) * sizeof(float)));
 	}
 
-	return hasOverlay;
+	m_vbo.Bind(true);
 }
 
-bool CNew3D::SkipLayer(int layer)
+bool CNew3D::SkipLayer(int layer) const
 {
 	for (const auto &n : m_nodes) {
 		if (n.viewport.priority == layer) {
@@ -269,6 +553,10 @@ void CNew3D::SetRenderStates()
 
 	m_r3dShader.SetShader(true);
 
+	if (m_r3dShader.VertexPulling()) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_vbo.GetID());
+	}
+
 	glDepthFunc		(GL_LEQUAL);
 	glEnable		(GL_DEPTH_TEST);
 	glDepthMask		(GL_TRUE);
@@ -291,13 +579,16 @@ void CNew3D::DisableRenderStates()
 	glDisable(GL_STENCIL_TEST);
 }
 
-void CNew3D::RenderFrame(void)
+void CNew3D::BuildFrame(void)
 {
 	for (int i = 0; i < 4; i++) {
 		m_nfPairs[i].zNear = -std::numeric_limits<float>::max();
 		m_nfPairs[i].zFar  =  std::numeric_limits<float>::max();
 	}
 
+	ResolveLos();
+	UpdateRenderScale();
+
 	{
 		std::lock_guard<std::mutex> guard(m_losMutex);
 		std::swap(m_losBack, m_losFront);
@@ -306,22 +597,178 @@ void CNew3D::RenderFrame(void)
 		}
 	}
 
+	m_frameAllocations = 0;
+	m_frameModelsCached = 0;
+
 	// release any resources from last frame
 	m_polyBufferRam.clear();		// clear dynamic model memory buffer
+	m_numRamVerts = 0;
+
+	GLintptr ringOffset = 0;
+	m_ramVerts = (PackedVertex*)m_vbo.NextSegment(ringOffset);
+	m_ramVertsBase = m_ramVerts ? (int)(ringOffset / sizeof(PackedVertex)) - MAX_ROM_VERTS : 0;
+
+	for (auto &n : m_nodes) {		// keep the model arrays for the viewports of this frame
+		n.models.clear();
+		ReserveMore(m_modelArrays, 1, m_frameAllocations);
+		m_modelArrays.push_back(std::move(n.models));
+	}
+
 	m_nodes.clear();				// memory will grow during the object life time, that's fine, no need to shrink to fit
-	m_modelMat.Release();			// would hope we wouldn't need this but no harm in checking
-	m_nodeAttribs.Reset();
+	m_numBuildTasks = 0;
+
+	if (!m_romCacheLoaded) {
+		LoadRomModelCache();		// stepping and shading mode are known by now, uploaded below in one go
+	}
+
+	RenderViewport(0x800000);						// set up viewports
+	BuildModels();									// build model structure
+	BuildDrawLists();
+	RecordCommands();
+
+	m_frameBuilt = true;
+}
+
+void CNew3D::Record(RenderCommand::Op op, int arg, int priority, int overlay, int node)
+{
+	ReserveMore(m_commands, 1, m_frameAllocations);
+	m_commands.push_back({ op, (UINT8)priority, (UINT8)overlay, (UINT8)arg, node });
+}
+
+// Works out the passes of the frame from the draw lists and records them, along with the final projection and
+// gl viewport of each node, which depend on the near and far planes of its priority layer
+void CNew3D::RecordCommands()
+{
+	Trace::Scope scope("RecordCommands");
+	using Op = RenderCommand::Op;
+
+	m_commands.clear();
+
+	for (auto &n : m_nodes) {
+		int priority = n.viewport.priority;
+		if (priority >= 0 && priority <= 3) {
+			CalcViewport(&n.viewport, std::abs(m_nfPairs[priority].zNear*0.96f), std::abs(m_nfPairs[priority].zFar*1.05f));	// make planes 5% bigger
+		}
+	}
+
+	Record(Op::BeginTimer, GPUTimer::ScrollFog);
+	int fogNode = FindScrollFog(m_scrollFogColour);
+	if (fogNode >= 0) {
+		Record(Op::ScrollFog, 0, 0, 0, fogNode);			// fog layer if applicable must be drawn here
+	}
+	Record(Op::EndTimer, GPUTimer::ScrollFog);
+
+	Record(Op::UploadVertices);
+
+	// full screen passes that can't change anything are skipped, the trans layers are only cleared and
+	// composited if something is drawn to them
+	bool transDrawn = false;
+
+	for (int pri = 0; pri <= 3; pri++) {
+
+		if (SkipLayer(pri)) continue;
+
+		for (int i = 0; i < 2; i++) {
+
+			bool renderOverlay	= (i == 1);
+			bool opaque			= !m_drawLists[pri][renderOverlay][0].batches.empty();
+			bool trans1			= !m_drawLists[pri][renderOverlay][1].batches.empty();
+			bool trans2			= !m_drawLists[pri][renderOverlay][2].batches.empty();
+
+			Record(Op::SetTarget, (int)Layer::colour);
+			Record(Op::Clear, RenderCommand::ClearColour | RenderCommand::ClearDepth | RenderCommand::ClearStencil);
+
+			Record(Op::BeginScene);
+
+			Record(Op::DiscardAlpha, 1);						// discard all translucent pixels in opaque pass
+			Record(Op::DrawList, 0, pri, renderOverlay);
+
+			if (!renderOverlay) {
+				int losNode = FindLosNode(pri);
+				if (losNode >= 0) {
+					Record(Op::ReadLos, 0, pri, 0, losNode);
+				}
+			}
+
+			Record(Op::EndScene);
+
+			if (opaque && transDrawn) {
+				Record(Op::DrawOverTransLayers);				// mask trans layer with opaque pixels
+			}
+			else {
+				m_compositeBytesSaved += m_r3dFrameBuffers.PassBytes(3);
+			}
+
+			if (opaque) {
+				Record(Op::CompositeBaseLayer);					// copy opaque pixels to back buffer
+			}
+			else {
+				m_compositeBytesSaved += m_r3dFrameBuffers.PassBytes(2);
+			}
+
+			if (!transDrawn && (trans1 || trans2)) {
+				Record(Op::SetTarget, (int)Layer::trans12);
+				Record(Op::Clear, RenderCommand::ClearColour);	// wipe both trans layers
+				transDrawn = true;
+			}
+
+			Record(Op::BeginScene);
+
+			Record(Op::DepthLess);								// alpha polys seem to use gl_less (ocean hunter)
+
+			Record(Op::DiscardAlpha, 0);						// render only translucent pixels
+
+			if (trans1 && trans2) {
+				Record(Op::StoreDepth);							// save depth buffer for 1st trans pass
+			}
+			else {
+				m_compositeBytesSaved += m_r3dFrameBuffers.PassBytes(4);	// both copies
+			}
+
+			Record(Op::SetTarget, (int)Layer::trans1);
+			Record(Op::DrawList, 1, pri, renderOverlay);
+
+			if (trans1 && trans2) {
+				Record(Op::RestoreDepth);						// restore depth buffer, trans layers don't seem to depth test against each other
+			}
+
+			Record(Op::SetTarget, (int)Layer::trans2);
+			Record(Op::DrawList, 2, pri, renderOverlay);
+
+			Record(Op::EndScene);
+
+			if (!m_hasOverlay[pri]) break;						// no high priority polys
+		}
+	}
+
+	if (transDrawn) {
+		Record(Op::CompositeAlphaLayer);
+	}
+	else {
+		m_compositeBytesSaved += m_r3dFrameBuffers.PassBytes(4);
+	}
+
+	m_compositeFrames++;
+}
 
-	RenderViewport(0x800000);						// build model structure
-	DrawScrollFog();								// fog layer if applicable must be drawn here
+// Uploads the instance matrices and the polys built this frame
+void CNew3D::UploadVertices()
+{
+	if (!m_instanceMats.empty()) {
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, m_instanceMats.size() * sizeof(float), m_instanceMats.data(), GL_STREAM_DRAW);	// orphans last frame's
+	}
 	
 	m_vbo.Bind(true);
-	m_vbo.BufferSubData(MAX_ROM_VERTS*sizeof(FVertex), m_polyBufferRam.size()*sizeof(FVertex), m_polyBufferRam.data());	// upload all the dynamic data to GPU in one go
+
+	if (!m_ramVerts) {
+		m_vbo.BufferSubData(MAX_ROM_VERTS*sizeof(PackedVertex), m_polyBufferRam.size()*sizeof(PackedVertex), m_polyBufferRam.data());	// upload all the dynamic data to GPU in one go
+	}
 
 	if (!m_polyBufferRom.empty()) {
 
 		// sync rom memory with vbo
-		int romBytes	= (int)m_polyBufferRom.size() * sizeof(FVertex);
+		int romBytes	= (int)m_polyBufferRom.size() * sizeof(PackedVertex);
 		int vboBytes	= m_vbo.GetSize();
 		int size		= romBytes - vboBytes;
 
@@ -331,62 +778,113 @@ void CNew3D::RenderFrame(void)
 			if (m_polyBufferRom.size() >= MAX_ROM_VERTS) {
 				m_polyBufferRom.clear();
 				m_romMap.clear();
+				m_dynamicModels.clear();
 				m_vbo.Reset();
+
+				for (auto& task : m_buildTasks) {
+					task.frame = 0;				// their meshes are gone too
+				}
 			}
 			else {
-				m_vbo.AppendData(size, &m_polyBufferRom[vboBytes / sizeof(FVertex)]);
+				m_vbo.AppendData(size, &m_polyBufferRom[vboBytes / sizeof(PackedVertex)]);
 			}
 		}
 	}
+}
 
-	m_r3dFrameBuffers.SetFBO(Layer::trans12);
-	glClear(GL_COLOR_BUFFER_BIT);					// wipe both trans layers
-
-	for (int pri = 0; pri <= 3; pri++) {
-
-		if (SkipLayer(pri)) continue;
+// Draws the frame as recorded, nothing here looks at the scene itself
+void CNew3D::RenderFrame(void)
+{
+	if (!m_frameBuilt) {
+		BuildFrame();
+	}
 
-		for (int i = 0; i < 2; i++) {
+	m_frameBuilt = false;
 
-			bool renderOverlay = (i == 1);
+	Trace::Scope scope("ExecuteCommands");
+	using Op = RenderCommand::Op;
 
-			m_r3dFrameBuffers.SetFBO(Layer::colour);
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	bool timed = m_dynamicResolution && !m_timerPending[m_timerQuery];
 
-			SetRenderStates();
+	if (timed) {
+		glBeginQuery(GL_TIME_ELAPSED, m_timerQueries[m_timerQuery]);
+	}
 
-			m_r3dShader.DiscardAlpha(true);						// discard all translucent pixels in opaque pass
-			bool hasOverlay = RenderScene(pri, renderOverlay, Layer::colour);
+	m_r3dShader.NewFrame();
+	m_textureCache.NewFrame();
 
-			if (!renderOverlay) {
-				ProcessLos(pri);
-			}
+	static const Layer layers[3] = { Layer::colour, Layer::trans1, Layer::trans2 };
 
-			DisableRenderStates();
+	for (const auto &c : m_commands) {
 
-			m_r3dFrameBuffers.DrawOverTransLayers();			// mask trans layer with opaque pixels
-			m_r3dFrameBuffers.CompositeBaseLayer();				// copy opaque pixels to back buffer
+		switch (c.op) {
 
+		case Op::BeginTimer:
+			GPUTimer::Begin(c.arg);
+			break;
+		case Op::EndTimer:
+			GPUTimer::End(c.arg);
+			break;
+		case Op::ScrollFog: {
+			Viewport &vp = m_nodes[c.node].viewport;
+			glViewport(vp.x, vp.y, vp.width, vp.height);
+			m_r3dScrollFog.DrawScrollFog(m_scrollFogColour, vp.scrollAtt, vp.fogParams[6], vp.spotFogColor, vp.spotEllipse);
+			break;
+		}
+		case Op::UploadVertices:
+			UploadVertices();
+			break;
+		case Op::SetTarget:
+			m_r3dFrameBuffers.SetFBO((Layer)c.arg);
+			break;
+		case Op::Clear:
+			glClear(((c.arg & RenderCommand::ClearColour) ? GL_COLOR_BUFFER_BIT : 0) | ((c.arg & RenderCommand::ClearDepth) ? GL_DEPTH_BUFFER_BIT : 0) | ((c.arg & RenderCommand::ClearStencil) ? GL_STENCIL_BUFFER_BIT : 0));
+			break;
+		case Op::BeginScene:
 			SetRenderStates();
-
-			glDepthFunc(GL_LESS);								// alpha polys seem to use gl_less (ocean hunter)
-
-			m_r3dShader.DiscardAlpha		(false);			// render only translucent pixels
-			m_r3dFrameBuffers.StoreDepth	();					// save depth buffer for 1st trans pass
-			m_r3dFrameBuffers.SetFBO		(Layer::trans1);
-			RenderScene						(pri, renderOverlay, Layer::trans1);
-
-			m_r3dFrameBuffers.RestoreDepth	();					// restore depth buffer, trans layers don't seem to depth test against each other
-			m_r3dFrameBuffers.SetFBO		(Layer::trans2);
-			RenderScene						(pri, renderOverlay, Layer::trans2);
-
+			break;
+		case Op::EndScene:
 			DisableRenderStates();
-
-			if (!hasOverlay) break;								// no high priority polys						
+			break;
+		case Op::DepthLess:
+			glDepthFunc(GL_LESS);
+			break;
+		case Op::DiscardAlpha:
+			m_r3dShader.DiscardAlpha(c.arg != 0);
+			break;
+		case Op::DrawList:
+			RenderScene(c.priority, c.overlay != 0, layers[c.arg]);
+			break;
+		case Op::ReadLos:
+			ReadLos(c.priority, m_nodes[c.node]);
+			break;
+		case Op::DrawOverTransLayers:
+			m_r3dFrameBuffers.DrawOverTransLayers();
+			break;
+		case Op::CompositeBaseLayer:
+			m_r3dFrameBuffers.CompositeBaseLayer();
+			break;
+		case Op::StoreDepth:
+			m_r3dFrameBuffers.StoreDepth();
+			break;
+		case Op::RestoreDepth:
+			m_r3dFrameBuffers.RestoreDepth();
+			break;
+		case Op::CompositeAlphaLayer:
+			m_r3dFrameBuffers.CompositeAlphaLayer();
+			break;
 		}
 	}
 
-	m_r3dFrameBuffers.CompositeAlphaLayer();
+	m_vbo.FenceSegment();							// segment can be rewritten once the gpu has drawn this frame
+
+	if (timed) {
+		glEndQuery(GL_TIME_ELAPSED);
+		m_timerPending[m_timerQuery] = true;
+		m_timerQuery = (m_timerQuery + 1) % NumTimerQueries;
+	}
+
+	m_r3dFrameBuffers.SetFBO(Layer::none);			// leave the back buffer's scissor box as we found it
 }
 
 void CNew3D::BeginFrame(void)
@@ -431,7 +929,7 @@ const UINT32* CNew3D::TranslateModelAddress(UINT32 modelAddr)
 	}
 }
 
-bool CNew3D::DrawModel(UINT32 modelAddr)
+bool CNew3D::DrawModel(BuildTask& task, UINT32 modelAddr)
 {
 	const UINT32*	modelAddress;
 	bool			cached = false;
@@ -440,20 +938,26 @@ bool CNew3D::DrawModel(UINT32 modelAddr)
 	modelAddress = TranslateModelAddress(modelAddr);
 
 	// create a new model to push onto the vector
-	m_nodes.back().models.emplace_back();
+	ReserveMore(task.models, 1, task.allocations);
+	task.models.emplace_back();
 
 	// get the last model in the array
-	m = &m_nodes.back().models.back();
+	m = &task.models.back();
 
 	if (IsVROMModel(modelAddr) && !IsDynamicModel((UINT32*)modelAddress)) {
 
 		// try to find meshes in the rom cache
 
-		m->meshes = m_romMap[modelAddr];	// will create an entry with a null pointer if empty
+		auto it = m_romMap.find(modelAddr);
 
-		if (m->meshes) {
+		if (it != m_romMap.end()) {
+			m->meshes = it->second;
 			cached = true;
 		}
+		else if (task.speculative) {
+			task.aborted = true;			// the cache is shared by all tasks, leave it to the in order run
+			return false;
+		}
 		else {
 			m->meshes = std::make_shared<std::vector<Mesh>>();
 			m_romMap[modelAddr] = m->meshes;		// store meshes in our rom map here
@@ -461,34 +965,44 @@ bool CNew3D::DrawModel(UINT32 modelAddr)
 
 		m->dynamic = false;
 	}
+	else if (FindDynamicModel(task, modelAddr, modelAddress, m)) {
+		cached = true;
+	}
 	else {
-		m->meshes = std::make_shared<std::vector<Mesh>>();
+		m->meshes = AllocMeshes(task);
 	}
 
 	// copy current model matrix
 	for (int i = 0; i < 16; i++) {
-		m->modelMat[i] = m_modelMat.currentMatrix[i];
+		m->modelMat[i] = task.modelMat.currentMatrix[i];
 	}
 
 	// update texture offsets
-	m->textureOffsetX = m_nodeAttribs.currentTexOffsetX;
-	m->textureOffsetY = m_nodeAttribs.currentTexOffsetY;
-	m->page = m_nodeAttribs.currentPage;
-	m->scale = m_nodeAttribs.currentModelScale;
+	m->textureOffsetX = task.nodeAttribs.currentTexOffsetX;
+	m->textureOffsetY = task.nodeAttribs.currentTexOffsetY;
+	m->page = task.nodeAttribs.currentPage;
+	m->scale = task.nodeAttribs.currentModelScale;
 
 	if (!cached) {
-		CacheModel(m, modelAddress);
+		CacheModel(task, m, modelAddress);
+		task.modelsCached++;
+
+		if (!task.dynamicModels.empty() && task.dynamicModels.back().model == task.models.size() - 1) {
+			auto& use = task.dynamicModels.back();
+			memcpy(use.prev, task.prev, sizeof(use.prev));
+			memcpy(use.prevTexCoords, task.prevTexCoords, sizeof(use.prevTexCoords));
+		}
 	}
 
-	if (m_nodeAttribs.currentClipStatus != Clip::INSIDE) {
-		ClipModel(m);	// not storing clipped values, only working out the Z range
+	if (task.nodeAttribs.currentClipStatus != Clip::INSIDE) {
+		ClipModel(task, m);	// not storing clipped values, only working out the Z range
 	}
 
 	return true;
 }
 
 // Descends into a 10-word culling node
-void CNew3D::DescendCullingNode(UINT32 addr)
+void CNew3D::DescendCullingNode(BuildTask& task, UINT32 addr, bool siblings)
 {
 	enum class NodeType { undefined = -1, viewport = 0, rootNode = 1, cullingNode = 2 };
 
@@ -498,11 +1012,11 @@ void CNew3D::DescendCullingNode(UINT32 addr)
 	UINT16			uCullRadius;
 	float			fCullRadius;
 	UINT16			uBlendRadius;
-	//float			fBlendRadius;
-	//UINT8			lodTablePointer;
+	float			fBlendRadius;
+	UINT8			lodTablePointer;
 	NodeType		nodeType;
 
-	if (m_nodeAttribs.StackLimit()) {
+	if (task.aborted || task.nodeAttribs.StackLimit()) {
 		return;
 	}
 
@@ -512,12 +1026,14 @@ void CNew3D::DescendCullingNode(UINT32 addr)
 		return;
 	}
 
+	NoteCullingRead(task, addr, 10);
+
 	// Extract known fields
 	nodeType		= (NodeType)(node[0x00] & 3);
 	child1Ptr		= node[0x07 - m_offset] & 0x7FFFFFF;	// mask colour table bits
 	sibling2Ptr		= node[0x08 - m_offset] & 0x1FFFFFF;	// mask colour table bits
 	matrixOffset	= node[0x03 - m_offset] & 0xFFF;
-	//lodTablePointer = (node[0x03 - m_offset] >> 12) & 0x7F;
+	lodTablePointer = (node[0x03 - m_offset] >> 12) & 0x7F;
 
 	// check our node type
 	if (nodeType == NodeType::viewport) {
@@ -525,76 +1041,84 @@ void CNew3D::DescendCullingNode(UINT32 addr)
 	}
 
 	// parse siblings 
-	if ((node[0x00] & 0x07) != 0x06) {						// colour table seems to indicate no siblings
+	if (siblings && (node[0x00] & 0x07) != 0x06) {			// colour table seems to indicate no siblings
 		if (!(sibling2Ptr & 0x1000000) && sibling2Ptr) {
-			DescendCullingNode(sibling2Ptr);				// no need to mask bit, would already be zero
+			DescendCullingNode(task, sibling2Ptr);			// no need to mask bit, would already be zero
 		}
 	}
 
 	if ((node[0x00] & 0x04)) {
-		m_colorTableAddr = ((node[0x03 - m_offset] >> 19) << 0) | ((node[0x07 - m_offset] >> 28) << 13) | ((node[0x08 - m_offset] >> 25) << 17);
-		m_colorTableAddr &= 0x000FFFFF; // clamp to 4MB (in words) range
+		task.colorTableAddr = ((node[0x03 - m_offset] >> 19) << 0) | ((node[0x07 - m_offset] >> 28) << 13) | ((node[0x08 - m_offset] >> 25) << 17);
+		task.colorTableAddr &= 0x000FFFFF; // clamp to 4MB (in words) range
+		task.colorTableSet = true;
 	}
 
-	m_nodeAttribs.Push();	// save current attribs
+	task.nodeAttribs.Push();	// save current attribs
 
 	if (!m_offset) {		// Step 1.5+
 
 		float modelScale = Util::Uint32AsFloat(node[1]);
 		if (modelScale > std::numeric_limits<float>::min()) {
-			m_nodeAttribs.currentModelScale = modelScale;
+			task.nodeAttribs.currentModelScale = modelScale;
 		}
 
 		// apply texture offsets, else retain current ones
 		if ((node[0x02] & 0x8000))	{
 			int tx = 32 * ((node[0x02] >> 7) & 0x3F);
 			int ty = 32 * (node[0x02] & 0x1F);
-			m_nodeAttribs.currentTexOffsetX	= tx;
-			m_nodeAttribs.currentTexOffsetY = ty;
-			m_nodeAttribs.currentPage = (node[0x02] & 0x4000) >> 14;
+			task.nodeAttribs.currentTexOffsetX	= tx;
+			task.nodeAttribs.currentTexOffsetY = ty;
+			task.nodeAttribs.currentPage = (node[0x02] & 0x4000) >> 14;
 		}
 	}
 
 	// Apply matrix and translation
-	m_modelMat.PushMatrix();
+	task.modelMat.PushMatrix();
 
 	// apply translation vector
 	if (node[0x00] & 0x10) {
 		float x = Util::Uint32AsFloat(node[0x04 - m_offset]);
 		float y = Util::Uint32AsFloat(node[0x05 - m_offset]);
 		float z = Util::Uint32AsFloat(node[0x06 - m_offset]);
-		m_modelMat.Translate(x, y, z);
+		task.modelMat.Translate(x, y, z);
 	}
 	// multiply matrix, if specified
 	else if (matrixOffset) {
-		MultMatrix(matrixOffset,m_modelMat);
+		MultMatrix(matrixOffset, task.matrixBasePtr, task.modelMat);
+		NoteCullingRead(task, task.matrixBase + matrixOffset * 12, 12);
 	}
 
 	uCullRadius = node[9 - m_offset] & 0xFFFF;
 	fCullRadius = R3DFloat::GetFloat16(uCullRadius);
 
 	uBlendRadius = node[9 - m_offset] >> 16;
-	//fBlendRadius = R3DFloat::GetFloat16(uBlendRadius);
+	fBlendRadius = R3DFloat::GetFloat16(uBlendRadius);
 
-	if (m_nodeAttribs.currentClipStatus != Clip::INSIDE) {
+	if (task.nodeAttribs.currentClipStatus != Clip::INSIDE) {
 
 		if (uCullRadius != R3DFloat::Pro16BitMax) {
 
 			CalcBox(fCullRadius, bbox);
-			TransformBox(m_modelMat, bbox);
+			TransformBox(task.modelMat, bbox);
 
-			m_nodeAttribs.currentClipStatus = ClipBox(bbox, m_planes);
+			task.nodeAttribs.currentClipStatus = ClipBox(bbox, task.planes);
 
-			if (m_nodeAttribs.currentClipStatus == Clip::INSIDE) {
-				CalcBoxExtents(bbox);
+			// geometry can't be nearer or further than the box corners, so if they are all in front of the camera
+			// the box gives a safe depth range, and the gpu clips whatever is off screen
+			if (m_gpuClipping && task.nodeAttribs.currentClipStatus == Clip::INTERCEPT && BoxInFront(bbox)) {
+				task.nodeAttribs.currentClipStatus = Clip::INSIDE;
+			}
+
+			if (task.nodeAttribs.currentClipStatus == Clip::INSIDE) {
+				CalcBoxExtents(task, bbox);
 			}
 		}
 		else {
-			m_nodeAttribs.currentClipStatus = Clip::NOT_SET;
+			task.nodeAttribs.currentClipStatus = Clip::NOT_SET;
 		}
 	}
 
-	if (m_nodeAttribs.currentClipStatus != Clip::OUTSIDE && fCullRadius > R3DFloat::Pro16BitFltMin) {
+	if (task.nodeAttribs.currentClipStatus != Clip::OUTSIDE && fCullRadius > R3DFloat::Pro16BitFltMin) {
 
 		// Descend down first link
 		if ((node[0x00] & 0x08))	// 4-element LOD table
@@ -602,50 +1126,90 @@ void CNew3D::DescendCullingNode(UINT32 addr)
 			lodTable = TranslateCullingAddress(child1Ptr);
 
 			if (NULL != lodTable) {
+				NoteCullingRead(task, child1Ptr, 4);
+				int lod = SelectLOD(task, lodTable, lodTablePointer, fBlendRadius);
 				if ((node[0x03 - m_offset] & 0x20000000)) {
-					DescendCullingNode(lodTable[0] & 0xFFFFFF);
+					DescendCullingNode(task, lodTable[lod] & 0xFFFFFF);
 				}
 				else {
-					DrawModel(lodTable[0] & 0xFFFFFF);	//TODO
+					DrawModel(task, lodTable[lod] & 0xFFFFFF);
 				}
 			}
 		}
 		else {
-			DescendNodePtr(child1Ptr);
+			DescendNodePtr(task, child1Ptr);
 		}
 
 	}
 
-	m_modelMat.PopMatrix();
+	task.modelMat.PopMatrix();
 
 	// Restore old texture offsets
-	m_nodeAttribs.Pop();
+	task.nodeAttribs.Pop();
 }
 
-void CNew3D::DescendNodePtr(UINT32 nodeAddr)
+// Picks the entry of a 4-element LOD table to draw for the distance of the current node from the camera. Each level is
+// drawn from its start range until it has faded halfway out over the blend radius before its delete range. Beyond the
+// last level the coarsest one is kept, the h/w fades it out but we can't. Tables that don't make sense draw level 0.
+int CNew3D::SelectLOD(const BuildTask& task, const UINT32* lodTable, UINT8 lodTablePointer, float blendRadius) const
 {
-	// Ignore null links
-	if ((nodeAddr & 0x00FFFFFF) == 0) {
-		return;
+	if (!task.lodBlendTable || m_lodDistanceScale == 0.0f) {
+		return 0;
 	}
 
-	switch ((nodeAddr >> 24) & 0x5)		// pointer type encoded in upper 8 bits
-	{
-	case 0x00:
-		DescendCullingNode(nodeAddr & 0xFFFFFF);
+	const float* m = task.modelMat.currentMatrix;
+	float distance = std::sqrt(m[12] * m[12] + m[13] * m[13] + m[14] * m[14]) * m_lodDistanceScale;
+	float blend = std::isfinite(blendRadius) ? std::max(blendRadius, 0.0f) * 0.5f : 0.0f;
+
+	const LODFeatureType& feature = task.lodBlendTable->table[lodTablePointer];
+	int lod = 0;
+
+	for (int i = 0; i < 4 && (lodTable[i] & 0xFFFFFF); i++) {
+
+		const LOD& range = feature.lod[i];
+
+		if (!std::isfinite(range.startRange) || !std::isfinite(range.deleteRange) || range.deleteRange <= range.startRange) {
+			return i ? lod : 0;
+		}
+
+		if (distance < range.startRange) {
+			break;
+		}
+
+		lod = i;
+
+		if (distance < range.deleteRange - blend) {
+			break;
+		}
+	}
+
+	return lod;
+}
+
+void CNew3D::DescendNodePtr(BuildTask& task, UINT32 nodeAddr)
+{
+	// Ignore null links
+	if ((nodeAddr & 0x00FFFFFF) == 0) {
+		return;
+	}
+
+	switch ((nodeAddr >> 24) & 0x5)		// pointer type encoded in upper 8 bits
+	{
+	case 0x00:
+		DescendCullingNode(task, nodeAddr & 0xFFFFFF);
 		break;
 	case 0x01:
-		DrawModel(nodeAddr & 0xFFFFFF);
+		DrawModel(task, nodeAddr & 0xFFFFFF);
 		break;
 	case 0x04:
-		DescendPointerList(nodeAddr & 0xFFFFFF);
+		DescendPointerList(task, nodeAddr & 0xFFFFFF);
 		break;
 	default:
 		break;
 	}
 }
 
-void CNew3D::DescendPointerList(UINT32 addr)
+void CNew3D::DescendPointerList(BuildTask& task, UINT32 addr)
 {
 	const UINT32*	list;
 	UINT32			nodeAddr;
@@ -661,13 +1225,15 @@ void CNew3D::DescendPointerList(UINT32 addr)
 
 	while (true) {
 
+		NoteCullingRead(task, addr + index, 1);
+
 		if (list[index] & 0x01000000) {
 			break;	// empty list
 		}
 
 		nodeAddr = list[index] & 0x00FFFFFF;	// clear upper 8 bits to ensure this is processed as a culling node
 
-		DescendCullingNode(nodeAddr);
+		DescendCullingNode(task, nodeAddr);
 
 		if (list[index] & 0x02000000) {
 			break;	// list end
@@ -692,12 +1258,12 @@ Matrix Stack
 * index is a 12-bit number specifying a matrix number relative to the base.
 * The base matrix MUST be set up before calling this function.
 */
-void CNew3D::MultMatrix(UINT32 matrixOffset, Mat4& mat)
+void CNew3D::MultMatrix(UINT32 matrixOffset, const float *matrixBasePtr, Mat4& mat)
 {
 	GLfloat		m[4*4];
-	const float	*src = &m_matrixBasePtr[matrixOffset * 12];
+	const float	*src = &matrixBasePtr[matrixOffset * 12];
 
-	if (m_matrixBasePtr == NULL)	// LA Machineguns
+	if (matrixBasePtr == NULL)	// LA Machineguns
 		return;
 
 	m[CMINDEX(0, 0)] = src[3];
@@ -747,9 +1313,11 @@ void CNew3D::MultMatrix(UINT32 matrixOffset, Mat4& mat)
 * function inserts a compensating matrix to undo these things.
 *
 * NOTE: This function assumes we are in GL_MODELVIEW matrix mode.
+*
+* Returns the matrix base pointer for MultMatrix().
 */
 
-void CNew3D::InitMatrixStack(UINT32 matrixBaseAddr, Mat4& mat)
+const float *CNew3D::InitMatrixStack(UINT32 matrixBaseAddr, Mat4& mat)
 {
 	GLfloat m[4 * 4];
 
@@ -763,13 +1331,16 @@ void CNew3D::InitMatrixStack(UINT32 matrixBaseAddr, Mat4& mat)
 	mat.LoadMatrix(m);
 
 	// Set matrix base address and apply matrix #0 (coordinate system matrix)
-	m_matrixBasePtr = (float *)TranslateCullingAddress(matrixBaseAddr);
-	MultMatrix(0, mat);
+	const float *matrixBasePtr = (float *)TranslateCullingAddress(matrixBaseAddr);
+	MultMatrix(0, matrixBasePtr, mat);
+
+	return matrixBasePtr;
 }
 
 // Draws viewports of the given priority
 void CNew3D::RenderViewport(UINT32 addr)
 {
+	Trace::Scope scope("RenderViewport");
 	static const GLfloat	color[8][3] =
 	{											// RGB1 color translation
 		{ 0.0f, 0.0f, 0.0f },	// off
@@ -782,149 +1353,802 @@ void CNew3D::RenderViewport(UINT32 addr)
 		{ 1.0f, 1.0f, 1.0f }	// white
 	};
 
-	if ((addr & 0x00FFFFFF) == 0) {
-		return;
+	if ((addr & 0x00FFFFFF) == 0) {
+		return;
+	}
+
+	// Translate address and obtain pointer
+	const uint32_t *vpnode = TranslateCullingAddress(addr);
+
+	if (NULL == vpnode) {
+		return;
+	}
+
+	if (!(vpnode[0] & 0x20)) {	// only if viewport enabled
+
+		// create node object 
+		ReserveMore(m_nodes, 1, m_frameAllocations);
+		m_nodes.emplace_back(Node());
+
+		if (m_modelArrays.empty()) {
+			m_nodes.back().models.reserve(2048);			// create space for models
+			m_frameAllocations++;
+		}
+		else {
+			m_nodes.back().models = std::move(m_modelArrays.back());
+			m_modelArrays.pop_back();
+		}
+
+		// get pointer to its viewport
+		Viewport *vp = &m_nodes.back().viewport;
+
+		// traversal state shared by the tasks of this viewport
+		BuildTask base;
+		base.node = m_nodes.size() - 1;
+
+		vp->priority	= (vpnode[0] >> 3) & 0x3;
+		vp->select		= (vpnode[0] >> 8) & 0x3;
+		vp->number		= (vpnode[0] >> 10);
+		base.priority	= vp->priority;
+
+		// Fetch viewport parameters (TO-DO: would rounding make a difference?)
+		vp->vpX			= (int)(((vpnode[0x1A] & 0xFFFF) * (float)(1.0 / 16.0)) + 0.5f);		// viewport X (12.4 fixed point)
+		vp->vpY			= (int)(((vpnode[0x1A] >> 16) * (float)(1.0 / 16.0)) + 0.5f);			// viewport Y (12.4)
+		vp->vpWidth		= (int)(((vpnode[0x14] & 0xFFFF) * (float)(1.0 / 4.0)) + 0.5f);		// width (14.2)
+		vp->vpHeight	= (int)(((vpnode[0x14] >> 16) * (float)(1.0 / 4.0)) + 0.5f);			// height (14.2)
+
+		uint32_t matrixBase	= vpnode[0x16] & 0xFFFFFF;							// matrix base address
+
+		base.lodBlendTableAddr	= vpnode[0x17] & 0xFFFFFF;
+		base.lodBlendTable		= (const LODBlendTable*)TranslateCullingAddress(base.lodBlendTableAddr);
+
+		/*
+		vp->angle_left		= -atan2f(Util::Uint32AsFloat(vpnode[12]),  Util::Uint32AsFloat(vpnode[13]));	// These values work out as the normals for the clipping planes.
+		vp->angle_right		=  atan2f(Util::Uint32AsFloat(vpnode[16]), -Util::Uint32AsFloat(vpnode[17]));	// Sometimes these values (dirt devils,lost world) are totally wrong
+		vp->angle_top		=  atan2f(Util::Uint32AsFloat(vpnode[14]),  Util::Uint32AsFloat(vpnode[15]));	// and don't work for the frustum values exactly.
+		vp->angle_bottom	= -atan2f(Util::Uint32AsFloat(vpnode[18]), -Util::Uint32AsFloat(vpnode[19]));	// Perhaps they are just used for culling and not rendering.
+		*/
+
+		float cv = Util::Uint32AsFloat(vpnode[0x8]);	// 1/(left-right)
+		float cw = Util::Uint32AsFloat(vpnode[0x9]);	// 1/(top-bottom)
+		float io = Util::Uint32AsFloat(vpnode[0xa]);	// top / bottom (ratio) - ish
+		float jo = Util::Uint32AsFloat(vpnode[0xb]);	// left / right (ratio)
+
+		vp->angle_left		= (0.0f - jo) / cv;
+		vp->angle_right		= (1.0f - jo) / cv;
+		vp->angle_bottom	= -(1.0f - io)/ cw;
+		vp->angle_top		= -(0.0f - io)/ cw;
+
+		// calculate the frustum shape, near/far pair are dummy values
+		CalcViewport(vp, 1.f, 1000.f);
+
+		// calculate frustum planes
+		CalcFrustumPlanes(base.planes, vp->projectionMatrix);	// we need to calc a 'projection matrix' to get the correct frustum planes for clipping
+
+		// Lighting (note that sun vector points toward sun -- away from vertex)
+		vp->lightingParams[0] =  Util::Uint32AsFloat(vpnode[0x05]);							// sun X
+		vp->lightingParams[1] = -Util::Uint32AsFloat(vpnode[0x06]);							// sun Y (- to convert to ogl cordinate system)
+		vp->lightingParams[2] = -Util::Uint32AsFloat(vpnode[0x04]);							// sun Z (- to convert to ogl cordinate system)
+		vp->lightingParams[3] = std::max(0.f, std::min(Util::Uint32AsFloat(vpnode[0x07]), 1.0f));	// sun intensity (clamp to 0-1)
+		vp->lightingParams[4] = (float)((vpnode[0x24] >> 8) & 0xFF) * (float)(1.0 / 255.0);	// ambient intensity
+		vp->lightingParams[5] = 0.0f;	// reserved
+		
+		vp->sunClamp		= m_sunClamp;
+		vp->intensityClamp	= (m_step == 0x10);		// just step 1.0 ?
+		vp->hardwareStep	= m_step;
+		
+		// Spotlight
+		int spotColorIdx = (vpnode[0x20] >> 11) & 7;									// spotlight color index
+		int spotFogColorIdx = (vpnode[0x20] >> 8) & 7;									// spotlight on fog color index
+		vp->spotEllipse[0] = (float)(INT16)(vpnode[0x1E] & 0xFFFF) * (float)(1.0 / 8.0);// spotlight X position (13.3 fixed point)
+		vp->spotEllipse[1] = (float)(INT16)(vpnode[0x1D] & 0xFFFF) * (float)(1.0 / 8.0);// spotlight Y
+		vp->spotEllipse[2] = (float)((vpnode[0x1E] >> 16) & 0xFFFF);					// spotlight X size (16-bit)
+		vp->spotEllipse[3] = (float)((vpnode[0x1D] >> 16) & 0xFFFF);					// spotlight Y size
+
+		vp->spotRange[0] = 1.0f / Util::Uint32AsFloat(vpnode[0x21]);					// spotlight start
+		vp->spotRange[1] = Util::Uint32AsFloat(vpnode[0x1F]);							// spotlight extent
+
+		vp->spotColor[0] = color[spotColorIdx][0];										// spotlight color
+		vp->spotColor[1] = color[spotColorIdx][1];
+		vp->spotColor[2] = color[spotColorIdx][2];
+
+		vp->spotFogColor[0] = color[spotFogColorIdx][0];								// spotlight color on fog
+		vp->spotFogColor[1] = color[spotFogColorIdx][1];
+		vp->spotFogColor[2] = color[spotFogColorIdx][2];
+
+		// spotlight is specified in terms of physical resolution
+		vp->spotEllipse[1] = 384.0f - vp->spotEllipse[1];								// flip Y position
+
+		// Avoid division by zero
+		vp->spotEllipse[2] = std::max(1.0f, vp->spotEllipse[2]);
+		vp->spotEllipse[3] = std::max(1.0f, vp->spotEllipse[3]);
+
+		vp->spotEllipse[2] = std::roundf(2047.0f / vp->spotEllipse[2]);
+		vp->spotEllipse[3] = std::roundf(2047.0f / vp->spotEllipse[3]);
+
+		// Scale the spotlight to the OpenGL viewport
+		vp->spotEllipse[0] = (vp->spotEllipse[0] * m_xRatio + (float)m_xOffs) * m_renderScale;
+		vp->spotEllipse[1] = (vp->spotEllipse[1] * m_yRatio + (float)m_yOffs) * m_renderScale;
+		vp->spotEllipse[2] *= m_xRatio * m_renderScale;
+		vp->spotEllipse[3] *= m_yRatio * m_renderScale;
+
+		// Line of sight position
+		vp->losPosX = (int)(((vpnode[0x1c] & 0xFFFF) / 16.0f) + 0.5f);					// x position
+		vp->losPosY = (int)(((vpnode[0x1c] >> 16) / 16.0f) + 0.5f);						// y position 0 starts from the top
+
+		// Fog
+		vp->fogParams[0] = (float)((vpnode[0x22] >> 16) & 0xFF) * (float)(1.0 / 255.0);	// fog color R
+		vp->fogParams[1] = (float)((vpnode[0x22] >> 8) & 0xFF) * (float)(1.0 / 255.0);	// fog color G
+		vp->fogParams[2] = (float)((vpnode[0x22] >> 0) & 0xFF) * (float)(1.0 / 255.0);	// fog color B
+		vp->fogParams[3] = std::abs(Util::Uint32AsFloat(vpnode[0x23]));					// fog density	- ocean hunter uses negative values, but looks the same
+		vp->fogParams[4] = (float)(INT16)(vpnode[0x25] & 0xFFFF)* (float)(1.0 / 255.0);	// fog start
+
+		// Avoid Infinite and NaN values for Star Wars Trilogy
+		if (std::isinf(vp->fogParams[3]) || std::isnan(vp->fogParams[3])) {
+			for (int i = 0; i < 7; i++) vp->fogParams[i] = 0.0f;
+		}
+
+		vp->fogParams[5] = (float)((vpnode[0x24] >> 16) & 0xFF) * (float)(1.0 / 255.0);	// fog attenuation
+		vp->fogParams[6] = (float)((vpnode[0x25] >> 16) & 0xFF) * (float)(1.0 / 255.0);	// fog ambient
+
+		vp->scrollFog = (float)(vpnode[0x20] & 0xFF) * (float)(1.0 / 255.0);				// scroll fog
+		vp->scrollAtt = (float)(vpnode[0x24] & 0xFF) * (float)(1.0 / 255.0);				// scroll attenuation
+
+		// Set up coordinate system and base matrix
+		base.matrixBase = matrixBase;
+		base.matrixBasePtr = InitMatrixStack(matrixBase, base.modelMat);
+		memcpy(base.baseMatrix, base.modelMat.currentMatrix, sizeof(base.baseMatrix));
+
+		// Descend down the node link. Need to start with a culling node because that defines our culling radius.
+		auto childptr = vpnode[0x02];
+		if (((childptr >> 24) & 0x5) == 0 && (childptr & 0x00FFFFFF)) {
+			AddBuildTasks(childptr & 0xFFFFFF, base);
+		}
+	}
+
+	// render next viewport
+	if (vpnode[0x01] != 0x01000000) {
+		RenderViewport(vpnode[0x01]);
+	}
+}
+
+// Splits the first culling node of a viewport and its siblings into tasks. Siblings are descended before the node
+// that links to them, so the chain is traversed back to front, each node starting from the viewport state.
+void CNew3D::AddBuildTasks(UINT32 nodeAddr, const BuildTask& base)
+{
+	std::vector<UINT32>& chain = m_buildChain;
+
+	chain.clear();
+
+	while (chain.size() < 0x10000) {			// don't hang on a sibling loop
+
+		const UINT32* cullingNode = TranslateCullingAddress(nodeAddr);
+
+		if (NULL == cullingNode || (cullingNode[0x00] & 3) == 0) {
+			break;								// viewport nodes aren't rendered
+		}
+
+		ReserveMore(chain, 1, m_frameAllocations);
+		chain.push_back(nodeAddr);
+
+		UINT32 sibling2Ptr = cullingNode[0x08 - m_offset] & 0x1FFFFFF;
+
+		if ((cullingNode[0x00] & 0x07) == 0x06 || (sibling2Ptr & 0x1000000) || !sibling2Ptr) {
+			break;
+		}
+
+		nodeAddr = sibling2Ptr;
+	}
+
+	if (chain.empty()) {
+		return;
+	}
+
+	std::reverse(chain.begin(), chain.end());
+
+	// a few tasks per thread, subtrees can differ a lot in size
+	unsigned numWorkers = CThread::GetJobPool()->GetNumWorkers();
+	size_t numTasks = numWorkers ? std::min(chain.size(), (size_t)(numWorkers + 1) * 4) : 1;
+
+	for (size_t i = 0; i < numTasks; i++) {
+
+		if (m_numBuildTasks == m_buildTasks.size()) {
+			ReserveMore(m_buildTasks, 1, m_frameAllocations);
+			m_buildTasks.emplace_back();			// tasks keep their memory from frame to frame
+		}
+
+		BuildTask& task = m_buildTasks[m_numBuildTasks++];
+
+		auto first	= chain.begin() + (chain.size() * i) / numTasks;
+		auto last	= chain.begin() + (chain.size() * (i + 1)) / numTasks;
+
+		// the same nodes descended from the same viewport state as last frame
+		task.reuse = task.frame + 1 == m_frameCount
+			&& task.priority == base.priority
+			&& task.matrixBase == base.matrixBase
+			&& task.lodBlendTableAddr == base.lodBlendTableAddr
+			&& task.roots.size() == (size_t)(last - first)
+			&& std::equal(first, last, task.roots.begin())
+			&& !memcmp(task.baseMatrix, base.baseMatrix, sizeof(task.baseMatrix))
+			&& !memcmp(task.planes, base.planes, sizeof(task.planes))
+			&& CanReuseBuildTask(task);
+
+		task.node				= base.node;
+		task.matrixBasePtr		= base.matrixBasePtr;
+		task.matrixBase			= base.matrixBase;
+		task.lodBlendTable		= base.lodBlendTable;
+		task.lodBlendTableAddr	= base.lodBlendTableAddr;
+		task.priority			= base.priority;
+		task.allocations		= 0;
+
+		if (task.reuse) {
+			continue;
+		}
+
+		memcpy(task.baseMatrix, base.baseMatrix, sizeof(task.baseMatrix));
+		std::copy(base.planes, base.planes + 5, task.planes);
+
+		task.roots.clear();
+		ReserveMore(task.roots, last - first, m_frameAllocations);
+		task.roots.insert(task.roots.end(), first, last);
+	}
+}
+
+// Culling RAM reads are merged with the one before where they follow on, as the nodes of a list often do
+void CNew3D::NoteCullingRead(BuildTask& task, UINT32 addr, UINT32 words)
+{
+	if (!m_cullingRAMLoDirty || !m_cullingRAMHiDirty) {
+		return;
+	}
+
+	addr &= 0x00FFFFFF;
+
+	if (!task.cullingReads.empty()) {
+
+		auto& last = task.cullingReads.back();
+
+		if (addr >= last.addr && addr <= last.addr + last.words) {
+			last.words = std::max(last.words, addr + words - last.addr);
+			return;
+		}
+	}
+
+	ReserveMore(task.cullingReads, 1, task.allocations);
+	task.cullingReads.push_back({ addr, words });
+}
+
+bool CNew3D::IsCullingRAMDirty(UINT32 addr, UINT32 words) const
+{
+	if ((addr >= 0x800000) && (addr < 0x840000)) {
+		return m_cullingRAMHiDirty->IsDirty((addr & 0x3FFFF) * 4, words * 4);
+	}
+	else if (addr < 0x100000) {
+		return m_cullingRAMLoDirty->IsDirty(addr * 4, words * 4);
+	}
+
+	return false;		// not translated, so never read
+}
+
+bool CNew3D::CanReuseBuildTask(const BuildTask& task)
+{
+	if (!m_cullingRAMLoDirty || !m_cullingRAMHiDirty || !m_polyRAMDirty) {
+		return false;
+	}
+
+	// dynamic polys would have to be copied again, and models decoded from polygon RAM without an entry in the
+	// dynamic model cache have no record of what they read
+	for (const auto& m : task.models) {
+		if (m.dynamic) {
+			return false;
+		}
+	}
+
+	for (const auto& read : task.cullingReads) {
+		if (IsCullingRAMDirty(read.addr, read.words)) {
+			return false;
+		}
+	}
+
+	// as in FindDynamicModel
+	for (const auto& use : task.dynamicModels) {
+
+		const ModelContents& contents = use.contents;
+
+		if (!use.cached) {
+			return false;
+		}
+
+		if (!IsVROMModel(use.addr) && m_polyRAMDirty->IsDirty(use.addr * 4, contents.numWords * 4)) {
+			return false;
+		}
+
+		if (contents.colorMin <= contents.colorMax && m_polyRAMDirty->IsDirty((contents.colorTableAddr + contents.colorMin) * 4, (contents.colorMax - contents.colorMin + 1) * 4)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// The tasks before may have drawn the same models with other colour tables, replacing them in the cache, in which
+// case a traversal would decode them again
+bool CNew3D::AreDynamicModelsCurrent(const BuildTask& task) const
+{
+	for (const auto& use : task.dynamicModels) {
+
+		auto it = m_dynamicModels.find(use.addr);
+
+		if (it == m_dynamicModels.end() || it->second.meshes != task.models[use.model].meshes || it->second.contents.hash != use.contents.hash || it->second.contents.numWords != use.contents.numWords) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CNew3D::StartBuildTask(BuildTask& task, UINT32 colorTableAddr, const Vertex prev[4], const UINT16 prevTexCoords[4][2], bool speculative)
+{
+	task.modelMat.Release();
+	task.modelMat.LoadMatrix(task.baseMatrix);
+	task.nodeAttribs.Reset();
+
+	task.colorTableAddr = colorTableAddr;
+	memcpy(task.prev, prev, sizeof(task.prev));
+	memcpy(task.prevTexCoords, prevTexCoords, sizeof(task.prevTexCoords));
+
+	task.startColorTableAddr = colorTableAddr;
+	memcpy(task.startPrev, prev, sizeof(task.startPrev));
+	memcpy(task.startPrevTexCoords, prevTexCoords, sizeof(task.startPrevTexCoords));
+
+	task.colorTableSet	= false;
+	task.prevSet		= false;
+	task.colorTableRead	= false;
+	task.prevRead		= false;
+	task.speculative	= speculative;
+	task.aborted		= false;
+
+	task.models.clear();
+	task.modelsCached = 0;
+	task.polyBufferRam.clear();
+	task.meshArraysUsed = 0;
+	task.dynamicModels.clear();
+	task.nfPair.zNear	= -std::numeric_limits<float>::max();
+	task.nfPair.zFar	=  std::numeric_limits<float>::max();
+
+	task.cullingReads.clear();
+
+	if (task.lodBlendTable) {
+		NoteCullingRead(task, task.lodBlendTableAddr, sizeof(LODBlendTable) / 4);
+	}
+}
+
+void CNew3D::RunBuildTask(BuildTask& task)
+{
+	Trace::Scope scope("RunBuildTask");
+	for (auto addr : task.roots) {
+		DescendCullingNode(task, addr, false);
+	}
+}
+
+void CNew3D::BuildModels()
+{
+	Trace::Scope scope("BuildModels");
+	CJobPool* pool = CThread::GetJobPool();
+	bool speculate = pool->GetNumWorkers() && m_numBuildTasks > 1;
+
+	// Tasks first run in parallel, starting with the state the last frame ended with. Any that turn out to have
+	// needed the state left by the tasks before them, or to add a model to the ROM cache, run again below in order,
+	// so the scene is always the same as a traversal on one thread.
+	if (speculate) {
+		pool->Run("New3D traversal", (unsigned)m_numBuildTasks, [this](unsigned i) {
+			if (m_buildTasks[i].reuse) {
+				return;
+			}
+			StartBuildTask(m_buildTasks[i], m_colorTableAddr, m_prev, m_prevTexCoords, true);
+			RunBuildTask(m_buildTasks[i]);
+		});
+	}
+
+	UINT32	colorTableAddr = m_colorTableAddr;
+	Vertex	prev[4];
+	UINT16	prevTexCoords[4][2];
+
+	memcpy(prev, m_prev, sizeof(prev));
+	memcpy(prevTexCoords, m_prevTexCoords, sizeof(prevTexCoords));
+
+	for (size_t i = 0; i < m_numBuildTasks; i++) {
+
+		BuildTask& task = m_buildTasks[i];
+		bool valid = task.reuse ? AreDynamicModelsCurrent(task) : speculate && !task.aborted;
+
+		if (task.colorTableRead && colorTableAddr != task.startColorTableAddr) {
+			valid = false;
+		}
+
+		if (task.prevRead && (memcmp(prev, task.startPrev, sizeof(prev)) || memcmp(prevTexCoords, task.startPrevTexCoords, sizeof(prevTexCoords)))) {
+			valid = false;
+		}
+
+		if (task.reuse) {
+			task.modelsCached = 0;
+		}
+
+		if (!valid) {
+			StartBuildTask(task, colorTableAddr, prev, prevTexCoords, false);
+			RunBuildTask(task);
+		}
+
+		if (task.colorTableSet) {
+			colorTableAddr = task.colorTableAddr;
+		}
+
+		if (task.prevSet) {
+			memcpy(prev, task.prev, sizeof(prev));
+			memcpy(prevTexCoords, task.prevTexCoords, sizeof(prevTexCoords));
+		}
+
+		UpdateDynamicModels(task);
+
+		// dynamic polys follow those of the tasks before
+		int polyBase = AppendRamVerts(task.polyBufferRam);
+
+		for (auto& m : task.models) {
+			if (m.dynamic) {
+				for (auto& mesh : *m.meshes) {
+					if (polyBase < 0) {
+						mesh.vertexCount = 0;	// out of space, drop the model for this frame
+					}
+					mesh.vboOffset += polyBase;
+				}
+			}
+		}
+
+		auto& models = m_nodes[task.node].models;
+		ReserveMore(models, task.models.size(), m_frameAllocations);
+
+		if (m_cullingRAMLoDirty && m_cullingRAMHiDirty) {
+			models.insert(models.end(), task.models.begin(), task.models.end());		// kept in case next frame can reuse them
+		}
+		else {
+			models.insert(models.end(), std::make_move_iterator(task.models.begin()), std::make_move_iterator(task.models.end()));
+		}
+
+		m_nfPairs[task.priority].zNear	= std::max(task.nfPair.zNear, m_nfPairs[task.priority].zNear);
+		m_nfPairs[task.priority].zFar	= std::min(task.nfPair.zFar, m_nfPairs[task.priority].zFar);
+
+		m_frameAllocations += task.allocations;
+		m_frameModelsCached += task.modelsCached;
+
+		task.frame = m_frameCount;
+	}
+
+	m_colorTableAddr = colorTableAddr;
+	memcpy(m_prev, prev, sizeof(m_prev));
+	memcpy(m_prevTexCoords, prevTexCoords, sizeof(m_prevTexCoords));
+
+	// forget models that haven't been drawn for a while
+	if ((m_frameCount & 1023) == 0) {
+		for (auto it = m_dynamicModels.begin(); it != m_dynamicModels.end(); ) {
+			if (it->second.frame + 1024 < m_frameCount) {
+				it = m_dynamicModels.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	m_frameCount++;
+}
+
+// The vrom model cache file holds the meshes of each model in m_romMap, with their vertices. Models are only
+// decoded from vrom, so they are the same every run as long as vrom and the settings in the header are.
+namespace {
+	struct RomModelCacheHeader
+	{
+		char	magic[8];
+		UINT32	version;
+		UINT32	vertexSize;
+		UINT32	meshSize;
+		UINT32	numPolyVerts;
+		UINT32	shadeIsSigned;
+		float	vertexFactor;
+		UINT32	numVerts;			// contents
+		UINT32	numModels;
+	};
+
+	struct RomModelCacheEntry
+	{
+		UINT32	addr;
+		UINT32	numMeshes;
+	};
+
+	static_assert(std::is_trivially_copyable<Mesh>::value && std::is_trivially_copyable<PackedVertex>::value, "vrom model cache stores meshes and vertices as is");
+}
+
+static RomModelCacheHeader MakeRomModelCacheHeader(int numPolyVerts, bool shadeIsSigned, float vertexFactor)
+{
+	RomModelCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "SMN3DVRM", sizeof(header.magic));
+	header.version			= ROM_MODEL_CACHE_VERSION;
+	header.vertexSize		= sizeof(PackedVertex);
+	header.meshSize			= sizeof(Mesh);
+	header.numPolyVerts		= numPolyVerts;
+	header.shadeIsSigned	= shadeIsSigned;
+	header.vertexFactor		= vertexFactor;
+	return header;
+}
+
+void CNew3D::LoadRomModelCache()
+{
+	m_romCacheLoaded = true;
+
+	if (m_romCacheDir.empty() || !m_vrom || !m_polyBufferRom.empty()) {
+		return;
+	}
+
+	UINT32 key = (UINT32)crc32(0, (const Bytef*)m_vrom, 0x4000000);
+	m_romCacheFile = ROMCache::GetFilePath(m_romCacheDir, m_gameName + "-new3d", key);
+
+	FILE* fp = fopen(m_romCacheFile.c_str(), "rb");
+	if (!fp) {
+		return;		// nothing cached yet
+	}
+
+	RomModelCacheHeader expected = MakeRomModelCacheHeader(m_numPolyVerts, m_shadeIsSigned, m_vertexFactor);
+	RomModelCacheHeader header;
+
+	std::vector<PackedVertex> verts;
+	std::unordered_map<UINT32, std::shared_ptr<std::vector<Mesh>>> romMap;
+
+	bool error = fread(&header, sizeof(header), 1, fp) != 1 || memcmp(&header, &expected, offsetof(RomModelCacheHeader, numVerts)) || header.numVerts >= MAX_ROM_VERTS;
+
+	if (!error) {
+		verts.resize(header.numVerts);
+		error = fread(verts.data(), sizeof(PackedVertex), verts.size(), fp) != verts.size();
+	}
+
+	for (UINT32 i = 0; i < header.numModels && !error; i++) {
+
+		RomModelCacheEntry entry;
+		error = fread(&entry, sizeof(entry), 1, fp) != 1 || entry.numMeshes > 0x10000;
+
+		if (!error) {
+			auto meshes = std::make_shared<std::vector<Mesh>>(entry.numMeshes);
+			error = fread(meshes->data(), sizeof(Mesh), meshes->size(), fp) != meshes->size();
+
+			for (const auto& mesh : *meshes) {
+				error = error || mesh.vboOffset < 0 || mesh.vertexCount < 0 || (size_t)mesh.vboOffset + mesh.vertexCount > verts.size();
+			}
+
+			romMap[entry.addr] = meshes;
+		}
+	}
+
+	fclose(fp);
+
+	if (error) {
+		ErrorLog("Ignoring video ROM model cache '%s', which does not match this version of Supermodel.", m_romCacheFile.c_str());
+		return;
+	}
+
+	m_polyBufferRom.swap(verts);
+	m_romMap.swap(romMap);
+	m_romCacheModels = m_romMap.size();
+
+	InfoLog("Loaded %u video ROM models from '%s'.", (unsigned)m_romCacheModels, m_romCacheFile.c_str());
+}
+
+void CNew3D::SaveRomModelCache()
+{
+	if (m_romCacheFile.empty() || m_romMap.size() <= m_romCacheModels) {
+		return;		// nothing new since loaded
+	}
+
+	// m_polyBufferRom also holds promoted dynamic models, only the vertices of rom models are kept
+	std::vector<PackedVertex> verts;
+	std::vector<Mesh> meshes;
+
+	for (const auto& e : m_romMap) {
+		for (const auto& mesh : *e.second) {
+			verts.insert(verts.end(), m_polyBufferRom.begin() + mesh.vboOffset, m_polyBufferRom.begin() + mesh.vboOffset + mesh.vertexCount);
+		}
+	}
+
+	RomModelCacheHeader header = MakeRomModelCacheHeader(m_numPolyVerts, m_shadeIsSigned, m_vertexFactor);
+	header.numVerts		= (UINT32)verts.size();
+	header.numModels	= (UINT32)m_romMap.size();
+
+	// write to a temporary file first so a partial file is never read
+	std::string tempFile = m_romCacheFile + ".tmp";
+	FILE* fp = fopen(tempFile.c_str(), "wb");
+
+	if (!fp) {
+		ErrorLog("Unable to create video ROM model cache '%s'.", m_romCacheFile.c_str());
+		return;
+	}
+
+	bool error = fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(verts.data(), sizeof(PackedVertex), verts.size(), fp) != verts.size();
+	int offset = 0;
+
+	for (const auto& e : m_romMap) {
+
+		RomModelCacheEntry entry = { e.first, (UINT32)e.second->size() };
+		meshes.assign(e.second->begin(), e.second->end());
+
+		for (auto& mesh : meshes) {
+			mesh.vboOffset	= offset;
+			offset			+= mesh.vertexCount;
+		}
+
+		error = error || fwrite(&entry, sizeof(entry), 1, fp) != 1 || fwrite(meshes.data(), sizeof(Mesh), meshes.size(), fp) != meshes.size();
+	}
+
+	error = fclose(fp) != 0 || error;
+
+	if (!error) {
+		remove(m_romCacheFile.c_str());		// rename() won't replace an existing file on Windows
+		error = rename(tempFile.c_str(), m_romCacheFile.c_str()) != 0;
+	}
+
+	if (error) {
+		remove(tempFile.c_str());
+		ErrorLog("Unable to write video ROM model cache '%s'.", m_romCacheFile.c_str());
+		return;
+	}
+
+	InfoLog("Wrote %u video ROM models to '%s'.", (unsigned)m_romMap.size(), m_romCacheFile.c_str());
+}
+
+// Dynamic polys go straight into this frame's mapped vbo segment if there is one, otherwise they are staged
+// in m_polyBufferRam and uploaded in one go before drawing.
+int CNew3D::AppendRamVerts(const std::vector<PackedVertex>& verts)
+{
+	if (m_numRamVerts + verts.size() > MAX_RAM_VERTS) {
+		return -1;
+	}
+
+	int base = m_ramVertsBase + m_numRamVerts;
+
+	if (m_ramVerts) {
+		std::copy(verts.begin(), verts.end(), m_ramVerts + m_numRamVerts);
+	}
+	else {
+		ReserveMore(m_polyBufferRam, verts.size(), m_frameAllocations);
+		m_polyBufferRam.insert(m_polyBufferRam.end(), verts.begin(), verts.end());
+	}
+
+	m_numRamVerts += (int)verts.size();
+
+	return base;
+}
+
+// Looks for a dynamic model with the same contents as when it was last drawn. The cache is only read here, the
+// task keeps a record of the model for UpdateDynamicModels().
+bool CNew3D::FindDynamicModel(BuildTask& task, UINT32 modelAddr, const UINT32 *data, Model *m)
+{
+	if (data == NULL) {
+		return false;
 	}
 
-	// Translate address and obtain pointer
-	const uint32_t *vpnode = TranslateCullingAddress(addr);
+	PolyHeader ph((UINT32*)data);
 
-	if (NULL == vpnode) {
-		return;
+	for (int i = 0; i < 4; i++) {
+		if (ph.SharedVertex(i)) {
+			return false;				// starts with vertices of the model before, can't be reused on its own
+		}
 	}
 
-	if (!(vpnode[0] & 0x20)) {	// only if viewport enabled
+	auto it = m_dynamicModels.find(modelAddr);
+	const DynamicModel* entry = (it != m_dynamicModels.end()) ? &it->second : nullptr;
 
-		// create node object 
-		m_nodes.emplace_back(Node());
-		m_nodes.back().models.reserve(2048);				// create space for models
+	ModelContents contents;
+	bool clean = false;
 
-		// get pointer to its viewport
-		Viewport *vp = &m_nodes.back().viewport;
+	// with nothing written to the pages it came from since last frame, the model is as it was
+	if (entry && m_polyRAMDirty && entry->frame + 1 == m_frameCount) {
 
-		vp->priority	= (vpnode[0] >> 3) & 0x3;
-		vp->select		= (vpnode[0] >> 8) & 0x3;
-		vp->number		= (vpnode[0] >> 10);
-		m_currentPriority = vp->priority;
+		const ModelContents& last = entry->contents;
 
-		// Fetch viewport parameters (TO-DO: would rounding make a difference?)
-		vp->vpX			= (int)(((vpnode[0x1A] & 0xFFFF) * (float)(1.0 / 16.0)) + 0.5f);		// viewport X (12.4 fixed point)
-		vp->vpY			= (int)(((vpnode[0x1A] >> 16) * (float)(1.0 / 16.0)) + 0.5f);			// viewport Y (12.4)
-		vp->vpWidth		= (int)(((vpnode[0x14] & 0xFFFF) * (float)(1.0 / 4.0)) + 0.5f);		// width (14.2)
-		vp->vpHeight	= (int)(((vpnode[0x14] >> 16) * (float)(1.0 / 4.0)) + 0.5f);			// height (14.2)
+		clean = IsVROMModel(modelAddr) || !m_polyRAMDirty->IsDirty(modelAddr * 4, last.numWords * 4);
 
-		uint32_t matrixBase	= vpnode[0x16] & 0xFFFFFF;							// matrix base address
+		if (clean && last.colorMin <= last.colorMax) {
+			clean = last.colorTableAddr == task.colorTableAddr && !m_polyRAMDirty->IsDirty((last.colorTableAddr + last.colorMin) * 4, (last.colorMax - last.colorMin + 1) * 4);
+		}
 
-		m_LODBlendTable = (LODBlendTable*)TranslateCullingAddress(vpnode[0x17] & 0xFFFFFF);
+		if (clean) {
+			contents = last;
+		}
+	}
 
-		/*
-		vp->angle_left		= -atan2f(Util::Uint32AsFloat(vpnode[12]),  Util::Uint32AsFloat(vpnode[13]));	// These values work out as the normals for the clipping planes.
-		vp->angle_right		=  atan2f(Util::Uint32AsFloat(vpnode[16]), -Util::Uint32AsFloat(vpnode[17]));	// Sometimes these values (dirt devils,lost world) are totally wrong
-		vp->angle_top		=  atan2f(Util::Uint32AsFloat(vpnode[14]),  Util::Uint32AsFloat(vpnode[15]));	// and don't work for the frustum values exactly.
-		vp->angle_bottom	= -atan2f(Util::Uint32AsFloat(vpnode[18]), -Util::Uint32AsFloat(vpnode[19]));	// Perhaps they are just used for culling and not rendering.
-		*/
+	if (!clean) {
 
-		float cv = Util::Uint32AsFloat(vpnode[0x8]);	// 1/(left-right)
-		float cw = Util::Uint32AsFloat(vpnode[0x9]);	// 1/(top-bottom)
-		float io = Util::Uint32AsFloat(vpnode[0xa]);	// top / bottom (ratio) - ish
-		float jo = Util::Uint32AsFloat(vpnode[0xb]);	// left / right (ratio)
+		const UINT32* end = data;
+		UINT64 colorHash = 0;
 
-		vp->angle_left		= (0.0f - jo) / cv;
-		vp->angle_right		= (1.0f - jo) / cv;
-		vp->angle_bottom	= -(1.0f - io)/ cw;
-		vp->angle_top		= -(0.0f - io)/ cw;
+		contents.colorTableAddr	= task.colorTableAddr;
+		contents.colorMin		= 0xFFF;
+		contents.colorMax		= 0;
 
-		// calculate the frustum shape, near/far pair are dummy values
-		CalcViewport(vp, 1.f, 1000.f);
+		do {
 
-		// calculate frustum planes
-		CalcFrustumPlanes(m_planes, vp->projectionMatrix);	// we need to calc a 'projection matrix' to get the correct frustum planes for clipping
+			end = std::max(end, (const UINT32*)ph.header + 7);
 
-		// Lighting (note that sun vector points toward sun -- away from vertex)
-		vp->lightingParams[0] =  Util::Uint32AsFloat(vpnode[0x05]);							// sun X
-		vp->lightingParams[1] = -Util::Uint32AsFloat(vpnode[0x06]);							// sun Y (- to convert to ogl cordinate system)
-		vp->lightingParams[2] = -Util::Uint32AsFloat(vpnode[0x04]);							// sun Z (- to convert to ogl cordinate system)
-		vp->lightingParams[3] = std::max(0.f, std::min(Util::Uint32AsFloat(vpnode[0x07]), 1.0f));	// sun intensity (clamp to 0-1)
-		vp->lightingParams[4] = (float)((vpnode[0x24] >> 8) & 0xFF) * (float)(1.0 / 255.0);	// ambient intensity
-		vp->lightingParams[5] = 0.0f;	// reserved
-		
-		vp->sunClamp		= m_sunClamp;
-		vp->intensityClamp	= (m_step == 0x10);		// just step 1.0 ?
-		vp->hardwareStep	= m_step;
-		
-		// Spotlight
-		int spotColorIdx = (vpnode[0x20] >> 11) & 7;									// spotlight color index
-		int spotFogColorIdx = (vpnode[0x20] >> 8) & 7;									// spotlight on fog color index
-		vp->spotEllipse[0] = (float)(INT16)(vpnode[0x1E] & 0xFFFF) * (float)(1.0 / 8.0);// spotlight X position (13.3 fixed point)
-		vp->spotEllipse[1] = (float)(INT16)(vpnode[0x1D] & 0xFFFF) * (float)(1.0 / 8.0);// spotlight Y
-		vp->spotEllipse[2] = (float)((vpnode[0x1E] >> 16) & 0xFFFF);					// spotlight X size (16-bit)
-		vp->spotEllipse[3] = (float)((vpnode[0x1D] >> 16) & 0xFFFF);					// spotlight Y size
+			if (ph.header[6] == 0) {
+				break;
+			}
 
-		vp->spotRange[0] = 1.0f / Util::Uint32AsFloat(vpnode[0x21]);					// spotlight start
-		vp->spotRange[1] = Util::Uint32AsFloat(vpnode[0x1F]);							// spotlight extent
+			if (!ph.PolyColor()) {
+				UINT32 colorIdx = ph.ColorIndex();
+				colorHash = HashWords(&m_polyRAM[task.colorTableAddr + colorIdx], 1, colorHash);
+				contents.colorMin = std::min(contents.colorMin, colorIdx);
+				contents.colorMax = std::max(contents.colorMax, colorIdx);
+			}
 
-		vp->spotColor[0] = color[spotColorIdx][0];										// spotlight color
-		vp->spotColor[1] = color[spotColorIdx][1];
-		vp->spotColor[2] = color[spotColorIdx][2];
+			end = std::max(end, (const UINT32*)ph.StartOfData() + (ph.NumVerts() - ph.NumSharedVerts()) * 4);
 
-		vp->spotFogColor[0] = color[spotFogColorIdx][0];								// spotlight color on fog
-		vp->spotFogColor[1] = color[spotFogColorIdx][1];
-		vp->spotFogColor[2] = color[spotFogColorIdx][2];
+		} while (ph.NextPoly());
 
-		// spotlight is specified in terms of physical resolution
-		vp->spotEllipse[1] = 384.0f - vp->spotEllipse[1];								// flip Y position
+		contents.numWords	= (UINT32)(end - data);
+		contents.hash		= HashWords(data, contents.numWords, colorHash);
+	}
 
-		// Avoid division by zero
-		vp->spotEllipse[2] = std::max(1.0f, vp->spotEllipse[2]);
-		vp->spotEllipse[3] = std::max(1.0f, vp->spotEllipse[3]);
+	bool cached = entry && entry->meshes && entry->contents.hash == contents.hash && entry->contents.numWords == contents.numWords;
 
-		vp->spotEllipse[2] = std::roundf(2047.0f / vp->spotEllipse[2]);
-		vp->spotEllipse[3] = std::roundf(2047.0f / vp->spotEllipse[3]);
+	ReserveMore(task.dynamicModels, 1, task.allocations);
+	task.dynamicModels.push_back({ modelAddr, task.models.size() - 1, cached, contents });
 
-		// Scale the spotlight to the OpenGL viewport
-		vp->spotEllipse[0] = vp->spotEllipse[0] * m_xRatio + (float)m_xOffs;
-		vp->spotEllipse[1] = vp->spotEllipse[1] * m_yRatio + (float)m_yOffs;
-		vp->spotEllipse[2] *= m_xRatio;
-		vp->spotEllipse[3] *= m_yRatio;
+	if (!cached) {
+		return false;
+	}
 
-		// Line of sight position
-		vp->losPosX = (int)(((vpnode[0x1c] & 0xFFFF) / 16.0f) + 0.5f);					// x position
-		vp->losPosY = (int)(((vpnode[0x1c] >> 16) / 16.0f) + 0.5f);						// y position 0 starts from the top
+	m->meshes	= entry->meshes;
+	m->dynamic	= false;
 
-		// Fog
-		vp->fogParams[0] = (float)((vpnode[0x22] >> 16) & 0xFF) * (float)(1.0 / 255.0);	// fog color R
-		vp->fogParams[1] = (float)((vpnode[0x22] >> 8) & 0xFF) * (float)(1.0 / 255.0);	// fog color G
-		vp->fogParams[2] = (float)((vpnode[0x22] >> 0) & 0xFF) * (float)(1.0 / 255.0);	// fog color B
-		vp->fogParams[3] = std::abs(Util::Uint32AsFloat(vpnode[0x23]));					// fog density	- ocean hunter uses negative values, but looks the same
-		vp->fogParams[4] = (float)(INT16)(vpnode[0x25] & 0xFFFF)* (float)(1.0 / 255.0);	// fog start
+	if (contents.colorMin <= contents.colorMax) {
+		task.colorTableRead |= !task.colorTableSet;
+	}
 
-		// Avoid Infinite and NaN values for Star Wars Trilogy
-		if (std::isinf(vp->fogParams[3]) || std::isnan(vp->fogParams[3])) {
-			for (int i = 0; i < 7; i++) vp->fogParams[i] = 0.0f;
-		}
+	memcpy(task.prev, entry->prev, sizeof(task.prev));
+	memcpy(task.prevTexCoords, entry->prevTexCoords, sizeof(task.prevTexCoords));
+	task.prevSet = true;
 
-		vp->fogParams[5] = (float)((vpnode[0x24] >> 16) & 0xFF) * (float)(1.0 / 255.0);	// fog attenuation
-		vp->fogParams[6] = (float)((vpnode[0x25] >> 16) & 0xFF) * (float)(1.0 / 255.0);	// fog ambient
+	return true;
+}
 
-		vp->scrollFog = (float)(vpnode[0x20] & 0xFF) * (float)(1.0 / 255.0);				// scroll fog
-		vp->scrollAtt = (float)(vpnode[0x24] & 0xFF) * (float)(1.0 / 255.0);				// scroll attenuation
+// Brings the dynamic model cache up to date with the models a task drew, moving those that have kept their
+// contents since an earlier frame into the rom buffer
+void CNew3D::UpdateDynamicModels(BuildTask& task)
+{
+	for (const auto& use : task.dynamicModels) {
 
-		// Clear texture offsets before proceeding
-		m_nodeAttribs.Reset();
+		DynamicModel& entry = m_dynamicModels[use.addr];
 
-		// Set up coordinate system and base matrix
-		InitMatrixStack(matrixBase, m_modelMat);
+		if (entry.contents.hash != use.contents.hash || entry.contents.numWords != use.contents.numWords) {
+			entry.since		= m_frameCount;
+			entry.meshes	= nullptr;
+		}
 
-		// Descend down the node link. Need to start with a culling node because that defines our culling radius.
-		auto childptr = vpnode[0x02];
-		if (((childptr >> 24) & 0x5) == 0) {
-			DescendNodePtr(vpnode[0x02]);
+		entry.contents	= use.contents;
+		entry.frame		= m_frameCount;
+
+		if (use.cached || entry.meshes || entry.since == m_frameCount) {
+			continue;
 		}
-	}
 
-	// render next viewport
-	if (vpnode[0x01] != 0x01000000) {
-		RenderViewport(vpnode[0x01]);
+		const Model& model = task.models[use.model];
+		auto meshes = std::make_shared<std::vector<Mesh>>(*model.meshes);
+
+		for (auto& mesh : *meshes) {
+			auto first = task.polyBufferRam.begin() + (mesh.vboOffset - MAX_ROM_VERTS);
+			mesh.vboOffset = (int)m_polyBufferRom.size();
+			m_polyBufferRom.insert(m_polyBufferRom.end(), first, first + mesh.vertexCount);
+		}
+
+		entry.meshes = meshes;
+		memcpy(entry.prev, use.prev, sizeof(entry.prev));
+		memcpy(entry.prevTexCoords, use.prevTexCoords, sizeof(entry.prevTexCoords));
 	}
 }
 
@@ -1003,7 +2227,7 @@ int CNew3D::GetTexFormat(int originalFormat, bool contour)
 	}
 }
 
-void CNew3D::SetMeshValues(SortingMesh *currentMesh, PolyHeader &ph)
+void CNew3D::SetMeshValues(Mesh *currentMesh, PolyHeader &ph)
 {
 	//copy attributes
 	currentMesh->textured		= ph.TexEnabled();
@@ -1074,7 +2298,7 @@ void CNew3D::SetMeshValues(SortingMesh *currentMesh, PolyHeader &ph)
 	}
 }
 
-void CNew3D::CacheModel(Model *m, const UINT32 *data)
+void CNew3D::CacheModel(BuildTask& task, Model *m, const UINT32 *data)
 {
 	if (data == NULL)
 		return;
@@ -1082,12 +2306,23 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 	UINT16			texCoords[4][2];
 	PolyHeader		ph;
 	UINT64			lastHash	= -1;
-	SortingMesh*	currentMesh = nullptr;
-	
-	std::unordered_map<UINT64, SortingMesh> sMap;
+	Mesh*			currentMesh = nullptr;
+	int				meshIndex	= -1;
+
+	// polygons are grouped into meshes in the task's scratch memory, which is kept from model to model
+	task.sortMeshes.clear();
+	task.sortHashes.clear();
+	task.sortPolys.clear();
+	task.sortVerts.clear();
+
+	if (++task.sortStamp == 0) {		// wrapped, forget entries from 4 billion models ago
+		for (auto& slot : task.meshTable) {
+			slot.stamp = 0;
+		}
+		task.sortStamp = 1;
+	}
 
 	ph = data; 
-	int numTriangles = ph.NumTrianglesTotal();
 
 	// Cache all polygons
 	do {
@@ -1104,18 +2339,14 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 
 		if (hash != lastHash) {
 
-			if (sMap.count(hash) == 0) {
-
-				currentMesh = &sMap.insert({hash, SortingMesh()}).first->second;
-
-				//make space for our vertices
-				currentMesh->verts.reserve(numTriangles * 3);
+			bool added;
+			meshIndex	= FindSortingMesh(task, hash, added);
+			currentMesh	= &task.sortMeshes[meshIndex];
 
+			if (added) {
 				//set mesh values
 				SetMeshValues(currentMesh, ph);
 			}
-			else
-				currentMesh = &sMap[hash];
 		}
 
 		// Obtain basic polygon parameters
@@ -1130,10 +2361,12 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 		{
 			if (ph.SharedVertex(i))
 			{
-				p.v[j] = m_prev[i];
+				p.v[j] = task.prev[i];
+
+				texCoords[j][0] = task.prevTexCoords[i][0];
+				texCoords[j][1] = task.prevTexCoords[i][1];
 
-				texCoords[j][0] = m_prevTexCoords[i][0];
-				texCoords[j][1] = m_prevTexCoords[i][1];
+				task.prevRead |= !task.prevSet;
 
 				//check if we need to recalc tex coords - will only happen if tex tiles are different + sharing vertices
 				if (hash != lastHash) {
@@ -1152,9 +2385,10 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 
 		if (!ph.PolyColor()) {
 			int colorIdx = ph.ColorIndex();
-			p.faceColour[2] = (m_polyRAM[m_colorTableAddr + colorIdx] & 0xFF);
-			p.faceColour[1] = ((m_polyRAM[m_colorTableAddr + colorIdx] >> 8) & 0xFF);
-			p.faceColour[0] = ((m_polyRAM[m_colorTableAddr + colorIdx] >> 16) & 0xFF);
+			p.faceColour[2] = (m_polyRAM[task.colorTableAddr + colorIdx] & 0xFF);
+			p.faceColour[1] = ((m_polyRAM[task.colorTableAddr + colorIdx] >> 8) & 0xFF);
+			p.faceColour[0] = ((m_polyRAM[task.colorTableAddr + colorIdx] >> 16) & 0xFF);
+			task.colorTableRead |= !task.colorTableSet;
 		}
 		else {
 			p.faceColour[0] = ((ph.header[4] >> 24));
@@ -1233,6 +2467,10 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 			vData += 4;
 		}
 
+		ReserveMore(task.sortVerts, 12, task.allocations);		// up to 2 quads as triangles
+
+		int firstVert = (int)task.sortVerts.size();
+
 		// check if we need to double up vertices for two sided lighting
 		if (ph.DoubleSided() && !ph.Discard()) {
 
@@ -1245,52 +2483,125 @@ void CNew3D::CacheModel(Model *m, const UINT32 *data)
 				V3::inverse(tempP.v[i2].normal);
 			}
 
-			CopyVertexData(tempP, currentMesh->verts);
+			CopyVertexData(tempP, task.sortVerts);
 		}
 
 		// Copy this polygon into the model buffer
 		if (!ph.Discard()) {
-			CopyVertexData(p, currentMesh->verts);
+			CopyVertexData(p, task.sortVerts);
+		}
+
+		int numVerts = (int)task.sortVerts.size() - firstVert;
+
+		if (numVerts) {
+			ReserveMore(task.sortPolys, 1, task.allocations);
+			task.sortPolys.push_back({ meshIndex, firstVert, numVerts });
+			currentMesh->vertexCount += numVerts;
 		}
 		
 		// Copy current vertices into previous vertex array
 		for (int i = 0; i < 4; i++) {
-			m_prev[i] = p.v[i];
-			m_prevTexCoords[i][0] = texCoords[i][0];
-			m_prevTexCoords[i][1] = texCoords[i][1];
+			task.prev[i] = p.v[i];
+			task.prevTexCoords[i][0] = texCoords[i][0];
+			task.prevTexCoords[i][1] = texCoords[i][1];
 		}
 
+		task.prevSet = true;
+
 	} while (ph.NextPoly());
 
-	//sorted the data, now copy to main data structures
+	//sorted the data, now copy to main data structures, packing the vertices as they go in
 
-	// we know how many meshes we have to reserve appropriate space
-	m->meshes->reserve(sMap.size());
+	std::vector<PackedVertex>&	buffer	= m->dynamic ? task.polyBufferRam : m_polyBufferRom;
+	int						vboBase	= m->dynamic ? MAX_ROM_VERTS : 0;
+	int						offset	= (int)buffer.size();
 
-	for (auto& it : sMap) {
+	// meshes follow each other in the order they first appeared, vertex count is recounted as they fill
+	for (auto& mesh : task.sortMeshes) {
+		mesh.vboOffset		= offset + vboBase;
+		offset				+= mesh.vertexCount;
+		mesh.vertexCount	= 0;
+	}
+
+	ReserveMore(buffer, task.sortVerts.size(), task.allocations);
+	buffer.resize(offset);
+
+	for (const auto& poly : task.sortPolys) {
+		Mesh& mesh = task.sortMeshes[poly.mesh];
+		std::copy(task.sortVerts.begin() + poly.first, task.sortVerts.begin() + poly.first + poly.count, buffer.begin() + (mesh.vboOffset - vboBase + mesh.vertexCount));
+		mesh.vertexCount += poly.count;
+	}
 
-		if (m->dynamic) {
+	//copy the meshes into the model structure
+	ReserveMore(*m->meshes, task.sortMeshes.size(), task.allocations);
+	m->meshes->assign(task.sortMeshes.begin(), task.sortMeshes.end());
+}
+
+// Finds the mesh of the model being cached for the given polygon attributes, adding one if there is none
+int CNew3D::FindSortingMesh(BuildTask& task, UINT64 hash, bool& added)
+{
+	if (task.sortMeshes.size() * 2 >= task.meshTable.size()) {
 
-			// calculate VBO values for current mesh
-			it.second.vboOffset		= (int)m_polyBufferRam.size() + MAX_ROM_VERTS;
-			it.second.vertexCount	= (int)it.second.verts.size();
+		// keep the table at most half full
+		std::vector<BuildTask::MeshSlot> table(std::max<size_t>(64, task.meshTable.size() * 2));
+		task.allocations++;
 
-			// copy poly data to main buffer
-			m_polyBufferRam.insert(m_polyBufferRam.end(), it.second.verts.begin(), it.second.verts.end());
+		for (size_t i = 0; i < task.sortMeshes.size(); i++) {
+			size_t slot = SlotOf(task.sortHashes[i], table.size());
+			while (table[slot].stamp == task.sortStamp) {
+				slot = (slot + 1) & (table.size() - 1);
+			}
+			table[slot] = { task.sortHashes[i], task.sortStamp, (int)i };
 		}
-		else {
-			// calculate VBO values for current mesh
-			it.second.vboOffset		= (int)m_polyBufferRom.size();
-			it.second.vertexCount	= (int)it.second.verts.size();
 
-			// copy poly data to main buffer
-			m_polyBufferRom.insert(m_polyBufferRom.end(), it.second.verts.begin(), it.second.verts.end());
+		task.meshTable.swap(table);
+	}
+
+	size_t slot = SlotOf(hash, task.meshTable.size());
+
+	while (task.meshTable[slot].stamp == task.sortStamp) {
+		if (task.meshTable[slot].hash == hash) {
+			added = false;
+			return task.meshTable[slot].mesh;
 		}
+		slot = (slot + 1) & (task.meshTable.size() - 1);
+	}
+
+	int index = (int)task.sortMeshes.size();
+
+	task.meshTable[slot] = { hash, task.sortStamp, index };
+
+	ReserveMore(task.sortMeshes, 1, task.allocations);
+	ReserveMore(task.sortHashes, 1, task.allocations);
+	task.sortMeshes.emplace_back();
+	task.sortHashes.push_back(hash);
+
+	added = true;
+	return index;
+}
+
+size_t CNew3D::SlotOf(UINT64 hash, size_t tableSize)
+{
+	return (size_t)((hash * 0x9E3779B97F4A7C15ull) >> 40) & (tableSize - 1);	// attribute bits are clustered, spread them out
+}
+
+// Mesh arrays of dynamic models, recycled once the models of the last frame let go of them
+std::shared_ptr<std::vector<Mesh>> CNew3D::AllocMeshes(BuildTask& task)
+{
+	if (task.meshArraysUsed == task.meshArrays.size()) {
+		ReserveMore(task.meshArrays, 1, task.allocations);
+		task.meshArrays.push_back(nullptr);
+	}
 
-		//copy the temp mesh into the model structure
-		//this will lose the associated vertex data, which is now copied to the main buffer anyway
-		m->meshes->push_back(it.second);
+	auto& meshes = task.meshArrays[task.meshArraysUsed++];
+
+	if (!meshes || meshes.use_count() > 1) {
+		meshes = std::make_shared<std::vector<Mesh>>();
+		task.allocations++;
 	}
+
+	meshes->clear();
+	return meshes;
 }
 
 bool CNew3D::IsDynamicModel(UINT32 *data)
@@ -1428,60 +2739,30 @@ void CNew3D::CalcBox(float distance, BBox& box)
 
 void CNew3D::MultVec(const float matrix[16], const float in[4], float out[4]) 
 {
-	for (int i = 0; i < 4; i++) {
-		out[i] =
-			in[0] * matrix[0 * 4 + i] +
-			in[1] * matrix[1 * 4 + i] +
-			in[2] * matrix[2 * 4 + i] +
-			in[3] * matrix[3 * 4 + i];
-	}
+	SIMD::MultVec(matrix, in, out);
 }
 
 void CNew3D::TransformBox(const float *m, BBox& box)
 {
-	for (int i = 0; i < 8; i++) {
-		float v[4];
-		MultVec(m, box.points[i], v);
-		box.points[i][0] = v[0];
-		box.points[i][1] = v[1];
-		box.points[i][2] = v[2];
-	}
+	SIMD::TransformPoints(m, box.points, 8);
 }
 
 Clip CNew3D::ClipBox(const BBox& box, Plane planes[5])
 {
-	int count = 0;
-
-	for (int i = 0; i < 8; i++) {
+	unsigned masks[5];		// bit per point inside each plane
 
-		int temp = 0;
+	SIMD::PlaneMasks(planes, 5, box.points, masks);
 
-		for (int j = 0; j < 5; j++) {
-			if (planes[j].DistanceToPoint(box.points[i]) >= 0.f) {
-				temp++;
-			}
-		}
-
-		if (temp == 5) count++;		// point is inside all 4 frustum planes
-	}
+	unsigned inside = masks[0] & masks[1] & masks[2] & masks[3] & masks[4];		// points inside all frustum planes
 
-	if (count == 8)	return Clip::INSIDE;
-	if (count > 0)	return Clip::INTERCEPT;
+	if (inside == 0xFF)	return Clip::INSIDE;
+	if (inside)			return Clip::INTERCEPT;
 	
 	//if we got here all points are outside of the view frustum
 	//check for all points being side same of any plane, means box outside of view
 
 	for (int i = 0; i < 5; i++) {
-
-		int temp = 0;
-
-		for (int j = 0; j < 8; j++) {
-			if (planes[i].DistanceToPoint(box.points[j]) >= 0.f) {
-				temp++;
-			}
-		}
-
-		if (temp == 0) {
+		if (masks[i] == 0) {
 			return Clip::OUTSIDE;
 		}
 	}
@@ -1491,12 +2772,23 @@ Clip CNew3D::ClipBox(const BBox& box, Plane planes[5])
 	return Clip::INTERCEPT;
 }
 
-void CNew3D::CalcBoxExtents(const BBox& box)
+bool CNew3D::BoxInFront(const BBox& box)
+{
+	for (int i = 0; i < 8; i++) {
+		if (box.points[i][2] >= 0.f) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CNew3D::CalcBoxExtents(BuildTask& task, const BBox& box)
 {
 	for (int i = 0; i < 8; i++) {
 		if (box.points[i][2] < 0.f) {
-			m_nfPairs[m_currentPriority].zNear = std::max(box.points[i][2], m_nfPairs[m_currentPriority].zNear);
-			m_nfPairs[m_currentPriority].zFar  = std::min(box.points[i][2], m_nfPairs[m_currentPriority].zFar);
+			task.nfPair.zNear = std::max(box.points[i][2], task.nfPair.zNear);
+			task.nfPair.zFar  = std::min(box.points[i][2], task.nfPair.zFar);
 		}
 	}
 }
@@ -1560,16 +2852,16 @@ void CNew3D::ClipPolygon(ClipPoly& clipPoly, Plane planes[5])
 	}
 }
 
-void CNew3D::ClipModel(const Model *m)
+void CNew3D::ClipModel(BuildTask& task, const Model *m)
 {
 	//===============================
-	ClipPoly				clipPoly;
-	std::vector<FVertex>*	vertices;
-	int						offset;
+	ClipPoly					clipPoly;
+	std::vector<PackedVertex>*	vertices;
+	int							offset;
 	//===============================
 
 	if (m->dynamic) {
-		vertices = &m_polyBufferRam;
+		vertices = &task.polyBufferRam;
 		offset = MAX_ROM_VERTS;
 	}
 	else {
@@ -1584,17 +2876,19 @@ void CNew3D::ClipModel(const Model *m)
 		for (int i = 0; i < mesh.vertexCount; i += m_numPolyVerts) {							// inc to next poly
 
 			for (int j = 0; j < m_numPolyVerts; j++) {
-				MultVec(m->modelMat, (*vertices)[start + i + j].pos, clipPoly.list[j].pos);		// copy all 3 of 4  our transformed vertices into our clip poly struct
+				const float* p = (*vertices)[start + i + j].pos;
+				float pos[4] = { p[0], p[1], p[2], 1.0f };
+				MultVec(m->modelMat, pos, clipPoly.list[j].pos);		// copy all 3 of 4  our transformed vertices into our clip poly struct
 			}
 
 			clipPoly.count = m_numPolyVerts;
 
-			ClipPolygon(clipPoly, m_planes);
+			ClipPolygon(clipPoly, task.planes);
 
 			for (int j = 0; j < clipPoly.count; j++) {
 				if (clipPoly.list[j].pos[2] < 0.f) {
-					m_nfPairs[m_currentPriority].zNear = std::max(clipPoly.list[j].pos[2], m_nfPairs[m_currentPriority].zNear);
-					m_nfPairs[m_currentPriority].zFar  = std::min(clipPoly.list[j].pos[2], m_nfPairs[m_currentPriority].zFar);
+					task.nfPair.zNear = std::max(clipPoly.list[j].pos[2], task.nfPair.zNear);
+					task.nfPair.zFar  = std::min(clipPoly.list[j].pos[2], task.nfPair.zFar);
 				}
 			}
 		}
@@ -1648,18 +2942,18 @@ void CNew3D::CalcViewport(Viewport* vp, float near, float far)
 		float correction = windowAR / viewableAreaAR;
 
 		vp->x		= 0;
-		vp->y		= m_yOffs + (int)((float)(384 - (vp->vpY + vp->vpHeight))*m_yRatio);
-		vp->width	= m_totalXRes;
-		vp->height = (int)((float)vp->vpHeight*m_yRatio);
+		vp->y		= (int)((m_yOffs + (float)(384 - (vp->vpY + vp->vpHeight))*m_yRatio) * m_renderScale);
+		vp->width	= (int)std::ceil(m_totalXRes * m_renderScale);
+		vp->height = (int)((float)vp->vpHeight*m_yRatio*m_renderScale);
 
 		vp->projectionMatrix.Frustum(l*correction, r*correction, b, t, near, far);
 	}
 	else {
 
-		vp->x		= m_xOffs + (int)((float)vp->vpX*m_xRatio);
-		vp->y		= m_yOffs + (int)((float)(384 - (vp->vpY + vp->vpHeight))*m_yRatio);
-		vp->width	= (int)((float)vp->vpWidth*m_xRatio);
-		vp->height	= (int)((float)vp->vpHeight*m_yRatio);
+		vp->x		= (int)((m_xOffs + (float)vp->vpX*m_xRatio) * m_renderScale);
+		vp->y		= (int)((m_yOffs + (float)(384 - (vp->vpY + vp->vpHeight))*m_yRatio) * m_renderScale);
+		vp->width	= (int)((float)vp->vpWidth*m_xRatio*m_renderScale);
+		vp->height	= (int)((float)vp->vpHeight*m_yRatio*m_renderScale);
 
 		vp->projectionMatrix.Frustum(l, r, b, t, near, far);
 	}
@@ -1683,44 +2977,166 @@ float CNew3D::GetLosValue(int layer)
 	return m_losFront->value[layer];
 }
 
+UINT32 CNew3D::GetFrameAllocations(void)
+{
+	return m_frameAllocations;
+}
+
+UINT32 CNew3D::GetFrameModelsCached(void)
+{
+	return m_frameModelsCached;
+}
+
+void CNew3D::SetPolyRAMDirtyPages(const CDirtyPages *dirty)
+{
+	m_polyRAMDirty = dirty;
+}
+
+void CNew3D::SetCullingRAMDirtyPages(const CDirtyPages *lo, const CDirtyPages *hi)
+{
+	m_cullingRAMLoDirty = lo;
+	m_cullingRAMHiDirty = hi;
+}
+
 void CNew3D::TranslateLosPosition(int inX, int inY, int& outX, int& outY)
 {
 	// remap real3d 496x384 to our new viewport
 	inY = 384 - inY;
 
-	outX = m_xOffs + int(inX * m_xRatio);
-	outY = m_yOffs + int(inY * m_yRatio);
+	outX = int((m_xOffs + inX * m_xRatio) * m_renderScale);
+	outY = int((m_yOffs + inY * m_yRatio) * m_renderScale);
 }
 
-bool CNew3D::ProcessLos(int priority)
+void CNew3D::UpdateRenderScale()
 {
-	for (const auto &n : m_nodes) {
-		if (n.viewport.priority == priority) {
-			if (n.viewport.losPosX || n.viewport.losPosY) {
+	if (!m_dynamicResolution) {
+		return;
+	}
 
-				int losX, losY;
-				TranslateLosPosition(n.viewport.losPosX, n.viewport.losPosY, losX, losY);
+	if (!m_timerQueries[0]) {
+		glGenQueries(NumTimerQueries, m_timerQueries);
+	}
 
-				float depth;
-				glReadPixels(losX, losY, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth);
+	// collect the timings that are ready, oldest first
+	for (int i = 0; i < NumTimerQueries; i++) {
 
-				if (depth < 0.99f || depth == 1.0f) {		// kinda guess work but when depth = 1, haven't drawn anything, when 0.99~ drawing sky somewhere far
-					return false;
-				}
+		int q = (m_timerQuery + i) % NumTimerQueries;
+
+		if (!m_timerPending[q]) {
+			continue;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(m_timerQueries[q], GL_QUERY_RESULT_AVAILABLE, &available);
 
-				depth = 2.0f * depth - 1.0f;
+		if (!available) {
+			break;								// later frames can't be done either
+		}
+
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(m_timerQueries[q], GL_QUERY_RESULT, &ns);
+		m_timerPending[q] = false;
+
+		// gpu time goes with the number of pixels, the square of the scale, aim 10% under budget and move a quarter of the way there per frame
+		float ms		= std::max(0.01f, (float)(ns / 1000000.0));
+		float target	= m_scaleControl * std::sqrt((m_gpuBudget * 0.9f) / ms);
+
+		m_scaleControl += (target - m_scaleControl) * 0.25f;
+		m_scaleControl	= std::min(1.0f, std::max(m_minRenderScale, m_scaleControl));
+	}
+
+	float scale = std::min(1.0f, std::ceil(m_scaleControl * 32.0f) / 32.0f);	// steps of 1/32 so small changes in timing don't move the picture around
+
+	if (scale != m_renderScale) {
+		m_renderScale = scale;
+		m_r3dFrameBuffers.SetScale(scale);
+	}
+}
+
+// Converts a depth buffer value to a LOS distance, returns false if there is nothing to see there
+static bool LosValue(float depth, float zNear, float zFar, float& zVal)
+{
+	if (depth < 0.99f || depth == 1.0f) {		// kinda guess work but when depth = 1, haven't drawn anything, when 0.99~ drawing sky somewhere far
+		return false;
+	}
+
+	depth = 2.0f * depth - 1.0f;
 
-				float zNear = m_nfPairs[priority].zNear;
-				float zFar	= m_nfPairs[priority].zFar;
-				float zVal	= 2.0f * zNear * zFar / (zFar + zNear - depth * (zFar - zNear));
+	zVal = 2.0f * zNear * zFar / (zFar + zNear - depth * (zFar - zNear));
+
+	return true;
+}
 
-				m_losBack->value[priority] = zVal;
-				return true;
+// Finds the viewport of the priority layer the line of sight is read from, -1 if none
+int CNew3D::FindLosNode(int priority) const
+{
+	for (size_t i = 0; i < m_nodes.size(); i++) {
+		const auto &n = m_nodes[i];
+		if (n.viewport.priority == priority) {
+			if (n.viewport.losPosX || n.viewport.losPosY) {
+				return (int)i;
 			}
 		}
 	}
 
-	return false;
+	return -1;
+}
+
+void CNew3D::ReadLos(int priority, const Node& n)
+{
+	int losX, losY;
+	TranslateLosPosition(n.viewport.losPosX, n.viewport.losPosY, losX, losY);
+
+	if (m_strictLos) {
+
+		float depth;
+		glReadPixels(losX, losY, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth);
+
+		LosValue(depth, m_nfPairs[priority].zNear, m_nfPairs[priority].zFar, m_losBack->value[priority]);
+		return;
+	}
+
+	LosSample& s = m_losSamples[priority];
+
+	if (!s.pbo) {
+		glGenBuffers(1, &s.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float), nullptr, GL_STREAM_READ);
+	}
+	else {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+	}
+
+	glReadPixels(losX, losY, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	s.fence	= glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	s.zNear	= m_nfPairs[priority].zNear;
+	s.zFar	= m_nfPairs[priority].zFar;
+}
+
+void CNew3D::ResolveLos()
+{
+	for (int i = 0; i < 4; i++) {
+
+		LosSample& s = m_losSamples[i];
+
+		if (!s.fence) {
+			continue;
+		}
+
+		// the frame has been presented by now, so this should hardly ever wait
+		while (glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(s.fence);
+		s.fence = nullptr;
+
+		float depth = 1.0f;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(float), &depth);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		LosValue(depth, s.zNear, s.zFar, m_losBack->value[i]);
+	}
 }
 
 } // New3D
@@ -36,6 +36,8 @@
 #include "Mat4.h"
 #include "R3DShader.h"
 #include "VBO.h"
+#include "TextureUploadBuffer.h"
+#include "TextureCache.h"
 #include "R3DData.h"
 #include "Plane.h"
 #include "Vec.h"
@@ -49,12 +51,22 @@ namespace New3D {
 class CNew3D : public IRender3D
 {
 public:
+	/*
+	* BuildFrame(void):
+	*
+	* Traverses the scene database and builds up the display lists without
+	* drawing anything, and records the passes that draw them, so that work
+	* such as the 2D layers can be done before RenderFrame() draws them. Optional, RenderFrame() builds the frame itself
+	* otherwise.
+	*/
+	void BuildFrame(void);
+
 	/*
 	* RenderFrame(void):
 	*
 	* Renders the complete scene database. Must be called between BeginFrame() and
 	* EndFrame(). This function traverses the scene database and builds up display
-	* lists.
+	* lists, unless BuildFrame() already did.
 	*/
 	void RenderFrame(void);
 
@@ -77,7 +89,8 @@ public:
 	/*
 	* UploadTextures(x, y, width, height):
 	*
-	* Signals that a portion of texture RAM has been updated.
+	* Signals that a portion of texture RAM has been updated. The rectangle is
+	* uploaded with a single call, through a pixel buffer where supported.
 	*
 	* Parameters:
 	*		x		X position within texture RAM.
@@ -173,6 +186,48 @@ public:
 	*/
 	float GetLosValue(int layer);
 
+	/*
+	* GetFrameAllocations(void);
+	*
+	* Gets the number of heap allocations made building the last frame. This
+	* should be zero once a scene has been running for a few frames.
+	*/
+	UINT32 GetFrameAllocations(void);
+
+	/*
+	* GetFrameModelsCached(void);
+	*
+	* Gets the number of models decoded from polygon RAM or VROM building the
+	* last frame, rather than found in the caches.
+	*/
+	UINT32 GetFrameModelsCached(void);
+
+	/*
+	* SetPolyRAMDirtyPages(dirty);
+	*
+	* Sets the polygon RAM pages written since the last frame was rendered,
+	* letting unchanged models be reused without checking their contents.
+	*
+	* Parameters:
+	*		dirty	Dirty pages, valid until RenderFrame() returns, or NULL if
+	*				writes aren't tracked.
+	*/
+	void SetPolyRAMDirtyPages(const CDirtyPages *dirty);
+
+	/*
+	* SetCullingRAMDirtyPages(lo, hi);
+	*
+	* Sets the culling RAM pages written since the last frame was rendered,
+	* letting the part of the scene they don't touch be reused from the last
+	* frame without traversing it again.
+	*
+	* Parameters:
+	*		lo		Dirty pages of culling RAM at 8C000000, valid until
+	*				RenderFrame() returns, or NULL if writes aren't tracked.
+	*		hi		Same for culling RAM at 8E000000.
+	*/
+	void SetCullingRAMDirtyPages(const CDirtyPages *lo, const CDirtyPages *hi);
+
 	/*
 	* CRender3D(config):
 	* ~CRender3D(void):
@@ -194,33 +249,56 @@ private:
 	const UINT32 *TranslateCullingAddress(UINT32 addr);
 	const UINT32 *TranslateModelAddress(UINT32 addr);
 
+	struct BuildTask;
+
 	// Matrix stack
-	void MultMatrix(UINT32 matrixOffset, Mat4& mat);
-	void InitMatrixStack(UINT32 matrixBaseAddr, Mat4& mat);
+	void MultMatrix(UINT32 matrixOffset, const float *matrixBasePtr, Mat4& mat);
+	const float *InitMatrixStack(UINT32 matrixBaseAddr, Mat4& mat);
 
 	// Scene database traversal
-	bool DrawModel(UINT32 modelAddr);
-	void DescendCullingNode(UINT32 addr);
-	void DescendPointerList(UINT32 addr);
-	void DescendNodePtr(UINT32 nodeAddr);
+	bool DrawModel(BuildTask& task, UINT32 modelAddr);
+	void DescendCullingNode(BuildTask& task, UINT32 addr, bool siblings = true);
+	void DescendPointerList(BuildTask& task, UINT32 addr);
+	void DescendNodePtr(BuildTask& task, UINT32 nodeAddr);
+	int SelectLOD(const BuildTask& task, const UINT32* lodTable, UINT8 lodTablePointer, float blendRadius) const;
 	void RenderViewport(UINT32 addr);
+	void AddBuildTasks(UINT32 nodeAddr, const BuildTask& base);			// split the top level culling nodes of a viewport into tasks
+	void StartBuildTask(BuildTask& task, UINT32 colorTableAddr, const Vertex prev[4], const UINT16 prevTexCoords[4][2], bool speculative);
+	void RunBuildTask(BuildTask& task);
+	void NoteCullingRead(BuildTask& task, UINT32 addr, UINT32 words);
+	bool IsCullingRAMDirty(UINT32 addr, UINT32 words) const;
+	bool CanReuseBuildTask(const BuildTask& task);		// nothing it read was written since it last ran
+	bool AreDynamicModelsCurrent(const BuildTask& task) const;	// the cached dynamic models it drew are still in the cache
+	void BuildModels();								// run the tasks, in parallel where possible, and merge their output into m_nodes
+	void LoadRomModelCache();						// read the vrom models decoded in earlier runs
+	void SaveRomModelCache();
+	int AppendRamVerts(const std::vector<PackedVertex>& verts);	// returns vbo offset of the first vertex relative to MAX_ROM_VERTS, or -1 if full
 
 	// building the scene
 	int	GetTexFormat(int originalFormat, bool contour);
-	void SetMeshValues(SortingMesh *currentMesh, PolyHeader &ph);
-	void CacheModel(Model *m, const UINT32 *data);
+	void SetMeshValues(Mesh *currentMesh, PolyHeader &ph);
+	void CacheModel(BuildTask& task, Model *m, const UINT32 *data);
+	int FindSortingMesh(BuildTask& task, UINT64 hash, bool& added);
+	static size_t SlotOf(UINT64 hash, size_t tableSize);
+	std::shared_ptr<std::vector<Mesh>> AllocMeshes(BuildTask& task);
+	bool FindDynamicModel(BuildTask& task, UINT32 modelAddr, const UINT32 *data, Model *m);
+	void UpdateDynamicModels(BuildTask& task);
 	void CopyVertexData(const R3DPoly& r3dPoly, std::vector<FVertex>& vertexArray);
 	void GetCoordinates(int width, int height, UINT16 uIn, UINT16 vIn, float uvScale, float& uOut, float& vOut);
 
-	bool RenderScene(int priority, bool renderOverlay, Layer layer);		// returns if has overlay plane
+	void BuildDrawLists();							// sort meshes into the passes of RenderScene
+	void RecordCommands();							// the passes of the frame, drawn by RenderFrame
+	void UploadVertices();
+	void RenderScene(int priority, bool renderOverlay, Layer layer);
 	bool IsDynamicModel(UINT32 *data);				// check if the model has a colour palette
 	bool IsVROMModel(UINT32 modelAddr);
-	void DrawScrollFog();
-	bool SkipLayer(int layer);
+	int FindScrollFog(float rgba[4]) const;
+	bool SkipLayer(int layer) const;
 	void SetRenderStates();
 	void DisableRenderStates();
 	void TranslateLosPosition(int inX, int inY, int& outX, int& outY);
-	bool ProcessLos(int priority);
+	int FindLosNode(int priority) const;
+	void ReadLos(int priority, const Node& n);
 
 	void CalcTexOffset(int offX, int offY, int page, int x, int y, int& newX, int& newY);	
 
@@ -232,6 +310,8 @@ private:
 	std::string m_gameName;
 	int m_numPolyVerts;
 	GLenum m_primType;
+	bool m_gpuClipping;				// treat boxes crossing the frustum sides as inside when in front of the camera
+	float m_lodDistanceScale;		// applied to distances before choosing a level of detail, 0 to always draw the most detailed
 
 	// GPU configuration
 	bool m_sunClamp;
@@ -255,14 +335,25 @@ private:
 	unsigned	m_xRes, m_yRes;           // resolution of Model 3's 496x384 display area within the window
 	unsigned 	m_totalXRes, m_totalYRes; // total OpenGL window resolution
 
-	// Real3D Base Matrix Pointer
-	const float	*m_matrixBasePtr;
+	// Dynamic resolution, the 3d scene is rendered into the bottom left m_renderScale of the frame buffers,
+	// which is adjusted from the gpu time of past frames. The composite passes scale it up to the window.
+	bool		m_dynamicResolution;
+	float		m_minRenderScale;
+	float		m_gpuBudget;				// ms
+	float		m_renderScale = 1.0f;		// applied to this frame's viewports
+	float		m_scaleControl = 1.0f;		// unquantized
+	static const int NumTimerQueries = 4;	// results are read a few frames late so we never wait for them
+	GLuint		m_timerQueries[NumTimerQueries] = {};
+	bool		m_timerPending[NumTimerQueries] = {};
+	int			m_timerQuery = 0;
+	void		UpdateRenderScale();
+
 	UINT32 m_colorTableAddr = 0x400;		// address of color table in polygon RAM
-	LODBlendTable* m_LODBlendTable;
 
 	GLuint			m_textureBuffer;
-	NodeAttributes	m_nodeAttribs;
-	Mat4			m_modelMat;				// current modelview matrix
+	TextureUploadBuffer	m_textureUploadBuffer;	// streams texture RAM updates to m_textureBuffer
+	TextureCache		m_textureCache;			// decoded textures, if enabled
+	bool				m_useTextureCache;
 
 	struct LOS
 	{
@@ -273,22 +364,145 @@ private:
 	LOS* m_losBack = &m_los[1];
 	std::mutex m_losMutex;
 
+	// Depth reads for LOS go into a pixel buffer and are resolved when the next frame starts, just before the
+	// values are swapped to the front, so the gpu is never waited on mid frame
+	struct LosSample
+	{
+		GLuint	pbo		= 0;
+		GLsync	fence	= nullptr;
+		float	zNear	= 0;
+		float	zFar	= 0;
+	} m_losSamples[4];
+
+	bool m_strictLos;						// read depth straight away instead
+	void ResolveLos();
+
 	Vertex			m_prev[4];				// these are class variables because sega bass fishing starts meshes with shared vertices from the previous one
 	UINT16			m_prevTexCoords[4][2];	// basically relying on undefined behavour
 
 	std::vector<Node>	 m_nodes;				// this represents the entire render frame
-	std::vector<FVertex> m_polyBufferRam;		// dynamic polys
-	std::vector<FVertex> m_polyBufferRom;		// rom polys
+	std::vector<std::vector<Model>> m_modelArrays;	// model arrays of last frame's nodes, reused for this frame's
+	UINT32				m_frameAllocations = 0;	// heap allocations building the frame
+	UINT32				m_frameModelsCached = 0;	// models decoded building the frame
+
+	struct DrawBatch						// consecutive meshes of a model with the same state, drawn with one call
+	{
+		Node*			node;
+		const Model*	model;
+		const Mesh*		mesh;					// state shared by the meshes
+		size_t			first;					// index of first mesh in the draw list arrays
+		GLsizei			count;
+		GLsizei			instances;				// models drawn, more than 1 if instanced
+		size_t			firstInstance;			// index into m_instanceMats
+	};
+
+	struct InstanceGroup					// how a model's opaque meshes are drawn
+	{
+		size_t			firstInstance;
+		GLsizei			instances;				// 0 if drawn with an earlier model's instances
+	};
+
+	struct DrawList
+	{
+		std::vector<DrawBatch>	batches;
+		std::vector<GLint>		first;			// vbo offset and vertex count of each mesh
+		std::vector<GLsizei>	count;
+	};
+
+	DrawList	m_drawLists[4][2][3];		// priority, overlay, layer (colour, trans1, trans2)
+	std::vector<float>			m_instanceMats;		// 16 per instance
+	std::vector<int>			m_instanceOrder;	// scratch for grouping the models of a node
+	std::vector<InstanceGroup>	m_instanceGroups;	// per model of the node being listed
+	void GroupInstances(const Node& n);
+	void SortByPermutation(DrawList& list, size_t first);	// from the first batch of a node
+	void SetInstanceMats(size_t firstInstance);
+	bool		m_hasOverlay[4];
+
+	// A step of drawing the frame. BuildFrame() records them all once the scene is built, making every
+	// decision about what to draw, so that RenderFrame() only walks the list making gl calls. Steps name
+	// layers, priorities and nodes rather than any gl objects or state.
+	struct RenderCommand
+	{
+		enum class Op : UINT8
+		{
+			BeginTimer,					// arg = GPUTimer stage
+			EndTimer,
+			ScrollFog,					// node, in m_scrollFogColour
+			UploadVertices,				// instance matrices and the polys built this frame
+			SetTarget,					// arg = Layer
+			Clear,						// arg = Clear bits
+			BeginScene,					// render states for drawing polys
+			EndScene,
+			DepthLess,
+			DiscardAlpha,				// arg = discard translucent rather than opaque pixels
+			DrawList,					// priority, overlay, arg = layer (colour, trans1, trans2)
+			ReadLos,					// priority, node
+			DrawOverTransLayers,
+			CompositeBaseLayer,
+			StoreDepth,
+			RestoreDepth,
+			CompositeAlphaLayer
+		};
+
+		enum Clear { ClearColour = 1, ClearDepth = 2, ClearStencil = 4 };
+
+		Op		op;
+		UINT8	priority;
+		UINT8	overlay;
+		UINT8	arg;
+		int		node;					// index into m_nodes
+	};
+
+	std::vector<RenderCommand>	m_commands;			// this frame's
+	float						m_scrollFogColour[4];
+	void Record(RenderCommand::Op op, int arg = 0, int priority = 0, int overlay = 0, int node = -1);
+	double		m_compositeBytesSaved = 0;		// estimated frame buffer traffic of the full screen passes skipped
+	UINT64		m_compositeFrames = 0;
+	std::vector<PackedVertex> m_polyBufferRam;		// dynamic polys, staged here when the vbo has no mapped ring
+	PackedVertex*	m_ramVerts = nullptr;			// mapped vbo segment dynamic polys are written to this frame
+	int			m_ramVertsBase = 0;				// vertex offset of the segment relative to MAX_ROM_VERTS
+	int			m_numRamVerts = 0;
+	std::vector<PackedVertex> m_polyBufferRom;		// rom polys
 	std::unordered_map<UINT32, std::shared_ptr<std::vector<Mesh>>> m_romMap;	// a hash table for all the ROM models. The meshes don't have model matrices or tex offsets yet
+	std::string	m_romCacheDir;					// where the rom map is saved to, empty if disabled
+	std::string	m_romCacheFile;
+	size_t		m_romCacheModels = 0;			// rom models in the cache file when loaded
+	bool		m_romCacheLoaded = false;
+
+	// Contents of a dynamic model, the polygon words and colour table entries it uses
+	struct ModelContents
+	{
+		UINT64	hash			= 0;
+		UINT32	numWords		= 0;
+		UINT32	colorTableAddr	= 0;
+		UINT32	colorMin		= 0;		// range of colour table entries used, if colorMin <= colorMax
+		UINT32	colorMax		= 0;
+	};
+
+	// Dynamic models that stay the same from frame to frame are moved in with the ROM models
+	struct DynamicModel
+	{
+		ModelContents	contents;
+		UINT64			since	= 0;		// frame the contents were first seen
+		UINT64			frame	= 0;		// last frame the contents were known to be current
+		std::shared_ptr<std::vector<Mesh>> meshes;	// in the rom buffer once the contents have lasted a frame
+		Vertex			prev[4];			// shared vertices left by the model
+		UINT16			prevTexCoords[4][2];
+	};
+
+	std::unordered_map<UINT32, DynamicModel> m_dynamicModels;
+	const CDirtyPages*	m_polyRAMDirty = nullptr;
+	const CDirtyPages*	m_cullingRAMLoDirty = nullptr;
+	const CDirtyPages*	m_cullingRAMHiDirty = nullptr;
+	UINT64				m_frameCount = 1;
 
 	GLuint m_vao;
+	GLuint m_instanceBuffer;				// model matrices of instanced draws, refilled each frame
 	VBO m_vbo;								// large VBO to hold our poly data, start of VBO is ROM data, ram polys follow
 	R3DShader m_r3dShader;
 	R3DScrollFog m_r3dScrollFog;
 	R3DFrameBuffers m_r3dFrameBuffers;
 
-	Plane m_planes[5];
-
 	struct BBox
 	{
 		V4::Vec4 points[8];
@@ -301,16 +515,113 @@ private:
 	};
 
 	NFPair m_nfPairs[4];
-	int m_currentPriority;
+
+	// A run of top level culling nodes of one viewport, traversed with its own state into its own output.
+	// The colour table address and shared vertices carry over from one model to the next in traversal
+	// order, so a task records whether it read the values it started with before setting them itself.
+	struct BuildTask
+	{
+		// viewport state
+		size_t					node;				// index into m_nodes
+		std::vector<UINT32>		roots;				// culling nodes in the order they are descended
+		float					baseMatrix[16];
+		const float*			matrixBasePtr;		// Real3D base matrix pointer
+		UINT32					matrixBase;			// and its culling RAM address
+		const LODBlendTable*	lodBlendTable;		// level of detail ranges, can be null
+		UINT32					lodBlendTableAddr;
+		Plane					planes[5];
+		int						priority;
+
+		// state inherited from the tasks before
+		UINT32					startColorTableAddr;
+		Vertex					startPrev[4];
+		UINT16					startPrevTexCoords[4][2];
+
+		// traversal state
+		Mat4					modelMat;			// current modelview matrix
+		NodeAttributes			nodeAttribs;
+		UINT32					colorTableAddr;
+		Vertex					prev[4];
+		UINT16					prevTexCoords[4][2];
+		bool					colorTableSet;
+		bool					prevSet;
+		bool					colorTableRead;		// inherited colour table address was used
+		bool					prevRead;			// inherited shared vertices were used
+		bool					speculative;		// running ahead of the tasks before it, ROM cache is read only
+		bool					aborted;			// needed to add to the ROM cache while speculative
+
+		// output
+		std::vector<Model>		models;
+		std::vector<PackedVertex>	polyBufferRam;		// dynamic polys, vbo offsets are relative to the start of this buffer
+		NFPair					nfPair;
+		UINT32					allocations;		// heap allocations this frame
+		UINT32					modelsCached;		// models decoded rather than found in the caches
+
+		// with culling RAM writes tracked, the output is kept for the next frame, which reuses it if the task
+		// descends the same nodes from the same viewport state and none of what it read has been written since
+		struct CullingRead
+		{
+			UINT32	addr;
+			UINT32	words;
+		};
+
+		std::vector<CullingRead>	cullingReads;	// nodes, lists and matrices, in culling RAM words
+		UINT64					frame = 0;			// last frame the output was built or reused for
+		bool					reuse = false;		// this frame
+
+		// scratch memory for CacheModel, grouping the polys of a model by their attributes
+		struct MeshSlot
+		{
+			UINT64	hash;
+			UINT32	stamp;							// model the slot belongs to, so the table needn't be cleared
+			int		mesh;
+		};
+
+		struct SortPoly
+		{
+			int		mesh;
+			int		first;							// vertices in sortVerts
+			int		count;
+		};
+
+		std::vector<MeshSlot>	meshTable;			// open addressing, power of 2 size
+		UINT32					sortStamp = 0;
+		std::vector<Mesh>		sortMeshes;
+		std::vector<UINT64>		sortHashes;
+		std::vector<SortPoly>	sortPolys;
+		std::vector<FVertex>	sortVerts;
+
+		std::vector<std::shared_ptr<std::vector<Mesh>>> meshArrays;	// for dynamic models, reused from frame to frame
+		size_t					meshArraysUsed;
+
+		// dynamic models drawn, m_dynamicModels is updated from these in traversal order
+		struct DynamicModelUse
+		{
+			UINT32			addr;
+			size_t			model;				// index into models
+			bool			cached;
+			ModelContents	contents;
+			Vertex			prev[4];
+			UINT16			prevTexCoords[4][2];
+		};
+
+		std::vector<DynamicModelUse>	dynamicModels;
+	};
+
+	std::vector<BuildTask>	m_buildTasks;			// kept from frame to frame along with their memory
+	size_t					m_numBuildTasks = 0;
+	bool					m_frameBuilt = false;		// by BuildFrame(), to be drawn by RenderFrame()
+	std::vector<UINT32>		m_buildChain;
 
 	void CalcFrustumPlanes	(Plane p[5], const float* matrix);
 	void CalcBox			(float distance, BBox& box);
 	void TransformBox		(const float *m, BBox& box);
 	void MultVec			(const float matrix[16], const float in[4], float out[4]);
 	Clip ClipBox			(const BBox& box, Plane planes[5]);
-	void ClipModel			(const Model *m);
+	void ClipModel			(BuildTask& task, const Model *m);
 	void ClipPolygon		(ClipPoly& clipPoly, Plane planes[5]);
-	void CalcBoxExtents		(const BBox& box);
+	void CalcBoxExtents		(BuildTask& task, const BBox& box);
+	bool BoxInFront			(const BBox& box);
 	void CalcViewport		(Viewport* vp, float near, float far);
 };
 
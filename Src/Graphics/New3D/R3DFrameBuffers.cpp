@@ -1,5 +1,8 @@
 #include "R3DFrameBuffers.h"
 #include "Mat4.h"
+#include "Graphics/GPUTimer.h"
+#include <algorithm>
+#include <cmath>
 
 #define countof(a) (sizeof(a)/sizeof(*(a)))
 
@@ -13,8 +16,15 @@ R3DFrameBuffers::R3DFrameBuffers()
 	m_renderBufferIDCopy = 0;
 	m_width = 0;
 	m_height = 0;
+	m_scale = 1.0f;
+	m_scaledWidth = 0;
+	m_scaledHeight = 0;
 	m_vao = 0;
 
+	for (auto &i : m_scissor) {
+		i = 0;
+	}
+
 	for (auto &i : m_texIDs) {
 		i = 0;
 	}
@@ -47,6 +57,11 @@ bool R3DFrameBuffers::CreateFBO(int width, int height)
 {
 	m_width = width;
 	m_height = height;
+	m_scale = 1.0f;
+	m_scaledWidth = width;
+	m_scaledHeight = height;
+
+	glGetIntegerv(GL_SCISSOR_BOX, m_scissor);		// set up by the OSD layer before we are created
 
 	m_texIDs[0] = CreateTexture(width, height);		// colour buffer
 	m_texIDs[1] = CreateTexture(width, height);		// trans layer1
@@ -100,14 +115,55 @@ void R3DFrameBuffers::StoreDepth()
 {
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_frameBufferID);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_frameBufferIDCopy);
-	glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBlitFramebuffer(0, 0, m_scaledWidth, m_scaledHeight, 0, 0, m_scaledWidth, m_scaledHeight, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
 }
 
 void R3DFrameBuffers::RestoreDepth()
 {
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_frameBufferIDCopy);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_frameBufferID);
-	glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	glBlitFramebuffer(0, 0, m_scaledWidth, m_scaledHeight, 0, 0, m_scaledWidth, m_scaledHeight, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+}
+
+void R3DFrameBuffers::SetScale(float scale)
+{
+	m_scale			= scale;
+	m_scaledWidth	= std::max(1, (int)std::ceil(m_width * scale));
+	m_scaledHeight	= std::max(1, (int)std::ceil(m_height * scale));
+
+	if (m_lastLayer != Layer::none) {
+		SetScissor(true);
+	}
+}
+
+void R3DFrameBuffers::SetScissor(bool scaled)
+{
+	if (!scaled) {
+		glScissor(m_scissor[0], m_scissor[1], m_scissor[2], m_scissor[3]);
+		return;
+	}
+
+	int x0 = (int)std::floor(m_scissor[0] * m_scale);
+	int y0 = (int)std::floor(m_scissor[1] * m_scale);
+	int x1 = (int)std::ceil((m_scissor[0] + m_scissor[2]) * m_scale);
+	int y1 = (int)std::ceil((m_scissor[1] + m_scissor[3]) * m_scale);
+
+	glScissor(x0, y0, x1 - x0, y1 - y0);
+}
+
+// texScale.xy maps the full screen quad to the rendered part of the buffers, .zw stops linear filtering
+// reading texels outside it when compositing to the back buffer
+void R3DFrameBuffers::SetTexScale(const GLSLShader& shader, int loc, bool composite) const
+{
+	float sx = (float)m_scaledWidth / m_width;
+	float sy = (float)m_scaledHeight / m_height;
+
+	if (composite) {
+		glUniform4f(shader.uniformLoc[loc], sx, sy, sx - (0.5f / m_width), sy - (0.5f / m_height));
+	}
+	else {
+		glUniform4f(shader.uniformLoc[loc], sx, sy, sx, sy);
+	}
 }
 
 void R3DFrameBuffers::DestroyFBO()
@@ -136,6 +192,9 @@ void R3DFrameBuffers::DestroyFBO()
 	m_renderBufferIDCopy = 0;
 	m_width = 0;
 	m_height = 0;
+	m_scale = 1.0f;
+	m_scaledWidth = 0;
+	m_scaledHeight = 0;
 }
 
 GLuint R3DFrameBuffers::CreateTexture(int width, int height)
@@ -195,6 +254,10 @@ void R3DFrameBuffers::SetFBO(Layer layer)
 	}
 	}
 
+	if ((layer == Layer::none) != (m_lastLayer == Layer::none)) {
+		SetScissor(layer != Layer::none);
+	}
+
 	m_lastLayer = layer;
 }
 
@@ -204,6 +267,8 @@ void R3DFrameBuffers::AllocShaderBase()
 
 	#version 410 core
 
+	uniform vec4 texScale;
+
 	// outputs
 	out vec2 fsTexCoord;
 
@@ -214,7 +279,7 @@ void R3DFrameBuffers::AllocShaderBase()
 										vec4( 1.0, -1.0, 0.0, 1.0),
 										vec4( 1.0,  1.0, 0.0, 1.0));
 
-		fsTexCoord = (vertices[gl_VertexID % 4].xy + 1.0) / 2.0;
+		fsTexCoord = ((vertices[gl_VertexID % 4].xy + 1.0) / 2.0) * texScale.xy;
 		gl_Position = vertices[gl_VertexID % 4];	
 	}
 
@@ -226,15 +291,31 @@ void R3DFrameBuffers::AllocShaderBase()
 
 	// inputs
 	uniform sampler2D tex1;			// base tex
+	uniform vec4 texScale;
+	uniform float sharpen;			// used when the 3d scene is rendered below screen resolution
 	in vec2 fsTexCoord;
 
 	// outputs
 	out vec4 fragColor;
 
+	vec3 Neighbour(vec2 offset, vec3 centre)
+	{
+		vec4 col = texture(tex1, min(fsTexCoord + offset, texScale.zw));
+		return col.a < 1.0 ? centre : col.rgb;		// don't sharpen against the empty pixels around polys
+	}
+
 	void main()
 	{
-		vec4 colBase = texture(tex1, fsTexCoord);
+		vec4 colBase = texture(tex1, min(fsTexCoord, texScale.zw));
 		if(colBase.a < 1.0) discard;
+
+		if(sharpen > 0.0) {
+			vec2 d = 1.0 / vec2(textureSize(tex1, 0));
+			vec3 blur = (Neighbour(vec2(d.x, 0.0), colBase.rgb) + Neighbour(vec2(-d.x, 0.0), colBase.rgb) +
+						 Neighbour(vec2(0.0, d.y), colBase.rgb) + Neighbour(vec2(0.0, -d.y), colBase.rgb)) * 0.25;
+			colBase.rgb = clamp(colBase.rgb + (colBase.rgb - blur) * sharpen, 0.0, 1.0);
+		}
+
 		fragColor = colBase;
 	}
 
@@ -242,6 +323,8 @@ void R3DFrameBuffers::AllocShaderBase()
 
 	m_shaderBase.LoadShaders(vertexShader, fragmentShader);
 	m_shaderBase.uniformLoc[0] = m_shaderTrans.GetUniformLocation("tex1");
+	m_shaderBase.uniformLoc[1] = m_shaderBase.GetUniformLocation("texScale");
+	m_shaderBase.uniformLoc[2] = m_shaderBase.GetUniformLocation("sharpen");
 }
 
 void R3DFrameBuffers::AllocShaderTrans()
@@ -250,6 +333,8 @@ void R3DFrameBuffers::AllocShaderTrans()
 
 	#version 410 core
 
+	uniform vec4 texScale;
+
 	// outputs
 	out vec2 fsTexCoord;
 
@@ -260,7 +345,7 @@ void R3DFrameBuffers::AllocShaderTrans()
 										vec4( 1.0, -1.0, 0.0, 1.0),
 										vec4( 1.0,  1.0, 0.0, 1.0));
 
-		fsTexCoord = (vertices[gl_VertexID % 4].xy + 1.0) / 2.0;
+		fsTexCoord = ((vertices[gl_VertexID % 4].xy + 1.0) / 2.0) * texScale.xy;
 		gl_Position = vertices[gl_VertexID % 4];
 	}
 
@@ -272,6 +357,7 @@ void R3DFrameBuffers::AllocShaderTrans()
 
 	uniform sampler2D tex1;			// trans layer 1
 	uniform sampler2D tex2;			// trans layer 2
+	uniform vec4 texScale;
 
 	in vec2 fsTexCoord;
 
@@ -280,8 +366,9 @@ void R3DFrameBuffers::AllocShaderTrans()
 
 	void main()
 	{
-		vec4 colTrans1 = texture( tex1, fsTexCoord);
-		vec4 colTrans2 = texture( tex2, fsTexCoord);
+		vec2 texCoord = min(fsTexCoord, texScale.zw);
+		vec4 colTrans1 = texture( tex1, texCoord);
+		vec4 colTrans2 = texture( tex2, texCoord);
 
 		if(colTrans1.a+colTrans2.a > 0.0) {
 			vec3 col1 = colTrans1.rgb * colTrans1.a;
@@ -300,6 +387,7 @@ void R3DFrameBuffers::AllocShaderTrans()
 
 	m_shaderTrans.uniformLoc[0] = m_shaderTrans.GetUniformLocation("tex1");
 	m_shaderTrans.uniformLoc[1] = m_shaderTrans.GetUniformLocation("tex2");
+	m_shaderTrans.uniformLoc[2] = m_shaderTrans.GetUniformLocation("texScale");
 }
 
 void R3DFrameBuffers::AllocShaderWipe()
@@ -308,6 +396,8 @@ void R3DFrameBuffers::AllocShaderWipe()
 
 	#version 410 core
 
+	uniform vec4 texScale;
+
 	// outputs
 	out vec2 fsTexCoord;
 
@@ -318,7 +408,7 @@ void R3DFrameBuffers::AllocShaderWipe()
 										vec4( 1.0, -1.0, 0.0, 1.0),
 										vec4( 1.0,  1.0, 0.0, 1.0));
 
-		fsTexCoord = (vertices[gl_VertexID % 4].xy + 1.0) / 2.0;
+		fsTexCoord = ((vertices[gl_VertexID % 4].xy + 1.0) / 2.0) * texScale.xy;
 		gl_Position = vertices[gl_VertexID % 4];
 	}
 
@@ -329,6 +419,7 @@ void R3DFrameBuffers::AllocShaderWipe()
 	#version 410 core
 
 	uniform sampler2D texColor;				// base colour layer
+	uniform vec4 texScale;
 	in vec2 fsTexCoord;
 
 	// outputs
@@ -337,7 +428,7 @@ void R3DFrameBuffers::AllocShaderWipe()
 
 	void main()
 	{
-		vec4 colBase = texture(texColor, fsTexCoord);
+		vec4 colBase = texture(texColor, min(fsTexCoord, texScale.zw));
 
 		if(colBase.a == 0.0) {
 			discard;					// no colour pixels have been written
@@ -352,10 +443,13 @@ void R3DFrameBuffers::AllocShaderWipe()
 	m_shaderWipe.LoadShaders(vertexShader, fragmentShader);
 
 	m_shaderWipe.uniformLoc[0] = m_shaderWipe.GetUniformLocation("texColor");
+	m_shaderWipe.uniformLoc[1] = m_shaderWipe.GetUniformLocation("texScale");
 }
 
 void R3DFrameBuffers::Draw()
 {
+	GPUTimer::Begin(GPUTimer::Composite);
+
 	SetFBO		(Layer::none);						// make sure to draw on the back buffer
 	glViewport	(0, 0, m_width, m_height);			// cover the entire screen
 	glDisable	(GL_DEPTH_TEST);					// disable depth testing / writing
@@ -379,10 +473,14 @@ void R3DFrameBuffers::Draw()
 
 	glDisable			(GL_BLEND);
 	glBindVertexArray	(0);
+
+	GPUTimer::End(GPUTimer::Composite);
 }
 
 void R3DFrameBuffers::CompositeBaseLayer()
 {
+	GPUTimer::Begin(GPUTimer::Composite);
+
 	SetFBO(Layer::none);							// make sure to draw on the back buffer
 	glViewport(0, 0, m_width, m_height);			// cover the entire screen
 	glDisable(GL_DEPTH_TEST);						// disable depth testing / writing
@@ -400,10 +498,14 @@ void R3DFrameBuffers::CompositeBaseLayer()
 	DrawBaseLayer();
 
 	glBindVertexArray(0);
+
+	GPUTimer::End(GPUTimer::Composite);
 }
 
 void R3DFrameBuffers::CompositeAlphaLayer()
 {
+	GPUTimer::Begin(GPUTimer::Composite);
+
 	SetFBO(Layer::none);							// make sure to draw on the back buffer
 	glViewport(0, 0, m_width, m_height);			// cover the entire screen
 	glDisable(GL_DEPTH_TEST);						// disable depth testing / writing
@@ -424,13 +526,17 @@ void R3DFrameBuffers::CompositeAlphaLayer()
 
 	glDisable(GL_BLEND);
 	glBindVertexArray(0);
+
+	GPUTimer::End(GPUTimer::Composite);
 }
 
 void R3DFrameBuffers::DrawOverTransLayers()
 {
+	GPUTimer::Begin(GPUTimer::Composite);
+
 	SetFBO(Layer::trans12);							// need to write to both layers
 
-	glViewport	(0, 0, m_width, m_height);			// cover the entire screen
+	glViewport	(0, 0, m_scaledWidth, m_scaledHeight);	// cover the rendered part of the buffers
 	glDisable	(GL_DEPTH_TEST);					// disable depth testing / writing
 	glDisable	(GL_CULL_FACE);
 	glDisable	(GL_BLEND);
@@ -441,17 +547,22 @@ void R3DFrameBuffers::DrawOverTransLayers()
 	glBindVertexArray(m_vao);
 	m_shaderWipe.EnableShader();
 	glUniform1i(m_shaderWipe.uniformLoc[0], 0);
+	SetTexScale(m_shaderWipe, 1, false);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 	m_shaderWipe.DisableShader();
 	glBindVertexArray(0);
+
+	GPUTimer::End(GPUTimer::Composite);
 }
 
 void R3DFrameBuffers::DrawBaseLayer()
 {
 	m_shaderBase.EnableShader();
 	glUniform1i(m_shaderTrans.uniformLoc[0], 0);		// to do check this
+	SetTexScale(m_shaderBase, 1, true);
+	glUniform1f(m_shaderBase.uniformLoc[2], m_scale < 1.0f ? (1.0f - m_scale) : 0.0f);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
@@ -463,6 +574,7 @@ void R3DFrameBuffers::DrawAlphaLayer()
 	m_shaderTrans.EnableShader();
 	glUniform1i(m_shaderTrans.uniformLoc[0], 1);		// tex unit 1
 	glUniform1i(m_shaderTrans.uniformLoc[1], 2);		// tex unit 2
+	SetTexScale(m_shaderTrans, 2, true);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
@@ -26,6 +26,9 @@ public:
 	void	SetFBO(Layer layer);
 	void	StoreDepth();
 	void	RestoreDepth();
+	void	SetScale(float scale);	// render into the bottom left part of the buffers only, the composite passes scale it up to the whole screen
+	float	GetScale() const { return m_scale; }
+	double	PassBytes(int surfaces) const { return (double)m_width * m_height * 4 * surfaces; }	// traffic of a full screen pass reading or writing this many 32 bit surfaces
 
 private:
 
@@ -37,6 +40,8 @@ private:
 
 	void	DrawBaseLayer();
 	void	DrawAlphaLayer();
+	void	SetScissor(bool scaled);
+	void	SetTexScale(const GLSLShader& shader, int loc, bool composite) const;
 
 	GLuint m_frameBufferID;
 	GLuint m_renderBufferID;
@@ -46,6 +51,10 @@ private:
 	Layer m_lastLayer;
 	int m_width;
 	int m_height;
+	float m_scale;
+	int m_scaledWidth;
+	int m_scaledHeight;
+	GLint m_scissor[4];		// scissor box of the back buffer
 
 	// shaders
 	GLSLShader m_shaderBase;
@@ -1,6 +1,7 @@
 #include "R3DShader.h"
 #include "R3DShaderQuads.h"
 #include "R3DShaderTriangles.h"
+#include "Graphics/ShaderCache.h"
 
 // having 2 sets of shaders to maintain is really less than ideal
 // but hopefully not too many breaking changes at this point
@@ -10,10 +11,13 @@ namespace New3D {
 R3DShader::R3DShader(const Util::Config::Node &config)
 	: m_config(config)
 {
-	m_shaderProgram		= 0;
-	m_vertexShader		= 0;
-	m_geoShader			= 0;
-	m_fragmentShader	= 0;
+	m_prog				= &m_uber;
+	m_permutations		= false;
+	m_numPermutations	= 0;
+	m_compiledThisFrame	= false;
+	m_vertexPulling		= false;
+	m_discardAlpha		= false;
+	m_textureCache		= nullptr;
 
 	Start();	// reset attributes
 }
@@ -50,130 +54,276 @@ void R3DShader::Start()
 	m_texWrapMode[0]	= 0;
 	m_texWrapMode[1]	= 0;
 
+	m_decodedTexture	= false;
+	m_decodedLayer		= -1;
+
 	m_dirtyMesh			= true;			// dirty means all the above are dirty, ie first run
 	m_dirtyModel		= true;
+	m_model				= nullptr;
 }
 
 bool R3DShader::LoadShader(const char* vertexShader, const char* fragmentShader)
 {
-	bool quads = m_config["QuadRendering"].ValueAs<bool>();
-
-	const char* vShader = vertexShaderR3D;
-	const char* gShader = "";
-	const char* fShader = fragmentShaderR3D;
+	bool quads		= m_config["QuadRendering"].ValueAs<bool>();
+	m_vertexPulling	= quads && m_config["QuadVertexPulling"].ValueAs<bool>();
+	m_permutations	= m_config["ShaderPermutations"].ValueAs<bool>();
 
-	std::string fragmentShaderCombined;
+	m_vShaderSource = vertexShaderR3D;
+	m_gShaderSource.clear();
+	m_fShaderSource = fragmentShaderR3D;
 
 	if (quads) {
-		vShader = vertexShaderR3DQuads;
-		gShader = geometryShaderR3DQuads;
+		m_vShaderSource = m_vertexPulling ? vertexShaderR3DQuadsPull : vertexShaderR3DQuads;
+		m_gShaderSource = m_vertexPulling ? "" : geometryShaderR3DQuads;
+		m_fShaderSource = fragmentShaderR3DQuads1;
+		m_fShaderSource += fragmentShaderR3DQuads2;
+	}
+
+	const char* vShader = m_vShaderSource.c_str();
+	const char* gShader = m_gShaderSource.c_str();
+	const char* fShader = m_fShaderSource.c_str();
 
-		fragmentShaderCombined += fragmentShaderR3DQuads1;
-		fragmentShaderCombined += fragmentShaderR3DQuads2;
-		fShader = fragmentShaderCombined.c_str();
+	m_uber.id = glCreateProgram();
+
+	if (!ShaderCache::Load(m_uber.id, { vShader, gShader, fShader })) {
+		CompileShader(m_uber.id, vShader, gShader, fShader);
+		ShaderCache::Save(m_uber.id, { vShader, gShader, fShader });
 	}
 
-	m_shaderProgram		= glCreateProgram();
-	m_vertexShader		= glCreateShader(GL_VERTEX_SHADER);
-	m_fragmentShader	= glCreateShader(GL_FRAGMENT_SHADER);
+	GetUniformLocations(m_uber);
 
-	glShaderSource(m_vertexShader,		1, (const GLchar **)&vShader, NULL);
-	glShaderSource(m_fragmentShader,	1, (const GLchar **)&fShader, NULL);
+	m_prog				= &m_uber;
+	m_numPermutations	= 0;
+	m_compiledThisFrame	= false;
 
-	glCompileShader(m_vertexShader);
-	glCompileShader(m_fragmentShader);
+	return true;
+}
 
-	if (quads) {
-		m_geoShader = glCreateShader(GL_GEOMETRY_SHADER);
-		glShaderSource(m_geoShader, 1, (const GLchar **)&gShader, NULL);
-		glCompileShader(m_geoShader);
-		glAttachShader(m_shaderProgram, m_geoShader);
-		PrintShaderResult(m_geoShader);
-	}
-
-	PrintShaderResult(m_vertexShader);
-	PrintShaderResult(m_fragmentShader);
-
-	glAttachShader(m_shaderProgram, m_vertexShader);
-	glAttachShader(m_shaderProgram, m_fragmentShader);
-	glLinkProgram(m_shaderProgram);
-
-	PrintProgramResult(m_shaderProgram);
-
-	m_locTexture1			= glGetUniformLocation(m_shaderProgram, "tex1");
-	m_locTexture1Enabled	= glGetUniformLocation(m_shaderProgram, "textureEnabled");
-	m_locTexture2Enabled	= glGetUniformLocation(m_shaderProgram, "microTexture");
-	m_locTextureAlpha		= glGetUniformLocation(m_shaderProgram, "textureAlpha");
-	m_locAlphaTest			= glGetUniformLocation(m_shaderProgram, "alphaTest");
-	m_locMicroTexScale		= glGetUniformLocation(m_shaderProgram, "microTextureScale");
-	m_locMicroTexID			= glGetUniformLocation(m_shaderProgram, "microTextureID");
-	m_locBaseTexInfo		= glGetUniformLocation(m_shaderProgram, "baseTexInfo");
-	m_locBaseTexType		= glGetUniformLocation(m_shaderProgram, "baseTexType");
-	m_locTextureInverted	= glGetUniformLocation(m_shaderProgram, "textureInverted");
-	m_locTexWrapMode		= glGetUniformLocation(m_shaderProgram, "textureWrapMode");
-
-	m_locFogIntensity		= glGetUniformLocation(m_shaderProgram, "fogIntensity");
-	m_locFogDensity			= glGetUniformLocation(m_shaderProgram, "fogDensity");
-	m_locFogStart			= glGetUniformLocation(m_shaderProgram, "fogStart");
-	m_locFogColour			= glGetUniformLocation(m_shaderProgram, "fogColour");
-	m_locFogAttenuation		= glGetUniformLocation(m_shaderProgram, "fogAttenuation");
-	m_locFogAmbient			= glGetUniformLocation(m_shaderProgram, "fogAmbient");
-
-	m_locLighting			= glGetUniformLocation(m_shaderProgram, "lighting");
-	m_locLightEnabled		= glGetUniformLocation(m_shaderProgram, "lightEnabled");
-	m_locSunClamp			= glGetUniformLocation(m_shaderProgram, "sunClamp");
-	m_locIntensityClamp		= glGetUniformLocation(m_shaderProgram, "intensityClamp");
-	m_locShininess			= glGetUniformLocation(m_shaderProgram, "shininess");
-	m_locSpecularValue		= glGetUniformLocation(m_shaderProgram, "specularValue");
-	m_locSpecularEnabled	= glGetUniformLocation(m_shaderProgram, "specularEnabled");
-	m_locFixedShading		= glGetUniformLocation(m_shaderProgram, "fixedShading");
-	m_locTranslatorMap		= glGetUniformLocation(m_shaderProgram, "translatorMap");
-
-	m_locSpotEllipse		= glGetUniformLocation(m_shaderProgram, "spotEllipse");
-	m_locSpotRange			= glGetUniformLocation(m_shaderProgram, "spotRange");
-	m_locSpotColor			= glGetUniformLocation(m_shaderProgram, "spotColor");
-	m_locSpotFogColor		= glGetUniformLocation(m_shaderProgram, "spotFogColor");
-	m_locModelScale			= glGetUniformLocation(m_shaderProgram, "modelScale");
-
-	m_locProjMat			= glGetUniformLocation(m_shaderProgram, "projMat");
-	m_locModelMat			= glGetUniformLocation(m_shaderProgram, "modelMat");
-
-	m_locHardwareStep		= glGetUniformLocation(m_shaderProgram, "hardwareStep");
-	m_locDiscardAlpha		= glGetUniformLocation(m_shaderProgram, "discardAlpha");
+void R3DShader::GetUniformLocations(Program& program)
+{
+	GLuint id = program.id;
+
+	program.locTexture1			= glGetUniformLocation(id, "tex1");
+	program.locTexture1Enabled	= glGetUniformLocation(id, "textureEnabled");
+	program.locTexture2Enabled	= glGetUniformLocation(id, "microTexture");
+	program.locTextureAlpha		= glGetUniformLocation(id, "textureAlpha");
+	program.locAlphaTest		= glGetUniformLocation(id, "alphaTest");
+	program.locMicroTexScale	= glGetUniformLocation(id, "microTextureScale");
+	program.locMicroTexID		= glGetUniformLocation(id, "microTextureID");
+	program.locBaseTexInfo		= glGetUniformLocation(id, "baseTexInfo");
+	program.locBaseTexType		= glGetUniformLocation(id, "baseTexType");
+	program.locTextureInverted	= glGetUniformLocation(id, "textureInverted");
+	program.locTexWrapMode		= glGetUniformLocation(id, "textureWrapMode");
+	program.locDecodedTexture	= glGetUniformLocation(id, "decodedTexture");
+	program.locDecodedTex		= glGetUniformLocation(id, "decodedTex");
+	program.locDecodedLayer		= glGetUniformLocation(id, "decodedLayer");
+
+	program.locFogIntensity		= glGetUniformLocation(id, "fogIntensity");
+	program.locFogDensity		= glGetUniformLocation(id, "fogDensity");
+	program.locFogStart			= glGetUniformLocation(id, "fogStart");
+	program.locFogColour		= glGetUniformLocation(id, "fogColour");
+	program.locFogAttenuation	= glGetUniformLocation(id, "fogAttenuation");
+	program.locFogAmbient		= glGetUniformLocation(id, "fogAmbient");
+
+	program.locLighting			= glGetUniformLocation(id, "lighting");
+	program.locLightEnabled		= glGetUniformLocation(id, "lightEnabled");
+	program.locSunClamp			= glGetUniformLocation(id, "sunClamp");
+	program.locIntensityClamp	= glGetUniformLocation(id, "intensityClamp");
+	program.locShininess		= glGetUniformLocation(id, "shininess");
+	program.locSpecularValue	= glGetUniformLocation(id, "specularValue");
+	program.locSpecularEnabled	= glGetUniformLocation(id, "specularEnabled");
+	program.locFixedShading		= glGetUniformLocation(id, "fixedShading");
+	program.locTranslatorMap	= glGetUniformLocation(id, "translatorMap");
+
+	program.locSpotEllipse		= glGetUniformLocation(id, "spotEllipse");
+	program.locSpotRange		= glGetUniformLocation(id, "spotRange");
+	program.locSpotColor		= glGetUniformLocation(id, "spotColor");
+	program.locSpotFogColor		= glGetUniformLocation(id, "spotFogColor");
+	program.locModelScale		= glGetUniformLocation(id, "modelScale");
+
+	program.locProjMat			= glGetUniformLocation(id, "projMat");
+	program.locModelMat			= glGetUniformLocation(id, "modelMat");
+	program.locInstanced		= glGetUniformLocation(id, "instanced");
+
+	program.locHardwareStep		= glGetUniformLocation(id, "hardwareStep");
+	program.locDiscardAlpha		= glGetUniformLocation(id, "discardAlpha");
+
+	program.viewport			= nullptr;
+	program.instanced			= false;
+	program.discardAlpha		= false;
+}
+
+void R3DShader::CompileShader(GLuint program, const char* vShader, const char* gShader, const char* fShader)
+{
+	GLuint vertexShader		= glCreateShader(GL_VERTEX_SHADER);
+	GLuint fragmentShader	= glCreateShader(GL_FRAGMENT_SHADER);
+
+	glShaderSource(vertexShader,	1, (const GLchar **)&vShader, NULL);
+	glShaderSource(fragmentShader,	1, (const GLchar **)&fShader, NULL);
+
+	glCompileShader(vertexShader);
+	glCompileShader(fragmentShader);
+
+	if (gShader[0]) {
+		GLuint geoShader = glCreateShader(GL_GEOMETRY_SHADER);
+		glShaderSource(geoShader, 1, (const GLchar **)&gShader, NULL);
+		glCompileShader(geoShader);
+		glAttachShader(program, geoShader);
+		PrintShaderResult(geoShader);
+		glDeleteShader(geoShader);		// freed with the program
+	}
+
+	PrintShaderResult(vertexShader);
+	PrintShaderResult(fragmentShader);
+
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	glLinkProgram(program);
+
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+
+	PrintProgramResult(program);
+}
+
+// bits of the PERMUTATION define in the fragment shaders
+int R3DShader::PermutationKey(const Mesh* m)
+{
+	return	(m->textured		? 1 : 0)	|
+			(m->microTexture	? 2 : 0)	|
+			(m->alphaTest		? 4 : 0)	|
+			(m->textureAlpha	? 8 : 0)	|
+			(m->lighting		? 16 : 0)	|
+			(m->specular		? 32 : 0)	|
+			(m->fixedShading	? 64 : 0);
+}
+
+bool R3DShader::LoadPermutation(int key)
+{
+	static const char* attribs[] = { "inVertex", "inNormal", "inTexCoord", "inColour", "inFaceNormal", "inFixedShade", "inInstanceMat" };
+
+	Program& program = m_permutation[key];
+
+	// the define goes after the #version line, which must come first
+	std::string fShader = m_fShaderSource;
+	size_t pos = fShader.find('\n', fShader.find("#version"));
+	fShader.insert(pos + 1, "#define PERMUTATION " + std::to_string(key) + "\n");
+
+	const char* vShader = m_vShaderSource.c_str();
+	const char* gShader = m_gShaderSource.c_str();
+
+	program.id = glCreateProgram();
+
+	bool cached = ShaderCache::Load(program.id, { vShader, gShader, fShader.c_str() });
+
+	if (!cached) {
+
+		if (m_compiledThisFrame) {
+			glDeleteProgram(program.id);		// try again next frame
+			program.id = 0;
+			return false;
+		}
+
+		// the vertex array is set up for the uber-shader's attribute locations
+		for (auto a : attribs) {
+			GLint loc = glGetAttribLocation(m_uber.id, a);
+			if (loc >= 0) {
+				glBindAttribLocation(program.id, loc, a);
+			}
+		}
+
+		CompileShader(program.id, vShader, gShader, fShader.c_str());
+		m_compiledThisFrame = true;
+	}
+
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program.id, GL_LINK_STATUS, &linked);
+
+	bool matching = true;
+	for (auto a : attribs) {
+		matching = matching && glGetAttribLocation(program.id, a) == glGetAttribLocation(m_uber.id, a);
+	}
+
+	if (!linked || !matching) {
+		glDeleteProgram(program.id);
+		program.id		= 0;
+		program.failed	= true;
+		return false;
+	}
+
+	if (!cached) {
+		ShaderCache::Save(program.id, { vShader, gShader, fShader.c_str() });
+	}
+
+	GetUniformLocations(program);
+	m_numPermutations++;
 
 	return true;
 }
 
-void R3DShader::UnloadShader()
+void R3DShader::UseProgram(Program& program)
 {
-	// make sure no shader is bound
-	glUseProgram(0);
+	glUseProgram(program.id);
+	m_prog = &program;
+
+	if (program.discardAlpha != m_discardAlpha) {
+		glUniform1i(program.locDiscardAlpha, m_discardAlpha);
+		program.discardAlpha = m_discardAlpha;
+	}
 
-	if (m_vertexShader) {
-		glDeleteShader(m_vertexShader);
-		m_vertexShader = 0;
+	// mesh and model values were cached for the previous program
+	m_dirtyMesh		= true;
+	m_dirtyModel	= true;
+}
+
+bool R3DShader::SelectProgram(const Mesh* m)
+{
+	Program* program = &m_uber;
+
+	if (m_permutations) {
+
+		int key = PermutationKey(m);
+		Program& p = m_permutation[key];
+
+		if (p.id || (!p.failed && m_numPermutations < MaxPermutations && LoadPermutation(key))) {
+			program = &p;
+		}
 	}
 
-	if (m_geoShader) {
-		glDeleteShader(m_geoShader);
-		m_geoShader = 0;
+	if (program == m_prog) {
+		return false;
 	}
 
-	if (m_fragmentShader) {
-		glDeleteShader(m_fragmentShader);
-		m_fragmentShader = 0;
+	UseProgram(*program);
+
+	return true;
+}
+
+void R3DShader::UnloadShader()
+{
+	// make sure no shader is bound
+	glUseProgram(0);
+
+	if (m_uber.id) {
+		glDeleteProgram(m_uber.id);
+		m_uber.id = 0;
 	}
 
-	if (m_shaderProgram) {
-		glDeleteProgram(m_shaderProgram);
-		m_shaderProgram = 0;
+	for (auto& p : m_permutation) {
+		if (p.id) {
+			glDeleteProgram(p.id);
+		}
+		p = Program();
 	}
+
+	m_prog = &m_uber;
+	m_numPermutations = 0;
 }
 
 GLint R3DShader::GetVertexAttribPos(const std::string& attrib)
 {
 	if (m_vertexLocCache.count(attrib)==0) {
-		auto pos = glGetAttribLocation(m_shaderProgram, attrib.c_str());
+		auto pos = glGetAttribLocation(m_uber.id, attrib.c_str());
 		m_vertexLocCache[attrib] = pos;
 	}
 
@@ -183,7 +333,7 @@ GLint R3DShader::GetVertexAttribPos(const std::string& attrib)
 void R3DShader::SetShader(bool enable)
 {
 	if (enable) {
-		glUseProgram(m_shaderProgram);
+		UseProgram(m_uber);
 		Start();
 		DiscardAlpha(false);	// need some default
 	}
@@ -199,26 +349,27 @@ void R3DShader::SetMeshUniforms(const Mesh* m)
 	}
 
 	if (m_dirtyMesh) {
-		glUniform1i(m_locTexture1, 0);
+		glUniform1i(m_prog->locTexture1, 0);
+		glUniform1i(m_prog->locDecodedTex, 1);
 	}
 
 	if (m_dirtyMesh || m->textured != m_textured1) {
-		glUniform1i(m_locTexture1Enabled, m->textured);
+		glUniform1i(m_prog->locTexture1Enabled, m->textured);
 		m_textured1 = m->textured;
 	}
 
 	if (m_dirtyMesh || m->microTexture != m_textured2) {
-		glUniform1i(m_locTexture2Enabled, m->microTexture);
+		glUniform1i(m_prog->locTexture2Enabled, m->microTexture);
 		m_textured2 = m->microTexture;
 	}
 
 	if (m_dirtyMesh || m->microTextureScale != m_microTexScale) {
-		glUniform1f(m_locMicroTexScale, m->microTextureScale);
+		glUniform1f(m_prog->locMicroTexScale, m->microTextureScale);
 		m_microTexScale = m->microTextureScale;
 	}
 
 	if (m_dirtyMesh || m->microTextureID != m_microTexID) {
-		glUniform1i(m_locMicroTexID, m->microTextureID);
+		glUniform1i(m_prog->locMicroTexID, m->microTextureID);
 		m_microTexID = m->microTextureID;
 	}
 
@@ -232,68 +383,90 @@ void R3DShader::SetMeshUniforms(const Mesh* m)
 		int translatedX, translatedY;
 		CalcTexOffset(m_transX, m_transY, m_transPage, m->x, m->y, translatedX, translatedY);	// need to apply model translation
 
-		glUniform4i(m_locBaseTexInfo, translatedX, translatedY, m->width, m->height);
+		glUniform4i(m_prog->locBaseTexInfo, translatedX, translatedY, m->width, m->height);
 	}
 
 	if (m_dirtyMesh || m_baseTexType != m->format) {
 		m_baseTexType = m->format;
-		glUniform1i(m_locBaseTexType,  m_baseTexType);
+		glUniform1i(m_prog->locBaseTexType,  m_baseTexType);
 	}
 
 	if (m_dirtyMesh || m->inverted != m_textureInverted) {
-		glUniform1i(m_locTextureInverted, m->inverted);
+		glUniform1i(m_prog->locTextureInverted, m->inverted);
 		m_textureInverted = m->inverted;
 	}
 
 	if (m_dirtyMesh || m->alphaTest != m_alphaTest) {
-		glUniform1i(m_locAlphaTest, m->alphaTest);
+		glUniform1i(m_prog->locAlphaTest, m->alphaTest);
 		m_alphaTest = m->alphaTest;
 	}
 
 	if (m_dirtyMesh || m->textureAlpha != m_textureAlpha) {
-		glUniform1i(m_locTextureAlpha, m->textureAlpha);
+		glUniform1i(m_prog->locTextureAlpha, m->textureAlpha);
 		m_textureAlpha = m->textureAlpha;
 	}
 
 	if (m_dirtyMesh || m->fogIntensity != m_fogIntensity) {
-		glUniform1f(m_locFogIntensity, m->fogIntensity);
+		glUniform1f(m_prog->locFogIntensity, m->fogIntensity);
 		m_fogIntensity = m->fogIntensity;
 	}
 
 	if (m_dirtyMesh || m->lighting != m_lightEnabled) {
-		glUniform1i(m_locLightEnabled, m->lighting);
+		glUniform1i(m_prog->locLightEnabled, m->lighting);
 		m_lightEnabled = m->lighting;
 	}
 
 	if (m_dirtyMesh || m->shininess != m_shininess) {
-		glUniform1f(m_locShininess, m->shininess);
+		glUniform1f(m_prog->locShininess, m->shininess);
 		m_shininess = m->shininess;
 	}
 
 	if (m_dirtyMesh || m->specular != m_specularEnabled) {
-		glUniform1i(m_locSpecularEnabled, m->specular);
+		glUniform1i(m_prog->locSpecularEnabled, m->specular);
 		m_specularEnabled = m->specular;
 	}
 
 	if (m_dirtyMesh || m->specularValue != m_specularValue) {
-		glUniform1f(m_locSpecularValue, m->specularValue);
+		glUniform1f(m_prog->locSpecularValue, m->specularValue);
 		m_specularValue = m->specularValue;
 	}
 
 	if (m_dirtyMesh || m->fixedShading != m_fixedShading) {
-		glUniform1i(m_locFixedShading, m->fixedShading);
+		glUniform1i(m_prog->locFixedShading, m->fixedShading);
 		m_fixedShading = m->fixedShading;
 	}
 
 	if (m_dirtyMesh || m->translatorMap != m_translatorMap) {
-		glUniform1i(m_locTranslatorMap, m->translatorMap);
+		glUniform1i(m_prog->locTranslatorMap, m->translatorMap);
 		m_translatorMap = m->translatorMap;
 	}
 
 	if (m_dirtyMesh || m->wrapModeU != m_texWrapMode[0] || m->wrapModeV != m_texWrapMode[1]) {
 		m_texWrapMode[0] = m->wrapModeU;
 		m_texWrapMode[1] = m->wrapModeV;
-		glUniform2iv(m_locTexWrapMode, 1, m_texWrapMode);
+		glUniform2iv(m_prog->locTexWrapMode, 1, m_texWrapMode);
+	}
+
+	if (m_textureCache) {
+
+		bool	decoded	= false;
+		int		layer	= m_decodedLayer;
+
+		if (m->textured) {
+			int translatedX, translatedY;
+			CalcTexOffset(m_transX, m_transY, m_transPage, m->x, m->y, translatedX, translatedY);
+			decoded = m_textureCache->Bind(1, translatedX, translatedY, m->width, m->height, m->format, m->alphaTest, m->wrapModeU, m->wrapModeV, layer);
+		}
+
+		if (m_dirtyMesh || decoded != m_decodedTexture) {
+			glUniform1i(m_prog->locDecodedTexture, decoded);
+			m_decodedTexture = decoded;
+		}
+
+		if (decoded && (m_dirtyMesh || layer != m_decodedLayer)) {
+			glUniform1i(m_prog->locDecodedLayer, layer);
+			m_decodedLayer = layer;
+		}
 	}
 
 	if (m_dirtyMesh || m->layered != m_layered) {
@@ -309,32 +482,56 @@ void R3DShader::SetMeshUniforms(const Mesh* m)
 	m_dirtyMesh = false;
 }
 
+void R3DShader::NewFrame()
+{
+	// viewports are rebuilt each frame
+	m_uber.viewport = nullptr;
+
+	for (auto& p : m_permutation) {
+		p.viewport = nullptr;
+	}
+
+	m_compiledThisFrame = false;
+}
+
 void R3DShader::SetViewportUniforms(const Viewport *vp)
 {
-	//didn't bother caching these, they don't get frequently called anyway
-	glUniform1f(m_locFogDensity, vp->fogParams[3]);
-	glUniform1f(m_locFogStart, vp->fogParams[4]);
-	glUniform3fv(m_locFogColour, 1, vp->fogParams);
-	glUniform1f(m_locFogAttenuation, vp->fogParams[5]);
-	glUniform1f(m_locFogAmbient, vp->fogParams[6]);
-
-	glUniform3fv(m_locLighting, 2, vp->lightingParams);
-	glUniform1i(m_locSunClamp, vp->sunClamp);
-	glUniform1i(m_locIntensityClamp, vp->intensityClamp);
-	glUniform4fv(m_locSpotEllipse, 1, vp->spotEllipse);
-	glUniform2fv(m_locSpotRange, 1, vp->spotRange);
-	glUniform3fv(m_locSpotColor, 1, vp->spotColor);
-	glUniform3fv(m_locSpotFogColor, 1, vp->spotFogColor);
-
-	glUniformMatrix4fv(m_locProjMat, 1, GL_FALSE, vp->projectionMatrix);
-
-	glUniform1i(m_locHardwareStep, vp->hardwareStep);
+	// viewports don't change within a frame, so these are only set again for a different one
+	if (vp == m_prog->viewport) {
+		return;
+	}
+
+	m_prog->viewport = vp;
+
+	glUniform1f(m_prog->locFogDensity, vp->fogParams[3]);
+	glUniform1f(m_prog->locFogStart, vp->fogParams[4]);
+	glUniform3fv(m_prog->locFogColour, 1, vp->fogParams);
+	glUniform1f(m_prog->locFogAttenuation, vp->fogParams[5]);
+	glUniform1f(m_prog->locFogAmbient, vp->fogParams[6]);
+
+	glUniform3fv(m_prog->locLighting, 2, vp->lightingParams);
+	glUniform1i(m_prog->locSunClamp, vp->sunClamp);
+	glUniform1i(m_prog->locIntensityClamp, vp->intensityClamp);
+	glUniform4fv(m_prog->locSpotEllipse, 1, vp->spotEllipse);
+	glUniform2fv(m_prog->locSpotRange, 1, vp->spotRange);
+	glUniform3fv(m_prog->locSpotColor, 1, vp->spotColor);
+	glUniform3fv(m_prog->locSpotFogColor, 1, vp->spotFogColor);
+
+	glUniformMatrix4fv(m_prog->locProjMat, 1, GL_FALSE, vp->projectionMatrix);
+
+	glUniform1i(m_prog->locHardwareStep, vp->hardwareStep);
 }
 
 void R3DShader::SetModelStates(const Model* model)
 {
+	if (!m_dirtyModel && model == m_model) {
+		return;			// still set, along with the texture values cached for its meshes
+	}
+
+	m_model = model;
+
 	if (m_dirtyModel || model->scale != m_modelScale) {
-		glUniform1f(m_locModelScale, model->scale);
+		glUniform1f(m_prog->locModelScale, model->scale);
 		m_modelScale = model->scale;
 	}
 
@@ -345,14 +542,32 @@ void R3DShader::SetModelStates(const Model* model)
 	// reset texture values
 	for (auto& i : m_baseTexInfo) { i = -1; }
 
-	glUniformMatrix4fv(m_locModelMat, 1, GL_FALSE, model->modelMat);
+	glUniformMatrix4fv(m_prog->locModelMat, 1, GL_FALSE, model->modelMat);
 
 	m_dirtyModel = false;
 }
 
+void R3DShader::SetTextureCache(TextureCache* cache)
+{
+	m_textureCache = cache;
+}
+
+void R3DShader::SetInstanced(bool instanced)
+{
+	if (instanced != m_prog->instanced) {
+		glUniform1i(m_prog->locInstanced, instanced);
+		m_prog->instanced = instanced;
+	}
+}
+
 void R3DShader::DiscardAlpha(bool discard)
 {
-	glUniform1i(m_locDiscardAlpha, discard);
+	m_discardAlpha = discard;
+
+	if (discard != m_prog->discardAlpha) {
+		glUniform1i(m_prog->locDiscardAlpha, discard);
+		m_prog->discardAlpha = discard;
+	}
 }
 
 void R3DShader::PrintShaderResult(GLuint shader)
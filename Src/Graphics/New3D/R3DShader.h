@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #include "Util/NewConfig.h"
 #include "Model.h"
+#include "TextureCache.h"
 #include <map>
 #include <string>
 
@@ -16,16 +17,94 @@ public:
 
 	bool	LoadShader			(const char* vertexShader = nullptr, const char* fragmentShader = nullptr);
 	void	UnloadShader		();
+	bool	SelectProgram		(const Mesh* m);			// switch to the permutation for the mesh's state, true if the program changed
 	void	SetMeshUniforms		(const Mesh* m);
 	void	SetModelStates		(const Model* model);
 	void	SetViewportUniforms	(const Viewport *vp);
+	void	SetInstanced		(bool instanced);			// take the model matrix from the instance attribute
+	void	SetTextureCache		(TextureCache* cache);		// sample decoded textures from it where possible, null for none
+	void	NewFrame			();
 	void	Start				();
 	void	SetShader			(bool enable = true);
 	GLint	GetVertexAttribPos	(const std::string& attrib);
 	void	DiscardAlpha		(bool discard);				// use to remove alpha from texture alpha only polys for 1st pass
+	bool	Permutations		() const { return m_permutations; }
+	bool	VertexPulling		() const { return m_vertexPulling; }	// quads are read from the vertex buffer bound as storage
+
+	static int PermutationKey	(const Mesh* m);			// mesh state the permutations are compiled for
 
 private:
 
+	static const int NumPermutations	= 128;				// 7 bits of state
+	static const int MaxPermutations	= 32;				// rarer combinations are drawn with the uber-shader
+
+	// a linked program and its uniform locations. the permutations have the mesh state as constants rather than
+	// uniforms, so their locations for those are -1, which gl ignores
+	struct Program
+	{
+		GLuint id		= 0;
+		bool failed		= false;		// permutation didn't link, don't try again
+
+		// uniforms kept across mesh and model changes, as last set in the program
+		const Viewport* viewport	= nullptr;		// until NewFrame()
+		bool instanced				= false;
+		bool discardAlpha			= false;
+
+		// mesh uniform locations
+		GLint locTexture1;
+		GLint locTexture1Enabled;
+		GLint locTexture2Enabled;
+		GLint locTextureAlpha;
+		GLint locAlphaTest;
+		GLint locMicroTexScale;
+		GLint locMicroTexID;
+		GLint locBaseTexInfo;
+		GLint locBaseTexType;
+		GLint locTextureInverted;
+		GLint locTexWrapMode;
+		GLint locTranslatorMap;
+		GLint locDecodedTexture;
+		GLint locDecodedTex;
+		GLint locDecodedLayer;
+
+		// viewport uniform locations
+		GLint locFogIntensity;
+		GLint locFogDensity;
+		GLint locFogStart;
+		GLint locFogColour;
+		GLint locFogAttenuation;
+		GLint locFogAmbient;
+		GLint locProjMat;
+
+		// lighting / other
+		GLint locLighting;
+		GLint locLightEnabled;
+		GLint locSunClamp;
+		GLint locIntensityClamp;
+		GLint locShininess;
+		GLint locSpecularValue;
+		GLint locSpecularEnabled;
+		GLint locFixedShading;
+
+		GLint locSpotEllipse;
+		GLint locSpotRange;
+		GLint locSpotColor;
+		GLint locSpotFogColor;
+
+		// model uniforms
+		GLint locModelScale;
+		GLint locModelMat;
+		GLint locInstanced;
+
+		// global uniforms
+		GLint locHardwareStep;
+		GLint locDiscardAlpha;
+	};
+
+	void CompileShader(GLuint program, const char* vShader, const char* gShader, const char* fShader);
+	void GetUniformLocations(Program& program);
+	bool LoadPermutation(int key);
+	void UseProgram(Program& program);
 	void PrintShaderResult(GLuint shader);
 	void PrintProgramResult(GLuint program);
 
@@ -34,25 +113,19 @@ private:
 	// run-time config
 	const Util::Config::Node &m_config;
 
-	// shader IDs
-	GLuint m_shaderProgram;
-	GLuint m_vertexShader;
-	GLuint m_geoShader;
-	GLuint m_fragmentShader;
-
-	// mesh uniform locations
-	GLint m_locTexture1;
-	GLint m_locTexture1Enabled;
-	GLint m_locTexture2Enabled;
-	GLint m_locTextureAlpha;
-	GLint m_locAlphaTest;
-	GLint m_locMicroTexScale;
-	GLint m_locMicroTexID;
-	GLint m_locBaseTexInfo;
-	GLint m_locBaseTexType;
-	GLint m_locTextureInverted;
-	GLint m_locTexWrapMode;
-	GLint m_locTranslatorMap;
+	// programs
+	Program		m_uber;								// mesh state as uniforms, draws anything
+	Program		m_permutation[NumPermutations];		// compiled as the states are first drawn
+	Program*	m_prog;								// in use
+	bool		m_permutations;
+	int			m_numPermutations;
+	bool		m_compiledThisFrame;				// one per frame at most, to spread out the stalls
+
+	// sources, kept to compile the permutations from
+	bool		m_vertexPulling;
+	std::string	m_vShaderSource;
+	std::string	m_gShaderSource;
+	std::string	m_fShaderSource;
 
 	// cached mesh values
 	bool	m_textured1;
@@ -74,6 +147,10 @@ private:
 	int		m_baseTexType;
 	int		m_texWrapMode[2];
 	bool	m_textureInverted;
+	bool	m_decodedTexture;
+	int		m_decodedLayer;
+
+	TextureCache*	m_textureCache;
 
 	// cached model values
 	float	m_modelScale;
@@ -85,37 +162,10 @@ private:
 	bool	m_dirtyMesh;
 	bool	m_dirtyModel;
 
-	// viewport uniform locations
-	GLint m_locFogIntensity;
-	GLint m_locFogDensity;
-	GLint m_locFogStart;
-	GLint m_locFogColour;
-	GLint m_locFogAttenuation;
-	GLint m_locFogAmbient;
-	GLint m_locProjMat;
-
-	// lighting / other
-	GLint m_locLighting;
-	GLint m_locLightEnabled;
-	GLint m_locSunClamp;
-	GLint m_locIntensityClamp;
-	GLint m_locShininess;
-	GLint m_locSpecularValue;
-	GLint m_locSpecularEnabled;
-	GLint m_locFixedShading;
-
-	GLint m_locSpotEllipse;
-	GLint m_locSpotRange;
-	GLint m_locSpotColor;
-	GLint m_locSpotFogColor;
-
-	// model uniforms
-	GLint m_locModelScale;
-	GLint m_locModelMat;
-
-	// global uniforms
-	GLint m_locHardwareStep;
-	GLint m_locDiscardAlpha;
+	// model whose uniforms are set, the passes of a frame revisit them
+	const Model*	m_model;		// kept until the shader is started again or the program changes
+
+	bool	m_discardAlpha;			// for the frame's pass, set in each program used
 
 	// vertex attribute position cache
 	std::map<std::string, GLint> m_vertexLocCache;
@@ -10,6 +10,7 @@ uniform float	modelScale;
 uniform mat4	modelMat;
 uniform mat4	projMat;
 uniform bool	translatorMap;
+uniform bool	instanced;			// model matrix comes from inInstanceMat
 
 // attributes
 in vec4		inVertex;
@@ -18,6 +19,7 @@ in vec2		inTexCoord;
 in vec3		inFaceNormal;		// used to emulate r3d culling 
 in float	inFixedShade;
 in vec4		inColour;
+in mat4		inInstanceMat;		// per instance
 
 // outputs to geometry shader
 
@@ -42,10 +44,10 @@ vec4 GetColour(vec4 colour)
 	return c;
 }
 
-float CalcBackFace(in vec3 viewVertex)
+float CalcBackFace(in vec3 viewVertex, in mat4 mvMat)
 {
 	vec3 vt = viewVertex; // - vec3(0.0);
-	vec3 vn = mat3(modelMat) * inFaceNormal;
+	vec3 vn = mat3(mvMat) * inFaceNormal;
 
 	// dot product of face normal with view direction
 	return dot(vt, vn);
@@ -53,13 +55,15 @@ float CalcBackFace(in vec3 viewVertex)
 
 void main(void)
 {
-	vs_out.viewVertex	= vec3(modelMat * inVertex);
-	vs_out.viewNormal	= (mat3(modelMat) * inNormal) / modelScale;
-	vs_out.discardPoly	= CalcBackFace(vs_out.viewVertex);
+	mat4 mvMat			= instanced ? inInstanceMat : modelMat;
+
+	vs_out.viewVertex	= vec3(mvMat * inVertex);
+	vs_out.viewNormal	= (mat3(mvMat) * inNormal) / modelScale;
+	vs_out.discardPoly	= CalcBackFace(vs_out.viewVertex, mvMat);
 	vs_out.color    	= GetColour(inColour);
 	vs_out.texCoord		= inTexCoord;
 	vs_out.fixedShade	= inFixedShade;
-	gl_Position			= projMat * modelMat * inVertex;
+	gl_Position			= projMat * mvMat * inVertex;
 }
 )glsl";
 
@@ -168,24 +172,183 @@ void main(void)
 
 )glsl";
 
+// alternative to the vertex and geometry shaders above, for gpus that are slow with geometry shaders. each quad is
+// drawn as 2 triangles, and each of their 6 vertices reads all 4 corners of the quad from the vertex buffer to give
+// the fragment shader the same outputs as the geometry shader would
+
+static const char *vertexShaderR3DQuadsPull = R"glsl(
+
+#version 450 core
+
+// uniforms
+uniform float	modelScale;
+uniform mat4	modelMat;
+uniform mat4	projMat;
+uniform bool	translatorMap;
+uniform bool	instanced;			// model matrix comes from inInstanceMat
+
+// the vertex buffer, 9 words a vertex laid out as PackedVertex
+layout(std430, binding = 0) readonly buffer Vertices
+{
+	uint vertexData[];
+};
+
+// attributes
+in mat4		inInstanceMat;		// per instance
+
+// outputs to fragment shader, as the geometry shader's
+
+out GS_OUT
+{
+	noperspective vec2 v[4];
+	noperspective float area[4];
+	flat float oneOverW[4];
+
+	//our regular attributes
+	flat vec3	viewVertex[4];
+	flat vec3	viewNormal[4];		// per vertex normal vector
+	flat vec2	texCoord[4];
+	flat vec4	color;
+	flat float	fixedShade[4];
+} vs_out;
+
+vec4 GetColour(vec4 colour)
+{
+	vec4 c = colour;
+
+	if(translatorMap) {
+		c.rgb *= 16.0;
+	}
+
+	return c;
+}
+
+// signed normalised 10:10:10:2, converted as gl does for the vertex attributes
+vec3 UnpackNormal(uint data)
+{
+	int d = int(data);
+	vec3 n = vec3(bitfieldExtract(d, 0, 10), bitfieldExtract(d, 10, 10), bitfieldExtract(d, 20, 10));
+
+	return max(n / 511.0, -1.0);
+}
+
+//a*b - c*d, computed in a stable fashion (Kahan)
+float DifferenceOfProducts(float a, float b, float c, float d)
+{
+    precise float cd = c * d;
+    precise float err = fma(-c, d, cd);
+    precise float dop = fma(a, b, -cd);
+    return dop + err;
+}
+
+void main(void)
+{
+	// corners of the quad (0-3 counter clockwise) for the vertices of its 2 triangles, as the geometry shader's strip
+	const int corners[6] = int[]( 1, 0, 2, 2, 0, 3 );
+
+	int quad	= gl_VertexID / 6;
+	int corner	= corners[gl_VertexID % 6];
+	mat4 mvMat	= instanced ? inInstanceMat : modelMat;
+
+	vec4 position[4];
+	vec2 v[4];
+	vec3 viewVertex0;
+
+	for (int i=0; i<4; i++) {
+		int base			= (quad * 4 + i) * 9;
+		vec4 vertex			= vec4(uintBitsToFloat(vertexData[base]), uintBitsToFloat(vertexData[base + 1]), uintBitsToFloat(vertexData[base + 2]), 1.0);
+		vec3 viewVertex		= vec3(mvMat * vertex);
+		vec3 viewNormal		= (mat3(mvMat) * UnpackNormal(vertexData[base + 3])) / modelScale;
+		vec2 texCoord		= vec2(uintBitsToFloat(vertexData[base + 4]), uintBitsToFloat(vertexData[base + 5]));
+		float fixedShade	= unpackSnorm2x16(vertexData[base + 8]).x;
+
+		position[i]			= projMat * mvMat * vertex;
+
+		float oneOverW		= 1.0 / position[i].w;
+		vs_out.oneOverW[i]	= oneOverW;
+		v[i]				= position[i].xy * oneOverW;
+
+		// our regular vertex attribs
+		vs_out.viewVertex[i]	= viewVertex * oneOverW;
+		vs_out.viewNormal[i]	= viewNormal * oneOverW;
+		vs_out.texCoord[i]		= texCoord   * oneOverW;
+		vs_out.fixedShade[i]	= fixedShade * oneOverW;
+
+		if (i == 0) {
+			viewVertex0 = viewVertex;
+		}
+	}
+
+	// emulate back face culling, the face normal is the same for all 4 corners. a degenerate triangle draws nothing
+	vec3 faceNormal = mat3(mvMat) * UnpackNormal(vertexData[quad * 36 + 6]);
+
+	if (dot(viewVertex0, faceNormal) > 0) {
+		gl_Position = vec4(0.0);
+		return;
+	}
+
+	// flat attributes
+	vs_out.color = GetColour(unpackUnorm4x8(vertexData[quad * 36 + 7]));
+
+	// crossproducts for all vertex combinations for the area computation below
+	precise float cross[4][4];
+	for (int i=0; i<4; i++)
+	{
+		cross[i][i] = 0.0;
+		for (int j=i+1; j<4; j++)
+			cross[i][j] = DifferenceOfProducts(position[i].x, position[j].y, position[j].x, position[i].y) / (position[i].w * position[j].w);
+	}
+	for (int i=1; i<4; i++)
+		for (int j=0; j<i; j++)
+			cross[i][j] = -cross[j][i];
+
+	for (int j=0; j<4; j++) {
+		vs_out.v[j] = v[j] - v[corner];
+		int j_next = (j+1) % 4;
+		// compute area via shoelace algorithm BUT divided by w afterwards to improve precision!
+		vs_out.area[j] = cross[j][j_next] + cross[j_next][corner] + cross[corner][j];
+	}
+
+	gl_Position = position[corner];
+}
+)glsl";
+
 static const char *fragmentShaderR3DQuads1 = R"glsl(
 
 #version 450 core
 
 uniform usampler2D tex1;			// entire texture sheet
 
-// texturing
+// mesh state, constants in the permutations compiled for it
+#ifdef PERMUTATION
+const bool	textureEnabled	= (PERMUTATION & 1) != 0;
+const bool	microTexture	= (PERMUTATION & 2) != 0;
+const bool	alphaTest		= (PERMUTATION & 4) != 0;
+const bool	textureAlpha	= (PERMUTATION & 8) != 0;
+const bool	lightEnabled	= (PERMUTATION & 16) != 0;	// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
+const bool	specularEnabled	= (PERMUTATION & 32) != 0;
+const bool	fixedShading	= (PERMUTATION & 64) != 0;
+#else
 uniform bool	textureEnabled;
 uniform bool	microTexture;
+uniform bool	alphaTest;
+uniform bool	textureAlpha;
+uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
+uniform bool	specularEnabled;	// specular enabled
+uniform bool	fixedShading;
+#endif
+
+// texturing
 uniform float	microTextureScale;
 uniform int		microTextureID;
 uniform ivec4	baseTexInfo;		// x/y are x,y positions in the texture sheet. z/w are with and height
 uniform int		baseTexType;
 uniform bool	textureInverted;
-uniform bool	textureAlpha;
-uniform bool	alphaTest;
 uniform bool	discardAlpha;
 uniform ivec2	textureWrapMode;
+uniform bool	decodedTexture;		// base texture comes from decodedTex rather than the sheet
+uniform sampler2DArray decodedTex;	// texture cache, decoded to rgba with the same mip levels
+uniform int		decodedLayer;
 
 // general
 uniform vec3	fogColour;
@@ -194,10 +357,8 @@ uniform vec2	spotRange;			// spotlight Z range: .x=start (viewspace coordinates)
 uniform vec3	spotColor;			// spotlight RGB color
 uniform vec3	spotFogColor;		// spotlight RGB color on fog
 uniform vec3	lighting[2];		// lighting state (lighting[0] = sun direction, lighting[1].x,y = diffuse, ambient intensities from 0-1.0)
-uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
 uniform bool	sunClamp;			// not used by daytona and la machine guns
 uniform bool	intensityClamp;		// some games such as daytona and 
-uniform bool	specularEnabled;	// specular enabled
 uniform float	specularValue;		// specular coefficient
 uniform float	shininess;			// specular shininess
 uniform float	fogIntensity;
@@ -205,7 +366,6 @@ uniform float	fogDensity;
 uniform float	fogStart;
 uniform float	fogAttenuation;
 uniform float	fogAmbient;
-uniform bool	fixedShading;
 uniform int		hardwareStep;
 
 // matrices (shared with vertex shader)
@@ -591,9 +751,28 @@ vec4 textureR3D(usampler2D texSampler, ivec2 wrapMode, ivec2 texSize, ivec2 texP
 	return mix(texLevel0, texLevel1, fract(fLevel));	// linear blend between our mipmap levels
 }
 
+// filtered by the gpu, at the level textureR3D would pick
+vec4 textureDecoded(ivec2 texSize, vec2 texCoord)
+{
+	float numLevels	= floor(log2(min(float(texSize.x), float(texSize.y))));
+	float fLevel	= min(mip_map_level(texCoord * vec2(texSize)), numLevels);
+
+	if(alphaTest) fLevel *= 0.5;
+	else fLevel *= 0.8;
+
+	return textureLod(decodedTex, vec3(texCoord, float(decodedLayer)), fLevel);
+}
+
 vec4 GetTextureValue()
 {
-	vec4 tex1Data = textureR3D(tex1, textureWrapMode, ivec2(baseTexInfo.zw), ivec2(baseTexInfo.xy), fsTexCoord);
+	vec4 tex1Data;
+
+	if(decodedTexture) {
+		tex1Data = textureDecoded(ivec2(baseTexInfo.zw), fsTexCoord);
+	}
+	else {
+		tex1Data = textureR3D(tex1, textureWrapMode, ivec2(baseTexInfo.zw), ivec2(baseTexInfo.xy), fsTexCoord);
+	}
 
 	if(textureInverted) {
 		tex1Data.rgb = vec3(1.0) - vec3(tex1Data.rgb);
@@ -10,6 +10,7 @@ uniform float	modelScale;
 uniform mat4	modelMat;
 uniform mat4	projMat;
 uniform bool	translatorMap;
+uniform bool	instanced;			// model matrix comes from inInstanceMat
 
 // attributes
 in	vec4	inVertex;
@@ -18,6 +19,7 @@ in  vec2	inTexCoord;
 in  vec4	inColour;
 in  vec3	inFaceNormal;		// used to emulate r3d culling 
 in  float	inFixedShade;
+in  mat4	inInstanceMat;		// per instance
 
 // outputs to fragment shader
 out vec3	fsViewVertex;
@@ -38,10 +40,10 @@ vec4 GetColour(vec4 colour)
 	return c;
 }
 
-float CalcBackFace(in vec3 viewVertex)
+float CalcBackFace(in vec3 viewVertex, in mat4 mvMat)
 {
 	vec3 vt = viewVertex - vec3(0.0);
-	vec3 vn = (mat3(modelMat) * inFaceNormal);
+	vec3 vn = (mat3(mvMat) * inFaceNormal);
 
 	// dot product of face normal with view direction
 	return dot(vt, vn);
@@ -49,13 +51,15 @@ float CalcBackFace(in vec3 viewVertex)
 
 void main(void)
 {
-	fsViewVertex	= vec3(modelMat * inVertex);
-	fsViewNormal	= (mat3(modelMat) * inNormal) / modelScale;
-	fsDiscard		= CalcBackFace(fsViewVertex);
+	mat4 mvMat		= instanced ? inInstanceMat : modelMat;
+
+	fsViewVertex	= vec3(mvMat * inVertex);
+	fsViewNormal	= (mat3(mvMat) * inNormal) / modelScale;
+	fsDiscard		= CalcBackFace(fsViewVertex, mvMat);
 	fsColor    		= GetColour(inColour);
 	fsTexCoord		= inTexCoord;
 	fsFixedShade	= inFixedShade;
-	gl_Position		= projMat * modelMat * inVertex;
+	gl_Position		= projMat * mvMat * inVertex;
 }
 )glsl";
 
@@ -65,18 +69,36 @@ static const char *fragmentShaderR3D = R"glsl(
 
 uniform usampler2D tex1;			// entire texture sheet
 
-// texturing
+// mesh state, constants in the permutations compiled for it
+#ifdef PERMUTATION
+const bool	textureEnabled	= (PERMUTATION & 1) != 0;
+const bool	microTexture	= (PERMUTATION & 2) != 0;
+const bool	alphaTest		= (PERMUTATION & 4) != 0;
+const bool	textureAlpha	= (PERMUTATION & 8) != 0;
+const bool	lightEnabled	= (PERMUTATION & 16) != 0;	// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
+const bool	specularEnabled	= (PERMUTATION & 32) != 0;
+const bool	fixedShading	= (PERMUTATION & 64) != 0;
+#else
 uniform bool	textureEnabled;
 uniform bool	microTexture;
+uniform bool	alphaTest;
+uniform bool	textureAlpha;
+uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
+uniform bool	specularEnabled;	// specular enabled
+uniform bool	fixedShading;
+#endif
+
+// texturing
 uniform float	microTextureScale;
 uniform int		microTextureID;
 uniform ivec4	baseTexInfo;		// x/y are x,y positions in the texture sheet. z/w are with and height
 uniform int		baseTexType;
 uniform bool	textureInverted;
-uniform bool	textureAlpha;
-uniform bool	alphaTest;
 uniform bool	discardAlpha;
 uniform ivec2	textureWrapMode;
+uniform bool	decodedTexture;		// base texture comes from decodedTex rather than the sheet
+uniform sampler2DArray decodedTex;	// texture cache, decoded to rgba with the same mip levels
+uniform int		decodedLayer;
 
 // general
 uniform vec3	fogColour;
@@ -85,10 +107,8 @@ uniform vec2	spotRange;			// spotlight Z range: .x=start (viewspace coordinates)
 uniform vec3	spotColor;			// spotlight RGB color
 uniform vec3	spotFogColor;		// spotlight RGB color on fog
 uniform vec3	lighting[2];		// lighting state (lighting[0] = sun direction, lighting[1].x,y = diffuse, ambient intensities from 0-1.0)
-uniform bool	lightEnabled;		// lighting enabled (1.0) or luminous (0.0), drawn at full intensity
 uniform bool	sunClamp;			// not used by daytona and la machine guns
 uniform bool	intensityClamp;		// some games such as daytona and 
-uniform bool	specularEnabled;	// specular enabled
 uniform float	specularValue;		// specular coefficient
 uniform float	shininess;			// specular shininess
 uniform float	fogIntensity;
@@ -96,7 +116,6 @@ uniform float	fogDensity;
 uniform float	fogStart;
 uniform float	fogAttenuation;
 uniform float	fogAmbient;
-uniform bool	fixedShading;
 uniform int		hardwareStep;
 
 //interpolated inputs from vertex shader
@@ -360,9 +379,28 @@ vec4 textureR3D(usampler2D texSampler, ivec2 wrapMode, ivec2 texSize, ivec2 texP
 	return mix(texLevel0, texLevel1, fract(fLevel));	// linear blend between our mipmap levels
 }
 
+// filtered by the gpu, at the level textureR3D would pick
+vec4 textureDecoded(ivec2 texSize, vec2 texCoord)
+{
+	float numLevels	= floor(log2(min(float(texSize.x), float(texSize.y))));
+	float fLevel	= min(mip_map_level(texCoord * vec2(texSize)), numLevels);
+
+	if(alphaTest) fLevel *= 0.5;
+	else fLevel *= 0.8;
+
+	return textureLod(decodedTex, vec3(texCoord, float(decodedLayer)), fLevel);
+}
+
 vec4 GetTextureValue()
 {
-	vec4 tex1Data = textureR3D(tex1, textureWrapMode, ivec2(baseTexInfo.zw), ivec2(baseTexInfo.xy), fsTexCoord);
+	vec4 tex1Data;
+
+	if(decodedTexture) {
+		tex1Data = textureDecoded(ivec2(baseTexInfo.zw), fsTexCoord);
+	}
+	else {
+		tex1Data = textureR3D(tex1, textureWrapMode, ivec2(baseTexInfo.zw), ivec2(baseTexInfo.xy), fsTexCoord);
+	}
 
 	if(textureInverted) {
 		tex1Data.rgb = vec3(1.0) - vec3(tex1Data.rgb);
@@ -0,0 +1,190 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include "Plane.h"
+
+// 4 wide float kernels for the matrix and culling maths done for every node and model. SSE2 and NEON are
+// part of the x64 and AArch64 base instruction sets, so the path is picked at compile time, with the scalar
+// code kept for other targets. Operations are done in the same order as the scalar code, without fused
+// multiply-adds, so all paths give the same results.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NEW3D_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NEW3D_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace New3D {
+namespace SIMD
+{
+#if defined(NEW3D_SIMD_SSE2)
+
+	typedef __m128 Float4;
+
+	inline Float4	Load	(const float* p)			{ return _mm_loadu_ps(p); }
+	inline void		Store	(float* p, Float4 v)		{ _mm_storeu_ps(p, v); }
+	inline Float4	Splat	(float f)					{ return _mm_set1_ps(f); }
+	inline Float4	Add		(Float4 a, Float4 b)		{ return _mm_add_ps(a, b); }
+	inline Float4	Mul		(Float4 a, Float4 b)		{ return _mm_mul_ps(a, b); }
+	inline unsigned	NotNegativeMask(Float4 v)			{ return (unsigned)_mm_movemask_ps(_mm_cmpge_ps(v, _mm_setzero_ps())); }
+
+	inline void Transpose(Float4& r0, Float4& r1, Float4& r2, Float4& r3)
+	{
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	}
+
+#elif defined(NEW3D_SIMD_NEON)
+
+	typedef float32x4_t Float4;
+
+	inline Float4	Load	(const float* p)			{ return vld1q_f32(p); }
+	inline void		Store	(float* p, Float4 v)		{ vst1q_f32(p, v); }
+	inline Float4	Splat	(float f)					{ return vdupq_n_f32(f); }
+	inline Float4	Add		(Float4 a, Float4 b)		{ return vaddq_f32(a, b); }
+	inline Float4	Mul		(Float4 a, Float4 b)		{ return vmulq_f32(a, b); }
+
+	inline unsigned NotNegativeMask(Float4 v)
+	{
+		static const uint32_t bits[4] = { 1, 2, 4, 8 };
+		return vaddvq_u32(vandq_u32(vcgeq_f32(v, vdupq_n_f32(0.f)), vld1q_u32(bits)));
+	}
+
+	inline void Transpose(Float4& r0, Float4& r1, Float4& r2, Float4& r3)
+	{
+		float32x4x2_t t01 = vtrnq_f32(r0, r1);
+		float32x4x2_t t23 = vtrnq_f32(r2, r3);
+		r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+		r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+		r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+		r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+	}
+
+#endif
+
+#if defined(NEW3D_SIMD_SSE2) || defined(NEW3D_SIMD_NEON)
+
+	// column major matrix times column vector: m[0..3] * in[0] + m[4..7] * in[1] + ...
+	inline Float4 MultVec(const float m[16], const float in[4])
+	{
+		Float4 r = Mul(Load(m), Splat(in[0]));
+		r = Add(r, Mul(Load(m + 4), Splat(in[1])));
+		r = Add(r, Mul(Load(m + 8), Splat(in[2])));
+		r = Add(r, Mul(Load(m + 12), Splat(in[3])));
+		return r;
+	}
+
+#endif
+
+	/*
+	* MultMatrices(a, b, r);
+	*
+	* r = a * b for column major 4x4 matrices. r may be the same matrix as a or b.
+	*/
+	inline void MultMatrices(const float a[16], const float b[16], float r[16])
+	{
+#if defined(NEW3D_SIMD_SSE2) || defined(NEW3D_SIMD_NEON)
+		Float4 c0 = Load(a), c1 = Load(a + 4), c2 = Load(a + 8), c3 = Load(a + 12);
+		Float4 p[4];
+
+		for (int j = 0; j < 4; j++) {
+			const float* bj = b + (j * 4);
+			p[j] = Add(Add(Add(Mul(c0, Splat(bj[0])), Mul(c1, Splat(bj[1]))), Mul(c2, Splat(bj[2]))), Mul(c3, Splat(bj[3])));
+		}
+
+		for (int j = 0; j < 4; j++) {
+			Store(r + (j * 4), p[j]);
+		}
+#else
+		float p[16];
+
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 4; j++) {
+				p[(j * 4) + i] = a[i] * b[(j * 4) + 0] + a[4 + i] * b[(j * 4) + 1] + a[8 + i] * b[(j * 4) + 2] + a[12 + i] * b[(j * 4) + 3];
+			}
+		}
+
+		for (int i = 0; i < 16; i++) {
+			r[i] = p[i];
+		}
+#endif
+	}
+
+	/*
+	* MultVec(m, in, out);
+	*
+	* out = m * in for a column major 4x4 matrix. out must not be in.
+	*/
+	inline void MultVec(const float m[16], const float in[4], float out[4])
+	{
+#if defined(NEW3D_SIMD_SSE2) || defined(NEW3D_SIMD_NEON)
+		Store(out, MultVec(m, in));
+#else
+		for (int i = 0; i < 4; i++) {
+			out[i] = in[0] * m[0 * 4 + i] + in[1] * m[1 * 4 + i] + in[2] * m[2 * 4 + i] + in[3] * m[3 * 4 + i];
+		}
+#endif
+	}
+
+	/*
+	* TransformPoints(m, points, count);
+	*
+	* Transforms the x, y and z of each point by m in place, w is left as is.
+	*/
+	inline void TransformPoints(const float m[16], float (*points)[4], int count)
+	{
+		for (int i = 0; i < count; i++) {
+			float v[4];
+			MultVec(m, points[i], v);
+			points[i][0] = v[0];
+			points[i][1] = v[1];
+			points[i][2] = v[2];
+		}
+	}
+
+	/*
+	* PlaneMasks(planes, numPlanes, points, masks);
+	*
+	* Sets bit i of masks[j] if points[i] is on the inner side of planes[j], including on the plane. Eight points.
+	*/
+	inline void PlaneMasks(const Plane* planes, int numPlanes, const float (*points)[4], unsigned* masks)
+	{
+#if defined(NEW3D_SIMD_SSE2) || defined(NEW3D_SIMD_NEON)
+		Float4 x[2], y[2], z[2];
+
+		for (int k = 0; k < 2; k++) {
+			Float4 w;
+			x[k] = Load(points[(k * 4) + 0]);
+			y[k] = Load(points[(k * 4) + 1]);
+			z[k] = Load(points[(k * 4) + 2]);
+			w    = Load(points[(k * 4) + 3]);
+			Transpose(x[k], y[k], z[k], w);		// one vector per coordinate of 4 points
+		}
+
+		for (int j = 0; j < numPlanes; j++) {
+			Float4 a = Splat(planes[j].a), b = Splat(planes[j].b), c = Splat(planes[j].c), d = Splat(planes[j].d);
+			masks[j] = 0;
+
+			for (int k = 0; k < 2; k++) {
+				Float4 dist = Add(Add(Add(Mul(a, x[k]), Mul(b, y[k])), Mul(c, z[k])), d);
+				masks[j] |= NotNegativeMask(dist) << (k * 4);
+			}
+		}
+#else
+		for (int j = 0; j < numPlanes; j++) {
+			masks[j] = 0;
+
+			for (int i = 0; i < 8; i++) {
+				const Plane& p = planes[j];
+				if (p.a * points[i][0] + p.b * points[i][1] + p.c * points[i][2] + p.d >= 0.f) {
+					masks[j] |= 1u << i;
+				}
+			}
+		}
+#endif
+	}
+}
+} // New3D
+
+#endif
@@ -0,0 +1,337 @@
+#include "TextureCache.h"
+#include <algorithm>
+
+// mip levels are stored in the same sheet as their texture, at these offsets within the page
+static const int mipXBase[] = { 0, 1024, 1536, 1792, 1920, 1984, 2016, 2032, 2040, 2044, 2046 };
+static const int mipYBase[] = { 0, 512, 768, 896, 960, 992, 1008, 1016, 1020, 1022, 1023 };
+
+static int KeyX			(UINT32 key) { return (int)(key & 0x3F) * 32; }
+static int KeyY			(UINT32 key) { return (int)((key >> 6) & 0x3F) * 32; }
+static int KeySizeU		(UINT32 key) { return (int)(key >> 12) & 7; }
+static int KeySizeV		(UINT32 key) { return (int)(key >> 15) & 7; }
+static int KeyFormat	(UINT32 key) { return (int)(key >> 18) & 0xF; }
+static bool KeyDilate	(UINT32 key) { return ((key >> 22) & 1) != 0; }
+
+static int NumLevels(int sizeU, int sizeV)
+{
+	return 5 + std::min(sizeU, sizeV) + 1;		// down to 1 texel in the smaller dimension, as the shaders do
+}
+
+TextureCache::TextureCache()
+{
+	m_textureRAM	= nullptr;
+	m_maxLayers		= MaxLayers;
+	m_frame			= 0;
+	m_boundTexture	= 0;
+	m_boundSampler	= 0;
+
+	for (auto& u : m_samplers) {
+		for (auto& v : u) {
+			v = 0;
+		}
+	}
+}
+
+void TextureCache::Create(const UINT16* textureRAM)
+{
+	m_textureRAM = textureRAM;
+
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &m_maxLayers);
+	m_maxLayers = std::min<GLint>(m_maxLayers, MaxLayers);
+
+	static const GLint wrapModes[2] = { GL_REPEAT, GL_MIRRORED_REPEAT };
+
+	for (int u = 0; u < 2; u++) {
+		for (int v = 0; v < 2; v++) {
+			GLuint& sampler = m_samplers[u][v];
+			glGenSamplers(1, &sampler);
+			glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wrapModes[u]);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wrapModes[v]);
+		}
+	}
+}
+
+void TextureCache::Destroy()
+{
+	for (auto& u : m_arrays) {
+		for (auto& array : u) {
+			DropArray(array);
+			if (array.texture) {
+				glDeleteTextures(1, &array.texture);
+				array.texture = 0;
+			}
+			array.layers = 0;
+		}
+	}
+
+	for (auto& u : m_samplers) {
+		for (auto& v : u) {
+			if (v) {
+				glDeleteSamplers(1, &v);
+				v = 0;
+			}
+		}
+	}
+
+	m_layers.clear();
+	m_textureRAM = nullptr;
+}
+
+void TextureCache::NewFrame()
+{
+	m_frame++;
+	m_boundTexture = 0;		// anything may have been bound in between
+	m_boundSampler = 0;
+}
+
+void TextureCache::Invalidate(int x, int y, int width, int height)
+{
+	if (!Enabled()) {
+		return;
+	}
+
+	for (auto it = m_layers.begin(); it != m_layers.end(); ) {
+
+		if (Overlaps(it->first, x, y, width, height)) {
+			m_arrays[KeySizeU(it->first)][KeySizeV(it->first)].owners[it->second] = NoOwner;
+			it = m_layers.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+bool TextureCache::Bind(GLuint unit, int x, int y, int width, int height, int format, bool dilate, int wrapU, int wrapV, int& layer)
+{
+	int sizeU = 0;
+	int sizeV = 0;
+
+	while ((32 << sizeU) < width)	{ sizeU++; }
+	while ((32 << sizeV) < height)	{ sizeV++; }
+
+	if (!Enabled() || sizeU >= NumSizes || sizeV >= NumSizes || (32 << sizeU) != width || (32 << sizeV) != height || (x & 31) || (y & 31) || format < 0 || format > 15) {
+		return false;
+	}
+
+	UINT32 key	= MakeKey(x, y, sizeU, sizeV, format, dilate);
+	auto it		= m_layers.find(key);
+
+	if (it != m_layers.end()) {
+		layer = it->second;
+	}
+	else {
+		layer = AllocLayer(sizeU, sizeV);
+
+		if (layer < 0) {
+			return false;
+		}
+
+		Decode(key, layer);
+		m_layers[key] = layer;
+		m_arrays[sizeU][sizeV].owners[layer] = key;
+	}
+
+	Array& array = m_arrays[sizeU][sizeV];
+	array.lastUsed[layer] = m_frame;
+
+	GLuint sampler = m_samplers[wrapU >= 2][wrapV >= 2];		// the clamped modes only differ from these at the edges
+
+	if (array.texture != m_boundTexture) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		glActiveTexture(GL_TEXTURE0);
+		m_boundTexture = array.texture;
+	}
+
+	if (sampler != m_boundSampler) {
+		glBindSampler(unit, sampler);
+		m_boundSampler = sampler;
+	}
+
+	return true;
+}
+
+UINT32 TextureCache::MakeKey(int x, int y, int sizeU, int sizeV, int format, bool dilate)
+{
+	return (UINT32)(x / 32) | ((UINT32)(y / 32) << 6) | ((UINT32)sizeU << 12) | ((UINT32)sizeV << 15) | ((UINT32)format << 18) | ((UINT32)dilate << 22);
+}
+
+// True if the rectangle overlaps any mip level of the region, which can wrap around the sheet horizontally and the
+// page vertically
+bool TextureCache::Overlaps(UINT32 key, int x, int y, int width, int height)
+{
+	int sizeU	= KeySizeU(key);
+	int sizeV	= KeySizeV(key);
+	int page	= KeyY(key) / 1024;
+
+	for (int level = 0; level < NumLevels(sizeU, sizeV); level++) {
+
+		int lx = mipXBase[level] + (KeyX(key) >> level);
+		int ly = mipYBase[level] + ((KeyY(key) & 1023) >> level) + page * 1024;
+		int lw = std::max(1, (32 << sizeU) >> level);
+		int lh = std::max(1, (32 << sizeV) >> level);
+
+		for (int dx = 0; dx <= 2048; dx += 2048) {
+			for (int dy = 0; dy <= 1024; dy += 1024) {
+				if (x < lx - dx + lw && lx - dx < x + width && y < ly - dy + lh && ly - dy < y + height) {
+					return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
+
+// Same as ExtractColour() in the shaders
+UINT32 TextureCache::DecodeTexel(int format, UINT16 value)
+{
+	auto rgba = [](UINT32 r, UINT32 g, UINT32 b, UINT32 a) { return r | (g << 8) | (b << 16) | (a << 24); };
+	auto x5 = [](UINT32 v) { return (v * 255 + 15) / 31; };
+	auto x4 = [](UINT32 v) { return v * 17; };
+	auto grey = [&rgba](UINT32 v, bool transparent) { return rgba(v, v, v, transparent ? 0 : 255); };
+
+	switch (format)
+	{
+	case 0:		return rgba(x5((value >> 10) & 0x1F), x5((value >> 5) & 0x1F), x5(value & 0x1F), (value & 0x8000) ? 0 : 255);
+	case 1:		return rgba(x4(value & 0xF), x4(value & 0xF), x4(value & 0xF), x4((value >> 4) & 0xF));
+	case 2:		return rgba(x4((value >> 4) & 0xF), x4((value >> 4) & 0xF), x4((value >> 4) & 0xF), x4(value & 0xF));
+	case 3:		return rgba(x4((value >> 8) & 0xF), x4((value >> 8) & 0xF), x4((value >> 8) & 0xF), x4((value >> 12) & 0xF));
+	case 4:		return rgba(x4((value >> 12) & 0xF), x4((value >> 12) & 0xF), x4((value >> 12) & 0xF), x4((value >> 8) & 0xF));
+	case 5:		return grey(value & 0xFF, (value & 0xFF) == 0xFF);
+	case 6:		return grey((value >> 8) & 0xFF, ((value >> 8) & 0xFF) == 0xFF);
+	case 7:		return rgba(x4((value >> 12) & 0xF), x4((value >> 8) & 0xF), x4((value >> 4) & 0xF), x4(value & 0xF));
+	case 8:		return grey(x4(value & 0xF), (value & 0xF) == 0xF);
+	case 9:		return grey(x4((value >> 4) & 0xF), ((value >> 4) & 0xF) == 0xF);
+	case 10:	return grey(x4((value >> 8) & 0xF), ((value >> 8) & 0xF) == 0xF);
+	case 11:	return grey(x4((value >> 12) & 0xF), ((value >> 12) & 0xF) == 0xF);
+	default:	return 0;
+	}
+}
+
+int TextureCache::AllocLayer(int sizeU, int sizeV)
+{
+	Array& array = m_arrays[sizeU][sizeV];
+
+	for (int i = 0; i < array.layers; i++) {
+		if (array.owners[i] == NoOwner) {
+			return i;
+		}
+	}
+
+	int width	= 32 << sizeU;
+	int height	= 32 << sizeV;
+	int limit	= std::min<int>(m_maxLayers, (2048 / width) * (2048 / height));		// no more than fit in the sheet
+
+	if (array.layers < limit) {
+
+		// grow, the regions in the old texture will be decoded again as they are drawn
+		DropArray(array);
+
+		if (array.texture) {
+			glDeleteTextures(1, &array.texture);
+			m_boundTexture = 0;		// the name may be reused
+		}
+
+		array.layers = std::min(limit, std::max(8, array.layers * 2));
+		array.owners.assign(array.layers, NoOwner);
+		array.lastUsed.assign(array.layers, 0);
+
+		int levels = NumLevels(sizeU, sizeV);
+
+		glGenTextures(1, &array.texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+		for (int level = 0; level < levels; level++) {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(1, width >> level), std::max(1, height >> level), array.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		return 0;
+	}
+
+	// full, reuse the least recently used layer
+	int oldest = (int)(std::min_element(array.lastUsed.begin(), array.lastUsed.end()) - array.lastUsed.begin());
+
+	m_layers.erase(array.owners[oldest]);
+	array.owners[oldest] = NoOwner;
+
+	return oldest;
+}
+
+void TextureCache::Decode(UINT32 key, int layer)
+{
+	int sizeU	= KeySizeU(key);
+	int sizeV	= KeySizeV(key);
+	int format	= KeyFormat(key);
+	int page	= KeyY(key) / 1024;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_arrays[sizeU][sizeV].texture);
+
+	for (int level = 0; level < NumLevels(sizeU, sizeV); level++) {
+
+		int lx = mipXBase[level] + (KeyX(key) >> level);
+		int ly = mipYBase[level] + ((KeyY(key) & 1023) >> level);
+		int lw = std::max(1, (32 << sizeU) >> level);
+		int lh = std::max(1, (32 << sizeV) >> level);
+
+		m_decoded.resize((size_t)lw * lh);
+
+		for (int j = 0; j < lh; j++) {
+			const UINT16* row = m_textureRAM + (((ly + j) & 1023) + page * 1024) * 2048;
+			for (int i = 0; i < lw; i++) {
+				m_decoded[j * lw + i] = DecodeTexel(format, row[(lx + i) & 2047]);
+			}
+		}
+
+		// alpha tested textures take the colour of an opaque neighbour for their transparent texels, as the shaders
+		// do when filtering, so edges don't bleed towards the colour of the transparent texels
+		if (KeyDilate(key)) {
+			for (int j = 0; j < lh; j++) {
+				for (int i = 0; i < lw; i++) {
+
+					UINT32& texel = m_decoded[j * lw + i];
+
+					if (texel >> 24) {
+						continue;
+					}
+
+					const UINT32 neighbours[4] = {
+						m_decoded[j * lw + ((i + 1) % lw)],
+						m_decoded[j * lw + ((i + lw - 1) % lw)],
+						m_decoded[((j + 1) % lh) * lw + i],
+						m_decoded[((j + lh - 1) % lh) * lw + i]
+					};
+
+					for (UINT32 n : neighbours) {
+						if (n >> 24) {
+							texel = n & 0xFFFFFF;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, lw, lh, 1, GL_RGBA, GL_UNSIGNED_BYTE, m_decoded.data());
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void TextureCache::DropArray(Array& array)
+{
+	for (UINT32 owner : array.owners) {
+		if (owner != NoOwner) {
+			m_layers.erase(owner);
+		}
+	}
+
+	array.owners.assign(array.owners.size(), NoOwner);
+}
@@ -0,0 +1,62 @@
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+#include <GL/glew.h>
+#include "Types.h"
+#include <unordered_map>
+#include <vector>
+
+// Optional cache of texture sheet regions decoded to RGBA8 along with their mip levels, so the shaders can sample
+// them with the GPU's own filtering rather than fetching, decoding and filtering raw texels per fragment. Regions of
+// the same size share an array texture, one layer each, and layers are reused least recently used first. Uploads to
+// texture RAM drop the regions they overlap at any mip level, which are decoded again the next time they're drawn.
+
+class TextureCache
+{
+public:
+	TextureCache();
+
+	void	Create			(const UINT16* textureRAM);
+	void	Destroy			();
+	bool	Enabled			() const { return m_textureRAM != nullptr; }
+	void	NewFrame		();
+	void	Invalidate		(int x, int y, int width, int height);
+
+	// Binds the decoded region to the given texture unit, with a sampler for the Real3D wrap modes. False if it
+	// can't be cached, in which case the shader must decode the sheet itself.
+	bool	Bind			(GLuint unit, int x, int y, int width, int height, int format, bool dilate, int wrapU, int wrapV, int& layer);
+
+private:
+	static const int	NumSizes	= 6;			// 32 to 1024 texels
+	static const int	MaxLayers	= 256;
+	static const UINT32	NoOwner		= 0xFFFFFFFF;
+
+	struct Array
+	{
+		GLuint					texture		= 0;
+		int						layers		= 0;
+		std::vector<UINT32>		owners;				// key of each layer
+		std::vector<UINT64>		lastUsed;			// frame
+	};
+
+	static UINT32	MakeKey			(int x, int y, int sizeU, int sizeV, int format, bool dilate);
+	static bool		Overlaps		(UINT32 key, int x, int y, int width, int height);
+	static UINT32	DecodeTexel		(int format, UINT16 value);
+
+	int		AllocLayer		(int sizeU, int sizeV);
+	void	Decode			(UINT32 key, int layer);
+	void	DropArray		(Array& array);
+
+	const UINT16*	m_textureRAM;
+	Array			m_arrays[NumSizes][NumSizes];
+	GLuint			m_samplers[2][2];				// repeat or mirror in u, v
+	GLint			m_maxLayers;
+	UINT64			m_frame;
+	GLuint			m_boundTexture;					// as bound by Bind() this frame
+	GLuint			m_boundSampler;
+
+	std::unordered_map<UINT32, int>	m_layers;		// layer of each cached region
+	std::vector<UINT32>				m_decoded;		// scratch
+};
+
+#endif
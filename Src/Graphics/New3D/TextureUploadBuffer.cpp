@@ -0,0 +1,108 @@
+#include "TextureUploadBuffer.h"
+#include <cstring>
+
+TextureUploadBuffer::TextureUploadBuffer()
+{
+	m_id		= 0;
+	m_ptr		= nullptr;
+	m_segment	= 0;
+	m_offset	= 0;
+
+	for (auto &fence : m_fences) {
+		fence = nullptr;
+	}
+}
+
+void TextureUploadBuffer::Create()
+{
+	if (!GLEW_ARB_buffer_storage) {
+		return;		// fall back to uploading from client memory
+	}
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glGenBuffers(1, &m_id);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_id);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)NumSegments * SegmentSize, nullptr, flags);
+	m_ptr = (UINT8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)NumSegments * SegmentSize, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (!m_ptr) {
+		Destroy();
+	}
+
+	m_segment	= 0;
+	m_offset	= 0;
+}
+
+void TextureUploadBuffer::Destroy()
+{
+	for (auto &fence : m_fences) {
+		if (fence) {
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
+	if (m_id) {
+		if (m_ptr) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_id);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &m_id);
+		m_id	= 0;
+		m_ptr	= nullptr;
+	}
+}
+
+void TextureUploadBuffer::NextSegment()
+{
+	m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	m_segment	= (m_segment + 1) % NumSegments;
+	m_offset	= 0;
+
+	GLsync &fence = m_fences[m_segment];
+
+	if (fence) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+}
+
+void TextureUploadBuffer::Upload(GLuint texture, unsigned x, unsigned y, unsigned width, unsigned height, const UINT16* textureRAM)
+{
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+	const UINT16* src = textureRAM + (y * 2048) + x;
+
+	if (!m_ptr) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 2048);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, src);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		return;
+	}
+
+	// rows are packed tightly in the buffer, each upload starts 64 byte aligned
+	int size = (int)(width * height * 2);
+
+	if (m_offset + size > SegmentSize) {
+		NextSegment();
+	}
+
+	int offset = (m_segment * SegmentSize) + m_offset;
+	UINT8* dst = m_ptr + offset;
+
+	for (unsigned i = 0; i < height; i++) {
+		memcpy(dst + (i * width * 2), src + (i * 2048), width * 2);
+	}
+
+	m_offset += (size + 63) & ~63;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RED_INTEGER, GL_UNSIGNED_SHORT, (const void*)(size_t)offset);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
@@ -0,0 +1,36 @@
+#ifndef _TEXTURE_UPLOAD_BUFFER_H_
+#define _TEXTURE_UPLOAD_BUFFER_H_
+
+#include <GL/glew.h>
+#include "Types.h"
+
+// Streams texture RAM rectangles to the texture sheet through a persistently
+// mapped pixel unpack buffer. The buffer is a ring of segments; a fence is
+// placed after the uploads from each segment, and a segment is only reused
+// once the GPU has passed its fence, so writing new data never waits on
+// uploads that are still in flight. Without ARB_buffer_storage, rectangles
+// are uploaded straight from client memory, one call per rectangle.
+
+class TextureUploadBuffer
+{
+public:
+	TextureUploadBuffer();
+
+	void Create			();
+	void Destroy		();
+	void Upload			(GLuint texture, unsigned x, unsigned y, unsigned width, unsigned height, const UINT16* textureRAM);
+
+private:
+	static const int	NumSegments		= 3;
+	static const int	SegmentSize		= 2048 * 2048 * 2;	// a whole texture sheet
+
+	void NextSegment	();
+
+	GLuint		m_id;
+	UINT8*		m_ptr;
+	int			m_segment;
+	int			m_offset;		// within current segment
+	GLsync		m_fences[NumSegments];
+};
+
+#endif
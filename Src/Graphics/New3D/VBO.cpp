@@ -6,6 +6,14 @@ VBO::VBO()
 	m_target	= 0;
 	m_capacity	= 0;
 	m_size		= 0;
+	m_ringPtr	= nullptr;
+	m_ringOffset	= 0;
+	m_segmentSize	= 0;
+	m_segment	= 0;
+
+	for (auto &fence : m_fences) {
+		fence = nullptr;
+	}
 }
 
 void VBO::Create(GLenum target, GLenum usage, GLsizeiptr size, const void* data)
@@ -21,6 +29,65 @@ void VBO::Create(GLenum target, GLenum usage, GLsizeiptr size, const void* data)
 	Bind(false);		// unbind
 }
 
+bool VBO::CreateRing(GLenum target, GLsizeiptr ringOffset, GLsizeiptr segmentSize)
+{
+	if (!GLEW_ARB_buffer_storage) {
+		return false;
+	}
+
+	const GLbitfield flags	= GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr size			= ringOffset + (segmentSize * NumSegments);
+
+	glGenBuffers(1, &m_id);
+	glBindBuffer(target, m_id);
+	glBufferStorage(target, size, nullptr, flags | GL_DYNAMIC_STORAGE_BIT);	// start of buffer is still written with glBufferSubData
+	m_ringPtr = (GLubyte*)glMapBufferRange(target, ringOffset, segmentSize * NumSegments, flags);
+	glBindBuffer(target, 0);
+
+	if (!m_ringPtr) {
+		glDeleteBuffers(1, &m_id);
+		m_id = 0;
+		return false;
+	}
+
+	m_target		= target;
+	m_capacity		= (int)ringOffset;		// AppendData only fills the space before the ring
+	m_size			= 0;
+	m_ringOffset	= ringOffset;
+	m_segmentSize	= segmentSize;
+	m_segment		= 0;
+
+	return true;
+}
+
+void* VBO::NextSegment(GLintptr& offset)
+{
+	if (!m_ringPtr) {
+		return nullptr;
+	}
+
+	m_segment = (m_segment + 1) % NumSegments;
+
+	GLsync &fence = m_fences[m_segment];
+
+	if (fence) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	offset = m_ringOffset + (m_segment * m_segmentSize);
+
+	return m_ringPtr + (m_segment * m_segmentSize);
+}
+
+void VBO::FenceSegment()
+{
+	if (m_ringPtr && !m_fences[m_segment]) {
+		m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
 void VBO::BufferSubData(GLintptr offset, GLsizeiptr size, const GLvoid* data)
 {
 	glBufferSubData(m_target, offset, size, data);
@@ -50,7 +117,20 @@ void VBO::Reset()
 
 void VBO::Destroy()
 {
+	for (auto &fence : m_fences) {
+		if (fence) {
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+
 	if (m_id) {
+		if (m_ringPtr) {
+			glBindBuffer(m_target, m_id);
+			glUnmapBuffer(m_target);
+			glBindBuffer(m_target, 0);
+			m_ringPtr = nullptr;
+		}
 		glDeleteBuffers(1, &m_id);
 		m_id		= 0;
 		m_target	= 0;
@@ -74,6 +154,11 @@ int VBO::GetSize()
 	return m_size;
 }
 
+GLuint VBO::GetID()
+{
+	return m_id;
+}
+
 int VBO::GetCapacity()
 {
 	return m_capacity;
@@ -3,12 +3,20 @@
 
 #include <GL/glew.h>
 
+// A vertex buffer can also be created with immutable storage and a persistently
+// mapped ring at its end (CreateRing). The ring is split into one segment per
+// frame in flight, each fenced after the frame's draws, so vertices for the
+// next frame are written straight into buffer memory the GPU is done with.
+
 class VBO
 {
 public:
 	VBO();
 
 	void Create			(GLenum target, GLenum usage, GLsizeiptr size, const void* data=nullptr);
+	bool CreateRing		(GLenum target, GLsizeiptr ringOffset, GLsizeiptr segmentSize);	// false without ARB_buffer_storage
+	void* NextSegment	(GLintptr& offset);		// waits until the GPU has finished with the segment
+	void FenceSegment	();						// after the draws using the current segment
 	void BufferSubData	(GLintptr offset, GLsizeiptr size, const GLvoid* data);
 	bool AppendData		(GLsizeiptr size, const GLvoid* data);
 	void Reset			();		// don't delete data, just go back to start
@@ -16,12 +24,20 @@ public:
 	void Bind			(bool enable);
 	int  GetSize		();
 	int  GetCapacity	();
+	GLuint GetID		();
 
 private:
+	static const int	NumSegments = 3;
+
 	GLuint		m_id;
 	GLenum		m_target;
 	int			m_capacity;
 	int			m_size;
+	GLubyte*	m_ringPtr;
+	GLintptr	m_ringOffset;
+	GLsizeiptr	m_segmentSize;
+	int			m_segment;
+	GLsync		m_fences[NumSegments];
 };
 
 #endif
@@ -279,7 +279,11 @@
 #include "Supermodel.h"
 #include "Shader.h"
 #include "Shaders2D.h" // fragment and vertex shaders
+#include "OSD/Thread.h"
+#include "GPUTimer.h"
+#include "TileLine.h"
 
+#include <algorithm>
 #include <cstring>
 #include <GL/glew.h>
 
@@ -300,73 +304,8 @@
  should be implemented first and tile pre-decoding second.
 ******************************************************************************/
 
-template <int bits, bool alphaTest, bool clip>
-static inline void DrawTileLine(uint32_t *line, int pixelOffset, uint16_t tile, int patternLine, const uint32_t *vram, const uint32_t *palette, uint16_t mask)
-{
-  static_assert(bits == 4 || bits == 8, "Tiles are either 4- or 8-bit");
-
-  // For 8-bit pixels, each line of tile pattern is two words
-  if (bits == 8)
-    patternLine *= 2;
-
-  // Compute offset of pattern for this line
-  int patternOffset;
-  if (bits == 4)
-  {
-    patternOffset = ((tile & 0x3FFF) << 1) | ((tile >> 15) & 1);
-    patternOffset *= 32;
-    patternOffset /= 4;
-  }
-  else
-  {
-    patternOffset = tile & 0x3FFF;
-    patternOffset *= 64;
-    patternOffset /= 4;
-  }
-
-  // Name table entry provides high color bits
-  uint32_t colorHi = tile & ((bits == 4) ? 0x7FF0 : 0x7F00);
-
-  // Draw
-  if (bits == 4)
-  {
-    uint32_t pattern = vram[patternOffset + patternLine];
-    for (int p = 7; p >= 0; p--)
-    {
-      if (!clip || (/*pixelOffset >= 0 &&*/ (unsigned int)pixelOffset < 496u)) // the >= 0 check is accounted for, as the cast to uint makes them appear as very large unsigned values
-      {
-        uint16_t maskTest = 1 << (15-((pixelOffset+0)/32));
-        bool visible = (mask & maskTest) != 0;
-        uint32_t pixel = visible ? palette[((pattern >> (p*4)) & 0xF) | colorHi] : 0;
-        if (!alphaTest || (visible && (pixel >> 24) != 0))  // only draw opaque pixels
-            line[pixelOffset] = pixel;
-      }
-      ++pixelOffset;
-    }
-  }
-  else
-  {
-    for (int i = 0; i < 2; i++) // 4 pixels per word
-    {
-      uint32_t pattern = vram[patternOffset + patternLine + i];
-      for (int p = 3; p >= 0; p--)
-      {
-        if (!clip || (/*pixelOffset >= 0 &&*/ (unsigned int)pixelOffset < 496u)) // the >= 0 check is accounted for, as the cast to uint makes them appear as very large unsigned values
-        {
-          uint16_t maskTest = 1 << (15-((pixelOffset+0)/32));
-          bool visible = (mask & maskTest) != 0;
-          uint32_t pixel = visible ? palette[((pattern >> (p*8)) & 0xFF) | colorHi] : 0;
-          if (!alphaTest || (visible && (pixel >> 24) != 0))
-              line[pixelOffset] = pixel;
-        }
-        ++pixelOffset;
-      }
-    }
-  }
-}
-
 template <int bits, bool alphaTest>
-static void DrawLayer(uint32_t *pixels, int layerNum, const uint32_t *vram, const uint32_t *regs, const uint32_t *palette)
+static void DrawLayer(uint32_t *pixels, int layerNum, const uint32_t *vram, const uint32_t *regs, const uint32_t *palette, int firstLine, int numLines)
 {
   const uint16_t *nameTableBase = (const uint16_t *) &vram[(0xF8000 + layerNum * 0x2000) / 4];
   const uint16_t *hScrollTable = (const uint16_t *) &vram[(0xF6000 + layerNum * 0x400) / 4];
@@ -382,9 +321,10 @@ static void DrawLayer(uint32_t *pixels, int layerNum, const uint32_t *vram, cons
   // zero, so we flip the mask when drawing alternate layers (layers 1 and 3).
   const uint16_t maskPolarity = (layerNum & 1) ? 0xFFFF : 0x0000;
 
-  uint32_t *line = pixels;
+  maskTable += 2 * firstLine;
+  uint32_t *line = pixels + 496 * firstLine;
 
-  for (int y = 0; y < 384; y++)
+  for (int y = firstLine; y < firstLine + numLines; y++)
   {
     int hScroll = (lineScrollMode ? hScrollTable[y] : hFullScroll) & 0x1FF;
     int hTile = hScroll / 8;
@@ -403,7 +343,11 @@ static void DrawLayer(uint32_t *pixels, int layerNum, const uint32_t *vram, cons
     // Middle tiles will not be clipped
     for (int tx = 1; tx < (62 - 1 + extraTile); tx++)
     {
+#if defined(RENDER2D_SIMD_SSE2) || defined(RENDER2D_SIMD_NEON)
+      DrawTileLineSIMD<bits, alphaTest>(line, pixelOffset, nameTable[(hTile ^ 1) & 63], vFine, vram, palette, mask);
+#else
       DrawTileLine<bits, alphaTest, false>(line, pixelOffset, nameTable[(hTile ^ 1) & 63], vFine, vram, palette, mask);
+#endif
       ++hTile;
       pixelOffset += 8;
     }
@@ -418,7 +362,7 @@ static void DrawLayer(uint32_t *pixels, int layerNum, const uint32_t *vram, cons
   }
 }
 
-std::pair<bool, bool> CRender2D::DrawTilemaps(uint32_t *pixelsBottom, uint32_t *pixelsTop)
+std::pair<bool, bool> CRender2D::DrawTilemapLines(uint32_t *pixelsBottom, uint32_t *pixelsTop, int firstLine, int numLines)
 {
   unsigned priority = (m_regs[0x20/4] >> 8) & 0xF;
 
@@ -436,16 +380,16 @@ std::pair<bool, bool> CRender2D::DrawTilemaps(uint32_t *pixelsBottom, uint32_t *
       if (noBottomSurface)
       {
         if (is4Bit)
-          DrawLayer<4, false>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<4, false>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
         else
-          DrawLayer<8, false>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<8, false>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
       }
       else
       {
         if (is4Bit)
-          DrawLayer<4, true>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<4, true>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
         else
-          DrawLayer<8, true>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<8, true>(pixelsBottom, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
       }
       noBottomSurface = false;
     }
@@ -468,16 +412,16 @@ std::pair<bool, bool> CRender2D::DrawTilemaps(uint32_t *pixelsBottom, uint32_t *
       if (noTopSurface)
       {
         if (is4Bit)
-          DrawLayer<4, false>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<4, false>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
         else
-          DrawLayer<8, false>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<8, false>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
       }
       else
       {
         if (is4Bit)
-          DrawLayer<4, true>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<4, true>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
         else
-          DrawLayer<8, true>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2]);
+          DrawLayer<8, true>(pixelsTop, layerNum, m_vram, m_regs, m_palette[layerNum / 2], firstLine, numLines);
       }
       noTopSurface = false;
     }
@@ -488,6 +432,269 @@ std::pair<bool, bool> CRender2D::DrawTilemaps(uint32_t *pixelsBottom, uint32_t *
 }
 
 
+std::pair<bool, bool> CRender2D::DrawTilemaps(uint32_t *pixelsBottom, uint32_t *pixelsTop)
+{
+  // Lines are independent of each other, so bands of them are drawn in
+  // parallel, each with all of its layers in order. Only runs of dirty lines
+  // are drawn.
+  static const int numBands = 8;
+  static const int linesPerBand = 384 / numBands;
+  std::pair<bool, bool> present[numBands];
+  bool drawn[numBands];
+  CThread::GetJobPool()->Run("Render2D", numBands, [&](unsigned band)
+  {
+    drawn[band] = false;
+    int end = (band + 1) * linesPerBand;
+    for (int y = band * linesPerBand; y < end; )
+    {
+      if (!m_lineDirty[y])
+      {
+        y++;
+        continue;
+      }
+      int first = y;
+      while (y < end && m_lineDirty[y])
+        y++;
+      present[band] = DrawTilemapLines(pixelsBottom, pixelsTop, first, y - first);
+      drawn[band] = true;
+    }
+  });
+  for (int band = 0; band < numBands; band++)
+  {
+    if (drawn[band])
+      return present[band];
+  }
+  return m_surfaces_present;
+}
+
+// Works out which lines of the surfaces must be redrawn from the pages written
+// and registers changed since they were last drawn. Returns false if none.
+bool CRender2D::FindDirtyLines(void)
+{
+  // Layer configuration, color offsets (through the palettes) and scroll
+  // registers of any layer change everything
+  uint32_t regs[5] = { m_regs[0x20/4], m_regs[0x60/4], m_regs[0x64/4], m_regs[0x68/4], m_regs[0x6C/4] };
+  bool all = m_allDirty || memcmp(regs, m_prevRegs, sizeof(regs)) != 0 ||
+             m_palDirty[0].IsDirty(0, 0x20000) || m_palDirty[1].IsDirty(0, 0x20000);
+  memcpy(m_prevRegs, regs, sizeof(regs));
+  if (all)
+  {
+    std::fill(m_lineDirty, m_lineDirty + 384, true);
+    return true;
+  }
+  std::fill(m_lineDirty, m_lineDirty + 384, false);
+
+  // Lines whose mask changed
+  bool any = false;
+  for (int y = 0; y < 384; y++)
+  {
+    if (m_vramDirty.IsDirty(0xF7000 + y * 4, 4))
+      m_lineDirty[y] = any = true;
+  }
+
+  // Lines of enabled layers whose scroll value, name table row or tile
+  // patterns changed
+  bool patternsDirty = m_vramDirty.IsDirty(0, 0x100000);
+  const uint16_t *nameTables = (const uint16_t *) &m_vram[0xF8000 / 4];
+  for (int layerNum = 0; layerNum < 4; layerNum++)
+  {
+    uint32_t scroll = m_regs[0x60/4 + layerNum];
+    if (!(scroll & 0x80000000))
+      continue;
+    bool is4Bit = (m_regs[0x20/4] & (1 << (12 + layerNum))) != 0;
+    int vScroll = (scroll >> 16) & 0x1FF;
+
+    bool rowDirty[64];
+    for (int row = 0; row < 64; row++)
+    {
+      uint32_t nameAddr = 0xF8000 + layerNum * 0x2000 + row * 128;
+      rowDirty[row] = m_vramDirty.IsDirty(nameAddr, 128);
+      if (rowDirty[row] || !patternsDirty)
+        continue;
+      const uint16_t *nameTable = &nameTables[layerNum * 0x1000 + row * 64];
+      for (int i = 0; i < 64 && !rowDirty[row]; i++)
+      {
+        uint16_t tile = nameTable[i];
+        if (is4Bit)
+          rowDirty[row] = m_vramDirty.IsDirty((((tile & 0x3FFF) << 1) | ((tile >> 15) & 1)) * 32, 32);
+        else
+          rowDirty[row] = m_vramDirty.IsDirty((tile & 0x3FFF) * 64, 64);
+      }
+    }
+
+    bool lineScrollMode = (scroll & 0x8000) != 0;
+    for (int y = 0; y < 384; y++)
+    {
+      if (rowDirty[((y + vScroll) / 8) & 63] || (lineScrollMode && m_vramDirty.IsDirty(0xF6000 + layerNum * 0x400 + y * 2, 2)))
+        m_lineDirty[y] = any = true;
+    }
+  }
+  return any;
+}
+
+
+/******************************************************************************
+ GPU Tilemap Rendering
+
+ VRAM and the palettes are kept in texture buffers, updated with the pages
+ written since the previous frame, and each surface is drawn by a fragment
+ shader in one pass over all of its layers.
+******************************************************************************/
+
+void CRender2D::CreateTilemapResources(void)
+{
+  m_tilemapShader.LoadShaders(s_vertexShaderSource, s_tilemapFragmentShaderSource);
+  m_tilemapShader.GetUniformLocationMap("vram");
+  m_tilemapShader.GetUniformLocationMap("palette");
+  m_tilemapShader.GetUniformLocationMap("layerConfig");
+  m_tilemapShader.GetUniformLocationMap("scrollRegs");
+  m_tilemapShader.GetUniformLocationMap("numLayers");
+  m_tilemapShader.GetUniformLocationMap("layers");
+  m_tilemapShader.EnableShader();
+  glUniform1i(m_tilemapShader.uniformLocMap["vram"], 0);     // texture unit 0
+  glUniform1i(m_tilemapShader.uniformLocMap["palette"], 1);  // texture unit 1
+  m_tilemapShader.DisableShader();
+
+  GLuint buffers[2];
+  glGenBuffers(2, buffers);
+  m_vramBuffer = buffers[0];
+  m_palBuffer = buffers[1];
+  glBindBuffer(GL_TEXTURE_BUFFER, m_vramBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, 0x100000, NULL, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, m_palBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, 2 * 0x20000, NULL, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  // Palette colors are already RGBA8 (see CTileGen::WritePalette())
+  glGenTextures(2, m_bufferTex);
+  glBindTexture(GL_TEXTURE_BUFFER, m_bufferTex[0]);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, m_vramBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, m_bufferTex[1]);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8, m_palBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  glGenFramebuffers(1, &m_tilemapFBO);
+}
+
+void CRender2D::DestroyTilemapResources(void)
+{
+  m_tilemapShader.UnloadShaders();
+  if (m_tilemapFBO)
+  {
+    glDeleteFramebuffers(1, &m_tilemapFBO);
+    m_tilemapFBO = 0;
+  }
+  if (m_bufferTex[0])
+  {
+    glDeleteTextures(2, m_bufferTex);
+    m_bufferTex[0] = m_bufferTex[1] = 0;
+  }
+  if (m_vramBuffer)
+  {
+    GLuint buffers[2] = { m_vramBuffer, m_palBuffer };
+    glDeleteBuffers(2, buffers);
+    m_vramBuffer = m_palBuffer = 0;
+  }
+}
+
+void CRender2D::UploadDirtyPages(void)
+{
+  const uint8_t *vram = (const uint8_t *) m_vram;
+  glBindBuffer(GL_TEXTURE_BUFFER, m_vramBuffer);
+  if (m_allDirty)
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, 0x100000, vram);
+  else
+  {
+    // Only the first 1 MB is used by the shader, palette RAM is uploaded
+    // already computed
+    m_vramDirty.ForEachRun([&](uint32_t offset, uint32_t size)
+    {
+      if (offset < 0x100000)
+        glBufferSubData(GL_TEXTURE_BUFFER, offset, std::min(offset + size, 0x100000u) - offset, vram + offset);
+    });
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, m_palBuffer);
+  for (int i = 0; i < 2; i++)
+  {
+    const uint8_t *palette = (const uint8_t *) m_palette[i];
+    if (m_allDirty)
+      glBufferSubData(GL_TEXTURE_BUFFER, i * 0x20000, 0x20000, palette);
+    else
+    {
+      m_palDirty[i].ForEachRun([&](uint32_t offset, uint32_t size)
+      {
+        glBufferSubData(GL_TEXTURE_BUFFER, i * 0x20000 + offset, size, palette + offset);
+      });
+    }
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  m_vramDirty.Clear();
+  m_palDirty[0].Clear();
+  m_palDirty[1].Clear();
+  m_allDirty = false;
+}
+
+std::pair<bool, bool> CRender2D::DrawTilemapsGPU(void)
+{
+  // Same layer selection and order as DrawTilemapLines()
+  unsigned priority = (m_regs[0x20/4] >> 8) & 0xF;
+  GLint layers[2][4];
+  GLint numLayers[2] = { 0, 0 };  // top, bottom
+  static const int order[4] = { 3, 2, 1, 0 };
+  for (int i = 0; i < 4; i++)
+  {
+    int layerNum = order[i];
+    bool enabled = (m_regs[0x60/4 + layerNum] & 0x80000000) != 0;
+    int surface = (priority & (1 << layerNum)) ? 0 : 1;
+    if (enabled)
+      layers[surface][numLayers[surface]++] = layerNum;
+  }
+  if (!numLayers[0] && !numLayers[1])
+    return std::pair<bool, bool>(false, false);
+
+  GLint prevFBO, viewport[4];
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFBO);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+  glDisable(GL_SCISSOR_TEST);
+  glDisable(GL_BLEND);
+  glDisable(GL_DEPTH_TEST);
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_tilemapFBO);
+  glViewport(0, 0, 496, 384);
+  m_tilemapShader.EnableShader();
+  glUniform1ui(m_tilemapShader.uniformLocMap["layerConfig"], m_regs[0x20/4]);
+  glUniform1uiv(m_tilemapShader.uniformLocMap["scrollRegs"], 4, &m_regs[0x60/4]);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_BUFFER, m_bufferTex[0]);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, m_bufferTex[1]);
+  glBindVertexArray(m_vao);
+  for (int surface = 0; surface < 2; surface++)
+  {
+    if (!numLayers[surface])
+      continue;
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texID[surface], 0);
+    glUniform1i(m_tilemapShader.uniformLocMap["numLayers"], numLayers[surface]);
+    glUniform1iv(m_tilemapShader.uniformLocMap["layers"], 4, layers[surface]);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  }
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  m_tilemapShader.DisableShader();
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prevFBO);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  if (scissor)
+    glEnable(GL_SCISSOR_TEST);
+
+  return std::pair<bool, bool>(numLayers[0] != 0, numLayers[1] != 0);
+}
+
+
 /******************************************************************************
  Frame Display Functions
 ******************************************************************************/
@@ -531,7 +738,7 @@ void CRender2D::Setup2D(bool isBottom)
   }
 
   // Set up the viewport and orthogonal projection
-  bool stretchBottom = m_config["WideBackground"].ValueAs<bool>() && isBottom;
+  bool stretchBottom = m_wideBackground.Get() && isBottom;
   if (!stretchBottom)
   {
     glViewport(m_xOffset - m_correction, m_yOffset + m_correction, m_xPixels, m_yPixels); //Preserve aspect ratio of tile layer by constraining and centering viewport
@@ -542,29 +749,95 @@ void CRender2D::BeginFrame(void)
 {
 }
 
+// Redraws the lines of all layers that changed, returns false if there were none
+bool CRender2D::DrawFrame(void)
+{
+  bool anyDirty = FindDirtyLines();
+  m_vramDirty.Clear();
+  m_palDirty[0].Clear();
+  m_palDirty[1].Clear();
+  m_allDirty = false;
+  if (anyDirty)
+    m_surfaces_present = DrawTilemaps(m_bottomSurface, m_topSurface);
+  return anyDirty;
+}
+
+int CRender2D::StartDrawThread(void *data)
+{
+  return ((CRender2D *) data)->RunDrawThread();
+}
+
+int CRender2D::RunDrawThread(void)
+{
+  while (true)
+  {
+    m_drawStart->Wait();
+    if (m_drawQuit)
+      return 0;
+    m_linesDrawn = DrawFrame();
+    m_drawDone->Post();
+  }
+}
+
+bool CRender2D::StartPreRenderFrame(void)
+{
+  if (m_drawThread == NULL)
+    return false;
+  m_drawPending = true;
+  m_drawStart->Post();
+  return true;
+}
+
 void CRender2D::PreRenderFrame(void)
 {
-  // Update all layers
-  m_surfaces_present = DrawTilemaps(m_bottomSurface, m_topSurface);
+  if (m_gpuTilemaps)
+  {
+    UploadDirtyPages();
+    m_surfaces_present = DrawTilemapsGPU();
+    return;
+  }
+
+  // Update the lines of all layers that changed, nothing to upload if none
+  bool anyDirty;
+  if (m_drawPending)
+  {
+    m_drawDone->Wait();
+    m_drawPending = false;
+    anyDirty = m_linesDrawn;
+  }
+  else
+    anyDirty = DrawFrame();
+  if (!anyDirty)
+    return;
+
+  // Upload the range of lines redrawn
+  int first = int(std::find(m_lineDirty, m_lineDirty + 384, true) - m_lineDirty);
+  int last = 383;
+  while (!m_lineDirty[last])
+    last--;
+  int offset = first * 496;
+  int height = last - first + 1;
   glActiveTexture(GL_TEXTURE0); // texture unit 0
   if (m_surfaces_present.first)
   {
     glBindTexture(GL_TEXTURE_2D, m_texID[0]);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 496, 384, GL_RGBA, GL_UNSIGNED_BYTE, m_topSurface);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, 496, height, GL_RGBA, GL_UNSIGNED_BYTE, m_topSurface + offset);
   }
   if (m_surfaces_present.second)
   {
     glBindTexture(GL_TEXTURE_2D, m_texID[1]);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 496, 384, GL_RGBA, GL_UNSIGNED_BYTE, m_bottomSurface);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, 496, height, GL_RGBA, GL_UNSIGNED_BYTE, m_bottomSurface + offset);
   }
 }
 
 void CRender2D::RenderFrameBottom(void)
 {
   // Display bottom surface if anything was drawn there, else clear everything
+  GPUTimer::Begin(GPUTimer::Render2DBottom);
   Setup2D(true);
   if (m_surfaces_present.second)
     DisplaySurface(1);
+  GPUTimer::End(GPUTimer::Render2DBottom);
 }
 
 void CRender2D::RenderFrameTop(void)
@@ -572,9 +845,11 @@ void CRender2D::RenderFrameTop(void)
   // Display top surface only if it exists
   if (m_surfaces_present.first)
   {
+    GPUTimer::Begin(GPUTimer::Render2DTop);
     Setup2D(false);
     glEnable(GL_BLEND);
     DisplaySurface(0);
+    GPUTimer::End(GPUTimer::Render2DTop);
   }
 }
 
@@ -607,13 +882,35 @@ void CRender2D::AttachPalette(const uint32_t *palPtr[2])
 {
   m_palette[0] = palPtr[0];
   m_palette[1] = palPtr[1];
-  DebugLog("Render2D attached palette\n");
 }
 
 void CRender2D::AttachVRAM(const uint8_t *vramPtr)
 {
   m_vram = (uint32_t *) vramPtr;
-  DebugLog("Render2D attached VRAM\n");
+}
+
+bool CRender2D::UsesDirtyPages(void) const
+{
+  return true;
+}
+
+void CRender2D::MarkDirty(const CDirtyPages &vramPages, const CDirtyPages palPages[2])
+{
+  if (m_allDirty)
+    return;
+  if (vramPages.PageSize() != m_vramDirty.PageSize())
+  {
+    m_allDirty = true;  // pages cannot be merged
+    return;
+  }
+  m_vramDirty.Merge(vramPages);
+  m_palDirty[0].Merge(palPages[0]);
+  m_palDirty[1].Merge(palPages[1]);
+}
+
+void CRender2D::MarkAllDirty(void)
+{
+  m_allDirty = true;
 }
 
 // Memory pool and offsets within it
@@ -642,13 +939,27 @@ bool CRender2D::Init(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned
   m_totalYPixels = totalYRes;
   m_correction = (UINT32)(((yRes / 384.f) * 2) + 0.5f);		// for some reason the 2d layer is 2 pixels off the 3D
 
+  // Worker for drawing the layers while the 3D scene is built
+  if (m_async2D && !m_gpuTilemaps)
+  {
+    m_drawStart = CThread::CreateSemaphore(0);
+    m_drawDone = CThread::CreateSemaphore(0);
+    if (m_drawStart != NULL && m_drawDone != NULL)
+      m_drawThread = CThread::CreateThread("Render2D", StartDrawThread, this);
+    if (m_drawThread == NULL)
+      InfoLog("Unable to create 2D drawing thread, drawing on the render thread instead: %s", CThread::GetLastError());
+  }
+
   DebugLog("Render2D initialized (allocated %1.1f MB)\n", float(MEMORY_POOL_SIZE) / 0x100000);
   return OKAY;
 }
 
 CRender2D::CRender2D(const Util::Config::Node& config)
   : m_config(config),
-  m_vao(0)
+  m_wideBackground(config, "WideBackground"),
+  m_vao(0),
+  m_gpuTilemaps(config["GPUTilemaps"].ValueAsDefault<bool>(false)),
+  m_async2D(config["Async2D"].ValueAsDefault<bool>(false))
 {
   DebugLog("Built Render2D\n");
 
@@ -679,11 +990,36 @@ CRender2D::CRender2D(const Util::Config::Node& config)
   glBindVertexArray(m_vao);
   // no states needed since we do it in the shader
   glBindVertexArray(0);
+
+  // Same page layout as the tile generator, so that its pages can be merged
+  unsigned pageSize = m_config["SnapshotPageSize"].ValueAsDefault<unsigned>(1024);
+  m_vramDirty.Init(0x120000, pageSize);
+  m_palDirty[0].Init(0x20000, pageSize);
+  m_palDirty[1].Init(0x20000, pageSize);
+
+  if (m_gpuTilemaps)
+    CreateTilemapResources();
 }
 
 CRender2D::~CRender2D(void)
 {
+  if (m_drawThread != NULL)
+  {
+    if (m_drawPending)
+      m_drawDone->Wait();
+    m_drawQuit = true;
+    m_drawStart->Post();
+    m_drawThread->Wait();
+    delete m_drawThread;
+    m_drawThread = NULL;
+  }
+  delete m_drawStart;
+  delete m_drawDone;
+  m_drawStart = NULL;
+  m_drawDone = NULL;
+
   m_shader.UnloadShaders();
+  DestroyTilemapResources();
   glDeleteTextures(2, m_texID);
 
   if (m_vao) {
@@ -31,6 +31,10 @@
 #include <GL/glew.h>
 #include "Util/NewConfig.h"
 #include "New3D/GLSLShader.h"
+#include "Model3/DirtyPages.h"
+
+class CThread;
+class CSemaphore;
 
 
 /*
@@ -52,6 +56,20 @@ public:
    */
   void BeginFrame(void);
 
+  /*
+   * StartPreRenderFrame(void):
+   *
+   * Starts drawing the layers on a worker thread, if asynchronous 2D drawing
+   * is enabled and the layers are drawn by the CPU, so that the caller can do
+   * other work until PreRenderFrame(), which waits for the worker and sends
+   * the surfaces to the GPU. The attached memory must not be modified until
+   * then.
+   *
+   * Returns:
+   *    True if drawing was started, false if PreRenderFrame() does it all.
+   */
+  bool StartPreRenderFrame(void);
+
   /*
    * PreRenderFrame(void):
    *
@@ -138,6 +156,35 @@ public:
    */
   void AttachVRAM(const uint8_t *vramPtr);
 
+  /*
+   * UsesDirtyPages(void):
+   *
+   * Returns true if the renderer needs to be told which pages of VRAM and the
+   * palettes were written by MarkDirty(), either to update its copies on the
+   * GPU or to redraw only the lines that changed.
+   */
+  bool UsesDirtyPages(void) const;
+
+  /*
+   * MarkDirty(vramPages, palPages):
+   *
+   * Records the pages of VRAM and the palettes that changed since the last
+   * call. They are uploaded or redrawn by the next PreRenderFrame(). Must be
+   * called while the attached memory is not being modified.
+   *
+   * Parameters:
+   *    vramPages Dirty pages of VRAM (0x120000 bytes).
+   *    palPages  Dirty pages of the two palettes (0x20000 bytes each).
+   */
+  void MarkDirty(const CDirtyPages &vramPages, const CDirtyPages palPages[2]);
+
+  /*
+   * MarkAllDirty(void):
+   *
+   * Indicates that all of VRAM and the palettes must be uploaded again.
+   */
+  void MarkAllDirty(void);
+
   /*
    * Init(xOffset, yOffset, xRes, yRes, totalXRes, totalYRes);
    *
@@ -174,12 +221,22 @@ public:
   
 private:
   // Private member functions
+  std::pair<bool, bool> DrawTilemapLines(uint32_t *destBottom, uint32_t *destTop, int firstLine, int numLines);
   std::pair<bool, bool> DrawTilemaps(uint32_t *destBottom, uint32_t *destTop);
+  bool FindDirtyLines(void);
   void DisplaySurface(int surface);
   void Setup2D(bool isBottom);
+  void CreateTilemapResources(void);
+  void DestroyTilemapResources(void);
+  void UploadDirtyPages(void);
+  std::pair<bool, bool> DrawTilemapsGPU(void);
+  bool DrawFrame(void);
+  static int StartDrawThread(void *data);
+  int RunDrawThread(void);
       
   // Run-time configuration
   const Util::Config::Node &m_config;
+  Util::Config::CachedValue<bool> m_wideBackground;  // read each frame
 
   // Data received from tile generator device object
   const uint32_t *m_vram;
@@ -199,9 +256,38 @@ private:
   GLuint m_vao;
   GLSLShader m_shader;
 
+  // GPU tilemap rendering: VRAM and palettes are kept in texture buffers and
+  // the surfaces are drawn into m_texID[] by a shader
+  bool        m_gpuTilemaps;
+  GLSLShader  m_tilemapShader;
+  GLuint      m_tilemapFBO = 0;
+  GLuint      m_vramBuffer = 0;   // tile data, scroll, mask and name tables (first 1 MB of VRAM)
+  GLuint      m_palBuffer = 0;    // palettes A/A' and B/B' one after the other
+  GLuint      m_bufferTex[2] = { 0, 0 };  // texture buffer views of the above
+
+  // Pages written since the last PreRenderFrame(), to upload (GPU tilemaps)
+  // or to find the lines to redraw from (CPU)
+  CDirtyPages m_vramDirty;
+  CDirtyPages m_palDirty[2];
+  bool        m_allDirty = true;  // everything (initially and after a reset)
+
+  // CPU rendering redraws only lines whose inputs changed
+  bool        m_lineDirty[384];
+  uint32_t    m_prevRegs[5];      // layer configuration and scroll registers last drawn with
+
   // PreRenderFrame() tracks which surfaces exist in current frame
   std::pair<bool, bool> m_surfaces_present = std::pair<bool, bool>(false, false);
 
+  // Asynchronous drawing: the worker runs DrawFrame() between
+  // StartPreRenderFrame() and PreRenderFrame()
+  bool        m_async2D;
+  CThread     *m_drawThread = 0;
+  CSemaphore  *m_drawStart = 0;
+  CSemaphore  *m_drawDone = 0;
+  bool        m_drawPending = false;
+  bool        m_drawQuit = false;
+  bool        m_linesDrawn = false; // whether the worker redrew any lines
+
   // Buffers
   uint8_t   *m_memoryPool = 0;    // all memory is allocated here
   uint32_t  *m_topSurface = 0;    // 512x384x32bpp pixel surface for top layers
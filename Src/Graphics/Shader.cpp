@@ -46,6 +46,7 @@
 #include <cstdio>
 #include <GL/glew.h>
 #include "Supermodel.h"
+#include "ShaderCache.h"
 
 
 // Load a source file. Pointer returned must be freed by caller. Returns NULL if failed.
@@ -113,11 +114,20 @@ bool LoadShaderProgram(GLuint *shaderProgramPtr, GLuint *vertexShaderPtr, GLuint
 		goto Quit;
 	}
 	
-	// Create the shaders and shader program
-	shaderProgram	= glCreateProgram();
+	// Create the shader program, linked straight from its binary if cached
+	shaderProgram		= glCreateProgram();
+	*shaderProgramPtr	= shaderProgram;
+	if (ShaderCache::Load(shaderProgram, { vsSource, fsSource }))
+	{
+		*vertexShaderPtr	= 0;
+		*fragmentShaderPtr	= 0;
+		glUseProgram(shaderProgram);
+		goto Quit;
+	}
+
+	// Create the shaders
 	vertexShader	= glCreateShader(GL_VERTEX_SHADER);
 	fragmentShader 	= glCreateShader(GL_FRAGMENT_SHADER);
-	*shaderProgramPtr	= shaderProgram;
 	*vertexShaderPtr 	= vertexShader;
 	*fragmentShaderPtr 	= fragmentShader;
 	
@@ -157,7 +167,10 @@ bool LoadShaderProgram(GLuint *shaderProgramPtr, GLuint *vertexShaderPtr, GLuint
 
 	// Enable the shader (if no errors)
 	if (ret == OKAY)
+	{
+		ShaderCache::Save(shaderProgram, { vsSource, fsSource });
 		glUseProgram(shaderProgram);
+	}
 
 	// Clean up and quit 
 Quit:
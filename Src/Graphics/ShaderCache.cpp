@@ -0,0 +1,169 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+ 
+/*
+ * ShaderCache.cpp
+ * 
+ * Cache of linked shader program binaries.
+ */
+
+#include "ShaderCache.h"
+#include "OSD/FileSystemPath.h"
+#include "OSD/Logger.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace ShaderCache
+{
+	struct Header
+	{
+		char		magic[8];
+		uint64_t	key;
+		uint32_t	format;
+		uint32_t	length;
+	};
+
+	static const char s_magic[8] = { 'S', 'M', 'S', 'H', 'A', 'D', 'E', 'R' };
+
+	static bool		s_init = false;
+	static bool		s_enabled = false;
+	static uint64_t	s_driverHash = 0;
+
+	// 64-bit FNV-1a
+	static uint64_t Hash(uint64_t hash, const char *str)
+	{
+		for (; str && *str; str++)
+		{
+			hash ^= (unsigned char) *str;
+			hash *= 0x100000001B3ull;
+		}
+		return hash ^ 0xFF;	// separates consecutive strings
+	}
+
+	static void Init(void)
+	{
+		s_init = true;
+
+		GLint numFormats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		s_enabled = numFormats > 0;
+
+		s_driverHash = 0xCBF29CE484222325ull;
+		s_driverHash = Hash(s_driverHash, (const char *) glGetString(GL_VENDOR));
+		s_driverHash = Hash(s_driverHash, (const char *) glGetString(GL_RENDERER));
+		s_driverHash = Hash(s_driverHash, (const char *) glGetString(GL_VERSION));
+
+		// Let the driver compile the shaders of a program concurrently when
+		// they are not in the cache
+		if (GLEW_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		else if (GLEW_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	}
+
+	static uint64_t GetKey(const std::vector<const char *> &sources)
+	{
+		uint64_t key = s_driverHash;
+		for (auto source: sources)
+			key = Hash(key, source);
+		return key;
+	}
+
+	static std::string GetFilePath(uint64_t key)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "ShaderCache-%016llx.bin", (unsigned long long) key);
+		return FileSystemPath::GetPath(FileSystemPath::Config) + name;
+	}
+
+	bool Load(GLuint program, const std::vector<const char *> &sources)
+	{
+		if (!s_init)
+			Init();
+		if (!s_enabled)
+			return false;
+
+		uint64_t key = GetKey(sources);
+		bool loaded = false;
+
+		FILE *fp = fopen(GetFilePath(key).c_str(), "rb");
+		if (fp)
+		{
+			Header header;
+			if (fread(&header, sizeof(header), 1, fp) == 1 && !memcmp(header.magic, s_magic, sizeof(s_magic)) && header.key == key)
+			{
+				std::vector<char> binary(header.length);
+				if (fread(binary.data(), 1, binary.size(), fp) == binary.size())
+				{
+					glProgramBinary(program, header.format, binary.data(), GLsizei(binary.size()));
+					GLint result = GL_FALSE;
+					glGetProgramiv(program, GL_LINK_STATUS, &result);
+					loaded = result == GL_TRUE;	// rejected by the driver if it has changed in some other way
+				}
+			}
+			fclose(fp);
+		}
+
+		if (!loaded)
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		return loaded;
+	}
+
+	void Save(GLuint program, const std::vector<const char *> &sources)
+	{
+		if (!s_enabled)
+			return;
+
+		GLint result = GL_FALSE;
+		GLint length = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &result);
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (result != GL_TRUE || length <= 0)
+			return;
+
+		Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, s_magic, sizeof(s_magic));
+		header.key = GetKey(sources);
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+		header.format = format;
+		header.length = uint32_t(length);
+
+		std::string file = GetFilePath(header.key);
+		FILE *fp = fopen(file.c_str(), "wb");
+		if (!fp)
+			return;
+		bool error = fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(binary.data(), 1, header.length, fp) != header.length;
+		error = fclose(fp) != 0 || error;
+		if (error)
+		{
+			remove(file.c_str());	// a partial file would only be rejected later
+			ErrorLog("Unable to write shader cache file '%s'.", file.c_str());
+		}
+	}
+}
@@ -0,0 +1,75 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+ 
+/*
+ * ShaderCache.h
+ * 
+ * Cache of linked shader program binaries.
+ */
+
+#ifndef INCLUDED_SHADERCACHE_H
+#define INCLUDED_SHADERCACHE_H
+
+#include <GL/glew.h>
+#include <vector>
+
+/*
+ * Drivers can return a linked program as a binary blob and link a program
+ * from one again, which takes a fraction of the time compiling the sources
+ * does. Binaries are kept in the config directory, one file per program,
+ * named after a hash of the program sources and the GL vendor, renderer and
+ * version strings, so any driver update or source change misses the cache.
+ *
+ * Usage:
+ *
+ *		if (!ShaderCache::Load(program, sources)) {
+ *			// compile and attach shaders, link
+ *			ShaderCache::Save(program, sources);
+ *		}
+ */
+namespace ShaderCache
+{
+	/*
+	 * Load(program, sources):
+	 *
+	 * Links a program from its cached binary. On failure, the program is left
+	 * ready for linking from source with its binary retrievable by Save().
+	 *
+	 * Parameters:
+	 *		program		Program object, not yet linked.
+	 *		sources		Source of each shader of the program, in a fixed order.
+	 *
+	 * Returns:
+	 *		True if the program was linked from the cache.
+	 */
+	bool Load(GLuint program, const std::vector<const char *> &sources);
+
+	/*
+	 * Save(program, sources):
+	 *
+	 * Writes the binary of a program linked from source to the cache. Does
+	 * nothing if it failed to link.
+	 */
+	void Save(GLuint program, const std::vector<const char *> &sources);
+}
+
+#endif	// INCLUDED_SHADERCACHE_H
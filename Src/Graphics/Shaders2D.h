@@ -71,4 +71,85 @@ static const char s_fragmentShaderSource[] = R"glsl(
 	)glsl";
 
 
+// Tilemap fragment shader: draws a surface from VRAM and the palettes, one
+// screen pixel (496x384) per fragment, with the same rules as the CPU path
+// in Render2D.cpp
+static const char s_tilemapFragmentShaderSource[] = R"glsl(
+
+	#version 410 core
+
+	// inputs
+	uniform usamplerBuffer	vram;			// first 1 MB of VRAM, one word per texel
+	uniform samplerBuffer	palette;		// palette A/A' followed by palette B/B'
+	uniform uint			layerConfig;	// layer configuration register (0x20)
+	uniform uint			scrollRegs[4];	// scroll registers (0x60-0x6C)
+	uniform int				numLayers;
+	uniform int				layers[4];		// layers to draw, bottom-most first
+
+	// outputs
+	out vec4 fragColor;
+
+	// VRAM is little endian, so the low half of each word comes first
+	uint ReadHalf(uint index)
+	{
+		uint word = texelFetch(vram, int(index >> 1)).r;
+		return ((index & 1u) != 0u) ? (word >> 16) : (word & 0xFFFFu);
+	}
+
+	vec4 LayerPixel(int layer, uint x, uint y, out bool visible)
+	{
+		// Stencil mask: A/A' use the second half of each line's word, and the
+		// alternate layers are shown where the bit is clear
+		uint mask = ReadHalf(0x7B800u + (y * 2u) + ((layer < 2) ? 1u : 0u));
+		if ((layer & 1) != 0)
+			mask ^= 0xFFFFu;
+		visible = (mask & (1u << (15u - (x / 32u)))) != 0u;
+		if (!visible)
+			return vec4(0.0);
+
+		// Scrolled position within the 512x512 tilemap
+		uint scroll = scrollRegs[layer];
+		uint hScroll = (((scroll & 0x8000u) != 0u) ? ReadHalf(0x7B000u + uint(layer) * 0x200u + y) : scroll) & 0x1FFu;
+		uint vScroll = (scroll >> 16) & 0x1FFu;
+		uint tx = hScroll + x;
+		uint ty = y + vScroll;
+		uint tile = ReadHalf(0x7C000u + uint(layer) * 0x1000u + ((64u * (ty / 8u)) & 0xFFFu) + (((tx / 8u) ^ 1u) & 63u));
+		uint fine = tx & 7u;
+		uint vFine = ty & 7u;
+
+		// Pattern data gives the low color bits, the name table entry the high ones
+		uint color;
+		if ((layerConfig & (1u << (12 + layer))) != 0u)
+		{
+			uint pattern = texelFetch(vram, int(((((tile & 0x3FFFu) << 1) | ((tile >> 15) & 1u)) * 8u) + vFine)).r;
+			color = ((pattern >> ((7u - fine) * 4u)) & 0xFu) | (tile & 0x7FF0u);
+		}
+		else
+		{
+			uint pattern = texelFetch(vram, int(((tile & 0x3FFFu) * 16u) + (vFine * 2u) + (fine / 4u))).r;
+			color = ((pattern >> ((3u - (fine & 3u)) * 8u)) & 0xFFu) | (tile & 0x7F00u);
+		}
+		return texelFetch(palette, int(color + uint(layer / 2) * 32768u));
+	}
+
+	void main()
+	{
+		uint x = uint(gl_FragCoord.x);
+		uint y = uint(gl_FragCoord.y);	// surface row 0 is the top line
+
+		// Bottom-most layer is drawn as is, the ones above only where opaque
+		vec4 color = vec4(0.0);
+		for (int i = 0; i < numLayers; i++)
+		{
+			bool visible;
+			vec4 pixel = LayerPixel(layers[i], x, y, visible);
+			if (i == 0 || (visible && pixel.a != 0.0))
+				color = pixel;
+		}
+		fragColor = color;
+	}
+
+	)glsl";
+
+
 #endif	// INCLUDED_SHADERS2D_H
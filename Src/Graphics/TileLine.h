@@ -0,0 +1,212 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * TileLine.h
+ *
+ * Draws one 8-pixel line of a tile generator tile into a 496-pixel line of a
+ * layer. Used by the software layer renderer in Render2D.cpp, and kept in a
+ * header so Test_Lockstep can check the SIMD version against the scalar one.
+ */
+
+#ifndef INCLUDED_TILELINE_H
+#define INCLUDED_TILELINE_H
+
+#include <cstdint>
+#include <cstring>
+
+// SSE2 and NEON are part of the x64 and AArch64 base instruction sets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RENDER2D_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define RENDER2D_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+template <int bits, bool alphaTest, bool clip>
+static inline void DrawTileLine(uint32_t *line, int pixelOffset, uint16_t tile, int patternLine, const uint32_t *vram, const uint32_t *palette, uint16_t mask)
+{
+  static_assert(bits == 4 || bits == 8, "Tiles are either 4- or 8-bit");
+
+  // For 8-bit pixels, each line of tile pattern is two words
+  if (bits == 8)
+    patternLine *= 2;
+
+  // Compute offset of pattern for this line
+  int patternOffset;
+  if (bits == 4)
+  {
+    patternOffset = ((tile & 0x3FFF) << 1) | ((tile >> 15) & 1);
+    patternOffset *= 32;
+    patternOffset /= 4;
+  }
+  else
+  {
+    patternOffset = tile & 0x3FFF;
+    patternOffset *= 64;
+    patternOffset /= 4;
+  }
+
+  // Name table entry provides high color bits
+  uint32_t colorHi = tile & ((bits == 4) ? 0x7FF0 : 0x7F00);
+
+  // Draw
+  if (bits == 4)
+  {
+    uint32_t pattern = vram[patternOffset + patternLine];
+    for (int p = 7; p >= 0; p--)
+    {
+      if (!clip || (/*pixelOffset >= 0 &&*/ (unsigned int)pixelOffset < 496u)) // the >= 0 check is accounted for, as the cast to uint makes them appear as very large unsigned values
+      {
+        uint16_t maskTest = 1 << (15-((pixelOffset+0)/32));
+        bool visible = (mask & maskTest) != 0;
+        uint32_t pixel = visible ? palette[((pattern >> (p*4)) & 0xF) | colorHi] : 0;
+        if (!alphaTest || (visible && (pixel >> 24) != 0))  // only draw opaque pixels
+            line[pixelOffset] = pixel;
+      }
+      ++pixelOffset;
+    }
+  }
+  else
+  {
+    for (int i = 0; i < 2; i++) // 4 pixels per word
+    {
+      uint32_t pattern = vram[patternOffset + patternLine + i];
+      for (int p = 3; p >= 0; p--)
+      {
+        if (!clip || (/*pixelOffset >= 0 &&*/ (unsigned int)pixelOffset < 496u)) // the >= 0 check is accounted for, as the cast to uint makes them appear as very large unsigned values
+        {
+          uint16_t maskTest = 1 << (15-((pixelOffset+0)/32));
+          bool visible = (mask & maskTest) != 0;
+          uint32_t pixel = visible ? palette[((pattern >> (p*8)) & 0xFF) | colorHi] : 0;
+          if (!alphaTest || (visible && (pixel >> 24) != 0))
+              line[pixelOffset] = pixel;
+        }
+        ++pixelOffset;
+      }
+    }
+  }
+}
+
+#if defined(RENDER2D_SIMD_SSE2) || defined(RENDER2D_SIMD_NEON)
+
+/*
+ * DrawTileLineSIMD<bits, alphaTest>(line, pixelOffset, tile, patternLine,
+ *                                   vram, palette, mask):
+ *
+ * Same as DrawTileLine<bits, alphaTest, false>() (which is the reference for
+ * it) but draws the tile line's 8 pixels at once. The stencil mask is tested
+ * once per 32-pixel span the line touches (at most 2) and the stores are
+ * masked per pixel.
+ */
+template <int bits, bool alphaTest>
+static inline void DrawTileLineSIMD(uint32_t *line, int pixelOffset, uint16_t tile, int patternLine, const uint32_t *vram, const uint32_t *palette, uint16_t mask)
+{
+  static_assert(bits == 4 || bits == 8, "Tiles are either 4- or 8-bit");
+
+  // Visibility of each of the 8 pixels (bit 0 is the left-most). Pixels from
+  // the split point onwards are in the next 32-pixel span.
+  int span = pixelOffset / 32;
+  int split = 32 - (pixelOffset & 31);
+  unsigned firstVisible = (mask >> (15 - span)) & 1;
+  unsigned visible;
+  if (split >= 8)
+    visible = firstVisible ? 0xFF : 0;
+  else
+  {
+    unsigned firstPixels = (1 << split) - 1;
+    visible = (firstVisible ? firstPixels : 0) | ((((mask >> (14 - span)) & 1) ? 0xFF : 0) & ~firstPixels);
+  }
+
+  uint32_t *dest = &line[pixelOffset];
+  if (!visible)
+  {
+    if (!alphaTest)
+      memset(dest, 0, 8 * sizeof(uint32_t));
+    return;
+  }
+
+  // Palette lookup, as in DrawTileLine()
+  uint32_t pixels[8];
+  if (bits == 4)
+  {
+    int patternOffset = (((tile & 0x3FFF) << 1) | ((tile >> 15) & 1)) * 8;
+    uint32_t pattern = vram[patternOffset + patternLine];
+    uint32_t colorHi = tile & 0x7FF0;
+    for (int i = 0; i < 8; i++)
+      pixels[i] = palette[((pattern >> ((7 - i) * 4)) & 0xF) | colorHi];
+  }
+  else
+  {
+    int patternOffset = (tile & 0x3FFF) * 16;
+    const uint32_t *pattern = &vram[patternOffset + patternLine * 2];
+    uint32_t colorHi = tile & 0x7F00;
+    for (int i = 0; i < 8; i++)
+      pixels[i] = palette[((pattern[i / 4] >> ((3 - (i & 3)) * 8)) & 0xFF) | colorHi];
+  }
+
+  // Clear hidden pixels, or leave them and transparent ones as they are when
+  // alpha testing
+#if defined(RENDER2D_SIMD_SSE2)
+  const __m128i bitsLo = _mm_set_epi32(0x08, 0x04, 0x02, 0x01);
+  const __m128i bitsHi = _mm_set_epi32(0x80, 0x40, 0x20, 0x10);
+  __m128i vis = _mm_set1_epi32(visible);
+  for (int half = 0; half < 2; half++)
+  {
+    const __m128i bit = half ? bitsHi : bitsLo;
+    __m128i keep = _mm_cmpeq_epi32(_mm_and_si128(vis, bit), bit);
+    __m128i pixel = _mm_loadu_si128((const __m128i *) &pixels[half * 4]);
+    __m128i *out = (__m128i *) &dest[half * 4];
+    if (alphaTest)
+    {
+      __m128i transparent = _mm_cmpeq_epi32(_mm_srli_epi32(pixel, 24), _mm_setzero_si128());
+      keep = _mm_andnot_si128(transparent, keep);
+      pixel = _mm_or_si128(_mm_and_si128(keep, pixel), _mm_andnot_si128(keep, _mm_loadu_si128(out)));
+    }
+    else
+      pixel = _mm_and_si128(keep, pixel);
+    _mm_storeu_si128(out, pixel);
+  }
+#else
+  static const uint32_t bitsLo[4] = { 0x01, 0x02, 0x04, 0x08 };
+  static const uint32_t bitsHi[4] = { 0x10, 0x20, 0x40, 0x80 };
+  uint32x4_t vis = vdupq_n_u32(visible);
+  for (int half = 0; half < 2; half++)
+  {
+    uint32x4_t keep = vtstq_u32(vis, vld1q_u32(half ? bitsHi : bitsLo));
+    uint32x4_t pixel = vld1q_u32(&pixels[half * 4]);
+    uint32_t *out = &dest[half * 4];
+    if (alphaTest)
+    {
+      keep = vandq_u32(keep, vtstq_u32(pixel, vdupq_n_u32(0xFF000000)));
+      pixel = vbslq_u32(keep, pixel, vld1q_u32(out));
+    }
+    else
+      pixel = vandq_u32(keep, pixel);
+    vst1q_u32(out, pixel);
+  }
+#endif
+}
+
+#endif
+
+#endif  // INCLUDED_TILELINE_H
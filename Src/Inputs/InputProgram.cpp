@@ -0,0 +1,382 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * InputProgram.cpp
+ *
+ * Implementation of CInputProgram.
+ */
+
+#include "InputProgram.h"
+
+#include "Supermodel.h"
+#include "Input.h"
+#include "InputTypes.h"
+#include "InputSystem.h"
+#include "MultiInputSource.h"
+
+#include <tuple>
+
+bool CInputProgram::Read::operator<(const Read &other) const
+{
+	return std::tie(type, device, index, dir) < std::tie(other.type, other.device, other.index, other.dir);
+}
+
+CInputProgram::~CInputProgram()
+{
+	Clear();
+}
+
+void CInputProgram::Clear(void)
+{
+	for (const Entry &entry : m_entries)
+	{
+		if (entry.source != NULL)
+			entry.source->Release();
+	}
+	m_entries.clear();
+	m_reads.clear();
+	m_snapshot.clear();
+	m_ops.clear();
+	m_children.clear();
+}
+
+CInputSource *CInputProgram::GetSource(CInput *input, InputType type)
+{
+	switch (type)
+	{
+	case InputSwitch:	return static_cast<CSwitchInput *>(input)->m_source;
+	case InputAnalog:	return static_cast<CAnalogInput *>(input)->m_source;
+	case InputAxis:		return static_cast<CAxisInput *>(input)->m_source;
+	default:			return NULL;
+	}
+}
+
+int CInputProgram::AddRead(ReadType type, int device, int index, int dir)
+{
+	Read read = { type, device, index, dir };
+	auto it = m_readIndex.find(read);
+	if (it != m_readIndex.end())
+		return it->second;
+	int idx = int(m_reads.size());
+	m_reads.push_back(read);
+	m_readIndex[read] = idx;
+	return idx;
+}
+
+int CInputProgram::CompileSource(CInputSource *source)
+{
+	Op op = { OpSource, source->type == SourceSwitch, -1, -1, source };
+
+	if (auto key = dynamic_cast<CInputSystem::CKeyInputSource *>(source))
+	{
+		op.type = OpKey;
+		op.read = AddRead(ReadKey, key->m_kbdNum, key->m_keyIndex);
+	}
+	else if (auto mseAxis = dynamic_cast<CInputSystem::CMseAxisInputSource *>(source))
+	{
+		op.type = OpMouseAxis;
+		op.read = AddRead(ReadMouseAxis, mseAxis->m_mseNum, mseAxis->m_axisNum);
+		if (mseAxis->m_axisNum == AXIS_Z)
+			op.read2 = AddRead(ReadMouseWheel, mseAxis->m_mseNum, 0);
+	}
+	else if (auto mseBut = dynamic_cast<CInputSystem::CMseButInputSource *>(source))
+	{
+		op.type = OpButton;
+		op.read = AddRead(ReadMouseButton, mseBut->m_mseNum, mseBut->m_butNum);
+	}
+	else if (auto joyAxis = dynamic_cast<CInputSystem::CJoyAxisInputSource *>(source))
+	{
+		op.type = OpJoyAxis;
+		op.read = AddRead(ReadJoyAxis, joyAxis->m_joyNum, joyAxis->m_axisNum);
+	}
+	else if (auto joyPOV = dynamic_cast<CInputSystem::CJoyPOVInputSource *>(source))
+	{
+		op.type = OpButton;
+		op.read = AddRead(ReadJoyPOV, joyPOV->m_joyNum, joyPOV->m_povNum, joyPOV->m_povDir);
+	}
+	else if (auto joyBut = dynamic_cast<CInputSystem::CJoyButInputSource *>(source))
+	{
+		op.type = OpButton;
+		op.read = AddRead(ReadJoyButton, joyBut->m_joyNum, joyBut->m_butNum);
+	}
+	else if (auto multi = dynamic_cast<CMultiInputSource *>(source))
+	{
+		// Children are compiled first, and listed together after
+		std::vector<int> children;
+		for (int i = 0; i < multi->m_numSrcs; i++)
+			children.push_back(CompileSource(multi->m_srcArray[i]));
+		op.type = multi->m_numSrcs == 0 ? OpEmpty : (multi->m_isOr ? OpOr : OpAnd);
+		op.read = int(m_children.size());
+		op.read2 = int(children.size());
+		m_children.insert(m_children.end(), children.begin(), children.end());
+	}
+	else if (auto neg = dynamic_cast<CNegInputSource *>(source))
+	{
+		op.type = OpNot;
+		op.read = CompileSource(neg->m_source);
+	}
+
+	m_ops.push_back(op);
+	return int(m_ops.size()) - 1;
+}
+
+void CInputProgram::Compile(CInputSystem *system, const std::vector<CInput *> &inputs)
+{
+	Clear();
+	m_system = system;
+	for (CInput *input : inputs)
+	{
+		Entry entry = { input, NULL, InputOther, -1 };
+		if (dynamic_cast<CSwitchInput *>(input) != NULL)
+			entry.type = InputSwitch;
+		else if (dynamic_cast<CAnalogInput *>(input) != NULL)
+			entry.type = InputAnalog;
+		else if (dynamic_cast<CAxisInput *>(input) != NULL)
+			entry.type = InputAxis;
+
+		entry.source = GetSource(input, entry.type);
+		if (entry.source != NULL)
+		{
+			entry.source->Acquire();
+			entry.op = CompileSource(entry.source);
+		}
+		m_entries.push_back(entry);
+	}
+	m_snapshot.resize(m_reads.size());
+	m_readIndex.clear();
+}
+
+bool CInputProgram::IsCurrent(void) const
+{
+	for (const Entry &entry : m_entries)
+	{
+		if (GetSource(entry.input, entry.type) != entry.source)
+			return false;
+	}
+	return true;
+}
+
+void CInputProgram::TakeSnapshot(void)
+{
+	for (size_t i = 0; i < m_reads.size(); i++)
+	{
+		const Read &read = m_reads[i];
+		switch (read.type)
+		{
+		case ReadKey:			m_snapshot[i] = m_system->IsKeyPressed(read.device, read.index); break;
+		case ReadMouseAxis:		m_snapshot[i] = m_system->GetMouseAxisValue(read.device, read.index); break;
+		case ReadMouseWheel:	m_snapshot[i] = m_system->GetMouseWheelDir(read.device); break;
+		case ReadMouseButton:	m_snapshot[i] = m_system->IsMouseButPressed(read.device, read.index); break;
+		case ReadJoyAxis:		m_snapshot[i] = m_system->GetJoyAxisValue(read.device, read.index); break;
+		case ReadJoyPOV:		m_snapshot[i] = m_system->IsJoyPOVInDir(read.device, read.index, read.dir); break;
+		case ReadJoyButton:		m_snapshot[i] = m_system->IsJoyButPressed(read.device, read.index); break;
+		}
+	}
+}
+
+// Same as the GetValueAsSwitch() of each type of source
+bool CInputProgram::GetValueAsSwitch(int idx, bool &val)
+{
+	const Op &op = m_ops[idx];
+	switch (op.type)
+	{
+	case OpEmpty:
+		return false;
+
+	case OpKey:
+	case OpButton:
+		if (!m_snapshot[op.read])
+			return false;
+		val = true;
+		return true;
+
+	case OpMouseAxis:
+		if (!static_cast<CInputSystem::CMseAxisInputSource *>(op.source)->SwitchValue(m_snapshot[op.read], op.read2 >= 0 ? m_snapshot[op.read2] : 0))
+			return false;
+		val = true;
+		return true;
+
+	case OpJoyAxis:
+		if (static_cast<CInputSystem::CJoyAxisInputSource *>(op.source)->ScaleAxisValue(m_snapshot[op.read], 0, 0, 3) < 2)
+			return false;
+		val = true;
+		return true;
+
+	case OpOr:
+		for (int i = 0; i < op.read2; i++)
+		{
+			if (GetValueAsSwitch(m_children[op.read + i], val))
+				return true;
+		}
+		return false;
+
+	case OpAnd:
+		for (int i = 0; i < op.read2; i++)
+		{
+			if (!GetValueAsSwitch(m_children[op.read + i], val))
+				return false;
+		}
+		return true;
+
+	case OpNot:
+	{
+		bool oldVal = val;
+		if (GetValueAsSwitch(op.read, val))
+		{
+			val = oldVal;
+			return false;
+		}
+		val = true;
+		return true;
+	}
+
+	default:
+		return static_cast<CInputSource *>(op.source)->GetValueAsSwitch(val);
+	}
+}
+
+// Same as the GetValueAsAnalog() of each type of source
+bool CInputProgram::GetValueAsAnalog(int idx, int &val, int minVal, int offVal, int maxVal)
+{
+	const Op &op = m_ops[idx];
+	switch (op.type)
+	{
+	case OpEmpty:
+		return false;
+
+	case OpKey:
+		return static_cast<CInputSystem::CKeyInputSource *>(op.source)->AnalogValue(m_snapshot[op.read] != 0, val, minVal, offVal, maxVal);
+
+	case OpButton:
+		if (!m_snapshot[op.read])
+			return false;
+		val = maxVal;
+		return true;
+
+	case OpMouseAxis:
+	case OpJoyAxis:
+	{
+		int axisVal;
+		if (op.type == OpMouseAxis)
+			axisVal = static_cast<CInputSystem::CMseAxisInputSource *>(op.source)->ScaleAxisValue(m_snapshot[op.read], minVal, offVal, maxVal);
+		else
+			axisVal = static_cast<CInputSystem::CJoyAxisInputSource *>(op.source)->ScaleAxisValue(m_snapshot[op.read], minVal, offVal, maxVal);
+		if (axisVal == offVal)
+			return false;
+		val = axisVal;
+		return true;
+	}
+
+	case OpOr:
+		for (int i = 0; i < op.read2; i++)
+		{
+			if (GetValueAsAnalog(m_children[op.read + i], val, minVal, offVal, maxVal))
+				return true;
+		}
+		return false;
+
+	case OpAnd:
+		// All switches must be active, and then the first other source that is
+		// gives the value
+		for (int i = 0; i < op.read2; i++)
+		{
+			int child = m_children[op.read + i];
+			if (m_ops[child].isSwitch && !GetValueAsAnalog(child, val, minVal, offVal, maxVal))
+				return false;
+		}
+		for (int i = 0; i < op.read2; i++)
+		{
+			int child = m_children[op.read + i];
+			if (!m_ops[child].isSwitch && GetValueAsAnalog(child, val, minVal, offVal, maxVal))
+				return true;
+		}
+		return op.isSwitch;
+
+	case OpNot:
+	{
+		int oldVal = val;
+		if (GetValueAsAnalog(op.read, val, minVal, offVal, maxVal))
+		{
+			val = oldVal;
+			return false;
+		}
+		val = maxVal;
+		return true;
+	}
+
+	default:
+		return static_cast<CInputSource *>(op.source)->GetValueAsAnalog(val, minVal, offVal, maxVal);
+	}
+}
+
+// Same as the Poll() of each type of input
+void CInputProgram::Poll(void)
+{
+	TakeSnapshot();
+	for (const Entry &entry : m_entries)
+	{
+		switch (entry.type)
+		{
+		case InputSwitch:
+		{
+			CSwitchInput *input = static_cast<CSwitchInput *>(entry.input);
+			input->prevValue = input->value;
+			bool boolValue = !!input->value;
+			if (entry.op >= 0 && GetValueAsSwitch(entry.op, boolValue))
+				input->value = (boolValue ? input->m_onVal : input->m_offVal);
+			else
+				input->value = input->m_offVal;
+			break;
+		}
+
+		case InputAnalog:
+		{
+			CAnalogInput *input = static_cast<CAnalogInput *>(entry.input);
+			input->prevValue = input->value;
+			int intValue = input->value;
+			if (entry.op >= 0 && GetValueAsAnalog(entry.op, intValue, input->m_minVal, input->m_minVal, input->m_maxVal))
+				input->value = intValue;
+			else
+				input->value = input->m_minVal;
+			break;
+		}
+
+		case InputAxis:
+		{
+			CAxisInput *input = static_cast<CAxisInput *>(entry.input);
+			input->prevValue = input->value;
+			if (input->PollRangeInputs())
+				break;
+			int intValue = input->value;
+			if (entry.op >= 0 && GetValueAsAnalog(entry.op, intValue, input->m_minVal, input->m_offVal, input->m_maxVal))
+				input->value = intValue;
+			else
+				input->value = input->m_offVal;
+			break;
+		}
+
+		default:
+			entry.input->Poll();
+			break;
+		}
+	}
+}
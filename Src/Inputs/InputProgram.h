@@ -0,0 +1,171 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * InputProgram.h
+ *
+ * Header file for CInputProgram, the inputs of a game compiled for polling
+ * in one pass.
+ */
+
+#ifndef INCLUDED_INPUTPROGRAM_H
+#define INCLUDED_INPUTPROGRAM_H
+
+#include "Types.h"
+#include <cstdint>
+#include <map>
+#include <vector>
+
+class CInputSystem;
+class CInputSource;
+class CInput;
+
+/*
+ * CInputProgram:
+ *
+ * The switch, analog and axis inputs of a game with the trees of input
+ * sources parsed from their mappings flattened into an array of operations,
+ * and the raw input system state those read gathered into a snapshot, each
+ * key, button or axis read once however many sources refer to it. Polling
+ * takes the snapshot and then evaluates each input's operations in turn,
+ * without virtual calls; it gives the same values as CInput::Poll(), which
+ * the other inputs, made from the values of those, are still polled with.
+ * Sources of a type the program does not know are called as they are.
+ *
+ * The program holds on to the sources it was compiled from, and must be
+ * compiled again when an input is mapped to another (see IsCurrent()).
+ */
+class CInputProgram
+{
+public:
+	~CInputProgram();
+
+	/*
+	 * Compile(system, inputs):
+	 *
+	 * Compiles the inputs, which are polled in the order given.
+	 */
+	void Compile(CInputSystem *system, const std::vector<CInput *> &inputs);
+
+	/*
+	 * IsCurrent(void):
+	 *
+	 * Returns false if any input has been mapped again since compiling.
+	 */
+	bool IsCurrent(void) const;
+
+	/*
+	 * Poll(void):
+	 *
+	 * Takes a snapshot of the input system, which must have been polled, and
+	 * updates the inputs from it.
+	 */
+	void Poll(void);
+
+	void Clear(void);
+
+	unsigned NumReads(void) const
+	{
+		return unsigned(m_reads.size());
+	}
+
+	unsigned NumOps(void) const
+	{
+		return unsigned(m_ops.size());
+	}
+
+private:
+	enum ReadType : uint8_t
+	{
+		ReadKey,
+		ReadMouseAxis,
+		ReadMouseWheel,
+		ReadMouseButton,
+		ReadJoyAxis,
+		ReadJoyPOV,
+		ReadJoyButton
+	};
+
+	struct Read
+	{
+		ReadType type;
+		int device;
+		int index;
+		int dir;
+
+		bool operator<(const Read &other) const;
+	};
+
+	enum OpType : uint8_t
+	{
+		OpEmpty,
+		OpKey,
+		OpButton,		// mouse or joystick button, or POV hat direction
+		OpMouseAxis,
+		OpJoyAxis,
+		OpOr,
+		OpAnd,
+		OpNot,
+		OpSource		// any other source, called through its interface
+	};
+
+	struct Op
+	{
+		OpType type;
+		bool isSwitch;			// source type is SourceSwitch
+		int read;				// raw value in the snapshot, or first child in m_children
+		int read2;				// mouse wheel direction, or number of children
+		void *source;			// leaf source with the settings of the operation
+	};
+
+	enum InputType : uint8_t
+	{
+		InputSwitch,
+		InputAnalog,
+		InputAxis,
+		InputOther				// polled with CInput::Poll()
+	};
+
+	struct Entry
+	{
+		CInput *input;
+		CInputSource *source;	// compiled, to tell if the input has been mapped again
+		InputType type;
+		int op;					// -1 if the input has no source
+	};
+
+	CInputSystem *m_system = nullptr;
+	std::vector<Read> m_reads;
+	std::vector<int> m_snapshot;
+	std::vector<Op> m_ops;
+	std::vector<int> m_children;
+	std::vector<Entry> m_entries;
+	std::map<Read, int> m_readIndex;	// while compiling
+
+	int AddRead(ReadType type, int device, int index, int dir = 0);
+	int CompileSource(CInputSource *source);
+	static CInputSource *GetSource(CInput *input, InputType type);
+	void TakeSnapshot(void);
+	bool GetValueAsSwitch(int op, bool &val);
+	bool GetValueAsAnalog(int op, int &val, int minVal, int offVal, int maxVal);
+};
+
+#endif	// INCLUDED_INPUTPROGRAM_H
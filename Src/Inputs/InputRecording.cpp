@@ -0,0 +1,214 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * InputRecording.cpp
+ *
+ * Implementation of CInputRecording.
+ *
+ * File Format
+ * -----------
+ * Recordings are block files (see BlockFile.h), compressed like save states,
+ * with two blocks:
+ *
+ *	"Input Recording":
+ *		Version (32-bit integer, currently 1)
+ *		Game name (32-bit length followed by characters)
+ *		Real-time clock seed, seconds since 1970 (64-bit integer)
+ *		Number of inputs (32-bit integer)
+ *		For each input:
+ *			Input ID (32-bit length followed by characters)
+ *			Number of values (32-bit integer, 2 for triggers, which have an
+ *			offscreen value too, otherwise 1)
+ *		Number of frames (32-bit integer)
+ *		Values of each frame, each input in turn (16-bit integers)
+ *
+ *	"Start State":
+ *		Size (32-bit integer)
+ *		Save state written to memory, uncompressed
+ */
+
+#include "InputRecording.h"
+
+#include "Supermodel.h"
+#include "Inputs.h"
+#include "Input.h"
+#include "InputTypes.h"
+#include "Game.h"
+#include "BlockFile.h"
+
+static const uint32_t RECORDING_VERSION = 1;
+
+static void WriteString(CBlockFile *file, const std::string &str)
+{
+	uint32_t length = uint32_t(str.length());
+	file->Write(&length, sizeof(length));
+	file->Write(str.data(), length);
+}
+
+static bool ReadString(CBlockFile *file, std::string *str)
+{
+	uint32_t length = 0;
+	if (file->Read(&length, sizeof(length)) != sizeof(length) || length > 1024)
+		return false;
+	str->resize(length);
+	return file->Read(&(*str)[0], length) == length;
+}
+
+unsigned CInputRecording::NumValues(CInput *input)
+{
+	return dynamic_cast<CTriggerInput *>(input) != NULL ? 2 : 1;
+}
+
+void CInputRecording::Start(CInputs *inputs, const Game &game, int64_t rtcSeed, std::vector<uint8_t> *state)
+{
+	// Record the inputs that CInputs::Poll() updates for the game, save the UI
+	m_inputs.clear();
+	m_valuesPerFrame = 0;
+	for (unsigned i = 0; i < inputs->Count(); i++)
+	{
+		CInput *input = (*inputs)[i];
+		if (!input->IsUIInput() && (input->gameFlags & game.inputs))
+		{
+			m_inputs.push_back(input);
+			m_valuesPerFrame += NumValues(input);
+		}
+	}
+	m_values.clear();
+	m_numFrames = 0;
+	m_frame = 0;
+	m_game = game.name;
+	m_rtcSeed = rtcSeed;
+	m_state.swap(*state);
+}
+
+void CInputRecording::RecordFrame(void)
+{
+	for (CInput *input : m_inputs)
+	{
+		m_values.push_back(input->value);
+		CTriggerInput *trigger = dynamic_cast<CTriggerInput *>(input);
+		if (trigger != NULL)
+			m_values.push_back(trigger->offscreenValue);
+	}
+	m_numFrames++;
+}
+
+bool CInputRecording::ReplayFrame(void)
+{
+	if (m_frame >= m_numFrames)
+		return false;
+	const UINT16 *values = &m_values[size_t(m_frame) * m_valuesPerFrame];
+	for (CInput *input : m_inputs)
+	{
+		input->prevValue = input->value;
+		input->value = *values++;
+		CTriggerInput *trigger = dynamic_cast<CTriggerInput *>(input);
+		if (trigger != NULL)
+			trigger->offscreenValue = *values++;
+	}
+	m_frame++;
+	return true;
+}
+
+bool CInputRecording::Save(const std::string &file, int level) const
+{
+	std::vector<uint8_t> buffer;
+	CBlockFile recording;
+	recording.Create(&buffer, "Supermodel Input Recording", "");
+
+	recording.NewBlock("Input Recording", __FILE__);
+	recording.Write(&RECORDING_VERSION, sizeof(RECORDING_VERSION));
+	WriteString(&recording, m_game);
+	recording.Write(&m_rtcSeed, sizeof(m_rtcSeed));
+	uint32_t numInputs = uint32_t(m_inputs.size());
+	recording.Write(&numInputs, sizeof(numInputs));
+	for (CInput *input : m_inputs)
+	{
+		WriteString(&recording, input->id);
+		uint32_t numValues = NumValues(input);
+		recording.Write(&numValues, sizeof(numValues));
+	}
+	recording.Write(&m_numFrames, sizeof(m_numFrames));
+	recording.Write(m_values.data(), uint32_t(m_values.size() * sizeof(UINT16)));
+
+	recording.NewBlock("Start State", __FILE__);
+	uint32_t stateSize = uint32_t(m_state.size());
+	recording.Write(&stateSize, sizeof(stateSize));
+	recording.Write(m_state.data(), stateSize);
+	recording.Close();
+
+	if (OKAY != CBlockFile::Save(file, buffer, level))
+		return ErrorLog("Unable to write input recording to '%s'.", file.c_str());
+	return OKAY;
+}
+
+bool CInputRecording::Load(const std::string &file, CInputs *inputs)
+{
+	CBlockFile recording;
+	if (OKAY != recording.Load(file))
+		return ErrorLog("Unable to load input recording '%s'.", file.c_str());
+	if (OKAY != recording.FindBlock("Input Recording"))
+		return ErrorLog("'%s' is not an input recording.", file.c_str());
+
+	uint32_t version = 0;
+	recording.Read(&version, sizeof(version));
+	if (version != RECORDING_VERSION)
+		return ErrorLog("'%s' is an input recording of an unsupported version (%u).", file.c_str(), version);
+	uint32_t numInputs = 0;
+	if (!ReadString(&recording, &m_game) ||
+		recording.Read(&m_rtcSeed, sizeof(m_rtcSeed)) != sizeof(m_rtcSeed) ||
+		recording.Read(&numInputs, sizeof(numInputs)) != sizeof(numInputs))
+		return ErrorLog("Input recording '%s' is corrupt.", file.c_str());
+
+	// Match the inputs recorded by ID, which must have the same number of values
+	m_inputs.clear();
+	m_valuesPerFrame = 0;
+	for (uint32_t i = 0; i < numInputs; i++)
+	{
+		std::string id;
+		uint32_t numValues = 0;
+		if (!ReadString(&recording, &id) || recording.Read(&numValues, sizeof(numValues)) != sizeof(numValues))
+			return ErrorLog("Input recording '%s' is corrupt.", file.c_str());
+		CInput *input = (*inputs)[id.c_str()];
+		if (input == NULL || input->IsUIInput() || NumValues(input) != numValues)
+			return ErrorLog("Input recording '%s' has an unknown input: %s.", file.c_str(), id.c_str());
+		m_inputs.push_back(input);
+		m_valuesPerFrame += numValues;
+	}
+
+	if (recording.Read(&m_numFrames, sizeof(m_numFrames)) != sizeof(m_numFrames))
+		return ErrorLog("Input recording '%s' is corrupt.", file.c_str());
+	m_values.resize(size_t(m_numFrames) * m_valuesPerFrame);
+	uint32_t valueBytes = uint32_t(m_values.size() * sizeof(UINT16));
+	if (recording.Read(m_values.data(), valueBytes) != valueBytes)
+		return ErrorLog("Input recording '%s' is corrupt.", file.c_str());
+
+	uint32_t stateSize = 0;
+	if (OKAY != recording.FindBlock("Start State") || recording.Read(&stateSize, sizeof(stateSize)) != sizeof(stateSize))
+		return ErrorLog("Input recording '%s' has no start state.", file.c_str());
+	m_state.resize(stateSize);
+	if (recording.Read(m_state.data(), stateSize) != stateSize)
+		return ErrorLog("Input recording '%s' is corrupt.", file.c_str());
+
+	m_frame = 0;
+	return OKAY;
+}
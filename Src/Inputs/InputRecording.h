@@ -0,0 +1,154 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * InputRecording.h
+ *
+ * Header file for CInputRecording, a recording of the game inputs of every
+ * frame, for replaying a run exactly.
+ */
+
+#ifndef INCLUDED_INPUTRECORDING_H
+#define INCLUDED_INPUTRECORDING_H
+
+#include "Types.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class CInputs;
+class CInput;
+struct Game;
+
+/*
+ * CInputRecording:
+ *
+ * Values of the inputs used by a game, for each frame emulated from a
+ * starting save state, along with the seed of the real-time clock. Replaying
+ * them from the same state sets the inputs in place of polling the input
+ * system, so that the same frames are emulated again. UI inputs are neither
+ * recorded nor replayed.
+ */
+class CInputRecording
+{
+public:
+	/*
+	 * Start(inputs, game, rtcSeed, state):
+	 *
+	 * Starts a new recording.
+	 *
+	 * Parameters:
+	 *		inputs	Inputs to record.
+	 *		game	Game being recorded.
+	 *		rtcSeed	Time the real-time clock was fixed to start from.
+	 *		state	Save state written to memory that the recording starts
+	 *				from. The recording takes over its contents.
+	 */
+	void Start(CInputs *inputs, const Game &game, int64_t rtcSeed, std::vector<uint8_t> *state);
+
+	/*
+	 * RecordFrame(void):
+	 *
+	 * Records the current input values, as those of the next frame.
+	 */
+	void RecordFrame(void);
+
+	/*
+	 * Save(file, level):
+	 *
+	 * Writes the recording to a file.
+	 *
+	 * Parameters:
+	 *		file	File path.
+	 *		level	zlib compression level (see CBlockFile::Save()).
+	 *
+	 * Returns:
+	 *		OKAY if successful, otherwise FAIL. Prints errors.
+	 */
+	bool Save(const std::string &file, int level) const;
+
+	/*
+	 * Load(file, inputs):
+	 *
+	 * Reads a recording to replay.
+	 *
+	 * Parameters:
+	 *		file	File path.
+	 *		inputs	Inputs to replay the recording into. Each input recorded
+	 *				must exist.
+	 *
+	 * Returns:
+	 *		OKAY if successful, otherwise FAIL. Prints errors.
+	 */
+	bool Load(const std::string &file, CInputs *inputs);
+
+	/*
+	 * ReplayFrame(void):
+	 *
+	 * Sets the inputs to their values for the next frame, as if they had
+	 * been polled.
+	 *
+	 * Returns:
+	 *		True if set, false if all frames have been replayed.
+	 */
+	bool ReplayFrame(void);
+
+	const std::string &GetGameName(void) const
+	{
+		return m_game;
+	}
+
+	int64_t GetRTCSeed(void) const
+	{
+		return m_rtcSeed;
+	}
+
+	// Save state written to memory that the recording starts from
+	const std::vector<uint8_t> &GetState(void) const
+	{
+		return m_state;
+	}
+
+	unsigned GetNumFrames(void) const
+	{
+		return m_numFrames;
+	}
+
+	// Frames replayed so far
+	unsigned GetFrame(void) const
+	{
+		return m_frame;
+	}
+
+private:
+	static unsigned NumValues(CInput *input);
+
+	std::vector<CInput *>	m_inputs;		// inputs recorded, in recording order
+	std::vector<UINT16>		m_values;		// values of each frame, in input order
+	unsigned				m_valuesPerFrame = 0;
+	unsigned				m_numFrames = 0;
+	unsigned				m_frame = 0;	// next frame to replay
+	std::string				m_game;
+	int64_t					m_rtcSeed = 0;
+	std::vector<uint8_t>	m_state;
+};
+
+#endif	// INCLUDED_INPUTRECORDING_H
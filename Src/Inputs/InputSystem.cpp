@@ -417,7 +417,9 @@ const char *CInputSystem::GetDefaultAxisName(int axisNum)
 }
 
 CInputSystem::CInputSystem(const char *systemName)
-  : m_dispX(0),
+  : m_ffQuit(false),
+    m_ffDropped(0),
+    m_dispX(0),
     m_dispY(0),
     m_dispW(0),
     m_dispH(0),
@@ -430,6 +432,7 @@ CInputSystem::CInputSystem(const char *systemName)
 
 CInputSystem::~CInputSystem()
 {
+  StopForceFeedback();
   m_emptySource->Release();
 
   ClearSettings();
@@ -1833,7 +1836,65 @@ bool CInputSystem::SendForceFeedbackCmd(int joyNum, int axisNum, ForceFeedbackCm
   const JoyDetails *joyDetails = GetJoyDetails(joyNum);
   if (!joyDetails->hasFFeedback || !joyDetails->axisHasFF[axisNum])
     return false;
-  return ProcessForceFeedbackCmd(joyNum, axisNum, ffCmd);
+
+  std::unique_lock<std::mutex> lock(m_ffLock);
+  if (m_ffQuit)
+    return false;
+  if (!m_ffThread.joinable())
+    m_ffThread = std::thread(&CInputSystem::ForceFeedbackThread, this);
+
+  // Replace the latest command queued for the axis if it is for the same
+  // effect, looking no further back than a command for another effect or a
+  // stop, which must still come between them
+  for (auto it = m_ffQueue.rbegin(); it != m_ffQueue.rend(); ++it)
+  {
+    if (it->joyNum != joyNum || (it->axisNum != axisNum && it->ffCmd.id != FFStop))
+      continue;
+    if (it->axisNum == axisNum && it->ffCmd.id == ffCmd.id && ffCmd.id != FFStop)
+    {
+      it->ffCmd = ffCmd;
+      return true;
+    }
+    break;
+  }
+
+  if (m_ffQueue.size() >= FF_QUEUE_SIZE)
+  {
+    m_ffQueue.pop_front();
+    if (m_ffDropped++ == 0)
+      DebugLog("Force feedback queue is full: dropping the oldest commands.\n");
+  }
+  m_ffQueue.push_back({ joyNum, axisNum, ffCmd });
+  lock.unlock();
+  m_ffWake.notify_one();
+  return true;
+}
+
+void CInputSystem::ForceFeedbackThread()
+{
+  std::unique_lock<std::mutex> lock(m_ffLock);
+  while (true)
+  {
+    m_ffWake.wait(lock, [this] { return m_ffQuit || !m_ffQueue.empty(); });
+    if (m_ffQueue.empty())
+      break;
+    QueuedFFCmd cmd = m_ffQueue.front();
+    m_ffQueue.pop_front();
+    lock.unlock();
+    ProcessForceFeedbackCmd(cmd.joyNum, cmd.axisNum, cmd.ffCmd);
+    lock.lock();
+  }
+}
+
+void CInputSystem::StopForceFeedback()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_ffLock);
+    m_ffQuit = true;
+  }
+  m_ffWake.notify_one();
+  if (m_ffThread.joinable())
+    m_ffThread.join();
 }
 
 bool CInputSystem::DetectJoystickAxis(unsigned joyNum, unsigned &axisNum, const char *escapeMapping, const char *confirmMapping)
@@ -2280,7 +2341,12 @@ bool CInputSystem::CKeyInputSource::GetValueAsSwitch(bool &val)
 
 bool CInputSystem::CKeyInputSource::GetValueAsAnalog(int &val, int minVal, int offVal, int maxVal)
 {
-  if (m_system->IsKeyPressed(m_kbdNum, m_keyIndex))
+  return AnalogValue(m_system->IsKeyPressed(m_kbdNum, m_keyIndex), val, minVal, offVal, maxVal);
+}
+
+bool CInputSystem::CKeyInputSource::AnalogValue(bool pressed, int &val, int minVal, int offVal, int maxVal)
+{
+  if (pressed)
     m_val = min<int>(m_maxVal, m_val + m_incr);
   else
     m_val = max<int>(0, m_val - m_decr);
@@ -2307,9 +2373,8 @@ CInputSystem::CMseAxisInputSource::CMseAxisInputSource(CInputSystem *system, int
     m_deadPixels = Clamp((int)deadZone, 0, 99);
 }
 
-int CInputSystem::CMseAxisInputSource::ScaleAxisValue(int minVal, int offVal, int maxVal)
+int CInputSystem::CMseAxisInputSource::ScaleAxisValue(int mseVal, int minVal, int offVal, int maxVal)
 {
-  int mseVal = m_system->GetMouseAxisValue(m_mseNum, m_axisNum);
   // If X- or Y-axis then convert to value centered around zero (ie relative to centre of display)
   int mseMin, mseMax;
   if (m_axisNum == AXIS_X || m_axisNum == AXIS_Y)
@@ -2348,28 +2413,32 @@ int CInputSystem::CMseAxisInputSource::ScaleAxisValue(int minVal, int offVal, in
   }
 }
 
-bool CInputSystem::CMseAxisInputSource::GetValueAsSwitch(bool &val)
+bool CInputSystem::CMseAxisInputSource::SwitchValue(int mseVal, int wheelDir)
 {
   // For Z-axis (wheel), switch value is handled slightly differently
   if (m_axisNum == AXIS_Z)
-  {
-    int wheelDir = m_system->GetMouseWheelDir(m_mseNum);
-    if (((m_axisDir == AXIS_POS || m_axisDir == AXIS_FULL)     && wheelDir <= 0) ||
-        ((m_axisDir == AXIS_NEG || m_axisDir == AXIS_INVERTED) && wheelDir >= 0))
-      return false;
-  }
+    return !(((m_axisDir == AXIS_POS || m_axisDir == AXIS_FULL)     && wheelDir <= 0) ||
+             ((m_axisDir == AXIS_NEG || m_axisDir == AXIS_INVERTED) && wheelDir >= 0));
   else
-  {
-    if (ScaleAxisValue(0, 0, 3) < 2)
-      return false;
-  }
+    return ScaleAxisValue(mseVal, 0, 0, 3) >= 2;
+}
+
+bool CInputSystem::CMseAxisInputSource::GetValueAsSwitch(bool &val)
+{
+  bool active;
+  if (m_axisNum == AXIS_Z)
+    active = SwitchValue(0, m_system->GetMouseWheelDir(m_mseNum));
+  else
+    active = SwitchValue(m_system->GetMouseAxisValue(m_mseNum, m_axisNum), 0);
+  if (!active)
+    return false;
   val = true;
   return true;
 }
 
 bool CInputSystem::CMseAxisInputSource::GetValueAsAnalog(int &val, int minVal, int offVal, int maxVal)
 {
-  int axisVal = ScaleAxisValue(minVal, offVal, maxVal);
+  int axisVal = ScaleAxisValue(m_system->GetMouseAxisValue(m_mseNum, m_axisNum), minVal, offVal, maxVal);
   if (axisVal == offVal)
     return false;
   val = axisVal;
@@ -2420,10 +2489,8 @@ CInputSystem::CJoyAxisInputSource::CJoyAxisInputSource(CInputSystem *system, int
   m_negSat = m_axisOffVal + (int)(dSaturation * (m_axisMinVal - m_axisOffVal));
 }
 
-int CInputSystem::CJoyAxisInputSource::ScaleAxisValue(int minVal, int offVal, int maxVal)
+int CInputSystem::CJoyAxisInputSource::ScaleAxisValue(int joyVal, int minVal, int offVal, int maxVal)
 {
-  // Get raw axis value from input system
-  int joyVal = m_system->GetJoyAxisValue(m_joyNum, m_axisNum);
   // Check if value is at axis off value
   if (joyVal == m_axisOffVal)
     return offVal;
@@ -2450,7 +2517,7 @@ int CInputSystem::CJoyAxisInputSource::ScaleAxisValue(int minVal, int offVal, in
 
 bool CInputSystem::CJoyAxisInputSource::GetValueAsSwitch(bool &val)
 {
-  if (ScaleAxisValue(0, 0, 3) < 2)
+  if (ScaleAxisValue(m_system->GetJoyAxisValue(m_joyNum, m_axisNum), 0, 0, 3) < 2)
     return false;
   val = true;
   return true;
@@ -2458,7 +2525,8 @@ bool CInputSystem::CJoyAxisInputSource::GetValueAsSwitch(bool &val)
 
 bool CInputSystem::CJoyAxisInputSource::GetValueAsAnalog(int &val, int minVal, int offVal, int maxVal)
 {
-  int axisVal = ScaleAxisValue(minVal, offVal, maxVal);
+  // Get raw axis value from input system
+  int axisVal = ScaleAxisValue(m_system->GetJoyAxisValue(m_joyNum, m_axisNum), minVal, offVal, maxVal);
   if (axisVal == offVal)
     return false;
   val = axisVal;
@@ -29,9 +29,14 @@
 #ifndef INCLUDED_INPUTSYSTEM_H
 #define INCLUDED_INPUTSYSTEM_H
 
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include "Input.h"
 #include "MultiInputSource.h"
 #include "Util/NewConfig.h"
 
@@ -320,6 +325,8 @@ struct JoyDetails
  */
 class CInputSystem
 { 
+  friend class CInputProgram;
+
 private:
   // Array of valid key names
   static const char *s_validKeyNames[];
@@ -360,10 +367,31 @@ private:
   // Empty input source
   CMultiInputSource *m_emptySource;
 
+  // Force feedback commands waiting for the force feedback thread, at most
+  // FF_QUEUE_SIZE of them, the oldest dropped when full
+  struct QueuedFFCmd
+  {
+    int joyNum;
+    int axisNum;
+    ForceFeedbackCmd ffCmd;
+  };
+  static const size_t FF_QUEUE_SIZE = 64;
+  std::deque<QueuedFFCmd> m_ffQueue;
+  std::thread m_ffThread;
+  std::mutex m_ffLock;
+  std::condition_variable m_ffWake;
+  bool m_ffQuit;
+  unsigned m_ffDropped;
+
   //
   // Helper methods
   //
 
+  /*
+   * Processes the queued force feedback commands until told to stop.
+   */
+  void ForceFeedbackThread();
+
   /*
    * Creates source cache.
    */
@@ -727,6 +755,12 @@ protected:
    */
   virtual CInputSource *CreateJoySource(int joyNum, EJoyPart joyPart);
 
+  /*
+   * Stops the force feedback thread once it has processed the commands still queued. Subclasses must call this in their destructors,
+   * before closing the joysticks, as the thread calls ProcessForceFeedbackCmd().
+   */
+  void StopForceFeedback();
+
 public:
 #ifdef DEBUG
   static unsigned totalSrcsAcquired;
@@ -850,6 +884,11 @@ public:
    */
   virtual void SetMouseVisibility(bool visible) = 0;
 
+  /*
+   * Queues the given force feedback command for the given joystick and axis number, to be processed by a thread of its own so that
+   * slow devices do not hold up the emulation. A command for an axis replaces one queued before it with the same effect that has not
+   * been processed yet, so only the latest force is applied. Returns false if the joystick axis has no force feedback.
+   */
   virtual bool SendForceFeedbackCmd(int joyNum, int axisNum, ForceFeedbackCmd ffCmd);
 
   bool DetectJoystickAxis(unsigned joyNum, unsigned &axisNum, const char *escapeMapping = "KEY_ESCAPE", const char *confirmMapping = "KEY_RETURN");
@@ -876,6 +915,13 @@ public:
     int m_val;              // Current analog key value
     int m_maxVal;           // Maximum analog key value
 
+    friend class CInputProgram;
+
+    /*
+     * Updates the analog key value, whether the key is pressed or not.
+     */
+    bool AnalogValue(bool pressed, int &val, int minVal, int offVal, int maxVal);
+
   public:
     CKeyInputSource(CInputSystem *system, int kbdNum, int keyIndex, unsigned sensitivity, unsigned decaySpeed);
 
@@ -896,10 +942,18 @@ public:
     int m_axisDir;          // Axis direction (AXIS_FULL, AXIS_INVERTED, AXIS_POSITIVE or AXIS_NEGATIVE)
     int m_deadPixels;       // Size in pixels of dead zone in centre of axis
 
+    friend class CInputProgram;
+
     /*
      * Scales the mouse axis value to the given range.
      */
-    int ScaleAxisValue(int minVal, int offVal, int maxVal);
+    int ScaleAxisValue(int mseVal, int minVal, int offVal, int maxVal);
+
+    /*
+     * Returns the switch value, from the axis value or, for the Z-axis, the
+     * wheel direction.
+     */
+    bool SwitchValue(int mseVal, int wheelDir);
 
   public:
     CMseAxisInputSource(CInputSystem *system, int mseNum, int axisNum, int axisDir, unsigned deadZone);
@@ -919,6 +973,8 @@ public:
     int m_mseNum;           // Mouse number 
     int m_butNum;           // Button number
 
+    friend class CInputProgram;
+
   public:
     CMseButInputSource(CInputSystem *system, int mseNum, int butNum);
 
@@ -946,10 +1002,12 @@ public:
     int m_posSat;           // Saturation for positive range (1-100%)
     int m_negSat;           // Saturation for negative range (1-100%)
 
+    friend class CInputProgram;
+
     /*
-     * Scales the joystick axis value to the given range.
+     * Scales the raw joystick axis value to the given range.
      */
-    int ScaleAxisValue(int minVal, int offVal, int maxVal);
+    int ScaleAxisValue(int joyVal, int minVal, int offVal, int maxVal);
 
   public:
     CJoyAxisInputSource(CInputSystem *system, int joyNum, int axisNum, int axisDir, int axisMinVal, int axisOffVal, int axisMaxVal,
@@ -973,6 +1031,8 @@ public:
     int m_povNum;           // POV hat number
     int m_povDir;           // POV hat direction (POV_UP, POV_LEFT, POV_RIGHT, POV_DOWN)
 
+    friend class CInputProgram;
+
   public:
     CJoyPOVInputSource(CInputSystem *system, int joyNum, int povNum, int povDir);
 
@@ -991,6 +1051,8 @@ public:
     int m_joyNum;           // Joystick number
     int m_butNum;           // Button number
 
+    friend class CInputProgram;
+
   public:
     CJoyButInputSource(CInputSystem *system, int joyNum, int butNum);
 
@@ -107,28 +107,34 @@ CAxisInput::CAxisInput(const char *inputId, const char *inputLabel, unsigned inp
 	//
 }
 
+bool CAxisInput::PollRangeInputs()
+{
+	if ((m_negInput == NULL || !m_negInput->HasValue()) && (m_posInput == NULL || !m_posInput->HasValue()))
+		return false;
+	if (m_maxVal > m_minVal)
+	{
+		value = m_offVal;
+		if (m_posInput != NULL) value += (int)(m_posInput->ValueAsFraction() * (double)(m_maxVal - m_offVal));
+		if (m_negInput != NULL) value -= (int)(m_negInput->ValueAsFraction() * (double)(m_offVal - m_minVal));
+	}
+	else
+	{ 
+		value = m_offVal;
+		if (m_posInput != NULL) value -= (int)(m_posInput->ValueAsFraction() * (double)(m_offVal - m_maxVal));
+		if (m_negInput != NULL) value += (int)(m_negInput->ValueAsFraction() * (double)(m_minVal - m_offVal));
+	}
+	return true;
+}
+
 void CAxisInput::Poll()
 {
 	prevValue = value;
 
 	// Try getting value from analog inputs that represent negative and positive range of the axis first and then try the default input source
+	if (PollRangeInputs())
+		return;
 	int intValue = value;
-	if ((m_negInput != NULL && m_negInput->HasValue()) || (m_posInput != NULL && m_posInput->HasValue()))
-	{
-		if (m_maxVal > m_minVal)
-		{
-			value = m_offVal;
-			if (m_posInput != NULL) value += (int)(m_posInput->ValueAsFraction() * (double)(m_maxVal - m_offVal));
-			if (m_negInput != NULL) value -= (int)(m_negInput->ValueAsFraction() * (double)(m_offVal - m_minVal));
-		}
-		else
-		{ 
-			value = m_offVal;
-			if (m_posInput != NULL) value -= (int)(m_posInput->ValueAsFraction() * (double)(m_offVal - m_maxVal));
-			if (m_negInput != NULL) value += (int)(m_negInput->ValueAsFraction() * (double)(m_minVal - m_offVal));
-		}
-	}
-	else if (m_source != NULL && m_source->GetValueAsAnalog(intValue, m_minVal, m_offVal, m_maxVal))
+	if (m_source != NULL && m_source->GetValueAsAnalog(intValue, m_minVal, m_offVal, m_maxVal))
 		value = intValue;
 	else 
 		value = m_offVal;
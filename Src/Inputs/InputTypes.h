@@ -16,6 +16,8 @@ private:
 	UINT16 m_offVal;
 	UINT16 m_onVal;
 
+	friend class CInputProgram;
+
 public:
 	CSwitchInput(const char *inputId, const char *inputLabel, unsigned inputGameFlags, const char *defaultMapping, 
 		UINT16 offVal = 0x00, UINT16 onVal = 0x01);
@@ -46,6 +48,8 @@ private:
 	UINT16 m_minVal;
 	UINT16 m_maxVal;
 
+	friend class CInputProgram;
+
 public:
 	CAnalogInput(const char *inputId, const char *inputLabel, unsigned inputGameFlags, const char *defaultMapping, 
 		UINT16 minVal = 0x00, UINT16 maxVal = 0xFF);
@@ -82,6 +86,14 @@ private:
 	UINT16 m_minVal;
 	UINT16 m_offVal;
 	UINT16 m_maxVal;
+
+	friend class CInputProgram;
+	friend class CInputs;
+
+	/*
+	 * Sets the value from the analog inputs for the negative and positive ranges, returning false if neither is activated
+	 */
+	bool PollRangeInputs();
 	
 public:
 	CAxisInput(const char *inputId, const char *inputLabel, unsigned inputGameFlags, const char *defaultMapping, CAnalogInput *negInput, CAnalogInput *posInput,
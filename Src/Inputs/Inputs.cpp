@@ -33,7 +33,9 @@
 #include "InputSystem.h"
 #include "InputTypes.h"
 #include "Game.h"
+#include "OSD/Thread.h"
 #include <stdarg.h>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -53,6 +55,8 @@ CInputs::CInputs(CInputSystem *system)
 	uiSaveState        = AddSwitchInput("UISaveState",        "Save State",            Game::INPUT_UI, "KEY_F5");
 	uiChangeSlot       = AddSwitchInput("UIChangeSlot",       "Change Save Slot",      Game::INPUT_UI, "KEY_F6");
 	uiLoadState        = AddSwitchInput("UILoadState",        "Load State",            Game::INPUT_UI, "KEY_F7");
+	uiRewind           = AddSwitchInput("UIRewind",           "Rewind",                Game::INPUT_UI, "KEY_BACKSPACE");
+	uiFastForward      = AddSwitchInput("UIFastForward",      "Fast Forward",          Game::INPUT_UI, "KEY_BACKQUOTE");
 	uiMusicVolUp	     = AddSwitchInput("UIMusicVolUp",		    "Increase Music Volume", Game::INPUT_UI, "KEY_F10");
 	uiMusicVolDown	   = AddSwitchInput("UIMusicVolDown",	    "Decrease Music Volume", Game::INPUT_UI, "KEY_F9");
 	uiSoundVolUp	     = AddSwitchInput("UISoundVolUp",		    "Increase Sound Volume", Game::INPUT_UI, "KEY_F12");
@@ -62,10 +66,14 @@ CInputs::CInputs(CInputSystem *system)
 	uiToggleFrLimit    = AddSwitchInput("UIToggleFrameLimit", "Toggle Frame Limiting", Game::INPUT_UI, "KEY_ALT+KEY_T");
 	uiDumpInpState     = AddSwitchInput("UIDumpInputState",   "Dump Input State",      Game::INPUT_UI, "KEY_ALT+KEY_U");
 	uiDumpTimings      = AddSwitchInput("UIDumpTimings",      "Dump Frame Timings",    Game::INPUT_UI, "KEY_ALT+KEY_O");
+	uiDumpTrace        = AddSwitchInput("UIDumpTrace",        "Dump Trace",            Game::INPUT_UI, "KEY_ALT+KEY_E");
 	uiScreenshot       = AddSwitchInput("UIScreenShot",	      "Screenshot",            Game::INPUT_UI, "KEY_ALT+KEY_S");
 #ifdef SUPERMODEL_DEBUGGER
 	uiEnterDebugger    = AddSwitchInput("UIEnterDebugger",    "Enter Debugger",        Game::INPUT_UI, "KEY_ALT+KEY_B");
 #endif
+#ifdef PPC_PROFILE
+	uiDumpPPCProfile   = AddSwitchInput("UIDumpPPCProfile",   "Dump PowerPC Profile",  Game::INPUT_UI, "KEY_ALT+KEY_H");
+#endif
 
 	// Common Controls
 	start[0]           = AddSwitchInput("Start1",   "P1 Start",  Game::INPUT_COMMON, "NONE");
@@ -278,6 +286,8 @@ CInputs::CInputs(CInputSystem *system)
 
 CInputs::~CInputs()
 {
+	m_uiProgram.Clear();
+	m_gameProgram.Clear();
 	for (vector<CInput*>::iterator it = m_inputs.begin(); it != m_inputs.end(); ++it)
 		delete *it;
 	m_inputs.clear();
@@ -743,20 +753,111 @@ bool CInputs::Poll(const Game *game, unsigned dispX, unsigned dispY, unsigned di
 	// Update the input system with the current display geometry
 	m_system->SetDisplayGeom(dispX, dispY, dispW, dispH);
 
-	// Poll the input system
-	if (!m_system->Poll())
+	// Poll the input system, reporting a request to quit seen by Latch() since
+	bool quit = m_quitLatched;
+	m_quitLatched = false;
+	if (!m_system->Poll() || quit)
 		return false;
 
-	// Poll all UI inputs and all the inputs used by the current game, or all inputs if game is NULL
+	// Poll all UI inputs and all the inputs used by the current game, or all inputs if game is NULL,
+	// compiling them again when the game changes or any is mapped again
 	uint32_t gameFlags = game ? game->inputs : Game::INPUT_ALL;
-	for (vector<CInput*>::iterator it = m_inputs.begin(); it != m_inputs.end(); ++it)
+	if (!m_programCompiled || gameFlags != m_programGameFlags || !m_uiProgram.IsCurrent() || !m_gameProgram.IsCurrent())
 	{
-		if ((*it)->IsUIInput() || ((*it)->gameFlags & gameFlags))
-			(*it)->Poll();
+		vector<CInput*> uiInputs;
+		vector<CInput*> gameInputs;
+		for (vector<CInput*>::iterator it = m_inputs.begin(); it != m_inputs.end(); ++it)
+		{
+			if ((*it)->IsUIInput())
+				uiInputs.push_back(*it);
+			else if ((*it)->gameFlags & gameFlags)
+				gameInputs.push_back(*it);
+		}
+		m_uiProgram.Compile(m_system, uiInputs);
+		m_gameProgram.Compile(m_system, gameInputs);
+		m_programCompiled = true;
+		m_programGameFlags = gameFlags;
+
+		// Keep a history of the axes aimed with, whose polls GetValueAt() interpolates between
+		std::lock_guard<std::mutex> lock(m_axisHistoryLock);
+		m_axisHistory.clear();
+		const CAxisInput *axes[] = { gunX[0], gunY[0], gunX[1], gunY[1], analogGunX[0], analogGunY[0], analogGunX[1], analogGunY[1], analogJoyX, analogJoyY };
+		for (const CAxisInput *axis : axes)
+		{
+			if (axis->gameFlags & gameFlags)
+			{
+				AxisHistory history = {};
+				history.input = axis;
+				m_axisHistory.push_back(history);
+			}
+		}
+		DebugLog("Compiled %u inputs into %u operations reading %u controls.\n", unsigned(uiInputs.size() + gameInputs.size()),
+			m_uiProgram.NumOps() + m_gameProgram.NumOps(), m_uiProgram.NumReads() + m_gameProgram.NumReads());
 	}
+	m_uiProgram.Poll();
+	m_gameProgram.Poll();
+	m_pollMicros = CThread::GetMicroseconds();
+	RecordAxisHistory();
 	return true;
 }
 
+void CInputs::Latch()
+{
+	if (!m_programCompiled)
+		return;
+	if (!m_system->Poll())
+		m_quitLatched = true;
+	m_gameProgram.Poll();
+	m_pollMicros = CThread::GetMicroseconds();
+	RecordAxisHistory();
+}
+
+void CInputs::RecordAxisHistory()
+{
+	std::lock_guard<std::mutex> lock(m_axisHistoryLock);
+	for (AxisHistory &history : m_axisHistory)
+	{
+		history.head = (history.head + 1) % AXIS_HISTORY_SIZE;
+		history.micros[history.head] = m_pollMicros;
+		history.values[history.head] = history.input->value;
+		history.count = std::min(history.count + 1, AXIS_HISTORY_SIZE);
+	}
+}
+
+UINT16 CInputs::GetValueAt(const CAxisInput *input, UINT64 micros) const
+{
+	std::lock_guard<std::mutex> lock(m_axisHistoryLock);
+	for (const AxisHistory &history : m_axisHistory)
+	{
+		if (history.input != input)
+			continue;
+		if (history.count < 2)
+			break;
+
+		// Find the polls either side of the time, or the last two if it is after them both
+		unsigned newer = history.head;
+		unsigned older = (newer + AXIS_HISTORY_SIZE - 1) % AXIS_HISTORY_SIZE;
+		for (unsigned i = 2; i < history.count && micros < history.micros[older]; i++)
+		{
+			newer = older;
+			older = (older + AXIS_HISTORY_SIZE - 1) % AXIS_HISTORY_SIZE;
+		}
+		if (micros <= history.micros[older])
+			return history.values[older];
+		UINT64 interval = history.micros[newer] - history.micros[older];
+		if (interval == 0)
+			break;
+
+		// Extrapolate no further ahead than the interval the motion was measured over, and never past the axis's range
+		double t = std::min(double(micros - history.micros[older]) / double(interval), 2.0);
+		double value = history.values[older] + t * (double(history.values[newer]) - double(history.values[older]));
+		double lo = std::min(input->m_minVal, input->m_maxVal);
+		double hi = std::max(input->m_minVal, input->m_maxVal);
+		return UINT16(std::max(lo, std::min(hi, value)) + 0.5);
+	}
+	return input->value;
+}
+
 void CInputs::DumpState(const Game *game)
 {
 	// Print header
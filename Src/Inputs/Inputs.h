@@ -29,8 +29,10 @@
 #define INCLUDED_INPUTS_H
 
 #include "InputTypes.h"
+#include "InputProgram.h"
 #include "Types.h"
 #include "Util/NewConfig.h"
+#include <mutex>
 #include <vector>
 
 class CInputSystem;
@@ -49,6 +51,39 @@ private:
   // Vector of all created inputs
   std::vector<CInput*> m_inputs;
 
+  // Inputs polled for the current game, compiled (see InputProgram.h), the
+  // UI inputs apart from those of the game so that Latch() can poll the game's
+  // alone
+  CInputProgram m_uiProgram;
+  CInputProgram m_gameProgram;
+  bool m_programCompiled = false;
+  uint32_t m_programGameFlags = 0;
+
+  // Time the game's inputs were last polled (microseconds) and whether Latch()
+  // saw the input system ask to quit, which the next Poll() reports
+  UINT64 m_pollMicros = 0;
+  bool m_quitLatched = false;
+
+  // Values of the game's gun and analog axes at the last few polls, so that
+  // GetValueAt() can estimate them between and just after polls. The PowerPC
+  // may read them on another thread, hence the lock
+  static const unsigned AXIS_HISTORY_SIZE = 4;
+  struct AxisHistory
+  {
+    const CAxisInput *input;
+    UINT64 micros[AXIS_HISTORY_SIZE];
+    UINT16 values[AXIS_HISTORY_SIZE];
+    unsigned count;
+    unsigned head;  // index of the newest sample
+  };
+  std::vector<AxisHistory> m_axisHistory;
+  mutable std::mutex m_axisHistoryLock;
+
+  /*
+   * Records the current values of the axes in m_axisHistory, polled at m_pollMicros.
+   */
+  void RecordAxisHistory();
+
   /*
    * Adds a switch input (eg button) to this collection.
    */ 
@@ -92,6 +127,8 @@ public:
   CSwitchInput  *uiSaveState;
   CSwitchInput  *uiChangeSlot;
   CSwitchInput  *uiLoadState;
+  CSwitchInput  *uiRewind;
+  CSwitchInput  *uiFastForward;
   CSwitchInput  *uiMusicVolUp;
   CSwitchInput  *uiMusicVolDown;
   CSwitchInput  *uiSoundVolUp;
@@ -101,10 +138,14 @@ public:
   CSwitchInput  *uiToggleFrLimit;
   CSwitchInput  *uiDumpInpState;
   CSwitchInput  *uiDumpTimings;
+  CSwitchInput  *uiDumpTrace;
   CSwitchInput  *uiScreenshot;
 #ifdef SUPERMODEL_DEBUGGER
   CSwitchInput  *uiEnterDebugger;
 #endif
+#ifdef PPC_PROFILE
+  CSwitchInput  *uiDumpPPCProfile;
+#endif
 
   // Common controls between all games
   CSwitchInput  *coin[2];
@@ -299,6 +340,28 @@ public:
    */
   bool Poll(const Game *game, unsigned dispX, unsigned dispY, unsigned dispW, unsigned dispH);
 
+  /*
+   * Polls the input system again and updates the inputs of the game last polled, leaving the UI inputs as they were, so that the game
+   * reads values sampled just before instead of at the start of the frame. Does nothing until Poll() has been called. Must be called
+   * from the thread that polls.
+   */
+  void Latch();
+
+  /*
+   * Returns the time, in microseconds (see CThread::GetMicroseconds()), at which the game's inputs were last polled or latched.
+   */
+  UINT64 GetPollMicros() const
+  {
+    return m_pollMicros;
+  }
+
+  /*
+   * Returns the value of a gun or analog axis of the game last polled estimated at the given time (see CThread::GetMicroseconds()),
+   * interpolated between the polls around it or extrapolated from the last two, by up to the interval between them, if it is later.
+   * Returns the current value of any other input or where there are too few polls to go on.
+   */
+  UINT16 GetValueAt(const CAxisInput *input, UINT64 micros) const;
+
   /*
    * Prints the current values of the inputs for the given game, or all inputs if game is NULL, to stdout for debugging purposes.
    */
@@ -51,6 +51,8 @@ private:
 	// Array of the input sources
 	CInputSource **m_srcArray;
 
+	friend class CInputProgram;
+
 public:
 	/*
 	 * Returns the combined source type of the given vector of sources.
@@ -94,6 +96,8 @@ private:
 	// Input source being negated
 	CInputSource *m_source;
 
+	friend class CInputProgram;
+
 public:
 	CNegInputSource(CInputSource *source);
 
@@ -129,12 +129,20 @@ static bool SCRIPTS_MoveMemory(struct NCR53C810Context *Ctx)
   DebugLog("53C810: Move Memory %08X -> %08X, %X\n", src, dest, numBytes);
   //if (dest==0x94000000)printf("53C810: Move Memory %08X -> %08X, %X\n", src, dest, numBytes);
 
-  // Perform a 32-bit copy if possible
-  for (i = 0; i < (numBytes/4); i++)
+  // Perform a 32-bit copy if possible, as a single block if the bus can
+  if (Ctx->Bus->CopyBlock32(dest, src, numBytes/4))
   {
-    Ctx->Bus->Write32(dest, Ctx->Bus->Read32(src));
-    dest += 4;
-    src += 4;
+    dest += numBytes & ~3;
+    src += numBytes & ~3;
+  }
+  else
+  {
+    for (i = 0; i < (numBytes/4); i++)
+    {
+      Ctx->Bus->Write32(dest, Ctx->Bus->Read32(src));
+      dest += 4;
+      src += 4;
+    }
   }
 
   // Finish off the last few odd bytes
@@ -232,6 +232,11 @@ void C93C46::Clear(void)
 	memset(regs, 0xFF, sizeof(regs));
 }
 
+bool C93C46::HasSameMemory(const C93C46 &other) const
+{
+	return memcmp(regs, other.regs, sizeof(regs)) == 0;
+}
+
 void C93C46::Reset(void)
 {
 	receiving = true;
@@ -65,6 +65,20 @@ public:
 	 * Clears the EEPROM contents by writing all 1's.
 	 */
 	void Clear(void);
+
+	/*
+	 * HasSameMemory(other):
+	 *
+	 * Compares the memory of two EEPROMs, ignoring the state of their serial
+	 * interfaces.
+	 *
+	 * Parameters:
+	 *		other	EEPROM to compare with.
+	 *
+	 * Returns:
+	 *		True if both hold the same data.
+	 */
+	bool HasSameMemory(const C93C46 &other) const;
 	
 	/*
 	 * Write(pinCS, pinCLK, pinDI):
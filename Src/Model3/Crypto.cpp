@@ -92,8 +92,11 @@ enum {
 };
 
 CCrypto::CCrypto()
-  : key(0)
+  : key(0),
+    subkey(0)
 {
+  build_tables();
+  schedule_keys();
 }
 
 void CCrypto::SaveState(CBlockFile *SaveState)
@@ -134,6 +137,7 @@ void CCrypto::LoadState(CBlockFile *SaveState)
 	SaveState->Read(&buffer_pos, sizeof(buffer_pos));
 	SaveState->Read(&line_buffer_pos, sizeof(line_buffer_pos));
 	SaveState->Read(&line_buffer_size, sizeof(line_buffer_size));
+	schedule_keys();
 }
 
 void CCrypto::Init(uint32_t encryptionKey, std::function<uint16_t(uint32_t)> ReadRAMCallback)
@@ -165,6 +169,7 @@ void CCrypto::Init(uint32_t encryptionKey, std::function<uint16_t(uint32_t)> Rea
 */
 
   key = encryptionKey;
+  schedule_keys();
 }
 
 void CCrypto::Reset()
@@ -183,6 +188,7 @@ void CCrypto::Reset()
 	line_buffer_pos = 0;
 	line_buffer_size = 0;
 	buffer_bit = 0;
+	schedule_keys();
 }
 
 UINT16 CCrypto::Decrypt(UINT8 **base)
@@ -232,6 +238,7 @@ void CCrypto::SetSubKey(UINT16 data)
 {
 	subkey = data;
 	enc_ready = false;
+	schedule_keys();
 }
 
 /***************************************************************************
@@ -781,6 +788,119 @@ UINT16 CCrypto::block_decrypt(UINT32 game_key, UINT16 sequence_key, UINT16 count
 	return aux;
 }
 
+/*
+ * The same as block_decrypt(), with the parts that depend only on the sboxes
+ * and scheduling, or on the game and sequence keys, done beforehand. What is
+ * left of the first network is a lookup per round. The second network depends
+ * on its middle result, so only its sbox bit gathering and scattering and the
+ * middle result scheduling are tabulated.
+ */
+void CCrypto::build_tables()
+{
+	for (int n = 0; n < 2; ++n) {
+		for (int r = 0; r < 4; ++r) {
+			for (int m = 0; m < 4; ++m) {
+				const sbox &s = n == 0 ? fn1_sboxes[r][m] : fn2_sboxes[r][m];
+				for (int input = 0; input < 256; ++input) {
+					int aux = 0;
+					for (int k = 0; k < 6; ++k)
+						if (s.inputs[k] != -1)
+							aux |= BIT(input, s.inputs[k]) << k;
+					sbox_inputs[n][r][m][input] = aux;
+				}
+				for (int x = 0; x < 64; ++x) {
+					int aux = s.table[x];
+					sbox_outputs[n][r][m][x] = (BIT(aux, 0) << s.outputs[0]) | (BIT(aux, 1) << s.outputs[1]);
+				}
+			}
+		}
+	}
+
+	memset(fn2_middle_subkeys, 0, sizeof(fn2_middle_subkeys));
+	for (int b = 0; b < 2; ++b) {
+		for (int v = 0; v < 256; ++v) {
+			for (int j = 0; j < 8; ++j) {
+				if (BIT(v, j) != 0) {
+					int aux = fn2_middle_result_scheduling[b * 8 + j] % 24;
+					int aux2 = fn2_middle_result_scheduling[b * 8 + j] / 24;
+					fn2_middle_subkeys[b][v][aux2] ^= (1 << aux);
+				}
+			}
+		}
+	}
+
+	// Bit shuffles are linear, so each is the OR of the shuffled bytes
+	for (int b = 0; b < 2; ++b) {
+		for (int v = 0; v < 256; ++v) {
+			int x = v << (b * 8);
+			counter_swap[b][v] = BITSWAP16(x, 5, 12, 14, 13, 9, 3, 6, 4, 8, 1, 15, 11, 0, 7, 10, 2);
+			data_swap[b][v] = BITSWAP16(x, 14, 3, 8, 12, 13, 7, 15, 4, 6, 2, 9, 5, 11, 0, 1, 10);
+			result_swap[b][v] = BITSWAP16(x, 15, 7, 6, 14, 13, 12, 5, 4, 3, 2, 11, 10, 9, 1, 0, 8);
+		}
+	}
+}
+
+inline int CCrypto::feistel_function_fast(int network, int round, int input, UINT32 subkeys) const
+{
+	return sbox_outputs[network][round][0][(sbox_inputs[network][round][0][input] ^ subkeys) & 0x3f] |
+		sbox_outputs[network][round][1][(sbox_inputs[network][round][1][input] ^ (subkeys >> 6)) & 0x3f] |
+		sbox_outputs[network][round][2][(sbox_inputs[network][round][2][input] ^ (subkeys >> 12)) & 0x3f] |
+		sbox_outputs[network][round][3][(sbox_inputs[network][round][3][input] ^ (subkeys >> 18)) & 0x3f];
+}
+
+void CCrypto::schedule_keys()
+{
+	UINT32 fn1_subkeys[4] = { 0, 0, 0, 0 };
+	memset(fn2_key_subkeys, 0, sizeof(fn2_key_subkeys));
+	for (int j = 0; j < FN1GK; ++j)
+		if (BIT(key, fn1_game_key_scheduling[j][0]) != 0)
+			fn1_subkeys[fn1_game_key_scheduling[j][1] / 24] ^= (1 << (fn1_game_key_scheduling[j][1] % 24));
+	for (int j = 0; j < FN2GK; ++j)
+		if (BIT(key, fn2_game_key_scheduling[j][0]) != 0)
+			fn2_key_subkeys[fn2_game_key_scheduling[j][1] / 24] ^= (1 << (fn2_game_key_scheduling[j][1] % 24));
+	for (int j = 0; j < 20; ++j)
+		if (BIT(subkey, fn1_sequence_key_scheduling[j][0]) != 0)
+			fn1_subkeys[fn1_sequence_key_scheduling[j][1] / 24] ^= (1 << (fn1_sequence_key_scheduling[j][1] % 24));
+	for (int j = 0; j < 16; ++j)
+		if (BIT(subkey, j) != 0)
+			fn2_key_subkeys[fn2_sequence_key_scheduling[j] / 24] ^= (1 << (fn2_sequence_key_scheduling[j] % 24));
+
+	for (int r = 0; r < 4; ++r)
+		for (int input = 0; input < 256; ++input)
+			fn1_rounds[r][input] = feistel_function_fast(0, r, input, fn1_subkeys[r]);
+}
+
+UINT16 CCrypto::block_decrypt_fast(UINT16 counter, UINT16 data)
+{
+	// First Feistel Network
+	int aux = counter_swap[0][counter & 0xff] | counter_swap[1][counter >> 8];
+	int B = aux >> 8;
+	int A = (aux & 0xff) ^ fn1_rounds[0][B];
+	B ^= fn1_rounds[1][A];
+	A ^= fn1_rounds[2][B];
+	B ^= fn1_rounds[3][A];
+	int middle_result = (B << 8) | A;
+
+	UINT32 subkeys[4];
+	for (int j = 0; j < 4; ++j)
+		subkeys[j] = fn2_key_subkeys[j] ^ fn2_middle_subkeys[0][middle_result & 0xff][j] ^ fn2_middle_subkeys[1][middle_result >> 8][j];
+
+	// Second Feistel Network
+	aux = data_swap[0][data & 0xff] | data_swap[1][data >> 8];
+	B = aux >> 8;
+	A = (aux & 0xff) ^ feistel_function_fast(1, 0, B, subkeys[0]);
+	B ^= feistel_function_fast(1, 1, A, subkeys[1]);
+	A ^= feistel_function_fast(1, 2, B, subkeys[2]);
+	B ^= feistel_function_fast(1, 3, A, subkeys[3]);
+	aux = (B << 8) | A;
+
+	return result_swap[0][aux & 0xff] | result_swap[1][aux >> 8];
+}
+
+UINT16 CCrypto::DecryptWord(UINT16 counter, UINT16 data, bool reference)
+{
+	return reference ? block_decrypt(key, subkey, counter, data) : block_decrypt_fast(counter, data);
+}
 
 UINT16 CCrypto::get_decrypted_16()
 {
@@ -788,7 +908,7 @@ UINT16 CCrypto::get_decrypted_16()
 
 	enc = m_read(prot_cur_address);
 
-	UINT16 dec = block_decrypt(key, subkey, prot_cur_address, enc);
+	UINT16 dec = block_decrypt_fast(prot_cur_address, enc);
 	UINT16 res = (dec & 3) | (dec_hist & 0xfffc);
 	dec_hist = dec;
 
@@ -976,7 +1096,9 @@ void CCrypto::line_fill()
 
 	line_buffer_pos = 0;
 
-	for(int i=0; i != line_buffer_size;) {
+	// Runs are cut short at the end of the line, which only corrupt streams
+	// would run past
+	for(int i=0; i < line_buffer_size;) {
 		// vlc 0: start of line
 		// vlc 1: interior of line
 		// vlc 2-9: 7-1 bytes from end of line
@@ -997,8 +1119,8 @@ void CCrypto::line_fill()
 
 				static int offsets[4] = {0, 1, 0, -1};
 				int offset = offsets[(tmp & 0x18) >> 3];
-				for(int j=0; j != count; j++) {
-					lc[i^1] = lp[((i+offset) % line_buffer_size)^1];
+				for(int j=0; j != count && i < line_buffer_size; j++) {
+					lc[i^1] = lp[((i+offset+line_buffer_size) % line_buffer_size)^1];
 					i++;
 				}
 
@@ -1013,7 +1135,7 @@ void CCrypto::line_fill()
 				byte = (byte | get_compressed_bit()) << 1;
 				byte = (byte | get_compressed_bit()) << 1;
 				byte =  byte | get_compressed_bit();
-				for(int j=0; j != count; j++)
+				for(int j=0; j != count && i < line_buffer_size; j++)
 					lc[(i++)^1] = byte;
 
 			}
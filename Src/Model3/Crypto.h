@@ -57,6 +57,10 @@ public:
 	void SetAddressHigh(uint16_t data);
 	void SetSubKey(uint16_t data);
 
+	// Decrypts one word with the current keys, through the precomputed tables
+	// or through the reference block_decrypt(), for Test_Lockstep
+	uint16_t DecryptWord(uint16_t counter, uint16_t data, bool reference);
+
 	std::function<uint16_t(uint32_t)> m_read;
 
 	/*
@@ -108,8 +112,28 @@ private:
 
 	static const uint8_t trees[9][2][32];
 
+	/*
+	 * Tables for block_decrypt_fast(), precomputed from the sboxes and key
+	 * scheduling at construction, and from the game and sequence keys whenever
+	 * they change, so that each word takes a few dozen lookups rather than
+	 * hundreds of bit operations.
+	 */
+	uint8_t sbox_inputs[2][4][4][256];		// input bits of each sbox of each round of each network, gathered
+	uint8_t sbox_outputs[2][4][4][64];		// sbox output bits, scattered into place
+	uint32_t fn2_middle_subkeys[2][256][4];	// middle result key scheduling, by byte
+	uint16_t counter_swap[2][256];			// bit shuffles, by byte
+	uint16_t data_swap[2][256];
+	uint16_t result_swap[2][256];
+	uint32_t fn2_key_subkeys[4];				// game and sequence key scheduling
+	uint8_t fn1_rounds[4][256];				// first network, all keys applied
+
+	void build_tables();
+	void schedule_keys();
+
 	int feistel_function(int input, const struct sbox *sboxes, uint32_t subkeys);
 	uint16_t block_decrypt(uint32_t game_key, uint16_t sequence_key, uint16_t counter, uint16_t data);
+	int feistel_function_fast(int network, int round, int input, uint32_t subkeys) const;
+	uint16_t block_decrypt_fast(uint16_t counter, uint16_t data);
 
 	uint16_t get_decrypted_16();
 	int get_compressed_bit();
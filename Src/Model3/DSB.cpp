@@ -134,7 +134,7 @@ int CDSBResampler::UpSampleAndMix(float *outL, float *outR, INT16 *inL, INT16 *i
 	float	v[2], musicVol;
 
 	// Obtain program volume settings
-	musicVol = (float)std::max(0,std::min(200,m_config["MusicVolume"].ValueAs<int>()));
+	musicVol = (float)std::max(0,std::min(200,m_musicVolume.Get()));
 	musicVol = musicVol * (float) (1.0 / 100.0);
 
 	v[0] = musicVol * (float) volumeL * (float) (1.0 / (255.0*256.0)); // 256 is there to correct for fixed point interpolation below
@@ -401,14 +401,15 @@ void CDSB1::SendCommand(UINT8 data)
 #endif
 }
 
-void CDSB1::RunFrame(float *audioL, float *audioR)
+void CDSB1::EmulateFrame(void)
 {
-	if (!m_config["EmulateDSB"].ValueAs<bool>())
+	MpegDec::SetDecoder(mpegDecoder);
+	if (!m_emulateDSB.Get())
 	{
 		// DSB code applies SCSP volume, too, so we must still mix
 		memset(mpegL, 0, (32000/60+2)*sizeof(INT16));
 		memset(mpegR, 0, (32000/60+2)*sizeof(INT16));
-		retainedSamples = Resampler.UpSampleAndMix(audioL, audioR, mpegL, mpegR, 0, 0, NUM_SAMPLES_PER_FRAME, 32000/60+2, 44100, 32000);
+		mixVolume = 0;
 		return;
 	}
 
@@ -427,15 +428,20 @@ void CDSB1::RunFrame(float *audioL, float *audioR)
 	//printf("VOLUME=%02X STEREO=%02X\n", volume, stereo);
 
 	// Convert volume from 0x00-0x7F -> 0x00-0xFF
-	UINT8 v = (UINT8) ((float) volume * (float)(255.0/127.0));
+	mixVolume = (UINT8) ((float) volume * (float)(255.0/127.0));
 
 	// Decode MPEG for this frame
 	MpegDec::DecodeAudio(&mpegL[retainedSamples], &mpegR[retainedSamples], 32000 / 60 - retainedSamples + 2);
-	retainedSamples = Resampler.UpSampleAndMix(audioL, audioR, mpegL, mpegR, v, v, NUM_SAMPLES_PER_FRAME, 32000/60+2, 44100, 32000);
+}
+
+void CDSB1::MixFrame(float *audioL, float *audioR)
+{
+	retainedSamples = Resampler.UpSampleAndMix(audioL, audioR, mpegL, mpegR, mixVolume, mixVolume, NUM_SAMPLES_PER_FRAME, 32000/60+2, 44100, 32000);
 }
 
 void CDSB1::Reset(void)
 {
+	MpegDec::SetDecoder(mpegDecoder);
 	MpegDec::Stop();
 	Resampler.Reset();
 	retainedSamples = 0;
@@ -455,6 +461,7 @@ void CDSB1::Reset(void)
 
 void CDSB1::SaveState(CBlockFile *StateFile)
 {
+	MpegDec::SetDecoder(mpegDecoder);
 	UINT32	playOffset, endOffset;
 	UINT8	isPlaying;
 
@@ -494,6 +501,7 @@ void CDSB1::SaveState(CBlockFile *StateFile)
 
 void CDSB1::LoadState(CBlockFile *StateFile)
 {
+	MpegDec::SetDecoder(mpegDecoder);
 	UINT32	playOffset, endOffset;
 	UINT8	isPlaying;
 
@@ -562,6 +570,11 @@ bool CDSB1::Init(const UINT8 *progROMPtr, const UINT8 *mpegROMPtr)
 		return ErrorLog("Insufficient memory for DSB1 board (needs %1.1f MB).", memSizeMB);
 	memset(memoryPool, 0, DSB1_MEMORY_POOL_SIZE);
 
+	// MPEG decoder of this board
+	mpegDecoder = MpegDec::CreateDecoder();
+	if (NULL == mpegDecoder)
+		return ErrorLog("Insufficient memory for DSB1 MPEG decoder.");
+
 	// Set up memory pointers
 	ram = &memoryPool[DSB1_OFFSET_RAM];
 	mpegL = (INT16 *) &memoryPool[DSB1_OFFSET_MPEG_LEFT];
@@ -569,6 +582,9 @@ bool CDSB1::Init(const UINT8 *progROMPtr, const UINT8 *mpegROMPtr)
 
 	// Initialize Z80 CPU
 	Z80.Init(this, Z80IRQCallback);
+	Z80.MapReadMemory(0x0000, 0x7FFF, progROM);
+	Z80.MapReadMemory(0x8000, 0xFFFF, ram);
+	Z80.MapWriteMemory(0x8000, 0xFFFF, ram);
 
 	retainedSamples = 0;
 
@@ -582,6 +598,7 @@ CZ80 *CDSB1::GetZ80(void)
 
 CDSB1::CDSB1(const Util::Config::Node &config)
   : m_config(config),
+    m_emulateDSB(config, "EmulateDSB"),
     Resampler(config)
 {
 	progROM		= NULL;
@@ -590,6 +607,8 @@ CDSB1::CDSB1(const Util::Config::Node &config)
 	ram			= NULL;
 	mpegL		= NULL;
 	mpegR		= NULL;
+	mpegDecoder	= NULL;
+	mixVolume	= 0;
 
 	// must init these otherwise we end up trying to read illegal addresses
 	mpegStart	= 0;
@@ -603,6 +622,9 @@ CDSB1::CDSB1(const Util::Config::Node &config)
 
 CDSB1::~CDSB1(void)
 {
+	MpegDec::DestroyDecoder(mpegDecoder);	// stop decoding from MPEG ROM
+	mpegDecoder = NULL;
+
 	if (memoryPool != NULL)
 	{
 		delete [] memoryPool;
@@ -968,14 +990,18 @@ void CDSB2::SendCommand(UINT8 data)
 }
 
 
-void CDSB2::RunFrame(float *audioL, float *audioR)
+void CDSB2::EmulateFrame(void)
 {
-  if (!m_config["EmulateDSB"].ValueAs<bool>())
+	MpegDec::SetDecoder(mpegDecoder);
+  if (!m_emulateDSB.Get())
   {
     // DSB code applies SCSP volume, too, so we must still mix
     memset(mpegL, 0, (32000/60+2) * sizeof(INT16));
     memset(mpegR, 0, (32000/60+2) * sizeof(INT16));
-    retainedSamples = Resampler.UpSampleAndMix(audioL, audioR, mpegL, mpegR, 0, 0, NUM_SAMPLES_PER_FRAME, 32000/60+2, 44100, 32000);
+    mixL = mpegL;
+    mixR = mpegR;
+    mixVolL = 0;
+    mixVolR = 0;
     return;
   }
 
@@ -1019,38 +1045,38 @@ void CDSB2::RunFrame(float *audioL, float *audioR)
   // Decode MPEG for this frame
   MpegDec::DecodeAudio(&mpegL[retainedSamples], &mpegR[retainedSamples], 32000 / 60 - retainedSamples + 2);
 
-  INT16 *leftChannelSource = nullptr;
-  INT16 *rightChannelSource = nullptr;
-  UINT8 volL = 0, volR = 0;
-
   switch (stereo)
   {
   default:
     case StereoMode::Stereo:
-      leftChannelSource = mpegL;
-      rightChannelSource = mpegR;
-      volL = volume[0];
-      volR = volume[1];
+      mixL = mpegL;
+      mixR = mpegR;
+      mixVolL = volume[0];
+      mixVolR = volume[1];
       break;
     case StereoMode::MonoLeft:
-      leftChannelSource = mpegL;
-      rightChannelSource = mpegL;
-      volL = volume[0];
-      volR = volume[0];
+      mixL = mpegL;
+      mixR = mpegL;
+      mixVolL = volume[0];
+      mixVolR = volume[0];
       break;
     case StereoMode::MonoRight:
-      leftChannelSource = mpegR;
-      rightChannelSource = mpegR;
-      volL = volume[1];
-      volR = volume[1];
+      mixL = mpegR;
+      mixR = mpegR;
+      mixVolL = volume[1];
+      mixVolR = volume[1];
       break;
   }
+}
 
-  retainedSamples = Resampler.UpSampleAndMix(audioL, audioR, leftChannelSource, rightChannelSource, volL, volR, NUM_SAMPLES_PER_FRAME, 32000/60+2, 44100, 32000);
+void CDSB2::MixFrame(float *audioL, float *audioR)
+{
+  retainedSamples = Resampler.UpSampleAndMix(audioL, audioR, mixL, mixR, mixVolL, mixVolR, NUM_SAMPLES_PER_FRAME, 32000/60+2, 44100, 32000);
 }
 
 void CDSB2::Reset(void)
 {
+	MpegDec::SetDecoder(mpegDecoder);
 	MpegDec::Stop();
 	Resampler.Reset();
 	retainedSamples = 0;
@@ -1080,6 +1106,7 @@ void CDSB2::Reset(void)
 
 void CDSB2::SaveState(CBlockFile *StateFile)
 {
+	MpegDec::SetDecoder(mpegDecoder);
 	UINT32	playOffset, endOffset;
 	UINT8	isPlaying;
 
@@ -1124,6 +1151,7 @@ void CDSB2::SaveState(CBlockFile *StateFile)
 
 void CDSB2::LoadState(CBlockFile *StateFile)
 {
+	MpegDec::SetDecoder(mpegDecoder);
 	UINT32	playOffset, endOffset;
 	UINT8	isPlaying;
 
@@ -1205,6 +1233,11 @@ bool CDSB2::Init(const UINT8 *progROMPtr, const UINT8 *mpegROMPtr)
 		return ErrorLog("Insufficient memory for DSB2 board (needs %1.1f MB).", memSizeMB);
 	memset(memoryPool, 0, DSB2_MEMORY_POOL_SIZE);
 
+	// MPEG decoder of this board
+	mpegDecoder = MpegDec::CreateDecoder();
+	if (NULL == mpegDecoder)
+		return ErrorLog("Insufficient memory for DSB2 MPEG decoder.");
+
 	// Set up memory pointers
 	ram = &memoryPool[DSB2_OFFSET_RAM];
 	mpegL = (INT16 *) &memoryPool[DSB2_OFFSET_MPEG_LEFT];
@@ -1214,6 +1247,8 @@ bool CDSB2::Init(const UINT8 *progROMPtr, const UINT8 *mpegROMPtr)
 	M68KSetContext(&M68K);
 	M68KInit();
 	M68KAttachBus(this);
+	M68KMapFetch(0x000000, 0x01FFFF, progROM);
+	M68KMapFetch(0xF00000, 0xF1FFFF, ram);
 	M68KSetIRQCallback(NULL);	// use default behavior (autovector, clear interrupt)
 	M68KGetContext(&M68K);
 
@@ -1229,6 +1264,7 @@ M68KCtx *CDSB2::GetM68K(void)
 
 CDSB2::CDSB2(const Util::Config::Node &config)
   : m_config(config),
+    m_emulateDSB(config, "EmulateDSB"),
     Resampler(config)
 {
 	progROM		= NULL;
@@ -1237,6 +1273,11 @@ CDSB2::CDSB2(const Util::Config::Node &config)
 	ram			= NULL;
 	mpegL		= NULL;
 	mpegR		= NULL;
+	mpegDecoder	= NULL;
+	mixL		= NULL;
+	mixR		= NULL;
+	mixVolL		= 0;
+	mixVolR		= 0;
 
 	cmdLatch	= 0;
 	mpegState	= 0;
@@ -1249,6 +1290,9 @@ CDSB2::CDSB2(const Util::Config::Node &config)
 
 CDSB2::~CDSB2(void)
 {
+	MpegDec::DestroyDecoder(mpegDecoder);	// stop decoding from MPEG ROM
+	mpegDecoder = NULL;
+
 	if (memoryPool != NULL)
 	{
 		delete [] memoryPool;
@@ -36,6 +36,7 @@
 #include "CPU/Bus.h"
 #include "CPU/68K/68K.h"
 #include "CPU/Z80/Z80.h"
+#include "Sound/MPEG/MpegAudio.h"
 #include "Util/NewConfig.h"
 
 #define FIFO_STACK_SIZE			0x100
@@ -74,11 +75,13 @@ public:
 	int		UpSampleAndMix(float *outL, float *outR, INT16 *inL, INT16 *inR, UINT8 volumeL, UINT8 volumeR, int sizeOut, int sizeIn, int outRate, int inRate);
 	void	Reset(void);
 	CDSBResampler(const Util::Config::Node &config)
-	  : m_config(config)
+	  : m_config(config),
+	    m_musicVolume(config, "MusicVolume")
   {
   }
 private:
 	const Util::Config::Node &m_config;
+	Util::Config::CachedValue<int> m_musicVolume;
 	int	nFrac;
 	int	pFrac;
 };
@@ -105,16 +108,37 @@ public:
 	virtual void SendCommand(UINT8 data) = 0;
 
 	/*
-	 * RunFrame(audioL, audioR):
+	 * EmulateFrame(void):
+	 *
+	 * Runs one frame and decodes its MPEG audio, for MixFrame() to mix. Only
+	 * the DSB itself is touched, so this may run on another thread while the
+	 * sound board generates the SCSP audio.
+	 */
+	virtual void EmulateFrame(void) = 0;
+
+	/*
+	 * MixFrame(audioL, audioR):
 	 *
-	 * Runs one frame and updates the MPEG audio. Audio is mixed into the
-	 * supplied buffers (they are assumed to already contain audio data).
+	 * Mixes the MPEG audio of the frame last emulated into the supplied
+	 * buffers (they are assumed to already contain audio data).
 	 *
 	 * Parameters:
 	 *		audioL	Left audio channel, one frame (44 KHz, 1/60th second).
 	 *		audioR	Right audio channel.
 	 */
-	virtual void RunFrame(float *audioL, float *audioR) = 0;
+	virtual void MixFrame(float *audioL, float *audioR) = 0;
+
+	/*
+	 * RunFrame(audioL, audioR):
+	 *
+	 * Runs one frame and mixes its MPEG audio into the supplied buffers: an
+	 * EmulateFrame() followed by a MixFrame().
+	 */
+	void RunFrame(float *audioL, float *audioR)
+	{
+		EmulateFrame();
+		MixFrame(audioL, audioR);
+	}
 
 	/*
 	 * Reset(void):
@@ -187,7 +211,8 @@ public:
 
 	// DSB interface (see CDSB definition)
 	void 	SendCommand(UINT8 data);
-	void 	RunFrame(float *audioL, float *audioR);
+	void 	EmulateFrame(void);
+	void 	MixFrame(float *audioL, float *audioR);
 	void 	Reset(void);
 	void	SaveState(CBlockFile *StateFile);
 	void	LoadState(CBlockFile *StateFile);
@@ -202,6 +227,7 @@ public:
 
 private:
   const Util::Config::Node &m_config;
+  Util::Config::CachedValue<bool> m_emulateDSB;
 
 	// Resampler
 	CDSBResampler	Resampler;
@@ -209,6 +235,8 @@ private:
 
   // MPEG decode buffers (48KHz, 1/60th second + 2 extra padding samples)
 	INT16	*mpegL, *mpegR;
+	MpegDec::Decoder	*mpegDecoder;	// this board's MPEG decoder
+	UINT8	mixVolume;		// volume EmulateFrame() left for MixFrame()
 
 	// DSB memory
 	const UINT8	*progROM;		// Z80 program ROM (passed in from parent object)
@@ -264,7 +292,8 @@ public:
 
 	// DSB interface (see definition of CDSB)
 	void 	SendCommand(UINT8 data);
-	void 	RunFrame(float *audioL, float *audioR);
+	void 	EmulateFrame(void);
+	void 	MixFrame(float *audioL, float *audioR);
 	void 	Reset(void);
 	void	SaveState(CBlockFile *StateFile);
 	void	LoadState(CBlockFile *StateFile);
@@ -279,6 +308,7 @@ public:
 
 private:
 	const Util::Config::Node &m_config;
+	Util::Config::CachedValue<bool> m_emulateDSB;
 
 	// Private helper functions
 	void	WriteMPEGFIFO(UINT8 byte);
@@ -289,6 +319,9 @@ private:
 
 	// MPEG decode buffers (48KHz, 1/60th second + 2 extra padding samples)
 	INT16	*mpegL, *mpegR;
+	MpegDec::Decoder	*mpegDecoder;	// this board's MPEG decoder
+	INT16	*mixL, *mixR;		// channels and volumes EmulateFrame() left for MixFrame()
+	UINT8	mixVolL, mixVolR;
 
 	// Stereo mode (do not change values because they are used in save states!)
 	enum class StereoMode: uint8_t
@@ -0,0 +1,207 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2021 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * DirtyPages.h
+ *
+ * Header file defining the CDirtyPages class: tracking of written pages in
+ * GPU memory regions that have read-only snapshots.
+ */
+
+#ifndef INCLUDED_DIRTYPAGES_H
+#define INCLUDED_DIRTYPAGES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * CDirtyPages:
+ *
+ * Bitmap of the pages of a memory region written since it was last copied.
+ * Pages are a power of two in size, one bit each, stored in 64-bit words so
+ * that clean parts of the region are skipped a word at a time. Each run of
+ * adjacent dirty pages is copied with a single memcpy().
+ */
+class CDirtyPages
+{
+public:
+  static const uint32_t MinPageSize = 0x100;
+  static const uint32_t MaxPageSize = 0x10000;
+
+  /*
+   * Init(regionSize, pageSize):
+   *
+   * Sizes the bitmap for a region and clears it.
+   *
+   * Parameters:
+   *    regionSize  Size of the memory region in bytes. Must be a multiple of
+   *                MaxPageSize.
+   *    pageSize    Page size in bytes. Rounded down to a power of two and
+   *                clamped to [MinPageSize,MaxPageSize].
+   */
+  void Init(uint32_t regionSize, uint32_t pageSize)
+  {
+    m_pageWidth = 0;
+    while ((2u << m_pageWidth) <= std::min(std::max(pageSize, MinPageSize), MaxPageSize))
+      m_pageWidth++;
+    m_regionSize = regionSize;
+    m_numPages = regionSize >> m_pageWidth;
+    m_bits.assign((m_numPages + 63) / 64, 0);
+  }
+
+  // Marks the page at the given byte address as dirty
+  inline void Mark(uint32_t addr)
+  {
+    uint32_t page = addr >> m_pageWidth;
+    m_bits[page >> 6] |= uint64_t(1) << (page & 63);
+  }
+
+  // Marks all pages overlapping a range of bytes as dirty
+  void MarkRange(uint32_t addr, uint32_t size)
+  {
+    if (!size)
+      return;
+    uint32_t last = (addr + size - 1) >> m_pageWidth;
+    for (uint32_t page = addr >> m_pageWidth; page <= last; page++)
+      m_bits[page >> 6] |= uint64_t(1) << (page & 63);
+  }
+
+  // Marks the pages dirty in another bitmap of the same layout as dirty
+  void Merge(const CDirtyPages &other)
+  {
+    for (size_t i = 0; i < m_bits.size(); i++)
+      m_bits[i] |= other.m_bits[i];
+  }
+
+  // Whether any page overlapping a range of bytes is dirty
+  bool IsDirty(uint32_t addr, uint32_t size) const
+  {
+    if (!size)
+      return false;
+    uint32_t last = std::min(addr + size - 1, m_regionSize - 1) >> m_pageWidth;
+    return Find(addr >> m_pageWidth, true) <= last;
+  }
+
+  void Clear(void)
+  {
+    std::fill(m_bits.begin(), m_bits.end(), 0);
+  }
+
+  uint32_t PageSize(void) const
+  {
+    return 1 << m_pageWidth;
+  }
+
+  /*
+   * Copy(dst, src):
+   *
+   * Copies the dirty pages of the region and clears the bitmap. Runs of pages
+   * not ending at the end of the region are extended by 4 bytes to allow for
+   * a possible 32-bit overlap.
+   *
+   * Parameters:
+   *    dst   Region to copy to.
+   *    src   Region to copy from.
+   *
+   * Returns:
+   *    Number of bytes copied.
+   */
+  uint32_t Copy(uint8_t *dst, const uint8_t *src)
+  {
+    uint32_t copied = 0;
+    ForEachRun([&](uint32_t offset, uint32_t size)
+    {
+      size = std::min(offset + size + 4, m_regionSize) - offset;
+      memcpy(dst + offset, src + offset, size);
+      copied += size;
+    });
+    Clear();
+    return copied;
+  }
+
+  /*
+   * ForEachRun(fn):
+   *
+   * Calls fn(offset, size) for each run of adjacent dirty pages, in address
+   * order. The bitmap is left as is.
+   */
+  template <typename F>
+  void ForEachRun(F fn) const
+  {
+    for (uint32_t page = Find(0, true); page < m_numPages; )
+    {
+      uint32_t end = Find(page, false);
+      fn(page << m_pageWidth, (end - page) << m_pageWidth);
+      page = Find(end, true);
+    }
+  }
+
+  void Swap(CDirtyPages &other)
+  {
+    std::swap(m_pageWidth, other.m_pageWidth);
+    std::swap(m_regionSize, other.m_regionSize);
+    std::swap(m_numPages, other.m_numPages);
+    m_bits.swap(other.m_bits);
+  }
+
+private:
+  static inline unsigned CountTrailingZeros(uint64_t word)
+  {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return unsigned(index);
+#else
+    return unsigned(__builtin_ctzll(word));
+#endif
+  }
+
+  // First page at or after the given one that is dirty (or clean), or
+  // m_numPages if there is none. Bits past the last page are never set.
+  uint32_t Find(uint32_t page, bool dirty) const
+  {
+    size_t i = page >> 6;
+    if (i >= m_bits.size())
+      return m_numPages;
+    uint64_t invert = dirty ? 0 : ~uint64_t(0);
+    uint64_t word = (m_bits[i] ^ invert) & (~uint64_t(0) << (page & 63));
+    while (!word)
+    {
+      if (++i >= m_bits.size())
+        return m_numPages;
+      word = m_bits[i] ^ invert;
+    }
+    return std::min(uint32_t(i * 64 + CountTrailingZeros(word)), m_numPages);
+  }
+
+  unsigned              m_pageWidth = 12;
+  uint32_t              m_regionSize = 0;
+  uint32_t              m_numPages = 0;
+  std::vector<uint64_t> m_bits;
+};
+
+#endif  // INCLUDED_DIRTYPAGES_H
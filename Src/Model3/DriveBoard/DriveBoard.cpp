@@ -219,6 +219,11 @@ CZ80* CDriveBoard::GetZ80(void)
   return &m_z80;
 }
 
+UINT64 CDriveBoard::GetIdleCycles(void)
+{
+  return m_z80IdleCycles;
+}
+
 void CDriveBoard::AttachInputs(CInputs* inputs, unsigned gameInputFlags)
 {
   m_inputs = inputs;
@@ -292,6 +297,8 @@ void CDriveBoard::RunFrame(void)
   // Assuming Z80 runs @ 4.0MHz and NMI triggers @ 60.0KHz for WheelBoard and JoystickBoard
   // Assuming Z80 runs @ 8.0MHz and INT triggers @ 60.0KHz for BillBoard
   // TODO - find out if Z80 frequency is correct and exact frequency of NMI interrupts (just guesswork at the moment!)
+  // Most of the time, the Z80 waits for the next interrupt or command byte
+  // from the main board, so the rest of each slice is skipped once it does.
   int cycles = (int)(m_z80Clock * 1000000 / 60);
   int loopCycles = 10000;
   while (cycles > 0)
@@ -303,7 +310,7 @@ void CDriveBoard::RunFrame(void)
       else
         m_z80.SetINT(true);
     }
-    cycles -= m_z80.Run(std::min<int>(loopCycles, cycles));
+    cycles -= m_z80.RunIdleSkip(std::min<int>(loopCycles, cycles), &m_z80IdleCycles);
   }
 }
 
@@ -327,8 +334,11 @@ bool CDriveBoard::Init(const UINT8* romPtr)
     }
     memset(m_ram, 0, RAM_SIZE);
 
-    // Initialize Z80
+    // Initialize Z80 (see Read8() and Write8() for the memory map)
     m_z80.Init(this, NULL);
+    m_z80.MapReadMemory(0x0000, ROM_SIZE - 1, m_rom);
+    m_z80.MapReadMemory(0xE000, 0xFFFF, m_ram);
+    m_z80.MapWriteMemory(0xE000, 0xFFFF, m_ram);
 
     // We are attached
     m_attached = true;
@@ -401,6 +411,7 @@ CDriveBoard::CDriveBoard(const Util::Config::Node& config)
     m_dummyROM(NULL),
     m_z80Clock(4.0),
     m_z80NMI(true),
+    m_z80IdleCycles(0),
     m_inputs(NULL),
     m_inputFlags(0),
     m_outputs(NULL)
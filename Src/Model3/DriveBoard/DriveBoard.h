@@ -120,6 +120,14 @@ public:
    */
   virtual CZ80 *GetZ80(void);
 
+  /*
+   * GetIdleCycles(void):
+   *
+   * Returns:
+   *    Total number of Z80 cycles skipped in wait loops, for diagnostics.
+   */
+  UINT64 GetIdleCycles(void);
+
   /*
    * SaveState(SaveState):
    *
@@ -316,6 +324,7 @@ protected:
     CZ80 m_z80;             // Z80 CPU
     float m_z80Clock;       // Z80 clock frequency
     bool m_z80NMI;          // Non Masquable Interrupt or Interrupt
+    UINT64 m_z80IdleCycles; // Z80 cycles skipped in wait loops
 
     CInputs* m_inputs;
     unsigned m_inputFlags;
@@ -70,6 +70,7 @@ void CSkiBoard::Disable(void)
 bool CSkiBoard::Init(const UINT8 *romPtr)
 {
   bool result = CDriveBoard::Init(romPtr);
+  m_z80.UnmapMemory();  // memory is handled by Read8() and Write8() below
   m_simulated = true;
   return result;
 }
@@ -0,0 +1,175 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2021 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * FrameStats.cpp
+ *
+ * Frame time histograms and hitch detection.
+ */
+
+#include "FrameStats.h"
+
+#include "Supermodel.h"
+#include "Util/Format.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+static const char *s_partNames[CFrameStats::NumParts] =
+{
+  "PPC",
+  "Security",
+  "Sync",
+  "Render",
+  "Sound",
+  "Drive",
+#ifdef NET_BOARD
+  "Net",
+#endif
+  "Frame"
+};
+
+static void GetPartMicros(const FrameTimings &timings, UINT64 micros[CFrameStats::NumParts])
+{
+  micros[CFrameStats::PPC] = timings.ppcMicros;
+  micros[CFrameStats::Security] = timings.securityMicros;
+  micros[CFrameStats::Sync] = timings.syncMicros;
+  micros[CFrameStats::Render] = timings.renderMicros;
+  micros[CFrameStats::Sound] = timings.sndMicros;
+  micros[CFrameStats::Drive] = timings.drvMicros;
+#ifdef NET_BOARD
+  micros[CFrameStats::Net] = timings.netMicros;
+#endif
+  micros[CFrameStats::Frame] = timings.frameMicros;
+}
+
+void CFrameStats::Init(UINT64 hitchMicros, unsigned hitchFrames)
+{
+  m_hitchMicros = hitchMicros;
+  m_last.resize((std::max)(hitchFrames, 1u));
+  Clear();
+}
+
+void CFrameStats::Clear(void)
+{
+  m_hitchQuietFrames = 0;
+  m_lastNext = 0;
+  m_lastCount = 0;
+  m_numFrames = 0;
+  m_skippedFrames = 0;
+  memset(m_totalMicros, 0, sizeof(m_totalMicros));
+  memset(m_maxMicros, 0, sizeof(m_maxMicros));
+  memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+void CFrameStats::Add(const FrameTimings &timings)
+{
+  UINT64 micros[NumParts];
+  GetPartMicros(timings, micros);
+  for (unsigned part = 0; part < NumParts; part++)
+  {
+    m_totalMicros[part] += micros[part];
+    m_maxMicros[part] = (std::max)(m_maxMicros[part], micros[part]);
+    m_buckets[part][(std::min)(micros[part] / BucketMicros, UINT64(NumBuckets - 1))]++;
+  }
+  m_numFrames++;
+  if (timings.renderSkipped)
+    m_skippedFrames++;
+
+  m_last[m_lastNext] = timings;
+  m_lastNext = (m_lastNext + 1) % unsigned(m_last.size());
+  m_lastCount = (std::min)(m_lastCount + 1, unsigned(m_last.size()));
+
+  if (m_hitchQuietFrames > 0)
+    m_hitchQuietFrames--;
+  else if (m_hitchMicros > 0 && timings.frameMicros > m_hitchMicros)
+  {
+    LogHitch(timings);
+    m_hitchQuietFrames = unsigned(m_last.size());
+  }
+}
+
+void CFrameStats::LogHitch(const FrameTimings &timings) const
+{
+  InfoLog("Hitch: frame %llu took %1.2f ms (threshold %1.2f ms). Last %u frames:",
+    timings.frameId, timings.frameMicros / 1000.0, m_hitchMicros / 1000.0, m_lastCount);
+  unsigned size = unsigned(m_last.size());
+  for (unsigned i = 0; i < m_lastCount; i++)
+  {
+    const FrameTimings &t = m_last[(m_lastNext + size - m_lastCount + i) % size];
+    std::string events;
+    if (t.textureUploads > 0)
+      events += Util::Format() << ", " << t.textureUploads << " texture uploads";
+    if (t.modelsCached > 0)
+      events += Util::Format() << ", " << t.modelsCached << " models cached";
+    if (t.renderAllocs > 0)
+      events += Util::Format() << ", " << t.renderAllocs << " render allocations";
+    if (t.audioUnderRuns > 0)
+      events += Util::Format() << ", " << t.audioUnderRuns << " audio under-runs";
+    if (t.securityMicros > 0)
+      events += Util::Format() << ", " << t.securityMicros << " us decrypting";
+    if (t.renderSkipped)
+      events += ", not rendered";
+    InfoLog("  %llu: %6.2f ms (PPC %5.2f, sync %5.2f of %u KB, render %5.2f, sound %5.2f, drive %5.2f)%s%s",
+      t.frameId, t.frameMicros / 1000.0, t.ppcMicros / 1000.0, t.syncMicros / 1000.0, t.syncSize / 1024,
+      t.renderMicros / 1000.0, t.sndMicros / 1000.0, t.drvMicros / 1000.0,
+      t.frameMicros > m_hitchMicros ? " !" : "", events.c_str());
+  }
+}
+
+void CFrameStats::Log(void) const
+{
+  if (m_numFrames == 0)
+    return;
+  InfoLog("Frame time histograms of %llu frames, in %1.1f ms buckets:", m_numFrames, BucketMicros / 1000.0);
+  for (unsigned part = 0; part < NumParts; part++)
+  {
+    // Percentiles are the upper bounds of the buckets they fall in
+    UINT64 p50 = 0;
+    UINT64 p99 = 0;
+    UINT64 count = 0;
+    std::string buckets;
+    for (unsigned i = 0; i < NumBuckets; i++)
+    {
+      if (m_buckets[part][i] == 0)
+        continue;
+      if (count < (m_numFrames + 1) / 2 && count + m_buckets[part][i] >= (m_numFrames + 1) / 2)
+        p50 = i;
+      if (count < (m_numFrames * 99 + 99) / 100 && count + m_buckets[part][i] >= (m_numFrames * 99 + 99) / 100)
+        p99 = i;
+      count += m_buckets[part][i];
+      buckets += Util::Format() << (buckets.empty() ? "" : " ") << (i * BucketMicros / 1000.0) << (i == NumBuckets - 1 ? "+:" : ":") << m_buckets[part][i];
+    }
+    InfoLog("  %-6s mean %5.2f ms, p50 < %5.1f ms, p99 < %5.1f ms, max %6.2f ms", s_partNames[part],
+      m_totalMicros[part] / 1000.0 / m_numFrames, (p50 + 1) * BucketMicros / 1000.0, (p99 + 1) * BucketMicros / 1000.0, m_maxMicros[part] / 1000.0);
+    InfoLog("         %s", buckets.c_str());
+  }
+  if (m_skippedFrames > 0)
+    InfoLog("%llu frames skipped for running over the frame budget.", m_skippedFrames);
+}
+
+CFrameStats::CFrameStats(void)
+  : m_hitchMicros(0),
+    m_last(1)
+{
+  Clear();
+}
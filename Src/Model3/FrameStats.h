@@ -0,0 +1,160 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2021 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * FrameStats.h
+ *
+ * Header file defining the FrameTimings structure and the CFrameStats class,
+ * which keeps histograms of frame timings and logs the frames around hitches.
+ */
+
+#ifndef INCLUDED_FRAMESTATS_H
+#define INCLUDED_FRAMESTATS_H
+
+#include "Real3D.h"
+#include "TileGen.h"
+#include "Types.h"
+#include <vector>
+
+/*
+ * FrameTimings
+ *
+ * Timings within a frame, for debugging purposes
+ */
+struct FrameTimings
+{
+  UINT64 ppcMicros;       // times in microseconds
+  UINT64 securityMicros;  // security board decryption, part of ppcMicros
+  UINT32 syncSize;
+  UINT64 syncMicros;
+  UINT32 replaySize;      // snapshot pages copied back into GPU memory by the PPC thread
+  Real3DSnapshotStats real3DReplay;     // replaySize per region
+  TileGenSnapshotStats tileGenReplay;
+  UINT64 renderMicros;
+  UINT32 renderAllocs;    // heap allocations building the 3D scene
+  UINT32 modelsCached;    // models decoded building the 3D scene
+  UINT32 textureUploads;  // texture uploads made to the renderer
+  UINT64 sndMicros;
+  UINT64 drvMicros;
+  UINT32 ppcIdleCycles;   // PowerPC cycles skipped in idle loops
+  UINT32 sndIdleCycles;   // sound 68K cycles skipped in idle loops
+  UINT32 drvIdleCycles;   // drive board Z80 cycles skipped in wait loops
+  UINT32 mainWaitMicros;  // time each thread waited for the others at the end of the frame
+  UINT32 ppcWaitMicros;
+  UINT32 sndWaitMicros;
+  UINT32 drvWaitMicros;
+  UINT32 audioUnderRuns;  // audio buffer under-runs during the frame
+  UINT64 inputAgeMicros;  // age of the inputs at the game's first read of them in the frame (0 if none)
+  UINT64 renderPollMicros; // when the inputs of the frame rendered were polled (0 if none was rendered)
+  bool renderSkipped;     // frame neither synced nor rendered, the last having run over the frame budget
+#ifdef NET_BOARD
+  UINT64 netMicros;
+  UINT64 netWaitMicros;   // time the net board waited for messages, part of netMicros
+  UINT32 rollbackFrames;  // frames run again after the net board predicted one wrong
+  UINT64 rollbackMicros;
+#endif
+  UINT64 frameMicros;
+  UINT64 frameId;
+};
+
+/*
+ * CFrameStats:
+ *
+ * Histograms of the time taken by each part of the frame, in buckets of half
+ * a millisecond, and a hitch detector. Adding a frame costs a few increments,
+ * so this is always on. The timings of the last frames are kept, and when a
+ * frame takes longer than the hitch threshold they are logged along with what
+ * happened in each (texture uploads, models decoded, snapshot sync size,
+ * audio under-runs and frame skips) to help tell what caused it. Once logged, another hitch
+ * is not logged until as many frames have passed again.
+ */
+class CFrameStats
+{
+public:
+  // Parts of the frame timed
+  enum Part
+  {
+    PPC,
+    Security,
+    Sync,
+    Render,
+    Sound,
+    Drive,
+#ifdef NET_BOARD
+    Net,
+#endif
+    Frame,
+    NumParts
+  };
+
+  static const unsigned BucketMicros = 500;
+  static const unsigned NumBuckets = 200;  // up to 100 ms, longer times are counted in the last
+
+  /*
+   * Init(hitchMicros, hitchFrames):
+   *
+   * Sets the hitch detector up and empties the histograms.
+   *
+   * Parameters:
+   *    hitchMicros   Frame time above which a frame is a hitch, in
+   *                  microseconds, or 0 to detect none.
+   *    hitchFrames   Number of frames logged for a hitch, up to and
+   *                  including it.
+   */
+  void Init(UINT64 hitchMicros, unsigned hitchFrames);
+
+  // Empties the histograms and the frames kept for hitches
+  void Clear(void);
+
+  /*
+   * Add(timings):
+   *
+   * Adds a frame to the histograms, logging the last frames if it is a hitch.
+   */
+  void Add(const FrameTimings &timings);
+
+  /*
+   * Log(void):
+   *
+   * Logs the histograms of the frames added so far, with their means and
+   * percentiles.
+   */
+  void Log(void) const;
+
+  CFrameStats(void);
+
+private:
+  void LogHitch(const FrameTimings &timings) const;
+
+  UINT64 m_hitchMicros;
+  unsigned m_hitchQuietFrames;      // frames left before another hitch is logged
+  std::vector<FrameTimings> m_last; // ring of the last frames
+  unsigned m_lastNext;              // where the next frame goes in the ring
+  unsigned m_lastCount;
+  UINT64 m_numFrames;
+  UINT64 m_skippedFrames;           // frames not rendered by automatic frame skipping
+  UINT64 m_totalMicros[NumParts];
+  UINT64 m_maxMicros[NumParts];
+  UINT32 m_buckets[NumParts][NumBuckets];
+};
+
+#endif  // INCLUDED_FRAMESTATS_H
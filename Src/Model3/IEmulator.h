@@ -35,6 +35,7 @@ class CRender2D;
 class IRender3D;
 class CInputs;
 class COutputs;
+class IEmulatorHost;
 
 /*
  * IEmulator:
@@ -172,6 +173,17 @@ public:
    */
   virtual void AttachOutputs(COutputs *OutputsPtr) = 0;
 
+  /*
+   * AttachHost(HostPtr):
+   *
+   * Attaches the host that video frames are framed by and audio is output
+   * to. Without one, frames are rendered and audio is discarded.
+   *
+   * Parameters:
+   *    HostPtr   Pointer to the host, or NULL.
+   */
+  virtual void AttachHost(IEmulatorHost *HostPtr) = 0;
+
   /*
    * Init(void):
    *
@@ -0,0 +1,104 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011 Bart Trzynadlowski, Nik Henson 
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free 
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+ 
+/*
+ * IEmulatorHost.h
+ *
+ * Header file defining the interface through which an emulator reaches the
+ * program hosting it, IEmulatorHost.
+ */
+
+#ifndef INCLUDED_IEMULATORHOST_H
+#define INCLUDED_IEMULATORHOST_H
+
+#include "Types.h"
+#include "OSD/Audio.h"
+
+/*
+ * IEmulatorHost:
+ *
+ * Video and audio output of an emulator instance. The emulator only reaches
+ * the host program through this, so that several instances, each with its own
+ * host, can be run in one process. Supermodel's own host forwards to the OSD
+ * video and audio functions.
+ */
+class IEmulatorHost
+{
+public:
+  /*
+   * BeginFrameVideo(void):
+   *
+   * Called before a frame is rendered.
+   *
+   * Returns:
+   *    False to skip rendering the frame.
+   */
+  virtual bool BeginFrameVideo(void) = 0;
+
+  /*
+   * EndFrameVideo(void):
+   *
+   * Called once a frame has been rendered (or skipped).
+   */
+  virtual void EndFrameVideo(void) = 0;
+
+  /*
+   * OutputAudio(numSamples, leftFrontBuffer, rightFrontBuffer,
+   *             leftRearBuffer, rightRearBuffer, flipStereo):
+   *
+   * Receives one frame of audio from the sound board, 44.1 KHz.
+   *
+   * Returns:
+   *    True if the host's buffer is full, so that an unsynchronized sound
+   *    board thread need not generate more.
+   */
+  virtual bool OutputAudio(unsigned numSamples, const float *leftFrontBuffer, const float *rightFrontBuffer,
+    const float *leftRearBuffer, const float *rightRearBuffer, bool flipStereo) = 0;
+
+  /*
+   * SetAudioCallback(callback, data):
+   *
+   * Sets a function for the host to call when it needs more audio, or NULL
+   * for none. Hosts that never run short of audio may ignore it.
+   */
+  virtual void SetAudioCallback(AudioCallbackFPtr callback, void *data)
+  {
+  }
+
+  /*
+   * GetAudioStats(stats):
+   *
+   * Reports the host's audio buffer under-runs and over-runs and how full its
+   * buffer is.
+   */
+  virtual void GetAudioStats(AudioStats *stats)
+  {
+    stats->underRuns = 0;
+    stats->overRuns = 0;
+    stats->fillLevel = 0.0f;
+  }
+
+  virtual ~IEmulatorHost(void)
+  {
+  }
+};
+
+#endif  // INCLUDED_IEMULATORHOST_H
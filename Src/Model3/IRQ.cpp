@@ -58,27 +58,39 @@ void CIRQ::LoadState(CBlockFile *SaveState)
 	
 	SaveState->Read(&irqEnable, sizeof(irqEnable));
 	SaveState->Read(&irqState, sizeof(irqState));
+	cpuLine = -1;
 }
 
 
 /******************************************************************************
  Emulation Functions
+ 
+ The PowerPC checks for interrupts when its IRQ line is raised, so the line is
+ only driven when its level changes. IRQs are asserted and deasserted many
+ times per frame (MIDI, VBlank polling) while the line is already at the level
+ required, and checking again would find the pending interrupt either taken or
+ still masked by the CPU, which checks again itself when it unmasks them.
 ******************************************************************************/
 
 void CIRQ::Assert(unsigned irqBits)
 {
 	irqState |= irqBits;
-	if ((irqState&irqEnable))	// low 8 bits are maskable interrupts
-		ppc_set_irq_line(1);
-	if ((irqState&(~0xFF)))		// any non-maskable interrupts pending?
+	// Low 8 bits are maskable interrupts, any others are non-maskable
+	if (cpuLine != 1 && ((irqState&irqEnable) || (irqState&(~0xFF))))
+	{
+		cpuLine = 1;
 		ppc_set_irq_line(1);
+	}
 }
 
 void CIRQ::Deassert(unsigned irqBits)
 {
 	irqState &= ~irqBits;
-	if (!(irqState & irqEnable) && !(irqState & (~0xFF)))
+	if (cpuLine != 0 && !(irqState & irqEnable) && !(irqState & (~0xFF)))
+	{
+		cpuLine = 0;
 		ppc_set_irq_line(0);	// if no pending IRQs, deassert CPU IRQ line
+	}
 }
 
 void CIRQ::WriteIRQEnable(UINT8 data)
@@ -100,6 +112,7 @@ void CIRQ::Reset(void)
 {
 	irqEnable = 0;	// disable all
 	irqState = 0;	// no IRQs pending
+	cpuLine = -1;
 }
 
 
@@ -113,6 +126,9 @@ void CIRQ::Init(void)
 }
 
 CIRQ::CIRQ(void)
+	: irqEnable(0),
+	  irqState(0),
+	  cpuLine(-1)
 {	
 	DebugLog("Built IRQ controller\n");
 }
@@ -144,6 +144,7 @@ public:
 private:
 	unsigned	irqEnable;	// 8 bits, 1=enabled, 0=disabled
 	unsigned	irqState;	// bits correspond to irqEnable, 1=pending, 0=not pending
+	int			cpuLine;	// CPU IRQ line level last set, -1 if not known (after reset or loading a state)
 };
 
 
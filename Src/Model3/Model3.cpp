@@ -32,7 +32,9 @@
  *    state. PowerPC timing variables have changed. Before 0.3a release,
  *    important to change format version #.
  *  - Remove FLIPENDIAN32() macros and have little endian devices flip data
- *    around themselves. Bus standard should be big endian.
+ *    around themselves. Bus standard should be big endian. (RAM and CROM are
+ *    already stored as host-order words; the remaining flips are for the
+ *    little endian Real3D and tile generator.)
  *  - ROM sets should probably be handled with a class that manages ROM
  *    loading, the game list, as well as ROM patching
  *  - Wrap up CPU emulation inside a class.
@@ -223,18 +225,25 @@
 #include "DriveBoard/WheelBoard.h"
 #include "Game.h"
 #include "ROMSet.h"
+#include "ROMCache.h"
 #ifdef NET_BOARD
 #include "Network/NetBoard.h"
 #include "Network/SimNetBoard.h"
+#include "Inputs/Inputs.h"
+#include "Inputs/InputTypes.h"
+#include "CPU/68K/68K.h"
 #endif // NET_BOARD
 #include "OSD/Audio.h"
-#include "OSD/Video.h"
+#include "OSD/FileSystemPath.h"
+#include "OSD/PageProtection.h"
+#include "OSD/Trace.h"
 #include "Util/Format.h"
 #include "Util/ByteSwap.h"
 #include <functional>
 #include <set>
 #include <iostream>
 #include <algorithm>
+#include <zlib.h>
 
 /******************************************************************************
  Model 3 Inputs
@@ -242,11 +251,35 @@
  Game controls. The EEPROM is mapped here as well.
 ******************************************************************************/
 
+// Reads a gun or analog axis, estimated at the time the game reads it when
+// m_interpolateAim is set: the frame's emulated time is spread over a frame
+// period from when the inputs were polled for it, so that reads late in the
+// frame see the aim moved on rather than where it was when the frame started
+UINT16 CModel3::ReadAimAxis(const CAxisInput *input) const
+{
+  if (!m_interpolateAim || m_frameCycles == 0)
+    return input->value;
+  UINT64 elapsed = std::min<UINT64>(ppc_total_cycles() - m_frameStartCycles, m_frameCycles);
+  UINT64 micros = m_framePollMicros + UINT64(elapsed * (1000000.0 / 57.524160) / m_frameCycles);
+  return Inputs->GetValueAt(input, micros);
+}
+
 UINT8 CModel3::ReadInputs(unsigned reg)
 {
   UINT8 adc[8];
   UINT8 data;
   reg &= 0x3F;
+
+  // Latch the inputs as the game first reads them in a frame, rather than
+  // using those polled before the frame started
+  if (!m_inputsRead && reg != 0x00)
+  {
+    m_inputsRead = true;
+    if (m_latchInputs)
+      Inputs->Latch();
+    m_ppcTimings.inputAgeMicros = CThread::GetMicroseconds() - Inputs->GetPollMicros();
+  }
+
   switch (reg)
   {
   case 0x00:  // input bank
@@ -591,16 +624,16 @@ UINT8 CModel3::ReadInputs(unsigned reg)
 
     if ((m_game.inputs & Game::INPUT_ANALOG_JOYSTICK))
     {
-      adc[0] = (UINT8)Inputs->analogJoyY->value;
-      adc[1] = (UINT8)Inputs->analogJoyX->value;
+      adc[0] = (UINT8)ReadAimAxis(Inputs->analogJoyY);
+      adc[1] = (UINT8)ReadAimAxis(Inputs->analogJoyX);
     }
 
     if (m_game.inputs & (Game::INPUT_ANALOG_GUN1 | Game::INPUT_ANALOG_GUN2))
     {
-      adc[0] = (UINT8)Inputs->analogGunX[0]->value;
-      adc[2] = (UINT8)Inputs->analogGunY[0]->value;
-      adc[1] = (UINT8)Inputs->analogGunX[1]->value;
-      adc[3] = (UINT8)Inputs->analogGunY[1]->value;
+      adc[0] = (UINT8)ReadAimAxis(Inputs->analogGunX[0]);
+      adc[2] = (UINT8)ReadAimAxis(Inputs->analogGunY[0]);
+      adc[1] = (UINT8)ReadAimAxis(Inputs->analogGunX[1]);
+      adc[3] = (UINT8)ReadAimAxis(Inputs->analogGunY[1]);
 
   	  // Unclear why this is necessary or how to cleanly fix it, so I'm
   	  // disabling it but leaving it here for future reference. The proper fix is
@@ -609,10 +642,10 @@ UINT8 CModel3::ReadInputs(unsigned reg)
   	  // all analog_gun games require axis inversion to be playable).
 	  if (m_game.name == "lostwsga" || m_game.name == "lostwsgo")
 	  { // to do, not a string compare
-        adc[0] =       (UINT8)Inputs->analogGunX[0]->value; // order is different for some reason in lost world
-        adc[1] = 255 - (UINT8)Inputs->analogGunY[0]->value; // why are values inverted? is this the wrong place to fix this
-        adc[2] =       (UINT8)Inputs->analogGunX[1]->value;
-        adc[3] = 255 - (UINT8)Inputs->analogGunY[1]->value;
+        adc[0] =       (UINT8)ReadAimAxis(Inputs->analogGunX[0]); // order is different for some reason in lost world
+        adc[1] = 255 - (UINT8)ReadAimAxis(Inputs->analogGunY[0]); // why are values inverted? is this the wrong place to fix this
+        adc[2] =       (UINT8)ReadAimAxis(Inputs->analogGunX[1]);
+        adc[3] = 255 - (UINT8)ReadAimAxis(Inputs->analogGunY[1]);
       }
     }
 
@@ -692,31 +725,44 @@ void CModel3::WriteInputs(unsigned reg, UINT8 data)
       serialFIFO2 = 0;
       if ((m_game.inputs & Game::INPUT_GUN1)||(m_game.inputs & Game::INPUT_GUN2))
       {
+        // Positions are read a byte at a time, so those read close together
+        // share one estimate rather than mixing bytes of different ones
+        UINT64 cycles = ppc_total_cycles();
+        if (!m_gunAimValid || cycles - m_gunAimCycles > m_frameCycles / 64)
+        {
+          for (int i = 0; i < 2; i++)
+          {
+            m_gunAim[i][0] = ReadAimAxis(Inputs->gunX[i]);
+            m_gunAim[i][1] = ReadAimAxis(Inputs->gunY[i]);
+          }
+          m_gunAimCycles = cycles;
+          m_gunAimValid = true;
+        }
         switch (gunReg)
         {
         case 0: // Player 1 gun Y (low 8 bits)
-          serialFIFO2 = Inputs->gunY[0]->value&0xFF;
+          serialFIFO2 = m_gunAim[0][1]&0xFF;
           break;
         case 1: // Player 1 gun Y (high 2 bits)
-          serialFIFO2 = (Inputs->gunY[0]->value>>8)&3;
+          serialFIFO2 = (m_gunAim[0][1]>>8)&3;
           break;
         case 2: // Player 1 gun X (low 8 bits)
-          serialFIFO2 = Inputs->gunX[0]->value&0xFF;
+          serialFIFO2 = m_gunAim[0][0]&0xFF;
           break;
         case 3: // Player 1 gun X (high 2 bits)
-          serialFIFO2 = (Inputs->gunX[0]->value>>8)&3;
+          serialFIFO2 = (m_gunAim[0][0]>>8)&3;
           break;
         case 4: // Player 2 gun Y (low 8 bits)
-          serialFIFO2 = Inputs->gunY[1]->value&0xFF;
+          serialFIFO2 = m_gunAim[1][1]&0xFF;
           break;
         case 5: // Player 2 gun Y (high 2 bits)
-          serialFIFO2 = (Inputs->gunY[1]->value>>8)&3;
+          serialFIFO2 = (m_gunAim[1][1]>>8)&3;
           break;
         case 6: // Player 2 gun X (low 8 bits)
-          serialFIFO2 = Inputs->gunX[1]->value&0xFF;
+          serialFIFO2 = m_gunAim[1][0]&0xFF;
           break;
         case 7: // Player 2 gun X (high 2 bits)
-          serialFIFO2 = (Inputs->gunX[1]->value>>8)&3;
+          serialFIFO2 = (m_gunAim[1][0]>>8)&3;
           break;
         case 8: // Off-screen indicator (bit 0 = player 1, bit 1 = player 2, set indicates off screen)
           serialFIFO2 = (Inputs->trigger[1]->offscreenValue<<1)|Inputs->trigger[0]->offscreenValue;
@@ -777,7 +823,10 @@ UINT32 CModel3::ReadSecurity(unsigned reg)
     else
     {
       uint8_t *base_ptr;
-      return m_cryptoDevice.Decrypt(&base_ptr) << 16;
+      UINT64 start = CThread::GetPerformanceCounter();
+      UINT32 data = m_cryptoDevice.Decrypt(&base_ptr) << 16;
+      m_securityTicks += CThread::GetPerformanceCounter() - start;
+      return data;
     }
   default:
     DebugLog("Security read: reg=%X\n", reg);
@@ -801,7 +850,9 @@ void CModel3::WriteSecurity(unsigned reg, UINT32 data)
   {
     uint16_t subKey = data >> 16;
     subKey = ((subKey & 0xFF00) >> 8) | ((subKey & 0x00FF) << 8);
+    UINT64 start = CThread::GetPerformanceCounter();
     m_cryptoDevice.SetSubKey(subKey);
+    m_securityTicks += CThread::GetPerformanceCounter() - start;
     break;
   }
   default:
@@ -862,6 +913,7 @@ void CModel3::SetCROMBank(unsigned idx)
   cromBankReg = idx;
   idx = (~idx) & 0xF;
   cromBank = &crom[0x800000 + (idx*0x800000)];
+  ppc_map_memory(0xFF000000, 0xFF7FFFFF, cromBank, false);
   DebugLog("CROM bank setting: %d (%02X), PC=%08X, LR=%08X\n", idx, cromBankReg, ppc_get_pc(), ppc_get_lr());
 }
 
@@ -943,7 +995,7 @@ UINT8 CModel3::Read8(UINT32 addr)
 {
   // RAM (most frequently accessed)
   if (addr<0x00800000)
-    return ram[addr^3];
+    return ram[addr^BYTE_LANE_XOR8];
 
   // Other
   switch ((addr >> 24))
@@ -951,9 +1003,9 @@ UINT8 CModel3::Read8(UINT32 addr)
   // CROM
   case 0xFF:
     if (addr < 0xFF800000)
-      return cromBank[(addr & 0x7FFFFF) ^ 3];
+      return cromBank[(addr & 0x7FFFFF) ^ BYTE_LANE_XOR8];
     else
-      return crom[(addr & 0x7FFFFF) ^ 3];
+      return crom[(addr & 0x7FFFFF) ^ BYTE_LANE_XOR8];
 
   // Real3D DMA
   case 0xC2:
@@ -1077,7 +1129,7 @@ UINT16 CModel3::Read16(UINT32 addr)
 
   // RAM (most frequently accessed)
   if (addr<0x00800000)
-    return *(UINT16 *) &ram[addr^2];
+    return *(UINT16 *) &ram[addr^BYTE_LANE_XOR16];
 
   // Other
   switch ((addr>>24))
@@ -1085,9 +1137,9 @@ UINT16 CModel3::Read16(UINT32 addr)
   // CROM
   case 0xFF:
     if (addr < 0xFF800000)
-      return *(UINT16 *) &cromBank[(addr&0x7FFFFF)^2];
+      return *(UINT16 *) &cromBank[(addr&0x7FFFFF)^BYTE_LANE_XOR16];
     else
-      return *(UINT16 *) &crom[(addr&0x7FFFFF)^2];
+      return *(UINT16 *) &crom[(addr&0x7FFFFF)^BYTE_LANE_XOR16];
 
   // Various
   case 0xF0:
@@ -1098,7 +1150,7 @@ UINT16 CModel3::Read16(UINT32 addr)
     // Backup RAM
     case 0x0C:
     case 0x0D:
-      return *(UINT16 *) &backupRAM[(addr&0x1FFFF)^2];
+      return *(UINT16 *) &backupRAM[(addr&0x1FFFF)^BYTE_LANE_XOR16];
 
     // Sound Board
     case 0x08:
@@ -1389,7 +1441,11 @@ void CModel3::Write8(UINT32 addr, UINT8 data)
   // RAM (most frequently accessed)
   if (addr < 0x00800000)
   {
-    ram[addr^3] = data;
+    ram[addr^BYTE_LANE_XOR8] = data;
+    if (ppcCodePages[addr>>12])
+      ppc_invalidate_code(addr);
+    if (m_rewindFrames > 0)
+      MarkRAMPage(addr);
     return;
   }
 
@@ -1424,7 +1480,8 @@ void CModel3::Write8(UINT32 addr, UINT8 data)
     // Backup RAM
     case 0x0C:
     case 0x0D:
-      backupRAM[(addr&0x1FFFF)^3] = data;
+      backupRAM[(addr&0x1FFFF)^BYTE_LANE_XOR8] = data;
+      m_backupRAMDirty.Mark(addr&0x1FFFF);
       break;
 
     // System registers
@@ -1530,7 +1587,11 @@ void CModel3::Write16(UINT32 addr, UINT16 data)
   // RAM (most frequently accessed)
   if (addr < 0x00800000)
   {
-    *(UINT16 *) &ram[addr^2] = data;
+    *(UINT16 *) &ram[addr^BYTE_LANE_XOR16] = data;
+    if (ppcCodePages[addr>>12])
+      ppc_invalidate_code(addr);
+    if (m_rewindFrames > 0)
+      MarkRAMPage(addr);
     return;
   }
 
@@ -1551,7 +1612,8 @@ void CModel3::Write16(UINT32 addr, UINT16 data)
     // Backup RAM
     case 0x0C:
     case 0x0D:
-      *(UINT16 *) &backupRAM[(addr&0x1FFFF)^2] = data;
+      *(UINT16 *) &backupRAM[(addr&0x1FFFF)^BYTE_LANE_XOR16] = data;
+      m_backupRAMDirty.Mark(addr&0x1FFFF);
       break;
 
     // MPC105
@@ -1624,6 +1686,10 @@ void CModel3::Write32(UINT32 addr, UINT32 data)
   if (addr<0x00800000)
   {
     *(UINT32 *) &ram[addr] = data;
+    if (ppcCodePages[addr>>12])
+      ppc_invalidate_code(addr);
+    if (m_rewindFrames > 0)
+      MarkRAMPage(addr);
     return;
   }
 
@@ -1633,6 +1699,8 @@ void CModel3::Write32(UINT32 addr, UINT32 data)
   // Real3D trigger
   case 0x88:  // 88000000
     GPU.Flush();
+    if (m_earlySyncPending)
+      EarlySyncGPUs();
     break;
 
   // Real3D low culling RAM
@@ -1693,6 +1761,7 @@ void CModel3::Write32(UINT32 addr, UINT32 data)
     case 0x0C:
     case 0x0D:
       *(UINT32 *) &backupRAM[(addr&0x1FFFF)] = data;
+      m_backupRAMDirty.Mark(addr&0x1FFFF);
       break;
 
     // MPC105
@@ -1851,6 +1920,48 @@ void CModel3::Write64(UINT32 addr, UINT64 data)
     Write32(addr+4, (UINT32) data);
 }
 
+/*
+ * Copies blocks from RAM to RAM or Real3D memory for the SCSI controller's
+ * memory moves, which games use for large uploads. Anything else (including
+ * RAM to Real3D blocks the Real3D cannot take in one go) is left to the
+ * caller to do word by word.
+ */
+bool CModel3::CopyBlock32(UINT32 dest, UINT32 src, unsigned numWords)
+{
+  UINT64 size = UINT64(numWords) * 4;
+  if (((src | dest) & 3) != 0 || src + size > 0x00800000)
+    return false;
+  if (numWords == 0)
+    return true;
+
+  if (dest >= 0x00800000)
+    return GPU.CopyBlockFromRAM(dest, src, numWords, true);
+  if (dest + size > 0x00800000)
+    return false;
+
+  // Words are copied in ascending order, so a destination overlapping the
+  // end of the source repeats the start of the source
+  UINT32 *d = (UINT32 *) &ram[dest];
+  const UINT32 *s = (const UINT32 *) &ram[src];
+  if (dest <= src || dest >= src + size)
+    memmove(d, s, size_t(size));
+  else
+  {
+    for (unsigned i = 0; i < numWords; i++)
+      d[i] = s[i];
+  }
+
+  // Invalidate code and mark rewind pages once per page rather than per word
+  for (UINT32 page = dest & ~0xFFF; page < dest + size; page += 0x1000)
+  {
+    if (ppcCodePages[page>>12])
+      ppc_invalidate_code(page);
+    if (m_rewindFrames > 0)
+      MarkRAMPage(page);
+  }
+  return true;
+}
+
 
 /******************************************************************************
  Emulation and Interface Functions
@@ -1858,6 +1969,8 @@ void CModel3::Write64(UINT32 addr, UINT64 data)
 
 void CModel3::SaveState(CBlockFile *SaveState)
 {
+  ppc_set_context(ppcContext);
+
   // Write Model 3 state
   SaveState->NewBlock("Model 3", __FILE__);
   SaveState->Write(&inputBank, sizeof(inputBank));
@@ -1867,6 +1980,7 @@ void CModel3::SaveState(CBlockFile *SaveState)
   SaveState->Write(&adcChannel, sizeof(adcChannel));
   SaveState->Write(&cromBankReg, sizeof(cromBankReg));
   SaveState->Write(&securityPtr, sizeof(securityPtr));
+  m_ramStateOffset = SaveState->GetPosition();
   SaveState->Write(ram, 0x800000);
   SaveState->Write(backupRAM, 0x20000);
   SaveState->Write(securityRAM, 0x20000);
@@ -1897,6 +2011,10 @@ void CModel3::LoadState(CBlockFile *SaveState)
     return;
   }
 
+  ppc_set_context(ppcContext);
+  if (m_turboBootFrames > 0)
+    EndTurboBoot("state loaded");
+  Scheduler.Clear();  // states are saved between frames, so no events are pending
   SaveState->Read(&inputBank, sizeof(inputBank));
   SaveState->Read(&serialFIFO1, sizeof(serialFIFO1));
   SaveState->Read(&serialFIFO2, sizeof(serialFIFO2));
@@ -1907,6 +2025,7 @@ void CModel3::LoadState(CBlockFile *SaveState)
   SaveState->Read(&securityPtr, sizeof(securityPtr));
   SaveState->Read(ram, 0x800000);
   SaveState->Read(backupRAM, 0x20000);
+  m_backupRAMDirty.MarkRange(0, 0x20000);
   SaveState->Read(securityRAM, 0x20000);
   SaveState->Read(&midiCtrlPort, sizeof(midiCtrlPort));
   int32_t securityFirstRead;
@@ -1925,6 +2044,9 @@ void CModel3::LoadState(CBlockFile *SaveState)
   DriveBoard->LoadState(SaveState);
   m_cryptoDevice.LoadState(SaveState);
   m_jtag.LoadState(SaveState);
+
+  // Memory written behind the back of page tracking
+  m_rewindCompareAll = true;
 }
 
 void CModel3::SaveNVRAM(CBlockFile *NVRAM)
@@ -1949,17 +2071,111 @@ void CModel3::LoadNVRAM(CBlockFile *NVRAM)
     return;
   }
   NVRAM->Read(backupRAM, 0x20000);
+
+  // Nothing to checkpoint until it changes
+  m_backupRAMDirty.MarkRange(0, 0x20000);
+  CheckpointNVRAM();
 }
 
 void CModel3::ClearNVRAM(void)
 {
   memset(backupRAM, 0, 0x20000);
+  m_backupRAMDirty.MarkRange(0, 0x20000);
   EEPROM.Clear();
 }
 
+bool CModel3::CheckpointNVRAM(void)
+{
+  // Games rewrite backup RAM with the same data often, which is not worth
+  // saving again
+  bool changed = false;
+  m_backupRAMDirty.ForEachRun([this, &changed](uint32_t offset, uint32_t size)
+  {
+    if (memcmp(&m_backupRAMCheckpoint[offset], &backupRAM[offset], size) != 0)
+    {
+      memcpy(&m_backupRAMCheckpoint[offset], &backupRAM[offset], size);
+      changed = true;
+    }
+  });
+  m_backupRAMDirty.Clear();
+  changed |= !EEPROM.HasSameMemory(m_eepromCheckpoint);
+  m_eepromCheckpoint = EEPROM;
+  return changed;
+}
+
+void CModel3::SaveNVRAMCheckpoint(CBlockFile *NVRAM)
+{
+  m_eepromCheckpoint.SaveState(NVRAM);
+  NVRAM->NewBlock("Backup RAM", __FILE__);
+  NVRAM->Write(m_backupRAMCheckpoint.data(), 0x20000);
+}
+
+void CModel3::SetFastForward(unsigned renderInterval)
+{
+  m_fastForwardInterval = renderInterval;
+  m_fastForwardFrame = 0;
+}
+
+bool CModel3::IsTurboBooting(void) const
+{
+  return m_turboBootFrames > 0;
+}
+
+void CModel3::StartTurboBoot(void)
+{
+  if (m_turboBootFrames > 0)
+    EndTurboBoot("reset");
+  m_turboBootFrames = unsigned(m_config["TurboBoot"].ValueAsDefault<float>(0) * 57.524160f + 0.5f);
+  ppc_set_watch_pc(m_turboBootFrames > 0 ? m_game.boot_pc : 0);
+  ppc_set_hle_boot(m_turboBootFrames > 0);
+  if (m_turboBootFrames > 0)
+  {
+    ppc_set_idle_skip(true);
+    if (m_game.boot_pc != 0)
+      InfoLog("Turbo booting until PC %08X or %u frames.", m_game.boot_pc, m_turboBootFrames);
+    else
+      InfoLog("Turbo booting for %u frames.", m_turboBootFrames);
+  }
+}
+
+void CModel3::EndTurboBoot(const char *reason)
+{
+  ppc_set_context(ppcContext);
+  m_turboBootFrames = 0;
+  ppc_set_watch_pc(0);
+  ppc_set_hle_boot(false);
+  ppc_set_idle_skip(m_config["PowerPCIdleSkip"].ValueAs<bool>() && m_game.idle_skip);
+  InfoLog("Turbo boot finished: %s.", reason);
+}
+
 void CModel3::RunFrame(void)
 {
-  UINT32 start = CThread::GetTicks();
+  UINT64 start = CThread::GetMicroseconds();
+
+  // When fast-forwarding, or falling behind, only the frames rendered are
+  // synced. The pages dirtied by the others accumulate, to be copied with
+  // the next sync.
+  bool sync = true;
+  if (m_fastForwardInterval > 0)
+  {
+    sync = ++m_fastForwardFrame >= m_fastForwardInterval;
+    if (sync)
+      m_fastForwardFrame = 0;
+  }
+  else if (m_skipNextFrame)
+  {
+    sync = false;
+    timings.syncSize = 0;
+    timings.syncMicros = 0;
+    timings.renderMicros = 0;
+  }
+  m_skipNextFrame = false;
+  timings.renderSkipped = m_fastForwardInterval == 0 && !sync;
+  timings.renderPollMicros = 0;
+
+  // Nothing is rendered while turbo booting
+  if (m_turboBootFrames > 0)
+    sync = false;
 
   // See if currently running multi-threaded
   if (m_multiThreaded)
@@ -1968,57 +2184,72 @@ void CModel3::RunFrame(void)
     if (!StartThreads())
       goto ThreadError;
 
-    // Wake threads for PPC main board (if multi-threading GPU), sound board (if sync'd) and drive board (if attached) so they can process a frame
-    if ((m_gpuMultiThreaded       && !ppcBrdThreadSync->Post()) ||
-        (syncSndBrdThread         && !sndBrdThreadSync->Post()) ||
-        (DriveBoard->IsAttached()  && !drvBrdThreadSync->Post()))
+    // With early rendering, the PPC main board thread syncs the GPUs as
+    // the game flushes the Real3D, so that the frame can be rendered while
+    // the thread emulates the rest of it
+    bool earlyRender = m_earlyRender && m_gpuMultiThreaded && m_frameQueueDepth == 0 && sync && gpusReady;
+    m_earlySyncPending = earlyRender;
+    m_earlySynced = false;
+
+    // Release threads for PPC main board (if multi-threading GPU), sound board (if sync'd) and drive board (if attached) so they can process a frame
+    if (!frameStartBarrier->Wait())
       goto ThreadError;
 
     // If not multi-threading GPU, then run PPC main board for a frame and sync GPUs now in this thread
     if (!m_gpuMultiThreaded)
     {
       RunMainBoardFrame();
-      SyncGPUs();
+      if (sync)
+        SyncGPUs();
     }
 
-    // Render frame
-    RenderFrame();
-
-    // Enter notify wait critical section
-    if (!notifyLock->Lock())
-      goto ThreadError;
-
-    // Wait for PPC main board, sound board and drive board threads to finish their work (if they are running and haven't finished already)
-    while ((m_gpuMultiThreaded      && !ppcBrdThreadDone) ||
-           (syncSndBrdThread        && !sndBrdThreadDone) ||
-           (DriveBoard->IsAttached() && !drvBrdThreadDone))
+    // Render frame. When multi-threading the GPU with a frame queued, this is
+    // the previous frame, rendered while the PPC main board thread emulates
+    // the next one. Without a queue, the frame is rendered once the thread has
+    // finished it, trading throughput for a frame less of latency.
+    bool renderQueued = !m_gpuMultiThreaded || m_frameQueueDepth > 0;
+    if (renderQueued && (m_gpuMultiThreaded ? m_syncedLastFrame : sync))
+      RenderFrame();
+    if (earlyRender)
     {
-      if (!notifySync->Wait(notifyLock))
+      if (!earlyRenderSignal->Wait())
         goto ThreadError;
+      if (m_earlySynced)
+        RenderFrame();
     }
-    ppcBrdThreadDone = false;
-    sndBrdThreadDone = false;
-    drvBrdThreadDone = false;
 
-    // Leave notify wait critical section
-    if (!notifyLock->Unlock())
+    // Wait for PPC main board, sound board and drive board threads to finish their work
+    if (!frameEndBarrier->Wait(&timings.mainWaitMicros))
       goto ThreadError;
 
     // If multi-threading GPU, then sync GPUs last while PPC main board thread is waiting
-    if (m_gpuMultiThreaded)
+    if (m_gpuMultiThreaded && sync && !m_earlySynced)
       SyncGPUs();
+    m_syncedLastFrame = sync;
+
+    if (!renderQueued && sync && !m_earlySynced)
+      RenderFrame();
 
 #ifdef NET_BOARD
-    if (NetBoard->IsRunning() && m_config["SimulateNet"].ValueAs<bool>())
+    if (NetBoard->IsRunning() && m_simulateNet.Get())
         RunNetBoardFrame();
 #endif
   }
+  else if (m_runAheadFrames > 0 && m_fastForwardInterval == 0 && m_turboBootFrames == 0)
+    RunFrameAhead();
+#ifdef NET_BOARD
+  else if (!m_rollback.empty() && NetBoard->IsRunning())
+    RunFrameRollback();
+#endif
   else
   {
     // If not multi-threaded, then just process and render a single frame for PPC main board, sound board and drive board in turn in this thread
     RunMainBoardFrame();
-    SyncGPUs();
-    RenderFrame();
+    if (sync)
+    {
+      SyncGPUs();
+      RenderFrame();
+    }
     RunSoundBoardFrame();
     if (DriveBoard->IsAttached())
       RunDriveBoardFrame();
@@ -2028,9 +2259,24 @@ void CModel3::RunFrame(void)
 #endif
   }
 
-  timings.frameTicks = CThread::GetTicks() - start;
+  if (m_rewindFrames > 0 && !m_multiThreaded)
+    PushRewindState();
+
+  CollectBoardTimings();
+  timings.frameMicros = CThread::GetMicroseconds() - start;
+  if (m_autoFrameSkip > 0)
+    UpdateFrameSkip(sync);
+  if (m_turboBootFrames > 0)
+  {
+    ppc_set_context(ppcContext);  // the PPC main board thread is waiting
+    if (ppc_watch_pc_hit())
+      EndTurboBoot("boot PC reached");
+    else if (--m_turboBootFrames == 0)
+      EndTurboBoot("time limit reached");
+  }
   // Frame counter
   timings.frameId++;
+  AddFrameStats();
   return;
 
 ThreadError:
@@ -2038,15 +2284,292 @@ ThreadError:
   m_multiThreaded = false;
 }
 
+void CModel3::BoardTimings::Clear(void)
+{
+  micros.store(0, std::memory_order_relaxed);
+  idleCycles.store(0, std::memory_order_relaxed);
+  waitMicros.store(0, std::memory_order_relaxed);
+  securityMicros = 0;
+  inputAgeMicros = 0;
+  replaySize = 0;
+  real3DReplay = Real3DSnapshotStats();
+  tileGenReplay = TileGenSnapshotStats();
+}
+
+void CModel3::CollectBoardTimings(void)
+{
+  // The boards in step with this thread have finished the frame (ordered by
+  // the frame end barrier). Those of the sound board thread otherwise are
+  // from its last frame.
+  timings.ppcMicros = m_ppcTimings.micros.load(std::memory_order_relaxed);
+  timings.securityMicros = m_ppcTimings.securityMicros;
+  timings.inputAgeMicros = m_ppcTimings.inputAgeMicros;
+  timings.replaySize = m_ppcTimings.replaySize;
+  timings.real3DReplay = m_ppcTimings.real3DReplay;
+  timings.tileGenReplay = m_ppcTimings.tileGenReplay;
+  timings.ppcIdleCycles = m_ppcTimings.idleCycles.load(std::memory_order_relaxed);
+  timings.sndMicros = m_sndTimings.micros.load(std::memory_order_relaxed);
+  timings.sndIdleCycles = m_sndTimings.idleCycles.load(std::memory_order_relaxed);
+  timings.drvMicros = m_drvTimings.micros.load(std::memory_order_relaxed);
+  timings.drvIdleCycles = m_drvTimings.idleCycles.load(std::memory_order_relaxed);
+  timings.ppcWaitMicros = m_ppcTimings.waitMicros.load(std::memory_order_relaxed);
+  timings.sndWaitMicros = m_sndTimings.waitMicros.load(std::memory_order_relaxed);
+  timings.drvWaitMicros = m_drvTimings.waitMicros.load(std::memory_order_relaxed);
+}
+
+void CModel3::UpdateFrameSkip(bool rendered)
+{
+  // The frames skipped are counted over each second of emulated frames
+  if (++m_skipWindowFrames >= 58)
+  {
+    m_skipWindowFrames = 0;
+    m_skipWindowSkips = 0;
+  }
+
+  // A rendered frame that ran over the frame budget has the next frame
+  // skipped, so that the boards keep real time. Two are never skipped in a
+  // row, as a frame that is slow without being rendered won't be helped.
+  UINT64 budgetMicros = UINT64(1000000.0 / 57.524160);
+  if (rendered && timings.frameMicros > budgetMicros && m_skipWindowSkips < m_autoFrameSkip)
+  {
+    m_skipNextFrame = true;
+    m_skipWindowSkips++;
+  }
+}
+
+void CModel3::RunFrameAhead(void)
+{
+  // Run the real frame, whose audio is heard but which is not shown
+  RunMainBoardFrame();
+  SyncGPUs();
+  RunSoundBoardFrame();
+  if (DriveBoard->IsAttached())
+    RunDriveBoardFrame();
+#ifdef NET_BOARD
+  if (NetBoard->IsRunning())
+    RunNetBoardFrame();
+#endif
+
+  // Save the state reached and keep going with the same inputs, showing only
+  // the last frame. The drive and net boards are left out as they have effects
+  // outside the emulator (force feedback), as are outputs, and audio is
+  // discarded.
+  CBlockFile state;
+  state.Create(&m_runAheadState, "Supermodel Run-Ahead State", "");
+  SaveState(&state);
+  state.Close();
+  COutputs *outputs = Outputs;
+  Outputs = NULL;
+  GPU.TrackTextureUploads();  // so that restoring the state re-uploads only these
+  for (unsigned i = 0; i < m_runAheadFrames; i++)
+  {
+    RunMainBoardFrame();
+    SyncGPUs();
+    if (i == m_runAheadFrames - 1)
+      RenderFrame();
+    SoundBoard.RunFrame(false);
+  }
+  Outputs = outputs;
+
+  // Return to the real timeline
+  state.Load(&m_runAheadState);
+  LoadState(&state);
+  state.Close();
+}
+
+#ifdef NET_BOARD
+void CModel3::RunFrameRollback(void)
+{
+  // Run the frame as when not multi-threaded, saving the state reached
+  // before the net board exchanges it, which may go back and run the frames
+  // since again. The frame is rendered last, once final.
+  RunMainBoardFrame();
+  SyncGPUs();
+  RunSoundBoardFrame();
+  if (DriveBoard->IsAttached())
+    RunDriveBoardFrame();
+  SaveRollbackFrame();
+  RunNetBoardFrame();
+
+  timings.rollbackFrames = 0;
+  timings.rollbackMicros = 0;
+  UINT32 frame;
+  if (NetBoard->GetRollback(&frame))
+    Resimulate(frame);
+  RenderFrame();
+}
+
+void CModel3::SaveRollbackFrame(void)
+{
+  UINT32 frame = NetBoard->GetFrame();
+  RollbackFrame &saved = m_rollback[frame % m_rollback.size()];
+  saved.frame = frame;
+  saved.valid = true;
+  CBlockFile state;
+  state.Create(&saved.state, "Supermodel Rollback State", "");
+  SaveState(&state);
+  NetBoard->SaveState(&state);
+  state.Close();
+  SaveInputs(&saved.inputs);
+}
+
+void CModel3::Resimulate(UINT32 frame)
+{
+  UINT64 start = CThread::GetMicroseconds();
+  UINT32 end = NetBoard->GetFrame();
+  const RollbackFrame &first = m_rollback[frame % m_rollback.size()];
+  if (end - frame > m_rollback.size() || !first.valid || first.frame != frame)
+    return;
+
+  // As when running ahead, outputs are left alone and audio is discarded,
+  // having been played already. The drive board runs too, to stay in step.
+  SaveInputs(&m_liveInputs);
+  COutputs *outputs = Outputs;
+  Outputs = NULL;
+  for (UINT32 f = frame; f != end; f++)
+  {
+    RollbackFrame &saved = m_rollback[f % m_rollback.size()];
+    if (f == frame)
+    {
+      CBlockFile state;
+      state.Load(&saved.state);
+      LoadState(&state);
+      NetBoard->LoadState(&state);
+      state.Close();
+    }
+    else
+    {
+      LoadInputs(saved.inputs);
+      RunMainBoardFrame();
+      SyncGPUs();
+      SoundBoard.RunFrame(false);
+      if (DriveBoard->IsAttached())
+        RunDriveBoardFrame();
+      SaveRollbackFrame();
+    }
+    NetBoard->ReplayFrame(f);
+  }
+  Outputs = outputs;
+  LoadInputs(m_liveInputs);
+
+  timings.rollbackFrames = end - frame;
+  timings.rollbackMicros = CThread::GetMicroseconds() - start;
+}
+
+void CModel3::SaveInputs(std::vector<UINT16> *values)
+{
+  values->clear();
+  if (Inputs == NULL)
+    return;
+  for (unsigned i = 0; i < Inputs->Count(); i++)
+  {
+    CInput *input = (*Inputs)[i];
+    if (input->IsUIInput())
+      continue;
+    values->push_back(input->value);
+    values->push_back(input->prevValue);
+    CTriggerInput *trigger = dynamic_cast<CTriggerInput *>(input);
+    if (trigger != NULL)
+      values->push_back(trigger->offscreenValue);
+  }
+}
+
+void CModel3::LoadInputs(const std::vector<UINT16> &values)
+{
+  if (Inputs == NULL || values.empty())
+    return;
+  const UINT16 *value = values.data();
+  for (unsigned i = 0; i < Inputs->Count(); i++)
+  {
+    CInput *input = (*Inputs)[i];
+    if (input->IsUIInput())
+      continue;
+    input->value = *value++;
+    input->prevValue = *value++;
+    CTriggerInput *trigger = dynamic_cast<CTriggerInput *>(input);
+    if (trigger != NULL)
+      trigger->offscreenValue = *value++;
+  }
+}
+#endif
+
+void CModel3::PushRewindState(void)
+{
+  CBlockFile state;
+  state.Create(&m_rewindState, "Supermodel Rewind State", "");
+  SaveState(&state);
+  state.Close();
+
+  // Only the pages written during the frame need comparing in RAM and Real3D
+  // memory, whose offsets in the state were just recorded
+  m_rewindRegions.clear();
+  m_rewindRegions.push_back({ m_ramStateOffset, 0x800000, &m_ramDirty });
+  GPU.GetRewindRegions(&m_rewindRegions);
+  m_rewind.Push(&m_rewindState, m_rewindRegions, m_rewindCompareAll);
+  m_rewindCompareAll = false;
+  GPU.ClearRewindPages();
+  ResetRAMPages();
+}
+
+bool CModel3::StepBack(void)
+{
+  if (!m_rewind.StepBack())
+    return false;
+
+  CBlockFile state;
+  state.Load(&m_rewind.GetState());
+  LoadState(&state);
+  state.Close();
+
+  // Memory is now exactly the newest state, so only what is written from now
+  // on must be compared when the next one is pushed
+  m_rewindCompareAll = false;
+  GPU.ClearRewindPages();
+  m_ramDirty.MarkRange(0, 0x800000);
+  ResetRAMPages();
+
+  RenderFrame();
+  return true;
+}
+
+void CModel3::MarkRAMPage(UINT32 addr)
+{
+  // The first write to a page since it was reset comes through the bus. Map
+  // the page for the PPC to write directly until the next state is pushed.
+  if (m_ramDirty.IsDirty(addr, 1))
+    return;
+  m_ramDirty.Mark(addr);
+  UINT32 page = addr & ~(CDirtyPages::MaxPageSize - 1);
+  ppc_map_memory(page, page + CDirtyPages::MaxPageSize - 1, &ram[page], true);
+}
+
+void CModel3::ResetRAMPages(void)
+{
+  ppc_set_context(ppcContext);
+  m_ramDirty.ForEachRun([this](uint32_t offset, uint32_t size)
+  {
+    ppc_map_memory(offset, offset + size - 1, &ram[offset], false);
+  });
+  m_ramDirty.Clear();
+}
+
 void CModel3::RunMainBoardFrame(void)
 {
-	UINT32 start = CThread::GetTicks();
+	Trace::Scope scope("RunMainBoardFrame");
+	ppc_set_context(ppcContext);	// may be called from the main board thread
+	UINT64 start = CThread::GetMicroseconds();
+	UINT64 idleStart = ppc_idle_cycles();
+	m_securityTicks = 0;
+	m_inputsRead = false;
+	m_ppcTimings.inputAgeMicros = 0;
+
+	// Bring GPU memory up to date with the snapshots now being rendered
+	m_ppcTimings.replaySize = GPU.ReplaySnapshots(&m_ppcTimings.real3DReplay) + TileGen.ReplaySnapshots(&m_ppcTimings.tileGenReplay);
 
 	// Compute display and VBlank timings
-	unsigned ppcCycles		= m_config["PowerPCFrequency"].ValueAs<unsigned>() * 1000000;
+	unsigned ppcCycles		= m_ppcFrequency.Get() * 1000000;
 	unsigned frameCycles	= (unsigned)((float)ppcCycles / 57.524160f);
 	unsigned offsetCycles   = (unsigned)((float)frameCycles * 33.f / 100.0f);
-	unsigned dispCycles     = frameCycles - offsetCycles;
 	unsigned statusCycles   = (unsigned)((float)frameCycles * (0.005f));
 
 	// we think a frame looks like this on the model 2
@@ -2065,138 +2588,240 @@ void CModel3::RunMainBoardFrame(void)
 	ppc_set_timer_ratio(ppc_get_bus_freq_multipler() * 2 * ppcCycles / ppc_get_cycles_per_sec());
 
 	// VBlank
+	UINT64 frameStart = ppc_total_cycles();
+	UINT64 frameEnd = frameStart + frameCycles;
+	m_frameStartCycles = frameStart;
+	m_frameCycles = frameCycles;
+	m_framePollMicros = Inputs->GetPollMicros();
+	m_gunAimValid = false;
 	if (gpusReady)
 	{
 		TileGen.BeginVBlank();
 		GPU.BeginVBlank(statusCycles);	// Games poll the ping_pong at startup. Values aren't 100% accurate so we stretch the frame a bit to ensure writes happen in the correct frame
+		Scheduler.Schedule(frameStart + offsetCycles, [this, frameEnd]() { OnVBlankIRQ(frameEnd); });	// start at 33% of the frame
+	}
 
-		ppc_execute(offsetCycles);
-		IRQ.Assert(0x02);								// start at 33% of the frame
-
-		// keep running cycles until IRQ2 is acknowledged
-		// Ski Champ can hang if we check the MIDI control port too early
-		// and miss MIDI interrupts pending before the next IRQ2
-		while (IRQ.ReadIRQEnable() & 0x2 && IRQ.ReadIRQState() & 0x2 && dispCycles > 1000)
-		{
-			ppc_execute(1000);
-			dispCycles -= 1000;
-		}
-
-		/*
-		* Sound:
-		*
-		* Bit 0x20 of the MIDI control port appears to enable periodic interrupts,
-		* which are used to send MIDI commands. Often games will write 0x27, send
-		* a series of commands, and write 0x06 to stop. Other games, like Star
-		* Wars Trilogy and Sega Rally 2, will enable interrupts at the beginning
-		* by writing 0x37 and will disable/enable interrupts to control command
-		* output.
-		*/
-		//printf("\t-- BEGIN (Ctrl=%02X, IRQEn=%02X, IRQPend=%02X) --\n", midiCtrlPort, IRQ.ReadIRQEnable()&0x40, IRQ.ReadIRQState());
-		int irqCount = 0;
-		while ((midiCtrlPort & 0x20))
-			//while (midiCtrlPort == 0x27)  // 27 triggers IRQ sequence, 06 stops it
-		{
-			// Don't waste time firing MIDI interrupts if game has disabled them
-			if ((IRQ.ReadIRQEnable() & 0x40) == 0)
-				break;
-
-			// Process MIDI interrupt
-			IRQ.Assert(0x40);
-			ppc_execute(200); // give PowerPC time to acknowledge IR
-			IRQ.Deassert(0x40);
-			ppc_execute(200); // acknowledge that IRQ was deasserted (TODO: is this really needed?)
-			dispCycles -= 400;
-
-			++irqCount;
-			if (irqCount > 128)
-			{
-				break;
-			}
-		}
-
-		IRQ.Assert(0x0D);
-
-		// End VBlank
-		GPU.EndVBlank();
-		TileGen.EndVBlank();
+	// Run the PowerPC for the whole frame. The VBlank events chain into each
+	// other and the remainder of the frame is the active display part.
+	Scheduler.RunUntil(frameEnd);
+	SoundBoard.EndMIDIFrame();
+
+	// Write how the PowerPC got wherever it stopped, once
+	if (m_ppcTrace && ppc_halted() && !m_ppcTraceDumped)
+	{
+		m_ppcTraceDumped = true;
+		ppc_dump_trace((Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << m_game.name << "_MainPPC_trace.txt").c_str());
 	}
 
-	// Run the PowerPC for the active display part of the frame
-	ppc_execute(dispCycles);
+	m_ppcTimings.idleCycles.store((UINT32)(ppc_idle_cycles() - idleStart), std::memory_order_relaxed);
+	m_ppcTimings.securityMicros = m_securityTicks * 1000000 / CThread::GetPerformanceFrequency();
+	m_ppcTimings.micros.store(CThread::GetMicroseconds() - start, std::memory_order_relaxed);
+}
 
-	timings.ppcTicks = CThread::GetTicks() - start;
+void CModel3::OnVBlankIRQ(UINT64 frameEnd)
+{
+	IRQ.Assert(0x02);
+	OnVBlankIRQPoll(frameEnd);
+}
+
+void CModel3::OnVBlankIRQPoll(UINT64 frameEnd)
+{
+	// keep running cycles until IRQ2 is acknowledged
+	// Ski Champ can hang if we check the MIDI control port too early
+	// and miss MIDI interrupts pending before the next IRQ2
+	if (IRQ.ReadIRQEnable() & 0x2 && IRQ.ReadIRQState() & 0x2 && frameEnd - Scheduler.Now() > 1000)
+	{
+		Scheduler.ScheduleIn(1000, [this, frameEnd]() { OnVBlankIRQPoll(frameEnd); });
+		return;
+	}
+
+	midiIRQCount = 0;
+	OnMIDIIRQ();
+}
+
+void CModel3::OnMIDIIRQ(void)
+{
+	/*
+	 * Sound:
+	 *
+	 * Bit 0x20 of the MIDI control port appears to enable periodic interrupts,
+	 * which are used to send MIDI commands. Often games will write 0x27, send
+	 * a series of commands, and write 0x06 to stop. Other games, like Star
+	 * Wars Trilogy and Sega Rally 2, will enable interrupts at the beginning
+	 * by writing 0x37 and will disable/enable interrupts to control command
+	 * output.
+	 *
+	 * Don't waste time firing MIDI interrupts if game has disabled them.
+	 */
+	if ((midiCtrlPort & 0x20) && (IRQ.ReadIRQEnable() & 0x40) && midiIRQCount <= 128)
+	{
+		// Process MIDI interrupt
+		IRQ.Assert(0x40);
+		Scheduler.ScheduleIn(200, [this]() { OnMIDIIRQDeassert(); });	// give PowerPC time to acknowledge IRQ
+		return;
+	}
+
+	OnVBlankEnd();
+}
+
+void CModel3::OnMIDIIRQDeassert(void)
+{
+	IRQ.Deassert(0x40);
+	++midiIRQCount;
+	Scheduler.ScheduleIn(200, [this]() { OnMIDIIRQ(); });	// acknowledge that IRQ was deasserted (TODO: is this really needed?)
+}
+
+void CModel3::OnVBlankEnd(void)
+{
+	IRQ.Assert(0x0D);
+
+	// End VBlank
+	GPU.EndVBlank();
+	TileGen.EndVBlank();
 }
 
 void CModel3::SyncGPUs(void)
 {
-  UINT32 start = CThread::GetTicks();
+  Trace::Scope scope("SyncGPUs");
+  UINT64 start = CThread::GetMicroseconds();
 
   timings.syncSize = GPU.SyncSnapshots() + TileGen.SyncSnapshots();
+  m_syncedPollMicros = m_framePollMicros;
   gpusReady = true;
 
-  timings.syncTicks = CThread::GetTicks() - start;
+  timings.syncMicros = CThread::GetMicroseconds() - start;
+}
+
+void CModel3::EarlySyncGPUs(void)
+{
+  m_earlySyncPending = false;
+  SyncGPUs();
+
+  // The game writes on into the memory left a frame behind by the sync, so it
+  // is brought up to date now rather than at the start of the next frame
+  m_ppcTimings.replaySize += GPU.ReplaySnapshots(&m_ppcTimings.real3DReplay) + TileGen.ReplaySnapshots(&m_ppcTimings.tileGenReplay);
+
+  // Writes for the rest of the frame go into the next one
+  m_earlySynced = true;
+  earlyRenderSignal->Post();
 }
 
 void CModel3::RenderFrame(void)
 {
-  UINT32 start = CThread::GetTicks();
+  Trace::Scope scope("RenderFrame");
+  UINT64 start = CThread::GetMicroseconds();
 
-  // Call OSD video callbacks
-  if (BeginFrameVideo() && gpusReady)
+  // Call host video callbacks
+  if ((NULL == Host || Host->BeginFrameVideo()) && gpusReady)
   {
     // Render frame
     TileGen.BeginFrame();
     GPU.BeginFrame();
+    if (TileGen.StartPreRenderFrame())
+      GPU.BuildFrame();   // while the 2D layers are drawn
     TileGen.PreRenderFrame();
     TileGen.RenderFrameBottom();
     GPU.RenderFrame();
     TileGen.RenderFrameTop();
     GPU.EndFrame();
     TileGen.EndFrame();
+    timings.renderAllocs = GPU.GetFrameAllocations();
+    timings.modelsCached = GPU.GetFrameModelsCached();
+    timings.renderPollMicros = m_syncedPollMicros;
   }
 
-  EndFrameVideo();
+  if (NULL != Host)
+    Host->EndFrameVideo();
 
-  timings.renderTicks = CThread::GetTicks() - start;
+  timings.renderMicros = CThread::GetMicroseconds() - start;
 }
 
 bool CModel3::RunSoundBoardFrame(void)
 {
-  UINT32 start = CThread::GetTicks();
-  bool bufferFull = SoundBoard.RunFrame();
-  timings.sndTicks = CThread::GetTicks() - start;
+  Trace::Scope scope("RunSoundBoardFrame");
+  UINT64 start = CThread::GetMicroseconds();
+  UINT64 idleStart = SoundBoard.GetIdleCycles();
+  bool bufferFull;
+  if (m_fastForwardInterval > 0 || m_turboBootFrames > 0)
+  {
+    // Audio is dropped, with the buffer taken to be full so that a sound
+    // board thread not in sync waits for the next audio callback
+    SoundBoard.RunFrame(false);
+    bufferFull = true;
+  }
+  else
+    bufferFull = SoundBoard.RunFrame();
+  m_sndTimings.micros.store(CThread::GetMicroseconds() - start, std::memory_order_relaxed);
+  m_sndTimings.idleCycles.store((UINT32)(SoundBoard.GetIdleCycles() - idleStart), std::memory_order_relaxed);
   return bufferFull;
 }
 
 void CModel3::RunDriveBoardFrame(void)
 {
-  UINT32 start = CThread::GetTicks();
+  Trace::Scope scope("RunDriveBoardFrame");
+  UINT64 start = CThread::GetMicroseconds();
+  UINT64 idleStart = DriveBoard->GetIdleCycles();
   DriveBoard->RunFrame();
-  timings.drvTicks = CThread::GetTicks() - start;
+  m_drvTimings.micros.store(CThread::GetMicroseconds() - start, std::memory_order_relaxed);
+  m_drvTimings.idleCycles.store((UINT32)(DriveBoard->GetIdleCycles() - idleStart), std::memory_order_relaxed);
 }
 
 #ifdef NET_BOARD
 void CModel3::RunNetBoardFrame(void)
 {
+  Trace::Scope scope("RunNetBoardFrame");
+  UINT64 start = CThread::GetMicroseconds();
   NetBoard->RunFrame();
+  timings.netMicros = CThread::GetMicroseconds() - start;
+  timings.netWaitMicros = NetBoard->GetWaitMicros();
 }
 #endif
 
+void CModel3::ApplyThreadSettings(const char *name, const char *coreSetting)
+{
+  static const char *priorityNames[] = { "normal", "high", "realtime" };
+
+  Trace::SetThreadName(name);
+
+  // Negative core numbers leave the thread to the O/S scheduler
+  int core = m_config[coreSetting].ValueAsDefault<int>(-1);
+  bool pinned = core >= 0 && CThread::SetCurrentThreadCore(unsigned(core));
+
+  std::string priorityName = m_config["ThreadPriority"].ValueAsDefault<std::string>("normal");
+  CThread::Priority priority = CThread::PRIORITY_NORMAL;
+  if (priorityName == "high")
+    priority = CThread::PRIORITY_HIGH;
+  else if (priorityName == "realtime")
+    priority = CThread::PRIORITY_REALTIME;
+  else if (priorityName != "normal")
+    ErrorLog("Unknown thread priority '%s'. Using normal priority.", priorityName.c_str());
+  CThread::Priority applied = priority == CThread::PRIORITY_NORMAL ? priority : CThread::SetCurrentThreadPriority(priority);
+
+  if (core >= 0 && !pinned)
+    ErrorLog("Unable to run %s thread on core %d.", name, core);
+  if (pinned)
+    InfoLog("%s thread: core %d, %s priority%s.", name, core, priorityNames[applied], applied != priority ? " (requested priority not permitted)" : "");
+  else
+    InfoLog("%s thread: any core, %s priority%s.", name, priorityNames[applied], applied != priority ? " (requested priority not permitted)" : "");
+}
+
 bool CModel3::StartThreads(void)
 {
   if (startedThreads)
     return true;
 
-  // Create synchronization objects
-  if (m_gpuMultiThreaded)
-  {
-    ppcBrdThreadSync = CThread::CreateSemaphore(0);
-    if (ppcBrdThreadSync == NULL)
-      goto ThreadError;
-  }
-  sndBrdThreadSync = CThread::CreateSemaphore(0);
-  if (sndBrdThreadSync == NULL)
+  // This thread renders
+  ApplyThreadSettings("Render", "RenderThreadCore");
+
+  // Create synchronization objects. The frame barriers are shared by this
+  // thread and each thread that runs in step with it.
+  unsigned syncdThreads;
+  syncdThreads = 1 + (m_gpuMultiThreaded ? 1 : 0) + (syncSndBrdThread ? 1 : 0) + (DriveBoard->IsAttached() ? 1 : 0);
+  frameStartBarrier = CThread::CreateFrameBarrier(syncdThreads);
+  if (frameStartBarrier == NULL)
+    goto ThreadError;
+  frameEndBarrier = CThread::CreateFrameBarrier(syncdThreads);
+  if (frameEndBarrier == NULL)
     goto ThreadError;
   sndBrdNotifyLock = CThread::CreateMutex();
   if (sndBrdNotifyLock == NULL)
@@ -2204,18 +2829,15 @@ bool CModel3::StartThreads(void)
   sndBrdNotifySync = CThread::CreateCondVar();
   if (sndBrdNotifySync == NULL)
     goto ThreadError;
-  if (DriveBoard->IsAttached())
-  {
-    drvBrdThreadSync = CThread::CreateSemaphore(0);
-    if (drvBrdThreadSync == NULL)
-      goto ThreadError;
-  }
   notifyLock = CThread::CreateMutex();
   if (notifyLock == NULL)
     goto ThreadError;
   notifySync = CThread::CreateCondVar();
   if (notifySync == NULL)
     goto ThreadError;
+  earlyRenderSignal = CThread::CreateSemaphore(0);
+  if (earlyRenderSignal == NULL)
+    goto ThreadError;
 
   // Reset thread flags
   pauseThreads = false;
@@ -2245,11 +2867,13 @@ bool CModel3::StartThreads(void)
       goto ThreadError;
   }
 
-  // Set audio callback if sound board thread is unsync'd
-  if (!syncSndBrdThread)
-  {
-    SetAudioCallback(AudioCallback, this);
-  }
+  // Queue MIDI commands for the sound board thread, so that the main board
+  // never passes them on while it is running. Set audio callback if sound
+  // board thread is unsync'd, which can then run ahead of or behind the main
+  // board.
+  SoundBoard.SetMIDIQueue(true, syncSndBrdThread);
+  if (!syncSndBrdThread && NULL != Host)
+    Host->SetAudioCallback(AudioCallback, this);
 
   startedThreads = true;
   return true;
@@ -2271,8 +2895,9 @@ bool CModel3::PauseThreads(void)
     goto ThreadError;
 
   // Let threads know that they should pause and wait for all of them to do so
+  // (threads in step with this one are already waiting for the next frame)
   pauseThreads = true;
-  while (ppcBrdThreadRunning || sndBrdThreadRunning || drvBrdThreadRunning)
+  while (sndBrdThreadRunning)
   {
     if (!notifySync->Wait(notifyLock))
       goto ThreadError;
@@ -2318,16 +2943,17 @@ bool CModel3::StopThreads(void)
     return true;
 
   // If sound board thread is unsync'd then remove audio callback
-  if (!syncSndBrdThread)
-    SetAudioCallback(NULL, NULL);
+  if (!syncSndBrdThread && NULL != Host)
+    Host->SetAudioCallback(NULL, NULL);
 
   // Enter notify critical section
   if (!notifyLock->Lock())
     goto ThreadError;
 
   // Let threads know that they should pause and wait for all of them to do so
+  // (threads in step with this one are already waiting for the next frame)
   pauseThreads = true;
-  while (ppcBrdThreadRunning || sndBrdThreadRunning || drvBrdThreadRunning)
+  while (sndBrdThreadRunning)
   {
     if (!notifySync->Wait(notifyLock))
       goto ThreadError;
@@ -2340,30 +2966,23 @@ bool CModel3::StopThreads(void)
   if (!notifyLock->Unlock())
     goto ThreadError;
 
-  // Resume each thread in turn and wait for them to exit
-  if (ppcBrdThread != NULL)
+  // Release the threads in step with this one, and wake the unsync'd sound
+  // board thread, then wait for them all to exit
+  if (frameStartBarrier->Wait())
   {
-    if (ppcBrdThreadSync->Post())
+    if (ppcBrdThread != NULL)
       ppcBrdThread->Wait();
+    if (sndBrdThread != NULL && syncSndBrdThread)
+      sndBrdThread->Wait();
+    if (drvBrdThread != NULL)
+      drvBrdThread->Wait();
   }
-  if (sndBrdThread != NULL)
-  {
-    if (syncSndBrdThread)
-    {
-      if (sndBrdThreadSync->Post())
-        sndBrdThread->Wait();
-    }
-    else
-    {
-      if (WakeSoundBoardThread())
-        sndBrdThread->Wait();
-    }
-  }
-  if (drvBrdThread != NULL)
+  if (sndBrdThread != NULL && !syncSndBrdThread)
   {
-    if (drvBrdThreadSync->Post())
-      drvBrdThread->Wait();
+    if (WakeSoundBoardThread())
+      sndBrdThread->Wait();
   }
+  SoundBoard.SetMIDIQueue(false);
 
   // Delete all thread and synchronization objects
   DeleteThreadObjects();
@@ -2397,20 +3016,20 @@ void CModel3::DeleteThreadObjects(void)
 
 
   // Delete synchronization objects
-  if (ppcBrdThreadSync != NULL)
+  if (frameStartBarrier != NULL)
   {
-    delete ppcBrdThreadSync;
-    ppcBrdThreadSync = NULL;
+    delete frameStartBarrier;
+    frameStartBarrier = NULL;
   }
-  if (sndBrdThreadSync != NULL)
+  if (frameEndBarrier != NULL)
   {
-    delete sndBrdThreadSync;
-    sndBrdThreadSync = NULL;
+    delete frameEndBarrier;
+    frameEndBarrier = NULL;
   }
-  if (drvBrdThreadSync != NULL)
+  if (earlyRenderSignal != NULL)
   {
-    delete drvBrdThreadSync;
-    drvBrdThreadSync = NULL;
+    delete earlyRenderSignal;
+    earlyRenderSignal = NULL;
   }
 
 
@@ -2438,14 +3057,44 @@ void CModel3::DeleteThreadObjects(void)
 
 void CModel3::DumpTimings(void)
 {
-  printf("PPC:%3ums%c render:%3ums%c sync:%4uK%c%3ums%c snd:%3ums%c drv:%3ums%c frame:%3ums%c\n",
-    timings.ppcTicks, (timings.ppcTicks > timings.renderTicks ? '!' : ','),
-    timings.renderTicks, (timings.renderTicks > timings.ppcTicks ? '!' : ','),
+  printf("PPC:%5.2fms%c idle:%5uK, render:%5.2fms%c allocs:%4u%c sync:%4uK%c%5.2fms%c replay:%4uK, snd:%5.2fms%c idle:%4uK, drv:%5.2fms%c idle:%4uK, frame:%5.2fms%c\n",
+    timings.ppcMicros / 1000.0, (timings.ppcMicros > timings.renderMicros ? '!' : ','),
+    timings.ppcIdleCycles / 1000,
+    timings.renderMicros / 1000.0, (timings.renderMicros > timings.ppcMicros ? '!' : ','),
+    timings.renderAllocs, (timings.renderAllocs > 0 ? '!' : ','),
     timings.syncSize / 1024, (timings.syncSize / 1024 > 128 ? '!' : ','),
-    timings.syncTicks, (timings.syncTicks > 1 ? '!' : ','),
-    timings.sndTicks, (timings.sndTicks > 10 ? '!' : ','),
-    timings.drvTicks, (timings.drvTicks > 10 ? '!' : ','),
-    timings.frameTicks, (timings.frameTicks > 16 ? '!' : ' '));
+    timings.syncMicros / 1000.0, (timings.syncMicros > 1000 ? '!' : ','),
+    timings.replaySize / 1024,
+    timings.sndMicros / 1000.0, (timings.sndMicros > 10000 ? '!' : ','),
+    timings.sndIdleCycles / 1000,
+    timings.drvMicros / 1000.0, (timings.drvMicros > 10000 ? '!' : ','),
+    timings.drvIdleCycles / 1000,
+    timings.frameMicros / 1000.0, (timings.frameMicros > 16667 ? '!' : ' '));
+  printf("  replayed - cullLo:%4uK, cullHi:%4uK, poly:%4uK, vram:%4uK, pal:%4uK\n",
+    timings.real3DReplay.cullingRAMLo / 1024, timings.real3DReplay.cullingRAMHi / 1024,
+    timings.real3DReplay.polyRAM / 1024,
+    timings.tileGenReplay.vram / 1024, timings.tileGenReplay.palettes / 1024);
+  printf("  frame sync wait - main:%6uus, ppc:%6uus, snd:%6uus, drv:%6uus\n",
+    timings.mainWaitMicros, timings.ppcWaitMicros, timings.sndWaitMicros, timings.drvWaitMicros);
+#ifdef NET_BOARD
+  printf("  net:%5.2fms, waiting for messages:%5.2fms\n", timings.netMicros / 1000.0, timings.netWaitMicros / 1000.0);
+#endif
+}
+
+void CModel3::AddFrameStats(void)
+{
+  AudioStats audioStats = {};
+  if (NULL != Host)
+    Host->GetAudioStats(&audioStats);
+  timings.audioUnderRuns = audioStats.underRuns - m_audioUnderRuns;
+  m_audioUnderRuns = audioStats.underRuns;
+  timings.textureUploads = GPU.GetTextureUploads();
+  m_frameStats.Add(timings);
+}
+
+void CModel3::LogFrameStats(void)
+{
+  m_frameStats.Log();
 }
 
 FrameTimings CModel3::GetTimings(void)
@@ -2453,6 +3102,33 @@ FrameTimings CModel3::GetTimings(void)
   return timings;
 }
 
+void CModel3::DumpExecTraces(void)
+{
+  std::string prefix = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << m_game.name << "_";
+  if (m_ppcTrace)
+  {
+    ppc_set_context(ppcContext);
+    ppc_dump_trace((prefix + m_ppcTrace->GetName() + "_trace.txt").c_str());
+  }
+  if (m_soundTrace)
+    M68KDumpExecTrace(SoundBoard.GetM68K(), prefix + m_soundTrace->GetName() + "_trace.txt");
+}
+
+void CModel3::GetMemoryHashes(UINT32 *ramHash, UINT32 *real3DHash, UINT32 *vramHash)
+{
+  *ramHash = UINT32(crc32(0, ram, 0x800000));
+  *real3DHash = GPU.GetMemoryHash();
+  *vramHash = TileGen.GetMemoryHash();
+}
+
+#ifdef PPC_PROFILE
+bool CModel3::DumpPPCProfile(const char *file)
+{
+  ppc_set_context(ppcContext);
+  return ppc_profile_dump(file);
+}
+#endif
+
 int CModel3::StartMainBoardThread(void *data)
 {
   // Call method on CModel3 to run PPC main board thread
@@ -2483,52 +3159,33 @@ int CModel3::StartDriveBoardThread(void *data)
 
 int CModel3::RunMainBoardThread(void)
 {
+  ApplyThreadSettings("MainBoard", "PPCThreadCore");
   for (;;)
   {
-    bool wait = true;
-    bool exit = false;
-    while (wait && !exit)
-    {
-      // Wait on PPC main board thread semaphore
-      if (!ppcBrdThreadSync->Wait())
-        goto ThreadError;
-
-      // Enter notify critical section
-      if (!notifyLock->Lock())
-        goto ThreadError;
+    // Wait for the render thread to start a frame
+    if (!frameStartBarrier->Wait())
+      goto ThreadError;
+    if (stopThreads)
+      return 0;
 
-      // Check threads are not being stopped or paused
-      if (stopThreads)
-        exit = true;
-      else if (!pauseThreads)
-      {
-        wait = false;
-        ppcBrdThreadRunning = true;
-      }
+    // Process a single frame for PPC main board (unless paused)
+    if (!pauseThreads)
+      RunMainBoardFrame();
 
-      // Leave notify critical section
-      if (!notifyLock->Unlock())
+    // Let the render thread waiting to render early know that the game did
+    // not flush the Real3D this frame
+    if (m_earlySyncPending)
+    {
+      m_earlySyncPending = false;
+      if (!earlyRenderSignal->Post())
         goto ThreadError;
     }
-    if (exit)
-      return 0;
 
-    // Process a single frame for PPC main board
-    RunMainBoardFrame();
-
-    // Enter notify critical section
-    if (!notifyLock->Lock())
-      goto ThreadError;
-
-    // Let other threads know processing has finished
-    ppcBrdThreadRunning = false;
-    ppcBrdThreadDone = true;
-    if (!notifySync->SignalAll())
-      goto ThreadError;
-
-    // Leave notify critical section
-    if (!notifyLock->Unlock())
+    // Let the render thread know processing has finished
+    UINT32 waitMicros;
+    if (!frameEndBarrier->Wait(&waitMicros))
       goto ThreadError;
+    m_ppcTimings.waitMicros.store(waitMicros, std::memory_order_relaxed);
   }
 
 ThreadError:
@@ -2584,6 +3241,7 @@ ThreadError:
 
 int CModel3::RunSoundBoardThread(void)
 {
+  ApplyThreadSettings("SoundBoard", "SoundThreadCore");
   for (;;)
   {
     bool wait = true;
@@ -2629,18 +3287,9 @@ int CModel3::RunSoundBoardThread(void)
     // Keep processing frames until pausing or audio buffer is full
     while (true)
     {
-      // Enter main notify critical section
-      bool paused;
-      if (!notifyLock->Lock())
-        goto ThreadError;
-
-      paused = pauseThreads;
-
-      // Leave main notify critical section
-      if (!notifyLock->Unlock())
-        goto ThreadError;
-
-      if (paused || RunSoundBoardFrame())
+      // Polled without taking the notify lock, which is only needed to
+      // let PauseThreads() know this thread has stopped running
+      if (pauseThreads.load(std::memory_order_acquire) || RunSoundBoardFrame())
         break;
       //printf("Rerunning sound board\n");
     }
@@ -2651,7 +3300,6 @@ int CModel3::RunSoundBoardThread(void)
 
     // Let other threads know processing has finished
     sndBrdThreadRunning = false;
-    sndBrdThreadDone = true;
     if (!notifySync->SignalAll())
       goto ThreadError;
 
@@ -2668,52 +3316,24 @@ ThreadError:
 
 int CModel3::RunSoundBoardThreadSyncd(void)
 {
+  ApplyThreadSettings("SoundBoard", "SoundThreadCore");
   for (;;)
   {
-    bool wait = true;
-    bool exit = false;
-    while (wait && !exit)
-    {
-      // Wait on sound board thread semaphore
-      if (!sndBrdThreadSync->Wait())
-        goto ThreadError;
-
-      // Enter notify critical section
-      if (!notifyLock->Lock())
-        goto ThreadError;
-
-      // Check threads are not being stopped or paused
-      if (stopThreads)
-        exit = true;
-      else if (!pauseThreads)
-      {
-        wait = false;
-        sndBrdThreadRunning = true;
-      }
-
-      // Leave notify critical section
-      if (!notifyLock->Unlock())
-        goto ThreadError;
-    }
-    if (exit)
+    // Wait for the render thread to start a frame
+    if (!frameStartBarrier->Wait())
+      goto ThreadError;
+    if (stopThreads)
       return 0;
 
-    // Process a single frame for sound board
-    RunSoundBoardFrame();
+    // Process a single frame for sound board (unless paused)
+    if (!pauseThreads)
+      RunSoundBoardFrame();
 
-    // Enter notify critical section
-    if (!notifyLock->Lock())
-      goto ThreadError;
-
-    // Let other threads know processing has finished
-    sndBrdThreadRunning = false;
-    sndBrdThreadDone = true;
-    if (!notifySync->SignalAll())
-      goto ThreadError;
-
-    // Leave notify critical section
-    if (!notifyLock->Unlock())
+    // Let the render thread know processing has finished
+    UINT32 waitMicros;
+    if (!frameEndBarrier->Wait(&waitMicros))
       goto ThreadError;
+    m_sndTimings.waitMicros.store(waitMicros, std::memory_order_relaxed);
   }
 
 ThreadError:
@@ -2724,52 +3344,24 @@ ThreadError:
 
 int CModel3::RunDriveBoardThread(void)
 {
+  ApplyThreadSettings("DriveBoard", "DriveThreadCore");
   for (;;)
   {
-    bool wait = true;
-    bool exit = false;
-    while (wait && !exit)
-    {
-      // Wait on drive board thread semaphore
-      if (!drvBrdThreadSync->Wait())
-        goto ThreadError;
-
-      // Enter notify critical section
-      if (!notifyLock->Lock())
-        goto ThreadError;
-
-      // Check threads are not being stopped or paused
-      if (stopThreads)
-        exit = true;
-      else if (!pauseThreads)
-      {
-        wait = false;
-        drvBrdThreadRunning = true;
-      }
-
-      // Leave notify critical section
-      if (!notifyLock->Unlock())
-        goto ThreadError;
-    }
-    if (exit)
-      return 0;
-
-    // Process a single frame for drive board
-    RunDriveBoardFrame();
-
-    // Enter notify critical section
-    if (!notifyLock->Lock())
+    // Wait for the render thread to start a frame
+    if (!frameStartBarrier->Wait())
       goto ThreadError;
+    if (stopThreads)
+      return 0;
 
-    // Let other threads know processing has finished
-    drvBrdThreadRunning = false;
-    drvBrdThreadDone = true;
-    if (!notifySync->SignalAll())
-      goto ThreadError;
+    // Process a single frame for drive board (unless paused)
+    if (!pauseThreads)
+      RunDriveBoardFrame();
 
-    // Leave notify critical section
-    if (!notifyLock->Unlock())
+    // Let the render thread know processing has finished
+    UINT32 waitMicros;
+    if (!frameEndBarrier->Wait(&waitMicros))
       goto ThreadError;
+    m_drvTimings.waitMicros.store(waitMicros, std::memory_order_relaxed);
   }
 
 ThreadError:
@@ -2780,8 +3372,11 @@ ThreadError:
 
 void CModel3::Reset(void)
 {
+  ppc_set_context(ppcContext);
+
   // Clear memory (but do not modify backup RAM!)
   memset(ram, 0, 0x800000);
+  m_rewindCompareAll = true;
 
   // Initial bank is bank 0
   SetCROMBank(0xFF);
@@ -2798,9 +3393,12 @@ void CModel3::Reset(void)
 
   // MIDI
   midiCtrlPort = 0;
+  midiIRQCount = 0;
 
   // Reset all devices
+  Scheduler.Clear();
   ppc_reset();
+  m_ppcTraceDumped = false;
   IRQ.Reset();
   PCIBridge.Reset();
   PCIBus.Reset();
@@ -2816,21 +3414,41 @@ void CModel3::Reset(void)
     DriveBoard->Reset();
 
   m_cryptoDevice.Reset();
+  StartTurboBoot();
 
   gpusReady = false;
 
-  timings.ppcTicks = 0;
+  timings.ppcMicros = 0;
+  timings.securityMicros = 0;
   timings.syncSize = 0;
-  timings.syncTicks = 0;
-  timings.renderTicks = 0;
-  timings.sndTicks = 0;
-  timings.drvTicks = 0;
+  timings.replaySize = 0;
+  timings.real3DReplay = Real3DSnapshotStats();
+  timings.tileGenReplay = TileGenSnapshotStats();
+  timings.syncMicros = 0;
+  timings.renderMicros = 0;
+  timings.renderAllocs = 0;
+  timings.modelsCached = 0;
+  timings.textureUploads = 0;
+  timings.sndMicros = 0;
+  timings.drvMicros = 0;
+  timings.ppcIdleCycles = 0;
+  timings.sndIdleCycles = 0;
+  timings.drvIdleCycles = 0;
+  timings.audioUnderRuns = 0;
 #ifdef NET_BOARD
-  timings.netTicks = 0;
+  timings.netMicros = 0;
+  timings.netWaitMicros = 0;
+  timings.rollbackFrames = 0;
+  timings.rollbackMicros = 0;
+  for (auto &frame : m_rollback)
+    frame.valid = false;
   NetBoard->Reset();
 #endif
-  timings.frameTicks = 0;
+  timings.frameMicros = 0;
   timings.frameId = 0;
+  m_ppcTimings.Clear();
+  m_sndTimings.Clear();
+  m_drvTimings.Clear();
   
   DebugLog("Model 3 reset\n");
 }
@@ -2845,11 +3463,9 @@ const Game &CModel3::GetGame() const
   return m_game;
 }
 
-// Stepping-dependent parameters (MPC10x type, etc.) are initialized here
-bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
+// Copies ROM regions into the memory pool in the layout the hardware expects
+bool CModel3::DecodeROMs(const ROMSet &rom_set)
 {
-  m_game = Game();
-
   /*
    * Copy in ROM data with mirroring as necessary for the following cases:
    *
@@ -2889,10 +3505,44 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
   rom_set.get_rom("mpeg_music").CopyTo(mpegROM, 16*0x100000);
   rom_set.get_rom("driveboard_program").CopyTo(driveROM, 64*1024);
 
-  // Convert PowerPC and 68K ROMs to little endian words
+  // Convert PowerPC ROMs to host-order words (see BYTE_LANE_XOR8) and 68K
+  // ROMs to little endian words
+#if BYTE_LANE_XOR8 != 0
   Util::FlipEndian32(crom, 8*0x100000 + 128*0x100000);
+#endif
   Util::FlipEndian16(soundROM, 512*1024);
   Util::FlipEndian16(sampleROM, 16*0x100000);
+  return OKAY;
+}
+
+// Stepping-dependent parameters (MPC10x type, etc.) are initialized here
+bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
+{
+  ppc_set_context(ppcContext);
+  m_game = Game();
+
+  /*
+   * Decoded ROMs occupy two contiguous spans of the memory pool, which are
+   * saved to and loaded from the decoded ROM cache as is. The DSB2 program is
+   * byte swapped further below, after caching.
+   */
+  std::vector<ROMCache::Span> romSpans =
+  {
+    { crom, size_t(backupRAM - crom) },         // CROM, banked CROM, VROM
+    { soundROM, size_t(netBuffer - soundROM) }  // sound, sample, DSB, and drive board ROMs
+  };
+  if (rom_set.cached)
+  {
+    if (ROMCache::Load(rom_set.cache_file, rom_set.cache_key, romSpans))
+      return FAIL;
+  }
+  else
+  {
+    if (OKAY != DecodeROMs(rom_set))
+      return FAIL;
+    if (!rom_set.cache_file.empty())
+      ROMCache::Save(rom_set.cache_file, rom_set.cache_key, romSpans);  // not fatal if this fails
+  }
 
   // Configure CPU and PCI bridge
   PPC_CONFIG  ppc_config;
@@ -2946,6 +3596,34 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
   PPCFetchRegions[2].end = 0;
   PPCFetchRegions[2].ptr = NULL;
   ppc_set_fetch(PPCFetchRegions);
+  ppc_map_memory(0x00000000, 0x007FFFFF, ram, true);
+  ppc_map_memory(0xFF800000, 0xFFFFFFFF, crom, false);
+  ppc_map_swapped_memory(0x8C000000, 0x8C3FFFFF, GPU.GetDirectWriteRAM(0x8C));  // Real3D, as in Write32()
+  ppc_map_swapped_memory(0x8E000000, 0x8E0FFFFF, GPU.GetDirectWriteRAM(0x8E));
+  ppc_map_swapped_memory(0x98000000, 0x983FFFFF, GPU.GetDirectWriteRAM(0x98));
+  SetCROMBank(cromBankReg);
+  if (m_config["PowerPCRecompiler"].ValueAs<bool>() && !(m_ppcTrace && m_ppcTrace->BranchesOnly()))
+    ppc_set_exec_mode(PPC_EXEC_RECOMPILER);   // branch traces are recorded by the block cache instead
+  else if (m_config["PowerPCBlockCache"].ValueAs<bool>())
+    ppc_set_exec_mode(PPC_EXEC_BLOCK_CACHE);
+  else
+    ppc_set_exec_mode(PPC_EXEC_INTERPRETER);
+  ppc_set_idle_skip(m_config["PowerPCIdleSkip"].ValueAs<bool>() && game.idle_skip);
+  ppc_clear_hle_routines();
+  for (auto &routine: game.hle_routines)
+  {
+    static const std::map<std::string, PPC_HLE_TYPE> types
+    {
+      { "memcpy",   PPC_HLE_MEMCPY },
+      { "memset",   PPC_HLE_MEMSET },
+      { "memcpy32", PPC_HLE_MEMCPY32 },
+      { "memset32", PPC_HLE_MEMSET32 },
+      { "selftest", PPC_HLE_SELFTEST }
+    };
+    if (routine.enabled && OKAY != ppc_add_hle_routine(routine.name.c_str(), types.at(routine.type), routine.words.data(), routine.masks.data(), UINT32(routine.words.size()), routine.cycles_per_word, routine.result))
+      ErrorLog("Unable to add PowerPC HLE routine '%s'.", routine.name.c_str());
+  }
+  ppc_set_hle(m_config["PowerPCHLE"].ValueAs<bool>(), m_config["PowerPCHLEValidate"].ValueAs<bool>());
 
   // Initialize Real3D
   int stepping = ((game.stepping[0] - '0') << 4) | (game.stepping[2] - '0');
@@ -3054,6 +3732,13 @@ bool CModel3::LoadGame(const Game &game, const ROMSet &rom_set)
   }
 
   m_runNetBoard = m_game.stepping != "1.0" && NetBoard->IsAttached();
+
+  // States are kept for rolling back as far as the net board may need to,
+  // which it only does when simulated and all in this thread
+  unsigned rollbackFrames = (std::min)(m_config["NetRollback"].ValueAsDefault<unsigned>(0), CSimNetBoard::MaxRollbackFrames);
+  m_rollback.clear();
+  if (rollbackFrames > 0 && m_config["SimulateNet"].ValueAs<bool>() && !m_multiThreaded && m_runAheadFrames == 0)
+    m_rollback.resize(rollbackFrames + 1);
 #endif
   return OKAY;
 }
@@ -3086,6 +3771,12 @@ void CModel3::AttachOutputs(COutputs *OutputsPtr)
   DebugLog("Model 3 attached outputs\n");
 }
 
+void CModel3::AttachHost(IEmulatorHost *HostPtr)
+{
+  Host = HostPtr;
+  SoundBoard.AttachHost(HostPtr);
+}
+
 const static int RAM_SIZE			= 0x800000;		//8MB
 const static int CROM_SIZE			= 0x800000;		//8MB
 const static int CROMxx_SIZE		= 0x8000000;	//128MB
@@ -3122,16 +3813,65 @@ const static int DRIVEROM_OFFSET	= DSBMPEGROM_OFFSET + DSBMPEGROM_SIZE;
 const static int NETBUFFER_OFFSET	= DRIVEROM_OFFSET + DRIVEROM_SIZE;
 const static int NETRAM_OFFSET		= NETBUFFER_OFFSET + NETBUFFER_SIZE;
 
+// Logs the size of each memory region, for working out how many instances fit on a host
+void CModel3::LogMemory(void)
+{
+  bool gpuLargePages;
+  size_t gpuSize = GPU.GetMemorySize(&gpuLargePages);
+  const char *large = m_largePages ? " (large pages)" : "";
+  const struct
+  {
+    const char *name;
+    size_t size;
+    const char *note;
+  } regions[] =
+  {
+    { "PowerPC RAM",          RAM_SIZE,               large },
+    { "CROM",                 CROM_SIZE,              large },
+    { "Banked CROM",          CROMxx_SIZE,            large },
+    { "VROM",                 VROM_SIZE,              large },
+    { "Backup RAM",           BACKUPRAM_SIZE,         large },
+    { "Security RAM",         SECURITYRAM_SIZE,       large },
+    { "Sound ROM",            SOUNDROM_SIZE,          large },
+    { "Sample ROM",           SAMPLEROM_SIZE,         large },
+    { "DSB program ROM",      DSBPROGROM_SIZE,        large },
+    { "DSB MPEG ROM",         DSBMPEGROM_SIZE,        large },
+    { "Drive board ROM",      DRIVEROM_SIZE,          large },
+    { "Net board buffer",     NETBUFFER_SIZE,         large },
+    { "Net board RAM",        NETRAM_SIZE,            large },
+    { "Real3D memory",        gpuSize,                gpuLargePages ? " (large pages)" : "" },
+    { "Tile generator memory", TileGen.GetMemorySize(), "" },
+    { "Sound board memory",   SoundBoard.GetMemorySize(), "" }
+  };
+  size_t total = 0;
+  InfoLog("Memory regions:");
+  for (const auto &region : regions)
+  {
+    InfoLog("  %-22s %8.2f MB%s", region.name, double(region.size) / 0x100000, region.note);
+    total += region.size;
+  }
+  InfoLog("  %-22s %8.2f MB", "Total", double(total) / 0x100000);
+}
+
 // Model 3 initialization. Some initialization is deferred until ROMs are loaded in LoadROMSet()
 bool CModel3::Init(void)
 {
   float memSizeMB = (float)MEM_POOL_SIZE / (float)0x100000;
 
-  // Allocate all memory for ROMs and PPC RAM
-  memoryPool = new(std::nothrow) UINT8[MEM_POOL_SIZE];
+  // PowerPC state
+  ppcContext = ppc_create_context();
+  if (NULL == ppcContext)
+    return ErrorLog("Insufficient memory for PowerPC context.");
+  ppc_set_context(ppcContext);
+  ppcCodePages = ppc_get_code_page_map();
+
+  // Allocate all memory for ROMs and PPC RAM, zeroed. Whole pages so that
+  // decoded ROMs can be mapped directly from the cache (see LoadGame()), and
+  // large pages where possible, as the PowerPC and Real3D access RAM and VROM
+  // all over.
+  memoryPool = static_cast<UINT8 *>(PageProtection::AllocateLarge(MEM_POOL_SIZE, &m_largePages));
   if (NULL == memoryPool)
     return ErrorLog("Insufficient memory for Model 3 object (needs %1.1f MB).", memSizeMB);
-  memset(memoryPool, 0, MEM_POOL_SIZE);
 
   // Set up pointers
   ram = &memoryPool[RAM_OFFSET];
@@ -3156,13 +3896,41 @@ bool CModel3::Init(void)
   SCSI.Init(this,&IRQ,0x100); // SCSI is actually a non-maskable interrupt, so we give it a bit number outside of 8-bit range
   RTC.Init();
   EEPROM.Init();
+  m_eepromCheckpoint = EEPROM;
   if (OKAY != TileGen.Init(&IRQ))
     return FAIL;
   if (OKAY != GPU.Init(vrom,this,&IRQ,0x100)) // same for Real3D DMA interrupt
     return FAIL;
+  GPU.AttachRAM(ram, RAM_SIZE);
   if (OKAY != SoundBoard.Init(soundROM,sampleROM))
     return FAIL;
 
+  // Execution traces
+  unsigned traceSize = m_config["ExecTraceSize"].ValueAsDefault<unsigned>(0);
+  if (traceSize > 0)
+  {
+    bool branchesOnly = m_config["ExecTraceBranches"].ValueAsDefault<bool>(false);
+    m_ppcTrace.reset(new CExecTrace("MainPPC", traceSize, branchesOnly));
+    m_soundTrace.reset(new CExecTrace("Snd68K", traceSize, branchesOnly));
+    ppc_attach_trace(m_ppcTrace.get());
+    M68KSetExecTrace(SoundBoard.GetM68K(), m_soundTrace.get());
+  }
+
+  // Rewinding. PPC RAM writes are tracked in pages as large as the PPC maps
+  // memory in, all of them written to begin with.
+  if (m_rewindFrames > 0)
+  {
+    size_t budget = size_t(m_config["RewindMemory"].ValueAsDefault<unsigned>(256)) << 20;
+    m_rewind.Init(budget, m_rewindFrames, m_config["RewindKeyframeInterval"].ValueAsDefault<unsigned>(300));
+    m_ramDirty.Init(0x800000, CDirtyPages::MaxPageSize);
+    m_ramDirty.MarkRange(0, 0x800000);
+  }
+
+  // NVRAM checkpoints. Backup RAM writes are tracked in the smallest pages.
+  m_backupRAMCheckpoint.assign(0x20000, 0);
+  m_backupRAMDirty.Init(0x20000, CDirtyPages::MinPageSize);
+  m_backupRAMDirty.MarkRange(0, 0x20000);
+
   PCIBridge.AttachPCIBus(&PCIBus);
   PCIBus.AttachDevice(13,&GPU);
   PCIBus.AttachDevice(14,&SCSI);
@@ -3175,6 +3943,7 @@ bool CModel3::Init(void)
       NetBoard = new CNetBoard(m_config);
 #endif // NET_BOARD
 
+  LogMemory();
   DebugLog("Initialized Model 3 (allocated %1.1f MB)\n", memSizeMB);
 
   return OKAY;
@@ -3185,6 +3954,11 @@ CSoundBoard *CModel3::GetSoundBoard(void)
   return &SoundBoard;
 }
 
+CRTC72421 *CModel3::GetRTC(void)
+{
+  return &RTC;
+}
+
 CDriveBoard *CModel3::GetDriveBoard(void)
 {
   return DriveBoard;
@@ -3199,19 +3973,52 @@ INetBoard *CModel3::GetNetBoard(void)
 
 CModel3::CModel3(Util::Config::Node &config)
   : m_config(config),
+    m_ppcFrequency(config, "PowerPCFrequency"),
+    m_simulateNet(config, "SimulateNet"),
     m_multiThreaded(config["MultiThreaded"].ValueAs<bool>()),
     m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>()),
+    m_frameQueueDepth((std::min)(config["FrameQueueDepth"].ValueAsDefault<unsigned>(1), 1u)),
+    m_earlyRender(config["EarlyRender"].ValueAsDefault<bool>(false)),
+    m_earlySyncPending(false),
+    m_earlySynced(false),
+    m_runAheadFrames((std::min)(config["RunAheadFrames"].ValueAsDefault<unsigned>(0), 4u)),
+    m_fastForwardInterval(0),
+    m_fastForwardFrame(0),
+    m_turboBootFrames(0),
+    m_syncedLastFrame(true),
+    m_autoFrameSkip(config["AutoFrameSkip"].ValueAsDefault<unsigned>(0)),
+    m_skipWindowFrames(0),
+    m_skipWindowSkips(0),
+    m_skipNextFrame(false),
+    m_latchInputs(config["LatchInputs"].ValueAsDefault<bool>(false)),
+    m_inputsRead(false),
+    m_interpolateAim(config["InterpolateAim"].ValueAsDefault<bool>(false)),
+    m_frameStartCycles(0),
+    m_frameCycles(0),
+    m_framePollMicros(0),
+    m_syncedPollMicros(0),
+    m_gunAimValid(false),
+    m_gunAimCycles(0),
+    m_rewindFrames(config["RewindFrames"].ValueAsDefault<unsigned>(0)),
+    m_rewindCompareAll(true),
+    m_ramStateOffset(0),
     TileGen(config),
     GPU(config),
     SoundBoard(config),
     m_jtag(GPU)
 {
+  memset(&timings, 0, sizeof(timings));
+  m_audioUnderRuns = 0;
+  m_frameStats.Init(UINT64(config["HitchThreshold"].ValueAsDefault<unsigned>(0)) * 1000, config["HitchFrames"].ValueAsDefault<unsigned>(30));
+
   // Initialize pointers so dtor can know whether to free them
   memoryPool = NULL;
+  m_largePages = false;
 
   // Various uninitialized pointers
   Inputs = NULL;
   Outputs = NULL;
+  Host = NULL;
   ram = NULL;
   crom = NULL;
   vrom = NULL;
@@ -3224,6 +4031,10 @@ CModel3::CModel3(Util::Config::Node &config)
   securityRAM = NULL;
   netRAM = NULL;
   netBuffer = NULL;
+  ppcContext = NULL;
+  ppcCodePages = NULL;
+  m_ppcTraceDumped = false;
+  midiIRQCount = 0;
 
   DSB = NULL;
   DriveBoard = NULL;
@@ -3241,20 +4052,15 @@ CModel3::CModel3(Util::Config::Node &config)
   sndBrdThread = NULL;
   drvBrdThread = NULL;
 
-  ppcBrdThreadRunning = false;
-  ppcBrdThreadDone = false;
   sndBrdThreadRunning = false;
-  sndBrdThreadDone = false;
-  drvBrdThreadRunning = false;
-  drvBrdThreadDone = false;
 
   syncSndBrdThread = false;
-  ppcBrdThreadSync = NULL;
-  sndBrdThreadSync = NULL;
-  drvBrdThreadSync = NULL;
+  frameStartBarrier = NULL;
+  frameEndBarrier = NULL;
 
   notifyLock = NULL;
   notifySync = NULL;
+  earlyRenderSignal = NULL;
 
   DebugLog("Built Model 3\n");
 }
@@ -3295,16 +4101,21 @@ CModel3::~CModel3(void)
   // Free memory
   if (memoryPool != NULL)
   {
-    delete [] memoryPool;
+    PageProtection::Free(memoryPool, MEM_POOL_SIZE);
     memoryPool = NULL;
   }
 
   if (DSB != NULL)
   {
+    SoundBoard.AttachDSB(NULL);  // stops the DSB thread
     delete DSB;
     DSB = NULL;
   }
 
+  ppc_destroy_context(ppcContext);
+  ppcContext = NULL;
+  ppcCodePages = NULL;
+
   if (DriveBoard != NULL)
   {
       delete DriveBoard;
@@ -3321,6 +4132,7 @@ CModel3::~CModel3(void)
 
   Inputs = NULL;
   Outputs = NULL;
+  Host = NULL;
   ram = NULL;
   crom = NULL;
   vrom = NULL;
@@ -32,39 +32,25 @@
 #include "53C810.h"
 #include "93C46.h"
 #include "Crypto.h"
+#include "FrameStats.h"
 #include "IEmulator.h"
 #include "JTAG.h"
 #include "MPC10x.h"
 #include "Real3D.h"
+#include "Rewind.h"
 #include "RTC72421.h"
+#include "Scheduler.h"
 #include "SoundBoard.h"
 #include "TileGen.h"
 #include "DriveBoard/DriveBoard.h"
 #include "CPU/PowerPC/ppc.h"
+#include "CPU/ExecTrace.h"
 #ifdef NET_BOARD
 #include "Network/INetBoard.h"
 #endif // NET_BOARD
 #include "Util/NewConfig.h"
-
-/*
- * FrameTimings
- *
- * Timings within a frame, for debugging purposes
- */
-struct FrameTimings
-{
-  UINT32 ppcTicks;
-  UINT32 syncSize;
-  UINT32 syncTicks;
-  UINT32 renderTicks;
-  UINT32 sndTicks;
-  UINT32 drvTicks;
-#ifdef NET_BOARD
-  UINT32 netTicks;
-#endif
-  UINT32 frameTicks;
-  UINT64 frameId;
-};
+#include <atomic>
+#include <memory>
 
 /*
  * CModel3:
@@ -74,8 +60,11 @@ struct FrameTimings
  * Inherits IBus in order to pass the address space handlers to devices that
  * may need them (CPU, DMA, etc.)
  *
- * NOTE: Currently NOT re-entrant due to a non-OOP PowerPC core. Do NOT create
- * create more than one CModel3 object!
+ * Each CModel3 owns its own PowerPC context, which is selected for the calling
+ * thread on entry to the emulation functions.
+ *
+ * NOTE: Currently still NOT re-entrant due to the sound board (SCSP and 68K
+ * cores keep global state). Do NOT create more than one CModel3 object!
  */
 class CModel3: public IEmulator, public IBus, public IPCIDevice
 {
@@ -95,6 +84,7 @@ public:
   void AttachRenderers(CRender2D *Render2DPtr, IRender3D *Render3DPtr);
   void AttachInputs(CInputs *InputsPtr);
   void AttachOutputs(COutputs *OutputsPtr);
+  void AttachHost(IEmulatorHost *HostPtr);
   bool Init(void);
   // For Scripting tweaks
   Util::Config::Node& GetConfig() { return this->m_config; }
@@ -112,6 +102,7 @@ public:
   void Write16(UINT32 addr, UINT16 data);
   void Write32(UINT32 addr, UINT32 data);
   void Write64(UINT32 addr, UINT64 data);
+  bool CopyBlock32(UINT32 dest, UINT32 src, unsigned numWords);
 
   /*
    * LoadGame(game, rom_set):
@@ -138,6 +129,16 @@ public:
    */
   CSoundBoard *GetSoundBoard(void);
 
+  /*
+   * GetRTC(void):
+   *
+   * Returns a reference to the real-time clock.
+   *
+   * Returns:
+   *    Pointer to CRTC72421 object.
+   */
+  CRTC72421 *GetRTC(void);
+
   /*
    * GetDriveBoard(void):
    *
@@ -160,6 +161,70 @@ public:
   INetBoard * GetNetBoard(void);
 #endif
 
+  /*
+   * StepBack(void):
+   *
+   * Returns to the state of the previous frame kept for rewinding and renders
+   * it. Requires rewinding to be enabled (RewindFrames) and multi-threading
+   * to be disabled.
+   *
+   * Returns:
+   *    True if a frame was stepped back, false if none is left.
+   */
+  bool StepBack(void);
+
+  /*
+   * SetFastForward(renderInterval):
+   *
+   * Fast-forwards by rendering only one frame in every renderInterval, with
+   * the GPUs synced just for those frames, and dropping the audio. Frame
+   * limiting is left to the caller.
+   *
+   * Parameters:
+   *    renderInterval  Frames run for each one rendered, or 0 to return to
+   *                    rendering every frame.
+   */
+  void SetFastForward(unsigned renderInterval);
+
+  /*
+   * IsTurboBooting(void):
+   *
+   * Turbo booting (see TurboBoot) runs the boot sequence after each reset
+   * without rendering or audio, with every PowerPC idle loop skipped and the
+   * self-test routines listed for the game passing at once, until the game
+   * reaches its boot PC or the time limit. Frame limiting is left to the
+   * caller.
+   *
+   * Returns:
+   *    True while turbo booting.
+   */
+  bool IsTurboBooting(void) const;
+
+  /*
+   * CheckpointNVRAM(void):
+   *
+   * Copies the backup RAM pages written since the last checkpoint, where they
+   * have changed, and the EEPROM to the NVRAM checkpoint, which
+   * SaveNVRAMCheckpoint() saves. Takes microseconds, so may be called between
+   * any two frames, but not while the emulator threads are running.
+   *
+   * Returns:
+   *    True if NVRAM has changed since the last checkpoint.
+   */
+  bool CheckpointNVRAM(void);
+
+  /*
+   * SaveNVRAMCheckpoint(NVRAM):
+   *
+   * Saves the NVRAM as of the last checkpoint, in the same format as
+   * SaveNVRAM(). May be called from another thread while the emulator runs,
+   * as long as CheckpointNVRAM() is not called until it returns.
+   *
+   * Parameters:
+   *    NVRAM   Block file to save to.
+   */
+  void SaveNVRAMCheckpoint(CBlockFile *NVRAM);
+
   /*
    * DumpTimings(void):
    *
@@ -174,6 +239,46 @@ public:
    */
   FrameTimings GetTimings(void);
 
+  /*
+   * LogFrameStats(void):
+   *
+   * Logs the frame time histograms of the frames run so far.
+   */
+  void LogFrameStats(void);
+
+  /*
+   * DumpExecTraces(void):
+   *
+   * Writes the execution traces of the PowerPC and the sound board 68K, if
+   * enabled by ExecTraceSize, to the log directory. Emulation threads must be
+   * paused.
+   */
+  void DumpExecTraces(void);
+
+  /*
+   * GetMemoryHashes(ramHash, real3DHash, vramHash):
+   *
+   * Gets CRC-32s of PowerPC RAM, Real3D memory and tile generator VRAM, for
+   * comparing runs. Emulation threads must be paused.
+   */
+  void GetMemoryHashes(UINT32 *ramHash, UINT32 *real3DHash, UINT32 *vramHash);
+
+#ifdef PPC_PROFILE
+  /*
+   * DumpPPCProfile(file):
+   *
+   * Writes the PowerPC opcode and hotspot profile collected so far to a
+   * file. Emulation threads must be paused.
+   *
+   * Parameters:
+   *    file    File path.
+   *
+   * Returns:
+   *    OKAY if successful, FAIL if the file could not be written.
+   */
+  bool DumpPPCProfile(const char *file);
+#endif
+
   /*
    * CModel3(config):
    * ~CModel3(void):
@@ -197,6 +302,7 @@ public:
 private:
   // Private member functions
   UINT8     ReadInputs(unsigned reg);
+  UINT16    ReadAimAxis(const CAxisInput *input) const;
   void      WriteInputs(unsigned reg, UINT8 data);
   uint16_t  ReadSecurityRAM(uint32_t addr);
   UINT32    ReadSecurity(unsigned reg);
@@ -204,18 +310,35 @@ private:
   void      SetCROMBank(unsigned idx);
   UINT8     ReadSystemRegister(unsigned reg);
   void      WriteSystemRegister(unsigned reg, UINT8 data);
+  bool      DecodeROMs(const ROMSet &rom_set);        // Copies ROM set into memory pool (see LoadGame)
 
   void RunMainBoardFrame(void);                       // Runs PPC main board for a frame
+  void OnVBlankIRQ(UINT64 frameEnd);                  // Main board frame events (see RunMainBoardFrame)
+  void OnVBlankIRQPoll(UINT64 frameEnd);
+  void OnMIDIIRQ(void);
+  void OnMIDIIRQDeassert(void);
+  void OnVBlankEnd(void);
   void SyncGPUs(void);                                // Sync's up GPUs in preparation for rendering - must be called when PPC is not running
+  void EarlySyncGPUs(void);                           // Syncs them as the game flushes the Real3D, from the PPC main board thread
   bool RunSoundBoardFrame(void);                      // Runs sound board for a frame
   void RunDriveBoardFrame(void);                      // Runs drive board for a frame
+  void RunFrameAhead(void);                           // Runs a frame, then shows the frame m_runAheadFrames later and returns to the first
+  void PushRewindState(void);                         // Adds the state reached by a frame to the rewind buffer
+  void MarkRAMPage(UINT32 addr);                      // Marks a RAM page written for rewinding and lets the PPC write it directly
+  void ResetRAMPages(void);                           // Makes the PPC write the RAM pages marked through the bus again, clearing them
 #ifdef NET_BOARD
   void RunNetBoardFrame(void);						  // Runs net board for a frame
+  void RunFrameRollback(void);                        // Runs a frame, going back to run the frames since again if the net board predicted one wrong
+  void SaveRollbackFrame(void);                       // Saves the state before the net board exchanges the frame, and the frame's inputs
+  void Resimulate(UINT32 frame);                      // Runs the frames since a net board frame again
+  void SaveInputs(std::vector<UINT16> *values);       // Saves the game inputs' values for running the frame again
+  void LoadInputs(const std::vector<UINT16> &values);
 #endif
 
   bool    StartThreads(void);                         // Starts all threads
   bool    StopThreads(void);                          // Stops all threads
   void    DeleteThreadObjects(void);                  // Deletes all threads and synchronization objects
+  void    ApplyThreadSettings(const char *name, const char *coreSetting); // Applies configured core and priority to calling thread
 
   static int StartMainBoardThread(void *data);        // Callback to start PPC main board thread
   static int StartSoundBoardThread(void *data);       // Callback to start sound board thread (unsync'd)
@@ -229,11 +352,64 @@ private:
   int     RunSoundBoardThread(void);                  // Runs sound board thread (not sync'd in step with render thread, ie running at full speed)
   int     RunSoundBoardThreadSyncd(void);             // Runs sound board thread (sync'd in step with render thread)
   int     RunDriveBoardThread(void);                  // Runs drive board thread (sync'd in step with render thread)
+  void    CollectBoardTimings(void);                  // Copies the boards' timings into those of the frame just run
+  void    AddFrameStats(void);                        // Adds the timings of the frame just run to the frame stats
+  void    UpdateFrameSkip(bool rendered);             // Decides whether the next frame is skipped, given the time the last took
+  void    StartTurboBoot(void);                       // Starts turbo booting on reset, if enabled
+  void    EndTurboBoot(const char *reason);           // Returns to running normally
+  void    LogMemory(void);                            // Logs the size of each memory region
 
   // Runtime configuration
   Util::Config::Node &m_config;
+  Util::Config::CachedValue<unsigned> m_ppcFrequency;  // read each frame
+  Util::Config::CachedValue<bool> m_simulateNet;
   bool m_multiThreaded;
   bool m_gpuMultiThreaded;
+  unsigned m_frameQueueDepth; // frames emulated ahead of the one being rendered (0 or 1)
+  bool m_earlyRender;         // without a frame queue, frame rendered from the game's Real3D flush rather than the end of the frame
+  bool m_earlySyncPending;    // GPUs to be synced at the next Real3D flush of this frame
+  bool m_earlySynced;         // they were, so the frame is being rendered
+  unsigned m_runAheadFrames;  // frames run ahead of the real timeline for display (0 to disable)
+  unsigned m_fastForwardInterval; // frames run for each one rendered when fast-forwarding (0 when not)
+  unsigned m_fastForwardFrame;    // frames run since the last one rendered
+  unsigned m_turboBootFrames;     // frames left to turbo boot (0 when not turbo booting)
+  bool m_syncedLastFrame;     // GPUs were synced at the end of the last frame, so it can be rendered
+  unsigned m_autoFrameSkip;   // most frames skipped a second when running over the frame budget (0 to disable)
+  unsigned m_skipWindowFrames; // frames run in the current second
+  unsigned m_skipWindowSkips;  // frames skipped in it
+  bool m_skipNextFrame;       // last frame ran over the frame budget, so the next is not rendered
+  bool m_latchInputs;         // inputs polled again at the game's first read of them each frame
+  bool m_inputsRead;          // game has read the inputs this frame
+  bool m_interpolateAim;      // gun and analog axes estimated at the time the game reads them
+  UINT64 m_frameStartCycles;  // PowerPC cycle count at the start of the frame
+  unsigned m_frameCycles;     // PowerPC cycles in a frame
+  UINT64 m_framePollMicros;   // time the inputs were polled for the frame
+  UINT64 m_syncedPollMicros;  // m_framePollMicros of the frame last synced to the GPUs
+  bool m_gunAimValid;         // m_gunAim holds an estimate made this frame
+  UINT64 m_gunAimCycles;      // PowerPC cycle count it was made at
+  UINT16 m_gunAim[2][2];      // light gun X and Y of each player
+  std::vector<uint8_t> m_runAheadState; // in-memory state that each frame returns to when running ahead
+  unsigned m_rewindFrames;    // frames that can be stepped back (0 to disable rewinding)
+  CRewindBuffer m_rewind;
+  std::vector<uint8_t> m_rewindState;   // state being pushed (reuses the memory of an older one)
+  std::vector<CRewindBuffer::Region> m_rewindRegions;
+  bool m_rewindCompareAll;    // state must be compared in full, having been loaded or reset
+  UINT32 m_ramStateOffset;    // state offset of RAM saved by SaveState()
+  CDirtyPages m_ramDirty;     // 64 KB RAM pages written since the last state was pushed
+  CDirtyPages m_backupRAMDirty;               // backup RAM pages written since the last NVRAM checkpoint
+  std::vector<uint8_t> m_backupRAMCheckpoint; // backup RAM and EEPROM as of the last NVRAM checkpoint
+  C93C46 m_eepromCheckpoint;
+#ifdef NET_BOARD
+  struct RollbackFrame
+  {
+    UINT32 frame = 0;         // net board frame
+    bool valid = false;
+    std::vector<uint8_t> state; // state before the net board exchanged the frame
+    std::vector<UINT16> inputs; // game inputs during the frame
+  };
+  std::vector<RollbackFrame> m_rollback;  // the last NetRollback + 1 frames, or none if not rolling back
+  std::vector<UINT16> m_liveInputs;       // inputs of the frame being run, kept while running frames again
+#endif
 
   // Game and hardware information
   Game m_game;
@@ -242,6 +418,9 @@ private:
   CInputs   *Inputs;
   COutputs  *Outputs;
 
+  // Host program (video frames and audio output)
+  IEmulatorHost *Host;
+
   // Input registers (game controls)
   UINT8   inputBank;
   UINT8   serialFIFO1, serialFIFO2;
@@ -253,6 +432,7 @@ private:
 
   // Emulated core Model 3 memory regions
   UINT8   *memoryPool;  // single allocated region for all ROM and system RAM
+  bool    m_largePages; // memory pool is backed by large pages
   UINT8   *ram;         // 8 MB PowerPC RAM
   UINT8   *crom;        // 8+128 MB CROM (fixed CROM first, then 64MB of banked CROMs -- Daytona2 might need extra?)
   UINT8   *vrom;        // 64 MB VROM (video ROM, visible only to Real3D)
@@ -273,39 +453,69 @@ private:
 
   // Security device
   bool      m_securityFirstRead = true;
+  UINT64    m_securityTicks = 0;  // performance counter ticks spent in the security board this frame
   unsigned  securityPtr;  // pointer to current offset in security data
 
   // PowerPC
+  PPC_CONTEXT       *ppcContext;    // this board's PowerPC
   PPC_FETCH_REGION  PPCFetchRegions[3];
+  CScheduler        Scheduler;      // main board event timeline
+  int               midiIRQCount;   // MIDI interrupts fired during the current VBlank
+  const UINT8       *ppcCodePages;  // RAM pages holding recompiled code (must be invalidated on write)
+  std::unique_ptr<CExecTrace> m_ppcTrace;   // execution traces (if enabled)
+  std::unique_ptr<CExecTrace> m_soundTrace;
+  bool              m_ppcTraceDumped; // PowerPC trace has been written after a fatal error
 
   // Multiple threading
   bool        gpusReady;           // True if GPUs are ready to render
   bool        startedThreads;      // True if threads have been created and started
-  bool        pauseThreads;        // True if threads should pause
-  bool        stopThreads;         // True if threads should stop
   bool        syncSndBrdThread;    // True if sound board thread should be sync'd in step with render thread
   CThread     *ppcBrdThread;       // PPC main board thread
   CThread     *sndBrdThread;       // Sound board thread
   CThread     *drvBrdThread;       // Drive board thread
-  bool        ppcBrdThreadRunning; // Flag to indicate PPC main board thread is currently processing
-  bool        ppcBrdThreadDone;    // Flag to indicate PPC main board thread has finished processing
-  bool        sndBrdThreadRunning; // Flag to indicate sound board thread is currently processing
-  bool        sndBrdThreadDone;    // Flag to indicate sound board thread has finished processing
   bool        sndBrdWakeNotify;    // Flag to indicate that sound board thread has been woken by audio callback (when not sync'd with render thread)
-  bool        drvBrdThreadRunning; // Flag to indicate drive board thread is currently processing
-  bool        drvBrdThreadDone;    // Flag to indicate drive board thread has finished processing
+
+  // Flags shared by all threads, on a cache line of their own. Those in step
+  // with the render thread read them after the frame start barrier, which
+  // orders them, and the sound board thread not in step polls them.
+  alignas(64) std::atomic<bool> pauseThreads;         // True if threads should pause
+  std::atomic<bool> stopThreads;                      // True if threads should stop
+  std::atomic<bool> sndBrdThreadRunning;              // Flag to indicate sound board thread is currently processing (when not sync'd with render thread)
 
   // Thread synchronization objects
-  CSemaphore  *ppcBrdThreadSync;
-  CSemaphore  *sndBrdThreadSync;
+  CFrameBarrier *frameStartBarrier;  // Render thread and threads sync'd in step with it start each frame together
+  CFrameBarrier *frameEndBarrier;    // ...and finish it together
   CMutex      *sndBrdNotifyLock;
   CCondVar    *sndBrdNotifySync;
-  CSemaphore  *drvBrdThreadSync;
   CMutex      *notifyLock;
   CCondVar    *notifySync;
+  CSemaphore  *earlyRenderSignal;  // Posted by the PPC main board thread once the GPUs are synced early or the frame is over
+
+  // Timings of a board for the frame, written by the thread running it. Each
+  // board's are on cache lines of their own, apart from the frame's timings
+  // written by the render thread, and copied into them once the frame is over
+  // (see CollectBoardTimings()).
+  struct alignas(64) BoardTimings
+  {
+    std::atomic<UINT64> micros{0};      // atomic as the sound board thread may not be in step
+    std::atomic<UINT32> idleCycles{0};
+    std::atomic<UINT32> waitMicros{0};  // stored as the thread leaves the frame, so may be the previous frame's when copied
+    UINT64 securityMicros = 0;          // main board only, always in step
+    UINT64 inputAgeMicros = 0;
+    UINT32 replaySize = 0;
+    Real3DSnapshotStats real3DReplay = Real3DSnapshotStats();
+    TileGenSnapshotStats tileGenReplay = TileGenSnapshotStats();
+
+    void Clear(void);
+  };
 
   // Frame timings
   FrameTimings timings;
+  BoardTimings m_ppcTimings;
+  BoardTimings m_sndTimings;
+  BoardTimings m_drvTimings;
+  CFrameStats m_frameStats;   // histograms and hitch detection
+  unsigned    m_audioUnderRuns; // audio under-runs counted by the end of the last frame
 
   // Other devices
   CIRQ        IRQ;            // Model 3 IRQ controller
@@ -34,11 +34,11 @@
 #include "ROMSet.h"
 #include "CPU/Bus.h"
 #include "Model3/IEmulator.h"
+#include "Model3/IEmulatorHost.h"
 #include "Model3/IRQ.h"
 #include "Model3/Real3D.h"
 #include "Model3/TileGen.h"
 #include "OSD/Logger.h"
-#include "OSD/Video.h"
 #include "Util/NewConfig.h"
 
 /*
@@ -78,13 +78,15 @@ public:
 
   void RenderFrame(void) override
   {
-    BeginFrameVideo();
+    if (m_host)
+      m_host->BeginFrameVideo();
     m_tileGen.BeginFrame();
     m_real3D.BeginFrame();
     m_real3D.RenderFrame();
     m_real3D.EndFrame();
     m_tileGen.EndFrame();
-    EndFrameVideo();
+    if (m_host)
+      m_host->EndFrameVideo();
   }
 
   void Reset(void) override
@@ -134,6 +136,11 @@ public:
   {
   }
 
+  void AttachHost(IEmulatorHost *HostPtr) override
+  {
+    m_host = HostPtr;
+  }
+
   bool Init(void) override
   {
     m_vrom.reset(new uint8_t[64*1024*1024], std::default_delete<uint8_t[]>());
@@ -157,6 +164,7 @@ public:
 
   CModel3GraphicsState(const Util::Config::Node &config, const std::string &filePath)
     : m_stateFilePath(filePath),
+      m_host(nullptr),
       m_tileGen(config),
       m_real3D(config)
   {
@@ -168,6 +176,7 @@ public:
 
 private:
   const std::string         m_stateFilePath;
+  IEmulatorHost             *m_host;
   std::shared_ptr<uint8_t>  m_vrom;
   Game                      m_game;
   CIRQ                      m_irq;
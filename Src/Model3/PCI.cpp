@@ -49,20 +49,15 @@
  */
 UINT32 CPCIBus::ReadConfigSpace(unsigned device, unsigned reg, unsigned bits, unsigned offset)
 {
-	unsigned	i;
-	
 	// Alignment check
 #ifdef DEBUG
 	if (((bits==16)&&(offset&1)) || ((bits==32)&&(offset&3)))
 		ErrorLog("Misaligned PCI read request (device=%d,reg=%X,offset=%d)\n", device, reg, offset);
 #endif
 
-	// Search device vector for a matching device
-	for (i = 0; i < DeviceVector.size(); i++)
-	{
-		if (DeviceVector[i].device == device)
-			return DeviceVector[i].DeviceObject->ReadPCIConfigSpace(device, reg, bits, offset);
-	}
+	// Look up the device
+	if (device < NumDeviceNumbers && DeviceTable[device] != NULL)
+		return DeviceTable[device]->ReadPCIConfigSpace(device, reg, bits, offset);
 	
 	DebugLog("PCI read request for unknown device (device=%d,reg=%X)\n", device, reg);
 	return 0;
@@ -76,16 +71,11 @@ UINT32 CPCIBus::ReadConfigSpace(unsigned device, unsigned reg, unsigned bits, un
  */
 void CPCIBus::WriteConfigSpace(unsigned device, unsigned reg, unsigned bits, unsigned offset, UINT32 data)
 {
-	unsigned	i;
-	
-	// Search device vector for a matching device
-	for (i = 0; i < DeviceVector.size(); i++)
+	// Look up the device
+	if (device < NumDeviceNumbers && DeviceTable[device] != NULL)
 	{
-		if (DeviceVector[i].device == device)
-		{
-			DeviceVector[i].DeviceObject->WritePCIConfigSpace(device, reg, bits, offset, data);
-			return;
-		}
+		DeviceTable[device]->WritePCIConfigSpace(device, reg, bits, offset, data);
+		return;
 	}
 	
 //	printf("PCI write request for unknown device (device=%d, reg=%X, data=%X)\n", device, reg, data);
@@ -121,6 +111,10 @@ void CPCIBus::AttachDevice(unsigned device, IPCIDevice *DeviceObjectPtr)
 	D.device = device;
 	D.DeviceObject = DeviceObjectPtr;
 	DeviceVector.push_back(D);
+	if (device < NumDeviceNumbers && DeviceTable[device] == NULL)
+		DeviceTable[device] = DeviceObjectPtr;
+	else
+		DebugLog("PCI device %d is not accessible\n", device);
 	
 	DebugLog("Attached device %d to PCI bus\n", device);
 }
@@ -133,6 +127,8 @@ void CPCIBus::AttachDevice(unsigned device, IPCIDevice *DeviceObjectPtr)
 void CPCIBus::Init(void)
 {
 	DeviceVector.clear();
+	for (unsigned i = 0; i < NumDeviceNumbers; i++)
+		DeviceTable[i] = NULL;
 }
 
 /*
@@ -142,6 +138,8 @@ void CPCIBus::Init(void)
  */
 CPCIBus::CPCIBus(void)
 {	
+	for (unsigned i = 0; i < NumDeviceNumbers; i++)
+		DeviceTable[i] = NULL;
 	DebugLog("Built PCI bus\n");
 }
 
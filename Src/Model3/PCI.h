@@ -183,6 +183,11 @@ private:
 	
 	// An array of device objects
 	std::vector<struct DeviceObjectLink> DeviceVector;
+	
+	// Device objects indexed by device number (the first attached for each),
+	// so that accesses need not search the vector
+	static const unsigned	NumDeviceNumbers = 32;
+	IPCIDevice				*DeviceTable[NumDeviceNumbers];
 };
 
 
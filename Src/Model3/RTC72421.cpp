@@ -33,8 +33,10 @@
 
 #include "RTC72421.h"
 
+#include <cstring>
 #include <ctime>
 #include "Supermodel.h"
+#include "CPU/PowerPC/ppc.h"
 
 
 /******************************************************************************
@@ -43,16 +45,23 @@
 
 UINT8 CRTC72421::ReadRegister(unsigned reg)
 {
-	static time_t oldTime{0};
 	time_t currentTime;
-	static struct tm *Time;
-
-	time(&currentTime);
-	if (currentTime != oldTime)
+	if (m_fixedTime)
+	{
+		int cyclesPerSec = ppc_get_cycles_per_sec();
+		currentTime = time_t(m_seed + int64_t((ppc_total_cycles() - m_seedCycles) / UINT64(cyclesPerSec > 0 ? cyclesPerSec : 1)));
+	}
+	else
+		time(&currentTime);
+	if (currentTime != m_lastTime)
 	{
-		Time = localtime(&currentTime);
-		oldTime = currentTime;
+		// Fixed time must not depend on the host time zone
+		struct tm *t = m_fixedTime ? gmtime(&currentTime) : localtime(&currentTime);
+		if (t != NULL)
+			m_time = *t;
+		m_lastTime = currentTime;
 	}
+	const struct tm *Time = &m_time;
 
 	switch (reg&0xF)
 	{
@@ -103,6 +112,14 @@ void CRTC72421::Reset(void)
 	// nothing to do
 }
 
+void CRTC72421::SetTime(int64_t seed)
+{
+	m_fixedTime = true;
+	m_seed = seed;
+	m_seedCycles = ppc_total_cycles();
+	m_lastTime = time_t(seed) - 1;	// recompute on next read
+}
+
 
 /******************************************************************************
  Initialization and Shutdown
@@ -115,6 +132,7 @@ void CRTC72421::Init(void)
 
 CRTC72421::CRTC72421(void)
 {	
+	memset(&m_time, 0, sizeof(m_time));
 	DebugLog("Built RTC-72421\n");
 }
 
@@ -29,6 +29,8 @@
 #define INCLUDED_RTC72421_H
 
 #include "Types.h"
+#include <cstdint>
+#include <ctime>
 
 /*
  * CRTC72421:
@@ -69,6 +71,19 @@ public:
 	 * RTC is battery-backed and always available.
 	 */
 	void Reset(void);
+
+	/*
+	 * SetTime(int64_t seed):
+	 *
+	 * Fixes the time to start from, in seconds since 1970 (UTC), instead of
+	 * following the host clock. The time then advances with the emulated
+	 * PowerPC cycles, so that the same time is read at the same point of
+	 * emulation on any host (as needed to replay input recordings).
+	 *
+	 * Parameters:
+	 *		seed	Time as of the current PowerPC cycle count.
+	 */
+	void SetTime(int64_t seed);
 	
 	/*
 	 * Init(void):
@@ -86,6 +101,13 @@ public:
 	 */
 	CRTC72421(void);
 	~CRTC72421(void);
+
+private:
+	struct tm	m_time;
+	time_t		m_lastTime = 0;
+	bool		m_fixedTime = false;
+	int64_t		m_seed = 0;
+	UINT64		m_seedCycles = 0;	// PowerPC cycle count when the time was fixed
 };
 
 
@@ -47,14 +47,21 @@
 #include "JTAG.h"
 #include "CPU/PowerPC/ppc.h"
 #include "Util/BMPFile.h"
+#include "Util/ByteSwap.h"
+#include "OSD/PageProtection.h"
+#include "OSD/Thread.h"
 #include <cstring>
 #include <algorithm>
-
-// Macros that divide memory regions into pages and mark them as dirty when they are written to
-#define PAGE_WIDTH 12
-#define PAGE_SIZE (1<<PAGE_WIDTH)
-#define DIRTY_SIZE(arraySize) (1+(arraySize-1)/(8*PAGE_SIZE))
-#define MARK_DIRTY(dirtyArray, addr) dirtyArray[addr>>(PAGE_WIDTH+3)] |= 1<<((addr>>PAGE_WIDTH)&7)
+#include <zlib.h>
+
+// SSE2 and NEON are part of the x64 and AArch64 base instruction sets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REAL3D_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define REAL3D_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
 // Offsets of memory regions within Real3D memory pool
 #define OFFSET_8C           0x0000000 // 4 MB, culling RAM low (at 0x8C000000)
@@ -68,12 +75,7 @@
 #define OFFSET_98_RO        0x1700000 // 4 MB, polygon RAM (at 0x98000000)      [read-only snapshot]
 #define OFFSET_TEXRAM_RO    0x1B00000 // 8 MB, texture RAM                      [read-only snapshot]
 #define MEM_POOL_SIZE_RO    (0x400000+0x100000+0x400000+0x800000)
-#define OFFSET_8C_DIRTY     0x2300000
-#define OFFSET_8E_DIRTY     (OFFSET_8C_DIRTY+DIRTY_SIZE(0x400000))
-#define OFFSET_98_DIRTY     (OFFSET_8E_DIRTY+DIRTY_SIZE(0x100000))
-#define OFFSET_TEXRAM_DIRTY (OFFSET_98_DIRTY+DIRTY_SIZE(0x400000))
-#define MEM_POOL_SIZE_DIRTY (DIRTY_SIZE(MEM_POOL_SIZE_RO))
-#define MEMORY_POOL_SIZE  (MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO+MEM_POOL_SIZE_DIRTY)
+#define MEMORY_POOL_SIZE  (MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO)
 
 static void UpdateRenderConfig(IRender3D *Render3D, uint64_t internalRenderConfig[]);
 
@@ -86,7 +88,15 @@ void CReal3D::SaveState(CBlockFile *SaveState)
 {
   SaveState->NewBlock("Real3D", __FILE__);
 
-  SaveState->Write(memoryPool, MEM_POOL_SIZE_RW); // Don't write out read-only snapshots or dirty page arrays
+  // Don't write out read-only snapshots or dirty page arrays. The regions may
+  // have been exchanged with their snapshots, so write them one at a time.
+  ReplaySnapshots(NULL);
+  m_rewindOffset = SaveState->GetPosition();
+  SaveState->Write(cullingRAMLo, 0x400000);
+  SaveState->Write(cullingRAMHi, 0x100000);
+  SaveState->Write(polyRAM, 0x400000);
+  SaveState->Write(textureRAM, 0x800000);
+  SaveState->Write(textureFIFO, 0x100000);
   SaveState->Write(&fifoIdx, sizeof(fifoIdx));
   SaveState->Write(m_vromTextureFIFO, sizeof(m_vromTextureFIFO));
 
@@ -111,6 +121,17 @@ void CReal3D::SaveState(CBlockFile *SaveState)
   SaveState->Write(&m_vromTextureFIFOIdx, sizeof(m_vromTextureFIFOIdx));
 }
 
+uint32_t CReal3D::GetMemoryHash(void)
+{
+  // As saved: the regions brought up to date and hashed one at a time
+  ReplaySnapshots(NULL);
+  uLong crc = crc32(0, (const Bytef *) cullingRAMLo, 0x400000);
+  crc = crc32(crc, (const Bytef *) cullingRAMHi, 0x100000);
+  crc = crc32(crc, (const Bytef *) polyRAM, 0x400000);
+  crc = crc32(crc, (const Bytef *) textureRAM, 0x800000);
+  return uint32_t(crc);
+}
+
 void CReal3D::LoadState(CBlockFile *SaveState)
 {
   if (OKAY != SaveState->FindBlock("Real3D"))
@@ -119,12 +140,47 @@ void CReal3D::LoadState(CBlockFile *SaveState)
     return;
   }
 
-  SaveState->Read(memoryPool, MEM_POOL_SIZE_RW);
+  SaveState->Read(cullingRAMLo, 0x400000);
+  SaveState->Read(cullingRAMHi, 0x100000);
+  SaveState->Read(polyRAM, 0x400000);
+
+  // Texture memory is compared with what the renderer was last given, so that
+  // only the textures that differ are uploaded again and the rest stay cached.
+  // Multi-threaded, that is its copy once the texels staged for the frame last
+  // synced are in it, less the uploads still queued for it. Those staged since
+  // are superseded by the state.
+  std::vector<QueuedUploadTextures> changed;
+  if (m_trackUploads)
+    SaveState->Read(textureRAM, 0x800000);
+  else if (m_gpuMultiThreaded)
+  {
+    SaveState->Read(textureRAM, 0x800000);
+    CopyStagedTexels(&m_stagingRO);
+    m_staging.Clear();
+    UpdateChangedTextures(textureRAMRO, textureRAM, &changed);
+    changed.insert(changed.end(), queuedUploadTexturesRO.begin(), queuedUploadTexturesRO.end());
+    queuedUploadTexturesRO.clear();
+    queuedUploadTextures.clear();
+  }
+  else
+  {
+    m_loadedTextureRAM.resize(0x800000 / sizeof(uint16_t));
+    SaveState->Read(m_loadedTextureRAM.data(), 0x800000);
+    UpdateChangedTextures(textureRAM, m_loadedTextureRAM.data(), &changed);
+  }
+  SaveState->Read(textureFIFO, 0x100000);
 
   // If multi-threaded, update read-only snapshots too
   if (m_gpuMultiThreaded)
-    UpdateSnapshots(true);
-  Render3D->UploadTextures(0, 0, 0, 2048, 2048);
+    ResetSnapshots();
+  if (m_trackUploads)
+  {
+    changed.swap(m_trackedUploads);
+    m_trackUploads = false;
+  }
+  for (const auto &it : changed)
+    Render3D->UploadTextures(it.level, it.x, it.y, it.width, it.height);
+  m_textureUploads += uint32_t(changed.size());
   SaveState->Read(&fifoIdx, sizeof(fifoIdx));
   SaveState->Read(&m_vromTextureFIFO, sizeof(m_vromTextureFIFO));
 
@@ -149,6 +205,72 @@ void CReal3D::LoadState(CBlockFile *SaveState)
   SaveState->Read(&m_vromTextureFIFOIdx, sizeof(m_vromTextureFIFOIdx));
 }
 
+void CReal3D::UpdateChangedTextures(uint16_t *uploaded, const uint16_t *loaded, std::vector<QueuedUploadTextures> *changed) const
+{
+  // Tiles of 32x32 texels (the finest the renderers invalidate) that differ
+  // are copied, and each run of them along a row is one upload
+  const unsigned tileSize = 32;
+  for (unsigned y = 0; y < 2048; y += tileSize)
+  {
+    unsigned runStart = 2048;
+    for (unsigned x = 0; x <= 2048; x += tileSize)
+    {
+      bool differs = false;
+      if (x < 2048)
+      {
+        for (unsigned row = y; row < y + tileSize; row++)
+        {
+          size_t offset = size_t(row) * 2048 + x;
+          if (memcmp(&uploaded[offset], &loaded[offset], tileSize * sizeof(uint16_t)) != 0)
+          {
+            differs = true;
+            break;
+          }
+        }
+      }
+      if (differs && runStart == 2048)
+        runStart = x;
+      else if (!differs && runStart != 2048)
+      {
+        for (unsigned row = y; row < y + tileSize; row++)
+        {
+          size_t offset = size_t(row) * 2048 + runStart;
+          memcpy(&uploaded[offset], &loaded[offset], (x - runStart) * sizeof(uint16_t));
+        }
+        changed->push_back({ 0, runStart, y, x - runStart, tileSize });
+        runStart = 2048;
+      }
+    }
+  }
+}
+
+void CReal3D::TrackTextureUploads(void)
+{
+  m_trackUploads = true;
+  m_trackedUploads.clear();
+}
+
+void CReal3D::GetRewindRegions(std::vector<CRewindBuffer::Region> *regions) const
+{
+  if (!m_trackRewindPages)
+    return;
+  // In the order written by SaveState()
+  regions->push_back({ m_rewindOffset + 0x000000, 0x400000, &cullingRAMLoDirty });
+  regions->push_back({ m_rewindOffset + 0x400000, 0x100000, &cullingRAMHiDirty });
+  regions->push_back({ m_rewindOffset + 0x500000, 0x400000, &polyRAMDirty });
+  regions->push_back({ m_rewindOffset + 0x900000, 0x800000, &textureRAMDirty });
+}
+
+void CReal3D::ClearRewindPages(void)
+{
+  if (!m_trackRewindPages)
+    return;
+  cullingRAMLoDirty.Clear();
+  cullingRAMHiDirty.Clear();
+  polyRAMDirty.Clear();
+  textureRAMDirty.Clear();
+}
+
 
 /******************************************************************************
  Rendering
@@ -185,79 +307,137 @@ uint32_t CReal3D::SyncSnapshots(void)
   if (!m_gpuMultiThreaded)
     return 0;
 
-  // Update read-only queue
-  queuedUploadTexturesRO = queuedUploadTextures;
+  // Update read-only queue, along with the texels staged for it. Normally
+  // the render thread has taken the last ones, but if not they go first.
+  queuedUploadTexturesRO.insert(queuedUploadTexturesRO.end(), queuedUploadTextures.begin(), queuedUploadTextures.end());
   queuedUploadTextures.clear();
-
-  // Update read-only snapshots
-  return UpdateSnapshots(false);
+  CopyStagedTexels(&m_stagingRO);
+  if (m_staging.overflow)
+  {
+    memcpy(textureRAMRO, textureRAM, 0x800000);
+    m_staging.Clear();
+  }
+  std::swap(m_staging, m_stagingRO);
+
+  // Real memory must be complete before it becomes the snapshot
+  uint32_t copied = ReplaySnapshots(NULL);
+
+  // Exchange the snapshots with the real memory. The real memory is then one
+  // frame behind, by the pages dirtied during this frame, which will be copied
+  // back into it by ReplaySnapshots() while this frame is rendered. Texture
+  // RAM stays put, the renderer's copy being updated from the staged texels.
+  std::swap(cullingRAMLo, cullingRAMLoRO);
+  std::swap(cullingRAMHi, cullingRAMHiRO);
+  std::swap(polyRAM, polyRAMRO);
+  polyRAMRenderDirty.Merge(polyRAMDirty);
+  cullingRAMLoRenderDirty.Merge(cullingRAMLoDirty);
+  cullingRAMHiRenderDirty.Merge(cullingRAMHiDirty);
+  cullingRAMLoDirty.Swap(cullingRAMLoReplay);
+  cullingRAMHiDirty.Swap(cullingRAMHiReplay);
+  polyRAMDirty.Swap(polyRAMReplay);
+  replayPending = true;
+  if (Render3D != NULL)
+    Render3D->AttachMemory(cullingRAMLoRO, cullingRAMHiRO, polyRAMRO, vrom, textureRAMRO);
+  return copied;
 }
 
-uint32_t CReal3D::UpdateSnapshot(bool copyWhole, uint8_t *src, uint8_t *dst, unsigned size, uint8_t *dirty)
+uint32_t CReal3D::ReplaySnapshots(Real3DSnapshotStats *stats)
 {
-  unsigned dirtySize = DIRTY_SIZE(size);
-  if (copyWhole)
-  {
-    // If updating whole region, then just copy all data in one go
-    memcpy(dst, src, size);
-    memset(dirty, 0, dirtySize);
-    return size;
-  }
-  else
+  Real3DSnapshotStats copied = { 0, 0, 0 };
+  if (replayPending)
   {
-    // Otherwise, loop through dirty pages array to find out what needs to be updated and copy only those parts
-    uint32_t copied = 0;
-    uint8_t *pSrc = src;
-    uint8_t *pDst = dst;
-    for (unsigned i = 0; i < dirtySize; i++)
+    // Copy pages dirtied during the previous frame from the snapshots. With
+    // page protection, the real memory was the snapshot until now and must
+    // be made entirely read-only again afterwards.
+    if (m_pageProtection)
+      ProtectWriteBuffers(true);
+    // regions are independent, so they are copied in parallel
+    CThread::GetJobPool()->Run("Real3D replay", 3, [&](unsigned region)
     {
-      uint8_t d = dirty[i];
-      if (d)
-      {
-        for (unsigned j = 0; j < 8; j++)
-        {
-          if (d&1)
-          {
-            // If not at very end of region, then copy an extra 4 bytes to allow for a possible 32-bit overlap
-            uint32_t toCopy = (i < dirtySize - 1 || j < 7 ? PAGE_SIZE + 4 : PAGE_SIZE);
-            memcpy(pDst, pSrc, toCopy);
-            copied += toCopy;
-          }
-          d >>= 1;
-          pSrc += PAGE_SIZE;
-          pDst += PAGE_SIZE;
-        }
-        dirty[i] = 0;
-      }
-      else
+      switch (region)
       {
-        pSrc += 8 * PAGE_SIZE;
-        pDst += 8 * PAGE_SIZE;
+      case 0: copied.cullingRAMLo = cullingRAMLoReplay.Copy((uint8_t*)cullingRAMLo, (const uint8_t*)cullingRAMLoRO); break;
+      case 1: copied.cullingRAMHi = cullingRAMHiReplay.Copy((uint8_t*)cullingRAMHi, (const uint8_t*)cullingRAMHiRO); break;
+      case 2: copied.polyRAM      = polyRAMReplay.Copy((uint8_t*)polyRAM, (const uint8_t*)polyRAMRO); break;
       }
-    }
-    return copied;
+    });
+    if (m_pageProtection)
+      ProtectWriteBuffers(false);
+    replayPending = false;
   }
+  if (stats != NULL)
+    *stats = copied;
+  return copied.cullingRAMLo + copied.cullingRAMHi + copied.polyRAM;
+}
+
+void CReal3D::ResetSnapshots(void)
+{
+  // Copy whole of all memory regions, leaving nothing to replay
+  memcpy(cullingRAMLoRO, cullingRAMLo, 0x400000);
+  memcpy(cullingRAMHiRO, cullingRAMHi, 0x100000);
+  memcpy(polyRAMRO, polyRAM, 0x400000);
+  memcpy(textureRAMRO, textureRAM, 0x800000);
+  m_staging.Clear();
+  m_stagingRO.Clear();
+  ClearDirtyPages();
+}
+
+void CReal3D::ClearDirtyPages(void)
+{
+  cullingRAMLoDirty.Clear();
+  cullingRAMHiDirty.Clear();
+  polyRAMDirty.Clear();
+  cullingRAMLoReplay.Clear();
+  cullingRAMHiReplay.Clear();
+  polyRAMReplay.Clear();
+  replayPending = false;
+
+  // Renderer can no longer assume anything about polygon or culling RAM
+  polyRAMRenderDirty.MarkRange(0, 0x400000);
+  cullingRAMLoRenderDirty.MarkRange(0, 0x400000);
+  cullingRAMHiRenderDirty.MarkRange(0, 0x100000);
+
+  // With page protection, a page is clean exactly when it is read-only
+  if (m_pageProtection)
+    ProtectWriteBuffers(false);
+}
+
+void CReal3D::ProtectWriteBuffers(bool writable)
+{
+  PageProtection::Protect(cullingRAMLo, 0x400000, writable);
+  PageProtection::Protect(cullingRAMHi, 0x100000, writable);
+  PageProtection::Protect(polyRAM, 0x400000, writable);
 }
 
-uint32_t CReal3D::UpdateSnapshots(bool copyWhole)
+// Invoked from the fault handler of whichever thread wrote to a protected page
+void CReal3D::OnPageWritten(void *context, size_t offset)
 {
-  // Update all memory region snapshots
-  uint32_t cullLoCopied  = UpdateSnapshot(copyWhole, (uint8_t*)cullingRAMLo, (uint8_t*)cullingRAMLoRO, 0x400000, cullingRAMLoDirty);
-  uint32_t cullHiCopied  = UpdateSnapshot(copyWhole, (uint8_t*)cullingRAMHi, (uint8_t*)cullingRAMHiRO, 0x100000, cullingRAMHiDirty);
-  uint32_t polyCopied    = UpdateSnapshot(copyWhole, (uint8_t*)polyRAM,      (uint8_t*)polyRAMRO,      0x400000, polyRAMDirty);
-  uint32_t textureCopied = UpdateSnapshot(copyWhole, (uint8_t*)textureRAM,   (uint8_t*)textureRAMRO,   0x800000, textureRAMDirty);
-  //printf("Read3D copied - cullLo:%4uK, cullHi:%4uK, poly:%4uK, texture:%4uK\n", cullLoCopied / 1024, cullHiCopied / 1024, polyCopied / 1024, textureCopied / 1024);
-  return cullLoCopied + cullHiCopied + polyCopied + textureCopied;
+  CReal3D *real3D = (CReal3D *) context;
+  const uint8_t *addr = real3D->memoryPool + offset;
+
+  // Snapshots are only ever written to when being reset, and need no marking
+  auto mark = [addr](CDirtyPages &dirty, const void *region, uint32_t size)
+  {
+    const uint8_t *start = (const uint8_t *) region;
+    if (addr >= start && addr < start + size)
+      dirty.Mark(uint32_t(addr - start));
+  };
+  mark(real3D->cullingRAMLoDirty, real3D->cullingRAMLo, 0x400000);
+  mark(real3D->cullingRAMHiDirty, real3D->cullingRAMHi, 0x100000);
+  mark(real3D->polyRAMDirty, real3D->polyRAM, 0x400000);
 }
 
 void CReal3D::BeginFrame(void)
 {
-  // If multi-threaded, perform now any queued texture uploads to renderer before rendering begins
+  // If multi-threaded, perform now any queued texture uploads to renderer before rendering begins, from its texture memory once
+  // the texels staged for them are in it
   if (m_gpuMultiThreaded)
   {
+    CopyStagedTexels(&m_stagingRO);
     for (const auto &it : queuedUploadTexturesRO) {
       Render3D->UploadTextures(it.level, it.x, it.y, it.width, it.height);
     }
+    m_textureUploads += uint32_t(queuedUploadTexturesRO.size());
 
     // done syncing data
     queuedUploadTexturesRO.clear();
@@ -266,10 +446,35 @@ void CReal3D::BeginFrame(void)
   Render3D->BeginFrame();
 }
 
+void CReal3D::SetRenderDirtyPages(void)
+{
+  // Without snapshots, writes to polygon and culling RAM aren't tracked
+  Render3D->SetPolyRAMDirtyPages(m_gpuMultiThreaded ? &polyRAMRenderDirty : NULL);
+  if (m_gpuMultiThreaded)
+    Render3D->SetCullingRAMDirtyPages(&cullingRAMLoRenderDirty, &cullingRAMHiRenderDirty);
+  else
+    Render3D->SetCullingRAMDirtyPages(NULL, NULL);
+}
+
+void CReal3D::BuildFrame(void)
+{
+  SetRenderDirtyPages();
+  Render3D->BuildFrame();
+}
+
 void CReal3D::RenderFrame(void)
 {
+  SetRenderDirtyPages();
+
   //if (commandPortWrittenRO)
     Render3D->RenderFrame();
+
+  if (m_gpuMultiThreaded)
+  {
+    polyRAMRenderDirty.Clear();
+    cullingRAMLoRenderDirty.Clear();
+    cullingRAMHiRenderDirty.Clear();
+  }
 }
 
 void CReal3D::EndFrame(void)
@@ -277,6 +482,29 @@ void CReal3D::EndFrame(void)
   Render3D->EndFrame();
 }
 
+uint32_t CReal3D::GetFrameAllocations(void)
+{
+  return Render3D->GetFrameAllocations();
+}
+
+size_t CReal3D::GetMemorySize(bool *largePages) const
+{
+  *largePages = m_largePages;
+  return m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW;
+}
+
+uint32_t CReal3D::GetFrameModelsCached(void)
+{
+  return Render3D->GetFrameModelsCached();
+}
+
+uint32_t CReal3D::GetTextureUploads(void)
+{
+  uint32_t uploads = m_textureUploads;
+  m_textureUploads = 0;
+  return uploads;
+}
+
 
 /******************************************************************************
  Texture Uploading and Decoding
@@ -338,6 +566,95 @@ static const unsigned decode8x1[8] =
   6
 };
 
+/*
+ * Queues a texture upload, merging it with recently queued rectangles that it
+ * overlaps or adjoins. Uploads are performed from the renderer's copy of
+ * texture RAM once the frame is synced and the texels staged for it have been
+ * copied there, so their order does not matter and a merged rectangle only
+ * needs to cover its parts. Rectangles are merged when their
+ * bounding box is no larger than their combined areas, so that merging never
+ * increases the amount of data uploaded; merged rectangles are merged again
+ * with the queue until no more merges are possible. Only the most recent
+ * entries are checked, as streamed textures are normally written in sequence.
+ */
+void CReal3D::QueueTextureUpload(unsigned level, unsigned x, unsigned y, unsigned width, unsigned height)
+{
+  const size_t maxMergeCandidates = 16;
+
+  QueuedUploadTextures upl;
+  upl.level = level;
+  upl.x = x;
+  upl.y = y;
+  upl.width = width;
+  upl.height = height;
+
+  bool merged;
+  do
+  {
+    merged = false;
+    size_t first = queuedUploadTextures.size() > maxMergeCandidates ? queuedUploadTextures.size() - maxMergeCandidates : 0;
+    for (size_t i = queuedUploadTextures.size(); i-- > first; )
+    {
+      const QueuedUploadTextures &other = queuedUploadTextures[i];
+      unsigned x0 = (std::min)(upl.x, other.x);
+      unsigned y0 = (std::min)(upl.y, other.y);
+      unsigned x1 = (std::max)(upl.x + upl.width, other.x + other.width);
+      unsigned y1 = (std::max)(upl.y + upl.height, other.y + other.height);
+      if ((x1 - x0) * (y1 - y0) <= upl.width * upl.height + other.width * other.height)
+      {
+        upl.level = (std::min)(upl.level, other.level);
+        upl.x = x0;
+        upl.y = y0;
+        upl.width = x1 - x0;
+        upl.height = y1 - y0;
+        queuedUploadTextures.erase(queuedUploadTextures.begin() + i);
+        merged = true;
+        break;
+      }
+    }
+  } while (merged);
+
+  queuedUploadTextures.push_back(upl);
+}
+
+/*
+ * Stages a copy of texels just stored for the render thread, which copies
+ * them into its texture memory ahead of the frame's uploads, so that texture
+ * RAM need not be snapshot. Past a texture RAM's worth, as when frames are
+ * skipped, nothing more is staged and the whole of it is copied at the sync.
+ */
+void CReal3D::StageTexels(unsigned x, unsigned y, unsigned width, unsigned height)
+{
+  size_t size = size_t(width) * height;
+  if (m_staging.overflow || m_staging.texels.size() + size > 0x800000 / sizeof(uint16_t))
+  {
+    m_staging.Clear();
+    m_staging.overflow = true;
+    return;
+  }
+  m_staging.rects.push_back({ 0, x, y, width, height });
+  size_t offset = m_staging.texels.size();
+  m_staging.texels.resize(offset + size);
+  for (unsigned row = 0; row < height; row++)
+    memcpy(&m_staging.texels[offset + size_t(row) * width], &textureRAM[(y + row) * 2048 + x], width * sizeof(uint16_t));
+}
+
+// Copies staged texels into the renderer's texture memory, in the order stored
+void CReal3D::CopyStagedTexels(TextureStaging *staging)
+{
+  const uint16_t *src = staging->texels.data();
+  for (const auto &it : staging->rects)
+  {
+    for (unsigned row = 0; row < it.height; row++)
+    {
+      memcpy(&textureRAMRO[(it.y + row) * 2048 + it.x], src, it.width * sizeof(uint16_t));
+      src += it.width;
+    }
+  }
+  staging->rects.clear();
+  staging->texels.clear();
+}
+
 void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, uint32_t &texDataOffset)
 {
   uint32_t tileX = (std::min)(8u, width);
@@ -345,7 +662,12 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
 
   texDataOffset = 0;
 
-  if (sixteenBit)  // 16-bit textures
+  if (sixteenBit && tileX == 8 && tileY == 8)  // 16-bit textures of whole 8x8 tiles, nearly all of them
+  {
+    StoreTexture16(xPos, yPos, width, height, texData);
+    texDataOffset = width * height;
+  }
+  else if (sixteenBit)  // 16-bit textures
   {
     // Outer 2 loops: NxN tiles
     for (uint32_t y = yPos; y < (yPos + height); y += tileY)
@@ -358,8 +680,8 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
         {
           for (uint32_t xx = 0; xx < tileX; xx++)
           {
-            if (m_gpuMultiThreaded)
-              MARK_DIRTY(textureRAMDirty, destOffset * 2);
+            if (m_trackRewindPages)
+              textureRAMDirty.Mark(destOffset * 2);
             if (tileX == 1) texData -= tileY;
             if (tileY == 1) texData -= tileX;
             if (tileX == 8)
@@ -404,8 +726,8 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
           for (uint32_t xx = 0; xx < tileX; xx++)
           {
             if (writeLSB | writeMSB) {
-              if (m_gpuMultiThreaded)
-                MARK_DIRTY(textureRAMDirty, destOffset * 2);
+              if (m_trackRewindPages)
+                textureRAMDirty.Mark(destOffset * 2);
               textureRAM[destOffset] &= byteMask[byteSelect];
               const uint8_t shift = (8 * ((xx & 1) ^ 1));
               const uint8_t index = (yy ^ 1) * tileX + (xx ^ 1) - (tileX & 1);
@@ -436,19 +758,68 @@ void CReal3D::StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigne
 
   // Signal to renderer that textures have changed
   // TO-DO: mipmaps? What if a game writes non-mipmap textures to mipmap area?
+  if (m_trackUploads)
+    m_trackedUploads.push_back({ level, xPos, yPos, width, height });
   if (m_gpuMultiThreaded)
   {
     // If multi-threaded, then queue calls to UploadTextures for render thread to perform at beginning of next frame
-    QueuedUploadTextures upl;
-    upl.level = level;
-    upl.x = xPos;
-    upl.y = yPos;
-    upl.width = width;
-    upl.height = height;
-    queuedUploadTextures.push_back(upl);
+    StageTexels(xPos, yPos, width, height);
+    QueueTextureUpload(level, xPos, yPos, width, height);
   }
   else
+  {
     Render3D->UploadTextures(level, xPos, yPos, width, height);
+    m_textureUploads++;
+  }
+}
+
+/*
+ * Stores 16-bit texels arranged in 8x8 tiles a row of texels at a time. Each
+ * pair of tile rows is 8 words: the even row is the even words and the odd
+ * row the odd ones, with the two texels of each word swapped (see decode8x8).
+ */
+void CReal3D::StoreTexture16(unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData)
+{
+  for (uint32_t y = yPos; y < (yPos + height); y += 8)
+  {
+    for (uint32_t x = xPos; x < (xPos + width); x += 8)
+    {
+      uint16_t *dest = &textureRAM[y * 2048 + x];
+      for (uint32_t yy = 0; yy < 8; yy += 2)
+      {
+#if defined(REAL3D_SIMD_SSE2)
+        __m128i a = _mm_loadu_si128((const __m128i *) &texData[0]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &texData[8]);
+        a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));  // even words low, odd words high
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i even = _mm_unpacklo_epi64(a, b);
+        __m128i odd = _mm_unpackhi_epi64(a, b);
+        even = _mm_shufflehi_epi16(_mm_shufflelo_epi16(even, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        odd = _mm_shufflehi_epi16(_mm_shufflelo_epi16(odd, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *) &dest[0], even);
+        _mm_storeu_si128((__m128i *) &dest[2048], odd);
+#elif defined(REAL3D_SIMD_NEON)
+        uint32x4x2_t words = vld2q_u32((const uint32_t *) texData);  // even and odd words
+        vst1q_u16(&dest[0], vrev32q_u16(vreinterpretq_u16_u32(words.val[0])));
+        vst1q_u16(&dest[2048], vrev32q_u16(vreinterpretq_u16_u32(words.val[1])));
+#else
+        for (uint32_t xx = 0; xx < 8; xx++)   // each row pair is laid out as the first
+        {
+          dest[xx] = texData[decode8x8[xx]];
+          dest[2048 + xx] = texData[decode8x8[8 + xx]];
+        }
+#endif
+        dest += 2 * 2048;
+        texData += 16;
+      }
+    }
+  }
+
+  if (m_trackRewindPages)
+  {
+    for (uint32_t y = yPos; y < (yPos + height); y++)
+      textureRAMDirty.MarkRange((y * 2048 + xPos) * 2, width * 2);
+  }
 }
 
 /*
@@ -528,10 +899,81 @@ void CReal3D::UploadTexture(uint32_t header, const uint16_t *texData)
   IRQ:  IRQ pending.
 ******************************************************************************/
 
+bool CReal3D::CopyBlockFromRAM(uint32_t destAddr, uint32_t srcAddr, uint32_t numWords, bool flipEndian)
+{
+  if (ram == NULL || ((srcAddr | destAddr) & 3) != 0)
+    return false;
+  uint64_t size = uint64_t(numWords) * 4;
+  if (uint64_t(srcAddr) + size > ramSize || (destAddr & 0xFFFFFF) + size > 0x1000000)
+    return false;
+
+  uint32_t *dest;
+  CDirtyPages *dirty = NULL;
+  uint32_t offset = destAddr & 0xFFFFFF;
+  switch (destAddr >> 24)
+  {
+  case 0x8C:
+    if (offset + size > 0x400000)
+      return false;
+    dest = &cullingRAMLo[offset / 4];
+    dirty = &cullingRAMLoDirty;
+    break;
+  case 0x8E:
+    if (offset + size > 0x100000)
+      return false;
+    dest = &cullingRAMHi[offset / 4];
+    dirty = &cullingRAMHiDirty;
+    break;
+  case 0x94:
+    if (fifoIdx + numWords > 0x100000 / 4)
+      return false; // let the bus report the overflow
+    dest = &textureFIFO[fifoIdx];
+    fifoIdx += numWords;
+    break;
+  case 0x98:
+    if (offset + size > 0x400000)
+      return false;
+    dest = &polyRAM[offset / 4];
+    dirty = &polyRAMDirty;
+    break;
+  default:
+    return false;
+  }
+
+  const uint32_t *src = (const uint32_t *) &ram[srcAddr];
+  if (!flipEndian)
+    memcpy(dest, src, size_t(size));
+  else
+    Util::CopyFlipEndian32((uint8_t *) dest, (const uint8_t *) src, size_t(size));
+  if (dirty != NULL && m_markDirtyPages)
+    dirty->MarkRange(offset, uint32_t(size));
+  return true;
+}
+
+/*
+ * Performs a DMA transfer from RAM to culling RAM, polygon RAM, or the
+ * texture FIFO as a block copy, producing the same result as the word by word
+ * bus transfer: the bus byte swaps words written to Real3D memory unless the
+ * DMA is reversing bytes as well. Returns false, leaving the transfer to the
+ * bus, if the block cannot be copied directly.
+ */
+bool CReal3D::DMACopyBlock(void)
+{
+  if (!CopyBlockFromRAM(dmaDest, dmaSrc, dmaLength, !(dmaConfig & 0x80)))
+    return false;
+  uint32_t size = dmaLength * 4;
+  dmaSrc += size;
+  dmaDest += size;
+  dmaLength = 0;
+  return true;
+}
+
 void CReal3D::DMACopy(void)
 {
   DebugLog("Real3D DMA copy (PC=%08X, LR=%08X): %08X -> %08X, %X %s\n", ppc_get_pc(), ppc_get_lr(), dmaSrc, dmaDest, dmaLength*4, (dmaConfig&0x80)?"(byte reversed)":"");
   //printf("Real3D DMA copy (PC=%08X, LR=%08X): %08X -> %08X, %X %s\n", ppc_get_pc(), ppc_get_lr(), dmaSrc, dmaDest, dmaLength*4, (dmaConfig&0x80)?"(byte reversed)":"");
+  if (DMACopyBlock())
+    return;
   if ((dmaConfig&0x80)) // reverse bytes
   {
     while (dmaLength != 0)
@@ -694,6 +1136,20 @@ void CReal3D::WriteTextureFIFO(uint32_t data)
     textureFIFO[fifoIdx++] = data;
 }
 
+// Appends as many words as fit, as that many calls to WriteTextureFIFO would
+void CReal3D::AppendTextureFIFO(const uint32_t *data, uint32_t numWords)
+{
+  uint32_t numFit = (std::min)(numWords, 0x100000/4 - fifoIdx);
+  memcpy(&textureFIFO[fifoIdx], data, numFit * sizeof(uint32_t));
+  fifoIdx += numFit;
+  if (numFit < numWords)
+  {
+    if (!error)
+      ErrorLog("Overflow in Real3D texture FIFO!");
+    error = true;
+  }
+}
+
 void CReal3D::WriteTexturePort(unsigned reg, uint32_t data)
 {
   if (step == 0x10)
@@ -705,8 +1161,14 @@ void CReal3D::WriteTexturePort(unsigned reg, uint32_t data)
       DebugLog("Real3D: 0-length VROM texture upload @ PC=%08X (%08X)\n", ppc_get_pc(), data);
       return;
     }
-    for (uint32_t i = 0; i < num_words; i++)
-      WriteTextureFIFO(vrom[(addr + i) & 0xFFFFFF]);
+    for (uint32_t i = 0; i < num_words; )
+    {
+      // Copied in runs up to where the address wraps
+      uint32_t src = (addr + i) & 0xFFFFFF;
+      uint32_t n = (std::min)(num_words - i, 0x1000000 - src);
+      AppendTextureFIFO(&vrom[src], n);
+      i += n;
+    }
   }
   else
   {
@@ -724,25 +1186,38 @@ void CReal3D::WriteTexturePort(unsigned reg, uint32_t data)
 
 void CReal3D::WriteLowCullingRAM(uint32_t addr, uint32_t data)
 {
-  if (m_gpuMultiThreaded)
-    MARK_DIRTY(cullingRAMLoDirty, addr);
+  if (m_markDirtyPages)
+    cullingRAMLoDirty.Mark(addr);
   cullingRAMLo[addr/4] = data;
 }
 
 void CReal3D::WriteHighCullingRAM(uint32_t addr, uint32_t data)
 {
-  if (m_gpuMultiThreaded)
-    MARK_DIRTY(cullingRAMHiDirty, addr);
+  if (m_markDirtyPages)
+    cullingRAMHiDirty.Mark(addr);
   cullingRAMHi[addr/4] = data;
 }
 
 void CReal3D::WritePolygonRAM(uint32_t addr, uint32_t data)
 {
-  if (m_gpuMultiThreaded)
-    MARK_DIRTY(polyRAMDirty, addr);
+  if (m_markDirtyPages)
+    polyRAMDirty.Mark(addr);
   polyRAM[addr/4] = data;
 }
 
+uint8_t *CReal3D::GetDirectWriteRAM(unsigned region)
+{
+  if (m_markDirtyPages || memoryPool == NULL)
+    return NULL;
+  switch (region)
+  {
+  case 0x8C:  return (uint8_t *) cullingRAMLo;
+  case 0x8E:  return (uint8_t *) cullingRAMHi;
+  case 0x98:  return (uint8_t *) polyRAM;
+  default:    return NULL;
+  }
+}
+
 // Internal registers accessible via JTAG port
 void CReal3D::WriteJTAGRegister(uint64_t instruction, uint64_t data)
 {
@@ -875,6 +1350,8 @@ void CReal3D::Reset(void)
 
   queuedUploadTextures.clear();
   queuedUploadTexturesRO.clear();
+  m_staging.Clear();
+  m_stagingRO.Clear();
 
   fifoIdx = 0;
   m_vromTextureFIFOIdx = 0;
@@ -888,7 +1365,11 @@ void CReal3D::Reset(void)
   dmaConfig = 0;
 
   unsigned memSize = (m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW);
+  if (m_pageProtection)
+    PageProtection::Protect(memoryPool, memSize, true);
   memset(memoryPool, 0, memSize);
+  if (m_gpuMultiThreaded)
+    ClearDirtyPages();
   memset(m_vromTextureFIFO, 0, sizeof(m_vromTextureFIFO));
   memset(m_internalRenderConfig, 0, sizeof(m_internalRenderConfig));
 
@@ -915,6 +1396,12 @@ void CReal3D::AttachRenderer(IRender3D *Render3DPtr)
   DebugLog("Real3D attached a Render3D object\n");
 }
 
+void CReal3D::AttachRAM(const uint8_t *ramPtr, uint32_t ramSizeBytes)
+{
+  ram = ramPtr;
+  ramSize = ramSizeBytes;
+}
+
 uint32_t CReal3D::GetASICIDCode(ASIC asic) const
 {
   auto it = m_asicID.find(asic);
@@ -986,10 +1473,30 @@ bool CReal3D::Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPt
   IRQ = IRQObjectPtr;
   dmaIRQ = dmaIRQBit;
 
-  // Allocate all Real3D RAM regions
-  memoryPool = new(std::nothrow) uint8_t[memSize];
+  // Allocate all Real3D RAM regions. With page protection, the pool must be
+  // page aligned and faults within it are handled.
+  m_pageProtection = m_gpuMultiThreaded && m_config["SnapshotPageProtection"].ValueAsDefault<bool>(false);
+  if (m_pageProtection)
+  {
+    memoryPool = (uint8_t *) PageProtection::Allocate(memSize);
+    if (memoryPool != NULL && PageProtection::Watch(memoryPool, memSize, OnPageWritten, this))
+    {
+      PageProtection::Free(memoryPool, memSize);
+      memoryPool = NULL;
+    }
+    if (NULL == memoryPool)
+    {
+      ErrorLog("Unable to use page protection for Real3D snapshots. Using dirty page tracking instead.");
+      m_pageProtection = false;
+    }
+  }
+  m_largePages = false;
+  if (!m_pageProtection)
+    memoryPool = (uint8_t *) PageProtection::AllocateLarge(memSize, &m_largePages);
   if (NULL == memoryPool)
     return ErrorLog("Insufficient memory for Real3D object (needs %1.1f MB).", memSizeMB);
+  m_trackRewindPages = !m_gpuMultiThreaded && m_config["RewindFrames"].ValueAsDefault<unsigned>(0) > 0;
+  m_markDirtyPages = (m_gpuMultiThreaded && !m_pageProtection) || m_trackRewindPages;
 
   // Set up main pointers
   cullingRAMLo = (uint32_t *) &memoryPool[OFFSET_8C];
@@ -1005,10 +1512,26 @@ bool CReal3D::Init(const uint8_t *vromPtr, IBus *BusObjectPtr, CIRQ *IRQObjectPt
     cullingRAMHiRO = (uint32_t *) &memoryPool[OFFSET_8E_RO];
     polyRAMRO = (uint32_t *) &memoryPool[OFFSET_98_RO];
     textureRAMRO = (uint16_t *) &memoryPool[OFFSET_TEXRAM_RO];
-    cullingRAMLoDirty = (uint8_t *) &memoryPool[OFFSET_8C_DIRTY];
-    cullingRAMHiDirty = (uint8_t *) &memoryPool[OFFSET_8E_DIRTY];
-    polyRAMDirty = (uint8_t *) &memoryPool[OFFSET_98_DIRTY];
-    textureRAMDirty = (uint8_t *) &memoryPool[OFFSET_TEXRAM_DIRTY];
+    unsigned pageSize = m_pageProtection ? unsigned(PageProtection::GetPageSize()) : m_config["SnapshotPageSize"].ValueAsDefault<unsigned>(1024);
+    cullingRAMLoDirty.Init(0x400000, pageSize);
+    cullingRAMHiDirty.Init(0x100000, pageSize);
+    polyRAMDirty.Init(0x400000, pageSize);
+    cullingRAMLoReplay.Init(0x400000, pageSize);
+    cullingRAMHiReplay.Init(0x100000, pageSize);
+    polyRAMReplay.Init(0x400000, pageSize);
+    polyRAMRenderDirty.Init(0x400000, pageSize);
+    cullingRAMLoRenderDirty.Init(0x400000, pageSize);
+    cullingRAMHiRenderDirty.Init(0x100000, pageSize);
+  }
+
+  // Without snapshots, the dirty page arrays may still be used for rewinding
+  if (m_trackRewindPages)
+  {
+    unsigned pageSize = m_config["SnapshotPageSize"].ValueAsDefault<unsigned>(1024);
+    cullingRAMLoDirty.Init(0x400000, pageSize);
+    cullingRAMHiDirty.Init(0x100000, pageSize);
+    polyRAMDirty.Init(0x400000, pageSize);
+    textureRAMDirty.Init(0x800000, pageSize);
   }
 
   // VROM pointer passed to us
@@ -1023,6 +1546,8 @@ CReal3D::CReal3D(const Util::Config::Node &config)
     m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>())
 {
   Render3D = NULL;
+  ram = NULL;
+  ramSize = 0;
   memoryPool = NULL;
   cullingRAMLo = NULL;
   cullingRAMHi = NULL;
@@ -1030,6 +1555,14 @@ CReal3D::CReal3D(const Util::Config::Node &config)
   textureRAM = NULL;
   textureFIFO = NULL;
   vrom = NULL;
+  replayPending = false;
+  m_trackUploads = false;
+  m_textureUploads = 0;
+  m_pageProtection = false;
+  m_largePages = false;
+  m_markDirtyPages = false;
+  m_trackRewindPages = false;
+  m_rewindOffset = 0;
   error = false;
   fifoIdx = 0;
   m_vromTextureFIFO[0] = 0;
@@ -1122,7 +1655,9 @@ CReal3D::~CReal3D(void)
   Render3D = NULL;
   if (memoryPool != NULL)
   {
-    delete [] memoryPool;
+    if (m_pageProtection)
+      PageProtection::Unwatch(memoryPool);
+    PageProtection::Free(memoryPool, m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW);
     memoryPool = NULL;
   }
   cullingRAMLo = NULL;
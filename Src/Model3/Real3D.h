@@ -34,6 +34,8 @@
 #include "CPU/Bus.h"
 #include "Graphics/IRender3D.h"
 #include "Util/NewConfig.h"
+#include "DirtyPages.h"
+#include "Rewind.h"
 
 #include <cstdint>
 #include <unordered_map>
@@ -54,6 +56,19 @@ struct QueuedUploadTextures
   unsigned height;
 };
 
+/*
+ * Real3DSnapshotStats:
+ *
+ * Bytes copied per memory region to keep the read-only snapshots used by
+ * multi-threaded rendering in sync, for tuning the snapshot page size.
+ */
+struct Real3DSnapshotStats
+{
+  uint32_t cullingRAMLo;
+  uint32_t cullingRAMHi;
+  uint32_t polyRAM;
+};
+
 /*
  * CReal3D:
  *
@@ -116,6 +131,45 @@ public:
    */
   void LoadState(CBlockFile *SaveState);
 
+  /*
+   * GetMemoryHash(void):
+   *
+   * Returns:
+   *    CRC-32 of culling, polygon and texture RAM, for comparing runs.
+   */
+  uint32_t GetMemoryHash(void);
+
+  /*
+   * TrackTextureUploads(void):
+   *
+   * Records the regions of texture memory uploaded to the renderer from now
+   * on. The next LoadState() then re-uploads just those regions rather than
+   * all of texture memory, which suffices when the state being loaded was
+   * saved as tracking began (as for run-ahead).
+   */
+  void TrackTextureUploads(void);
+
+  /*
+   * GetRewindRegions(regions):
+   *
+   * Adds the memory regions saved by the last SaveState(), with the pages
+   * written since ClearRewindPages(), to a list for the rewind buffer. The
+   * pages are only tracked when rewinding without multi-threading, as set up
+   * by Init().
+   *
+   * Parameters:
+   *    regions   List to add the regions to.
+   */
+  void GetRewindRegions(std::vector<CRewindBuffer::Region> *regions) const;
+
+  /*
+   * ClearRewindPages(void):
+   *
+   * Clears the pages written for the rewind buffer, once a state has been
+   * pushed.
+   */
+  void ClearRewindPages(void);
+
   /*
    * BeginVBlank(void):
    *
@@ -138,9 +192,31 @@ public:
    * end of each frame when both the render thread and the PPC thread have finished
    * their work.  If multi-threaded rendering is not enabled, then this method does
    * nothing.
+   *
+   * The snapshots are exchanged with the real memory by pointer, so no copying
+   * is done here unless ReplaySnapshots() was not called since the last sync.
+   *
+   * Returns:
+   *    Number of bytes copied.
    */
   uint32_t SyncSnapshots(void);
 
+  /*
+   * ReplaySnapshots(void):
+   *
+   * Brings the real memory, which SyncSnapshots() left one frame behind, up to
+   * date by copying into it the pages written during the previous frame. Must
+   * be called before the PPC next accesses Real3D memory. As it only reads the
+   * snapshots, it may run in the PPC thread while the render thread is busy.
+   *
+   * Parameters:
+   *    stats   If not NULL, receives the number of bytes copied per region.
+   *
+   * Returns:
+   *    Number of bytes copied.
+   */
+  uint32_t ReplaySnapshots(Real3DSnapshotStats *stats);
+
   /*
    * BeginFrame(void):
    *
@@ -149,6 +225,16 @@ public:
    * since it may be running in a separate thread.
    */
   void BeginFrame(void);
+
+  /*
+   * BuildFrame(void):
+   *
+   * Traverses the scene database and builds the frame without drawing it,
+   * so that other work can be done before RenderFrame() draws it.  Optional;
+   * RenderFrame() builds the frame itself if this was not called.  The same
+   * restrictions apply as to RenderFrame().
+   */
+  void BuildFrame(void);
   
   /*
    * RenderFrame(void):
@@ -167,6 +253,44 @@ public:
    * may be running in a separate thread.
    */
   void EndFrame(void);
+
+  /*
+   * GetFrameAllocations(void):
+   *
+   * Returns:
+   *    Number of heap allocations the renderer made building the last frame.
+   *    Must be called from the render thread.
+   */
+  uint32_t GetFrameAllocations(void);
+
+  /*
+   * GetMemorySize(largePages):
+   *
+   * Parameters:
+   *    largePages  Set to whether the memory is backed by large pages.
+   *
+   * Returns:
+   *    Size of Real3D memory, including snapshots, in bytes.
+   */
+  size_t GetMemorySize(bool *largePages) const;
+
+  /*
+   * GetFrameModelsCached(void):
+   *
+   * Returns:
+   *    Number of models the renderer decoded building the last frame, rather
+   *    than finding them in its caches. Must be called from the render thread.
+   */
+  uint32_t GetFrameModelsCached(void);
+
+  /*
+   * GetTextureUploads(void):
+   *
+   * Returns:
+   *    Number of texture uploads made to the renderer since the last call.
+   *    Must be called from the render thread.
+   */
+  uint32_t GetTextureUploads(void);
   
   /*
    * Flush(void):
@@ -276,6 +400,23 @@ public:
    *    data  Data to write.
    */
   void WritePolygonRAM(uint32_t addr, uint32_t data);
+
+  /*
+   * GetDirectWriteRAM(region):
+   *
+   * Gets the memory of the culling or polygon RAM for the bus to store words
+   * to directly, byte reversed, rather than through the write handlers above.
+   * That can be done unless the handlers have to mark the pages written,
+   * which page protection and single-threaded rendering without rewind don't
+   * need.
+   *
+   * Parameters:
+   *    region  Top byte of the bus address: 0x8C, 0x8E or 0x98.
+   *
+   * Returns:
+   *    Pointer to the region, or NULL if writes must go through the handlers.
+   */
+  uint8_t *GetDirectWriteRAM(unsigned region);
   
   /*
    * WriteJTAGRegister(instruction, data):
@@ -358,6 +499,43 @@ public:
    *    Render3DPtr   Pointer to a 3D renderer object.
    */
   void AttachRenderer(IRender3D *Render3DPtr);
+
+  /*
+   * AttachRAM(ramPtr, ramSize):
+   *
+   * Gives DMA direct access to PowerPC RAM, so that transfers from RAM to
+   * Real3D memory can be performed as block copies instead of one bus read
+   * and write per word. Optional; without it, all transfers use the bus.
+   *
+   * Parameters:
+   *    ramPtr    Pointer to RAM (each 32-bit word in host format, as read
+   *              and written by the bus), mapped at address 0.
+   *    ramSize   Size of RAM in bytes.
+   */
+  void AttachRAM(const uint8_t *ramPtr, uint32_t ramSize);
+
+  /*
+   * CopyBlockFromRAM(dest, src, numWords, flipEndian):
+   *
+   * Copies a block of words from the attached RAM to culling RAM, polygon
+   * RAM, or the texture FIFO, marking the pages written dirty. Used for DMA
+   * transfers (by the Real3D itself and the SCSI controller) that would
+   * otherwise be performed one bus write at a time.
+   *
+   * Parameters:
+   *    dest        Destination address on the bus.
+   *    src         RAM address.
+   *    numWords    Number of 32-bit words to copy.
+   *    flipEndian  Byte swap each word, as the bus does when writing words
+   *                read from RAM to Real3D memory.
+   *
+   * Returns:
+   *    True if the block was copied, false if no RAM is attached, the source
+   *    is not entirely in RAM, or the destination would wrap, overflow, or
+   *    cross into another device. Nothing is written in that case and the
+   *    copy must go through the bus.
+   */
+  bool CopyBlockFromRAM(uint32_t dest, uint32_t src, uint32_t numWords, bool flipEndian);
   
   /*
    * GetASICIDCodes(asic):
@@ -429,17 +607,47 @@ public:
   ~CReal3D(void);
   
 private:
+  // Texels stored while multi-threaded, captured as they are stored to be
+  // copied into the renderer's texture memory before its uploads are made
+  struct TextureStaging
+  {
+    std::vector<QueuedUploadTextures> rects;  // in the order stored (level unused)
+    std::vector<uint16_t>             texels; // of each rectangle in turn, row by row
+    bool                              overflow = false; // too many to stage, the whole of texture RAM is copied instead
+
+    void Clear(void)
+    {
+      rects.clear();
+      texels.clear();
+      overflow = false;
+    }
+  };
+
   // Private member functions
   void      DMACopy(void);
+  bool      DMACopyBlock(void);
   void      StoreTexture(unsigned level, unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData, bool sixteenBit, bool writeLSB, bool writeMSB, uint32_t &texDataOffset);
+  void      StoreTexture16(unsigned xPos, unsigned yPos, unsigned width, unsigned height, const uint16_t *texData);
+  void      AppendTextureFIFO(const uint32_t *data, uint32_t numWords);
 
   void      UploadTexture(uint32_t header, const uint16_t *texData);
-  uint32_t  UpdateSnapshots(bool copyWhole);
-  uint32_t  UpdateSnapshot(bool copyWhole, uint8_t *src, uint8_t *dst, unsigned size, uint8_t *dirty);
+  void      QueueTextureUpload(unsigned level, unsigned x, unsigned y, unsigned width, unsigned height);
+  void      StageTexels(unsigned x, unsigned y, unsigned width, unsigned height);
+  void      CopyStagedTexels(TextureStaging *staging);
+  void      UpdateChangedTextures(uint16_t *uploaded, const uint16_t *loaded, std::vector<QueuedUploadTextures> *changed) const;
+  void      ResetSnapshots(void);
+  void      ClearDirtyPages(void);
+  void      SetRenderDirtyPages(void);
+  void      ProtectWriteBuffers(bool writable);
+  static void OnPageWritten(void *context, size_t offset);
 
   // Config 
   const Util::Config::Node &m_config;
   const bool                m_gpuMultiThreaded;
+  bool                      m_pageProtection; // detect writes to memory by page faults instead of in write handlers
+  bool                      m_markDirtyPages; // write handlers must mark dirty pages
+  bool                      m_trackRewindPages; // dirty pages are kept for the rewind buffer (single-threaded only)
+  uint32_t                  m_rewindOffset;   // state offset of the memory regions saved by SaveState()
 
   // Renderer attached to the Real3D
   IRender3D *Render3D;
@@ -454,6 +662,7 @@ private:
 
   // Real3D memory
   uint8_t   *memoryPool;        // all memory allocated here
+  bool      m_largePages;       // memory pool is backed by large pages
   uint32_t  *cullingRAMLo;      // 4MB of culling RAM at 8C000000
   uint32_t  *cullingRAMHi;      // 1MB of culling RAM at 8E000000
   uint32_t  *polyRAM;           // 4MB of polygon RAM at 98000000
@@ -467,20 +676,50 @@ private:
   uint32_t  *cullingRAMLoRO;    // 4MB of culling RAM at 8C000000 [read-only snapshot]
   uint32_t  *cullingRAMHiRO;    // 1MB of culling RAM at 8E000000 [read-only snapshot]
   uint32_t  *polyRAMRO;         // 4MB of polygon RAM at 98000000 [read-only snapshot]
-  uint16_t  *textureRAMRO;      // 8MB of internal texture RAM    [read-only snapshot]
+  uint16_t  *textureRAMRO;      // 8MB of internal texture RAM    [renderer's copy, updated from staged texels]
   
-  // Arrays to keep track of dirty pages in memory regions
-  uint8_t   *cullingRAMLoDirty;
-  uint8_t   *cullingRAMHiDirty;
-  uint8_t   *polyRAMDirty;
-  uint8_t   *textureRAMDirty;
+  // Dirty pages in memory regions
+  CDirtyPages cullingRAMLoDirty;
+  CDirtyPages cullingRAMHiDirty;
+  CDirtyPages polyRAMDirty;
+  CDirtyPages textureRAMDirty;    // for rewinding only, texture RAM being staged instead
+
+  // Pages dirtied during the previous frame, still to be copied by ReplaySnapshots()
+  CDirtyPages cullingRAMLoReplay;
+  CDirtyPages cullingRAMHiReplay;
+  CDirtyPages polyRAMReplay;
+  bool      replayPending;
+
+  // Polygon and culling RAM pages written since the renderer last drew a frame
+  CDirtyPages polyRAMRenderDirty;
+  CDirtyPages cullingRAMLoRenderDirty;
+  CDirtyPages cullingRAMHiRenderDirty;
 
   // Queued texture uploads
   std::vector<QueuedUploadTextures> queuedUploadTextures;
   std::vector<QueuedUploadTextures> queuedUploadTexturesRO;  // Read-only copy of queue
+
+  // Texels stored while multi-threaded and since the last sync
+  TextureStaging                    m_staging;
+  TextureStaging                    m_stagingRO;      // of the frame synced, for the render thread
+
+  // Texture uploads since TrackTextureUploads()
+  bool                              m_trackUploads;
+  std::vector<QueuedUploadTextures> m_trackedUploads;
+
+  // Texture memory read from a state, to be compared with what the renderer
+  // has (single-threaded only)
+  std::vector<uint16_t>             m_loadedTextureRAM;
+
+  // Texture uploads made to the renderer since GetTextureUploads()
+  uint32_t                          m_textureUploads;
   
   // Big endian bus object for DMA memory access
   IBus  *Bus;
+
+  // PowerPC RAM for block DMA transfers
+  const uint8_t *ram;
+  uint32_t      ramSize;
   
   // IRQ handling
   CIRQ    *IRQ;   // IRQ controller
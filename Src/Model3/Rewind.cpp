@@ -0,0 +1,201 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2021 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Rewind.cpp
+ *
+ * Rewind buffer of the last frames of emulator state.
+ *
+ * Delta Format
+ * ------------
+ * A delta is a sequence of records, one for each run of adjacent pages that
+ * differ between two states of the same size:
+ *
+ *    Offset  Description
+ *    ------  -----------
+ *    0       Offset of the run in the state (32-bit integer)
+ *    4       Size of the run in bytes, N (32-bit integer)
+ *    8       XOR of the two states over the run (N bytes)
+ *
+ * XOR being its own inverse, the same delta takes either state to the other.
+ */
+
+#include "Rewind.h"
+
+#include <algorithm>
+#include <cstring>
+
+void CRewindBuffer::AddRecord(const std::vector<uint8_t> &state, uint32_t offset, uint32_t size, std::vector<uint8_t> *delta)
+{
+  size_t pos = delta->size();
+  delta->resize(pos + 8 + size);
+  uint8_t *record = delta->data() + pos;
+  memcpy(record + 0, &offset, 4);
+  memcpy(record + 4, &size, 4);
+  const uint8_t *a = state.data() + offset;
+  const uint8_t *b = m_state.data() + offset;
+  for (uint32_t i = 0; i < size; i++)
+    record[8 + i] = a[i] ^ b[i];
+}
+
+// Compares a range of the new state with the newest one page by page, adding
+// a record to the delta for each run of pages that differ
+void CRewindBuffer::Compare(const std::vector<uint8_t> &state, uint32_t start, uint32_t end, std::vector<uint8_t> *delta)
+{
+  uint32_t runStart = 0;
+  uint32_t runEnd = 0;
+  for (uint32_t pos = start; pos < end; )
+  {
+    uint32_t next = std::min((pos / PageSize + 1) * PageSize, end);
+    if (memcmp(&state[pos], &m_state[pos], next - pos) != 0)
+    {
+      if (pos != runEnd)
+      {
+        if (runEnd > runStart)
+          AddRecord(state, runStart, runEnd - runStart, delta);
+        runStart = pos;
+      }
+      runEnd = next;
+    }
+    pos = next;
+  }
+  if (runEnd > runStart)
+    AddRecord(state, runStart, runEnd - runStart, delta);
+}
+
+void CRewindBuffer::Apply(const std::vector<uint8_t> &delta)
+{
+  for (size_t pos = 0; pos + 8 <= delta.size(); )
+  {
+    uint32_t offset;
+    uint32_t size;
+    memcpy(&offset, &delta[pos + 0], 4);
+    memcpy(&size, &delta[pos + 4], 4);
+    const uint8_t *src = &delta[pos + 8];
+    uint8_t *dst = m_state.data() + offset;
+    for (uint32_t i = 0; i < size; i++)
+      dst[i] ^= src[i];
+    pos += 8 + size;
+  }
+}
+
+void CRewindBuffer::DropOldest(void)
+{
+  m_memoryUsed -= m_frames.front().data.capacity();
+  m_frames.pop_front();
+}
+
+void CRewindBuffer::Push(std::vector<uint8_t> *state, const std::vector<Region> &regions, bool compareAll)
+{
+  if (m_state.empty())
+  {
+    m_state.swap(*state);
+    m_memoryUsed += m_state.capacity();
+    m_sinceKeyframe = 0;
+    return;
+  }
+
+  m_frames.emplace_back();
+  Frame &frame = m_frames.back();
+  m_sinceKeyframe++;
+  frame.keyframe = state->size() != m_state.size() || (m_keyframeInterval > 0 && m_sinceKeyframe >= m_keyframeInterval);
+  if (frame.keyframe)
+  {
+    // The newest state is kept whole, already counted
+    frame.data.swap(m_state);
+    m_sinceKeyframe = 0;
+  }
+  else
+  {
+    // Compare what may have changed: everything outside the regions, and the
+    // dirty pages inside them, extended by 4 bytes like CDirtyPages::Copy()
+    uint32_t size = uint32_t(state->size());
+    if (compareAll)
+      Compare(*state, 0, size, &frame.data);
+    else
+    {
+      std::vector<const Region *> sorted;
+      for (const Region &region : regions)
+        sorted.push_back(&region);
+      std::sort(sorted.begin(), sorted.end(), [](const Region *a, const Region *b) { return a->offset < b->offset; });
+      uint32_t pos = 0;
+      for (const Region *region : sorted)
+      {
+        uint32_t regionEnd = std::min(region->offset + region->size, size);
+        Compare(*state, pos, std::min(region->offset, size), &frame.data);
+        region->dirty->ForEachRun([&](uint32_t offset, uint32_t runSize)
+        {
+          uint32_t start = region->offset + offset;
+          Compare(*state, std::min(start, regionEnd), std::min(start + runSize + 4, regionEnd), &frame.data);
+        });
+        pos = std::max(pos, regionEnd);
+      }
+      Compare(*state, pos, size, &frame.data);
+    }
+    frame.data.shrink_to_fit();
+    m_memoryUsed += frame.data.capacity();
+    m_memoryUsed -= m_state.capacity();
+  }
+  m_state.swap(*state);
+  m_memoryUsed += m_state.capacity();
+
+  while (!m_frames.empty() && (m_frames.size() > m_maxFrames || m_memoryUsed > m_memoryBudget))
+    DropOldest();
+}
+
+bool CRewindBuffer::StepBack(void)
+{
+  if (m_frames.empty())
+    return false;
+
+  Frame &frame = m_frames.back();
+  if (frame.keyframe)
+  {
+    m_memoryUsed -= m_state.capacity();
+    m_state.swap(frame.data);
+  }
+  else
+  {
+    Apply(frame.data);
+    m_memoryUsed -= frame.data.capacity();
+  }
+  m_frames.pop_back();
+  if (m_sinceKeyframe > 0)
+    m_sinceKeyframe--;
+  return true;
+}
+
+void CRewindBuffer::Clear(void)
+{
+  std::vector<uint8_t>().swap(m_state);
+  m_frames.clear();
+  m_memoryUsed = 0;
+  m_sinceKeyframe = 0;
+}
+
+void CRewindBuffer::Init(size_t memoryBudget, unsigned maxFrames, unsigned keyframeInterval)
+{
+  m_memoryBudget = memoryBudget;
+  m_maxFrames = maxFrames;
+  m_keyframeInterval = keyframeInterval;
+  Clear();
+}
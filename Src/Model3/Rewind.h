@@ -0,0 +1,158 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2021 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Rewind.h
+ *
+ * Header file defining the CRewindBuffer class: the last frames of emulator
+ * state, kept as differences between consecutive save states.
+ */
+
+#ifndef INCLUDED_REWIND_H
+#define INCLUDED_REWIND_H
+
+#include "DirtyPages.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/*
+ * CRewindBuffer:
+ *
+ * Ring of the states of the last frames, each a save state written to memory.
+ * Only the newest state is kept whole. Every older frame is the XOR of its
+ * state with the next one, over just the pages that differ, so that stepping
+ * back a frame applies a single delta to the newest state. Keyframes, full
+ * copies of a state, are stored every so many frames and whenever the size of
+ * the state changes. The oldest frames are dropped to stay within the memory
+ * budget and the number of frames retained.
+ *
+ * Finding the pages that differ means comparing the new state with the
+ * previous one. Regions of the state whose written pages are tracked, such as
+ * RAM, only have those pages compared.
+ */
+class CRewindBuffer
+{
+public:
+  // Page size in which states are compared
+  static const uint32_t PageSize = 0x1000;
+
+  /*
+   * Region:
+   *
+   * Memory region saved in a state, starting at the given offset, with the
+   * pages written since the previous state was pushed marked in a bitmap of
+   * the region. Pages not marked are the same as in the previous state.
+   */
+  struct Region
+  {
+    uint32_t          offset;
+    uint32_t          size;
+    const CDirtyPages *dirty;
+  };
+
+  /*
+   * Init(memoryBudget, maxFrames, keyframeInterval):
+   *
+   * Sets the limits and empties the buffer.
+   *
+   * Parameters:
+   *    memoryBudget      Memory that the states may take, in bytes.
+   *    maxFrames         Maximum number of frames that can be stepped back.
+   *    keyframeInterval  Frames between keyframes, or 0 to only store one
+   *                      when the state size changes.
+   */
+  void Init(size_t memoryBudget, unsigned maxFrames, unsigned keyframeInterval);
+
+  // Empties the buffer
+  void Clear(void);
+
+  /*
+   * Push(state, regions, compareAll):
+   *
+   * Adds the state of a new frame, which becomes the newest. The buffer takes
+   * over the contents of the state vector and may hand back the memory of
+   * the previous state in it, to be reused for the next one.
+   *
+   * Parameters:
+   *    state       Save state written to memory. Its contents are undefined
+   *                on return.
+   *    regions     Regions of the state with tracked pages, in any order and
+   *                not overlapping.
+   *    compareAll  Compares the whole state, ignoring the tracked pages (for
+   *                example after another state was loaded).
+   */
+  void Push(std::vector<uint8_t> *state, const std::vector<Region> &regions, bool compareAll);
+
+  /*
+   * StepBack(void):
+   *
+   * Returns to the state of the previous frame, which then becomes the newest,
+   * dropping the newest frame.
+   *
+   * Returns:
+   *    True if there was a previous frame, otherwise false (the newest state
+   *    is left as is).
+   */
+  bool StepBack(void);
+
+  // Newest state, empty if none has been pushed
+  const std::vector<uint8_t> &GetState(void) const
+  {
+    return m_state;
+  }
+
+  // Number of frames that can be stepped back
+  unsigned GetNumFrames(void) const
+  {
+    return unsigned(m_frames.size());
+  }
+
+  // Memory taken by the states, in bytes
+  size_t GetMemoryUsed(void) const
+  {
+    return m_memoryUsed;
+  }
+
+private:
+  struct Frame
+  {
+    bool                  keyframe; // data is the whole state, otherwise a delta
+    std::vector<uint8_t>  data;
+  };
+
+  void  Compare(const std::vector<uint8_t> &state, uint32_t start, uint32_t end, std::vector<uint8_t> *delta);
+  void  AddRecord(const std::vector<uint8_t> &state, uint32_t offset, uint32_t size, std::vector<uint8_t> *delta);
+  void  Apply(const std::vector<uint8_t> &delta);
+  void  DropOldest(void);
+
+  size_t                m_memoryBudget = 0;
+  unsigned              m_maxFrames = 0;
+  unsigned              m_keyframeInterval = 0;
+  unsigned              m_sinceKeyframe = 0;  // frames pushed since the last keyframe
+  size_t                m_memoryUsed = 0;
+  std::vector<uint8_t>  m_state;              // newest state
+  std::deque<Frame>     m_frames;             // older frames, oldest first
+};
+
+#endif  // INCLUDED_REWIND_H
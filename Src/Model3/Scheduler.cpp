@@ -0,0 +1,97 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2021 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Scheduler.cpp
+ *
+ * Main board event timeline. Implementation of the CScheduler class.
+ */
+
+#include "Scheduler.h"
+
+#include "Supermodel.h"
+#include "CPU/PowerPC/ppc.h"
+#include <algorithm>
+
+
+bool CScheduler::Later(const Event &a, const Event &b)
+{
+	if (a.cycle != b.cycle)
+		return a.cycle > b.cycle;
+	return a.seq > b.seq;
+}
+
+UINT64 CScheduler::Now(void) const
+{
+	return m_dispatching ? m_dispatchCycle : ppc_total_cycles();
+}
+
+void CScheduler::Schedule(UINT64 cycle, Callback callback)
+{
+	m_events.push_back({ cycle, m_seq++, std::move(callback) });
+	std::push_heap(m_events.begin(), m_events.end(), Later);
+}
+
+void CScheduler::ScheduleIn(UINT64 cycles, Callback callback)
+{
+	Schedule(Now() + cycles, std::move(callback));
+}
+
+void CScheduler::RunUntil(UINT64 cycle)
+{
+	while (true)
+	{
+		UINT64 now = ppc_total_cycles();
+
+		// Dispatch everything that is due
+		while (!m_events.empty() && m_events.front().cycle <= now)
+		{
+			std::pop_heap(m_events.begin(), m_events.end(), Later);
+			Event event = std::move(m_events.back());
+			m_events.pop_back();
+			m_dispatching = true;
+			m_dispatchCycle = event.cycle;
+			event.callback();
+			m_dispatching = false;
+		}
+
+		// Run up to the next event or the end of the requested period
+		UINT64 target = cycle;
+		if (!m_events.empty() && m_events.front().cycle < target)
+			target = m_events.front().cycle;
+		if (target <= now)
+			break;
+		ppc_execute((int)(target - now));
+	}
+}
+
+void CScheduler::Clear(void)
+{
+	m_events.clear();
+}
+
+CScheduler::CScheduler(void)
+	: m_seq(0),
+	  m_dispatchCycle(0),
+	  m_dispatching(false)
+{
+}
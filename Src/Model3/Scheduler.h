@@ -0,0 +1,116 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2021 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Scheduler.h
+ *
+ * Header file defining the CScheduler class: main board event timeline.
+ */
+
+#ifndef INCLUDED_SCHEDULER_H
+#define INCLUDED_SCHEDULER_H
+
+#include "Types.h"
+#include <functional>
+#include <vector>
+
+/*
+ * CScheduler:
+ *
+ * Timeline of main board events, measured in PowerPC cycles. The PowerPC is
+ * executed exactly up to the next pending event, at which point the event's
+ * callback is invoked. Callbacks may schedule further events.
+ *
+ * Events that the devices already evaluate lazily from the cycle count (the
+ * decrementer and the Real3D status bit) do not need to be scheduled here.
+ */
+class CScheduler
+{
+public:
+	typedef std::function<void(void)> Callback;
+
+	/*
+	 * Now(void):
+	 *
+	 * Returns:
+	 *		The current time in PowerPC cycles. While an event is being
+	 *		dispatched, this is the time the event was scheduled for rather
+	 *		than the (possibly slightly later) actual CPU time, so that chained
+	 *		events do not drift.
+	 */
+	UINT64 Now(void) const;
+
+	/*
+	 * Schedule(cycle, callback):
+	 * ScheduleIn(cycles, callback):
+	 *
+	 * Adds an event to the timeline, either at an absolute time or relative
+	 * to Now(). Events scheduled for the same cycle are dispatched in the
+	 * order they were added.
+	 *
+	 * Parameters:
+	 *		cycle		Absolute PowerPC cycle count.
+	 *		cycles		Number of cycles from now.
+	 *		callback	Function to invoke.
+	 */
+	void Schedule(UINT64 cycle, Callback callback);
+	void ScheduleIn(UINT64 cycles, Callback callback);
+
+	/*
+	 * RunUntil(cycle):
+	 *
+	 * Runs the PowerPC up to the specified absolute cycle count, dispatching
+	 * all events that fall due along the way. Events scheduled beyond this
+	 * point remain pending.
+	 *
+	 * Parameters:
+	 *		cycle	Absolute PowerPC cycle count to run to.
+	 */
+	void RunUntil(UINT64 cycle);
+
+	/*
+	 * Clear(void):
+	 *
+	 * Discards all pending events.
+	 */
+	void Clear(void);
+
+	CScheduler(void);
+
+private:
+	struct Event
+	{
+		UINT64		cycle;
+		UINT64		seq;	// tie breaker preserving insertion order
+		Callback	callback;
+	};
+
+	static bool Later(const Event &a, const Event &b);
+
+	std::vector<Event>	m_events;	// min-heap ordered by (cycle, seq)
+	UINT64			m_seq;
+	UINT64			m_dispatchCycle;
+	bool			m_dispatching;
+};
+
+
+#endif	// INCLUDED_SCHEDULER_H
@@ -52,6 +52,20 @@
  *
  *		ROM 200000-5FFFFF -> A00000-DFFFFF
  *		ROM 600000-7FFFFF -> E00000-FFFFFF
+ *
+ * MIDI Recordings
+ * ---------------
+ * The bytes the main board writes to the MIDI port can be recorded and played
+ * back without the rest of the system, to run the sound board alone. Files are
+ * in native byte order:
+ *
+ *		Offset	Size	Contents
+ *		0		16		"Supermodel MIDI", null terminated
+ *		16		4		Format version (1)
+ *		20		4		Number of main board frames recorded
+ *		24		32		Game name, null padded
+ *		56		5*n		Each byte written: frame number (4 bytes, counted
+ *						from 0) followed by the byte
  */
 
 #include "SoundBoard.h"
@@ -78,6 +92,11 @@ static FILE		*soundFP;
 
 #define MEMORY_POOL_SIZE        (0x100000 + 0x100000 + 4*LENGTH_CHANNEL_BUFFER)
 
+// MIDI recording file header
+static const char	MIDI_RECORDING_ID[16]		= "Supermodel MIDI";
+static const UINT32	MIDI_RECORDING_VERSION		= 1;
+static const long	MIDI_RECORDING_FRAMES		= 20;	// offset of number of frames
+static const size_t	MIDI_RECORDING_GAME_LENGTH	= 32;
 
 /******************************************************************************
  68K Address Space Handlers
@@ -302,40 +321,49 @@ void CSoundBoard::Write32(unsigned int a,unsigned int d)
 /******************************************************************************
  SCSP 68K Callbacks
  
- The SCSP emulator drives the 68K via callbacks. These have to live outside of
- the CSoundBoard object for now, unfortunately.
+ The SCSP emulator drives the 68K via callbacks, which are passed the sound
+ board they belong to.
 ******************************************************************************/
 
-// Status of IRQ pins (IPL2-0) on 68K
-// TODO: can we get rid of this global variable altogether?
-static int	irqLine = 0;
-
 // Interrupt acknowledge callback (TODO: don't need this, default behavior in M68K.cpp should be fine)
-int IRQAck(int irqLevel)
+int CSoundBoard::IRQAck(void *data, int irqLevel)
 {
+	CSoundBoard *board = (CSoundBoard *) data;
 	M68KSetIRQ(0);
-	irqLine = 0;
+	board->irqLine = 0;
 	return M68K_IRQ_AUTOVECTOR;
 }
 
 // SCSP callback for generating IRQs
-void SCSP68KIRQCallback(int irqLevel)
+void CSoundBoard::SCSP68KIRQCallback(void *data, int irqLevel)
 {
+	CSoundBoard *board = (CSoundBoard *) data;
+
 	/*
 	 * IRQ arbitration logic: only allow higher priority IRQs to be asserted or
 	 * 0 to clear pending IRQ.
 	 */
-	if ((irqLevel>irqLine) || (0==irqLevel))
+	if ((irqLevel>board->irqLine) || (0==irqLevel))
 	{
-		irqLine = irqLevel;	
+		board->irqLine = irqLevel;	
 		
 	}
-	M68KSetIRQ(irqLine);
+	M68KSetIRQ(board->irqLine);
 }
 
+/*
+ * Sound programs spend most of their time polling RAM for a flag set by the
+ * SCSP timer interrupt handler. The SCSP emulator already runs the 68K in
+ * batches that end before the next enabled interrupt, so once the 68K has
+ * settled into such a loop, nothing can break it before the batch ends.
+ */
+
 // SCSP callback for running the 68K
-int SCSP68KRunCallback(int numCycles)
+int CSoundBoard::SCSP68KRunCallback(void *data, int numCycles)
 {
+	CSoundBoard *board = (CSoundBoard *) data;
+	if (board->idleSkip)
+		return M68KRunIdleSkip(numCycles, &board->idleCycles) - numCycles;
 	return M68KRun(numCycles) - numCycles;
 }
 
@@ -344,11 +372,175 @@ int SCSP68KRunCallback(int numCycles)
  Sound Board Interface
 ******************************************************************************/
 
-void CSoundBoard::WriteMIDIPort(UINT8 data)
+void CSoundBoard::SendMIDI(UINT8 data)
 {
+	SCSP_SetContext(scspContext);
 	SCSP_MidiIn(data);
-	if (NULL != DSB)	// DSB receives all commands as well
+	if (NULL == DSB)
+		return;
+
+	// DSB receives all commands as well, through the queue if it has a thread
+	if (NULL == dsbThread)
+	{
 		DSB->SendCommand(data);
+		return;
+	}
+	UINT32 w = dsbQueueW.load(std::memory_order_relaxed);
+	if (w - dsbQueueR.load(std::memory_order_acquire) >= DSB_QUEUE_SIZE)
+	{
+		DebugLog("DSB queue overflow, dropped %02X\n", data);
+		return;
+	}
+	dsbQueue[w & (DSB_QUEUE_SIZE - 1)] = data;
+	dsbQueueW.store(w + 1, std::memory_order_release);
+}
+
+void CSoundBoard::WriteMIDIPort(UINT8 data)
+{
+	if (NULL != midiRecordFP)
+	{
+		UINT32 frame = midiWriteFrame.load(std::memory_order_relaxed) - midiRecordStart;
+		fwrite(&frame, sizeof(frame), 1, midiRecordFP);
+		fwrite(&data, sizeof(data), 1, midiRecordFP);
+	}
+
+	if (!midiQueueEnabled)
+	{
+		SendMIDI(data);
+		return;
+	}
+
+	UINT32 w = midiQueueW.load(std::memory_order_relaxed);
+	if (w - midiQueueR.load(std::memory_order_acquire) >= MIDI_QUEUE_SIZE)
+	{
+		DebugLog("MIDI queue overflow, dropped %02X\n", data);
+		return;
+	}
+	midiQueue[w & (MIDI_QUEUE_SIZE - 1)].frame = midiWriteFrame.load(std::memory_order_relaxed);
+	midiQueue[w & (MIDI_QUEUE_SIZE - 1)].data = data;
+	midiQueueW.store(w + 1, std::memory_order_release);
+}
+
+void CSoundBoard::EndMIDIFrame(void)
+{
+	midiWriteFrame.fetch_add(1, std::memory_order_release);
+}
+
+void CSoundBoard::RunMIDIQueue(bool flush)
+{
+	// Move on to the next main board frame, catching up if too far behind. In
+	// step, the main board is running the frame being played back, and only
+	// the one before it is complete.
+	UINT32 written = midiWriteFrame.load(std::memory_order_acquire);
+	UINT32 last;	// frame played back up to
+	if (flush)
+		last = midiReadFrame = written;
+	else if (midiQueueInStep)
+		last = midiReadFrame++ - 1;
+	else
+	{
+		if (written - midiReadFrame > MIDI_QUEUE_MAX_LAG)
+			midiReadFrame = written - MIDI_QUEUE_MAX_LAG;
+		else if (midiReadFrame != written)
+			midiReadFrame++;
+		last = midiReadFrame;
+	}
+
+	// Pass on bytes written up to the frame being played back
+	UINT32 r = midiQueueR.load(std::memory_order_relaxed);
+	UINT32 w = midiQueueW.load(std::memory_order_acquire);
+	while (r != w && (INT32)(midiQueue[r & (MIDI_QUEUE_SIZE - 1)].frame - last) <= 0)
+	{
+		SendMIDI(midiQueue[r & (MIDI_QUEUE_SIZE - 1)].data);
+		r++;
+	}
+	midiQueueR.store(r, std::memory_order_release);
+}
+
+void CSoundBoard::SetMIDIQueue(bool enable, bool inStep)
+{
+	if (midiQueueEnabled && !enable)
+		RunMIDIQueue(true);
+	midiQueueEnabled = enable;
+	midiQueueInStep = enable && inStep;
+	midiReadFrame = midiWriteFrame.load(std::memory_order_relaxed);
+}
+
+bool CSoundBoard::StartMIDIRecording(const std::string &file, const std::string &game)
+{
+	StopMIDIRecording();
+
+	midiRecordFP = fopen(file.c_str(), "wb");
+	if (NULL == midiRecordFP)
+		return ErrorLog("Unable to create MIDI recording: %s", file.c_str());
+
+	char	name[MIDI_RECORDING_GAME_LENGTH] = { };
+	UINT32	numFrames = 0;
+	strncpy(name, game.c_str(), sizeof(name) - 1);
+	fwrite(MIDI_RECORDING_ID, sizeof(MIDI_RECORDING_ID), 1, midiRecordFP);
+	fwrite(&MIDI_RECORDING_VERSION, sizeof(MIDI_RECORDING_VERSION), 1, midiRecordFP);
+	fwrite(&numFrames, sizeof(numFrames), 1, midiRecordFP);
+	fwrite(name, sizeof(name), 1, midiRecordFP);
+
+	midiRecordStart = midiWriteFrame.load(std::memory_order_relaxed);
+	InfoLog("Recording MIDI port to %s.", file.c_str());
+	return OKAY;
+}
+
+void CSoundBoard::StopMIDIRecording(void)
+{
+	if (NULL == midiRecordFP)
+		return;
+
+	// Fill in number of frames recorded
+	UINT32 numFrames = midiWriteFrame.load(std::memory_order_relaxed) - midiRecordStart;
+	fseek(midiRecordFP, MIDI_RECORDING_FRAMES, SEEK_SET);
+	fwrite(&numFrames, sizeof(numFrames), 1, midiRecordFP);
+	fclose(midiRecordFP);
+	midiRecordFP = NULL;
+	InfoLog("Stopped MIDI recording after %u frames.", numFrames);
+}
+
+bool CSoundBoard::LoadMIDIRecording(MIDIRecording *recording, const std::string &file)
+{
+	FILE *fp = fopen(file.c_str(), "rb");
+	if (NULL == fp)
+		return ErrorLog("Unable to open MIDI recording: %s", file.c_str());
+
+	char	id[sizeof(MIDI_RECORDING_ID)];
+	UINT32	version = 0;
+	char	name[MIDI_RECORDING_GAME_LENGTH + 1] = { };
+	bool	valid = fread(id, sizeof(id), 1, fp) == 1 &&
+					fread(&version, sizeof(version), 1, fp) == 1 &&
+					fread(&recording->numFrames, sizeof(recording->numFrames), 1, fp) == 1 &&
+					fread(name, MIDI_RECORDING_GAME_LENGTH, 1, fp) == 1 &&
+					!memcmp(id, MIDI_RECORDING_ID, sizeof(id)) &&
+					version == MIDI_RECORDING_VERSION;
+	if (!valid)
+	{
+		fclose(fp);
+		return ErrorLog("%s is not a valid MIDI recording.", file.c_str());
+	}
+	recording->game = name;
+
+	MIDIEntry	entry;
+	recording->entries.clear();
+	while (fread(&entry.frame, sizeof(entry.frame), 1, fp) == 1 && fread(&entry.data, sizeof(entry.data), 1, fp) == 1)
+	{
+		if (entry.frame >= recording->numFrames)
+			break;
+		recording->entries.push_back(entry);
+	}
+	fclose(fp);
+	return OKAY;
+}
+
+void CSoundBoard::GetFrameAudio(const float *channels[4])
+{
+	channels[0] = audioFL;
+	channels[1] = audioFR;
+	channels[2] = audioRL;
+	channels[3] = audioRR;
 }
 
 static INT16 ClampINT16(float x)
@@ -363,15 +555,38 @@ static INT16 ClampINT16(float x)
     return (INT16)xi;
 }
 
-bool CSoundBoard::RunFrame(void)
+bool CSoundBoard::RunFrame(bool outputAudio)
 {
-	// Run sound board first to generate SCSP audio
-	if (m_config["EmulateSound"].ValueAs<bool>())
+	// Pass on queued MIDI commands
+	if (midiQueueEnabled)
+		RunMIDIQueue(false);
+
+	// Have the DSB thread emulate a frame for the commands sent so far
+	bool dsbThreaded = NULL != dsbThread;
+	if (dsbThreaded)
 	{
-		M68KSetContext(&M68K);
-		SCSP_Update();
-		M68KGetContext(&M68K);
+		dsbQueueEnd[dsbFramesStarted % DSB_RING_FRAMES] = dsbQueueW.load(std::memory_order_relaxed);
+		dsbFramesStarted++;
+		dsbFrameStart->Post();
 	}
+
+	// Run sound board first to generate SCSP audio. The DSB only depends on
+	// the commands it has been sent, not on the sound board, so it can be
+	// emulated on the job pool at the same time, and mixed in once both are
+	// done exactly as if it had run afterwards
+	bool dsbInParallel = !dsbThreaded && m_parallelSound && NULL != DSB && m_emulateSound.Get();
+	if (dsbInParallel)
+	{
+		CThread::GetJobPool()->Run("Sound board", 2, [this](unsigned i)
+		{
+			if (i == 0)
+				RunSCSP();
+			else
+				DSB->EmulateFrame();
+		});
+	}
+	else if (m_emulateSound.Get())
+		RunSCSP();
 	else
 	{
 		memset(audioFL, 0, LENGTH_CHANNEL_BUFFER);
@@ -381,15 +596,18 @@ bool CSoundBoard::RunFrame(void)
 	}
 
 	// Compute sound volume as 
-	float soundVol = (float)std::max(0,std::min(200,m_config["SoundVolume"].ValueAs<int>()));
+	float soundVol = (float)std::max(0,std::min(200,m_soundVolume.Get()));
 	soundVol = soundVol * (float)(1.0 / 100.0);
 
-	// Apply sound volume setting to SCSP channels only
-	for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-		audioFL[i] *= soundVol;
-		audioFR[i] *= soundVol;
-		audioRL[i] *= soundVol;
-		audioRR[i] *= soundVol;
+	// Apply sound volume setting to SCSP channels only, nothing to do at the
+	// default of 100%
+	if (soundVol != 1.0f) {
+		for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
+			audioFL[i] *= soundVol;
+			audioFR[i] *= soundVol;
+			audioRL[i] *= soundVol;
+			audioRR[i] *= soundVol;
+		}
 	}
 
 	// Run DSB and mix with existing audio, apply music volume
@@ -397,14 +615,25 @@ bool CSoundBoard::RunFrame(void)
 		// Will need to mix with proper front, rear channels or both (game specific)
 		bool mixDSBWithFront = true; // Everything to front channels for now
 		// Case "both" not handled for now
-		if (mixDSBWithFront)
-			DSB->RunFrame(audioFL, audioFR);
+		if (dsbThreaded)
+			MixDSBThreadFrame(mixDSBWithFront ? audioFL : audioRL, mixDSBWithFront ? audioFR : audioRR);
 		else
-			DSB->RunFrame(audioRL, audioRR);
+		{
+			if (!dsbInParallel)
+				DSB->EmulateFrame();
+			if (mixDSBWithFront)
+				DSB->MixFrame(audioFL, audioFR);
+			else
+				DSB->MixFrame(audioRL, audioRR);
+		}
 	}
 
 	// Output the audio buffers
-	bool bufferFull = OutputAudio(NUM_SAMPLES_PER_FRAME, audioFL, audioFR, audioRL, audioRR, m_config["FlipStereo"].ValueAs<bool>());
+	if (!outputAudio)
+		return false;
+	bool bufferFull = false;
+	if (NULL != host)
+		bufferFull = host->OutputAudio(NUM_SAMPLES_PER_FRAME, audioFL, audioFR, audioRL, audioRR, m_flipStereo.Get());
 
 #ifdef SUPERMODEL_LOG_AUDIO
 	// Output to binary file
@@ -425,8 +654,109 @@ bool CSoundBoard::RunFrame(void)
 	return bufferFull;
 }
 
+// Runs the sound board 68K and SCSPs for a frame, on whichever thread calls it
+void CSoundBoard::RunSCSP(void)
+{
+	idleSkip = m_idleSkip.Get();
+	M68KSetContext(&M68K);
+	SCSP_SetContext(scspContext);
+	SCSP_Update();
+	M68KGetContext(&M68K);
+}
+
+// Mixes in the frame the DSB thread was started on in the previous call to
+// RunFrame(), waiting for it if need be. There is none until the second.
+void CSoundBoard::MixDSBThreadFrame(float *audioL, float *audioR)
+{
+	if (dsbFramesStarted - dsbFramesMixed < 2)
+		return;
+	while (dsbFramesDone == dsbFramesMixed)
+	{
+		dsbFrameDone->Wait();
+		dsbFramesDone++;
+	}
+	const float (*ring)[NUM_SAMPLES_PER_FRAME] = dsbRing[dsbFramesMixed % DSB_RING_FRAMES];
+	for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++)
+	{
+		audioL[i] += ring[0][i];
+		audioR[i] += ring[1][i];
+	}
+	dsbFramesMixed++;
+}
+
+// Waits until the DSB thread is idle, so that the DSB can be used directly.
+// Discarding drops the frames not yet mixed and the commands not yet passed
+// on, as when the DSB's state is changed.
+void CSoundBoard::SyncDSBThread(bool discard)
+{
+	if (NULL == dsbThread)
+		return;
+	while (dsbFramesDone != dsbFramesStarted)
+	{
+		dsbFrameDone->Wait();
+		dsbFramesDone++;
+	}
+	if (discard)
+	{
+		dsbFramesMixed = dsbFramesStarted;
+		dsbQueueR.store(dsbQueueW.load(std::memory_order_relaxed), std::memory_order_release);
+	}
+}
+
+void CSoundBoard::StopDSBThread(void)
+{
+	if (NULL == dsbThread)
+		return;
+	SyncDSBThread(true);
+	dsbQuit.store(true, std::memory_order_relaxed);
+	dsbFrameStart->Post();
+	dsbThread->Wait();
+	delete dsbThread;
+	delete dsbFrameStart;
+	delete dsbFrameDone;
+	dsbThread = NULL;
+	dsbFrameStart = NULL;
+	dsbFrameDone = NULL;
+	dsbQuit.store(false, std::memory_order_relaxed);
+}
+
+int CSoundBoard::StartDSBThread(void *data)
+{
+	CSoundBoard *board = (CSoundBoard *) data;
+	board->RunDSBThread();
+	return 0;
+}
+
+void CSoundBoard::RunDSBThread(void)
+{
+	while (dsbFrameStart->Wait() && !dsbQuit.load(std::memory_order_relaxed))
+	{
+		// Pass on the commands sent before the frame was started, but none
+		// sent since, which belong to the next frame. The end was written
+		// before the frame start was posted.
+		unsigned slot = dsbThreadFrame++ % DSB_RING_FRAMES;
+		UINT32 r = dsbQueueR.load(std::memory_order_relaxed);
+		UINT32 end = dsbQueueEnd[slot];
+		for (; r != end; r++)
+			DSB->SendCommand(dsbQueue[r & (DSB_QUEUE_SIZE - 1)]);
+		dsbQueueR.store(r, std::memory_order_release);
+
+		// Emulate and mix into the next buffer of the ring, from silence, so
+		// that adding it to the sound board's audio gives the same result as
+		// mixing into it directly
+		float (*ring)[NUM_SAMPLES_PER_FRAME] = dsbRing[slot];
+		memset(ring, 0, sizeof(dsbRing[0]));
+		DSB->EmulateFrame();
+		DSB->MixFrame(ring[0], ring[1]);
+		dsbFrameDone->Post();
+	}
+}
+
 void CSoundBoard::Reset(void)
 {
+	StopMIDIRecording();
+	SyncDSBThread(true);
+
 	// Even if SCSP emulation is disabled, we must reset to establish a valid 68K state
 	memcpy(ram1, soundROM, 16);				// copy 68K vector table
 	ctrlReg = 0;							// set default banks
@@ -452,15 +782,28 @@ void CSoundBoard::SaveState(CBlockFile *SaveState)
 	SaveState->Write(&ctrlReg, sizeof(ctrlReg));
 	
 	// All other devices...
+	SyncDSBThread(false);
 	M68KSetContext(&M68K);
 	M68KSaveState(SaveState, "Sound Board 68K");
+	SCSP_SetContext(scspContext);
 	SCSP_SaveState(SaveState);
 	if (NULL != DSB)
 		DSB->SaveState(SaveState);
+
+	// The DSB thread's frame not yet mixed belongs to this state, having been
+	// emulated a frame ahead
+	if (NULL != dsbThread && dsbFramesStarted != dsbFramesMixed)
+	{
+		SaveState->NewBlock("Sound Board DSB Frame", __FILE__);
+		SaveState->Write(dsbRing[dsbFramesMixed % DSB_RING_FRAMES], sizeof(dsbRing[0]));
+	}
 }
 
 void CSoundBoard::LoadState(CBlockFile *SaveState)
 {
+	// A recording cannot be played back past a state change
+	StopMIDIRecording();
+
 	if (OKAY != SaveState->FindBlock("Sound Board"))
 	{
 		ErrorLog("Unable to load sound board state. Save state file is corrupt.");
@@ -476,9 +819,20 @@ void CSoundBoard::LoadState(CBlockFile *SaveState)
 	M68KSetContext(&M68K);	// so we don't lose callback pointers when copying context back
 	M68KLoadState(SaveState, "Sound Board 68K");
 	M68KGetContext(&M68K);
+	SCSP_SetContext(scspContext);
 	SCSP_LoadState(SaveState);
+	SyncDSBThread(true);
 	if (NULL != DSB)
 		DSB->LoadState(SaveState);
+	if (NULL != dsbThread && OKAY == SaveState->FindBlock("Sound Board DSB Frame"))
+	{
+		SaveState->Read(dsbRing[(dsbFramesStarted - 1) % DSB_RING_FRAMES], sizeof(dsbRing[0]));
+		dsbFramesMixed = dsbFramesStarted - 1;
+	}
+
+	// Commands queued before the state was loaded are dropped
+	midiQueueR.store(midiQueueW.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	midiReadFrame = midiWriteFrame.load(std::memory_order_relaxed);
 }
 
 
@@ -488,10 +842,40 @@ void CSoundBoard::LoadState(CBlockFile *SaveState)
 
 void CSoundBoard::AttachDSB(CDSB *DSBPtr)
 {
+	StopDSBThread();
 	DSB = DSBPtr;
+	if (NULL == DSB)
+		return;
 	DebugLog("Sound Board connected to DSB\n");
+
+	if (m_dsbThreaded)
+	{
+		dsbFrameStart = CThread::CreateSemaphore(0);
+		dsbFrameDone = CThread::CreateSemaphore(0);
+		if (NULL != dsbFrameStart && NULL != dsbFrameDone)
+			dsbThread = CThread::CreateThread("DSB", StartDSBThread, this);
+		if (NULL == dsbThread)
+		{
+			ErrorLog("Unable to create DSB thread: %s. Running the DSB on the sound board thread.", CThread::GetLastError());
+			delete dsbFrameStart;
+			delete dsbFrameDone;
+			dsbFrameStart = NULL;
+			dsbFrameDone = NULL;
+		}
+		dsbFramesStarted = dsbFramesDone = dsbFramesMixed = dsbThreadFrame = 0;
+	}
 }
 
+void CSoundBoard::AttachHost(IEmulatorHost *HostPtr)
+{
+	host = HostPtr;
+}
+
+
+size_t CSoundBoard::GetMemorySize(void) const
+{
+	return MEMORY_POOL_SIZE;
+}
 
 bool CSoundBoard::Init(const UINT8 *soundROMPtr, const UINT8 *sampleROMPtr)
 {
@@ -521,12 +905,19 @@ bool CSoundBoard::Init(const UINT8 *soundROMPtr, const UINT8 *sampleROMPtr)
 	M68KSetContext(&M68K);
 	M68KInit();
 	M68KAttachBus(this);
-	M68KSetIRQCallback(IRQAck);
+	M68KMapFetch(0x000000, 0x0FFFFF, ram1);
+	M68KMapFetch(0x200000, 0x2FFFFF, ram2);
+	M68KMapFetch(0x600000, 0x67FFFF, soundROM);
+	M68KSetIRQCallback(IRQAck, this);
 	M68KGetContext(&M68K);
 		
 	// Initialize SCSPs
+	scspContext = SCSP_CreateContext();
+	if (NULL == scspContext)
+		return ErrorLog("Insufficient memory for SCSP context.");
+	SCSP_SetContext(scspContext);
 	SCSP_SetBuffers(audioFL, audioFR, audioRL, audioRR, NUM_SAMPLES_PER_FRAME);
-	SCSP_SetCB(SCSP68KRunCallback, SCSP68KIRQCallback);
+	SCSP_SetCB(SCSP68KRunCallback, SCSP68KIRQCallback, this);
 	if (OKAY != SCSP_Init(m_config, 2))
 		return FAIL;
 	SCSP_SetRAM(0, ram1);
@@ -552,10 +943,40 @@ CDSB *CSoundBoard::GetDSB(void)
 	return DSB;
 }
 
+UINT64 CSoundBoard::GetIdleCycles(void)
+{
+	return idleCycles;
+}
+
 CSoundBoard::CSoundBoard(const Util::Config::Node &config)
-  : m_config(config)
+  : m_config(config),
+    m_emulateSound(config, "EmulateSound"),
+    m_idleSkip(config, "SoundIdleSkip"),
+    m_soundVolume(config, "SoundVolume"),
+    m_flipStereo(config, "FlipStereo"),
+    m_parallelSound(config["ParallelSound"].ValueAsDefault<bool>(false)),
+    m_dsbThreaded(config["DSBThread"].ValueAsDefault<bool>(false)),
+    dsbQuit(false),
+    dsbQueueW(0),
+    dsbQueueR(0),
+    midiQueueW(0),
+    midiWriteFrame(0),
+    midiQueueR(0)
 {
 	DSB = NULL;
+	dsbThread = NULL;
+	dsbFrameStart = NULL;
+	dsbFrameDone = NULL;
+	dsbFramesStarted = dsbFramesDone = dsbFramesMixed = dsbThreadFrame = 0;
+	memset(dsbQueueEnd, 0, sizeof(dsbQueueEnd));
+	host = NULL;
+	scspContext = NULL;
+	irqLine = 0;
+	idleSkip = true;
+	idleCycles = 0;
+	midiQueueEnabled = false;
+	midiQueueInStep = false;
+	midiReadFrame = 0;
 	memoryPool = NULL;
 	ram1 = NULL;
 	ram2 = NULL;
@@ -566,6 +987,9 @@ CSoundBoard::CSoundBoard(const Util::Config::Node &config)
 	soundROM = NULL;
 	sampleROM = NULL;
 	
+	midiRecordFP = NULL;
+	midiRecordStart = 0;
+	
 	DebugLog("Built Sound Board\n");
 }
 
@@ -589,7 +1013,16 @@ CSoundBoard::~CSoundBoard(void)
 	fclose(soundFP);
 #endif
 
-	SCSP_Deinit();
+	StopMIDIRecording();
+	StopDSBThread();
+
+	if (scspContext != NULL)
+	{
+		SCSP_SetContext(scspContext);
+		SCSP_Deinit();
+		SCSP_DestroyContext(scspContext);
+		scspContext = NULL;
+	}
 	
 	DSB = NULL;
 	
@@ -31,7 +31,12 @@
 #include "Types.h"
 #include "CPU/Bus.h"
 #include "Model3/DSB.h"
+#include "Model3/IEmulatorHost.h"
 #include "OSD/Thread.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
 
 /*
  * CSoundBoard:
@@ -41,6 +46,22 @@
 class CSoundBoard: public IBus
 {
 public:
+	// A byte written to the MIDI port and the main board frame it was written
+	// in
+	struct MIDIEntry
+	{
+		UINT32	frame;
+		UINT8	data;
+	};
+
+	// MIDI port writes recorded by StartMIDIRecording()
+	struct MIDIRecording
+	{
+		std::string				game;		// name of game recorded
+		UINT32					numFrames;	// main board frames recorded
+		std::vector<MIDIEntry>	entries;	// frames counted from 0
+	};
+
 	/*
 	 * Read8(addr):
 	 * Read16(addr):
@@ -78,12 +99,105 @@ public:
 	/*
 	 * WriteMIDIPort(data):
 	 *
-	 * Writes to the sound board MIDI port.
+	 * Writes to the sound board MIDI port. With the MIDI queue enabled, the
+	 * byte is queued and passed on by RunFrame().
 	 *
 	 * Parameters:
 	 *		data	Byte to write to MIDI port.
 	 */
 	void WriteMIDIPort(UINT8 data);
+
+	/*
+	 * EndMIDIFrame(void):
+	 *
+	 * Marks the end of a main board frame. Bytes written to the MIDI port are
+	 * timestamped with the number of frames ended so far. Must be called from
+	 * the thread that writes the MIDI port.
+	 */
+	void EndMIDIFrame(void);
+
+	/*
+	 * SetMIDIQueue(enable, inStep):
+	 *
+	 * Enables or disables the MIDI queue, which lets the sound board run on
+	 * its own thread, ahead of or behind the main board. While enabled, MIDI
+	 * port writes are put in a lock-free queue and each call to RunFrame()
+	 * passes on those written up to the main board frame it is playing back.
+	 * This goes forward by one frame per call, so commands from frames that
+	 * arrive late in a burst are spread out as they were written, and jumps
+	 * ahead when more than MIDI_QUEUE_MAX_LAG frames behind. Disabling the
+	 * queue passes on any bytes left in it straight away. Must not be called
+	 * while the sound board is running on another thread.
+	 *
+	 * With the sound board thread in step with the main board, running each
+	 * frame alongside it, each call to RunFrame() passes on exactly the bytes
+	 * of the main board frame before, which has always ended by then. The
+	 * commands are a frame late, but the same whatever the threads' timing.
+	 *
+	 * Parameters:
+	 *		enable	True to queue MIDI port writes, false to pass them on
+	 *				immediately.
+	 *		inStep	True if the main board and sound board run their frames
+	 *				at the same time.
+	 */
+	void SetMIDIQueue(bool enable, bool inStep = false);
+
+	/*
+	 * StartMIDIRecording(file, game):
+	 *
+	 * Records the bytes written to the MIDI port from here on to a file,
+	 * with the main board frame each was written in. Played back from a
+	 * reset, passing on the bytes of each frame before running the sound
+	 * board for it, the recording reproduces the sound board output. It
+	 * should therefore be started right after a reset. Recording stops when
+	 * the board is reset or a state is loaded. Must be called from the thread
+	 * that writes the MIDI port.
+	 *
+	 * Parameters:
+	 *		file	File to record to.
+	 *		game	Name of the game being recorded.
+	 *
+	 * Returns:
+	 *		OKAY if successful, FAIL if the file could not be created. Prints
+	 *		own error messages.
+	 */
+	bool StartMIDIRecording(const std::string &file, const std::string &game);
+
+	/*
+	 * StopMIDIRecording(void):
+	 *
+	 * Stops recording MIDI port writes, if recording, and closes the file.
+	 */
+	void StopMIDIRecording(void);
+
+	/*
+	 * LoadMIDIRecording(recording, file):
+	 *
+	 * Loads a recording made by StartMIDIRecording().
+	 *
+	 * Parameters:
+	 *		recording	Recording to load into.
+	 *		file		File to load.
+	 *
+	 * Returns:
+	 *		OKAY if successful, FAIL if the file could not be read or is not
+	 *		a MIDI recording. Prints own error messages.
+	 */
+	static bool LoadMIDIRecording(MIDIRecording *recording, const std::string &file);
+
+	/*
+	 * GetFrameAudio(channels):
+	 *
+	 * Returns the audio generated by the last call to RunFrame(), with the
+	 * sound volume applied and the Digital Sound Board mixed in, whether it
+	 * was output or not. Each channel is NUM_SAMPLES_PER_FRAME samples long.
+	 *
+	 * Parameters:
+	 *		channels	Set to the front left, front right, rear left and
+	 *					rear right channels, in that order. Valid until the
+	 *					next call to RunFrame().
+	 */
+	void GetFrameAudio(const float *channels[4]);
 	
 	/*
 	 * SaveState(SaveState):
@@ -106,11 +220,18 @@ public:
 	void LoadState(CBlockFile *SaveState);
 
 	/*
-	 * RunFrame(void):
+	 * RunFrame(outputAudio):
 	 *
 	 * Runs the sound board for one frame, updating sound in the process.
+	 *
+	 * Parameters:
+	 *		outputAudio	If false, the audio generated is discarded (for
+	 *					frames that are not on the real timeline).
+	 *
+	 * Returns:
+	 *		True if the audio output buffer is full.
 	 */
-	bool RunFrame(void);
+	bool RunFrame(bool outputAudio = true);
 	
 	/*
 	 * Reset(void):
@@ -124,12 +245,25 @@ public:
 	 *
 	 * Connects a Digital Sound Board. The sound board passes MIDI commands,
 	 * resets the board, and runs it each frame to generate audio. If there is
-	 * no DSB, this function does not need to be called.
+	 * no DSB, this function does not need to be called. With DSBThread set,
+	 * this starts the DSB's thread, and the DSB must be detached, by passing
+	 * NULL, before it is destroyed.
 	 *
 	 * Parameters:
-	 *		DSBPtr	Pointer to DSB object.
+	 *		DSBPtr	Pointer to DSB object, or NULL to detach it.
 	 */
 	void AttachDSB(CDSB *DSBPtr);
+
+	/*
+	 * AttachHost(HostPtr):
+	 *
+	 * Attaches the host that audio is output to. Without one, audio is only
+	 * available through GetFrameAudio().
+	 *
+	 * Parameters:
+	 *		HostPtr	Pointer to the host, or NULL.
+	 */
+	void AttachHost(IEmulatorHost *HostPtr);
 	
 	/*
 	 * GetMS68K(void):
@@ -151,6 +285,17 @@ public:
 	 */
 	CDSB *GetDSB(void);
 
+	/*
+	 * GetIdleCycles(void):
+	 *
+	 * Returns the total number of sound 68K cycles skipped in idle loops, for
+	 * diagnostics.
+	 *
+	 * Returns:
+	 *		Cycles skipped since startup.
+	 */
+	UINT64 GetIdleCycles(void);
+
 	/*
 	 * Init(soundROMPtr, sampleROMPtr):
 	 *
@@ -166,6 +311,9 @@ public:
 	 */
 	bool Init(const UINT8 *soundROMPtr, const UINT8 *sampleROMPtr);
 
+	// Size of sound board RAM and audio buffers, in bytes
+	size_t GetMemorySize(void) const;
+
 	/*
 	 * CSoundBoard(config):
 	 * ~CSoundBoard(void):
@@ -182,15 +330,82 @@ public:
 private:
 	// Private helper functions
 	void		UpdateROMBanks(void);
+	void		SendMIDI(UINT8 data);
+	void		RunMIDIQueue(bool flush);
+	void		RunSCSP(void);
+	void		MixDSBThreadFrame(float *audioL, float *audioR);
+	void		SyncDSBThread(bool discard);
+	void		StopDSBThread(void);
+	void		RunDSBThread(void);
+	static int	StartDSBThread(void *data);
+
+	// 68K callbacks, passed the sound board
+	static int	IRQAck(void *data, int irqLevel);
+	static void	SCSP68KIRQCallback(void *data, int irqLevel);
+	static int	SCSP68KRunCallback(void *data, int numCycles);
 	
 	// Config
 	const Util::Config::Node &m_config;
+	Util::Config::CachedValue<bool>	m_emulateSound;
+	Util::Config::CachedValue<bool>	m_idleSkip;
+	Util::Config::CachedValue<int>	m_soundVolume;
+	Util::Config::CachedValue<bool>	m_flipStereo;
+	bool	m_parallelSound;	// DSB emulated on the job pool alongside the SCSPs
+	bool	m_dsbThreaded;		// DSB emulated on its own thread, a frame ahead
 
 	// Digital Sound Board
 	CDSB		*DSB;
+
+	// DSB thread. Each frame, RunFrame() has the thread emulate the DSB for
+	// the commands sent so far and mixes in the frame it emulated the time
+	// before, so the DSB has a whole frame to run in. Commands reach it
+	// through a lock-free queue like the MIDI queue, and its output through a
+	// ring of frame buffers. Frames are counted by the sound board thread,
+	// except dsbThreadFrame. Each frame passes on the commands queued up to
+	// the end RunFrame() recorded for it when starting it, whenever the DSB
+	// thread gets to run, so that the result does not depend on timing.
+	static const unsigned	DSB_QUEUE_SIZE	= 4096;	// must be a power of two
+	static const unsigned	DSB_RING_FRAMES	= 2;
+	CThread					*dsbThread;
+	CSemaphore				*dsbFrameStart;	// posted for each frame to emulate
+	CSemaphore				*dsbFrameDone;	// posted as each has been emulated
+	std::atomic<bool>		dsbQuit;
+	UINT32					dsbFramesStarted, dsbFramesDone, dsbFramesMixed;
+	UINT32					dsbThreadFrame;
+	UINT8					dsbQueue[DSB_QUEUE_SIZE];
+	alignas(64) std::atomic<UINT32>	dsbQueueW;
+	alignas(64) std::atomic<UINT32>	dsbQueueR;
+	UINT32					dsbQueueEnd[DSB_RING_FRAMES];
+	float					dsbRing[DSB_RING_FRAMES][2][NUM_SAMPLES_PER_FRAME];
+
+	// Host that audio is output to (if any)
+	IEmulatorHost	*host;
+
+	// MIDI queue, written by the main board thread and read by the sound board
+	// thread. Positions are total numbers of entries written and read, kept
+	// on cache lines of their own as each is written by one of the threads.
+	static const unsigned	MIDI_QUEUE_SIZE		= 4096;	// must be a power of two
+	static const unsigned	MIDI_QUEUE_MAX_LAG	= 8;	// frames
+	bool					midiQueueEnabled;
+	bool					midiQueueInStep;
+	MIDIEntry				midiQueue[MIDI_QUEUE_SIZE];
+	alignas(64) std::atomic<UINT32>	midiQueueW;
+	std::atomic<UINT32>		midiWriteFrame;	// main board frames ended
+	alignas(64) std::atomic<UINT32>	midiQueueR;
+	UINT32					midiReadFrame;	// main board frame being played back
+
+	// MIDI recording, written by the main board thread
+	FILE					*midiRecordFP;
+	UINT32					midiRecordStart;	// main board frame recording started at
 	
 	// 68K context
 	M68KCtx		M68K;
+	int			irqLine;		// status of IRQ pins (IPL2-0) on 68K
+	bool		idleSkip;		// idle loop skipping (see SCSP68KRunCallback())
+	UINT64		idleCycles;		// total cycles skipped
+
+	// SCSP context
+	struct SCSP_CONTEXT	*scspContext;
 	
 	// Sound board memory
 	const UINT8	*soundROM;		// 68K program ROM (passed in from parent object)
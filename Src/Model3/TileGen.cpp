@@ -37,8 +37,10 @@
  * "computed" palettes.
  *
  * The computed palettes are updated whenever the real palette is modified, a
- * single color entry at a time. If the color register is modified, the entire
- * palette has to be recomputed accordingly.
+ * single color entry at a time. If a color offset register is modified, the
+ * palette it applies to has to be recomputed accordingly. To make that cheap,
+ * a third copy holds the decoded colors before any offset is applied, so the
+ * offset can be added to several entries at a time with SIMD instructions.
  *
  * The read-only copy of the palette, which is generated for the renderer, only
  * stores the two computed palettes.
@@ -53,31 +55,32 @@
 #include "TileGen.h"
 
 #include <cstring>
+#include <utility>
+#include <zlib.h>
 #include "Supermodel.h"
 
-// Macros that divide memory regions into pages and mark them as dirty when they are written to
-#define PAGE_WIDTH 10
-#define PAGE_SIZE (1<<PAGE_WIDTH)
-#define DIRTY_SIZE(arraySize) (1+(arraySize-1)/(8*PAGE_SIZE))
-#define MARK_DIRTY(dirtyArray, addr) dirtyArray[addr>>(PAGE_WIDTH+3)] |= 1<<((addr>>PAGE_WIDTH)&7)
+// SSE2 and NEON are part of the x64 and AArch64 base instruction sets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TILEGEN_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define TILEGEN_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
 // Offsets of memory regions within TileGen memory pool
 #define OFFSET_VRAM         0x000000	// VRAM and palette data
 #define OFFSET_PAL_A        0x120000	// computed A/A' palette
 #define OFFSET_PAL_B		0x140000	// computed B/B' palette 
-#define MEM_POOL_SIZE_RW    (0x120000+0x040000)
+#define OFFSET_PAL_BASE		0x160000	// decoded palette without color offsets
+#define MEM_POOL_SIZE_RW    (0x120000+0x060000)
 
-#define OFFSET_VRAM_RO      0x160000   // [read-only snapshot]
-#define OFFSET_PAL_RO_A     0x280000   // [read-only snapshot]
-#define OFFSET_PAL_RO_B		0x2A0000
+#define OFFSET_VRAM_RO      0x180000   // [read-only snapshot]
+#define OFFSET_PAL_RO_A     0x2A0000   // [read-only snapshot]
+#define OFFSET_PAL_RO_B		0x2C0000
 #define MEM_POOL_SIZE_RO    (0x120000+0x040000)
 
-#define OFFSET_VRAM_DIRTY   0x2C0000
-#define OFFSET_PAL_A_DIRTY  (OFFSET_VRAM_DIRTY+DIRTY_SIZE(0x120000))
-#define OFFSET_PAL_B_DIRTY	(OFFSET_PAL_A_DIRTY+DIRTY_SIZE(0x20000))
-#define MEM_POOL_SIZE_DIRTY (DIRTY_SIZE(0x120000)+2*DIRTY_SIZE(0x20000))	// VRAM + 2 palette dirty buffers
-
-#define MEMORY_POOL_SIZE	(MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO+MEM_POOL_SIZE_DIRTY)
+#define MEMORY_POOL_SIZE	(MEM_POOL_SIZE_RW+MEM_POOL_SIZE_RO)
 
 
 /******************************************************************************
@@ -87,10 +90,17 @@
 void CTileGen::SaveState(CBlockFile *SaveState)
 {
 	SaveState->NewBlock("Tile Generator", __FILE__);
+	ReplaySnapshots(NULL);
 	SaveState->Write(vram, 0x120000); // Don't write out palette, read-only snapshots or dirty page arrays, just VRAM
 	SaveState->Write(regs, sizeof(regs));
 }
 
+UINT32 CTileGen::GetMemoryHash(void)
+{
+	ReplaySnapshots(NULL);
+	return UINT32(crc32(0, vram, 0x120000));
+}
+
 void CTileGen::LoadState(CBlockFile *SaveState)
 {
 	if (OKAY != SaveState->FindBlock("Tile Generator"))
@@ -99,22 +109,49 @@ void CTileGen::LoadState(CBlockFile *SaveState)
 		return;
 	}
 	
-	// Load memory one word at a time
+	// Load memory one word at a time. Only the words that differ are written,
+	// so that just their pages are marked dirty.
 	for (int i = 0; i < 0x120000; i += 4)
 	{
 		UINT32 data;
 	
 		SaveState->Read(&data, sizeof(data));
-		WriteRAM32(i, data);
+		if (*(UINT32 *) &vram[i] != data)
+			WriteRAM32(i, data);
 	}	
 	SaveState->Read(regs, sizeof(regs));
 	
 	// Because regs were read after palette, must recompute
 	RecomputePalettes();
 	
-	// If multi-threaded, update read-only snapshots too
+	// A renderer keeping its own copy is given just the VRAM pages that differ
+	// from what it has, which multi-threaded are those of the snapshot, and
+	// the whole of the recomputed palettes
 	if (m_gpuMultiThreaded)
-		UpdateSnapshots(true);
+	{
+		CDirtyPages vramChanged;
+		vramChanged.Init(0x120000, vramDirty.PageSize());
+		for (UINT32 offset = 0; offset < 0x120000; offset += vramDirty.PageSize())
+		{
+			if (memcmp(&vram[offset], &vramRO[offset], vramDirty.PageSize()) != 0)
+				vramChanged.Mark(offset);
+		}
+		CDirtyPages palChanged[2];
+		palChanged[0].Swap(palDirty[0]);
+		palChanged[1].Swap(palDirty[1]);
+		palDirty[0].Init(0x020000, palChanged[0].PageSize());
+		palDirty[1].Init(0x020000, palChanged[1].PageSize());
+		ResetSnapshots();
+		if (Render2D != NULL && Render2D->UsesDirtyPages())
+			Render2D->MarkDirty(vramChanged, palChanged);
+	}
+	else if (m_trackDirtyPages && Render2D != NULL)
+	{
+		Render2D->MarkDirty(vramDirty, palDirty);
+		vramDirty.Clear();
+		palDirty[0].Clear();
+		palDirty[1].Clear();
+	}
 }
 
 
@@ -143,108 +180,202 @@ void CTileGen::EndVBlank(void)
 	//
 }
 
-void CTileGen::RecomputePalettes(void)
+static inline UINT32 AddColorOffset(UINT32 color, UINT32 offsetReg)
 {
-	// Writing the colors forces palettes to be computed
-	if (m_gpuMultiThreaded)
+	UINT8	r = (color>>0)&0xFF, g = (color>>8)&0xFF, b = (color>>16)&0xFF, a = (color>>24)&0xFF;
+	INT32	ir, ig, ib;
+	
+	/*
+	 * Color offsets are signed but I'm not sure whether or not their range is 
+	 * merely [-128,+127], which would mean adding to a 0 component would not 
+	 * result full intensity (only +127 at most). Alternatively, the signed 
+	 * value might have to be multiplied by 2. That is assumed here. In either 
+	 * case, the signed addition should be saturated.
+	 */
+
+	ib = (INT32) (INT8)((offsetReg>>16)&0xFF);
+	ig = (INT32) (INT8)((offsetReg>>8)&0xFF);
+	ir = (INT32) (INT8)((offsetReg>>0)&0xFF);
+	ib *= 2;
+	ig *= 2;
+	ir *= 2;
+	
+	// Add with saturation
+	ib += (INT32) (UINT32) b;
+	if (ib < 0)			ib = 0;
+	else if (ib > 0xFF)	ib = 0xFF;
+	ig += (INT32) (UINT32) g;
+	if (ig < 0)			ig = 0;
+	else if (ig > 0xFF)	ig = 0xFF;
+	ir += (INT32) (UINT32) r;
+	if (ir < 0)			ir = 0;
+	else if (ir > 0xFF)	ir = 0xFF;
+	
+	// Construct the final 32-bit ABGR-format color
+	r = (UINT8) ir;
+	g = (UINT8) ig;
+	b = (UINT8) ib;
+	return ((UINT32)a<<24)|((UINT32)b<<16)|((UINT32)g<<8)|(UINT32)r;
+}
+
+void CTileGen::RecomputePalette(int which)
+{
+	// Add the color offset to every decoded color. Components are widened to
+	// 16 bits so that the (doubled) signed offset can be added and the result
+	// saturated to [0,255] when narrowing back. Alpha is left as is.
+	UINT32 offsetReg = regs[0x40/4 + which];
+	INT16 r = 2 * (INT8)((offsetReg>>0)&0xFF);
+	INT16 g = 2 * (INT8)((offsetReg>>8)&0xFF);
+	INT16 b = 2 * (INT8)((offsetReg>>16)&0xFF);
+	UINT32 *dest = pal[which];
+	if (r == 0 && g == 0 && b == 0)
+		memcpy(dest, palBase, 32768*4);
+	else
 	{
-		for (unsigned colorAddr = 0; colorAddr < 32768*4; colorAddr += 4 )
+#if defined(TILEGEN_SIMD_SSE2)
+		const __m128i offset = _mm_set_epi16(0, b, g, r, 0, b, g, r);
+		const __m128i zero = _mm_setzero_si128();
+		for (int i = 0; i < 32768; i += 4)
 		{
-			MARK_DIRTY(palDirty[0], colorAddr);
-			MARK_DIRTY(palDirty[1], colorAddr);
-			WritePalette(colorAddr/4, *(UINT32 *) &vram[0x100000+colorAddr]);
+			__m128i colors = _mm_loadu_si128((const __m128i *) &palBase[i]);
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(colors, zero), offset);
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(colors, zero), offset);
+			_mm_storeu_si128((__m128i *) &dest[i], _mm_packus_epi16(lo, hi));
 		}
+#elif defined(TILEGEN_SIMD_NEON)
+		const INT16 offsets[8] = { r, g, b, 0, r, g, b, 0 };
+		const int16x8_t offset = vld1q_s16(offsets);
+		for (int i = 0; i < 32768; i += 4)
+		{
+			uint8x16_t colors = vld1q_u8((const uint8_t *) &palBase[i]);
+			int16x8_t lo = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(colors))), offset);
+			int16x8_t hi = vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(colors))), offset);
+			vst1q_u8((uint8_t *) &dest[i], vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+		}
+#else
+		for (int i = 0; i < 32768; i++)
+			dest[i] = AddColorOffset(palBase[i], offsetReg);
+#endif
 	}
-	else
-	{
-		for (unsigned colorAddr = 0; colorAddr < 32768*4; colorAddr += 4 )
-			WritePalette(colorAddr/4, *(UINT32 *) &vram[0x100000+colorAddr]);
-	}
+
+	// Whole palette must be marked dirty
+	if (m_trackDirtyPages)
+		palDirty[which].MarkRange(0, 32768*4);
+}
+
+void CTileGen::RecomputePalettes(void)
+{
+	RecomputePalette(0);
+	RecomputePalette(1);
 }
 
 UINT32 CTileGen::SyncSnapshots(void)
 {
+	// VRAM and palettes must be complete before they are modified or become the snapshots
+	UINT32 copied = ReplaySnapshots(NULL);
+
 	// Good time to recompute the palettes
-	if (recomputePalettes)
+	for (int i = 0; i < 2; i++)
 	{
-		RecomputePalettes();
-		recomputePalettes = false;
+		if (recomputePalette[i])
+		{
+			RecomputePalette(i);
+			recomputePalette[i] = false;
+		}
 	}
 	
 	if (!m_gpuMultiThreaded)
+	{
+		// Pass on what changed this frame to a renderer keeping its own copy
+		if (m_trackDirtyPages && Render2D != NULL)
+		{
+			Render2D->MarkDirty(vramDirty, palDirty);
+			vramDirty.Clear();
+			palDirty[0].Clear();
+			palDirty[1].Clear();
+		}
 		return 0;
+	}
 	
-	// Update read-only snapshots
-	return UpdateSnapshots(false);
+	// Exchange the snapshots with VRAM and the palettes. These are then one frame
+	// behind, by the pages dirtied during this frame, which will be copied back
+	// into them by ReplaySnapshots() while this frame is rendered.
+	std::swap(vram, vramRO);
+	std::swap(pal[0], palRO[0]);
+	std::swap(pal[1], palRO[1]);
+	vramDirty.Swap(vramReplay);
+	palDirty[0].Swap(palReplay[0]);
+	palDirty[1].Swap(palReplay[1]);
+	replayPending = true;
+	if (Render2D != NULL)
+	{
+		Render2D->AttachVRAM(vramRO);
+		Render2D->AttachPalette((const UINT32 **)palRO);
+		if (Render2D->UsesDirtyPages())
+			Render2D->MarkDirty(vramReplay, palReplay);	// what the new snapshots have that the old ones did not
+	}
+	memcpy(regsRO, regs, sizeof(regs)); // Always copy whole of regs buffer
+	return copied + sizeof(regs);
 }
 
-UINT32 CTileGen::UpdateSnapshot(bool copyWhole, UINT8 *src, UINT8 *dst, unsigned size, UINT8 *dirty)
+UINT32 CTileGen::ReplaySnapshots(TileGenSnapshotStats *stats)
 {
-	unsigned dirtySize = DIRTY_SIZE(size);
-	if (copyWhole)
+	TileGenSnapshotStats copied = { 0, 0 };
+	if (replayPending)
 	{
-		// If updating whole region, then just copy all data in one go
-		memcpy(dst, src, size);
-		memset(dirty, 0, dirtySize);
-		return size;
-	}
-	else
-	{
-		// Otherwise, loop through dirty pages array to find out what needs to be updated and copy only those parts
-		UINT32 copied = 0;
-		UINT8 *pSrc = src;
-		UINT8 *pDst = dst;
-		for (unsigned i = 0; i < dirtySize; i++)
-		{
-			UINT8 d = dirty[i];
-			if (d)
-			{
-				for (unsigned j = 0; j < 8; j++)
-				{
-					if (d&1)
-					{
-						// If not at very end of region, then copy an extra 4 bytes to allow for a possible 32-bit overlap
-						UINT32 toCopy = (i < dirtySize - 1 || j < 7 ? PAGE_SIZE + 4 : PAGE_SIZE);
-						memcpy(pDst, pSrc, toCopy);
-						copied += toCopy;
-					}
-					d >>= 1;
-					pSrc += PAGE_SIZE;	
-					pDst += PAGE_SIZE;
-				}
-				dirty[i] = 0;
-			}
-			else
-			{
-				pSrc += 8 * PAGE_SIZE;	
-				pDst += 8 * PAGE_SIZE;
-			}
-		}
-		return copied;
+		// Copy pages dirtied during the previous frame from the snapshots
+		copied.vram = vramReplay.Copy(vram, vramRO);
+		copied.palettes = palReplay[0].Copy((UINT8*)pal[0], (const UINT8*)palRO[0]);
+		copied.palettes += palReplay[1].Copy((UINT8*)pal[1], (const UINT8*)palRO[1]);
+		replayPending = false;
 	}
+	if (stats != NULL)
+		*stats = copied;
+	return copied.vram + copied.palettes;
 }
 
-UINT32 CTileGen::UpdateSnapshots(bool copyWhole)
+void CTileGen::ResetSnapshots(void)
 {
-	// Update all memory region snapshots
-	UINT32 palACopied  = UpdateSnapshot(copyWhole, (UINT8*)pal[0],  (UINT8*)palRO[0],  0x020000, palDirty[0]);
-	UINT32 palBCopied  = UpdateSnapshot(copyWhole, (UINT8*)pal[1],  (UINT8*)palRO[1],  0x020000, palDirty[1]);
-	UINT32 vramCopied = UpdateSnapshot(copyWhole, (UINT8*)vram, (UINT8*)vramRO, 0x120000, vramDirty);
-	memcpy(regsRO, regs, sizeof(regs)); // Always copy whole of regs buffer
-	//printf("TileGen copied - palA:%4uK, palB:%4uK, vram:%4uK, regs:%uK\n", palACopied / 1024, palBCopied / 1024, vramCopied / 1024, sizeof(regs) / 1024);
-	return palACopied + palBCopied + vramCopied + sizeof(regs);
+	// Copy whole of all memory regions, leaving nothing to replay
+	memcpy(palRO[0], pal[0], 0x020000);
+	memcpy(palRO[1], pal[1], 0x020000);
+	memcpy(vramRO, vram, 0x120000);
+	memcpy(regsRO, regs, sizeof(regs));
+	ClearDirtyPages();
+}
+
+void CTileGen::ClearDirtyPages(void)
+{
+	vramDirty.Clear();
+	palDirty[0].Clear();
+	palDirty[1].Clear();
+	vramReplay.Clear();
+	palReplay[0].Clear();
+	palReplay[1].Clear();
+	replayPending = false;
+}
+
+void CTileGen::MarkRendererDirty(void)
+{
+	// Memory was changed wholesale, so a renderer keeping its own copy must
+	// update all of it
+	if (Render2D != NULL && Render2D->UsesDirtyPages())
+		Render2D->MarkAllDirty();
 }
 
 void CTileGen::BeginFrame(void)
 {
 	// NOTE: Render2D->WriteVRAM(addr, data) is no longer being called for RAM addresses that are written
-	// to and instead this class relies upon the fact that Render2D currently marks everything as dirty
-	// with every frame.  If this were to change in the future then code to handle marking the correct
-	// parts of the renderer as dirty would need to be added here.
+	// to. Renderers that keep a copy of VRAM instead receive the dirty pages in SyncSnapshots().
 	
 	Render2D->BeginFrame();
 }
 
+bool CTileGen::StartPreRenderFrame(void)
+{
+  return Render2D->StartPreRenderFrame();
+}
+
 void CTileGen::PreRenderFrame(void)
 {
   Render2D->PreRenderFrame();
@@ -276,8 +407,8 @@ UINT32 CTileGen::ReadRAM32(unsigned addr)
 
 void CTileGen::WriteRAM32(unsigned addr, UINT32 data)
 {
-	if (m_gpuMultiThreaded)
-		MARK_DIRTY(vramDirty, addr);
+	if (m_trackDirtyPages)
+		vramDirty.Mark(addr);
 	*(UINT32 *) &vram[addr] = data;
 		
 	// Update palette if required
@@ -287,10 +418,10 @@ void CTileGen::WriteRAM32(unsigned addr, UINT32 data)
 		unsigned color = addr/4;	// color index
 		
 		// Same address in both palettes must be marked dirty
-		if (m_gpuMultiThreaded)
+		if (m_trackDirtyPages)
 		{
-			MARK_DIRTY(palDirty[0], addr);
-			MARK_DIRTY(palDirty[1], addr);
+			palDirty[0].Mark(addr);
+			palDirty[1].Mark(addr);
 		}
 			
 		// Both palettes will be modified simultaneously
@@ -343,43 +474,6 @@ void CTileGen::InitPalette(void)
 	}
 }
 
-static inline UINT32 AddColorOffset(UINT8 r, UINT8 g, UINT8 b, UINT8 a, UINT32 offsetReg)
-{
-	INT32	ir, ig, ib;
-	
-	/*
-	 * Color offsets are signed but I'm not sure whether or not their range is 
-	 * merely [-128,+127], which would mean adding to a 0 component would not 
-	 * result full intensity (only +127 at most). Alternatively, the signed 
-	 * value might have to be multiplied by 2. That is assumed here. In either 
-	 * case, the signed addition should be saturated.
-	 */
-
-	ib = (INT32) (INT8)((offsetReg>>16)&0xFF);
-	ig = (INT32) (INT8)((offsetReg>>8)&0xFF);
-	ir = (INT32) (INT8)((offsetReg>>0)&0xFF);
-	ib *= 2;
-	ig *= 2;
-	ir *= 2;
-	
-	// Add with saturation
-	ib += (INT32) (UINT32) b;
-	if (ib < 0)			ib = 0;
-	else if (ib > 0xFF)	ib = 0xFF;
-	ig += (INT32) (UINT32) g;
-	if (ig < 0)			ig = 0;
-	else if (ig > 0xFF)	ig = 0xFF;
-	ir += (INT32) (UINT32) r;
-	if (ir < 0)			ir = 0;
-	else if (ir > 0xFF)	ir = 0xFF;
-	
-	// Construct the final 32-bit ABGR-format color
-	r = (UINT8) ir;
-	g = (UINT8) ig;
-	b = (UINT8) ib;
-	return ((UINT32)a<<24)|((UINT32)b<<16)|((UINT32)g<<8)|(UINT32)r;
-}
-
 void CTileGen::WritePalette(unsigned color, UINT32 data)
 {
 	UINT8		r, g, b, a;
@@ -396,8 +490,10 @@ void CTileGen::WritePalette(unsigned color, UINT32 data)
 		r = ((data & 0x1F) * 255) / 31;
 	}
 
-	pal[0][color] = AddColorOffset(r, g, b, a, regs[0x40/4]);	// A/A'
-	pal[1][color] = AddColorOffset(r, g, b, a, regs[0x44/4]);	// B/B'
+	UINT32 base = ((UINT32)a<<24)|((UINT32)b<<16)|((UINT32)g<<8)|(UINT32)r;
+	palBase[color] = base;
+	pal[0][color] = AddColorOffset(base, regs[0x40/4]);	// A/A'
+	pal[1][color] = AddColorOffset(base, regs[0x44/4]);	// B/B'
 }
 
 UINT32 CTileGen::ReadRegister(unsigned reg)
@@ -423,11 +519,11 @@ void CTileGen::WriteRegister(unsigned reg, UINT32 data)
 		break;
 	case 0x40:	// layer A/A' color offset
 	case 0x44:	// layer B/B' color offset
-		// We only have a mechanism to recompute both palettes simultaneously.
-		// These regs are often written together in the same frame. To avoid
-		// needlessly recomputing both palettes twice, we defer the operation.
+		// Only the palette the register applies to is recomputed. These regs
+		// are often written several times in the same frame, so the operation
+		// is deferred until the sync.
 		if (regs[reg/4] != data)	// only if changed
-			recomputePalettes = true;
+			recomputePalette[(reg - 0x40) / 4] = true;
 		break;
 	case 0x10:	// IRQ acknowledge
 		IRQ->Deassert(data&0xFF);
@@ -450,9 +546,12 @@ void CTileGen::Reset(void)
 	memset(memoryPool, 0, memSize);
 	memset(regs, 0, sizeof(regs));
 	memset(regsRO, 0, sizeof(regsRO));
+	if (m_gpuMultiThreaded)
+		ClearDirtyPages();
 	
 	InitPalette();
-	recomputePalettes = false;
+	recomputePalette[0] = recomputePalette[1] = false;
+	MarkRendererDirty();
 
 	DebugLog("Tile Generator reset\n");
 }
@@ -466,6 +565,16 @@ void CTileGen::AttachRenderer(CRender2D *Render2DPtr)
 {
 	Render2D = Render2DPtr;
 
+	// Track written pages for the renderer even when not multi-threaded, if it
+	// needs them. A new renderer starts out with everything dirty.
+	m_trackDirtyPages = m_gpuMultiThreaded || Render2D->UsesDirtyPages();
+	if (!m_gpuMultiThreaded)
+	{
+		vramDirty.Clear();
+		palDirty[0].Clear();
+		palDirty[1].Clear();
+	}
+
 	// If multi-threaded, attach read-only snapshots to renderer instead of real ones
 	if (m_gpuMultiThreaded)
 	{
@@ -484,6 +593,11 @@ void CTileGen::AttachRenderer(CRender2D *Render2DPtr)
 }
 
 
+size_t CTileGen::GetMemorySize(void) const
+{
+	return m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW;
+}
+
 bool CTileGen::Init(CIRQ *IRQObjectPtr)
 {
 	unsigned memSize   = (m_gpuMultiThreaded ? MEMORY_POOL_SIZE : MEM_POOL_SIZE_RW);
@@ -498,16 +612,23 @@ bool CTileGen::Init(CIRQ *IRQObjectPtr)
 	vram = (UINT8 *) &memoryPool[OFFSET_VRAM];
 	pal[0] = (UINT32 *) &memoryPool[OFFSET_PAL_A];
 	pal[1] = (UINT32 *) &memoryPool[OFFSET_PAL_B];
+	palBase = (UINT32 *) &memoryPool[OFFSET_PAL_BASE];
+
+	// Dirty page arrays are used by the renderer even if not multi-threaded
+	unsigned pageSize = m_config["SnapshotPageSize"].ValueAsDefault<unsigned>(1024);
+	vramDirty.Init(0x120000, pageSize);
+	palDirty[0].Init(0x020000, pageSize);
+	palDirty[1].Init(0x020000, pageSize);
 
-	// If multi-threaded, set up pointers for read-only snapshots and dirty page arrays too
+	// If multi-threaded, set up pointers for read-only snapshots and replay arrays too
 	if (m_gpuMultiThreaded)
 	{
 		vramRO = (UINT8 *) &memoryPool[OFFSET_VRAM_RO];
 		palRO[0] = (UINT32 *) &memoryPool[OFFSET_PAL_RO_A];
 		palRO[1] = (UINT32 *) &memoryPool[OFFSET_PAL_RO_B];
-		vramDirty = (UINT8 *) &memoryPool[OFFSET_VRAM_DIRTY];
-		palDirty[0] = (UINT8 *) &memoryPool[OFFSET_PAL_A_DIRTY];
-		palDirty[1] = (UINT8 *) &memoryPool[OFFSET_PAL_B_DIRTY];
+		vramReplay.Init(0x120000, pageSize);
+		palReplay[0].Init(0x020000, pageSize);
+		palReplay[1].Init(0x020000, pageSize);
 	}
 
 	// Hook up the IRQ controller
@@ -519,10 +640,13 @@ bool CTileGen::Init(CIRQ *IRQObjectPtr)
 
 CTileGen::CTileGen(const Util::Config::Node &config)
   : m_config(config),
-    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>())
+    m_gpuMultiThreaded(config["GPUMultiThreaded"].ValueAs<bool>()),
+    m_trackDirtyPages(m_gpuMultiThreaded)
 {
 	IRQ = NULL;
+	Render2D = NULL;
 	memoryPool = NULL;
+	replayPending = false;
 	DebugLog("Built Tile Generator\n");
 }
 
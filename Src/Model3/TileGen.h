@@ -29,8 +29,21 @@
 #define INCLUDED_TILEGEN_H
 
 #include "IRQ.h"
+#include "DirtyPages.h"
 #include "Graphics/Render2D.h"
 
+/*
+ * TileGenSnapshotStats:
+ *
+ * Bytes copied per memory region to keep the read-only snapshots used by
+ * multi-threaded rendering in sync, for tuning the snapshot page size.
+ */
+struct TileGenSnapshotStats
+{
+	UINT32	vram;
+	UINT32	palettes;	// both computed palettes
+};
+
 /*
  * CTileGen:
  *
@@ -59,6 +72,14 @@ public:
 	 *		SaveState	Block file to load state information from.
 	 */
 	void LoadState(CBlockFile *SaveState);
+
+	/*
+	 * GetMemoryHash(void):
+	 *
+	 * Returns:
+	 *		CRC-32 of VRAM (including the palette), for comparing runs.
+	 */
+	UINT32 GetMemoryHash(void);
 	
 	/*
 	 * BeginVBlank(void):
@@ -82,9 +103,33 @@ public:
 	 * end of each frame when both the render thread and the PPC thread have finished
 	 * their work.  If multi-threaded rendering is not enabled, then this method does
 	 * nothing.
+	 *
+	 * The snapshots are exchanged with VRAM and the palettes by pointer, so only
+	 * the registers are copied here unless ReplaySnapshots() was not called since
+	 * the last sync.
+	 *
+	 * Returns:
+	 *		Number of bytes copied.
 	 */
 	UINT32 SyncSnapshots(void);
 
+	/*
+	 * ReplaySnapshots(void):
+	 *
+	 * Brings VRAM and the palettes, which SyncSnapshots() left one frame behind,
+	 * up to date by copying into them the pages written during the previous
+	 * frame. Must be called before the PPC next accesses the tile generator. As
+	 * it only reads the snapshots, it may run in the PPC thread while the render
+	 * thread is busy.
+	 *
+	 * Parameters:
+	 *		stats	If not NULL, receives the number of bytes copied per region.
+	 *
+	 * Returns:
+	 *		Number of bytes copied.
+	 */
+	UINT32 ReplaySnapshots(TileGenSnapshotStats *stats);
+
 	/*
 	 * BeginFrame(void):
 	 *
@@ -96,6 +141,20 @@ public:
 	 */
 	void BeginFrame(void);
 
+  /*
+   * StartPreRenderFrame(void):
+   *
+   * Starts drawing the layers on a worker thread, if the 2D renderer draws
+   * them asynchronously, to be finished by PreRenderFrame().  Must be called
+   * after BeginFrame().
+   *
+   * Invokes the equivalent method in the underlying 2D renderer.
+   *
+   * Returns:
+   *    True if drawing was started.
+   */
+  bool StartPreRenderFrame(void);
+
   /*
    * PreRenderFrame(void):
    *
@@ -238,6 +297,9 @@ public:
 	 *		occurred. Prints own error messages.
 	 */
 	bool Init(CIRQ *IRQObjectPtr);
+
+	// Size of tile generator memory, including snapshots, in bytes
+	size_t GetMemorySize(void) const;
 	 
 	/*
 	 * CTileGen(config):
@@ -254,14 +316,17 @@ public:
 	
 private:
 	// Private member functions
+	void		RecomputePalette(int which);
 	void		RecomputePalettes(void);
 	void		InitPalette(void);
 	void		WritePalette(unsigned color, UINT32 data);
-	UINT32		UpdateSnapshots(bool copyWhole);
-	UINT32		UpdateSnapshot(bool copyWhole, UINT8 *src, UINT8 *dst, unsigned size, UINT8 *dirty);
+	void		ResetSnapshots(void);
+	void		ClearDirtyPages(void);
+	void		MarkRendererDirty(void);
 
   const Util::Config::Node &m_config;
   const bool m_gpuMultiThreaded;
+  bool m_trackDirtyPages;	// multi-threaded or renderer keeps its own copy of VRAM (CRender2D::UsesDirtyPages())
 
 	CIRQ		*IRQ;		// IRQ controller the tile generator is attached to
 	CRender2D	*Render2D;	// 2D renderer the tile generator is attached to
@@ -274,15 +339,21 @@ private:
 	UINT8	*memoryPool;		// all memory allocated here
 	UINT8   *vram;          	// 1.125MB of VRAM
 	UINT32	*pal[2];			// 2 x 0x20000 byte (32K colors) palette
-	bool	recomputePalettes;	// whether to recompute palettes A/A' and B/B' during sync
+	UINT32	*palBase;			// 0x20000 byte palette decoded without color offsets
+	bool	recomputePalette[2];	// whether to recompute palettes A/A' and B/B' during sync
 
 	// Read-only snapshots
 	UINT8   *vramRO;        // 1.125MB of VRAM                       [read-only snapshot]	
 	UINT32  *palRO[2];      // 2 x 0x20000 byte (32K colors) palette [read-only snapshot]
 	
-	// Arrays to keep track of dirty pages in memory regions
-	UINT8   *vramDirty;
-	UINT8   *palDirty[2];	// one for each palette
+	// Dirty pages in memory regions (also passed to the renderer if it uses them)
+	CDirtyPages	vramDirty;
+	CDirtyPages	palDirty[2];	// one for each palette
+
+	// Pages dirtied during the previous frame, still to be copied by ReplaySnapshots()
+	CDirtyPages	vramReplay;
+	CDirtyPages	palReplay[2];
+	bool	replayPending;
 
 	// Registers
 	UINT32	regs[64];
@@ -26,6 +26,7 @@
 #include "Types.h"
 #include "Game.h"
 #include "BlockFile.h"
+#include "NetStats.h"
 
 class INetBoard
 {
@@ -43,6 +44,25 @@ public:
 	virtual bool IsAttached(void) = 0;
 	virtual bool IsRunning(void) = 0;
 
+	// Time spent waiting for messages from the other machines in the last frame
+	virtual UINT64 GetWaitMicros(void) = 0;
+
+	// Stats of the link with the other machines, false if not kept
+	virtual bool GetLinkStats(NetLinkStats *stats) = 0;
+
+	/*
+	 * Rolling back (see CModel3::RunFrameRollback()):
+	 *
+	 * GetFrame() is the number of the next frame RunFrame() exchanges with
+	 * the other machines. GetRollback() returns a frame already exchanged
+	 * with data that was predicted wrong, from which the frames must be run
+	 * again, each starting from the state saved before its exchange and
+	 * ending with ReplayFrame(), which exchanges it again without waiting.
+	 */
+	virtual UINT32 GetFrame(void) = 0;
+	virtual bool GetRollback(UINT32 *frame) = 0;
+	virtual void ReplayFrame(UINT32 frame) = 0;
+
 	virtual bool Init(UINT8* netRAMPtr, UINT8* netBufferPtr) = 0;
 
 	virtual void GetGame(const Game&) = 0;
@@ -0,0 +1,51 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef INCLUDED_INETLINK_H
+#define INCLUDED_INETLINK_H
+
+#include <vector>
+
+/*
+ * INetLink:
+ *
+ * Both ends of one machine's hop in the ring of linked machines: messages
+ * are sent to the next machine and received from the previous one, in order.
+ * An empty message means the link is broken. Used by the simulated net board
+ * for the links other than TCP, whose ends are TCPSend and TCPReceive.
+ */
+class INetLink
+{
+public:
+	virtual ~INetLink()
+	{
+	}
+
+	virtual bool Send(const void* data, int length) = 0;
+	virtual bool CheckDataAvailable(int timeoutMS = 0) = 0;	// timeoutMS -1 = wait forever until data arrives, 0 = no waiting, 1+ wait time in milliseconds
+	virtual std::vector<char>& Receive() = 0;
+	virtual bool Connect() = 0;
+	virtual bool Connected() = 0;
+	virtual unsigned QueueDepth() = 0;						// messages waiting to be received
+};
+
+#endif	// INCLUDED_INETLINK_H
@@ -98,6 +98,7 @@
 #include "NetBoard.h"
 #include "Util/Format.h"
 #include "Util/ByteSwap.h"
+#include "OSD/Thread.h"
 #include <algorithm>
 
 // few macros to make debugging a bit less painful
@@ -139,6 +140,11 @@ int NetIRQAck(int irqLevel)
 	return M68K_IRQ_AUTOVECTOR;
 }
 
+static int NetIRQAckCallback(void *data, int irqLevel)
+{
+	return NetIRQAck(irqLevel);
+}
+
 // SCSP callback for generating IRQs
 void NET68KIRQCallback(int irqLevel)
 {
@@ -589,7 +595,9 @@ void CNetBoard::Write8(UINT32 a, UINT8 d)
 			case 0x80:
 				DebugLog("receive enable off=%x size=%x\n", recv_offset, recv_size);
 				{
+					UINT64 start = CThread::GetMicroseconds();
 					auto &recv_data = netr->Receive();
+					m_waitMicros += CThread::GetMicroseconds() - start;
 					memcpy(CommRAM + recv_offset, recv_data.data(), recv_data.size());
 				}
 
@@ -1150,7 +1158,8 @@ bool CNetBoard::Init(UINT8 * netRAMPtr, UINT8 *netBufferPtr)
 	M68KSetContext(&M68K);
 	M68KInit();
 	M68KAttachBus(this);
-	M68KSetIRQCallback(NetIRQAck);
+	M68KMapFetch(0x000000, 0x00FFFF, RAM);
+	M68KSetIRQCallback(NetIRQAckCallback);
 	//M68KSetIRQCallback(NULL);
 	M68KGetContext(&M68K);
 	//Net_SetCB(NET68KRunCallback, NET68KIRQCallback);
@@ -1164,17 +1173,18 @@ bool CNetBoard::Init(UINT8 * netRAMPtr, UINT8 *netBufferPtr)
 	nets = std::make_unique<TCPSend>(addr_out, port_out);
 	netr = std::make_unique<TCPReceive>(port_in);
 
+	// connected in the background; messages sent before then are lost, as
+	// they would be on a real link that is down
 	if (m_config["Network"].ValueAs<bool>() && m_attached) {
-		while (!nets->Connect()) {
-			printf("Connecting to %s:%i ..\n", addr_out.c_str(), port_out);
-		}
-		printf("Successfully connected.\n");
+		m_connector.Start(addr_out + ":" + std::to_string(port_out),
+			[this]() { return nets->Connected() && netr->Connected(); },
+			[this]() { return nets->Connected() || nets->Connect(); });
 	}
 
 	return OKAY;
 }
 
-CNetBoard::CNetBoard(const Util::Config::Node &config) : m_config(config)
+CNetBoard::CNetBoard(const Util::Config::Node &config) : m_config(config), m_idleSkip(config, "NetIdleSkip")
 {
 	memoryPool	= NULL;
 	bank		= NULL;
@@ -1194,6 +1204,8 @@ CNetBoard::CNetBoard(const Util::Config::Node &config) : m_config(config)
 
 CNetBoard::~CNetBoard(void)
 {
+	m_connector.Stop();
+
 	SAFE_ARRAY_DELETE(memoryPool);
 	SAFE_ARRAY_DELETE(bank);
 	SAFE_ARRAY_DELETE(ct);
@@ -1223,6 +1235,8 @@ void CNetBoard::LoadState(CBlockFile * SaveState)
 
 void CNetBoard::RunFrame(void)
 {
+	m_waitMicros = 0;
+
 	if (!IsRunning())
 		return;
 
@@ -1235,6 +1249,21 @@ void CNetBoard::RunFrame(void)
 	}*/
 
 
+	/*
+	 * The 68K spends most of the frame waiting for the next IRQ5 or for the
+	 * PowerPC to fill comm RAM, neither of which can happen during a burst
+	 * (received data is only fetched when the 68K asks for it). Each burst
+	 * therefore ends as soon as the 68K settles into an idle loop.
+	 */
+	bool idleSkip = m_idleSkip.Get();
+	auto RunBurst = [this, idleSkip](int numCycles)
+	{
+		if (idleSkip)
+			M68KRunIdleSkip(numCycles, &m_idleCycles);
+		else
+			M68KRun(numCycles);
+	};
+
 	M68KSetIRQ(5); // apparently, must be called every xx milli secondes or every frames or 3-4 in a frame
 	/*if (test_irq == 0 || test_irq<2)
 	{
@@ -1247,7 +1276,7 @@ void CNetBoard::RunFrame(void)
 		//M68KRun(10000);
 	}*/
 
-	M68KRun((4000000 / 60)); // original
+	RunBurst((4000000 / 60)); // original
 	//M68KRun((4000000 / 60)*3); // 12Mhz
 
 	//DebugLog("NetBoard PC=%06X\n", M68KGetPC());
@@ -1257,11 +1286,11 @@ void CNetBoard::RunFrame(void)
 
 	// 3 times more avoid network error canceled on certain games (certainly due to irq5 that would be calling 3-4 times in a frame)
 	M68KSetIRQ(5);
-	M68KRun((4000000 / 60));
+	RunBurst((4000000 / 60));
 	M68KSetIRQ(5);
-	M68KRun((4000000 / 60));
+	RunBurst((4000000 / 60));
 	M68KSetIRQ(5);
-	M68KRun((4000000 / 60));
+	RunBurst((4000000 / 60));
 
 	M68KGetContext(&M68K);
 }
@@ -1309,6 +1338,31 @@ bool CNetBoard::IsRunning(void)
 	return m_attached && (ioreg[0xc0] != 0);
 }
 
+UINT64 CNetBoard::GetWaitMicros(void)
+{
+	return m_waitMicros;
+}
+
+bool CNetBoard::GetLinkStats(NetLinkStats *stats)
+{
+	return false;
+}
+
+// The emulated board always waits for the other machines
+UINT32 CNetBoard::GetFrame(void)
+{
+	return 0;
+}
+
+bool CNetBoard::GetRollback(UINT32 *frame)
+{
+	return false;
+}
+
+void CNetBoard::ReplayFrame(UINT32 frame)
+{
+}
+
 void CNetBoard::GetGame(const Game& gameinfo)
 {
 	Gameinfo = gameinfo;
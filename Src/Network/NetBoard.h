@@ -32,6 +32,7 @@
 #include "TCPSend.h"
 #include "TCPSendAsync.h"
 #include "TCPReceive.h"
+#include "NetConnector.h"
 
 //#define NET_BUF_SIZE 32800 // 16384 not enough
 
@@ -57,6 +58,11 @@ public:
 	M68KCtx *GetM68K(void);
 	bool IsAttached(void);
 	bool IsRunning(void);
+	UINT64 GetWaitMicros(void);
+	bool GetLinkStats(NetLinkStats *stats);
+	UINT32 GetFrame(void);
+	bool GetRollback(UINT32 *frame);
+	void ReplayFrame(UINT32 frame);
 
 	bool Init(UINT8 *netRAMPtr, UINT8 *netBufferPtr);
 
@@ -79,6 +85,7 @@ public:
 private:
 	// Config
 	const Util::Config::Node &m_config;
+	Util::Config::CachedValue<bool> m_idleSkip;  // read each frame
 	// 68K CPU
 	M68KCtx		M68K;
 
@@ -100,6 +107,8 @@ private:
 	UINT16		send_offset;
 	UINT16		send_size;
 	UINT8		slot;
+	UINT64		m_idleCycles = 0;	// 68K cycles skipped in idle loops
+	UINT64		m_waitMicros = 0;	// time spent waiting for messages in the last frame
 
 	// netsock
 	UINT16 port_in = 0;
@@ -108,6 +117,7 @@ private:
 
 	std::unique_ptr<TCPSend> nets;
 	std::unique_ptr<TCPReceive> netr;
+	CNetConnector m_connector;
 
 	//game info
 	Game Gameinfo;
@@ -0,0 +1,103 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "NetConnector.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+static const unsigned MIN_RETRY_MS = 50;		// first wait after a failed attempt
+static const unsigned MAX_RETRY_MS = 5000;
+static const unsigned CHECK_MS = 16;			// how often a link that is up is checked
+
+CNetConnector::~CNetConnector(void)
+{
+	Stop();
+}
+
+void CNetConnector::Start(const std::string &description, std::function<bool()> connected, std::function<bool()> connect)
+{
+	if (m_thread.joinable())
+		return;
+
+	m_description = description;
+	m_isConnected = connected;
+	m_connect = connect;
+	m_quit = false;
+	m_thread = std::thread(&CNetConnector::ConnectProc, this);
+}
+
+void CNetConnector::Stop(void)
+{
+	m_quit = true;
+	if (m_thread.joinable())
+		m_thread.join();
+	m_connected = false;
+}
+
+void CNetConnector::Sleep(unsigned ms)
+{
+	// In small steps, to see when to stop
+	for (unsigned slept = 0; slept < ms && !m_quit; slept += CHECK_MS)
+		std::this_thread::sleep_for(std::chrono::milliseconds(std::min(CHECK_MS, ms - slept)));
+}
+
+void CNetConnector::ConnectProc(void)
+{
+	unsigned retryMS = MIN_RETRY_MS;
+	bool first = true;
+
+	while (!m_quit)
+	{
+		if (m_isConnected())
+		{
+			if (!m_connected)
+			{
+				printf("Successfully connected.\n");
+				m_generation++;
+				m_connected = true;
+			}
+			retryMS = MIN_RETRY_MS;
+			Sleep(CHECK_MS);
+			continue;
+		}
+
+		if (m_connected)
+		{
+			printf("Net link to %s lost, reconnecting ..\n", m_description.c_str());
+			m_connected = false;
+		}
+		else if (first)
+			printf("Connecting to %s ..\n", m_description.c_str());
+		first = false;
+
+		if (m_connect())
+		{
+			retryMS = MIN_RETRY_MS;
+			Sleep(CHECK_MS);
+			continue;
+		}
+
+		Sleep(retryMS);
+		retryMS = std::min(retryMS * 2, MAX_RETRY_MS);
+	}
+}
@@ -0,0 +1,102 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef INCLUDED_NETCONNECTOR_H
+#define INCLUDED_NETCONNECTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+/*
+ * CNetConnector:
+ *
+ * Keeps a net board's link with its neighbours up from a thread of its own,
+ * so that connecting never holds up the emulation. Whenever the link is down
+ * it tries to connect, waiting twice as long after each failure, up to a few
+ * seconds, so that a machine that is off for a while is not flooded with
+ * attempts but is linked again soon after it comes back.
+ *
+ * The transport decides what the link being up means: Start() is given a
+ * function telling whether it is, and one making an attempt to connect what
+ * is down, which may block for a while. The thread calls no other method of the
+ * transport, which must cope with these being called while the emulation
+ * uses it (TCPSend only connects a socket while it has none, and only the
+ * emulation closes it).
+ */
+class CNetConnector
+{
+public:
+	/*
+	 * Start(description, connected, connect):
+	 *
+	 * Starts the thread, if not already running.
+	 *
+	 * Parameters:
+	 *		description		What is being connected to, for the log.
+	 *		connected		Returns whether the link is up.
+	 *		connect			Attempts to connect what is down. Returns false if
+	 *						an attempt failed, to wait longer before the next,
+	 *						or true if the link is up or waits on the other
+	 *						machines (e.g. to accept a connection).
+	 */
+	void Start(const std::string &description, std::function<bool()> connected, std::function<bool()> connect);
+
+	/*
+	 * Stop():
+	 *
+	 * Stops the thread, waiting for an attempt to connect underway, before
+	 * the transport is destroyed.
+	 */
+	void Stop(void);
+
+	// Whether the link was up when last checked, a few milliseconds ago at most
+	bool Connected(void) const
+	{
+		return m_connected;
+	}
+
+	// The number of times the link has come up, so that users can tell a new
+	// connection from the one they last used
+	uint32_t Generation(void) const
+	{
+		return m_generation;
+	}
+
+	~CNetConnector(void);
+
+private:
+	void ConnectProc(void);
+	void Sleep(unsigned ms);
+
+	std::string m_description;
+	std::function<bool()> m_isConnected;
+	std::function<bool()> m_connect;
+	std::thread m_thread;
+	std::atomic_bool m_quit = false;
+	std::atomic_bool m_connected = false;
+	std::atomic<uint32_t> m_generation = 0;
+};
+
+#endif	// INCLUDED_NETCONNECTOR_H
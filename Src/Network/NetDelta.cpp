@@ -0,0 +1,162 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "NetDelta.h"
+
+#include <zlib.h>
+#include <cstring>
+
+namespace NetDelta
+{
+	static const uint8_t FLAG_DELTA = 0x01;
+	static const uint8_t FLAG_COMPRESSED = 0x02;
+	static const size_t HEADER_SIZE = 5;
+	static const size_t MIN_UNCHANGED_RUN = 4;	// shorter runs are cheaper sent as changed bytes
+	static const uint32_t MAX_SLICE_SIZE = 0x20000;	// all of comm RAM
+
+	static void PutVarint(std::vector<uint8_t> *out, size_t value)
+	{
+		while (value >= 0x80)
+		{
+			out->push_back(uint8_t(value | 0x80));
+			value >>= 7;
+		}
+		out->push_back(uint8_t(value));
+	}
+
+	static bool GetVarint(const uint8_t **p, const uint8_t *end, size_t *value)
+	{
+		*value = 0;
+		for (unsigned shift = 0; *p < end && shift < 32; shift += 7)
+		{
+			uint8_t b = *(*p)++;
+			*value |= size_t(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	void Encode(std::vector<uint8_t> *out, const uint8_t *data, size_t size, const uint8_t *prev, int zlibLevel)
+	{
+		out->resize(HEADER_SIZE);
+		(*out)[0] = prev != nullptr ? FLAG_DELTA : 0;
+		uint32_t size32 = uint32_t(size);
+		memcpy(&(*out)[1], &size32, sizeof(size32));
+
+		if (prev == nullptr)
+			out->insert(out->end(), data, data + size);
+		else
+		{
+			size_t i = 0;
+			while (i < size)
+			{
+				size_t unchanged = i;
+				while (i < size && data[i] == prev[i])
+					i++;
+				if (i == size)
+					break;		// the rest is unchanged
+				size_t changed = i;
+				// Extend the changed run over unchanged runs too short to be worth a pair
+				while (i < size)
+				{
+					while (i < size && data[i] != prev[i])
+						i++;
+					size_t same = i;
+					while (same < size && same - i < MIN_UNCHANGED_RUN && data[same] == prev[same])
+						same++;
+					if (same == size || same - i >= MIN_UNCHANGED_RUN)
+						break;
+					i = same;
+				}
+				PutVarint(out, changed - unchanged);
+				PutVarint(out, i - changed);
+				for (size_t j = changed; j < i; j++)
+					out->push_back(data[j] ^ prev[j]);
+			}
+		}
+
+		if (zlibLevel > 0)
+		{
+			uLongf packedSize = compressBound(uLong(out->size() - HEADER_SIZE));
+			std::vector<uint8_t> packed(HEADER_SIZE + packedSize);
+			if (compress2(&packed[HEADER_SIZE], &packedSize, out->data() + HEADER_SIZE, uLong(out->size() - HEADER_SIZE), zlibLevel > 9 ? 9 : zlibLevel) == Z_OK &&
+				HEADER_SIZE + packedSize < out->size())
+			{
+				memcpy(packed.data(), out->data(), HEADER_SIZE);
+				packed[0] |= FLAG_COMPRESSED;
+				packed.resize(HEADER_SIZE + packedSize);
+				out->swap(packed);
+			}
+		}
+	}
+
+	bool Decode(std::vector<uint8_t> *slice, const uint8_t *data, size_t size)
+	{
+		if (size < HEADER_SIZE)
+			return false;
+		uint8_t flags = data[0];
+		uint32_t sliceSize;
+		memcpy(&sliceSize, &data[1], sizeof(sliceSize));
+		const uint8_t *body = data + HEADER_SIZE;
+		size_t bodySize = size - HEADER_SIZE;
+		if (sliceSize > MAX_SLICE_SIZE)
+			return false;
+
+		// Decompress into a buffer of its own, larger than any body can be
+		std::vector<uint8_t> unpacked;
+		if (flags & FLAG_COMPRESSED)
+		{
+			uLongf unpackedSize = uLongf(sliceSize) * 2 + 32;
+			unpacked.resize(unpackedSize);
+			if (uncompress(unpacked.data(), &unpackedSize, body, uLong(bodySize)) != Z_OK)
+				return false;
+			body = unpacked.data();
+			bodySize = unpackedSize;
+		}
+
+		if (!(flags & FLAG_DELTA))
+		{
+			if (bodySize != sliceSize)
+				return false;
+			slice->assign(body, body + bodySize);
+			return true;
+		}
+
+		if (slice->size() != sliceSize)
+			return false;
+		const uint8_t *p = body;
+		const uint8_t *end = body + bodySize;
+		size_t i = 0;
+		while (p < end)
+		{
+			size_t unchanged, changed;
+			if (!GetVarint(&p, end, &unchanged) || !GetVarint(&p, end, &changed) ||
+				unchanged > sliceSize - i || changed > sliceSize - i - unchanged || changed > size_t(end - p))
+				return false;
+			i += unchanged;
+			for (size_t j = 0; j < changed; j++)
+				(*slice)[i++] ^= *p++;
+		}
+		return true;
+	}
+}
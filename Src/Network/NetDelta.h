@@ -0,0 +1,88 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef INCLUDED_NETDELTA_H
+#define INCLUDED_NETDELTA_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+ * NetDelta:
+ *
+ * Encoding of the comm RAM slices the simulated net board passes around the
+ * ring, most of which stay the same from one frame to the next. A slice is
+ * sent either whole (a keyframe) or as its XOR against the slice sent in the
+ * same slot the frame before, of which only the runs of changed bytes are
+ * kept. Either may then be compressed with zlib.
+ *
+ * Format
+ * ------
+ *	Flags (8 bits): bit 0 set for a delta, bit 1 set if compressed
+ *	Size of the slice (32-bit integer)
+ *	Body, compressed with zlib if flagged:
+ *		Keyframe: the slice
+ *		Delta: pairs of run lengths (LEB128 varints), the first of bytes
+ *		unchanged and the second of bytes changed, each pair followed by
+ *		the changed bytes XORed with the previous slice, until the end
+ *
+ * An encoded slice is never empty, as empty messages mean the link is
+ * broken.
+ */
+namespace NetDelta
+{
+	/*
+	 * Encode(out, data, size, prev, zlibLevel):
+	 *
+	 * Encodes a slice.
+	 *
+	 * Parameters:
+	 *		out			Encoded slice.
+	 *		data		Slice.
+	 *		size		Size of the slice in bytes.
+	 *		prev		Slice last sent in the same slot, or null for a
+	 *					keyframe. Must be size bytes.
+	 *		zlibLevel	Compression level, from 1 (fastest) to 9 (smallest),
+	 *					or 0 for none. Kept only if smaller.
+	 */
+	void Encode(std::vector<uint8_t> *out, const uint8_t *data, size_t size, const uint8_t *prev, int zlibLevel);
+
+	/*
+	 * Decode(slice, data, size):
+	 *
+	 * Decodes a slice.
+	 *
+	 * Parameters:
+	 *		slice	Slice last received in the same slot, replaced by the
+	 *				slice decoded.
+	 *		data	Encoded slice.
+	 *		size	Size of the encoded slice in bytes.
+	 *
+	 * Returns:
+	 *		False if the encoded slice is corrupt or is a delta against a
+	 *		slice of another size.
+	 */
+	bool Decode(std::vector<uint8_t> *slice, const uint8_t *data, size_t size);
+}
+
+#endif	// INCLUDED_NETDELTA_H
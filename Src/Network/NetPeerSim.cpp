@@ -0,0 +1,225 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "NetPeerSim.h"
+#include "NetDelta.h"
+#include "OSD/Thread.h"
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t RANDOM_SEED = 0x5eed;
+static const double RESEND_MICROS = 4000;		// as UDPLink
+static const unsigned HANDSHAKE_MESSAGES = 4;	// GUID twice, machine index, number of machines
+static const unsigned INDEX_MESSAGE = 2;		// incremented by each slave
+
+NetPeerSim::NetPeerSim(const Settings& settings, std::unique_ptr<CNetRecording> replay) :
+	m_settings(settings),
+	m_replay(std::move(replay)),
+	m_random(RANDOM_SEED),
+	m_lastDue(0),
+	m_handshake(0),
+	m_step(0),
+	m_frame(0),
+	m_sliceSize(0),
+	m_deltaFrame(0)
+{
+	if (m_settings.peers < 1) {
+		m_settings.peers = 1;
+	}
+}
+
+uint64_t NetPeerSim::HopMicros()
+{
+	// not std::uniform_real_distribution, which differs between libraries
+	auto uniform = [this]() { return double(m_random()) / 4294967296.0; };
+
+	double micros = m_settings.latencyMS * 1000.0 + m_settings.jitterMS * 1000.0 * uniform();
+	for (int i = 0; i < 16 && uniform() * 100.0 < m_settings.lossPercent; i++) {
+		micros += RESEND_MICROS;
+	}
+	return uint64_t(micros);
+}
+
+void NetPeerSim::Queue(uint64_t sent, unsigned hops, const void* data, size_t length)
+{
+	uint64_t due = sent;
+	for (unsigned i = 0; i < hops; i++) {
+		due += HopMicros();
+	}
+
+	// messages arrive in order, as over TCP
+	m_lastDue = std::max(m_lastDue, due);
+	m_queue.push_back({ m_lastDue, std::vector<char>((const char*)data, (const char*)data + length) });
+}
+
+void NetPeerSim::StartFrame(uint64_t now, const void* own, size_t length)
+{
+	unsigned peers = m_settings.peers;
+
+	// the machine's first slice tells the size of them all
+	if (m_sliceSize == 0) {
+		if (m_settings.delta) {
+			std::vector<uint8_t> slice;
+			NetDelta::Decode(&slice, (const uint8_t*)own, length);
+			m_sliceSize = slice.size();
+		}
+		else {
+			m_sliceSize = length;
+		}
+		m_slices.assign(peers, std::vector<uint8_t>(m_sliceSize));
+		m_sentSlices.assign(peers, std::vector<uint8_t>());
+	}
+
+	bool keyframe = m_deltaFrame == 0;
+	if (++m_deltaFrame >= m_settings.keyframeInterval && m_settings.keyframeInterval > 0) {
+		m_deltaFrame = 0;
+	}
+
+	// slot i is received i + 1 hops from the machine that sent it, the
+	// nearest first, then the machine's own slice comes back around
+	for (unsigned i = 0; i < peers; i++) {
+		std::vector<uint8_t>& slice = m_slices[i];
+		if (m_replay) {
+			memcpy(slice.data(), m_replay->GetSlice(m_frame, i), std::min(m_sliceSize, m_replay->GetSliceSize()));
+		}
+		else if (m_sliceSize > 0) {
+			memcpy(slice.data(), &m_frame, std::min(m_sliceSize, sizeof(m_frame)));
+			for (int j = 0; j < 8; j++) {
+				slice[m_random() % m_sliceSize] = uint8_t(m_random());
+			}
+		}
+
+		if (m_settings.delta) {
+			std::vector<uint8_t>& prev = m_sentSlices[i];
+			NetDelta::Encode(&m_encoded, slice.data(), slice.size(), keyframe || prev.size() != slice.size() ? nullptr : prev.data(), m_settings.compression);
+			prev = slice;
+			Queue(now, i + 1, m_encoded.data(), m_encoded.size());
+		}
+		else {
+			Queue(now, i + 1, slice.data(), slice.size());
+		}
+	}
+	Queue(now, peers + 1, own, length);
+	m_frame++;
+}
+
+bool NetPeerSim::Send(const void* data, int length)
+{
+	uint64_t now = CThread::GetMicroseconds();
+	unsigned peers = m_settings.peers;
+
+	// a broken link goes around the ring, and the handshake starts again
+	if (length == 0) {
+		Queue(now, peers + 1, nullptr, 0);
+		m_handshake = 0;
+		m_step = 0;
+		return true;
+	}
+
+	if (m_handshake < HANDSHAKE_MESSAGES) {
+		std::vector<char> message((const char*)data, (const char*)data + length);
+		if (m_handshake == INDEX_MESSAGE) {
+			for (char& index : message) {
+				index = char(index + peers);
+			}
+		}
+		Queue(now, peers + 1, message.data(), message.size());
+		m_handshake++;
+		m_step = 0;
+		return true;
+	}
+
+	// the slices the machine passes on go no further than the peers
+	if (m_step == 0) {
+		StartFrame(now, data, length);
+	}
+	m_step = (m_step + 1) % (peers + 1);
+	return true;
+}
+
+void NetPeerSim::WaitUntil(uint64_t due)
+{
+	// sleep for all but the last millisecond, which is spun
+	uint64_t now = CThread::GetMicroseconds();
+	if (due > now + 1000) {
+		CThread::Sleep(UINT32((due - now) / 1000 - 1));
+	}
+	while (CThread::GetMicroseconds() < due)
+		;
+}
+
+bool NetPeerSim::CheckDataAvailable(int timeoutMS)
+{
+	if (m_queue.empty()) {
+		return false;
+	}
+
+	uint64_t now = CThread::GetMicroseconds();
+	uint64_t due = m_queue.front().due;
+	if (due <= now) {
+		return true;
+	}
+	if (timeoutMS < 0 || due - now <= uint64_t(timeoutMS) * 1000) {
+		WaitUntil(due);
+		return true;
+	}
+	if (timeoutMS > 0) {
+		WaitUntil(now + uint64_t(timeoutMS) * 1000);
+	}
+	return false;
+}
+
+std::vector<char>& NetPeerSim::Receive()
+{
+	if (m_queue.empty()) {
+		m_recBuffer.clear();
+		return m_recBuffer;
+	}
+
+	WaitUntil(m_queue.front().due);
+	m_recBuffer.swap(m_queue.front().data);
+	m_queue.pop_front();
+	return m_recBuffer;
+}
+
+bool NetPeerSim::Connect()
+{
+	return true;
+}
+
+bool NetPeerSim::Connected()
+{
+	return true;
+}
+
+unsigned NetPeerSim::QueueDepth()
+{
+	uint64_t now = CThread::GetMicroseconds();
+	unsigned depth = 0;
+	for (const Message& message : m_queue) {
+		if (message.due > now) {
+			break;
+		}
+		depth++;
+	}
+	return depth;
+}
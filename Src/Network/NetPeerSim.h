@@ -0,0 +1,106 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef INCLUDED_NETPEERSIM_H
+#define INCLUDED_NETPEERSIM_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+#include "INetLink.h"
+#include "NetRecording.h"
+
+/*
+ * NetPeerSim:
+ *
+ * The rest of a ring of linked machines, simulated in-process, for
+ * benchmarking the simulated net board without other machines. The machine
+ * must be the master. The simulated peers act as slaves in the handshake,
+ * and in each frame send their own slices and pass the others on, as
+ * CSimNetBoard does without rolling back. Their slices are replayed from a
+ * CNetRecording or, without one, made up, a few bytes changing every frame.
+ *
+ * Each message takes a hop per machine it passes through: a fixed latency,
+ * plus a random jitter of up to the given amount, plus, for each time it is
+ * lost, the UDP link's resend interval. The peers start their frames when
+ * the machine does. Receive() waits until a message is due, so stalls are
+ * measured as on a real link. The random numbers start from the same seed
+ * every time, for the same frames with the same inputs (see
+ * CInputRecording).
+ */
+class NetPeerSim : public INetLink
+{
+public:
+	struct Settings
+	{
+		unsigned	peers = 1;			// other machines in the ring
+		double		latencyMS = 0;		// per hop
+		double		jitterMS = 0;
+		double		lossPercent = 0;
+		bool		delta = false;		// slices sent as deltas (see NetDelta.h), as the machine does
+		unsigned	keyframeInterval = 0;
+		int			compression = 0;
+	};
+
+	NetPeerSim(const Settings& settings, std::unique_ptr<CNetRecording> replay);
+
+	bool Send(const void* data, int length);
+	bool CheckDataAvailable(int timeoutMS = 0);
+	std::vector<char>& Receive();
+	bool Connect();
+	bool Connected();
+	unsigned QueueDepth();
+
+private:
+
+	struct Message
+	{
+		uint64_t			due;			// CThread::GetMicroseconds() when it arrives
+		std::vector<char>	data;
+	};
+
+	uint64_t HopMicros();
+	void Queue(uint64_t sent, unsigned hops, const void* data, size_t length);
+	void StartFrame(uint64_t now, const void* own, size_t length);
+	void WaitUntil(uint64_t due);
+
+	Settings			m_settings;
+	std::unique_ptr<CNetRecording> m_replay;
+	std::mt19937		m_random;
+	std::deque<Message>	m_queue;			// messages on their way to the machine, in order
+	uint64_t			m_lastDue;
+	unsigned			m_handshake;		// handshake messages sent by the machine
+	unsigned			m_step;				// messages sent by the machine in the current frame
+	uint32_t			m_frame;
+
+	// the peers' slices, per slot received by the machine
+	size_t				m_sliceSize;
+	std::vector<std::vector<uint8_t>> m_slices;
+	std::vector<std::vector<uint8_t>> m_sentSlices;
+	unsigned			m_deltaFrame;
+	std::vector<uint8_t> m_encoded;
+	std::vector<char>	m_recBuffer;
+};
+
+#endif	// INCLUDED_NETPEERSIM_H
@@ -0,0 +1,110 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * NetRecording.cpp
+ *
+ * Implementation of CNetRecording.
+ *
+ * File Format
+ * -----------
+ * Recordings are block files (see BlockFile.h), compressed like save states,
+ * with one block:
+ *
+ *	"Net Recording":
+ *		Version (32-bit integer, currently 1)
+ *		Slice size (32-bit integer)
+ *		Slices per frame (32-bit integer)
+ *		Number of frames (32-bit integer)
+ *		Slices of each frame in turn
+ */
+
+#include "NetRecording.h"
+
+#include "Supermodel.h"
+#include "BlockFile.h"
+
+static const uint32_t RECORDING_VERSION = 1;
+
+void CNetRecording::Add(const uint8_t *slice, size_t size, unsigned slicesPerFrame)
+{
+	if (m_frames == 0 && m_added == 0)
+	{
+		m_sliceSize = uint32_t(size);
+		m_slicesPerFrame = slicesPerFrame;
+	}
+	if (size != m_sliceSize || slicesPerFrame != m_slicesPerFrame || size == 0)
+		return;
+
+	m_data.insert(m_data.end(), slice, slice + size);
+	if (++m_added == m_slicesPerFrame)
+	{
+		m_frames++;
+		m_added = 0;
+	}
+}
+
+bool CNetRecording::Save(const std::string &file, int level) const
+{
+	std::vector<uint8_t> buffer;
+	CBlockFile recording;
+	recording.Create(&buffer, "Supermodel Net Recording", "");
+
+	recording.NewBlock("Net Recording", __FILE__);
+	recording.Write(&RECORDING_VERSION, sizeof(RECORDING_VERSION));
+	recording.Write(&m_sliceSize, sizeof(m_sliceSize));
+	recording.Write(&m_slicesPerFrame, sizeof(m_slicesPerFrame));
+	recording.Write(&m_frames, sizeof(m_frames));
+	recording.Write(m_data.data(), uint32_t(size_t(m_frames) * m_slicesPerFrame * m_sliceSize));
+	recording.Close();
+
+	if (OKAY != CBlockFile::Save(file, buffer, level))
+		return ErrorLog("Unable to write net recording to '%s'.", file.c_str());
+	printf("Wrote %u frames of net traffic to '%s'.\n", m_frames, file.c_str());
+	return OKAY;
+}
+
+bool CNetRecording::Load(const std::string &file)
+{
+	CBlockFile recording;
+	if (OKAY != recording.Load(file))
+		return ErrorLog("Unable to load net recording '%s'.", file.c_str());
+	if (OKAY != recording.FindBlock("Net Recording"))
+		return ErrorLog("'%s' is not a net recording.", file.c_str());
+
+	uint32_t version = 0;
+	recording.Read(&version, sizeof(version));
+	if (version != RECORDING_VERSION)
+		return ErrorLog("'%s' is a net recording of an unsupported version (%u).", file.c_str(), version);
+	if (recording.Read(&m_sliceSize, sizeof(m_sliceSize)) != sizeof(m_sliceSize) ||
+		recording.Read(&m_slicesPerFrame, sizeof(m_slicesPerFrame)) != sizeof(m_slicesPerFrame) ||
+		recording.Read(&m_frames, sizeof(m_frames)) != sizeof(m_frames) ||
+		m_sliceSize == 0 || m_sliceSize > 0x10000 || m_slicesPerFrame == 0 || m_slicesPerFrame > 255 || m_frames == 0)
+		return ErrorLog("Net recording '%s' is corrupt or empty.", file.c_str());
+
+	m_data.resize(size_t(m_frames) * m_slicesPerFrame * m_sliceSize);
+	uint32_t dataBytes = uint32_t(m_data.size());
+	if (recording.Read(m_data.data(), dataBytes) != dataBytes)
+		return ErrorLog("Net recording '%s' is corrupt.", file.c_str());
+	m_added = 0;
+	return OKAY;
+}
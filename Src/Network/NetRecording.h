@@ -0,0 +1,90 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * NetRecording.h
+ *
+ * Header file for CNetRecording, a recording of the comm RAM slices other
+ * machines sent over a simulated net board link, for replaying them from
+ * simulated peers (see NetPeerSim.h).
+ */
+
+#ifndef INCLUDED_NETRECORDING_H
+#define INCLUDED_NETRECORDING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * CNetRecording:
+ *
+ * The slices received in each frame, in the order received, other than the
+ * machine's own coming back around the ring: one per other machine, nearest
+ * first. All are the same size.
+ */
+class CNetRecording
+{
+public:
+	/*
+	 * Add(slice, size, slicesPerFrame):
+	 *
+	 * Records the next slice received. A recording keeps the size and number
+	 * of slices of its first frame; others are ignored.
+	 */
+	void Add(const uint8_t *slice, size_t size, unsigned slicesPerFrame);
+
+	bool Save(const std::string &file, int level) const;
+	bool Load(const std::string &file);
+
+	unsigned GetFrames(void) const
+	{
+		return m_frames;
+	}
+
+	unsigned GetSlicesPerFrame(void) const
+	{
+		return m_slicesPerFrame;
+	}
+
+	size_t GetSliceSize(void) const
+	{
+		return m_sliceSize;
+	}
+
+	// Slice of a frame, repeating the recording from the start after the last
+	const uint8_t *GetSlice(uint32_t frame, unsigned slice) const
+	{
+		size_t index = size_t(frame % m_frames) * m_slicesPerFrame + slice % m_slicesPerFrame;
+		return &m_data[index * m_sliceSize];
+	}
+
+private:
+	uint32_t m_sliceSize = 0;
+	uint32_t m_slicesPerFrame = 0;
+	uint32_t m_frames = 0;			// complete frames
+	uint32_t m_added = 0;			// slices of the frame being added
+	std::vector<uint8_t> m_data;
+};
+
+#endif	// INCLUDED_NETRECORDING_H
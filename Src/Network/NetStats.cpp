@@ -0,0 +1,105 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "NetStats.h"
+
+#include "Supermodel.h"
+#include "OSD/Thread.h"
+#include <algorithm>
+#include <cmath>
+
+void CNetLinkMonitor::FrameStart(void)
+{
+	m_frameStart = CThread::GetMicroseconds();
+	m_frameWait = 0;
+}
+
+void CNetLinkMonitor::Sent(uint64_t micros, size_t bytes)
+{
+	m_stats.sendMicros += micros;
+	m_stats.bytesSent += bytes;
+}
+
+void CNetLinkMonitor::Received(uint64_t waitMicros, unsigned queueDepth, size_t bytes)
+{
+	m_stats.messages++;
+	m_stats.bytesReceived += bytes;
+	m_stats.waitMicros += waitMicros;
+	m_frameWait += waitMicros;
+	m_stats.queueDepth = queueDepth;
+	m_stats.maxQueueDepth = std::max(m_stats.maxQueueDepth, queueDepth);
+}
+
+void CNetLinkMonitor::RoundTrip(void)
+{
+	// Smoothed as RTP does its interarrival jitter (RFC 3550)
+	double rtt = double(CThread::GetMicroseconds() - m_frameStart);
+	if (!m_haveRTT)
+	{
+		m_stats.rttMicros = rtt;
+		m_haveRTT = true;
+	}
+	m_stats.jitterMicros += (std::fabs(rtt - m_stats.rttMicros) - m_stats.jitterMicros) / 16.0;
+	m_stats.rttMicros += (rtt - m_stats.rttMicros) / 8.0;
+}
+
+void CNetLinkMonitor::FrameEnd(unsigned logFrames)
+{
+	unsigned bucket = 0;
+	while (bucket < NetLinkStats::NumWaitBuckets - 1 && m_frameWait >= (1000u << bucket))
+		bucket++;
+	m_stats.waitBuckets[bucket]++;
+	m_stats.frames++;
+
+	if (logFrames > 0 && m_stats.frames - m_logged.frames >= logFrames)
+		Log();
+}
+
+void CNetLinkMonitor::Log(void)
+{
+	const NetLinkStats &now = m_stats;
+	const NetLinkStats &then = m_logged;
+	uint64_t frames = now.frames - then.frames;
+	uint64_t b[NetLinkStats::NumWaitBuckets];
+	for (unsigned i = 0; i < NetLinkStats::NumWaitBuckets; i++)
+		b[i] = now.waitBuckets[i] - then.waitBuckets[i];
+
+	InfoLog("Net link over %llu frames: round trip %1.2f ms, jitter %1.2f ms, wait %1.2f ms/frame, send %1.2f ms/frame, queue depth %u (max %u)",
+		(unsigned long long)frames, now.rttMicros / 1000.0, now.jitterMicros / 1000.0,
+		double(now.waitMicros - then.waitMicros) / 1000.0 / double(frames), double(now.sendMicros - then.sendMicros) / 1000.0 / double(frames),
+		now.queueDepth, now.maxQueueDepth);
+	InfoLog("  sent %1.0f bytes/frame, received %1.0f bytes/frame",
+		double(now.bytesSent - then.bytesSent) / double(frames), double(now.bytesReceived - then.bytesReceived) / double(frames));
+	InfoLog("  frames waiting <1 ms: %llu, <2 ms: %llu, <4 ms: %llu, <8 ms: %llu, <16 ms: %llu, stalled: %llu",
+		(unsigned long long)b[0], (unsigned long long)b[1], (unsigned long long)b[2], (unsigned long long)b[3], (unsigned long long)b[4], (unsigned long long)b[5]);
+
+	m_logged = m_stats;
+}
+
+void CNetLinkMonitor::Reset(void)
+{
+	m_stats = NetLinkStats();
+	m_logged = NetLinkStats();
+	m_frameStart = 0;
+	m_frameWait = 0;
+	m_haveRTT = false;
+}
@@ -0,0 +1,120 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef INCLUDED_NETSTATS_H
+#define INCLUDED_NETSTATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * NetLinkStats:
+ *
+ * How the link with the neighbouring machines in the ring is doing, as seen
+ * by one machine: the time for its own data to come back around the ring
+ * (the round trip), how much that varies from frame to frame (the jitter),
+ * how long each frame waited on the previous machine and took to send to
+ * the next, and how many messages had already arrived when each was taken
+ * (the queue depth). Counts and totals are since the link was made, so that
+ * callers can take the difference between two snapshots.
+ */
+struct NetLinkStats
+{
+	static const unsigned NumWaitBuckets = 6;	// frames that waited under 1, 2, 4, 8 and 16 ms, and longer (stalls)
+
+	uint64_t	frames = 0;				// frames exchanged
+	uint64_t	messages = 0;			// messages received
+	uint64_t	waitMicros = 0;			// time spent waiting to receive
+	uint64_t	sendMicros = 0;			// time spent sending
+	uint64_t	bytesSent = 0;
+	uint64_t	bytesReceived = 0;
+	uint64_t	waitBuckets[NumWaitBuckets] = {};
+	double		rttMicros = 0;			// round trip, smoothed
+	double		jitterMicros = 0;		// smoothed difference between consecutive round trips
+	unsigned	queueDepth = 0;			// messages waiting when the last one was taken
+	unsigned	maxQueueDepth = 0;
+
+	uint64_t Stalls(void) const
+	{
+		return waitBuckets[NumWaitBuckets - 1];
+	}
+};
+
+/*
+ * CNetLinkMonitor:
+ *
+ * Collects NetLinkStats as a net board exchanges a frame, and logs them now
+ * and then.
+ */
+class CNetLinkMonitor
+{
+public:
+	/*
+	 * FrameStart():
+	 *
+	 * Marks the start of a frame's exchange, which is when the round trip
+	 * begins.
+	 */
+	void FrameStart(void);
+
+	/*
+	 * Sent(micros, bytes), Received(waitMicros, queueDepth, bytes):
+	 *
+	 * Records a message sent or received, the time taken, its size and the
+	 * number of messages that had arrived after the one received.
+	 */
+	void Sent(uint64_t micros, size_t bytes);
+	void Received(uint64_t waitMicros, unsigned queueDepth, size_t bytes);
+
+	/*
+	 * RoundTrip():
+	 *
+	 * Marks the arrival of the machine's own data back around the ring.
+	 */
+	void RoundTrip(void);
+
+	/*
+	 * FrameEnd(logFrames):
+	 *
+	 * Ends the frame's exchange and, every logFrames frames (if not 0), logs
+	 * the stats of those frames.
+	 */
+	void FrameEnd(unsigned logFrames);
+
+	const NetLinkStats &GetStats(void) const
+	{
+		return m_stats;
+	}
+
+	void Reset(void);
+
+private:
+	void Log(void);
+
+	NetLinkStats	m_stats;
+	NetLinkStats	m_logged;			// stats when last logged
+	uint64_t		m_frameStart = 0;
+	uint64_t		m_frameWait = 0;
+	bool			m_haveRTT = false;
+};
+
+#endif	// INCLUDED_NETSTATS_H
@@ -0,0 +1,300 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * ShmLink.cpp
+ *
+ * Each ring is a shared memory region holding a header, with the fields
+ * written by each end on cache lines of their own, and the messages. A
+ * message is its length (32-bit, 0 for the empty message of a broken link)
+ * followed by its data, padded to a multiple of 4 bytes, and may wrap around
+ * the end of the ring.
+ *
+ * An end about to wait for the other sets its waiting flag and then reads the
+ * signal word it waits on. The other end changes the signal after a message
+ * or space is made, and only wakes it if the flag is set. Either the waiter
+ * sees the change, or the other end sees the flag.
+ */
+
+#include "ShmLink.h"
+#include "OSD/Logger.h"
+#include "OSD/SharedMemory.h"
+#include "OSD/Thread.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#if defined(_DEBUG)
+#include <stdio.h>
+#define DPRINTF DebugLog
+#else
+#define DPRINTF(a, ...)
+#endif
+
+static const uint32_t RING_MAGIC = 0x4d534d53;		// "SMSM"
+static const uint64_t RING_SIZE = 1 << 22;			// power of two, a few frames of the largest messages
+static const int MAX_MESSAGE_SIZE = RING_SIZE / 4;
+
+struct ShmLink::Ring
+{
+	std::atomic<uint32_t>	magic;			// set by the reader once created
+	std::atomic<uint32_t>	writer;			// session of the machine writing, 0 until it has opened the ring
+	std::atomic<uint32_t>	closed;			// either end has gone
+
+	// written by the writer
+	alignas(64) std::atomic<uint64_t>	head;			// bytes written
+	std::atomic<uint32_t>	written;		// messages written
+	std::atomic<uint32_t>	dataSignal;		// changed on writing a message or closing
+	std::atomic<uint32_t>	writerWaiting;	// waiting for space
+
+	// written by the reader
+	alignas(64) std::atomic<uint64_t>	tail;			// bytes read
+	std::atomic<uint32_t>	spaceSignal;	// changed on reading a message or closing
+	std::atomic<uint32_t>	readerWaiting;	// waiting for data
+
+	alignas(64) uint8_t		data[RING_SIZE];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free, "shared memory atomics must be lock free");
+
+static std::string RingName(int port)
+{
+	return "supermodel-netlink-" + std::to_string(port);
+}
+
+static void CopyIn(uint8_t* ring, uint64_t pos, const void* src, size_t length)
+{
+	size_t offset = size_t(pos & (RING_SIZE - 1));
+	size_t first = std::min(length, size_t(RING_SIZE - offset));
+	memcpy(ring + offset, src, first);
+	memcpy(ring, (const uint8_t*)src + first, length - first);
+}
+
+static void CopyOut(void* dest, const uint8_t* ring, uint64_t pos, size_t length)
+{
+	size_t offset = size_t(pos & (RING_SIZE - 1));
+	size_t first = std::min(length, size_t(RING_SIZE - offset));
+	memcpy(dest, ring + offset, first);
+	memcpy((uint8_t*)dest + first, ring, length - first);
+}
+
+// Waits until ready() is true, signalled by the other end, or times out
+template <typename Ready>
+static bool WaitUntil(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiting, int timeoutMS, Ready ready)
+{
+	UINT32 start = CThread::GetTicks();
+	while (!ready()) {
+		int remaining = -1;
+		if (timeoutMS >= 0) {
+			UINT32 elapsed = CThread::GetTicks() - start;
+			if (elapsed >= (UINT32)timeoutMS) {
+				return false;
+			}
+			remaining = timeoutMS - (int)elapsed;
+		}
+
+		waiting.store(1);
+		uint32_t value = signal.load();
+		if (ready()) {
+			waiting.store(0);
+			break;
+		}
+		SharedMemory::Wait(&signal, value, remaining);
+		waiting.store(0);
+	}
+	return true;
+}
+
+static void Close(std::atomic<uint32_t>& closed, std::atomic<uint32_t>& dataSignal, std::atomic<uint32_t>& spaceSignal)
+{
+	closed.store(1);
+	dataSignal.fetch_add(1);
+	spaceSignal.fetch_add(1);
+	SharedMemory::Wake(&dataSignal);
+	SharedMemory::Wake(&spaceSignal);
+}
+
+ShmLink::ShmLink(int portOut, int portIn, int timeoutMS) :
+	m_portOut(portOut),
+	m_portIn(portIn),
+	m_timeoutMS(timeoutMS),
+	m_session(0),
+	m_createFailed(false),
+	m_in(nullptr),
+	m_out(nullptr),
+	m_received(0)
+{
+	std::random_device random;
+	do {
+		m_session = random();
+	} while (!m_session);
+}
+
+ShmLink::~ShmLink()
+{
+	// tell both neighbours this end has gone
+	if (m_out) {
+		Close(m_out->closed, m_out->dataSignal, m_out->spaceSignal);
+		SharedMemory::Close(m_out);
+		m_out = nullptr;
+	}
+
+	if (m_in) {
+		Close(m_in->closed, m_in->dataSignal, m_in->spaceSignal);
+		SharedMemory::Close(m_in);
+		m_in = nullptr;
+	}
+}
+
+bool ShmLink::Send(const void* data, int length)
+{
+	// If we failed bail out
+	if (!Connected()) {
+		DPRINTF("Not connected\n");
+		return false;
+	}
+
+	if (length > MAX_MESSAGE_SIZE) {
+		ErrorLog("Net board message of %d bytes is too large for shared memory.", length);
+		return false;
+	}
+
+	DPRINTF("Sending %i bytes\n", length);
+
+	Ring* ring = m_out;
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	uint64_t size = sizeof(uint32_t) + ((length + 3) & ~3);
+	auto space = [&]() {
+		return ring->closed.load() || RING_SIZE - (head - ring->tail.load(std::memory_order_acquire)) >= size;
+	};
+	if (!WaitUntil(ring->spaceSignal, ring->writerWaiting, m_timeoutMS, space) || ring->closed.load()) {
+		DPRINTF("Timed out waiting for space, or the next machine has gone.\n");
+		return false;
+	}
+
+	uint32_t length32 = (uint32_t)length;
+	CopyIn(ring->data, head, &length32, sizeof(length32));
+	if (length) {
+		CopyIn(ring->data, head + sizeof(length32), data, length);
+	}
+	ring->head.store(head + size, std::memory_order_release);
+	ring->written.fetch_add(1);
+	ring->dataSignal.fetch_add(1);
+	if (ring->readerWaiting.load()) {
+		SharedMemory::Wake(&ring->dataSignal);
+	}
+	return true;
+}
+
+bool ShmLink::WaitForMessage(int timeoutMS)
+{
+	Ring* ring = m_in;
+	auto available = [&]() {
+		return ring->closed.load() || ring->written.load() != m_received;
+	};
+	return WaitUntil(ring->dataSignal, ring->readerWaiting, timeoutMS, available) && ring->written.load() != m_received;
+}
+
+bool ShmLink::CheckDataAvailable(int timeoutMS)
+{
+	if (!m_in) {
+		return false;
+	}
+
+	return WaitForMessage(timeoutMS);
+}
+
+std::vector<char>& ShmLink::Receive()
+{
+	if (!m_in || !WaitForMessage(m_timeoutMS)) {
+		DPRINTF("Timed out waiting to receive, or the previous machine has gone.\n");
+		m_recBuffer.clear();
+		return m_recBuffer;
+	}
+
+	Ring* ring = m_in;
+	uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+	uint32_t length = 0;
+	CopyOut(&length, ring->data, tail, sizeof(length));
+	m_recBuffer.resize(length);
+	if (length) {
+		CopyOut(m_recBuffer.data(), ring->data, tail + sizeof(length), length);
+	}
+	ring->tail.store(tail + sizeof(length) + ((length + 3) & ~3), std::memory_order_release);
+	m_received++;
+	ring->spaceSignal.fetch_add(1);
+	if (ring->writerWaiting.load()) {
+		SharedMemory::Wake(&ring->spaceSignal);
+	}
+
+	DPRINTF("Received %i bytes\n", (int)m_recBuffer.size());
+	return m_recBuffer;
+}
+
+bool ShmLink::Connect()
+{
+	if (Connected()) {
+		return true;
+	}
+
+	// Create the ring the previous machine writes to
+	if (!m_in && !m_createFailed) {
+		m_in = (Ring*)SharedMemory::Create(RingName(m_portIn), sizeof(Ring));
+		if (m_in) {
+			m_in->magic.store(RING_MAGIC, std::memory_order_release);
+		}
+		else {
+			ErrorLog("Unable to create shared memory for net board port %d.", m_portIn);
+			m_createFailed = true;
+		}
+	}
+
+	// Open the next machine's ring once it has created it
+	if (!m_out) {
+		Ring* ring = (Ring*)SharedMemory::Open(RingName(m_portOut), sizeof(Ring));
+		if (ring && ring->magic.load(std::memory_order_acquire) == RING_MAGIC) {
+			m_out = ring;
+			m_out->writer.store(m_session);
+		}
+		else if (ring) {
+			SharedMemory::Close(ring);
+		}
+	}
+
+	if (!Connected()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return Connected();
+}
+
+bool ShmLink::Connected()
+{
+	return m_in != nullptr && m_out != nullptr && m_in->writer.load() != 0;
+}
+
+unsigned ShmLink::QueueDepth()
+{
+	return m_in ? m_in->written.load() - m_received : 0;
+}
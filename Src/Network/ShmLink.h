@@ -0,0 +1,79 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef _SHMLINK_H_
+#define _SHMLINK_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "INetLink.h"
+
+/*
+ * ShmLink:
+ *
+ * Both ends of one machine's hop in the ring of linked machines, when they all
+ * run on one host: instead of TCPSend and TCPReceive, messages are written to a
+ * ring buffer in memory shared with the next machine and read from the one
+ * shared with the previous machine. Rings are named after the port of the
+ * machine reading them, so the PortIn and PortOut settings pair them up as
+ * they pair up sockets, and AddressOut is not needed.
+ *
+ * Sending or receiving a message copies it once and makes no system call
+ * unless the other end is waiting, for data or for space. A message that does
+ * not arrive within the timeout, or a machine that closes its end, is reported
+ * as an empty message, as a broken TCP link is.
+ *
+ * Connect() must be called until it succeeds before sending: it creates the
+ * ring this machine reads and waits for both neighbours to have opened theirs.
+ */
+class ShmLink : public INetLink
+{
+public:
+	ShmLink(int portOut, int portIn, int timeoutMS);
+	~ShmLink();
+
+	bool Send(const void* data, int length);
+	bool CheckDataAvailable(int timeoutMS = 0);		// timeoutMS -1 = wait forever until data arrives, 0 = no waiting, 1+ wait time in milliseconds
+	std::vector<char>& Receive();
+	bool Connect();
+	bool Connected();
+	unsigned QueueDepth();							// messages waiting to be received
+
+private:
+
+	struct Ring;
+
+	bool WaitForMessage(int timeoutMS);
+
+	int					m_portOut;
+	int					m_portIn;
+	int					m_timeoutMS;		// time to wait for a message or for space before giving up, -1 = forever
+	uint32_t			m_session;			// written to the next machine's ring once opened
+	bool				m_createFailed;		// reported once
+	Ring*				m_in;				// created by this machine, read from the previous one
+	Ring*				m_out;				// created by the next machine, written to it
+	uint32_t			m_received;			// messages read from m_in
+	std::vector<char>	m_recBuffer;
+};
+
+#endif
@@ -20,10 +20,10 @@
  ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
-#include <chrono>
-#include <thread>
+#include <algorithm>
 #include "Supermodel.h"
 #include "SimNetBoard.h"
+#include "OSD/Thread.h"
 
  // these make 16-bit read/writes much neater
 #define RAM16 *(uint16_t*)&RAM
@@ -36,26 +36,363 @@ inline bool CSimNetBoard::IsGame(const char* gameName)
 	return (m_gameInfo.name == gameName) || (m_gameInfo.parent == gameName);
 }
 
+void CSimNetBoard::NetSend(const void* data, int length)
+{
+	uint64_t start = CThread::GetMicroseconds();
+	if (netl)
+		netl->Send(data, length);
+	else
+		nets->Send(data, length);
+	m_linkMonitor.Sent(CThread::GetMicroseconds() - start, length);
+}
+
+std::vector<char>& CSimNetBoard::NetReceive(void)
+{
+	uint64_t start = CThread::GetMicroseconds();
+	auto& data = netl ? netl->Receive() : netr->Receive(m_receiveTimeout);
+	uint64_t wait = CThread::GetMicroseconds() - start;
+	m_waitMicros += wait;
+	m_linkMonitor.Received(wait, netl ? netl->QueueDepth() : netr->QueueDepth(), data.size());
+	return data;
+}
+
+void CSimNetBoard::BreakLink(void)
+{
+	// link broken - send an "empty" packet to alert other machines
+	NetSend(nullptr, 0);
+	m_state = State::lost;
+	if (m_gameType == GameType::one)
+		m_status1 = 0x40;			// send "link broken" message to mainboard
+	printf("Net link broken, waiting to link again ..\n");
+}
+
+void CSimNetBoard::StartConnector(void)
+{
+	auto connected = [this]() {
+		return netl ? netl->Connected() : nets->Connected() && netr->Connected();
+	};
+
+	// TCPReceive accepts connections from the previous machine by itself
+	auto connect = [this]() {
+		return netl ? netl->Connect() : nets->Connected() || nets->Connect();
+	};
+
+	m_connector.Start(m_linkDescription, connected, connect);
+}
+
+bool CSimNetBoard::LinkUp(void)
+{
+	// TCP only notices the next machine has gone when sending, unless checked
+	if (nets)
+		nets->CheckClosed();
+	return m_connector.Connected();
+}
+
+bool CSimNetBoard::StartHandshake(void)
+{
+	// The GUID is sent again on a new connection, or if it has not come back
+	// after a while, in case it was lost with a machine that went
+	static const unsigned RetryFrames = 2 * 60;
+
+	if (!m_handshakeSent || m_handshakeGeneration != m_connector.Generation() || ++m_handshakeFrames >= RetryFrames)
+	{
+		// flush receive buffer
+		while (NetDataAvailable())
+			NetReceive();
+
+		NetSend(&m_linkGUID, sizeof(m_linkGUID));
+		m_handshakeSent = true;
+		m_handshakeGeneration = m_connector.Generation();
+		m_handshakeFrames = 0;
+	}
+
+	return NetDataAvailable();
+}
+
+void CSimNetBoard::SwapCommBanks(void)
+{
+	if (m_commbank)
+	{
+		m_commbank = false;
+		CommRAM = Buffer;
+		externalCommRAM = Buffer + 0x10000;
+	}
+	else
+	{
+		m_commbank = true;
+		CommRAM = Buffer + 0x10000;
+		externalCommRAM = Buffer;
+	}
+}
+
+CSimNetBoard::FrameSlices* CSimNetBoard::GetFrameSlices(uint32_t frame, bool create)
+{
+	FrameSlices& slices = m_history[frame % m_history.size()];
+	if (slices.valid && slices.frame == frame)
+		return &slices;
+
+	// a frame can only take the place of one too old to be rolled back to,
+	// which the other machines cannot get further ahead of than this
+	if (!create || frame - (m_frame - m_rollbackFrames - 1) >= m_history.size())
+		return nullptr;
+
+	slices.frame = frame;
+	slices.valid = true;
+	slices.data.resize(m_numMachines + 1);
+	for (auto& data : slices.data)
+		data.clear();
+	slices.real.assign(m_numMachines + 1, false);
+	return &slices;
+}
+
+bool CSimNetBoard::HandleFrameMessage(std::vector<char>& message)
+{
+	// frame number (32 bits) and slot (8 bits) followed by the slice
+	if (message.size() < 5)
+		return false;
+	uint32_t frame;
+	memcpy(&frame, message.data(), sizeof(frame));
+	unsigned slot = uint8_t(message[4]) + 1u;
+	if (slot >= unsigned(m_numMachines))
+		return false;
+
+	// pass it on until every other machine has it; our own we never need back
+	if (slot + 1 < unsigned(m_numMachines))
+	{
+		message[4] = char(slot);
+		NetSend(message.data(), int(message.size()));
+	}
+
+	FrameSlices* slices = GetFrameSlices(frame, !(frame < m_frame));
+	if (slices == nullptr)
+		return true;		// long gone
+
+	// a prediction that was wrong, or a correction made by a machine that
+	// rolled back itself, means going back to the frame if its state is kept
+	const uint8_t* data = (const uint8_t*)message.data() + 5;
+	size_t size = message.size() - 5;
+	std::vector<uint8_t>& slice = slices->data[slot];
+	bool changed = slice.size() != size || memcmp(slice.data(), data, size) != 0;
+	slice.assign(data, data + size);
+	slices->real[slot] = true;
+	if (!changed || !(frame < m_frame))
+		return true;
+	if (m_frame - frame > m_rollbackFrames + 1)
+	{
+		// the machines have drifted apart
+		if (!m_rollbackTooLate)
+			ErrorLog("Net board received data for frame %u too late to roll back to.", frame);
+		m_rollbackTooLate = true;
+	}
+	else if (!m_rollbackPending || frame < m_rollbackFrame)
+	{
+		m_rollbackPending = true;
+		m_rollbackFrame = frame;
+	}
+	return true;
+}
+
+void CSimNetBoard::ApplyFrame(FrameSlices& slices, bool replay)
+{
+	// our own slice, sent again when rolling back changed it
+	uint8_t* own = CommRAM + 0x100;
+	std::vector<uint8_t>& sent = slices.data[0];
+	if (!replay || sent.size() != m_segmentSize || memcmp(sent.data(), own, m_segmentSize) != 0)
+	{
+		sent.resize(5 + m_segmentSize);
+		memcpy(sent.data(), &slices.frame, sizeof(slices.frame));
+		sent[4] = 0;
+		memcpy(sent.data() + 5, own, m_segmentSize);
+		NetSend(sent.data(), int(sent.size()));
+		sent.erase(sent.begin(), sent.begin() + 5);
+	}
+	slices.data[m_numMachines].assign(own, own + m_segmentSize);
+	slices.real[m_numMachines] = true;
+
+	// the other machines' slices, predicted to be the same as in the frame
+	// before if they have not arrived
+	FrameSlices* prev = GetFrameSlices(slices.frame - 1, false);
+	for (int slot = 1; slot < m_numMachines; slot++)
+	{
+		uint8_t* dest = CommRAM + 0x100 + slot * m_segmentSize;
+		std::vector<uint8_t>& slice = slices.data[slot];
+		if (!slices.real[slot])
+		{
+			if (prev != nullptr && !prev->data[slot].empty())
+				slice = prev->data[slot];
+			else
+				slice.assign(dest, dest + m_segmentSize);
+		}
+		memcpy(dest, slice.data(), slice.size());
+	}
+	memcpy(CommRAM + 0x100 + m_numMachines * m_segmentSize, own, m_segmentSize);
+}
+
+bool CSimNetBoard::ExchangeFrame(void)
+{
+	if (m_history.empty())
+		m_history.resize(2 * (m_rollbackFrames + 1));
+
+	// take whatever has arrived, waiting only for the frame that would
+	// otherwise have to be rolled back further than states are kept
+	while (NetDataAvailable())
+	{
+		if (!HandleFrameMessage(NetReceive()))
+			return false;
+	}
+	if (m_frame >= m_rollbackFrames)
+	{
+		FrameSlices* oldest = GetFrameSlices(m_frame - m_rollbackFrames, true);
+		while (oldest != nullptr && std::find(oldest->real.begin() + 1, oldest->real.begin() + m_numMachines, false) != oldest->real.begin() + m_numMachines)
+		{
+			if (!HandleFrameMessage(NetReceive()))
+				return false;
+		}
+	}
+
+	ApplyFrame(*GetFrameSlices(m_frame, true), false);
+	m_frame++;
+	return true;
+}
+
+uint32_t CSimNetBoard::GetFrame(void)
+{
+	return m_frame;
+}
+
+bool CSimNetBoard::GetRollback(uint32_t* frame)
+{
+	if (!m_rollbackPending)
+		return false;
+	*frame = m_rollbackFrame;
+	m_rollbackPending = false;
+	return true;
+}
+
+void CSimNetBoard::ReplayFrame(uint32_t frame)
+{
+	FrameSlices* slices = GetFrameSlices(frame, false);
+	if (m_state != State::ready || slices == nullptr)
+		return;
+
+	m_counter++;
+	CommRAM16[0x6] = FLIPENDIAN16(m_counter);
+	ApplyFrame(*slices, true);
+	SwapCommBanks();
+	m_frame = frame + 1;
+}
+
+void CSimNetBoard::StartExchanges(void)
+{
+	m_deltaFrame = 0;
+	m_sentSlices.clear();
+	m_receivedSlices.clear();
+	m_frame = 0;
+	m_history.clear();
+	m_rollbackPending = false;
+	m_rollbackTooLate = false;
+	m_handshakeSent = false;
+}
+
+void CSimNetBoard::SendSlice(int slot, const uint8_t* data)
+{
+	if (!m_delta)
+	{
+		NetSend(data, m_segmentSize);
+		return;
+	}
+
+	// the first slot of each frame decides whether the frame is a keyframe
+	if (slot == 0)
+	{
+		m_keyframe = m_deltaFrame == 0;
+		if (++m_deltaFrame >= m_keyframeInterval && m_keyframeInterval > 0)
+			m_deltaFrame = 0;
+	}
+
+	if (m_sentSlices.size() <= size_t(slot))
+		m_sentSlices.resize(slot + 1);
+	std::vector<uint8_t>& prev = m_sentSlices[slot];
+	bool keyframe = m_keyframe || prev.size() != m_segmentSize;
+	NetDelta::Encode(&m_encoded, data, m_segmentSize, keyframe ? nullptr : prev.data(), m_compression);
+	NetSend(m_encoded.data(), int(m_encoded.size()));
+	prev.assign(data, data + m_segmentSize);
+}
+
+bool CSimNetBoard::ReceiveSlice(int slot, uint8_t* dest)
+{
+	auto& recv_data = NetReceive();
+	if (recv_data.size() == 0)
+		return false;
+
+	if (!m_delta)
+	{
+		memcpy(dest, recv_data.data(), recv_data.size());
+		return true;
+	}
+
+	if (m_receivedSlices.size() <= size_t(slot))
+		m_receivedSlices.resize(slot + 1);
+	std::vector<uint8_t>& slice = m_receivedSlices[slot];
+	if (!NetDelta::Decode(&slice, (const uint8_t*)recv_data.data(), recv_data.size()))
+	{
+		ErrorLog("Net board received a corrupt comm RAM delta; link broken.");
+		return false;
+	}
+	memcpy(dest, slice.data(), slice.size());
+	return true;
+}
+
+bool CSimNetBoard::NetDataAvailable(void)
+{
+	return netl ? netl->CheckDataAvailable() : netr->CheckDataAvailable();
+}
+
 CSimNetBoard::CSimNetBoard(const Util::Config::Node& config) : m_config(config)
 {
 }
 
 CSimNetBoard::~CSimNetBoard(void)
 {
-	m_quit = true;
+	m_connector.Stop();
 
-	if (m_connectThread.joinable())
-		m_connectThread.join();
+	if (m_recording && m_recording->GetFrames() > 0)
+	{
+		std::string file = m_config["NetRecordFile"].ValueAs<std::string>();
+		int level = int(std::min(9u, m_config["StateCompression"].ValueAs<unsigned>()));
+		if (OKAY == m_recording->Save(file, level))
+			printf("Net recording of %u frames saved to '%s'.\n", m_recording->GetFrames(), file.c_str());
+	}
 }
 
+// Only the memory shared with the main board, for rolling back (see
+// CModel3::SaveRollbackFrame()); the state of the link is not saved
 void CSimNetBoard::SaveState(CBlockFile* SaveState)
 {
-	
+	SaveState->NewBlock("Simulated Net Board", __FILE__);
+	SaveState->Write(RAM, 0x10000);
+	SaveState->Write(Buffer, 0x20000);
+	SaveState->Write(&m_commbank, sizeof(m_commbank));
+	SaveState->Write(&m_counter, sizeof(m_counter));
+	SaveState->Write(&m_IRQ2ack, sizeof(m_IRQ2ack));
+	SaveState->Write(&m_status0, sizeof(m_status0));
+	SaveState->Write(&m_status1, sizeof(m_status1));
 }
 
 void CSimNetBoard::LoadState(CBlockFile* SaveState)
 {
+	if (OKAY != SaveState->FindBlock("Simulated Net Board"))
+		return;
 
+	SaveState->Read(RAM, 0x10000);
+	SaveState->Read(Buffer, 0x20000);
+	SaveState->Read(&m_commbank, sizeof(m_commbank));
+	SaveState->Read(&m_counter, sizeof(m_counter));
+	SaveState->Read(&m_IRQ2ack, sizeof(m_IRQ2ack));
+	SaveState->Read(&m_status0, sizeof(m_status0));
+	SaveState->Read(&m_status1, sizeof(m_status1));
+	CommRAM = m_commbank ? Buffer + 0x10000 : Buffer;
+	externalCommRAM = m_commbank ? Buffer : Buffer + 0x10000;
 }
 
 bool CSimNetBoard::Init(uint8_t* netRAMPtr, uint8_t* netBufferPtr)
@@ -86,22 +423,82 @@ bool CSimNetBoard::Init(uint8_t* netRAMPtr, uint8_t* netBufferPtr)
 	port_out = m_config["PortOut"].ValueAs<unsigned>();
 	addr_out = m_config["AddressOut"].ValueAs<std::string>();
 
-	nets = std::make_unique<TCPSend>(addr_out, port_out);
-	netr = std::make_unique<TCPReceive>(port_in);
+	m_linkDescription = addr_out + ":" + std::to_string(port_out);
+
+	if (m_config["NetSimPeers"].ValueAs<unsigned>() > 0)
+	{
+		NetPeerSim::Settings settings;
+		settings.peers = std::min(m_config["NetSimPeers"].ValueAs<unsigned>(), 7u);
+		settings.latencyMS = m_config["NetSimLatency"].ValueAs<double>();
+		settings.jitterMS = m_config["NetSimJitter"].ValueAs<double>();
+		settings.lossPercent = m_config["NetSimLoss"].ValueAs<double>();
+		settings.delta = m_config["NetDelta"].ValueAs<bool>();
+		settings.keyframeInterval = m_config["NetKeyframe"].ValueAs<unsigned>();
+		settings.compression = int(m_config["NetCompression"].ValueAs<unsigned>());
+
+		std::unique_ptr<CNetRecording> replay;
+		std::string replayFile = m_config["NetSimReplayFile"].ValueAs<std::string>();
+		if (!replayFile.empty())
+		{
+			replay = std::make_unique<CNetRecording>();
+			if (OKAY != replay->Load(replayFile))
+				return FAIL;
+		}
+
+		m_linkDescription = std::to_string(settings.peers) + " simulated peers";
+		netl = std::make_unique<NetPeerSim>(settings, std::move(replay));
+	}
+	else if (m_config["NetSharedMemory"].ValueAs<bool>())
+	{
+		unsigned timeout = m_config["NetTimeout"].ValueAs<unsigned>();
+		m_linkDescription = "port " + std::to_string(port_out) + " through shared memory";
+		netl = std::make_unique<ShmLink>(port_out, port_in, timeout > 0 ? int(timeout) : -1);
+	}
+	else if (m_config["NetUDP"].ValueAs<bool>())
+	{
+		netl = std::make_unique<UDPLink>(addr_out, port_out, port_in, m_config["NetUDPRedundancy"].ValueAs<unsigned>(), m_config["NetUDPTimeout"].ValueAs<unsigned>());
+	}
+	else
+	{
+		nets = std::make_unique<TCPSend>(addr_out, port_out);
+		netr = std::make_unique<TCPReceive>(port_in);
+		unsigned timeout = m_config["NetTimeout"].ValueAs<unsigned>();
+		m_receiveTimeout = timeout > 0 ? int(timeout) : -1;
+	}
+
+	m_statsLogFrames = m_config["NetStatsLog"].ValueAs<unsigned>() * 60;
+
+	if (!m_config["NetRecordFile"].ValueAs<std::string>().empty())
+		m_recording = std::make_unique<CNetRecording>();
+
+	// machines sending deltas cannot link with those that do not
+	m_delta = m_config["NetDelta"].ValueAs<bool>();
+	m_keyframeInterval = m_config["NetKeyframe"].ValueAs<unsigned>();
+	m_compression = int(m_config["NetCompression"].ValueAs<unsigned>());
+	m_linkGUID = m_delta ? netGUID ^ 0xde17a : netGUID;
+
+	// nor can machines rolling back (which never send deltas)
+	m_rollbackFrames = std::min(m_config["NetRollback"].ValueAs<unsigned>(), MaxRollbackFrames);
+	if (m_rollbackFrames > 0)
+	{
+		m_delta = false;
+		m_linkGUID = netGUID ^ 0x5011bac;
+	}
 
 	return 0;
 }
 
 void CSimNetBoard::RunFrame(void)
 {
+	m_waitMicros = 0;
+
 	if (!IsRunning())
 		return;
 
 	switch (m_state)
 	{
 	case State::start:
-		if (!m_connected && !m_connectThread.joinable())
-			m_connectThread = std::thread(&CSimNetBoard::ConnectProc, this);
+		StartConnector();
 		m_status0 = 0;
 		m_status1 = IsGame("dirtdvls") ? 0x4004 : 0xe000;
 		m_state = State::init;
@@ -138,34 +535,29 @@ void CSimNetBoard::RunFrame(void)
 		{
 			m_status0 += 1; // type 1 games require this to be incremented every frame
 
-			if (!m_connected)
+			if (!LinkUp())
 				break;
 
 			uint8_t numMachines, machineIndex;
 
 			if (RAM16[0x400] == 0)	// master
 			{
-				// flush receive buffer
-				while (netr->CheckDataAvailable())
-				{
-					netr->Receive();
-				}
-
-				// check all linked instances have the same GUID
-				nets->Send(&netGUID, sizeof(netGUID));
-				auto& recv_data = netr->Receive();
+				// check all linked instances have the same GUID, waiting for it over frames
+				if (!StartHandshake())
+					break;
+				auto& recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				uint64_t testGUID;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
 
 				// send the GUID for one more loop
-				nets->Send(&testGUID, sizeof(testGUID));
-				netr->Receive();
+				NetSend(&testGUID, sizeof(testGUID));
+				NetReceive();
 				
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 				{
 					ErrorLog("unable to verify connection. Make sure all machines are using same build!");
 					m_state = State::error;
@@ -174,40 +566,42 @@ void CSimNetBoard::RunFrame(void)
 
 				// master has an index of zero
 				machineIndex = 0;
-				nets->Send(&machineIndex, sizeof(machineIndex));
+				NetSend(&machineIndex, sizeof(machineIndex));
 
 				// receive back the number of other linked machines
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				numMachines = recv_data[0];
 
 				// send the number of other linked machines
-				nets->Send(&numMachines, sizeof(numMachines));
-				netr->Receive();
+				NetSend(&numMachines, sizeof(numMachines));
+				NetReceive();
 			}
 			else
 			{
-				// receive GUID from the previous machine and check it matches
-				auto& recv_data = netr->Receive();
+				// receive GUID from the previous machine and check it matches, not waiting for it
+				if (!NetDataAvailable())
+					break;
+				auto& recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				uint64_t testGUID;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
-				nets->Send(&testGUID, sizeof(testGUID));
+				NetSend(&testGUID, sizeof(testGUID));
 
 				// one more time, in case a later machine has a GUID mismatch
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
-				nets->Send(&testGUID, sizeof(testGUID));
+				NetSend(&testGUID, sizeof(testGUID));
 
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 				{
 					ErrorLog("unable to verify connection. Make sure all machines are using same build!");
 					m_state = State::error;
@@ -215,18 +609,18 @@ void CSimNetBoard::RunFrame(void)
 				}
 
 				// receive the previous machine's index, increment it, send it to the next machine
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				machineIndex = recv_data[0] + 1;
-				nets->Send(&machineIndex, sizeof(machineIndex));
+				NetSend(&machineIndex, sizeof(machineIndex));
 
 				// receive the number of other linked machines and forward it on
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				numMachines = recv_data[0];
-				nets->Send(&numMachines, sizeof(numMachines));
+				NetSend(&numMachines, sizeof(numMachines));
 			}
 
 			// if there are no other linked machines, only continue if Supermodel is linked to itself
@@ -259,10 +653,11 @@ void CSimNetBoard::RunFrame(void)
 			CommRAM16[0xe] = FLIPENDIAN16(RAM16[0x402] - m_segmentSize + 0x200);
 
 			m_state = State::ready;
+			StartExchanges();
 		}
 		else
 		{
-			if (!m_connected)
+			if (!LinkUp())
 				break;
 
 			// we have to track both playable and non-playable machines for type 2
@@ -274,26 +669,23 @@ void CSimNetBoard::RunFrame(void)
 
 			if (RAM16[0x200] == 0)	// master
 			{
-				// flush receive buffer
-				while (netr->CheckDataAvailable())
-					netr->Receive();
-
-				// check all linked instances have the same GUID
-				nets->Send(&netGUID, sizeof(netGUID));
-				auto& recv_data = netr->Receive();
+				// check all linked instances have the same GUID, waiting for it over frames
+				if (!StartHandshake())
+					break;
+				auto& recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 
 				uint64_t testGUID;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
 
 				// send the GUID for one more loop
-				nets->Send(&testGUID, sizeof(testGUID));
-				netr->Receive();
+				NetSend(&testGUID, sizeof(testGUID));
+				NetReceive();
 
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 				{
 					ErrorLog("unable to verify connection. Make sure all machines are using same build!");
 					m_state = State::error;
@@ -302,40 +694,42 @@ void CSimNetBoard::RunFrame(void)
 
 				// master has indices set to zero
 				machineIndex.total = 0, machineIndex.playable = 0;
-				nets->Send(&machineIndex, sizeof(machineIndex));
+				NetSend(&machineIndex, sizeof(machineIndex));
 
 				// receive back the number of other linked machines
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&numMachines, &recv_data[0], recv_data.size());
 
 				// send the number of other linked machines
-				nets->Send(&numMachines, sizeof(numMachines));
-				netr->Receive();
+				NetSend(&numMachines, sizeof(numMachines));
+				NetReceive();
 			}
 			else if (RAM16[0x200] < 0x8000)	// slave
 			{
-				// receive GUID from the previous machine and check it matches
-				auto& recv_data = netr->Receive();
+				// receive GUID from the previous machine and check it matches, not waiting for it
+				if (!NetDataAvailable())
+					break;
+				auto& recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				uint64_t testGUID;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
-				nets->Send(&testGUID, sizeof(testGUID));
+				NetSend(&testGUID, sizeof(testGUID));
 
 				// one more time, in case a later machine has a GUID mismatch
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
-				nets->Send(&testGUID, sizeof(testGUID));
+				NetSend(&testGUID, sizeof(testGUID));
 
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 				{
 					ErrorLog("unable to verify connection. Make sure all machines are using same build!");
 					m_state = State::error;
@@ -343,48 +737,50 @@ void CSimNetBoard::RunFrame(void)
 				}
 
 				// receive the indices of the previous machine and increment them
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&machineIndex, &recv_data[0], recv_data.size());
 				machineIndex.total++, machineIndex.playable++;
 
 				// send our indices to the next machine
-				nets->Send(&machineIndex, sizeof(machineIndex));
+				NetSend(&machineIndex, sizeof(machineIndex));
 
 				// receive the number of machines
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&numMachines, &recv_data[0], recv_data.size());
 
 				// forward the number of machines
-				nets->Send(&numMachines, sizeof(numMachines));
+				NetSend(&numMachines, sizeof(numMachines));
 			}
 			else
 			{
 				// relay/satellite
 				
-				// receive GUID from the previous machine and check it matches
-				auto& recv_data = netr->Receive();
+				// receive GUID from the previous machine and check it matches, not waiting for it
+				if (!NetDataAvailable())
+					break;
+				auto& recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				uint64_t testGUID;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
-				nets->Send(&testGUID, sizeof(testGUID));
+				NetSend(&testGUID, sizeof(testGUID));
 
 				// one more time, in case a later machine has a GUID mismatch
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&testGUID, &recv_data[0], recv_data.size());
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 					testGUID = 0;
-				nets->Send(&testGUID, sizeof(testGUID));
+				NetSend(&testGUID, sizeof(testGUID));
 
-				if (testGUID != netGUID)
+				if (testGUID != m_linkGUID)
 				{
 					ErrorLog("unable to verify connection. Make sure all machines are using same build!");
 					m_state = State::error;
@@ -392,23 +788,23 @@ void CSimNetBoard::RunFrame(void)
 				}
 
 				// receive the indices of the previous machine; don't increment the playable index
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&machineIndex, &recv_data[0], recv_data.size());
 				machineIndex.total++;
 
 				// send our indices to the next machine
-				nets->Send(&machineIndex, sizeof(machineIndex));
+				NetSend(&machineIndex, sizeof(machineIndex));
 
 				// receive the number of machines
-				recv_data = netr->Receive();
+				recv_data = NetReceive();
 				if (recv_data.empty())
 					break;
 				memcpy(&numMachines, &recv_data[0], recv_data.size());
 
 				// forward the number of machines
-				nets->Send(&numMachines, sizeof(numMachines));
+				NetSend(&numMachines, sizeof(numMachines));
 
 				// indicate that this machine is a relay/satellite
 				if (!IsGame("dirtdvls"))
@@ -450,6 +846,7 @@ void CSimNetBoard::RunFrame(void)
 			CommRAM16[0xe] = FLIPENDIAN16(RAM16[0x206] + 0x80);
 
 			m_state = State::ready;
+			StartExchanges();
 		}
 		break;
 
@@ -457,38 +854,41 @@ void CSimNetBoard::RunFrame(void)
 		m_counter++;
 		CommRAM16[0x6] = FLIPENDIAN16(m_counter);
 		
-		// we only send what we need to; helps cut down on bandwidth
-		// each machine has to receive back its own data (TODO: copy this data manually?)
-		for (int i = 0; i < m_numMachines; i++)
-		{
-			nets->Send(CommRAM + 0x100 + i * m_segmentSize, m_segmentSize);
-			auto& recv_data = netr->Receive();
-			if (recv_data.size() == 0)
-			{
-				// link broken - send an "empty" packet to alert other machines
-				nets->Send(nullptr, 0);
-				m_state = State::error;
-				if (m_gameType == GameType::one)
-					m_status1 = 0x40;			// send "link broken" message to mainboard
-				break;
-			}
-			memcpy(CommRAM + 0x100 + (i + 1) * m_segmentSize, recv_data.data(), recv_data.size());
-		}
-
-		// swap CommRAM banks
-		if (m_commbank)
+		m_linkMonitor.FrameStart();
+		if (m_rollbackFrames > 0)
 		{
-			m_commbank = false;
-			CommRAM = Buffer;
-			externalCommRAM = Buffer + 0x10000;
+			if (!ExchangeFrame())
+				BreakLink();
 		}
 		else
 		{
-			m_commbank = true;
-			CommRAM = Buffer + 0x10000;
-			externalCommRAM = Buffer;
+			// we only send what we need to; helps cut down on bandwidth
+			// each machine has to receive back its own data (TODO: copy this data manually?)
+			for (int i = 0; i < m_numMachines; i++)
+			{
+				SendSlice(i, CommRAM + 0x100 + i * m_segmentSize);
+				if (!ReceiveSlice(i, CommRAM + 0x100 + (i + 1) * m_segmentSize))
+				{
+					BreakLink();
+					break;
+				}
+				if (m_recording && i < m_numMachines - 1)
+					m_recording->Add(CommRAM + 0x100 + (i + 1) * m_segmentSize, m_segmentSize, m_numMachines - 1);
+				if (i == m_numMachines - 1)
+					m_linkMonitor.RoundTrip();		// our own data is back
+			}
 		}
-		
+		if (m_state == State::ready)
+			m_linkMonitor.FrameEnd(m_statsLogFrames);
+
+		SwapCommBanks();
+		break;
+
+	case State::lost:
+		// the game sees the link broken until the other machines have linked
+		// again with this one, when it goes through the handshake again
+		if (LinkUp())
+			m_state = State::testing;
 		break;
 
 	case State::error:
@@ -502,12 +902,25 @@ void CSimNetBoard::Reset(void)
 	// if netboard was active, send an "empty" packet so the other machines don't get stuck waiting for data
 	if (m_state == State::ready)
 	{
-		nets->Send(nullptr, 0);
-		netr->Receive();
+		NetSend(nullptr, 0);
+		NetReceive();
 	}
 
 	m_running = false;
 	m_state = State::start;
+	m_handshakeSent = false;
+	m_linkMonitor.Reset();
+}
+
+UINT64 CSimNetBoard::GetWaitMicros(void)
+{
+	return m_waitMicros;
+}
+
+bool CSimNetBoard::GetLinkStats(NetLinkStats *stats)
+{
+	*stats = m_linkMonitor.GetStats();
+	return true;
 }
 
 bool CSimNetBoard::IsAttached(void)
@@ -525,35 +938,6 @@ void CSimNetBoard::GetGame(const Game& gameInfo)
 	m_gameInfo = gameInfo;
 }
 
-void CSimNetBoard::ConnectProc(void)
-{
-	using namespace std::chrono_literals;
-
-	if (m_connected)
-		return;
-
-	printf("Connecting to %s:%i ..\n", addr_out.c_str(), port_out);
-
-	// wait until TCPSend has connected to the next machine
-	while (!nets->Connect())
-	{
-		if (m_quit)
-			return;
-	}
-
-	// wait until TCPReceive has accepted a connection from the previous machine
-	while (!netr->Connected())
-	{
-		if (m_quit)
-			return;
-		std::this_thread::sleep_for(1ms);
-	}
-
-	printf("Successfully connected.\n");
-
-	m_connected = true;
-}
-
 uint8_t CSimNetBoard::ReadCommRAM8(unsigned addr)
 {
 	return externalCommRAM[addr];
@@ -26,6 +26,12 @@
 #include <cstdint>
 #include "TCPSend.h"
 #include "TCPReceive.h"
+#include "UDPLink.h"
+#include "ShmLink.h"
+#include "NetPeerSim.h"
+#include "NetRecording.h"
+#include "NetConnector.h"
+#include "NetDelta.h"
 #include "INetBoard.h"
 
 enum class State
@@ -34,6 +40,7 @@ enum class State
 	init,
 	testing,
 	ready,
+	lost,		// link broken, waiting to link again
 	error
 };
 
@@ -47,6 +54,8 @@ enum class GameType
 class CSimNetBoard : public INetBoard
 {
 public:
+	static const unsigned MaxRollbackFrames = 8;
+
 	CSimNetBoard(const Util::Config::Node& config);
 	~CSimNetBoard(void);
 
@@ -59,6 +68,12 @@ public:
 
 	bool IsAttached(void);
 	bool IsRunning(void);
+	UINT64 GetWaitMicros(void);
+	bool GetLinkStats(NetLinkStats *stats);
+
+	uint32_t GetFrame(void);
+	bool GetRollback(uint32_t* frame);
+	void ReplayFrame(uint32_t frame);
 
 	void GetGame(const Game& gameInfo);
 
@@ -86,12 +101,56 @@ private:
 	uint16_t port_in = 0;
 	uint16_t port_out = 0;
 	std::string addr_out;
-	std::thread m_connectThread;
-	std::atomic_bool m_quit = false;
-	std::atomic_bool m_connected = false;
+	CNetConnector m_connector;
+	bool m_handshakeSent = false;				// the master's GUID is going around the ring
+	uint32_t m_handshakeGeneration = 0;			// connection it was sent on
+	unsigned m_handshakeFrames = 0;				// frames it has been going around
 
 	std::unique_ptr<TCPSend> nets = nullptr;
 	std::unique_ptr<TCPReceive> netr = nullptr;
+	std::unique_ptr<INetLink> netl = nullptr;	// replaces nets and netr when linking over UDP or shared memory, or with simulated peers
+	std::string m_linkDescription;				// what the connector connects to
+	int m_receiveTimeout = -1;					// milliseconds netr waits for a message, -1 = forever
+	uint64_t m_waitMicros = 0;					// time spent waiting for messages in the last frame
+	CNetLinkMonitor m_linkMonitor;
+	unsigned m_statsLogFrames = 0;				// frames between logs of the link stats, 0 = never
+	std::unique_ptr<CNetRecording> m_recording;	// other machines' slices received, saved to NetRecordFile
+	uint64_t m_linkGUID = 0;					// differs between machines that cannot link
+
+	// comm RAM slices sent as deltas (see NetDelta.h)
+	bool m_delta = false;
+	unsigned m_keyframeInterval = 0;			// frames between keyframes, 0 = only the first
+	int m_compression = 0;						// zlib level
+	unsigned m_deltaFrame = 0;					// frames since the last keyframe
+	bool m_keyframe = false;					// frame being sent is a keyframe
+	std::vector<std::vector<uint8_t>> m_sentSlices;		// per slot, the last slice sent
+	std::vector<std::vector<uint8_t>> m_receivedSlices;	// per slot, the last slice received
+	std::vector<uint8_t> m_encoded;
+
+	// Rollback (NetRollback frames): instead of waiting for each frame's
+	// slices, those that have not arrived are predicted to be the same as the
+	// frame before, and the main board goes back to the frame and runs the
+	// frames since again when they turn out different. Waits only when the
+	// oldest frame that can be rolled back to is not complete. Messages are
+	// the frame number (32 bits) and slot (8 bits) followed by the slice.
+	struct FrameSlices
+	{
+		uint32_t frame = 0;
+		bool valid = false;
+		std::vector<std::vector<uint8_t>> data;	// per slot, 0 being ours as sent
+		std::vector<bool> real;					// slot's data arrived rather than predicted
+	};
+	unsigned m_rollbackFrames = 0;
+	uint32_t m_frame = 0;						// next frame exchanged
+	std::vector<FrameSlices> m_history;			// twice as many frames as rolled back, as the others can be that far ahead
+	bool m_rollbackPending = false;
+	uint32_t m_rollbackFrame = 0;
+	bool m_rollbackTooLate = false;				// logged data that came too late to roll back
+
+	FrameSlices* GetFrameSlices(uint32_t frame, bool create);
+	bool HandleFrameMessage(std::vector<char>& message);
+	void ApplyFrame(FrameSlices& slices, bool replay);
+	bool ExchangeFrame(void);
 
 	Game m_gameInfo;
 	GameType m_gameType = GameType::unknown;
@@ -111,7 +170,17 @@ private:
 	bool m_commbank = false;
 
 	inline bool IsGame(const char* gameName);
-	void ConnectProc(void);
+	void NetSend(const void* data, int length);
+	std::vector<char>& NetReceive(void);
+	bool NetDataAvailable(void);
+	void StartConnector(void);
+	bool LinkUp(void);
+	bool StartHandshake(void);
+	void StartExchanges(void);
+	void BreakLink(void);
+	void SwapCommBanks(void);
+	void SendSlice(int slot, const uint8_t* data);
+	bool ReceiveSlice(int slot, uint8_t* dest);
 };
 
 #endif
\ No newline at end of file
@@ -36,7 +36,12 @@ using namespace std::chrono_literals;
 TCPReceive::TCPReceive(int port) :
 	m_listenSocket(nullptr),
 	m_receiveSocket(nullptr),
-	m_socketSet(nullptr)
+	m_socketSet(nullptr),
+	m_running(false),
+	m_queueHead(0),
+	m_queueTail(0),
+	m_size(0),
+	m_read(0)
 {
 	SDLNet_Init();
 
@@ -49,7 +54,7 @@ TCPReceive::TCPReceive(int port) :
 		m_listenSocket = SDLNet_TCP_Open(&ip);
 		if (m_listenSocket) {
 			m_running = true;
-			m_listenThread = std::thread(&TCPReceive::ListenFunc, this);
+			m_receiveThread = std::thread(&TCPReceive::ReceiveFunc, this);
 		}
 	}
 }
@@ -58,8 +63,8 @@ TCPReceive::~TCPReceive()
 {
 	m_running = false;
 
-	if (m_listenThread.joinable()) {
-		m_listenThread.join();
+	if (m_receiveThread.joinable()) {
+		m_receiveThread.join();
 	}
 
 	if (m_listenSocket) {
@@ -80,80 +85,162 @@ TCPReceive::~TCPReceive()
 	SDLNet_Quit();
 }
 
-bool TCPReceive::CheckDataAvailable(int timeoutMS)
+bool TCPReceive::WaitForMessage(int timeoutMS)
 {
-	if (!m_receiveSocket) {
-		return false;
+	// Messages queued before a connection was lost are still returned
+	auto ready = [this]() {
+		return m_queueHead.load(std::memory_order_relaxed) != m_queueTail.load(std::memory_order_acquire) || !m_receiveSocket;
+	};
+
+	if (!ready() && timeoutMS != 0) {
+		std::unique_lock<std::mutex> lock(m_waitLock);
+		if (timeoutMS < 0) {
+			m_waitCond.wait(lock, ready);
+		}
+		else {
+			m_waitCond.wait_for(lock, std::chrono::milliseconds(timeoutMS), ready);
+		}
 	}
 
-	return SDLNet_CheckSockets(m_socketSet, timeoutMS) > 0;
+	return m_queueHead.load(std::memory_order_relaxed) != m_queueTail.load(std::memory_order_acquire);
 }
 
-std::vector<char>& TCPReceive::Receive()
+bool TCPReceive::CheckDataAvailable(int timeoutMS)
 {
-	if (!m_receiveSocket) {
-		DPRINTF("Can't receive because no socket.\n");
+	return WaitForMessage(timeoutMS);
+}
+
+std::vector<char>& TCPReceive::Receive(int timeoutMS)
+{
+	if (!WaitForMessage(timeoutMS)) {
+		DPRINTF("No message received.\n");
 		m_recBuffer.clear();
 		return m_recBuffer;
 	}
 
-	int size = 0;
-	int result = 0;
+	// Trade the buffer last returned for the message, so that the queue keeps
+	// buffers already large enough
+	unsigned head = m_queueHead.load(std::memory_order_relaxed);
+	m_recBuffer.swap(m_queue[head % QueueSize]);
+	m_queueHead.store(head + 1, std::memory_order_release);
 
-	result = SDLNet_TCP_Recv(m_receiveSocket, &size, sizeof(int));
-	DPRINTF("Received %i bytes\n", result);
-	if (result <= 0) {
-		SDLNet_TCP_Close(m_receiveSocket);
-		m_receiveSocket = nullptr;
+	DPRINTF("Received %i bytes\n", (int)m_recBuffer.size());
+	return m_recBuffer;
+}
+
+void TCPReceive::Wake()
+{
+	// Taking the lock ensures a Receive() about to wait sees the change
+	{
+		std::lock_guard<std::mutex> lock(m_waitLock);
 	}
+	m_waitCond.notify_one();
+}
+
+void TCPReceive::Disconnect()
+{
+	TCPsocket socket = m_receiveSocket;
+	SDLNet_DelSocket(m_socketSet, (SDLNet_GenericSocket)socket);
+	SDLNet_TCP_Close(socket);
+	m_receiveSocket = nullptr;
+	DPRINTF("Connection closed.\n");
+	Wake();
+}
+
+bool TCPReceive::ReadAvailable()
+{
+	TCPsocket socket = m_receiveSocket;
+	int result;
 
-	// reserve our space
-	m_recBuffer.resize(size);
+	// Length first, then the message into the buffer at the tail of the queue
+	if (m_read < (int)sizeof(m_size)) {
+		result = SDLNet_TCP_Recv(socket, (char*)&m_size + m_read, sizeof(m_size) - m_read);
+		if (result <= 0) {
+			return false;
+		}
+		m_read += result;
+		if (m_read < (int)sizeof(m_size)) {
+			return true;
+		}
+		if (m_size < 0) {
+			return false;
+		}
+		m_queue[m_queueTail.load(std::memory_order_relaxed) % QueueSize].resize(m_size);
+		if (m_size > 0) {
+			return true;	// read only once per SDLNet_CheckSockets(), which never blocks for long
+		}
+	}
 
-	while (size) {
+	unsigned tail = m_queueTail.load(std::memory_order_relaxed);
+	std::vector<char>& message = m_queue[tail % QueueSize];
+	int offset = m_read - (int)sizeof(m_size);
 
-		result = SDLNet_TCP_Recv(m_receiveSocket, m_recBuffer.data() + (m_recBuffer.size() - size), size);
+	if (offset < m_size) {
+		result = SDLNet_TCP_Recv(socket, message.data() + offset, m_size - offset);
 		DPRINTF("Received %i bytes\n", result);
 		if (result <= 0) {
-			SDLNet_TCP_Close(m_receiveSocket);
-			m_receiveSocket = nullptr;
-			break;
+			return false;
 		}
+		m_read += result;
+		offset += result;
+	}
 
-		size -= result;
+	if (offset == m_size) {
+		m_queueTail.store(tail + 1, std::memory_order_release);
+		m_read = 0;
+		Wake();
 	}
 
-	return m_recBuffer;
+	return true;
 }
 
-void TCPReceive::ListenFunc()
+void TCPReceive::ReceiveFunc()
 {
 	while (m_running) {
 
-		std::this_thread::sleep_for(16ms);
-		if (m_receiveSocket) continue;
+		if (!m_receiveSocket) {
 
-		auto socket = SDLNet_TCP_Accept(m_listenSocket);
+			std::this_thread::sleep_for(16ms);
 
-		if (socket) {
+			auto socket = SDLNet_TCP_Accept(m_listenSocket);
 
-			// remove old socket if required from socket set
-			if (m_receiveSocket) {
-				SDLNet_DelSocket(m_socketSet, (SDLNet_GenericSocket)m_receiveSocket.load());
+			if (socket) {
+				// a message partly read from a previous connection is dropped
+				m_read = 0;
+
+				SDLNet_AddSocket(m_socketSet, (SDLNet_GenericSocket)socket);
+				m_receiveSocket = socket;
+
+				DPRINTF("Accepted connection.\n");
 			}
 
-			m_receiveSocket = socket;
+			continue;
+		}
 
-			SDLNet_AddSocket(m_socketSet, (SDLNet_GenericSocket)socket);
+		// No more is read while the queue is full, so that the sender is held
+		// back by TCP
+		if (m_queueTail.load(std::memory_order_relaxed) - m_queueHead.load(std::memory_order_acquire) >= QueueSize) {
+			std::this_thread::sleep_for(1ms);
+			continue;
+		}
 
-			// add socket to socket set
-			DPRINTF("Accepted connection.\n");
+		// Wait for data a little at a time to see when to stop
+		if (SDLNet_CheckSockets(m_socketSet, 16) <= 0) {
+			continue;
 		}
 
+		if (!ReadAvailable()) {
+			Disconnect();
+		}
 	}
 }
 
 bool TCPReceive::Connected()
 {
 	return (m_receiveSocket != 0);
-}
\ No newline at end of file
+}
+
+unsigned TCPReceive::QueueDepth()
+{
+	return m_queueTail.load(std::memory_order_acquire) - m_queueHead.load(std::memory_order_relaxed);
+}
@@ -25,9 +25,19 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <vector>
 #include "SDLIncludes.h"
 
+/*
+ * TCPReceive:
+ *
+ * Receives the messages sent by TCPSend from the previous machine. A thread
+ * of its own accepts the connection and assembles the messages as they
+ * arrive into a queue of buffers that are reused, so that Receive() only
+ * takes messages already complete, waiting only if none has arrived yet.
+ */
 class TCPReceive
 {
 public:
@@ -35,19 +45,40 @@ public:
 	~TCPReceive();
 
 	bool CheckDataAvailable(int timeoutMS = 0);		// timeoutMS -1 = wait forever until data arrives, 0 = no waiting, 1+ wait time in milliseconds
-	std::vector<char>& Receive();
+	std::vector<char>& Receive(int timeoutMS = -1);	// empty if the connection is lost or no message arrives within timeoutMS
 	bool Connected();
+	unsigned QueueDepth();							// complete messages waiting to be received
 
 private:
 
-	void ListenFunc();
+	static const unsigned QueueSize = 16;
+
+	void ReceiveFunc();
+	bool ReadAvailable();
+	void Disconnect();
+	void Wake();
+	bool WaitForMessage(int timeoutMS);
 
 	TCPsocket m_listenSocket;
 	std::atomic<TCPsocket> m_receiveSocket;
 	SDLNet_SocketSet m_socketSet;
-	std::thread m_listenThread;
+	std::thread m_receiveThread;
 	std::atomic_bool m_running;
+
+	// Complete messages, added at the tail by the receive thread only and
+	// taken from the head by Receive() only. The lock and condition variable
+	// are only for waking a waiting Receive().
+	std::vector<char> m_queue[QueueSize];
+	std::atomic<unsigned> m_queueHead;
+	std::atomic<unsigned> m_queueTail;
+	std::mutex m_waitLock;
+	std::condition_variable m_waitCond;
+
+	// Message being assembled by the receive thread
+	int m_size;
+	int m_read;		// bytes of the length and message read so far
+
 	std::vector<char> m_recBuffer;
 };
 
-#endif
\ No newline at end of file
+#endif
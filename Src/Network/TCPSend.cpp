@@ -22,6 +22,7 @@
 
 #include "TCPSend.h"
 #include "OSD/Logger.h"
+#include <cstring>
 
 #if defined(_DEBUG)
 #include <stdio.h>
@@ -35,16 +36,21 @@ static const int RETRY_COUNT = 10;			// shrugs
 TCPSend::TCPSend(std::string& ip, int port) :
 	m_ip(ip),
 	m_port(port),
-	m_socket(nullptr)
+	m_socket(nullptr),
+	m_socketSet(nullptr)
 {
 	SDLNet_Init();
+
+	m_socketSet = SDLNet_AllocSocketSet(1);
 }
 
 TCPSend::~TCPSend()
 {
-	if (m_socket) {
-		SDLNet_TCP_Close(m_socket);
-		m_socket = nullptr;
+	Close();
+
+	if (m_socketSet) {
+		SDLNet_FreeSocketSet(m_socketSet);
+		m_socketSet = nullptr;
 	}
 
 	SDLNet_Quit();	// unload lib (winsock dll for windows)
@@ -60,21 +66,58 @@ bool TCPSend::Send(const void * data, int length)
 
 	DPRINTF("Sending %i bytes\n", length);
 
-	int sent = SDLNet_TCP_Send(m_socket, &length, sizeof(int));		// pack the length at the start of transmission.
+	// Send the length and the data in one go. Sent separately, the data would
+	// wait for the length to be acknowledged until the peer's delayed ACK.
+	// SDL_net already disables Nagle's algorithm for the sockets it connects.
+	int frameSize = (int)sizeof(int) + length;
+	if (m_frame.size() < (size_t)frameSize) {
+		m_frame.resize(frameSize);
+	}
 
-	if (!length)
-		return true;		// 0 sized packet will blow our connex
+	memcpy(m_frame.data(), &length, sizeof(int));		// pack the length at the start of transmission.
+	if (length) {
+		memcpy(m_frame.data() + sizeof(int), data, length);		// 0 sized packet only sends the length
+	}
 
-	sent = SDLNet_TCP_Send(m_socket, data, length);
+	int sent = SDLNet_TCP_Send(m_socket, m_frame.data(), frameSize);
 
-	if (sent < length) {
-		SDLNet_TCP_Close(m_socket);
-		m_socket = nullptr;
+	if (sent < frameSize) {
+		Close();
 	}
 
 	return true;
 }
 
+void TCPSend::Close()
+{
+	TCPsocket socket = m_socket;
+	if (socket) {
+		SDLNet_DelSocket(m_socketSet, (SDLNet_GenericSocket)socket);
+		m_socket = nullptr;
+		SDLNet_TCP_Close(socket);
+	}
+}
+
+bool TCPSend::CheckClosed()
+{
+	TCPsocket socket = m_socket;
+	if (!socket) {
+		return true;
+	}
+
+	// Nothing is ever sent back, so the socket is only readable once closed
+	if (SDLNet_CheckSockets(m_socketSet, 0) > 0 && SDLNet_SocketReady(socket)) {
+		char data;
+		if (SDLNet_TCP_Recv(socket, &data, 1) <= 0) {
+			DPRINTF("Connection closed by the next machine.\n");
+			Close();
+			return true;
+		}
+	}
+
+	return false;
+}
+
 bool TCPSend::Connected()
 {
 	return m_socket != 0;
@@ -86,7 +129,11 @@ bool TCPSend::Connect()
 	int result = SDLNet_ResolveHost(&ip, m_ip.c_str(), m_port);
 
 	if (result == 0) {
-		m_socket = SDLNet_TCP_Open(&ip);
+		TCPsocket socket = SDLNet_TCP_Open(&ip);
+		if (socket) {
+			SDLNet_AddSocket(m_socketSet, (SDLNet_GenericSocket)socket);
+			m_socket = socket;
+		}
 	}
 
 	return Connected();
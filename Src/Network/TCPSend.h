@@ -24,6 +24,8 @@
 #define _TCPSEND_H_
 
 #include <string>
+#include <vector>
+#include <atomic>
 #include "SDLIncludes.h"
 
 class TCPSend
@@ -33,13 +35,18 @@ public:
 	~TCPSend();
 
 	bool Send(const void* data, int length);
-	bool Connect();
+	bool Connect();				// may be called from another thread while not connected
 	bool Connected();
+	bool CheckClosed();			// closes the socket if the next machine has, from the sending thread; true if not connected
 private:
 
-	std::string	m_ip;
-	int			m_port;
-	TCPsocket	m_socket;		// sdl socket
+	void Close();
+
+	std::string			m_ip;
+	int					m_port;
+	std::atomic<TCPsocket>	m_socket;		// sdl socket
+	SDLNet_SocketSet	m_socketSet;	// to see if the next machine has closed the connection
+	std::vector<char>	m_frame;		// length and data of the message being sent, kept to avoid allocating per message
 
 };
 
@@ -23,6 +23,7 @@
 #include "TCPSendAsync.h"
 #include "OSD/Logger.h"
 #include <utility>
+#include <cstring>
 
 #if defined(_DEBUG)
 #include <stdio.h>
@@ -79,14 +80,20 @@ bool TCPSendAsync::Send(const void * data, int length)
 		return true;		// 0 sized packet will blow our connex
 	}
 
-	auto dataBuffer = std::unique_ptr<char[]>(new char[length+4]);
-
-	*((int32_t*)dataBuffer.get()) = length;				// set start of buffer to length
-	memcpy(dataBuffer.get() + 4, data, length);		// copy the rest of the data
-
 	// lock our array and signal to other thread data is ready
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
+
+		std::vector<char> dataBuffer;
+		if (!m_freeBuffers.empty()) {
+			dataBuffer = std::move(m_freeBuffers.back());
+			m_freeBuffers.pop_back();
+		}
+
+		dataBuffer.resize(length + 4);
+		*((int32_t*)dataBuffer.data()) = length;			// set start of buffer to length
+		memcpy(dataBuffer.data() + 4, data, length);	// copy the rest of the data
+
 		m_dataBuffers.emplace_back(std::move(dataBuffer));
 		
 		m_hasData = true;	// must set data ready in case of spurious wake up 
@@ -105,8 +112,6 @@ void TCPSendAsync::SendThread()
 {
 	while (true) {
 
-		std::unique_ptr<char[]> sendData;
-
 		{
 			std::unique_lock<std::mutex> lock(m_mutex);
 			m_cv.wait(lock, [this] { return m_hasData.load(); });
@@ -115,34 +120,41 @@ void TCPSendAsync::SendThread()
 				return;					// if we have woken up with no data assume we need to exit the thread
 			}
 
-			auto front = m_dataBuffers.begin();
-			sendData = std::move(*front);
-			m_dataBuffers.erase(front);
+			m_sendBuffers.swap(m_dataBuffers);	// take everything queued so far
 			m_hasData = false;		// potentially we could still have data in pipe, we'll set this at the bottom
 
 			// unlock mutex now so we don't block whilst sending
 		}
 
-		if (sendData == nullptr) {
-			break;		// shouldn't be able to get here
-		}
+		bool failed = false;
 
-		// get send size (which is packed at the start of the data
-		auto sendSize = *((int32_t*)sendData.get()) + 4;		// send size doesn't include 'header'
+		for (auto& sendData : m_sendBuffers) {
 
-		int sent = SDLNet_TCP_Send(m_socket, sendData.get(), sendSize);		// pack the length at the start of transmission.
-		if (sent < sendSize) {
-			SDLNet_TCP_Close(m_socket);
-			m_socket = nullptr;
-			break;
-		}
+			// get send size (which is packed at the start of the data
+			auto sendSize = *((int32_t*)sendData.data()) + 4;		// send size doesn't include 'header'
 
-		// we have finished with this buffer so release the data
-		sendData = nullptr;
+			int sent = SDLNet_TCP_Send(m_socket, sendData.data(), sendSize);		// length and data go in one send
+			if (sent < sendSize) {
+				SDLNet_TCP_Close(m_socket);
+				m_socket = nullptr;
+				failed = true;
+				break;
+			}
+		}
 
-		//check if we still have data in the pipe, if so set ready state again
+		// we have finished with these buffers so keep them for reuse, and
+		// check if we still have data in the pipe, if so set ready state again
 		{
 			std::unique_lock<std::mutex> lock(m_mutex);
+			for (auto& sendData : m_sendBuffers) {
+				m_freeBuffers.emplace_back(std::move(sendData));
+			}
+			m_sendBuffers.clear();
+
+			if (failed) {
+				break;
+			}
+
 			if (m_dataBuffers.size()) {
 				m_hasData = true;
 				m_cv.notify_one();
@@ -54,7 +54,13 @@ private:
 	std::mutex				m_mutex;
 	std::thread				m_sendThread;
 
-	std::vector<std::unique_ptr<char[]>> m_dataBuffers;	// each pointer is to an array of data. First word is the size of the data
+	// Messages waiting for the send thread, the ones it is sending, and
+	// buffers already sent for reuse. Each holds the size of the data in its
+	// first word, followed by the data. Buffers move between these without
+	// being freed, so that sending does not allocate once they are big enough.
+	std::vector<std::vector<char>> m_dataBuffers;
+	std::vector<std::vector<char>> m_sendBuffers;
+	std::vector<std::vector<char>> m_freeBuffers;
 
 };
 
@@ -0,0 +1,379 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * UDPLink.cpp
+ *
+ * Datagram formats (all fields 32-bit, in host byte order like the length
+ * prefix of TCPSend messages, as all machines in a ring run Supermodel on
+ * the same kind of CPU). Messages, sent to the next machine:
+ *
+ *		Magic number ("SMUM")
+ *		Session (random, chosen when the link is created)
+ *		Number of the last message included
+ *		Number of messages included (0 for a greeting)
+ *		For each message, oldest first:
+ *			Length
+ *			Data
+ *
+ * Acknowledgements, sent back to the previous machine for each datagram of
+ * messages received from it:
+ *
+ *		Magic number ("SMUA")
+ *		Session of the messages acknowledged
+ *		Number of the next message expected
+ */
+
+#include "UDPLink.h"
+#include "OSD/Logger.h"
+#include <cstring>
+#include <random>
+
+#if defined(_DEBUG)
+#include <stdio.h>
+#define DPRINTF DebugLog
+#else
+#define DPRINTF(a, ...)
+#endif
+
+static const uint32_t MESSAGE_MAGIC = 0x4d554d53;	// "SMUM"
+static const uint32_t ACK_MAGIC = 0x41554d53;		// "SMUA"
+static const int HEADER_SIZE = 4 * sizeof(uint32_t);
+static const int ACK_SIZE = 3 * sizeof(uint32_t);
+static const int MAX_PACKET_SIZE = 65507;			// largest UDP datagram over IPv4
+static const Uint32 RESEND_MS = 4;					// resend interval while waiting
+
+UDPLink::UDPLink(std::string& ip, int portOut, int portIn, unsigned redundancy, int timeoutMS) :
+	m_ip(ip),
+	m_portOut(portOut),
+	m_redundancy(redundancy < 1 ? 1 : (redundancy > MaxRedundancy ? MaxRedundancy : redundancy)),
+	m_timeoutMS(timeoutMS),
+	m_resolved(false),
+	m_connected(false),
+	m_socket(nullptr),
+	m_sendPacket(nullptr),
+	m_recvPacket(nullptr),
+	m_socketSet(nullptr),
+	m_session(0),
+	m_sendSeq(0),
+	m_ackSeq(0),
+	m_acknowledged(false),
+	m_lastSendTime(0),
+	m_receiving(false),
+	m_recvSession(0),
+	m_recvAddress(),
+	m_recvSeq(0),
+	m_queueHead(0),
+	m_queueCount(0),
+	m_lost(false)
+{
+	SDLNet_Init();
+
+	std::random_device random;
+	m_session = random();
+
+	m_socket = SDLNet_UDP_Open(portIn);
+	if (m_socket) {
+		m_sendPacket = SDLNet_AllocPacket(MAX_PACKET_SIZE);
+		m_recvPacket = SDLNet_AllocPacket(MAX_PACKET_SIZE);
+		m_socketSet = SDLNet_AllocSocketSet(1);
+		SDLNet_UDP_AddSocket(m_socketSet, m_socket);
+	}
+	else {
+		ErrorLog("Unable to open UDP port %d for the net board.", portIn);
+	}
+}
+
+UDPLink::~UDPLink()
+{
+	if (m_socketSet) {
+		SDLNet_FreeSocketSet(m_socketSet);
+		m_socketSet = nullptr;
+	}
+
+	if (m_sendPacket) {
+		SDLNet_FreePacket(m_sendPacket);
+		m_sendPacket = nullptr;
+	}
+
+	if (m_recvPacket) {
+		SDLNet_FreePacket(m_recvPacket);
+		m_recvPacket = nullptr;
+	}
+
+	if (m_socket) {
+		SDLNet_UDP_Close(m_socket);
+		m_socket = nullptr;
+	}
+
+	SDLNet_Quit();	// unload lib (winsock dll for windows)
+}
+
+bool UDPLink::Send(const void* data, int length)
+{
+	// If we failed bail out
+	if (!Connected()) {
+		DPRINTF("Not connected\n");
+		return false;
+	}
+
+	if (length > MAX_PACKET_SIZE - HEADER_SIZE - (int)sizeof(uint32_t)) {
+		ErrorLog("Net board message of %d bytes is too large for UDP.", length);
+		return false;
+	}
+
+	DPRINTF("Sending %i bytes\n", length);
+
+	// Keep the message for the next datagrams sent
+	auto& message = m_sent[m_sendSeq % m_redundancy];
+	message.resize(length);
+	if (length) {
+		memcpy(message.data(), data, length);
+	}
+	m_sendSeq++;
+
+	SendPacket();
+	return true;
+}
+
+void UDPLink::SendPacket()
+{
+	// Include as many of the last messages not acknowledged as fit, at least
+	// the last one, or none in a greeting
+	uint32_t last = m_sendSeq - 1;
+	uint32_t count = 0;
+	int size = HEADER_SIZE;
+	while (count < m_redundancy && count < m_sendSeq - m_ackSeq) {
+		int messageSize = (int)sizeof(uint32_t) + (int)m_sent[(last - count) % m_redundancy].size();
+		if (size + messageSize > MAX_PACKET_SIZE) {
+			break;
+		}
+		size += messageSize;
+		count++;
+	}
+
+	uint8_t* p = m_sendPacket->data;
+	uint32_t header[4] = { MESSAGE_MAGIC, m_session, last, count };
+	memcpy(p, header, sizeof(header));
+	p += sizeof(header);
+
+	for (uint32_t seq = last - count + 1; seq != last + 1; seq++) {
+		auto& message = m_sent[seq % m_redundancy];
+		uint32_t length = (uint32_t)message.size();
+		memcpy(p, &length, sizeof(length));
+		p += sizeof(length);
+		if (length) {
+			memcpy(p, message.data(), length);
+			p += length;
+		}
+	}
+
+	m_sendPacket->len = size;
+	m_sendPacket->address = m_address;
+	SDLNet_UDP_Send(m_socket, -1, m_sendPacket);
+	m_lastSendTime = SDL_GetTicks();
+}
+
+void UDPLink::SendAck()
+{
+	uint32_t ack[3] = { ACK_MAGIC, m_recvSession, m_recvSeq };
+	memcpy(m_sendPacket->data, ack, sizeof(ack));
+	m_sendPacket->len = ACK_SIZE;
+	m_sendPacket->address = m_recvAddress;
+	SDLNet_UDP_Send(m_socket, -1, m_sendPacket);
+}
+
+void UDPLink::ReadPacket()
+{
+	const uint8_t* p = m_recvPacket->data;
+	int size = m_recvPacket->len;
+
+	uint32_t header[4];
+	if (size < ACK_SIZE) {
+		return;
+	}
+	memcpy(header, p, ACK_SIZE);
+
+	// Acknowledgement from the next machine
+	if (header[0] == ACK_MAGIC) {
+		if (header[1] == m_session && (int32_t)(m_sendSeq - header[2]) >= 0) {
+			if ((int32_t)(header[2] - m_ackSeq) > 0) {
+				m_ackSeq = header[2];
+			}
+			m_acknowledged = true;
+		}
+		return;
+	}
+
+	if (size < HEADER_SIZE) {
+		return;
+	}
+	memcpy(header, p, sizeof(header));
+	if (header[0] != MESSAGE_MAGIC) {
+		return;
+	}
+
+	uint32_t session = header[1];
+	uint32_t last = header[2];
+	uint32_t count = header[3];
+
+	// Start after a greeting from a machine not heard from before, or with the
+	// newest message if messages were already on the way (e.g. since a
+	// timeout), as a new TCP connection would
+	if (!m_receiving || session != m_recvSession) {
+		m_receiving = true;
+		m_recvSession = session;
+		m_recvSeq = count ? last : last + 1;
+		m_lost = false;
+	}
+	m_recvAddress = m_recvPacket->address;
+
+	int offset = HEADER_SIZE;
+	for (uint32_t seq = last - count + 1; seq != last + 1; seq++) {
+
+		uint32_t length;
+		if (offset + (int)sizeof(length) > size) {
+			break;
+		}
+		memcpy(&length, p + offset, sizeof(length));
+		offset += sizeof(length);
+		if (length > (uint32_t)(size - offset)) {
+			break;
+		}
+
+		int32_t ahead = (int32_t)(seq - m_recvSeq);
+		if (ahead < 0) {
+			offset += length;		// already received
+			continue;
+		}
+
+		if (ahead > 0 || m_queueCount == QueueSize) {
+			// Messages in between will never arrive, so none after them can be
+			// used either or the ring would lose its order. Receive() times out.
+			if (!m_lost) {
+				ErrorLog("Net board lost messages from the previous machine.");
+			}
+			m_lost = true;
+			break;
+		}
+
+		auto& message = m_queue[(m_queueHead + m_queueCount) % QueueSize];
+		message.resize(length);
+		if (length) {
+			memcpy(message.data(), p + offset, length);
+		}
+		offset += length;
+		m_queueCount++;
+		m_recvSeq++;
+	}
+
+	SendAck();
+}
+
+void UDPLink::Poll(int timeoutMS)
+{
+	if (SDLNet_CheckSockets(m_socketSet, timeoutMS) > 0) {
+		while (SDLNet_UDP_Recv(m_socket, m_recvPacket) > 0) {
+			ReadPacket();
+		}
+	}
+}
+
+bool UDPLink::CheckDataAvailable(int timeoutMS)
+{
+	if (!m_socket) {
+		return false;
+	}
+
+	Poll(m_queueCount ? 0 : timeoutMS);
+	return m_queueCount > 0;
+}
+
+std::vector<char>& UDPLink::Receive()
+{
+	if (!m_socket) {
+		DPRINTF("Can't receive because no socket.\n");
+		m_recBuffer.clear();
+		return m_recBuffer;
+	}
+
+	Uint32 start = SDL_GetTicks();
+
+	while (!m_queueCount) {
+
+		Uint32 now = SDL_GetTicks();
+		if (m_timeoutMS >= 0 && now - start >= (Uint32)m_timeoutMS) {
+			DPRINTF("Timed out waiting to receive.\n");
+			m_receiving = false;		// take up the previous machine's messages again from its next datagram
+			m_recBuffer.clear();
+			return m_recBuffer;
+		}
+
+		// The next machine may still be waiting for the last messages
+		if (m_ackSeq != m_sendSeq && now - m_lastSendTime >= RESEND_MS) {
+			SendPacket();
+		}
+
+		Poll(RESEND_MS);
+	}
+
+	m_recBuffer.swap(m_queue[m_queueHead]);
+	m_queueHead = (m_queueHead + 1) % QueueSize;
+	m_queueCount--;
+
+	DPRINTF("Received %i bytes\n", (int)m_recBuffer.size());
+	return m_recBuffer;
+}
+
+bool UDPLink::Connect()
+{
+	if (!m_socket || m_connected) {
+		return Connected();
+	}
+
+	if (!m_resolved) {
+		m_resolved = SDLNet_ResolveHost(&m_address, m_ip.c_str(), m_portOut) == 0;
+		if (!m_resolved) {
+			return false;
+		}
+	}
+
+	// Greet the next machine until it acknowledges, and wait to be greeted by
+	// the previous one, acknowledging it
+	if (!m_acknowledged && SDL_GetTicks() - m_lastSendTime >= RESEND_MS) {
+		SendPacket();
+	}
+	Poll(RESEND_MS);
+
+	m_connected = m_acknowledged && m_receiving;
+	return Connected();
+}
+
+bool UDPLink::Connected()
+{
+	return m_socket != nullptr && m_connected;
+}
+
+unsigned UDPLink::QueueDepth()
+{
+	return m_queueCount;
+}
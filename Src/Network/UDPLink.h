@@ -0,0 +1,106 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2011-2020 Bart Trzynadlowski, Nik Henson, Ian Curtis,
+ **                     Harry Tuttle, and Spindizzi
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#ifndef _UDPLINK_H_
+#define _UDPLINK_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "SDLIncludes.h"
+#include "INetLink.h"
+
+/*
+ * UDPLink:
+ *
+ * Both ends of one machine's hop in the ring of linked machines, over UDP
+ * instead of TCPSend and TCPReceive: messages are sent to the next machine and
+ * received from the previous one, in order, with the same Send() and
+ * Receive() interface.
+ *
+ * Messages are numbered and each datagram carries the last few sent that the
+ * next machine has not acknowledged, so that one lost datagram is made up for
+ * by the next. While waiting to receive, unacknowledged messages are sent
+ * again every few milliseconds, because the machine waiting for them may be
+ * waiting before sending anything else. A message that does not arrive within
+ * the timeout is reported as an empty message, as a broken TCP link is.
+ *
+ * Connect() must be called until it succeeds before sending, as with TCP: it
+ * exchanges greetings with both neighbours so that no message is sent before
+ * the next machine is listening.
+ */
+class UDPLink : public INetLink
+{
+public:
+	UDPLink(std::string& ip, int portOut, int portIn, unsigned redundancy, int timeoutMS);
+	~UDPLink();
+
+	bool Send(const void* data, int length);
+	bool CheckDataAvailable(int timeoutMS = 0);		// timeoutMS -1 = wait forever until data arrives, 0 = no waiting, 1+ wait time in milliseconds
+	std::vector<char>& Receive();
+	bool Connect();
+	bool Connected();
+	unsigned QueueDepth();							// messages waiting to be received
+
+private:
+
+	static const unsigned MaxRedundancy = 16;
+	static const unsigned QueueSize = 64;
+
+	void SendPacket();
+	void SendAck();
+	void Poll(int timeoutMS);
+	void ReadPacket();
+
+	std::string			m_ip;
+	int					m_portOut;
+	unsigned			m_redundancy;		// messages per datagram
+	int					m_timeoutMS;		// time to wait for a message before giving up
+	IPaddress			m_address;			// next machine
+	bool				m_resolved;
+	bool				m_connected;		// greetings exchanged with both neighbours
+	UDPsocket			m_socket;
+	UDPpacket*			m_sendPacket;
+	UDPpacket*			m_recvPacket;
+	SDLNet_SocketSet	m_socketSet;
+
+	// Messages sent, the last m_redundancy of which are kept for resending
+	uint32_t			m_session;			// identifies this link's messages, so a restarted machine's numbering is recognized
+	uint32_t			m_sendSeq;			// number of the next message sent
+	uint32_t			m_ackSeq;			// number of the first message not acknowledged
+	bool				m_acknowledged;		// the next machine has acknowledged a datagram
+	std::vector<char>	m_sent[MaxRedundancy];
+	Uint32				m_lastSendTime;
+
+	// Messages received in order and not yet returned by Receive()
+	bool				m_receiving;		// a datagram has been received from m_recvSession
+	uint32_t			m_recvSession;
+	IPaddress			m_recvAddress;		// previous machine, to which acknowledgements are sent
+	uint32_t			m_recvSeq;			// number of the next message expected
+	std::vector<char>	m_queue[QueueSize];
+	unsigned			m_queueHead;
+	unsigned			m_queueCount;
+	bool				m_lost;				// messages were lost for good
+	std::vector<char>	m_recBuffer;
+};
+
+#endif
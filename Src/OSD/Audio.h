@@ -36,9 +36,31 @@ typedef void (*AudioCallbackFPtr)(void *data);
 
 extern void SetAudioCallback(AudioCallbackFPtr callback, void *data);
 
+/*
+ * SetAudioSink(AudioSinkFPtr sink, void *data)
+ *
+ * Sets a function to be given each chunk of audio once it has been mixed for
+ * the host's channels, such as to record it, or NULL for none. It is called
+ * from the thread calling OutputAudio(), even when headless, and must not
+ * block. Samples are 16-bit, 44.1 KHz and interleaved.
+ */
+typedef void (*AudioSinkFPtr)(void *data, const INT16 *samples, unsigned numSamples, unsigned numChannels);
+
+extern void SetAudioSink(AudioSinkFPtr sink, void *data);
+
 extern void SetAudioEnabled(bool enabled);
 extern void SetAudioType(Game::AudioTypes type);
 
+/*
+ * SetAudioHeadless(bool headless)
+ *
+ * When set before OpenAudio(), no host audio device is opened: each chunk of
+ * audio is still mixed, then discarded, and the buffer is reported full after
+ * every chunk so that exactly one frame of audio is generated per frame (for
+ * benchmarking).
+ */
+extern void SetAudioHeadless(bool headless);
+
 /*
  * OpenAudio()
  *
@@ -53,6 +75,21 @@ extern bool OpenAudio(const Util::Config::Node& config);
  */
 extern bool OutputAudio(unsigned numSamples, const float* leftFrontBuffer, const float* rightFrontBuffer, const float* leftRearBuffer, const float* rightRearBuffer, bool flipStereo);
 
+/*
+ * GetAudioStats(stats)
+ *
+ * Reports the total numbers of buffer under-runs and over-runs so far and how
+ * full the audio buffer is (0 to 1).
+ */
+struct AudioStats
+{
+	unsigned underRuns;
+	unsigned overRuns;
+	float fillLevel;
+};
+
+extern void GetAudioStats(AudioStats *stats);
+
 /*
  * CloseAudio()
  *
@@ -0,0 +1,63 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * EncoderPipe.h
+ *
+ * Header file for OS-dependent pipes to an external encoding program (e.g.,
+ * ffmpeg): the program's standard input, and named pipes it opens as further
+ * inputs.
+ */
+
+#ifndef INCLUDED_ENCODERPIPE_H
+#define INCLUDED_ENCODERPIPE_H
+
+#include <string>
+
+namespace EncoderPipe
+{
+    struct Pipe;
+
+    /*
+     * StartProcess() runs a command line with its standard input connected
+     * to the pipe returned. MakeNamed() makes a named pipe for the program to
+     * open, and returns its path in *path. Both return NULL on failure.
+     */
+    Pipe *StartProcess(const std::string &command);
+    Pipe *MakeNamed(const std::string &name, std::string *path);
+
+    /*
+     * Write() blocks until all the data is written. On a named pipe, the
+     * first write waits for the program to open it, for up to timeoutMs
+     * milliseconds. Returns false if the program has gone away or never
+     * opened the pipe.
+     */
+    bool Write(Pipe *pipe, const void *data, size_t length, unsigned timeoutMs = 10000);
+
+    /*
+     * Close() closes the pipe, so that the program sees the end of its
+     * input, and waits for a process started by StartProcess() to exit.
+     * Returns its exit code, or 0 for a named pipe.
+     */
+    int Close(Pipe *pipe);
+}
+
+#endif  // INCLUDED_ENCODERPIPE_H
@@ -21,6 +21,7 @@
  **/
 
 #include "OSD/Logger.h"
+#include <chrono>
 #include <set>
 #ifdef _WIN32
 #include <windows.h>
@@ -164,11 +165,16 @@ std::shared_ptr<CLogger> CreateLogger(const Util::Config::Node &config)
  * CMultiLogger
  */
 
+// Each logger is given a copy of the arguments, as using them consumes them
+
 void CMultiLogger::DebugLog(const char *fmt, va_list vl)
 {
   for (auto &logger: m_loggers)
   {
-    logger->DebugLog(fmt, vl);
+    va_list copy;
+    va_copy(copy, vl);
+    logger->DebugLog(fmt, copy);
+    va_end(copy);
   }
 }
 
@@ -176,7 +182,10 @@ void CMultiLogger::InfoLog(const char *fmt, va_list vl)
 {
   for (auto &logger: m_loggers)
   {
-    logger->InfoLog(fmt, vl);
+    va_list copy;
+    va_copy(copy, vl);
+    logger->InfoLog(fmt, copy);
+    va_end(copy);
   }
 }
 
@@ -184,7 +193,10 @@ void CMultiLogger::ErrorLog(const char *fmt, va_list vl)
 {
   for (auto &logger: m_loggers)
   {
-    logger->ErrorLog(fmt, vl);
+    va_list copy;
+    va_copy(copy, vl);
+    logger->ErrorLog(fmt, copy);
+    va_end(copy);
   }
 }
 
@@ -220,6 +232,97 @@ void CConsoleErrorLogger::ErrorLog(const char *fmt, va_list vl)
  * CFileLogger
  */
 
+// Ring of messages logged by one thread, which only it writes and only the
+// writer thread reads
+struct CFileLogger::ThreadRing
+{
+  static const unsigned Size = 512;         // power of two
+  static const unsigned MessageSize = 512;  // longer messages are cut short
+
+  struct Message
+  {
+    uint64_t sequence;
+    char text[MessageSize];
+  };
+
+  std::thread::id owner;
+  std::atomic<uint32_t> head;     // messages logged so far
+  std::atomic<uint32_t> tail;     // messages written so far
+  Message messages[Size];
+
+  ThreadRing(std::thread::id thread)
+    : owner(thread),
+      head(0),
+      tail(0)
+  {
+  }
+};
+
+// Ring of the logger the calling thread last logged to
+static thread_local uint64_t t_ringLoggerId = 0;
+static thread_local void *t_ring = nullptr;
+
+static std::atomic<uint64_t> s_nextLoggerId(1);
+
+CFileLogger::ThreadRing *CFileLogger::GetRing(void)
+{
+  if (t_ringLoggerId == m_id)
+    return static_cast<ThreadRing *>(t_ring);
+
+  // Rings outlive their threads and are taken over by threads that later
+  // get the same ID
+  std::lock_guard<std::mutex> lock(m_ringsLock);
+  std::thread::id thread = std::this_thread::get_id();
+  ThreadRing *ring = nullptr;
+  for (auto &r: m_rings)
+  {
+    if (r->owner == thread)
+      ring = r.get();
+  }
+  if (ring == nullptr)
+  {
+    m_rings.emplace_back(new ThreadRing(thread));
+    ring = m_rings.back().get();
+  }
+  t_ringLoggerId = m_id;
+  t_ring = ring;
+  return ring;
+}
+
+void CFileLogger::Log(const char *prefix, const char *suffix, const char *fmt, va_list vl)
+{
+  ThreadRing *ring = GetRing();
+  uint32_t head = ring->head.load(std::memory_order_relaxed);
+  uint32_t pending = head - ring->tail.load(std::memory_order_acquire);
+
+  // Only with the ring full does logging wait, for the writer to catch up
+  while (pending >= ThreadRing::Size)
+  {
+    m_wakeWriter.store(true, std::memory_order_relaxed);
+    m_writerWake.notify_one();
+    std::this_thread::yield();
+    pending = head - ring->tail.load(std::memory_order_acquire);
+  }
+
+  // Format into the ring, keeping room for the suffix
+  ThreadRing::Message &message = ring->messages[head & (ThreadRing::Size - 1)];
+  size_t room = sizeof(message.text) - strlen(suffix);
+  int length = snprintf(message.text, room, "%s", prefix);
+  int formatted = vsnprintf(message.text + length, room - length, fmt, vl);
+  if (formatted > 0)
+    length += std::min(formatted, int(room - length - 1));
+  strcpy(message.text + length, suffix);
+  message.sequence = m_sequence.fetch_add(1, std::memory_order_relaxed);
+  ring->head.store(head + 1, std::memory_order_release);
+
+  // Wake the writer early rather than let the ring fill up
+  if (pending + 1 >= ThreadRing::Size / 2)
+  {
+    m_wakeWriter.store(true, std::memory_order_relaxed);
+    m_writerWake.notify_one();
+  }
+}
+
 void CFileLogger::DebugLog(const char *fmt, va_list vl)
 {
   if (m_logLevel > LogLevel::Debug)
@@ -227,15 +330,7 @@ void CFileLogger::DebugLog(const char *fmt, va_list vl)
     return;
   }
 
-  char string1[4096];
-  char string2[4096];
-
-  vsprintf(string1, fmt, vl);
-  sprintf(string2, "[Debug] %s", string1);
-
-  // Debug logging is so copious that we don't bother to guarantee it is saved
-  std::unique_lock<std::mutex> lock(m_mtx);
-  WriteToFiles(string2);
+  Log("[Debug] ", "", fmt, vl);
 }
 
 void CFileLogger::InfoLog(const char *fmt, va_list vl)
@@ -245,16 +340,7 @@ void CFileLogger::InfoLog(const char *fmt, va_list vl)
     return;
   }
 
-  char string1[4096];
-  char string2[4096];
-
-  vsprintf(string1, fmt, vl);
-  sprintf(string2, "[Info]  %s\n", string1);
-
-  // Write to file, close, and reopen to ensure it was saved
-  std::unique_lock<std::mutex> lock(m_mtx);
-  WriteToFiles(string2);
-  ReopenFiles(std::ios::app);
+  Log("[Info]  ", "\n", fmt, vl);
 }
 
 void CFileLogger::ErrorLog(const char *fmt, va_list vl)
@@ -264,16 +350,100 @@ void CFileLogger::ErrorLog(const char *fmt, va_list vl)
     return;
   }
 
-  char string1[4096];
-  char string2[4096];
+  // Errors are written before returning to ensure they are saved
+  Log("[Error] ", "\n", fmt, vl);
+  Flush();
+}
 
-  vsprintf(string1, fmt, vl);
-  sprintf(string2, "[Error] %s\n", string1);
+void CFileLogger::Flush(void)
+{
+  std::unique_lock<std::mutex> lock(m_writerLock);
+  if (!m_writer.joinable())
+    return;
+  uint64_t request = ++m_flushRequests;
+  m_writerWake.notify_one();
+  m_flushed.wait(lock, [&] { return m_flushesDone >= request; });
+}
+
+void CFileLogger::WriterThread(void)
+{
+  std::unique_lock<std::mutex> lock(m_writerLock);
+  while (true)
+  {
+    bool quit = m_quit;
+    uint64_t request = m_flushRequests;
+    lock.unlock();
+    WritePending();
+    lock.lock();
+    m_flushesDone = request;
+    m_flushed.notify_all();
+    if (quit)
+      break;
+    m_writerWake.wait_for(lock, std::chrono::milliseconds(10), [this]
+    {
+      return m_quit || m_flushRequests != m_flushesDone || m_wakeWriter.exchange(false, std::memory_order_relaxed);
+    });
+  }
+}
+
+void CFileLogger::WritePending(void)
+{
+  std::vector<ThreadRing *> rings;
+  {
+    std::lock_guard<std::mutex> lock(m_ringsLock);
+    for (auto &ring: m_rings)
+      rings.push_back(ring.get());
+  }
 
-  // Write to file, close, and reopen to ensure it was saved
-  std::unique_lock<std::mutex> lock(m_mtx);
-  WriteToFiles(string2);
-  ReopenFiles(std::ios::app);
+  // Write in the order logged, taking the earliest message of any ring in
+  // turn, up to those logged by now
+  std::vector<uint32_t> heads;
+  for (ThreadRing *ring: rings)
+    heads.push_back(ring->head.load(std::memory_order_acquire));
+  bool wrote = false;
+  while (true)
+  {
+    ThreadRing *next = nullptr;
+    for (size_t i = 0; i < rings.size(); i++)
+    {
+      ThreadRing *ring = rings[i];
+      uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+      if (tail != heads[i] && (next == nullptr || ring->messages[tail & (ThreadRing::Size - 1)].sequence < next->messages[next->tail.load(std::memory_order_relaxed) & (ThreadRing::Size - 1)].sequence))
+        next = ring;
+    }
+    if (next == nullptr)
+      break;
+    uint32_t tail = next->tail.load(std::memory_order_relaxed);
+    WriteMessage(next->messages[tail & (ThreadRing::Size - 1)].text);
+    next->tail.store(tail + 1, std::memory_order_release);
+    wrote = true;
+  }
+
+  if (wrote)
+  {
+    for (std::ofstream &ofs: m_logFiles)
+      ofs.flush();
+    for (FILE *fp: m_systemFiles)
+      fflush(fp);
+  }
+}
+
+void CFileLogger::WriteMessage(const char *str)
+{
+  if (m_lastMessage == str)
+  {
+    m_repeats++;
+    return;
+  }
+  if (m_repeats > 0)
+  {
+    char string[64];
+    sprintf(string, "[Info]  Last message repeated %u times.\n", m_repeats);
+    WriteToFiles(string);
+  }
+  WriteToFiles(str);
+  m_lastMessage = str;
+  m_repeats = 0;
 }
 
 void CFileLogger::ReopenFiles(std::ios_base::openmode mode)
@@ -309,19 +479,56 @@ void CFileLogger::WriteToFiles(const char *str)
   }
 }
 
+void CFileLogger::Start(void)
+{
+  ReopenFiles(std::ios::out);
+  m_writer = std::thread(&CFileLogger::WriterThread, this);
+}
+
 CFileLogger::CFileLogger(CLogger::LogLevel level, std::vector<std::string> filenames)
   : m_logLevel(level),
-    m_logFilenames(filenames)
+    m_logFilenames(filenames),
+    m_id(s_nextLoggerId++),
+    m_sequence(0),
+    m_wakeWriter(false),
+    m_quit(false),
+    m_flushRequests(0),
+    m_flushesDone(0),
+    m_repeats(0)
 {
-  ReopenFiles(std::ios::out);
+  Start();
 }
 
 CFileLogger::CFileLogger(CLogger::LogLevel level, std::vector<std::string> filenames, std::vector<FILE *> systemFiles)
   : m_logLevel(level),
     m_logFilenames(filenames),
-    m_systemFiles(systemFiles)
+    m_systemFiles(systemFiles),
+    m_id(s_nextLoggerId++),
+    m_sequence(0),
+    m_wakeWriter(false),
+    m_quit(false),
+    m_flushRequests(0),
+    m_flushesDone(0),
+    m_repeats(0)
 {
-  ReopenFiles(std::ios::out);
+  Start();
+}
+
+CFileLogger::~CFileLogger()
+{
+  // Write what is left, including the count of a last message repeated
+  {
+    std::lock_guard<std::mutex> lock(m_writerLock);
+    m_quit = true;
+  }
+  m_writerWake.notify_one();
+  m_writer.join();
+  if (m_repeats > 0)
+  {
+    char string[64];
+    sprintf(string, "[Info]  Last message repeated %u times.\n", m_repeats);
+    WriteToFiles(string);
+  }
 }
 
 /*
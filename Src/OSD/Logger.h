@@ -33,12 +33,16 @@
 #include "Types.h"
 #include "Version.h"
 #include "Util/NewConfig.h"
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdarg>
 #include <cstring>
 #include <fstream>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 
@@ -169,9 +173,16 @@ class CConsoleErrorLogger: public CLogger
 /*
  * CFileLogger:
  *
- * Default logger that logs to debug and error log files. Files are opened and
- * closed for each message in order to preserve contents in case of program
- * crash.
+ * Default logger that logs to debug and error log files.
+ *
+ * Messages are formatted by the thread logging them into a ring of its own,
+ * which only it writes, and written out by a background thread, so logging
+ * neither takes locks nor waits on the files. The writer wakes every few
+ * milliseconds and flushes the files after each batch, so that little is lost
+ * if the program crashes, and errors are written before ErrorLog() returns. A
+ * message repeated is written once, followed by a count of the repeats when
+ * another message comes. Only a thread that fills its ring waits, for the
+ * writer to catch up.
  */
 class CFileLogger: public CLogger
 {
@@ -179,16 +190,53 @@ public:
   void DebugLog(const char *fmt, va_list vl);
   void InfoLog(const char *fmt, va_list vl);
   void ErrorLog(const char *fmt, va_list vl);
+
+  /*
+   * Flush(void):
+   *
+   * Waits until all messages logged so far have been written.
+   */
+  void Flush(void);
+
 	CFileLogger(LogLevel level, std::vector<std::string> filenames);
   CFileLogger(LogLevel level, std::vector<std::string> filenames, std::vector<FILE *> systemFiles);
+  ~CFileLogger();
 
 private:
-	std::mutex m_mtx; // needed because we may close/reopen files and logging must be thread-safe
+  struct ThreadRing;
+
   LogLevel m_logLevel;
 	const std::vector<std::string> m_logFilenames;
   std::vector<std::ofstream> m_logFiles;
   std::vector<FILE *> m_systemFiles;
 
+  // Rings of the threads that have logged, and order of messages across them
+  const uint64_t m_id;  // tells loggers apart in each thread's cached ring
+  std::mutex m_ringsLock;
+  std::vector<std::unique_ptr<ThreadRing>> m_rings;
+  std::atomic<uint64_t> m_sequence;
+
+  // Writer thread
+  std::thread m_writer;
+  std::mutex m_writerLock;
+  std::condition_variable m_writerWake;
+  std::condition_variable m_flushed;
+  std::atomic<bool> m_wakeWriter;
+  bool m_quit;
+  uint64_t m_flushRequests;
+  uint64_t m_flushesDone;
+
+  // Last message written and the times it has been repeated since (writer
+  // thread only)
+  std::string m_lastMessage;
+  unsigned m_repeats;
+
+  void Start(void);
+  ThreadRing *GetRing(void);
+  void Log(const char *prefix, const char *suffix, const char *fmt, va_list vl);
+  void WriterThread(void);
+  void WritePending(void);
+  void WriteMessage(const char *str);
   void ReopenFiles(std::ios_base::openmode mode);
   void WriteToFiles(const char *str);
 };
@@ -0,0 +1,55 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * OutputStream.h
+ *
+ * Header file for OS-dependent streams of output messages to other programs,
+ * over UDP or through a named pipe.
+ */
+
+#ifndef INCLUDED_OUTPUTSTREAM_H
+#define INCLUDED_OUTPUTSTREAM_H
+
+#include <string>
+
+namespace OutputStream
+{
+    struct Stream;
+
+    /*
+     * OpenUDP() sends each message as a datagram to a host and port.
+     * OpenPipe() makes a named pipe (a FIFO in the temporary directory on
+     * POSIX systems, unless the name is a path) that one reader at a time can
+     * open, and writes each message as a line. Both return NULL on failure.
+     */
+    Stream *OpenUDP(const std::string &address, unsigned port);
+    Stream *OpenPipe(const std::string &name);
+
+    /*
+     * Write() never blocks: it returns false, dropping the message, when it
+     * cannot be sent at once, such as when nobody has the pipe open.
+     */
+    bool Write(Stream *stream, const char *message, size_t length);
+    void Close(Stream *stream);
+}
+
+#endif  // INCLUDED_OUTPUTSTREAM_H
@@ -26,6 +26,8 @@
 #include "Outputs.h"
 
 #include "Supermodel.h"
+#include "OSD/OutputStream.h"
+#include "Util/Format.h"
 
 const char *COutputs::s_outputNames[] =
 	{ 
@@ -64,16 +66,39 @@ EOutputs COutputs::GetOutputByName(const char *name)
 }
 
 COutputs::COutputs()
+	: m_frame(0), m_stop(false)
 {
 	memset(m_first, true, sizeof(m_first));
 	memset(m_values, 0, sizeof(m_values));
+	memset(&m_batch, 0, sizeof(m_batch));
+	memset(&m_pending, 0, sizeof(m_pending));
 }
 
 COutputs::~COutputs()
+{
+	StopDelivery();
+}
+
+bool COutputs::Initialize()
+{
+	return true;
+}
+
+void COutputs::Attached()
+{
+	//
+}
+
+void COutputs::SendOutput(EOutputs output, UINT8 prevValue, UINT8 value)
 {
 	//
 }
 
+void COutputs::AddSink(std::unique_ptr<IOutputSink> sink)
+{
+	m_sinks.push_back(std::move(sink));
+}
+
 const Game &COutputs::GetGame() const
 {
 	return m_game;
@@ -101,8 +126,11 @@ void COutputs::SetValue(EOutputs output, UINT8 value)
 	UINT8 prevValue = m_values[idx];
 	m_first[idx] = false;
 	m_values[idx] = value;
-	if (firstSet || value != prevValue)
-		SendOutput(output, prevValue, value);
+	if ((firstSet || value != prevValue) && !m_batch.Changed(idx))
+	{
+		m_batch.changed |= 1 << idx;
+		m_batch.prevValues[idx] = prevValue;
+	}
 }
 
 bool COutputs::HasValue(EOutputs output) 
@@ -113,3 +141,105 @@ bool COutputs::HasValue(EOutputs output)
 	return !m_first[output]; 
 }
 
+
+void COutputs::EndFrame()
+{
+	m_frame++;
+	if (m_batch.changed == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (unsigned i = 0; i < NUM_OUTPUTS; i++)
+		{
+			if (m_batch.Changed(i) && !m_pending.Changed(i))
+				m_pending.prevValues[i] = m_batch.prevValues[i];
+			if (!m_first[i])
+				m_pending.used |= 1 << i;
+		}
+		m_pending.changed |= m_batch.changed;
+		m_pending.frame = m_frame;
+		memcpy(m_pending.values, m_values, sizeof(m_values));
+	}
+	m_batch.changed = 0;
+
+	// The thread starts with the first change, after the subclass is made
+	if (!m_thread.joinable())
+		m_thread = std::thread(&COutputs::DeliveryThread, this);
+	m_wake.notify_one();
+}
+
+void COutputs::StopDelivery()
+{
+	if (!m_thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+void COutputs::DeliveryThread()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_wake.wait(lock, [this]() { return m_stop || m_pending.changed != 0; });
+		if (m_pending.changed != 0)
+		{
+			OutputBatch batch = m_pending;
+			m_pending.changed = 0;
+			lock.unlock();
+			Deliver(batch);
+			lock.lock();
+		}
+		else if (m_stop)
+			break;
+	}
+}
+
+void COutputs::Deliver(const OutputBatch &batch)
+{
+	for (unsigned i = 0; i < NUM_OUTPUTS; i++)
+	{
+		if (batch.Changed(i))
+			SendOutput((EOutputs)i, batch.prevValues[i], batch.values[i]);
+	}
+	for (auto &sink : m_sinks)
+		sink->Send(m_game, batch);
+}
+
+Util::Format FormatOutputsJSON(const Game &game, const OutputBatch &batch, bool all)
+{
+	Util::Format json;
+	json << "{\"game\":\"" << game.name << "\",\"frame\":" << batch.frame << ",\"outputs\":{";
+	const char *separator = "";
+	for (unsigned i = 0; i < NUM_OUTPUTS; i++)
+	{
+		if (all ? ((batch.used >> i) & 1) : batch.Changed(i))
+		{
+			json << separator << '"' << COutputs::GetOutputName((EOutputs)i) << "\":" << unsigned(batch.values[i]);
+			separator = ",";
+		}
+	}
+	json << "}}";
+	return json;
+}
+
+COutputStreamSink::COutputStreamSink(OutputStream::Stream *stream)
+	: m_stream(stream), m_synced(false)
+{
+}
+
+COutputStreamSink::~COutputStreamSink()
+{
+	OutputStream::Close(m_stream);
+}
+
+void COutputStreamSink::Send(const Game &game, const OutputBatch &batch)
+{
+	Util::Format json = FormatOutputsJSON(game, batch, !m_synced);
+	m_synced = OutputStream::Write(m_stream, json.c_str(), json.size());
+}
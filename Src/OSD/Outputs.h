@@ -30,6 +30,14 @@
 
 #include "Game.h"
 #include "Types.h"
+#include "Util/Format.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 /*
  * EOutputs enumeration of all available outputs.
@@ -56,6 +64,51 @@ enum EOutputs
 
 #define NUM_OUTPUTS 14
 
+/*
+ * OutputBatch:
+ *
+ * The outputs that changed in a frame, or in several if they were not
+ * delivered in between, with their values before and after. An output that
+ * changed and changed back is still included.
+ */
+struct OutputBatch
+{
+	UINT32 frame;                     // frames ended so far, when the last included ended
+	UINT32 changed;                   // bit per output
+	UINT32 used;                      // bit per output set at least once
+	UINT8 prevValues[NUM_OUTPUTS];    // values before the first change
+	UINT8 values[NUM_OUTPUTS];        // all current values
+
+	bool Changed(unsigned idx) const
+	{
+		return (changed >> idx) & 1;
+	}
+};
+
+/*
+ * IOutputSink:
+ *
+ * A subscriber to the outputs other than the COutputs subclass itself, such
+ * as a stream to lighting controllers. Send() is called by the delivery
+ * thread only.
+ */
+class IOutputSink
+{
+public:
+	virtual ~IOutputSink() {}
+
+	virtual void Send(const Game &game, const OutputBatch &batch) = 0;
+};
+
+/*
+ * COutputs:
+ *
+ * Output values set by the emulator during a frame are gathered and delivered
+ * when the frame ends, all at once, by a thread of their own, to the subclass
+ * (through SendOutput()) and to any sinks added. Setting values only stores
+ * them, so how outputs are delivered costs the emulator nothing. SetValue()
+ * and EndFrame() must be called from the same thread.
+ */
 class COutputs
 {
 public:
@@ -80,21 +133,36 @@ public:
 	 */
 	virtual ~COutputs();
 
+	/*
+	 * COutputs():
+	 *
+	 * Constructor. Outputs of this class itself are delivered to the sinks
+	 * alone.
+	 */
+	COutputs();
+
 	/*
      * Initialize():
 	 *
 	 * Initializes the outputs.  Must be called before the outputs are attached.
-	 * To be implemented by the subclass.
+	 * May be overridden by the subclass.
 	 */
-	virtual bool Initialize() = 0;
+	virtual bool Initialize();
 
 	/*
 	 * Attached():
 	 *
 	 * Lets the outputs know they have been attached to the emulator.
-	 * To be implemented by the subclass.
+	 * May be overridden by the subclass.
+	 */
+	virtual void Attached();
+
+	/*
+	 * AddSink(sink):
+	 *
+	 * Adds a subscriber to the outputs. Must be called before any frames end.
 	 */
-	virtual void Attached() = 0;
+	void AddSink(std::unique_ptr<IOutputSink> sink);
 
 	/*
 	 * GetGame():
@@ -132,21 +200,31 @@ public:
 	 */
 	bool HasValue(EOutputs output);
 
-protected:
 	/*
-	 * COutputs():
+	 * EndFrame():
 	 *
-	 * Constructor.
+	 * Hands the outputs changed since the last call to the delivery thread,
+	 * merged with any it has not delivered yet. Called once per frame.
 	 */
-	COutputs();
+	void EndFrame();
 
+protected:
 	/*
 	 * SendOutput():
 	 *
-	 * Called when an output's value changes so that the subclass can handle it appropriately.
-	 * To be implemented by the subclass.
+	 * Called, from the delivery thread, for each output whose value changed so
+	 * that the subclass can handle it appropriately. May be overridden by the
+	 * subclass.
+	 */
+	virtual void SendOutput(EOutputs output, UINT8 prevValue, UINT8 value);
+
+	/*
+	 * StopDelivery():
+	 *
+	 * Delivers what is pending and stops the delivery thread. Subclasses
+	 * overriding SendOutput() must call it from their destructors.
 	 */
-	virtual void SendOutput(EOutputs output, UINT8 prevValue, UINT8 value) = 0;
+	void StopDelivery();
 
 private:
 	static const char* s_outputNames[]; // Static array of output names
@@ -154,6 +232,54 @@ private:
 	Game m_game;                  // Currently running game
 	bool m_first[NUM_OUTPUTS];    // For each output, true if an initial value has been set
 	UINT8 m_values[NUM_OUTPUTS];  // Current value of each output
+
+	// Changes in the current frame, and those waiting for the delivery thread
+	OutputBatch m_batch;
+	OutputBatch m_pending;
+	UINT32 m_frame;
+	std::vector<std::unique_ptr<IOutputSink>> m_sinks;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_stop;
+
+	void DeliveryThread();
+	void Deliver(const OutputBatch &batch);
+};
+
+/*
+ * FormatOutputsJSON(game, batch, all):
+ *
+ * Formats a batch as a line of JSON, with only the outputs that changed or,
+ * if all is true, all those used:
+ *
+ *		{"game":"scud","frame":1234,"outputs":{"LampStart":1,"RawLamps":4}}
+ */
+Util::Format FormatOutputsJSON(const Game &game, const OutputBatch &batch, bool all);
+
+namespace OutputStream
+{
+	struct Stream;
+}
+
+/*
+ * COutputStreamSink:
+ *
+ * Writes each batch as a line of JSON to a UDP address or named pipe (see
+ * OutputStream.h). While nobody is listening batches are dropped, and the
+ * first written after that has all the outputs used.
+ */
+class COutputStreamSink : public IOutputSink
+{
+public:
+	COutputStreamSink(OutputStream::Stream *stream);
+	~COutputStreamSink();
+
+	void Send(const Game &game, const OutputBatch &batch);
+
+private:
+	OutputStream::Stream *m_stream;
+	bool m_synced;
 };
 
 #endif	// INCLUDED_OUTPUTS_H
@@ -0,0 +1,66 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * PageProtection.h
+ *
+ * Header file for OS-dependent detection of writes to memory using page
+ * protection.
+ */
+
+#ifndef INCLUDED_PAGEPROTECTION_H
+#define INCLUDED_PAGEPROTECTION_H
+
+#include <cstddef>
+
+namespace PageProtection
+{
+    /*
+     * Called on the first write to a read-only page of a watched range, from
+     * the writing thread and inside its fault handler, so it must not take
+     * locks or allocate memory. The page has already been made writable.
+     * The offset is that of the page within the range.
+     */
+    typedef void (*WriteHandler)(void *context, size_t offset);
+
+    size_t GetPageSize();
+
+    // Allocation of whole pages, initially writable and zeroed (NULL on failure)
+    void *Allocate(size_t size);
+    void Free(void *ptr, size_t size);
+
+    /*
+     * Allocation of whole pages like Allocate(), backed by large pages (2 MB
+     * on x86) where the OS permits, to take fewer TLB misses on random access
+     * to large regions. Falls back to normal pages, setting largePages to
+     * whether large pages were used. Freed with Free(). Large pages must not
+     * be protected or watched.
+     */
+    void *AllocateLarge(size_t size, bool *largePages);
+
+    // Both return true on error. Protect() requires page aligned arguments.
+    bool Protect(void *ptr, size_t size, bool writable);
+    bool Watch(void *ptr, size_t size, WriteHandler handler, void *context);
+
+    void Unwatch(void *ptr);
+}
+
+#endif  // INCLUDED_PAGEPROTECTION_H
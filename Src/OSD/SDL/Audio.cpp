@@ -24,10 +24,17 @@
   *
   * SDL audio playback. Implements the OSD audio interface.
   *
-  * Buffer sizes and read/write positions must be sample-aligned. A sample is
-  * defined to encompass both channels so for, e.g., 16-bit audio as used here,
-  * a sample is 4 bytes. Static assertions are employed to ensure that the
-  * initial set up of the buffer is correct.
+  * Mixed audio is passed from OutputAudio() to the SDL callback through a
+  * single-producer/single-consumer ring buffer. Each side only ever advances
+  * its own position, so no lock is needed. Positions and sizes are counted in
+  * samples, where a sample encompasses all host channels, e.g. 8 bytes for
+  * 16-bit 4-channel audio.
+  *
+  * With dynamic rate control enabled, each chunk is resampled by up to 0.5%
+  * before it is queued, slightly more or fewer samples being produced when the
+  * buffer is below or above half full. This absorbs small differences between
+  * the rate at which frames are emulated and the rate at which the host plays
+  * audio, so that neither under-runs nor over-runs build up over time.
   *
   * Model 3 Audio is always 4 channels. SCSP1 is usually for each front
   * channels (on CN8 connector) and SCSP2 for rear channels (on CN7).
@@ -57,9 +64,12 @@
 
 #include "Supermodel.h"
 #include "SDLIncludes.h"
+#include "AudioResampler.h"
 
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 
   // Model3 audio output is 44.1KHz 4-channel sound and frame rate is 60fps
 #define SAMPLE_RATE_M3     (44100)
@@ -68,7 +78,11 @@
 
 #define MAX_SND_FREQ       (75)
 #define MIN_SND_FREQ       (45)
-#define MAX_LATENCY        (100)
+#define MIN_LATENCY_MS     (20)
+#define MAX_LATENCY_MS     (1000)
+
+#define MAX_SAMPLES_PER_FRAME (SAMPLE_RATE_M3 / MIN_SND_FREQ)
+#define MAX_RESAMPLED_PER_FRAME (MAX_SAMPLES_PER_FRAME + MAX_SAMPLES_PER_FRAME / 100 + 2)
 
 #define NUM_CHANNELS_M3 (4)
 
@@ -83,7 +97,6 @@ int nbHostAudioChannels = NUM_CHANNELS_M3;   // Number of channels on host
 
 static int samples_per_frame_host = SAMPLES_PER_FRAME_M3;
 static int bytes_per_sample_host = BYTES_PER_SAMPLE_M3;
-static int bytes_per_frame_host = BYTES_PER_FRAME_M3;
 
 // Balance percents for mixer
 float BalanceLeftRight = 0; // 0 mid balance, 100: left only,  -100:right only 
@@ -95,25 +108,34 @@ float balanceFactorRearLeft   = 1.0f;
 float balanceFactorRearRight  = 1.0f;
 
 static bool enabled = true;         // True if sound output is enabled
-static constexpr unsigned latency = 20;       // Audio latency to use (ie size of audio buffer) as percentage of max buffer size
-static constexpr bool underRunLoop = true;    // True if should loop back to beginning of buffer on under-run, otherwise sound is just skipped
+static bool headless = false;       // True if no host audio device is used
 
 static constexpr unsigned playSamples = 512;  // Size (in samples) of callback play buffer
 
-static UINT32 audioBufferSize = 0;  // Size (in bytes) of audio buffer
-static INT8* audioBuffer = NULL;    // Audio buffer
+static INT16* audioBuffer = NULL;   // Audio ring buffer
+static UINT32 ringSamples = 0;      // Size (in samples) of audio ring buffer, a power of two
+static UINT32 bufferSamples = 0;    // Number of samples that may be buffered, set by latency
 
-static UINT32 writePos = 0;         // Current position at which writing into buffer
-static UINT32 playPos = 0;          // Current position at which playing data in buffer via callback
+// Total number of samples written and played. Reduced modulo ringSamples to
+// index the buffer, the difference is the number of samples buffered.
+static std::atomic<UINT32> writePos(0);
+static std::atomic<UINT32> playPos(0);
 
-static bool writeWrapped = false;   // True if write position has wrapped around at end of buffer but play position has not done so yet
+static std::atomic<unsigned> underRuns(0);  // Number of buffer under-runs that have occured
+static std::atomic<unsigned> overRuns(0);   // Number of buffer over-runs that have occured
 
-static unsigned underRuns = 0;      // Number of buffer under-runs that have occured
-static unsigned overRuns = 0;       // Number of buffer over-runs that have occured
+static bool rateControl = false;    // True if dynamic rate control is enabled
+
+// Only touched by OutputAudio()
+static CAudioResampler<MAX_SAMPLES_PER_FRAME, MAX_RESAMPLED_PER_FRAME> resampler;
 
 static AudioCallbackFPtr callback = NULL; // Pointer to audio callback that is called when audio buffer is less than half empty
 static void* callbackData = NULL;         // Pointer to data to be passed to audio callback when it is called
 
+static std::mutex sinkMutex;              // Guards the audio sink, which OutputAudio() calls on the emulation thread
+static AudioSinkFPtr sink = NULL;
+static void* sinkData = NULL;
+
 static const Util::Config::Node* s_config = 0;
 
 
@@ -128,6 +150,13 @@ void SetAudioCallback(AudioCallbackFPtr newCallback, void* newData)
     SDL_UnlockAudio();
 }
 
+void SetAudioSink(AudioSinkFPtr newSink, void* newData)
+{
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    sink = newSink;
+    sinkData = newData;
+}
+
 void SetAudioEnabled(bool newEnabled)
 {
     enabled = newEnabled;
@@ -142,16 +171,9 @@ void SetAudioType(Game::AudioTypes type)
     AudioType = type;
 }
 
-static INT16 MixINT16(float x, float y)
+void SetAudioHeadless(bool newHeadless)
 {
-    INT32 sum = (INT32)((x + y)*0.5f); //!! dither
-    if (sum > INT16_MAX) {
-        sum = INT16_MAX;
-    }
-    if (sum < INT16_MIN) {
-        sum = INT16_MIN;
-    }
-    return (INT16)sum;
+    headless = newHeadless;
 }
 
 static float MixFloat(float x, float y)
@@ -171,239 +193,266 @@ static INT16 ClampINT16(float x)
     return (INT16)xi;
 }
 
+// Copies samples between the ring buffer and a linear buffer, in two parts
+// if the region wraps around the end of the ring
+static void CopyFromRing(INT16* dst, UINT32 pos, UINT32 numSamples)
+{
+    unsigned channels = nbHostAudioChannels;
+    UINT32 start = pos & (ringSamples - 1);
+    UINT32 len1 = std::min(numSamples, ringSamples - start);
+    memcpy(dst, audioBuffer + start * channels, len1 * bytes_per_sample_host);
+    memcpy(dst + len1 * channels, audioBuffer, (numSamples - len1) * bytes_per_sample_host);
+}
+
+static void CopyToRing(UINT32 pos, const INT16* src, UINT32 numSamples)
+{
+    unsigned channels = nbHostAudioChannels;
+    UINT32 start = pos & (ringSamples - 1);
+    UINT32 len1 = std::min(numSamples, ringSamples - start);
+    memcpy(audioBuffer + start * channels, src, len1 * bytes_per_sample_host);
+    memcpy(audioBuffer, src + len1 * channels, (numSamples - len1) * bytes_per_sample_host);
+}
+
 static void PlayCallback(void* data, Uint8* stream, int len)
 {
-    //printf("PlayCallback(%d) [writePos = %u, writeWrapped = %s, playPos = %u, audioBufferSize = %u]\n",
-    //	len, writePos, (writeWrapped ? "true" : "false"), playPos, audioBufferSize);
+    UINT32 wanted = len / bytes_per_sample_host;
+    UINT32 read = playPos.load(std::memory_order_relaxed);
+    UINT32 available = writePos.load(std::memory_order_acquire) - read;
 
-    // Get current write position and adjust it if write has wrapped but play position has not
-    UINT32 adjWritePos = writePos;
-    if (writeWrapped)
-        adjWritePos += audioBufferSize;
+    // On under-run, play what there is followed by silence
+    UINT32 count = std::min(wanted, available);
+    if (count < wanted)
+        underRuns.fetch_add(1, std::memory_order_relaxed);
 
-    // Check if play position overlaps write position (ie buffer under-run)
-	if (playPos + len > adjWritePos)
-	{
-        underRuns++;
-
-        //printf("Audio buffer under-run #%u in PlayCallback(%d) [writePos = %u, writeWrapped = %s, playPos = %u, audioBufferSize = %u]\n",
-        //	underRuns, len, writePos, (writeWrapped ? "true" : "false"), playPos, audioBufferSize);
-
-        // See what action to take on under-run
-		if (underRunLoop)
-		{
-            // If loop, then move play position back to beginning of data in buffer
-            playPos = adjWritePos + bytes_per_frame_host;
-
-            // Check if play position has moved past end of buffer
-            if (playPos >= audioBufferSize)
-                // If so, wrap it around to beginning again (but keep write wrapped flag as before)
-                playPos -= audioBufferSize;
-            else
-                // Otherwise, set write wrapped flag as will now appear as if write has wrapped but play position has not
-                writeWrapped = true;
-		}
-		else
-		{
-            // Otherwise, just copy silence to audio output stream and exit
-            memset(stream, 0, len);
-            return;
-        }
+    if (enabled)
+        CopyFromRing((INT16*)stream, read, count);
+    else
+        memset(stream, 0, count * bytes_per_sample_host);
+    memset(stream + count * bytes_per_sample_host, 0, (wanted - count) * bytes_per_sample_host);
+
+    // Hand the played region back to OutputAudio()
+    playPos.store(read + count, std::memory_order_release);
+
+    bool bufferFull = available - count + 2 * samples_per_frame_host > bufferSamples;
+
+    // If buffer is not full then call audio callback
+    if (callback && !bufferFull)
+        callback(callbackData);
+}
+
+// Each host channel is one input channel, the average of two, or the average
+// of all four, after the balance factors have been applied
+enum MixSource { MIX_ONE, MIX_TWO, MIX_ALL };
+
+struct MixLayout
+{
+    unsigned channels;
+    MixSource source[NUM_CHANNELS_M3];
+    unsigned a[NUM_CHANNELS_M3], b[NUM_CHANNELS_M3];
+};
+
+// Input channels, in the order the buffers are passed to MixChannels()
+enum { FL = 0, FR, RL, RR };
+
+static void SetMix(MixLayout& layout, unsigned ch, MixSource source, unsigned a = 0, unsigned b = 0)
+{
+    layout.source[ch] = source;
+    layout.a[ch] = a;
+    layout.b[ch] = b;
+}
+
+// Works out once per chunk how the host channels are made up, according to
+// the number of host channels and the game audio type
+static MixLayout GetMixLayout(bool flipStereo)
+{
+    MixLayout layout{};
+    layout.channels = std::min(nbHostAudioChannels, NUM_CHANNELS_M3);
+
+    if (nbHostAudioChannels == 1) {
+        SetMix(layout, 0, MIX_ALL);
+        return layout;
     }
 
-    INT8* src1;
-    INT8* src2;
-    UINT32 len1;
-    UINT32 len2;
+    // Flip again left/right if configured in audio
+    switch (AudioType) {
+    case Game::STEREO_RL:
+    case Game::QUAD_1_FRL_2_RRL:
+    case Game::QUAD_1_RRL_2_FRL:
+        flipStereo = !flipStereo;
+        break;
+    }
 
-    // Check if play region extends past end of buffer
-	if (playPos + len > audioBufferSize)
-	{
-        // If so, split play region into two
-        src1 = audioBuffer + playPos;
-        src2 = audioBuffer;
-        len1 = audioBufferSize - playPos;
-        len2 = len - len1;
-	}
-	else
-	{
-        // Otherwise, just copy whole region
-        src1 = audioBuffer + playPos;
-        src2 = 0;
-        len1 = len;
-        len2 = 0;
+    // Swapping left and right channels swaps each pair of host channels
+    unsigned l = flipStereo ? 1 : 0;
+    unsigned r = flipStereo ? 0 : 1;
+
+    // Now order channels according to audio type
+    if (nbHostAudioChannels == 2) {
+        SetMix(layout, l, MIX_TWO, FL, RL);
+        SetMix(layout, r, MIX_TWO, FR, RR);
+        return layout;
     }
 
-    // Check if audio is enabled
-	if (enabled)
-	{
-        // If so, copy play region into audio output stream
-        memcpy(stream, src1, len1);
+    switch (AudioType) {
+    case Game::MONO:
+        for (unsigned ch = 0; ch < 4; ch++)
+            SetMix(layout, ch, MIX_ALL);
+        break;
 
-        // Also, if not looping on under-runs then blank region out
-        if (!underRunLoop)
-            memset(src1, 0, len1);
+    case Game::STEREO_LR:
+    case Game::STEREO_RL:
+        SetMix(layout, l, MIX_TWO, FL, FR);
+        SetMix(layout, r, MIX_TWO, RL, RR);
+        SetMix(layout, 2 + l, MIX_TWO, FL, FR);
+        SetMix(layout, 2 + r, MIX_TWO, RL, RR);
+        break;
 
-		if (len2)
-		{
-            // If region was split into two, copy second half into audio output stream as well
-            memcpy(stream + len1, src2, len2);
+    case Game::QUAD_1_FLR_2_RLR:
+    case Game::QUAD_1_FRL_2_RRL:
+        // Normal channels Front Left/Right then Rear Left/Right
+        SetMix(layout, l, MIX_ONE, FL);
+        SetMix(layout, r, MIX_ONE, FR);
+        SetMix(layout, 2 + l, MIX_ONE, RL);
+        SetMix(layout, 2 + r, MIX_ONE, RR);
+        break;
 
-            // Also, if not looping on under-runs then blank region out
-            if (!underRunLoop)
-                memset(src2, 0, len2);
-        }
-	}
-	else
-        // Otherwise, just copy silence to audio output stream
-        memset(stream, 0, len);
+    case Game::QUAD_1_RLR_2_FLR:
+    case Game::QUAD_1_RRL_2_FRL:
+        // Reversed channels Front/Rear Left then Front/Rear Right
+        SetMix(layout, l, MIX_ONE, RL);
+        SetMix(layout, r, MIX_ONE, RR);
+        SetMix(layout, 2 + l, MIX_ONE, FL);
+        SetMix(layout, 2 + r, MIX_ONE, FR);
+        break;
 
-    // Move play position forward for next time
-    playPos += len;
+    case Game::QUAD_1_LR_2_FR_MIX:
+        // Split mix: one goes to left/right, other front/rear (mono)
+        // =>Remix all!
+        SetMix(layout, l, MIX_TWO, FL, RL);
+        SetMix(layout, r, MIX_TWO, FL, RR);
+        SetMix(layout, 2 + l, MIX_TWO, FR, RL);
+        SetMix(layout, 2 + r, MIX_TWO, FR, RR);
+        break;
+    }
 
-    bool bufferFull = adjWritePos + 2 * bytes_per_frame_host > playPos + audioBufferSize;
+    return layout;
+}
 
-    // Check if play position has moved past end of buffer
-	if (playPos >= audioBufferSize)
-	{
-        // If so, wrap it around to beginning again and reset write wrapped flag
-        playPos -= audioBufferSize;
-        writeWrapped = false;
+static float MixSample(const MixLayout& layout, unsigned ch, const float in[4])
+{
+    switch (layout.source[ch]) {
+    case MIX_ONE:
+        return in[layout.a[ch]];
+    case MIX_TWO:
+        return MixFloat(in[layout.a[ch]], in[layout.b[ch]]);
+    default:
+        return MixFloat(MixFloat(in[FL], in[FR]), MixFloat(in[RL], in[RR]));
     }
+}
 
-    // If buffer is not full then call audio callback
-    if (callback && !bufferFull)
-        callback(callbackData);
+#if defined(AUDIO_SIMD_SSE2)
+typedef __m128 MixVector;
+
+static inline MixVector MixAverage(MixVector x, MixVector y)
+{
+    return _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(0.5f));
 }
+#elif defined(AUDIO_SIMD_NEON)
+typedef float32x4_t MixVector;
 
+static inline MixVector MixAverage(MixVector x, MixVector y)
+{
+    return vmulq_f32(vaddq_f32(x, y), vdupq_n_f32(0.5f));
+}
+#endif
+
+#if defined(AUDIO_SIMD_SSE2) || defined(AUDIO_SIMD_NEON)
+static inline MixVector MixSamples(const MixLayout& layout, unsigned ch, const MixVector in[4])
+{
+    switch (layout.source[ch]) {
+    case MIX_ONE:
+        return in[layout.a[ch]];
+    case MIX_TWO:
+        return MixAverage(in[layout.a[ch]], in[layout.b[ch]]);
+    default:
+        return MixAverage(MixAverage(in[FL], in[FR]), MixAverage(in[RL], in[RR]));
+    }
+}
+#endif
+
+// Applies the balance, mixes the host channels and converts them to 16-bit
+// interleaved samples, in one pass. Runs of 4 samples are done as vectors,
+// with the same operations in the same order as the scalar code for the rest,
+// so that the results are the same either way. Float to integer conversion
+// truncates and saturates like ClampINT16().
 static void MixChannels(unsigned numSamples, const float* leftFrontBuffer, const float* rightFrontBuffer, const float* leftRearBuffer, const float* rightRearBuffer, void* dest, bool flipStereo)
 {
     INT16* p = (INT16*)dest;
-
-    if (nbHostAudioChannels == 1) {
-        for (unsigned i = 0; i < numSamples; i++) {
-            INT16 monovalue = MixINT16(
-                MixFloat(leftFrontBuffer[i] * balanceFactorFrontLeft,rightFrontBuffer[i] * balanceFactorFrontRight),
-                MixFloat(leftRearBuffer[i]  * balanceFactorRearLeft, rightRearBuffer[i]  * balanceFactorRearRight));
-            *p++ = monovalue;
+    const float* in[4] = { leftFrontBuffer, rightFrontBuffer, leftRearBuffer, rightRearBuffer };
+    const float balance[4] = { balanceFactorFrontLeft, balanceFactorFrontRight, balanceFactorRearLeft, balanceFactorRearRight };
+    const MixLayout layout = GetMixLayout(flipStereo);
+    unsigned i = 0;
+
+#if defined(AUDIO_SIMD_SSE2) || defined(AUDIO_SIMD_NEON)
+    unsigned numVectors = layout.channels == 3 ? 0 : numSamples & ~3u;
+#endif
+
+#if defined(AUDIO_SIMD_SSE2)
+    for (; i < numVectors; i += 4) {
+        MixVector v[4];
+        __m128i out[4];
+        for (unsigned ch = 0; ch < 4; ch++)
+            v[ch] = _mm_mul_ps(_mm_loadu_ps(in[ch] + i), _mm_set1_ps(balance[ch]));
+        for (unsigned ch = 0; ch < layout.channels; ch++)
+            out[ch] = _mm_cvttps_epi32(MixSamples(layout, ch, v));
+
+        if (layout.channels == 1) {
+            _mm_storel_epi64((__m128i*)p, _mm_packs_epi32(out[0], out[0]));
         }
-    } else {
-        // Flip again left/right if configured in audio
-        switch (AudioType) {
-        case Game::STEREO_RL:
-        case Game::QUAD_1_FRL_2_RRL:
-        case Game::QUAD_1_RRL_2_FRL:
-            flipStereo = !flipStereo;
-            break;
+        else if (layout.channels == 2) {
+            __m128i lr = _mm_packs_epi32(out[0], out[1]);
+            _mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi16(lr, _mm_unpackhi_epi64(lr, lr)));
         }
-
-        // Now order channels according to audio type
-        if (nbHostAudioChannels == 2) {
-            for (unsigned i = 0; i < numSamples; i++) {
-                INT16 leftvalue = MixINT16(leftFrontBuffer[i] * balanceFactorFrontLeft, leftRearBuffer[i] * balanceFactorRearLeft);
-                INT16 rightvalue = MixINT16(rightFrontBuffer[i]*balanceFactorFrontRight, rightRearBuffer[i]*balanceFactorRearRight);
-                if (flipStereo) // swap left and right channels
-                {
-                    *p++ = rightvalue;
-                    *p++ = leftvalue;
-                } else {
-                    *p++ = leftvalue;
-                    *p++ = rightvalue;
-                }
-            }
-        } else if (nbHostAudioChannels == 4) {
-            for (unsigned i = 0; i < numSamples; i++) {
-                float frontLeftValue = leftFrontBuffer[i]*balanceFactorFrontLeft;
-                float frontRightValue = rightFrontBuffer[i]*balanceFactorFrontRight;
-                float rearLeftValue = leftRearBuffer[i]*balanceFactorRearLeft;
-                float rearRightValue = rightRearBuffer[i]*balanceFactorRearRight;
-
-                // Check game audio type
-                switch (AudioType) {
-                case Game::MONO: {
-                    INT16 monovalue = MixINT16(MixFloat(frontLeftValue, frontRightValue), MixFloat(rearLeftValue, rearRightValue));
-                    *p++ = monovalue;
-                    *p++ = monovalue;
-                    *p++ = monovalue;
-                    *p++ = monovalue;
-                } break;
-
-                case Game::STEREO_LR:
-                case Game::STEREO_RL: {
-                    INT16 leftvalue =  MixINT16(frontLeftValue, frontRightValue);
-                    INT16 rightvalue = MixINT16(rearLeftValue,  rearRightValue);
-                    if (flipStereo) // swap left and right channels
-                    {
-                        *p++ = rightvalue;
-                        *p++ = leftvalue;
-                        *p++ = rightvalue;
-                        *p++ = leftvalue;
-                    } else {
-                        *p++ = leftvalue;
-                        *p++ = rightvalue;
-                        *p++ = leftvalue;
-                        *p++ = rightvalue;
-                    }
-                } break;
-
-                case Game::QUAD_1_FLR_2_RLR:
-                case Game::QUAD_1_FRL_2_RRL: {
-                    // Normal channels Front Left/Right then Rear Left/Right
-                    if (flipStereo) // swap left and right channels
-                    {
-                        *p++ = ClampINT16(frontRightValue);
-                        *p++ = ClampINT16(frontLeftValue);
-                        *p++ = ClampINT16(rearRightValue);
-                        *p++ = ClampINT16(rearLeftValue);
-                    } else {
-                        *p++ = ClampINT16(frontLeftValue);
-                        *p++ = ClampINT16(frontRightValue);
-                        *p++ = ClampINT16(rearLeftValue);
-                        *p++ = ClampINT16(rearRightValue);
-                    }
-                } break;
-
-                case Game::QUAD_1_RLR_2_FLR:
-                case Game::QUAD_1_RRL_2_FRL:
-                    // Reversed channels Front/Rear Left then Front/Rear Right
-                    if (flipStereo) // swap left and right channels
-                    {
-                        *p++ = ClampINT16(rearRightValue);
-                        *p++ = ClampINT16(rearLeftValue);
-                        *p++ = ClampINT16(frontRightValue);
-                        *p++ = ClampINT16(frontLeftValue);
-                    } else {
-                        *p++ = ClampINT16(rearLeftValue);
-                        *p++ = ClampINT16(rearRightValue);
-                        *p++ = ClampINT16(frontLeftValue);
-                        *p++ = ClampINT16(frontRightValue);
-                    }
-                    break;
-
-                case Game::QUAD_1_LR_2_FR_MIX:
-                    // Split mix: one goes to left/right, other front/rear (mono)
-                    // =>Remix all!
-                    INT16 newfrontLeftValue = MixINT16(frontLeftValue, rearLeftValue);
-                    INT16 newfrontRightValue = MixINT16(frontLeftValue, rearRightValue);
-                    INT16 newrearLeftValue = MixINT16(frontRightValue, rearLeftValue);
-                    INT16 newrearRightValue = MixINT16(frontRightValue, rearRightValue);
-
-                    if (flipStereo) // swap left and right channels
-                    {
-                        *p++ = newfrontRightValue;
-                        *p++ = newfrontLeftValue;
-                        *p++ = newrearRightValue;
-                        *p++ = newrearLeftValue;
-                    } else {
-                        *p++ = newfrontLeftValue;
-                        *p++ = newfrontRightValue;
-                        *p++ = newrearLeftValue;
-                        *p++ = newrearRightValue;
-                    }
-                    break;
-                }
-            }
+        else {
+            __m128i c01 = _mm_packs_epi32(out[0], out[1]);
+            __m128i c23 = _mm_packs_epi32(out[2], out[3]);
+            c01 = _mm_unpacklo_epi16(c01, _mm_unpackhi_epi64(c01, c01));
+            c23 = _mm_unpacklo_epi16(c23, _mm_unpackhi_epi64(c23, c23));
+            _mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi32(c01, c23));
+            _mm_storeu_si128((__m128i*)p + 1, _mm_unpackhi_epi32(c01, c23));
+        }
+        p += 4 * layout.channels;
+    }
+#elif defined(AUDIO_SIMD_NEON)
+    for (; i < numVectors; i += 4) {
+        MixVector v[4];
+        int16x4_t out[4];
+        for (unsigned ch = 0; ch < 4; ch++)
+            v[ch] = vmulq_f32(vld1q_f32(in[ch] + i), vdupq_n_f32(balance[ch]));
+        for (unsigned ch = 0; ch < layout.channels; ch++)
+            out[ch] = vqmovn_s32(vcvtq_s32_f32(MixSamples(layout, ch, v)));
+
+        if (layout.channels == 1) {
+            vst1_s16(p, out[0]);
+        }
+        else if (layout.channels == 2) {
+            int16x4x2_t lr = { { out[0], out[1] } };
+            vst2_s16(p, lr);
         }
+        else {
+            int16x4x4_t quad = { { out[0], out[1], out[2], out[3] } };
+            vst4_s16(p, quad);
+        }
+        p += 4 * layout.channels;
+    }
+#endif
+
+    for (; i < numSamples; i++) {
+        float v[4];
+        for (unsigned ch = 0; ch < 4; ch++)
+            v[ch] = in[ch][i] * balance[ch];
+        for (unsigned ch = 0; ch < layout.channels; ch++)
+            *p++ = ClampINT16(MixSample(layout, ch, v));
     }
 }
 
@@ -428,7 +477,7 @@ bool OpenAudio(const Util::Config::Node& config)
 {
     s_config = &config;
     // Initialize SDL audio sub-system
-    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+    if (!headless && SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
         return ErrorLog("Unable to initialize SDL audio sub-system: %s\n", SDL_GetError());
 
     // Number of channels requested in config (default is 4)
@@ -468,7 +517,7 @@ bool OpenAudio(const Util::Config::Node& config)
     desired.callback = PlayCallback;
 
     // Now force SDL to use the format we requested (nullptr); it will convert if necessary
-    if (SDL_OpenAudio(&desired, nullptr) < 0) {
+    if (!headless && SDL_OpenAudio(&desired, nullptr) < 0) {
         if (desired.channels==2) {
             return ErrorLog("Unable to open 44.1KHz 2-channel audio with SDL: %s\n", SDL_GetError());
         } else if (desired.channels==4) {
@@ -485,202 +534,104 @@ bool OpenAudio(const Util::Config::Node& config)
         soundFreq_Hz = MIN_SND_FREQ;
     samples_per_frame_host = (INT32)(SAMPLE_RATE_M3 / soundFreq_Hz);
     bytes_per_sample_host = (nbHostAudioChannels * sizeof(INT16));
-    bytes_per_frame_host =  (samples_per_frame_host * bytes_per_sample_host);
 
+    // Reset resampler
+    rateControl = s_config->Get("DynamicRateControl").ValueAs<bool>();
+    resampler.Reset();
 
-    // Create audio buffer
-    uint32_t bufferSize = ((SAMPLE_RATE_M3 * latency) / MAX_LATENCY) * bytes_per_sample_host;
-    if (!(bufferSize % bytes_per_sample_host == 0)) {
-        return ErrorLog("must be an integer multiple of the sample size\n");
-    }
-    audioBufferSize = bufferSize;
 
-    int minBufferSize = 3 * bytes_per_frame_host;
-    audioBufferSize = std::max<int>(minBufferSize, audioBufferSize);
-    audioBuffer = new(std::nothrow) INT8[audioBufferSize];
+    // Create audio buffer, sized by the latency in milliseconds
+    int latencyMs = std::max(MIN_LATENCY_MS, std::min(MAX_LATENCY_MS, s_config->Get("AudioLatency").ValueAs<int>()));
+    bufferSamples = std::max<UINT32>((SAMPLE_RATE_M3 * latencyMs) / 1000, 3 * samples_per_frame_host);
+    ringSamples = 1;
+    while (ringSamples < bufferSamples)
+        ringSamples <<= 1;
+    audioBuffer = new(std::nothrow) INT16[ringSamples * nbHostAudioChannels];
     if (audioBuffer == NULL) {
-        float audioBufMB = (float)audioBufferSize / (float)0x100000;
+        float audioBufMB = (float)(ringSamples * bytes_per_sample_host) / (float)0x100000;
         return ErrorLog("Insufficient memory for audio latency buffer (need %1.1f MB).", audioBufMB);
     }
-    memset(audioBuffer, 0, sizeof(INT8) * audioBufferSize);
+    memset(audioBuffer, 0, ringSamples * bytes_per_sample_host);
 
-    // Set initial play position to be beginning of buffer and initial write position to be half-way into buffer
+    // Start with the buffer half full of silence, just past the first frame
     playPos = 0;
-    uint32_t endOfBuffer = bufferSize - bytes_per_frame_host;
-    uint32_t midpointAfterFirstFrameUnaligned = bytes_per_frame_host + (bufferSize - bytes_per_frame_host) / 2;
-    uint32_t extraPaddingNeeded = (bytes_per_frame_host - midpointAfterFirstFrameUnaligned % bytes_per_frame_host) % bytes_per_frame_host;
-    uint32_t midpointAfterFirstFrame = midpointAfterFirstFrameUnaligned + extraPaddingNeeded;
-    if (!((endOfBuffer % (nbHostAudioChannels*sizeof(INT16))) == 0)) {
-        return ErrorLog("must be an integer multiple of the sample size\n");
-    }
-    if (!((midpointAfterFirstFrame % nbHostAudioChannels*sizeof(INT16)) == 0)) {
-        return ErrorLog("must be an integer multiple of the sample size\n");
-    }
-
-    writePos = std::min<int>(endOfBuffer, midpointAfterFirstFrame);
-    writeWrapped = false;
+    writePos = std::min(bufferSamples - samples_per_frame_host, (bufferSamples + samples_per_frame_host) / 2);
 
     // Reset counters
     underRuns = 0;
     overRuns = 0;
 
     // Start audio playing
-    SDL_PauseAudio(0);
+    if (!headless)
+        SDL_PauseAudio(0);
     return OKAY;
 }
 
 bool OutputAudio(unsigned numSamples, const float* leftFrontBuffer, const float* rightFrontBuffer, const float* leftRearBuffer, const float* rightRearBuffer, bool flipStereo)
 {
-    //printf("OutputAudio(%u) [writePos = %u, writeWrapped = %s, playPos = %u, audioBufferSize = %u]\n",
-    //	numSamples, writePos, (writeWrapped ? "true" : "false"), playPos, audioBufferSize);
-
-    UINT32 bytesRemaining;
-    UINT32 bytesToCopy;
-    INT16* src;
-
     // Number of samples should never be more than max number of samples per frame
     if (numSamples > (unsigned)samples_per_frame_host)
         numSamples = samples_per_frame_host;
 
-    // Mix together left and right channels into single chunk of data
-    INT16 mixBuffer[NUM_CHANNELS_M3 * (SAMPLE_RATE_M3 / MIN_SND_FREQ)];
-    MixChannels(numSamples, leftFrontBuffer, rightFrontBuffer, leftRearBuffer, rightRearBuffer, mixBuffer, flipStereo);
-
-    // Lock SDL audio callback so that it doesn't interfere with following code
-    SDL_LockAudio();
-
-    // Calculate number of bytes for current sound chunk
-    UINT32 numBytes = numSamples * bytes_per_sample_host;
+    UINT32 write = writePos.load(std::memory_order_relaxed);
+    UINT32 buffered = write - playPos.load(std::memory_order_acquire);
 
-    // Get end of current play region (writing must occur past this point)
-    UINT32 playEndPos = playPos + bytes_per_frame_host;
-
-    // Undo any wrap-around of the write position that may have occurred to create following ordering: playPos < playEndPos < writePos
-    if (playEndPos > writePos && writeWrapped)
-        writePos += audioBufferSize;
-
-    // Check if play region has caught up with write position and now overlaps it (ie buffer under-run)
-	if (playEndPos > writePos)
-	{
-        underRuns++;
-
-        //printf("Audio buffer under-run #%u in OutputAudio(%u) [writePos = %u, writeWrapped = %s, playPos = %u, audioBufferSize = %u, numBytes = %u]\n",
-        //	underRuns, numSamples, writePos, (writeWrapped ? "true" : "false"), playPos, audioBufferSize, numBytes);
-
-        // See what action to take on under-run
-		if (underRunLoop)
-		{
-            // If loop, then move play position back to beginning of data in buffer
-            playPos = writePos + numBytes + bytes_per_frame_host;
-
-            // Check if play position has moved past end of buffer
-            if (playPos >= audioBufferSize)
-                // If so, wrap it around to beginning again (but keep write wrapped flag as before)
-                playPos -= audioBufferSize;
-			else
-			{
-                // Otherwise, set write wrapped flag as will now appear as if write has wrapped but play position has not
-                writeWrapped = true;
-                writePos += audioBufferSize;
-            }
-		}
-		else
-		{
-            // Otherwise, bump write position forward in chunks until it is past end of play region
-			do
-			{
-                writePos += numBytes;
-			}
-			while (playEndPos > writePos);
-        }
-    }
-
-    // Check if write position has caught up with play region and now overlaps it (ie buffer over-run)
-    bool overRun = writePos + numBytes > playPos + audioBufferSize;
-
-    bool bufferFull = writePos + 2 * bytes_per_frame_host > playPos + audioBufferSize;
-
-    // Move write position back to within buffer
-    if (writePos >= audioBufferSize)
-        writePos -= audioBufferSize;
-
-    // Handle buffer over-run
-	if (overRun)
-	{
-        overRuns++;
-
-        //printf("Audio buffer over-run #%u in OutputAudio(%u) [writePos = %u, writeWrapped = %s, playPos = %u, audioBufferSize = %u, numBytes = %u]\n",
-        //	overRuns, numSamples, writePos, (writeWrapped ? "true" : "false"), playPos, audioBufferSize, numBytes);
-
-        bufferFull = true;
-
-        // Discard current chunk of data
-    }
-    else
+    // With dynamic rate control, stretch or shrink the chunk to steer the
+    // buffer towards half full, by the most when a quarter or 3/4 full
+    float resampled[4][MAX_RESAMPLED_PER_FRAME];
+    if (rateControl)
     {
-    src = mixBuffer;
-    INT8* dst1;
-    INT8* dst2;
-    UINT32 len1;
-    UINT32 len2;
-
-    // Check if write region extends past end of buffer
-	if (writePos + numBytes > audioBufferSize)
-	{
-        // If so, split write region into two
-        dst1 = audioBuffer + writePos;
-        dst2 = audioBuffer;
-        len1 = audioBufferSize - writePos;
-        len2 = numBytes - len1;
-	}
-	else
-	{
-        // Otherwise, just copy whole region
-        dst1 = audioBuffer + writePos;
-        dst2 = NULL;
-        len1 = numBytes;
-        len2 = NULL;
+        double ratio = RateControlRatio(buffered, bufferSamples);
+        const float* in[4] = { leftFrontBuffer, rightFrontBuffer, leftRearBuffer, rightRearBuffer };
+        float* out[4] = { resampled[0], resampled[1], resampled[2], resampled[3] };
+        numSamples = resampler.Resample(numSamples, in, out, ratio);
+        leftFrontBuffer = resampled[0];
+        rightFrontBuffer = resampled[1];
+        leftRearBuffer = resampled[2];
+        rightRearBuffer = resampled[3];
     }
 
-    // Copy chunk to write position in buffer
-    bytesRemaining = numBytes;
-    bytesToCopy = (bytesRemaining > len1 ? len1 : bytesRemaining);
-    memcpy(dst1, src, bytesToCopy);
-
-    // Adjust for number of bytes copied
-    bytesRemaining -= bytesToCopy;
-    src = (INT16*)((UINT8*)src + bytesToCopy);
-
-	if (bytesRemaining)
-	{
-        // If write region was split into two, copy second half of chunk into buffer as well
-        bytesToCopy = (bytesRemaining > len2 ? len2 : bytesRemaining);
-        memcpy(dst2, src, bytesToCopy);
+    // Mix together left and right channels into single chunk of data
+    INT16 mixBuffer[NUM_CHANNELS_M3 * MAX_RESAMPLED_PER_FRAME];
+    MixChannels(numSamples, leftFrontBuffer, rightFrontBuffer, leftRearBuffer, rightRearBuffer, mixBuffer, flipStereo);
+    {
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        if (sink)
+            sink(sinkData, mixBuffer, numSamples, nbHostAudioChannels);
     }
+    if (headless)
+        return true;
 
-    // Move write position forward for next time
-    writePos += numBytes;
+    bool bufferFull = buffered + 2 * samples_per_frame_host > bufferSamples;
 
-    // Check if write position has moved past end of buffer
-	if (writePos >= audioBufferSize)
-	{
-        // If so, wrap it around to beginning again and set write wrapped flag
-        writePos -= audioBufferSize;
-        writeWrapped = true;
-    }
+    // On over-run, discard current chunk of data
+    if (buffered + numSamples > bufferSamples)
+    {
+        overRuns.fetch_add(1, std::memory_order_relaxed);
+        return true;
     }
 
-    // Unlock SDL audio callback
-    SDL_UnlockAudio();
+    // Copy chunk into buffer and hand it over to PlayCallback()
+    CopyToRing(write, mixBuffer, numSamples);
+    writePos.store(write + numSamples, std::memory_order_release);
 
-    // Return whether buffer is half full
+    // Return whether buffer is full
     return bufferFull;
 }
 
+void GetAudioStats(AudioStats* stats)
+{
+    UINT32 buffered = writePos.load(std::memory_order_relaxed) - playPos.load(std::memory_order_relaxed);
+    stats->underRuns = underRuns.load(std::memory_order_relaxed);
+    stats->overRuns = overRuns.load(std::memory_order_relaxed);
+    stats->fillLevel = bufferSamples ? std::min(1.0f, (float)buffered / (float)bufferSamples) : 0.0f;
+}
+
 void CloseAudio()
 {
     // Close SDL audio output
-    SDL_CloseAudio();
+    if (!headless)
+        SDL_CloseAudio();
 
     // Delete audio buffer
 	if (audioBuffer != NULL)
@@ -0,0 +1,144 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * AudioResampler.h
+ *
+ * Resampler and fill level controller for dynamic rate control of the audio
+ * output. Used by Audio.cpp, and kept in a header so Test_Lockstep can drive
+ * them through simulated runs with the host clock drifting.
+ */
+
+#ifndef INCLUDED_AUDIORESAMPLER_H
+#define INCLUDED_AUDIORESAMPLER_H
+
+#include <algorithm>
+#include <cstring>
+
+// SSE2 and NEON are part of the x64 and AArch64 base instruction sets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIO_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define AUDIO_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Most the output rate is stretched or shrunk by
+static constexpr double MAX_RATE_DELTA = 0.005;
+
+// Ratio of output to input samples that steers the buffer towards half full,
+// by the most when a quarter or 3/4 full
+static inline double RateControlRatio(unsigned buffered, unsigned bufferSamples)
+{
+    double fill = (double)buffered / (double)bufferSamples;
+    return 1.0 + std::max(-MAX_RATE_DELTA, std::min(MAX_RATE_DELTA, MAX_RATE_DELTA * 4.0 * (0.5 - fill)));
+}
+
+/*
+ * CAudioResampler:
+ *
+ * Resamples chunks of up to maxInput samples of 4-channel audio by a given
+ * ratio of output to input samples, using Catmull-Rom interpolation, giving
+ * up to maxOutput samples. The channels are processed together, as one vector
+ * per sample. The last input samples are kept for the next chunk, so the
+ * output is continuous and lags the input by 2 samples.
+ */
+template <unsigned maxInput, unsigned maxOutput>
+class CAudioResampler
+{
+public:
+    void Reset()
+    {
+        memset(m_frames, 0, sizeof(m_frames));
+        m_pos = 1.0;
+    }
+
+    // Returns the number of output samples
+    unsigned Resample(unsigned numSamples, const float* in[4], float* out[4], double ratio)
+    {
+        float (*frames)[4] = m_frames;
+        for (unsigned i = 0; i < numSamples; i++) {
+            frames[3 + i][0] = in[0][i];
+            frames[3 + i][1] = in[1][i];
+            frames[3 + i][2] = in[2][i];
+            frames[3 + i][3] = in[3][i];
+        }
+
+        // Interpolating between samples i and i+1 needs samples i-1 to i+2
+        double step = 1.0 / ratio;
+        double end = (double)(numSamples + 1);
+        double pos = m_pos;
+        unsigned count = 0;
+        for (; pos < end && count < maxOutput; pos += step, count++) {
+            unsigned i = (unsigned)pos;
+            float x = (float)(pos - (double)i);
+            alignas(16) float y[4];
+#if defined(AUDIO_SIMD_SSE2)
+            __m128 p0 = _mm_load_ps(frames[i - 1]);
+            __m128 p1 = _mm_load_ps(frames[i]);
+            __m128 p2 = _mm_load_ps(frames[i + 1]);
+            __m128 p3 = _mm_load_ps(frames[i + 2]);
+            __m128 vx = _mm_set1_ps(x);
+            __m128 a = _mm_add_ps(_mm_sub_ps(p3, p0), _mm_mul_ps(_mm_set1_ps(3.0f), _mm_sub_ps(p1, p2)));
+            __m128 b = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(_mm_add_ps(p0, p0), _mm_mul_ps(_mm_set1_ps(5.0f), p1)), _mm_mul_ps(_mm_set1_ps(4.0f), p2)), p3);
+            __m128 c = _mm_sub_ps(p2, p0);
+            __m128 r = _mm_add_ps(c, _mm_mul_ps(vx, _mm_add_ps(b, _mm_mul_ps(vx, a))));
+            _mm_store_ps(y, _mm_add_ps(p1, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), vx), r)));
+#elif defined(AUDIO_SIMD_NEON)
+            float32x4_t p0 = vld1q_f32(frames[i - 1]);
+            float32x4_t p1 = vld1q_f32(frames[i]);
+            float32x4_t p2 = vld1q_f32(frames[i + 1]);
+            float32x4_t p3 = vld1q_f32(frames[i + 2]);
+            float32x4_t vx = vdupq_n_f32(x);
+            float32x4_t a = vaddq_f32(vsubq_f32(p3, p0), vmulq_f32(vdupq_n_f32(3.0f), vsubq_f32(p1, p2)));
+            float32x4_t b = vsubq_f32(vaddq_f32(vsubq_f32(vaddq_f32(p0, p0), vmulq_f32(vdupq_n_f32(5.0f), p1)), vmulq_f32(vdupq_n_f32(4.0f), p2)), p3);
+            float32x4_t c = vsubq_f32(p2, p0);
+            float32x4_t r = vaddq_f32(c, vmulq_f32(vx, vaddq_f32(b, vmulq_f32(vx, a))));
+            vst1q_f32(y, vaddq_f32(p1, vmulq_f32(vmulq_f32(vdupq_n_f32(0.5f), vx), r)));
+#else
+            for (int ch = 0; ch < 4; ch++) {
+                float p0 = frames[i - 1][ch], p1 = frames[i][ch], p2 = frames[i + 1][ch], p3 = frames[i + 2][ch];
+                float a = (p3 - p0) + 3.0f * (p1 - p2);
+                float b = (p0 + p0) - 5.0f * p1 + 4.0f * p2 - p3;
+                float c = p2 - p0;
+                y[ch] = p1 + (0.5f * x) * (c + x * (b + x * a));
+            }
+#endif
+            out[0][count] = y[0];
+            out[1][count] = y[1];
+            out[2][count] = y[2];
+            out[3][count] = y[3];
+        }
+
+        // Keep the last 3 input samples, which the next output samples depend on
+        memmove(frames[0], frames[numSamples], sizeof(frames[0]) * 3);
+        m_pos = pos - (double)numSamples;
+        return count;
+    }
+
+private:
+    // The last 3 samples of the previous chunk followed by the current chunk
+    alignas(16) float m_frames[3 + maxInput][4] = {};
+    double m_pos = 1.0;     // position of the next output sample in m_frames
+};
+
+#endif  // INCLUDED_AUDIORESAMPLER_H
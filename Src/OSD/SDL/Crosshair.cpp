@@ -258,7 +258,7 @@ void CCrosshair::Update(uint32_t currentInputs, CInputs* Inputs, unsigned int xO
   float x[2]{ 0.0f }, y[2]{ 0.0f };
 
   // Crosshairs can be enabled/disabled at run-tim
-  unsigned crosshairs = m_config["Crosshairs"].ValueAs<unsigned>();
+  unsigned crosshairs = m_crosshairs.Get();
   crosshairs &= 3;
   if (!crosshairs)
     return;
@@ -332,6 +332,7 @@ void CCrosshair::GunToViewCoords(float* x, float* y)
 
 CCrosshair::CCrosshair(const Util::Config::Node& config)
   : m_config(config),
+    m_crosshairs(config, "Crosshairs"),
     m_vertexShader(nullptr),
     m_fragmentShader(nullptr)
 {
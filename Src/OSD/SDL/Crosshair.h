@@ -30,6 +30,7 @@ class CCrosshair
 {
 private:
   const Util::Config::Node& m_config;
+  Util::Config::CachedValue<unsigned> m_crosshairs;
   bool m_isBitmapCrosshair = false;
   std::string m_crosshairStyle = "";
   GLuint m_crosshairTexId[2] = { 0 };
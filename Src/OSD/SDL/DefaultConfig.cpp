@@ -0,0 +1,227 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * DefaultConfig.cpp
+ *
+ * Default settings of all configuration options, kept apart from Main.cpp so
+ * that programs embedding the emulator (see LibSupermodel.h) start from the
+ * same settings.
+ */
+
+#include "DefaultConfig.h"
+#include "OSD/FileSystemPath.h"
+#include "Util/Format.h"
+
+Util::Config::Node DefaultConfig()
+{
+  Util::Config::Node config("Global");
+  config.Set("GameXMLFile", Util::Format() << FileSystemPath::GetPath(FileSystemPath::Config) << "Games.xml");
+  config.Set("ROMCacheDirectory", "");
+  config.Set("VerifyROMs", false);
+  config.Set("VerifyROMsInBackground", true);
+  config.Set("ConvertROMs", false);
+  config.Set("InitStateFile", "");
+  config.Set("StateCompression", "1");
+  config.Set("NVRAMCheckpointInterval", "10");
+  // CModel3
+  config.Set("MultiThreaded", true);
+  config.Set("GPUMultiThreaded", true);
+  config.Set("SnapshotPageSize", "1024");
+  config.Set("SnapshotPageProtection", false);
+  config.Set("FrameQueueDepth", "1");
+  config.Set("EarlyRender", false);
+  config.Set("LateInputSampling", false);
+  config.Set("LatchInputs", false);
+  config.Set("InterpolateAim", false);
+  config.Set("RunAheadFrames", "0");
+  config.Set("RewindFrames", "0");
+  config.Set("RewindMemory", "256");
+  config.Set("RewindKeyframeInterval", "300");
+  config.Set("RecordInputsFile", "");
+  config.Set("ReplayInputsFile", "");
+  config.Set("BenchmarkFrames", "0");
+  config.Set("BenchmarkFile", "");
+  config.Set("BenchmarkPresent", true);
+  config.Set("AutoTuneFrames", "0");
+  config.Set("TurboToFrame", "0");
+  config.Set("TurboBoot", "0");
+  config.Set("FastForwardInterval", "10");
+  config.Set("TraceSeconds", "0");
+  config.Set("ExecTraceSize", "0");
+  config.Set("ExecTraceBranches", false);
+  config.Set("StartupProfile", false);
+  config.Set("HitchThreshold", "35");
+  config.Set("AutoFrameSkip", "0");
+  config.Set("PowerSave", false);
+  config.Set("HitchFrames", "30");
+  config.Set("PPCThreadCore", "-1");
+  config.Set("SoundThreadCore", "-1");
+  config.Set("DriveThreadCore", "-1");
+  config.Set("RenderThreadCore", "-1");
+  config.Set("ThreadPriority", "normal");
+  config.Set("PowerPCFrequency", "50");
+  config.Set("PowerPCRecompiler", false);
+  config.Set("PowerPCBlockCache", false);
+  config.Set("PowerPCIdleSkip", true);
+  config.Set("PowerPCHLE", true);
+  config.Set("PowerPCHLEValidate", false);
+  // 2D and 3D graphics engines
+  config.Set("MultiTexture", false);
+  config.Set("VertexShader", "");
+  config.Set("FragmentShader", "");
+  config.Set("VertexShaderFog", "");
+  config.Set("FragmentShaderFog", "");
+  config.Set("VertexShader2D", "");
+  config.Set("FragmentShader2D", "");
+  // CSoundBoard
+  config.Set("EmulateSound", true);
+  config.Set("Balance", "0.0");
+  config.Set("BalanceLeftRight", "0.0");
+  config.Set("BalanceFrontRear", "0.0");
+  config.Set("NbSoundChannels", "4");
+  config.Set("SoundFreq", "57.6"); // 60.0f? 57.524160f?
+  config.Set("AudioLatency", "200");
+  config.Set("DynamicRateControl", false);
+  // CDSB
+  config.Set("EmulateDSB", true);
+  config.Set("SoundVolume", "100");
+  config.Set("MusicVolume", "100");
+  // Other sound options
+  config.Set("LegacySoundDSP", false); // New config option for games that do not play correctly with MAME's SCSP sound core.
+  config.Set("StrictSCSPTiming", false);
+  config.Set("BlockSCSPRendering", false);
+  config.Set("ParallelSound", false);
+  config.Set("DSBThread", false);
+  config.Set("SoundIdleSkip", true);
+  config.Set("RecordMIDIFile", "");
+  config.Set("ReplayMIDIFile", "");
+  config.Set("ReplayWAVFile", "");
+  // CDriveBoard
+  config.Set("ForceFeedback", false);
+  // Platform-specific/UI
+  config.Set("New3DEngine", true);
+  config.Set("QuadRendering", false);
+  config.Set("GPUClipping", false);
+  config.Set("LODQuality", "100");
+  config.Set("TextureCache", false);
+  config.Set("ShaderPermutations", false);
+  config.Set("QuadVertexPulling", false);
+  config.Set("StrictLOS", false);
+  config.Set("DynamicResolution", false);
+  config.Set("DynamicResolutionMin", "50");
+  config.Set("GPUFrameBudget", "14");
+  config.Set("GPUTimings", false);
+  config.Set("XResolution", "496");
+  config.Set("YResolution", "384");
+  config.SetEmpty("WindowXPosition");
+  config.SetEmpty("WindowYPosition");
+  config.Set("FullScreen", false);
+  config.Set("BorderlessWindow", false);
+
+  config.Set("WideScreen", false);
+  config.Set("Stretch", false);
+  config.Set("WideBackground", false);
+  config.Set("GPUTilemaps", false);
+  config.Set("Async2D", false);
+  config.Set("VSync", true);
+  config.Set("AdaptiveVSync", false);
+  config.Set("FrameDelay", false);
+  config.Set("MaxFramesInFlight", "0");
+  config.Set("Headless", false);
+  config.Set("CaptureInterval", "0");
+  config.Set("CaptureImages", false);
+  config.Set("CaptureMemory", false);
+  config.Set("CaptureFormat", "bmp");
+  config.Set("RecordVideoFile", "");
+  config.Set("RecordVideoEncoder", "software");
+  config.Set("RecordVideoBitrate", "8000");
+  config.Set("Throttle", true);
+  config.Set("RefreshRate", 60.0f);
+  config.Set("ShowFrameRate", false);
+  config.Set("FrameRateOverlay", true);
+  config.Set("Crosshairs", int(0));
+  config.Set("CrosshairStyle", "vector");
+  config.Set("FlipStereo", false);
+#ifdef SUPERMODEL_WIN32
+  config.Set("InputSystem", "dinput");
+  // DirectInput ForceFeedback
+  config.Set("DirectInputConstForceLeftMax", "100");
+  config.Set("DirectInputConstForceRightMax", "100");
+  config.Set("DirectInputSelfCenterMax", "100");
+  config.Set("DirectInputFrictionMax", "100");
+  config.Set("DirectInputVibrateMax", "100");
+  // XInput ForceFeedback
+  config.Set("XInputConstForceThreshold", "30");
+  config.Set("XInputConstForceMax", "100");
+  config.Set("XInputVibrateMax", "100");
+  config.Set("XInputStereoVibration", true);
+  // SDL ForceFeedback
+  config.Set("SDLConstForceMax", "100");
+  config.Set("SDLSelfCenterMax", "100");
+  config.Set("SDLFrictionMax", "100");
+  config.Set("SDLVibrateMax", "100");
+  config.Set("SDLConstForceThreshold", "30");
+#ifdef NET_BOARD
+  // NetBoard
+  config.Set("Network", false);
+  config.Set("NetIdleSkip", true);
+  config.Set("SimulateNet", true);
+  config.Set("PortIn", unsigned(1970));
+  config.Set("PortOut", unsigned(1971));
+  config.Set("AddressOut", "127.0.0.1");
+  config.Set("NetTimeout", unsigned(0));
+  config.Set("NetStatsLog", unsigned(0));
+  config.Set("NetDelta", false);
+  config.Set("NetKeyframe", unsigned(60));
+  config.Set("NetCompression", unsigned(0));
+  config.Set("NetUDP", false);
+  config.Set("NetUDPRedundancy", unsigned(4));
+  config.Set("NetUDPTimeout", unsigned(1000));
+  config.Set("NetSharedMemory", false);
+  config.Set("NetRollback", unsigned(0));
+  config.Set("NetSimPeers", unsigned(0));
+  config.Set("NetSimLatency", "0.25");
+  config.Set("NetSimJitter", "0");
+  config.Set("NetSimLoss", "0");
+  config.Set("NetSimReplayFile", "");
+  config.Set("NetRecordFile", "");
+#endif
+#else
+  config.Set("InputSystem", "sdl");
+  // SDL ForceFeedback
+  config.Set("SDLConstForceMax", "100");
+  config.Set("SDLSelfCenterMax", "100");
+  config.Set("SDLFrictionMax", "100");
+  config.Set("SDLVibrateMax", "100");
+  config.Set("SDLConstForceThreshold", "30");
+#endif
+  config.Set("Outputs", "none");
+  config.Set("OutputsAddress", "127.0.0.1");
+  config.Set("OutputsPort", unsigned(8000));
+  config.Set("OutputsPipe", "supermodel-outputs");
+  config.Set("MetricsAddress", "");
+  config.Set("MetricsPort", unsigned(8125));
+  config.Set("MetricsPrefix", "supermodel");
+  config.Set("MetricsInterval", unsigned(10));
+  config.Set("DumpTextures", false);
+  return config;
+}
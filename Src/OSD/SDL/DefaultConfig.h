@@ -0,0 +1,42 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * DefaultConfig.h
+ *
+ * Default settings of all configuration options, which settings from the
+ * configuration file, the command line and game definitions are applied over.
+ */
+
+#ifndef INCLUDED_DEFAULTCONFIG_H
+#define INCLUDED_DEFAULTCONFIG_H
+
+#include "Util/NewConfig.h"
+
+/*
+ * DefaultConfig():
+ *
+ * Returns:
+ *    The default global configuration section.
+ */
+Util::Config::Node DefaultConfig();
+
+#endif  // INCLUDED_DEFAULTCONFIG_H
@@ -0,0 +1,230 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "FrameCapture.h"
+#include "Supermodel.h"
+#include "Util/BMPFile.h"
+#include "Util/PNGFile.h"
+#include <zlib.h>
+#include <cstring>
+
+void CFrameCapture::Capture(const Request &request, unsigned width, unsigned height)
+{
+  size_t size = size_t(width) * height * 4;
+  if (!m_async)
+  {
+    Job job;
+    job.request = request;
+    job.width = width;
+    job.height = height;
+    job.pixels = GetPixels(size);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, job.pixels.data());
+    Queue(std::move(job));
+    return;
+  }
+
+  // Make room for the frame if rendering has got ahead of the read backs
+  if (m_numPending == NumBuffers)
+    Retire(true);
+
+  Buffer &buffer = m_buffers[(m_oldestBuffer + m_numPending) % NumBuffers];
+  if (buffer.pbo == 0)
+    glGenBuffers(1, &buffer.pbo);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+  if (buffer.size != size)
+  {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    buffer.size = size;
+  }
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  buffer.job.request = request;
+  buffer.job.width = width;
+  buffer.job.height = height;
+  m_numPending++;
+}
+
+void CFrameCapture::Update()
+{
+  // Frames are passed on in order, so that hashes are logged in order
+  while (m_numPending > 0 && Retire(false))
+    ;
+}
+
+void CFrameCapture::Flush()
+{
+  while (m_numPending > 0)
+    Retire(true);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this] { return m_jobs.empty() && !m_working; });
+  if (m_rawFile != nullptr)
+    fclose(m_rawFile);
+  m_rawFile = nullptr;
+  m_rawFileName.clear();
+}
+
+/*
+ * Maps the oldest pixel buffer read into, if its read back has finished (or
+ * once it has, if waiting), and queues its frame for the worker.
+ */
+bool CFrameCapture::Retire(bool wait)
+{
+  Buffer &buffer = m_buffers[m_oldestBuffer];
+  GLenum status = glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  while (wait && status == GL_TIMEOUT_EXPIRED)
+    status = glClientWaitSync(buffer.fence, 0, 1000000000);  // 1 s in ns
+  if (status == GL_TIMEOUT_EXPIRED)
+    return false;
+  glDeleteSync(buffer.fence);
+  buffer.fence = nullptr;
+
+  Job job = std::move(buffer.job);
+  job.pixels = GetPixels(buffer.size);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.pbo);
+  const void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, buffer.size, GL_MAP_READ_BIT);
+  if (data != nullptr)
+  {
+    memcpy(job.pixels.data(), data, buffer.size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_oldestBuffer = (m_oldestBuffer + 1) % NumBuffers;
+  m_numPending--;
+  if (data == nullptr)
+    ErrorLog("Unable to read back frame %llu.", (unsigned long long) job.request.frame);
+  else
+    Queue(std::move(job));
+  return true;
+}
+
+std::vector<uint8_t> CFrameCapture::GetPixels(size_t size)
+{
+  std::vector<uint8_t> pixels;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_freePixels.empty())
+    {
+      pixels = std::move(m_freePixels.back());
+      m_freePixels.pop_back();
+    }
+  }
+  pixels.resize(size);
+  return pixels;
+}
+
+void CFrameCapture::Queue(Job &&job)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cv.wait(lock, [this] { return m_jobs.size() < MaxQueuedJobs; });
+  m_jobs.push_back(std::move(job));
+  m_cv.notify_all();
+}
+
+void CFrameCapture::Write(const Job &job)
+{
+  const uint8_t *pixels = job.pixels.data();
+  if (job.request.hashFile != nullptr)
+  {
+    uLong crc = crc32(0, pixels, uInt(job.pixels.size()));
+    fprintf(job.request.hashFile, "%llu %08lX%s%s\n", (unsigned long long) job.request.frame, (unsigned long) crc,
+      job.request.hashExtra.empty() ? "" : " ", job.request.hashExtra.c_str());
+  }
+  if (job.request.sink)
+    job.request.sink(pixels, job.width, job.height);
+  if (job.request.file.empty())
+    return;
+
+  switch (job.request.format)
+  {
+  case Format::BMP:
+    Util::WriteSurfaceToBMP<Util::RGBA8>(job.request.file, pixels, job.width, job.height, true);
+    break;
+  case Format::PNG:
+    Util::WriteSurfaceToPNG<Util::RGBA8>(job.request.file, pixels, job.width, job.height, true);
+    break;
+  case Format::Raw:
+    if (job.request.file != m_rawFileName)
+    {
+      if (m_rawFile != nullptr)
+        fclose(m_rawFile);
+      m_rawFileName = job.request.file;
+      m_rawFile = fopen(m_rawFileName.c_str(), "wb");
+      if (m_rawFile == nullptr)
+        ErrorLog("Unable to open '%s' for writing.", m_rawFileName.c_str());
+    }
+    if (m_rawFile != nullptr)
+    {
+      size_t rowSize = job.width * 4;
+      for (unsigned y = job.height; y > 0; y--)
+        fwrite(&pixels[(y - 1) * rowSize], 1, rowSize, m_rawFile);
+    }
+    break;
+  }
+}
+
+void CFrameCapture::WorkerThread()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    m_cv.wait(lock, [this] { return m_quit || !m_jobs.empty(); });
+    if (m_jobs.empty())
+      return;
+    Job job = std::move(m_jobs.front());
+    m_jobs.pop_front();
+    m_working = true;
+    m_cv.notify_all();
+    lock.unlock();
+    Write(job);
+    lock.lock();
+    m_freePixels.push_back(std::move(job.pixels));
+    m_working = false;
+    m_cv.notify_all();
+  }
+}
+
+CFrameCapture::CFrameCapture()
+  : m_async(GLEW_VERSION_3_2 || GLEW_ARB_sync),
+    m_oldestBuffer(0),
+    m_numPending(0),
+    m_working(false),
+    m_quit(false),
+    m_rawFile(nullptr)
+{
+  m_thread = std::thread(&CFrameCapture::WorkerThread, this);
+}
+
+CFrameCapture::~CFrameCapture()
+{
+  Flush();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+  for (Buffer &buffer : m_buffers)
+  {
+    if (buffer.pbo != 0)
+      glDeleteBuffers(1, &buffer.pbo);
+  }
+}
@@ -0,0 +1,147 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * FrameCapture.h
+ *
+ * Reading back of finished frames for screenshots and -capture-every.
+ */
+
+#ifndef INCLUDED_FRAMECAPTURE_H
+#define INCLUDED_FRAMECAPTURE_H
+
+#include <GL/glew.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * CFrameCapture:
+ *
+ * Reads frames back from the frame buffer and writes them out without holding
+ * up rendering. Each frame is read into one of a ring of pixel buffer
+ * objects, with a fence to tell when the copy has finished, and mapped once
+ * it has, normally a frame or two later. The pixels are then hashed, encoded
+ * and written by a worker thread. Without fences, frames are read back
+ * synchronously but still written by the worker.
+ */
+class CFrameCapture
+{
+public:
+  enum class Format
+  {
+    BMP,
+    PNG,
+    Raw   // RGBA, top row first, frames with the same file appended to it
+  };
+
+  struct Request
+  {
+    std::string file;           // image to write, or empty for none
+    Format format = Format::BMP;
+    FILE *hashFile = nullptr;   // if not null, "<frame> <CRC-32>" logged to it
+    std::string hashExtra;      // appended to the line logged, after a space
+    uint64_t frame = 0;
+
+    // If set, given the RGBA pixels, bottom row first, on the worker thread
+    std::function<void(const uint8_t *pixels, unsigned width, unsigned height)> sink;
+  };
+
+  /*
+   * Capture(request, width, height):
+   *
+   * Starts reading back the bottom left width x height pixels of the current
+   * read buffer. Called from the thread rendering, once the frame is drawn.
+   * Only blocks if all the pixel buffers or the worker's queue are full.
+   */
+  void Capture(const Request &request, unsigned width, unsigned height);
+
+  /*
+   * Update():
+   *
+   * Passes the frames that have been read back to the worker. Called from the
+   * thread rendering, once a frame.
+   */
+  void Update();
+
+  /*
+   * Flush():
+   *
+   * Waits for all the frames captured to be read back and written, and closes
+   * raw files. Must be called before closing any hash file given to Capture().
+   */
+  void Flush();
+
+  CFrameCapture();
+  ~CFrameCapture();
+
+private:
+  static const unsigned NumBuffers = 3;
+  static const size_t MaxQueuedJobs = 8;  // frames waiting for the worker
+
+  struct Job
+  {
+    Request request;
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<uint8_t> pixels;
+  };
+
+  struct Buffer
+  {
+    GLuint pbo = 0;
+    size_t size = 0;
+    GLsync fence = nullptr;
+    Job job;
+  };
+
+  bool m_async;
+  Buffer m_buffers[NumBuffers];
+  unsigned m_oldestBuffer;
+  unsigned m_numPending;
+
+  // Shared with the worker
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<Job> m_jobs;
+  std::vector<std::vector<uint8_t>> m_freePixels; // reused to avoid allocating
+  bool m_working;
+  bool m_quit;
+  std::thread m_thread;
+
+  // Used by the worker only, or while it is idle
+  std::string m_rawFileName;
+  FILE *m_rawFile;
+
+  bool Retire(bool wait);
+  std::vector<uint8_t> GetPixels(size_t size);
+  void Queue(Job &&job);
+  void Write(const Job &job);
+  void WorkerThread();
+};
+
+#endif  // INCLUDED_FRAMECAPTURE_H
@@ -0,0 +1,421 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * LibSupermodel.cpp
+ *
+ * Implementation of the C interface to the emulator (see LibSupermodel.h).
+ * Each instance is built the way Supermodel() in Main.cpp builds the one it
+ * runs, with a host that keeps the frames and audio for the caller and inputs
+ * set by the caller instead of polled from devices.
+ */
+
+#include "LibSupermodel.h"
+#include "DefaultConfig.h"
+#include "SDLIncludes.h"
+#include "Supermodel.h"
+#include "GameLoader.h"
+#include "Graphics/Legacy3D/Legacy3D.h"
+#include "Graphics/New3D/New3D.h"
+#include "Inputs/Input.h"
+#include "Inputs/Inputs.h"
+#include "Inputs/InputSystem.h"
+#include "Model3/IEmulatorHost.h"
+#include "Model3/Model3.h"
+#include "Util/NewConfig.h"
+#include "Util/ConfigBuilders.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+
+/******************************************************************************
+ Inputs
+******************************************************************************/
+
+/*
+ * CNullInputSystem:
+ *
+ * Input system without devices. Inputs keep the values the caller sets, since
+ * they are never polled.
+ */
+class CNullInputSystem: public CInputSystem
+{
+public:
+  CNullInputSystem()
+    : CInputSystem("Null")
+  {
+  }
+
+protected:
+  bool InitializeSystem() { return true; }
+  int GetKeyIndex(const char *keyName) { return -1; }
+  const char *GetKeyName(int keyIndex) { return NULL; }
+  bool IsKeyPressed(int kbdNum, int keyIndex) { return false; }
+  int GetMouseAxisValue(int mseNum, int axisNum) { return 0; }
+  int GetMouseWheelDir(int mseNum) { return 0; }
+  bool IsMouseButPressed(int mseNum, int butNum) { return false; }
+  int GetJoyAxisValue(int joyNum, int axisNum) { return 0; }
+  bool IsJoyPOVInDir(int joyNum, int povNum, int povDir) { return false; }
+  bool IsJoyButPressed(int joyNum, int butNum) { return false; }
+  bool ProcessForceFeedbackCmd(int joyNum, int axisNum, ForceFeedbackCmd ffCmd) { return false; }
+
+public:
+  int GetNumKeyboards() { return 0; }
+  int GetNumMice() { return 0; }
+  int GetNumJoysticks() { return 0; }
+  const KeyDetails *GetKeyDetails(int kbdNum) { return NULL; }
+  const MouseDetails *GetMouseDetails(int mseNum) { return NULL; }
+  const JoyDetails *GetJoyDetails(int joyNum) { return NULL; }
+  bool Poll() { return true; }
+  void SetMouseVisibility(bool visible) { }
+};
+
+
+/******************************************************************************
+ Host
+******************************************************************************/
+
+/*
+ * CLibHost:
+ *
+ * Keeps the audio of an instance, mixed to 16-bit stereo, for
+ * Supermodel_GetAudio(). Frames are left in the back buffer of the instance's
+ * window, which is never swapped, for Supermodel_GetFramebuffer().
+ */
+class CLibHost: public IEmulatorHost
+{
+public:
+  static const size_t MaxFrames = 44100;   // one second
+
+  std::vector<INT16> samples;              // interleaved stereo
+
+  bool BeginFrameVideo(void)
+  {
+    return true;
+  }
+
+  void EndFrameVideo(void)
+  {
+  }
+
+  bool OutputAudio(unsigned numSamples, const float *leftFrontBuffer, const float *rightFrontBuffer, const float *leftRearBuffer, const float *rightRearBuffer, bool flipStereo)
+  {
+    // Rear channels are mixed into the front ones, as for a stereo device
+    const float *left = flipStereo ? rightFrontBuffer : leftFrontBuffer;
+    const float *right = flipStereo ? leftFrontBuffer : rightFrontBuffer;
+    const float *leftRear = flipStereo ? rightRearBuffer : leftRearBuffer;
+    const float *rightRear = flipStereo ? leftRearBuffer : rightRearBuffer;
+    for (unsigned i = 0; i < numSamples; i++)
+    {
+      float l = left[i] + (leftRear != NULL ? leftRear[i] : 0.0f);
+      float r = right[i] + (rightRear != NULL ? rightRear[i] : 0.0f);
+      samples.push_back(INT16(std::max(-32768.0f, std::min(32767.0f, l))));
+      samples.push_back(INT16(std::max(-32768.0f, std::min(32767.0f, r))));
+    }
+
+    // Audio nobody takes is dropped, oldest first
+    if (samples.size() > 2 * MaxFrames)
+      samples.erase(samples.begin(), samples.end() - 2 * MaxFrames);
+    return false;
+  }
+};
+
+
+/******************************************************************************
+ Loader and Instances
+******************************************************************************/
+
+struct SupermodelLoader
+{
+  std::string romCacheDir;
+  std::unique_ptr<GameLoader> loader;
+  std::mutex lock;
+  std::map<std::string, std::pair<Game, ROMSet>> games;  // loaded ROM sets by zip file
+};
+
+struct SupermodelInstance
+{
+  Util::Config::Node config;
+  Game game;
+  SDL_Window *window = nullptr;
+  SDL_GLContext context = nullptr;
+  unsigned width = 0;
+  unsigned height = 0;
+  CNullInputSystem inputSystem;
+  std::unique_ptr<CInputs> inputs;
+  CLibHost host;
+  std::unique_ptr<CModel3> model3;
+  std::unique_ptr<CRender2D> render2D;
+  std::unique_ptr<IRender3D> render3D;
+
+  SupermodelInstance()
+    : config("Global")
+  {
+  }
+
+  ~SupermodelInstance()
+  {
+    // The renderers free their GL objects in the instance's context
+    if (context != nullptr)
+      SDL_GL_MakeCurrent(window, context);
+    model3.reset();
+    render3D.reset();
+    render2D.reset();
+    inputs.reset();
+    if (context != nullptr)
+    {
+      SDL_GL_MakeCurrent(window, nullptr);
+      SDL_GL_DeleteContext(context);
+    }
+    if (window != nullptr)
+    {
+      SDL_DestroyWindow(window);
+      SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    }
+  }
+
+  // Every call may come from a different thread than the last
+  void MakeCurrent()
+  {
+    SDL_GL_MakeCurrent(window, context);
+  }
+};
+
+static bool CreateInstanceWindow(SupermodelInstance *instance)
+{
+  if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0)
+    return ErrorLog("Unable to initialize SDL video subsystem: %s\n", SDL_GetError());
+
+  SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+  SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+  SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+  SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
+  SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+  SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+  SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+  if (instance->config["New3DEngine"].ValueAs<bool>())
+  {
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, instance->config["QuadRendering"].ValueAs<bool>() ? 5 : 1);
+  }
+  else
+  {
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, 0);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+  }
+
+  instance->window = SDL_CreateWindow("Supermodel", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, instance->width, instance->height, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+  if (nullptr == instance->window)
+  {
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    return ErrorLog("Unable to create an OpenGL display: %s\n", SDL_GetError());
+  }
+  instance->context = SDL_GL_CreateContext(instance->window);
+  if (nullptr == instance->context)
+    return ErrorLog("Unable to create OpenGL context: %s\n", SDL_GetError());
+  instance->MakeCurrent();
+
+  // An EGL context (SDL_VIDEODRIVER=offscreen) has no GLX display, but the GL
+  // functions themselves load fine
+  GLenum err = glewInit();
+  if (GLEW_OK != err && GLEW_ERROR_NO_GLX_DISPLAY != err)
+    return ErrorLog("OpenGL initialization failed: %s\n", glewGetErrorString(err));
+  glViewport(0, 0, instance->width, instance->height);
+  return OKAY;
+}
+
+extern "C" SupermodelLoader *Supermodel_CreateLoader(const char *gamesXML, const char *romCacheDir)
+{
+  SupermodelLoader *loader = new(std::nothrow) SupermodelLoader();
+  if (NULL == loader)
+    return NULL;
+  std::string xmlFile = gamesXML != NULL ? std::string(gamesXML) : DefaultConfig()["GameXMLFile"].ValueAs<std::string>();
+  loader->romCacheDir = romCacheDir != NULL ? romCacheDir : "";
+  loader->loader.reset(new GameLoader(xmlFile, loader->romCacheDir));
+  if (loader->loader->GetGames().empty())
+  {
+    ErrorLog("No games defined in %s.", xmlFile.c_str());
+    delete loader;
+    return NULL;
+  }
+  return loader;
+}
+
+extern "C" void Supermodel_DestroyLoader(SupermodelLoader *loader)
+{
+  delete loader;
+}
+
+extern "C" SupermodelInstance *Supermodel_Create(SupermodelLoader *loader, const char *zipFile, const char *const *options, unsigned width, unsigned height)
+{
+  if (NULL == loader || NULL == zipFile || 0 == width || 0 == height)
+    return NULL;
+
+  // Settings given override the defaults, as on the command line
+  Util::Config::Node optionConfig("Global");
+  for (const char *const *option = options; option != NULL && *option != NULL; option++)
+  {
+    const char *equals = strchr(*option, '=');
+    if (NULL == equals)
+    {
+      ErrorLog("Ignoring option '%s', which is not of the form Key=Value.", *option);
+      continue;
+    }
+    optionConfig.Set(std::string(*option, equals), std::string(equals + 1));
+  }
+
+  // ROM sets are decoded once and shared by all instances of a game
+  Game game;
+  ROMSet romSet;
+  {
+    std::lock_guard<std::mutex> guard(loader->lock);
+    auto it = loader->games.find(zipFile);
+    if (it == loader->games.end())
+    {
+      if (loader->loader->Load(&game, &romSet, zipFile, loader->romCacheDir))
+        return NULL;
+      it = loader->games.insert({ zipFile, { game, romSet } }).first;
+    }
+    game = it->second.first;
+    romSet = it->second.second;
+  }
+
+  std::unique_ptr<SupermodelInstance> instance(new(std::nothrow) SupermodelInstance());
+  if (!instance)
+    return NULL;
+  Util::Config::Node defaults = DefaultConfig();
+  for (auto &setting: game.performance)
+  {
+    if (defaults.TryGet(setting.first) != nullptr)
+      defaults.Set(setting.first, setting.second);
+  }
+  Util::Config::MergeINISections(&instance->config, defaults, optionConfig);
+
+  // The instance runs on the calling thread alone, and is never throttled
+  instance->config.Get("MultiThreaded").SetValue(false);
+  instance->config.Get("GPUMultiThreaded").SetValue(false);
+  instance->config.Get("Throttle").SetValue(false);
+  instance->config.Set("XResolution", width);
+  instance->config.Set("YResolution", height);
+  instance->game = game;
+  instance->width = width;
+  instance->height = height;
+
+  if (OKAY != CreateInstanceWindow(instance.get()))
+    return NULL;
+
+  instance->inputs.reset(new CInputs(&instance->inputSystem));
+  if (!instance->inputs->Initialize())
+  {
+    ErrorLog("Unable to initalize inputs.\n");
+    return NULL;
+  }
+
+  instance->model3.reset(new CModel3(instance->config));
+  if (OKAY != instance->model3->Init())
+    return NULL;
+  if (instance->model3->LoadGame(game, romSet))
+    return NULL;
+
+  instance->render2D.reset(new CRender2D(instance->config));
+  if (instance->config["New3DEngine"].ValueAs<bool>())
+    instance->render3D.reset(new New3D::CNew3D(instance->config, game.name));
+  else
+    instance->render3D.reset(new Legacy3D::CLegacy3D(instance->config));
+  if (OKAY != instance->render2D->Init(0, 0, width, height, width, height))
+    return NULL;
+  if (OKAY != instance->render3D->Init(0, 0, width, height, width, height))
+    return NULL;
+  instance->model3->AttachRenderers(instance->render2D.get(), instance->render3D.get());
+  instance->model3->AttachInputs(instance->inputs.get());
+  instance->model3->AttachHost(&instance->host);
+  instance->model3->Reset();
+  return instance.release();
+}
+
+extern "C" void Supermodel_Destroy(SupermodelInstance *instance)
+{
+  delete instance;
+}
+
+extern "C" int Supermodel_StepFrame(SupermodelInstance *instance)
+{
+  instance->MakeCurrent();
+  instance->model3->RunFrame();
+  return 0;
+}
+
+extern "C" int Supermodel_SetInput(SupermodelInstance *instance, const char *id, unsigned value)
+{
+  CInput *input = (*instance->inputs)[id];
+  if (NULL == input)
+    return 1;
+  input->prevValue = input->value;
+  input->value = UINT16(value);
+  return 0;
+}
+
+extern "C" void Supermodel_GetFrameSize(const SupermodelInstance *instance, unsigned *width, unsigned *height)
+{
+  *width = instance->width;
+  *height = instance->height;
+}
+
+extern "C" int Supermodel_GetFramebuffer(SupermodelInstance *instance, uint8_t *pixels)
+{
+  instance->MakeCurrent();
+  size_t pitch = size_t(instance->width) * 4;
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadBuffer(GL_BACK);
+  glReadPixels(0, 0, instance->width, instance->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+  if (glGetError() != GL_NO_ERROR)
+    return 1;
+
+  // OpenGL reads bottom row first
+  std::vector<uint8_t> row(pitch);
+  for (unsigned y = 0; y < instance->height / 2; y++)
+  {
+    uint8_t *top = pixels + y * pitch;
+    uint8_t *bottom = pixels + (instance->height - 1 - y) * pitch;
+    memcpy(row.data(), top, pitch);
+    memcpy(top, bottom, pitch);
+    memcpy(bottom, row.data(), pitch);
+  }
+  return 0;
+}
+
+extern "C" unsigned Supermodel_GetAudio(SupermodelInstance *instance, int16_t *samples, unsigned maxFrames)
+{
+  std::vector<INT16> &buffer = instance->host.samples;
+  size_t frames = std::min(size_t(maxFrames), buffer.size() / 2);
+  std::copy(buffer.begin(), buffer.begin() + 2 * frames, samples);
+  buffer.erase(buffer.begin(), buffer.begin() + 2 * frames);
+  return unsigned(frames);
+}
@@ -0,0 +1,159 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * LibSupermodel.h
+ *
+ * C interface to the emulator, for programs that embed it, such as to run many
+ * instances of a game side by side in one process. Built by the 'lib' make
+ * target into libsupermodel.a.
+ *
+ * Each instance has an emulator, sound board and drive board of its own, and
+ * renders to a hidden window with its own OpenGL context. Instances may be
+ * driven from different threads at once, but each from one thread at a time,
+ * and all of them are created and destroyed on the main thread (SDL's windows
+ * require it on some platforms). Multi-threading within an instance is
+ * disabled, so an instance runs entirely on the thread that steps it. The log
+ * and the job pool are shared by all instances in the process, and instances
+ * have no net board.
+ *
+ * Functions returning int return 0 on success and non-zero on failure.
+ */
+
+#ifndef INCLUDED_LIBSUPERMODEL_H
+#define INCLUDED_LIBSUPERMODEL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SupermodelLoader SupermodelLoader;
+typedef struct SupermodelInstance SupermodelInstance;
+
+/*
+ * Supermodel_CreateLoader(gamesXML, romCacheDir):
+ *
+ * Loads the game definitions once, for creating any number of instances. ROM
+ * sets are loaded once per zip file and shared by the instances created from
+ * them.
+ *
+ * Parameters:
+ *    gamesXML      Game definition file (Games.xml), or NULL for the default.
+ *    romCacheDir   Decoded ROM cache directory, or NULL for none.
+ *
+ * Returns:
+ *    The loader, or NULL if the definitions could not be loaded.
+ */
+SupermodelLoader *Supermodel_CreateLoader(const char *gamesXML, const char *romCacheDir);
+
+/*
+ * Supermodel_DestroyLoader(loader):
+ *
+ * Frees the loader and the ROM sets it holds. Instances created from it are
+ * not affected.
+ */
+void Supermodel_DestroyLoader(SupermodelLoader *loader);
+
+/*
+ * Supermodel_Create(loader, zipFile, options, width, height):
+ *
+ * Creates an instance running the game in a zip file, reset and ready to
+ * step.
+ *
+ * Parameters:
+ *    loader    Loader holding the game definitions.
+ *    zipFile   ROM set.
+ *    options   Settings as "Key=Value" strings, with the keys of
+ *              Supermodel.ini (e.g. "New3DEngine=0"), ending with NULL. May
+ *              be NULL.
+ *    width     Width of the frames rendered, in pixels.
+ *    height    Height of the frames rendered, in pixels.
+ *
+ * Returns:
+ *    The instance, or NULL if it could not be created.
+ */
+SupermodelInstance *Supermodel_Create(SupermodelLoader *loader, const char *zipFile, const char *const *options, unsigned width, unsigned height);
+
+/*
+ * Supermodel_Destroy(instance):
+ *
+ * Frees an instance. Must be called from the thread that created it.
+ */
+void Supermodel_Destroy(SupermodelInstance *instance);
+
+/*
+ * Supermodel_StepFrame(instance):
+ *
+ * Runs one frame, rendering it and adding its audio to the instance's audio
+ * buffer.
+ */
+int Supermodel_StepFrame(SupermodelInstance *instance);
+
+/*
+ * Supermodel_SetInput(instance, id, value):
+ *
+ * Sets the value of an input from the next frame on, as replaying a recording
+ * does.
+ *
+ * Parameters:
+ *    instance  Instance.
+ *    id        Input id, as in Supermodel.ini without the "Input" prefix
+ *              (e.g. "Start1", "Steering").
+ *    value     0 or 1 for switches, the raw value for analog inputs and axes.
+ *
+ * Returns:
+ *    Non-zero if there is no such input.
+ */
+int Supermodel_SetInput(SupermodelInstance *instance, const char *id, unsigned value);
+
+/*
+ * Supermodel_GetFrameSize(instance, width, height):
+ *
+ * Gets the size of the frames rendered.
+ */
+void Supermodel_GetFrameSize(const SupermodelInstance *instance, unsigned *width, unsigned *height);
+
+/*
+ * Supermodel_GetFramebuffer(instance, pixels):
+ *
+ * Reads back the last frame rendered as RGBA, 8 bits per channel, top row
+ * first, into a buffer of width * height * 4 bytes.
+ */
+int Supermodel_GetFramebuffer(SupermodelInstance *instance, uint8_t *pixels);
+
+/*
+ * Supermodel_GetAudio(instance, samples, maxFrames):
+ *
+ * Takes up to maxFrames of the audio rendered since the last call, as 16-bit,
+ * 44.1 KHz interleaved stereo. Audio not taken is kept, up to a second.
+ *
+ * Returns:
+ *    Number of stereo frames written.
+ */
+unsigned Supermodel_GetAudio(SupermodelInstance *instance, int16_t *samples, unsigned maxFrames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDED_LIBSUPERMODEL_H
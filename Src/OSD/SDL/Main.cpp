@@ -74,14 +74,26 @@
 #include "Graphics/Legacy3D/Legacy3D.h"
 #include "Graphics/New3D/New3D.h"
 #include "Model3/IEmulator.h"
+#include "Model3/IEmulatorHost.h"
 #include "Model3/Model3.h"
+#include "Inputs/InputRecording.h"
 #include "OSD/Audio.h"
+#include "OSD/OutputStream.h"
+#include "OSD/Outputs.h"
+#include "OSD/Thread.h"
+#include "OSD/Trace.h"
 #include "Graphics/New3D/VBO.h"
+#include "Graphics/GPUTimer.h"
 
 #include <iostream>
 #include "Util/BMPFile.h"
 
 #include "Crosshair.h"
+#include "DefaultConfig.h"
+#include "FrameCapture.h"
+#include "VideoRecorder.h"
+#include "StatsOverlay.h"
+#include "MetricsExporter.h"
 
 /******************************************************************************
  Global Run-time Config
@@ -95,6 +107,7 @@ static Util::Config::Node s_runtime_config("Global");
 ******************************************************************************/
 
 SDL_Window *s_window = nullptr;
+static bool s_headless = false;         // render offscreen, without a display
 
 /*
  * Position and size of rectangular region within OpenGL display to render to.
@@ -111,6 +124,17 @@ static unsigned  totalXRes, totalYRes;  // total resolution (the whole GL viewpo
  */
 static CCrosshair* s_crosshair = nullptr;
 
+/*
+ * Frame rate and statistics drawn over the picture, if shown
+ */
+static CStatsOverlay* s_statsOverlay = nullptr;
+
+/*
+ * Read back of frames for screenshots and frame capture
+ */
+static CFrameCapture* s_frameCapture = nullptr;
+static std::string s_screenshotFile;  // captured at the end of the next frame
+
 static bool SetGLGeometry(unsigned *xOffsetPtr, unsigned *yOffsetPtr, unsigned *xResPtr, unsigned *yResPtr, unsigned *totalXResPtr, unsigned *totalYResPtr, bool keepAspectRatio)
 {
   // What resolution did we actually get?
@@ -244,6 +268,11 @@ static bool CreateGLScreen(bool coreContext, bool quadRendering, const std::stri
     return ErrorLog("Internal error: CreateGLScreen() called more than once");
   }
 
+  // Without a display, render to an offscreen surface: SDL's offscreen driver
+  // creates the context on an EGL pbuffer, needing no display server
+  if (s_headless)
+    SDL_setenv("SDL_VIDEODRIVER", "offscreen", 1);
+
   // Initialize video subsystem
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
     return ErrorLog("Unable to initialize SDL video subsystem: %s\n", SDL_GetError());
@@ -270,7 +299,7 @@ static bool CreateGLScreen(bool coreContext, bool quadRendering, const std::stri
   }
 
   // Set video mode
-  s_window = SDL_CreateWindow(caption.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, *xResPtr, *yResPtr, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | (fullScreen ? SDL_WINDOW_FULLSCREEN : 0));
+  s_window = SDL_CreateWindow(caption.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, *xResPtr, *yResPtr, SDL_WINDOW_OPENGL | (s_headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN) | (fullScreen && !s_headless ? SDL_WINDOW_FULLSCREEN : 0));
   if (nullptr == s_window)
   {
     ErrorLog("Unable to create an OpenGL display: %s\n", SDL_GetError());
@@ -290,15 +319,19 @@ static bool CreateGLScreen(bool coreContext, bool quadRendering, const std::stri
     return FAIL;
   }
 
-  // Set vsync
-  SDL_GL_SetSwapInterval(s_runtime_config["VSync"].ValueAsDefault<bool>(false) ? 1 : 0);
+  // Set vsync. Adaptive vsync, where supported, swaps a frame that missed the
+  // vertical blank straight away rather than waiting for the next one.
+  bool vsync = s_runtime_config["VSync"].ValueAsDefault<bool>(false);
+  if (!vsync || !s_runtime_config["AdaptiveVSync"].ValueAsDefault<bool>(false) || SDL_GL_SetSwapInterval(-1) != 0)
+    SDL_GL_SetSwapInterval(vsync ? 1 : 0);
 
   // Set the context as the current window context
   SDL_GL_MakeCurrent(s_window, context);
 
-  // Initialize GLEW, allowing us to use features beyond OpenGL 1.2
+  // Initialize GLEW, allowing us to use features beyond OpenGL 1.2. An EGL
+  // context has no GLX display, but the GL functions themselves load fine.
   err = glewInit();
-  if (GLEW_OK != err)
+  if (GLEW_OK != err && !(s_headless && GLEW_ERROR_NO_GLX_DISPLAY == err))
   {
     ErrorLog("OpenGL initialization failed: %s\n", glewGetErrorString(err));
     return FAIL;
@@ -339,7 +372,7 @@ static void DestroyGLScreen()
 static bool ResizeGLScreen(unsigned *xOffsetPtr, unsigned *yOffsetPtr, unsigned *xResPtr, unsigned *yResPtr, unsigned *totalXResPtr, unsigned *totalYResPtr, bool keepAspectRatio, bool fullScreen)
 {
   // Set full screen mode
-  if (SDL_SetWindowFullscreen(s_window, fullScreen ? SDL_WINDOW_FULLSCREEN : 0) < 0)
+  if (SDL_SetWindowFullscreen(s_window, fullScreen && !s_headless ? SDL_WINDOW_FULLSCREEN : 0) < 0)
   {
     ErrorLog("Unable to enter %s mode: %s\n", fullScreen ? "fullscreen" : "windowed", SDL_GetError());
     return FAIL;
@@ -507,9 +540,9 @@ static void DumpPPCRegisters(IBus *bus)
 
 static void SaveFrameBuffer(const std::string& file)
 {
-    std::shared_ptr<uint8_t> pixels(new uint8_t[totalXRes * totalYRes * 4], std::default_delete<uint8_t[]>());
-    glReadPixels(0, 0, totalXRes, totalYRes, GL_RGBA, GL_UNSIGNED_BYTE, pixels.get());
-    Util::WriteSurfaceToBMP<Util::RGBA8>(file, pixels.get(), totalXRes, totalYRes, true);
+    CFrameCapture::Request request;
+    request.file = file;
+    s_frameCapture->Capture(request, totalXRes, totalYRes);
 }
 
 void Screenshot()
@@ -517,24 +550,32 @@ void Screenshot()
     // Make a screenshot
     time_t now = std::time(nullptr);
     tm* ltm = std::localtime(&now);
-    std::string file = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Screenshots)
-        << "Screenshot_"
-        << std::setfill('0') << std::setw(4) << (1900 + ltm->tm_year)
-        << '-'
-        << std::setw(2) << (1 + ltm->tm_mon)
-        << '-'
-        << std::setw(2) << ltm->tm_mday
-        << "_("
-        << std::setw(2) << ltm->tm_hour
-        << '-'
-        << std::setw(2) << ltm->tm_min
-        << '-'
-        << std::setw(2) << ltm->tm_sec
-        << ").bmp";
+    std::string file = (Util::Format() << FileSystemPath::GetPath(FileSystemPath::Screenshots))
+        .Printf("Screenshot_%04d-%02d-%02d_(%02d-%02d-%02d).bmp", 1900 + ltm->tm_year, 1 + ltm->tm_mon, ltm->tm_mday,
+          ltm->tm_hour, ltm->tm_min, ltm->tm_sec);
 
     std::cout << "Screenshot created: " << file << std::endl;
-    SaveFrameBuffer(file);
+    s_screenshotFile = file;
+}
+
+static void DumpExecTraces(IEmulator *Model3)
+{
+  CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+  if (M)
+    M->DumpExecTraces();
+}
+
+#ifdef PPC_PROFILE
+static void DumpPPCProfile(IEmulator *Model3)
+{
+  CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+  if (!M)
+    return;
+  std::string file = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << Model3->GetGame().name << "_ppc_profile.txt";
+  if (OKAY == M->DumpPPCProfile(file.c_str()))
+    printf("PowerPC profile written to '%s'.\n", file.c_str());
 }
+#endif
 
 /******************************************************************************
  Render State Analysis
@@ -625,6 +666,7 @@ static void TestPolygonHeaderBits(IEmulator *Emu)
     }
   }
 
+  s_frameCapture->Flush();
   glReadBuffer(readBuffer);
 
   // Generate the HTML GUI
@@ -661,20 +703,63 @@ static void TestPolygonHeaderBits(IEmulator *Emu)
  Different subsystems output their own blocks.
 ******************************************************************************/
 
-static const int STATE_FILE_VERSION = 3;  // save state file version
-static const int NVRAM_FILE_VERSION = 0;  // NVRAM file version
+static const int STATE_FILE_VERSION = 4;  // save state file version (4: compressed blocks)
+static const int STATE_FILE_MIN_VERSION = 3;  // oldest save state file version that can be loaded
+static const int NVRAM_FILE_VERSION = 1;  // NVRAM file version (1: compressed blocks)
+static const int NVRAM_FILE_MIN_VERSION = 0;  // oldest NVRAM file version that can be loaded
 static unsigned s_saveSlot = 0;           // save state slot #
 
-static void SaveState(IEmulator *Model3)
+// Save state being compressed and written by the save state thread
+struct PendingSave
 {
-  CBlockFile  SaveState;
+  std::string           file;
+  std::vector<uint8_t>  buffer;
+  int                   level;
+};
+static PendingSave s_pendingSave;
+static CThread *s_saveThread = nullptr;
+
+// Compresses the blocks of a save state on the job pool, a piece at a time
+static void RunSaveStateJobs(unsigned count, const std::function<void(unsigned)> &job)
+{
+  CThread::GetJobPool()->Run("SaveState", count, job);
+}
 
-  std::string file_path = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Saves) << Model3->GetGame().name << ".st" << s_saveSlot;
-  if (OKAY != SaveState.Create(file_path, "Supermodel Save State", "Supermodel Version " SUPERMODEL_VERSION))
+static int WriteSaveState(void *data)
+{
+  const PendingSave *save = static_cast<const PendingSave *>(data);
+  if (OKAY != CBlockFile::Save(save->file, save->buffer, save->level, RunSaveStateJobs))
   {
-    ErrorLog("Unable to save state to '%s'.", file_path.c_str());
-    return;
+    ErrorLog("Unable to save state to '%s'.", save->file.c_str());
+    return 1;
   }
+  printf("Saved state to '%s'.\n", save->file.c_str());
+  DebugLog("Saved state to '%s'.\n", save->file.c_str());
+  return 0;
+}
+
+// Waits until the last save state has been written
+static void WaitForSaveState()
+{
+  if (s_saveThread != nullptr)
+  {
+    s_saveThread->Wait();
+    delete s_saveThread;
+    s_saveThread = nullptr;
+  }
+}
+
+static int GetCompressionLevel()
+{
+  return (int) std::min(9u, s_runtime_config["StateCompression"].ValueAs<unsigned>());
+}
+
+// Writes a save state to memory, uncompressed
+static void SaveStateToMemory(IEmulator *Model3, std::vector<uint8_t> *buffer)
+{
+  CBlockFile  SaveState;
+
+  SaveState.Create(buffer, "Supermodel Save State", "Supermodel Version " SUPERMODEL_VERSION);
 
   // Write file format version and ROM set ID to header block
   int32_t fileVersion = STATE_FILE_VERSION;
@@ -684,14 +769,46 @@ static void SaveState(IEmulator *Model3)
   // Save state
   Model3->SaveState(&SaveState);
   SaveState.Close();
-  printf("Saved state to '%s'.\n", file_path.c_str());
-  DebugLog("Saved state to '%s'.\n", file_path.c_str());
+}
+
+static void SaveState(IEmulator *Model3)
+{
+  // Take a snapshot in memory, which is compressed and written to the file
+  // on another thread so that emulation can carry on. The pause is only as
+  // long as copying the state; compression is spread over the job pool.
+  WaitForSaveState();
+  s_pendingSave.file = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Saves) << Model3->GetGame().name << ".st" << s_saveSlot;
+  s_pendingSave.level = GetCompressionLevel();
+  SaveStateToMemory(Model3, &s_pendingSave.buffer);
+
+  s_saveThread = CThread::CreateThread("SaveState", WriteSaveState, &s_pendingSave);
+  if (s_saveThread == nullptr)
+    WriteSaveState(&s_pendingSave);
+}
+
+// Checks that a save state opened for reading is compatible and loads it
+static bool LoadState(IEmulator *Model3, CBlockFile *SaveState, const std::string &file_path)
+{
+  if (OKAY != SaveState->FindBlock("Supermodel Save State"))
+    return ErrorLog("'%s' does not appear to be a valid save state file.", file_path.c_str());
+
+  int32_t fileVersion;
+  SaveState->Read(&fileVersion, sizeof(fileVersion));
+  if (fileVersion < STATE_FILE_MIN_VERSION || fileVersion > STATE_FILE_VERSION)
+    return ErrorLog("'%s' is incompatible with this version of Supermodel.", file_path.c_str());
+
+  Model3->LoadState(SaveState);
+  SaveState->Close();
+  return OKAY;
 }
 
 static void LoadState(IEmulator *Model3, std::string file_path = std::string())
 {
   CBlockFile  SaveState;
 
+  // The file may still be being written
+  WaitForSaveState();
+
   // Generate file path
   if (file_path.empty())
     file_path = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Saves) << Model3->GetGame().name << ".st" << s_saveSlot;
@@ -703,47 +820,98 @@ static void LoadState(IEmulator *Model3, std::string file_path = std::string())
     return;
   }
 
-  if (OKAY != SaveState.FindBlock("Supermodel Save State"))
-  {
-    ErrorLog("'%s' does not appear to be a valid save state file.", file_path.c_str());
-    return;
-  }
-
-  int32_t fileVersion;
-  SaveState.Read(&fileVersion, sizeof(fileVersion));
-  if (fileVersion != STATE_FILE_VERSION)
-  {
-    ErrorLog("'%s' is incompatible with this version of Supermodel.", file_path.c_str());
-    return;
-  }
-
   // Load
-  Model3->LoadState(&SaveState);
-  SaveState.Close();
+  if (OKAY != LoadState(Model3, &SaveState, file_path))
+    return;
   printf("Loaded state from '%s'.\n", file_path.c_str());
   DebugLog("Loaded state from '%s'.\n", file_path.c_str());
 }
 
-static void SaveNVRAM(IEmulator *Model3)
+// Writes an NVRAM file for a game, with the NVRAM saved by the given function
+static bool SaveNVRAMFile(const std::string &game_name, int level, const std::function<void(CBlockFile *)> &save)
 {
   CBlockFile  NVRAM;
+  std::vector<uint8_t> buffer;
 
-  std::string file_path = Util::Format() << FileSystemPath::GetPath(FileSystemPath::NVRAM) << Model3->GetGame().name << ".nv";
-  if (OKAY != NVRAM.Create(file_path, "Supermodel NVRAM State", "Supermodel Version " SUPERMODEL_VERSION))
-  {
-    ErrorLog("Unable to save NVRAM to '%s'. Make sure directory exists!", file_path.c_str());
-    return;
-  }
+  std::string file_path = Util::Format() << FileSystemPath::GetPath(FileSystemPath::NVRAM) << game_name << ".nv";
+  NVRAM.Create(&buffer, "Supermodel NVRAM State", "Supermodel Version " SUPERMODEL_VERSION);
 
   // Write file format version and ROM set ID to header block
   int32_t fileVersion = NVRAM_FILE_VERSION;
   NVRAM.Write(&fileVersion, sizeof(fileVersion));
-  NVRAM.Write(Model3->GetGame().name);
+  NVRAM.Write(game_name);
 
   // Save NVRAM
-  Model3->SaveNVRAM(&NVRAM);
+  save(&NVRAM);
   NVRAM.Close();
+  if (OKAY != CBlockFile::Save(file_path, buffer, level))
+    return ErrorLog("Unable to save NVRAM to '%s'. Make sure directory exists!", file_path.c_str());
   DebugLog("Saved NVRAM to '%s'.\n", file_path.c_str());
+  return OKAY;
+}
+
+// NVRAM checkpoint being written by the NVRAM thread
+struct PendingNVRAM
+{
+  CModel3           *model3;
+  std::string       game_name;
+  int               level;
+  std::atomic<bool> done{ false };
+};
+static PendingNVRAM s_pendingNVRAM;
+static CThread *s_nvramThread = nullptr;
+
+static int WriteNVRAMCheckpoint(void *data)
+{
+  PendingNVRAM *pending = static_cast<PendingNVRAM *>(data);
+  SaveNVRAMFile(pending->game_name, pending->level, [pending](CBlockFile *NVRAM) { pending->model3->SaveNVRAMCheckpoint(NVRAM); });
+  pending->done.store(true, std::memory_order_release);
+  return 0;
+}
+
+// Waits until the last NVRAM checkpoint has been written
+static void WaitForNVRAMCheckpoint()
+{
+  if (s_nvramThread != nullptr)
+  {
+    s_nvramThread->Wait();
+    delete s_nvramThread;
+    s_nvramThread = nullptr;
+  }
+}
+
+/*
+ * CheckpointNVRAM(Model3):
+ *
+ * Copies the NVRAM changed since the last checkpoint, between frames, and
+ * writes it out on a thread of its own, so that bookkeeping and high scores
+ * survive losing power. Returns false if the last checkpoint is still being
+ * written, to be tried again next frame.
+ */
+static bool CheckpointNVRAM(IEmulator *Model3)
+{
+  CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+  if (M == nullptr)
+    return true;
+  if (s_nvramThread != nullptr && !s_pendingNVRAM.done.load(std::memory_order_acquire))
+    return false;
+  WaitForNVRAMCheckpoint();
+  if (!M->CheckpointNVRAM())
+    return true;
+  s_pendingNVRAM.model3 = M;
+  s_pendingNVRAM.game_name = Model3->GetGame().name;
+  s_pendingNVRAM.level = GetCompressionLevel();
+  s_pendingNVRAM.done.store(false, std::memory_order_relaxed);
+  s_nvramThread = CThread::CreateThread("NVRAM", WriteNVRAMCheckpoint, &s_pendingNVRAM);
+  if (s_nvramThread == nullptr)
+    ErrorLog("Unable to create NVRAM checkpoint thread: %s", CThread::GetLastError());
+  return true;
+}
+
+static void SaveNVRAM(IEmulator *Model3)
+{
+  WaitForNVRAMCheckpoint();
+  SaveNVRAMFile(Model3->GetGame().name, GetCompressionLevel(), [Model3](CBlockFile *NVRAM) { Model3->SaveNVRAM(NVRAM); });
 }
 
 static void LoadNVRAM(IEmulator *Model3)
@@ -768,7 +936,7 @@ static void LoadNVRAM(IEmulator *Model3)
 
   int32_t fileVersion;
   NVRAM.Read(&fileVersion, sizeof(fileVersion));
-  if (fileVersion != NVRAM_FILE_VERSION)
+  if (fileVersion < NVRAM_FILE_MIN_VERSION || fileVersion > NVRAM_FILE_VERSION)
   {
     ErrorLog("'%s' is incompatible with this version of Supermodel.", file_path.c_str());
     return;
@@ -781,6 +949,273 @@ static void LoadNVRAM(IEmulator *Model3)
 }
 
 
+/******************************************************************************
+ Input Recording and Replay
+
+ Inputs are recorded from a save state taken once the emulator has started,
+ with the real-time clock fixed to the time recording began. Replaying loads
+ that state and clock, and sets the game inputs of each frame in place of the
+ polled ones.
+******************************************************************************/
+
+static void StartInputRecording(IEmulator *Model3, CInputs *Inputs, CInputRecording *recording)
+{
+  int64_t rtcSeed = int64_t(time(NULL));
+  CModel3 *model3 = dynamic_cast<CModel3 *>(Model3);
+  if (model3 != nullptr)
+    model3->GetRTC()->SetTime(rtcSeed);
+  std::vector<uint8_t> state;
+  SaveStateToMemory(Model3, &state);
+  recording->Start(Inputs, Model3->GetGame(), rtcSeed, &state);
+}
+
+static void SaveInputRecording(const CInputRecording &recording, const std::string &file_path)
+{
+  if (OKAY == recording.Save(file_path, GetCompressionLevel()))
+    printf("Recorded %u frames of inputs to '%s'.\n", recording.GetNumFrames(), file_path.c_str());
+}
+
+static bool StartInputReplay(IEmulator *Model3, CInputs *Inputs, CInputRecording *recording, const std::string &file_path)
+{
+  if (OKAY != recording->Load(file_path, Inputs))
+    return FAIL;
+  if (recording->GetGameName() != Model3->GetGame().name)
+    return ErrorLog("'%s' is an input recording of %s, not %s.", file_path.c_str(), recording->GetGameName().c_str(), Model3->GetGame().name.c_str());
+  CBlockFile SaveState;
+  if (OKAY != SaveState.Load(&recording->GetState()) || OKAY != LoadState(Model3, &SaveState, file_path))
+    return FAIL;
+  CModel3 *model3 = dynamic_cast<CModel3 *>(Model3);
+  if (model3 != nullptr)
+    model3->GetRTC()->SetTime(recording->GetRTCSeed());
+  printf("Replaying %u frames of inputs from '%s'.\n", recording->GetNumFrames(), file_path.c_str());
+  return OKAY;
+}
+
+
+/******************************************************************************
+ Startup Profiling
+******************************************************************************/
+
+// Performance counter value at the start of main() and at the end of each
+// startup phase since, logged with -startup-profile
+struct StartupPhase
+{
+  const char  *name;
+  uint64_t    ticks;
+};
+
+static uint64_t s_startupTicks = 0;
+static std::vector<StartupPhase> s_startupPhases;
+
+static void MarkStartupPhase(const char *name)
+{
+  s_startupPhases.push_back({ name, CThread::GetPerformanceCounter() });
+}
+
+// ROM set whose CRCs are checked by the verification thread once the game is
+// running, when loading it did not (see GameLoader::VerifyROMs())
+struct ROMVerification
+{
+  std::unique_ptr<GameLoader> loader;
+  std::string                 zipfilename;
+  std::string                 warning;    // set if any file is bad
+  std::atomic<bool>           done{ false };
+  bool                        reported = false;
+};
+static ROMVerification s_romVerification;
+static CThread *s_verifyThread = nullptr;
+
+// Reads the files on this one thread, so as to leave the job pool to the
+// emulator
+static int VerifyROMsInBackground(void *data)
+{
+  ROMVerification *verification = static_cast<ROMVerification *>(data);
+  std::vector<std::string> bad_files;
+  if (verification->loader->VerifyROMs(&bad_files, verification->zipfilename, false))
+  {
+    for (const std::string &bad_file : bad_files)
+      ErrorLog("Bad ROM file %s.", bad_file.c_str());
+    verification->warning = Util::Format() << "Warning: " << bad_files.size() << " bad ROM file" << (bad_files.size() == 1 ? "" : "s") << " (see log)";
+  }
+  verification->done.store(true, std::memory_order_release);
+  return 0;
+}
+
+static void StartROMVerification()
+{
+  if (s_romVerification.loader != nullptr && s_verifyThread == nullptr)
+  {
+    s_verifyThread = CThread::CreateThread("VerifyROMs", VerifyROMsInBackground, &s_romVerification);
+    if (s_verifyThread == nullptr)
+      ErrorLog("Unable to create ROM verification thread: %s", CThread::GetLastError());
+  }
+}
+
+// Waits until the ROM set has been verified
+static void WaitForROMVerification()
+{
+  if (s_verifyThread != nullptr)
+  {
+    s_verifyThread->Wait();
+    delete s_verifyThread;
+    s_verifyThread = nullptr;
+  }
+  s_romVerification.loader.reset();
+}
+
+// Blocking verification of -verify-roms, on the job pool. Returns the exit
+// code.
+static int VerifyROMs(const GameLoader &loader, const std::string &zipfilename)
+{
+  std::vector<std::string> bad_files;
+  if (loader.VerifyROMs(&bad_files, zipfilename, true))
+  {
+    for (const std::string &bad_file : bad_files)
+      printf("%s\n", bad_file.c_str());
+    printf("%u bad ROM file%s in '%s'.\n", unsigned(bad_files.size()), bad_files.size() == 1 ? "" : "s", zipfilename.c_str());
+    return 1;
+  }
+  printf("All ROM files in '%s' are good.\n", zipfilename.c_str());
+  return 0;
+}
+
+// Writes a ROM pack next to each zip archive given with -convert-roms. Returns
+// the exit code.
+static int ConvertROMs(const GameLoader &loader, const std::vector<std::string> &zipfilenames)
+{
+  int result = 0;
+  for (const std::string &zipfilename : zipfilenames)
+  {
+    std::string pack_filename;
+    if (loader.ConvertToPack(&pack_filename, zipfilename))
+    {
+      printf("Unable to convert '%s' (see log).\n", zipfilename.c_str());
+      result = 1;
+    }
+    else
+      printf("Converted '%s' to '%s'.\n", zipfilename.c_str(), pack_filename.c_str());
+  }
+  return result;
+}
+
+/*
+ * LogStartupProfile():
+ *
+ * Logs how long after the start of the process each startup phase ended and
+ * how long it took, in milliseconds.
+ */
+static void LogStartupProfile(void)
+{
+  double msPerTick = 1e3 / double(CThread::GetPerformanceFrequency());
+  uint64_t prevTicks = s_startupTicks;
+  InfoLog("Startup profile (ms since start, ms taken, phase):");
+  for (const StartupPhase &phase : s_startupPhases)
+  {
+    InfoLog("  %10.1f %10.1f  %s", double(phase.ticks - s_startupTicks) * msPerTick, double(phase.ticks - prevTicks) * msPerTick, phase.name);
+    prevTicks = phase.ticks;
+  }
+}
+
+
+/******************************************************************************
+ Benchmarking
+******************************************************************************/
+
+/*
+ * WriteBenchmarkReport(file_path, Model3, frames, seconds):
+ *
+ * Writes the statistics of the frame timings collected by -benchmark as JSON,
+ * to a file or, if no path is given, to stdout. Times are in milliseconds, to
+ * the microsecond measured by CModel3, and percentiles are nearest-rank.
+ */
+static void WriteBenchmarkReport(const std::string &file_path, IEmulator *Model3, const std::vector<FrameTimings> &frames, double seconds)
+{
+  struct Subsystem
+  {
+    const char *name;
+    UINT64 FrameTimings::*micros;
+  };
+  static const Subsystem subsystems[] =
+  {
+    { "ppc",    &FrameTimings::ppcMicros },
+    { "security", &FrameTimings::securityMicros },
+    { "sync",   &FrameTimings::syncMicros },
+    { "render", &FrameTimings::renderMicros },
+    { "sound",  &FrameTimings::sndMicros },
+    { "drive",  &FrameTimings::drvMicros },
+    { "inputAge", &FrameTimings::inputAgeMicros },
+#ifdef NET_BOARD
+    { "net",    &FrameTimings::netMicros },
+    { "netwait", &FrameTimings::netWaitMicros },
+#endif
+    { "total",  &FrameTimings::frameMicros }
+  };
+
+  FILE *fp = stdout;
+  if (!file_path.empty())
+  {
+    fp = fopen(file_path.c_str(), "w");
+    if (fp == nullptr)
+    {
+      ErrorLog("Unable to write benchmark report to '%s'.", file_path.c_str());
+      return;
+    }
+  }
+
+  size_t n = frames.size();
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"game\": \"%s\",\n", Model3->GetGame().name.c_str());
+  fprintf(fp, "  \"frames\": %u,\n", unsigned(n));
+  fprintf(fp, "  \"seconds\": %.3f,\n", seconds);
+  fprintf(fp, "  \"fps\": %.3f,\n", seconds > 0 ? double(n) / seconds : 0.0);
+  fprintf(fp, "  \"multiThreaded\": %s,\n", s_runtime_config["MultiThreaded"].ValueAs<bool>() ? "true" : "false");
+  fprintf(fp, "  \"gpuMultiThreaded\": %s,\n", s_runtime_config["GPUMultiThreaded"].ValueAs<bool>() ? "true" : "false");
+#if defined(SUPERMODEL_PGO_USE)
+  fprintf(fp, "  \"pgo\": \"use\",\n");
+#elif defined(SUPERMODEL_PGO_GENERATE)
+  fprintf(fp, "  \"pgo\": \"generate\",\n");
+#else
+  fprintf(fp, "  \"pgo\": \"none\",\n");
+#endif
+  fprintf(fp, "  \"timings\": {\n");
+  std::vector<UINT64> micros(n);
+  const size_t numSubsystems = sizeof(subsystems) / sizeof(subsystems[0]);
+  for (size_t i = 0; i < numSubsystems; i++)
+  {
+    double sum = 0;
+    for (size_t j = 0; j < n; j++)
+    {
+      micros[j] = frames[j].*subsystems[i].micros;
+      sum += double(micros[j]);
+    }
+    std::sort(micros.begin(), micros.end());
+    auto percentile = [&](double p) { return n ? double(micros[std::min(n - 1, size_t(std::ceil(p * double(n))) - 1)]) / 1000.0 : 0.0; };
+    fprintf(fp, "    \"%s\": { \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f }%s\n", subsystems[i].name,
+      n ? sum / double(n) / 1000.0 : 0.0, percentile(0.50), percentile(0.99), n ? double(micros[n - 1]) / 1000.0 : 0.0, i + 1 < numSubsystems ? "," : "");
+  }
+  fprintf(fp, "  }");
+#ifdef NET_BOARD
+  // Totals for the run, which starts from the link being made
+  CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+  NetLinkStats net;
+  if (M && M->GetNetBoard()->IsRunning() && M->GetNetBoard()->GetLinkStats(&net) && net.frames > 0)
+  {
+    double netFrames = double(net.frames);
+    fprintf(fp, ",\n  \"net\": { \"frames\": %u, \"bytesSentPerFrame\": %.1f, \"bytesReceivedPerFrame\": %.1f, \"waitPerFrame\": %.3f, \"stalls\": %u, \"rtt\": %.3f, \"jitter\": %.3f }",
+      unsigned(net.frames), double(net.bytesSent) / netFrames, double(net.bytesReceived) / netFrames, double(net.waitMicros) / netFrames / 1000.0,
+      unsigned(net.Stalls()), net.rttMicros / 1000.0, net.jitterMicros / 1000.0);
+  }
+#endif
+  fprintf(fp, "\n}\n");
+
+  if (fp != stdout)
+  {
+    fclose(fp);
+    printf("Wrote benchmark report to '%s'.\n", file_path.c_str());
+  }
+}
+
+
 /*
 static void PrintGLError(GLenum error)
 {
@@ -805,74 +1240,350 @@ static void PrintGLError(GLenum error)
 
 static CInputs *videoInputs = NULL;
 static uint32_t currentInputs = 0;
+static bool s_presentFrames = true;  // false to finish frames without swapping buffers (benchmarking)
 
-bool BeginFrameVideo()
+/*
+ * Frame capture: every nth frame is read back and its CRC-32 logged, and
+ * optionally written to an image, for comparing the output of runs or
+ * recording them. Read back and writing are done by s_frameCapture, in the
+ * background.
+ */
+static unsigned s_captureInterval = 0;  // 0 for none
+static bool s_captureImages = false;
+static CFrameCapture::Format s_captureFormat = CFrameCapture::Format::BMP;
+static uint64_t s_captureFrames = 0;
+static std::string s_captureBaseName;   // path and name prefix of images
+static FILE *s_captureHashFile = nullptr;
+static CModel3 *s_captureMemory = nullptr;  // if set, its memory is hashed with each frame (single-threaded only)
+
+static void StartFrameCapture(const std::string &baseName, unsigned interval, bool images, const std::string &format, CModel3 *memory)
 {
-  return true;
+  if (format == "png")
+    s_captureFormat = CFrameCapture::Format::PNG;
+  else if (format == "raw")
+    s_captureFormat = CFrameCapture::Format::Raw;
+  else if (format == "bmp")
+    s_captureFormat = CFrameCapture::Format::BMP;
+  else
+  {
+    ErrorLog("Unknown frame capture format '%s'. Use 'bmp', 'png' or 'raw'.", format.c_str());
+    return;
+  }
+
+  std::string file = baseName + "_frames.txt";
+  s_captureHashFile = fopen(file.c_str(), "w");
+  if (s_captureHashFile == nullptr)
+  {
+    ErrorLog("Unable to write frame hashes to '%s'.", file.c_str());
+    return;
+  }
+  s_captureBaseName = baseName;
+  s_captureInterval = interval;
+  s_captureImages = images;
+  s_captureFrames = 0;
+  s_captureMemory = memory;
+  InfoLog("Capturing every %u frames to '%s'.", interval, file.c_str());
+  if (images && s_captureFormat == CFrameCapture::Format::Raw)
+    InfoLog("Raw frames are %ux%u RGBA, written to '%s_frames.raw'.", totalXRes, totalYRes, baseName.c_str());
 }
 
-void EndFrameVideo()
+static void StopFrameCapture()
 {
-  // Show crosshairs for light gun games
-  if (videoInputs)
-    s_crosshair->Update(currentInputs, videoInputs, xOffset, yOffset, xRes, yRes);
-
-  // Swap the buffers
-  SDL_GL_SwapWindow(s_window);
+  s_frameCapture->Flush();
+  if (s_captureHashFile != nullptr)
+    fclose(s_captureHashFile);
+  s_captureHashFile = nullptr;
+  s_captureInterval = 0;
+  s_captureMemory = nullptr;
 }
 
+static void CaptureFrame(uint64_t frame)
+{
+  CFrameCapture::Request request;
+  request.format = s_captureFormat;
+  request.hashFile = s_captureHashFile;
+  request.frame = frame;
+  if (s_captureMemory != nullptr)
+  {
+    UINT32 ramHash, real3DHash, vramHash;
+    s_captureMemory->GetMemoryHashes(&ramHash, &real3DHash, &vramHash);
+    char hashes[64];
+    snprintf(hashes, sizeof(hashes), "ram=%08X real3d=%08X vram=%08X", ramHash, real3DHash, vramHash);
+    request.hashExtra = hashes;
+  }
+  if (s_captureImages)
+  {
+    switch (s_captureFormat)
+    {
+    case CFrameCapture::Format::BMP:
+      request.file = Util::Format() << s_captureBaseName << "_" << frame << ".bmp";
+      break;
+    case CFrameCapture::Format::PNG:
+      request.file = Util::Format() << s_captureBaseName << "_" << frame << ".png";
+      break;
+    case CFrameCapture::Format::Raw:
+      request.file = s_captureBaseName + "_frames.raw";
+      break;
+    }
+  }
+  s_frameCapture->Capture(request, totalXRes, totalYRes);
+}
 
-/******************************************************************************
- Frame Timing
-******************************************************************************/
-
-static uint64_t s_perfCounterFrequency = 0;
+/*
+ * Video recording: every frame is read back by s_frameCapture and passed,
+ * with the audio, to s_videoRecorder to encode.
+ */
+static CVideoRecorder *s_videoRecorder = nullptr;
 
-static uint64_t GetDesiredRefreshRateMilliHz()
+static void RecordAudio(void *data, const INT16 *samples, unsigned numSamples, unsigned numChannels)
 {
-  // The refresh rate is expressed as mHz (millihertz -- Hz * 1000) in order to
-  // be expressable as an integer. E.g.: 57.524 Hz -> 57524 mHz.
-  float refreshRateHz = std::abs(s_runtime_config["RefreshRate"].ValueAs<float>());
-  uint64_t refreshRateMilliHz = uint64_t(1000.0f * refreshRateHz);
-  return refreshRateMilliHz;
+  reinterpret_cast<CVideoRecorder *>(data)->AddAudio(samples, numSamples, numChannels);
 }
 
-static void SuperSleepUntil(uint64_t target)
+static void StartVideoRecording(const std::string &file, const std::string &encoderName, unsigned bitrate, unsigned refreshRateMilliHz)
 {
-  uint64_t time = SDL_GetPerformanceCounter();
-
-  // If we're ahead of the target, we're done
-  if (time > target)
+  IVideoEncoder *encoder = CreateVideoEncoder(encoderName, file, bitrate);
+  if (encoder == nullptr)
   {
+    ErrorLog("Unknown video encoder '%s'. Not recording video.", encoderName.c_str());
     return;
   }
-
-  // Compute the whole number of millis to sleep. Because OS sleep is not accurate,
-  // we actually sleep for one less and will spin-wait for the final millisecond.
-  int32_t numWholeMillisToSleep = int32_t((target - time) * 1000 / s_perfCounterFrequency);
-  numWholeMillisToSleep -= 1;
-  if (numWholeMillisToSleep > 0)
+  s_videoRecorder = new CVideoRecorder();
+  if (s_videoRecorder->Start(encoder, totalXRes, totalYRes, refreshRateMilliHz) != OKAY)
   {
-    SDL_Delay(numWholeMillisToSleep);
+    delete s_videoRecorder;
+    s_videoRecorder = nullptr;
+    return;
   }
-
-  // Spin until requested time
-  volatile uint64_t now;
-  int32_t remain;
-  do
-  {
-    now = SDL_GetPerformanceCounter();
-    remain = int32_t((target - now));
-  } while (remain>0);
+  SetAudioSink(RecordAudio, s_videoRecorder);
+  InfoLog("Recording video to '%s' with the '%s' encoder.", file.c_str(), encoderName.c_str());
 }
 
+static void StopVideoRecording()
+{
+  // Frames read back are flushed to the recorder by StopFrameCapture() first
+  if (s_videoRecorder == nullptr)
+    return;
+  SetAudioSink(NULL, NULL);
+  s_videoRecorder->Stop();
+  delete s_videoRecorder;
+  s_videoRecorder = nullptr;
+}
 
-/******************************************************************************
- Main Program Loop
-******************************************************************************/
+static void RecordFrame()
+{
+  CFrameCapture::Request request;
+  request.sink = [](const uint8_t *pixels, unsigned width, unsigned height)
+  {
+    s_videoRecorder->AddFrame(pixels, width, height);
+  };
+  s_frameCapture->Capture(request, totalXRes, totalYRes);
+}
 
-#ifdef SUPERMODEL_DEBUGGER
-int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *Inputs, COutputs *Outputs, std::shared_ptr<Debugger::CDebugger> Debugger)
+/*
+ * Presentation: when each frame was presented, for frame delay and the input
+ * latency shown with the frame rate, and the fences limiting how many frames
+ * the GPU may fall behind (see MaxFramesInFlight)
+ */
+static uint64_t s_presentMicros = 0;        // when the last swap returned
+static uint64_t s_swapMicros = 0;           // how long it took
+static unsigned s_maxFramesInFlight = 0;    // 0 leaves it to the driver
+static std::vector<GLsync> s_frameFences;   // frames being drawn, oldest first
+
+// Waits until fewer than s_maxFramesInFlight frames are still being drawn, so
+// that the next frame is at most that many ahead of the GPU
+static void LimitFramesInFlight()
+{
+  if (s_maxFramesInFlight == 0)
+    return;
+  s_frameFences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+  while (s_frameFences.size() >= s_maxFramesInFlight)
+  {
+    // Gives up after 100 ms, which only a stalled driver would take
+    glClientWaitSync(s_frameFences.front(), GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+    glDeleteSync(s_frameFences.front());
+    s_frameFences.erase(s_frameFences.begin());
+  }
+}
+
+bool BeginFrameVideo()
+{
+  return true;
+}
+
+void EndFrameVideo()
+{
+  // Show crosshairs for light gun games
+  if (videoInputs)
+    s_crosshair->Update(currentInputs, videoInputs, xOffset, yOffset, xRes, yRes);
+  if (s_statsOverlay)
+    s_statsOverlay->Draw(xOffset, yOffset, xRes, yRes);
+
+  // Read back the finished frame if capturing it or taking a screenshot
+  if (s_captureInterval > 0 && ++s_captureFrames % s_captureInterval == 0)
+    CaptureFrame(s_captureFrames);
+  if (!s_screenshotFile.empty())
+  {
+    SaveFrameBuffer(s_screenshotFile);
+    s_screenshotFile.clear();
+  }
+  if (s_videoRecorder != nullptr)
+    RecordFrame();
+
+  // Swap the buffers, or just wait for the frame to be drawn
+  uint64_t swapStart = CThread::GetMicroseconds();
+  if (s_presentFrames)
+    SDL_GL_SwapWindow(s_window);
+  else
+    glFinish();
+  LimitFramesInFlight();
+  s_presentMicros = CThread::GetMicroseconds();
+  s_swapMicros = s_presentMicros - swapStart;
+  GPUTimer::EndFrame();
+
+  // Hand frames read back earlier to be written
+  s_frameCapture->Update();
+}
+
+/*
+ * COSDHost:
+ *
+ * Hosts the emulator in this program's window: the video callbacks above and
+ * the OSD audio output.
+ */
+class COSDHost: public IEmulatorHost
+{
+public:
+  bool BeginFrameVideo(void) override
+  {
+    return ::BeginFrameVideo();
+  }
+
+  void EndFrameVideo(void) override
+  {
+    ::EndFrameVideo();
+  }
+
+  bool OutputAudio(unsigned numSamples, const float *leftFrontBuffer, const float *rightFrontBuffer,
+    const float *leftRearBuffer, const float *rightRearBuffer, bool flipStereo) override
+  {
+    return ::OutputAudio(numSamples, leftFrontBuffer, rightFrontBuffer, leftRearBuffer, rightRearBuffer, flipStereo);
+  }
+
+  void SetAudioCallback(AudioCallbackFPtr callback, void *data) override
+  {
+    ::SetAudioCallback(callback, data);
+  }
+
+  void GetAudioStats(AudioStats *stats) override
+  {
+    ::GetAudioStats(stats);
+  }
+};
+
+static COSDHost s_osdHost;
+
+
+/******************************************************************************
+ Frame Timing
+******************************************************************************/
+
+static uint64_t GetDesiredRefreshRateMilliHz()
+{
+  // The refresh rate is expressed as mHz (millihertz -- Hz * 1000) in order to
+  // be expressable as an integer. E.g.: 57.524 Hz -> 57524 mHz.
+  float refreshRateHz = std::abs(s_runtime_config["RefreshRate"].ValueAs<float>());
+  uint64_t refreshRateMilliHz = uint64_t(1000.0f * refreshRateHz);
+  return refreshRateMilliHz;
+}
+
+// How long before the target SuperSleepUntil() stops sleeping and spins,
+// calibrated from how late the OS wakes it
+static uint64_t s_sleepMarginMicros = 1000;
+
+// Saving power (see PowerSave): sleep instead of spinning, and present paused
+// frames only when they change
+static bool s_powerSave = false;
+
+// Set when the window has to be drawn again, such as once uncovered or resized
+static std::atomic<bool> s_windowChanged(true);
+
+static int SDLCALL WatchWindowEvents(void *userdata, SDL_Event *event)
+{
+  if (event->type == SDL_WINDOWEVENT)
+    s_windowChanged.store(true, std::memory_order_relaxed);
+  return 0;
+}
+
+// Waits until the given time in microseconds (see CThread::GetMicroseconds())
+static void SuperSleepUntil(uint64_t target)
+{
+  uint64_t time = CThread::GetMicroseconds();
+
+  // If we're ahead of the target, we're done
+  if (time >= target)
+  {
+    return;
+  }
+
+  // Saving power, sleep all the way, at the cost of waking a little late
+  if (s_powerSave)
+  {
+    CThread::SleepMicroseconds(target - time);
+    return;
+  }
+
+  // Sleep until the margin before the target. The margin follows the worst
+  // recent oversleep with some to spare, decaying slowly, so one late wake up
+  // costs a little more spinning for a while rather than a late frame.
+  if (target - time > s_sleepMarginMicros)
+  {
+    uint64_t wake = target - s_sleepMarginMicros;
+    CThread::SleepMicroseconds(wake - time);
+    uint64_t woke = CThread::GetMicroseconds();
+    uint64_t oversleep = woke > wake ? woke - wake : 0;
+    uint64_t margin = std::max(oversleep + oversleep / 4 + 50, s_sleepMarginMicros - s_sleepMarginMicros / 64);
+    s_sleepMarginMicros = std::min(std::max(margin, uint64_t(100)), uint64_t(4000));
+  }
+
+  // Spin until requested time
+  while (CThread::GetMicroseconds() < target)
+    ;
+}
+
+// When the next frame is due, given when the last was: a frame later, so
+// frames keep to the refresh rate on average, unless that is already past
+// (the emulator fell behind or was held up), when the schedule restarts from
+// now rather than hurrying through frames to catch up
+static uint64_t NextFrameTime(uint64_t due, uint64_t microsPerFrame)
+{
+  uint64_t now = CThread::GetMicroseconds();
+  return due + microsPerFrame > now ? due + microsPerFrame : now + microsPerFrame;
+}
+
+// Minimum, total and maximum of a time over the frames since the frame rate
+// was last shown
+struct RollingTime
+{
+  uint64_t minMicros = UINT64_MAX;
+  uint64_t totalMicros = 0;
+  uint64_t maxMicros = 0;
+
+  void Add(uint64_t micros)
+  {
+    minMicros = std::min(minMicros, micros);
+    totalMicros += micros;
+    maxMicros = std::max(maxMicros, micros);
+  }
+};
+
+
+/******************************************************************************
+ Main Program Loop
+******************************************************************************/
+
+#ifdef SUPERMODEL_DEBUGGER
+int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *Inputs, COutputs *Outputs, std::shared_ptr<Debugger::CDebugger> Debugger)
 {
   std::shared_ptr<CLogger> oldLogger;
 #else
@@ -880,26 +1591,83 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 {
 #endif // SUPERMODEL_DEBUGGER
   std::string initialState = s_runtime_config["InitStateFile"].ValueAs<std::string>();
-  uint64_t    prevFPSTicks;
+  std::string midiRecording = s_runtime_config["RecordMIDIFile"].ValueAs<std::string>();
+  std::string inputRecordingFile = s_runtime_config["RecordInputsFile"].ValueAs<std::string>();
+  std::string inputReplayFile = s_runtime_config["ReplayInputsFile"].ValueAs<std::string>();
+  CInputRecording inputRecording;
+  bool        recordingInputs = false;
+  bool        replayingInputs = false;
+  CModel3     *rewinder = nullptr;
+  unsigned    benchmarkFrames = s_runtime_config["BenchmarkFrames"].ValueAs<unsigned>();
+  std::vector<FrameTimings> benchmarkTimings;
+  uint64_t    benchmarkStart = 0;
+  uint64_t    benchmarkEnd = 0;
+  double      traceSeconds = s_runtime_config["TraceSeconds"].ValueAs<double>();
+  bool        execTrace = s_runtime_config["ExecTraceSize"].ValueAs<unsigned>() > 0;
+  std::string traceFile;
+  uint64_t    prevFPSMicros;
   unsigned    fpsFramesElapsed;
+  unsigned    fpsTimedFrames = 0;
+  RollingTime fpsBusy[4];                        // PPC, render, sound, and drive board thread time
+  RollingTime fpsWait[4];                        // main, PPC, sound and drive board thread frame sync wait
+  RollingTime fpsSync;                           // snapshot sync
+  uint64_t    fpsSyncBytes = 0;
+  unsigned    fpsSkipped = 0;                    // frames skipped for falling behind since the last update
+  RollingTime fpsInterval;                       // time from one frame to the next
+  RollingTime fpsLatency;                        // time from polling inputs to presenting the frame they made
+  unsigned    fpsLatencyFrames = 0;
+  double      fpsIntervalSquares = 0;            // sum of squared intervals, in ms
+  unsigned    fpsIntervals = 0;
+  uint64_t    fpsLastMicros = 0;
+  std::unique_ptr<CMetricsExporter> metrics;     // if exporting metrics
+  uint64_t    metricsLastMicros = 0;             // when the last frame was counted by it
+  uint64_t    fpsCPUMicros = 0;                  // process CPU time at the last update
+  uint64_t    startCPUMicros = 0;                // and when emulation started
+  AudioStats  fpsAudioStats = {};                // audio buffer counts at the last update
+#ifdef NET_BOARD
+  NetLinkStats fpsNetStats;                      // net link stats at the last update
+  unsigned    fpsRollbacks = 0;                  // net board rollbacks since the last update
+  unsigned    fpsRollbackFrames = 0;             // most frames run again by one of them
+  uint64_t    fpsRollbackMicros = 0;
+#endif
   bool        gameHasLightguns = false;
   bool        quit = false;
   bool        paused = false;
+  bool        pausedRedraw = false;              // paused frame must be presented again when saving power
   bool        dumpTimings = false;
+  bool        lateInputSampling = s_runtime_config["LateInputSampling"].ValueAs<bool>();
+  bool        frameDelay = s_runtime_config["FrameDelay"].ValueAs<bool>() && s_runtime_config["VSync"].ValueAs<bool>() && s_presentFrames;
+  uint64_t    frameDelayStart = 0;               // when the frame delay last ended
+  uint64_t    frameWorkMicros = 0;               // longest recent time from then to the end of the swap, less its wait
+  bool        startupProfile = s_runtime_config["StartupProfile"].ValueAs<bool>();
+  Util::Config::CachedValue<bool> throttle(s_runtime_config, "Throttle");  // read each frame
+  Util::Config::CachedValue<bool> showFrameRate(s_runtime_config, "ShowFrameRate");
+
+  // Fast-forwarding runs unthrottled, showing one frame in every
+  // FastForwardInterval, up to TurboToFrame and while the key is held
+  unsigned    turboToFrame = s_runtime_config["TurboToFrame"].ValueAs<unsigned>();
+  unsigned    fastForwardInterval = std::max(1u, s_runtime_config["FastForwardInterval"].ValueAs<unsigned>());
+  unsigned    nvramCheckpointFrames = benchmarkFrames > 0 ? 0 : unsigned(s_runtime_config["NVRAMCheckpointInterval"].ValueAs<float>() * 57.524160f + 0.5f);
+  unsigned    nvramCheckpointFrame = 0;
+  unsigned    framesRun = 0;
+  bool        fastForward = false;
+  bool        turboBooting = false;              // emulator is turbo booting, unthrottled (see TurboBoot)
 
   // Initialize and load ROMs
   if (OKAY != Model3->Init())
     return 1;
+  MarkStartupPhase("Emulator initialization");
   if (Model3->LoadGame(game, *rom_set))
     return 1;
   *rom_set = ROMSet();  // free up this memory we won't need anymore
+  MarkStartupPhase("Game loading");
 
   // Load NVRAM
   LoadNVRAM(Model3);
 
   // Set the video mode
   char baseTitleStr[128];
-  char titleStr[128];
+  char titleStr[512];
   totalXRes = xRes = s_runtime_config["XResolution"].ValueAs<unsigned>();
   totalYRes = yRes = s_runtime_config["YResolution"].ValueAs<unsigned>();
   sprintf(baseTitleStr, "Supermodel - %s", game.title.c_str());
@@ -925,10 +1693,19 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   // Info log GL information
   PrintGLInfo(false, true, false);
 
-  // Initialize audio system
+  // Frames are not shown when benchmarking without presenting them
+  if (benchmarkFrames > 0 && !s_runtime_config["BenchmarkPresent"].ValueAs<bool>())
+  {
+    s_presentFrames = false;
+    SDL_HideWindow(s_window);
+  }
+
+  // Initialize audio system, without a device when benchmarking or headless
   SetAudioType(game.audio);
+  SetAudioHeadless(benchmarkFrames > 0 || s_headless);
   if (OKAY != OpenAudio(s_runtime_config))
     return 1;
+  MarkStartupPhase("Video mode and audio");
 
   // Hide mouse if fullscreen, enable crosshairs for gun games
   Inputs->GetInputSystem()->SetMouseVisibility(!s_runtime_config["FullScreen"].ValueAs<bool>());
@@ -946,11 +1723,19 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   // Attach the outputs to the emulator
   if (Outputs != NULL)
     Model3->AttachOutputs(Outputs);
+  Model3->AttachHost(&s_osdHost);
 
   // Frame timing
-  s_perfCounterFrequency = SDL_GetPerformanceFrequency();
-  uint64_t perfCountPerFrame = s_perfCounterFrequency * 1000 / GetDesiredRefreshRateMilliHz();
+  uint64_t microsPerFrame = 1000000000 / GetDesiredRefreshRateMilliHz();
   uint64_t nextTime = 0;
+  if (s_runtime_config["FrameDelay"].ValueAs<bool>() && !frameDelay)
+    InfoLog("Frame delay requires VSync and is disabled.");
+  s_maxFramesInFlight = std::min(s_runtime_config["MaxFramesInFlight"].ValueAs<unsigned>(), 3u);
+  if (s_maxFramesInFlight > 0 && !GLEW_VERSION_3_2 && !GLEW_ARB_sync)
+  {
+    InfoLog("GPU fences are not supported, so MaxFramesInFlight is ignored.");
+    s_maxFramesInFlight = 0;
+  }
 
   // Initialize the renderers
   CRender2D *Render2D = new CRender2D(s_runtime_config);
@@ -960,14 +1745,82 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   if (OKAY != Render3D->Init(xOffset, yOffset, xRes, yRes, totalXRes, totalYRes))
     goto QuitError;
   Model3->AttachRenderers(Render2D,Render3D);
+  MarkStartupPhase("Renderer initialization");
+
+  // GPU time of each render stage, if requested
+  if (s_runtime_config["GPUTimings"].ValueAs<bool>())
+  {
+    std::string file = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << Model3->GetGame().name << "_gpu_timings.csv";
+    GPUTimer::Enable(true, file);
+  }
+
+  // Export performance metrics if requested
+  if (!s_runtime_config["MetricsAddress"].ValueAs<std::string>().empty())
+  {
+    std::string address = s_runtime_config["MetricsAddress"].ValueAs<std::string>();
+    unsigned port = s_runtime_config["MetricsPort"].ValueAs<unsigned>();
+    OutputStream::Stream *stream = OutputStream::OpenUDP(address, port);
+    if (stream == nullptr)
+      ErrorLog("Unable to send metrics to %s:%u.", address.c_str(), port);
+    else
+    {
+      std::string prefix = Util::Format() << s_runtime_config["MetricsPrefix"].ValueAs<std::string>() << '.' << Model3->GetGame().name;
+      metrics.reset(new CMetricsExporter(stream, prefix, s_runtime_config["MetricsInterval"].ValueAs<unsigned>()));
+    }
+  }
+
+  // Capture frames if requested
+  if (s_runtime_config["CaptureInterval"].ValueAs<unsigned>() > 0)
+  {
+    std::string baseName = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << Model3->GetGame().name;
+    CModel3 *memory = s_runtime_config["CaptureMemory"].ValueAs<bool>() ? dynamic_cast<CModel3 *>(Model3) : nullptr;
+    StartFrameCapture(baseName, s_runtime_config["CaptureInterval"].ValueAs<unsigned>(), s_runtime_config["CaptureImages"].ValueAs<bool>(), s_runtime_config["CaptureFormat"].ValueAs<std::string>(), memory);
+  }
+
+  // Record video if requested
+  if (!s_runtime_config["RecordVideoFile"].ValueAs<std::string>().empty())
+    StartVideoRecording(s_runtime_config["RecordVideoFile"].ValueAs<std::string>(), s_runtime_config["RecordVideoEncoder"].ValueAs<std::string>(), s_runtime_config["RecordVideoBitrate"].ValueAs<unsigned>(), unsigned(GetDesiredRefreshRateMilliHz()));
+
+  // Record a timeline of each thread's work if requested
+  if (traceSeconds > 0)
+  {
+    traceFile = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << Model3->GetGame().name << "_trace.json";
+    Trace::SetThreadName("Main");
+    Trace::Enable(true);
+  }
 
   // Reset emulator
   Model3->Reset();
 
+  // Record sound board MIDI port from reset if requested
+  if (!midiRecording.empty())
+  {
+    CModel3 *model3 = dynamic_cast<CModel3 *>(Model3);
+    if (model3 != nullptr)
+      model3->GetSoundBoard()->StartMIDIRecording(midiRecording, game.name);
+  }
+
   // Load initial save state if requested
   if (initialState.length() > 0)
     LoadState(Model3, initialState);
 
+  // Record or replay inputs from here on
+  if (!inputReplayFile.empty())
+  {
+    if (OKAY != StartInputReplay(Model3, Inputs, &inputRecording, inputReplayFile))
+      goto QuitError;
+    replayingInputs = true;
+  }
+  else if (!inputRecordingFile.empty())
+  {
+    StartInputRecording(Model3, Inputs, &inputRecording);
+    recordingInputs = true;
+  }
+
+  // Frames are kept for rewinding by the emulator itself
+  if (s_runtime_config["RewindFrames"].ValueAs<unsigned>() > 0)
+    rewinder = dynamic_cast<CModel3 *>(Model3);
+
 #ifdef SUPERMODEL_DEBUGGER
   // If debugger was supplied, set it as logger and attach it to system
   oldLogger = GetLogger();
@@ -980,7 +1833,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
   // Emulate!
   fpsFramesElapsed = 0;
-  prevFPSTicks = SDL_GetPerformanceCounter();
+  prevFPSMicros = CThread::GetMicroseconds();
   quit = false;
   paused = false;
   dumpTimings = false;
@@ -991,13 +1844,118 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
     quit = true;
   }
 #endif
+  MarkStartupPhase("Reset and initial state");
+  StartROMVerification();
+  s_powerSave = s_runtime_config["PowerSave"].ValueAs<bool>();
+  CThread::SetPowerSaving(s_powerSave);
+  if (s_powerSave)
+    SDL_AddEventWatch(WatchWindowEvents, nullptr);
+  fpsCPUMicros = startCPUMicros = CThread::GetProcessCPUMicroseconds();
+  benchmarkStart = CThread::GetMicroseconds();
   while (!quit)
   {
-    // Render if paused, otherwise run a frame
-    if (paused)
-      Model3->RenderFrame();
+    // Render if paused, otherwise run a frame. Holding the rewind key steps
+    // back a frame at a time instead, or one frame per press when paused.
+    bool rewind = rewinder != nullptr && (paused ? Inputs->uiRewind->Pressed() : Inputs->uiRewind->value != 0);
+    if (rewind)
+    {
+      if (!rewinder->StepBack())
+        Model3->RenderFrame();
+    }
+    else if (paused)
+    {
+      // Saving power, the paused frame is presented again only once it has
+      // changed
+      bool windowChanged = s_windowChanged.exchange(false, std::memory_order_relaxed);
+      if (!s_powerSave || pausedRedraw || windowChanged || !s_screenshotFile.empty())
+        Model3->RenderFrame();
+      pausedRedraw = false;
+    }
     else
+    {
+      if (recordingInputs)
+        inputRecording.RecordFrame();
+      else if (replayingInputs && !inputRecording.ReplayFrame())
+      {
+        InfoLog("Input replay finished after %u frames.", inputRecording.GetFrame());
+        replayingInputs = false;
+      }
+      // Tell the emulator when fast-forwarding starts or stops
+      bool turbo = framesRun < turboToFrame || Inputs->uiFastForward->value != 0;
+      if (turbo != fastForward)
+      {
+        CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+        if (M != nullptr)
+          M->SetFastForward(turbo ? fastForwardInterval : 0);
+        if (!turbo && framesRun == turboToFrame)
+          InfoLog("Fast-forwarded to frame %u.", turboToFrame);
+        fastForward = turbo;
+      }
       Model3->RunFrame();
+      framesRun++;
+
+      // Frame delay: how long the frame took to emulate and present, less the
+      // swap's wait for the vertical blank, following the longest recent one
+      // and decaying slowly
+      if (frameDelay && frameDelayStart != 0 && s_presentMicros > frameDelayStart)
+      {
+        uint64_t work = s_presentMicros - frameDelayStart;
+        work -= std::min(work, s_swapMicros);
+        frameWorkMicros = std::max(work + work / 8, frameWorkMicros - frameWorkMicros / 64);
+      }
+      CModel3 *booting = dynamic_cast<CModel3 *>(Model3);
+      turboBooting = booting != nullptr && booting->IsTurboBooting();
+
+      // Collect the timings of each frame emulated when benchmarking, until
+      // the number requested
+      if (benchmarkFrames > 0)
+      {
+        CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+        if (M != nullptr)
+          benchmarkTimings.push_back(M->GetTimings());
+        if (benchmarkTimings.size() >= benchmarkFrames || M == nullptr)
+        {
+          benchmarkEnd = CThread::GetMicroseconds();
+          quit = true;
+        }
+      }
+
+      // Startup ends with the first frame
+      if (startupProfile)
+      {
+        MarkStartupPhase("First frame");
+        LogStartupProfile();
+        startupProfile = false;
+      }
+
+      // Checkpoint NVRAM every so often
+      if (nvramCheckpointFrames > 0 && ++nvramCheckpointFrame >= nvramCheckpointFrames && CheckpointNVRAM(Model3))
+        nvramCheckpointFrame = 0;
+    }
+
+    // Hand this frame's output changes to the outputs' delivery thread
+    if (Outputs != NULL)
+      Outputs->EndFrame();
+
+    // With frame delay, the inputs are polled and the frame run as late as
+    // possible for it to be ready at the next vertical blank: a frame after
+    // the last swap returned, at one, less the longest recent frame and a
+    // millisecond to spare. VSync then limits the frame rate.
+    bool delayFrame = frameDelay && !paused && throttle.Get() && !fastForward && !turboBooting;
+    if (delayFrame)
+    {
+      uint64_t vblank = s_presentMicros + microsPerFrame;
+      SuperSleepUntil(vblank - std::min(vblank, frameWorkMicros + 1000));
+      frameDelayStart = CThread::GetMicroseconds();
+    }
+
+    // With late input sampling, frame limiting happens before the inputs are
+    // polled rather than after, so that the next frame starts right after
+    else if (lateInputSampling && (paused || (throttle.Get() && !fastForward && !turboBooting)))
+    {
+        SuperSleepUntil(nextTime);
+        nextTime = NextFrameTime(nextTime, microsPerFrame);
+    }
 
     // Poll the inputs
     if (!Inputs->Poll(&game, xOffset, yOffset, xRes, yRes))
@@ -1041,6 +1999,12 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
       // Reset emulator
       Model3->Reset();
+      pausedRedraw = true;
+
+      // Inputs recorded or replayed from the previous state no longer apply
+      if (recordingInputs)
+        SaveInputRecording(inputRecording, inputRecordingFile);
+      recordingInputs = replayingInputs = false;
 
 #ifdef SUPERMODEL_DEBUGGER
       // If debugger was supplied, reset it too
@@ -1060,6 +2024,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
     {
       // Toggle emulator paused flag
       paused = !paused;
+      pausedRedraw = true;
 
       if (paused)
       {
@@ -1108,6 +2073,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
       Model3->AttachRenderers(Render2D,Render3D);
 
       Render3D->UploadTextures(0, 0, 0, 2048, 2048);    // sync texture memory
+      pausedRedraw = true;
 
       Inputs->GetInputSystem()->SetMouseVisibility(!s_runtime_config["FullScreen"].ValueAs<bool>());
     }
@@ -1145,6 +2111,10 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
       // Load game state
       LoadState(Model3);
+      pausedRedraw = true;
+      if (recordingInputs)
+        SaveInputRecording(inputRecording, inputRecordingFile);
+      recordingInputs = replayingInputs = false;
 
 #ifdef SUPERMODEL_DEBUGGER
       // If debugger was supplied, reset it after loading state
@@ -1223,6 +2193,18 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
       dumpTimings = !dumpTimings;
     }
 #endif
+    else if (Inputs->uiDumpTrace->Pressed() && (traceSeconds > 0 || execTrace))
+    {
+      // Write the timeline of the last few seconds and the execution traces
+      if (!paused)
+        Model3->PauseThreads();
+      if (traceSeconds > 0)
+        Trace::Write(traceFile, traceSeconds);
+      if (execTrace)
+        DumpExecTraces(Model3);
+      if (!paused)
+        Model3->ResumeThreads();
+    }
     else if (Inputs->uiSelectCrosshairs->Pressed() && gameHasLightguns)
     {
       int crosshairs = (s_runtime_config["Crosshairs"].ValueAs<unsigned>() + 1) & 3;
@@ -1234,6 +2216,7 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
       case 1: puts("Showing Player 1 crosshair only."); break;
       case 2: puts("Showing Player 2 crosshair only."); break;
       }
+      pausedRedraw = true;
     }
     else if (Inputs->uiClearNVRAM->Pressed())
     {
@@ -1252,6 +2235,19 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
       // Make a screenshot
       Screenshot();
     }
+#ifdef PPC_PROFILE
+    else if (Inputs->uiDumpPPCProfile->Pressed())
+    {
+      if (!paused)
+        Model3->PauseThreads();
+
+      // Write PowerPC profile
+      DumpPPCProfile(Model3);
+
+      if (!paused)
+        Model3->ResumeThreads();
+    }
+#endif
 #ifdef SUPERMODEL_DEBUGGER
       else if (Debugger != NULL && Inputs->uiEnterDebugger->Pressed())
       {
@@ -1262,25 +2258,196 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 #endif // SUPERMODEL_DEBUGGER
 
     // Refresh rate (frame limiting)
-    if (paused || s_runtime_config["Throttle"].ValueAs<bool>())
+    if (!lateInputSampling && !delayFrame && (paused || (throttle.Get() && !fastForward && !turboBooting)))
     {
         SuperSleepUntil(nextTime);
-        nextTime = SDL_GetPerformanceCounter() + perfCountPerFrame;
+        nextTime = NextFrameTime(nextTime, microsPerFrame);
+    }
+
+    // Warn of bad ROM files on the overlay, creating it for the warning alone
+    // if the frame rate isn't shown
+    if (!s_romVerification.reported && s_romVerification.done.load(std::memory_order_acquire))
+    {
+      s_romVerification.reported = true;
+      if (!s_romVerification.warning.empty() && !showFrameRate.Get() && s_statsOverlay == nullptr)
+      {
+        s_statsOverlay = new CStatsOverlay();
+        if (s_statsOverlay->Init() == OKAY)
+          s_statsOverlay->SetText(s_romVerification.warning);
+        else
+        {
+          delete s_statsOverlay;
+          s_statsOverlay = nullptr;
+        }
+      }
     }
 
     // Measure frame rate
-    uint64_t currentFPSTicks = SDL_GetPerformanceCounter();
-    if (s_runtime_config["ShowFrameRate"].ValueAs<bool>())
+    uint64_t currentFPSMicros = CThread::GetMicroseconds();
+    if (metrics != nullptr && !paused)
+    {
+      CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+      if (M && metricsLastMicros != 0)
+        metrics->AddFrame(M->GetTimings(), currentFPSMicros - metricsLastMicros);
+      metricsLastMicros = currentFPSMicros;
+#ifdef NET_BOARD
+      // The net link's stats are read about once a second
+      NetLinkStats netStats;
+      if (M && framesRun % 60 == 0 && M->GetNetBoard()->IsRunning() && M->GetNetBoard()->GetLinkStats(&netStats))
+        metrics->SetNetStats(netStats.rttMicros, netStats.jitterMicros, netStats.Stalls());
+#endif
+    }
+    if (showFrameRate.Get())
     {
       fpsFramesElapsed += 1;
-      uint64_t measurementTicks = currentFPSTicks - prevFPSTicks;
-      if (measurementTicks >= s_perfCounterFrequency) // update FPS every 1 second (s_perfCounterFrequency is how many perf ticks in one second)
+      if (fpsLastMicros != 0)
       {
-        float fps = float(fpsFramesElapsed) / (float(measurementTicks) / float(s_perfCounterFrequency));
-        sprintf(titleStr, "%s - %1.3f FPS%s", baseTitleStr, fps, paused ? " (Paused)" : "");
-        SDL_SetWindowTitle(s_window, titleStr);
-        prevFPSTicks = currentFPSTicks;   // reset tick count
+        uint64_t interval = currentFPSMicros - fpsLastMicros;
+        fpsInterval.Add(interval);
+        fpsIntervalSquares += (interval / 1000.0) * (interval / 1000.0);
+        fpsIntervals++;
+      }
+      fpsLastMicros = currentFPSMicros;
+      CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+      if (M && !paused)
+      {
+        FrameTimings timings = M->GetTimings();
+        fpsBusy[0].Add(timings.ppcMicros);
+        fpsBusy[1].Add(timings.renderMicros);
+        fpsBusy[2].Add(timings.sndMicros);
+        fpsBusy[3].Add(timings.drvMicros);
+        fpsWait[0].Add(timings.mainWaitMicros);
+        fpsWait[1].Add(timings.ppcWaitMicros);
+        fpsWait[2].Add(timings.sndWaitMicros);
+        fpsWait[3].Add(timings.drvWaitMicros);
+        fpsSync.Add(timings.syncMicros);
+        fpsSyncBytes += timings.syncSize;
+        if (timings.renderSkipped)
+          fpsSkipped++;
+        if (timings.renderPollMicros != 0 && s_presentMicros > timings.renderPollMicros)
+        {
+          fpsLatency.Add(s_presentMicros - timings.renderPollMicros);
+          fpsLatencyFrames++;
+        }
+#ifdef NET_BOARD
+        if (timings.rollbackFrames > 0)
+        {
+          fpsRollbacks++;
+          fpsRollbackFrames = std::max(fpsRollbackFrames, unsigned(timings.rollbackFrames));
+          fpsRollbackMicros += timings.rollbackMicros;
+        }
+#endif
+        fpsTimedFrames++;
+      }
+      uint64_t measurementMicros = currentFPSMicros - prevFPSMicros;
+      if (measurementMicros >= 1000000) // update FPS every 1 second
+      {
+        float seconds = float(measurementMicros) / 1e6f;
+        float fps = float(fpsFramesElapsed) / seconds;
+        Util::Format stats;
+        stats.Printf("%1.3f FPS%s", fps, paused ? " (Paused)" : "");
+        // Process CPU time, in cores busy, to size hardware by
+        uint64_t cpuMicros = CThread::GetProcessCPUMicroseconds();
+        if (cpuMicros != 0)
+          stats.Printf(", CPU %1.0f%%", 100.0 * double(cpuMicros - fpsCPUMicros) / double(measurementMicros));
+        fpsCPUMicros = cpuMicros;
+        if (fpsSkipped > 0)
+          stats.Printf(", %u skipped", fpsSkipped);
+        // Frame pacing: the average time between frames, its standard
+        // deviation, and the longest
+        if (fpsIntervals > 0)
+        {
+          double mean = fpsInterval.totalMicros / 1000.0 / fpsIntervals;
+          double variance = std::max(0.0, fpsIntervalSquares / fpsIntervals - mean * mean);
+          stats.Printf("\nframe time %1.2fms, deviation %1.2fms, max %1.2fms", mean, std::sqrt(variance), fpsInterval.maxMicros / 1000.0);
+        }
+        // Minimum/average/maximum time from polling the inputs to presenting
+        // the frame emulated with them
+        if (fpsLatencyFrames > 0)
+        {
+          stats.Printf("\ninput latency %1.1f/%1.1f/%1.1fms", fpsLatency.minMicros / 1000.0,
+            fpsLatency.totalMicros / 1000.0 / fpsLatencyFrames, fpsLatency.maxMicros / 1000.0);
+        }
+        // Minimum/average/maximum time each thread spent working, the average
+        // time it waited for the others at the end of the frame, and the
+        // snapshot sync
+        if (M && fpsTimedFrames > 0)
+        {
+          static const char *names[4] = { "PPC", "render", "sound", "drive" };
+          for (int i = 0; i < 4; i++)
+          {
+            stats.Printf("\n%-6s %1.1f/%1.1f/%1.1fms", names[i],
+              fpsBusy[i].minMicros / 1000.0, fpsBusy[i].totalMicros / 1000.0 / fpsTimedFrames, fpsBusy[i].maxMicros / 1000.0);
+          }
+          stats.Printf("\nwait main %1.1fms, PPC %1.1fms, sound %1.1fms, drive %1.1fms",
+            fpsWait[0].totalMicros / 1000.0 / fpsTimedFrames, fpsWait[1].totalMicros / 1000.0 / fpsTimedFrames,
+            fpsWait[2].totalMicros / 1000.0 / fpsTimedFrames, fpsWait[3].totalMicros / 1000.0 / fpsTimedFrames);
+          stats.Printf("\nsync %u KB, %1.1fms", unsigned(fpsSyncBytes / fpsTimedFrames / 1024), fpsSync.totalMicros / 1000.0 / fpsTimedFrames);
+        }
+        // Audio buffer fill level and under-/over-runs since the last update
+        AudioStats audioStats;
+        GetAudioStats(&audioStats);
+        stats.Printf("\naudio %1.0f%%, %u/%u under/over-runs", audioStats.fillLevel * 100.0f,
+          audioStats.underRuns - fpsAudioStats.underRuns, audioStats.overRuns - fpsAudioStats.overRuns);
+        fpsAudioStats = audioStats;
+#ifdef NET_BOARD
+        // Net link round trip, jitter, queue depth and frames stalled since the last update
+        NetLinkStats netStats;
+        if (M && M->GetNetBoard()->IsRunning() && M->GetNetBoard()->GetLinkStats(&netStats) && netStats.frames > 0)
+        {
+          stats.Printf("\nnet RTT %1.1fms, jitter %1.1fms, queue %u, %u stalls", netStats.rttMicros / 1000.0,
+            netStats.jitterMicros / 1000.0, netStats.queueDepth, unsigned(netStats.Stalls() - std::min(netStats.Stalls(), fpsNetStats.Stalls())));
+          fpsNetStats = netStats;
+        }
+        // Rollbacks, the most frames run again by one, and the time spent running them
+        if (s_runtime_config["NetRollback"].ValueAs<unsigned>() > 0 && M && M->GetNetBoard()->IsRunning())
+          stats.Printf("\n%u rollbacks of up to %u frames, %1.1fms", fpsRollbacks, fpsRollbackFrames, fpsRollbackMicros / 1000.0);
+        fpsRollbacks = 0;
+        fpsRollbackFrames = 0;
+        fpsRollbackMicros = 0;
+#endif
+        // GPU time per frame of the 2D layers, the 3D scene and New3D's compositing
+        double gpuMs[GPUTimer::NumStages];
+        if (GPUTimer::GetAverages(gpuMs))
+        {
+          double scene = gpuMs[GPUTimer::ScrollFog];
+          for (int i = GPUTimer::Scene; i < GPUTimer::Composite; i++)
+            scene += gpuMs[i];
+          double total = 0;
+          for (int i = 0; i < GPUTimer::NumStages; i++)
+            total += gpuMs[i];
+          stats.Printf("\nGPU 2D %1.1fms, 3D %1.1fms, composite %1.1fms, %1.0f%% busy",
+            gpuMs[GPUTimer::Render2DBottom] + gpuMs[GPUTimer::Render2DTop], scene, gpuMs[GPUTimer::Composite], std::min(100.0, total * fps / 10.0));
+        }
+        if (s_romVerification.reported && !s_romVerification.warning.empty())
+          stats.Printf("\n%s", s_romVerification.warning.c_str());
+        pausedRedraw = true;
+        if (s_statsOverlay != nullptr)
+          s_statsOverlay->SetText(stats);
+        else
+        {
+          // All on one line of the title bar
+          int len = snprintf(titleStr, sizeof(titleStr), "%s", baseTitleStr);
+          for (const std::string &line : stats.Split('\n'))
+          {
+            if (len > 0 && size_t(len) < sizeof(titleStr))
+              len += snprintf(titleStr + len, sizeof(titleStr) - len, " - %s", line.c_str());
+          }
+          SDL_SetWindowTitle(s_window, titleStr);
+        }
+        prevFPSMicros = currentFPSMicros; // reset time
         fpsFramesElapsed = 0;             // reset frame count
+        fpsTimedFrames = 0;
+        for (int i = 0; i < 4; i++)
+          fpsBusy[i] = fpsWait[i] = RollingTime();
+        fpsSync = RollingTime();
+        fpsSyncBytes = 0;
+        fpsSkipped = 0;
+        fpsInterval = RollingTime();
+        fpsLatency = RollingTime();
+        fpsLatencyFrames = 0;
+        fpsIntervalSquares = 0;
+        fpsIntervals = 0;
       }
     }
 
@@ -1294,6 +2461,45 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
   // Make sure all threads are paused before shutting down
   Model3->PauseThreads();
+  if (s_powerSave)
+    SDL_DelEventWatch(WatchWindowEvents, nullptr);
+  CThread::SetPowerSaving(false);
+
+  // CPU use over the whole run, in cores busy
+  {
+    uint64_t runMicros = CThread::GetMicroseconds() - benchmarkStart;
+    uint64_t runCPUMicros = CThread::GetProcessCPUMicroseconds();
+    if (runCPUMicros != 0 && runMicros > 0)
+      InfoLog("CPU use averaged %1.0f%% of a core over %1.0f seconds.", 100.0 * double(runCPUMicros - startCPUMicros) / double(runMicros), runMicros / 1e6);
+  }
+
+  // Write the timeline of the last few seconds
+  if (traceSeconds > 0)
+  {
+    Trace::Write(traceFile, traceSeconds);
+    Trace::Enable(false);
+  }
+
+  // Log frame time histograms
+  {
+    CModel3 *M = dynamic_cast<CModel3 *>(Model3);
+    if (M)
+      M->LogFrameStats();
+  }
+
+  // Report benchmark, including frames run if it was quit early
+  if (benchmarkFrames > 0)
+  {
+    if (benchmarkEnd == 0)
+      benchmarkEnd = CThread::GetMicroseconds();
+    double seconds = double(benchmarkEnd - benchmarkStart) / 1e6;
+    WriteBenchmarkReport(s_runtime_config["BenchmarkFile"].ValueAs<std::string>(), Model3, benchmarkTimings, seconds);
+  }
+
+#ifdef PPC_PROFILE
+  // Write PowerPC profile (while debugger, if any, can still provide labels)
+  DumpPPCProfile(Model3);
+#endif
 
 #ifdef SUPERMODEL_DEBUGGER
   // If debugger was supplied, detach it from system and restore old logger
@@ -1304,13 +2510,21 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
   }
 #endif // SUPERMODEL_DEBUGGER
 
-  // Save NVRAM
-  SaveNVRAM(Model3);
+  // Finish writing save state and input recording, and save NVRAM
+  WaitForSaveState();
+  if (recordingInputs)
+    SaveInputRecording(inputRecording, inputRecordingFile);
+  if (benchmarkFrames == 0)
+    SaveNVRAM(Model3);
 
-  // Close audio
+  // Close audio, once metrics are no longer read from it
+  metrics.reset();
   CloseAudio();
 
   // Shut down renderers
+  StopFrameCapture();
+  StopVideoRecording();
+  GPUTimer::Enable(false, "");
   delete Render2D;
   delete Render3D;
 
@@ -1318,30 +2532,147 @@ int Supermodel(const Game &game, ROMSet *rom_set, IEmulator *Model3, CInputs *In
 
   // Quit with an error
 QuitError:
+  WaitForNVRAMCheckpoint();
+  StopFrameCapture();
+  StopVideoRecording();
+  GPUTimer::Enable(false, "");
   delete Render2D;
   delete Render3D;
   return 1;
 }
 
 
+/******************************************************************************
+ Sound Board Playback
+******************************************************************************/
+
+// Writes the header of a 4-channel 32-bit float WAV file at 44.1 KHz
+static void WriteWAVHeader(FILE *fp, uint32_t numSamples)
+{
+  auto put16 = [fp](uint16_t v) { uint8_t b[2] = { uint8_t(v), uint8_t(v >> 8) }; fwrite(b, sizeof(b), 1, fp); };
+  auto put32 = [fp](uint32_t v) { uint8_t b[4] = { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) }; fwrite(b, sizeof(b), 1, fp); };
+  const uint32_t blockAlign = 4 * sizeof(float);
+  const uint32_t dataSize = numSamples * blockAlign;
+
+  fwrite("RIFF", 4, 1, fp);
+  put32(4 + (8 + 18) + (8 + 4) + (8 + dataSize));
+  fwrite("WAVE", 4, 1, fp);
+  fwrite("fmt ", 4, 1, fp);
+  put32(18);
+  put16(3);                 // IEEE float
+  put16(4);                 // channels
+  put32(44100);             // sample rate
+  put32(44100 * blockAlign);
+  put16(blockAlign);
+  put16(32);                // bits per sample
+  put16(0);
+  fwrite("fact", 4, 1, fp);
+  put32(4);
+  put32(numSamples);
+  fwrite("data", 4, 1, fp);
+  put32(dataSize);
+}
+
+/*
+ * ReplayMIDI(game, rom_set, Model3, midiFile, wavFile):
+ *
+ * Plays back a MIDI recording made with -record-midi on the sound board alone
+ * (68K, SCSPs and Digital Sound Board), without a window, audio output or any
+ * other part of the system, as fast as possible. The audio generated can be
+ * written to a WAV file, which is the same from one run to the next, and the
+ * number of samples generated per second is reported.
+ */
+static int ReplayMIDI(const Game &game, ROMSet *rom_set, CModel3 *Model3, const std::string &midiFile, const std::string &wavFile)
+{
+  CSoundBoard::MIDIRecording recording;
+  if (OKAY != CSoundBoard::LoadMIDIRecording(&recording, midiFile))
+    return 1;
+  if (recording.game != game.name)
+  {
+    ErrorLog("MIDI recording %s is of %s, not %s.", midiFile.c_str(), recording.game.c_str(), game.name.c_str());
+    return 1;
+  }
+
+  // Initialize and load ROMs, without renderers or inputs
+  if (OKAY != Model3->Init())
+    return 1;
+  if (Model3->LoadGame(game, *rom_set))
+    return 1;
+  *rom_set = ROMSet();
+  Model3->Reset();
+
+  FILE *wav = nullptr;
+  if (!wavFile.empty())
+  {
+    wav = fopen(wavFile.c_str(), "wb");
+    if (wav == nullptr)
+    {
+      ErrorLog("Unable to create WAV file: %s", wavFile.c_str());
+      return 1;
+    }
+    WriteWAVHeader(wav, 0);  // filled in at the end
+  }
+
+  // Pass on the bytes of each frame and run the sound board for it, timing
+  // only the sound board
+  CSoundBoard *SoundBoard = Model3->GetSoundBoard();
+  std::vector<float> samples(4 * NUM_SAMPLES_PER_FRAME);
+  uint64_t ticks = 0;
+  size_t next = 0;
+  for (UINT32 frame = 0; frame < recording.numFrames; frame++)
+  {
+    uint64_t start = SDL_GetPerformanceCounter();
+    for (; next < recording.entries.size() && recording.entries[next].frame <= frame; next++)
+      SoundBoard->WriteMIDIPort(recording.entries[next].data);
+    SoundBoard->RunFrame(false);
+    ticks += SDL_GetPerformanceCounter() - start;
+
+    if (wav != nullptr)
+    {
+      const float *channels[4];
+      SoundBoard->GetFrameAudio(channels);
+      for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++)
+      {
+        for (int ch = 0; ch < 4; ch++)
+          samples[i * 4 + ch] = channels[ch][i];
+      }
+      fwrite(samples.data(), sizeof(float), samples.size(), wav);
+    }
+  }
+
+  uint64_t numSamples = uint64_t(recording.numFrames) * NUM_SAMPLES_PER_FRAME;
+  if (wav != nullptr)
+  {
+    fseek(wav, 0, SEEK_SET);
+    WriteWAVHeader(wav, uint32_t(numSamples));
+    fclose(wav);
+  }
+
+  double seconds = double(ticks) / double(SDL_GetPerformanceFrequency());
+  double samplesPerSecond = seconds > 0 ? double(numSamples) / seconds : 0;
+  printf("Played back %u frames (%llu samples) in %1.3f s: %1.0f samples/s, %1.1fx real time\n",
+    recording.numFrames, (unsigned long long)numSamples, seconds, samplesPerSecond, samplesPerSecond / 44100.0);
+  InfoLog("Played back %u frames in %1.3f s: %1.0f samples/s.", recording.numFrames, seconds, samplesPerSecond);
+  return 0;
+}
+
+
 /******************************************************************************
  Entry Point and Command Line Procesing
 ******************************************************************************/
 
 static const std::string s_analysisPath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Analysis);
 static const std::string s_configFilePath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Config) << "Supermodel.ini";
-static const std::string s_gameXMLFilePath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Config) << "Games.xml";
 static const std::string s_logFilePath = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << "Supermodel.log";
+static const char s_configFileComment[] = {
+  ";\n"
+  "; Supermodel Configuration File\n"
+  ";\n"
+};
 
 // Create and configure inputs
 static bool ConfigureInputs(CInputs *Inputs, Util::Config::Node *fileConfig, Util::Config::Node *runtimeConfig, const Game &game, bool configure)
 {
-  static const char configFileComment[] = {
-    ";\n"
-    "; Supermodel Configuration File\n"
-    ";\n"
-  };
-
   Inputs->LoadFromConfig(*runtimeConfig);
 
   // If the user wants to configure the inputs, do that now
@@ -1368,7 +2699,7 @@ static bool ConfigureInputs(CInputs *Inputs, Util::Config::Node *fileConfig, Uti
     {
       // Write input configuration and input system settings to config file
       Inputs->StoreToConfig(fileConfigRoot);
-      Util::Config::WriteINIFile(s_configFilePath, *fileConfig, configFileComment);
+      Util::Config::WriteINIFile(s_configFilePath, *fileConfig, s_configFileComment);
 
       // Also save to runtime configuration in case we proceed and play
       Inputs->StoreToConfig(runtimeConfig);
@@ -1381,6 +2712,140 @@ static bool ConfigureInputs(CInputs *Inputs, Util::Config::Node *fileConfig, Uti
   return OKAY;
 }
 
+
+/******************************************************************************
+ Auto-Tuning
+******************************************************************************/
+
+static std::string QuoteArgument(const std::string &arg)
+{
+#ifdef SUPERMODEL_WIN32
+  return "\"" + arg + "\"";
+#else
+  std::string quoted("'");
+  for (char c: arg)
+  {
+    if (c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  return quoted + "'";
+#endif
+}
+
+/*
+ * AutoTune(argc, argv, fileConfig, game, frames):
+ *
+ * Runs the game as a benchmark of the given number of frames with each
+ * combination of threading, 3D engine and quad rendering, each in a process
+ * of its own started with the same command line, and stores the combination
+ * with the lowest 99th percentile frame time in the game's section of the
+ * configuration file. Returns the exit code.
+ */
+static int AutoTune(int argc, char **argv, Util::Config::Node *fileConfig, const Game &game, unsigned frames)
+{
+  struct Candidate
+  {
+    bool multiThreaded;
+    bool gpuMultiThreaded;
+    bool new3D;
+    bool quadRendering;
+    double p99 = 0;
+    double mean = 0;
+  };
+  std::vector<Candidate> candidates;
+  for (bool new3D: { true, false })
+  {
+    for (bool quadRendering: { false, true })
+    {
+      if (quadRendering && !new3D)
+        continue;
+      candidates.push_back({ false, false, new3D, quadRendering });
+      candidates.push_back({ true, false, new3D, quadRendering });
+      candidates.push_back({ true, true, new3D, quadRendering });
+    }
+  }
+
+  // The options setting what is tried, or how the benchmark is run, aren't
+  // passed on
+  static const char *replaced[] =
+  {
+    "-autotune", "-benchmark", "-benchmark-report", "-benchmark-no-present",
+    "-threads", "-no-threads", "-gpu-multi-threaded", "-no-gpu-thread",
+    "-new3d", "-legacy3d", "-quad-rendering", "-no-quad-rendering"
+  };
+  std::string command = QuoteArgument(argv[0]);
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg(argv[i]);
+    std::string option = arg.substr(0, arg.find('='));
+    if (std::find_if(std::begin(replaced), std::end(replaced), [&](const char *r) { return option == r; }) == std::end(replaced))
+      command += " " + QuoteArgument(arg);
+  }
+  std::string reportFile = Util::Format() << FileSystemPath::GetPath(FileSystemPath::Log) << game.name << "_autotune.json";
+
+  printf("Auto-tuning %s over %u frames per run.\n", game.title.c_str(), frames);
+  const Candidate *best = nullptr;
+  for (auto &c: candidates)
+  {
+    std::string run = Util::Format() << command << " -benchmark=" << frames << " -benchmark-no-present -benchmark-report=" << QuoteArgument(reportFile)
+      << (c.multiThreaded ? " -threads" : " -no-threads") << (c.gpuMultiThreaded ? " -gpu-multi-threaded" : " -no-gpu-thread")
+      << (c.new3D ? " -new3d" : " -legacy3d") << (c.quadRendering ? " -quad-rendering" : " -no-quad-rendering");
+#ifdef SUPERMODEL_WIN32
+    run = "\"" + run + "\"";  // cmd.exe drops the outer quotes
+#endif
+    remove(reportFile.c_str());
+    int status = system(run.c_str());
+
+    // Read the totals from the report, and check the settings weren't
+    // changed by others that need them
+    std::string report;
+    FILE *fp = fopen(reportFile.c_str(), "r");
+    if (fp != nullptr)
+    {
+      char buf[4096];
+      size_t n;
+      while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        report.append(buf, n);
+      fclose(fp);
+      remove(reportFile.c_str());
+    }
+    std::string threading = Util::Format() << "\"multiThreaded\": " << (c.multiThreaded ? "true" : "false") << ",\n  \"gpuMultiThreaded\": " << (c.gpuMultiThreaded ? "true" : "false");
+    size_t total = report.find("\"total\"");
+    double p50 = 0;
+    bool valid = status == 0 && total != std::string::npos && report.find(threading) != std::string::npos &&
+      sscanf(report.c_str() + total, "\"total\": { \"mean\": %lf, \"p50\": %lf, \"p99\": %lf", &c.mean, &p50, &c.p99) == 3;
+
+    printf("  %-14s %-9s %-15s  ", c.multiThreaded ? (c.gpuMultiThreaded ? "-threads" : "-no-gpu-thread") : "-no-threads", c.new3D ? "-new3d" : "-legacy3d", c.quadRendering ? "-quad-rendering" : "");
+    if (!valid)
+    {
+      puts("failed, or settings overridden");
+      continue;
+    }
+    printf("p99 %7.3f ms, mean %7.3f ms\n", c.p99, c.mean);
+    if (best == nullptr || c.p99 < best->p99 || (c.p99 == best->p99 && c.mean < best->mean))
+      best = &c;
+  }
+
+  if (best == nullptr)
+  {
+    ErrorLog("Auto-tuning failed: no configuration could be benchmarked.");
+    return 1;
+  }
+
+  Util::Config::Node *section = fileConfig->TryGet(game.name);
+  if (section == nullptr)
+    section = &fileConfig->Add(game.name);
+  section->Set("MultiThreaded", best->multiThreaded ? "1" : "0");
+  section->Set("GPUMultiThreaded", best->gpuMultiThreaded ? "1" : "0");
+  section->Set("New3DEngine", best->new3D ? "1" : "0");
+  section->Set("QuadRendering", best->quadRendering ? "1" : "0");
+  Util::Config::WriteINIFile(s_configFilePath, *fileConfig, s_configFileComment);
+  printf("Wrote fastest configuration to [ %s ] in '%s'.\n", game.name.c_str(), s_configFilePath.c_str());
+  return 0;
+}
+
 // Print game list
 static void PrintGameList(const std::string &xml_file, const std::map<std::string, Game> &games)
 {
@@ -1419,99 +2884,6 @@ static void LogConfig(const Util::Config::Node &config)
   InfoLog("");
 }
 
-static Util::Config::Node DefaultConfig()
-{
-  Util::Config::Node config("Global");
-  config.Set("GameXMLFile", s_gameXMLFilePath);
-  config.Set("InitStateFile", "");
-  // CModel3
-  config.Set("MultiThreaded", true);
-  config.Set("GPUMultiThreaded", true);
-  config.Set("PowerPCFrequency", "50");
-  // 2D and 3D graphics engines
-  config.Set("MultiTexture", false);
-  config.Set("VertexShader", "");
-  config.Set("FragmentShader", "");
-  config.Set("VertexShaderFog", "");
-  config.Set("FragmentShaderFog", "");
-  config.Set("VertexShader2D", "");
-  config.Set("FragmentShader2D", "");
-  // CSoundBoard
-  config.Set("EmulateSound", true);
-  config.Set("Balance", "0.0");
-  config.Set("BalanceLeftRight", "0.0");
-  config.Set("BalanceFrontRear", "0.0");
-  config.Set("NbSoundChannels", "4");
-  config.Set("SoundFreq", "57.6"); // 60.0f? 57.524160f?
-  // CDSB
-  config.Set("EmulateDSB", true);
-  config.Set("SoundVolume", "100");
-  config.Set("MusicVolume", "100");
-  // Other sound options
-  config.Set("LegacySoundDSP", false); // New config option for games that do not play correctly with MAME's SCSP sound core.
-  // CDriveBoard
-  config.Set("ForceFeedback", false);
-  // Platform-specific/UI
-  config.Set("New3DEngine", true);
-  config.Set("QuadRendering", false);
-  config.Set("XResolution", "496");
-  config.Set("YResolution", "384");
-  config.SetEmpty("WindowXPosition");
-  config.SetEmpty("WindowYPosition");
-  config.Set("FullScreen", false);
-  config.Set("BorderlessWindow", false);
-
-  config.Set("WideScreen", false);
-  config.Set("Stretch", false);
-  config.Set("WideBackground", false);
-  config.Set("VSync", true);
-  config.Set("Throttle", true);
-  config.Set("RefreshRate", 60.0f);
-  config.Set("ShowFrameRate", false);
-  config.Set("Crosshairs", int(0));
-  config.Set("CrosshairStyle", "vector");
-  config.Set("FlipStereo", false);
-#ifdef SUPERMODEL_WIN32
-  config.Set("InputSystem", "dinput");
-  // DirectInput ForceFeedback
-  config.Set("DirectInputConstForceLeftMax", "100");
-  config.Set("DirectInputConstForceRightMax", "100");
-  config.Set("DirectInputSelfCenterMax", "100");
-  config.Set("DirectInputFrictionMax", "100");
-  config.Set("DirectInputVibrateMax", "100");
-  // XInput ForceFeedback
-  config.Set("XInputConstForceThreshold", "30");
-  config.Set("XInputConstForceMax", "100");
-  config.Set("XInputVibrateMax", "100");
-  config.Set("XInputStereoVibration", true);
-  // SDL ForceFeedback
-  config.Set("SDLConstForceMax", "100");
-  config.Set("SDLSelfCenterMax", "100");
-  config.Set("SDLFrictionMax", "100");
-  config.Set("SDLVibrateMax", "100");
-  config.Set("SDLConstForceThreshold", "30");
-#ifdef NET_BOARD
-  // NetBoard
-  config.Set("Network", false);
-  config.Set("SimulateNet", true);
-  config.Set("PortIn", unsigned(1970));
-  config.Set("PortOut", unsigned(1971));
-  config.Set("AddressOut", "127.0.0.1");
-#endif
-#else
-  config.Set("InputSystem", "sdl");
-  // SDL ForceFeedback
-  config.Set("SDLConstForceMax", "100");
-  config.Set("SDLSelfCenterMax", "100");
-  config.Set("SDLFrictionMax", "100");
-  config.Set("SDLVibrateMax", "100");
-  config.Set("SDLConstForceThreshold", "30");
-#endif
-  config.Set("Outputs", "none");
-  config.Set("DumpTextures", false);
-  return config;
-}
-
 static void Title(void)
 {
   puts("Supermodel: A Sega Model 3 Arcade Emulator (Version " SUPERMODEL_VERSION ")");
@@ -1522,21 +2894,95 @@ static void Help(void)
 {
   Util::Config::Node defaultConfig = DefaultConfig();
   puts("Usage: Supermodel <romset> [options]");
-  puts("ROM set must be a valid ZIP file containing a single game.");
+  puts("ROM set must be a valid ZIP file containing a single game, a ROM pack made");
+  puts("with -convert-roms, or a directory of uncompressed ROM files named after the");
+  puts("game (e.g., 'scud').");
   puts("");
   puts("General Options:");
   puts("  -?, -h, -help, --help   Print this help text");
   puts("  -print-games            List supported games and quit");
-  printf("  -game-xml-file=<file>   ROM set definition file [Default: %s]\n", s_gameXMLFilePath.c_str());
+  printf("  -game-xml-file=<file>   ROM set definition file [Default: %s]\n", defaultConfig["GameXMLFile"].ValueAs<std::string>().c_str());
+  puts("  -rom-cache=<dir>        Cache decoded ROMs in directory [Default: none]");
+  puts("  -verify-roms            Check the CRCs of the ROM set's files and quit");
+  puts("  -convert-roms           Write a faster loading ROM pack for each ZIP file");
+  puts("                          given and quit");
   printf("  -log-output=<outputs>   Log output destination(s) [Default: %s]\n", s_logFilePath.c_str());
   puts("  -log-level=<level>      Logging threshold [Default: info]");
   puts("");
   puts("Core Options:");
   printf("  -ppc-frequency=<freq>   PowerPC frequency in MHz [Default: %d]\n", defaultConfig["PowerPCFrequency"].ValueAs<unsigned>());
+  puts("  -ppc-recompiler         Use PowerPC dynamic recompiler (x86-64 only)");
+  puts("  -no-ppc-recompiler      Do not use PowerPC dynamic recompiler [Default]");
+  puts("  -ppc-block-cache        Cache pre-decoded PowerPC instructions");
+  puts("  -no-ppc-block-cache     Fetch and decode every PowerPC instruction [Default]");
+  puts("  -idle-skip              Skip PowerPC idle loops [Default]");
+  puts("  -no-idle-skip           Always execute PowerPC idle loops");
+  puts("  -ppc-hle                Do the game's copy and clear routines listed in");
+  puts("                          Games.xml on the host [Default]");
+  puts("  -no-ppc-hle             Always execute the game's copy and clear routines");
+  puts("  -ppc-hle-validate       Execute them, checking the host gets the same result");
   puts("  -no-threads             Disable multi-threading entirely");
   puts("  -gpu-multi-threaded     Run graphics rendering in separate thread [Default]");
   puts("  -no-gpu-thread          Run graphics rendering in main thread");
+  printf("  -snapshot-page-size=<n> GPU memory snapshot granularity in bytes [Default: %d]\n", defaultConfig["SnapshotPageSize"].ValueAs<unsigned>());
+  puts("  -snapshot-page-protection");
+  puts("                          Detect Real3D memory writes by page faults (experimental)");
+  puts("  -no-snapshot-page-protection");
+  puts("                          Detect Real3D memory writes in software [Default]");
+  printf("  -frame-queue-depth=<n>  Frames emulated ahead of rendering, 0 or 1 [Default: %d]\n", defaultConfig["FrameQueueDepth"].ValueAs<unsigned>());
+  puts("  -early-render           With no frame queue, render as soon as the game");
+  puts("                          flushes the Real3D rather than at the end of the frame");
+  puts("  -no-early-render        Render once the frame has been emulated [Default]");
+  puts("  -late-input             Sample inputs just before each frame is emulated");
+  puts("  -no-late-input          Sample inputs as soon as each frame ends [Default]");
+  puts("  -latch-inputs           Sample inputs again as the game first reads them in");
+  puts("                          each frame (disables GPU multi-threading)");
+  puts("  -no-latch-inputs        Game reads the inputs sampled before the frame");
+  puts("                          [Default]");
+  puts("  -interpolate-aim        Estimate gun and analog positions when the game reads");
+  puts("                          them from the last few samples");
+  puts("  -no-interpolate-aim     Game reads the positions last sampled [Default]");
+  printf("  -run-ahead=<n>          Show the frame n frames ahead, 0 to 4 [Default: %d]\n", defaultConfig["RunAheadFrames"].ValueAs<unsigned>());
+  printf("  -rewind=<n>             Frames that can be stepped back, 0 to disable [Default: %d]\n", defaultConfig["RewindFrames"].ValueAs<unsigned>());
+  printf("  -rewind-memory=<mb>     Memory for rewinding in MB [Default: %d]\n", defaultConfig["RewindMemory"].ValueAs<unsigned>());
+  puts("  -rewind-keyframes=<n>");
+  printf("                          Frames between full states kept for rewinding [Default: %d]\n", defaultConfig["RewindKeyframeInterval"].ValueAs<unsigned>());
+  puts("  -ppc-thread-core=<n>    Run main board thread on given CPU [Default: any]");
+  puts("  -sound-thread-core=<n>  Run sound board thread on given CPU [Default: any]");
+  puts("  -drive-thread-core=<n>  Run drive board thread on given CPU [Default: any]");
+  puts("  -render-thread-core=<n> Run render thread on given CPU [Default: any]");
+  printf("  -thread-priority=<p>    Board thread priority: normal, high, realtime [Default: %s]\n", defaultConfig["ThreadPriority"].ValueAs<std::string>().c_str());
   puts("  -load-state=<file>      Load save state after starting");
+  printf("  -state-compression=<n>  Save state and NVRAM compression, 0 (none) to 9 [Default: %d]\n", defaultConfig["StateCompression"].ValueAs<unsigned>());
+  printf("  -nvram-checkpoint=<seconds>\n                          Save NVRAM in the background this often when it has\n                          changed, 0 to save it only on exit [Default: %d]\n", defaultConfig["NVRAMCheckpointInterval"].ValueAs<unsigned>());
+  puts("  -record-inputs=<file>   Record game inputs from start (or loaded state) to file");
+  puts("  -replay-inputs=<file>   Replay recorded game inputs from their starting state");
+  puts("  -benchmark=<n>          Run n frames unthrottled, report frame timings and quit");
+  puts("  -benchmark-report=<file>");
+  puts("                          Write benchmark report to file [Default: stdout]");
+  puts("  -benchmark-no-present   Do not show the frames run by -benchmark");
+  puts("  -autotune=<n>           Benchmark n frames with each threading and 3D engine");
+  puts("                          setting, and save the fastest for the game");
+  puts("  -turbo-to-frame=<n>     Fast-forward from the start up to frame n");
+  puts("  -turbo-boot=<seconds>   Run the boot sequence unrendered and unthrottled, for up");
+  puts("                          to this long or until the game's boot PC [Default: 0]");
+  printf("  -fast-forward-interval=<n>\n                          Frames run for each one shown when fast-forwarding\n                          [Default: %d]\n", defaultConfig["FastForwardInterval"].ValueAs<unsigned>());
+  puts("  -startup-profile        Log the time taken by each phase of startup");
+  puts("  -trace=<seconds>        Record a timeline of each thread, writing the last");
+  puts("                          seconds to <game>_trace.json on Alt+E and on exit");
+  puts("  -exec-trace=<n>         Record the last n instructions of the PowerPC and sound");
+  puts("                          68K, writing them to <game>_<cpu>_trace.txt on Alt+E");
+  puts("                          and when the PowerPC crashes [Default: 0 (off)]");
+  puts("  -exec-trace-branches    Record only the targets of jumps in execution traces");
+  printf("  -hitch-threshold=<ms>   Log the last frames when one takes longer, 0 to disable\n                          [Default: %d]\n", defaultConfig["HitchThreshold"].ValueAs<unsigned>());
+  printf("  -hitch-frames=<n>       Frames logged for each hitch [Default: %d]\n", defaultConfig["HitchFrames"].ValueAs<unsigned>());
+  puts("  -metrics-address=<addr> Send performance metrics to this statsd server");
+  printf("  -metrics-port=<n>       ... at this port [Default: %u]\n", defaultConfig["MetricsPort"].ValueAs<unsigned>());
+  printf("  -metrics-prefix=<s>     Metrics are named <s>.<game>.<metric> [Default: %s]\n", defaultConfig["MetricsPrefix"].ValueAs<std::string>().c_str());
+  printf("  -metrics-interval=<seconds>\n                          How often metrics are sent [Default: %u]\n", defaultConfig["MetricsInterval"].ValueAs<unsigned>());
+  printf("  -frame-skip=<n>         Skip rendering up to n frames a second when running\n                          slower than 57.524 Hz, 0 to disable [Default: %d]\n", defaultConfig["AutoFrameSkip"].ValueAs<unsigned>());
+  puts("  -power-save             Sleep rather than spin between frames, and present");
+  puts("                          paused frames only when they change");
   puts("");
   puts("Video Options:");
   puts("  -res=<x>,<y>            Resolution [Default: 496,384]");
@@ -1547,17 +2993,53 @@ static void Help(void)
   puts("  -wide-screen            Expand 3D field of view to screen width");
   puts("  -wide-bg                When wide-screen mode is enabled, also expand the 2D");
   puts("                          background layer to screen width");
+  puts("  -gpu-tilemaps           Draw the 2D layers on the GPU");
+  puts("  -no-gpu-tilemaps        Draw the 2D layers on the CPU [Default]");
+  puts("  -async-2d               Draw the 2D layers on the CPU while the 3D scene is");
+  puts("                          built");
+  puts("  -no-async-2d            Draw the 2D layers before the 3D scene [Default]");
   puts("  -stretch                Fit viewport to resolution, ignoring aspect ratio");
   puts("  -no-throttle            Disable frame rate lock");
   puts("  -vsync                  Lock to vertical refresh rate [Default]");
   puts("  -no-vsync               Do not lock to vertical refresh rate");
+  puts("  -adaptive-vsync         With VSync, show late frames at once rather than at");
+  puts("                          the next refresh");
+  puts("  -no-adaptive-vsync      Always wait for the refresh [Default]");
+  puts("  -frame-delay            With VSync, run each frame just before the refresh");
+  puts("  -no-frame-delay         Run each frame as soon as the last is shown [Default]");
+  printf("  -max-frames-in-flight=<n>\n                          Frames the GPU may fall behind [Default: %d (driver)]\n", defaultConfig["MaxFramesInFlight"].ValueAs<unsigned>());
   puts("  -true-hz                Use true Model 3 refresh rate of 57.524 Hz");
-  puts("  -show-fps               Display frame rate in window title bar");
+  puts("  -headless               Render offscreen (EGL), without a window or display");
+  puts("  -capture-every=<n>      Read back every nth frame, logging its CRC-32 to");
+  puts("                          <game>_frames.txt [Default: 0 (off)]");
+  puts("  -capture-images         Also write the frames read back to <game>_<n>.bmp");
+  puts("  -capture-memory         Also log CRC-32s of RAM, Real3D memory and VRAM");
+  puts("  -capture-format=<fmt>   Format of images captured: bmp [Default], png, or");
+  puts("                          raw (all frames appended to <game>_frames.raw)");
+  puts("  -record-video=<file>    Record the picture and sound to a video file with ffmpeg");
+  puts("  -record-encoder=<name>  Encoder: software [Default], nvenc, vaapi, qsv, mf,");
+  puts("                          or videotoolbox");
+  printf("  -record-bitrate=<kbps>  Video bit rate in Kbit/s [Default: %u]\n", defaultConfig["RecordVideoBitrate"].ValueAs<unsigned>());
+  puts("  -show-fps               Display frame rate and statistics");
+  puts("  -fps-overlay            Draw them over the picture [Default]");
+  puts("  -fps-title              Show them in the window title bar instead");
+  puts("  -gpu-timings            Time render stages on the GPU, shown with -show-fps and");
+  puts("                          logged to <game>_gpu_timings.csv");
   puts("  -crosshairs=<n>         Crosshairs configuration for gun games:");
   puts("                          0=none [Default], 1=P1 only, 2=P2 only, 3=P1 & P2");
   puts("  -crosshair-style=<s>    Crosshair style: vector or bmp. [Default: vector]");
   puts("  -new3d                  New 3D engine by Ian Curtis [Default]");
   puts("  -quad-rendering         Enable proper quad rendering");
+  puts("  -no-quad-rendering      Draw quads as two triangles [Default]");
+  puts("  -quad-vertex-pulling    Render quads without a geometry shader");
+  puts("  -gpu-clipping           Leave clipping of partly visible models to the GPU");
+  printf("  -lod-quality=<n>        Detail of distant models in percent, 0 for full [Default: %d]\n", defaultConfig["LODQuality"].ValueAs<unsigned>());
+  puts("  -strict-los             Read line of sight depth synchronously (new engine)");
+  puts("  -texture-cache          Sample textures decoded in advance (new engine)");
+  puts("  -shader-permutations    Specialise shaders to mesh states (new engine)");
+  puts("  -dynamic-res            Lower 3D resolution to keep GPU time under budget");
+  printf("  -dynamic-res-min=<n>    Lowest 3D resolution in percent [Default: %d]\n", defaultConfig["DynamicResolutionMin"].ValueAs<unsigned>());
+  printf("  -gpu-budget=<ms>        GPU time per frame for -dynamic-res [Default: %d]\n", defaultConfig["GPUFrameBudget"].ValueAs<unsigned>());
   puts("  -legacy3d               Legacy 3D engine (faster but less accurate)");
   puts("  -multi-texture          Use 8 texture maps for decoding (legacy engine)");
   puts("  -no-multi-texture       Decode to single texture (legacy engine) [Default]");
@@ -1575,11 +3057,29 @@ static void Help(void)
   puts("  -music-volume=<vol>     Digital Sound Board volume in % [Default: 100]");
   puts("  -balance=<bal>          Relative front/rear balance in % [Default: 0]");
   puts("  -channels=<c>           Number of sound channels to use on host [Default: 4]");
+  puts("  -audio-latency=<ms>     Size of host audio buffer in milliseconds [Default: 200]");
+  puts("  -dynamic-rate-control   Resample audio by up to 0.5% to keep host buffer half full");
+  puts("  -no-dynamic-rate-control");
+  puts("                          Pass audio to host unchanged [Default]");
   puts("  -flip-stereo            Swap left and right audio channels");
   puts("  -no-sound               Disable sound board emulation (sound effects)");
   puts("  -no-dsb                 Disable Digital Sound Board (MPEG music)");
   puts("  -new-scsp               New SCSP engine based on MAME [Default]");
   puts("  -legacy-scsp            Legacy SCSP engine by ElSemi");
+  puts("  -strict-scsp-timing     Run sound 68K after every SCSP sample (slower)");
+  puts("  -block-scsp             Render SCSP slots in blocks of samples when possible");
+  puts("  -no-block-scsp          Render SCSP slots one sample at a time [Default]");
+  puts("  -parallel-sound         Run the DSB, and the slave SCSP's blocks, alongside");
+  puts("                          the master SCSP on the job pool");
+  puts("  -no-parallel-sound      Run the sound chips one after another [Default]");
+  puts("  -dsb-thread             Run the DSB on its own thread, a frame ahead of the mix");
+  puts("  -no-dsb-thread          Run the DSB on the sound board thread [Default]");
+  puts("  -sound-idle-skip        Skip sound 68K idle loops [Default]");
+  puts("  -no-sound-idle-skip     Always execute sound 68K idle loops");
+  puts("  -record-midi=<file>     Record MIDI commands sent to the sound board from reset");
+  puts("  -replay-midi=<file>     Play back MIDI recording on the sound board alone, as");
+  puts("                          fast as possible, report the speed and quit");
+  puts("  -replay-wav=<file>      Write audio played back by -replay-midi to WAV file");
   puts("");
 #ifdef NET_BOARD
   puts("Net Options:");
@@ -1587,6 +3087,19 @@ static void Help(void)
   puts("  -net                    Enable net board");
   puts("  -simulate-netboard      Simulate the net board [Default]");
   puts("  -emulate-netboard       Emulate the net board (requires -no-threads)");
+  puts("  -net-tcp                Link simulated net boards over TCP [Default]");
+  puts("  -net-udp                Link simulated net boards over UDP");
+  puts("  -net-shm                Link simulated net boards on one host through shared");
+  puts("                          memory, by port number");
+  puts("  -net-delta              Send only what changed in comm RAM each frame");
+  puts("  -no-net-delta           Send all of comm RAM each frame [Default]");
+  puts("  -net-sim-peers=<n>      Link with n simulated machines in-process, for");
+  puts("                          benchmarking (the game must be set to master)");
+  printf("  -net-sim-latency=<ms>   Simulated peers' latency per hop [Default: %s]\n", defaultConfig["NetSimLatency"].ValueAs<std::string>().c_str());
+  puts("  -net-sim-jitter=<ms>    Simulated peers' random added latency per hop");
+  puts("  -net-sim-loss=<pct>     Simulated peers' percentage of messages resent");
+  puts("  -net-sim-replay=<file>  Simulated peers send the slices of a net recording");
+  puts("  -net-record=<file>      Record the slices other machines send to a file");
   puts("");
 #endif
   puts("Input Options:");
@@ -1594,8 +3107,13 @@ static void Help(void)
   puts("  -config-inputs          Configure keyboards, mice, and game controllers");
 #ifdef SUPERMODEL_WIN32
   printf("  -input-system=<s>       Input system [Default: %s]\n", defaultConfig["InputSystem"].ValueAs<std::string>().c_str());
-  printf("  -outputs=<s>            Outputs [Default: %s]\n", defaultConfig["Outputs"].ValueAs<std::string>().c_str());
 #endif
+  printf("  -outputs=<s>            Outputs, any of win (Windows only), udp and pipe,\n");
+  printf("                          separated by commas [Default: %s]\n", defaultConfig["Outputs"].ValueAs<std::string>().c_str());
+  printf("  -outputs-address=<addr> Send outputs as JSON datagrams to this host [Default: %s]\n", defaultConfig["OutputsAddress"].ValueAs<std::string>().c_str());
+  printf("  -outputs-port=<n>       ... at this port [Default: %u]\n", defaultConfig["OutputsPort"].ValueAs<unsigned>());
+  printf("  -outputs-pipe=<name>    Write outputs as JSON lines to this named pipe\n");
+  printf("                          [Default: %s]\n", defaultConfig["OutputsPipe"].ValueAs<std::string>().c_str());
   puts("  -print-inputs           Prints current input configuration");
   puts("");
   puts("Debug Options:");
@@ -1603,6 +3121,7 @@ static void Help(void)
 #ifdef SUPERMODEL_DEBUGGER
   puts("  -disable-debugger       Completely disable debugger functionality");
   puts("  -enter-debugger         Enter debugger at start of emulation");
+  puts("  -gdb-port=<port>        Serve GDB remote protocol for main CPU on TCP port");
   puts("");
 #endif // SUPERMODEL_DEBUGGER
 }
@@ -1619,6 +3138,7 @@ struct ParsedCommandLine
   bool print_inputs = false;
   bool disable_debugger = false;
   bool enter_debugger = false;
+  unsigned gdb_port = 0;
 #ifdef DEBUG
   std::string gfx_state;
 #endif
@@ -1638,8 +3158,48 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
   const std::map<std::string, std::string> valued_options
   { // -option=value
     { "-game-xml-file",         "GameXMLFile"             },
+    { "-rom-cache",             "ROMCacheDirectory"       },
     { "-load-state",            "InitStateFile"           },
+    { "-state-compression",     "StateCompression"        },
+    { "-nvram-checkpoint",      "NVRAMCheckpointInterval" },
+    { "-record-inputs",         "RecordInputsFile"        },
+    { "-replay-inputs",         "ReplayInputsFile"        },
+    { "-benchmark",             "BenchmarkFrames"         },
+    { "-capture-every",         "CaptureInterval"         },
+    { "-capture-format",        "CaptureFormat"           },
+    { "-record-video",          "RecordVideoFile"         },
+    { "-record-encoder",        "RecordVideoEncoder"      },
+    { "-record-bitrate",        "RecordVideoBitrate"      },
+    { "-benchmark-report",      "BenchmarkFile"           },
+    { "-autotune",              "AutoTuneFrames"          },
+    { "-turbo-to-frame",        "TurboToFrame"            },
+    { "-turbo-boot",            "TurboBoot"               },
+    { "-fast-forward-interval", "FastForwardInterval"     },
+    { "-trace",                 "TraceSeconds"            },
+    { "-exec-trace",            "ExecTraceSize"           },
+    { "-hitch-threshold",       "HitchThreshold"          },
+    { "-hitch-frames",          "HitchFrames"             },
+    { "-metrics-address",       "MetricsAddress"          },
+    { "-metrics-port",          "MetricsPort"             },
+    { "-metrics-prefix",        "MetricsPrefix"           },
+    { "-metrics-interval",      "MetricsInterval"         },
+    { "-frame-skip",            "AutoFrameSkip"           },
     { "-ppc-frequency",         "PowerPCFrequency"        },
+    { "-snapshot-page-size",    "SnapshotPageSize"        },
+    { "-frame-queue-depth",     "FrameQueueDepth"         },
+    { "-max-frames-in-flight",  "MaxFramesInFlight"       },
+    { "-dynamic-res-min",       "DynamicResolutionMin"    },
+    { "-gpu-budget",            "GPUFrameBudget"          },
+    { "-lod-quality",           "LODQuality"              },
+    { "-run-ahead",             "RunAheadFrames"          },
+    { "-rewind",                "RewindFrames"            },
+    { "-rewind-memory",         "RewindMemory"            },
+    { "-rewind-keyframes",      "RewindKeyframeInterval"  },
+    { "-ppc-thread-core",       "PPCThreadCore"           },
+    { "-sound-thread-core",     "SoundThreadCore"         },
+    { "-drive-thread-core",     "DriveThreadCore"         },
+    { "-render-thread-core",    "RenderThreadCore"        },
+    { "-thread-priority",       "ThreadPriority"          },
     { "-crosshairs",            "Crosshairs"              },
     { "-crosshair-style",       "CrosshairStyle"          },
     { "-vert-shader",           "VertexShader"            },
@@ -1653,17 +3213,55 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
     { "-balance",               "Balance"                 },
     { "-channels", 	            "NbSoundChannels"         },
     { "-soundfreq",             "SoundFreq"               },
+    { "-audio-latency",         "AudioLatency"            },
+    { "-record-midi",           "RecordMIDIFile"          },
+    { "-replay-midi",           "ReplayMIDIFile"          },
+    { "-replay-wav",            "ReplayWAVFile"           },
+#ifdef NET_BOARD
+    { "-net-sim-peers",         "NetSimPeers"             },
+    { "-net-sim-latency",       "NetSimLatency"           },
+    { "-net-sim-jitter",        "NetSimJitter"            },
+    { "-net-sim-loss",          "NetSimLoss"              },
+    { "-net-sim-replay",        "NetSimReplayFile"        },
+    { "-net-record",            "NetRecordFile"           },
+#endif
     { "-input-system",          "InputSystem"             },
     { "-outputs",               "Outputs"                 },
+    { "-outputs-address",       "OutputsAddress"          },
+    { "-outputs-port",          "OutputsPort"             },
+    { "-outputs-pipe",          "OutputsPipe"             },
     { "-log-output",            "LogOutput"               },
     { "-log-level",             "LogLevel"                }
   };
   const std::map<std::string, std::pair<std::string, bool>> bool_options
   { // -option
+    { "-verify-roms",         { "VerifyROMs",       true } },
+    { "-convert-roms",        { "ConvertROMs",      true } },
+    { "-power-save",          { "PowerSave",        true } },
+    { "-no-power-save",       { "PowerSave",        false } },
     { "-threads",             { "MultiThreaded",    true } },
     { "-no-threads",          { "MultiThreaded",    false } },
     { "-gpu-multi-threaded",  { "GPUMultiThreaded", true } },
     { "-no-gpu-thread",       { "GPUMultiThreaded", false } },
+    { "-snapshot-page-protection",    { "SnapshotPageProtection", true } },
+    { "-no-snapshot-page-protection", { "SnapshotPageProtection", false } },
+    { "-late-input",          { "LateInputSampling", true } },
+    { "-no-late-input",       { "LateInputSampling", false } },
+    { "-early-render",        { "EarlyRender",      true } },
+    { "-no-early-render",     { "EarlyRender",      false } },
+    { "-latch-inputs",        { "LatchInputs",      true } },
+    { "-no-latch-inputs",     { "LatchInputs",      false } },
+    { "-interpolate-aim",     { "InterpolateAim",   true } },
+    { "-no-interpolate-aim",  { "InterpolateAim",   false } },
+    { "-ppc-recompiler",      { "PowerPCRecompiler", true } },
+    { "-no-ppc-recompiler",   { "PowerPCRecompiler", false } },
+    { "-ppc-block-cache",     { "PowerPCBlockCache", true } },
+    { "-no-ppc-block-cache",  { "PowerPCBlockCache", false } },
+    { "-idle-skip",           { "PowerPCIdleSkip",   true } },
+    { "-no-idle-skip",        { "PowerPCIdleSkip",   false } },
+    { "-ppc-hle",             { "PowerPCHLE",        true } },
+    { "-no-ppc-hle",          { "PowerPCHLE",        false } },
+    { "-ppc-hle-validate",    { "PowerPCHLEValidate", true } },
     { "-window",              { "FullScreen",       false } },
     { "-fullscreen",          { "FullScreen",       true } },
     { "-borderless",          { "BorderlessWindow", true } },
@@ -1673,16 +3271,37 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
     { "-no-stretch",          { "Stretch",          false } },
     { "-wide-bg",             { "WideBackground",   true } },
     { "-no-wide-bg",          { "WideBackground",   false } },
+    { "-gpu-tilemaps",        { "GPUTilemaps",      true } },
+    { "-no-gpu-tilemaps",     { "GPUTilemaps",      false } },
+    { "-async-2d",            { "Async2D",          true } },
+    { "-no-async-2d",         { "Async2D",          false } },
     { "-no-multi-texture",    { "MultiTexture",     false } },
     { "-multi-texture",       { "MultiTexture",     true } },
     { "-throttle",            { "Throttle",         true } },
     { "-no-throttle",         { "Throttle",         false } },
     { "-vsync",               { "VSync",            true } },
+    { "-headless",            { "Headless",         true } },
+    { "-capture-images",      { "CaptureImages",    true } },
+    { "-capture-memory",      { "CaptureMemory",    true } },
     { "-no-vsync",            { "VSync",            false } },
+    { "-adaptive-vsync",      { "AdaptiveVSync",    true } },
+    { "-no-adaptive-vsync",   { "AdaptiveVSync",    false } },
+    { "-frame-delay",         { "FrameDelay",       true } },
+    { "-no-frame-delay",      { "FrameDelay",       false } },
     { "-show-fps",            { "ShowFrameRate",    true } },
     { "-no-fps",              { "ShowFrameRate",    false } },
+    { "-fps-overlay",         { "FrameRateOverlay", true } },
+    { "-fps-title",           { "FrameRateOverlay", false } },
     { "-new3d",               { "New3DEngine",      true } },
     { "-quad-rendering",      { "QuadRendering",    true } },
+    { "-no-quad-rendering",   { "QuadRendering",    false } },
+    { "-gpu-clipping",        { "GPUClipping",      true } },
+    { "-texture-cache",       { "TextureCache",     true } },
+    { "-shader-permutations", { "ShaderPermutations", true } },
+    { "-quad-vertex-pulling", { "QuadVertexPulling", true } },
+    { "-strict-los",          { "StrictLOS",        true } },
+    { "-dynamic-res",         { "DynamicResolution", true } },
+    { "-gpu-timings",         { "GPUTimings",       true } },
     { "-legacy3d",            { "New3DEngine",      false } },
     { "-no-flip-stereo",      { "FlipStereo",       false } },
     { "-flip-stereo",         { "FlipStereo",       true } },
@@ -1692,15 +3311,34 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
     { "-no-dsb",              { "EmulateDSB",       false } },
     { "-legacy-scsp",         { "LegacySoundDSP",   true } },
     { "-new-scsp",            { "LegacySoundDSP",   false } },
+    { "-strict-scsp-timing",  { "StrictSCSPTiming", true } },
+    { "-dynamic-rate-control",    { "DynamicRateControl", true } },
+    { "-no-dynamic-rate-control", { "DynamicRateControl", false } },
+    { "-block-scsp",          { "BlockSCSPRendering", true } },
+    { "-no-block-scsp",       { "BlockSCSPRendering", false } },
+    { "-parallel-sound",      { "ParallelSound",    true } },
+    { "-no-parallel-sound",   { "ParallelSound",    false } },
+    { "-dsb-thread",          { "DSBThread",        true } },
+    { "-no-dsb-thread",       { "DSBThread",        false } },
+    { "-sound-idle-skip",     { "SoundIdleSkip",    true } },
+    { "-no-sound-idle-skip",  { "SoundIdleSkip",    false } },
 #ifdef NET_BOARD
     { "-net",                 { "Network",       true } },
     { "-no-net",              { "Network",       false } },
     { "-simulate-netboard",   { "SimulateNet",   true } },
     { "-emulate-netboard",    { "SimulateNet",   false } },
+    { "-net-tcp",             { "NetUDP",        false } },
+    { "-net-udp",             { "NetUDP",        true } },
+    { "-net-shm",             { "NetSharedMemory", true } },
+    { "-net-delta",           { "NetDelta",      true } },
+    { "-no-net-delta",        { "NetDelta",      false } },
 #endif
     { "-no-force-feedback",   { "ForceFeedback",    false } },
     { "-force-feedback",      { "ForceFeedback",    true } },
     { "-dump-textures",       { "DumpTextures",     true } },
+    { "-benchmark-no-present", { "BenchmarkPresent", false } },
+    { "-startup-profile",     { "StartupProfile",   true } },
+    { "-exec-trace-branches", { "ExecTraceBranches", true } },
   };
   for (int i = 1; i < argc; i++)
   {
@@ -1809,6 +3447,17 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
         cmd_line.disable_debugger = true;
       else if (arg == "-enter-debugger")
         cmd_line.enter_debugger = true;
+      else if (arg == "-gdb-port" || arg.find("-gdb-port=") == 0)
+      {
+        unsigned port;
+        if (1 == sscanf(&argv[i][9], "=%u", &port) && port > 0 && port <= 65535)
+          cmd_line.gdb_port = port;
+        else
+        {
+          ErrorLog("'-gdb-port' requires a TCP port number (e.g., '-gdb-port=2345').");
+          cmd_line.error = true;
+        }
+      }
 #endif
 #ifdef DEBUG
       else if (arg == "-gfx-state" || arg.find("-gfx-state=") == 0)
@@ -1843,6 +3492,7 @@ static ParsedCommandLine ParseCommandLine(int argc, char **argv)
 
 int main(int argc, char **argv)
 {
+  s_startupTicks = CThread::GetPerformanceCounter();
   Title();
   if (argc <= 1)
   {
@@ -1872,6 +3522,7 @@ int main(int argc, char **argv)
   InfoLog("Started as:");
   for (int i = 0; i < argc; i++)
     InfoLog("  argv[%d] = %s", i, argv[i]);
+  MarkStartupPhase("Command line and logging");
 
   // Finish processing command line
   if (cmd_line.print_help)
@@ -1910,20 +3561,237 @@ int main(int argc, char **argv)
     if (rom_specified || print_games)
     {
       std::string xml_file = config3["GameXMLFile"].ValueAs<std::string>();
-      GameLoader loader(xml_file);
+      std::unique_ptr<GameLoader> loader(new GameLoader(xml_file, config3["ROMCacheDirectory"].ValueAs<std::string>()));
+      MarkStartupPhase("Game definitions");
       if (print_games)
       {
-        PrintGameList(xml_file, loader.GetGames());
+        PrintGameList(xml_file, loader->GetGames());
         return 0;
       }
-      if (loader.Load(&game, &rom_set, *cmd_line.rom_files.begin()))
+      if (config3["VerifyROMs"].ValueAs<bool>())
+        return VerifyROMs(*loader, *cmd_line.rom_files.begin());
+      if (config3["ConvertROMs"].ValueAs<bool>())
+        return ConvertROMs(*loader, cmd_line.rom_files);
+      if (loader->Load(&game, &rom_set, *cmd_line.rom_files.begin(), config3["ROMCacheDirectory"].ValueAs<std::string>()))
         return 1;
+      MarkStartupPhase("ROM set loading");
+      if (!rom_set.verified && config3["VerifyROMsInBackground"].ValueAs<bool>())
+      {
+        // Kept for the verification thread
+        s_romVerification.loader = std::move(loader);
+        s_romVerification.zipfilename = *cmd_line.rom_files.begin();
+      }
+      if (!game.performance.empty())
+      {
+        // The game's performance profile replaces the defaults it covers,
+        // and is itself overridden by anything in the .ini file
+        Util::Config::Node defaults = DefaultConfig();
+        for (auto &setting: game.performance)
+        {
+          if (defaults.TryGet(setting.first) != nullptr)
+            defaults.Set(setting.first, setting.second);
+          else
+            ErrorLog("%s: Ignoring unknown setting '%s' in performance profile of '%s'.", xml_file.c_str(), setting.first.c_str(), game.name.c_str());
+        }
+        Util::Config::MergeINISections(&fileConfigWithDefaults, defaults, fileConfig);
+        Util::Config::MergeINISections(&config3, fileConfigWithDefaults, cmd_line.config);
+      }
       Util::Config::MergeINISections(&config4, config3, fileConfig[game.name]);   // apply game-specific config
     }
     else
       config4 = config3;
     Util::Config::MergeINISections(&s_runtime_config, config4, cmd_line.config);  // apply command line overrides once more
   }
+
+  // Auto-tuning runs the game in processes of its own, with each setting
+  if (rom_specified && s_runtime_config["AutoTuneFrames"].ValueAs<unsigned>() > 0)
+    return AutoTune(argc, argv, &fileConfig, game, s_runtime_config["AutoTuneFrames"].ValueAs<unsigned>());
+
+  // Running ahead restores the state of the whole emulator every frame, so it
+  // must all run in one thread
+  if (s_runtime_config["RunAheadFrames"].ValueAs<unsigned>() > 0 && (s_runtime_config["MultiThreaded"].ValueAs<bool>() || s_runtime_config["GPUMultiThreaded"].ValueAs<bool>()))
+  {
+    InfoLog("Run-ahead is enabled: disabling multi-threading.");
+    s_runtime_config.Get("MultiThreaded").SetValue(false);
+    s_runtime_config.Get("GPUMultiThreaded").SetValue(false);
+  }
+
+  // Rewinding saves the state of the whole emulator every frame, and tracks
+  // the memory pages written in between, so it must all run in one thread too
+  if (s_runtime_config["RewindFrames"].ValueAs<unsigned>() > 0 && (s_runtime_config["MultiThreaded"].ValueAs<bool>() || s_runtime_config["GPUMultiThreaded"].ValueAs<bool>()))
+  {
+    InfoLog("Rewind is enabled: disabling multi-threading.");
+    s_runtime_config.Get("MultiThreaded").SetValue(false);
+    s_runtime_config.Get("GPUMultiThreaded").SetValue(false);
+  }
+
+#ifdef NET_BOARD
+  // Simulated peers link with the simulated net board, in lockstep
+  if (s_runtime_config["NetSimPeers"].ValueAs<unsigned>() > 0)
+  {
+    if (!s_runtime_config["Network"].ValueAs<bool>() || !s_runtime_config["SimulateNet"].ValueAs<bool>())
+    {
+      InfoLog("Net peers are simulated: enabling the simulated net board.");
+      s_runtime_config.Get("Network").SetValue(true);
+      s_runtime_config.Get("SimulateNet").SetValue(true);
+    }
+    if (s_runtime_config["NetRollback"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Net peers are simulated: disabling net rollback.");
+      s_runtime_config.Get("NetRollback").SetValue("0");
+    }
+  }
+
+  // Rolling back the net board loads earlier states and runs the frames since
+  // again in one go, so as with running ahead it must all run in one thread,
+  // and it makes its own use of the saved states
+  if (s_runtime_config["NetRollback"].ValueAs<unsigned>() > 0)
+  {
+    if (s_runtime_config["MultiThreaded"].ValueAs<bool>() || s_runtime_config["GPUMultiThreaded"].ValueAs<bool>())
+    {
+      InfoLog("Net rollback is enabled: disabling multi-threading.");
+      s_runtime_config.Get("MultiThreaded").SetValue(false);
+      s_runtime_config.Get("GPUMultiThreaded").SetValue(false);
+    }
+    if (s_runtime_config["RunAheadFrames"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Net rollback is enabled: disabling run-ahead.");
+      s_runtime_config.Get("RunAheadFrames").SetValue("0");
+    }
+  }
+#endif
+
+  // Input recordings must replay exactly the same frames: the inputs must be
+  // read at the same point of every frame, which needs a single thread, and
+  // rewinding would change the frames recorded
+  bool recordInputs = !s_runtime_config["RecordInputsFile"].ValueAs<std::string>().empty();
+  bool replayInputs = !s_runtime_config["ReplayInputsFile"].ValueAs<std::string>().empty();
+  if (recordInputs && replayInputs)
+  {
+    InfoLog("Replaying inputs: not recording inputs.");
+    s_runtime_config.Get("RecordInputsFile").SetValue("");
+  }
+  bool benchmark = s_runtime_config["BenchmarkFrames"].ValueAs<unsigned>() > 0;
+  if (recordInputs || replayInputs)
+  {
+    // When benchmarking, the multi-threaded paths are measured too, with the
+    // replayed inputs still read at the same point of every frame
+    if ((recordInputs || !benchmark) && (s_runtime_config["MultiThreaded"].ValueAs<bool>() || s_runtime_config["GPUMultiThreaded"].ValueAs<bool>()))
+    {
+      InfoLog("Recording or replaying inputs: disabling multi-threading.");
+      s_runtime_config.Get("MultiThreaded").SetValue(false);
+      s_runtime_config.Get("GPUMultiThreaded").SetValue(false);
+    }
+    if (s_runtime_config["RewindFrames"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Recording or replaying inputs: disabling rewind.");
+      s_runtime_config.Get("RewindFrames").SetValue("0");
+    }
+  }
+  // Memory is hashed as frames finish, which must be between the frames
+  // emulated by each board
+  if (s_runtime_config["CaptureMemory"].ValueAs<bool>() && s_runtime_config["CaptureInterval"].ValueAs<unsigned>() > 0 &&
+      (s_runtime_config["MultiThreaded"].ValueAs<bool>() || s_runtime_config["GPUMultiThreaded"].ValueAs<bool>()))
+  {
+    InfoLog("Capturing memory hashes: disabling multi-threading.");
+    s_runtime_config.Get("MultiThreaded").SetValue(false);
+    s_runtime_config.Get("GPUMultiThreaded").SetValue(false);
+  }
+  if (replayInputs && !s_runtime_config["InitStateFile"].ValueAs<std::string>().empty())
+  {
+    InfoLog("Replaying inputs: not loading initial save state.");
+    s_runtime_config.Get("InitStateFile").SetValue("");
+  }
+
+  // Latched inputs are polled by the PowerPC as the game reads them, which
+  // must happen in the main thread as the input system is polled there, and
+  // would overwrite replayed inputs and differ from those recorded or those
+  // the frames run ahead or rolled back were emulated with
+  if (s_runtime_config["LatchInputs"].ValueAs<bool>())
+  {
+    if (recordInputs || replayInputs)
+    {
+      InfoLog("Recording or replaying inputs: disabling input latching.");
+      s_runtime_config.Get("LatchInputs").SetValue(false);
+    }
+    else if (s_runtime_config["RunAheadFrames"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Run-ahead is enabled: disabling input latching.");
+      s_runtime_config.Get("LatchInputs").SetValue(false);
+    }
+#ifdef NET_BOARD
+    else if (s_runtime_config["NetRollback"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Net rollback is enabled: disabling input latching.");
+      s_runtime_config.Get("LatchInputs").SetValue(false);
+    }
+#endif
+    else if (s_runtime_config["MultiThreaded"].ValueAs<bool>() && s_runtime_config["GPUMultiThreaded"].ValueAs<bool>())
+    {
+      InfoLog("Latching inputs: disabling GPU multi-threading.");
+      s_runtime_config.Get("GPUMultiThreaded").SetValue(false);
+    }
+  }
+
+  // Interpolated positions depend on when the frame is emulated, so they too
+  // would differ from those recorded or emulated first
+  if (s_runtime_config["InterpolateAim"].ValueAs<bool>())
+  {
+    if (recordInputs || replayInputs)
+    {
+      InfoLog("Recording or replaying inputs: disabling aim interpolation.");
+      s_runtime_config.Get("InterpolateAim").SetValue(false);
+    }
+    else if (s_runtime_config["RunAheadFrames"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Run-ahead is enabled: disabling aim interpolation.");
+      s_runtime_config.Get("InterpolateAim").SetValue(false);
+    }
+#ifdef NET_BOARD
+    else if (s_runtime_config["NetRollback"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Net rollback is enabled: disabling aim interpolation.");
+      s_runtime_config.Get("InterpolateAim").SetValue(false);
+    }
+#endif
+  }
+
+  // There is no display to synchronize to when headless
+  s_headless = s_runtime_config["Headless"].ValueAs<bool>();
+  if (s_headless && s_runtime_config["VSync"].ValueAs<bool>())
+  {
+    InfoLog("Headless: disabling VSync.");
+    s_runtime_config.Get("VSync").SetValue(false);
+  }
+
+  // Benchmarks run as fast as possible
+  if (benchmark && (s_runtime_config["Throttle"].ValueAs<bool>() || s_runtime_config["VSync"].ValueAs<bool>()))
+  {
+    InfoLog("Benchmarking: disabling frame limiting and VSync.");
+    s_runtime_config.Get("Throttle").SetValue(false);
+    s_runtime_config.Get("VSync").SetValue(false);
+  }
+
+  // MIDI recordings are played back from a reset, so they cannot include the
+  // state changes made by running ahead, rewinding, or loading a state
+  if (!s_runtime_config["RecordMIDIFile"].ValueAs<std::string>().empty())
+  {
+    if (s_runtime_config["RunAheadFrames"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Recording MIDI: disabling run-ahead.");
+      s_runtime_config.Get("RunAheadFrames").SetValue("0");
+    }
+    if (s_runtime_config["RewindFrames"].ValueAs<unsigned>() > 0)
+    {
+      InfoLog("Recording MIDI: disabling rewind.");
+      s_runtime_config.Get("RewindFrames").SetValue("0");
+    }
+    if (!s_runtime_config["InitStateFile"].ValueAs<std::string>().empty())
+    {
+      InfoLog("Recording MIDI: not loading initial save state.");
+      s_runtime_config.Get("InitStateFile").SetValue("");
+    }
+  }
   LogConfig(s_runtime_config);
 
   // Initialize SDL (individual subsystems get initialized later)
@@ -1944,6 +3812,15 @@ int main(int argc, char **argv)
 #endif // SUPERMODEL_DEBUGGER
   std::string selectedInputSystem = s_runtime_config["InputSystem"].ValueAs<std::string>();
 
+  // Play back a MIDI recording on the sound board alone, without a window
+  if (rom_specified && !s_runtime_config["ReplayMIDIFile"].ValueAs<std::string>().empty())
+  {
+    CModel3 *model3 = new CModel3(s_runtime_config);
+    exitCode = ReplayMIDI(game, &rom_set, model3, s_runtime_config["ReplayMIDIFile"].ValueAs<std::string>(), s_runtime_config["ReplayWAVFile"].ValueAs<std::string>());
+    delete model3;
+    goto Exit;
+  }
+
   // Create a window
   xRes = 496;
   yRes = 384;
@@ -1952,6 +3829,7 @@ int main(int argc, char **argv)
     exitCode = 1;
     goto Exit;
   }
+  MarkStartupPhase("SDL and OpenGL initialization");
 
   // Create Crosshair
   s_crosshair = new CCrosshair(s_runtime_config);
@@ -1962,6 +3840,21 @@ int main(int argc, char **argv)
       goto Exit;
   }
 
+  // Create the frame rate overlay, or show the frame rate in the title bar
+  if (s_runtime_config["ShowFrameRate"].ValueAs<bool>() && s_runtime_config["FrameRateOverlay"].ValueAs<bool>())
+  {
+    s_statsOverlay = new CStatsOverlay();
+    if (s_statsOverlay->Init() != OKAY)
+    {
+      ErrorLog("Unable to create the frame rate overlay. Showing the frame rate in the title bar instead.");
+      delete s_statsOverlay;
+      s_statsOverlay = nullptr;
+    }
+  }
+
+  // Read back of frames
+  s_frameCapture = new CFrameCapture();
+
   // Create Model 3 emulator
 #ifdef DEBUG
   Model3 = s_gfxStatePath.empty() ? static_cast<IEmulator *>(new CModel3(s_runtime_config)) : static_cast<IEmulator *>(new CModel3GraphicsState(s_runtime_config, s_gfxStatePath));
@@ -2004,6 +3897,7 @@ int main(int argc, char **argv)
     exitCode = 1;
     goto Exit;
   }
+  MarkStartupPhase("Emulator construction and inputs");
 
   if (cmd_line.print_inputs)
   {
@@ -2014,22 +3908,54 @@ int main(int argc, char **argv)
   if (!rom_specified)
     goto Exit;
 
-  // Create outputs
-#ifdef SUPERMODEL_WIN32
+  // Create outputs: Windows messages are sent by the outputs themselves, the
+  // streams by sinks
   {
-    std::string outputs = s_runtime_config["Outputs"].ValueAs<std::string>();
-    if (outputs == "none")
-      Outputs = NULL;
-    else if (outputs == "win")
-      Outputs = new CWinOutputs();
-    else
+    std::vector<std::unique_ptr<IOutputSink>> sinks;
+#ifdef SUPERMODEL_WIN32
+    bool winOutputs = false;
+#endif
+    for (const std::string &output : Util::Format(s_runtime_config["Outputs"].ValueAs<std::string>()).Split(','))
     {
-      ErrorLog("Unknown outputs: %s\n", outputs.c_str());
-      exitCode = 1;
-      goto Exit;
+      OutputStream::Stream *stream = nullptr;
+      if (output == "none")
+        continue;
+#ifdef SUPERMODEL_WIN32
+      else if (output == "win")
+        winOutputs = true;
+#endif
+      else if (output == "udp")
+      {
+        std::string address = s_runtime_config["OutputsAddress"].ValueAs<std::string>();
+        unsigned port = s_runtime_config["OutputsPort"].ValueAs<unsigned>();
+        if ((stream = OutputStream::OpenUDP(address, port)) == nullptr)
+          ErrorLog("Unable to send outputs to %s:%u.", address.c_str(), port);
+      }
+      else if (output == "pipe")
+      {
+        std::string pipe = s_runtime_config["OutputsPipe"].ValueAs<std::string>();
+        if ((stream = OutputStream::OpenPipe(pipe)) == nullptr)
+          ErrorLog("Unable to create outputs pipe '%s'.", pipe.c_str());
+      }
+      else
+      {
+        ErrorLog("Unknown outputs: %s\n", output.c_str());
+        exitCode = 1;
+        goto Exit;
+      }
+      if (stream != nullptr)
+        sinks.emplace_back(new COutputStreamSink(stream));
     }
+
+#ifdef SUPERMODEL_WIN32
+    if (winOutputs)
+      Outputs = new CWinOutputs();
+#endif
+    if (Outputs == NULL && !sinks.empty())
+      Outputs = new COutputs();
+    for (auto &sink : sinks)
+      Outputs->AddSink(std::move(sink));
   }
-#endif // SUPERMODEL_WIN32
 
   // Initialize outputs
   if (Outputs != NULL && !Outputs->Initialize())
@@ -2044,6 +3970,7 @@ int main(int argc, char **argv)
   if (!cmd_line.disable_debugger)
   {
     Debugger = std::make_shared<Debugger::CSupermodelDebugger>(dynamic_cast<CModel3 *>(Model3), Inputs, logger);
+    Debugger->SetGDBPort(cmd_line.gdb_port);
     // If -enter-debugger option was set force debugger to break straightaway
     if (cmd_line.enter_debugger)
       Debugger->ForceBreak(true);
@@ -2057,6 +3984,7 @@ int main(int argc, char **argv)
   delete Model3;
 
 Exit:
+  WaitForROMVerification();
   if (Inputs != NULL)
     delete Inputs;
   if (InputSystem != NULL)
@@ -2065,6 +3993,10 @@ Exit:
     delete Outputs;
   if (s_crosshair != NULL)
       delete s_crosshair;
+  if (s_statsOverlay != NULL)
+    delete s_statsOverlay;
+  if (s_frameCapture != NULL)
+    delete s_frameCapture;
   DestroyGLScreen();
   SDL_Quit();
 
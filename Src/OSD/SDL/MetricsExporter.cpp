@@ -0,0 +1,209 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "MetricsExporter.h"
+#include "Supermodel.h"
+#include "OSD/Audio.h"
+#include "OSD/Thread.h"
+#include "Util/Format.h"
+#include <algorithm>
+
+void CMetricsExporter::AddFrame(const FrameTimings &timings, uint64_t intervalMicros)
+{
+  m_frames.fetch_add(1, std::memory_order_relaxed);
+  if (timings.renderSkipped)
+    m_skipped.fetch_add(1, std::memory_order_relaxed);
+  m_syncBytes.fetch_add(timings.syncSize, std::memory_order_relaxed);
+  m_syncMicros.fetch_add(timings.syncMicros, std::memory_order_relaxed);
+  m_frameMicros.fetch_add(timings.frameMicros, std::memory_order_relaxed);
+  m_busyMicros[0].fetch_add(timings.ppcMicros, std::memory_order_relaxed);
+  m_busyMicros[1].fetch_add(timings.renderMicros, std::memory_order_relaxed);
+  m_busyMicros[2].fetch_add(timings.sndMicros, std::memory_order_relaxed);
+  m_busyMicros[3].fetch_add(timings.drvMicros, std::memory_order_relaxed);
+  unsigned bucket = unsigned(std::min<uint64_t>(intervalMicros / BucketMicros, NumBuckets - 1));
+  m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  uint64_t maxMicros = m_maxIntervalMicros.load(std::memory_order_relaxed);
+  while (intervalMicros > maxMicros && !m_maxIntervalMicros.compare_exchange_weak(maxMicros, intervalMicros, std::memory_order_relaxed))
+    ;
+}
+
+void CMetricsExporter::SetNetStats(double rttMicros, double jitterMicros, uint64_t stalls)
+{
+  m_netRTTMicros.store(uint64_t(rttMicros), std::memory_order_relaxed);
+  m_netJitterMicros.store(uint64_t(jitterMicros), std::memory_order_relaxed);
+  m_netStalls.store(stalls, std::memory_order_relaxed);
+  m_netValid.store(true, std::memory_order_release);
+}
+
+void CMetricsExporter::ExportThread()
+{
+  uint64_t lastMicros = CThread::GetMicroseconds();
+  uint64_t lastCPUMicros = CThread::GetProcessCPUMicroseconds();
+  AudioStats lastAudio;
+  GetAudioStats(&lastAudio);
+  uint64_t lastNetStalls = m_netStalls.load(std::memory_order_relaxed);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_stop)
+  {
+    m_wake.wait_for(lock, std::chrono::seconds(m_intervalSeconds), [this]() { return m_stop; });
+    if (m_stop)
+      break;
+    lock.unlock();
+
+    // Counts since the last export, the audio and net ones being totals
+    uint64_t now = CThread::GetMicroseconds();
+    uint64_t cpuMicros = CThread::GetProcessCPUMicroseconds();
+    AudioStats audio;
+    GetAudioStats(&audio);
+    AudioStats audioSince = audio;
+    audioSince.underRuns = audio.underRuns - lastAudio.underRuns;
+    audioSince.overRuns = audio.overRuns - lastAudio.overRuns;
+    uint64_t netStalls = m_netStalls.load(std::memory_order_relaxed);
+    Export(now - lastMicros, cpuMicros != 0 ? cpuMicros - lastCPUMicros : 0, audioSince, netStalls - std::min(netStalls, lastNetStalls));
+    lastMicros = now;
+    lastCPUMicros = cpuMicros;
+    lastAudio = audio;
+    lastNetStalls = netStalls;
+
+    lock.lock();
+  }
+}
+
+void CMetricsExporter::Export(uint64_t elapsedMicros, uint64_t cpuMicros, const AudioStats &audio, uint64_t netStalls)
+{
+  // Take the counters. A frame being added meanwhile may be split between
+  // this export and the next, which does not matter over a few seconds.
+  uint64_t frames = m_frames.exchange(0, std::memory_order_relaxed);
+  uint64_t skipped = m_skipped.exchange(0, std::memory_order_relaxed);
+  uint64_t syncBytes = m_syncBytes.exchange(0, std::memory_order_relaxed);
+  uint64_t syncMicros = m_syncMicros.exchange(0, std::memory_order_relaxed);
+  uint64_t frameMicros = m_frameMicros.exchange(0, std::memory_order_relaxed);
+  uint64_t busyMicros[4];
+  for (int i = 0; i < 4; i++)
+    busyMicros[i] = m_busyMicros[i].exchange(0, std::memory_order_relaxed);
+  uint32_t buckets[NumBuckets];
+  uint64_t counted = 0;
+  for (unsigned i = 0; i < NumBuckets; i++)
+  {
+    buckets[i] = m_buckets[i].exchange(0, std::memory_order_relaxed);
+    counted += buckets[i];
+  }
+  uint64_t maxIntervalMicros = m_maxIntervalMicros.exchange(0, std::memory_order_relaxed);
+
+  // statsd lines, several to a datagram, kept small enough not to fragment
+  std::string packet;
+  auto send = [this, &packet](const char *name, double value, const char *type)
+  {
+    std::string line = Util::Format().Printf("%s.%s:%g|%s", m_prefix.c_str(), name, value, type);
+    if (!packet.empty() && packet.size() + 1 + line.size() > 1400)
+    {
+      OutputStream::Write(m_stream, packet.c_str(), packet.size());
+      packet.clear();
+    }
+    packet += packet.empty() ? line : "\n" + line;
+  };
+
+  double seconds = elapsedMicros / 1e6;
+  send("fps", frames / seconds, "g");
+  send("frames.skipped", double(skipped), "c");
+  if (frames > 0)
+  {
+    send("frame.work_ms", frameMicros / 1000.0 / frames, "g");
+    send("sync.bytes", double(syncBytes / frames), "g");
+    send("sync.ms", syncMicros / 1000.0 / frames, "g");
+  }
+
+  // Time between frames: percentiles from the histogram, nearest-rank, and
+  // the longest as measured, which may be past the last bucket
+  if (counted > 0)
+  {
+    static const struct { const char *name; unsigned percent; } percentiles[] =
+    {
+      { "frame.time_ms.p50", 50 }, { "frame.time_ms.p90", 90 }, { "frame.time_ms.p99", 99 }
+    };
+    for (auto &percentile : percentiles)
+    {
+      uint64_t rank = std::max<uint64_t>(1, (counted * percentile.percent + 99) / 100);
+      uint64_t seen = 0;
+      unsigned i = 0;
+      while (i < NumBuckets - 1 && (seen += buckets[i]) < rank)
+        i++;
+      send(percentile.name, (i + 0.5) * BucketMicros / 1000.0, "g");
+    }
+    send("frame.time_ms.max", maxIntervalMicros / 1000.0, "g");
+  }
+
+  // Share of the time each thread was busy, and the CPU time of the process
+  static const char *threads[4] = { "thread.ppc.busy", "thread.render.busy", "thread.sound.busy", "thread.drive.busy" };
+  for (int i = 0; i < 4; i++)
+    send(threads[i], 100.0 * busyMicros[i] / elapsedMicros, "g");
+  if (cpuMicros != 0)
+    send("cpu", 100.0 * cpuMicros / elapsedMicros, "g");
+
+  send("audio.underruns", audio.underRuns, "c");
+  send("audio.overruns", audio.overRuns, "c");
+  send("audio.fill", 100.0 * audio.fillLevel, "g");
+
+  if (m_netValid.load(std::memory_order_acquire))
+  {
+    send("net.rtt_ms", m_netRTTMicros.load(std::memory_order_relaxed) / 1000.0, "g");
+    send("net.jitter_ms", m_netJitterMicros.load(std::memory_order_relaxed) / 1000.0, "g");
+    send("net.stalls", double(netStalls), "c");
+  }
+
+  if (!packet.empty())
+    OutputStream::Write(m_stream, packet.c_str(), packet.size());
+}
+
+CMetricsExporter::CMetricsExporter(OutputStream::Stream *stream, const std::string &prefix, unsigned intervalSeconds)
+  : m_frames(0),
+    m_skipped(0),
+    m_syncBytes(0),
+    m_syncMicros(0),
+    m_frameMicros(0),
+    m_maxIntervalMicros(0),
+    m_netRTTMicros(0),
+    m_netJitterMicros(0),
+    m_netStalls(0),
+    m_netValid(false),
+    m_stream(stream),
+    m_prefix(prefix),
+    m_intervalSeconds(std::max(1u, intervalSeconds)),
+    m_stop(false)
+{
+  for (auto &busy : m_busyMicros)
+    busy.store(0, std::memory_order_relaxed);
+  for (auto &bucket : m_buckets)
+    bucket.store(0, std::memory_order_relaxed);
+  m_thread = std::thread(&CMetricsExporter::ExportThread, this);
+}
+
+CMetricsExporter::~CMetricsExporter()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+  OutputStream::Close(m_stream);
+}
@@ -0,0 +1,113 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * MetricsExporter.h
+ *
+ * Periodic export of performance metrics to a statsd server, for keeping an
+ * eye on many cabinets at once (see -metrics-address).
+ */
+
+#ifndef INCLUDED_METRICSEXPORTER_H
+#define INCLUDED_METRICSEXPORTER_H
+
+#include "Model3/FrameStats.h"
+#include "OSD/OutputStream.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct AudioStats;
+
+/*
+ * CMetricsExporter:
+ *
+ * Aggregates the timings of each frame into counters, a histogram of the
+ * time between frames and the longest of those times, and every few seconds sends them, along with the
+ * audio buffer under- and over-runs, the net link and the CPU time used, as
+ * statsd datagrams over UDP from a thread of its own. The emulation thread
+ * only increments atomic counters, which the exporting thread takes and zeros,
+ * so neither ever waits for the other.
+ */
+class CMetricsExporter
+{
+public:
+  static const unsigned BucketMicros = 100;
+  static const unsigned NumBuckets = 1000;  // up to 100 ms, longer times are counted in the last
+
+  /*
+   * AddFrame(timings, intervalMicros):
+   *
+   * Counts a frame emulated, with the time since the previous one. Called
+   * from the emulation thread.
+   */
+  void AddFrame(const FrameTimings &timings, uint64_t intervalMicros);
+
+  /*
+   * SetNetStats(rttMicros, jitterMicros, stalls):
+   *
+   * Sets the net link's smoothed round trip and jitter, and the total number
+   * of frames it has stalled, as last read. May be called from any thread.
+   */
+  void SetNetStats(double rttMicros, double jitterMicros, uint64_t stalls);
+
+  /*
+   * CMetricsExporter(stream, prefix, intervalSeconds):
+   *
+   * Starts sending metrics named <prefix>.<metric> to the stream every
+   * intervalSeconds. The stream is closed by the destructor.
+   */
+  CMetricsExporter(OutputStream::Stream *stream, const std::string &prefix, unsigned intervalSeconds);
+  ~CMetricsExporter();
+
+private:
+  // Counters since the last export, zeroed as they are taken
+  std::atomic<uint64_t> m_frames;
+  std::atomic<uint64_t> m_skipped;
+  std::atomic<uint64_t> m_syncBytes;
+  std::atomic<uint64_t> m_syncMicros;
+  std::atomic<uint64_t> m_frameMicros;
+  std::atomic<uint64_t> m_busyMicros[4];  // PPC, render, sound and drive board threads
+  std::atomic<uint32_t> m_buckets[NumBuckets];
+  std::atomic<uint64_t> m_maxIntervalMicros;
+
+  // Net link, as last read
+  std::atomic<uint64_t> m_netRTTMicros;
+  std::atomic<uint64_t> m_netJitterMicros;
+  std::atomic<uint64_t> m_netStalls;
+  std::atomic<bool> m_netValid;
+
+  OutputStream::Stream *m_stream;
+  const std::string m_prefix;
+  const unsigned m_intervalSeconds;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  bool m_stop;
+  std::thread m_thread;
+
+  void ExportThread();
+  void Export(uint64_t elapsedMicros, uint64_t cpuMicros, const AudioStats &audio, uint64_t netStalls);
+};
+
+#endif  // INCLUDED_METRICSEXPORTER_H
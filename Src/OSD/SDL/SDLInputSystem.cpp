@@ -182,6 +182,7 @@ CSDLInputSystem::CSDLInputSystem(const Util::Config::Node& config)
 
 CSDLInputSystem::~CSDLInputSystem()
 {
+  StopForceFeedback();
   CloseJoysticks();
 }
 
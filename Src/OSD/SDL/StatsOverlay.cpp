@@ -0,0 +1,256 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StatsOverlay.h"
+#include "Supermodel.h"
+#include <algorithm>
+
+// 5x7 font of ASCII 32 to 95, a byte per row with the leftmost pixel in bit
+// 4, padded to 8 rows
+static const GLubyte s_font[64][8] =
+{
+  { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // space
+  { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04, 0x00 },  // !
+  { 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // "
+  { 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A, 0x00 },  // #
+  { 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04, 0x00 },  // $
+  { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03, 0x00 },  // %
+  { 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D, 0x00 },  // &
+  { 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '
+  { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02, 0x00 },  // (
+  { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08, 0x00 },  // )
+  { 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00, 0x00 },  // *
+  { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00, 0x00 },  // +
+  { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08, 0x00 },  // ,
+  { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00, 0x00 },  // -
+  { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },  // .
+  { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00, 0x00 },  // /
+  { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E, 0x00 },  // 0
+  { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00 },  // 1
+  { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F, 0x00 },  // 2
+  { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E, 0x00 },  // 3
+  { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02, 0x00 },  // 4
+  { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E, 0x00 },  // 5
+  { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E, 0x00 },  // 6
+  { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08, 0x00 },  // 7
+  { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E, 0x00 },  // 8
+  { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C, 0x00 },  // 9
+  { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00, 0x00 },  // :
+  { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08, 0x00 },  // ;
+  { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02, 0x00 },  // <
+  { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00, 0x00 },  // =
+  { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08, 0x00 },  // >
+  { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04, 0x00 },  // ?
+  { 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E, 0x00 },  // @
+  { 0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00 },  // A
+  { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E, 0x00 },  // B
+  { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E, 0x00 },  // C
+  { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C, 0x00 },  // D
+  { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F, 0x00 },  // E
+  { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10, 0x00 },  // F
+  { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F, 0x00 },  // G
+  { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11, 0x00 },  // H
+  { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E, 0x00 },  // I
+  { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C, 0x00 },  // J
+  { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11, 0x00 },  // K
+  { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F, 0x00 },  // L
+  { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11, 0x00 },  // M
+  { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x00 },  // N
+  { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00 },  // O
+  { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10, 0x00 },  // P
+  { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D, 0x00 },  // Q
+  { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11, 0x00 },  // R
+  { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E, 0x00 },  // S
+  { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00 },  // T
+  { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00 },  // U
+  { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04, 0x00 },  // V
+  { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A, 0x00 },  // W
+  { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11, 0x00 },  // X
+  { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x00 },  // Y
+  { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F, 0x00 },  // Z
+  { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E, 0x00 },  // [
+  { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00 },  // backslash
+  { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E, 0x00 },  // ]
+  { 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00 },  // ^
+  { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x00 },  // _
+};
+
+bool CStatsOverlay::Init()
+{
+  static const char *vertexShader = R"glsl(
+
+    #version 410 core
+
+    uniform vec2 cellSize;                  // in normalized device coordinates
+    layout(location = 0) in ivec4 inGlyph;  // column, row, font index
+    flat out int glyph;
+    out vec2 cellPos;                       // in font pixels
+
+    void main(void)
+    {
+      vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+      cellPos = corner * vec2(6.0, 9.0);
+      glyph = inGlyph.z;
+      vec2 pos = (vec2(inGlyph.xy) + corner) * cellSize;
+      gl_Position = vec4(pos.x - 1.0, 1.0 - pos.y, 0.0, 1.0);
+    }
+    )glsl";
+
+  static const char *fragmentShader = R"glsl(
+
+    #version 410 core
+
+    uniform usampler2D font;
+    flat in int glyph;
+    in vec2 cellPos;
+    out vec4 fragColour;
+
+    void main(void)
+    {
+      // Characters sit a pixel in from the top left of their cells, on a
+      // translucent background
+      ivec2 p = ivec2(cellPos) - ivec2(1, 1);
+      bool lit = false;
+      if (p.x >= 0 && p.x < 5 && p.y >= 0 && p.y < 7)
+        lit = ((texelFetch(font, ivec2(p.y, glyph), 0).r >> uint(4 - p.x)) & 1u) != 0u;
+      fragColour = lit ? vec4(1.0, 1.0, 1.0, 1.0) : vec4(0.0, 0.0, 0.0, 0.6);
+    }
+    )glsl";
+
+  if (!m_shader.LoadShaders(vertexShader, fragmentShader))
+    return FAIL;
+  m_shader.GetUniformLocationMap("cellSize");
+  m_shader.GetUniformLocationMap("font");
+
+  // Font rows, one glyph per row of the texture
+  glGenTextures(1, &m_fontTexId);
+  glBindTexture(GL_TEXTURE_2D, m_fontTexId);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, 8, 64, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, s_font);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_vbo.Create(GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW, sizeof(Glyph) * MaxGlyphs);
+  glGenVertexArrays(1, &m_vao);
+  glBindVertexArray(m_vao);
+  m_vbo.Bind(true);
+  glVertexAttribIPointer(0, 4, GL_SHORT, sizeof(Glyph), 0);
+  glVertexAttribDivisor(0, 1);
+  glEnableVertexAttribArray(0);
+  m_vbo.Bind(false);
+  glBindVertexArray(0);
+
+  m_glyphs.reserve(MaxGlyphs);
+  return OKAY;
+}
+
+void CStatsOverlay::SetText(const std::string &text)
+{
+  std::lock_guard<std::mutex> lock(m_textLock);
+  if (text != m_text)
+  {
+    m_text = text;
+    m_textChanged = true;
+  }
+}
+
+void CStatsOverlay::BuildGlyphs(const std::string &text)
+{
+  m_glyphs.clear();
+  GLshort column = 0;
+  GLshort row = 0;
+  for (char c : text)
+  {
+    if (c == '\n')
+    {
+      column = 0;
+      row++;
+      continue;
+    }
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    else if (c < ' ' || c > '_')
+      c = '?';
+    if (m_glyphs.size() < size_t(MaxGlyphs))
+      m_glyphs.push_back({ column, row, GLshort(c - ' '), 0 });
+    column++;
+  }
+}
+
+void CStatsOverlay::Draw(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yRes)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_textLock);
+    if (m_textChanged)
+    {
+      BuildGlyphs(m_text);
+      m_textChanged = false;
+      m_numGlyphs = int(m_glyphs.size());
+      if (m_numGlyphs > 0)
+      {
+        m_vbo.Bind(true);
+        m_vbo.BufferSubData(0, m_numGlyphs * sizeof(Glyph), m_glyphs.data());
+        m_vbo.Bind(false);
+      }
+    }
+  }
+  if (m_numGlyphs == 0 || xRes == 0 || yRes == 0)
+    return;
+
+  // Font pixels a whole number of screen pixels, about 360 lines of them
+  float scale = float((std::max)(1u, yRes / 360));
+
+  glViewport(xOffset, yOffset, xRes, yRes);
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  m_shader.EnableShader();
+  glUniform2f(m_shader.uniformLocMap["cellSize"], 2.0f * CellWidth * scale / xRes, 2.0f * CellHeight * scale / yRes);
+  glUniform1i(m_shader.uniformLocMap["font"], 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_fontTexId);
+
+  glBindVertexArray(m_vao);
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_numGlyphs);
+  glBindVertexArray(0);
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  m_shader.DisableShader();
+  glDisable(GL_BLEND);
+}
+
+CStatsOverlay::CStatsOverlay()
+  : m_textChanged(false),
+    m_numGlyphs(0),
+    m_vao(0),
+    m_fontTexId(0)
+{
+}
+
+CStatsOverlay::~CStatsOverlay()
+{
+  if (m_vao != 0)
+    glDeleteVertexArrays(1, &m_vao);
+  if (m_fontTexId != 0)
+    glDeleteTextures(1, &m_fontTexId);
+  m_vbo.Destroy();
+}
@@ -0,0 +1,96 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * StatsOverlay.h
+ *
+ * Text drawn over the picture, such as the frame rate and statistics shown
+ * with -show-fps.
+ */
+
+#ifndef INCLUDED_STATSOVERLAY_H
+#define INCLUDED_STATSOVERLAY_H
+
+#include "Graphics/New3D/GLSLShader.h"
+#include "Graphics/New3D/VBO.h"
+#include <GL/glew.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * CStatsOverlay:
+ *
+ * Draws lines of text over the top left of the picture with a built-in 5x7
+ * font. Each character is one instance of a quad, all drawn by a single call,
+ * and the instances are only uploaded again when the text changes, so the
+ * overlay costs next to nothing per frame. Lower case letters are drawn in
+ * upper case.
+ */
+class CStatsOverlay
+{
+public:
+  bool Init();
+
+  /*
+   * SetText(text):
+   *
+   * Sets the text to draw from the next frame on, lines separated by '\n'.
+   * Nothing is drawn while it is empty. May be called from any thread.
+   */
+  void SetText(const std::string &text);
+
+  /*
+   * Draw(xOffset, yOffset, xRes, yRes):
+   *
+   * Draws the text into the given viewport, scaled with its height. Called
+   * from the thread rendering, at the end of each frame.
+   */
+  void Draw(unsigned xOffset, unsigned yOffset, unsigned xRes, unsigned yRes);
+
+  CStatsOverlay();
+  ~CStatsOverlay();
+
+private:
+  static const int MaxGlyphs = 2048;
+  static const int CellWidth = 6;    // font pixels, including the spacing
+  static const int CellHeight = 9;
+
+  struct Glyph
+  {
+    GLshort column, row, index, padding;
+  };
+
+  std::mutex m_textLock;
+  std::string m_text;
+  bool m_textChanged;
+
+  std::vector<Glyph> m_glyphs;
+  int m_numGlyphs;
+  GLSLShader m_shader;
+  VBO m_vbo;
+  GLuint m_vao;
+  GLuint m_fontTexId;
+
+  void BuildGlyphs(const std::string &text);
+};
+
+#endif  // INCLUDED_STATSOVERLAY_H
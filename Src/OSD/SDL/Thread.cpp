@@ -29,17 +29,127 @@
 
 #include "Supermodel.h"
 #include "SDLIncludes.h"
+#include "OSD/Trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#define CPU_RELAX()	_mm_pause()
+#else
+#define CPU_RELAX()
+#endif
 
 void CThread::Sleep(UINT32 ms)
 {
 	SDL_Delay(ms);
 }
 
+void CThread::SleepMicroseconds(UINT64 us)
+{
+	if (us == 0)
+		return;
+#ifdef _WIN32
+	// High resolution timers (Windows 10 1803 on) are not bound by the timer
+	// tick, which is 1 ms at best. Each thread keeps one, or falls back on the
+	// ordinary kind.
+	static thread_local HANDLE timer = NULL;
+	static thread_local bool created = false;
+	if (!created)
+	{
+		created = true;
+		timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (timer == NULL)
+			timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+	}
+	LARGE_INTEGER due;
+	due.QuadPart = -LONGLONG(us * 10);	// relative, in 100 ns units
+	if (timer != NULL && SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+		WaitForSingleObject(timer, INFINITE);
+	else
+		::Sleep(DWORD((us + 999) / 1000));
+#elif defined(__linux__)
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	t.tv_sec += time_t(us / 1000000);
+	t.tv_nsec += long(us % 1000000) * 1000;
+	if (t.tv_nsec >= 1000000000)
+	{
+		t.tv_sec++;
+		t.tv_nsec -= 1000000000;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+		;
+#else
+	timespec t;
+	t.tv_sec = time_t(us / 1000000);
+	t.tv_nsec = long(us % 1000000) * 1000;
+	while (nanosleep(&t, &t) != 0 && errno == EINTR)
+		;
+#endif
+}
+
 UINT32 CThread::GetTicks()
 {
 	return SDL_GetTicks();
 }
 
+UINT64 CThread::GetPerformanceCounter()
+{
+	return SDL_GetPerformanceCounter();
+}
+
+UINT64 CThread::GetPerformanceFrequency()
+{
+	return SDL_GetPerformanceFrequency();
+}
+
+UINT64 CThread::GetMicroseconds()
+{
+	static const UINT64 frequency = SDL_GetPerformanceFrequency();
+	UINT64 count = SDL_GetPerformanceCounter();
+	return (count / frequency) * 1000000 + (count % frequency) * 1000000 / frequency;
+}
+
+UINT64 CThread::GetProcessCPUMicroseconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0;
+	UINT64 kernelTicks = (UINT64(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+	UINT64 userTicks = (UINT64(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+	return (kernelTicks + userTicks) / 10;	// 100 ns units
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return UINT64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + UINT64(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+static std::atomic<bool> s_powerSaving(false);
+
+void CThread::SetPowerSaving(bool enable)
+{
+	s_powerSaving.store(enable, std::memory_order_relaxed);
+}
+
 CThread *CThread::CreateThread(const std::string &name, ThreadStart start, void *startParam)
 {
 	SDL_Thread *impl = SDL_CreateThread(start, name.c_str(), startParam);
@@ -72,6 +182,20 @@ CMutex *CThread::CreateMutex()
 	return new CMutex(impl);
 }
 
+CFrameBarrier *CThread::CreateFrameBarrier(unsigned count)
+{
+	SDL_mutex *mutex = SDL_CreateMutex();
+	if (mutex == NULL)
+		return NULL;
+	SDL_cond *cond = SDL_CreateCond();
+	if (cond == NULL)
+	{
+		SDL_DestroyMutex(mutex);
+		return NULL;
+	}
+	return new CFrameBarrier(count, mutex, cond);
+}
+
 const char *CThread::GetLastError()
 {
 	return SDL_GetError();
@@ -131,6 +255,7 @@ UINT32 CSemaphore::GetValue()
 
 bool CSemaphore::Wait()
 {
+	Trace::Scope scope("SemaphoreWait");
 	return SDL_SemWait((SDL_sem*)m_impl) == 0;
 }
 
@@ -151,6 +276,7 @@ CCondVar::~CCondVar()
 
 bool CCondVar::Wait(CMutex *mutex)
 {
+	Trace::Scope scope("CondVarWait");
 	return SDL_CondWait((SDL_cond*)m_impl, (SDL_mutex*)mutex->m_impl) == 0;
 }
 
@@ -183,3 +309,268 @@ bool CMutex::Unlock()
 {
 	return SDL_mutexV((SDL_mutex*)m_impl) == 0;
 }
+
+// How long a waiting thread spins, and then yields, before blocking
+static const UINT64 BARRIER_SPIN_US		= 50;
+static const UINT64 BARRIER_YIELD_US	= 200;
+
+CFrameBarrier::CFrameBarrier(unsigned count, void *mutex, void *cond)
+  : m_count(count),
+    m_arrived(0),
+    m_generation(0),
+    m_blocked(0),
+    m_mutex(mutex),
+    m_cond(cond)
+{
+	//
+}
+
+CFrameBarrier::~CFrameBarrier()
+{
+	SDL_DestroyCond((SDL_cond*)m_cond);
+	SDL_DestroyMutex((SDL_mutex*)m_mutex);
+}
+
+bool CFrameBarrier::Wait(UINT32 *waitMicroseconds)
+{
+	Trace::Scope scope("FrameBarrierWait");
+	UINT64 start = SDL_GetPerformanceCounter();
+	unsigned generation = m_generation.load(std::memory_order_acquire);
+	bool ok = true;
+
+	// Each thread's writes during the frame are released as it arrives, and
+	// acquired by all of them as they leave
+	if (m_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == m_count)
+	{
+		// Last to arrive: release the others. A thread about to block
+		// increments m_blocked before checking the generation, so either it
+		// sees the new generation or it is counted here and signalled (both
+		// sides sequentially consistent).
+		m_arrived.store(0, std::memory_order_relaxed);
+		m_generation.store(generation + 1, std::memory_order_seq_cst);
+		if (m_blocked.load(std::memory_order_seq_cst) != 0)
+		{
+			if (SDL_LockMutex((SDL_mutex*)m_mutex) != 0)
+				return false;
+			ok = SDL_CondBroadcast((SDL_cond*)m_cond) == 0;
+			ok = SDL_UnlockMutex((SDL_mutex*)m_mutex) == 0 && ok;
+		}
+	}
+	else
+	{
+		UINT64 freq = SDL_GetPerformanceFrequency();
+		static const bool spin = std::thread::hardware_concurrency() > 1;	// pointless on one CPU
+		bool powerSaving = s_powerSaving.load(std::memory_order_relaxed);
+		UINT64 spinEnd = start + (spin && !powerSaving ? BARRIER_SPIN_US * freq / 1000000 : 0);
+		UINT64 yieldEnd = start + (powerSaving ? 0 : BARRIER_YIELD_US * freq / 1000000);
+		UINT64 now = start;
+
+		while (m_generation.load(std::memory_order_acquire) == generation && now < spinEnd)
+		{
+			for (int i = 0; i < 16; i++)
+				CPU_RELAX();
+			now = SDL_GetPerformanceCounter();
+		}
+		while (m_generation.load(std::memory_order_acquire) == generation && now < yieldEnd)
+		{
+			std::this_thread::yield();
+			now = SDL_GetPerformanceCounter();
+		}
+		if (m_generation.load() == generation)
+		{
+			if (SDL_LockMutex((SDL_mutex*)m_mutex) != 0)
+				return false;
+			m_blocked.fetch_add(1);
+			while (ok && m_generation.load() == generation)
+				ok = SDL_CondWait((SDL_cond*)m_cond, (SDL_mutex*)m_mutex) == 0;
+			m_blocked.fetch_sub(1);
+			ok = SDL_UnlockMutex((SDL_mutex*)m_mutex) == 0 && ok;
+		}
+	}
+
+	if (waitMicroseconds != NULL)
+		*waitMicroseconds = (UINT32)((SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
+	return ok;
+}
+
+// Most workers the shared job pool starts, however many CPUs there are
+static const unsigned JOB_POOL_MAX_WORKERS	= 15;
+
+struct JobBatch
+{
+	const std::function<void(unsigned)> *job;
+	const char *name;
+	std::atomic<unsigned> remaining;
+};
+
+struct Job
+{
+	JobBatch *batch;
+	unsigned index;
+};
+
+struct JobQueue
+{
+	std::mutex mutex;
+	std::deque<Job> jobs;
+};
+
+struct JobPoolImpl
+{
+	std::vector<std::thread> threads;
+	std::unique_ptr<JobQueue[]> queues;		// one per worker
+	unsigned numQueues = 0;
+	std::atomic<unsigned> nextQueue{0};
+	std::atomic<unsigned> pending{0};		// jobs queued but not yet taken
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	bool stop = false;
+	std::atomic<CJobPool::TimingHook> hook{nullptr};
+	void *hookContext = nullptr;
+};
+
+// Takes a job from the front of the given queue, or else steals one from the back of another
+static bool TakeJob(JobPoolImpl *impl, unsigned first, Job *job)
+{
+	for (unsigned i = 0; i < impl->numQueues; i++)
+	{
+		JobQueue &queue = impl->queues[(first + i) % impl->numQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+			continue;
+		if (i == 0)
+		{
+			*job = queue.jobs.front();
+			queue.jobs.pop_front();
+		}
+		else
+		{
+			*job = queue.jobs.back();
+			queue.jobs.pop_back();
+		}
+		impl->pending.fetch_sub(1);
+		return true;
+	}
+	return false;
+}
+
+static void RunJob(JobPoolImpl *impl, const Job &job, unsigned worker)
+{
+	CJobPool::TimingHook hook = impl->hook.load();
+	UINT64 start = hook != nullptr ? SDL_GetPerformanceCounter() : 0;
+	(*job.batch->job)(job.index);
+	if (hook != nullptr)
+	{
+		UINT32 us = (UINT32)((SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
+		hook(impl->hookContext, job.batch->name, job.index, worker, us);
+	}
+	// The batch belongs to the submitting thread and may be gone straight after this
+	job.batch->remaining.fetch_sub(1);
+}
+
+static void JobPoolWorker(JobPoolImpl *impl, unsigned queue)
+{
+	Trace::SetThreadName("JobPool");
+	while (true)
+	{
+		Job job;
+		if (TakeJob(impl, queue, &job))
+		{
+			RunJob(impl, job, queue + 1);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(impl->wakeMutex);
+		impl->wake.wait(lock, [impl] { return impl->stop || impl->pending.load() != 0; });
+		if (impl->stop)
+			break;
+	}
+}
+
+CJobPool *CThread::GetJobPool()
+{
+	static CJobPool pool([]
+	{
+		JobPoolImpl *impl = new JobPoolImpl;
+		unsigned cpus = std::thread::hardware_concurrency();
+		impl->numQueues = std::min(cpus > 1 ? cpus - 1 : 0, JOB_POOL_MAX_WORKERS);
+		impl->queues.reset(new JobQueue[impl->numQueues]);
+		for (unsigned i = 0; i < impl->numQueues; i++)
+			impl->threads.emplace_back(JobPoolWorker, impl, i);
+		return (void *) impl;
+	}());
+	return &pool;
+}
+
+CJobPool::CJobPool(void *impl)
+  : m_impl(impl)
+{
+	//
+}
+
+CJobPool::~CJobPool()
+{
+	JobPoolImpl *impl = (JobPoolImpl*)m_impl;
+	{
+		std::lock_guard<std::mutex> lock(impl->wakeMutex);
+		impl->stop = true;
+	}
+	impl->wake.notify_all();
+	for (auto &thread: impl->threads)
+		thread.join();
+	delete impl;
+}
+
+unsigned CJobPool::GetNumWorkers() const
+{
+	return ((JobPoolImpl*)m_impl)->numQueues;
+}
+
+void CJobPool::Run(const char *name, unsigned count, const std::function<void(unsigned)> &job)
+{
+	JobPoolImpl *impl = (JobPoolImpl*)m_impl;
+	JobBatch batch;
+	batch.job = &job;
+	batch.name = name;
+	batch.remaining.store(count);
+
+	// Nothing to gain from queuing a single job
+	if (impl->numQueues == 0 || count <= 1)
+	{
+		for (unsigned i = 0; i < count; i++)
+			RunJob(impl, Job{ &batch, i }, 0);
+		return;
+	}
+
+	// Spread the jobs over the worker queues, starting where the last batch ended
+	unsigned first = impl->nextQueue.fetch_add(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		JobQueue &queue = impl->queues[(first + i) % impl->numQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(Job{ &batch, i });
+	}
+	impl->pending.fetch_add(count);
+	{
+		// Workers check pending with the mutex held, so none can miss the wake-up
+		std::lock_guard<std::mutex> lock(impl->wakeMutex);
+	}
+	impl->wake.notify_all();
+
+	// Help out until the batch is done, including with other threads' jobs
+	while (batch.remaining.load() != 0)
+	{
+		Job other;
+		if (TakeJob(impl, first, &other))
+			RunJob(impl, other, 0);
+		else
+			CPU_RELAX();
+	}
+}
+
+void CJobPool::SetTimingHook(TimingHook hook, void *context)
+{
+	JobPoolImpl *impl = (JobPoolImpl*)m_impl;
+	impl->hook.store(nullptr);
+	impl->hookContext = context;
+	impl->hook.store(hook);
+}
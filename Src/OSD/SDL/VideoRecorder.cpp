@@ -0,0 +1,316 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "VideoRecorder.h"
+#include "Supermodel.h"
+#include "OSD/EncoderPipe.h"
+#include "OSD/Thread.h"
+#include "Util/Format.h"
+#include <algorithm>
+#include <cstring>
+
+/******************************************************************************
+ Encoders
+******************************************************************************/
+
+/*
+ * Encoding is done by ffmpeg, which is given the frames on its standard
+ * input and the audio through a named pipe, and uses the host's hardware
+ * encoder if asked to. Other encoders, such as ones calling a hardware
+ * encoder's API directly, can be added by implementing IVideoEncoder.
+ */
+class CFFmpegEncoder : public IVideoEncoder
+{
+public:
+  bool Open(unsigned width, unsigned height, unsigned refreshRateMilliHz, unsigned sampleRate) override
+  {
+    m_frameSize = size_t(width) * height * 4;
+    std::string audioPath;
+    std::string pipeName = Util::Format() << "supermodel_audio_" << CThread::GetMicroseconds();
+    m_audio = EncoderPipe::MakeNamed(pipeName, &audioPath);
+    if (m_audio == nullptr)
+      ErrorLog("Unable to create a pipe for recorded audio. Recording video only.");
+
+    Util::Format command;
+    command << "ffmpeg -hide_banner -loglevel error -y";
+    command << " -f rawvideo -pix_fmt rgba -s " << width << "x" << height;
+    command.Printf(" -framerate %.3f -i -", double(refreshRateMilliHz) / 1000.0);
+    if (m_audio != nullptr)
+      command << " -f s16le -ar " << sampleRate << " -ac 2 -i \"" << audioPath << "\"";
+    command << " " << m_options << " -b:v " << m_bitrate << "k";
+    if (m_audio != nullptr)
+      command << " -c:a aac -b:a 192k";
+    command << " \"" << m_file << "\"";
+
+    m_video = EncoderPipe::StartProcess(command);
+    if (m_video == nullptr)
+    {
+      EncoderPipe::Close(m_audio);
+      m_audio = nullptr;
+      return ErrorLog("Unable to run ffmpeg to record video.");
+    }
+    return OKAY;
+  }
+
+  bool WriteVideo(const uint8_t *pixels) override
+  {
+    return EncoderPipe::Write(m_video, pixels, m_frameSize) ? OKAY : FAIL;
+  }
+
+  bool WriteAudio(const int16_t *samples, unsigned numSamples) override
+  {
+    if (m_audio == nullptr)
+      return OKAY;
+    return EncoderPipe::Write(m_audio, samples, numSamples * 2 * sizeof(int16_t)) ? OKAY : FAIL;
+  }
+
+  void EndVideo() override
+  {
+    // Its standard input ends when it is closed, waiting for it to exit
+  }
+
+  void EndAudio() override
+  {
+    EncoderPipe::Close(m_audio);
+    m_audio = nullptr;
+  }
+
+  void Close() override
+  {
+    // ffmpeg finishes the file once both of its inputs have ended
+    EndAudio();
+    int exitCode = EncoderPipe::Close(m_video);
+    m_video = nullptr;
+    if (exitCode != 0)
+      ErrorLog("ffmpeg exited with code %d while recording to '%s'.", exitCode, m_file.c_str());
+  }
+
+  CFFmpegEncoder(const std::string &file, const std::string &options, unsigned bitrate)
+    : m_file(file),
+      m_options(options),
+      m_bitrate(bitrate),
+      m_frameSize(0),
+      m_video(nullptr),
+      m_audio(nullptr)
+  {
+  }
+
+  ~CFFmpegEncoder()
+  {
+    if (m_video != nullptr)
+      Close();
+  }
+
+private:
+  std::string m_file;
+  std::string m_options;
+  unsigned m_bitrate;
+  size_t m_frameSize;
+  EncoderPipe::Pipe *m_video;
+  EncoderPipe::Pipe *m_audio;
+};
+
+IVideoEncoder *CreateVideoEncoder(const std::string &name, const std::string &file, unsigned bitrate)
+{
+  // ffmpeg options selecting each encoder
+  static const struct
+  {
+    const char *name;
+    const char *options;
+  } s_encoders[] =
+  {
+    { "nvenc",        "-c:v h264_nvenc -preset p4 -pix_fmt yuv420p" },
+    { "vaapi",        "-vaapi_device /dev/dri/renderD128 -vf format=nv12,hwupload -c:v h264_vaapi" },
+    { "qsv",          "-c:v h264_qsv -pix_fmt nv12" },
+    { "mf",           "-c:v h264_mf -pix_fmt nv12" },
+    { "videotoolbox", "-c:v h264_videotoolbox -pix_fmt yuv420p" },
+    { "software",     "-c:v libx264 -preset veryfast -pix_fmt yuv420p" }
+  };
+
+  for (auto &encoder : s_encoders)
+  {
+    if (name == encoder.name)
+      return new CFFmpegEncoder(file, encoder.options, bitrate);
+  }
+  return nullptr;
+}
+
+/******************************************************************************
+ Recorder
+******************************************************************************/
+
+bool CVideoRecorder::Start(IVideoEncoder *encoder, unsigned width, unsigned height, unsigned refreshRateMilliHz)
+{
+  m_encoder = encoder;
+  if (m_encoder->Open(width, height, refreshRateMilliHz, SampleRate) != OKAY)
+  {
+    delete m_encoder;
+    m_encoder = nullptr;
+    return FAIL;
+  }
+  m_width = width;
+  m_height = height;
+
+  m_video.maxQueued = MaxQueuedFrames;
+  m_video.thread = std::thread(&CVideoRecorder::WorkerThread, this, std::ref(m_video),
+    [this](const std::vector<uint8_t> &frame) { return m_encoder->WriteVideo(frame.data()); },
+    [this]() { m_encoder->EndVideo(); });
+  m_audio.maxQueued = MaxQueuedChunks;
+  m_audio.thread = std::thread(&CVideoRecorder::WorkerThread, this, std::ref(m_audio),
+    [this](const std::vector<uint8_t> &chunk) { return m_encoder->WriteAudio((const int16_t *) chunk.data(), unsigned(chunk.size() / (2 * sizeof(int16_t)))); },
+    [this]() { m_encoder->EndAudio(); });
+  return OKAY;
+}
+
+void CVideoRecorder::AddFrame(const uint8_t *pixels, unsigned width, unsigned height)
+{
+  if (width != m_width || height != m_height)
+  {
+    std::lock_guard<std::mutex> lock(m_video.mutex);
+    m_video.dropped++;
+    return;
+  }
+
+  // Flipped to put the top row first
+  size_t rowSize = size_t(width) * 4;
+  Add(m_video, rowSize * height, [&](uint8_t *dest)
+  {
+    for (unsigned y = height; y > 0; y--)
+    {
+      memcpy(dest, &pixels[(y - 1) * rowSize], rowSize);
+      dest += rowSize;
+    }
+  });
+}
+
+void CVideoRecorder::AddAudio(const int16_t *samples, unsigned numSamples, unsigned numChannels)
+{
+  Add(m_audio, numSamples * 2 * sizeof(int16_t), [&](uint8_t *dest)
+  {
+    int16_t *out = (int16_t *) dest;
+    for (unsigned i = 0; i < numSamples; i++)
+    {
+      const int16_t *in = &samples[i * numChannels];
+      switch (numChannels)
+      {
+      case 1:
+        *out++ = in[0];
+        *out++ = in[0];
+        break;
+      case 4:   // front left, front right, rear left, rear right
+        *out++ = int16_t((int(in[0]) + int(in[2])) / 2);
+        *out++ = int16_t((int(in[1]) + int(in[3])) / 2);
+        break;
+      default:
+        *out++ = in[0];
+        *out++ = in[1];
+        break;
+      }
+    }
+  });
+}
+
+void CVideoRecorder::Add(Stream &stream, size_t size, const std::function<void(uint8_t *)> &fill)
+{
+  std::lock_guard<std::mutex> lock(stream.mutex);
+  if (m_encoder == nullptr || stream.quit || stream.failed || stream.queued.size() >= stream.maxQueued)
+  {
+    stream.dropped++;
+    return;
+  }
+  std::vector<uint8_t> buffer;
+  if (!stream.free.empty())
+  {
+    buffer = std::move(stream.free.back());
+    stream.free.pop_back();
+  }
+  buffer.resize(size);
+  fill(buffer.data());
+  stream.queued.push_back(std::move(buffer));
+  stream.cv.notify_one();
+}
+
+void CVideoRecorder::WorkerThread(Stream &stream, const std::function<bool(const std::vector<uint8_t> &)> &write, const std::function<void()> &end)
+{
+  std::unique_lock<std::mutex> lock(stream.mutex);
+  while (true)
+  {
+    stream.cv.wait(lock, [&] { return stream.quit || !stream.queued.empty(); });
+    if (stream.queued.empty())
+    {
+      lock.unlock();
+      end();
+      return;
+    }
+    std::vector<uint8_t> buffer = std::move(stream.queued.front());
+    stream.queued.pop_front();
+    lock.unlock();
+    bool result = write(buffer);
+    lock.lock();
+    if (result == OKAY)
+      stream.written++;
+    else
+    {
+      // The encoder has gone away, so nothing more can be written
+      stream.failed = true;
+      stream.dropped += stream.queued.size() + 1;
+      stream.queued.clear();
+    }
+    stream.free.push_back(std::move(buffer));
+  }
+}
+
+void CVideoRecorder::Stop()
+{
+  if (m_encoder == nullptr)
+    return;
+
+  // Both streams are ended before waiting for either, as the encoder may be
+  // waiting for the end of one before it reads the rest of the other
+  for (Stream *stream : { &m_video, &m_audio })
+  {
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stream->quit = true;
+    stream->cv.notify_one();
+  }
+  m_video.thread.join();
+  m_audio.thread.join();
+  m_encoder->Close();
+  delete m_encoder;
+  m_encoder = nullptr;
+
+  InfoLog("Recorded %llu frames of video (%llu dropped) and %llu chunks of audio (%llu dropped).",
+    (unsigned long long) m_video.written, (unsigned long long) m_video.dropped, (unsigned long long) m_audio.written, (unsigned long long) m_audio.dropped);
+  if (m_video.failed || m_audio.failed)
+    ErrorLog("The video encoder stopped accepting data before the recording ended.");
+}
+
+CVideoRecorder::CVideoRecorder()
+  : m_encoder(nullptr),
+    m_width(0),
+    m_height(0)
+{
+}
+
+CVideoRecorder::~CVideoRecorder()
+{
+  Stop();
+}
@@ -0,0 +1,178 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * VideoRecorder.h
+ *
+ * Recording of the picture and sound to a video file, with -record-video.
+ */
+
+#ifndef INCLUDED_VIDEORECORDER_H
+#define INCLUDED_VIDEORECORDER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * IVideoEncoder:
+ *
+ * Encodes frames of video and chunks of audio and muxes them into a file or
+ * stream. Video is given from one thread and audio from another, so that an
+ * encoder waiting for more of one stream does not hold up the other, and
+ * either write may block.
+ */
+class IVideoEncoder
+{
+public:
+  /*
+   * Open(width, height, refreshRateMilliHz, sampleRate):
+   *
+   * Starts encoding frames of the given size and rate, and 16-bit stereo
+   * audio at the given rate. Returns OKAY or FAIL.
+   */
+  virtual bool Open(unsigned width, unsigned height, unsigned refreshRateMilliHz, unsigned sampleRate) = 0;
+
+  /*
+   * WriteVideo(pixels):
+   *
+   * Encodes a frame of RGBA pixels, top row first. Returns OKAY or FAIL.
+   */
+  virtual bool WriteVideo(const uint8_t *pixels) = 0;
+
+  /*
+   * WriteAudio(samples, numSamples):
+   *
+   * Encodes interleaved stereo samples. Returns OKAY or FAIL.
+   */
+  virtual bool WriteAudio(const int16_t *samples, unsigned numSamples) = 0;
+
+  /*
+   * EndVideo(), EndAudio():
+   *
+   * Each is called from the thread writing the stream once it has ended, as
+   * the encoder may need to see the end of one to finish reading the other.
+   */
+  virtual void EndVideo() = 0;
+  virtual void EndAudio() = 0;
+
+  /*
+   * Close():
+   *
+   * Finishes encoding, once both streams have ended.
+   */
+  virtual void Close() = 0;
+
+  virtual ~IVideoEncoder()
+  {
+  }
+};
+
+/*
+ * CreateVideoEncoder(name, file, bitrate):
+ *
+ * Creates the named encoder, writing to the given file at the given video bit
+ * rate (Kbit/s), or returns NULL if there is no such encoder. The encoders
+ * available are listed in the README.
+ */
+extern IVideoEncoder *CreateVideoEncoder(const std::string &name, const std::string &file, unsigned bitrate);
+
+/*
+ * CVideoRecorder:
+ *
+ * Feeds an encoder from the frames read back by CFrameCapture and the audio
+ * passed to its sink, through a bounded queue for each that a worker thread
+ * per stream empties. Nothing given to the recorder ever waits for the
+ * encoder: when it falls behind, frames and chunks of audio are dropped, and
+ * counted.
+ */
+class CVideoRecorder
+{
+public:
+  /*
+   * Start(encoder, width, height, refreshRateMilliHz):
+   *
+   * Opens the encoder, which the recorder then owns, and starts recording.
+   * Returns OKAY or FAIL.
+   */
+  bool Start(IVideoEncoder *encoder, unsigned width, unsigned height, unsigned refreshRateMilliHz);
+
+  /*
+   * AddFrame(pixels, width, height):
+   *
+   * Queues a frame of RGBA pixels, bottom row first as read back. Frames of
+   * a different size to the recording are dropped.
+   */
+  void AddFrame(const uint8_t *pixels, unsigned width, unsigned height);
+
+  /*
+   * AddAudio(samples, numSamples, numChannels):
+   *
+   * Queues a chunk of interleaved 44.1 KHz audio, which is mixed down or up
+   * to stereo.
+   */
+  void AddAudio(const int16_t *samples, unsigned numSamples, unsigned numChannels);
+
+  /*
+   * Stop():
+   *
+   * Writes out whatever is queued and closes the encoder.
+   */
+  void Stop();
+
+  CVideoRecorder();
+  ~CVideoRecorder();
+
+private:
+  static const unsigned SampleRate = 44100;
+  static const size_t MaxQueuedFrames = 8;
+  static const size_t MaxQueuedChunks = 32;   // about half a second of audio
+
+  struct Stream
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> queued;
+    std::vector<std::vector<uint8_t>> free;   // reused to avoid allocating
+    size_t maxQueued = 0;
+    uint64_t written = 0;
+    uint64_t dropped = 0;
+    bool failed = false;
+    bool quit = false;
+    std::thread thread;
+  };
+
+  IVideoEncoder *m_encoder;
+  unsigned m_width;
+  unsigned m_height;
+  Stream m_video;
+  Stream m_audio;
+
+  void Add(Stream &stream, size_t size, const std::function<void(uint8_t *)> &fill);
+  void WorkerThread(Stream &stream, const std::function<bool(const std::vector<uint8_t> &)> &write, const std::function<void()> &end);
+};
+
+#endif  // INCLUDED_VIDEORECORDER_H
@@ -0,0 +1,63 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * SharedMemory.h
+ *
+ * Header file for OS-dependent memory shared between processes, and waiting
+ * on words in it.
+ */
+
+#ifndef INCLUDED_SHAREDMEMORY_H
+#define INCLUDED_SHAREDMEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace SharedMemory
+{
+    /*
+     * Regions are named, so that other processes on the same host can map
+     * them. Create() makes a zeroed region, replacing any of the same name
+     * left by a process that exited without closing it, and Open() maps one
+     * created by another process, failing if there is none yet. Both return
+     * NULL on failure. Close() unmaps a region, and removes its name if this
+     * process created it.
+     */
+    void *Create(const std::string &name, size_t size);
+    void *Open(const std::string &name, size_t size);
+    void Close(void *ptr);
+
+    /*
+     * Wait() blocks until Wake() is called on a word of a shared region, by
+     * any process, for at most timeoutMS milliseconds (-1 = forever). It
+     * returns at once if the word no longer holds the expected value, so a
+     * waker changes the word before calling Wake(), and may return early
+     * without either having happened, so waiters check what they wait for
+     * again. Returns false on timeout.
+     */
+    bool Wait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMS);
+    void Wake(std::atomic<uint32_t> *word);
+}
+
+#endif  // INCLUDED_SHAREDMEMORY_H
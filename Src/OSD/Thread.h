@@ -30,11 +30,15 @@
 
 #include "Types.h"
 
+#include <atomic>
+#include <functional>
 #include <string>
 
 class CSemaphore;
 class CMutex;
 class CCondVar;
+class CFrameBarrier;
+class CJobPool;
 
 typedef int (*ThreadStart)(void *startParam);
 
@@ -45,6 +49,14 @@ typedef int (*ThreadStart)(void *startParam);
  */
 class CThread
 {
+public:
+	enum Priority
+	{
+		PRIORITY_NORMAL,
+		PRIORITY_HIGH,
+		PRIORITY_REALTIME
+	};
+
 private:
   const std::string m_name;
 	void *m_impl;
@@ -58,6 +70,16 @@ public:
 	 * Sleeps for specified number of milliseconds.
 	 */
 	static void Sleep(UINT32 ms);
+
+	/*
+	 * SleepMicroseconds
+	 *
+	 * Sleeps for about the specified number of microseconds, with the finest
+	 * timer the OS has (a high resolution waitable timer on Windows,
+	 * clock_nanosleep() on Linux). Like any sleep it may overrun by some
+	 * tens of microseconds or more, depending on the OS.
+	 */
+	static void SleepMicroseconds(UINT64 us);
 	
 	/*
 	 * GetTicks
@@ -65,6 +87,40 @@ public:
 	 * Gets number of millseconds since beginning of program.
 	 */
 	static UINT32 GetTicks();
+
+	/*
+	 * GetPerformanceCounter
+	 *
+	 * Gets the value of the highest resolution monotonic counter available,
+	 * which advances GetPerformanceFrequency() times per second.
+	 */
+	static UINT64 GetPerformanceCounter();
+	static UINT64 GetPerformanceFrequency();
+
+	/*
+	 * GetMicroseconds
+	 *
+	 * Gets number of microseconds since an arbitrary point, from the
+	 * performance counter.
+	 */
+	static UINT64 GetMicroseconds();
+
+	/*
+	 * GetProcessCPUMicroseconds
+	 *
+	 * Gets the CPU time used by all threads of the process so far, user and
+	 * kernel, in microseconds. Returns 0 where this is not available.
+	 */
+	static UINT64 GetProcessCPUMicroseconds();
+
+	/*
+	 * SetPowerSaving
+	 *
+	 * When enabled, threads waiting at a frame barrier block in the O/S
+	 * straight away rather than spinning and yielding first, trading a little
+	 * latency in waking them for CPU time.
+	 */
+	static void SetPowerSaving(bool enable);
 	
 	/*
    * CreateThread
@@ -93,6 +149,35 @@ public:
 	 * Creates a new mutex.
 	 */
 	static CMutex *CreateMutex();
+
+	/*
+	 * CreateFrameBarrier
+	 *
+	 * Creates a new barrier for the given number of threads.
+	 */
+	static CFrameBarrier *CreateFrameBarrier(unsigned count);
+
+	/*
+	 * GetJobPool
+	 *
+	 * Returns the job pool shared by all subsystems, creating it on first use.
+	 */
+	static CJobPool *GetJobPool();
+
+	/*
+	 * SetCurrentThreadCore
+	 *
+	 * Pins the calling thread to the given logical CPU.  Returns false if this is not possible on this platform.
+	 */
+	static bool SetCurrentThreadCore(unsigned core);
+
+	/*
+	 * SetCurrentThreadPriority
+	 *
+	 * Sets the scheduling priority of the calling thread, falling back on lower priorities where the requested one is not
+	 * permitted.  Returns the priority that was applied.
+	 */
+	static Priority SetCurrentThreadPriority(Priority priority);
 	
 	/*
 	 * GetLastError
@@ -239,4 +324,89 @@ public:
 	bool Unlock();
 };
 
+/*
+ * CFrameBarrier
+ *
+ * Class that represents a barrier for a fixed number of threads that run in
+ * step with each other, such as once per frame.  Waiting threads spin, then
+ * yield, and only block in the O/S once the wait has become long, so that
+ * threads arriving close together are released without context switches.
+ */
+class CFrameBarrier
+{
+friend class CThread;
+
+private:
+	// Arriving threads write m_arrived while the waiting ones poll m_generation, so they are on separate cache lines
+	const unsigned m_count;
+	alignas(64) std::atomic<unsigned> m_arrived;
+	alignas(64) std::atomic<unsigned> m_generation;
+	std::atomic<unsigned> m_blocked;		// threads blocked in the O/S
+	void *m_mutex;
+	void *m_cond;
+
+	CFrameBarrier(unsigned count, void *mutex, void *cond);
+
+public:
+	~CFrameBarrier();
+
+	/*
+	 * Wait
+	 *
+	 * Suspends the calling thread until all threads have called Wait(), then releases them all.  The barrier can then be used again
+	 * straight away.  If waitMicroseconds is given, it receives the time spent waiting in microseconds.
+	 */
+	bool Wait(UINT32 *waitMicroseconds = NULL);
+};
+
+/*
+ * CJobPool
+ *
+ * Class that represents a pool of worker threads that run short jobs in parallel, for splitting work within a frame.  Each
+ * worker has its own queue and steals from the others' once it is empty, and the thread submitting jobs runs them too
+ * while it waits, so jobs may themselves submit jobs.  Jobs of one batch must not depend on each other.
+ */
+class CJobPool
+{
+friend class CThread;
+
+public:
+	/*
+	 * TimingHook
+	 *
+	 * Called after each job with the batch name, job index, worker that ran it (0 for the submitting thread) and its
+	 * duration in microseconds.  May be called from any thread.
+	 */
+	typedef void (*TimingHook)(void *context, const char *name, unsigned index, unsigned worker, UINT32 microseconds);
+
+private:
+	void *m_impl;
+
+	CJobPool(void *impl);
+
+public:
+	~CJobPool();
+
+	/*
+	 * GetNumWorkers
+	 *
+	 * Returns the number of worker threads, not counting threads submitting jobs.
+	 */
+	unsigned GetNumWorkers() const;
+
+	/*
+	 * Run
+	 *
+	 * Runs job(0) to job(count - 1) across the pool and returns once all of them have finished.
+	 */
+	void Run(const char *name, unsigned count, const std::function<void(unsigned)> &job);
+
+	/*
+	 * SetTimingHook
+	 *
+	 * Sets the function called with the time taken by each job, or NULL to stop timing them.
+	 */
+	void SetTimingHook(TimingHook hook, void *context);
+};
+
 #endif	// INCLUDED_THREADS_H
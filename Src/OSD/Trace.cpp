@@ -0,0 +1,188 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Trace.cpp
+ *
+ * Implementation of the thread timeline trace.
+ */
+
+#include "Trace.h"
+
+#include "Supermodel.h"
+#include "OSD/Thread.h"
+#include "Util/Format.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Trace
+{
+	struct Event
+	{
+		UINT64		time;
+		const char	*name;
+		bool		begin;
+	};
+
+	// Ring of events recorded by one thread, about a minute at the rate of
+	// the busiest thread
+	struct ThreadRing
+	{
+		static const unsigned Size = 1 << 16;	// power of two
+
+		std::string				name;
+		std::atomic<UINT64>		count;			// events recorded so far
+		Event					events[Size];
+
+		ThreadRing()
+			: count(0)
+		{
+		}
+	};
+
+	static std::atomic<bool> s_enabled(false);
+	static std::mutex s_ringsLock;
+	static std::vector<std::unique_ptr<ThreadRing>> s_rings;
+	static thread_local ThreadRing *t_ring = nullptr;
+	static thread_local const char *t_name = nullptr;
+
+	static ThreadRing *GetRing(void)
+	{
+		if (t_ring == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(s_ringsLock);
+			s_rings.emplace_back(new ThreadRing());
+			t_ring = s_rings.back().get();
+			if (t_name != nullptr)
+				t_ring->name = t_name;
+			else
+				t_ring->name = Util::Format() << "Thread " << s_rings.size();
+		}
+		return t_ring;
+	}
+
+	static void Record(const char *name, bool begin)
+	{
+		ThreadRing *ring = GetRing();
+		UINT64 count = ring->count.load(std::memory_order_relaxed);
+		Event &e = ring->events[count & (ThreadRing::Size - 1)];
+		e.time = CThread::GetPerformanceCounter();
+		e.name = name;
+		e.begin = begin;
+		ring->count.store(count + 1, std::memory_order_release);
+	}
+
+	void Enable(bool enable)
+	{
+		s_enabled.store(enable, std::memory_order_relaxed);
+	}
+
+	bool IsEnabled(void)
+	{
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	void SetThreadName(const char *name)
+	{
+		t_name = name;
+		if (t_ring != nullptr)
+		{
+			std::lock_guard<std::mutex> lock(s_ringsLock);
+			t_ring->name = name;
+		}
+	}
+
+	void Begin(const char *name)
+	{
+		Record(name, true);
+	}
+
+	void End(const char *name)
+	{
+		Record(name, false);
+	}
+
+	// Writes a string as a JSON string literal
+	static void WriteString(FILE *fp, const char *str)
+	{
+		fputc('"', fp);
+		for (; *str != '\0'; str++)
+		{
+			if (*str == '"' || *str == '\\')
+				fputc('\\', fp);
+			fputc(*str, fp);
+		}
+		fputc('"', fp);
+	}
+
+	bool Write(const std::string &file, double seconds)
+	{
+		FILE *fp = fopen(file.c_str(), "w");
+		if (fp == nullptr)
+			return ErrorLog("Unable to write trace to '%s'.", file.c_str());
+
+		UINT64 frequency = CThread::GetPerformanceFrequency();
+		UINT64 now = CThread::GetPerformanceCounter();
+		UINT64 span = UINT64(seconds * double(frequency));
+		UINT64 start = now > span ? now - span : 0;
+		double usPerCount = 1e6 / double(frequency);
+
+		std::lock_guard<std::mutex> lock(s_ringsLock);
+		fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		bool first = true;
+		for (size_t tid = 0; tid < s_rings.size(); tid++)
+		{
+			const ThreadRing &ring = *s_rings[tid];
+			fprintf(fp, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", first ? "" : ",\n", unsigned(tid));
+			WriteString(fp, ring.name.c_str());
+			fprintf(fp, "}}");
+			first = false;
+
+			// Skip the oldest quarter of a full ring, which may be being
+			// overwritten, and ends of scopes that began before the start
+			UINT64 count = ring.count.load(std::memory_order_acquire);
+			UINT64 oldest = count > ThreadRing::Size ? count - ThreadRing::Size * 3 / 4 : 0;
+			unsigned depth = 0;
+			for (UINT64 i = oldest; i < count; i++)
+			{
+				const Event &e = ring.events[i & (ThreadRing::Size - 1)];
+				if (e.time < start || e.name == nullptr)
+					continue;
+				if (e.begin)
+					depth++;
+				else if (depth > 0)
+					depth--;
+				else
+					continue;
+				fprintf(fp, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"name\":", e.begin ? 'B' : 'E', unsigned(tid), double(e.time - start) * usPerCount);
+				WriteString(fp, e.name);
+				fputc('}', fp);
+			}
+		}
+		fprintf(fp, "\n]}\n");
+		fclose(fp);
+		printf("Wrote trace of the last %1.1f seconds to '%s'.\n", seconds, file.c_str());
+		return OKAY;
+	}
+}
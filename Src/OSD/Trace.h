@@ -0,0 +1,108 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Trace.h
+ *
+ * Timeline of what each thread does within frames, written as Chrome trace
+ * JSON for viewing in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ */
+
+#ifndef INCLUDED_TRACE_H
+#define INCLUDED_TRACE_H
+
+#include <string>
+
+/*
+ * Each thread records the beginning and end of named scopes, timed with
+ * CThread::GetPerformanceCounter(), into a ring of its own that only it
+ * writes, so recording takes no locks. The rings hold the last several
+ * seconds of events, of which Write() saves the most recent. Names must be
+ * string literals (or otherwise outlive the trace), as only pointers to them
+ * are kept. Nothing is recorded until tracing is enabled.
+ *
+ * Usage:
+ *
+ *		{
+ *			Trace::Scope scope("RunMainBoardFrame");
+ *			// work
+ *		}
+ */
+namespace Trace
+{
+	void Enable(bool enable);
+	bool IsEnabled(void);
+
+	/*
+	 * SetThreadName(name):
+	 *
+	 * Names the calling thread in the trace. Threads not named are numbered.
+	 */
+	void SetThreadName(const char *name);
+
+	void Begin(const char *name);
+	void End(const char *name);
+
+	/*
+	 * Scope:
+	 *
+	 * Begins a scope when constructed and ends it when destroyed, if tracing
+	 * was enabled at construction.
+	 */
+	class Scope
+	{
+	public:
+		Scope(const char *name)
+			: m_name(IsEnabled() ? name : nullptr)
+		{
+			if (m_name != nullptr)
+				Begin(m_name);
+		}
+
+		~Scope()
+		{
+			if (m_name != nullptr)
+				End(m_name);
+		}
+
+	private:
+		const char *m_name;
+	};
+
+	/*
+	 * Write(file, seconds):
+	 *
+	 * Writes the events of the last few seconds to a Chrome trace JSON file.
+	 * Events being recorded by other threads as they are read may be torn, so
+	 * the emulator threads should be paused.
+	 *
+	 * Parameters:
+	 *		file		File path.
+	 *		seconds		How far back to go. Fewer seconds are written if the
+	 *					rings hold fewer.
+	 *
+	 * Returns:
+	 *		OKAY if successful, otherwise FAIL. Prints errors.
+	 */
+	bool Write(const std::string &file, double seconds);
+}
+
+#endif	// INCLUDED_TRACE_H
@@ -0,0 +1,116 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "OSD/EncoderPipe.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace EncoderPipe
+{
+    struct Pipe
+    {
+        FILE *process = nullptr;
+        int fd = -1;
+        std::string path;           // of the FIFO, opened on the first write
+    };
+
+    Pipe *StartProcess(const std::string &command)
+    {
+        // The program exiting would otherwise end this process on the next write
+        signal(SIGPIPE, SIG_IGN);
+        FILE *process = popen(command.c_str(), "w");
+        if (process == nullptr)
+            return nullptr;
+        Pipe *pipe = new Pipe();
+        pipe->process = process;
+        pipe->fd = fileno(process);
+        return pipe;
+    }
+
+    Pipe *MakeNamed(const std::string &name, std::string *path)
+    {
+        std::string fifo = "/tmp/" + name;
+        if (mkfifo(fifo.c_str(), 0600) != 0 && errno != EEXIST)
+            return nullptr;
+        signal(SIGPIPE, SIG_IGN);
+        Pipe *pipe = new Pipe();
+        pipe->path = fifo;
+        *path = fifo;
+        return pipe;
+    }
+
+    bool Write(Pipe *pipe, const void *data, size_t length, unsigned timeoutMs)
+    {
+        // Opening for writing without blocking fails until there is a reader
+        for (unsigned waited = 0; pipe->fd < 0; waited += 10)
+        {
+            pipe->fd = open(pipe->path.c_str(), O_WRONLY | O_NONBLOCK);
+            if (pipe->fd >= 0)
+                fcntl(pipe->fd, F_SETFL, fcntl(pipe->fd, F_GETFL) & ~O_NONBLOCK);
+            else if (errno != ENXIO || waited >= timeoutMs)
+                return false;
+            else
+                usleep(10000);
+        }
+
+        const char *p = (const char *)data;
+        while (length > 0)
+        {
+            ssize_t written = write(pipe->fd, p, length);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            p += written;
+            length -= size_t(written);
+        }
+        return true;
+    }
+
+    int Close(Pipe *pipe)
+    {
+        int exitCode = 0;
+        if (pipe == nullptr)
+            return exitCode;
+        if (pipe->process != nullptr)
+        {
+            int status = pclose(pipe->process);
+            exitCode = status >= 0 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        else
+        {
+            // Opened for reading too, which cannot block, if nothing was
+            // written, so that a reader still waiting to open it sees its end
+            if (pipe->fd < 0)
+                pipe->fd = open(pipe->path.c_str(), O_RDWR | O_NONBLOCK);
+            if (pipe->fd >= 0)
+                close(pipe->fd);
+            unlink(pipe->path.c_str());
+        }
+        delete pipe;
+        return exitCode;
+    }
+}
@@ -0,0 +1,120 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "OSD/OutputStream.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace OutputStream
+{
+    struct Stream
+    {
+        int fd = -1;
+        bool pipe = false;
+        std::string path;           // of the FIFO, opened when a reader has
+        sockaddr_storage address;
+        socklen_t addressLength = 0;
+    };
+
+    Stream *OpenUDP(const std::string &address, unsigned port)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo *info = nullptr;
+        if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &info) != 0 || info == nullptr)
+            return nullptr;
+
+        Stream *stream = new Stream();
+        stream->fd = socket(info->ai_family, SOCK_DGRAM, 0);
+        memcpy(&stream->address, info->ai_addr, info->ai_addrlen);
+        stream->addressLength = socklen_t(info->ai_addrlen);
+        freeaddrinfo(info);
+        if (stream->fd < 0)
+        {
+            delete stream;
+            return nullptr;
+        }
+        fcntl(stream->fd, F_SETFL, fcntl(stream->fd, F_GETFL) | O_NONBLOCK);
+        return stream;
+    }
+
+    Stream *OpenPipe(const std::string &name)
+    {
+        std::string path = name.find('/') == std::string::npos ? "/tmp/" + name : name;
+        if (mkfifo(path.c_str(), 0600) != 0 && errno != EEXIST)
+            return nullptr;
+
+        // A reader going away would otherwise end the process
+        signal(SIGPIPE, SIG_IGN);
+
+        Stream *stream = new Stream();
+        stream->pipe = true;
+        stream->path = path;
+        return stream;
+    }
+
+    bool Write(Stream *stream, const char *message, size_t length)
+    {
+        if (!stream->pipe)
+            return sendto(stream->fd, message, length, 0, (const sockaddr *)&stream->address, stream->addressLength) == ssize_t(length);
+
+        // Opening for writing without blocking fails until there is a reader
+        if (stream->fd < 0)
+        {
+            stream->fd = open(stream->path.c_str(), O_WRONLY | O_NONBLOCK);
+            if (stream->fd < 0)
+                return false;
+        }
+        // Gathered into one write, which a pipe keeps whole up to PIPE_BUF
+        iovec line[2];
+        line[0].iov_base = const_cast<char *>(message);
+        line[0].iov_len = length;
+        line[1].iov_base = const_cast<char *>("\n");
+        line[1].iov_len = 1;
+        ssize_t written = writev(stream->fd, line, 2);
+        if (written < 0 && errno == EPIPE)
+        {
+            close(stream->fd);
+            stream->fd = -1;
+        }
+        return written == ssize_t(length + 1);
+    }
+
+    void Close(Stream *stream)
+    {
+        if (stream == nullptr)
+            return;
+        if (stream->fd >= 0)
+            close(stream->fd);
+        if (stream->pipe)
+            unlink(stream->path.c_str());
+        delete stream;
+    }
+}
@@ -0,0 +1,152 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PageProtection.h"
+#include <atomic>
+#include <cstdint>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace PageProtection
+{
+    struct Range
+    {
+        std::atomic<uint8_t *> base;
+        size_t size;
+        WriteHandler handler;
+        void *context;
+    };
+
+    static const size_t MaxRanges = 8;
+    static Range s_ranges[MaxRanges];
+    static struct sigaction s_oldSIGSEGV;
+    static struct sigaction s_oldSIGBUS;   // raised instead of SIGSEGV on some systems, e.g. macOS
+    static bool s_installed = false;
+
+    static void OnFault(int sig, siginfo_t *info, void *ucontext)
+    {
+        uint8_t *addr = (uint8_t *) info->si_addr;
+        for (Range &range: s_ranges)
+        {
+            uint8_t *base = range.base.load(std::memory_order_acquire);
+            if (base != nullptr && addr >= base && addr < base + range.size)
+            {
+                size_t offset = (addr - base) & ~(GetPageSize() - 1);
+                mprotect(base + offset, GetPageSize(), PROT_READ | PROT_WRITE);
+                range.handler(range.context, offset);
+                return;
+            }
+        }
+
+        // Not a watched page: pass on to the previous handler. If it was the
+        // default action, restore it so that the faulting access repeats and
+        // terminates the process as usual.
+        struct sigaction *old = (sig == SIGBUS) ? &s_oldSIGBUS : &s_oldSIGSEGV;
+        if ((old->sa_flags & SA_SIGINFO) && old->sa_sigaction != nullptr)
+            old->sa_sigaction(sig, info, ucontext);
+        else if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN)
+            old->sa_handler(sig);
+        else
+            sigaction(sig, old, nullptr);
+    }
+
+    size_t GetPageSize()
+    {
+        static const size_t s_pageSize = size_t(sysconf(_SC_PAGESIZE));
+        return s_pageSize;
+    }
+
+    void *Allocate(size_t size)
+    {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    void *AllocateLarge(size_t size, bool *largePages)
+    {
+        *largePages = false;
+#ifdef MADV_HUGEPAGE
+        // Align to the huge page size, so that all of the range that spans
+        // huge pages can use them, by mapping more and trimming both ends
+        const size_t hugePageSize = 0x200000;
+        size = (size + GetPageSize() - 1) & ~(GetPageSize() - 1);
+        uint8_t *ptr = (uint8_t *) mmap(nullptr, size + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == (uint8_t *) MAP_FAILED)
+            return nullptr;
+        uint8_t *aligned = (uint8_t *) (((uintptr_t) ptr + hugePageSize - 1) & ~(uintptr_t) (hugePageSize - 1));
+        if (aligned > ptr)
+            munmap(ptr, aligned - ptr);
+        if (ptr + hugePageSize > aligned)
+            munmap(aligned + size, ptr + hugePageSize - aligned);
+        *largePages = madvise(aligned, size, MADV_HUGEPAGE) == 0;
+        return aligned;
+#else
+        return Allocate(size);
+#endif
+    }
+
+    void Free(void *ptr, size_t size)
+    {
+        if (ptr != nullptr)
+            munmap(ptr, size);
+    }
+
+    bool Protect(void *ptr, size_t size, bool writable)
+    {
+        return mprotect(ptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ) != 0;
+    }
+
+    bool Watch(void *ptr, size_t size, WriteHandler handler, void *context)
+    {
+        if (!s_installed)
+        {
+            struct sigaction sa;
+            sa.sa_sigaction = OnFault;
+            sigemptyset(&sa.sa_mask);
+            sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+            if (sigaction(SIGSEGV, &sa, &s_oldSIGSEGV) != 0 || sigaction(SIGBUS, &sa, &s_oldSIGBUS) != 0)
+                return true;
+            s_installed = true;
+        }
+        for (Range &range: s_ranges)
+        {
+            if (range.base.load() == nullptr)
+            {
+                range.size = size;
+                range.handler = handler;
+                range.context = context;
+                range.base.store((uint8_t *) ptr, std::memory_order_release);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Unwatch(void *ptr)
+    {
+        for (Range &range: s_ranges)
+        {
+            if (range.base.load() == (uint8_t *) ptr)
+                range.base.store(nullptr);
+        }
+    }
+}
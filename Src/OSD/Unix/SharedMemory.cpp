@@ -0,0 +1,154 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "OSD/SharedMemory.h"
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace SharedMemory
+{
+    struct Region
+    {
+        void *ptr;
+        size_t size;
+        std::string name;   // removed on closing if created here
+    };
+
+    static std::mutex s_regionsLock;
+    static std::vector<Region> s_regions;
+
+    // POSIX names begin with a slash and have no others
+    static std::string ObjectName(const std::string &name)
+    {
+        return "/" + name;
+    }
+
+    static void *Map(int fd, const std::string &name, size_t size, bool created)
+    {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            if (created)
+                shm_unlink(ObjectName(name).c_str());
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(s_regionsLock);
+        s_regions.push_back({ ptr, size, created ? name : std::string() });
+        return ptr;
+    }
+
+    void *Create(const std::string &name, size_t size)
+    {
+        // Objects outlive the processes that create them
+        shm_unlink(ObjectName(name).c_str());
+        int fd = shm_open(ObjectName(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+            return nullptr;
+        if (ftruncate(fd, off_t(size)) != 0)
+        {
+            close(fd);
+            shm_unlink(ObjectName(name).c_str());
+            return nullptr;
+        }
+        return Map(fd, name, size, true);
+    }
+
+    void *Open(const std::string &name, size_t size)
+    {
+        int fd = shm_open(ObjectName(name).c_str(), O_RDWR, 0600);
+        if (fd < 0)
+            return nullptr;
+
+        // The creator may not have sized it yet
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < size)
+        {
+            close(fd);
+            return nullptr;
+        }
+        return Map(fd, name, size, false);
+    }
+
+    void Close(void *ptr)
+    {
+        std::lock_guard<std::mutex> lock(s_regionsLock);
+        for (auto it = s_regions.begin(); it != s_regions.end(); ++it)
+        {
+            if (it->ptr == ptr)
+            {
+                munmap(it->ptr, it->size);
+                if (!it->name.empty())
+                    shm_unlink(ObjectName(it->name).c_str());
+                s_regions.erase(it);
+                return;
+            }
+        }
+    }
+
+#ifdef __linux__
+    // Futexes work across processes on shared mappings, costing no system
+    // call to wake when nothing waits (which callers track themselves)
+    bool Wait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMS)
+    {
+        struct timespec timeout;
+        timeout.tv_sec = timeoutMS / 1000;
+        timeout.tv_nsec = long(timeoutMS % 1000) * 1000000;
+        long result = syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, timeoutMS < 0 ? nullptr : &timeout, nullptr, 0);
+        return result == 0 || errno != ETIMEDOUT;
+    }
+
+    void Wake(std::atomic<uint32_t> *word)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+#else
+    // Elsewhere, watch the word, sleeping briefly in between
+    bool Wait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMS)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (word->load() == expected)
+        {
+            if (timeoutMS >= 0 && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(timeoutMS))
+                return false;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        return true;
+    }
+
+    void Wake(std::atomic<uint32_t> *word)
+    {
+    }
+#endif
+}
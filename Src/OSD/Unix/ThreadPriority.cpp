@@ -0,0 +1,78 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "OSD/Thread.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Best effort: without the required privileges each of these fails harmlessly
+
+bool CThread::SetCurrentThreadCore(unsigned core)
+{
+#ifdef __linux__
+    if (core >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    // macOS only takes affinity hints between threads, not CPU numbers
+    (void) core;
+    return false;
+#endif
+}
+
+static bool SetRealtimePriority()
+{
+    // Lowest FIFO priority: preempts all normal threads without competing
+    // with the system's own real-time threads
+    sched_param param = {};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+static bool SetHighPriority()
+{
+#ifdef __linux__
+    // Linux applies nice values to individual threads
+    return setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), -10) == 0;
+#elif defined(__APPLE__)
+    return pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+CThread::Priority CThread::SetCurrentThreadPriority(Priority priority)
+{
+    if (priority == PRIORITY_REALTIME && SetRealtimePriority())
+        return PRIORITY_REALTIME;
+    if (priority >= PRIORITY_HIGH && SetHighPriority())
+        return PRIORITY_HIGH;
+    return PRIORITY_NORMAL;
+}
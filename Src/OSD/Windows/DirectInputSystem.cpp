@@ -32,6 +32,7 @@
 
 #include <array>
 #include <algorithm>
+#include <chrono>
 
 #include <wbemidl.h>
 #include <oleauto.h>
@@ -434,7 +435,8 @@ CDirectInputSystem::CDirectInputSystem(const Util::Config::Node &config, SDL_Win
 	m_useRawInput(useRawInput), m_useXInput(useXInput), m_enableFFeedback(true),
 	m_initializedCOM(false), m_activated(false), m_window(window), m_hwnd(NULL), m_screenW(0), m_screenH(0), 
 	m_getRIDevListPtr(NULL), m_getRIDevInfoPtr(NULL), m_regRIDevsPtr(NULL), m_getRIDataPtr(NULL),
-	m_xiGetCapabilitiesPtr(NULL), m_xiGetStatePtr(NULL), m_xiSetStatePtr(NULL), m_di8(NULL), m_di8Keyboard(NULL), m_di8Mouse(NULL)
+	m_xiGetCapabilitiesPtr(NULL), m_xiGetStatePtr(NULL), m_xiSetStatePtr(NULL), m_di8(NULL), m_di8Keyboard(NULL), m_di8Mouse(NULL),
+	m_joyStatesFresh(false), m_joyThreadQuit(false)
 {
 	// Reset initial states
 	memset(&m_combRawMseState, 0, sizeof(m_combRawMseState));
@@ -444,6 +446,7 @@ CDirectInputSystem::CDirectInputSystem(const Util::Config::Node &config, SDL_Win
 
 CDirectInputSystem::~CDirectInputSystem()
 {
+	StopForceFeedback();
 	CloseKeyboardsAndMice();
 	CloseJoysticks();
 
@@ -1287,10 +1290,15 @@ void CDirectInputSystem::OpenJoysticks()
 		m_joyDetails.push_back(joyDetails);
 		m_diJoyStates.push_back(joyState);
 	}
+	m_joyPollStates = m_diJoyStates;
+	m_joySharedStates = m_diJoyStates;
+	m_xiRetryTicks.assign(m_diJoyStates.size(), 0);
 }
 
 void CDirectInputSystem::ActivateJoysticks()
 {
+	std::lock_guard<std::mutex> lock(m_joyDeviceLock);
+
 	// Set DirectInput cooperative level of joysticks
 	unsigned joyNum = 0;
 	for (std::vector<DIJoyInfo>::iterator it = m_diJoyInfos.begin(); it != m_diJoyInfos.end(); ++it)
@@ -1312,20 +1320,27 @@ void CDirectInputSystem::ActivateJoysticks()
 void CDirectInputSystem::PollJoysticks()
 {
 	// Get current joystick states from XInput and DirectInput
+	std::lock_guard<std::mutex> lock(m_joyDeviceLock);
+	ULONGLONG now = GetTickCount64();
 	int i = 0;
 	for (std::vector<DIJoyInfo>::iterator it = m_diJoyInfos.begin(); it != m_diJoyInfos.end(); ++it)
 	{
-		LPDIJOYSTATE2 pJoyState = &m_diJoyStates[i++];
+		ULONGLONG *pRetryTicks = &m_xiRetryTicks[i];
+		LPDIJOYSTATE2 pJoyState = &m_joyPollStates[i++];
 
 		HRESULT hr;
 		if (it->isXInput)
 		{
-			// Use XInput to query joystick
+			// Use XInput to query joystick, unless found unplugged less than a second ago
+			if (now < *pRetryTicks)
+				continue;
 			XINPUT_STATE xState;
 			memset(&xState, 0, sizeof(xState));
-			if (FAILED(hr = m_xiGetStatePtr(it->xInputNum, &xState)))
+			if (m_xiGetStatePtr(it->xInputNum, &xState) != ERROR_SUCCESS)
 			{
 				memset(pJoyState, 0, sizeof(DIJOYSTATE2));
+				pJoyState->rgdwPOV[0] = -1;
+				*pRetryTicks = now + 1000;
 				continue;
 			}
 
@@ -1391,8 +1406,46 @@ void CDirectInputSystem::PollJoysticks()
 	}
 }
 
+void CDirectInputSystem::JoystickThread()
+{
+	std::unique_lock<std::mutex> lock(m_joyStatesLock);
+	while (!m_joyThreadQuit)
+	{
+		lock.unlock();
+		PollJoysticks();
+		lock.lock();
+		m_joySharedStates = m_joyPollStates;
+		m_joyStatesFresh = true;
+
+		// Poll at about 1 kHz, well ahead of the frame rate
+		m_joyWake.wait_for(lock, std::chrono::milliseconds(1));
+	}
+}
+
+void CDirectInputSystem::StartJoystickThread()
+{
+	if (m_joyThread.joinable() || m_diJoyInfos.empty())
+		return;
+	m_joyThreadQuit = false;
+	m_joyThread = std::thread(&CDirectInputSystem::JoystickThread, this);
+}
+
+void CDirectInputSystem::StopJoystickThread()
+{
+	if (!m_joyThread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_joyStatesLock);
+		m_joyThreadQuit = true;
+	}
+	m_joyWake.notify_one();
+	m_joyThread.join();
+}
+
 void CDirectInputSystem::CloseJoysticks()
 {
+	StopJoystickThread();
+
 	// Release any DirectInput force feedback effects that were created
 	for (std::vector<DIJoyInfo>::iterator it = m_diJoyInfos.begin(); it != m_diJoyInfos.end(); ++it)
 	{
@@ -1419,6 +1472,10 @@ void CDirectInputSystem::CloseJoysticks()
 	m_joyDetails.clear();
 	m_diJoyInfos.clear();
 	m_diJoyStates.clear();
+	m_joyPollStates.clear();
+	m_joySharedStates.clear();
+	m_xiRetryTicks.clear();
+	m_joyStatesFresh = false;
 	m_di8Joysticks.clear();
 }
 
@@ -1771,6 +1828,7 @@ bool CDirectInputSystem::IsJoyButPressed(int joyNum, int butNum)
 
 bool CDirectInputSystem::ProcessForceFeedbackCmd(int joyNum, int axisNum, ForceFeedbackCmd ffCmd)
 {
+	std::lock_guard<std::mutex> lock(m_joyDeviceLock);
 	DIJoyInfo *pInfo = &m_diJoyInfos[joyNum];
 
 	HRESULT hr;
@@ -2069,6 +2127,7 @@ bool CDirectInputSystem::Poll()
 		// Activate the devices now that a Window handle is available
 		ActivateKeyboardsAndMice();
 		ActivateJoysticks();
+		StartJoystickThread();
 
 		m_activated = true;
 	}
@@ -2121,9 +2180,16 @@ bool CDirectInputSystem::Poll()
 			return false;	
 	}
 
-	// Poll keyboards, mice and joysticks
+	// Poll keyboards and mice, and take the joystick states last polled
 	PollKeyboardsAndMice();
-	PollJoysticks();
+	{
+		std::lock_guard<std::mutex> lock(m_joyStatesLock);
+		if (m_joyStatesFresh)
+		{
+			m_diJoyStates.swap(m_joySharedStates);
+			m_joyStatesFresh = false;
+		}
+	}
 
 	return true;
 }
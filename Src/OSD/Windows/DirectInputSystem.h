@@ -41,6 +41,9 @@
 #include <XInput.h>
 #include <functional>
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #define NUM_DI_KEYS (sizeof(s_keyMap) / sizeof(DIKeyMapStruct))
@@ -166,6 +169,22 @@ private:
 	std::vector<DIJoyInfo> m_diJoyInfos;
 	std::vector<DIJOYSTATE2> m_diJoyStates;
 
+	// Joysticks are polled by a thread of their own, as XInput and DirectInput
+	// can take milliseconds to answer for a controller that is unplugged or
+	// misbehaving. It polls into m_joyPollStates and publishes them to
+	// m_joySharedStates, which Poll() swaps with m_diJoyStates. XInput
+	// controllers found unplugged are only tried again every so often, so that
+	// they are picked up when plugged back in without slowing each poll.
+	std::vector<DIJOYSTATE2> m_joyPollStates;
+	std::vector<DIJOYSTATE2> m_joySharedStates;
+	std::vector<ULONGLONG> m_xiRetryTicks;
+	std::thread m_joyThread;
+	std::mutex m_joyStatesLock;
+	std::mutex m_joyDeviceLock;			// held while using the joystick devices
+	std::condition_variable m_joyWake;
+	bool m_joyStatesFresh;
+	bool m_joyThreadQuit;
+
 	bool GetRegString(HKEY regKey, const char *regPath, std::string &str);
 
 	bool GetRegDeviceName(const char *rawDevName, char *name);
@@ -188,6 +207,12 @@ private:
 
 	void PollJoysticks();
 
+	void JoystickThread();
+
+	void StartJoystickThread();
+
+	void StopJoystickThread();
+
 	void CloseJoysticks();
 
 	HRESULT CreateJoystickEffect(LPDIRECTINPUTDEVICE8 di8Joystick, int axisNum, ForceFeedbackCmd ffCmd, LPDIRECTINPUTEFFECT *di8Effect);
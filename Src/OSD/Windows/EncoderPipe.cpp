@@ -0,0 +1,103 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2023 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "OSD/EncoderPipe.h"
+#include <cstdio>
+#include <windows.h>
+
+namespace EncoderPipe
+{
+    struct Pipe
+    {
+        FILE *process = nullptr;
+        HANDLE pipe = INVALID_HANDLE_VALUE;
+        bool connected = false;
+    };
+
+    Pipe *StartProcess(const std::string &command)
+    {
+        FILE *process = _popen(command.c_str(), "wb");
+        if (process == nullptr)
+            return nullptr;
+        Pipe *pipe = new Pipe();
+        pipe->process = process;
+        return pipe;
+    }
+
+    Pipe *MakeNamed(const std::string &name, std::string *path)
+    {
+        // Without waiting, ConnectNamedPipe() reports whether the program has
+        // connected rather than waiting for it, so that Write() can time out
+        std::string pipePath = "\\\\.\\pipe\\" + name;
+        HANDLE handle = CreateNamedPipeA(pipePath.c_str(), PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_NOWAIT, 1, 65536, 0, 0, nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+            return nullptr;
+        Pipe *pipe = new Pipe();
+        pipe->pipe = handle;
+        *path = pipePath;
+        return pipe;
+    }
+
+    bool Write(Pipe *pipe, const void *data, size_t length, unsigned timeoutMs)
+    {
+        if (pipe->process != nullptr)
+            return fwrite(data, 1, length, pipe->process) == length;
+
+        for (unsigned waited = 0; !pipe->connected; waited += 10)
+        {
+            if (ConnectNamedPipe(pipe->pipe, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED)
+            {
+                // Then block on writes, like the program's standard input
+                DWORD mode = PIPE_READMODE_BYTE | PIPE_WAIT;
+                SetNamedPipeHandleState(pipe->pipe, &mode, nullptr, nullptr);
+                pipe->connected = true;
+            }
+            else if (GetLastError() != ERROR_PIPE_LISTENING || waited >= timeoutMs)
+                return false;
+            else
+                Sleep(10);
+        }
+
+        const char *p = (const char *)data;
+        while (length > 0)
+        {
+            DWORD written = 0;
+            if (!WriteFile(pipe->pipe, p, DWORD(length), &written, nullptr) || written == 0)
+                return false;
+            p += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    int Close(Pipe *pipe)
+    {
+        int exitCode = 0;
+        if (pipe == nullptr)
+            return exitCode;
+        if (pipe->process != nullptr)
+            exitCode = _pclose(pipe->process);
+        if (pipe->pipe != INVALID_HANDLE_VALUE)
+            CloseHandle(pipe->pipe);
+        delete pipe;
+        return exitCode;
+    }
+}
@@ -0,0 +1,124 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "OSD/OutputStream.h"
+#include "Util/Format.h"
+#include <cstring>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+namespace OutputStream
+{
+    struct Stream
+    {
+        SOCKET socket = INVALID_SOCKET;
+        HANDLE pipe = INVALID_HANDLE_VALUE;
+        sockaddr_storage address;
+        int addressLength = 0;
+    };
+
+    Stream *OpenUDP(const std::string &address, unsigned port)
+    {
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+            return nullptr;
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo *info = nullptr;
+        if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &info) != 0 || info == nullptr)
+        {
+            WSACleanup();
+            return nullptr;
+        }
+
+        Stream *stream = new Stream();
+        stream->socket = socket(info->ai_family, SOCK_DGRAM, 0);
+        memcpy(&stream->address, info->ai_addr, info->ai_addrlen);
+        stream->addressLength = int(info->ai_addrlen);
+        freeaddrinfo(info);
+        if (stream->socket == INVALID_SOCKET)
+        {
+            delete stream;
+            WSACleanup();
+            return nullptr;
+        }
+        u_long nonBlocking = 1;
+        ioctlsocket(stream->socket, FIONBIO, &nonBlocking);
+        return stream;
+    }
+
+    Stream *OpenPipe(const std::string &name)
+    {
+        // Without waiting, ConnectNamedPipe() reports whether a client has
+        // connected rather than waiting for one
+        std::string path = "\\\\.\\pipe\\" + name;
+        HANDLE pipe = CreateNamedPipeA(path.c_str(), PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_NOWAIT, 1, 4096, 0, 0, nullptr);
+        if (pipe == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        Stream *stream = new Stream();
+        stream->pipe = pipe;
+        return stream;
+    }
+
+    bool Write(Stream *stream, const char *message, size_t length)
+    {
+        if (stream->pipe == INVALID_HANDLE_VALUE)
+            return sendto(stream->socket, message, int(length), 0, (const sockaddr *)&stream->address, stream->addressLength) == int(length);
+
+        if (!ConnectNamedPipe(stream->pipe, nullptr))
+        {
+            DWORD error = GetLastError();
+            if (error == ERROR_NO_DATA)             // the client went away
+                DisconnectNamedPipe(stream->pipe);
+            if (error != ERROR_PIPE_CONNECTED)
+                return false;
+        }
+        // The line goes in one write so readers never see part of one
+        Util::Format line;
+        line.Printf("%.*s\n", int(length), message);
+        DWORD written = 0;
+        if (!WriteFile(stream->pipe, line.c_str(), DWORD(line.size()), &written, nullptr))
+        {
+            if (GetLastError() == ERROR_NO_DATA)
+                DisconnectNamedPipe(stream->pipe);
+            return false;
+        }
+        return written == DWORD(line.size());
+    }
+
+    void Close(Stream *stream)
+    {
+        if (stream == nullptr)
+            return;
+        if (stream->socket != INVALID_SOCKET)
+        {
+            closesocket(stream->socket);
+            WSACleanup();
+        }
+        if (stream->pipe != INVALID_HANDLE_VALUE)
+            CloseHandle(stream->pipe);
+        delete stream;
+    }
+}
@@ -0,0 +1,155 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PageProtection.h"
+#include <atomic>
+#include <cstdint>
+#include <windows.h>
+
+namespace PageProtection
+{
+    struct Range
+    {
+        std::atomic<uint8_t *> base;
+        size_t size;
+        WriteHandler handler;
+        void *context;
+    };
+
+    static const size_t MaxRanges = 8;
+    static Range s_ranges[MaxRanges];
+    static PVOID s_exceptionHandler = nullptr;
+
+    static LONG CALLBACK OnException(PEXCEPTION_POINTERS info)
+    {
+        const EXCEPTION_RECORD *record = info->ExceptionRecord;
+        if (record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || record->NumberParameters < 2 || record->ExceptionInformation[0] != 1)
+            return EXCEPTION_CONTINUE_SEARCH; // not a write access violation
+        uint8_t *addr = (uint8_t *) record->ExceptionInformation[1];
+        for (Range &range: s_ranges)
+        {
+            uint8_t *base = range.base.load(std::memory_order_acquire);
+            if (base != nullptr && addr >= base && addr < base + range.size)
+            {
+                size_t offset = (addr - base) & ~(GetPageSize() - 1);
+                DWORD oldProtect;
+                VirtualProtect(base + offset, GetPageSize(), PAGE_READWRITE, &oldProtect);
+                range.handler(range.context, offset);
+                return EXCEPTION_CONTINUE_EXECUTION;
+            }
+        }
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    size_t GetPageSize()
+    {
+        static const size_t s_pageSize = []()
+        {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return size_t(info.dwPageSize);
+        }();
+        return s_pageSize;
+    }
+
+    void *Allocate(size_t size)
+    {
+        return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+
+    // Large pages require the lock memory privilege, which must be granted to
+    // the user and enabled in the process
+    static bool EnableLockMemoryPrivilege()
+    {
+        HANDLE token;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+            return false;
+        TOKEN_PRIVILEGES privileges;
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        bool enabled = LookupPrivilegeValue(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+            AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+            GetLastError() == ERROR_SUCCESS;  // not ERROR_NOT_ALL_ASSIGNED
+        CloseHandle(token);
+        return enabled;
+    }
+
+    void *AllocateLarge(size_t size, bool *largePages)
+    {
+        static const bool s_privilege = EnableLockMemoryPrivilege();
+        size_t largePageSize = GetLargePageMinimum();
+        *largePages = false;
+        if (s_privilege && largePageSize > 0)
+        {
+            size_t largeSize = (size + largePageSize - 1) & ~(largePageSize - 1);
+            void *ptr = VirtualAlloc(nullptr, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (ptr != nullptr)
+            {
+                *largePages = true;
+                return ptr;
+            }
+        }
+        return Allocate(size);
+    }
+
+    void Free(void *ptr, size_t size)
+    {
+        if (ptr != nullptr)
+            VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+
+    bool Protect(void *ptr, size_t size, bool writable)
+    {
+        DWORD oldProtect;
+        return !VirtualProtect(ptr, size, writable ? PAGE_READWRITE : PAGE_READONLY, &oldProtect);
+    }
+
+    bool Watch(void *ptr, size_t size, WriteHandler handler, void *context)
+    {
+        if (s_exceptionHandler == nullptr)
+        {
+            s_exceptionHandler = AddVectoredExceptionHandler(1, OnException);
+            if (s_exceptionHandler == nullptr)
+                return true;
+        }
+        for (Range &range: s_ranges)
+        {
+            if (range.base.load() == nullptr)
+            {
+                range.size = size;
+                range.handler = handler;
+                range.context = context;
+                range.base.store((uint8_t *) ptr, std::memory_order_release);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Unwatch(void *ptr)
+    {
+        for (Range &range: s_ranges)
+        {
+            if (range.base.load() == (uint8_t *) ptr)
+                range.base.store(nullptr);
+        }
+    }
+}
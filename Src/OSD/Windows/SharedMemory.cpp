@@ -0,0 +1,143 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "OSD/SharedMemory.h"
+#include <map>
+#include <mutex>
+#include <vector>
+#include <windows.h>
+
+namespace SharedMemory
+{
+    struct Region
+    {
+        void *ptr;
+        size_t size;
+        HANDLE mapping;
+        std::string name;
+        std::map<size_t, HANDLE> events;  // by offset of the word waited on
+    };
+
+    static std::mutex s_regionsLock;
+    static std::vector<Region> s_regions;
+
+    // Session-local names, so that no privileges are needed
+    static std::string ObjectName(const std::string &name)
+    {
+        return "Local\\" + name;
+    }
+
+    static void *Map(HANDLE mapping, const std::string &name, size_t size)
+    {
+        void *ptr = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (ptr == nullptr)
+        {
+            CloseHandle(mapping);
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(s_regionsLock);
+        s_regions.push_back({ ptr, size, mapping, name, {} });
+        return ptr;
+    }
+
+    void *Create(const std::string &name, size_t size)
+    {
+        // Mappings go away with the last handle to them, so any of the same
+        // name belongs to a running process
+        uint64_t size64 = size;
+        HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, DWORD(size64 >> 32), DWORD(size64), ObjectName(name).c_str());
+        if (mapping == nullptr)
+            return nullptr;
+        if (GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(mapping);
+            return nullptr;
+        }
+        return Map(mapping, name, size);
+    }
+
+    void *Open(const std::string &name, size_t size)
+    {
+        HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, ObjectName(name).c_str());
+        if (mapping == nullptr)
+            return nullptr;
+        return Map(mapping, name, size);
+    }
+
+    void Close(void *ptr)
+    {
+        std::lock_guard<std::mutex> lock(s_regionsLock);
+        for (auto it = s_regions.begin(); it != s_regions.end(); ++it)
+        {
+            if (it->ptr == ptr)
+            {
+                for (auto &event: it->events)
+                    CloseHandle(event.second);
+                UnmapViewOfFile(it->ptr);
+                CloseHandle(it->mapping);
+                s_regions.erase(it);
+                return;
+            }
+        }
+    }
+
+    // WaitOnAddress() does not work across processes, so each word has a
+    // named auto-reset event, which stays signalled if set before waiting
+    static HANDLE GetEvent(std::atomic<uint32_t> *word)
+    {
+        std::lock_guard<std::mutex> lock(s_regionsLock);
+        for (Region &region: s_regions)
+        {
+            uint8_t *base = (uint8_t *) region.ptr;
+            uint8_t *addr = (uint8_t *) word;
+            if (addr >= base && addr < base + region.size)
+            {
+                size_t offset = addr - base;
+                auto it = region.events.find(offset);
+                if (it != region.events.end())
+                    return it->second;
+                std::string name = ObjectName(region.name) + "-" + std::to_string(offset);
+                HANDLE event = CreateEventA(nullptr, FALSE, FALSE, name.c_str());
+                if (event != nullptr)
+                    region.events[offset] = event;
+                return event;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Wait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMS)
+    {
+        if (word->load() != expected)
+            return true;
+        HANDLE event = GetEvent(word);
+        if (event == nullptr)
+            return true;
+        return WaitForSingleObject(event, timeoutMS < 0 ? INFINITE : DWORD(timeoutMS)) != WAIT_TIMEOUT;
+    }
+
+    void Wake(std::atomic<uint32_t> *word)
+    {
+        HANDLE event = GetEvent(word);
+        if (event != nullptr)
+            SetEvent(event);
+    }
+}
@@ -0,0 +1,65 @@
+/**
+ ** Supermodel
+ ** A Sega Model 3 Arcade Emulator.
+ ** Copyright 2003-2022 The Supermodel Team
+ **
+ ** This file is part of Supermodel.
+ **
+ ** Supermodel is free software: you can redistribute it and/or modify it under
+ ** the terms of the GNU General Public License as published by the Free
+ ** Software Foundation, either version 3 of the License, or (at your option)
+ ** any later version.
+ **
+ ** Supermodel is distributed in the hope that it will be useful, but WITHOUT
+ ** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ ** FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ ** more details.
+ **
+ ** You should have received a copy of the GNU General Public License along
+ ** with Supermodel.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "OSD/Thread.h"
+#include <windows.h>
+
+// Best effort: without the required privileges each of these fails harmlessly
+
+bool CThread::SetCurrentThreadCore(unsigned core)
+{
+    if (core >= sizeof(DWORD_PTR) * 8)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+}
+
+static bool SetRealtimePriority()
+{
+    // Register with the Multimedia Class Scheduler Service as a game thread.
+    // avrt.dll is loaded on demand so that it is not needed to start up.
+    typedef HANDLE (WINAPI *AvSetMmThreadCharacteristicsFunc)(LPCWSTR, LPDWORD);
+    HMODULE avrt = LoadLibraryW(L"avrt.dll");
+    if (avrt == NULL)
+        return false;
+    auto avSetMmThreadCharacteristics = (AvSetMmThreadCharacteristicsFunc) GetProcAddress(avrt, "AvSetMmThreadCharacteristicsW");
+    DWORD taskIndex = 0;
+    if (avSetMmThreadCharacteristics == NULL || avSetMmThreadCharacteristics(L"Games", &taskIndex) == NULL)
+    {
+        FreeLibrary(avrt);
+        return false;
+    }
+    return true;  // avrt.dll stays loaded for as long as the thread is registered
+}
+
+static bool SetHighPriority()
+{
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST) != 0;
+}
+
+CThread::Priority CThread::SetCurrentThreadPriority(Priority priority)
+{
+    if (priority == PRIORITY_REALTIME && SetRealtimePriority())
+        return PRIORITY_REALTIME;
+    if (priority >= PRIORITY_HIGH && SetHighPriority())
+        return PRIORITY_HIGH;
+    return PRIORITY_NORMAL;
+}
@@ -54,6 +54,8 @@ CWinOutputs::CWinOutputs() : m_hwnd(NULL)
 
 CWinOutputs::~CWinOutputs()
 {
+	StopDelivery();
+
 	// Broadcast a shutdown message
 	if (m_hwnd)
 		PostMessage(HWND_BROADCAST, m_onStop, (WPARAM)m_hwnd, 0);
@@ -111,6 +113,7 @@ void CWinOutputs::SendOutput(EOutputs output, UINT8 prevValue, UINT8 value)
 	
 	// Loop through all registered clients and send them new output value
 	LPARAM param = (LPARAM)output + 1;
+	std::lock_guard<std::mutex> lock(m_clientsLock);
 	for (vector<RegisteredClient>::iterator it = m_clients.begin(), end = m_clients.end(); it != end; ++it)
 		PostMessage(it->hwnd, m_updateState, param, value);
 }
@@ -178,6 +181,7 @@ LRESULT CWinOutputs::OutputWindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM
 LRESULT CWinOutputs::RegisterClient(HWND hwnd, LPARAM id)
 {
 	// Check that given client is not already registered
+	std::lock_guard<std::mutex> lock(m_clientsLock);
 	for (vector<RegisteredClient>::iterator it = m_clients.begin(), end = m_clients.end(); it != end; ++it)
 	{
 		if (it->id == id)
@@ -215,6 +219,7 @@ LRESULT CWinOutputs::UnregisterClient(HWND hwnd, LPARAM id)
 {
 	// Find any matching clients and remove them
 	bool found = false;
+	std::lock_guard<std::mutex> lock(m_clientsLock);
 	vector<RegisteredClient>::iterator it = m_clients.begin();
 	while (it != m_clients.end())
 	{
@@ -33,6 +33,7 @@
 
 #include "OSD/Outputs.h"
 
+#include <mutex>
 #include <vector>
 
 using namespace std;
@@ -81,7 +82,8 @@ protected:
 	/*
 	 * SendOutput():
 	 *
-	 * Sends the appropriate output message to all registered clients.
+	 * Sends the appropriate output message to all registered clients, from
+	 * the delivery thread.
 	 */
 	void SendOutput(EOutputs output, UINT8 prevValue, UINT8 value);
 
@@ -114,6 +116,7 @@ private:
 	UINT m_getIdString;
 
 	vector<RegisteredClient> m_clients;
+	std::mutex m_clientsLock;	// clients are registered by the window procedure while outputs are delivered
 
 	/*
 	 * AllocateMessageId(regId, str):
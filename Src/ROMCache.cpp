@@ -0,0 +1,149 @@
+#include "ROMCache.h"
+#include "OSD/Logger.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace ROMCache
+{
+  static const size_t MaxSpans = 8;
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t key;
+    uint32_t num_spans;
+    uint32_t reserved;
+    uint64_t span_size[MaxSpans];
+  };
+
+  static const char s_magic[8] = { 'S', 'M', 'D', 'E', 'C', 'R', 'O', 'M' };
+
+  std::string GetFilePath(const std::string &dir, const std::string &game_name, uint32_t key)
+  {
+    std::string path = dir;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\')
+      path += '/';
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "-%08x.bin", key);
+    return path + game_name + suffix;
+  }
+
+  static bool ReadHeader(Header *header, FILE *fp, uint32_t key)
+  {
+    if (fread(header, sizeof(*header), 1, fp) != 1)
+      return false;
+    return !memcmp(header->magic, s_magic, sizeof(s_magic)) && header->version == Version && header->key == key && header->num_spans <= MaxSpans;
+  }
+
+  bool IsValid(const std::string &file, uint32_t key)
+  {
+    FILE *fp = fopen(file.c_str(), "rb");
+    if (!fp)
+      return false;
+    Header header;
+    bool valid = ReadHeader(&header, fp, key);
+    fclose(fp);
+    return valid;
+  }
+
+  bool Save(const std::string &file, uint32_t key, const std::vector<Span> &spans)
+  {
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = Version;
+    header.key = key;
+    header.num_spans = uint32_t(spans.size());
+    if (spans.size() > MaxSpans)
+      return ErrorLog("Too many regions for decoded ROM cache.");
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+      if (spans[i].size % Alignment)
+        return ErrorLog("Decoded ROM cache region is not a multiple of 0x%x bytes.", unsigned(Alignment));
+      header.span_size[i] = spans[i].size;
+    }
+
+    // Write to a temporary file first, so that instances starting at the same
+    // time never see a partial file
+    std::string temp_file = file + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    FILE *fp = fopen(temp_file.c_str(), "wb");
+    if (!fp)
+      return ErrorLog("Unable to create decoded ROM cache '%s'.", file.c_str());
+    std::vector<uint8_t> padding(Alignment - sizeof(header), 0);
+    bool error = fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(padding.data(), padding.size(), 1, fp) != 1;
+    for (auto &span: spans)
+      error = error || fwrite(span.ptr, span.size, 1, fp) != 1;
+    error = fclose(fp) != 0 || error;
+    if (error || rename(temp_file.c_str(), file.c_str()) != 0)
+    {
+      remove(temp_file.c_str());
+      return ErrorLog("Unable to write decoded ROM cache '%s'.", file.c_str());
+    }
+    InfoLog("Wrote decoded ROM cache '%s'.", file.c_str());
+    return false;
+  }
+
+  bool Load(const std::string &file, uint32_t key, const std::vector<Span> &spans)
+  {
+    FILE *fp = fopen(file.c_str(), "rb");
+    if (!fp)
+      return ErrorLog("Unable to open decoded ROM cache '%s'.", file.c_str());
+    Header header;
+    bool error = !ReadHeader(&header, fp, key) || header.num_spans != spans.size();
+    uint64_t file_size = Alignment;
+    for (size_t i = 0; i < spans.size() && !error; i++)
+    {
+      error = header.span_size[i] != spans[i].size;
+      file_size += spans[i].size;
+    }
+    fseek(fp, 0, SEEK_END);
+    error = error || uint64_t(ftell(fp)) < file_size;
+    if (error)
+    {
+      fclose(fp);
+      return ErrorLog("Decoded ROM cache '%s' does not match this version of Supermodel. Delete it and try again.", file.c_str());
+    }
+
+    uint64_t offset = Alignment;
+#ifndef _WIN32
+    // Map copy-on-write over the destination where page alignment permits
+    size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+    for (auto &span: spans)
+    {
+      if (((uintptr_t) span.ptr % page_size) == 0 && (offset % page_size) == 0 && (span.size % page_size) == 0)
+      {
+        void *ptr = mmap(span.ptr, span.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(fp), off_t(offset));
+        error = error || ptr != span.ptr;
+#ifdef MADV_WILLNEED
+        // Pages are read on first access, which would stall emulation the
+        // first time large regions are touched after a cold start. Have the
+        // OS read them all in the background instead.
+        if (ptr == span.ptr)
+          madvise(ptr, span.size, MADV_WILLNEED);
+#endif
+      }
+      else
+      {
+        fseek(fp, long(offset), SEEK_SET);
+        error = error || fread(span.ptr, span.size, 1, fp) != 1;
+      }
+      offset += span.size;
+    }
+#else
+    fseek(fp, long(offset), SEEK_SET);
+    for (auto &span: spans)
+      error = error || fread(span.ptr, span.size, 1, fp) != 1;
+#endif
+    fclose(fp);
+    if (error)
+      return ErrorLog("Unable to read decoded ROM cache '%s'.", file.c_str());
+    InfoLog("Loaded ROMs from decoded ROM cache '%s'.", file.c_str());
+    return false;
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef INCLUDED_ROMCACHE_H
+#define INCLUDED_ROMCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Decoded ROM cache.
+ *
+ * Loading a game means inflating the ROM files and interleaving, byte
+ * swapping, and mirroring them into the emulator's memory. The result depends
+ * only on the ROM set, so it can be saved once and read back on later runs,
+ * which then skip the zip archives entirely. Where the host allows it, cached
+ * spans are memory-mapped copy-on-write rather than read, letting all
+ * emulator instances running the same game share physical pages. Mapped spans
+ * are filled by page on first access and prefetched by the OS in the
+ * background, so loading them takes no time and emulation starts at once.
+ *
+ * A cache file is a header followed by the spans passed to Save(), in order.
+ * Span sizes and file offsets are multiples of Alignment, and so must span
+ * addresses be for mapping to be possible.
+ */
+namespace ROMCache
+{
+  struct Span
+  {
+    uint8_t *ptr;
+    size_t size;
+  };
+
+  // Alignment of spans in memory and in the file (largest common page size)
+  static const size_t Alignment = 0x10000;
+
+  // Must be incremented whenever the decoded data stored by any emulator
+  // changes, invalidating existing cache files
+  static const uint32_t Version = 1;
+
+  // Cache file name for a ROM set; key identifies the ROM set contents
+  std::string GetFilePath(const std::string &dir, const std::string &game_name, uint32_t key);
+
+  // Whether the file exists and is a cache file for the given key
+  bool IsValid(const std::string &file, uint32_t key);
+
+  // Both return true on error
+  bool Save(const std::string &file, uint32_t key, const std::vector<Span> &spans);
+  bool Load(const std::string &file, uint32_t key, const std::vector<Span> &spans);
+}
+
+#endif  // INCLUDED_ROMCACHE_H
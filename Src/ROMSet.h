@@ -33,6 +33,17 @@ struct ROM
 struct ROMSet
 {
   std::map<std::string, ROM> rom_by_region;
+
+  // Decoded ROM cache file (see ROMCache.h), empty if not used. If cached is
+  // set, the file exists and ROM regions hold only their sizes, no data.
+  std::string cache_file;
+  uint32_t cache_key = 0;
+  bool cached = false;
+
+  // Every file was inflated from a zip archive, which checks its CRC, rather
+  // than taken from the cache or uncompressed files (see
+  // GameLoader::VerifyROMs())
+  bool verified = false;
   
   ROM get_rom(const std::string &region) const;
 };
@@ -1,70 +1,273 @@
 #define MINIMP3_IMPLEMENTATION
 #include "Pkgs/minimp3.h"
 #include "MpegAudio.h"
+#include "Supermodel.h"
+#include "OSD/Thread.h"
+#include <cstring>
+#include <new>
 
-struct Decoder
+// MPEG frames are decoded ahead of playback by a worker thread into a small
+// queue, so that DecodeAudio() mostly just copies PCM. Each queued frame holds
+// the decoder state after it was decoded. When playback is changed (new track,
+// loop points or position), the frames decoded ahead are dropped and decoding
+// resumes from the state after the frame being played, so the output is the
+// same as decoding each frame at the time it is needed. If no frame is ready
+// when one is needed, it is decoded right away rather than waiting.
+//
+// Each DSB has a decoder of its own, selected per thread with SetDecoder() as
+// the SCSP and CPU contexts are.
+
+struct Stream
 {
 	mp3dec_t			mp3d;
-	mp3dec_frame_info_t	info;
 	const uint8_t*		buffer;
 	int					size, pos;
 	bool				loop;
-	bool				stopped;
+};
+
+struct Frame
+{
+	Stream				after;		// stream state after decoding this frame
+	mp3dec_frame_info_t	info;
 	int					numSamples;
-	int					pcmPos;
+	bool				ended;		// reached end of a buffer that does not loop
 	short				pcm[MINIMP3_MAX_SAMPLES_PER_FRAME];
 };
 
-static Decoder dec = { 0 };
+static const unsigned NUM_QUEUED_FRAMES = 8;
+
+struct MpegDec::Decoder
+{
+	// Playback, only used by the thread calling the MpegDec functions
+	Stream				played;		// stream state after the frame being played
+	Frame				frame;		// frame being played
+	int					pcmPos;
+	bool				stopped;
+
+	// Decoding ahead, shared with the worker thread under lock
+	CThread*			thread;
+	bool				noThread;	// thread could not be created
+	CMutex*				lock;
+	CCondVar*			wake;
+	Stream				next;		// stream state to decode the next frame from
+	Frame				queue[NUM_QUEUED_FRAMES];
+	unsigned			head, count;
+	unsigned			generation;	// incremented whenever the queue is dropped
+	bool				quit;
+};
+
+static MpegDec::Decoder s_defaultDecoder = { };
+static thread_local MpegDec::Decoder *s_decoder = &s_defaultDecoder;
+
+#define dec (*s_decoder)
+
+static bool EndOfBuffer(const Stream& s)
+{
+	return s.pos >= s.size - HDR_SIZE;
+}
+
+// Decodes the next frame of a stream, starting from f.after
+static void DecodeFrame(Frame& f)
+{
+	Stream& s = f.after;
+
+	f.numSamples = mp3dec_decode_frame(
+		&s.mp3d,
+		s.buffer + s.pos,
+		s.size - s.pos,
+		f.pcm,
+		&f.info);
+
+	s.pos += f.info.frame_bytes;
+
+	// check end of buffer handling
+	f.ended = false;
+	if (EndOfBuffer(s)) {
+		if (s.loop) {
+			s.pos = 0;
+		}
+		else {
+			f.ended = true;
+		}
+	}
+}
+
+static int DecodeThread(void *param)
+{
+	s_decoder = (MpegDec::Decoder *) param;	// the decoder that started the thread
+
+	if (!dec.lock->Lock()) {
+		goto ThreadError;
+	}
+
+	for (;;) {
+		while (!dec.quit && (dec.count == NUM_QUEUED_FRAMES || !dec.next.buffer)) {
+			if (!dec.wake->Wait(dec.lock)) {
+				goto ThreadError;
+			}
+		}
+
+		if (dec.quit) {
+			break;
+		}
+
+		// decode into the first free slot, which only this thread writes to
+		unsigned generation = dec.generation;
+		Frame& f = dec.queue[(dec.head + dec.count) % NUM_QUEUED_FRAMES];
+		f.after = dec.next;
+
+		dec.lock->Unlock();
+		DecodeFrame(f);
+		dec.lock->Lock();
+
+		// keep it unless the queue was dropped meanwhile
+		if (generation == dec.generation) {
+			dec.next = f.after;
+			dec.count++;
+		}
+	}
+
+	dec.lock->Unlock();
+	return 0;
+
+ThreadError:
+	ErrorLog("Threading error in MPEG decoder: %s", CThread::GetLastError());
+	return 1;
+}
+
+static void StartThread()
+{
+	if (dec.thread || dec.noThread || !dec.played.buffer) {
+		return;
+	}
+
+	dec.lock = CThread::CreateMutex();
+	dec.wake = CThread::CreateCondVar();
+	dec.head = 0;
+	dec.count = 0;
+	dec.generation = 0;
+	dec.quit = false;
+	dec.next = dec.played;
+
+	if (dec.lock && dec.wake) {
+		dec.thread = CThread::CreateThread("MPEGDecoder", DecodeThread, s_decoder);
+	}
+
+	if (!dec.thread) {
+		ErrorLog("Unable to create MPEG decoder thread: %s\nDecoding MPEG audio during playback.", CThread::GetLastError());
+		delete dec.lock;
+		delete dec.wake;
+		dec.lock = nullptr;
+		dec.wake = nullptr;
+		dec.noThread = true;
+	}
+}
+
+// Drops the frames decoded ahead, after playback has been changed
+static void Restart()
+{
+	StartThread();
+
+	if (!dec.thread) {
+		return;
+	}
+
+	dec.lock->Lock();
+	dec.next = dec.played;
+	dec.count = 0;
+	dec.generation++;
+	dec.wake->Signal();
+	dec.lock->Unlock();
+}
+
+// Moves on to the next frame, decoding it now if the worker has not yet
+static void NextFrame()
+{
+	Frame& f = dec.frame;
+
+	if (dec.thread) {
+		dec.lock->Lock();
+		if (dec.count) {
+			memcpy(&f, &dec.queue[dec.head], sizeof(Frame));
+			dec.head = (dec.head + 1) % NUM_QUEUED_FRAMES;
+			dec.count--;
+			dec.wake->Signal();
+			dec.lock->Unlock();
+			dec.played = f.after;
+			return;
+		}
+
+		// drop whatever the worker is decoding, it is this frame, and keep it
+		// from starting on it again until done
+		f.after = dec.next;
+		dec.generation++;
+		DecodeFrame(f);
+		dec.next = f.after;
+		dec.wake->Signal();
+		dec.lock->Unlock();
+	}
+	else {
+		f.after = dec.played;
+		DecodeFrame(f);
+	}
+
+	dec.played = f.after;
+}
 
 void MpegDec::SetMemory(const uint8_t *data, int length, bool loop)
 {
-	mp3dec_init(&dec.mp3d);
+	mp3dec_init(&dec.played.mp3d);
+
+	dec.played.buffer	= data;
+	dec.played.size		= length;
+	dec.played.pos		= 0;
+	dec.played.loop		= loop;
+	dec.frame.numSamples = 0;
+	dec.pcmPos			= 0;
+	dec.stopped			= false;
 
-	dec.buffer		= data;
-	dec.size		= length;
-	dec.pos			= 0;
-	dec.numSamples	= 0;
-	dec.pcmPos		= 0;
-	dec.loop		= loop;
-	dec.stopped		= false;
+	Restart();
 }
 
 void MpegDec::UpdateMemory(const uint8_t* data, int length, bool loop)
 {
 	int diff;
-	if (data > dec.buffer) {
-		diff = (int)(data - dec.buffer);
+	if (data > dec.played.buffer) {
+		diff = (int)(data - dec.played.buffer);
 	}
 	else {
-		diff = -(int)(dec.buffer - data);
+		diff = -(int)(dec.played.buffer - data);
 	}
 
-	dec.buffer	= data;
-	dec.size	= length;
-	dec.pos		= dec.pos - diff;		// update position relative to our new start location
-	dec.loop	= loop;
+	dec.played.buffer	= data;
+	dec.played.size		= length;
+	dec.played.pos		= dec.played.pos - diff;		// update position relative to our new start location
+	dec.played.loop		= loop;
+
+	Restart();
 }
 
 int MpegDec::GetPosition()
 {
-	return (int)dec.pos;
+	return (int)dec.played.pos;
 }
 
 void MpegDec::SetPosition(int pos)
 {
-	dec.pos = pos;
+	dec.played.pos = pos;
+
+	Restart();
 }
 
 static void FlushBuffer(int16_t*& left, int16_t*& right, int& numStereoSamples)
 {
-	int numChans = dec.info.channels;
+	int numChans = dec.frame.info.channels;
 
 	int &i = dec.pcmPos;
 
-	for (; i < (dec.numSamples * numChans) && numStereoSamples; i += numChans) {
-		*left++ = dec.pcm[i];
-		*right++ = dec.pcm[i + numChans - 1];
+	for (; i < (dec.frame.numSamples * numChans) && numStereoSamples; i += numChans) {
+		*left++ = dec.frame.pcm[i];
+		*right++ = dec.frame.pcm[i + numChans - 1];
 		numStereoSamples--;
 	}
 }
@@ -80,25 +283,64 @@ static void EndWithSilence(int16_t*& left, int16_t*& right, int& numStereoSample
 	}
 }
 
-static bool EndOfBuffer()
+void MpegDec::Stop()
 {
-	return dec.pos >= dec.size - HDR_SIZE;
+	dec.stopped = true;
 }
 
-void MpegDec::Stop()
+MpegDec::Decoder *MpegDec::CreateDecoder()
 {
-	dec.stopped = true;
+	return new(std::nothrow) Decoder();
+}
+
+void MpegDec::DestroyDecoder(Decoder *decoder)
+{
+	if (decoder == nullptr || decoder == &s_defaultDecoder) {
+		return;
+	}
+
+	Decoder *prev = s_decoder;
+	s_decoder = decoder;
+	Shutdown();
+	s_decoder = (prev == decoder) ? &s_defaultDecoder : prev;
+	delete decoder;
+}
+
+void MpegDec::SetDecoder(Decoder *decoder)
+{
+	s_decoder = (decoder == nullptr) ? &s_defaultDecoder : decoder;
 }
 
 bool MpegDec::IsLoaded()
 {
-	return dec.buffer != nullptr;
+	return dec.played.buffer != nullptr;
+}
+
+void MpegDec::Shutdown()
+{
+	if (dec.thread) {
+		dec.lock->Lock();
+		dec.quit = true;
+		dec.wake->Signal();
+		dec.lock->Unlock();
+		dec.thread->Wait();
+
+		delete dec.thread;
+		delete dec.lock;
+		delete dec.wake;
+		dec.thread	= nullptr;
+		dec.lock	= nullptr;
+		dec.wake	= nullptr;
+	}
+
+	dec.played.buffer = nullptr;
+	dec.noThread = false;
 }
 
 void MpegDec::DecodeAudio(int16_t* left, int16_t* right, int numStereoSamples)
 {
 	// if we are stopped return silence
-	if (dec.stopped || !dec.buffer) {
+	if (dec.stopped || !dec.played.buffer) {
 		EndWithSilence(left, right, numStereoSamples);
 	}
 
@@ -107,26 +349,13 @@ void MpegDec::DecodeAudio(int16_t* left, int16_t* right, int numStereoSamples)
 
 	while (numStereoSamples) {
 
-		dec.numSamples = mp3dec_decode_frame(
-			&dec.mp3d,
-			dec.buffer + dec.pos,
-			dec.size - dec.pos,
-			dec.pcm,
-			&dec.info);
-
-		dec.pos += dec.info.frame_bytes;
+		NextFrame();
 		dec.pcmPos = 0;	// reset pos
 
 		FlushBuffer(left, right, numStereoSamples);
 
-		// check end of buffer handling
-		if (EndOfBuffer()) {
-			if (dec.loop) {
-				dec.pos = 0;
-			}
-			else {
-				EndWithSilence(left, right, numStereoSamples);
-			}
+		if (dec.frame.ended) {
+			EndWithSilence(left, right, numStereoSamples);
 		}
 
 	}
@@ -5,6 +5,13 @@
 
 namespace MpegDec
 {
+	// Each DSB has its own decoder, which the functions below act on once
+	// selected on the calling thread (initially a built-in default decoder)
+	struct	Decoder;
+	Decoder	*CreateDecoder();					// returns nullptr if out of memory
+	void	DestroyDecoder(Decoder *decoder);	// shuts it down first
+	void	SetDecoder(Decoder *decoder);		// nullptr selects the default decoder
+
 	void	SetMemory(const uint8_t *data, int length, bool loop);
 	void	UpdateMemory(const uint8_t *data, int length, bool loop);
 	int		GetPosition();
@@ -12,6 +19,7 @@ namespace MpegDec
 	void	DecodeAudio(int16_t* left, int16_t* right, int numStereoSamples);
 	void	Stop();
 	bool	IsLoaded();
+	void	Shutdown();
 }
 
 #endif
@@ -74,12 +74,13 @@ Anyways credit to R. Belmont and ElSemi for the code, and for being awesome emul
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <climits>
+#include <mutex>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 
-static const Util::Config::Node *s_config = 0;
-static bool s_multiThreaded = false;
-bool legacySound; // For LegacySound (SCSP DSP) config option. 
-
 #define USEDSP
 //#define RB_VOLUME
 
@@ -87,15 +88,7 @@ bool legacySound; // For LegacySound (SCSP DSP) config option.
 
 //#define CORRECT_FOR_18BIT_DAC
 
-// These globals control the operation of the SCSP, they are no longer extern and are set through SCSP_SetBuffers(). --Bart
-static double SoundClock; // Originally titled SysFPS; seems to be for the sound CPU.
 static const double Freq = 76;
-static float* bufferfl;
-static float* bufferfr;
-static float* bufferrl;
-static float* bufferrr;
-static int length;
-
 static const double srate=44100;
 
 
@@ -123,28 +116,10 @@ static const double srate=44100;
 #define DWORD UINT32
 #endif
 
-static CMutex *MIDILock;	// for safe access to the MIDI FIFOs
-static int (*Run68kCB)(int cycles);
-static void (*Int68kCB)(int irq);
-static void (*RetIntCB)();
-static DWORD IrqTimA;
-static DWORD IrqTimBC;
-static DWORD IrqMidi;
-
-unsigned short MCIEB;
-unsigned short MCIPD;
-
 #define MIDI_STACK_SIZE			0x100
 #define MIDI_STACK_SIZE_MASK	(MIDI_STACK_SIZE-1)
 
-static BYTE MidiOutStack[16];
-static BYTE MidiOutW=0,MidiOutR=0;
-static BYTE MidiStack[MIDI_STACK_SIZE];
-static BYTE MidiOutFill;
-static BYTE MidiInFill;
-static BYTE MidiW=0,MidiR=0;
-static BYTE HasSlaveSCSP=0;
-
+// Tables shared by all contexts, built once by SCSP_InitTables()
 static DWORD FNS_Table[0x400];
 static INT32 EG_TABLE[0x400];
 
@@ -157,10 +132,6 @@ static int LPANTABLE[0x10000];
 static int RPANTABLE[0x10000];
 #endif
 
-
-static int TimPris[3];
-static int TimCnt[3];
-
 #define SHIFT	12
 #define FIX(v)	((UINT32) ((float) (1<<SHIFT)*(v)))
 
@@ -254,6 +225,10 @@ struct _EG
 	int DL;		//Decay level
 	BYTE EGHOLD;
 	BYTE LPLINK;
+
+	//current segment, see EG_Update
+	int samples;	//until the state may change, 0 to recompute
+	int delta;	//volume change per sample until then
 };
 
 struct _SLOT
@@ -274,6 +249,15 @@ struct _SLOT
 	_LFO ALFO;		//Amplitude LFO
 	int slot;
 	signed short Prev;	//Previous sample (for interpolation)
+
+	// Register fields used for every sample, decoded when the registers are
+	// written (SCSP_DecodeSlotRegs)
+	BYTE ssctl, sbctl, lpctl, pcm8b, lpslnk, sdir, stwinh, d2r;
+	BYTE mdl, mdxsl, mdysl, plfos, alfos, isel, imxl;
+	DWORD lsa, lea;
+	int dspGain;	//LPANTABLE entry for the DSP input level
+	int leftGain, rightGain;	//LPANTABLE/RPANTABLE entries for the direct output
+	int ringGain;	//LPANTABLE entry for the ring buffer (FM) output
 };
 
 #define MEM4B(scsp)		((scsp->data[0]>>0x0)&0x0200)
@@ -312,6 +296,7 @@ struct _SCSP
 	_SLOT Slots[32];
 	signed short RINGBUF[64];
 	unsigned char BUFPTR;
+	UINT32 ActiveSlots;	//bit n set if Slots[n].active
 #if FM_DELAY
 	signed short DELAYBUF[FM_DELAY];
 	BYTE DELAYPTR;
@@ -325,9 +310,123 @@ struct _SCSP
 #endif
 
 	int ARTABLE[64], DRTABLE[64];
-} SCSPs[MAX_SCSP],*SCSP=SCSPs;
+};
 
-static signed short *RBUFDST;	//this points to where the sample will be stored in the RingBuf
+#define SCSP_MAX_68K_BATCH	32	// see SCSP_68KBatchSize()
+
+/*
+ * Everything belonging to one sound board's pair of SCSPs, so that several
+ * sound boards can be emulated in one process. As with the PowerPC contexts,
+ * each thread runs whichever context it last selected with SCSP_SetContext(),
+ * and the tables above are shared by all of them.
+ */
+struct SCSP_CONTEXT
+{
+	_SCSP chips[MAX_SCSP];
+	_SCSP *chip;			// SCSP being accessed
+	signed short *rbufdst;	// where the sample will be stored in the ring buffer
+
+	// Configuration
+	Util::Config::CachedValue<float> balance;
+	bool multiThreaded;
+	bool strictTiming;		// run the 68K after every sample
+	bool blockRendering;	// render slots a 68K batch at a time when possible
+	bool parallelChips;		// render the blocks of the two chips on the job pool at once
+	bool legacySound;		// LegacySoundDSP config option
+
+	// Set through SCSP_SetBuffers() and SCSP_SetCB()
+	double soundClock;		// originally titled SysFPS; seems to be for the sound CPU
+	float *bufferfl, *bufferfr, *bufferrl, *bufferrr;
+	int length;
+	int (*run68kCB)(void *data, int cycles);
+	void (*int68kCB)(void *data, int irq);
+	void *cbData;
+
+	CMutex *midiLock;		// for safe access to the MIDI FIFOs
+	DWORD irqTimA, irqTimBC, irqMidi;
+	unsigned short mcieb, mcipd;
+	BYTE midiOutStack[16];
+	BYTE midiOutW, midiOutR;
+	BYTE midiStack[MIDI_STACK_SIZE];
+	BYTE midiOutFill, midiInFill;
+	BYTE midiW, midiR;
+	BYTE hasSlaveSCSP;
+	int timPris[3], timCnt[3];
+	int lastdiff;			// 68K cycles run past the last batch
+
+	// Block rendering (see SCSP_RenderBlock())
+	signed int blockSamples[2][32][SCSP_MAX_68K_BATCH];
+	int blockLength[2][32];	// samples rendered before the slot stopped
+	UINT32 blockSlots[2];	// slots rendered
+};
+
+static SCSP_CONTEXT scsp_default_context;
+static thread_local SCSP_CONTEXT *scsp_context = &scsp_default_context;
+
+#define SCSPs				(scsp_context->chips)
+#define SCSP				(scsp_context->chip)
+#define RBUFDST				(scsp_context->rbufdst)
+#define s_balance			(scsp_context->balance)
+#define s_multiThreaded		(scsp_context->multiThreaded)
+#define s_strictTiming		(scsp_context->strictTiming)
+#define s_blockRendering	(scsp_context->blockRendering)
+#define s_parallelChips		(scsp_context->parallelChips)
+#define legacySound			(scsp_context->legacySound)
+#define SoundClock			(scsp_context->soundClock)
+#define bufferfl			(scsp_context->bufferfl)
+#define bufferfr			(scsp_context->bufferfr)
+#define bufferrl			(scsp_context->bufferrl)
+#define bufferrr			(scsp_context->bufferrr)
+#define Run68kCB(cycles)	(scsp_context->run68kCB(scsp_context->cbData, cycles))
+#define Int68kCB(irq)		(scsp_context->int68kCB(scsp_context->cbData, irq))
+#define MIDILock			(scsp_context->midiLock)
+#define IrqTimA				(scsp_context->irqTimA)
+#define IrqTimBC			(scsp_context->irqTimBC)
+#define IrqMidi				(scsp_context->irqMidi)
+#define MCIEB				(scsp_context->mcieb)
+#define MCIPD				(scsp_context->mcipd)
+#define MidiOutStack		(scsp_context->midiOutStack)
+#define MidiOutW			(scsp_context->midiOutW)
+#define MidiOutR			(scsp_context->midiOutR)
+#define MidiStack			(scsp_context->midiStack)
+#define MidiOutFill			(scsp_context->midiOutFill)
+#define MidiInFill			(scsp_context->midiInFill)
+#define MidiW				(scsp_context->midiW)
+#define MidiR				(scsp_context->midiR)
+#define HasSlaveSCSP		(scsp_context->hasSlaveSCSP)
+#define TimPris				(scsp_context->timPris)
+#define TimCnt				(scsp_context->timCnt)
+#define lastdiff			(scsp_context->lastdiff)
+#define s_blockSamples		(scsp_context->blockSamples)
+#define s_blockLength		(scsp_context->blockLength)
+#define s_blockSlots		(scsp_context->blockSlots)
+
+SCSP_CONTEXT *SCSP_CreateContext(void)
+{
+	SCSP_CONTEXT *ctx = new(std::nothrow) SCSP_CONTEXT();
+	if (ctx != NULL)
+		ctx->chip = ctx->chips;
+	return ctx;
+}
+
+void SCSP_DestroyContext(SCSP_CONTEXT *ctx)
+{
+	if (ctx == NULL || ctx == &scsp_default_context)
+		return;
+	if (scsp_context == ctx)
+		scsp_context = &scsp_default_context;
+	delete ctx;
+}
+
+void SCSP_SetContext(SCSP_CONTEXT *ctx)
+{
+	scsp_context = (ctx == NULL) ? &scsp_default_context : ctx;
+}
+
+SCSP_CONTEXT *SCSP_GetContext(void)
+{
+	return scsp_context;
+}
 
 
 unsigned char DecodeSCI(unsigned char irq)
@@ -467,11 +566,13 @@ void Compute_EG(_SLOT *slot)
 	slot->EG.RR = Get_DR(rate, RR(slot));
 	slot->EG.DL = 0x1f - DL(slot);
 	slot->EG.EGHOLD = EGHOLD(slot);
+	slot->EG.samples = 0;
 }
 
 void SCSP_StopSlot(_SLOT *slot,int keyoff);
+void SCSP_DecodeSlotRegs(_SLOT *slot);
 
-int EG_Update(_SLOT *slot)
+static int EG_Advance(_SLOT *slot)
 {
 	switch (slot->EG.state)
 	{
@@ -479,7 +580,7 @@ int EG_Update(_SLOT *slot)
 		slot->EG.volume += slot->EG.AR;
 		if (slot->EG.volume >= (0x3ff << EG_SHIFT))
 		{
-			if (!LPSLNK(slot))
+			if (!slot->lpslnk)
 			{
 				slot->EG.state = DECAY1;
 				if (slot->EG.D1R >= (1024 << EG_SHIFT)) //Skip SCSP_DECAY1, go directly to SCSP_DECAY2
@@ -498,7 +599,7 @@ int EG_Update(_SLOT *slot)
 			slot->EG.state = DECAY2;
 		break;
 	case DECAY2:
-		if (D2R(slot) == 0)
+		if (slot->d2r == 0)
 			return (slot->EG.volume >> EG_SHIFT) << (SHIFT - 10);
 		slot->EG.volume -= slot->EG.D2R;
 		if (slot->EG.volume <= 0)
@@ -521,6 +622,75 @@ int EG_Update(_SLOT *slot)
 	return (slot->EG.volume >> EG_SHIFT) << (SHIFT - 10);
 }
 
+// Samples until the volume, rising or falling by rate each sample, first
+// reaches limit
+static int EG_SamplesUpTo(int volume, int rate, int limit)
+{
+	if (volume >= limit)
+		return 1;
+	return rate > 0 ? (limit - volume + rate - 1) / rate : INT_MAX;
+}
+
+static int EG_SamplesDownTo(int volume, int rate, int limit)
+{
+	if (volume <= limit)
+		return 1;
+	return rate > 0 ? (volume - limit + rate - 1) / rate : INT_MAX;
+}
+
+// Works out how many samples the current state runs for before EG_Advance()
+// could change it, so that the samples in between only need the step.
+static void EG_ComputeSegment(_SLOT *slot)
+{
+	switch (slot->EG.state)
+	{
+	case ATTACK:
+		slot->EG.delta = slot->EG.AR;
+		slot->EG.samples = EG_SamplesUpTo(slot->EG.volume, slot->EG.AR, 0x3ff << EG_SHIFT);
+		break;
+	case DECAY1:
+		// Level check passes once the volume drops below the next level up
+		slot->EG.delta = -slot->EG.D1R;
+		slot->EG.samples = EG_SamplesDownTo(slot->EG.volume, slot->EG.D1R, ((slot->EG.DL + 1) << (EG_SHIFT + 5)) - 1);
+		break;
+	case DECAY2:
+		// Held where it is while D2R is 0
+		slot->EG.delta = slot->d2r ? -slot->EG.D2R : 0;
+		slot->EG.samples = slot->d2r ? EG_SamplesDownTo(slot->EG.volume, slot->EG.D2R, 0) : INT_MAX;
+		break;
+	case RELEASE:
+		slot->EG.delta = -slot->EG.RR;
+		slot->EG.samples = EG_SamplesDownTo(slot->EG.volume, slot->EG.RR, 0);
+		break;
+	default:
+		slot->EG.delta = 0;
+		slot->EG.samples = 1;
+		break;
+	}
+}
+
+/*
+ * Within a state, the volume moves by a fixed step each sample and the only
+ * decision is when the next state is reached, which is known in advance. The
+ * envelope is therefore run as segments: a count of samples that just take
+ * the step, and a full update on the last one, where the state may change.
+ * Anything else changing the state or rates sets the count to 0, so that the
+ * next sample takes the full update and the segment is worked out again.
+ */
+int EG_Update(_SLOT *slot)
+{
+	if (--slot->EG.samples > 0)
+	{
+		slot->EG.volume += slot->EG.delta;
+		if (slot->EG.state == ATTACK && slot->EG.EGHOLD)
+			return 0x3ff << (SHIFT - 10);
+		return (slot->EG.volume >> EG_SHIFT) << (SHIFT - 10);
+	}
+	int value = EG_Advance(slot);
+	EG_ComputeSegment(slot);
+	return value;
+}
+
 
 DWORD SCSP_Step(_SLOT *slot)
 {
@@ -557,11 +727,30 @@ void Compute_LFO(_SLOT *slot)
 }
 
 
+// The SCSP a slot belongs to (slots are started and stopped while SCSP points
+// at either one)
+static inline _SCSP *SCSP_SlotChip(_SLOT *slot)
+{
+	return (slot >= SCSPs[1].Slots && slot < SCSPs[1].Slots + 32) ? SCSPs + 1 : SCSPs + 0;
+}
+
+static void SCSP_UpdateActiveSlots(_SCSP *chip)
+{
+	chip->ActiveSlots = 0;
+	for (int i = 0; i < 32; ++i)
+	{
+		if (chip->Slots[i].active)
+			chip->ActiveSlots |= 1u << i;
+	}
+}
+
 void SCSP_StartSlot(_SLOT *slot)
 {
 	UINT32 start_offset;
+	_SCSP *chip = SCSP_SlotChip(slot);
 
 	slot->active = 1;
+	chip->ActiveSlots |= 1u << (slot - chip->Slots);
 	slot->Back = 0;
 	slot->nxt_addr = 1 << SHIFT;
 	slot->cur_addr = 0;
@@ -571,6 +760,7 @@ void SCSP_StartSlot(_SLOT *slot)
 	Compute_EG(slot);
 	slot->EG.state = ATTACK;
 	slot->EG.volume = 0x17F << EG_SHIFT;
+	slot->EG.samples = 0;
 	slot->Prev = 0;
 	Compute_LFO(slot);
 	/*{
@@ -591,49 +781,27 @@ void SCSP_StopSlot(_SLOT *slot,int keyoff)
 	if(keyoff)
 	{
 		slot->EG.state=RELEASE;
+		slot->EG.samples = 0;
 //		return;
 	}
 	else
+	{
+		_SCSP *chip = SCSP_SlotChip(slot);
 		slot->active=0;
+		chip->ActiveSlots &= ~(1u << (slot - chip->Slots));
+	}
 	slot->data[0]&=~0x800;
 	//DebugLog("KEYOFF2 %d",slot->slot);
 }
 
 //#define log2(n) (log((float) n)/log((float) 2))
 
-bool SCSP_Init(const Util::Config::Node &config, int n)
+/*
+ * Builds the tables shared by all contexts. They are the same for all of them,
+ * so they are only built by the first SCSP_Init().
+ */
+static void SCSP_InitTables(void)
 {
-	s_config = &config;
-	s_multiThreaded = config["MultiThreaded"].ValueAs<bool>();
-	legacySound = config["LegacySoundDSP"].ValueAs<bool>();
-	SoundClock = Freq;
-
-	if(n==2)
-	{
-		SCSP=SCSPs+1;
-		memset(SCSP,0,sizeof(_SCSP));
-		SCSP->Master=0;
-		HasSlaveSCSP=1;
-#ifdef USEDSP
-		SCSPDSP_Init(&SCSP->DSP);
-#endif
-
-	}
-	SCSP=SCSPs+0;
-	memset(SCSP,0,sizeof(_SCSP));
-#ifdef USEDSP
-	SCSPDSP_Init(&SCSP->DSP);
-#endif
-	SCSP->Master=1;
-	SCSP->SCSPRAM_LENGTH = 512 * 1024;
-	SCSP->DSP.SCSPRAM = (UINT16 *)SCSP->SCSPRAM;
-	SCSP->DSP.SCSPRAM_LENGTH = (512 * 1024) / 2;
-	MidiR=MidiW=0;
-	MidiOutR=MidiOutW=0;
-	MidiOutFill=0;
-	MidiInFill=0;
-	
-
 	for(int i=0;i<0x400;++i)
 	{
 		double fcent=(double) 1200.0*log2((double)(((double) 1024.0+(double)i)/(double)1024.0));
@@ -749,17 +917,62 @@ bool SCSP_Init(const Util::Config::Node &config, int n)
 		scale=(double) (1<<EG_SHIFT);
 		DRTABLE[i]=(int) (step*scale);
 	}
+
+	LFO_Init();
+}
+
+bool SCSP_Init(const Util::Config::Node &config, int n)
+{
+	s_balance = Util::Config::CachedValue<float>(config, "Balance");
+	s_multiThreaded = config["MultiThreaded"].ValueAs<bool>();
+	legacySound = config["LegacySoundDSP"].ValueAs<bool>();
+	s_strictTiming = config["StrictSCSPTiming"].ValueAs<bool>();
+	s_blockRendering = config["BlockSCSPRendering"].ValueAs<bool>();
+	s_parallelChips = config["ParallelSound"].ValueAsDefault<bool>(false);
+	SoundClock = Freq;
+
+	if(n==2)
+	{
+		SCSP=SCSPs+1;
+		memset(SCSP,0,sizeof(_SCSP));
+		SCSP->Master=0;
+		HasSlaveSCSP=1;
+#ifdef USEDSP
+		SCSPDSP_Init(&SCSP->DSP);
+#endif
+
+	}
+	SCSP=SCSPs+0;
+	memset(SCSP,0,sizeof(_SCSP));
+#ifdef USEDSP
+	SCSPDSP_Init(&SCSP->DSP);
+#endif
+	SCSP->Master=1;
+	SCSP->SCSPRAM_LENGTH = 512 * 1024;
+	SCSP->DSP.SCSPRAM = (UINT16 *)SCSP->SCSPRAM;
+	SCSP->DSP.SCSPRAM_LENGTH = (512 * 1024) / 2;
+	MidiR=MidiW=0;
+	MidiOutR=MidiOutW=0;
+	MidiOutFill=0;
+	MidiInFill=0;
+	
+
+	static std::once_flag tablesBuilt;
+	std::call_once(tablesBuilt, SCSP_InitTables);
 	
 	for(int i=0;i<32;++i)
 		SCSPs[0].Slots[i].slot=i;
+	for(int i=0;i<MAX_SCSP;++i)
+	{
+		for(int j=0;j<32;++j)
+			SCSP_DecodeSlotRegs(SCSPs[i].Slots+j);
+	}
 
 #ifdef USEDSP
 	//allocate 0x300 (over 1 frame) * 32 slots * 16 bit
 	SCSP->MIXBuf=(signed short *) malloc(0x300*32*sizeof(signed short));
 #endif
 
-	LFO_Init();
-
 	SCSPs->data[0x20 / 2] = 0;
 	TimCnt[0] = 0xffff;
 	TimCnt[1] = 0xffff;
@@ -783,6 +996,33 @@ void SCSP_SetRAM(int n,unsigned char *r)
 #endif
 }
 
+void SCSP_DecodeSlotRegs(_SLOT *slot)
+{
+	slot->ssctl = SSCTL(slot);
+	slot->sbctl = SBCTL(slot);
+	slot->lpctl = LPCTL(slot);
+	slot->pcm8b = PCM8B(slot) != 0;
+	slot->lpslnk = LPSLNK(slot) != 0;
+	slot->sdir = SDIR(slot) != 0;
+	slot->stwinh = STWINH(slot) != 0;
+	slot->d2r = D2R(slot);
+	slot->EG.samples = 0;	// rates or d2r may have changed
+	slot->mdl = MDL(slot);
+	slot->mdxsl = MDXSL(slot);
+	slot->mdysl = MDYSL(slot);
+	slot->plfos = PLFOS(slot);
+	slot->alfos = ALFOS(slot);
+	slot->isel = ISEL(slot);
+	slot->imxl = IMXL(slot);
+	slot->lsa = LSA(slot);
+	slot->lea = LEA(slot);
+	slot->dspGain = LPANTABLE[((TL(slot)) << 0x0) | ((IMXL(slot)) << 0xd)];
+	UINT16 Enc = ((TL(slot)) << 0x0) | ((DIPAN(slot)) << 0x8) | ((DISDL(slot)) << 0xd);
+	slot->leftGain = LPANTABLE[Enc];
+	slot->rightGain = RPANTABLE[Enc];
+	slot->ringGain = LPANTABLE[((SDIR(slot) ? 0 : TL(slot)) << 0x0) | (0x7 << 0xd)];
+}
+
 void SCSP_UpdateSlotReg(int s,int r)
 {
 	struct _SLOT *slot = SCSP->Slots + s;
@@ -824,6 +1064,7 @@ void SCSP_UpdateSlotReg(int s,int r)
 		Compute_LFO(slot);
 		break;
 	}
+	SCSP_DecodeSlotRegs(slot);
 }
 
 void SCSP_UpdateReg(int reg)
@@ -1034,6 +1275,9 @@ void SCSP_w8(unsigned int addr,unsigned char val)
 		SCSP->RINGBUF[(addr-0x600)/2]=val;
 	else
 	{
+#ifdef USEDSP
+		SCSP->DSP.Decoded = false;
+#endif
 		if (legacySound == true) {
 #ifdef USEDSP
 			//DSP
@@ -1101,6 +1345,9 @@ void SCSP_w16(unsigned int addr,unsigned short val)
 		SCSP->RINGBUF[(addr - 0x600) / 2] = val;
 	else
 	{
+#ifdef USEDSP
+		SCSP->DSP.Decoded = false;
+#endif
 		if (legacySound == true) {
 #ifdef USEDSP
 			// ElSemi's legacy DSP. For now we will need this for Fighting Vipers 2.
@@ -1169,6 +1416,7 @@ void SCSP_w32(unsigned int addr,unsigned int val)
 	{
 #ifdef USEDSP
 		//DSP
+		SCSP->DSP.Decoded = false;
 		rotl(val, 16);
 			if(addr<0x780)	//COEF
 				*(unsigned int *) &(SCSP->DSP.COEF[(addr-0x700)/2])=val;
@@ -1326,7 +1574,8 @@ void SCSP_TimersAddTicks(int ticks)
 }
 
 
-signed int inline SCSP_UpdateSlot(_SLOT *slot)
+// Updates a slot by one sample, writing its ring buffer entry to ringDst
+signed int inline SCSP_UpdateSlot(_SLOT *slot, signed short *ringDst)
 {
 	signed int sample;
 	int step = slot->step;
@@ -1335,16 +1584,16 @@ signed int inline SCSP_UpdateSlot(_SLOT *slot)
 	DWORD *slot_addr[2] = { &(slot->cur_addr), &(slot->nxt_addr) };
 
 
-	if (SSCTL(slot) != 0)
+	if (slot->ssctl != 0)
 		return 0;
 
-	if (PLFOS(slot) != 0)
+	if (slot->plfos != 0)
 	{
 		step = step * PLFO_Step(&(slot->PLFO));
 		step >>= (SHIFT);
 	}
 
-	if (PCM8B(slot)) {
+	if (slot->pcm8b) {
 		addr1 = slot->cur_addr >> SHIFT;
 		addr2 = slot->nxt_addr >> SHIFT;
 	}
@@ -1354,15 +1603,15 @@ signed int inline SCSP_UpdateSlot(_SLOT *slot)
 		addr2 = (slot->nxt_addr >> (SHIFT - 1)) & 0x7fffe;
 	}
 
-	if (MDL(slot) != 0 || MDXSL(slot) != 0 || MDYSL(slot) != 0)
+	if (slot->mdl != 0 || slot->mdxsl != 0 || slot->mdysl != 0)
 	{
-		signed int smp = (SCSPs->RINGBUF[(SCSPs->BUFPTR + MDXSL(slot)) & 63] + SCSPs->RINGBUF[(SCSPs->BUFPTR + MDYSL(slot)) & 63]) / 2;
+		signed int smp = (SCSPs->RINGBUF[(SCSPs->BUFPTR + slot->mdxsl) & 63] + SCSPs->RINGBUF[(SCSPs->BUFPTR + slot->mdysl) & 63]) / 2;
 		smp <<= 0xA; // associate cycle with 1024
 		// Here down below, a sample range of 24 is needed for VF3 to sound correct.
-		smp >>= 0x18 - MDL(slot); // ex. for MDL=0xF, sample range corresponds to +/- 64 pi (32=2^5 cycles) so shift by 11 (16-5 == 0x1A-0xF)
-		if (!PCM8B(slot)) smp <<= 1;
+		smp >>= 0x18 - slot->mdl; // ex. for MDL=0xF, sample range corresponds to +/- 64 pi (32=2^5 cycles) so shift by 11 (16-5 == 0x1A-0xF)
+		if (!slot->pcm8b) smp <<= 1;
 		addr1 += smp; addr2 += smp;
-		if (!PCM8B(slot))
+		if (!slot->pcm8b)
 		{
 			addr1 &= 0x7fffe; addr2 &= 0x7fffe;
 		}
@@ -1371,8 +1620,8 @@ signed int inline SCSP_UpdateSlot(_SLOT *slot)
 			addr1 &= 0x7ffff; addr2 &= 0x7ffff;
 		}
 	}
-	//if (SSCTL(slot) == 0) {
-		if (PCM8B(slot))	//8 bit signed
+	//if (slot->ssctl == 0) {
+		if (slot->pcm8b)	//8 bit signed
 		{
 			signed char p1 = *(signed char *) &(slot->base[addr1 ^ 1]);
 			signed char p2 = *(signed char *) &(slot->base[addr2 ^ 1]);
@@ -1396,17 +1645,17 @@ signed int inline SCSP_UpdateSlot(_SLOT *slot)
 			//s=(int) p[0]*((1<<SHIFT)-fpart)+(int) p[1]*fpart;
 			//sample=s>>SHIFT;
 
-			/*		if(SBCTL(slot)&1)	//reverse data
+			/*		if(slot->sbctl&1)	//reverse data
 			sample^=0x7fff;
-			if(SBCTL(slot)&2)	//reverse sign
+			if(slot->sbctl&2)	//reverse sign
 			sample^=0x8000;
 			*/
 		}
 	//}
 
-	if (SBCTL(slot) & 0x1)
+	if (slot->sbctl & 0x1)
 		sample ^= 0x7FFF;
-	if (SBCTL(slot) & 0x2)
+	if (slot->sbctl & 0x2)
 		sample = (INT16)(sample ^ 0x8000);
 
 	if (slot->Back)
@@ -1418,65 +1667,68 @@ signed int inline SCSP_UpdateSlot(_SLOT *slot)
 	addr1 = slot->cur_addr >> SHIFT;
 	addr2 = slot->nxt_addr >> SHIFT;
 
-	if (addr1 >= LSA(slot) && !(slot->Back))
+	if (addr1 >= slot->lsa && !(slot->Back))
 	{
-		if (LPSLNK(slot) && slot->EG.state == ATTACK)
+		if (slot->lpslnk && slot->EG.state == ATTACK)
+		{
 			slot->EG.state = DECAY1;
+			slot->EG.samples = 0;
+		}
 	}
 
 
 	for (addr_select = 0; addr_select < 2; addr_select++)
 	{
 		INT32 rem_addr;
-		switch (LPCTL(slot))
+		switch (slot->lpctl)
 		{
 		case 0: //no loop
-			if (*addr[addr_select] >= LSA(slot) && *addr[addr_select] >= LEA(slot))
+			if (*addr[addr_select] >= slot->lsa && *addr[addr_select] >= slot->lea)
 			{
 				//slot->active=0;
 				SCSP_StopSlot(slot, 0);
 			}
 			break;
 		case 1: //normal loop
-			if (*addr[addr_select] >= LEA(slot))
+			if (*addr[addr_select] >= slot->lea)
 			{
-				rem_addr = *slot_addr[addr_select] - (LEA(slot) << SHIFT);
-				*slot_addr[addr_select] = (LSA(slot) << SHIFT) + rem_addr;
+				rem_addr = *slot_addr[addr_select] - (slot->lea << SHIFT);
+				*slot_addr[addr_select] = (slot->lsa << SHIFT) + rem_addr;
 			}
 			break;
 		case 2: //reverse loop
-			if ((*addr[addr_select] >= LSA(slot)) && !(slot->Back))
+			if ((*addr[addr_select] >= slot->lsa) && !(slot->Back))
 			{
-				rem_addr = *slot_addr[addr_select] - (LSA(slot) << SHIFT);
-				*slot_addr[addr_select] = (LEA(slot) << SHIFT) - rem_addr;
+				rem_addr = *slot_addr[addr_select] - (slot->lsa << SHIFT);
+				*slot_addr[addr_select] = (slot->lea << SHIFT) - rem_addr;
 				slot->Back = 1;
 			}
-			else if ((*addr[addr_select] < LSA(slot) || (*slot_addr[addr_select] & 0x80000000)) && slot->Back)
+			else if ((*addr[addr_select] < slot->lsa || (*slot_addr[addr_select] & 0x80000000)) && slot->Back)
 			{
-				rem_addr = (LSA(slot) << SHIFT) - *slot_addr[addr_select];
-				*slot_addr[addr_select] = (LEA(slot) << SHIFT) - rem_addr;
+				rem_addr = (slot->lsa << SHIFT) - *slot_addr[addr_select];
+				*slot_addr[addr_select] = (slot->lea << SHIFT) - rem_addr;
 			}
 			break;
 		case 3: //ping-pong
-			if (*addr[addr_select] >= LEA(slot)) //reached end, reverse till start
+			if (*addr[addr_select] >= slot->lea) //reached end, reverse till start
 			{
-				rem_addr = *slot_addr[addr_select] - (LEA(slot) << SHIFT);
-				*slot_addr[addr_select] = (LEA(slot) << SHIFT) - rem_addr;
+				rem_addr = *slot_addr[addr_select] - (slot->lea << SHIFT);
+				*slot_addr[addr_select] = (slot->lea << SHIFT) - rem_addr;
 				slot->Back = 1;
 			}
-			else if ((*addr[addr_select] < LSA(slot) || (*slot_addr[addr_select] & 0x80000000)) && slot->Back)//reached start or negative
+			else if ((*addr[addr_select] < slot->lsa || (*slot_addr[addr_select] & 0x80000000)) && slot->Back)//reached start or negative
 			{
-				rem_addr = (LSA(slot) << SHIFT) - *slot_addr[addr_select];
-				*slot_addr[addr_select] = (LSA(slot) << SHIFT) + rem_addr;
+				rem_addr = (slot->lsa << SHIFT) - *slot_addr[addr_select];
+				*slot_addr[addr_select] = (slot->lsa << SHIFT) + rem_addr;
 				slot->Back = 0;
 			}
 			break;
 		}
 	}
 
-	if (!SDIR(slot))
+	if (!slot->sdir)
 	{
-		if (ALFOS(slot) != 0) 
+		if (slot->alfos != 0) 
 		{
 			sample = sample * ALFO_Step(&(slot->ALFO));
 			sample >>= (SHIFT);
@@ -1490,34 +1742,167 @@ signed int inline SCSP_UpdateSlot(_SLOT *slot)
 			sample = (sample * EG_TABLE[EG_Update(slot) >> (SHIFT - 10)]) >> SHIFT;
 	}
 
-	if (!STWINH(slot))
+	if (!slot->stwinh)
+		*ringDst = (sample * slot->ringGain) >> (SHIFT + 1);
+
+
+	return sample;
+}
+
+
+void SCSP_CpuRunScanline()
+{
+
+}
+
+/*
+ * Number of samples to generate before the 68K must run again. Normally the
+ * 68K runs after every sample, but while no interrupt is pending and no MIDI
+ * input is waiting, nothing can happen within the next few samples that the
+ * 68K would have to react to until the first enabled timer expires, so it is
+ * run in one larger batch instead. Register writes by the 68K then take effect
+ * up to SCSP_MAX_68K_BATCH samples late, which is inaudible.
+ *
+ * The timers are advanced for the whole batch once it is over, rather than
+ * sample by sample. Their counters and the interrupts pending can only be
+ * seen by the 68K, which runs at the end of each batch, so this is exact.
+ */
+static int SCSP_68KBatchSize(int remaining)
+{
+	if (s_strictTiming || MidiW != MidiR)
+		return 1;
+
+	DWORD en = SCSPs->data[0x1e / 2];
+	if (SCSPs->data[0x20 / 2] & en)
+		return 1;	// interrupt pending
+
+	int batch = std::min(remaining, SCSP_MAX_68K_BATCH);
+	static const DWORD timerEnable[3] = { 0x40, 0x80, 0x100 };
+	for (int i = 0; i < 3; i++)
+	{
+		if (!(en & timerEnable[i]) || TimCnt[i] > 0xff00)
+			continue;
+		int inc = 1 << (8 - ((SCSPs->data[(0x18 + 2 * i) / 2] >> 8) & 0x7));
+		int samples = (0xff00 - TimCnt[i]) / inc + 1;	// sample on which timer expires
+		batch = std::min(batch, samples);
+	}
+	return batch;
+}
+
+static inline unsigned SCSP_LowestSlot(UINT32 mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return unsigned(index);
+#else
+	return unsigned(__builtin_ctz(mask));
+#endif
+}
+
+// Adds a slot's output sample to the DSP input and the direct output
+static inline void SCSP_MixSample(_SCSP *chip, _SLOT *slot, signed int sample, signed int &left, signed int &right)
+{
+	SCSPDSP_SetSample(&chip->DSP, (sample*slot->dspGain) >> (SHIFT - 2), slot->isel, slot->imxl);
+#ifdef RB_VOLUME
+	left += (sample * volume[TL(slot) + pan_left[DIPAN(slot)]]) >> 17;
+	right += (sample * volume[TL(slot) + pan_right[DIPAN(slot)]]) >> 17;
+#else
+	left += (sample*slot->leftGain) >> SHIFT;
+	right += (sample*slot->rightGain) >> SHIFT;
+#endif
+}
+
+// Updates an active slot and mixes its output. RBUFDST must point at the
+// slot's ring buffer entry.
+static inline void SCSP_MixSlot(_SCSP *chip, _SLOT *slot, float balance, signed int &left, signed int &right)
+{
+	SCSP_MixSample(chip, slot, (int)(balance*(float)SCSP_UpdateSlot(slot, RBUFDST)), left, right);
+}
+
+/*
+ * Block rendering: no register can change between two runs of the 68K, so
+ * each active slot can be run for the whole batch of samples in one go, its
+ * outputs being mixed sample by sample afterwards. Slots only affect each
+ * other through the ring buffer, which FM slots read from as the other slots
+ * write it, so blocks are only rendered while no active slot uses FM. The
+ * one difference to rendering sample by sample is that a slot playing back
+ * DSP work memory sees the DSP's writes up to a batch late.
+ */
+static void SCSP_RenderBlockChip(int i, int length, float balance)
+{
+	_SCSP *chip = SCSPs + i;
+	s_blockSlots[i] = chip->ActiveSlots;
+	for (UINT32 pending = s_blockSlots[i]; pending != 0; pending &= pending - 1)
 	{
-		if (!SDIR(slot))
+		unsigned sl = SCSP_LowestSlot(pending);
+		_SLOT *slot = chip->Slots + sl;
+		signed int *samples = s_blockSamples[i][sl];
+		int n = 0;
+		while (n < length && slot->active)
 		{
-			UINT16 Enc = ((TL(slot)) << 0x0) | (0x7 << 0xd);
-			*RBUFDST = (sample * LPANTABLE[Enc]) >> (SHIFT + 1);
+			signed short *ringDst = chip->RINGBUF + ((chip->BUFPTR + 32 * n + sl) & 63);
+			samples[n++] = (int)(balance*(float)SCSP_UpdateSlot(slot, ringDst));
 		}
-		else
+		s_blockLength[i][sl] = n;
+	}
+}
+
+static bool SCSP_RenderBlock(int length, float masterBalance, float slaveBalance)
+{
+	if (!HasSlaveSCSP && SCSPs[1].ActiveSlots)
+		return false;	// would share the master's ring buffer
+	for (int i = 0; i < 2; ++i)
+	{
+		for (UINT32 pending = SCSPs[i].ActiveSlots; pending != 0; pending &= pending - 1)
 		{
-			UINT16 Enc = (0 << 0x0) | (0x7 << 0xd);
-			*RBUFDST = (sample * LPANTABLE[Enc]) >> (SHIFT + 1);
+			const _SLOT *slot = SCSPs[i].Slots + SCSP_LowestSlot(pending);
+			if (slot->mdl != 0 || slot->mdxsl != 0 || slot->mdysl != 0)
+				return false;
 		}
 	}
 
-
-	return sample;
+	/*
+	 * With a slave SCSP the chips have separate ring buffers, so nothing one
+	 * renders is seen by the other and, when both are playing, the slave's
+	 * slots are rendered on the job pool alongside the master's. The job sets
+	 * this context on whichever thread runs it.
+	 */
+	if (s_parallelChips && HasSlaveSCSP && SCSPs[0].ActiveSlots && SCSPs[1].ActiveSlots)
+	{
+		SCSP_CONTEXT *ctx = scsp_context;
+		CThread::GetJobPool()->Run("SCSP", 2, [ctx, length, masterBalance, slaveBalance](unsigned i)
+		{
+			SCSP_CONTEXT *prev = scsp_context;
+			scsp_context = ctx;
+			SCSP_RenderBlockChip(i, length, i ? slaveBalance : masterBalance);
+			scsp_context = prev;
+		});
+	}
+	else
+	{
+		SCSP_RenderBlockChip(0, length, masterBalance);
+		SCSP_RenderBlockChip(1, length, slaveBalance);
+	}
+	return true;
 }
 
-
-void SCSP_CpuRunScanline()
+// Mixes sample n of the slots rendered by SCSP_RenderBlock()
+static inline void SCSP_MixBlockSample(int i, int n, signed int &left, signed int &right)
 {
-
+	for (UINT32 pending = s_blockSlots[i]; pending != 0; pending &= pending - 1)
+	{
+		unsigned sl = SCSP_LowestSlot(pending);
+		if (n < s_blockLength[i][sl])
+			SCSP_MixSample(SCSPs + i, SCSPs[i].Slots + sl, s_blockSamples[i][sl][n], left, right);
+	}
 }
 
 void SCSP_DoMasterSamples(int nsamples)
 {
 	int slice = (int)(12000000. / (SoundClock*nsamples));	// 68K cycles/sample
-	static int lastdiff = 0;
+	int batch = SCSP_68KBatchSize(nsamples);
+	int batchLeft = batch;
 
 	/*
 	 * Compute relative master/slave SCSP balance (note: master is often used
@@ -1525,7 +1910,7 @@ void SCSP_DoMasterSamples(int nsamples)
 	 * When one SCSP is fully attenuated, the other's samples will be multiplied
 	 * by 2.
 	 */
-	float balance = std::max(-100.f,std::min(100.f,s_config->Get("Balance").ValueAs<float>()));
+	float balance = std::max(-100.f,std::min(100.f,s_balance.Get()));
 	balance *= 0.01f;
 	float masterBalance = 1.0f + balance;
 	float slaveBalance = 1.0f - balance;
@@ -1534,6 +1919,7 @@ void SCSP_DoMasterSamples(int nsamples)
 	float* buffr = bufferfr;
 	float* bufrl = bufferrl;
 	float* bufrr = bufferrr;
+	int blockPos = -1;	// sample within the block rendered for this batch, if any
 
 	/*
 	 * Generate samples
@@ -1543,81 +1929,78 @@ void SCSP_DoMasterSamples(int nsamples)
 		signed int smpfl = 0, smpfr = 0;
 		signed int smprl = 0, smprr = 0;
 
+#if FM_DELAY
+		// The delay buffer is advanced for every slot, so all are visited
 		for (INT32 sl = 0; sl < 32; ++sl)
 		{
-#if FM_DELAY
 			RBUFDST = SCSPs[0].DELAYBUF + SCSPs[0].DELAYPTR;
-#else
-			RBUFDST = SCSPs[0].RINGBUF + SCSPs[0].BUFPTR;
-#endif
 			if (SCSPs[0].Slots[sl].active)
-			{
-				_SLOT *slot = SCSPs[0].Slots + sl;
-				UINT16 Enc;
-
-				signed int sample = (int)(masterBalance*(float)SCSP_UpdateSlot(slot));
-
-				Enc = ((TL(slot)) << 0x0) | ((IMXL(slot)) << 0xd);
-				SCSPDSP_SetSample(&SCSPs[0].DSP, (sample*LPANTABLE[Enc]) >> (SHIFT - 2), ISEL(slot), IMXL(slot));
-				Enc = ((TL(slot)) << 0x0) | ((DIPAN(slot)) << 0x8) | ((DISDL(slot)) << 0xd);
-#ifdef RB_VOLUME
-				smpfl += (sample * volume[TL(slot) + pan_left[DIPAN(slot)]]) >> 17;
-				smpfr += (sample * volume[TL(slot) + pan_right[DIPAN(slot)]]) >> 17;
-#else				
-				{
-					smpfl += (sample*LPANTABLE[Enc]) >> SHIFT;
-					smpfr += (sample*RPANTABLE[Enc]) >> SHIFT;
-				}
-#endif
-			}
-#if FM_DELAY
+				SCSP_MixSlot(&SCSPs[0], SCSPs[0].Slots + sl, masterBalance, smpfl, smpfr);
 			SCSPs[0].RINGBUF[(SCSPs[0].BUFPTR + 64 - (FM_DELAY - 1)) & 63] = SCSPs[0].DELAYBUF[(SCSPs[0].DELAYPTR + FM_DELAY - (FM_DELAY - 1)) % FM_DELAY];
-#endif
 			++SCSPs[0].BUFPTR;
 			SCSPs[0].BUFPTR &= 63;
-#if FM_DELAY
 			++SCSPs[0].DELAYPTR;
 			if (SCSPs[0].DELAYPTR > FM_DELAY - 1) SCSPs[0].DELAYPTR = 0;
-#endif
 			if (HasSlaveSCSP)
-#if FM_DELAY
 				RBUFDST = SCSPs[1].DELAYBUF + SCSPs[1].DELAYPTR;
-#else
-				RBUFDST = SCSPs[1].RINGBUF + SCSPs[1].BUFPTR;
-#endif
 			{
 				if (SCSPs[1].Slots[sl].active)
-				{
-					_SLOT *slot = SCSPs[1].Slots + sl;
-					UINT16 Enc;
-
-					signed int sample = (int)(slaveBalance*(float)SCSP_UpdateSlot(slot));
-
-					Enc = ((TL(slot)) << 0x0) | ((IMXL(slot)) << 0xd);
-					SCSPDSP_SetSample(&SCSPs[1].DSP, (sample*LPANTABLE[Enc]) >> (SHIFT - 2), ISEL(slot), IMXL(slot));
-					Enc = ((TL(slot)) << 0x0) | ((DIPAN(slot)) << 0x8) | ((DISDL(slot)) << 0xd);
-					{
-#ifdef RB_VOLUME
-						smprl += (sample * volume[TL(slot) + pan_left[DIPAN(slot)]]) >> 17;
-						smprr += (sample * volume[TL(slot) + pan_right[DIPAN(slot)]]) >> 17;
-#else				
-						smprl += (sample*LPANTABLE[Enc]) >> SHIFT;
-						smprr += (sample*RPANTABLE[Enc]) >> SHIFT;
-					}
-#endif
-				}
-#if FM_DELAY
+					SCSP_MixSlot(&SCSPs[1], SCSPs[1].Slots + sl, slaveBalance, smprl, smprr);
 				SCSPs[1].RINGBUF[(SCSPs[1].BUFPTR + 64 - (FM_DELAY - 1)) & 63] = SCSPs[1].DELAYBUF[(SCSPs[1].DELAYPTR + FM_DELAY - (FM_DELAY - 1)) % FM_DELAY];
-#endif
 				++SCSPs[1].BUFPTR;
 				SCSPs[1].BUFPTR &= 63;
-#if FM_DELAY
 				++SCSPs[1].DELAYPTR;
 				if (SCSPs[1].DELAYPTR > FM_DELAY - 1) SCSPs[1].DELAYPTR = 0;
-#endif
 			}
+		}
+#else
+		if (s_blockRendering && batchLeft == batch)
+			blockPos = SCSP_RenderBlock(batch, masterBalance, slaveBalance) ? 0 : -1;
 
-	}
+		if (blockPos >= 0)
+		{
+			SCSP_MixBlockSample(0, blockPos, smpfl, smpfr);
+			SCSP_MixBlockSample(1, blockPos, smprl, smprr);
+			++blockPos;
+			SCSPs[0].BUFPTR = (SCSPs[0].BUFPTR + 32) & 63;
+			SCSPs[1].BUFPTR = (SCSPs[1].BUFPTR + 32) & 63;
+		}
+		else
+		{
+			/*
+			 * Only active slots are visited, in slot order and alternating between
+			 * the two SCSPs as if all were. Each slot writes its ring buffer entry
+			 * at the buffer pointer, which advances by one per slot whether active
+			 * or not, and FM reads the master's ring buffer relative to its
+			 * pointer (which has already moved past the slot when a slave slot is
+			 * updated), so the pointers are set for each slot as they would have
+			 * been.
+			 */
+			unsigned base0 = SCSPs[0].BUFPTR;
+			unsigned base1 = SCSPs[1].BUFPTR;
+			UINT32 active0 = SCSPs[0].ActiveSlots;
+			UINT32 active1 = SCSPs[1].ActiveSlots;
+			for (UINT32 pending = active0 | active1; pending != 0; pending &= pending - 1)
+			{
+				unsigned sl = SCSP_LowestSlot(pending);
+				if (active0 & (1u << sl))
+				{
+					SCSPs[0].BUFPTR = (base0 + sl) & 63;
+					RBUFDST = SCSPs[0].RINGBUF + SCSPs[0].BUFPTR;
+					SCSP_MixSlot(&SCSPs[0], SCSPs[0].Slots + sl, masterBalance, smpfl, smpfr);
+				}
+				if (active1 & (1u << sl))
+				{
+					SCSPs[0].BUFPTR = (base0 + sl + 1) & 63;
+					SCSPs[1].BUFPTR = (base1 + sl) & 63;
+					RBUFDST = (HasSlaveSCSP ? SCSPs[1].RINGBUF + SCSPs[1].BUFPTR : SCSPs[0].RINGBUF + ((base0 + sl) & 63));
+					SCSP_MixSlot(&SCSPs[1], SCSPs[1].Slots + sl, slaveBalance, smprl, smprr);
+				}
+			}
+			SCSPs[0].BUFPTR = (base0 + 32) & 63;
+			SCSPs[1].BUFPTR = (base1 + 32) & 63;
+		}
+#endif
 
 		SCSPDSP_Step(&SCSPs[0].DSP);
 		if (HasSlaveSCSP)
@@ -1719,21 +2102,26 @@ void SCSP_DoMasterSamples(int nsamples)
 			*bufrr++ = (float)smprr;
 		}
 
-		SCSP_TimersAddTicks(1);
+		if (--batchLeft > 0)
+			continue;
+		SCSP_TimersAddTicks(batch);	// enabled timers can only expire on the last sample of the batch
 		CheckPendingIRQ();
-		lastdiff = Run68kCB(slice - lastdiff);
+		lastdiff = Run68kCB(slice * batch - lastdiff);
+		batch = SCSP_68KBatchSize(nsamples - s - 1);
+		batchLeft = batch;
 	}
 }
 
 void SCSP_Update()
 {
-	SCSP_DoMasterSamples(length);
+	SCSP_DoMasterSamples(scsp_context->length);
 }
 
-void SCSP_SetCB(int (*Run68k)(int cycles),void (*Int68k)(int irq))
+void SCSP_SetCB(int (*Run68k)(void *data, int cycles), void (*Int68k)(void *data, int irq), void *data)
 {
-	Int68kCB=Int68k;
-	Run68kCB=Run68k;
+	scsp_context->int68kCB = Int68k;
+	scsp_context->run68kCB = Run68k;
+	scsp_context->cbData = data;
 }
 
 void SCSP_MidiIn(BYTE val)
@@ -2090,6 +2478,7 @@ void SCSP_LoadState(CBlockFile *StateFile)
 			StateFile->Read(&(SCSPs[i].Slots[j].EG.volume), sizeof(SCSPs[i].Slots[j].EG.volume));
 			StateFile->Read(&egState, sizeof(egState));
 			SCSPs[i].Slots[j].EG.state = (_STATE) egState;
+			SCSPs[i].Slots[j].EG.samples = 0;
 			StateFile->Read(&(SCSPs[i].Slots[j].EG.step), sizeof(SCSPs[i].Slots[j].EG.step));
 			StateFile->Read(&(SCSPs[i].Slots[j].EG.AR), sizeof(SCSPs[i].Slots[j].EG.AR));
 			StateFile->Read(&(SCSPs[i].Slots[j].EG.D1R), sizeof(SCSPs[i].Slots[j].EG.D1R));
@@ -2109,7 +2498,9 @@ void SCSP_LoadState(CBlockFile *StateFile)
 
 			// Recompute LFOs
 			Compute_LFO(&(SCSPs[i].Slots[j]));
+			SCSP_DecodeSlotRegs(&(SCSPs[i].Slots[j]));
 		}
+		SCSP_UpdateActiveSlots(&SCSPs[i]);
 		
 		// DSP
 		StateFile->Read(&(SCSPs[i].DSP.RBP), sizeof(SCSPs[i].DSP.RBP));
@@ -2125,6 +2516,7 @@ void SCSP_LoadState(CBlockFile *StateFile)
 		StateFile->Read(SCSPs[i].DSP.EFREG, sizeof(SCSPs[i].DSP.EFREG));
 		StateFile->Read(&(SCSPs[i].DSP.Stopped), sizeof(SCSPs[i].DSP.Stopped));
 		StateFile->Read(&(SCSPs[i].DSP.LastStep), sizeof(SCSPs[i].DSP.LastStep));
+		SCSPs[i].DSP.Decoded = false;
 	}
 }
 
@@ -2136,13 +2528,14 @@ void SCSP_SetBuffers(float *leftBufferPtr, float *rightBufferPtr, float* leftRea
 	bufferrl = leftRearBufferPtr;
 	bufferrr = rightRearBufferPtr;
 
-	length = bufferLength;
+	scsp_context->length = bufferLength;
 }
 
 void SCSP_Deinit(void)
 {
 #ifdef USEDSP
 	free(SCSP->MIXBuf);
+	SCSP->MIXBuf = NULL;
 #endif
 	delete MIDILock;
 	MIDILock = NULL;
@@ -32,6 +32,21 @@
 #include "Types.h"
 #include "Util/NewConfig.h"
 
+/*
+ * SCSP contexts:
+ *
+ * All state belonging to a pair of SCSPs is kept in a context, so that several
+ * sound boards can run in one process. Each thread runs whichever context it
+ * last selected with SCSP_SetContext(), initially a built-in default context.
+ * The functions below all act on the selected context.
+ */
+struct SCSP_CONTEXT;
+
+SCSP_CONTEXT *SCSP_CreateContext(void);	// returns NULL if out of memory
+void SCSP_DestroyContext(SCSP_CONTEXT *ctx);	// call SCSP_Deinit() on it first
+void SCSP_SetContext(SCSP_CONTEXT *ctx);	// NULL selects the default context
+SCSP_CONTEXT *SCSP_GetContext(void);
+
 void SCSP_w8(UINT32 addr,UINT8 val);
 void SCSP_w16(UINT32 addr,UINT16 val);
 void SCSP_w32(UINT32 addr,UINT32 val);
@@ -39,7 +54,7 @@ UINT8 SCSP_r8(UINT32 addr);
 UINT16 SCSP_r16(UINT32 addr);
 UINT32 SCSP_r32(UINT32 addr);
 
-void SCSP_SetCB(int (*Run68k)(int cycles),void (*Int68k)(int irq));
+void SCSP_SetCB(int (*Run68k)(void *data, int cycles), void (*Int68k)(void *data, int irq), void *data);
 void SCSP_Update();
 void SCSP_MidiIn(UINT8);
 void SCSP_MidiOutW(UINT8);
@@ -202,6 +202,102 @@ void SCSPDSP_Init(_SCSPDSP *DSP)
 	DSP->RBL = (8 * 1024); // Initial RBL is 0
 	DSP->Stopped = 1;
 }
+enum
+{
+	SCSPDSP_OP_TWT = 1 << 0,
+	SCSPDSP_OP_XSEL = 1 << 1,
+	SCSPDSP_OP_IWT = 1 << 2,
+	SCSPDSP_OP_IWT_INPUT = 1 << 3,	//IWT with IWA == IRA: MEMVAL is also the input
+	SCSPDSP_OP_TABLE = 1 << 4,
+	SCSPDSP_OP_MEM = 1 << 5,	//MRD or MWT on an odd step, the only ones allowed to access memory
+	SCSPDSP_OP_MRD = 1 << 6,
+	SCSPDSP_OP_MWT = 1 << 7,
+	SCSPDSP_OP_EWT = 1 << 8,
+	SCSPDSP_OP_ADRL = 1 << 9,
+	SCSPDSP_OP_FRCL = 1 << 10,
+	SCSPDSP_OP_YRL = 1 << 11,
+	SCSPDSP_OP_NEGB = 1 << 12,
+	SCSPDSP_OP_ZERO = 1 << 13,
+	SCSPDSP_OP_BSEL = 1 << 14,
+	SCSPDSP_OP_NOFL = 1 << 15,
+	SCSPDSP_OP_ADREB = 1 << 16,
+	SCSPDSP_OP_NXADR = 1 << 17
+};
+
+/*
+ * SCSPDSP_Decode(DSP):
+ *
+ * Decodes the bit fields of the program steps up to LastStep once, so that
+ * SCSPDSP_Step() does not have to for every step of every sample. Programs
+ * are normally loaded once and run unchanged.
+ */
+static void SCSPDSP_Decode(_SCSPDSP *DSP)
+{
+	DSP->NumOps = 0;
+	DSP->Halts = false;
+	for (int step = 0; step < DSP->LastStep; ++step)
+	{
+		const UINT16 *IPtr = DSP->MPRO + step * 4;
+		_SCSPDSP_OP *op = DSP->Ops + step;
+
+		UINT32 IRA = (IPtr[1] >> 6) & 0x3F;
+		UINT32 IWA = (IPtr[1] >> 0) & 0x1F;
+		// colmns97 hits this
+		if (IRA > 0x31)
+		{
+			DSP->Halts = true;
+			break;
+		}
+
+		UINT32 flags = 0;
+		if ((IPtr[0] >> 7) & 0x01) flags |= SCSPDSP_OP_TWT;
+		if ((IPtr[1] >> 15) & 0x01) flags |= SCSPDSP_OP_XSEL;
+		if ((IPtr[1] >> 5) & 0x01) flags |= SCSPDSP_OP_IWT | (IRA == IWA ? SCSPDSP_OP_IWT_INPUT : 0);
+		if ((IPtr[2] >> 15) & 0x01) flags |= SCSPDSP_OP_TABLE;
+		if ((IPtr[2] >> 14) & 0x01) flags |= SCSPDSP_OP_MWT;
+		if ((IPtr[2] >> 13) & 0x01) flags |= SCSPDSP_OP_MRD;
+		if ((IPtr[2] >> 12) & 0x01) flags |= SCSPDSP_OP_EWT;
+		if ((IPtr[2] >> 7) & 0x01) flags |= SCSPDSP_OP_ADRL;
+		if ((IPtr[2] >> 6) & 0x01) flags |= SCSPDSP_OP_FRCL;
+		if ((IPtr[2] >> 3) & 0x01) flags |= SCSPDSP_OP_YRL;
+		if ((IPtr[2] >> 2) & 0x01) flags |= SCSPDSP_OP_NEGB;
+		if ((IPtr[2] >> 1) & 0x01) flags |= SCSPDSP_OP_ZERO;
+		if ((IPtr[2] >> 0) & 0x01) flags |= SCSPDSP_OP_BSEL;
+		if ((IPtr[3] >> 15) & 0x01) flags |= SCSPDSP_OP_NOFL;	//????
+		if ((IPtr[3] >> 1) & 0x01) flags |= SCSPDSP_OP_ADREB;
+		if ((IPtr[3] >> 0) & 0x01) flags |= SCSPDSP_OP_NXADR;
+		if ((flags & (SCSPDSP_OP_MRD | SCSPDSP_OP_MWT)) && (step & 1))	//memory only allowed on odd? DoA inserts NOPs on even
+			flags |= SCSPDSP_OP_MEM;
+
+		op->Flags = flags;
+		op->TRA = (IPtr[0] >> 8) & 0x7F;
+		op->TWA = (IPtr[0] >> 0) & 0x7F;
+		if (IRA <= 0x1f)
+		{
+			op->INSEL = 0;
+			op->IRA = IRA;
+		}
+		else if (IRA <= 0x2F)
+		{
+			op->INSEL = 1;
+			op->IRA = IRA - 0x20;
+		}
+		else
+		{
+			op->INSEL = 2;
+			op->IRA = IRA - 0x30;
+		}
+		op->IWA = IWA;
+		op->YSEL = (IPtr[1] >> 13) & 0x03;
+		op->SHIFT = (IPtr[2] >> 4) & 0x03;
+		op->EWA = (IPtr[2] >> 8) & 0x0F;
+		op->COEF = (IPtr[3] >> 9) & 0x3f;
+		op->MASA = (IPtr[3] >> 2) & 0x1f;	//???
+		++DSP->NumOps;
+	}
+	DSP->Decoded = true;
+}
+
 //#ifndef DYNDSP
 void SCSPDSP_Step(_SCSPDSP *DSP)
 {
@@ -216,230 +312,159 @@ void SCSPDSP_Step(_SCSPDSP *DSP)
 	INT32 Y_REG = 0;      //24 bit
 	UINT32 ADDR = 0;
 	UINT32 ADRS_REG = 0;  //13 bit
-	int step;
 
 	if (DSP->Stopped)
 		return;
+	if (!DSP->Decoded)
+		SCSPDSP_Decode(DSP);
 
 	memset(DSP->EFREG, 0, 2 * 16);
-	for (step = 0; step </*128*/DSP->LastStep; ++step)
+	const _SCSPDSP_OP *end = DSP->Ops + DSP->NumOps;
+	for (const _SCSPDSP_OP *op = DSP->Ops; op != end; ++op)
 	{
-		UINT16 *IPtr = DSP->MPRO + step * 4;
-
-		//		if(IPtr[0]==0 && IPtr[1]==0 && IPtr[2]==0 && IPtr[3]==0)
-		//			break;
-
-		UINT32 TRA = (IPtr[0] >> 8) & 0x7F;
-		UINT32 TWT = (IPtr[0] >> 7) & 0x01;
-		UINT32 TWA = (IPtr[0] >> 0) & 0x7F;
-
-		UINT32 XSEL = (IPtr[1] >> 15) & 0x01;
-		UINT32 YSEL = (IPtr[1] >> 13) & 0x03;
-		UINT32 IRA = (IPtr[1] >> 6) & 0x3F;
-		UINT32 IWT = (IPtr[1] >> 5) & 0x01;
-		UINT32 IWA = (IPtr[1] >> 0) & 0x1F;
-
-		UINT32 TABLE = (IPtr[2] >> 15) & 0x01;
-		UINT32 MWT = (IPtr[2] >> 14) & 0x01;
-		UINT32 MRD = (IPtr[2] >> 13) & 0x01;
-		UINT32 EWT = (IPtr[2] >> 12) & 0x01;
-		UINT32 EWA = (IPtr[2] >> 8) & 0x0F;
-		UINT32 ADRL = (IPtr[2] >> 7) & 0x01;
-		UINT32 FRCL = (IPtr[2] >> 6) & 0x01;
-		UINT32 SHIFT = (IPtr[2] >> 4) & 0x03;
-		UINT32 YRL = (IPtr[2] >> 3) & 0x01;
-		UINT32 NEGB = (IPtr[2] >> 2) & 0x01;
-		UINT32 ZERO = (IPtr[2] >> 1) & 0x01;
-		UINT32 BSEL = (IPtr[2] >> 0) & 0x01;
-
-		UINT32 NOFL = (IPtr[3] >> 15) & 0x01;	//????
-		UINT32 COEF = (IPtr[3] >> 9) & 0x3f;
-
-		UINT32 MASA = (IPtr[3] >> 2) & 0x1f;	//???
-		UINT32 ADREB = (IPtr[3] >> 1) & 0x01;
-		UINT32 NXADR = (IPtr[3] >> 0) & 0x01;
-
+		UINT32 flags = op->Flags;
 		INT64 v;
 
 		//operations are done at 24 bit precision
-#if 0
-		if (MASA)
-			int a = 1;
-		if (NOFL)
-			int a = 1;
-#endif
+
 		//INPUTS RW
-// colmns97 hits this
-//		assert(IRA<0x32);
-		if (IRA <= 0x1f)
-			INPUTS = DSP->MEMS[IRA];
-		else if (IRA <= 0x2F)
-			INPUTS = DSP->MIXS[IRA - 0x20] << 4;  //MIXS is 20 bit
-		else if (IRA <= 0x31)
-			INPUTS = DSP->EXTS[IRA - 0x30] << 8;  //EXTS is 16 bit
+		if (op->INSEL == 0)
+			INPUTS = DSP->MEMS[op->IRA];
+		else if (op->INSEL == 1)
+			INPUTS = DSP->MIXS[op->IRA] << 4;  //MIXS is 20 bit
 		else
-			return;
+			INPUTS = DSP->EXTS[op->IRA] << 8;  //EXTS is 16 bit
 
 		INPUTS <<= 8;
 		INPUTS >>= 8;
-		//if(INPUTS&0x00800000)
-		//	INPUTS|=0xFF000000;
 
-		if (IWT)
+		if (flags & SCSPDSP_OP_IWT)
 		{
-			DSP->MEMS[IWA] = MEMVAL;  //MEMVAL was selected in previous MRD
-			if (IRA == IWA)
+			DSP->MEMS[op->IWA] = MEMVAL;  //MEMVAL was selected in previous MRD
+			if (flags & SCSPDSP_OP_IWT_INPUT)
 				INPUTS = MEMVAL;
 		}
 
 		//Operand sel
 		//B
-		if (!ZERO)
+		if (!(flags & SCSPDSP_OP_ZERO))
 		{
-			if (BSEL)
+			if (flags & SCSPDSP_OP_BSEL)
 				B = ACC;
 			else
 			{
-				B = DSP->TEMP[(TRA + DSP->DEC) & 0x7F];
+				B = DSP->TEMP[(op->TRA + DSP->DEC) & 0x7F];
 				B <<= 8;
 				B >>= 8;
-				//if(B&0x00800000)
-				//	B|=0xFF000000;  //Sign extend
 			}
-			if (NEGB)
+			if (flags & SCSPDSP_OP_NEGB)
 				B = 0 - B;
 		}
 		else
 			B = 0;
 
 		//X
-		if (XSEL)
+		if (flags & SCSPDSP_OP_XSEL)
 			X = INPUTS;
 		else
 		{
-			X = DSP->TEMP[(TRA + DSP->DEC) & 0x7F];
+			X = DSP->TEMP[(op->TRA + DSP->DEC) & 0x7F];
 			X <<= 8;
 			X >>= 8;
-			//if(X&0x00800000)
-			//	X|=0xFF000000;
 		}
 
 		//Y
-		if (YSEL == 0)
+		if (op->YSEL == 0)
 			Y = FRC_REG;
-		else if (YSEL == 1)
-			Y = DSP->COEF[COEF] >> 3;   //COEF is 16 bits
-		else if (YSEL == 2)
+		else if (op->YSEL == 1)
+			Y = DSP->COEF[op->COEF] >> 3;   //COEF is 16 bits
+		else if (op->YSEL == 2)
 			Y = (Y_REG >> 11) & 0x1FFF;
-		else if (YSEL == 3)
+		else
 			Y = (Y_REG >> 4) & 0x0FFF;
 
-		if (YRL)
+		if (flags & SCSPDSP_OP_YRL)
 			Y_REG = INPUTS;
 
 		//Shifter
-		if (SHIFT == 0)
+		if (op->SHIFT <= 1)
 		{
-			SHIFTED = ACC;
+			SHIFTED = op->SHIFT ? ACC * 2 : ACC;
 			if (SHIFTED > 0x007FFFFF)
 				SHIFTED = 0x007FFFFF;
 			if (SHIFTED < (-0x00800000))
 				SHIFTED = -0x00800000;
 		}
-		else if (SHIFT == 1)
-		{
-			SHIFTED = ACC * 2;
-			if (SHIFTED > 0x007FFFFF)
-				SHIFTED = 0x007FFFFF;
-			if (SHIFTED < (-0x00800000))
-				SHIFTED = -0x00800000;
-		}
-		else if (SHIFT == 2)
-		{
-			SHIFTED = ACC * 2;
-			SHIFTED <<= 8;
-			SHIFTED >>= 8;
-			//SHIFTED&=0x00FFFFFF;
-			//if(SHIFTED&0x00800000)
-			//	SHIFTED|=0xFF000000;
-		}
-		else if (SHIFT == 3)
+		else
 		{
-			SHIFTED = ACC;
+			SHIFTED = (op->SHIFT == 2) ? ACC * 2 : ACC;
 			SHIFTED <<= 8;
 			SHIFTED >>= 8;
-			//SHIFTED&=0x00FFFFFF;
-			//if(SHIFTED&0x00800000)
-			//	SHIFTED|=0xFF000000;
 		}
 
 		//ACCUM
 		Y <<= 19;
 		Y >>= 19;
-		//if(Y&0x1000)
-		//	Y|=0xFFFFF000;
 
 		v = (((INT64)X*(INT64)Y) >> 12);
 		ACC = (int)v + B;
 
-		if (TWT)
-			DSP->TEMP[(TWA + DSP->DEC) & 0x7F] = SHIFTED;
+		if (flags & SCSPDSP_OP_TWT)
+			DSP->TEMP[(op->TWA + DSP->DEC) & 0x7F] = SHIFTED;
 
-		if (FRCL)
+		if (flags & SCSPDSP_OP_FRCL)
 		{
-			if (SHIFT == 3)
+			if (op->SHIFT == 3)
 				FRC_REG = SHIFTED & 0x0FFF;
 			else
 				FRC_REG = (SHIFTED >> 11) & 0x1FFF;
 		}
 
-		if (MRD || MWT)
-			//if(0)
+		if (flags & SCSPDSP_OP_MEM)
 		{
-			ADDR = DSP->MADRS[MASA];
-			if (!TABLE)
+			ADDR = DSP->MADRS[op->MASA];
+			if (!(flags & SCSPDSP_OP_TABLE))
 				ADDR += DSP->DEC;
-			if (ADREB)
+			if (flags & SCSPDSP_OP_ADREB)
 				ADDR += ADRS_REG & 0x0FFF;
-			if (NXADR)
+			if (flags & SCSPDSP_OP_NXADR)
 				ADDR++;
-			if (!TABLE)
+			if (!(flags & SCSPDSP_OP_TABLE))
 				ADDR &= DSP->RBL - 1;
 			else
 				ADDR &= 0xFFFF;
-			//ADDR<<=1;
-			//ADDR+=DSP->RBP<<13;
-			//MEMVAL=DSP->SCSPRAM[ADDR>>1];
 			ADDR += DSP->RBP << 12;
 			if (ADDR > 0x7ffff) ADDR = 0; //!! MAME has ADDR <<= 1 in here, but this seems to be wrong?
-			if (MRD && (step & 1)) //memory only allowed on odd? DoA inserts NOPs on even
+			if (flags & SCSPDSP_OP_MRD)
 			{
-				if (NOFL)
+				if (flags & SCSPDSP_OP_NOFL)
 					MEMVAL = DSP->SCSPRAM[ADDR] << 8;
 				else
 					MEMVAL = UNPACK(DSP->SCSPRAM[ADDR]);
 			}
-			if (MWT && (step & 1))
+			if (flags & SCSPDSP_OP_MWT)
 			{
-				if (NOFL)
+				if (flags & SCSPDSP_OP_NOFL)
 					DSP->SCSPRAM[ADDR] = SHIFTED >> 8;
 				else
 					DSP->SCSPRAM[ADDR] = PACK(SHIFTED);
 			}
 		}
 
-		if (ADRL)
+		if (flags & SCSPDSP_OP_ADRL)
 		{
-			if (SHIFT == 3)
+			if (op->SHIFT == 3)
 				ADRS_REG = (SHIFTED >> 12) & 0xFFF;
 			else
 				ADRS_REG = (INPUTS >> 16);
 		}
 
-		if (EWT)
-			DSP->EFREG[EWA] += SHIFTED >> 8;
+		if (flags & SCSPDSP_OP_EWT)
+			DSP->EFREG[op->EWA] += SHIFTED >> 8;
 
 	}
+	if (DSP->Halts)
+		return;
 	--DSP->DEC;
 	memset(DSP->MIXS, 0, 4 * 16);
 }
@@ -464,6 +489,7 @@ void SCSPDSP_Start(_SCSPDSP *DSP)
 			break;
 	}
 	DSP->LastStep = i + 1;
+	DSP->Decoded = false;
 
 /*
 	int test=0;
@@ -35,6 +35,15 @@
 #define DYNOPT	1		//set to 1 to enable optimization of recompiler
 
 
+//a pre-decoded MPRO step
+struct _SCSPDSP_OP
+{
+	UINT32 Flags;	//SCSPDSP_OP_* bits
+	UINT8 TRA, TWA;
+	UINT8 INSEL, IRA;	//input (0: MEMS, 1: MIXS, 2: EXTS) and index within it
+	UINT8 IWA, YSEL, SHIFT, COEF, MASA, EWA;
+};
+
 //the DSP Context
 struct _SCSPDSP
 {
@@ -62,6 +71,13 @@ struct _SCSPDSP
 	
 	bool Stopped;
 	int LastStep;
+
+//decoded program, rebuilt by SCSPDSP_Step() when Decoded is cleared (on
+//writes to COEF/MADRS/MPRO and on state load)
+	_SCSPDSP_OP Ops[128];
+	int NumOps;
+	bool Halts;	//program stops at Ops[NumOps] (invalid input), without ending the sample
+	bool Decoded;
 #ifdef DYNDSP
 	INT32 ACC;	//26 bit
 	INT32 SHIFTED;	//24 bit
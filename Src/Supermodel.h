@@ -121,4 +121,22 @@ static inline UINT32 FLIPENDIAN32(UINT32 d)
 	return ((d>>24) | ((d<<8)&0x00FF0000) | ((d>>8)&0x0000FF00) | (d<<24));
 }
 
+/*
+ * BYTE_LANE_XOR8:
+ * BYTE_LANE_XOR16:
+ *
+ * Big endian memory regions (PowerPC RAM, CROM, backup RAM) are stored as
+ * host-order 32-bit words, so aligned 32-bit loads, stores and instruction
+ * fetches need no byte swapping. Bytes and half-words within a word are
+ * located by XORing their address with these offsets. On a big endian host
+ * the layout is the same as the emulated memory and the offsets are zero.
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define BYTE_LANE_XOR8	0
+#define BYTE_LANE_XOR16	0
+#else
+#define BYTE_LANE_XOR8	3
+#define BYTE_LANE_XOR16	2
+#endif
+
 #endif	// INCLUDED_SUPERMODEL_H
@@ -3,48 +3,268 @@
 #include <intrin.h>
 #endif
 
+// SSE2 and NEON are part of the x64 and AArch64 base instruction sets
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BYTESWAP_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BYTESWAP_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// SSSE3 (pshufb) and AVX2 are not, so they are compiled for specially and
+// only used when the CPU reports them
+#if defined(BYTESWAP_SIMD_SSE2) && (defined(_MSC_VER) || defined(__GNUC__))
+#define BYTESWAP_SIMD_DISPATCH
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define BYTESWAP_TARGET(isa)
+#else
+#include <cpuid.h>
+#define BYTESWAP_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
 namespace Util
 {
-  void FlipEndian16(uint8_t * const buffer, const size_t size)
+  typedef void (*CopyFlipFn)(uint8_t *dest, const uint8_t *src, size_t size);
+
+  // Scalar copies of whatever the vector loops leave over
+  static void CopyFlipEndian16Tail(uint8_t * const dest, const uint8_t * const src, size_t i, const size_t size)
   {
-#ifdef _MSC_VER
-    uint16_t * const buffer16 = (uint16_t*)buffer;
-    for (size_t i = 0; i < size/2; i++)
-      buffer16[i] = _byteswap_ushort(buffer16[i]);
-#elif defined(__GNUC__)
-    uint16_t * const buffer16 = (uint16_t*)buffer;
-    for (size_t i = 0; i < size/2; i++)
-      buffer16[i] = __builtin_bswap16(buffer16[i]);
-#else
-    for (size_t i = 0; i < (size & ~1); i += 2)
+    for (; i < (size & ~1); i += 2)
+    {
+      uint8_t tmp = src[i + 0];
+      dest[i + 0] = src[i + 1];
+      dest[i + 1] = tmp;
+    }
+  }
+
+  static void CopyFlipEndian32Tail(uint8_t * const dest, const uint8_t * const src, size_t i, const size_t size)
+  {
+    for (; i < (size & ~3); i += 4)
     {
-      uint8_t tmp = buffer[i + 0];
-      buffer[i + 0] = buffer[i + 1];
-      buffer[i + 1] = tmp;
+      uint8_t tmp1 = src[i + 0];
+      uint8_t tmp2 = src[i + 1];
+      dest[i + 0] = src[i + 3];
+      dest[i + 1] = src[i + 2];
+      dest[i + 2] = tmp2;
+      dest[i + 3] = tmp1;
     }
+  }
+
+  static void CopyFlipEndian16Base(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    size_t i = 0;
+#if defined(BYTESWAP_SIMD_SSE2)
+    for (; i + 16 <= size; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+      _mm_storeu_si128((__m128i *) (dest + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+#elif defined(BYTESWAP_SIMD_NEON)
+    for (; i + 16 <= size; i += 16)
+      vst1q_u8(dest + i, vrev16q_u8(vld1q_u8(src + i)));
 #endif
+    CopyFlipEndian16Tail(dest, src, i, size);
   }
 
-  void FlipEndian32(uint8_t * const buffer, const size_t size)
+  static void CopyFlipEndian32Base(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    size_t i = 0;
+#if defined(BYTESWAP_SIMD_SSE2)
+    // Swap the 16-bit halves of each word, then the bytes of each half
+    for (; i + 16 <= size; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+      v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+      _mm_storeu_si128((__m128i *) (dest + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+#elif defined(BYTESWAP_SIMD_NEON)
+    for (; i + 16 <= size; i += 16)
+      vst1q_u8(dest + i, vrev32q_u8(vld1q_u8(src + i)));
+#endif
+    CopyFlipEndian32Tail(dest, src, i, size);
+  }
+
+#if defined(BYTESWAP_SIMD_DISPATCH)
+  // pshufb masks selecting the bytes of each element in reverse
+  static const __m128i *Mask16(void)
+  {
+    alignas(16) static const int8_t mask[16] = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+    return (const __m128i *) mask;
+  }
+
+  static const __m128i *Mask32(void)
+  {
+    alignas(16) static const int8_t mask[16] = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+    return (const __m128i *) mask;
+  }
+
+  BYTESWAP_TARGET("ssse3") static size_t CopyShuffleSSSE3(uint8_t * const dest, const uint8_t * const src, const size_t size, const __m128i *maskPtr)
+  {
+    const __m128i mask = _mm_load_si128(maskPtr);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (src + i + 16));
+      _mm_storeu_si128((__m128i *) (dest + i), _mm_shuffle_epi8(a, mask));
+      _mm_storeu_si128((__m128i *) (dest + i + 16), _mm_shuffle_epi8(b, mask));
+    }
+    for (; i + 16 <= size; i += 16)
+      _mm_storeu_si128((__m128i *) (dest + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + i)), mask));
+    return i;
+  }
+
+  BYTESWAP_TARGET("avx2") static size_t CopyShuffleAVX2(uint8_t * const dest, const uint8_t * const src, const size_t size, const __m128i *maskPtr)
+  {
+    const __m256i mask = _mm256_broadcastsi128_si256(_mm_load_si128(maskPtr));
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *) (src + i + 32));
+      _mm256_storeu_si256((__m256i *) (dest + i), _mm256_shuffle_epi8(a, mask));
+      _mm256_storeu_si256((__m256i *) (dest + i + 32), _mm256_shuffle_epi8(b, mask));
+    }
+    for (; i + 32 <= size; i += 32)
+      _mm256_storeu_si256((__m256i *) (dest + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (src + i)), mask));
+    return i;
+  }
+
+  static void CopyFlipEndian16SSSE3(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    CopyFlipEndian16Tail(dest, src, CopyShuffleSSSE3(dest, src, size, Mask16()), size);
+  }
+
+  static void CopyFlipEndian32SSSE3(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    CopyFlipEndian32Tail(dest, src, CopyShuffleSSSE3(dest, src, size, Mask32()), size);
+  }
+
+  static void CopyFlipEndian16AVX2(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    size_t i = CopyShuffleAVX2(dest, src, size, Mask16());
+    CopyFlipEndian16Tail(dest, src, i + CopyShuffleSSSE3(dest + i, src + i, size - i, Mask16()), size);
+  }
+
+  static void CopyFlipEndian32AVX2(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    size_t i = CopyShuffleAVX2(dest, src, size, Mask32());
+    CopyFlipEndian32Tail(dest, src, i + CopyShuffleSSSE3(dest + i, src + i, size - i, Mask32()), size);
+  }
+
+  enum class ISA
+  {
+    SSE2,
+    SSSE3,
+    AVX2
+  };
+
+  // Best instruction set usable, checking the OS saves the AVX registers too
+  static ISA DetectISA(void)
   {
+    unsigned regs[4] = { 0, 0, 0, 0 };
 #ifdef _MSC_VER
-    uint32_t * const buffer32 = (uint32_t*)buffer;
-    for (size_t i = 0; i < size/4; i++)
-      buffer32[i] = _byteswap_ulong(buffer32[i]);
-#elif defined(__GNUC__)
-    uint32_t * const buffer32 = (uint32_t*)buffer;
-    for (size_t i = 0; i < size/4; i++)
-      buffer32[i] = __builtin_bswap32(buffer32[i]);
+    int info[4];
+    __cpuid(info, 0);
+    unsigned maxLeaf = unsigned(info[0]);
+    __cpuid(info, 1);
+    regs[2] = unsigned(info[2]);
 #else
-    for (size_t i = 0; i < (size & ~3); i += 4)
+    unsigned maxLeaf = __get_cpuid_max(0, nullptr);
+    __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    if (!(regs[2] & (1u << 9)))
+      return ISA::SSE2;
+    bool avx = (regs[2] & (1u << 27)) && (regs[2] & (1u << 28));
+    if (avx)
     {
-      uint8_t tmp1 = buffer[i+0];
-      uint8_t tmp2 = buffer[i+1];
-      buffer[i+0] = buffer[i+3];
-      buffer[i+1] = buffer[i+2];
-      buffer[i+2] = tmp2;
-      buffer[i+3] = tmp1;
+#ifdef _MSC_VER
+      avx = (_xgetbv(0) & 6) == 6;
+#else
+      unsigned xcr0, xcr0Hi;
+      __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0Hi) : "c" (0));
+      avx = (xcr0 & 6) == 6;
+#endif
     }
+    if (avx && maxLeaf >= 7)
+    {
+#ifdef _MSC_VER
+      __cpuidex(info, 7, 0);
+      regs[1] = unsigned(info[1]);
+#else
+      __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
 #endif
+      if (regs[1] & (1u << 5))
+        return ISA::AVX2;
+    }
+    return ISA::SSSE3;
+  }
+
+  static CopyFlipFn SelectCopyFlipEndian16(void)
+  {
+    switch (DetectISA())
+    {
+    case ISA::AVX2:   return CopyFlipEndian16AVX2;
+    case ISA::SSSE3:  return CopyFlipEndian16SSSE3;
+    default:          return CopyFlipEndian16Base;
+    }
+  }
+
+  static CopyFlipFn SelectCopyFlipEndian32(void)
+  {
+    switch (DetectISA())
+    {
+    case ISA::AVX2:   return CopyFlipEndian32AVX2;
+    case ISA::SSSE3:  return CopyFlipEndian32SSSE3;
+    default:          return CopyFlipEndian32Base;
+    }
+  }
+#else
+  static CopyFlipFn SelectCopyFlipEndian16(void)
+  {
+    return CopyFlipEndian16Base;
+  }
+
+  static CopyFlipFn SelectCopyFlipEndian32(void)
+  {
+    return CopyFlipEndian32Base;
+  }
+#endif
+
+  void FlipEndian16(uint8_t * const buffer, const size_t size)
+  {
+    CopyFlipEndian16(buffer, buffer, size);
+  }
+
+  void CopyFlipEndian16(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    static const CopyFlipFn copy = SelectCopyFlipEndian16();
+    copy(dest, src, size);
+  }
+
+  void FlipEndian32(uint8_t * const buffer, const size_t size)
+  {
+    CopyFlipEndian32(buffer, buffer, size);
+  }
+
+  void CopyFlipEndian32(uint8_t * const dest, const uint8_t * const src, const size_t size)
+  {
+    static const CopyFlipFn copy = SelectCopyFlipEndian32();
+    copy(dest, src, size);
+  }
+
+  void InterleaveFlipEndian16(uint8_t * const dest, const size_t stride, const uint8_t * const src, const size_t size)
+  {
+    // Each word is stored alone, never touching the bytes between, which
+    // other threads may be filling in
+    uint8_t *d = dest;
+    for (size_t i = 0; i < (size & ~1); i += 2, d += stride)
+    {
+      d[0] = src[i + 1];
+      d[1] = src[i + 0];
+    }
   }
 } // Util
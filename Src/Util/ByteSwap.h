@@ -7,7 +7,15 @@
 namespace Util
 {
   void FlipEndian16(uint8_t *buffer, size_t size);
+  // Copies size bytes (even) from src to dest, swapping the bytes of each
+  // 16-bit word. dest may be src but must not otherwise overlap it.
+  void CopyFlipEndian16(uint8_t *dest, const uint8_t *src, size_t size);
   void FlipEndian32(uint8_t *buffer, size_t size);
+  // As CopyFlipEndian16() but for 32-bit words (size a multiple of 4).
+  void CopyFlipEndian32(uint8_t *dest, const uint8_t *src, size_t size);
+  // Copies size bytes (even) from src to 16-bit words every stride bytes
+  // from dest, swapping the bytes of each. The bytes between are not touched.
+  void InterleaveFlipEndian16(uint8_t *dest, size_t stride, const uint8_t *src, size_t size);
 } // Util
 
 #endif  // INCLUDED_BYTESWAP_H
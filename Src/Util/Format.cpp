@@ -1,9 +1,66 @@
 #include "Util/Format.h"
 #include <algorithm>
 #include <cctype>
+#include <cstdarg>
+#include <cstdio>
 
 namespace Util
 {
+  void Format::Append(const char *str, size_t length)
+  {
+    if (!m_onHeap)
+    {
+      if (m_size + length <= InlineCapacity)
+      {
+        memcpy(m_inline + m_size, str, length);
+        m_size += length;
+        m_inline[m_size] = '\0';
+        return;
+      }
+      m_heap.reserve(2 * (m_size + length));
+      m_heap.assign(m_inline, m_size);
+      m_onHeap = true;
+    }
+    m_heap.append(str, length);
+  }
+
+  Format &Format::Printf(const char *fmt, ...)
+  {
+    va_list vl;
+    va_start(vl, fmt);
+    va_list vl2;
+    va_copy(vl2, vl);
+    int length;
+    if (!m_onHeap)
+    {
+      // Try the rest of the inline buffer first
+      length = vsnprintf(m_inline + m_size, InlineCapacity + 1 - m_size, fmt, vl);
+      if (length >= 0 && m_size + size_t(length) <= InlineCapacity)
+        m_size += size_t(length);
+      else
+      {
+        m_inline[m_size] = '\0';
+        if (length > 0)
+        {
+          m_heap.reserve(2 * (m_size + size_t(length)));
+          m_heap.assign(m_inline, m_size);
+          m_onHeap = true;
+        }
+      }
+    }
+    else
+      length = vsnprintf(nullptr, 0, fmt, vl);
+    if (m_onHeap && length > 0)
+    {
+      size_t end = m_heap.size();
+      m_heap.resize(end + size_t(length));
+      vsnprintf(&m_heap[end], size_t(length) + 1, fmt, vl2);
+    }
+    va_end(vl2);
+    va_end(vl);
+    return *this;
+  }
+
   std::ostream &operator<<(std::ostream &os, const Format &format)
   {
     format.Write(os);
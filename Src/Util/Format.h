@@ -6,19 +6,32 @@
 #include <iomanip>
 #include <cstdint>
 #include <vector>
+#include <cstring>
 
 namespace Util
 {
+  /*
+   * Builds a string with << as a std::ostringstream would, into a buffer of
+   * its own that only moves to the heap once it outgrows InlineCapacity, so
+   * short strings built every frame cost no allocations. Strings, characters
+   * and numbers are formatted directly (numbers as a default std::ostream
+   * would, without manipulators); anything else goes through a temporary
+   * stream. Printf() appends printf-style for widths and precisions.
+   */
   class Format
   {
   public:
+    static const size_t InlineCapacity = 256;
+
     template <typename T>
     Format &operator<<(const T &data)
     {
-      m_stream << data;
+      Append(data);
       return *this;
     }
-  
+
+    Format &Printf(const char *fmt, ...);
+
     operator std::string() const
     {
       return str();
@@ -26,69 +39,149 @@ namespace Util
 
     std::string str() const
     {
-      return m_stream.str();
+      return std::string(data(), size());
+    }
+
+    // Contents, null terminated, valid until the next change
+    const char *c_str() const
+    {
+      return data();
+    }
+
+    size_t size() const
+    {
+      return m_onHeap ? m_heap.size() : m_size;
     }
 
     void Write(std::ostream &os) const
     {
-      if (m_stream.rdbuf()->in_avail())
-        os << m_stream.rdbuf();
+      os.write(data(), std::streamsize(size()));
     }
 
     template <typename T>
     Format &Join(const T &collection)
     {
-      std::string separator = m_stream.str();
+      std::string separator = str();
       clear();
       for (auto it = collection.begin(); it != collection.end(); )
       {
-        m_stream << *it;
+        *this << *it;
         ++it;
         if (it != collection.end())
-          m_stream << separator;
+          Append(separator);
       }
       return *this;
     }
 
-    std::vector<std::string> Split(char separator)
+    std::vector<std::string> Split(char separator) const
     {
-      // Very inefficient: lots of intermediate string copies!
-      std::string str = m_stream.str();
-      const char *start = str.c_str();
+      const char *start = data();
       const char *end = start;
+      const char *last = start + size();
       std::vector<std::string> parts;
-      do
+      while (true)
       {
-        if (*end == separator || !*end)
+        if (end == last || *end == separator)
         {
-          size_t len = end - start;
-          if (len)
-            parts.emplace_back(start, len);
-          else
-            parts.emplace_back();
+          parts.emplace_back(start, end - start);
+          if (end == last)
+            break;
           start = end + 1;
         }
         ++end;
-      } while (end[-1]);
+      }
       return parts;
     }
 
+    void clear()
+    {
+      m_heap.clear();
+      m_onHeap = false;
+      m_size = 0;
+      m_inline[0] = '\0';
+    }
+
     Format(const std::string &str)
-      : m_stream(str)
     {
+      clear();
+      Append(str);
     }
-      
+
     Format()
     {
+      clear();
     }
+
   private:
-    //TODO: write own buffer implementation to more easily support ToLower() et
-    //      al as methods of Util::Format
-    std::stringstream m_stream;
-      
-    void clear()
+    char m_inline[InlineCapacity + 1];  // plus the terminator
+    size_t m_size;                      // bytes used of m_inline
+    std::string m_heap;                 // everything, once m_inline overflows
+    bool m_onHeap;
+
+    const char *data() const
+    {
+      return m_onHeap ? m_heap.c_str() : m_inline;
+    }
+
+    void Append(const char *str, size_t length);
+
+    void Append(const char *str)
+    {
+      Append(str, strlen(str));
+    }
+
+    void Append(char *str)
+    {
+      Append(str, strlen(str));
+    }
+
+    void Append(const std::string &str)
+    {
+      Append(str.data(), str.size());
+    }
+
+    void Append(const Format &format)
+    {
+      Append(format.data(), format.size());
+    }
+
+    void Append(char c)
+    {
+      Append(&c, 1);
+    }
+
+    void Append(signed char c)
+    {
+      Append((const char *) &c, 1);
+    }
+
+    void Append(unsigned char c)
+    {
+      Append((const char *) &c, 1);
+    }
+
+    void Append(bool b)
+    {
+      Append(b ? "1" : "0", 1);
+    }
+
+    void Append(short n)              { Printf("%d", int(n)); }
+    void Append(unsigned short n)     { Printf("%u", unsigned(n)); }
+    void Append(int n)                { Printf("%d", n); }
+    void Append(unsigned n)           { Printf("%u", n); }
+    void Append(long n)               { Printf("%ld", n); }
+    void Append(unsigned long n)      { Printf("%lu", n); }
+    void Append(long long n)          { Printf("%lld", n); }
+    void Append(unsigned long long n) { Printf("%llu", n); }
+    void Append(float n)              { Printf("%g", double(n)); }
+    void Append(double n)             { Printf("%g", n); }
+
+    template <typename T>
+    void Append(const T &data)
     {
-      m_stream.str(std::string());
+      std::ostringstream os;
+      os << data;
+      Append(os.str());
     }
   };
   
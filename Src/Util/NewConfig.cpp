@@ -297,10 +297,13 @@ namespace Util
       parent.m_children[node->m_key] = node;
     }
 
+    std::atomic<unsigned> Node::s_generation(0);
+
     void Node::DeepCopy(const Node &that)
     {
       if (this == &that)
         return;
+      Changed();
       Destroy();
       *const_cast<std::string *>(&m_key) = that.m_key;
       if (that.m_value)
@@ -314,6 +317,7 @@ namespace Util
 
     void Node::Swap(Node &rhs)
     {
+      Changed();
       m_next_sibling.swap(rhs.m_next_sibling);
       m_first_child.swap(rhs.m_first_child);
       m_last_child.swap(rhs.m_last_child);
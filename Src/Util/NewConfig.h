@@ -2,6 +2,7 @@
 #define INCLUDED_UTIL_CONFIG_H
 
 #include "Util/GenericValue.h"
+#include <atomic>
 #include <map>
 #include <memory>
 #include <iterator>
@@ -24,6 +25,12 @@ namespace Util
       std::map<std::string, ptr_t> m_children;
       mutable std::map<std::string, Node> m_missing_nodes;  // missing nodes from failed queries (must also be empty)
       bool m_missing = false;
+      static std::atomic<unsigned> s_generation;
+
+      static inline void Changed()
+      {
+        s_generation.fetch_add(1, std::memory_order_relaxed);
+      }
 
       void Destroy()
       {
@@ -172,11 +179,19 @@ namespace Util
       inline void Clear()
       {
         m_value = nullptr;
+        Changed();
       }
 
       inline void SetValue(const std::shared_ptr<GenericValue> &value)
       {
         m_value = value;
+        Changed();
+      }
+
+      // Count of changes made to the values of any nodes so far
+      static inline unsigned Generation()
+      {
+        return s_generation.load(std::memory_order_relaxed);
       }
 
       template <typename T>
@@ -211,6 +226,7 @@ namespace Util
             m_value->Set(value);
           else
             m_value = std::make_shared<ValueInstance<T>>(value);
+          Changed();
         }
         else
           throw std::range_error(Util::Format() << "Node \"" << m_key << "\" does not exist");
@@ -309,6 +325,57 @@ namespace Util
       ~Node();
     };
 
+    /*
+     * CachedValue<T>:
+     *
+     * Typed copy of the value of a node, for settings read in hot paths. The
+     * node is only looked up and its value converted again once any node has
+     * changed since the last read, so that changes made at run time still
+     * take effect. Given a default, it is used while the node is empty, as
+     * with Node::ValueAsDefault().
+     */
+    template <typename T>
+    class CachedValue
+    {
+    public:
+      CachedValue(const Node &config, const std::string &path)
+        : m_config(&config),
+          m_path(path)
+      {}
+
+      CachedValue(const Node &config, const std::string &path, const T &default_value)
+        : m_config(&config),
+          m_path(path),
+          m_default(default_value),
+          m_hasDefault(true)
+      {}
+
+      CachedValue()
+      {}
+
+      inline T Get()
+      {
+        unsigned generation = Node::Generation();
+        if (!m_valid || generation != m_generation)
+        {
+          const Node &node = (*m_config)[m_path];
+          m_value = m_hasDefault ? node.ValueAsDefault<T>(m_default) : node.template ValueAs<T>();
+          m_generation = generation;
+          m_valid = true;
+        }
+        return m_value;
+      }
+
+    private:
+      const Node *m_config = nullptr;
+      std::string m_path;
+      T m_value = T();
+      T m_default = T();
+      bool m_hasDefault = false;
+      unsigned m_generation = 0;
+      bool m_valid = false;
+    };
+
     void PrintConfigTree(const Node &config, int indent_level = 0, int tab_stops = 2);
   } // Config
 } // Util
@@ -0,0 +1,98 @@
+#ifndef INCLUDED_PNGFILE_HPP
+#define INCLUDED_PNGFILE_HPP
+
+#include "OSD/Logger.h"
+#include "Util/BMPFile.h"
+#include <zlib.h>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+namespace Util
+{
+  namespace detail
+  {
+    static inline void AppendPNGWord(std::vector<uint8_t> &out, uint32_t data)
+    {
+      out.push_back(uint8_t(data >> 24));
+      out.push_back(uint8_t(data >> 16));
+      out.push_back(uint8_t(data >> 8));
+      out.push_back(uint8_t(data));
+    }
+
+    static inline void AppendPNGChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t size)
+    {
+      AppendPNGWord(out, uint32_t(size));
+      size_t start = out.size();
+      out.insert(out.end(), type, type + 4);
+      out.insert(out.end(), data, data + size);
+      uLong crc = crc32(0, &out[start], uInt(out.size() - start));
+      AppendPNGWord(out, uint32_t(crc));
+    }
+  } // detail
+
+  /*
+   * Writes a surface as a 24-bit RGB PNG, dropping the alpha channel. Rows
+   * are unfiltered and compressed for speed rather than size, as this is used
+   * to record sequences of frames.
+   */
+  template <class SurfaceFormat>
+  static bool WriteSurfaceToPNG(const std::string &file_name, const uint8_t *pixels, int32_t width, int32_t height, bool flip_vertical)
+  {
+    using namespace detail;
+    size_t row_size = 1 + width * 3;
+    std::vector<uint8_t> image(row_size * height);
+    uint8_t *dest = image.data();
+    for (int32_t y = 0; y < height; y++)
+    {
+      int32_t src_y = flip_vertical ? (height - 1 - y) : y;
+      const uint8_t *src = &pixels[src_y * width * SurfaceFormat::bytes_per_pixel];
+      *dest++ = 0;  // filter type: none
+      for (int32_t x = 0; x < width; x++)
+      {
+        *dest++ = SurfaceFormat::GetRed(src);
+        *dest++ = SurfaceFormat::GetGreen(src);
+        *dest++ = SurfaceFormat::GetBlue(src);
+        src += SurfaceFormat::bytes_per_pixel;
+      }
+    }
+
+    uLongf compressed_size = compressBound(uLong(image.size()));
+    std::vector<uint8_t> compressed(compressed_size);
+    if (compress2(compressed.data(), &compressed_size, image.data(), uLong(image.size()), Z_BEST_SPEED) != Z_OK)
+    {
+      ErrorLog("Unable to compress '%s'.", file_name.c_str());
+      return true;
+    }
+
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<uint8_t> header;
+    AppendPNGWord(header, uint32_t(width));
+    AppendPNGWord(header, uint32_t(height));
+    header.push_back(8);  // bits per channel
+    header.push_back(2);  // color type: RGB
+    header.push_back(0);  // compression: deflate
+    header.push_back(0);  // filter method
+    header.push_back(0);  // not interlaced
+    std::vector<uint8_t> file(signature, signature + sizeof(signature));
+    AppendPNGChunk(file, "IHDR", header.data(), header.size());
+    AppendPNGChunk(file, "IDAT", compressed.data(), compressed_size);
+    AppendPNGChunk(file, "IEND", nullptr, 0);
+
+    FILE *fp = fopen(file_name.c_str(), "wb");
+    if (fp)
+    {
+      fwrite(file.data(), sizeof(uint8_t), file.size(), fp);
+      fclose(fp);
+    }
+    else
+    {
+      ErrorLog("Unable to open '%s' for writing.", file_name.c_str());
+      return true;
+    }
+    return false;
+  }
+} // Util
+
+#endif  // INCLUDED_PNGFILE_HPP
@@ -202,6 +202,21 @@ int main()
     test_results.push_back({ "Duplicate leaf nodes", config.ToString() == expected_config });
   }
 
+  // Cached values follow changes to the node, and fall back on their default
+  // while it is empty
+  {
+    Util::Config::Node config("global");
+    config.Set("PowerPCFrequency", "50");
+    Util::Config::CachedValue<unsigned> frequency(config, "PowerPCFrequency");
+    Util::Config::CachedValue<unsigned> missing(config, "Missing", 7);
+    bool before = frequency.Get() == 50;
+    config.Get("PowerPCFrequency").SetValue("66");
+    test_results.push_back({ "Cached value 1", before && frequency.Get() == 66 });
+    test_results.push_back({ "Cached value 2", missing.Get() == 7 });
+    config.Set("Missing", "8");
+    test_results.push_back({ "Cached value 3", missing.Get() == 8 });
+  }
+
   PrintTestResults(test_results);
   return 0;
 }
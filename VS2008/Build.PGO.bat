@@ -0,0 +1,53 @@
+@rem
+@rem Profile-guided optimized build with MSVC. Run from a Developer Command
+@rem Prompt, in this directory, with Python on the path:
+@rem
+@rem   Build.PGO.bat <romdir> [<recordings>]
+@rem
+@rem Builds Release|x64 as a baseline, then instrumented, trains it on the games
+@rem of Scripts\pgo_training.py, rebuilds it with the profile and compares the
+@rem frame rates of both builds, written to x64\Release\pgo_benchmark.json.
+@rem
+@if "%~1" equ "" (
+echo Usage: Build.PGO.bat ^<romdir^> [^<recordings^>]
+pause
+exit
+)
+set ROMDIR=%~f1
+set RECORDINGS=
+@if "%~2" neq "" (set RECORDINGS=--recordings=%~f2)
+set BUILD=msbuild /nologo /m Supermodel.sln /t:Supermodel:Rebuild /p:Configuration=Release /p:Platform=x64
+
+set CL=
+%BUILD%
+@if %ERRORLEVEL% neq 0 goto failed
+xcopy /E /I /Y /Q x64\Release x64\Release.Base
+
+set CL=/DSUPERMODEL_PGO_GENERATE
+%BUILD% /p:WholeProgramOptimization=PGInstrument
+@if %ERRORLEVEL% neq 0 goto failed
+del /Q x64\Release\*.pgc
+pushd ..
+python Scripts\pgo_training.py train %RECORDINGS% VS2008\x64\Release\Supermodel.exe "%ROMDIR%"
+@if %ERRORLEVEL% neq 0 (
+popd
+goto failed
+)
+popd
+
+set CL=/DSUPERMODEL_PGO_USE
+%BUILD% /p:WholeProgramOptimization=PGOptimize
+@if %ERRORLEVEL% neq 0 goto failed
+set CL=
+pushd ..
+python Scripts\pgo_training.py compare %RECORDINGS% --output=VS2008\x64\Release\pgo_benchmark.json VS2008\x64\Release.Base\Supermodel.exe VS2008\x64\Release\Supermodel.exe "%ROMDIR%"
+popd
+@echo PGO build succeeded
+pause
+exit
+
+:failed
+set CL=
+@echo PGO build failed
+pause
+exit